@@ -3,6 +3,24 @@
 #ifndef _SHIM_VDSO_ARCH_H_
 #define _SHIM_VDSO_ARCH_H_
 
+#include <stdint.h>
+
 #define LINUX_VDSO_FILENAME "linux-vdso.so.1"
 
+/* Size of the data page mapped right before the vDSO image; must match `vdso.lds`. */
+#define VDSO_DATA_SIZE 4096
+
+/*
+ * Published by LibOS in the vDSO data page (see `update_vdso_time_data()`), so that the vDSO can
+ * compute the time from RDTSC without going through the syscall path. The fields are a copy of
+ * PAL_TSC_TIME_BASE; `tsc_hz == 0` means that the vDSO must take the syscall path.
+ */
+struct vdso_time_data {
+    uint32_t seq; /* odd while LibOS updates the fields below */
+    uint64_t tsc_hz;
+    uint64_t base_tsc;
+    uint64_t base_usec;
+    uint64_t max_tsc_delta;
+};
+
 #endif /* _SHIM_VDSO_ARCH_H_ */
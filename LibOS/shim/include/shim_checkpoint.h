@@ -327,6 +327,8 @@ struct checkpoint_hdr {
 
     size_t mem_offset;
     size_t mem_entries_cnt;
+    size_t mem_streams_cnt; /* memory is sent over this many streams, see `send_memory_on_streams` */
+    bool mem_direct;        /* parent may write memory directly, see `send_memory_directly` */
 
     size_t palhdl_offset;
     size_t palhdl_entries_cnt;
@@ -354,6 +356,15 @@ int create_process_and_send_checkpoint(migrate_func_t migrate_func,
                                        struct shim_process* process_description,
                                        struct shim_thread* thread_description, ...);
 
+/*!
+ * \brief Initialize the pool of pre-created child processes.
+ *
+ * Reads `libos.process_pool_size` from the manifest. Called at the end of process initialization.
+ *
+ * \return  0 on success, negative POSIX error code on failure.
+ */
+int init_process_pool(void);
+
 /*!
  * \brief Receive a checkpoint from parent process and restore state based on it.
  *
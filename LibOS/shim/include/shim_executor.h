@@ -0,0 +1,39 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/*
+ * Executor for short LibOS-internal jobs.
+ *
+ * The IPC worker and the async worker block on host events and hand the work they receive (IPC
+ * messages, expired timers, exited threads) to the executor: a small pool of internal threads
+ * shared by both, sized by `libos.internal_threads` in the manifest. Each pool thread keeps its own
+ * queue of jobs and steals jobs from the other queues when its own is empty. Jobs run to
+ * completion, so they must not block for long.
+ *
+ * Without pool threads (the default), jobs run synchronously in the submitting thread.
+ */
+
+#ifndef SHIM_EXECUTOR_H_
+#define SHIM_EXECUTOR_H_
+
+#include <stdbool.h>
+
+#include "list.h"
+
+DEFINE_LIST(shim_job);
+struct shim_job {
+    LIST_TYPE(shim_job) list;
+    void (*run)(struct shim_job* job);
+};
+DEFINE_LISTP(shim_job);
+
+int init_executor(void);
+void terminate_executor(void);
+
+/* Returns true if submitted jobs run in pool threads, i.e. asynchronously. */
+bool executor_is_async(void);
+
+/* Run `job->run(job)` in a pool thread (or right away, if there is none). `job` must stay valid
+ * until it runs; submission never fails. */
+void executor_submit(struct shim_job* job);
+
+#endif /* SHIM_EXECUTOR_H_ */
@@ -39,6 +39,18 @@ struct shim_fs_ops {
     /* write: the content from the file opened as handle */
     ssize_t (*write)(struct shim_handle* hdl, const void* buf, size_t count);
 
+    /* pread, pwrite: same as read and write, but at offset `pos` and without using or changing the
+     * file position (optional, otherwise pread64/pwrite64 use seek + read/write) */
+    ssize_t (*pread)(struct shim_handle* hdl, void* buf, size_t count, file_off_t pos);
+    ssize_t (*pwrite)(struct shim_handle* hdl, const void* buf, size_t count, file_off_t pos);
+
+    /* sendfile: copy up to `count` bytes from the file opened as handle (starting at `*offset` if
+     * `offset` is not NULL, at the current position otherwise) directly into `out_hdl`; the data
+     * does not pass through LibOS buffers. Returns -EOPNOTSUPP if not possible for this pair of
+     * handles, in which case the caller must fall back to read + write. */
+    ssize_t (*sendfile)(struct shim_handle* hdl, struct shim_handle* out_hdl, file_off_t* offset,
+                        size_t count);
+
     /* mmap: mmap handle to address */
     int (*mmap)(struct shim_handle* hdl, void** addr, size_t size, int prot, int flags,
                 uint64_t offset);
@@ -108,6 +120,7 @@ struct shim_fs_ops {
 /* Limit for the number of dentry children. This is mostly to prevent overflow if (untrusted) host
  * pretends to have many files in a directory. */
 #define DENTRY_MAX_CHILDREN 1000000
+#define DENTRY_HASH_MIN_CHILDREN 32
 
 struct fs_lock_info;
 
@@ -117,9 +130,12 @@ struct shim_dentry {
     int state; /* flags for managing state */
 
     /* File name, maximum of NAME_MAX characters. By convention, the root has an empty name. Does
-     * not change. Length is kept for performance reasons. */
-    char* name;
+     * not change. Length is kept for performance reasons. Interned: dentries with the same name
+     * share one refcounted copy (see `get_dentry_name` in shim_dcache.c). */
+    const char* name;
     size_t name_len;
+    /* `hash_buf(name, name_len)`, used for looking up the dentry in its parent. Does not change. */
+    HASHTYPE name_hash;
 
     /* Mounted filesystem this dentry belongs to. Does not change. */
     struct shim_mount* mount;
@@ -136,10 +152,22 @@ struct shim_dentry {
     LISTP_TYPE(shim_dentry) children; /* These children and siblings link */
     LIST_TYPE(shim_dentry) siblings;
 
+    /* Index of `children` by name, used by `lookup_dcache` in large directories. Allocated once the
+     * directory has `DENTRY_HASH_MIN_CHILDREN` children and grown as it fills up; NULL before that
+     * (and in a freshly restored checkpoint). `hash_next` links the entries of one bucket. Protected
+     * by `g_dcache_lock`, like `children`. */
+    struct shim_dentry** children_hash;
+    size_t children_hash_size;
+    struct shim_dentry* hash_next;
+
     /* Filesystem mounted under this dentry. If set, this dentry is a mountpoint: filesystem
      * operations should use `attached_mount->root` instead of this dentry. */
     struct shim_mount* attached_mount;
 
+    /* Time (in microseconds) at which a filesystem lookup marked this dentry as negative, used to
+     * expire cached negative dentries after `g_negative_dentry_ttl_us`. */
+    uint64_t negative_time;
+
     /* file type: S_IFREG, S_IFDIR, S_IFLNK etc. */
     mode_t type;
 
@@ -254,6 +282,10 @@ struct shim_mount {
     void* cpdata;
     size_t cpsize;
 
+    /* Set for mounts declared immutable in the manifest: the host files under them do not change
+     * while Graphene runs, so negative dentries are cached forever (see `dentry_gc`). */
+    bool immutable;
+
     REFTYPE ref_count;
     LIST_TYPE(shim_mount) hlist;
     LIST_TYPE(shim_mount) list;
@@ -491,16 +523,17 @@ int open_namei(struct shim_handle* hdl, struct shim_dentry* start, const char* p
 int dentry_open(struct shim_handle* hdl, struct shim_dentry* dent, int flags);
 
 /*!
- * \brief Populate a directory handle with current dentries
+ * \brief Populate a directory handle with current directory entries
  *
  * \param hdl a directory handle
  *
- * This function populates the `hdl->dir_info` structure with current dentries in a directory, so
- * that the directory can be listed using `getdents/getdents64` syscalls.
+ * This function populates the `hdl->dir_info` structure with names of current entries in a
+ * directory, so that the directory can be listed using `getdents/getdents64` syscalls. The entries
+ * are not looked up (no dentries are created for them).
  *
  * The caller should hold `g_dcache_lock` and `hdl->lock`.
  *
- * If the handle is currently populated (i.e. `hdl->dir_info.dents` is not null), this function is a
+ * If the handle is currently populated (i.e. `hdl->dir_info.dot` is not null), this function is a
  * no-op. If you want to refresh the handle with new contents, call `clear_directory_handle` first.
  */
 int populate_directory_handle(struct shim_handle* hdl);
@@ -510,9 +543,9 @@ int populate_directory_handle(struct shim_handle* hdl);
  *
  * \param hdl a directory handle
  *
- * This function discards an array of dentries previously prepared by `populate_directory_handle`.
+ * This function discards a listing previously prepared by `populate_directory_handle`.
  *
- * If the handle is currently not populated (i.e. `hdl->dir_info.dents` is null), this function is a
+ * If the handle is currently not populated (i.e. `hdl->dir_info.dot` is null), this function is a
  * no-op.
  */
 void clear_directory_handle(struct shim_handle* hdl);
@@ -623,6 +656,10 @@ ino_t dentry_ino(struct shim_dentry* dent);
 struct shim_dentry* get_new_dentry(struct shim_mount* mount, struct shim_dentry* parent,
                                    const char* name, size_t name_len);
 
+/* How long negative dentries outside of immutable mounts are trusted (`fs.negative_dentry_ttl_ms`
+ * in the manifest); 0 keeps the default behavior of dropping them opportunistically. */
+extern uint64_t g_negative_dentry_ttl_us;
+
 /*!
  * \brief Search for a child of a dentry with a given name
  *
@@ -638,6 +675,11 @@ struct shim_dentry* get_new_dentry(struct shim_mount* mount, struct shim_dentry*
  */
 struct shim_dentry* lookup_dcache(struct shim_dentry* parent, const char* name, size_t name_len);
 
+/* Same as `lookup_dcache`, for callers that already computed `name_hash = hash_buf(name,
+ * name_len)`, e.g. with `hash_path_component`. */
+struct shim_dentry* __lookup_dcache(struct shim_dentry* parent, const char* name, size_t name_len,
+                                    HASHTYPE name_hash);
+
 /*
  * Returns true if `anc` is an ancestor of `dent`. Both dentries need to be within the same mounted
  * filesystem.
@@ -655,9 +697,16 @@ bool dentry_is_ancestor(struct shim_dentry* anc, struct shim_dentry* dent);
  * uniqueness. We might need a better solution for the filesystem to be fully consistent.
  */
 
+HASHTYPE hash_buf(const char* buf, size_t len);
 HASHTYPE hash_str(const char* str);
+/* Hashes the path component starting at `name` (up to the next '/' or the end of string) and
+ * stores its length in `*out_len`. The result equals `hash_buf(name, *out_len)`. */
+HASHTYPE hash_path_component(const char* name, size_t* out_len);
 HASHTYPE hash_name(HASHTYPE parent_hbuf, const char* name);
 HASHTYPE hash_abs_path(struct shim_dentry* dent);
+/* Returns `hash_abs_path` of a (possibly not yet created) child of `dir`, given the hash of its
+ * name. */
+HASHTYPE hash_abs_path_child(struct shim_dentry* dir, HASHTYPE name_hash);
 
 #define READDIR_BUF_SIZE 4096
 
@@ -680,6 +729,16 @@ extern struct shim_fs eventfd_builtin_fs;
 
 struct shim_fs* find_fs(const char* name);
 
+/* In-memory pipes, see "LibOS/shim/src/fs/pipe/fs.c" */
+int mem_pipe_create(struct shim_handle* rd_hdl, struct shim_handle* wr_hdl, int flags);
+int mem_pipe_move_to_host(struct shim_handle* hdl);
+bool is_mem_pipe(struct shim_handle* hdl);
+PAL_FLG mem_pipe_pal_events(struct shim_handle* hdl, PAL_FLG events);
+
+/* eventfds, see "LibOS/shim/src/fs/eventfd/fs.c" and "LibOS/shim/src/sys/shim_eventfd.c" */
+int create_host_eventfd(PAL_HANDLE* efd, bool nonblocking, bool semaphore);
+int eventfd_move_to_host(struct shim_handle* hdl);
+
 /*!
  * \brief Compute file position for `seek`
  *
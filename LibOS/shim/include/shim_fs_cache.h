@@ -0,0 +1,62 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/*
+ * Page cache for host-backed (chroot) files.
+ *
+ * Small reads of regular files are served from page-sized copies of the file kept in LibOS memory,
+ * filled with read-ahead on a miss, so that e.g. a config parser reading 512 bytes at a time does
+ * not pay a host call (on SGX, an OCALL) per read. One cache is shared by all handles of a file in
+ * a process (it hangs off `struct shim_file_data`). The total size of all caches is bounded by
+ * `fs.file_cache_size` in the manifest; the cache is disabled if it is 0 (the default).
+ *
+ * Writes are write-through: the host file is always up to date and the cached pages are updated in
+ * place, so `fstat`, `poll` and other processes see every write immediately. The cache is *not*
+ * coherent with writes to the same file made by other processes (except over a shared handle, see
+ * `file_sync_lock` in chroot), nor with writes through shared writable `mmap`s of the file, which
+ * is why it has to be enabled explicitly.
+ */
+
+#ifndef SHIM_FS_CACHE_H_
+#define SHIM_FS_CACHE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "pal.h"
+#include "shim_types.h"
+
+struct shim_file_cache;
+
+/* Initialize the page cache subsystem (reads `fs.file_cache_size`). */
+int init_file_cache(void);
+
+/* Returns a new, empty cache for one file, or NULL if the page cache is disabled or out of
+ * memory (in which case the file is simply not cached). */
+struct shim_file_cache* file_cache_create(void);
+void file_cache_destroy(struct shim_file_cache* cache);
+
+/*!
+ * \brief Read from a file through its page cache
+ *
+ * \param cache the file's cache
+ * \param pal_handle handle used to read missing pages from the host
+ * \param pos offset in the file
+ * \param buf output buffer
+ * \param count number of bytes to read
+ *
+ * \returns number of bytes read (short only at the end of file), or negative error code if nothing
+ * could be read
+ */
+ssize_t file_cache_read(struct shim_file_cache* cache, PAL_HANDLE pal_handle, file_off_t pos,
+                        void* buf, size_t count);
+
+/* Update the cached pages after `count` bytes of `buf` were written to the host file at `pos`. */
+void file_cache_write(struct shim_file_cache* cache, file_off_t pos, const void* buf, size_t count);
+
+/* Update the cached pages after the host file was truncated (or extended) to `len` bytes. */
+void file_cache_truncate(struct shim_file_cache* cache, file_off_t len);
+
+/* Drop all cached pages of a file, e.g. when it was changed outside of this process. */
+void file_cache_invalidate(struct shim_file_cache* cache);
+
+#endif /* SHIM_FS_CACHE_H_ */
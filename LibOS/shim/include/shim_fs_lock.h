@@ -13,7 +13,7 @@
 
 #include <stdbool.h>
 
-#include "list.h"
+#include "avl_tree.h"
 #include "shim_types.h"
 
 #define FS_LOCK_EOF ((uint64_t)-1)
@@ -38,8 +38,6 @@ int init_fs_lock(void);
  * - The locks work only on files that have a dentry (no pipes, sockets etc.)
  */
 
-DEFINE_LISTP(posix_lock);
-DEFINE_LIST(posix_lock);
 struct posix_lock {
     /* Lock type: F_RDLCK, F_WRLCK, F_UNLCK */
     int type;
@@ -53,8 +51,8 @@ struct posix_lock {
     /* PID of process taking the lock */
     IDTYPE pid;
 
-    /* List node, used internally */
-    LIST_TYPE(posix_lock) list;
+    /* Tree node, used internally */
+    struct avl_tree_node tree_node;
 };
 
 /*!
@@ -33,4 +33,32 @@ ssize_t mem_file_write(struct shim_mem_file* mem, file_off_t pos_start, const vo
 int mem_file_truncate(struct shim_mem_file* mem, file_off_t size);
 int mem_file_poll(struct shim_mem_file* mem, file_off_t pos, int poll_type);
 
+/*
+ * Extent-based storage for in-memory files that can grow large (used by `tmpfs`). The file is split
+ * into extents of `MEM_EXTENT_SIZE` bytes, allocated on first write, so growing a file never copies
+ * the data already written and holes (e.g. after `ftruncate` or a write past the end) take no
+ * memory and read as zeroes. To keep small files small, the first extent is allocated only as
+ * large as needed, growing geometrically up to the full extent size.
+ *
+ * The operations have the same semantics as the `mem_file_*` ones above.
+ */
+#define MEM_EXTENT_SIZE (64 * 1024)
+
+struct shim_extent_file {
+    char** extents;           /* NULL entries are holes */
+    size_t extents_cnt;       /* capacity of `extents` */
+    size_t first_extent_size; /* allocated size of `extents[0]` */
+    file_off_t size;
+};
+
+void extent_file_init(struct shim_extent_file* file);
+void extent_file_destroy(struct shim_extent_file* file);
+
+ssize_t extent_file_read(struct shim_extent_file* file, file_off_t pos_start, void* buf,
+                         size_t size);
+ssize_t extent_file_write(struct shim_extent_file* file, file_off_t pos_start, const void* buf,
+                          size_t size);
+int extent_file_truncate(struct shim_extent_file* file, file_off_t size);
+int extent_file_poll(struct shim_extent_file* file, file_off_t pos, int poll_type);
+
 #endif /* SHIM_FS_MEM_ */
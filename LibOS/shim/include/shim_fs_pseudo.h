@@ -66,6 +66,9 @@ struct shim_dev_ops {
 #define PSEUDO_PERM_FILE_R  PERM_r__r__r__  /* default for all other files */
 #define PSEUDO_PERM_FILE_RW PERM_rw_rw_rw_
 
+/* `str.cache_usec` of files whose contents never change */
+#define PSEUDO_CACHE_FOREVER UINT64_MAX
+
 /*
  * A node of the pseudo filesystem. A single node can describe either a single file, or a family of
  * files (see `name_exists` and `list_names` below).
@@ -75,6 +78,9 @@ struct shim_dev_ops {
  */
 DEFINE_LIST(pseudo_node);
 DEFINE_LISTP(pseudo_node);
+struct pseudo_cache_entry;
+DEFINE_LIST(pseudo_cache_entry);
+DEFINE_LISTP(pseudo_cache_entry);
 struct pseudo_node {
     enum pseudo_type type;
 
@@ -124,6 +130,32 @@ struct pseudo_node {
              */
             int (*load)(struct shim_dentry* dent, char** out_data, size_t* out_size);
 
+            /*
+             * If non-zero, the data provided by `load` is kept for this many microseconds (for
+             * each file of the node) and newly-opened files get a copy of it instead of calling
+             * `load` again. Use `PSEUDO_CACHE_FOREVER` for files that never change, such as CPU
+             * topology. Must not be used together with `save`.
+             */
+            uint64_t cache_usec;
+            LISTP_TYPE(pseudo_cache_entry) cache;
+
+            /*
+             * Alternative to `load` for large read-only files (such as `/proc/<pid>/maps`), which
+             * generates the file incrementally: a read formats only the records it needs instead
+             * of the whole file.
+             *
+             * Should write as many whole records as fit into `buf` (of size `size`), starting at
+             * the record identified by `*cursor`, set `*out_size` to their length and advance
+             * `*cursor` past them. The meaning of the cursor is up to the callback, except that
+             * 0 denotes the beginning of the file. Setting `*out_size` to 0 denotes the end of
+             * the file. If not even a single record fits into `buf`, should return -ENOSPC: the
+             * callback will be retried with a bigger buffer.
+             *
+             * Files using this callback are not seekable relative to their end.
+             */
+            int (*generate)(struct shim_dentry* dent, uint64_t* cursor, char* buf, size_t size,
+                            size_t* out_size);
+
             /* Invoked when saving a modified file (on `close` or `flush`). Optional. */
             int (*save)(struct shim_dentry* dent, const char* data, size_t size);
         } str;
@@ -156,6 +188,8 @@ struct pseudo_node {
  */
 int pseudo_parse_ulong(const char* str, unsigned long max_value, unsigned long* out_value);
 
+int init_pseudo_fs(void);
+
 struct pseudo_node* pseudo_add_root_dir(const char* name);
 
 struct pseudo_node* pseudo_add_dir(struct pseudo_node* parent_ent, const char* name);
@@ -175,13 +209,17 @@ extern struct shim_fs pseudo_builtin_fs;
 int init_procfs(void);
 int proc_meminfo_load(struct shim_dentry* dent, char** out_data, size_t* out_size);
 int proc_cpuinfo_load(struct shim_dentry* dent, char** out_data, size_t* out_size);
+int proc_graphene_malloc_load(struct shim_dentry* dent, char** out_data, size_t* out_size);
+int proc_graphene_syscalls_load(struct shim_dentry* dent, char** out_data, size_t* out_size);
+int proc_graphene_locks_load(struct shim_dentry* dent, char** out_data, size_t* out_size);
 int proc_self_follow_link(struct shim_dentry* dent, char** out_target);
 bool proc_thread_pid_name_exists(struct shim_dentry* parent, const char* name);
 int proc_thread_pid_list_names(struct shim_dentry* parent, readdir_callback_t callback, void* arg);
 bool proc_thread_tid_name_exists(struct shim_dentry* parent, const char* name);
 int proc_thread_tid_list_names(struct shim_dentry* parent, readdir_callback_t callback, void* arg);
 int proc_thread_follow_link(struct shim_dentry* dent, char** out_target);
-int proc_thread_maps_load(struct shim_dentry* dent, char** out_data, size_t* out_size);
+int proc_thread_maps_generate(struct shim_dentry* dent, uint64_t* cursor, char* buf, size_t size,
+                              size_t* out_size);
 int proc_thread_cmdline_load(struct shim_dentry* dent, char** out_data, size_t* out_size);
 bool proc_thread_fd_name_exists(struct shim_dentry* parent, const char* name);
 int proc_thread_fd_list_names(struct shim_dentry* parent, readdir_callback_t callback, void* arg);
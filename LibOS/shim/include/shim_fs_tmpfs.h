@@ -0,0 +1,101 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/*
+ * Shared tmpfs store. A tmpfs mount with URI `shared:` keeps its files not in the dentries of the
+ * current process, but in a store hosted by the main process (IPC leader), so that all processes
+ * of a Graphene instance see the same files. The store is a flat table indexed by absolute path.
+ *
+ * In the main process, the functions below operate on the store directly. In other processes, they
+ * send a request to the main process over IPC (one round-trip per call, and per
+ * `TMPFS_STORE_MAX_IO` bytes for reads and writes).
+ *
+ * Caveats:
+ *
+ * - There is no local caching of file data, so every read and write of a shared file pays an IPC
+ *   round-trip when done outside of the main process.
+ * - Dentries in other processes are not invalidated when a file is created or deleted elsewhere
+ *   (the same as for files on the host); operations on a deleted file fail with -ENOENT.
+ * - The files live only as long as the main process.
+ */
+
+#ifndef SHIM_FS_TMPFS_H_
+#define SHIM_FS_TMPFS_H_
+
+#include <stdbool.h>
+
+#include "shim_fs.h"
+#include "shim_types.h"
+
+#define TMPFS_SHARED_URI "shared:"
+
+/* Maximum amount of data transferred in one IPC message by `tmpfs_store_read/write` */
+#define TMPFS_STORE_MAX_IO (1024 * 1024)
+
+struct tmpfs_store_attr {
+    mode_t type;
+    mode_t perm;
+    file_off_t size;
+    time_t ctime;
+    time_t mtime;
+    time_t atime;
+};
+
+/* Initialize the shared tmpfs store. */
+int init_tmpfs_store(void);
+
+int tmpfs_store_stat(const char* path, struct tmpfs_store_attr* attr);
+/* Create a file or directory (`type` is S_IFREG or S_IFDIR). Returns -EEXIST if it exists. */
+int tmpfs_store_create(const char* path, mode_t type, mode_t perm);
+int tmpfs_store_chmod(const char* path, mode_t perm);
+/* Delete a file or an empty directory (returns -ENOTEMPTY for non-empty ones). */
+int tmpfs_store_unlink(const char* path);
+/* Rename a file or directory (with all its contents), replacing `new_path` if it exists. */
+int tmpfs_store_rename(const char* old_path, const char* new_path);
+int tmpfs_store_readdir(const char* path, readdir_callback_t callback, void* arg);
+
+ssize_t tmpfs_store_read(const char* path, file_off_t pos, void* buf, size_t size);
+ssize_t tmpfs_store_write(const char* path, file_off_t pos, const void* buf, size_t size);
+int tmpfs_store_truncate(const char* path, file_off_t size);
+
+/*
+ * Store operations, as executed in the main process (used by the IPC callback). For READ, `data`
+ * receives at most `size` bytes; for READDIR, `*out_data` receives a newly allocated buffer of
+ * null-terminated names.
+ */
+enum {
+    TMPFS_STORE_STAT,
+    TMPFS_STORE_CREATE,
+    TMPFS_STORE_CHMOD,
+    TMPFS_STORE_UNLINK,
+    TMPFS_STORE_RENAME,
+    TMPFS_STORE_READDIR,
+    TMPFS_STORE_READ,
+    TMPFS_STORE_WRITE,
+    TMPFS_STORE_TRUNCATE,
+};
+
+struct tmpfs_store_req {
+    int op;
+    const char* path;
+    const char* new_path; /* RENAME */
+    mode_t type;          /* CREATE */
+    mode_t perm;          /* CREATE, CHMOD */
+    file_off_t pos;       /* READ, WRITE; new size for TRUNCATE */
+    size_t size;          /* READ, WRITE */
+    const void* data;     /* WRITE */
+};
+
+/*!
+ * \brief Execute a store operation in the main process
+ *
+ * \param req the operation
+ * \param[out] attr attributes of the file (for STAT)
+ * \param[out] out_data newly allocated buffer with the result data (for READ and READDIR)
+ * \param[out] out_size size of \p out_data
+ *
+ * \returns the operation result (number of bytes for READ and WRITE), or negative error code
+ */
+ssize_t tmpfs_store_do(struct tmpfs_store_req* req, struct tmpfs_store_attr* attr,
+                       void** out_data, size_t* out_size);
+
+#endif /* SHIM_FS_TMPFS_H_ */
@@ -68,6 +68,11 @@ struct shim_file_data {
     unsigned long mtime;
     unsigned long ctime;
     unsigned long nlink;
+    /* Page cache shared by all handles of this file, NULL if not cached (see shim_fs_cache.h). */
+    struct shim_file_cache* cache;
+    /* For directories: attributes of the children returned by the last listing that were not
+     * looked up yet, NULL if none (see `chroot_readdir`). Protected by `lock`. */
+    struct shim_prefetched_attrs* prefetched_attrs;
 };
 
 struct shim_file_handle {
@@ -84,9 +89,14 @@ struct shim_file_handle {
 #define FILE_HANDLE_DATA(hdl)  ((hdl)->info.file.data)
 #define FILE_DENTRY_DATA(dent) ((struct shim_file_data*)(dent)->data)
 
+struct shim_mem_pipe;
+
 struct shim_pipe_handle {
     bool ready_for_ops; /* true for pipes, false for FIFOs that were mknod'ed but not open'ed */
     char name[PIPE_URI_SIZE];
+    /* in-memory buffer shared by both ends of a pipe2() pipe while they stay in this process, NULL
+     * for host-backed pipes (see "LibOS/shim/src/fs/pipe/fs.c") */
+    struct shim_mem_pipe* mem;
 };
 
 #define SOCK_STREAM   1
@@ -157,14 +167,22 @@ struct shim_sock_handle {
         size_t size;             /* total size (capacity) of buffer `buf` */
         size_t start;            /* beginning of buffered but yet unread data in `buf` */
         size_t end;              /* end of buffered but yet unread data in `buf` */
-        char uri[SOCK_URI_SIZE]; /* cached URI for recvfrom(udp_socket) case */
+        struct sockaddr_storage addr; /* cached source for recvfrom(udp_socket) case */
+        size_t addrlen;               /* size of `addr`, 0 if the source was not read */
         char buf[];              /* peek buffer of size `size` */
     }* peek_buffer;
 };
 
 struct shim_dir_handle {
-    /* The first two dentries are always "." and ".." */
-    struct shim_dentry** dents;
+    /* Dentries for "." and "..", NULL if the handle is not populated */
+    struct shim_dentry* dot;
+    struct shim_dentry* dotdot;
+
+    /* Names of the other entries, null-terminated and stored one after another: entry `i` (counting
+     * "." and ".." as 0 and 1) is at `names + name_offs[i - 2]`. */
+    char* names;
+    size_t* name_offs;
+
     size_t count;
     size_t pos;
 };
@@ -173,6 +191,12 @@ struct shim_str_handle {
     struct shim_mem_file mem;
     bool dirty;
     file_off_t pos;
+
+    /* Only for pseudo-files with a `generate` callback, for which `mem` holds just a window of the
+     * file: `gen_pos` is the file offset of this window and `gen_cursor` the cursor of the first
+     * record after it. */
+    file_off_t gen_pos;
+    uint64_t gen_cursor;
 };
 
 struct shim_tmpfs_handle {
@@ -193,8 +217,12 @@ struct shim_epoll_item {
     struct shim_handle* epoll;       /* reference to epoll object that monitors handle object */
     LIST_TYPE(shim_epoll_item) list; /* list of shim_epoll_items, used by epoll object (via `fds`) */
     LIST_TYPE(shim_epoll_item) back; /* list of epolls, used by handle object (via `epolls`) */
+    LIST_TYPE(shim_epoll_item) ready; /* on epoll's `ready` list iff `revents` is non-zero */
+    PAL_HANDLE pal_registered;        /* PAL handle registered in epoll's `pal_waitset` */
 };
 
+struct shim_epoll_pal_set;
+
 struct shim_epoll_handle {
     size_t waiter_cnt;
 
@@ -203,12 +231,50 @@ struct shim_epoll_handle {
 
     AEVENTTYPE event;
     LISTP_TYPE(shim_epoll_item) fds;
+    /* Items with pending events, so that `epoll_wait` does not have to scan all of `fds`. */
+    LISTP_TYPE(shim_epoll_item) ready;
+
+    /* Arguments for DkStreamsWaitEvents(), built from `fds` on first `epoll_wait` and reused until
+     * `fds` changes. `pal_set_stale` is set when a monitored handle changes its PAL handle. */
+    struct shim_epoll_pal_set* pal_set;
+    bool pal_set_stale;
+
+    /* PAL wait set mirroring `fds`, so that a wait only returns ready handles. NULL if the PAL does
+     * not support wait sets; `use_waitset` is cleared if some handle cannot be registered there
+     * (then the snapshot above is used). Items removed while there are waiters stay on `removed`,
+     * because a waiter may still get their address from the wait set. */
+    PAL_HANDLE pal_waitset;
+    bool use_waitset;
+    LISTP_TYPE(shim_epoll_item) removed;
+};
+
+struct eventfd_waiter;
+DEFINE_LISTP(eventfd_waiter);
+
+struct shim_eventfd_handle {
+    /* set once the eventfd is backed by a host eventfd (to be shared with child processes), the
+     * fields below are unused then; see "LibOS/shim/src/fs/eventfd/fs.c" */
+    bool on_host;
+    bool semaphore;
+    uint64_t val;
+    /* PAL handle of the eventfd while it is kept in LibOS, signaled iff `val` is not zero */
+    AEVENTTYPE event;
+    bool signaled;
+    LISTP_TYPE(eventfd_waiter) waiters;
 };
 
 struct shim_fs;
 struct shim_qstr;
 struct shim_dentry;
 
+#define HANDLE_REF_SHARDS 8
+
+/* Padded to a cache line, so that threads using different shards don't share it. */
+struct shim_handle_ref_shard {
+    int64_t counter;
+    char pad[64 - sizeof(int64_t)];
+};
+
 /* The epolls list links to the back field of the shim_epoll_item structure
  */
 struct shim_handle {
@@ -216,6 +282,11 @@ struct shim_handle {
     bool is_dir;
 
     REFTYPE ref_count;
+    /* Handles used by several threads at once switch to sharded reference counting, see
+     * `enable_handle_ref_shards` in shim_handle.c. */
+    int ref_shards_state;
+    unsigned int ref_owner_tid;
+    struct shim_handle_ref_shard ref_shards[HANDLE_REF_SHARDS];
 
     struct shim_fs* fs;
     struct shim_dentry* dentry;
@@ -248,7 +319,7 @@ struct shim_handle {
         struct shim_sock_handle sock;    /* TYPE_SOCK */
 
         struct shim_epoll_handle epoll;  /* TYPE_EPOLL */
-        /* (no data) */                  /* TYPE_EVENTFD */
+        struct shim_eventfd_handle eventfd; /* TYPE_EVENTFD */
     } info;
 
     struct shim_dir_handle dir_info;
@@ -274,23 +345,41 @@ struct shim_fd_handle {
     struct shim_handle* handle;
 };
 
+/*
+ * File descriptors are kept in a two-level table: `map[fd / FD_CHUNK_SIZE]` is a chunk of
+ * `FD_CHUNK_SIZE` entries, allocated on first use. Chunks and entries are never moved or freed while
+ * the map is alive, so `get_fd_handle` can look up a descriptor without taking `lock`; only
+ * installing and closing descriptors take it.
+ */
+#define FD_CHUNK_SIZE 256
+#define FD_CHUNKS_CNT ((FDTYPE_MAX + 1) / FD_CHUNK_SIZE)
+
 struct shim_handle_map {
     /* the top of created file descriptors */
-    FDTYPE fd_size;
     FDTYPE fd_top;
 
     /* refrence count and lock */
     REFTYPE ref_count;
     struct shim_lock lock;
 
-    /* An array of file descriptor belong to this mapping */
-    struct shim_fd_handle** map;
+    /* File descriptors belonging to this mapping, see above */
+    struct shim_fd_handle** map[FD_CHUNKS_CNT];
 };
 
 /* allocating file descriptors */
 #define FD_NULL                     ((FDTYPE)-1)
 #define HANDLE_ALLOCATED(fd_handle) ((fd_handle) && (fd_handle)->vfd != FD_NULL)
 
+/* Returns the entry of `fd` (allocated or not, see `HANDLE_ALLOCATED`), or NULL if there is none.
+ * Without `map->lock` held, the fields of the entry may change concurrently. */
+static inline struct shim_fd_handle* __get_fd_entry(struct shim_handle_map* map, FDTYPE fd) {
+    struct shim_fd_handle** chunk = __atomic_load_n(&map->map[fd / FD_CHUNK_SIZE],
+                                                    __ATOMIC_ACQUIRE);
+    if (!chunk)
+        return NULL;
+    return __atomic_load_n(&chunk[fd % FD_CHUNK_SIZE], __ATOMIC_ACQUIRE);
+}
+
 struct shim_handle* __get_fd_handle(FDTYPE fd, int* flags, struct shim_handle_map* map);
 struct shim_handle* get_fd_handle(FDTYPE fd, int* flags, struct shim_handle_map* map);
 
@@ -30,6 +30,9 @@ extern const PAL_CONTROL* g_pal_control;
 // TODO(mkow): We should make it cross-object-inlinable, ideally by enabling LTO, less ideally by
 // pasting it here and making `inline`, but our current linker scripts prevent both.
 void shim_log(int level, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+/* Writes out messages buffered because of `libos.log_buffer_size`. */
+void log_flush(void);
+int init_log_writer(void);
 
 #if 0
 #define DEBUG_BREAK_ON_FAILURE() DEBUG_BREAK()
@@ -57,6 +60,11 @@ void shim_log(int level, const char* fmt, ...) __attribute__((format(printf, 2,
  * Emulates the syscall given the entry \p context.
  */
 noreturn void shim_emulate_syscall(PAL_CONTEXT* context);
+
+int init_syscall_stats(void);
+int get_syscall_stats(char** out_data, size_t* out_size);
+void print_syscall_stats(void);
+void syscall_trace_flush(struct shim_thread* thread);
 /*!
  * \brief Restore the CPU context.
  *
@@ -158,6 +166,9 @@ bool handle_signal(PAL_CONTEXT* context, __sigset_t* old_mask_ptr);
 long pal_to_unix_errno(long err);
 
 void warn_unsupported_syscall(unsigned long sysno);
+/* Returns the name of syscall `sysno`, or NULL if it is unknown. */
+const char* get_syscall_name(unsigned long sysno);
+size_t get_syscall_arg_kinds(unsigned long sysno, char* kinds, size_t size);
 void debug_print_syscall_before(unsigned long sysno, ...);
 void debug_print_syscall_after(unsigned long sysno, ...);
 
@@ -341,6 +352,9 @@ extern void* __load_address;
 extern void* __load_address_end;
 
 extern const char** migrated_envp;
+extern const char** migrated_argv;
+extern const char* migrated_args_strs;
+extern size_t migrated_args_strs_size;
 
 int init_brk_region(void* brk_region, size_t data_segment_size);
 void reset_brk(void);
@@ -356,9 +370,16 @@ void set_rlimit_cur(int resource, uint64_t rlim);
 int object_wait_with_retry(PAL_HANDLE handle);
 
 struct shim_handle;
+struct shim_epoll_handle;
 
 void _update_epolls(struct shim_handle* handle);
+/* Drops `pal_handle`, which `handle` stopped using but which stays open, from the PAL wait sets of
+ * the epolls monitoring `handle`. Must be called with `handle->lock` held. */
+void _forget_epoll_pal_handle(struct shim_handle* handle, PAL_HANDLE pal_handle);
 void delete_from_epoll_handles(struct shim_handle* handle);
+/* Sets up the PAL wait set of `epoll` (its `event` must already exist); `use_waitset` is set only
+ * if the PAL supports wait sets. */
+void create_epoll_waitset(struct shim_epoll_handle* epoll);
 /*!
  * \brief Check if next `epoll_wait` with `EPOLLET` should trigger for this handle
  *
@@ -373,18 +394,29 @@ void delete_from_epoll_handles(struct shim_handle* handle);
  * output (e.g. `write`), \p was_partial - if that operation was done partially (e.g. `read` did not
  * fill the whole buffer).
  *
- * This `EPOLLET` emulation is not entirely identical with Linux. Unfortunately we cannot implement
- * it ideally without PAL support, but adding such support is impossible on PALs other than native
- * Linux. Due to this we have a "hacky" approach: if a handle is successfully waited for on some
+ * Epoll instances backed by a PAL wait set get real edge-triggered notifications from the host and
+ * do not depend on this function. For the others, this `EPOLLET` emulation is not entirely
+ * identical with Linux. We have a "hacky" approach: if a handle is successfully waited for on some
  * epoll instance using `EPOLLET` semantics, it's marked as not epollet-ready and then is not
  * included in further `EPOLLET` waits. To mark it back as epollet-ready, an operation must be
  * observed, which either returns `-EAGAIN` (non-blocking operation which cannot be completed atm)
  * or a partial operation (e.g. `read` not filling the whole buffer). The idea is that application
  * cannot assume that all data was processed (hence expect next `EPOLLET` wait not to hang), until
  * it sees one of the above happening.
+ *
+ * Only the transition back to epollet-ready wakes up epoll waiters, and handles which are not
+ * epollet-ready are left out of the wait altogether, so the cost of an `EPOLLET` wait loop grows
+ * with the number of events instead of the number of registered handles.
  */
 void maybe_epoll_et_trigger(struct shim_handle* handle, int ret, bool in, bool was_partial);
 
+/* sendmsg()/recvmsg() on socket `fd`; also used by writev()/readv() on sockets, so that all buffers
+ * are sent/received in one PAL call */
+ssize_t do_sendmsg(int fd, struct iovec* bufs, int nbufs, int flags, const struct sockaddr* addr,
+                   int addrlen);
+ssize_t do_recvmsg(int fd, struct iovec* bufs, size_t nbufs, int flags, struct sockaddr* addr,
+                   int* addrlen);
+
 void* allocate_stack(size_t size, size_t protect_size, bool user);
 int init_stack(const char** argv, const char** envp, const char*** out_argp, elf_auxv_t** out_auxv);
 
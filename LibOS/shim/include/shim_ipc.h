@@ -12,6 +12,7 @@
 #include "avl_tree.h"
 #include "pal.h"
 #include "shim_defs.h"
+#include "shim_fs_tmpfs.h"
 #include "shim_handle.h"
 #include "shim_internal.h"
 #include "shim_thread.h"
@@ -36,6 +37,8 @@ enum {
     IPC_MSG_POSIX_LOCK_SET,
     IPC_MSG_POSIX_LOCK_GET,
     IPC_MSG_POSIX_LOCK_CLEAR_PID,
+    IPC_MSG_TMPFS_STORE,
+    IPC_MSG_CONN_CLOSE,         /*!< Sender closes its connection, but is still alive. */
     IPC_MSG_CODE_BOUND,
 };
 
@@ -49,6 +52,10 @@ struct shim_ipc_ids {
     IDTYPE self_vmid;
     IDTYPE parent_vmid;
     IDTYPE leader_vmid;
+    /* IDs delegated by the parent at process creation (none if `id_block_start` is 0); see
+     * #delegate_id_block */
+    IDTYPE id_block_start;
+    IDTYPE id_block_end;
 };
 
 extern struct shim_ipc_ids g_process_ipc_ids;
@@ -164,15 +171,22 @@ int ipc_cld_exit_send(unsigned int exitcode, unsigned int term_signal);
 int ipc_cld_exit_callback(IDTYPE src, void* data, uint64_t seq);
 void ipc_child_disconnect_callback(IDTYPE vmid);
 
+/* Size of the ranges a process uses for its own threads; carved from its ID blocks. */
 #define MAX_RANGE_SIZE 0x20
+/* Size of the ID blocks the IPC leader hands out. */
+#define ID_BLOCK_SIZE 0x400
+/* Size of the ID blocks a process passes on to each child process from its own block. */
+#define DELEGATED_ID_BLOCK_SIZE 0x100
 
 /*!
- * \brief Request a new ID range from the IPC leader
+ * \brief Request a new ID block from the IPC leader
  *
- * \param[out] out_start start of the new ID range
- * \param[out] out_end end of the new ID range
+ * \param[out] out_start start of the new ID block
+ * \param[out] out_end end of the new ID block
  *
- * Sender becomes the owner of the returned ID range.
+ * Sender becomes the owner of the returned ID block (at most #ID_BLOCK_SIZE IDs). It hands out
+ * ranges of it to its threads and blocks of it to its child processes without involving the
+ * leader.
  */
 int ipc_alloc_id_range(IDTYPE* out_start, IDTYPE* out_end);
 int ipc_alloc_id_range_callback(IDTYPE src, void* data, uint64_t seq);
@@ -183,7 +197,8 @@ int ipc_alloc_id_range_callback(IDTYPE src, void* data, uint64_t seq);
  * \param start start of the ID range
  * \param end end of the ID range
  *
- * \p start and \p end must denote a full range (for details check #ipc_change_id_owner).
+ * \p start and \p end may cover only a part of an allocated range (e.g. the part of an ID block
+ * that a process used for its threads), and IDs in them that are not in use are skipped.
  */
 int ipc_release_id_range(IDTYPE start, IDTYPE end);
 int ipc_release_id_range_callback(IDTYPE src, void* data, uint64_t seq);
@@ -199,24 +214,57 @@ int ipc_release_id_range_callback(IDTYPE src, void* data, uint64_t seq);
  * - process1 owns range 1..10
  * - `ipc_change_id_owner(id=5, new_owner=process2)`
  * - now process1 owns ranges 1..4 and 6..10, process2 owns 5..5
- * - each of these ranges must be freed separately, e.g.
- *   `ipc_release_id_range(5, 5); ipc_release_id_range(1, 4); ipc_release_id_range(6, 10);`
- *   is ok to do, but `ipc_release_id_range(5, 10);` is not.
- * Theoretically speaking any process can free any range (as long as each range is freed only once),
+ * - each of these ranges should be freed by its owner, e.g. process2 does
+ *   `ipc_release_id_range(5, 5)` and process1 does `ipc_release_id_range(1, 4)` and
+ *   `ipc_release_id_range(6, 10)`.
+ * Theoretically speaking any process can free any range (as long as each ID is freed only once),
  * but in the current implementation a process frees only ranges it owns.
  */
 int ipc_change_id_owner(IDTYPE id, IDTYPE new_owner);
 int ipc_change_id_owner_callback(IDTYPE src, void* data, uint64_t seq);
 
+/*!
+ * \brief Change owner of an ID and of an ID block along with it
+ *
+ * \param id ID to change the ownership of, or `0` for none
+ * \param block_start start of the ID block, or `0` for none
+ * \param block_end end of the ID block
+ * \param new_owner new owner of \p id and of the IDs in the block that are in use
+ *
+ * Same as #ipc_change_id_owner, but takes over a delegated ID block in the same round-trip to the
+ * IPC leader. Used by a new process for its PID and the IDs delegated by its parent.
+ */
+int ipc_change_id_owner_with_block(IDTYPE id, IDTYPE block_start, IDTYPE block_end,
+                                   IDTYPE new_owner);
+
 /*!
  * \brief Find the owner of a given id
  *
  * \param id id to find the owner of
  * \param[out] out_owner contains vmid of the process owning \p id
  *
- * If nobody owns \p id then `0` is returned in \p out_owner.
+ * If nobody owns \p id then `0` is returned in \p out_owner. Answers of the IPC leader are cached,
+ * see #ipc_forget_id_owner.
  */
 int ipc_get_id_owner(IDTYPE id, IDTYPE* out_owner);
+/*!
+ * \brief Drop the cached owner of an ID
+ *
+ * \param id ID whose owner turned out to be stale (it is unreachable or does not know \p id)
+ *
+ * \returns `true` if an owner was cached, i.e. a new lookup with #ipc_get_id_owner may give a
+ * different answer.
+ */
+bool ipc_forget_id_owner(IDTYPE id);
+/*!
+ * \brief Remember the owner of an ID learned from a message the owner sent us
+ *
+ * \param id     ID that \p owner is known to own
+ * \param owner  vmid of the process owning \p id
+ *
+ * Does nothing in the IPC leader, which knows all owners anyway.
+ */
+void ipc_learn_id_owner(IDTYPE id, IDTYPE owner);
 int ipc_get_id_owner_callback(IDTYPE src, void* data, uint64_t seq);
 
 struct shim_ipc_pid_kill {
@@ -304,4 +352,32 @@ int ipc_posix_lock_set_callback(IDTYPE src, void* data, unsigned long seq);
 int ipc_posix_lock_get_callback(IDTYPE src, void* data, unsigned long seq);
 int ipc_posix_lock_clear_pid_callback(IDTYPE src, void* data, unsigned long seq);
 
+/*
+ * TMPFS_STORE: `struct shim_ipc_tmpfs_store` -> `struct shim_ipc_tmpfs_store_resp`
+ */
+
+struct shim_ipc_tmpfs_store {
+    /* see `struct tmpfs_store_req` in `shim_fs_tmpfs.h` */
+    int op;
+    mode_t type;
+    mode_t perm;
+    file_off_t pos;
+    size_t size;
+
+    size_t path_size;     /* including the null terminator */
+    size_t new_path_size; /* 0 if there is no `new_path` */
+    char data[];          /* path, new path, data for WRITE */
+};
+
+struct shim_ipc_tmpfs_store_resp {
+    int64_t result;
+    struct tmpfs_store_attr attr;
+    size_t data_size;
+    char data[];
+};
+
+ssize_t ipc_tmpfs_store_request(struct tmpfs_store_req* req, struct tmpfs_store_attr* attr,
+                                void** out_data, size_t* out_size);
+int ipc_tmpfs_store_callback(IDTYPE src, void* data, unsigned long seq);
+
 #endif /* SHIM_IPC_H_ */
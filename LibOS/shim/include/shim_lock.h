@@ -10,11 +10,19 @@
 #include <stdbool.h>
 
 #include "assert.h"
+#include "cpu.h"
 #include "pal.h"
 #include "shim_thread.h"
 #include "shim_types.h"
 
 extern bool lock_enabled;
+extern bool g_lock_stats_enabled;
+
+/* Lock contention stats, enabled by `libos.lock_stats` (see utils/lock_stats.c) */
+int init_lock_stats(void);
+void account_lock(const char* file, int line, bool contended, uint64_t wait_cycles);
+int get_lock_stats(char** out_data, size_t* out_size);
+void print_lock_stats(void);
 
 static inline void enable_locking(void) {
     if (!lock_enabled)
@@ -40,19 +48,34 @@ static inline void destroy_lock(struct shim_lock* l) {
     clear_lock(l);
 }
 
-static void lock(struct shim_lock* l) {
+/* Use `lock()`, which records the call site for the lock stats. */
+static void _lock(struct shim_lock* l, const char* file, int line) {
     if (!lock_enabled) {
         return;
     }
 
     assert(l->lock);
 
+    bool contended = false;
+    uint64_t start = 0;
+    if (g_lock_stats_enabled) {
+        /* racy peek, only for the stats */
+        contended = __atomic_load_n(&l->owner, __ATOMIC_RELAXED) != 0;
+        start = get_tsc();
+    }
+
     while (DkEventWait(l->lock, /*timeout=*/NULL) < 0)
         /* nop */;
 
+    if (g_lock_stats_enabled) {
+        account_lock(file, line, contended, get_tsc() - start);
+    }
+
     l->owner = get_cur_tid();
 }
 
+#define lock(l) _lock(l, __FILE__, __LINE__)
+
 static inline void unlock(struct shim_lock* l) {
     if (!lock_enabled) {
         return;
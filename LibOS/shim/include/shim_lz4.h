@@ -0,0 +1,24 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/*
+ * LZ4 block format, see "LibOS/shim/src/utils/lz4.c". Kept apart from shim_utils.h, so that the
+ * codec can also be built against the host libc (with USE_STDLIB) and tested on its own.
+ */
+
+#ifndef _SHIM_LZ4_H_
+#define _SHIM_LZ4_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define LZ4_HASH_LOG        12
+#define LZ4_HASH_TABLE_SIZE (sizeof(uint32_t) << LZ4_HASH_LOG)
+
+/* Compresses `src` (less than 4GB) into `dst` using `hash_table` (LZ4_HASH_TABLE_SIZE bytes) as
+ * scratch space; returns the compressed size, or 0 if it does not fit into `dst_size` bytes. */
+size_t lz4_compress(const void* src, size_t src_size, void* dst, size_t dst_size,
+                    uint32_t* hash_table);
+/* Decompresses `src` into exactly `dst_size` bytes; returns 0 or -EINVAL on malformed input. */
+int lz4_decompress(const void* src, size_t src_size, void* dst, size_t dst_size);
+
+#endif /* _SHIM_LZ4_H_ */
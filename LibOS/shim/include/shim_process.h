@@ -23,12 +23,30 @@ struct shim_child_process {
     /* Signal sent to the parent process (us) on this child termination. */
     int child_termination_signal;
 
-    /* These 3 fields are set when the child terminates. */
+    /* These 4 fields are set when the child terminates. */
+    bool exited;
     int exit_code;
     int term_signal;
     IDTYPE uid;
 
+    /* On `g_process.children` or `g_process.zombies`, depending on `exited`. */
     LIST_TYPE(shim_child_process) list;
+    /* On `g_process.children_by_pid`, until the child is reaped. */
+    UT_hash_handle hh;
+};
+
+struct shim_thread;
+
+/* A thread blocked in wait4() or waitid(). Lives on the stack of the waiting thread. */
+struct shim_child_waiter {
+    struct shim_child_waiter* next;
+    struct shim_thread* thread;
+    /* Same meaning as in `struct shim_thread_queue`. */
+    bool in_use;
+    /* What the thread waits for, see `child_matches_wait()`. */
+    int which;
+    IDTYPE id;
+    int options;
 };
 
 struct shim_process {
@@ -48,13 +66,16 @@ struct shim_process {
     /* Handle to the executable file. Protected by `fs_lock`. */
     struct shim_handle* exec;
 
-    /* Threads waiting for some child to exit. Protected by `children_lock`. */
-    struct shim_thread_queue* wait_queue;
+    /* Threads waiting for some child to exit. A child exit wakes only the waiters it matches.
+     * Protected by `children_lock`. */
+    struct shim_child_waiter* wait_queue;
 
     /* List of child processes that are still running. Protected by `children_lock`. */
     LISTP_TYPE(shim_child_process) children;
     /* List of already exited children. Protected by `children_lock`. */
     LISTP_TYPE(shim_child_process) zombies;
+    /* All children from both lists above, hashed by PID. Protected by `children_lock`. */
+    struct shim_child_process* children_by_pid;
 
     struct shim_lock children_lock;
     struct shim_lock fs_lock;
@@ -77,6 +98,18 @@ void destroy_child_process(struct shim_child_process* child);
 /* Adds `child` to `g_process` children list. */
 void add_child_process(struct shim_child_process* child);
 
+/* Returns the running or exited (but not yet reaped) child `pid`, or NULL. Requires
+ * `g_process.children_lock` to be held. */
+struct shim_child_process* find_child_process(IDTYPE pid);
+/* Removes the exited child `child` from `g_process` and frees it. Requires
+ * `g_process.children_lock` to be held. */
+void reap_child_process(struct shim_child_process* child);
+
+/* Returns whether `child` is reported by wait4()/waitid() called with `which`, `id` and
+ * `options` (`P_*` and `W*` constants). */
+bool child_matches_wait(const struct shim_child_process* child, int which, IDTYPE id,
+                        int options);
+
 /*
  * These 2 functions mark a child as exited, moving it from `children` list to `zombies` list
  * and generate a child-termination signal (if needed).
@@ -94,4 +127,18 @@ bool mark_child_exited_by_pid(IDTYPE pid, IDTYPE child_uid, int exit_code, int s
  */
 bool is_zombie_process(IDTYPE pid);
 
+/*
+ * vfork+execve fast path (see shim_fork.c): the vfork child runs on the thread of the parent until
+ * it calls execve() or exits, which spawns the real child process and resumes the parent.
+ */
+bool can_use_vfork_fast_path(unsigned long flags);
+long vfork_fast_path_begin(unsigned long flags, unsigned long user_stack_addr, int* set_parent_tid);
+bool is_vfork_child(void);
+/* Takes ownership of `exec`. On success, returns to the parent (from vfork) with the child PID. */
+long vfork_fast_path_execve(struct shim_handle* exec, const char** argv, const char** envp);
+long vfork_fast_path_exit(int error_code);
+
+/* Non-negative in a child spawned by the fast path for a vfork child that exited before execve. */
+extern int g_spawned_exit_code;
+
 #endif // _SHIM_PROCESS_H
@@ -160,6 +160,7 @@ int do_kill_pgroup(IDTYPE sender, IDTYPE pgid, int sig);
 
 void fill_siginfo_code_and_status(siginfo_t* info, int signal, int exit_code);
 
+int init_sleep(void);
 int do_nanosleep(uint64_t timeout_us, struct __kernel_timespec* rem);
 
 #endif /* _SHIM_SIGNAL_H_ */
@@ -222,6 +222,21 @@ struct sync_handle {
     /* Requested by server; always lower than cur_state, or NONE */
     int server_req_state;
 
+    /* How long a lease is kept after the server confirms it before a downgrade is honored (0 means
+     * right away). Grows when the process keeps re-requesting the handle right after giving it
+     * away, shrinks when keeping it did not help. */
+    uint64_t hold_us;
+    /* Time of the last CONFIRM_UPGRADE (only tracked if hold_us is not 0). */
+    uint64_t acquired_time;
+    /* Time of the last downgrade requested by the server. */
+    uint64_t downgraded_time;
+    /* A downgrade is being deferred until the hold time ends. */
+    bool downgrade_deferred;
+    /* The deferred downgrade has a pending timer (which holds a reference to the handle). */
+    bool downgrade_timer;
+    /* The handle was locked again while its downgrade was deferred. */
+    bool used_while_deferred;
+
     /* Reference count, used internally by sync client: the user of the handle just calls
      * `sync_create` / `sync_destroy`. */
     REFTYPE ref_count;
@@ -240,6 +255,10 @@ int init_sync_client(void);
  * we shut down the IPC helper. */
 int shutdown_sync_client(void);
 
+/* Returns true if the sync engine is enabled (`libos.sync.enable`), i.e. handles may be shared with
+ * other processes and `sync_lock()` can involve remote communication. */
+bool sync_is_enabled(void);
+
 /* Create a new sync handle. If `id` is 0, allocate a fresh handle ID. */
 int sync_create(struct sync_handle** handle, uint64_t id);
 
@@ -33,6 +33,7 @@ struct shim_tcb {
      * an SGX enclave) we lack a way to restore all (or at least some) registers atomically. */
     void*               syscall_scratch_pc;
     void*               vma_cache;
+    void*               slab_cache;
     char                log_prefix[32];
 };
 
@@ -52,6 +53,7 @@ static inline void __shim_tcb_init(shim_tcb_t* shim_tcb) {
     shim_tcb->handle_call = &handle_call;
     shim_tcb->context.syscall_nr = -1;
     shim_tcb->vma_cache = NULL;
+    shim_tcb->slab_cache = NULL;
 }
 
 /* Call this function at the beginning of thread execution. */
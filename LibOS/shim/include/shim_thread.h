@@ -12,6 +12,7 @@
 #include <stdint.h>
 
 #include "api.h"
+#include "cpu.h"
 #include "pal.h"
 #include "list.h"
 #include "shim_handle.h"
@@ -57,11 +58,22 @@ struct shim_signal_queue {
     struct shim_rt_signal_queue rt_signal_queues[NUM_SIGS - SIGRTMIN + 1];
 };
 
+/* Last span of user memory accepted by `is_in_adjacent_user_vmas()`, valid while the VMA tree
+ * sequence number is `seq`; see "LibOS/shim/src/bookkeep/shim_vma.c". */
+struct shim_user_range_cache {
+    uintptr_t begin;
+    uintptr_t end;
+    int prot;
+    uint32_t seq;
+};
+
 DEFINE_LIST(shim_thread);
 DEFINE_LISTP(shim_thread);
 struct shim_thread {
     /* Field for inserting threads on global `g_thread_list`. */
     LIST_TYPE(shim_thread) list;
+    /* Next thread in the same bucket of the TID hash table (see `lookup_thread`). */
+    struct shim_thread* hash_next;
 
     /* Pointer to the bottom of the internal LibOS stack. */
     void* libos_stack_bottom;
@@ -110,9 +122,41 @@ struct shim_thread {
     struct robust_list_head* robust_list;
 
     PAL_HANDLE scheduler_event;
+    /* Set by `thread_wakeup()` before signaling `scheduler_event`, so that `thread_spin_wait()` can
+     * notice a wakeup without waiting on the event (on SGX, that is an OCALL on both sides). */
+    bool wakeup_pending;
+    /* Set while the thread sleeps in `thread_wait()`, which returns on a pending signal: then
+     * `thread_wakeup()` is enough to deliver a signal and no host signal (`DkThreadResume()`) is
+     * needed, see `thread_signal_kick()`. */
+    bool waiting_for_signals;
+
+    /* `sched_yield()` calls answered without a host yield since the last one, see shim_sched.c */
+    unsigned int yields_skipped;
 
     struct wake_queue_node wake_queue;
 
+    /* Freed futex kept for the next `futex_wait()` of this thread, see
+     * "LibOS/shim/src/sys/shim_futex.c". Accessed only by this thread. */
+    struct shim_futex* spare_futex;
+
+    /* scratch space of poll() and select(), see "LibOS/shim/src/sys/shim_poll.c" */
+    struct shim_poll_cache* poll_cache;
+
+    /* random number generator of getrandom(), see "LibOS/shim/src/utils/random.c" */
+    struct shim_random_state* random_state;
+
+    /* Accessed only by this thread. */
+    struct shim_user_range_cache user_range_cache;
+
+    /* CPU affinity mask as last returned by `DkThreadGetCpuAffinity()`, cached because thread
+     * pools query it all the time; NULL until the first query and after `sched_setaffinity()`.
+     * Protected by `lock`. See "LibOS/shim/src/sys/shim_sched.c". */
+    unsigned long* cpu_affinity;
+
+    /* Records of `libos.syscall_trace_file` not yet written out, allocated on the first traced
+     * syscall. Only accessed by the thread itself. See "LibOS/shim/src/shim_syscalls.c". */
+    struct syscall_trace_buf* syscall_trace;
+
     bool time_to_die;
 
     void* stack;
@@ -133,6 +177,9 @@ struct shim_thread_queue {
     bool in_use;
 };
 
+void free_poll_cache(struct shim_poll_cache* cache);
+void free_random_state(struct shim_random_state* state);
+
 int init_threading(void);
 int init_id_ranges(IDTYPE preload_tid);
 
@@ -140,6 +187,20 @@ static inline bool is_internal(struct shim_thread* thread) {
     return thread->tid == 0;
 }
 
+/* Approximate number of user threads of this process which are not blocked in a LibOS wait (they
+ * may still be blocked in the host, e.g. in a read). Used by `sched_yield()` to tell whether any
+ * thread of this process may be waiting for a CPU; updated without locks, so it may be off for a
+ * moment. */
+extern int g_runnable_threads_cnt;
+
+static inline void thread_block_begin(void) {
+    __atomic_sub_fetch(&g_runnable_threads_cnt, 1, __ATOMIC_RELAXED);
+}
+
+static inline void thread_block_end(void) {
+    __atomic_add_fetch(&g_runnable_threads_cnt, 1, __ATOMIC_RELAXED);
+}
+
 /*!
  * \brief Allocates new ID
  *
@@ -151,16 +212,35 @@ static inline bool is_internal(struct shim_thread* thread) {
  * no longer locally tracked. You probably want to call #ipc_change_id_owner afterwards.
  */
 IDTYPE get_new_id(bool remove_from_owned);
+/*!
+ * \brief Sets aside a block of IDs for a new child process
+ *
+ * \param[out] out_start start of the ID block
+ * \param[out] out_end end of the ID block
+ *
+ * The block (at most #DELEGATED_ID_BLOCK_SIZE IDs) comes from the ID block of this process, so the
+ * child can allocate IDs without asking the IPC leader. It is no longer locally tracked; the child
+ * takes it over with #ipc_change_id_owner_with_block, or the caller releases it if the child could
+ * not be created.
+ */
+int delegate_id_block(IDTYPE* out_start, IDTYPE* out_end);
 /*!
  * \brief Releases (frees) previously allocated ID
  *
  * \param id ID to release
  */
 void release_id(IDTYPE id);
+/*!
+ * \brief Releases the IDs of this process that were never used, before the process exits
+ */
+void release_id_pool(void);
 
 void free_signal_queue(struct shim_signal_queue* queue);
 
 void get_signal_dispositions(struct shim_signal_dispositions* dispositions);
+/* Returns a new (unshared) copy of `dispositions`, or NULL if out of memory. */
+struct shim_signal_dispositions* copy_signal_dispositions(
+    struct shim_signal_dispositions* dispositions);
 void put_signal_dispositions(struct shim_signal_dispositions* dispositions);
 
 void get_thread(struct shim_thread* thread);
@@ -204,25 +284,62 @@ static inline void set_cur_thread(struct shim_thread* thread) {
 static inline void thread_prepare_wait(void) {
     struct shim_thread* cur_thread = get_cur_thread();
     assert(!is_internal(cur_thread));
+    __atomic_store_n(&cur_thread->wakeup_pending, false, __ATOMIC_RELAXED);
     DkEventClear(cur_thread->scheduler_event);
 }
 
+/* Spins for at most `iterations` rounds waiting for `thread_wakeup()`. Returns true if the thread
+ * was woken up in the meantime, false if it should go on with `thread_wait()`. */
+static inline bool thread_spin_wait(size_t iterations) {
+    struct shim_thread* cur_thread = get_cur_thread();
+    for (size_t i = 0; i < iterations; i++) {
+        if (__atomic_load_n(&cur_thread->wakeup_pending, __ATOMIC_ACQUIRE)) {
+            return true;
+        }
+        CPU_RELAX();
+    }
+    return false;
+}
+
 static inline int thread_wait(uint64_t* timeout_us, bool ignore_pending_signals) {
     struct shim_thread* cur_thread = get_cur_thread();
     assert(!is_internal(cur_thread));
 
-    if (!ignore_pending_signals && have_pending_signals()) {
-        return -EINTR;
+    if (!ignore_pending_signals) {
+        __atomic_store_n(&cur_thread->waiting_for_signals, true, __ATOMIC_RELAXED);
+        /* pairs with the fence in `thread_signal_kick()`: either we see the new signal or the
+         * sender sees `waiting_for_signals` (and wakes us up via `scheduler_event`) */
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (have_pending_signals()) {
+            __atomic_store_n(&cur_thread->waiting_for_signals, false, __ATOMIC_RELAXED);
+            return -EINTR;
+        }
     }
 
+    thread_block_begin();
     int ret = DkEventWait(cur_thread->scheduler_event, timeout_us);
+    thread_block_end();
+    __atomic_store_n(&cur_thread->waiting_for_signals, false, __ATOMIC_RELAXED);
     return ret == -PAL_ERROR_TRYAGAIN ? -ETIMEDOUT : pal_to_unix_errno(ret);
 }
 
 static inline void thread_wakeup(struct shim_thread* thread) {
+    __atomic_store_n(&thread->wakeup_pending, true, __ATOMIC_RELEASE);
     DkEventSet(thread->scheduler_event);
 }
 
+/* Makes `thread` (not the current one) notice a signal just queued for it. A thread sleeping in
+ * `thread_wait()` only needs a wakeup and handles the signal on its syscall return; a thread running
+ * user code or blocked in the host must be interrupted by a host signal. */
+static inline int thread_signal_kick(struct shim_thread* thread) {
+    thread_wakeup(thread);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&thread->waiting_for_signals, __ATOMIC_RELAXED)) {
+        return 0;
+    }
+    return pal_to_unix_errno(DkThreadResume(thread->pal_handle));
+}
+
 /* Adds the thread to the wake-up queue.
  * If this thread is already on some queue, then it *will* be woken up soon and there is no need
  * to add it to another queue.
@@ -324,7 +441,8 @@ bool kill_other_threads(void);
 noreturn void thread_exit(int error_code, int term_signal);
 noreturn void process_exit(int error_code, int term_signal);
 
-void release_robust_list(struct robust_list_head* head);
+int init_futex(void);
+void release_robust_list(struct robust_list_head* head, IDTYPE tid);
 void release_clear_child_tid(int* clear_child_tid);
 
 #endif /* _SHIM_THREAD_H_ */
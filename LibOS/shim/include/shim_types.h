@@ -224,11 +224,13 @@ enum {
     MSG_DONTWAIT = 0x40,   /* Nonblocking IO. */
     MSG_WAITALL  = 0x100,  /* Wait for full request or error */
     MSG_NOSIGNAL = 0x4000, /* Do not generate SIGPIPE. */
+    MSG_WAITFORONE = 0x10000, /* recvmmsg(): block only for the first message. */
 #define MSG_OOB      MSG_OOB
 #define MSG_PEEK     MSG_PEEK
 #define MSG_DONTWAIT MSG_DONTWAIT
 #define MSG_WAITALL  MSG_WAITALL
 #define MSG_NOSIGNAL MSG_NOSIGNAL
+#define MSG_WAITFORONE MSG_WAITFORONE
 };
 
 struct msghdr {
@@ -358,6 +360,7 @@ typedef struct shim_aevent {
 
 #define STR_SIZE 4096
 
+/* Allocated in size classes with `get_str_obj`, so usually smaller than STR_SIZE. */
 struct shim_str {
     char str[STR_SIZE];
 };
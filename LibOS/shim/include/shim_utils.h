@@ -26,10 +26,10 @@ static inline uint64_t hash64(uint64_t key) {
     return key;
 }
 
-/* string object */
-struct shim_str* get_str_obj(void);
+/* string object; only the first `str_obj_size(size)` bytes of the returned object are usable */
+struct shim_str* get_str_obj(size_t size);
 int free_str_obj(struct shim_str* str);
-int init_str_mgr(void);
+size_t str_obj_size(size_t size);
 
 /* qstring object */
 #define QSTR_INIT \
@@ -49,6 +49,31 @@ static inline void qstrfree(struct shim_qstr* qstr) {
     qstr->len     = 0;
 }
 
+/* Returns a buffer of `qstr` big enough for a string of length `len` (and the terminating null
+ * byte). The current overflow object is reused if it has the right size class; one restored from
+ * a checkpoint has exactly the size of its string and is always replaced. */
+static inline char* qstr_get_buf(struct shim_qstr* qstr, size_t len) {
+    if (len < QSTR_SIZE) {
+        if (qstr->oflow) {
+            free_str_obj(qstr->oflow);
+            qstr->oflow = NULL;
+        }
+        return qstr->name;
+    }
+
+    if (qstr->oflow && !memory_migrated(qstr->oflow)
+            && str_obj_size(qstr->len + 1) == str_obj_size(len + 1)) {
+        return qstr->oflow->str;
+    }
+
+    struct shim_str* str = get_str_obj(len + 1);
+    if (!str)
+        return NULL;
+    free_str_obj(qstr->oflow);
+    qstr->oflow = str;
+    return str->str;
+}
+
 static inline char* qstrsetstr(struct shim_qstr* qstr, const char* str, size_t len) {
     if (!str) {
         qstrfree(qstr);
@@ -58,21 +83,9 @@ static inline char* qstrsetstr(struct shim_qstr* qstr, const char* str, size_t l
     if (len >= STR_SIZE)
         return NULL;
 
-    char* buf = qstr->name;
-
-    if (len >= QSTR_SIZE) {
-        if (!qstr->oflow) {
-            qstr->oflow = get_str_obj();
-            if (!qstr->oflow)
-                return NULL;
-        }
-        buf = qstr->oflow->str;
-    } else {
-        if (qstr->oflow) {
-            free_str_obj(qstr->oflow);
-            qstr->oflow = NULL;
-        }
-    }
+    char* buf = qstr_get_buf(qstr, len);
+    if (!buf)
+        return NULL;
 
     memcpy(buf, str, len);
     buf[len] = 0;
@@ -92,17 +105,9 @@ static inline char* qstrsetstrs(struct shim_qstr* qstr, int nstrs, const char**
     if (total_len >= STR_SIZE)
         return NULL;
 
-    char* buf = qstr->name;
-
-    if (total_len >= QSTR_SIZE) {
-        if (!qstr->oflow) {
-            // TODO: alloc proper size.
-            qstr->oflow = get_str_obj();
-            if (!qstr->oflow)
-                return NULL;
-        }
-        buf = qstr->oflow->str;
-    }
+    char* buf = qstr_get_buf(qstr, total_len);
+    if (!buf)
+        return NULL;
 
     char* ptr = buf;
     qstr->len = 0;
@@ -135,6 +140,9 @@ static inline int qstrcmpstr(const struct shim_qstr* qstr, const char* str, size
 
 /* heap allocation functions */
 int init_slab(void);
+void destroy_thread_slab_cache(void);
+int get_malloc_stats(char** out_data, size_t* out_size);
+void print_malloc_stats(void);
 
 void* malloc(size_t size);
 void free(void* mem);
@@ -163,11 +171,16 @@ int vmid_to_uri(IDTYPE vmid, char* uri, size_t uri_len);
 /* create unique files/pipes */
 int create_pipe(char* name, char* uri, size_t size, PAL_HANDLE* hdl, struct shim_qstr* qstr,
                 bool use_vmid_for_name);
+/* connect `srv` and `cli` handles by a fresh host pipe (see "LibOS/shim/src/sys/shim_pipe.c") */
+int create_pipes(struct shim_handle* srv, struct shim_handle* cli, int flags, char* name,
+                 struct shim_qstr* qstr);
 
 /* Asynchronous event support */
 int init_async_worker(void);
 int64_t install_async_event(PAL_HANDLE object, unsigned long time,
                             void (*callback)(IDTYPE caller, void* arg), void* arg);
+/* call `callback(arg)` from the async worker once, after `time` microseconds */
+int install_async_timer(uint64_t time, void (*callback)(IDTYPE caller, void* arg), void* arg);
 struct shim_thread* terminate_async_worker(void);
 
 extern const toml_table_t* g_manifest_root;
@@ -175,6 +188,9 @@ extern const toml_table_t* g_manifest_root;
 int read_exact(PAL_HANDLE handle, void* buf, size_t size);
 int write_exact(PAL_HANDLE handle, void* buf, size_t size);
 
+/* random bytes for getrandom() and /dev/[u]random, see "LibOS/shim/src/utils/random.c" */
+int get_random_bytes(void* buf, size_t size);
+
 static inline uint64_t timespec_to_us(const struct __kernel_timespec* ts) {
     return ts->tv_sec * TIME_US_IN_S + ts->tv_nsec / TIME_NS_IN_US;
 }
@@ -11,4 +11,7 @@
 extern const uint8_t vdso_so[];
 extern const size_t vdso_so_size;
 
+/* Publish the current time parameters of PAL to the vDSO data page. */
+void update_vdso_time_data(void);
+
 #endif /* _SHIM_VDSO_H_ */
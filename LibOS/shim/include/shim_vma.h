@@ -49,6 +49,9 @@ struct shim_vma_info {
 /* vma is backed by a file and has been protected as writable, so it has to be checkpointed during
  * migration */
 #define VMA_TAINTED 0x40000000
+/* vma is a read-only view of a file mapped by the PAL outside of `user_address` without copying
+ * (see `file_map_untrusted` in PAL_CONTROL); it cannot be made writable or executable */
+#define VMA_ZERO_COPY 0x08000000
 
 int init_vma(void);
 
@@ -75,6 +78,17 @@ void bkeep_remove_tmp_vma(void* vma);
 /* Bookkeeping a change to memory protections. */
 int bkeep_mprotect(void* addr, size_t length, int prot, bool is_internal);
 
+struct shim_vma_range {
+    void* addr;
+    size_t length;
+};
+
+/* Bookkeeping a change to memory protections of `count` ranges at once, e.g. for runtimes that
+ * change protections of many small regions. Either all ranges are changed or none of them is.
+ * Adjacent vmas that end up with the same properties are merged afterwards. */
+int bkeep_mprotect_ranges(const struct shim_vma_range* ranges, size_t count, int prot,
+                          bool is_internal);
+
 /*
  * Bookkeeping an allocation of memory at a fixed address. `flags` must contain either MAP_FIXED or
  * MAP_FIXED_NOREPLACE - the former forces bookkeeping and removes any overlapping VMAs, the latter
@@ -121,9 +135,18 @@ bool is_in_adjacent_user_vmas(const void* addr, size_t length, int prot);
 int dump_all_vmas(struct shim_vma_info** vma_infos, size_t* count, bool include_unmapped);
 void free_vma_info_array(struct shim_vma_info* vma_infos, size_t count);
 
+/* Copies out at most `max_count` (non-internal) vmas, starting with the one that contains `addr`
+ * or is the first above it, and returns their number. The caller must release the `file` handles
+ * of the returned vmas. Allows iterating over all vmas without a snapshot of the whole list. */
+size_t dump_vmas_from(void* addr, struct shim_vma_info* infos, size_t max_count,
+                      bool include_unmapped);
+
 /* Implementation of madvise(MADV_DONTNEED) syscall */
 int madvise_dontneed_range(uintptr_t begin, uintptr_t end);
 
+/* Implementation of madvise(MADV_FREE) syscall; releases the memory only if the PAL supports it */
+int madvise_free_range(uintptr_t begin, uintptr_t end);
+
 void debug_print_all_vmas(void);
 
 #endif /* _SHIM_VMA_H_ */
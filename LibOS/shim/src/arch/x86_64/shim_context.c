@@ -24,6 +24,8 @@
 static bool     g_shim_xsave_enabled  = false;
 static uint64_t g_shim_xsave_features = SHIM_XFEATURE_MASK_FPSSE;
 static uint32_t g_shim_xsave_size     = XSTATE_RESET_SIZE;
+/* end offset of each extended state component in the (non-compacted) XSAVE area; 0 if unknown */
+static uint32_t g_shim_xstate_component_end[64];
 
 static const uint32_t g_shim_xstate_reset_state[XSTATE_RESET_SIZE / sizeof(uint32_t)]
 __attribute__((aligned(SHIM_XSTATE_ALIGN))) = {
@@ -67,6 +69,16 @@ void shim_xstate_init(void) {
     g_shim_xsave_features  = xfeatures;
     g_shim_xsave_size      = xsavesize;
 
+    /* components 0 and 1 (x87, SSE) live in the legacy area */
+    for (size_t i = 2; i < ARRAY_SIZE(g_shim_xstate_component_end); i++) {
+        if (!(xfeatures & (1UL << i)))
+            continue;
+        if (DkCpuIdRetrieve(CPUID_LEAF_XSAVE, i, value) < 0)
+            continue;
+        /* EAX: size of the component, EBX: its offset in the non-compacted format */
+        g_shim_xstate_component_end[i] = value[CPUID_WORD_EBX] + value[CPUID_WORD_EAX];
+    }
+
 out:
     log_debug("LibOS xsave_enabled %d, xsave_size 0x%x(%u), xsave_features 0x%lx",
               g_shim_xsave_enabled, g_shim_xsave_size, g_shim_xsave_size, g_shim_xsave_features);
@@ -164,20 +176,46 @@ __asm__(
     "ret\n"
 );
 
+/*
+ * Returns how many bytes of the xsave-made state `xstate` are meaningful: components not marked in
+ * the XSTATE_BV header field are in their initial state and XRSTOR does not read them. Large
+ * components (AVX-512 is 2 KB) are thus copied only if the app actually used them.
+ */
+static size_t xstate_used_size(const struct shim_xstate* xstate, size_t xstate_size) {
+    uint64_t xfeatures = xstate->xstate_hdr.xfeatures;
+    if (xfeatures & ~g_shim_xsave_features) {
+        /* invalid (will fail in XRSTOR anyway), do not try to be smart */
+        return xstate_size;
+    }
+
+    size_t size = sizeof(*xstate);
+    for (size_t i = 2; i < ARRAY_SIZE(g_shim_xstate_component_end); i++) {
+        if (!(xfeatures & (1UL << i)))
+            continue;
+        if (!g_shim_xstate_component_end[i])
+            return xstate_size;
+        size = MAX(size, g_shim_xstate_component_end[i]);
+    }
+    return MIN(size, xstate_size);
+}
+
 /* Copies FPU state. Returns whether the copied state was xsave-made. */
 static bool shim_xstate_copy(struct shim_xstate* dst, const struct shim_xstate* src) {
     if (src == NULL) {
         src = (const struct shim_xstate*)g_shim_xstate_reset_state;
     }
 
-    size_t copy_size = sizeof(struct shim_fpstate);
     int src_is_xstate = is_xstate_extended(src);
     if (src_is_xstate) {
-        copy_size = src->fpstate.sw_reserved.xstate_size + SHIM_FP_XSTATE_MAGIC2_SIZE;
+        size_t xstate_size = src->fpstate.sw_reserved.xstate_size;
+        memcpy(dst, src, xstate_used_size(src, xstate_size));
+        /* MAGIC2 trailer right after the whole xstate area */
+        memcpy((char*)dst + xstate_size, (const char*)src + xstate_size,
+               SHIM_FP_XSTATE_MAGIC2_SIZE);
+    } else {
+        memcpy(dst, src, sizeof(struct shim_fpstate));
     }
 
-    memcpy(dst, src, copy_size);
-
     if (!src_is_xstate) {
         memset(&dst->fpstate.sw_reserved, 0, sizeof(dst->fpstate.sw_reserved));
     }
@@ -29,8 +29,6 @@ static struct shim_lock handle_mgr_lock;
 
 static MEM_MGR handle_mgr = NULL;
 
-#define INIT_HANDLE_MAP_SIZE 32
-
 //#define DEBUG_REF
 
 static int init_tty_handle(struct shim_handle* hdl, bool write) {
@@ -147,13 +145,11 @@ out:
     return ret;
 }
 
-static struct shim_handle_map* get_new_handle_map(FDTYPE size);
+static struct shim_handle_map* get_new_handle_map(void);
 
-static int __init_handle(struct shim_fd_handle** fdhdl, FDTYPE fd, struct shim_handle* hdl,
+static int __init_handle(struct shim_handle_map* map, FDTYPE fd, struct shim_handle* hdl,
                          int fd_flags);
 
-static int __enlarge_handle_map(struct shim_handle_map* map, size_t size);
-
 int init_handle(void) {
     if (!create_lock(&handle_mgr_lock)) {
         return -ENOMEM;
@@ -175,7 +171,7 @@ int init_important_handles(void) {
     struct shim_handle_map* handle_map = get_thread_handle_map(thread);
 
     if (!handle_map) {
-        handle_map = get_new_handle_map(INIT_HANDLE_MAP_SIZE);
+        handle_map = get_new_handle_map();
         if (!handle_map)
             return -ENOMEM;
 
@@ -187,16 +183,8 @@ int init_important_handles(void) {
 
     lock(&handle_map->lock);
 
-    if (handle_map->fd_size < 3) {
-        ret = __enlarge_handle_map(handle_map, INIT_HANDLE_MAP_SIZE);
-        if (ret < 0) {
-            unlock(&handle_map->lock);
-            return ret;
-        }
-    }
-
     /* initialize stdin */
-    if (!HANDLE_ALLOCATED(handle_map->map[0])) {
+    if (!HANDLE_ALLOCATED(__get_fd_entry(handle_map, 0))) {
         struct shim_handle* stdin_hdl = get_new_handle();
         if (!stdin_hdl) {
             unlock(&handle_map->lock);
@@ -209,12 +197,16 @@ int init_important_handles(void) {
             return ret;
         }
 
-        __init_handle(&handle_map->map[0], /*fd=*/0, stdin_hdl, /*flags=*/0);
+        ret = __init_handle(handle_map, /*fd=*/0, stdin_hdl, /*flags=*/0);
         put_handle(stdin_hdl);
+        if (ret < 0) {
+            unlock(&handle_map->lock);
+            return ret;
+        }
     }
 
     /* initialize stdout */
-    if (!HANDLE_ALLOCATED(handle_map->map[1])) {
+    if (!HANDLE_ALLOCATED(__get_fd_entry(handle_map, 1))) {
         struct shim_handle* stdout_hdl = get_new_handle();
         if (!stdout_hdl) {
             unlock(&handle_map->lock);
@@ -227,14 +219,22 @@ int init_important_handles(void) {
             return ret;
         }
 
-        __init_handle(&handle_map->map[1], /*fd=*/1, stdout_hdl, /*flags=*/0);
+        ret = __init_handle(handle_map, /*fd=*/1, stdout_hdl, /*flags=*/0);
         put_handle(stdout_hdl);
+        if (ret < 0) {
+            unlock(&handle_map->lock);
+            return ret;
+        }
     }
 
     /* initialize stderr as duplicate of stdout */
-    if (!HANDLE_ALLOCATED(handle_map->map[2])) {
-        struct shim_handle* stdout_hdl = handle_map->map[1]->handle;
-        __init_handle(&handle_map->map[2], /*fd=*/2, stdout_hdl, /*flags=*/0);
+    if (!HANDLE_ALLOCATED(__get_fd_entry(handle_map, 2))) {
+        struct shim_handle* stdout_hdl = __get_fd_entry(handle_map, 1)->handle;
+        ret = __init_handle(handle_map, /*fd=*/2, stdout_hdl, /*flags=*/0);
+        if (ret < 0) {
+            unlock(&handle_map->lock);
+            return ret;
+        }
     }
 
     if (handle_map->fd_top == FD_NULL || handle_map->fd_top < 2)
@@ -252,7 +252,7 @@ struct shim_handle* __get_fd_handle(FDTYPE fd, int* fd_flags, struct shim_handle
     struct shim_fd_handle* fd_handle = NULL;
 
     if (map->fd_top != FD_NULL && fd <= map->fd_top) {
-        fd_handle = map->map[fd];
+        fd_handle = __get_fd_entry(map, fd);
         if (!HANDLE_ALLOCATED(fd_handle))
             return NULL;
 
@@ -264,16 +264,152 @@ struct shim_handle* __get_fd_handle(FDTYPE fd, int* fd_flags, struct shim_handle
     return NULL;
 }
 
+/*
+ * Sharded reference counting. A handle shared by several threads (a listening socket, a log file,
+ * an epoll instance) would otherwise bounce the cache line of `ref_count` between cores on every
+ * syscall. Once a handle installed in an fd table is looked up by a second thread, `get_handle` and
+ * `put_handle` go to one of `ref_shards` picked by the thread ID instead. Meanwhile `ref_count` holds
+ * an extra `REF_SHARDS_BIAS`, so it cannot drop to zero; a single shard may go negative. When the
+ * handle is removed from an fd table, the shards are folded back into `ref_count` and the handle
+ * uses only `ref_count` from then on.
+ *
+ * An active shard holds `REF_SHARD_ACTIVE` plus its count, so it is always positive. Inactive
+ * shards are zero (or, in debug builds, poisoned negative after the handle is freed), so a thread
+ * racing with folding falls back to `ref_count`.
+ */
+#define REF_SHARDS_BIAS  (1L << 40)
+#define REF_SHARD_ACTIVE (1L << 62)
+
+enum {
+    REF_SHARDS_OFF = 0,
+    REF_SHARDS_ENABLING,
+    REF_SHARDS_ON,
+    REF_SHARDS_FOLDED,
+};
+
+/* Adds `delta` to the shard of the current thread, returns false if the shard is not active. */
+static bool handle_ref_shard_add(struct shim_handle* hdl, int64_t delta) {
+    int64_t* shard = &hdl->ref_shards[get_cur_tid() % HANDLE_REF_SHARDS].counter;
+    int64_t val = __atomic_load_n(shard, __ATOMIC_RELAXED);
+    do {
+        if (val <= 0)
+            return false;
+    } while (!__atomic_compare_exchange_n(shard, &val, val + delta, /*weak=*/true,
+                                          __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+    return true;
+}
+
+/* Caller must hold a reference to `hdl`. */
+static void enable_handle_ref_shards(struct shim_handle* hdl) {
+    int state = REF_SHARDS_OFF;
+    if (!__atomic_compare_exchange_n(&hdl->ref_shards_state, &state, REF_SHARDS_ENABLING,
+                                     /*weak=*/false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+        return;
+
+    __atomic_add_fetch(&hdl->ref_count.counter, REF_SHARDS_BIAS, __ATOMIC_SEQ_CST);
+    for (size_t i = 0; i < HANDLE_REF_SHARDS; i++)
+        __atomic_store_n(&hdl->ref_shards[i].counter, REF_SHARD_ACTIVE, __ATOMIC_RELEASE);
+
+    __atomic_store_n(&hdl->ref_shards_state, REF_SHARDS_ON, __ATOMIC_RELEASE);
+}
+
+/* Called when an fd table drops its reference to `hdl` (the caller still holds that reference). */
+static void fold_handle_ref_shards(struct shim_handle* hdl) {
+    while (true) {
+        int state = __atomic_load_n(&hdl->ref_shards_state, __ATOMIC_ACQUIRE);
+        if (state == REF_SHARDS_FOLDED)
+            return;
+        if (state == REF_SHARDS_ENABLING) {
+            CPU_RELAX();
+            continue;
+        }
+        if (__atomic_compare_exchange_n(&hdl->ref_shards_state, &state, REF_SHARDS_FOLDED,
+                                        /*weak=*/false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            if (state == REF_SHARDS_OFF)
+                return;
+            break;
+        }
+    }
+
+    int64_t delta = -REF_SHARDS_BIAS;
+    for (size_t i = 0; i < HANDLE_REF_SHARDS; i++) {
+        int64_t val = __atomic_exchange_n(&hdl->ref_shards[i].counter, 0, __ATOMIC_SEQ_CST);
+        if (val > 0)
+            delta += val - REF_SHARD_ACTIVE;
+    }
+
+    int64_t count = __atomic_add_fetch(&hdl->ref_count.counter, delta, __ATOMIC_SEQ_CST);
+    __UNUSED(count);
+    assert(count > 0);
+}
+
+/* Switches `hdl` to sharded reference counting once a second thread looks it up by fd. */
+static void note_handle_user(struct shim_handle* hdl) {
+    if (__atomic_load_n(&hdl->ref_shards_state, __ATOMIC_RELAXED) != REF_SHARDS_OFF)
+        return;
+
+    unsigned int tid = get_cur_tid();
+    unsigned int owner = __atomic_load_n(&hdl->ref_owner_tid, __ATOMIC_RELAXED);
+    if (!owner) {
+        __atomic_store_n(&hdl->ref_owner_tid, tid, __ATOMIC_RELAXED);
+    } else if (owner != tid) {
+        enable_handle_ref_shards(hdl);
+    }
+}
+
+/*
+ * Takes a reference to `hdl`, unless its reference count already dropped to zero. Handle objects
+ * come from `handle_mgr`, which never returns memory to the system, so this is safe to call even if
+ * `hdl` was freed (and possibly reused) in the meantime; freed handles have a zero (or, in debug
+ * builds, poisoned negative) reference count.
+ */
+static bool get_handle_if_alive(struct shim_handle* hdl) {
+    /* an active shard means the handle was not folded yet, so it is still alive */
+    if (handle_ref_shard_add(hdl, 1))
+        return true;
+
+    int64_t count = __atomic_load_n(&hdl->ref_count.counter, __ATOMIC_SEQ_CST);
+    do {
+        if (count <= 0)
+            return false;
+    } while (!__atomic_compare_exchange_n(&hdl->ref_count.counter, &count, count + 1,
+                                          /*weak=*/false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+    return true;
+}
+
+/*
+ * Lock-free: the entry of `fd` cannot go away (see `struct shim_handle_map`), but it can be closed
+ * or replaced concurrently. We take a reference to the handle found in the entry and then check
+ * that the entry still holds it; otherwise the reference might have been taken on a handle that was
+ * already closed (or freed and reused), so we drop it and retry.
+ */
 struct shim_handle* get_fd_handle(FDTYPE fd, int* fd_flags, struct shim_handle_map* map) {
     if (!map)
         map = get_thread_handle_map(NULL);
 
-    struct shim_handle* hdl = NULL;
-    lock(&map->lock);
-    if ((hdl = __get_fd_handle(fd, fd_flags, map)))
-        get_handle(hdl);
-    unlock(&map->lock);
-    return hdl;
+    struct shim_fd_handle* fd_handle = __get_fd_entry(map, fd);
+    if (!fd_handle)
+        return NULL;
+
+    while (true) {
+        struct shim_handle* hdl = __atomic_load_n(&fd_handle->handle, __ATOMIC_ACQUIRE);
+        if (!hdl)
+            return NULL;
+
+        int flags = __atomic_load_n(&fd_handle->flags, __ATOMIC_RELAXED);
+        if (!get_handle_if_alive(hdl))
+            continue;
+
+        if (__atomic_load_n(&fd_handle->handle, __ATOMIC_ACQUIRE) != hdl) {
+            put_handle(hdl);
+            continue;
+        }
+
+        note_handle_user(hdl);
+        if (fd_flags)
+            *fd_flags = flags;
+        return hdl;
+    }
 }
 
 struct shim_handle* __detach_fd_handle(struct shim_fd_handle* fd, int* flags,
@@ -288,15 +424,17 @@ struct shim_handle* __detach_fd_handle(struct shim_fd_handle* fd, int* flags,
         if (flags)
             *flags = fd->flags;
 
-        fd->vfd    = FD_NULL;
-        fd->handle = NULL;
-        fd->flags  = 0;
+        fold_handle_ref_shards(handle);
+
+        fd->vfd = FD_NULL;
+        __atomic_store_n(&fd->handle, NULL, __ATOMIC_RELEASE);
+        __atomic_store_n(&fd->flags, 0, __ATOMIC_RELAXED);
 
         if (vfd == map->fd_top)
             do {
                 map->fd_top = vfd ? vfd - 1 : FD_NULL;
                 vfd--;
-            } while (vfd >= 0 && !HANDLE_ALLOCATED(map->map[vfd]));
+            } while (vfd >= 0 && !HANDLE_ALLOCATED(__get_fd_entry(map, vfd)));
     }
 
     return handle;
@@ -310,8 +448,7 @@ struct shim_handle* detach_fd_handle(FDTYPE fd, int* flags, struct shim_handle_m
 
     lock(&handle_map->lock);
 
-    if (fd < handle_map->fd_size)
-        handle = __detach_fd_handle(handle_map->map[fd], flags, handle_map);
+    handle = __detach_fd_handle(__get_fd_entry(handle_map, fd), flags, handle_map);
 
     unlock(&handle_map->lock);
 
@@ -349,22 +486,32 @@ struct shim_handle* get_new_handle(void) {
     return new_handle;
 }
 
-static int __init_handle(struct shim_fd_handle** fdhdl, FDTYPE fd, struct shim_handle* hdl,
+static int __init_handle(struct shim_handle_map* map, FDTYPE fd, struct shim_handle* hdl,
                          int fd_flags) {
-    struct shim_fd_handle* new_handle = *fdhdl;
+    assert(locked(&map->lock));
     assert((fd_flags & ~FD_CLOEXEC) == 0);  // The only supported flag right now
 
+    struct shim_fd_handle** chunk = map->map[fd / FD_CHUNK_SIZE];
+    if (!chunk) {
+        chunk = calloc(FD_CHUNK_SIZE, sizeof(*chunk));
+        if (!chunk)
+            return -ENOMEM;
+        __atomic_store_n(&map->map[fd / FD_CHUNK_SIZE], chunk, __ATOMIC_RELEASE);
+    }
+
+    struct shim_fd_handle* new_handle = chunk[fd % FD_CHUNK_SIZE];
     if (!new_handle) {
-        new_handle = malloc(sizeof(struct shim_fd_handle));
+        new_handle = calloc(1, sizeof(struct shim_fd_handle));
         if (!new_handle)
             return -ENOMEM;
-        *fdhdl = new_handle;
+        __atomic_store_n(&chunk[fd % FD_CHUNK_SIZE], new_handle, __ATOMIC_RELEASE);
     }
 
-    new_handle->vfd   = fd;
-    new_handle->flags = fd_flags;
+    new_handle->vfd = fd;
+    __atomic_store_n(&new_handle->flags, fd_flags, __ATOMIC_RELAXED);
     get_handle(hdl);
-    new_handle->handle = hdl;
+    /* published last, lock-free readers only look at `handle` */
+    __atomic_store_n(&new_handle->handle, hdl, __ATOMIC_RELEASE);
     return 0;
 }
 
@@ -382,15 +529,14 @@ static int __set_new_fd_handle(FDTYPE fd, struct shim_handle* hdl, int fd_flags,
     lock(&handle_map->lock);
 
     if (handle_map->fd_top != FD_NULL) {
-        assert(handle_map->map);
         if (find_free) {
             // find first free fd
-            while (fd <= handle_map->fd_top && HANDLE_ALLOCATED(handle_map->map[fd])) {
+            while (fd <= handle_map->fd_top && HANDLE_ALLOCATED(__get_fd_entry(handle_map, fd))) {
                 fd++;
             }
         } else {
             // check if requested fd is occupied
-            if (fd <= handle_map->fd_top && HANDLE_ALLOCATED(handle_map->map[fd])) {
+            if (fd <= handle_map->fd_top && HANDLE_ALLOCATED(__get_fd_entry(handle_map, fd))) {
                 ret = -EBADF;
                 goto out;
             }
@@ -402,22 +548,7 @@ static int __set_new_fd_handle(FDTYPE fd, struct shim_handle* hdl, int fd_flags,
         goto out;
     }
 
-    // Enlarge handle_map->map (or allocate if necessary)
-    if (fd >= handle_map->fd_size) {
-        size_t new_size = handle_map->fd_size;
-        if (new_size == 0)
-            new_size = INIT_HANDLE_MAP_SIZE;
-        while (new_size <= fd)
-            new_size *= 2;
-
-        ret = __enlarge_handle_map(handle_map, new_size);
-        if (ret < 0)
-            goto out;
-    }
-
-    assert(handle_map->map);
-    assert(fd < handle_map->fd_size);
-    ret = __init_handle(&handle_map->map[fd], fd, hdl, fd_flags);
+    ret = __init_handle(handle_map, fd, hdl, fd_flags);
     if (ret < 0)
         goto out;
 
@@ -456,6 +587,9 @@ static inline __attribute__((unused)) const char* __handle_name(struct shim_hand
 }
 
 void get_handle(struct shim_handle* hdl) {
+    if (handle_ref_shard_add(hdl, 1))
+        return;
+
 #ifdef DEBUG_REF
     int ref_count = REF_INC(hdl->ref_count);
 
@@ -472,6 +606,9 @@ static void destroy_handle(struct shim_handle* hdl) {
 }
 
 void put_handle(struct shim_handle* hdl) {
+    if (handle_ref_shard_add(hdl, -1))
+        return;
+
     int ref_count = REF_DEC(hdl->ref_count);
 
 #ifdef DEBUG_REF
@@ -534,23 +671,14 @@ int get_file_size(struct shim_handle* hdl, uint64_t* size) {
     return 0;
 }
 
-static struct shim_handle_map* get_new_handle_map(FDTYPE size) {
+static struct shim_handle_map* get_new_handle_map(void) {
     struct shim_handle_map* handle_map = calloc(1, sizeof(struct shim_handle_map));
 
     if (!handle_map)
         return NULL;
 
-    handle_map->map = calloc(size, sizeof(*handle_map->map));
-
-    if (!handle_map->map) {
-        free(handle_map);
-        return NULL;
-    }
-
-    handle_map->fd_top  = FD_NULL;
-    handle_map->fd_size = size;
+    handle_map->fd_top = FD_NULL;
     if (!create_lock(&handle_map->lock)) {
-        free(handle_map->map);
         free(handle_map);
         return NULL;
     }
@@ -560,71 +688,44 @@ static struct shim_handle_map* get_new_handle_map(FDTYPE size) {
     return handle_map;
 }
 
-static int __enlarge_handle_map(struct shim_handle_map* map, size_t size) {
-    assert(locked(&map->lock));
-
-    if (size <= map->fd_size)
-        return 0;
-
-    struct shim_fd_handle** new_map = calloc(size, sizeof(new_map[0]));
-    if (!new_map)
-        return -ENOMEM;
-
-    memcpy(new_map, map->map, map->fd_size * sizeof(new_map[0]));
-    free(map->map);
-    map->map     = new_map;
-    map->fd_size = size;
-    return 0;
-}
-
 int dup_handle_map(struct shim_handle_map** new, struct shim_handle_map* old_map) {
-    lock(&old_map->lock);
-
-    /* allocate a new handle mapping with the same size as
-       the old one */
-    struct shim_handle_map* new_map = get_new_handle_map(old_map->fd_size);
+    /* allocate a new, empty handle mapping */
+    struct shim_handle_map* new_map = get_new_handle_map();
 
     if (!new_map)
         return -ENOMEM;
 
-    new_map->fd_top = old_map->fd_top;
+    int ret = 0;
+    lock(&old_map->lock);
+    lock(&new_map->lock);
 
     if (old_map->fd_top == FD_NULL)
         goto done;
 
     for (int i = 0; i <= old_map->fd_top; i++) {
-        struct shim_fd_handle* fd_old = old_map->map[i];
-        struct shim_fd_handle* fd_new;
+        struct shim_fd_handle* fd_old = __get_fd_entry(old_map, i);
 
         /* now we go through the handle map and reassign each
            of them being allocated */
         if (HANDLE_ALLOCATED(fd_old)) {
-            /* first, get the handle to prevent it from being deleted */
-            struct shim_handle* hdl = fd_old->handle;
-            get_handle(hdl);
-
-            fd_new = malloc(sizeof(struct shim_fd_handle));
-            if (!fd_new) {
-                for (int j = 0; j < i; j++) {
-                    put_handle(new_map->map[j]->handle);
-                    free(new_map->map[j]);
-                }
-                unlock(&old_map->lock);
-                *new = NULL;
-                free(new_map);
-                return -ENOMEM;
-            }
-
             /* DP: I assume we really need a deep copy of the handle map? */
-            new_map->map[i] = fd_new;
-            fd_new->vfd     = fd_old->vfd;
-            fd_new->handle  = hdl;
-            fd_new->flags   = fd_old->flags;
+            ret = __init_handle(new_map, i, fd_old->handle, fd_old->flags);
+            if (ret < 0)
+                break;
+            new_map->fd_top = i;
         }
     }
 
 done:
+    unlock(&new_map->lock);
     unlock(&old_map->lock);
+
+    if (ret < 0) {
+        put_handle_map(new_map);
+        *new = NULL;
+        return ret;
+    }
+
     *new = new_map;
     return 0;
 }
@@ -637,26 +738,30 @@ void put_handle_map(struct shim_handle_map* map) {
     int ref_count = REF_DEC(map->ref_count);
 
     if (!ref_count) {
-        if (map->fd_top == FD_NULL)
-            goto done;
-
-        for (int i = 0; i <= map->fd_top; i++) {
-            if (!map->map[i])
+        for (size_t i = 0; i < FD_CHUNKS_CNT; i++) {
+            struct shim_fd_handle** chunk = map->map[i];
+            if (!chunk)
                 continue;
 
-            if (map->map[i]->vfd != FD_NULL) {
-                struct shim_handle* handle = map->map[i]->handle;
+            for (size_t j = 0; j < FD_CHUNK_SIZE; j++) {
+                if (!chunk[j])
+                    continue;
 
-                if (handle)
-                    put_handle(handle);
-            }
+                if (chunk[j]->vfd != FD_NULL) {
+                    struct shim_handle* handle = chunk[j]->handle;
 
-            free(map->map[i]);
+                    if (handle) {
+                        fold_handle_ref_shards(handle);
+                        put_handle(handle);
+                    }
+                }
+
+                free(chunk[j]);
+            }
+            free(chunk);
         }
 
-    done:
         destroy_lock(&map->lock);
-        free(map->map);
         free(map);
     }
 }
@@ -670,10 +775,11 @@ int walk_handle_map(int (*callback)(struct shim_fd_handle*, struct shim_handle_m
         goto done;
 
     for (int i = 0; i <= map->fd_top; i++) {
-        if (!HANDLE_ALLOCATED(map->map[i]))
+        struct shim_fd_handle* fd_handle = __get_fd_entry(map, i);
+        if (!HANDLE_ALLOCATED(fd_handle))
             continue;
 
-        if ((ret = (*callback)(map->map[i], map)) < 0)
+        if ((ret = (*callback)(fd_handle, map)) < 0)
             break;
     }
 
@@ -696,14 +802,37 @@ BEGIN_CP_FUNC(handle) {
         ADD_TO_CP_MAP(obj, off);
         new_hdl = (struct shim_handle*)(base + off);
 
+        /* the child cannot share LibOS memory, switch in-memory pipes and eventfds to host ones */
+        if (hdl->type == TYPE_PIPE || hdl->type == TYPE_EVENTFD) {
+            int ret = hdl->type == TYPE_PIPE ? mem_pipe_move_to_host(hdl)
+                                             : eventfd_move_to_host(hdl);
+            if (ret < 0)
+                return ret;
+        }
+
         lock(&hdl->lock);
         *new_hdl = *hdl;
 
         if (hdl->fs && hdl->fs->fs_ops && hdl->fs->fs_ops->checkout)
             hdl->fs->fs_ops->checkout(new_hdl);
 
+        if (new_hdl->type == TYPE_PIPE)
+            new_hdl->info.pipe.mem = NULL;
+
+        if (new_hdl->type == TYPE_EVENTFD) {
+            /* an eventfd kept in LibOS is copied, its event is recreated on restore */
+            if (!new_hdl->info.eventfd.on_host)
+                new_hdl->pal_handle = NULL;
+            memset(&new_hdl->info.eventfd.event, 0, sizeof(new_hdl->info.eventfd.event));
+            new_hdl->info.eventfd.signaled = false;
+            INIT_LISTP(&new_hdl->info.eventfd.waiters);
+        }
+
         new_hdl->dentry = NULL;
         REF_SET(new_hdl->ref_count, 0);
+        new_hdl->ref_shards_state = REF_SHARDS_OFF;
+        new_hdl->ref_owner_tid = 0;
+        memset(new_hdl->ref_shards, 0, sizeof(new_hdl->ref_shards));
         clear_lock(&new_hdl->lock);
 
         DO_CP(fs, hdl->fs, &new_hdl->fs);
@@ -713,11 +842,14 @@ BEGIN_CP_FUNC(handle) {
         if (hdl->dentry) {
             if (hdl->dentry->type == S_IFDIR) {
                 /*
-                 * We don't checkpoint children dentries of a directory dentry, so the child process
-                 * will need to list the directory again. However, we keep `dir_info.pos` unchanged
-                 * so that `getdents/getdents64` will resume from the same place.
+                 * We don't checkpoint the directory listing, so the child process will need to list
+                 * the directory again. However, we keep `dir_info.pos` unchanged so that
+                 * `getdents/getdents64` will resume from the same place.
                  */
-                new_hdl->dir_info.dents = NULL;
+                new_hdl->dir_info.dot = NULL;
+                new_hdl->dir_info.dotdot = NULL;
+                new_hdl->dir_info.names = NULL;
+                new_hdl->dir_info.name_offs = NULL;
                 new_hdl->dir_info.count = 0;
             }
             DO_CP_MEMBER(dentry, hdl, new_hdl, dentry);
@@ -742,6 +874,15 @@ BEGIN_CP_FUNC(handle) {
                 DO_CP(epoll_item, &hdl->info.epoll.fds, &new_hdl->info.epoll.fds);
                 __atomic_store_n(&new_hdl->info.epoll.waiter_cnt, 0, __ATOMIC_RELAXED);
                 memset(&new_hdl->info.epoll.event, '\0', sizeof(new_hdl->info.epoll.event));
+                /* rebuilt on restore */
+                INIT_LISTP(&new_hdl->info.epoll.ready);
+                new_hdl->info.epoll.pal_set = NULL;
+                new_hdl->info.epoll.pal_set_stale = false;
+                /* host wait sets are not inherited, the child creates its own on restore (unless
+                 * this epoll already fell back to the snapshot, e.g. because of dup-ed FDs) */
+                new_hdl->info.epoll.pal_waitset = NULL;
+                new_hdl->info.epoll.use_waitset = hdl->info.epoll.use_waitset;
+                INIT_LISTP(&new_hdl->info.epoll.removed);
                 break;
             case TYPE_SOCK:
                 /* no support for multiple processes sharing options/peek buffer of the socket */
@@ -793,9 +934,38 @@ BEGIN_RS_FUNC(handle) {
             size_t count = 0;
             LISTP_FOR_EACH_ENTRY(epoll_item, &hdl->info.epoll.fds, list) {
                 epoll_item->epoll = hdl;
+                if (epoll_item->revents) {
+                    INIT_LIST_HEAD(epoll_item, ready);
+                    LISTP_ADD_TAIL(epoll_item, &hdl->info.epoll.ready, ready);
+                }
                 count++;
             }
             assert(hdl->info.epoll.fds_count == count);
+
+            if (hdl->info.epoll.use_waitset) {
+                hdl->info.epoll.use_waitset = false;
+                create_epoll_waitset(&hdl->info.epoll);
+                /* items are registered on the first wait, their PAL handles may not exist yet */
+                hdl->info.epoll.pal_set_stale = true;
+            }
+            break;
+        }
+        case TYPE_EVENTFD: {
+            if (hdl->info.eventfd.on_host)
+                break;
+
+            int ret = create_event(&hdl->info.eventfd.event);
+            if (ret < 0) {
+                return ret;
+            }
+            if (hdl->info.eventfd.val) {
+                ret = set_event(&hdl->info.eventfd.event, 1);
+                if (ret < 0) {
+                    return ret;
+                }
+                hdl->info.eventfd.signaled = true;
+            }
+            hdl->pal_handle = event_handle(&hdl->info.eventfd.event);
             break;
         }
         default:
@@ -831,36 +1001,36 @@ BEGIN_CP_FUNC(handle_map) {
 
     struct shim_handle_map* handle_map     = (struct shim_handle_map*)obj;
     struct shim_handle_map* new_handle_map = NULL;
-    struct shim_fd_handle** ptr_array;
 
     lock(&handle_map->lock);
 
-    int fd_size = handle_map->fd_top != FD_NULL ? handle_map->fd_top + 1 : 0;
-
-    size = sizeof(struct shim_handle_map) + (sizeof(struct shim_fd_handle*) * fd_size);
-
     size_t off = GET_FROM_CP_MAP(obj);
 
     if (!off) {
-        off            = ADD_CP_OFFSET(size);
+        off            = ADD_CP_OFFSET(sizeof(struct shim_handle_map));
         new_handle_map = (struct shim_handle_map*)(base + off);
 
         *new_handle_map = *handle_map;
-
-        ptr_array = (void*)new_handle_map + sizeof(struct shim_handle_map);
-
-        new_handle_map->fd_size = fd_size;
-        new_handle_map->map     = fd_size ? ptr_array : NULL;
+        memset(new_handle_map->map, 0, sizeof(new_handle_map->map));
 
         REF_SET(new_handle_map->ref_count, 0);
         clear_lock(&new_handle_map->lock);
 
-        for (int i = 0; i < fd_size; i++) {
-            if (HANDLE_ALLOCATED(handle_map->map[i]))
-                DO_CP(fd_handle, handle_map->map[i], &ptr_array[i]);
-            else
-                ptr_array[i] = NULL;
-        }
+        if (handle_map->fd_top != FD_NULL)
+            for (int i = 0; i <= handle_map->fd_top; i++) {
+                struct shim_fd_handle* fd_handle = __get_fd_entry(handle_map, i);
+                if (!HANDLE_ALLOCATED(fd_handle))
+                    continue;
+
+                /* only chunks with allocated descriptors are checkpointed */
+                struct shim_fd_handle*** chunk = &new_handle_map->map[i / FD_CHUNK_SIZE];
+                if (!*chunk) {
+                    size_t chunk_size = FD_CHUNK_SIZE * sizeof(**chunk);
+                    *chunk = (struct shim_fd_handle**)(base + ADD_CP_OFFSET(chunk_size));
+                    memset(*chunk, 0, chunk_size);
+                }
+                DO_CP(fd_handle, fd_handle, &(*chunk)[i % FD_CHUNK_SIZE]);
+            }
 
         ADD_CP_FUNC_ENTRY(off);
     } else {
@@ -879,9 +1049,8 @@ BEGIN_RS_FUNC(handle_map) {
     __UNUSED(offset);
 
     CP_REBASE(handle_map->map);
-    assert(handle_map->map);
 
-    DEBUG_RS("size=%d,top=%d", handle_map->fd_size, handle_map->fd_top);
+    DEBUG_RS("top=%d", handle_map->fd_top);
 
     if (!create_lock(&handle_map->lock)) {
         return -ENOMEM;
@@ -890,10 +1059,15 @@ BEGIN_RS_FUNC(handle_map) {
 
     if (handle_map->fd_top != FD_NULL)
         for (int i = 0; i <= handle_map->fd_top; i++) {
-            CP_REBASE(handle_map->map[i]);
-            if (HANDLE_ALLOCATED(handle_map->map[i])) {
-                CP_REBASE(handle_map->map[i]->handle);
-                struct shim_handle* hdl = handle_map->map[i]->handle;
+            struct shim_fd_handle** chunk = handle_map->map[i / FD_CHUNK_SIZE];
+            if (!chunk)
+                continue;
+
+            struct shim_fd_handle** entry = &chunk[i % FD_CHUNK_SIZE];
+            CP_REBASE(*entry);
+            if (HANDLE_ALLOCATED(*entry)) {
+                CP_REBASE((*entry)->handle);
+                struct shim_handle* hdl = (*entry)->handle;
                 assert(hdl);
                 get_handle(hdl);
                 DEBUG_RS("[%d]%s", i, qstrempty(&hdl->uri) ? hdl->fs_type : qstrgetstr(&hdl->uri));
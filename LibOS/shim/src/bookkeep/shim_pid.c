@@ -41,6 +41,10 @@ static bool id_range_cmp(struct avl_tree_node* _a, struct avl_tree_node* _b) {
 static struct id_range* g_last_range = NULL;
 static struct avl_tree g_used_ranges_tree = { .cmp = id_range_cmp };
 static IDTYPE g_last_used_id = 0;
+/* Rest of the ID block of this process (see #ipc_alloc_id_range) not yet used for its own ranges or
+ * delegated to a child; empty if `g_pool_start` is 0. */
+static IDTYPE g_pool_start = 0;
+static IDTYPE g_pool_end = 0;
 static struct shim_lock g_ranges_lock;
 
 int init_id_ranges(IDTYPE preload_tid) {
@@ -48,6 +52,10 @@ int init_id_ranges(IDTYPE preload_tid) {
         return -ENOMEM;
     }
 
+    /* the parent delegated a part of its ID block; `init_ipc_worker` takes over its ownership */
+    g_pool_start = g_process_ipc_ids.id_block_start;
+    g_pool_end = g_process_ipc_ids.id_block_end;
+
     if (!preload_tid) {
         return 0;
     }
@@ -66,6 +74,40 @@ int init_id_ranges(IDTYPE preload_tid) {
     return 0;
 }
 
+/* Takes up to `size` IDs from the start of the pool, refilling it from the IPC leader if it is
+ * empty. */
+static int take_from_pool(IDTYPE size, IDTYPE* out_start, IDTYPE* out_end) {
+    assert(locked(&g_ranges_lock));
+    assert(size);
+
+    if (!g_pool_start) {
+        int ret = ipc_alloc_id_range(&g_pool_start, &g_pool_end);
+        if (ret < 0) {
+            g_pool_start = 0;
+            return ret;
+        }
+        assert(0 < g_pool_start && g_pool_start <= g_pool_end);
+    }
+
+    *out_start = g_pool_start;
+    if (g_pool_end - g_pool_start < size) {
+        *out_end = g_pool_end;
+        g_pool_start = 0;
+        g_pool_end = 0;
+    } else {
+        *out_end = g_pool_start + size - 1;
+        g_pool_start += size;
+    }
+    return 0;
+}
+
+int delegate_id_block(IDTYPE* out_start, IDTYPE* out_end) {
+    lock(&g_ranges_lock);
+    int ret = take_from_pool(DELEGATED_ID_BLOCK_SIZE, out_start, out_end);
+    unlock(&g_ranges_lock);
+    return ret;
+}
+
 IDTYPE get_new_id(bool remove_from_owned) {
     IDTYPE ret_id = 0;
     lock(&g_ranges_lock);
@@ -77,7 +119,7 @@ IDTYPE get_new_id(bool remove_from_owned) {
         }
         IDTYPE start;
         IDTYPE end;
-        int ret = ipc_alloc_id_range(&start, &end);
+        int ret = take_from_pool(MAX_RANGE_SIZE, &start, &end);
         if (ret < 0) {
             log_debug("Failed to allocate new id range: %d", ret);
             free(g_last_range);
@@ -180,3 +222,19 @@ void release_id(IDTYPE id) {
     }
     unlock(&g_ranges_lock);
 }
+
+void release_id_pool(void) {
+    lock(&g_ranges_lock);
+    IDTYPE start = g_pool_start;
+    IDTYPE end = g_pool_end;
+    g_pool_start = 0;
+    g_pool_end = 0;
+    unlock(&g_ranges_lock);
+
+    if (start) {
+        int ret = ipc_release_id_range(start, end);
+        if (ret < 0) {
+            log_debug("Failed to release unused IDs [%u..%u]: %d", start, end, ret);
+        }
+    }
+}
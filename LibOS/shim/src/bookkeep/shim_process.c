@@ -3,6 +3,8 @@
  *                    Borys Popławski <borysp@invisiblethingslab.com>
  */
 
+#include <linux/wait.h>
+
 #include "api.h"
 #include "list.h"
 #include "pal.h"
@@ -16,7 +18,7 @@
 #include "shim_thread.h"
 #include "shim_utils.h"
 
-typedef bool (*child_cmp_t)(const struct shim_child_process*, unsigned long);
+typedef struct shim_child_process* (*child_lookup_t)(IDTYPE);
 
 struct shim_process g_process = { .pid = 0 };
 
@@ -40,6 +42,7 @@ int init_process(int argc, const char** argv) {
 
     INIT_LISTP(&g_process.children);
     INIT_LISTP(&g_process.zombies);
+    g_process.children_by_pid = NULL;
 
     g_process.wait_queue = NULL;
 
@@ -102,58 +105,105 @@ void add_child_process(struct shim_child_process* child) {
     assert(LIST_EMPTY(child, list));
     lock(&g_process.children_lock);
     LISTP_ADD(child, &g_process.children, list);
+    HASH_ADD(hh, g_process.children_by_pid, pid, sizeof(child->pid), child);
     unlock(&g_process.children_lock);
 }
 
-static bool cmp_child_by_vmid(const struct shim_child_process* child, unsigned long arg) {
-    IDTYPE vmid = (IDTYPE)arg;
-    return child->vmid == vmid;
+struct shim_child_process* find_child_process(IDTYPE pid) {
+    assert(locked(&g_process.children_lock));
+
+    struct shim_child_process* child = NULL;
+    HASH_FIND(hh, g_process.children_by_pid, &pid, sizeof(pid), child);
+    return child;
+}
+
+void reap_child_process(struct shim_child_process* child) {
+    assert(locked(&g_process.children_lock));
+    assert(child->exited);
+
+    LISTP_DEL_INIT(child, &g_process.zombies, list);
+    HASH_DEL(g_process.children_by_pid, child);
+    destroy_child_process(child);
+}
+
+bool child_matches_wait(const struct shim_child_process* child, int which, IDTYPE id,
+                        int options) {
+    if (!(options & __WALL)
+            && (!!(options & __WCLONE)) == (child->child_termination_signal == SIGCHLD)) {
+        return false;
+    }
+
+    switch (which) {
+        case P_PID:
+            return child->pid == id;
+        case P_PGID:
+            /* TODO: this makes no sense, until we implement IPC pgid change. */
+            return false;
+        case P_ALL:
+            return true;
+        default:
+            /* Impossible. */
+            BUG();
+    }
+}
+
+static struct shim_child_process* lookup_running_child_by_vmid(IDTYPE vmid) {
+    struct shim_child_process* child;
+    LISTP_FOR_EACH_ENTRY(child, &g_process.children, list) {
+        if (child->vmid == vmid) {
+            return child;
+        }
+    }
+    return NULL;
 }
 
-static bool cmp_child_by_pid(const struct shim_child_process* child, unsigned long arg) {
-    IDTYPE pid = (IDTYPE)arg;
-    return child->pid == pid;
+static struct shim_child_process* lookup_running_child_by_pid(IDTYPE pid) {
+    struct shim_child_process* child = find_child_process(pid);
+    return child && !child->exited ? child : NULL;
 }
 
-static bool mark_child_exited(child_cmp_t child_cmp, unsigned long arg, IDTYPE child_uid,
+static bool mark_child_exited(child_lookup_t child_lookup, IDTYPE id, IDTYPE child_uid,
                               int exit_code, int signal) {
-    bool ret = false;
-    int parent_signal = 0;
-    IDTYPE child_pid = 0;
-    struct shim_thread_queue* wait_queue = NULL;
+    struct shim_child_waiter* woken = NULL;
 
     lock(&g_process.children_lock);
 
-    struct shim_child_process* child = NULL;
-    struct shim_child_process* tmp = NULL;
-    LISTP_FOR_EACH_ENTRY_SAFE(child, tmp, &g_process.children, list) {
-        if (child_cmp(child, arg)) {
-            child->exit_code = exit_code;
-            child->term_signal = signal;
-            child->uid = child_uid;
-
-            LISTP_DEL(child, &g_process.children, list);
-            /* TODO: if SIGCHLD is ignored or has SA_NOCLDWAIT flag set, then the child should not
-             * become a zombie. */
-            LISTP_ADD(child, &g_process.zombies, list);
-
-            parent_signal = child->child_termination_signal;
-            child_pid = child->pid;
-
-            wait_queue = g_process.wait_queue;
-            g_process.wait_queue = NULL;
-
-            ret = true;
-            break;
+    struct shim_child_process* child = child_lookup(id);
+    if (!child) {
+        unlock(&g_process.children_lock);
+        return false;
+    }
+
+    child->exited = true;
+    child->exit_code = exit_code;
+    child->term_signal = signal;
+    child->uid = child_uid;
+
+    LISTP_DEL(child, &g_process.children, list);
+    /* TODO: if SIGCHLD is ignored or has SA_NOCLDWAIT flag set, then the child should not
+     * become a zombie. */
+    LISTP_ADD(child, &g_process.zombies, list);
+
+    /* Take off the queue only the threads which can reap this child; the others keep sleeping. */
+    struct shim_child_waiter** waiter_ptr = &g_process.wait_queue;
+    while (*waiter_ptr) {
+        struct shim_child_waiter* waiter = *waiter_ptr;
+        if (child_matches_wait(child, waiter->which, waiter->id, waiter->options)) {
+            *waiter_ptr = waiter->next;
+            waiter->next = woken;
+            woken = waiter;
+        } else {
+            waiter_ptr = &waiter->next;
         }
     }
 
     /* We send signal to our process while still holding the lock, so that no thread is able to
      * see 0 pending signals but still get an exited child info. */
+    int parent_signal = child->child_termination_signal;
     if (parent_signal) {
         siginfo_t info = {0};
         info.si_signo = parent_signal;
-        info.si_pid = child_pid;
+        info.si_pid = child->pid;
         info.si_uid = child_uid;
         fill_siginfo_code_and_status(&info, signal, exit_code);
         int x = kill_current_proc(&info);
@@ -164,10 +214,10 @@ static bool mark_child_exited(child_cmp_t child_cmp, unsigned long arg, IDTYPE c
 
     unlock(&g_process.children_lock);
 
-    while (wait_queue) {
-        struct shim_thread_queue* next = wait_queue->next;
-        struct shim_thread* thread = wait_queue->thread;
-        __atomic_store_n(&wait_queue->in_use, false, __ATOMIC_RELEASE);
+    while (woken) {
+        struct shim_child_waiter* next = woken->next;
+        struct shim_thread* thread = woken->thread;
+        __atomic_store_n(&woken->in_use, false, __ATOMIC_RELEASE);
         /* In theory the atomic release store above does not prevent hoisting of code to before it.
          * Here we rely on the order: first store to `in_use`, then wake the thread. Let's add
          * a compiler barrier to prevent compiler from messing with this (e.g. if `thread_wakeup`
@@ -175,33 +225,24 @@ static bool mark_child_exited(child_cmp_t child_cmp, unsigned long arg, IDTYPE c
         COMPILER_BARRIER();
         thread_wakeup(thread);
         put_thread(thread);
-        wait_queue = next;
+        woken = next;
     }
 
-    return ret;
+    return true;
 }
 
 bool mark_child_exited_by_vmid(IDTYPE vmid, IDTYPE child_uid, int exit_code, int signal) {
-    return mark_child_exited(cmp_child_by_vmid, (unsigned long)vmid, child_uid, exit_code, signal);
+    return mark_child_exited(lookup_running_child_by_vmid, vmid, child_uid, exit_code, signal);
 }
 
 bool mark_child_exited_by_pid(IDTYPE pid, IDTYPE child_uid, int exit_code, int signal) {
-    return mark_child_exited(cmp_child_by_pid, (unsigned long)pid, child_uid, exit_code, signal);
+    return mark_child_exited(lookup_running_child_by_pid, pid, child_uid, exit_code, signal);
 }
 
 bool is_zombie_process(IDTYPE pid) {
-    bool found = false;
     lock(&g_process.children_lock);
-
-    struct shim_child_process* zombie;
-    LISTP_FOR_EACH_ENTRY(zombie, &g_process.zombies, list) {
-        if (zombie->pid == pid) {
-            found = true;
-            goto out;
-        }
-    }
-
-out:
+    struct shim_child_process* child = find_child_process(pid);
+    bool found = child && child->exited;
     unlock(&g_process.children_lock);
     return found;
 }
@@ -246,10 +287,13 @@ BEGIN_CP_FUNC(process_description) {
     DO_CP_MEMBER(dentry, process, new_process, cwd);
     new_process->umask = process->umask;
 
-    DO_CP_MEMBER(handle, process, new_process, exec);
+    /* a process spawned only to report the exit of a vfork child has no executable */
+    if (process->exec)
+        DO_CP_MEMBER(handle, process, new_process, exec);
 
     INIT_LISTP(&new_process->children);
     INIT_LISTP(&new_process->zombies);
+    new_process->children_by_pid = NULL;
 
     clear_lock(&new_process->fs_lock);
     clear_lock(&new_process->children_lock);
@@ -262,6 +306,7 @@ BEGIN_CP_FUNC(process_description) {
     LISTP_FOR_EACH_ENTRY(child, &process->children, list) {
         children[i] = *child;
         INIT_LIST_HEAD(&children[i], list);
+        memset(&children[i].hh, 0, sizeof(children[i].hh));
         i++;
     }
 
@@ -275,6 +320,7 @@ BEGIN_CP_FUNC(process_description) {
     LISTP_FOR_EACH_ENTRY(zombie, &process->zombies, list) {
         zombies[i] = *zombie;
         INIT_LIST_HEAD(&zombies[i], list);
+        memset(&zombies[i].hh, 0, sizeof(zombies[i].hh));
         i++;
     }
 
@@ -316,6 +362,7 @@ BEGIN_RS_FUNC(process_description) {
 
     INIT_LISTP(&process->children);
     INIT_LISTP(&process->zombies);
+    process->children_by_pid = NULL;
 
     char* data_ptr = (char*)process + sizeof(*process);
     size_t children_count = *(size_t*)data_ptr;
@@ -324,6 +371,7 @@ BEGIN_RS_FUNC(process_description) {
     data_ptr += children_count * sizeof(*children);
     for (size_t i = 0; i < children_count; i++) {
         LISTP_ADD_TAIL(&children[i], &process->children, list);
+        HASH_ADD(hh, process->children_by_pid, pid, sizeof(children[i].pid), &children[i]);
     }
 
     size_t zombies_count = *(size_t*)data_ptr;
@@ -332,6 +380,7 @@ BEGIN_RS_FUNC(process_description) {
     data_ptr += zombies_count * sizeof(*zombies);
     for (size_t i = 0; i < zombies_count; i++) {
         LISTP_ADD_TAIL(&zombies[i], &process->zombies, list);
+        HASH_ADD(hh, process->children_by_pid, pid, sizeof(zombies[i].pid), &zombies[i]);
     }
 
     g_process = *process;
@@ -138,14 +138,34 @@ static bool has_standard_signal(struct shim_signal* signal_slot) {
     return signal_slot->siginfo.si_signo != 0;
 }
 
+/*
+ * Signal masks and `pending_mask` of signal queues fit in a single word, so they are read without
+ * any locks. Signal masks are written only by their own thread (or before the thread starts).
+ * `pending_mask` is still written under the lock of its queue, but atomically.
+ *
+ * A thread changing its signal mask and another thread queueing a signal for it do not need a lock
+ * either: the former stores the mask and then checks the pending signals (on syscall return, in
+ * `handle_signal()`), the latter adds the signal and then checks the mask. Both sides use full
+ * barriers (sequentially consistent store / locked RMW), so at least one of them sees the other.
+ */
+static_assert(sizeof(__sigset_t) == sizeof(unsigned long), "sigset must be a single word");
+
+static void pending_mask_add(struct shim_signal_queue* queue, int sig) {
+    __atomic_or_fetch(&queue->pending_mask.__val[0], __sigmask(sig), __ATOMIC_SEQ_CST);
+}
+
+static void pending_mask_del(struct shim_signal_queue* queue, int sig) {
+    __atomic_and_fetch(&queue->pending_mask.__val[0], ~__sigmask(sig), __ATOMIC_SEQ_CST);
+}
+
 static void recalc_pending_mask(struct shim_signal_queue* queue, int sig) {
     if (sig < SIGRTMIN) {
         if (!has_standard_signal(&queue->standard_signals[sig - 1])) {
-            __sigdelset(&queue->pending_mask, sig);
+            pending_mask_del(queue, sig);
         }
     } else {
         if (is_rt_sq_empty(&queue->rt_signal_queues[sig - SIGRTMIN])) {
-            __sigdelset(&queue->pending_mask, sig);
+            pending_mask_del(queue, sig);
         }
     }
 }
@@ -160,13 +180,9 @@ void get_all_pending_signals(__sigset_t* set) {
         return;
     }
 
-    lock(&current->lock);
-    lock(&g_process_signal_queue_lock);
-
-    __sigorset(set, &current->signal_queue.pending_mask, &g_process_signal_queue.pending_mask);
-
-    unlock(&g_process_signal_queue_lock);
-    unlock(&current->lock);
+    set->__val[0] = __atomic_load_n(&current->signal_queue.pending_mask.__val[0], __ATOMIC_ACQUIRE)
+                    | __atomic_load_n(&g_process_signal_queue.pending_mask.__val[0],
+                                      __ATOMIC_ACQUIRE);
 }
 
 bool have_pending_signals(void) {
@@ -174,9 +190,9 @@ bool have_pending_signals(void) {
     __sigset_t set;
     get_all_pending_signals(&set);
 
-    lock(&current->lock);
-    __signotset(&set, &set, &current->signal_mask);
-    unlock(&current->lock);
+    __sigset_t mask;
+    get_sig_mask(current, &mask);
+    __signotset(&set, &set, &mask);
 
     return !__sigisemptyset(&set) || __atomic_load_n(&current->time_to_die, __ATOMIC_ACQUIRE);
 }
@@ -220,7 +236,7 @@ static bool queue_append_signal(struct shim_signal_queue* queue, struct shim_sig
     }
 
     if (ret) {
-        __sigaddset(&queue->pending_mask, sig);
+        pending_mask_add(queue, sig);
     }
 
     return ret;
@@ -549,15 +565,15 @@ void clear_illegal_signals(__sigset_t* set) {
 void get_sig_mask(struct shim_thread* thread, __sigset_t* mask) {
     assert(thread);
 
-    *mask = thread->signal_mask;
+    mask->__val[0] = __atomic_load_n(&thread->signal_mask.__val[0], __ATOMIC_ACQUIRE);
 }
 
 void set_sig_mask(struct shim_thread* thread, const __sigset_t* set) {
     assert(thread);
     assert(set);
-    assert(locked(&thread->lock));
 
-    thread->signal_mask = *set;
+    /* sequentially consistent, see the comment above `pending_mask_add()` */
+    __atomic_store_n(&thread->signal_mask.__val[0], set->__val[0], __ATOMIC_SEQ_CST);
 }
 
 /* XXX: This function assumes that the stack is growing towards lower addresses. */
@@ -746,10 +762,8 @@ bool handle_signal(PAL_CONTEXT* context, __sigset_t* old_mask_ptr) {
         clear_illegal_signals(&new_mask);
 
         __sigset_t old_mask;
-        lock(&current->lock);
         get_sig_mask(current, &old_mask);
         set_sig_mask(current, &new_mask);
-        unlock(&current->lock);
 
         prepare_sigframe(context, &signal.siginfo, handler, sa->sa_restorer,
                          !!(sa->sa_flags & SA_ONSTACK), old_mask_ptr ?: &old_mask);
@@ -24,10 +24,51 @@
 #include "shim_signal.h"
 #include "shim_thread.h"
 #include "shim_vma.h"
+#include "spinlock.h"
 
-/* TODO: consider changing this list to a tree. */
 static LISTP_TYPE(shim_thread) g_thread_list = LISTP_INIT;
 struct shim_lock g_thread_list_lock;
+int g_runnable_threads_cnt = 0;
+
+/* Threads on `g_thread_list` are also hashed by TID, so that `lookup_thread` (used by signal
+ * delivery, tgkill, /proc etc.) neither scans the whole list nor takes `g_thread_list_lock`. TIDs are
+ * handed out sequentially, so plain modulo spreads them evenly. Each bucket has its own spinlock;
+ * a thread is added and removed with both `g_thread_list_lock` and the bucket lock held. */
+#define THREAD_HASH_SIZE 1024
+
+static struct thread_hash_bucket {
+    struct shim_thread* first;
+    spinlock_t lock;
+} g_thread_hash[THREAD_HASH_SIZE] = {
+    [0 ... THREAD_HASH_SIZE - 1] = {
+        .lock = INIT_SPINLOCK_UNLOCKED,
+    },
+};
+
+static struct thread_hash_bucket* thread_hash_bucket(IDTYPE tid) {
+    return &g_thread_hash[tid % THREAD_HASH_SIZE];
+}
+
+static void hash_thread(struct shim_thread* thread) {
+    struct thread_hash_bucket* bucket = thread_hash_bucket(thread->tid);
+    spinlock_lock(&bucket->lock);
+    thread->hash_next = bucket->first;
+    bucket->first = thread;
+    spinlock_unlock(&bucket->lock);
+}
+
+static void unhash_thread(struct shim_thread* thread) {
+    struct thread_hash_bucket* bucket = thread_hash_bucket(thread->tid);
+    spinlock_lock(&bucket->lock);
+    struct shim_thread** pos = &bucket->first;
+    while (*pos != thread) {
+        assert(*pos);
+        pos = &(*pos)->hash_next;
+    }
+    *pos = thread->hash_next;
+    thread->hash_next = NULL;
+    spinlock_unlock(&bucket->lock);
+}
 
 //#define DEBUG_REF
 
@@ -73,10 +114,45 @@ static struct shim_thread* alloc_new_thread(void) {
     return thread;
 }
 
+/* LibOS stacks of freed threads are kept for reuse, so that an application creating and destroying
+ * threads all the time does not pay for the bookkeeping, the allocation and the guard page of a new
+ * stack on each clone (each of which is an OCALL on SGX). */
+#define LIBOS_STACK_CACHE_SIZE 32
+static void* g_libos_stack_cache[LIBOS_STACK_CACHE_SIZE];
+static size_t g_libos_stack_cache_cnt = 0;
+static spinlock_t g_libos_stack_cache_lock = INIT_SPINLOCK_UNLOCKED;
+
+static void* get_cached_libos_stack(void) {
+    void* addr = NULL;
+    spinlock_lock(&g_libos_stack_cache_lock);
+    if (g_libos_stack_cache_cnt) {
+        addr = g_libos_stack_cache[--g_libos_stack_cache_cnt];
+    }
+    spinlock_unlock(&g_libos_stack_cache_lock);
+    return addr;
+}
+
+static bool put_cached_libos_stack(void* addr) {
+    bool cached = false;
+    spinlock_lock(&g_libos_stack_cache_lock);
+    if (g_libos_stack_cache_cnt < LIBOS_STACK_CACHE_SIZE) {
+        g_libos_stack_cache[g_libos_stack_cache_cnt++] = addr;
+        cached = true;
+    }
+    spinlock_unlock(&g_libos_stack_cache_lock);
+    return cached;
+}
+
 int alloc_thread_libos_stack(struct shim_thread* thread) {
     assert(thread->libos_stack_bottom == NULL);
 
-    void* addr = NULL;
+    void* addr = get_cached_libos_stack();
+    if (addr) {
+        /* Still bookkept and allocated, with the guard page in place. */
+        thread->libos_stack_bottom = (char*)addr + SHIM_THREAD_LIBOS_STACK_SIZE;
+        return 0;
+    }
+
     int prot = PROT_READ | PROT_WRITE;
     int flags = MAP_PRIVATE | MAP_ANONYMOUS | VMA_INTERNAL;
     int ret = bkeep_mmap_any(SHIM_THREAD_LIBOS_STACK_SIZE, prot, flags, /*file=*/NULL, /*offset=*/0,
@@ -160,9 +236,7 @@ static int init_main_thread(void) {
 
     __sigset_t set;
     __sigemptyset(&set);
-    lock(&cur_thread->lock);
     set_sig_mask(cur_thread, &set);
-    unlock(&cur_thread->lock);
 
     ret = DkEventCreate(&cur_thread->scheduler_event, /*init_signaled=*/false, /*auto_clear=*/true);
     if (ret < 0) {
@@ -194,25 +268,19 @@ int init_threading(void) {
     return init_main_thread();
 }
 
-static struct shim_thread* __lookup_thread(IDTYPE tid) {
-    assert(locked(&g_thread_list_lock));
-
-    struct shim_thread* tmp;
+struct shim_thread* lookup_thread(IDTYPE tid) {
+    struct thread_hash_bucket* bucket = thread_hash_bucket(tid);
+    struct shim_thread* thread;
 
-    LISTP_FOR_EACH_ENTRY(tmp, &g_thread_list, list) {
-        if (tmp->tid == tid) {
-            get_thread(tmp);
-            return tmp;
+    spinlock_lock(&bucket->lock);
+    for (thread = bucket->first; thread; thread = thread->hash_next) {
+        if (thread->tid == tid) {
+            get_thread(thread);
+            break;
         }
     }
+    spinlock_unlock(&bucket->lock);
 
-    return NULL;
-}
-
-struct shim_thread* lookup_thread(IDTYPE tid) {
-    lock(&g_thread_list_lock);
-    struct shim_thread* thread = __lookup_thread(tid);
-    unlock(&g_thread_list_lock);
     return thread;
 }
 
@@ -248,11 +316,9 @@ struct shim_thread* get_new_thread(void) {
     thread->signal_dispositions = cur_thread->signal_dispositions;
     get_signal_dispositions(thread->signal_dispositions);
 
-    /* No need for this lock as we have just created `thread`, but `set_sig_mask` has an assert for
-     * it. Also there is no problem with locking order as `thread` is not yet shared. */
-    lock(&thread->lock);
-    set_sig_mask(thread, &cur_thread->signal_mask);
-    unlock(&thread->lock);
+    __sigset_t mask;
+    get_sig_mask(cur_thread, &mask);
+    set_sig_mask(thread, &mask);
 
     struct shim_handle_map* map = get_thread_handle_map(cur_thread);
     assert(map);
@@ -274,6 +340,19 @@ struct shim_thread* get_new_internal_thread(void) {
     return alloc_new_thread();
 }
 
+struct shim_signal_dispositions* copy_signal_dispositions(
+        struct shim_signal_dispositions* dispositions) {
+    struct shim_signal_dispositions* copy = alloc_default_signal_dispositions();
+    if (!copy) {
+        return NULL;
+    }
+
+    lock(&dispositions->lock);
+    memcpy(copy->actions, dispositions->actions, sizeof(copy->actions));
+    unlock(&dispositions->lock);
+    return copy;
+}
+
 void get_signal_dispositions(struct shim_signal_dispositions* dispositions) {
     int ref_count = REF_INC(dispositions->ref_count);
     DEBUG_PRINT_REF_COUNT(ref_count);
@@ -304,17 +383,20 @@ void put_thread(struct shim_thread* thread) {
         assert(LIST_EMPTY(thread, list));
 
         if (thread->libos_stack_bottom) {
-            void* tmp_vma = NULL;
             char* addr = (char*)thread->libos_stack_bottom - SHIM_THREAD_LIBOS_STACK_SIZE;
-            if (bkeep_munmap(addr, SHIM_THREAD_LIBOS_STACK_SIZE, /*is_internal=*/true, &tmp_vma) < 0) {
-                log_error("[put_thread] Failed to remove bookkeeped memory at %p-%p!",
-                          addr, (char*)addr + SHIM_THREAD_LIBOS_STACK_SIZE);
-                BUG();
-            }
-            if (DkVirtualMemoryFree(addr, SHIM_THREAD_LIBOS_STACK_SIZE) < 0) {
-                BUG();
+            if (!put_cached_libos_stack(addr)) {
+                void* tmp_vma = NULL;
+                if (bkeep_munmap(addr, SHIM_THREAD_LIBOS_STACK_SIZE, /*is_internal=*/true,
+                                 &tmp_vma) < 0) {
+                    log_error("[put_thread] Failed to remove bookkeeped memory at %p-%p!",
+                              addr, (char*)addr + SHIM_THREAD_LIBOS_STACK_SIZE);
+                    BUG();
+                }
+                if (DkVirtualMemoryFree(addr, SHIM_THREAD_LIBOS_STACK_SIZE) < 0) {
+                    BUG();
+                }
+                bkeep_remove_tmp_vma(tmp_vma);
             }
-            bkeep_remove_tmp_vma(tmp_vma);
         }
 
         free(thread->groups_info.groups);
@@ -335,13 +417,19 @@ void put_thread(struct shim_thread* thread) {
         /* `signal_altstack` is provided by the user, no need for a clean up. */
 
         if (thread->robust_list) {
-            release_robust_list(thread->robust_list);
+            release_robust_list(thread->robust_list, thread->tid);
         }
 
         if (thread->scheduler_event) {
             DkObjectClose(thread->scheduler_event);
         }
 
+        free_poll_cache(thread->poll_cache);
+        free_random_state(thread->random_state);
+        free(thread->cpu_affinity);
+        free(thread->syscall_trace);
+        free(thread->spare_futex);
+
         /* `wake_queue` is only meaningful when `thread` is part of some wake up queue (is just
          * being woken up), which would imply `ref_count > 0`. */
 
@@ -373,7 +461,9 @@ void add_thread(struct shim_thread* thread) {
 
     get_thread(thread);
     LISTP_ADD_AFTER(thread, prev, &g_thread_list, list);
+    hash_thread(thread);
     unlock(&g_thread_list_lock);
+    thread_block_end();
 }
 
 /*
@@ -395,12 +485,14 @@ bool check_last_thread(bool mark_self_dead) {
     }
 
     if (mark_self_dead) {
+        unhash_thread(self);
         LISTP_DEL_INIT(self, &g_thread_list, list);
     }
 
     unlock(&g_thread_list_lock);
 
     if (mark_self_dead) {
+        thread_block_begin();
         put_thread(self);
     }
 
@@ -421,7 +513,7 @@ void cleanup_thread(IDTYPE caller, void* arg) {
         CPU_RELAX();
 
     if (thread->robust_list) {
-        release_robust_list(thread->robust_list);
+        release_robust_list(thread->robust_list, thread->tid);
         thread->robust_list = NULL;
     }
 
@@ -536,6 +628,14 @@ BEGIN_CP_FUNC(thread) {
         new_thread->handle_map = NULL;
         memset(&new_thread->signal_queue, 0, sizeof(new_thread->signal_queue));
         new_thread->robust_list = NULL;
+        new_thread->poll_cache = NULL;
+        new_thread->random_state = NULL;
+        /* sequence numbers of the VMA tree of this process mean nothing in the new one */
+        memset(&new_thread->user_range_cache, 0, sizeof(new_thread->user_range_cache));
+        new_thread->cpu_affinity = NULL;
+        new_thread->syscall_trace = NULL;
+        new_thread->spare_futex = NULL;
+        new_thread->hash_next = NULL;
         REF_SET(new_thread->ref_count, 0);
 
         DO_CP_MEMBER(signal_dispositions, thread, new_thread, signal_dispositions);
@@ -550,9 +650,10 @@ BEGIN_CP_FUNC(thread) {
             struct shim_tcb* new_tcb = new_thread->shim_tcb;
             *new_tcb = *thread->shim_tcb;
             /* don't export stale pointers */
-            new_tcb->self      = NULL;
-            new_tcb->tp        = NULL;
-            new_tcb->vma_cache = NULL;
+            new_tcb->self       = NULL;
+            new_tcb->tp         = NULL;
+            new_tcb->vma_cache  = NULL;
+            new_tcb->slab_cache = NULL;
 
             new_tcb->log_prefix[0] = '\0';
 
@@ -612,15 +713,22 @@ BEGIN_RS_FUNC(thread) {
         return ret;
     }
 
-    CP_REBASE(thread->shim_tcb);
-    CP_REBASE(thread->shim_tcb->context.regs);
+    /* a thread without TCB has no context to resume, it starts executing `g_process.exec` from
+     * scratch (see the vfork+execve fast path in shim_fork.c) */
+    if (thread->shim_tcb) {
+        CP_REBASE(thread->shim_tcb);
+        CP_REBASE(thread->shim_tcb->context.regs);
 
-    shim_tcb_t* tcb = shim_get_tcb();
-    *tcb = *thread->shim_tcb;
-    __shim_tcb_init(tcb);
+        shim_tcb_t* tcb = shim_get_tcb();
+        /* this thread may have already cached slab objects, don't lose them */
+        void* slab_cache = tcb->slab_cache;
+        *tcb = *thread->shim_tcb;
+        __shim_tcb_init(tcb);
+        tcb->slab_cache = slab_cache;
 
-    assert(tcb->context.regs);
-    set_tls(tcb->context.tls);
+        assert(tcb->context.regs);
+        set_tls(tcb->context.tls);
+    }
 
     thread->pal_handle = g_pal_control->first_thread;
 
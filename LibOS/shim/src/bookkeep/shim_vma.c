@@ -26,14 +26,14 @@
 #include "shim_tcb.h"
 #include "shim_utils.h"
 #include "shim_vma.h"
-#include "spinlock.h"
+#include "seqlock.h"
 
 /* Filter flags that will be saved in `struct shim_vma`. For example there is no need for saving
  * MAP_FIXED or unsupported flags. */
 static int filter_saved_flags(int flags) {
     return flags & (MAP_SHARED | MAP_SHARED_VALIDATE | MAP_PRIVATE | MAP_ANONYMOUS | MAP_GROWSDOWN
                     | MAP_HUGETLB | MAP_HUGE_2MB | MAP_HUGE_1GB | MAP_STACK
-                    | VMA_UNMAPPED | VMA_INTERNAL | VMA_TAINTED);
+                    | VMA_UNMAPPED | VMA_INTERNAL | VMA_TAINTED | VMA_ZERO_COPY);
 }
 
 /* TODO: split flags into internal (Graphene) and Linux; also to consider: completely remove Linux
@@ -86,19 +86,24 @@ static bool is_addr_in_vma(uintptr_t addr, struct shim_vma* vma) {
 }
 
 /* Returns whether `addr` is smaller or inside a vma (`node`). */
-static bool cmp_addr_to_vma(void* addr, struct avl_tree_node* node) {
+static inline bool cmp_addr_to_vma(uintptr_t addr, struct avl_tree_node* node) {
     struct shim_vma* vma = container_of(node, struct shim_vma, tree_node);
 
-    return (uintptr_t)addr < vma->end;
+    return addr < vma->end;
 }
 
+/* VMA lookups are on the path of most memory syscalls and user-pointer checks. */
+DEFINE_AVL_TREE_LOWER_BOUND_FN(vma_tree_lower_bound, uintptr_t, cmp_addr_to_vma)
+
 /*
  * "vma_tree" holds all vmas with the assumption that no 2 overlap (though they could be adjacent).
- * Currently we do not merge similar adjacent vmas - if we ever start doing it, this code needs
- * to be revisited as there might be some optimizations that would break due to it.
+ * Similar adjacent vmas are merged only after changing protections (see `_vma_merge_range`) - code
+ * holding a pointer to a vma in the tree must not assume that it stays there after such a change.
  */
 static struct avl_tree vma_tree = {.cmp = vma_tree_cmp};
-static spinlock_t vma_tree_lock = INIT_SPINLOCK_UNLOCKED;
+/* Writers (and readers that cannot retry) take the lock, other readers are lock-free, see
+ * `_lookup_vma_lockless`. */
+static seqlock_t vma_tree_lock = INIT_SEQLOCK_UNLOCKED;
 
 static struct shim_vma* node2vma(struct avl_tree_node* node) {
     if (!node) {
@@ -108,37 +113,71 @@ static struct shim_vma* node2vma(struct avl_tree_node* node) {
 }
 
 static struct shim_vma* _get_next_vma(struct shim_vma* vma) {
-    assert(spinlock_is_locked(&vma_tree_lock));
+    assert(seqlock_is_locked(&vma_tree_lock));
     return node2vma(avl_tree_next(&vma->tree_node));
 }
 
 static struct shim_vma* _get_prev_vma(struct shim_vma* vma) {
-    assert(spinlock_is_locked(&vma_tree_lock));
+    assert(seqlock_is_locked(&vma_tree_lock));
     return node2vma(avl_tree_prev(&vma->tree_node));
 }
 
 static struct shim_vma* _get_last_vma(void) {
-    assert(spinlock_is_locked(&vma_tree_lock));
+    assert(seqlock_is_locked(&vma_tree_lock));
     return node2vma(avl_tree_last(&vma_tree));
 }
 
 static struct shim_vma* _get_first_vma(void) {
-    assert(spinlock_is_locked(&vma_tree_lock));
+    assert(seqlock_is_locked(&vma_tree_lock));
     return node2vma(avl_tree_first(&vma_tree));
 }
 
 /* Returns the vma that contains `addr`. If there is no such vma, returns the closest vma with
  * higher address. */
 static struct shim_vma* _lookup_vma(uintptr_t addr) {
-    assert(spinlock_is_locked(&vma_tree_lock));
+    assert(seqlock_is_locked(&vma_tree_lock));
 
-    struct avl_tree_node* node = avl_tree_lower_bound_fn(&vma_tree, (void*)addr, cmp_addr_to_vma);
+    struct avl_tree_node* node = vma_tree_lower_bound(&vma_tree, addr);
     if (!node) {
         return NULL;
     }
     return container_of(node, struct shim_vma, tree_node);
 }
 
+/*
+ * Lock-free version of `_lookup_vma`; `seq` must come from `read_seqbegin(&vma_tree_lock)`.
+ * Returns false if the tree was modified (the caller must retry), otherwise stores the result in
+ * `*out_vma`.
+ *
+ * Seqlock readers normally must not follow pointers, as the pointed-to objects could be freed by
+ * a concurrent writer. VMA objects are never freed though (`vma_mgr` never returns its memory and
+ * the only non-`vma_mgr` VMAs are the initial ones, migrated before any other thread runs, and
+ * `g_enlarge_tmp_vma`). We also check the sequence before each dereference, so every followed
+ * pointer was read from a consistent tree and points to mapped memory, even if the VMA was removed
+ * since. Fields of the returned VMA are not stable and the caller must validate whatever it reads
+ * from it with `read_seqretry`.
+ */
+static bool _lookup_vma_lockless(uintptr_t addr, uint32_t seq, struct shim_vma** out_vma) {
+    struct avl_tree_node* node = __atomic_load_n(&vma_tree.root, __ATOMIC_RELAXED);
+    struct avl_tree_node* ret = NULL;
+
+    while (node) {
+        if (read_seqretry(&vma_tree_lock, seq)) {
+            return false;
+        }
+        struct shim_vma* vma = container_of(node, struct shim_vma, tree_node);
+        if (addr < __atomic_load_n(&vma->end, __ATOMIC_RELAXED)) {
+            ret = node;
+            node = __atomic_load_n(&node->left, __ATOMIC_RELAXED);
+        } else {
+            node = __atomic_load_n(&node->right, __ATOMIC_RELAXED);
+        }
+    }
+
+    *out_vma = node2vma(ret);
+    return true;
+}
+
 typedef bool (*traverse_visitor)(struct shim_vma* vma, void* visitor_arg);
 
 /*
@@ -153,7 +192,7 @@ typedef bool (*traverse_visitor)(struct shim_vma* vma, void* visitor_arg);
 // TODO: Probably other VMA functions could make use of this helper.
 static bool _traverse_vmas_in_range(uintptr_t begin, uintptr_t end, traverse_visitor visitor,
                                     void* visitor_arg) {
-    assert(spinlock_is_locked(&vma_tree_lock));
+    assert(seqlock_is_locked(&vma_tree_lock));
     assert(begin <= end);
 
     if (begin == end)
@@ -205,7 +244,7 @@ static void split_vma(struct shim_vma* old_vma, struct shim_vma* new_vma, uintpt
  */
 static int _vma_bkeep_remove(uintptr_t begin, uintptr_t end, bool is_internal,
                              struct shim_vma** new_vma_ptr, struct shim_vma** vmas_to_free) {
-    assert(spinlock_is_locked(&vma_tree_lock));
+    assert(seqlock_is_locked(&vma_tree_lock));
     assert(!new_vma_ptr || *new_vma_ptr);
     assert(IS_ALLOC_ALIGNED_PTR(begin) && IS_ALLOC_ALIGNED_PTR(end));
 
@@ -297,11 +336,11 @@ static void* _vma_malloc(size_t size) {
     if (ret < 0) {
         struct shim_vma* vmas_to_free = NULL;
 
-        spinlock_lock(&vma_tree_lock);
+        write_seqbegin(&vma_tree_lock);
         /* Since we are freeing a range we just created, additional vma is not needed. */
         ret = _vma_bkeep_remove((uintptr_t)addr, (uintptr_t)addr + size, /*is_internal=*/true, NULL,
                                 &vmas_to_free);
-        spinlock_unlock(&vma_tree_lock);
+        write_seqend(&vma_tree_lock);
         if (ret < 0) {
             log_error("Removing a vma we just created failed with %d!", ret);
             BUG();
@@ -427,6 +466,10 @@ static void remove_from_thread_vma_cache(struct shim_vma* to_remove) {
     }
 }
 
+/* Temporary VMA used while enlarging `vma_mgr`, protected by `vma_mgr_lock`. It is static (and not
+ * on the stack) so that lock-free readers of `vma_tree` never see pointers to stack memory. */
+static struct shim_vma g_enlarge_tmp_vma;
+
 static struct shim_vma* alloc_vma(void) {
     struct shim_vma* vma = get_from_thread_vma_cache();
     if (vma) {
@@ -438,14 +481,15 @@ static struct shim_vma* alloc_vma(void) {
     if (!vma) {
         /* `enlarge_mem_mgr` below will call _vma_malloc, which uses at most 1 vma - so we
          * temporarily provide it. */
-        struct shim_vma tmp_vma = {0};
+        struct shim_vma* tmp_vma = &g_enlarge_tmp_vma;
+        memset(tmp_vma, 0, sizeof(*tmp_vma));
         /* vma cache is empty, as we checked it before. */
-        if (!add_to_thread_vma_cache(&tmp_vma)) {
+        if (!add_to_thread_vma_cache(tmp_vma)) {
             log_error("Failed to add tmp vma to cache!");
             BUG();
         }
         if (!enlarge_mem_mgr(vma_mgr, size_align_up(DEFAULT_VMA_COUNT))) {
-            remove_from_thread_vma_cache(&tmp_vma);
+            remove_from_thread_vma_cache(tmp_vma);
             goto out_unlock;
         }
 
@@ -455,22 +499,22 @@ static struct shim_vma* alloc_vma(void) {
             BUG();
         }
 
-        spinlock_lock(&vma_tree_lock);
+        write_seqbegin(&vma_tree_lock);
         /* Currently `tmp_vma` is always used (added to `vma_tree`), but this assumption could
-         * easily be changed (e.g. if we implement VMAs merging).*/
-        struct avl_tree_node* node = &tmp_vma.tree_node;
+         * easily be changed. It is never merged with other vmas (see `are_vmas_mergeable`). */
+        struct avl_tree_node* node = &tmp_vma->tree_node;
         if (node->parent || vma_tree.root == node) {
             /* `tmp_vma` is in `vma_tree`, we need to migrate it. */
-            copy_vma(&tmp_vma, vma_migrate);
+            copy_vma(tmp_vma, vma_migrate);
             avl_tree_swap_node(&vma_tree, node, &vma_migrate->tree_node);
             vma_migrate = NULL;
         }
-        spinlock_unlock(&vma_tree_lock);
+        write_seqend(&vma_tree_lock);
 
         if (vma_migrate) {
             free_mem_obj_to_mgr(vma_mgr, vma_migrate);
         }
-        remove_from_thread_vma_cache(&tmp_vma);
+        remove_from_thread_vma_cache(tmp_vma);
 
         vma = get_mem_obj_from_mgr(vma_mgr);
     }
@@ -507,7 +551,7 @@ static void free_vmas_freelist(struct shim_vma* vma) {
 }
 
 static int _bkeep_initial_vma(struct shim_vma* new_vma) {
-    assert(spinlock_is_locked(&vma_tree_lock));
+    assert(seqlock_is_locked(&vma_tree_lock));
 
     struct shim_vma* tmp_vma = _lookup_vma(new_vma->begin);
     if (tmp_vma && tmp_vma->begin < new_vma->end) {
@@ -546,7 +590,7 @@ int init_vma(void) {
         copy_comment(&init_vmas[2 + i], g_pal_control->preloaded_ranges[i].comment);
     }
 
-    spinlock_lock(&vma_tree_lock);
+    write_seqbegin(&vma_tree_lock);
     int ret = 0;
     /* First of init_vmas is reserved for later usage. */
     for (size_t i = 1; i < ARRAY_SIZE(init_vmas); i++) {
@@ -572,7 +616,7 @@ int init_vma(void) {
         log_debug("Initial VMA region 0x%lx-0x%lx (%s) bookkeeped", init_vmas[i].begin,
                   init_vmas[i].end, init_vmas[i].comment);
     }
-    spinlock_unlock(&vma_tree_lock);
+    write_seqend(&vma_tree_lock);
     /* From now on if we return with an error we might leave a structure local to this function in
      * vma_tree. We do not bother with removing them - this is initialization of VMA subsystem, if
      * it fails the whole application startup fails and we should never call any of functions in
@@ -630,7 +674,7 @@ int init_vma(void) {
         }
     }
 
-    spinlock_lock(&vma_tree_lock);
+    write_seqbegin(&vma_tree_lock);
     for (size_t i = 0; i < ARRAY_SIZE(init_vmas); i++) {
         /* Skip empty areas. */
         if (init_vmas[i].begin == init_vmas[i].end) {
@@ -640,7 +684,7 @@ int init_vma(void) {
         avl_tree_swap_node(&vma_tree, &init_vmas[i].tree_node, &vmas_to_migrate_to[i]->tree_node);
         vmas_to_migrate_to[i] = NULL;
     }
-    spinlock_unlock(&vma_tree_lock);
+    write_seqend(&vma_tree_lock);
 
     for (size_t i = 0; i < ARRAY_SIZE(vmas_to_migrate_to); i++) {
         if (vmas_to_migrate_to[i]) {
@@ -652,7 +696,7 @@ int init_vma(void) {
 }
 
 static void _add_unmapped_vma(uintptr_t begin, uintptr_t end, struct shim_vma* vma) {
-    assert(spinlock_is_locked(&vma_tree_lock));
+    assert(seqlock_is_locked(&vma_tree_lock));
 
     vma->begin  = begin;
     vma->end    = end;
@@ -682,7 +726,7 @@ int bkeep_munmap(void* addr, size_t length, bool is_internal, void** tmp_vma_ptr
 
     struct shim_vma* vmas_to_free = NULL;
 
-    spinlock_lock(&vma_tree_lock);
+    write_seqbegin(&vma_tree_lock);
     int ret = _vma_bkeep_remove((uintptr_t)addr, (uintptr_t)addr + length, is_internal,
                                 vma2 ? &vma2 : NULL, &vmas_to_free);
     if (ret >= 0) {
@@ -690,7 +734,7 @@ int bkeep_munmap(void* addr, size_t length, bool is_internal, void** tmp_vma_ptr
         *tmp_vma_ptr = (void*)vma1;
         vma1 = NULL;
     }
-    spinlock_unlock(&vma_tree_lock);
+    write_seqend(&vma_tree_lock);
 
     free_vmas_freelist(vmas_to_free);
     if (vma1) {
@@ -714,9 +758,9 @@ void bkeep_remove_tmp_vma(void* _vma) {
 
     assert(vma->flags == (VMA_INTERNAL | VMA_UNMAPPED));
 
-    spinlock_lock(&vma_tree_lock);
+    write_seqbegin(&vma_tree_lock);
     avl_tree_delete(&vma_tree, &vma->tree_node);
-    spinlock_unlock(&vma_tree_lock);
+    write_seqend(&vma_tree_lock);
 
     free_vma(vma);
 }
@@ -753,7 +797,7 @@ int bkeep_mmap_fixed(void* addr, size_t length, int prot, int flags, struct shim
 
     struct shim_vma* vmas_to_free = NULL;
 
-    spinlock_lock(&vma_tree_lock);
+    write_seqbegin(&vma_tree_lock);
     int ret = 0;
     if (flags & MAP_FIXED_NOREPLACE) {
         struct shim_vma* tmp_vma = _lookup_vma(new_vma->begin);
@@ -767,7 +811,7 @@ int bkeep_mmap_fixed(void* addr, size_t length, int prot, int flags, struct shim
     if (ret >= 0) {
         avl_tree_insert(&vma_tree, &new_vma->tree_node);
     }
-    spinlock_unlock(&vma_tree_lock);
+    write_seqend(&vma_tree_lock);
 
     free_vmas_freelist(vmas_to_free);
     if (vma1) {
@@ -787,9 +831,60 @@ static void vma_update_prot(struct shim_vma* vma, int prot) {
     }
 }
 
-static int _vma_bkeep_change(uintptr_t begin, uintptr_t end, int prot, bool is_internal,
-                             struct shim_vma** new_vma_ptr1, struct shim_vma** new_vma_ptr2) {
-    assert(spinlock_is_locked(&vma_tree_lock));
+/* Returns whether `a` and `b` (which directly follows `a` in `vma_tree`) can be merged. */
+static bool are_vmas_mergeable(struct shim_vma* a, struct shim_vma* b) {
+    if (a->end != b->begin || a->prot != b->prot || a->flags != b->flags || a->file != b->file) {
+        return false;
+    }
+    /* Unmapped vmas are handed out by `bkeep_munmap` and `g_enlarge_tmp_vma` is tracked by
+     * `alloc_vma`, so these must never disappear from the tree behind their owner's back. */
+    if ((a->flags & VMA_UNMAPPED) || a == &g_enlarge_tmp_vma || b == &g_enlarge_tmp_vma) {
+        return false;
+    }
+    if (a->file && a->offset + (a->end - a->begin) != b->offset) {
+        return false;
+    }
+    return !strcmp(a->comment, b->comment);
+}
+
+/* Merges compatible adjacent vmas inside [begin, end), including the vmas directly bordering this
+ * range. Merged-away vmas are put on the `vmas_to_free` list. */
+static void _vma_merge_range(uintptr_t begin, uintptr_t end, struct shim_vma** vmas_to_free) {
+    assert(seqlock_is_locked(&vma_tree_lock));
+
+    struct shim_vma* vma = _lookup_vma(begin);
+    if (!vma) {
+        return;
+    }
+    struct shim_vma* prev = _get_prev_vma(vma);
+    if (prev) {
+        vma = prev;
+    }
+
+    while (vma && vma->begin < end) {
+        struct shim_vma* next = _get_next_vma(vma);
+        if (next && are_vmas_mergeable(vma, next)) {
+            /* `vma_tree` is ordered by `end`, so `vma` can take over the range of `next` once
+             * `next` is out of the tree. */
+            avl_tree_delete(&vma_tree, &next->tree_node);
+            vma->end = next->end;
+
+            next->next_free = *vmas_to_free;
+            *vmas_to_free = next;
+            continue;
+        }
+        vma = next;
+    }
+}
+
+/*
+ * Checks whether protections of [begin, end) can be changed to `prot`. On success returns the
+ * number of additional vmas (at most 2) that `_vma_bkeep_change` needs for splitting the vmas at
+ * the boundaries of this range. Changing protections never removes vma boundaries, so this number
+ * stays an upper bound after other ranges got changed (as long as nothing was merged meanwhile).
+ */
+static int _vma_check_change(uintptr_t begin, uintptr_t end, int prot, bool is_internal) {
+    assert(seqlock_is_locked(&vma_tree_lock));
     assert(IS_ALLOC_ALIGNED_PTR(begin) && IS_ALLOC_ALIGNED_PTR(end));
     assert(begin < end);
 
@@ -821,6 +916,9 @@ static int _vma_bkeep_change(uintptr_t begin, uintptr_t end, int prot, bool is_i
                 return -EACCES;
             }
         }
+        if ((vma->flags & VMA_ZERO_COPY) && (prot & (PROT_WRITE | PROT_EXEC))) {
+            return -EACCES;
+        }
 
         if (end <= vma->end) {
             break;
@@ -843,12 +941,36 @@ static int _vma_bkeep_change(uintptr_t begin, uintptr_t end, int prot, bool is_i
         return -ENOMEM;
     }
 
-    vma = first_vma;
+    int needed_vmas = 0;
+    /* For PROT_GROWSDOWN we just pretend that `vma->begin == begin`. */
+    if (first_vma->begin < begin && !(prot & PROT_GROWSDOWN)) {
+        needed_vmas++;
+    }
+    if (end < vma->end) {
+        needed_vmas++;
+    }
+    return needed_vmas;
+}
+
+static struct shim_vma* pop_spare_vma(struct shim_vma** spare_vmas) {
+    struct shim_vma* vma = *spare_vmas;
+    assert(vma);
+    *spare_vmas = vma->next_free;
+    return vma;
+}
+
+/* The range must have been checked with `_vma_check_change` and `spare_vmas` must hold at least
+ * as many vmas as it returned. */
+static void _vma_bkeep_change(uintptr_t begin, uintptr_t end, int prot,
+                              struct shim_vma** spare_vmas) {
+    assert(seqlock_is_locked(&vma_tree_lock));
+
+    struct shim_vma* vma = _lookup_vma(begin);
+    assert(vma && vma->begin <= begin);
 
     /* For PROT_GROWSDOWN we just pretend that `vma->begin == begin`. */
     if (vma->begin < begin && !(prot & PROT_GROWSDOWN)) {
-        struct shim_vma* new_vma1 = *new_vma_ptr1;
-        *new_vma_ptr1 = NULL;
+        struct shim_vma* new_vma1 = pop_spare_vma(spare_vmas);
 
         split_vma(vma, new_vma1, begin);
         vma_update_prot(new_vma1, prot);
@@ -858,17 +980,16 @@ static int _vma_bkeep_change(uintptr_t begin, uintptr_t end, int prot, bool is_i
         avl_tree_insert(&vma_tree, &new_vma1->tree_node);
 
         if (end < new_vma1->end) {
-            struct shim_vma* new_vma2 = *new_vma_ptr2;
-            *new_vma_ptr2 = NULL;
+            struct shim_vma* new_vma2 = pop_spare_vma(spare_vmas);
 
             split_vma(new_vma1, new_vma2, end);
             vma_update_prot(new_vma2, vma->prot);
 
             avl_tree_insert(&vma_tree, &new_vma2->tree_node);
-            return 0;
+            return;
         }
 
-        /* Error checking at the begining ensures we always have the next node. */
+        /* Error checking in `_vma_check_change` ensures we always have the next node. */
         assert(next);
         vma = next;
     }
@@ -883,61 +1004,97 @@ static int _vma_bkeep_change(uintptr_t begin, uintptr_t end, int prot, bool is_i
         if (!vma) {
             /* We've reached the very last vma. */
             assert(prev->end == end);
-            return 0;
+            return;
         }
     }
 
     if (end <= vma->begin) {
-        return 0;
+        return;
     }
 
-    struct shim_vma* new_vma2 = *new_vma_ptr2;
-    *new_vma_ptr2 = NULL;
+    struct shim_vma* new_vma2 = pop_spare_vma(spare_vmas);
 
     split_vma(vma, new_vma2, end);
     vma_update_prot(vma, prot);
 
     avl_tree_insert(&vma_tree, &new_vma2->tree_node);
-
-    return 0;
 }
 
-int bkeep_mprotect(void* addr, size_t length, int prot, bool is_internal) {
-    if (!length || !IS_ALLOC_ALIGNED(length) || !IS_ALLOC_ALIGNED_PTR(addr)) {
-        return -EINVAL;
+int bkeep_mprotect_ranges(const struct shim_vma_range* ranges, size_t count, int prot,
+                          bool is_internal) {
+    for (size_t i = 0; i < count; i++) {
+        if (!ranges[i].length || !IS_ALLOC_ALIGNED(ranges[i].length)
+                || !IS_ALLOC_ALIGNED_PTR(ranges[i].addr)) {
+            return -EINVAL;
+        }
     }
 
-    struct shim_vma* vma1 = alloc_vma();
-    if (!vma1) {
-        return -ENOMEM;
-    }
-    struct shim_vma* vma2 = alloc_vma();
-    if (!vma2) {
-        free_vma(vma1);
-        return -ENOMEM;
-    }
+    struct shim_vma* spare_vmas = NULL;
+    size_t spare_count = 0;
+    struct shim_vma* vmas_to_free = NULL;
+    int ret;
 
-    spinlock_lock(&vma_tree_lock);
-    int ret = _vma_bkeep_change((uintptr_t)addr, (uintptr_t)addr + length, prot, is_internal, &vma1,
-                                &vma2);
-    spinlock_unlock(&vma_tree_lock);
+    /* Vmas cannot be allocated while holding `vma_tree_lock`, so we count the vmas needed for
+     * splitting first and, if we do not have enough of them, allocate more and retry. */
+    while (1) {
+        size_t needed_vmas = 0;
+        ret = 0;
 
-    if (vma1) {
-        free_vma(vma1);
-    }
-    if (vma2) {
-        free_vma(vma2);
+        write_seqbegin(&vma_tree_lock);
+        for (size_t i = 0; i < count; i++) {
+            uintptr_t begin = (uintptr_t)ranges[i].addr;
+            ret = _vma_check_change(begin, begin + ranges[i].length, prot, is_internal);
+            if (ret < 0) {
+                break;
+            }
+            needed_vmas += ret;
+        }
+
+        if (ret >= 0 && needed_vmas <= spare_count) {
+            /* Merging removes vma boundaries, so it must not happen before all splits are done. */
+            for (size_t i = 0; i < count; i++) {
+                uintptr_t begin = (uintptr_t)ranges[i].addr;
+                _vma_bkeep_change(begin, begin + ranges[i].length, prot, &spare_vmas);
+            }
+            for (size_t i = 0; i < count; i++) {
+                uintptr_t begin = (uintptr_t)ranges[i].addr;
+                _vma_merge_range(begin, begin + ranges[i].length, &vmas_to_free);
+            }
+            ret = 0;
+        }
+        write_seqend(&vma_tree_lock);
+
+        if (ret < 0 || needed_vmas <= spare_count) {
+            break;
+        }
+
+        for (; spare_count < needed_vmas; spare_count++) {
+            struct shim_vma* vma = alloc_vma();
+            if (!vma) {
+                ret = -ENOMEM;
+                goto out;
+            }
+            vma->next_free = spare_vmas;
+            spare_vmas = vma;
+        }
     }
 
+out:
+    free_vmas_freelist(vmas_to_free);
+    free_vmas_freelist(spare_vmas);
     return ret;
 }
 
+int bkeep_mprotect(void* addr, size_t length, int prot, bool is_internal) {
+    struct shim_vma_range range = {.addr = addr, .length = length};
+    return bkeep_mprotect_ranges(&range, 1, prot, is_internal);
+}
+
 /* TODO consider:
  * maybe it's worth to keep another tree, complementary to `vma_tree`, that would hold free areas.
  * It would give O(logn) unmapped lookup, which now is O(n) in the worst case, but it would also
  * double the memory usage of this subsystem and add some complexity.
- * Another idea is to merge adjacent vmas, that are not backed by any file and have the same prot
- * and flags (the question is whether that happens often). */
+ * Another idea is to merge adjacent vmas also here, not only after changing protections. */
 /* This function allocates at most 1 vma. If in the future it uses more, `_vma_malloc` should be
  * updated as well. */
 int bkeep_mmap_any_in_range(void* _bottom_addr, void* _top_addr, size_t length, int prot, int flags,
@@ -980,7 +1137,7 @@ int bkeep_mmap_any_in_range(void* _bottom_addr, void* _top_addr, size_t length,
     new_vma->offset = file ? offset : 0;
     copy_comment(new_vma, comment ?: "");
 
-    spinlock_lock(&vma_tree_lock);
+    write_seqbegin(&vma_tree_lock);
 
     struct shim_vma* vma = _lookup_vma(top_addr);
     uintptr_t max_addr;
@@ -1018,7 +1175,7 @@ out_found:
     new_vma = NULL;
 
 out:
-    spinlock_unlock(&vma_tree_lock);
+    write_seqend(&vma_tree_lock);
     if (new_vma) {
         free_vma(new_vma);
     }
@@ -1065,7 +1222,44 @@ int lookup_vma(void* addr, struct shim_vma_info* vma_info) {
     assert(vma_info);
     int ret = 0;
 
-    spinlock_lock(&vma_tree_lock);
+    /* Try without locking first. This only works for VMAs without a file: taking a reference to
+     * the file is not possible without preventing a concurrent removal of the VMA. */
+    while (true) {
+        uint32_t seq = read_seqbegin(&vma_tree_lock);
+        struct shim_vma* vma;
+        if (!_lookup_vma_lockless((uintptr_t)addr, seq, &vma)) {
+            continue;
+        }
+
+        bool found = false;
+        struct shim_handle* file = NULL;
+        if (vma) {
+            vma_info->addr        = (void*)__atomic_load_n(&vma->begin, __ATOMIC_RELAXED);
+            vma_info->length      = __atomic_load_n(&vma->end, __ATOMIC_RELAXED)
+                                    - (uintptr_t)vma_info->addr;
+            vma_info->prot        = __atomic_load_n(&vma->prot, __ATOMIC_RELAXED);
+            vma_info->flags       = __atomic_load_n(&vma->flags, __ATOMIC_RELAXED);
+            vma_info->file_offset = __atomic_load_n(&vma->offset, __ATOMIC_RELAXED);
+            vma_info->file        = NULL;
+            memcpy(vma_info->comment, vma->comment, sizeof(vma_info->comment));
+            file  = __atomic_load_n(&vma->file, __ATOMIC_RELAXED);
+            found = (uintptr_t)vma_info->addr <= (uintptr_t)addr;
+        }
+
+        if (read_seqretry(&vma_tree_lock, seq)) {
+            continue;
+        }
+        if (!found) {
+            return -ENOENT;
+        }
+        if (!file) {
+            vma_info->comment[sizeof(vma_info->comment) - 1] = '\0';
+            return 0;
+        }
+        break;
+    }
+
+    read_seqlock_excl(&vma_tree_lock);
     struct shim_vma* vma = _lookup_vma((uintptr_t)addr);
     if (!vma || !is_addr_in_vma((uintptr_t)addr, vma)) {
         ret = -ENOENT;
@@ -1075,7 +1269,7 @@ int lookup_vma(void* addr, struct shim_vma_info* vma_info) {
     dump_vma(vma_info, vma);
 
 out:
-    spinlock_unlock(&vma_tree_lock);
+    read_sequnlock_excl(&vma_tree_lock);
     return ret;
 }
 
@@ -1092,21 +1286,86 @@ static bool adj_visitor(struct shim_vma* vma, void* visitor_arg) {
     return is_ok;
 }
 
+/* Lock-free check of `is_in_adjacent_user_vmas`. Returns false if the tree was modified (the caller
+ * must retry), otherwise stores the result in `*out_is_ok`. On success, `*out_range` is set to the
+ * whole span of the checked VMAs and the protection they all have. */
+static bool _is_in_adjacent_user_vmas_lockless(uintptr_t begin, uintptr_t end, int prot,
+                                               uint32_t seq, bool* out_is_ok,
+                                               struct shim_user_range_cache* out_range) {
+    uintptr_t addr = begin;
+    *out_is_ok = false;
+    out_range->prot = PROT_READ | PROT_WRITE | PROT_EXEC;
+
+    while (addr < end) {
+        struct shim_vma* vma;
+        if (!_lookup_vma_lockless(addr, seq, &vma)) {
+            return false;
+        }
+        if (!vma) {
+            return true;
+        }
+
+        uintptr_t vma_begin = __atomic_load_n(&vma->begin, __ATOMIC_RELAXED);
+        uintptr_t vma_end   = __atomic_load_n(&vma->end, __ATOMIC_RELAXED);
+        int vma_prot        = __atomic_load_n(&vma->prot, __ATOMIC_RELAXED);
+        int vma_flags       = __atomic_load_n(&vma->flags, __ATOMIC_RELAXED);
+        if (vma_end <= addr) {
+            /* the VMA changed under us, don't risk looping forever */
+            return false;
+        }
+
+        if (addr < vma_begin || (vma_flags & (VMA_INTERNAL | VMA_UNMAPPED))
+                || (vma_prot & prot) != prot) {
+            return true;
+        }
+        if (addr == begin) {
+            out_range->begin = vma_begin;
+        }
+        out_range->prot &= vma_prot;
+        addr = vma_end;
+    }
+
+    out_range->end = addr;
+    *out_is_ok = true;
+    return true;
+}
+
+/*
+ * Each thread remembers the last span of VMAs accepted below, together with the VMA tree sequence
+ * number. While the tree is not modified, checks inside that span are answered without a lookup,
+ * which covers the common case of syscalls passing the same buffers again and again (read/write
+ * loops, poll arrays, stack variables).
+ */
 bool is_in_adjacent_user_vmas(const void* addr, size_t length, int prot) {
     uintptr_t begin = (uintptr_t)addr;
     uintptr_t end = begin + length;
     assert(begin <= end);
 
-    struct adj_visitor_ctx ctx = {
-        .prot = prot,
-        .is_ok = true,
-    };
+    if (begin == end) {
+        return true;
+    }
 
-    spinlock_lock(&vma_tree_lock);
-    bool is_continuous = _traverse_vmas_in_range(begin, end, adj_visitor, &ctx);
-    spinlock_unlock(&vma_tree_lock);
+    struct shim_thread* cur_thread = get_cur_thread();
+    struct shim_user_range_cache* cache = cur_thread ? &cur_thread->user_range_cache : NULL;
 
-    return is_continuous && ctx.is_ok;
+    while (true) {
+        uint32_t seq = read_seqbegin(&vma_tree_lock);
+        if (cache && cache->seq == seq && cache->begin <= begin && end <= cache->end
+                && (cache->prot & prot) == prot) {
+            return true;
+        }
+
+        bool is_ok;
+        struct shim_user_range_cache range;
+        if (_is_in_adjacent_user_vmas_lockless(begin, end, prot, seq, &is_ok, &range)
+                && !read_seqretry(&vma_tree_lock, seq)) {
+            if (is_ok && cache) {
+                range.seq = seq;
+                *cache = range;
+            }
+            return is_ok;
+        }
+    }
 }
 
 static size_t dump_all_vmas_with_buf(struct shim_vma_info* infos, size_t max_count,
@@ -1114,7 +1373,7 @@ static size_t dump_all_vmas_with_buf(struct shim_vma_info* infos, size_t max_cou
     size_t size = 0;
     struct shim_vma_info* vma_info = infos;
 
-    spinlock_lock(&vma_tree_lock);
+    read_seqlock_excl(&vma_tree_lock);
     struct shim_vma* vma;
 
     for (vma = _get_first_vma(); vma; vma = _get_next_vma(vma)) {
@@ -1128,7 +1387,7 @@ static size_t dump_all_vmas_with_buf(struct shim_vma_info* infos, size_t max_cou
         size++;
     }
 
-    spinlock_unlock(&vma_tree_lock);
+    read_sequnlock_excl(&vma_tree_lock);
 
     return size;
 }
@@ -1154,6 +1413,26 @@ int dump_all_vmas(struct shim_vma_info** ret_infos, size_t* ret_count, bool incl
     }
 }
 
+size_t dump_vmas_from(void* addr, struct shim_vma_info* infos, size_t max_count,
+                      bool include_unmapped) {
+    size_t count = 0;
+
+    read_seqlock_excl(&vma_tree_lock);
+    struct shim_vma* vma;
+
+    for (vma = _lookup_vma((uintptr_t)addr); vma && count < max_count; vma = _get_next_vma(vma)) {
+        if (vma->flags & ((include_unmapped ? 0 : VMA_UNMAPPED) | VMA_INTERNAL)) {
+            continue;
+        }
+        dump_vma(&infos[count], vma);
+        count++;
+    }
+
+    read_sequnlock_excl(&vma_tree_lock);
+
+    return count;
+}
+
 void free_vma_info_array(struct shim_vma_info* vma_infos, size_t count) {
     for (size_t i = 0; i < count; i++) {
         if (vma_infos[i].file) {
@@ -1167,6 +1446,7 @@ void free_vma_info_array(struct shim_vma_info* vma_infos, size_t count) {
 struct madvise_dontneed_ctx {
     uintptr_t begin;
     uintptr_t end;
+    bool zero_memory;
     int error;
 };
 
@@ -1194,28 +1474,118 @@ static bool madvise_dontneed_visitor(struct shim_vma* vma, void* visitor_arg) {
         return false;
     }
 
-    uintptr_t zero_start = MAX(ctx->begin, vma->begin);
-    uintptr_t zero_end = MIN(ctx->end, vma->end);
-    memset((void*)zero_start, 0, zero_end - zero_start);
+    if (ctx->zero_memory) {
+        uintptr_t zero_start = MAX(ctx->begin, vma->begin);
+        uintptr_t zero_end = MIN(ctx->end, vma->end);
+        memset((void*)zero_start, 0, zero_end - zero_start);
+    }
     return true;
 }
 
+/* Set once the PAL turns out to be unable to release memory (e.g. SGX without EDMM). */
+static bool g_discard_unsupported = false;
+
+/*
+ * Finds the first part of [`*begin`, `end`) that belongs to a single anonymous user vma and returns
+ * it in [`*begin`, `*out_end`), together with the permissions of the vma. Returns false if there is
+ * no such part.
+ */
+static bool find_anonymous_part(uintptr_t* begin, uintptr_t end, uintptr_t* out_end,
+                                int* out_prot) {
+    bool found = false;
+
+    read_seqlock_excl(&vma_tree_lock);
+    for (struct shim_vma* vma = _lookup_vma(*begin); vma && vma->begin < end;
+            vma = _get_next_vma(vma)) {
+        if (!vma->file && !(vma->flags & (VMA_UNMAPPED | VMA_INTERNAL))) {
+            *begin = MAX(*begin, vma->begin);
+            *out_end = MIN(end, vma->end);
+            *out_prot = vma->prot;
+            found = true;
+            break;
+        }
+    }
+    read_sequnlock_excl(&vma_tree_lock);
+
+    return found;
+}
+
+/*
+ * Asks the PAL to drop the contents of all anonymous writable memory in [begin, end), returning
+ * the backing memory to the host. The PAL calls may take long (with EDMM each page is trimmed),
+ * so they are done without holding the VMA lock. Returns -ENOSYS if the PAL cannot do it; the
+ * memory in [`*out_failed_at`, end) is then left untouched.
+ */
+static int discard_anonymous_memory(uintptr_t begin, uintptr_t end, uintptr_t* out_failed_at) {
+    if (__atomic_load_n(&g_discard_unsupported, __ATOMIC_RELAXED)) {
+        *out_failed_at = begin;
+        return -ENOSYS;
+    }
+
+    uintptr_t part_end;
+    int prot;
+    while (begin < end && find_anonymous_part(&begin, end, &part_end, &prot)) {
+        if (prot & PROT_WRITE) {
+            int ret = DkVirtualMemoryDiscard((void*)begin, part_end - begin,
+                                             LINUX_PROT_TO_PAL(prot, /*map_flags=*/0));
+            if (ret == -PAL_ERROR_NOTIMPLEMENTED) {
+                __atomic_store_n(&g_discard_unsupported, true, __ATOMIC_RELAXED);
+                *out_failed_at = begin;
+                return -ENOSYS;
+            }
+            if (ret < 0) {
+                /* the vma could have been changed concurrently, in which case zeroing the memory
+                 * below is as good as anything */
+                *out_failed_at = begin;
+                return pal_to_unix_errno(ret);
+            }
+        }
+        begin = part_end;
+    }
+    return 0;
+}
+
 int madvise_dontneed_range(uintptr_t begin, uintptr_t end) {
     struct madvise_dontneed_ctx ctx = {
         .begin = begin,
         .end = end,
+        .zero_memory = __atomic_load_n(&g_discard_unsupported, __ATOMIC_RELAXED),
         .error = 0,
     };
 
-    spinlock_lock(&vma_tree_lock);
+    read_seqlock_excl(&vma_tree_lock);
     bool is_continuous = _traverse_vmas_in_range(begin, end, madvise_dontneed_visitor, &ctx);
-    spinlock_unlock(&vma_tree_lock);
+    read_sequnlock_excl(&vma_tree_lock);
 
     if (!is_continuous)
         return -ENOMEM;
+    if (ctx.error < 0 || ctx.zero_memory)
+        return ctx.error;
+
+    uintptr_t failed_at;
+    if (discard_anonymous_memory(begin, end, &failed_at) < 0) {
+        /* fall back to zeroing the memory ourselves */
+        ctx.begin = failed_at;
+        ctx.zero_memory = true;
+
+        read_seqlock_excl(&vma_tree_lock);
+        is_continuous = _traverse_vmas_in_range(failed_at, end, madvise_dontneed_visitor, &ctx);
+        read_sequnlock_excl(&vma_tree_lock);
+
+        if (!is_continuous)
+            return -ENOMEM;
+    }
     return ctx.error;
 }
 
+int madvise_free_range(uintptr_t begin, uintptr_t end) {
+    /* MADV_FREE allows keeping the old contents, so there is nothing to do if the PAL cannot
+     * release the memory; other errors are ignored for the same reason */
+    uintptr_t failed_at;
+    (void)discard_anonymous_memory(begin, end, &failed_at);
+    return 0;
+}
+
 
 BEGIN_CP_FUNC(vma) {
     __UNUSED(size);
@@ -1377,7 +1747,7 @@ static void debug_print_vma(struct shim_vma* vma) {
 }
 
 void debug_print_all_vmas(void) {
-    spinlock_lock(&vma_tree_lock);
+    read_seqlock_excl(&vma_tree_lock);
 
     struct shim_vma* vma = _get_first_vma();
     while (vma) {
@@ -1385,5 +1755,5 @@ void debug_print_all_vmas(void) {
         vma = _get_next_vma(vma);
     }
 
-    spinlock_unlock(&vma_tree_lock);
+    read_sequnlock_excl(&vma_tree_lock);
 }
@@ -15,6 +15,7 @@
 #include "pal_error.h"
 #include "shim_flags_conv.h"
 #include "shim_fs.h"
+#include "shim_fs_cache.h"
 #include "shim_handle.h"
 #include "shim_internal.h"
 #include "shim_lock.h"
@@ -36,12 +37,46 @@ struct file_sync_data {
     file_off_t marker;
 };
 
+/*
+ * Attributes of directory entries, as returned by DkStreamReadDir. `chroot_readdir` keeps them in
+ * the directory data, and `chroot_lookup` of a child uses (and drops) its entry instead of querying
+ * the host again. This turns listing a directory and stat'ing each of its entries (e.g. `ls -l`)
+ * from one PAL call per entry into one PAL call per batch of entries.
+ *
+ * The entries are used only shortly after the listing: attributes of files are otherwise queried at
+ * the time of lookup, and another process might have changed the file in the meantime.
+ */
+#define PREFETCHED_ATTRS_TTL_US 1000000
+
+struct prefetched_attr {
+    UT_hash_handle hh;
+    PAL_IDX handle_type;
+    bool readable;
+    bool writable;
+    bool runnable;
+    PAL_NUM size;
+    size_t name_len;
+    char name[];
+};
+
+struct shim_prefetched_attrs {
+    uint64_t time;
+    struct prefetched_attr* table;
+};
+
+/* Number of entries read by one DkStreamReadDir call in `chroot_readdir` */
+#define READDIR_ATTRS_CNT 128
+
 static void file_sync_lock(struct shim_file_handle* file, int state) {
     struct file_sync_data data;
     bool updated = sync_lock(file->sync, state, &data, sizeof(data));
     if (updated) {
         file->size = data.size;
         file->marker = data.marker;
+        /* the handle was used by another process in the meantime, which might have written to the
+         * file */
+        if (file->data)
+            file_cache_invalidate(file->data->cache);
     }
 }
 
@@ -151,10 +186,26 @@ static struct shim_file_data* __create_data(void) {
         free(data);
         return NULL;
     }
+    data->cache = file_cache_create();
     return data;
 }
 
+static void free_prefetched_attrs(struct shim_prefetched_attrs* attrs) {
+    if (!attrs)
+        return;
+
+    struct prefetched_attr* attr;
+    struct prefetched_attr* tmp;
+    HASH_ITER(hh, attrs->table, attr, tmp) {
+        HASH_DEL(attrs->table, attr);
+        free(attr);
+    }
+    free(attrs);
+}
+
 static void __destroy_data(struct shim_file_data* data) {
+    free_prefetched_attrs(data->prefetched_attrs);
+    file_cache_destroy(data->cache);
     qstrfree(&data->host_uri);
     destroy_lock(&data->lock);
     free(data);
@@ -220,24 +271,14 @@ static int create_data(struct shim_dentry* dent, const char* uri, size_t len) {
 
 static int chroot_readdir(struct shim_dentry* dent, readdir_callback_t callback, void* arg);
 
-static int __query_attr(struct shim_dentry* dent, struct shim_file_data* data,
-                        PAL_HANDLE pal_handle) {
-    PAL_STREAM_ATTR pal_attr;
+static int __set_attr(struct shim_dentry* dent, struct shim_file_data* data,
+                      const PAL_STREAM_ATTR* pal_attr) {
     enum shim_file_type old_type = data->type;
-
     int ret;
-    if (pal_handle) {
-        ret = DkStreamAttributesQueryByHandle(pal_handle, &pal_attr);
-    } else {
-        ret = DkStreamAttributesQuery(qstrgetstr(&data->host_uri), &pal_attr);
-    }
-    if (ret < 0) {
-        return pal_to_unix_errno(ret);
-    }
 
     mode_t type;
     /* need to correct the data type */
-    switch (pal_attr.handle_type) {
+    switch (pal_attr->handle_type) {
         case PAL_TYPE_FILE:
             data->type = FILE_REGULAR;
             type = S_IFREG;
@@ -260,19 +301,19 @@ static int __query_attr(struct shim_dentry* dent, struct shim_file_data* data,
                         qstrgetstr(&data->host_uri));
             return -EACCES;
         default:
-            log_error("unexpected handle type returned by PAL: %d", pal_attr.handle_type);
+            log_error("unexpected handle type returned by PAL: %d", pal_attr->handle_type);
             BUG();
     }
 
-    mode_t perm = (pal_attr.readable ? S_IRUSR : 0) |
-                  (pal_attr.writable ? S_IWUSR : 0) |
-                  (pal_attr.runnable ? S_IXUSR : 0);
+    mode_t perm = (pal_attr->readable ? S_IRUSR : 0) |
+                  (pal_attr->writable ? S_IWUSR : 0) |
+                  (pal_attr->runnable ? S_IXUSR : 0);
     if (dent) {
         dent->type = type;
         dent->perm = perm;
     }
 
-    __atomic_store_n(&data->size.counter, pal_attr.pending_size, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&data->size.counter, pal_attr->pending_size, __ATOMIC_SEQ_CST);
 
     if (data->type == FILE_DIR) {
         /* Move up the uri update; need to convert manifest-level file:
@@ -299,6 +340,72 @@ static int __query_attr(struct shim_dentry* dent, struct shim_file_data* data,
     return 0;
 }
 
+static int __query_attr(struct shim_dentry* dent, struct shim_file_data* data,
+                        PAL_HANDLE pal_handle) {
+    PAL_STREAM_ATTR pal_attr;
+
+    int ret;
+    if (pal_handle) {
+        ret = DkStreamAttributesQueryByHandle(pal_handle, &pal_attr);
+    } else {
+        ret = DkStreamAttributesQuery(qstrgetstr(&data->host_uri), &pal_attr);
+    }
+    if (ret < 0) {
+        return pal_to_unix_errno(ret);
+    }
+
+    return __set_attr(dent, data, &pal_attr);
+}
+
+/* Take the attributes of `dent` prefetched by listing its parent, if there are any (and they are
+ * recent enough). */
+static bool take_prefetched_attr(struct shim_dentry* dent, PAL_STREAM_ATTR* pal_attr) {
+    struct shim_dentry* parent = dent->parent;
+    if (!parent || parent->mount != dent->mount)
+        return false;
+
+    struct shim_file_data* parent_data = FILE_DENTRY_DATA(parent);
+    if (!parent_data)
+        return false;
+
+    bool found = false;
+    lock(&parent_data->lock);
+    struct shim_prefetched_attrs* attrs = parent_data->prefetched_attrs;
+    if (!attrs)
+        goto out;
+
+    uint64_t now;
+    if (DkSystemTimeQuery(&now) < 0 || now - attrs->time > PREFETCHED_ATTRS_TTL_US) {
+        free_prefetched_attrs(attrs);
+        parent_data->prefetched_attrs = NULL;
+        goto out;
+    }
+
+    struct prefetched_attr* attr;
+    HASH_FIND(hh, attrs->table, dent->name, dent->name_len, attr);
+    if (!attr)
+        goto out;
+
+    memset(pal_attr, 0, sizeof(*pal_attr));
+    pal_attr->handle_type  = attr->handle_type;
+    pal_attr->readable     = attr->readable;
+    pal_attr->writable     = attr->writable;
+    pal_attr->runnable     = attr->runnable;
+    pal_attr->pending_size = attr->size;
+    found = true;
+
+    HASH_DEL(attrs->table, attr);
+    free(attr);
+    if (!attrs->table) {
+        free_prefetched_attrs(attrs);
+        parent_data->prefetched_attrs = NULL;
+    }
+
+out:
+    unlock(&parent_data->lock);
+    return found;
+}
+
 static inline int try_create_data(struct shim_dentry* dent, const char* uri, size_t len,
                                   struct shim_file_data** dataptr) {
     struct shim_file_data* data = FILE_DENTRY_DATA(dent);
@@ -324,11 +431,18 @@ static int query_dentry(struct shim_dentry* dent, PAL_HANDLE pal_handle, struct
     if ((ret = try_create_data(dent, NULL, 0, &data)) < 0)
         return ret;
 
+    PAL_STREAM_ATTR pal_attr;
+    bool prefetched = !data->queried && !pal_handle && take_prefetched_attr(dent, &pal_attr);
+
     lock(&data->lock);
 
-    if (!data->queried && (ret = __query_attr(dent, data, pal_handle)) < 0) {
-        unlock(&data->lock);
-        return ret;
+    if (!data->queried) {
+        ret = prefetched ? __set_attr(dent, data, &pal_attr)
+                         : __query_attr(dent, data, pal_handle);
+        if (ret < 0) {
+            unlock(&data->lock);
+            return ret;
+        }
     }
 
     if (stat) {
@@ -585,6 +699,64 @@ static int chroot_close(struct shim_handle* hdl) {
     return 0;
 }
 
+/* Reads at `pos` without touching the file position. Returns the number of bytes read or a negative
+ * error code. */
+static ssize_t chroot_read_at(struct shim_handle* hdl, void* buf, size_t count, file_off_t pos) {
+    struct shim_file_handle* file = &hdl->info.file;
+    struct shim_file_data* data = FILE_HANDLE_DATA(hdl);
+    ssize_t ret;
+
+    if (file->type == FILE_REGULAR && data->cache) {
+        ret = file_cache_read(data->cache, hdl->pal_handle, pos, buf, count);
+    } else if (file->type == FILE_REGULAR && g_pal_control->file_read) {
+        ret = g_pal_control->file_read(hdl->pal_handle, pos, count, buf);
+        if (ret < 0)
+            ret = pal_to_unix_errno(ret);
+    } else {
+        ret = DkStreamRead(hdl->pal_handle, pos, &count, buf, NULL, 0);
+        if (ret < 0)
+            return pal_to_unix_errno(ret);
+        if (__builtin_add_overflow(count, 0, &ret)) {
+            BUG();
+        }
+    }
+    return ret;
+}
+
+/* Writes at `pos` without touching the file position or size. Returns the number of bytes written
+ * or a negative error code. */
+static ssize_t chroot_write_at(struct shim_handle* hdl, const void* buf, size_t count,
+                               file_off_t pos) {
+    struct shim_file_handle* file = &hdl->info.file;
+    ssize_t ret;
+
+    if (file->type == FILE_REGULAR && g_pal_control->file_write) {
+        ret = g_pal_control->file_write(hdl->pal_handle, pos, count, buf);
+        if (ret >= 0)
+            count = ret;
+    } else {
+        ret = DkStreamWrite(hdl->pal_handle, pos, &count, (void*)buf, NULL);
+    }
+    if (ret < 0)
+        return pal_to_unix_errno(ret);
+
+    if (__builtin_add_overflow(count, 0, &ret)) {
+        BUG();
+    }
+    if (file->type == FILE_REGULAR)
+        file_cache_write(FILE_HANDLE_DATA(hdl)->cache, pos, buf, count);
+    return ret;
+}
+
+/* Must be called with `hdl->lock` held. */
+static void chroot_extend_size(struct shim_handle* hdl, file_off_t end) {
+    struct shim_file_handle* file = &hdl->info.file;
+    if (end > file->size) {
+        file->size = end;
+        chroot_update_size(hdl, file, FILE_HANDLE_DATA(hdl));
+    }
+}
+
 static ssize_t chroot_read(struct shim_handle* hdl, void* buf, size_t count) {
     ssize_t ret = 0;
 
@@ -612,17 +784,10 @@ static ssize_t chroot_read(struct shim_handle* hdl, void* buf, size_t count) {
     lock(&hdl->lock);
     file_sync_lock(file, SYNC_STATE_EXCLUSIVE);
 
-    ret = DkStreamRead(hdl->pal_handle, file->marker, &count, buf, NULL, 0);
-    if (ret < 0) {
-        ret = pal_to_unix_errno(ret);
-    } else {
-        if (__builtin_add_overflow(count, 0, &ret)) {
-            BUG();
-        }
-        if (file->type != FILE_TTY && file->type != FILE_DEV &&
-                __builtin_add_overflow(file->marker, count, &file->marker)) {
-            BUG();
-        }
+    ret = chroot_read_at(hdl, buf, count, file->marker);
+    if (ret > 0 && file->type != FILE_TTY && file->type != FILE_DEV &&
+            __builtin_add_overflow(file->marker, ret, &file->marker)) {
+        BUG();
     }
 
     file_sync_unlock(file);
@@ -659,26 +824,137 @@ static ssize_t chroot_write(struct shim_handle* hdl, const void* buf, size_t cou
     lock(&hdl->lock);
     file_sync_lock(file, SYNC_STATE_EXCLUSIVE);
 
-    ret = DkStreamWrite(hdl->pal_handle, file->marker, &count, (void*)buf, NULL);
-    if (ret < 0) {
-        ret = pal_to_unix_errno(ret);
-    } else {
-        if (__builtin_add_overflow(count, 0, &ret)) {
-            BUG();
-        }
+    ret = chroot_write_at(hdl, buf, count, file->marker);
+    if (ret >= 0) {
         if (file->type != FILE_TTY && file->type != FILE_DEV &&
-                __builtin_add_overflow(file->marker, count, &file->marker)) {
+                __builtin_add_overflow(file->marker, ret, &file->marker)) {
             BUG();
         }
-        if (file->marker > file->size) {
-            file->size = file->marker;
-            chroot_update_size(hdl, file, FILE_HANDLE_DATA(hdl));
+        chroot_extend_size(hdl, file->marker);
+    }
+
+    file_sync_unlock(file);
+    unlock(&hdl->lock);
+out:
+    return ret;
+}
+
+/*
+ * pread() and pwrite() do not use the file position, so unlike read() and write() they take no
+ * locks, unless the sync engine is enabled: then the handle may be shared with other processes and
+ * the file size and cache must be synchronized with them, which requires the handle lock.
+ */
+static ssize_t chroot_pread(struct shim_handle* hdl, void* buf, size_t count, file_off_t pos) {
+    ssize_t ret;
+
+    if (count == 0)
+        return 0;
+
+    if (NEED_RECREATE(hdl) && (ret = chroot_recreate(hdl)) < 0)
+        return ret;
+
+    if (!(hdl->acc_mode & MAY_READ))
+        return -EBADF;
+
+    struct shim_file_handle* file = &hdl->info.file;
+
+    file_off_t dummy_off_t;
+    if (__builtin_add_overflow(pos, count, &dummy_off_t))
+        return -EFBIG;
+
+    if (!sync_is_enabled())
+        return chroot_read_at(hdl, buf, count, pos);
+
+    lock(&hdl->lock);
+    file_sync_lock(file, SYNC_STATE_EXCLUSIVE);
+    ret = chroot_read_at(hdl, buf, count, pos);
+    file_sync_unlock(file);
+    unlock(&hdl->lock);
+    return ret;
+}
+
+static ssize_t chroot_pwrite(struct shim_handle* hdl, const void* buf, size_t count,
+                             file_off_t pos) {
+    ssize_t ret;
+
+    if (count == 0)
+        return 0;
+
+    if (NEED_RECREATE(hdl) && (ret = chroot_recreate(hdl)) < 0)
+        return ret;
+
+    if (!(hdl->acc_mode & MAY_WRITE))
+        return -EBADF;
+
+    assert(hdl->type == TYPE_FILE);
+    struct shim_file_handle* file = &hdl->info.file;
+
+    file_off_t end;
+    if (__builtin_add_overflow(pos, count, &end))
+        return -EFBIG;
+
+    if (!sync_is_enabled()) {
+        ret = chroot_write_at(hdl, buf, count, pos);
+        if (ret > 0 && pos + ret > __atomic_load_n(&file->size, __ATOMIC_RELAXED)) {
+            /* only writes past the end of file need the lock, to update the size */
+            lock(&hdl->lock);
+            chroot_extend_size(hdl, pos + ret);
+            unlock(&hdl->lock);
         }
+        return ret;
     }
 
+    lock(&hdl->lock);
+    file_sync_lock(file, SYNC_STATE_EXCLUSIVE);
+    ret = chroot_write_at(hdl, buf, count, pos);
+    if (ret > 0)
+        chroot_extend_size(hdl, pos + ret);
     file_sync_unlock(file);
     unlock(&hdl->lock);
+    return ret;
+}
+
+static ssize_t chroot_sendfile(struct shim_handle* hdl, struct shim_handle* out_hdl,
+                               file_off_t* offset, size_t count) {
+    ssize_t ret;
+
+    if (NEED_RECREATE(hdl) && (ret = chroot_recreate(hdl)) < 0)
+        return ret;
+
+    if (!(hdl->acc_mode & MAY_READ))
+        return -EBADF;
+
+    assert(hdl->type == TYPE_FILE);
+    struct shim_file_handle* file = &hdl->info.file;
+    if (file->type != FILE_REGULAR || !out_hdl->pal_handle)
+        return -EOPNOTSUPP;
+
+    lock(&hdl->lock);
+    file_sync_lock(file, SYNC_STATE_EXCLUSIVE);
+
+    file_off_t pos = offset ? *offset : file->marker;
+    file_off_t dummy_off_t;
+    if (__builtin_add_overflow(pos, count, &dummy_off_t)) {
+        ret = -EFBIG;
+        goto out;
+    }
+
+    PAL_NUM copied = count;
+    ret = DkStreamSendFile(out_hdl->pal_handle, hdl->pal_handle, pos, &copied);
+    if (ret < 0) {
+        ret = ret == -PAL_ERROR_NOTSUPPORT ? -EOPNOTSUPP : pal_to_unix_errno(ret);
+        goto out;
+    }
+
+    if (offset)
+        *offset = pos + copied;
+    else
+        file->marker = pos + copied;
+    ret = (ssize_t)copied;
+
 out:
+    file_sync_unlock(file);
+    unlock(&hdl->lock);
     return ret;
 }
 
@@ -693,6 +969,14 @@ static int chroot_mmap(struct shim_handle* hdl, void** addr, size_t size, int pr
     if (flags & MAP_ANONYMOUS)
         return -EINVAL;
 
+    if (flags & VMA_ZERO_COPY) {
+        /* read-only view outside of the process memory, see mmap_zero_copy() */
+        if (!g_pal_control->file_map_untrusted)
+            return -EOPNOTSUPP;
+        ret = g_pal_control->file_map_untrusted(hdl->pal_handle, addr, offset, size);
+        return ret == -PAL_ERROR_NOTSUPPORT ? -EOPNOTSUPP : pal_to_unix_errno(ret);
+    }
+
     return pal_to_unix_errno(DkStreamMap(hdl->pal_handle, addr, pal_prot, offset, size));
 }
 
@@ -758,6 +1042,7 @@ static int chroot_truncate(struct shim_handle* hdl, file_off_t len) {
         ret = pal_to_unix_errno(ret);
         goto out;
     }
+    file_cache_truncate(FILE_HANDLE_DATA(hdl)->cache, len);
 
     if (file->marker > len)
         file->marker = len;
@@ -779,12 +1064,46 @@ static int chroot_dput(struct shim_dentry* dent) {
     return 0;
 }
 
+/* Remember the attributes of entry `name` of `dent` for a later lookup. */
+static int add_prefetched_attr(struct shim_dentry* dent, struct shim_prefetched_attrs* attrs,
+                               const char* name, size_t name_len,
+                               const PAL_STREAM_ATTR* pal_attr) {
+    if (pal_attr->handle_type == PAL_HANDLE_TYPE_BOUND)
+        return 0;
+
+    /* Skip entries that already have a dentry: their lookup (if needed at all) should see the
+     * changes made through that dentry after this listing. */
+    struct shim_dentry* child = __lookup_dcache(dent, name, name_len, hash_buf(name, name_len));
+    if (child) {
+        put_dentry(child);
+        return 0;
+    }
+
+    struct prefetched_attr* attr = malloc(sizeof(*attr) + name_len);
+    if (!attr)
+        return -ENOMEM;
+
+    attr->handle_type = pal_attr->handle_type;
+    attr->readable    = pal_attr->readable;
+    attr->writable    = pal_attr->writable;
+    attr->runnable    = pal_attr->runnable;
+    attr->size        = pal_attr->pending_size;
+    attr->name_len    = name_len;
+    memcpy(attr->name, name, name_len);
+    HASH_ADD(hh, attrs->table, name, name_len, attr);
+    return 0;
+}
+
 static int chroot_readdir(struct shim_dentry* dent, readdir_callback_t callback, void* arg) {
+    assert(locked(&g_dcache_lock));
+
     struct shim_file_data* data = NULL;
     int ret = 0;
     PAL_HANDLE pal_hdl = NULL;
     size_t buf_size = READDIR_BUF_SIZE;
     char* buf = NULL;
+    PAL_STREAM_ATTR* pal_attrs = NULL;
+    struct shim_prefetched_attrs* attrs = NULL;
 
     if ((ret = try_create_data(dent, NULL, 0, &data)) < 0)
         return ret;
@@ -798,15 +1117,36 @@ static int chroot_readdir(struct shim_dentry* dent, readdir_callback_t callback,
     }
 
     buf = malloc(buf_size);
-    if (!buf) {
+    pal_attrs = malloc(READDIR_ATTRS_CNT * sizeof(*pal_attrs));
+    attrs = calloc(1, sizeof(*attrs));
+    if (!buf || !pal_attrs || !attrs) {
         ret = -ENOMEM;
         goto out;
     }
 
+    /* The attributes are at least as old as the start of the listing. */
+    if (DkSystemTimeQuery(&attrs->time) < 0) {
+        free(pal_attrs);
+        pal_attrs = NULL;
+    }
+
     while (1) {
         /* DkStreamRead for directory will return as many entries as fits into the buffer. */
         size_t bytes = buf_size;
-        ret = DkStreamRead(pal_hdl, 0, &bytes, buf, NULL, 0);
+        size_t attrs_cnt = 0;
+        if (pal_attrs) {
+            attrs_cnt = READDIR_ATTRS_CNT;
+            ret = DkStreamReadDir(pal_hdl, &bytes, buf, pal_attrs, &attrs_cnt);
+            if (ret == -PAL_ERROR_NOTSUPPORT) {
+                /* The PAL cannot return the attributes with the names; the lookups will query each
+                 * entry separately. */
+                free(pal_attrs);
+                pal_attrs = NULL;
+                ret = DkStreamRead(pal_hdl, 0, &bytes, buf, NULL, 0);
+            }
+        } else {
+            ret = DkStreamRead(pal_hdl, 0, &bytes, buf, NULL, 0);
+        }
         if (ret < 0) {
             ret = pal_to_unix_errno(ret);
             goto out;
@@ -818,6 +1158,7 @@ static int chroot_readdir(struct shim_dentry* dent, readdir_callback_t callback,
         assert(buf[bytes - 1] == '\0');
 
         size_t start = 0;
+        size_t idx = 0;
         while (start < bytes - 1) {
             size_t end = start;
             while (buf[end] != '\0')
@@ -830,8 +1171,18 @@ static int chroot_readdir(struct shim_dentry* dent, readdir_callback_t callback,
 
             /* By the PAL convention, if a name ends with '/', it is a directory. However, we ignore
              * that distinction here and pass the name without '/' to the callback. */
-            if (buf[end - 1] == '/')
+            size_t name_len = end - start;
+            if (buf[end - 1] == '/') {
                 buf[end - 1] = '\0';
+                name_len--;
+            }
+
+            if (pal_attrs && idx < attrs_cnt) {
+                ret = add_prefetched_attr(dent, attrs, &buf[start], name_len, &pal_attrs[idx]);
+                if (ret < 0)
+                    goto out;
+            }
+            idx++;
 
             if ((ret = callback(&buf[start], arg)) < 0)
                 goto out;
@@ -840,8 +1191,18 @@ static int chroot_readdir(struct shim_dentry* dent, readdir_callback_t callback,
         }
     }
 
+    if (attrs->table) {
+        lock(&data->lock);
+        free_prefetched_attrs(data->prefetched_attrs);
+        data->prefetched_attrs = attrs;
+        attrs = NULL;
+        unlock(&data->lock);
+    }
+
     ret = 0;
 out:
+    free_prefetched_attrs(attrs);
+    free(pal_attrs);
     free(buf);
     DkObjectClose(pal_hdl);
     return ret;
@@ -916,6 +1277,7 @@ static int chroot_unlink(struct shim_dentry* dir, struct shim_dentry* dent) {
     }
 
     data->queried = false;
+    file_cache_invalidate(data->cache);
 
     __atomic_add_fetch(&data->version.counter, 1, __ATOMIC_SEQ_CST);
     __atomic_store_n(&data->size.counter, 0, __ATOMIC_SEQ_CST);
@@ -983,6 +1345,8 @@ static int chroot_rename(struct shim_dentry* old, struct shim_dentry* new) {
     new->perm = old->perm;
     new->type = old->type;
     old_data->queried = false;
+    file_cache_invalidate(old_data->cache);
+    file_cache_invalidate(new_data->cache);
 
     DkObjectClose(pal_hdl);
 
@@ -1024,6 +1388,9 @@ struct shim_fs_ops chroot_fs_ops = {
     .close      = &chroot_close,
     .read       = &chroot_read,
     .write      = &chroot_write,
+    .pread      = &chroot_pread,
+    .pwrite     = &chroot_pwrite,
+    .sendfile   = &chroot_sendfile,
     .mmap       = &chroot_mmap,
     .seek       = &chroot_seek,
     .hstat      = &chroot_hstat,
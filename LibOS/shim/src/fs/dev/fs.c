@@ -12,6 +12,7 @@
 #include "pal.h"
 #include "shim_fs.h"
 #include "shim_fs_pseudo.h"
+#include "shim_utils.h"
 
 static ssize_t dev_null_read(struct shim_handle* hdl, void* buf, size_t count) {
     __UNUSED(hdl);
@@ -49,10 +50,10 @@ static ssize_t dev_zero_read(struct shim_handle* hdl, void* buf, size_t count) {
 
 static ssize_t dev_random_read(struct shim_handle* hdl, void* buf, size_t count) {
     __UNUSED(hdl);
-    int ret = DkRandomBitsRead(buf, count);
+    int ret = get_random_bytes(buf, count);
 
     if (ret < 0)
-        return pal_to_unix_errno(ret);
+        return ret;
     return count;
 }
 
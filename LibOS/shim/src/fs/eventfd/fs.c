@@ -15,11 +15,162 @@
 #include "shim_handle.h"
 #include "shim_internal.h"
 #include "shim_lock.h"
+#include "shim_thread.h"
+
+/*
+ * Eventfds are kept in LibOS memory: the counter lives in the handle and blocked readers and
+ * writers sleep on their thread events, like futex waiters. An event (see `create_event`) serves as
+ * the PAL handle for poll() and epoll; it is signaled iff the counter is not zero and only touched
+ * when the counter changes from or to zero. An eventfd always counts as writable there, as writes
+ * only block on counter overflow.
+ *
+ * When the eventfd is about to be inherited by a child process and host eventfds are allowed in
+ * the manifest, it is switched to a host eventfd shared by both processes, see
+ * eventfd_move_to_host(). Otherwise the child gets its own copy of the counter.
+ */
+
+#define EVENTFD_MAX_VAL (UINT64_MAX - 1)
+
+DEFINE_LIST(eventfd_waiter);
+struct eventfd_waiter {
+    struct shim_thread* thread;
+    LIST_TYPE(eventfd_waiter) list;
+};
+
+/* Brings the event in line with the counter value `new_val`, before the counter is changed to it,
+ * so that the caller can fail without changing the counter. */
+static int eventfd_update_event(struct shim_handle* hdl, uint64_t new_val) {
+    struct shim_eventfd_handle* eventfd = &hdl->info.eventfd;
+    assert(locked(&hdl->lock));
+
+    bool readable = new_val != 0;
+    if (readable != eventfd->signaled) {
+        int ret = readable ? set_event(&eventfd->event, 1) : wait_event(&eventfd->event);
+        if (ret < 0)
+            return ret;
+        eventfd->signaled = readable;
+    }
+    return 0;
+}
+
+static void eventfd_wake(struct shim_eventfd_handle* eventfd, struct wake_queue_head* queue) {
+    struct eventfd_waiter* waiter;
+    struct eventfd_waiter* tmp;
+    LISTP_FOR_EACH_ENTRY_SAFE(waiter, tmp, &eventfd->waiters, list) {
+        struct shim_thread* thread = waiter->thread;
+        LISTP_DEL_INIT(waiter, &eventfd->waiters, list);
+        add_thread_to_queue(queue, thread);
+    }
+}
+
+/* Sleeps until the counter changes. Called and returns with `hdl->lock` held. */
+static int eventfd_wait(struct shim_handle* hdl) {
+    struct shim_eventfd_handle* eventfd = &hdl->info.eventfd;
+    struct eventfd_waiter waiter = {.thread = get_cur_thread()};
+
+    thread_prepare_wait();
+    INIT_LIST_HEAD(&waiter, list);
+    LISTP_ADD_TAIL(&waiter, &eventfd->waiters, list);
+    unlock(&hdl->lock);
+
+    int ret = thread_wait(/*timeout_us=*/NULL, /*ignore_pending_signals=*/false);
+
+    lock(&hdl->lock);
+    if (!LIST_EMPTY(&waiter, list)) {
+        /* not woken up by a counter change (signal or spurious wakeup) */
+        LISTP_DEL_INIT(&waiter, &eventfd->waiters, list);
+    }
+    return ret == -EINTR ? -ERESTARTSYS : ret;
+}
+
+/* Returns 1 if the eventfd was moved to a host eventfd, so the caller has to use the PAL handle. */
+static int eventfd_mem_read(struct shim_handle* hdl, uint64_t* out_val) {
+    struct shim_eventfd_handle* eventfd = &hdl->info.eventfd;
+    struct wake_queue_head queue = {.first = WAKE_QUEUE_TAIL};
+    int ret = 0;
+
+    lock(&hdl->lock);
+    while (!eventfd->on_host && !eventfd->val) {
+        if (hdl->flags & O_NONBLOCK) {
+            ret = -EAGAIN;
+            goto out;
+        }
+        ret = eventfd_wait(hdl);
+        if (ret < 0)
+            goto out;
+    }
+    if (eventfd->on_host) {
+        ret = 1;
+        goto out;
+    }
+
+    uint64_t val = eventfd->semaphore ? 1 : eventfd->val;
+    ret = eventfd_update_event(hdl, eventfd->val - val);
+    if (ret < 0)
+        goto out;
+
+    *out_val = val;
+    eventfd->val -= val;
+    eventfd_wake(eventfd, &queue);
+
+out:
+    unlock(&hdl->lock);
+    wake_queue(&queue);
+    return ret;
+}
+
+/* Returns 1 if the eventfd was moved to a host eventfd, so the caller has to use the PAL handle. */
+static int eventfd_mem_write(struct shim_handle* hdl, uint64_t val) {
+    struct shim_eventfd_handle* eventfd = &hdl->info.eventfd;
+    struct wake_queue_head queue = {.first = WAKE_QUEUE_TAIL};
+    int ret = 0;
+
+    lock(&hdl->lock);
+    while (!eventfd->on_host && EVENTFD_MAX_VAL - eventfd->val < val) {
+        if (hdl->flags & O_NONBLOCK) {
+            ret = -EAGAIN;
+            goto out;
+        }
+        ret = eventfd_wait(hdl);
+        if (ret < 0)
+            goto out;
+    }
+    if (eventfd->on_host) {
+        ret = 1;
+        goto out;
+    }
+
+    if (val) {
+        ret = eventfd_update_event(hdl, eventfd->val + val);
+        if (ret < 0)
+            goto out;
+
+        eventfd->val += val;
+        eventfd_wake(eventfd, &queue);
+    }
+
+out:
+    unlock(&hdl->lock);
+    wake_queue(&queue);
+    return ret;
+}
 
 static ssize_t eventfd_read(struct shim_handle* hdl, void* buf, size_t count) {
     if (count < sizeof(uint64_t))
         return -EINVAL;
 
+    if (!__atomic_load_n(&hdl->info.eventfd.on_host, __ATOMIC_ACQUIRE)) {
+        uint64_t val;
+        int ret = eventfd_mem_read(hdl, &val);
+        if (ret <= 0) {
+            maybe_epoll_et_trigger(hdl, ret, /*in=*/true, /*was_partial=*/false);
+            if (ret < 0)
+                return ret;
+            memcpy(buf, &val, sizeof(val));
+            return sizeof(val);
+        }
+    }
+
     size_t orig_count = count;
     int ret = DkStreamRead(hdl->pal_handle, 0, &count, buf, NULL, 0);
     ret = pal_to_unix_errno(ret);
@@ -35,6 +186,19 @@ static ssize_t eventfd_write(struct shim_handle* hdl, const void* buf, size_t co
     if (count < sizeof(uint64_t))
         return -EINVAL;
 
+    if (!__atomic_load_n(&hdl->info.eventfd.on_host, __ATOMIC_ACQUIRE)) {
+        uint64_t val;
+        memcpy(&val, buf, sizeof(val));
+        if (val == UINT64_MAX)
+            return -EINVAL;
+
+        int ret = eventfd_mem_write(hdl, val);
+        if (ret <= 0) {
+            maybe_epoll_et_trigger(hdl, ret, /*in=*/false, /*was_partial=*/false);
+            return ret < 0 ? ret : (ssize_t)sizeof(val);
+        }
+    }
+
     size_t orig_count = count;
     int ret = DkStreamWrite(hdl->pal_handle, 0, &count, (void*)buf, NULL);
     ret = pal_to_unix_errno(ret);
@@ -46,11 +210,75 @@ static ssize_t eventfd_write(struct shim_handle* hdl, const void* buf, size_t co
     return (ssize_t)count;
 }
 
+int eventfd_move_to_host(struct shim_handle* hdl) {
+    assert(hdl->type == TYPE_EVENTFD);
+    struct shim_eventfd_handle* eventfd = &hdl->info.eventfd;
+    struct wake_queue_head queue = {.first = WAKE_QUEUE_TAIL};
+    int ret = 0;
+
+    lock(&hdl->lock);
+    if (eventfd->on_host)
+        goto out;
+
+    PAL_HANDLE pal_handle = NULL;
+    ret = create_host_eventfd(&pal_handle, !!(hdl->flags & O_NONBLOCK), eventfd->semaphore);
+    if (ret == -ENOSYS) {
+        log_warning("eventfd is inherited as a copy, child and parent do not share the counter "
+                    "(set sys.insecure__allow_eventfd to share it)");
+        ret = 0;
+        goto out;
+    }
+    if (ret < 0)
+        goto out;
+
+    if (eventfd->val) {
+        size_t size = sizeof(eventfd->val);
+        ret = DkStreamWrite(pal_handle, 0, &size, &eventfd->val, NULL);
+        if (ret < 0 || size != sizeof(eventfd->val)) {
+            ret = ret < 0 ? pal_to_unix_errno(ret) : -EINVAL;
+            DkObjectClose(pal_handle);
+            goto out;
+        }
+    }
+
+    /* the event stays open until the handle is closed (see eventfd_close), as threads blocked in
+     * poll() may still use it; it is signaled so that they wake up and poll again */
+    PAL_HANDLE old_pal_handle = hdl->pal_handle;
+    hdl->pal_handle = pal_handle;
+    __atomic_store_n(&eventfd->on_host, true, __ATOMIC_RELEASE);
+    _forget_epoll_pal_handle(hdl, old_pal_handle);
+    _update_epolls(hdl);
+
+    eventfd_wake(eventfd, &queue);
+    if (!eventfd->signaled) {
+        /* the eventfd is on the host already and cannot be moved back; threads blocked in poll()
+         * on the old event only wake up on their timeout or a signal if this fails */
+        int set_ret = set_event(&eventfd->event, 1);
+        if (set_ret < 0)
+            log_warning("eventfd_move_to_host: signaling the event failed: %d", set_ret);
+        else
+            eventfd->signaled = true;
+    }
+
+out:
+    unlock(&hdl->lock);
+    wake_queue(&queue);
+    return ret;
+}
+
 static int eventfd_poll(struct shim_handle* hdl, int poll_type) {
     int ret = 0;
 
     lock(&hdl->lock);
 
+    if (!hdl->info.eventfd.on_host) {
+        if ((poll_type & FS_POLL_RD) && hdl->info.eventfd.val)
+            ret |= FS_POLL_RD;
+        if ((poll_type & FS_POLL_WR) && hdl->info.eventfd.val < EVENTFD_MAX_VAL)
+            ret |= FS_POLL_WR;
+        goto out;
+    }
+
     if (!hdl->pal_handle) {
         ret = -EBADF;
         goto out;
@@ -76,10 +304,18 @@ out:
     return ret;
 }
 
+static int eventfd_close(struct shim_handle* hdl) {
+    /* the PAL handle of an eventfd kept in LibOS is its event, closed by put_handle() */
+    if (hdl->info.eventfd.on_host)
+        destroy_event(&hdl->info.eventfd.event);
+    return 0;
+}
+
 struct shim_fs_ops eventfd_fs_ops = {
     .read  = &eventfd_read,
     .write = &eventfd_write,
     .poll  = &eventfd_poll,
+    .close = &eventfd_close,
 };
 
 struct shim_fs eventfd_builtin_fs = {
@@ -21,13 +21,459 @@
 #include "shim_process.h"
 #include "shim_signal.h"
 #include "shim_thread.h"
+#include "shim_utils.h"
 #include "stat.h"
 
+/*
+ * In-memory pipes
+ *
+ * Both ends of a pipe created by pipe2() start in the same process, and most pipes never leave it
+ * (e.g. self-pipes of event loops, pipes between threads). Data of such pipes is kept in a ring
+ * buffer in LibOS memory, so that read() and write() do not go through the PAL (which on SGX means
+ * OCALLs and TLS encryption for every call). Blocked readers and writers sleep on their thread
+ * events, like futex waiters.
+ *
+ * poll() and epoll still need host-visible handles: each end gets an event (see `create_event`) as
+ * its PAL handle. `rd_event` is signaled iff the read end is readable (data or EOF), `wr_event` iff
+ * the write end is writable (free space or no reader). They are only touched on empty/non-empty and
+ * full/non-full transitions. Since an event can only become readable, the write end reports
+ * writability as readability of `wr_event`, see mem_pipe_pal_events().
+ *
+ * When an end is about to leave the process (checkpoint for fork or execve), both ends are switched
+ * to a fresh host pipe and the buffered data is written into it, see mem_pipe_move_to_host().
+ * Nobody can read from the host pipe before the switch, so the buffer must not be larger than what
+ * a host pipe takes without a reader: 64 KiB is the in-enclave pipe ring of Linux-SGX and well
+ * below the socket buffer backing host pipes on Linux.
+ */
+
+#define MEM_PIPE_SIZE (64 * 1024)
+/* writes of at most this many bytes are atomic (PIPE_BUF) */
+#define MEM_PIPE_ATOMIC_SIZE 4096
+
+DEFINE_LIST(mem_pipe_waiter);
+struct mem_pipe_waiter {
+    struct shim_thread* thread;
+    LIST_TYPE(mem_pipe_waiter) list;
+};
+DEFINE_LISTP(mem_pipe_waiter);
+
+struct shim_mem_pipe {
+    REFTYPE ref_count;
+    struct shim_lock lock;
+
+    /* set once both ends use their host pipe handles, all other fields are unused then */
+    bool on_host;
+
+    /* read and write end (not referenced), NULL once closed */
+    struct shim_handle* ends[2];
+
+    char* buf;
+    size_t head;
+    size_t used;
+
+    LISTP_TYPE(mem_pipe_waiter) readers;
+    LISTP_TYPE(mem_pipe_waiter) writers;
+
+    AEVENTTYPE rd_event;
+    AEVENTTYPE wr_event;
+    bool rd_signaled;
+    bool wr_signaled;
+};
+
+static void put_mem_pipe(struct shim_mem_pipe* mem) {
+    if (REF_DEC(mem->ref_count))
+        return;
+
+    destroy_event(&mem->rd_event);
+    destroy_event(&mem->wr_event);
+    if (lock_created(&mem->lock))
+        destroy_lock(&mem->lock);
+    free(mem->buf);
+    free(mem);
+}
+
+int mem_pipe_create(struct shim_handle* rd_hdl, struct shim_handle* wr_hdl, int flags) {
+    struct shim_mem_pipe* mem = calloc(1, sizeof(*mem));
+    if (!mem)
+        return -ENOMEM;
+
+    REF_SET(mem->ref_count, 1);
+    INIT_LISTP(&mem->readers);
+    INIT_LISTP(&mem->writers);
+
+    int ret;
+    mem->buf = malloc(MEM_PIPE_SIZE);
+    if (!mem->buf || !create_lock(&mem->lock)) {
+        ret = -ENOMEM;
+        goto out;
+    }
+
+    ret = create_event(&mem->rd_event);
+    if (ret < 0)
+        goto out;
+    ret = create_event(&mem->wr_event);
+    if (ret < 0)
+        goto out;
+
+    /* an empty pipe is writable, but not readable */
+    ret = set_event(&mem->wr_event, 1);
+    if (ret < 0)
+        goto out;
+    mem->wr_signaled = true;
+
+    mem->ends[0] = rd_hdl;
+    mem->ends[1] = wr_hdl;
+    REF_SET(mem->ref_count, 2);
+
+    rd_hdl->info.pipe.mem = mem;
+    rd_hdl->pal_handle = event_handle(&mem->rd_event);
+    wr_hdl->info.pipe.mem = mem;
+    wr_hdl->pal_handle = event_handle(&mem->wr_event);
+
+    if (flags & O_NONBLOCK) {
+        rd_hdl->flags |= O_NONBLOCK;
+        wr_hdl->flags |= O_NONBLOCK;
+    }
+    return 0;
+
+out:
+    put_mem_pipe(mem);
+    return ret;
+}
+
+bool is_mem_pipe(struct shim_handle* hdl) {
+    return hdl->type == TYPE_PIPE && hdl->info.pipe.mem
+           && !__atomic_load_n(&hdl->info.pipe.mem->on_host, __ATOMIC_ACQUIRE);
+}
+
+PAL_FLG mem_pipe_pal_events(struct shim_handle* hdl, PAL_FLG events) {
+    if (!(hdl->acc_mode & MAY_WRITE) || !is_mem_pipe(hdl))
+        return events;
+
+    PAL_FLG swapped = events & ~(PAL_WAIT_READ | PAL_WAIT_WRITE);
+    if (events & PAL_WAIT_READ)
+        swapped |= PAL_WAIT_WRITE;
+    if (events & PAL_WAIT_WRITE)
+        swapped |= PAL_WAIT_READ;
+    return swapped;
+}
+
+/* Brings `rd_event` and `wr_event` in line with the buffer state. On failure, `rd_signaled` and
+ * `wr_signaled` still tell the actual state of the events, so the next call retries. */
+static int mem_pipe_update_events(struct shim_mem_pipe* mem) {
+    assert(locked(&mem->lock));
+
+    int ret = 0;
+    bool readable = mem->used || !mem->ends[1];
+    if (readable != mem->rd_signaled) {
+        ret = readable ? set_event(&mem->rd_event, 1) : wait_event(&mem->rd_event);
+        if (ret < 0)
+            return ret;
+        mem->rd_signaled = readable;
+    }
+
+    bool writable = mem->used < MEM_PIPE_SIZE || !mem->ends[0];
+    if (writable != mem->wr_signaled) {
+        ret = writable ? set_event(&mem->wr_event, 1) : wait_event(&mem->wr_event);
+        if (ret < 0)
+            return ret;
+        mem->wr_signaled = writable;
+    }
+    return 0;
+}
+
+static void mem_pipe_wake(LISTP_TYPE(mem_pipe_waiter)* waiters, struct wake_queue_head* queue) {
+    struct mem_pipe_waiter* waiter;
+    struct mem_pipe_waiter* tmp;
+    LISTP_FOR_EACH_ENTRY_SAFE(waiter, tmp, waiters, list) {
+        struct shim_thread* thread = waiter->thread;
+        LISTP_DEL_INIT(waiter, waiters, list);
+        add_thread_to_queue(queue, thread);
+    }
+}
+
+/* Sleeps until woken up by the other end. Called and returns with `mem->lock` held. */
+static int mem_pipe_wait(struct shim_mem_pipe* mem, LISTP_TYPE(mem_pipe_waiter)* waiters) {
+    struct mem_pipe_waiter waiter = {.thread = get_cur_thread()};
+
+    thread_prepare_wait();
+    INIT_LIST_HEAD(&waiter, list);
+    LISTP_ADD_TAIL(&waiter, waiters, list);
+    unlock(&mem->lock);
+
+    int ret = thread_wait(/*timeout_us=*/NULL, /*ignore_pending_signals=*/false);
+
+    lock(&mem->lock);
+    if (!LIST_EMPTY(&waiter, list)) {
+        /* not woken up by the other end (signal or spurious wakeup) */
+        LISTP_DEL_INIT(&waiter, waiters, list);
+    }
+    return ret == -EINTR ? -ERESTARTSYS : ret;
+}
+
+/* Reads from the in-memory buffer. Sets `*on_host` (and reads nothing) if the pipe was moved to a
+ * host pipe in the meantime. */
+static ssize_t mem_pipe_read(struct shim_handle* hdl, void* buf, size_t count, bool* on_host) {
+    struct shim_mem_pipe* mem = hdl->info.pipe.mem;
+    struct wake_queue_head queue = {.first = WAKE_QUEUE_TAIL};
+    ssize_t ret;
+
+    lock(&mem->lock);
+    while (!mem->used) {
+        if (mem->on_host) {
+            *on_host = true;
+            ret = 0;
+            goto out;
+        }
+        if (!mem->ends[1] || !count) {
+            /* EOF (or nothing asked for) */
+            ret = 0;
+            goto out;
+        }
+        if (hdl->flags & O_NONBLOCK) {
+            ret = -EAGAIN;
+            goto out;
+        }
+        ret = mem_pipe_wait(mem, &mem->readers);
+        if (ret < 0)
+            goto out;
+    }
+
+    size_t size  = MIN(count, mem->used);
+    size_t first = MIN(size, MEM_PIPE_SIZE - mem->head);
+    memcpy(buf, mem->buf + mem->head, first);
+    memcpy((char*)buf + first, mem->buf, size - first);
+
+    mem->head = (mem->head + size) % MEM_PIPE_SIZE;
+    mem->used -= size;
+    if (!mem->used)
+        mem->head = 0;
+
+    mem_pipe_wake(&mem->writers, &queue);
+    ret = mem_pipe_update_events(mem);
+    if (ret < 0) {
+        /* the data is consumed already, so it must be returned; only poll() is off until the next
+         * transition retries */
+        log_warning("mem_pipe_read: updating events failed: %ld", ret);
+    }
+    ret = (ssize_t)size;
+
+out:
+    unlock(&mem->lock);
+    wake_queue(&queue);
+    return ret;
+}
+
+/* Writes to the in-memory buffer. Sets `*on_host` (and writes nothing) if the pipe was moved to a
+ * host pipe in the meantime. */
+static ssize_t mem_pipe_write(struct shim_handle* hdl, const void* buf, size_t count,
+                              bool* on_host) {
+    struct shim_mem_pipe* mem = hdl->info.pipe.mem;
+    struct wake_queue_head queue = {.first = WAKE_QUEUE_TAIL};
+    /* small writes must not be interleaved with other writes, so they wait for enough space */
+    size_t min_space = count <= MEM_PIPE_ATOMIC_SIZE ? count : 1;
+    size_t done = 0;
+    ssize_t ret = 0;
+
+    lock(&mem->lock);
+    while (done < count) {
+        if (mem->on_host) {
+            *on_host = !done;
+            break;
+        }
+        if (!mem->ends[0]) {
+            ret = -EPIPE;
+            break;
+        }
+
+        size_t space = MEM_PIPE_SIZE - mem->used;
+        if (space < min_space || !space) {
+            if (hdl->flags & O_NONBLOCK) {
+                ret = -EAGAIN;
+                break;
+            }
+            ret = mem_pipe_wait(mem, &mem->writers);
+            if (ret < 0)
+                break;
+            continue;
+        }
+
+        size_t size  = MIN(count - done, space);
+        size_t tail  = (mem->head + mem->used) % MEM_PIPE_SIZE;
+        size_t first = MIN(size, MEM_PIPE_SIZE - tail);
+        memcpy(mem->buf + tail, (const char*)buf + done, first);
+        memcpy(mem->buf, (const char*)buf + done + first, size - first);
+
+        mem->used += size;
+        done += size;
+
+        mem_pipe_wake(&mem->readers, &queue);
+        ret = mem_pipe_update_events(mem);
+        if (ret < 0)
+            break;
+    }
+    unlock(&mem->lock);
+    wake_queue(&queue);
+
+    /* a partial write is reported as such, the error shows up on the next write */
+    return done ? (ssize_t)done : ret;
+}
+
+static int mem_pipe_poll(struct shim_handle* hdl, int poll_type, bool* on_host) {
+    struct shim_mem_pipe* mem = hdl->info.pipe.mem;
+    int ret = 0;
+
+    lock(&mem->lock);
+    if (mem->on_host) {
+        *on_host = true;
+    } else if (hdl->acc_mode & MAY_READ) {
+        if (!mem->ends[1])
+            ret |= FS_POLL_ER;
+        if ((poll_type & FS_POLL_RD) && (mem->used || !mem->ends[1]))
+            ret |= FS_POLL_RD;
+    } else {
+        if (!mem->ends[0])
+            ret |= FS_POLL_ER;
+        if ((poll_type & FS_POLL_WR) && (mem->used < MEM_PIPE_SIZE || !mem->ends[0]))
+            ret |= FS_POLL_WR;
+    }
+    unlock(&mem->lock);
+    return ret;
+}
+
+static int set_pal_pipe_flags(struct shim_handle* hdl, int flags);
+
+/* Writes the buffered data to the host pipe `pal_handle`, which must be non-blocking: nobody reads
+ * from it yet, so waiting for free space would never end. */
+static int mem_pipe_write_to_host(struct shim_mem_pipe* mem, PAL_HANDLE pal_handle) {
+    for (size_t done = 0; done < mem->used;) {
+        size_t pos  = (mem->head + done) % MEM_PIPE_SIZE;
+        size_t size = MIN(mem->used - done, MEM_PIPE_SIZE - pos);
+        int ret = DkStreamWrite(pal_handle, 0, &size, mem->buf + pos, NULL);
+        if (ret == -PAL_ERROR_INTERRUPTED)
+            continue;
+        if (ret == -PAL_ERROR_TRYAGAIN) {
+            log_warning("pipe: %lu buffered bytes do not fit into the host pipe", mem->used);
+            return -EAGAIN;
+        }
+        if (ret < 0)
+            return pal_to_unix_errno(ret);
+        done += size;
+    }
+    return 0;
+}
+
+int mem_pipe_move_to_host(struct shim_handle* hdl) {
+    assert(hdl->type == TYPE_PIPE);
+    struct shim_mem_pipe* mem = hdl->info.pipe.mem;
+    if (!mem)
+        return 0;
+
+    struct wake_queue_head queue = {.first = WAKE_QUEUE_TAIL};
+    struct shim_handle* tmp_hdl = NULL;
+    int ret = 0;
+
+    lock(&mem->lock);
+    if (mem->on_host)
+        goto out;
+
+    /* a closed end is stood in for by a temporary handle, which is dropped at the end so that the
+     * other end sees EOF (or EPIPE) */
+    struct shim_handle* ends[2] = {mem->ends[0], mem->ends[1]};
+    if (!ends[0] || !ends[1]) {
+        tmp_hdl = get_new_handle();
+        if (!tmp_hdl) {
+            ret = -ENOMEM;
+            goto out;
+        }
+        tmp_hdl->type = TYPE_PIPE;
+        ends[ends[0] ? 1 : 0] = tmp_hdl;
+    }
+
+    lock(&ends[0]->lock);
+    lock(&ends[1]->lock);
+
+    PAL_HANDLE old_pal_handles[2] = {ends[0]->pal_handle, ends[1]->pal_handle};
+    ret = create_pipes(ends[0], ends[1], /*flags=*/0, ends[0]->info.pipe.name, &ends[0]->uri);
+    if (ret < 0)
+        goto out_unlock;
+
+    memcpy(ends[1]->info.pipe.name, ends[0]->info.pipe.name, sizeof(ends[1]->info.pipe.name));
+    qstrcopy(&ends[1]->uri, &ends[0]->uri);
+
+    /* the buffered data goes to the host pipe before it is published, so that nothing overtakes
+     * it; if it does not fit, the pipe stays in memory and the checkpoint fails */
+    if (mem->ends[0] && mem->used) {
+        ret = set_pal_pipe_flags(ends[1], O_NONBLOCK);
+        if (ret < 0)
+            goto out_restore;
+        ret = mem_pipe_write_to_host(mem, ends[1]->pal_handle);
+        if (ret < 0)
+            goto out_restore;
+    }
+
+    for (int i = 0; i < 2; i++) {
+        if (ends[i] != tmp_hdl) {
+            ret = set_pal_pipe_flags(ends[i], ends[i]->flags & O_NONBLOCK);
+            if (ret < 0)
+                goto out_restore;
+        }
+    }
+
+    free(mem->buf);
+    mem->buf = NULL;
+    mem->used = 0;
+
+    __atomic_store_n(&mem->on_host, true, __ATOMIC_RELEASE);
+    for (int i = 0; i < 2; i++) {
+        if (ends[i] != tmp_hdl) {
+            _forget_epoll_pal_handle(ends[i], old_pal_handles[i]);
+            _update_epolls(ends[i]);
+        }
+    }
+
+    /* blocked readers and writers retry on the host pipe; threads blocked in poll() on the events
+     * wake up and poll again (the events stay open until `mem` is freed, as they may still use
+     * them) */
+    mem_pipe_wake(&mem->readers, &queue);
+    mem_pipe_wake(&mem->writers, &queue);
+    if (!mem->rd_signaled && set_event(&mem->rd_event, 1) == 0)
+        mem->rd_signaled = true;
+    if (!mem->wr_signaled && set_event(&mem->wr_event, 1) == 0)
+        mem->wr_signaled = true;
+    goto out_unlock;
+
+out_restore:
+    for (int i = 0; i < 2; i++) {
+        DkObjectClose(ends[i]->pal_handle);
+        ends[i]->pal_handle = old_pal_handles[i];
+    }
+out_unlock:
+    unlock(&ends[1]->lock);
+    unlock(&ends[0]->lock);
+out:
+    unlock(&mem->lock);
+    wake_queue(&queue);
+    if (tmp_hdl)
+        put_handle(tmp_hdl);
+    return ret;
+}
+
 static ssize_t pipe_read(struct shim_handle* hdl, void* buf, size_t count) {
     assert(hdl->type == TYPE_PIPE);
     if (!hdl->info.pipe.ready_for_ops)
         return -EACCES;
 
+    if (hdl->info.pipe.mem) {
+        bool on_host = false;
+        ssize_t ret = mem_pipe_read(hdl, buf, count, &on_host);
+        if (!on_host) {
+            maybe_epoll_et_trigger(hdl, ret < 0 ? (int)ret : 0, /*in=*/true,
+                                   ret >= 0 && (size_t)ret < count);
+            return ret;
+        }
+    }
+
     size_t orig_count = count;
     int ret = DkStreamRead(hdl->pal_handle, 0, &count, buf, NULL, 0);
     ret = pal_to_unix_errno(ret);
@@ -45,8 +491,20 @@ static ssize_t pipe_write(struct shim_handle* hdl, const void* buf, size_t count
         return -EACCES;
 
     size_t orig_count = count;
-    int ret = DkStreamWrite(hdl->pal_handle, 0, &count, (void*)buf, NULL);
-    ret = pal_to_unix_errno(ret);
+    int ret;
+    bool on_host = true;
+    if (hdl->info.pipe.mem) {
+        on_host = false;
+        ssize_t written = mem_pipe_write(hdl, buf, count, &on_host);
+        if (!on_host) {
+            ret = written < 0 ? (int)written : 0;
+            count = written < 0 ? 0 : (size_t)written;
+        }
+    }
+    if (on_host) {
+        ret = DkStreamWrite(hdl->pal_handle, 0, &count, (void*)buf, NULL);
+        ret = pal_to_unix_errno(ret);
+    }
     maybe_epoll_et_trigger(hdl, ret, /*in=*/false, ret == 0 ? count < orig_count : false);
     if (ret < 0) {
         if (ret == -EPIPE) {
@@ -100,6 +558,13 @@ static int pipe_poll(struct shim_handle* hdl, int poll_type) {
     if (!hdl->info.pipe.ready_for_ops)
         return -EACCES;
 
+    if (hdl->info.pipe.mem) {
+        bool on_host = false;
+        ret = mem_pipe_poll(hdl, poll_type, &on_host);
+        if (!on_host)
+            return ret;
+    }
+
     lock(&hdl->lock);
 
     if (!hdl->pal_handle) {
@@ -127,7 +592,7 @@ out:
     return ret;
 }
 
-static int pipe_setflags(struct shim_handle* hdl, int flags) {
+static int set_pal_pipe_flags(struct shim_handle* hdl, int flags) {
     if (!hdl->pal_handle)
         return 0;
 
@@ -158,6 +623,41 @@ static int pipe_setflags(struct shim_handle* hdl, int flags) {
     return 0;
 }
 
+static int pipe_setflags(struct shim_handle* hdl, int flags) {
+    /* in-memory pipes look at `hdl->flags` directly; when moved to a host pipe, the flags are
+     * applied then */
+    if (is_mem_pipe(hdl))
+        return 0;
+
+    return set_pal_pipe_flags(hdl, flags);
+}
+
+static int pipe_close(struct shim_handle* hdl) {
+    struct shim_mem_pipe* mem = hdl->info.pipe.mem;
+    if (!mem)
+        return 0;
+
+    struct wake_queue_head queue = {.first = WAKE_QUEUE_TAIL};
+    int ret = 0;
+
+    lock(&mem->lock);
+    int end = mem->ends[0] == hdl ? 0 : 1;
+    assert(mem->ends[end] == hdl);
+    mem->ends[end] = NULL;
+    if (!mem->on_host) {
+        /* the PAL handle is an event owned by `mem` */
+        hdl->pal_handle = NULL;
+        mem_pipe_wake(end == 0 ? &mem->writers : &mem->readers, &queue);
+        ret = mem_pipe_update_events(mem);
+    }
+    unlock(&mem->lock);
+    wake_queue(&queue);
+
+    hdl->info.pipe.mem = NULL;
+    put_mem_pipe(mem);
+    return ret;
+}
+
 static int fifo_open(struct shim_handle* hdl, struct shim_dentry* dent, int flags) {
     assert(hdl);
     assert(dent && dent->data && dent->fs);
@@ -237,6 +737,7 @@ static struct shim_fs_ops pipe_fs_ops = {
     .hstat    = &pipe_hstat,
     .poll     = &pipe_poll,
     .setflags = &pipe_setflags,
+    .close    = &pipe_close,
 };
 
 static struct shim_fs_ops fifo_fs_ops = {
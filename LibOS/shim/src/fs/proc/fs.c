@@ -12,6 +12,9 @@
 #include "shim_fs_pseudo.h"
 #include "shim_process.h"
 
+/* `MemFree` changes all the time, but there is no point in querying it more often than this */
+#define PROC_MEMINFO_CACHE_USEC (10 * 1000)
+
 int proc_self_follow_link(struct shim_dentry* dent, char** out_target) {
     __UNUSED(dent);
     IDTYPE pid = g_process.pid;
@@ -27,7 +30,8 @@ static void init_thread_dir(struct pseudo_node* ent) {
     pseudo_add_link(ent, "root", &proc_thread_follow_link);
     pseudo_add_link(ent, "cwd", &proc_thread_follow_link);
     pseudo_add_link(ent, "exe", &proc_thread_follow_link);
-    pseudo_add_str(ent, "maps", &proc_thread_maps_load);
+    struct pseudo_node* maps = pseudo_add_str(ent, "maps", /*load=*/NULL);
+    maps->str.generate = &proc_thread_maps_generate;
     pseudo_add_str(ent, "cmdline", &proc_thread_cmdline_load);
 
     struct pseudo_node* fd = pseudo_add_dir(ent, "fd");
@@ -46,8 +50,15 @@ static void init_ipc_thread_dir(struct pseudo_node* ent) {
 int init_procfs(void) {
     struct pseudo_node* root = pseudo_add_root_dir("proc");
 
-    pseudo_add_str(root, "meminfo", &proc_meminfo_load);
-    pseudo_add_str(root, "cpuinfo", &proc_cpuinfo_load);
+    struct pseudo_node* meminfo = pseudo_add_str(root, "meminfo", &proc_meminfo_load);
+    meminfo->str.cache_usec = PROC_MEMINFO_CACHE_USEC;
+    struct pseudo_node* cpuinfo = pseudo_add_str(root, "cpuinfo", &proc_cpuinfo_load);
+    cpuinfo->str.cache_usec = PSEUDO_CACHE_FOREVER;
+
+    struct pseudo_node* graphene = pseudo_add_dir(root, "graphene");
+    pseudo_add_str(graphene, "malloc", &proc_graphene_malloc_load);
+    pseudo_add_str(graphene, "syscalls", &proc_graphene_syscalls_load);
+    pseudo_add_str(graphene, "locks", &proc_graphene_locks_load);
 
     pseudo_add_link(root, "self", &proc_self_follow_link);
 
@@ -4,11 +4,14 @@
 /*!
  * \file
  *
- * This file contains the implementation of `/proc/meminfo` and `/proc/cpuinfo`.
+ * This file contains the implementation of `/proc/meminfo`, `/proc/cpuinfo` and
+ * `/proc/graphene/malloc`.
  */
 
 #include "shim_fs.h"
 #include "shim_fs_pseudo.h"
+#include "shim_lock.h"
+#include "shim_utils.h"
 #include "stat.h"
 
 int proc_meminfo_load(struct shim_dentry* dent, char** out_data, size_t* out_size) {
@@ -81,11 +84,13 @@ retry:
     }
 
     if ((size_t)ret >= *size - off) {
-        char* tmp = realloc_size(*str, *size, *size + 128);
+        /* grow geometrically, `/proc/cpuinfo` of a many-core machine has tens of kilobytes */
+        size_t new_size = MAX(*size * 2, off + ret + 1);
+        char* tmp = realloc_size(*str, *size, new_size);
         if (!tmp) {
             return -ENOMEM;
         }
-        *size += 128;
+        *size = new_size;
         *str = tmp;
         goto retry;
     }
@@ -137,3 +142,18 @@ int proc_cpuinfo_load(struct shim_dentry* dent, char** out_data, size_t* out_siz
     *out_size = size;
     return 0;
 }
+
+int proc_graphene_malloc_load(struct shim_dentry* dent, char** out_data, size_t* out_size) {
+    __UNUSED(dent);
+    return get_malloc_stats(out_data, out_size);
+}
+
+int proc_graphene_syscalls_load(struct shim_dentry* dent, char** out_data, size_t* out_size) {
+    __UNUSED(dent);
+    return get_syscall_stats(out_data, out_size);
+}
+
+int proc_graphene_locks_load(struct shim_dentry* dent, char** out_data, size_t* out_size) {
+    __UNUSED(dent);
+    return get_lock_stats(out_data, out_size);
+}
@@ -49,98 +49,81 @@ out:
     return ret;
 }
 
-int proc_thread_maps_load(struct shim_dentry* dent, char** out_data, size_t* out_size) {
-    __UNUSED(dent);
+/* Formats a single line of `/proc/<pid>/maps`. Returns the length of the whole line, which can be
+ * greater than `size` (in which case the line was truncated), same as `snprintf`. */
+static size_t format_maps_line(const struct shim_vma_info* vma, char* buf, size_t size) {
+    uintptr_t start = (uintptr_t)vma->addr;
+    uintptr_t end   = (uintptr_t)vma->addr + vma->length;
+    char pt[3]      = {
+        (vma->prot & PROT_READ) ? 'r' : '-',
+        (vma->prot & PROT_WRITE) ? 'w' : '-',
+        (vma->prot & PROT_EXEC) ? 'x' : '-',
+    };
+    char pr = (vma->flags & MAP_PRIVATE) ? 'p' : 's';
+    int len;
 
-    int ret;
-    size_t vma_count;
-    struct shim_vma_info* vmas = NULL;
-    ret = dump_all_vmas(&vmas, &vma_count, /*include_unmapped=*/false);
-    if (ret < 0) {
-        return ret;
-    }
+    if (vma->file) {
+        int dev_major = 0, dev_minor = 0;
+        unsigned long ino = vma->file->dentry ? dentry_ino(vma->file->dentry) : 0;
+        char* path = NULL;
 
-#define DEFAULT_VMA_BUFFER_SIZE 256
+        if (vma->file->dentry)
+            dentry_abs_path(vma->file->dentry, &path, /*size=*/NULL);
 
-    char* buffer;
-    size_t buffer_size = DEFAULT_VMA_BUFFER_SIZE, offset = 0;
-    buffer = malloc(buffer_size);
-    if (!buffer) {
-        ret = -ENOMEM;
-        goto err;
+        len = snprintf(buf, size, "%08lx-%08lx %c%c%c%c %08lx %02d:%02d %lu %s\n", start, end,
+                       pt[0], pt[1], pt[2], pr, vma->file_offset, dev_major, dev_minor, ino,
+                       path ? path : "[unknown]");
+
+        free(path);
+    } else if (vma->comment[0]) {
+        len = snprintf(buf, size, "%08lx-%08lx %c%c%c%c 00000000 00:00 0 %s\n", start, end, pt[0],
+                       pt[1], pt[2], pr, vma->comment);
+    } else {
+        len = snprintf(buf, size, "%08lx-%08lx %c%c%c%c 00000000 00:00 0\n", start, end, pt[0],
+                       pt[1], pt[2], pr);
     }
 
-    for (struct shim_vma_info* vma = vmas; vma < vmas + vma_count; vma++) {
-        size_t old_offset = offset;
-        uintptr_t start   = (uintptr_t)vma->addr;
-        uintptr_t end     = (uintptr_t)vma->addr + vma->length;
-        char pt[3]        = {
-            (vma->prot & PROT_READ) ? 'r' : '-',
-            (vma->prot & PROT_WRITE) ? 'w' : '-',
-            (vma->prot & PROT_EXEC) ? 'x' : '-',
-        };
-        char pr = (vma->flags & MAP_PRIVATE) ? 'p' : 's';
-
-#define ADDR_FMT(addr) ((addr) > 0xffffffff ? "%lx" : "%08lx")
-#define EMIT(fmt...)                                                    \
-    do {                                                                \
-        offset += snprintf(buffer + offset, buffer_size - offset, fmt); \
-    } while (0)
-
-    retry_emit_vma:
-        if (vma->file) {
-            int dev_major = 0, dev_minor = 0;
-            unsigned long ino = vma->file->dentry ? dentry_ino(vma->file->dentry) : 0;
-            char* path = NULL;
-
-            if (vma->file->dentry)
-                dentry_abs_path(vma->file->dentry, &path, /*size=*/NULL);
-
-            EMIT(ADDR_FMT(start), start);
-            EMIT("-");
-            EMIT(ADDR_FMT(end), end);
-            EMIT(" %c%c%c%c %08lx %02d:%02d %lu %s\n", pt[0], pt[1], pt[2], pr, vma->file_offset,
-                 dev_major, dev_minor, ino, path ? path : "[unknown]");
-
-            free(path);
-        } else {
-            EMIT(ADDR_FMT(start), start);
-            EMIT("-");
-            EMIT(ADDR_FMT(end), end);
-            if (vma->comment[0])
-                EMIT(" %c%c%c%c 00000000 00:00 0 %s\n", pt[0], pt[1], pt[2], pr, vma->comment);
-            else
-                EMIT(" %c%c%c%c 00000000 00:00 0\n", pt[0], pt[1], pt[2], pr);
-        }
+    assert(len >= 0);
+    return len;
+}
 
-        if (offset >= buffer_size) {
-            char* new_buffer = malloc(buffer_size * 2);
-            if (!new_buffer) {
-                ret = -ENOMEM;
-                goto err;
-            }
+#define MAPS_VMA_BATCH 8
 
-            offset = old_offset;
-            memcpy(new_buffer, buffer, old_offset);
-            free(buffer);
-            buffer = new_buffer;
-            buffer_size *= 2;
-            goto retry_emit_vma;
+/* The cursor is the end address of the last VMA already emitted. */
+int proc_thread_maps_generate(struct shim_dentry* dent, uint64_t* cursor, char* buf, size_t size,
+                              size_t* out_size) {
+    __UNUSED(dent);
+
+    struct shim_vma_info vmas[MAPS_VMA_BATCH];
+    size_t offset = 0;
+    bool is_full = false;
+
+    while (!is_full) {
+        size_t count = dump_vmas_from((void*)*cursor, vmas, ARRAY_SIZE(vmas),
+                                      /*include_unmapped=*/false);
+        if (!count)
+            break;
+
+        for (size_t i = 0; i < count; i++) {
+            if (!is_full) {
+                size_t len = format_maps_line(&vmas[i], buf + offset, size - offset);
+                if (len < size - offset) {
+                    offset += len;
+                    *cursor = (uintptr_t)vmas[i].addr + vmas[i].length;
+                } else {
+                    is_full = true;
+                }
+            }
+            if (vmas[i].file)
+                put_handle(vmas[i].file);
         }
     }
 
-    *out_data = buffer;
-    *out_size = offset;
-    ret = 0;
+    if (is_full && offset == 0)
+        return -ENOSPC;
 
-err:
-    if (ret < 0) {
-        free(buffer);
-    }
-    if (vmas) {
-        free_vma_info_array(vmas, vma_count);
-    }
-    return ret;
+    *out_size = offset;
+    return 0;
 }
 
 int proc_thread_cmdline_load(struct shim_dentry* dent, char** out_data, size_t* out_size) {
@@ -235,8 +218,7 @@ bool proc_thread_fd_name_exists(struct shim_dentry* parent, const char* name) {
     struct shim_handle_map* handle_map = get_thread_handle_map(NULL);
     lock(&handle_map->lock);
 
-    if (fd > handle_map->fd_top || handle_map->map[fd] == NULL ||
-            handle_map->map[fd]->handle == NULL) {
+    if (fd > handle_map->fd_top || !HANDLE_ALLOCATED(__get_fd_entry(handle_map, fd))) {
         unlock(&handle_map->lock);
         return false;
     }
@@ -253,7 +235,7 @@ int proc_thread_fd_list_names(struct shim_dentry* parent, readdir_callback_t cal
 
     int ret = 0;
     for (int i = 0; i <= handle_map->fd_top; i++)
-        if (handle_map->map[i] && handle_map->map[i]->handle) {
+        if (HANDLE_ALLOCATED(__get_fd_entry(handle_map, i))) {
             char name[11];
             snprintf(name, sizeof(name), "%u", i);
             if ((ret = callback(name, arg)) < 0)
@@ -293,14 +275,14 @@ int proc_thread_fd_follow_link(struct shim_dentry* dent, char** out_target) {
     struct shim_handle_map* handle_map = get_thread_handle_map(NULL);
     lock(&handle_map->lock);
 
-    if (fd > handle_map->fd_top || handle_map->map[fd] == NULL ||
-            handle_map->map[fd]->handle == NULL) {
+    struct shim_fd_handle* fd_handle = __get_fd_entry(handle_map, fd);
+    if (fd > handle_map->fd_top || !HANDLE_ALLOCATED(fd_handle)) {
         unlock(&handle_map->lock);
         return -ENOENT;
     }
 
     int ret;
-    struct shim_handle* hdl = handle_map->map[fd]->handle;
+    struct shim_handle* hdl = fd_handle->handle;
 
     if (hdl->dentry) {
         ret = dentry_abs_path(hdl->dentry, out_target, /*size=*/NULL);
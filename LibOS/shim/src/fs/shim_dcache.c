@@ -34,6 +34,118 @@ static MEM_MGR dentry_mgr = NULL;
 
 struct shim_dentry* g_dentry_root = NULL;
 
+uint64_t g_negative_dentry_ttl_us = 0;
+
+/*
+ * Interned dentry names. Path-heavy workloads create many dentries with the same name in different
+ * directories ("node_modules", "index.js", "Makefile", ...), so names are stored once and shared by
+ * all such dentries. `dent->name` points to `str` of a `dentry_name`. Unlike dentries, names are
+ * shared across the whole tree, so they have their own lock (malloc is called under it, hence not
+ * a spinlock).
+ */
+struct dentry_name {
+    struct dentry_name* next; /* in the bucket of `g_dentry_names` */
+    size_t ref_count;         /* protected by `g_dentry_names_lock` */
+    HASHTYPE hash;            /* `hash_buf(str, len)` */
+    size_t len;
+    char str[];
+};
+
+#define DENTRY_NAMES_MIN_SIZE 256
+
+static struct shim_lock g_dentry_names_lock;
+static struct dentry_name** g_dentry_names = NULL;
+static size_t g_dentry_names_size = 0; /* number of buckets, power of two */
+static size_t g_dentry_names_count = 0;
+
+static void resize_dentry_names(size_t size) {
+    assert(locked(&g_dentry_names_lock));
+
+    struct dentry_name** names = calloc(size, sizeof(*names));
+    if (!names) {
+        /* keep the old table, lookups just get slower */
+        return;
+    }
+
+    for (size_t i = 0; i < g_dentry_names_size; i++) {
+        struct dentry_name* name = g_dentry_names[i];
+        while (name) {
+            struct dentry_name* next = name->next;
+            size_t idx = name->hash & (size - 1);
+            name->next = names[idx];
+            names[idx] = name;
+            name = next;
+        }
+    }
+
+    free(g_dentry_names);
+    g_dentry_names = names;
+    g_dentry_names_size = size;
+}
+
+/* Returns an interned copy of `str` (of length `len` and hash `hash`), with a reference taken, or
+ * NULL if out of memory. */
+static const char* get_dentry_name(const char* str, size_t len, HASHTYPE hash) {
+    const char* ret = NULL;
+
+    lock(&g_dentry_names_lock);
+
+    if (g_dentry_names_count >= g_dentry_names_size) {
+        resize_dentry_names(g_dentry_names_size ? g_dentry_names_size * 2 : DENTRY_NAMES_MIN_SIZE);
+        if (!g_dentry_names_size)
+            goto out;
+    }
+
+    struct dentry_name** bucket = &g_dentry_names[hash & (g_dentry_names_size - 1)];
+    struct dentry_name* name;
+    for (name = *bucket; name; name = name->next) {
+        if (name->hash == hash && name->len == len && memcmp(name->str, str, len) == 0) {
+            name->ref_count++;
+            ret = name->str;
+            goto out;
+        }
+    }
+
+    name = malloc(sizeof(*name) + len + 1);
+    if (!name)
+        goto out;
+    name->ref_count = 1;
+    name->hash = hash;
+    name->len = len;
+    memcpy(name->str, str, len);
+    name->str[len] = '\0';
+    name->next = *bucket;
+    *bucket = name;
+    g_dentry_names_count++;
+    ret = name->str;
+
+out:
+    unlock(&g_dentry_names_lock);
+    return ret;
+}
+
+static void put_dentry_name(const char* str) {
+    struct dentry_name* name = container_of(str, struct dentry_name, str);
+
+    lock(&g_dentry_names_lock);
+    assert(name->ref_count > 0);
+    if (--name->ref_count > 0) {
+        unlock(&g_dentry_names_lock);
+        return;
+    }
+
+    struct dentry_name** pprev = &g_dentry_names[name->hash & (g_dentry_names_size - 1)];
+    while (*pprev != name) {
+        assert(*pprev);
+        pprev = &(*pprev)->next;
+    }
+    *pprev = name->next;
+    g_dentry_names_count--;
+    unlock(&g_dentry_names_lock);
+
+    free(name);
+}
+
 static struct shim_dentry* alloc_dentry(void) {
     struct shim_dentry* dent =
         get_mem_obj_from_mgr_enlarge(dentry_mgr, size_align_up(DCACHE_MGR_ALLOC));
@@ -58,12 +170,21 @@ static struct shim_dentry* alloc_dentry(void) {
 static void free_dentry(struct shim_dentry* dentry);
 
 int init_dcache(void) {
-    if (!create_lock(&dcache_mgr_lock) || !create_lock(&g_dcache_lock)) {
+    if (!create_lock(&dcache_mgr_lock) || !create_lock(&g_dcache_lock)
+            || !create_lock(&g_dentry_names_lock)) {
         return -ENOMEM;
     }
 
     dentry_mgr = create_mem_mgr(init_align_up(DCACHE_MGR_ALLOC));
 
+    int64_t ttl_ms;
+    int ret = toml_int_in(g_manifest_root, "fs.negative_dentry_ttl_ms", /*defaultval=*/0, &ttl_ms);
+    if (ret < 0 || ttl_ms < 0) {
+        log_error("Cannot parse 'fs.negative_dentry_ttl_ms' (the value must be 0 or greater)");
+        return -EINVAL;
+    }
+    g_negative_dentry_ttl_us = (uint64_t)ttl_ms * 1000;
+
     if (g_pal_control->parent_process) {
         /* In a child process, `g_dentry_root` will be restored from a checkpoint. */
         return 0;
@@ -86,7 +207,8 @@ int init_dcache(void) {
     g_dentry_root->perm = PERM_rwx______;
     g_dentry_root->type = S_IFDIR;
 
-    char* name = strdup("");
+    HASHTYPE name_hash = hash_buf("", 0);
+    const char* name = get_dentry_name("", 0, name_hash);
     if (!name) {
         free_dentry(g_dentry_root);
         g_dentry_root = NULL;
@@ -94,6 +216,7 @@ int init_dcache(void) {
     }
     g_dentry_root->name = name;
     g_dentry_root->name_len = 0;
+    g_dentry_root->name_hash = name_hash;
 
     return 0;
 }
@@ -117,7 +240,9 @@ static void free_dentry(struct shim_dentry* dent) {
         put_mount(dent->mount);
     }
 
-    free(dent->name);
+    if (dent->name) {
+        put_dentry_name(dent->name);
+    }
 
     if (dent->parent) {
         put_dentry(dent->parent);
@@ -126,6 +251,7 @@ static void free_dentry(struct shim_dentry* dent) {
     assert(dent->nchildren == 0);
     assert(LISTP_EMPTY(&dent->children));
     assert(LIST_EMPTY(dent, siblings));
+    free(dent->children_hash);
 
     if (dent->attached_mount) {
         put_mount(dent->attached_mount);
@@ -156,6 +282,90 @@ void put_dentry(struct shim_dentry* dent) {
     }
 }
 
+static struct shim_dentry** children_hash_bucket(struct shim_dentry* parent, HASHTYPE name_hash) {
+    assert(parent->children_hash);
+    /* `children_hash_size` is always a power of two */
+    size_t idx = name_hash & (parent->children_hash_size - 1);
+    return &parent->children_hash[idx];
+}
+
+/* (Re)builds the name index of `parent` with `size` buckets. On allocation failure the old index
+ * (if any) is kept; lookups fall back to scanning `children` when there is none. */
+static void rehash_children(struct shim_dentry* parent, size_t size) {
+    struct shim_dentry** buckets = calloc(size, sizeof(*buckets));
+    if (!buckets)
+        return;
+
+    free(parent->children_hash);
+    parent->children_hash      = buckets;
+    parent->children_hash_size = size;
+
+    struct shim_dentry* child;
+    LISTP_FOR_EACH_ENTRY(child, &parent->children, siblings) {
+        struct shim_dentry** bucket = children_hash_bucket(parent, child->name_hash);
+        child->hash_next = *bucket;
+        *bucket = child;
+    }
+}
+
+static void add_child_to_hash(struct shim_dentry* parent, struct shim_dentry* dent) {
+    if (!parent->children_hash) {
+        if (parent->nchildren >= DENTRY_HASH_MIN_CHILDREN)
+            rehash_children(parent, 2 * DENTRY_HASH_MIN_CHILDREN);
+        /* either there is no index, or `dent` (already on `children`) was just indexed */
+        return;
+    }
+
+    if (parent->nchildren > 2 * parent->children_hash_size) {
+        size_t old_size = parent->children_hash_size;
+        rehash_children(parent, 4 * old_size);
+        if (parent->children_hash_size != old_size)
+            return;
+    }
+
+    struct shim_dentry** bucket = children_hash_bucket(parent, dent->name_hash);
+    dent->hash_next = *bucket;
+    *bucket = dent;
+}
+
+static void del_child_from_hash(struct shim_dentry* parent, struct shim_dentry* dent) {
+    if (!parent->children_hash)
+        return;
+
+    struct shim_dentry** pprev = children_hash_bucket(parent, dent->name_hash);
+    while (*pprev && *pprev != dent)
+        pprev = &(*pprev)->hash_next;
+    assert(*pprev == dent);
+    *pprev = dent->hash_next;
+    dent->hash_next = NULL;
+}
+
+/* Returns true if a negative dentry can still be trusted without asking the host again: always on
+ * immutable mounts, and for `g_negative_dentry_ttl_us` after the lookup that found it otherwise. */
+static bool negative_dentry_is_fresh(struct shim_dentry* dent) {
+    if (dent->mount && dent->mount->immutable)
+        return true;
+
+    if (!g_negative_dentry_ttl_us)
+        return false;
+
+    uint64_t now;
+    if (DkSystemTimeQuery(&now) < 0)
+        return false;
+    return now - dent->negative_time < g_negative_dentry_ttl_us;
+}
+
+/* With a TTL configured, an expired negative dentry is made invalid again, so that the next
+ * `validate_dentry` repeats the filesystem lookup. */
+static void expire_negative_dentry(struct shim_dentry* dent) {
+    if (!g_negative_dentry_ttl_us)
+        return;
+    if ((dent->state & (DENTRY_VALID | DENTRY_NEGATIVE)) != (DENTRY_VALID | DENTRY_NEGATIVE))
+        return;
+    if (!negative_dentry_is_fresh(dent))
+        dent->state &= ~(DENTRY_VALID | DENTRY_NEGATIVE);
+}
+
 void dentry_gc(struct shim_dentry* dent) {
     assert(locked(&g_dcache_lock));
     assert(dent->parent);
@@ -166,6 +376,12 @@ void dentry_gc(struct shim_dentry* dent) {
     if ((dent->state & DENTRY_VALID) && !(dent->state & DENTRY_NEGATIVE))
         return;
 
+    /* Keep cached negative lookups, so that repeated probes of nonexistent files (e.g. by the
+     * dynamic loader or Python imports) do not go to the host. */
+    if ((dent->state & DENTRY_VALID) && negative_dentry_is_fresh(dent))
+        return;
+
+    del_child_from_hash(dent->parent, dent);
     LISTP_DEL_INIT(dent, &dent->parent->children, siblings);
     dent->parent->nchildren--;
     /* This should delete `dent` */
@@ -182,12 +398,14 @@ struct shim_dentry* get_new_dentry(struct shim_mount* mount, struct shim_dentry*
     if (!dent)
         return NULL;
 
-    dent->name = alloc_substr(name, name_len);
+    HASHTYPE name_hash = hash_buf(name, name_len);
+    dent->name = get_dentry_name(name, name_len, name_hash);
     if (!dent->name) {
         free_dentry(dent);
         return NULL;
     }
-    dent->name_len = name_len;
+    dent->name_len  = name_len;
+    dent->name_hash = name_hash;
 
     if (parent && parent->nchildren >= DENTRY_MAX_CHILDREN) {
         log_warning("get_new_dentry: nchildren limit reached");
@@ -208,6 +426,7 @@ struct shim_dentry* get_new_dentry(struct shim_mount* mount, struct shim_dentry*
         get_dentry(dent);
         LISTP_ADD_TAIL(dent, &parent->children, siblings);
         parent->nchildren++;
+        add_child_to_hash(parent, dent);
     }
 
     return dent;
@@ -221,6 +440,11 @@ struct shim_dentry* dentry_up(struct shim_dentry* dent) {
 }
 
 struct shim_dentry* lookup_dcache(struct shim_dentry* parent, const char* name, size_t name_len) {
+    return __lookup_dcache(parent, name, name_len, hash_buf(name, name_len));
+}
+
+struct shim_dentry* __lookup_dcache(struct shim_dentry* parent, const char* name, size_t name_len,
+                                    HASHTYPE name_hash) {
     assert(locked(&g_dcache_lock));
 
     assert(parent);
@@ -228,8 +452,29 @@ struct shim_dentry* lookup_dcache(struct shim_dentry* parent, const char* name,
 
     struct shim_dentry* tmp;
     struct shim_dentry* dent;
+
+    if (parent->children_hash) {
+        /* Only the bucket of `name` is walked (and garbage-collected), which keeps lookups in
+         * directories with many thousands of cached entries cheap. */
+        dent = *children_hash_bucket(parent, name_hash);
+        while (dent) {
+            tmp = dent->hash_next;
+            if (dent->name_hash == name_hash && dent->name_len == name_len
+                    && memcmp(dent->name, name, dent->name_len) == 0) {
+                expire_negative_dentry(dent);
+                get_dentry(dent);
+                return dent;
+            }
+            dentry_gc(dent);
+            dent = tmp;
+        }
+        return NULL;
+    }
+
     LISTP_FOR_EACH_ENTRY_SAFE(dent, tmp, &parent->children, siblings) {
-        if (dent->name_len == name_len && memcmp(dent->name, name, dent->name_len) == 0) {
+        if (dent->name_hash == name_hash && dent->name_len == name_len
+                && memcmp(dent->name, name, dent->name_len) == 0) {
+            expire_negative_dentry(dent);
             get_dentry(dent);
             return dent;
         }
@@ -442,6 +687,13 @@ void dump_dcache(struct shim_dentry* dent) {
     unlock(&g_dcache_lock);
 }
 
+/*
+ * Only dentries which are pinned by something else in the checkpoint (handles, cwd and root of the
+ * process, mount points and mount roots) are checkpointed, together with their ancestors (needed
+ * for path reconstruction and ".."). Children are never followed, so the size of the checkpoint
+ * does not depend on how large the dcache of the parent has grown; the child looks up everything
+ * else again (`DENTRY_LISTED` is cleared, so directories are listed again as well).
+ */
 BEGIN_CP_FUNC(dentry_root) {
     __UNUSED(obj);
     __UNUSED(size);
@@ -488,6 +740,9 @@ BEGIN_CP_FUNC(dentry) {
         *new_dent = *dent;
         INIT_LISTP(&new_dent->children);
         INIT_LIST_HEAD(new_dent, siblings);
+        new_dent->children_hash      = NULL;
+        new_dent->children_hash_size = 0;
+        new_dent->hash_next          = NULL;
         clear_lock(&new_dent->lock);
         REF_SET(new_dent->ref_count, 0);
 
@@ -502,7 +757,8 @@ BEGIN_CP_FUNC(dentry) {
         /* `fs_lock` is used only by process leader. */
         new_dent->fs_lock = NULL;
 
-        DO_CP_MEMBER(str, dent, new_dent, name);
+        /* interned names are shared, `cp_str` copies each of them only once */
+        DO_CP(str, (char*)dent->name, &new_dent->name);
 
         if (new_dent->mount)
             DO_CP_MEMBER(mount, dent, new_dent, mount);
@@ -543,6 +799,12 @@ BEGIN_RS_FUNC(dentry) {
         return -ENOMEM;
     }
 
+    /* The checkpoint holds one copy of each name; intern it again in this process. */
+    dent->name = get_dentry_name(dent->name, dent->name_len, dent->name_hash);
+    if (!dent->name) {
+        return -ENOMEM;
+    }
+
     if (dent->mount) {
         get_mount(dent->mount);
     }
@@ -554,6 +816,7 @@ BEGIN_RS_FUNC(dentry) {
         get_dentry(dent->parent);
         get_dentry(dent);
         LISTP_ADD_TAIL(dent, &dent->parent->children, siblings);
+        add_child_to_hash(dent->parent, dent);
     }
 
     if (dent->attached_mount) {
@@ -59,6 +59,8 @@ int init_fs(void) {
         goto err;
     }
 
+    if ((ret = init_pseudo_fs()) < 0)
+        goto err;
     if ((ret = init_procfs()) < 0)
         goto err;
     if ((ret = init_devfs()) < 0)
@@ -87,10 +89,13 @@ static void free_mount(struct shim_mount* mount) {
 
 static bool mount_migrated = false;
 
+static int __mount_fs(const char* type, const char* uri, const char* mount_path, bool immutable);
+
 static int __mount_root(void) {
     int ret = 0;
     char* fs_root_type = NULL;
     char* fs_root_uri  = NULL;
+    bool fs_root_immutable;
 
     assert(g_manifest_root);
 
@@ -108,15 +113,23 @@ static int __mount_root(void) {
         goto out;
     }
 
+    ret = toml_bool_in(g_manifest_root, "fs.root.immutable", /*defaultval=*/false,
+                       &fs_root_immutable);
+    if (ret < 0) {
+        log_error("Cannot parse 'fs.root.immutable' (the value must be `true` or `false`)");
+        ret = -EINVAL;
+        goto out;
+    }
+
     if (fs_root_type && fs_root_uri) {
         log_debug("Mounting root as %s filesystem: from %s to /", fs_root_type, fs_root_uri);
-        if ((ret = mount_fs(fs_root_type, fs_root_uri, "/")) < 0) {
+        if ((ret = __mount_fs(fs_root_type, fs_root_uri, "/", fs_root_immutable)) < 0) {
             log_error("Mounting root filesystem failed (%d)", ret);
             goto out;
         }
     } else {
         log_debug("Mounting root as chroot filesystem: from file:. to /");
-        if ((ret = mount_fs("chroot", URI_PREFIX_FILE, "/")) < 0) {
+        if ((ret = __mount_fs("chroot", URI_PREFIX_FILE, "/", fs_root_immutable)) < 0) {
             log_error("Mounting root filesystem failed (%d)", ret);
             goto out;
         }
@@ -208,6 +221,15 @@ static int __mount_one_other(toml_table_t* mount) {
         goto out;
     }
 
+    bool mount_immutable;
+    ret = toml_bool_in(mount, "immutable", /*defaultval=*/false, &mount_immutable);
+    if (ret < 0) {
+        log_error("Cannot parse 'fs.mount.%s.immutable' (the value must be `true` or `false`)",
+                  key);
+        ret = -EINVAL;
+        goto out;
+    }
+
     log_debug("Mounting as %s filesystem: from %s to %s", mount_type, mount_uri, mount_path);
 
     if (!strcmp(mount_path, "/")) {
@@ -236,7 +258,7 @@ static int __mount_one_other(toml_table_t* mount) {
                   "recommended for use in production!", mount_uri);
     }
 
-    if ((ret = mount_fs(mount_type, mount_uri, mount_path)) < 0) {
+    if ((ret = __mount_fs(mount_type, mount_uri, mount_path, mount_immutable)) < 0) {
         log_error("Mounting %s on %s (type=%s) failed (%d)", mount_uri, mount_path, mount_type,
                   -ret);
         goto out;
@@ -383,7 +405,7 @@ struct shim_fs* find_fs(const char* name) {
 }
 
 static int mount_fs_at_dentry(const char* type, const char* uri, const char* mount_path,
-                              struct shim_dentry* mount_point) {
+                              struct shim_dentry* mount_point, bool immutable) {
     assert(locked(&g_dcache_lock));
     assert(!mount_point->attached_mount);
 
@@ -426,6 +448,7 @@ static int mount_fs_at_dentry(const char* type, const char* uri, const char* mou
     }
     mount->fs = fs;
     mount->data = mount_data;
+    mount->immutable = immutable;
 
     /* Attach mount to mountpoint, and the other way around */
 
@@ -486,7 +509,7 @@ err:
     return ret;
 }
 
-int mount_fs(const char* type, const char* uri, const char* mount_path) {
+static int __mount_fs(const char* type, const char* uri, const char* mount_path, bool immutable) {
     int ret;
     struct shim_dentry* mount_point = NULL;
 
@@ -498,7 +521,7 @@ int mount_fs(const char* type, const char* uri, const char* mount_path) {
         goto out;
     }
 
-    if ((ret = mount_fs_at_dentry(type, uri, mount_path, mount_point)) < 0)
+    if ((ret = mount_fs_at_dentry(type, uri, mount_path, mount_point, immutable)) < 0)
         goto out;
 
     ret = 0;
@@ -510,6 +533,10 @@ out:
     return ret;
 }
 
+int mount_fs(const char* type, const char* uri, const char* mount_path) {
+    return __mount_fs(type, uri, mount_path, /*immutable=*/false);
+}
+
 /*
  * XXX: These two functions are useless - `mount` is not freed even if refcount reaches 0.
  * Unfortunately Graphene is not keeping track of this refcount correctly, so we cannot free
@@ -0,0 +1,360 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/*
+ * Page cache for host-backed files, see `shim_fs_cache.h`.
+ *
+ * All pages of all files live in one hash table, keyed by (cache, page index), and on one global
+ * LRU list used for eviction once `fs.file_cache_size` is reached. A single lock protects all of
+ * it; it is never held while talking to the host.
+ */
+
+#include "list.h"
+#include "shim_fs_cache.h"
+#include "shim_internal.h"
+#include "shim_lock.h"
+#include "shim_utils.h"
+
+#define FILE_CACHE_PAGE_SIZE 4096
+/* Number of pages read from the host on a miss. Reads of at least this size bypass the cache. */
+#define FILE_CACHE_READAHEAD 16
+
+DEFINE_LIST(file_cache_page);
+DEFINE_LISTP(file_cache_page);
+struct file_cache_page {
+    struct shim_file_cache* cache;
+    uint64_t index;
+    /* Number of valid bytes; less than a full page only for the page containing end of file. */
+    size_t valid;
+    struct file_cache_page* hash_next;
+    LIST_TYPE(file_cache_page) lru;
+    LIST_TYPE(file_cache_page) list;
+    char data[FILE_CACHE_PAGE_SIZE];
+};
+
+struct shim_file_cache {
+    LISTP_TYPE(file_cache_page) pages;
+    /* The page containing end of file (if cached and not full), see `file_cache_write`. */
+    struct file_cache_page* partial;
+    /* Incremented on every change of the file, so that data read from the host concurrently with
+     * a change is not added to the cache (see `fill_pages`). */
+    uint64_t generation;
+};
+
+static struct shim_lock g_file_cache_lock;
+static size_t g_file_cache_max_pages = 0;
+static size_t g_file_cache_pages_cnt = 0;
+static LISTP_TYPE(file_cache_page) g_file_cache_lru; /* most recently used first */
+static struct file_cache_page** g_file_cache_hash;
+static size_t g_file_cache_hash_size;
+
+int init_file_cache(void) {
+    uint64_t cache_size;
+    int ret = toml_sizestring_in(g_manifest_root, "fs.file_cache_size", /*defaultval=*/0,
+                                 &cache_size);
+    if (ret < 0) {
+        log_error("Cannot parse 'fs.file_cache_size'");
+        return -EINVAL;
+    }
+
+    size_t max_pages = cache_size / FILE_CACHE_PAGE_SIZE;
+    if (!max_pages)
+        return 0;
+
+    if (!create_lock(&g_file_cache_lock))
+        return -ENOMEM;
+
+    size_t hash_size = 64;
+    while (hash_size < max_pages)
+        hash_size *= 2;
+
+    g_file_cache_hash = calloc(hash_size, sizeof(*g_file_cache_hash));
+    if (!g_file_cache_hash)
+        return -ENOMEM;
+
+    g_file_cache_hash_size  = hash_size;
+    g_file_cache_max_pages = max_pages;
+    INIT_LISTP(&g_file_cache_lru);
+    return 0;
+}
+
+static struct file_cache_page** hash_bucket(struct shim_file_cache* cache, uint64_t index) {
+    uint64_t hash = hash64((uint64_t)(uintptr_t)cache ^ (index * 0x9e3779b97f4a7c15ULL));
+    return &g_file_cache_hash[hash & (g_file_cache_hash_size - 1)];
+}
+
+static struct file_cache_page* find_page(struct shim_file_cache* cache, uint64_t index) {
+    assert(locked(&g_file_cache_lock));
+
+    struct file_cache_page* page = *hash_bucket(cache, index);
+    while (page && (page->cache != cache || page->index != index))
+        page = page->hash_next;
+    return page;
+}
+
+static void drop_page(struct file_cache_page* page) {
+    assert(locked(&g_file_cache_lock));
+
+    struct shim_file_cache* cache = page->cache;
+
+    struct file_cache_page** pprev = hash_bucket(cache, page->index);
+    while (*pprev != page)
+        pprev = &(*pprev)->hash_next;
+    *pprev = page->hash_next;
+
+    LISTP_DEL(page, &g_file_cache_lru, lru);
+    LISTP_DEL(page, &cache->pages, list);
+    if (cache->partial == page)
+        cache->partial = NULL;
+
+    g_file_cache_pages_cnt--;
+    free(page);
+}
+
+/* Adds a page with `size` bytes of `data` (possibly less than a page at end of file), replacing
+ * any page with the same index. Evicts the least recently used page if the cache is full. */
+static void insert_page(struct shim_file_cache* cache, uint64_t index, const char* data,
+                        size_t size) {
+    assert(locked(&g_file_cache_lock));
+
+    struct file_cache_page* page = find_page(cache, index);
+    if (page)
+        drop_page(page);
+
+    if (g_file_cache_pages_cnt >= g_file_cache_max_pages)
+        drop_page(LISTP_LAST_ENTRY(&g_file_cache_lru, struct file_cache_page, lru));
+
+    page = malloc(sizeof(*page));
+    if (!page)
+        return;
+
+    page->cache = cache;
+    page->index = index;
+    page->valid = size;
+    memcpy(page->data, data, size);
+
+    struct file_cache_page** bucket = hash_bucket(cache, index);
+    page->hash_next = *bucket;
+    *bucket = page;
+
+    INIT_LIST_HEAD(page, lru);
+    LISTP_ADD(page, &g_file_cache_lru, lru);
+    INIT_LIST_HEAD(page, list);
+    LISTP_ADD(page, &cache->pages, list);
+
+    if (size < FILE_CACHE_PAGE_SIZE) {
+        /* a new end of file, any previous one is outdated */
+        if (cache->partial)
+            drop_page(cache->partial);
+        cache->partial = page;
+    }
+
+    g_file_cache_pages_cnt++;
+}
+
+struct shim_file_cache* file_cache_create(void) {
+    if (!g_file_cache_max_pages)
+        return NULL;
+
+    struct shim_file_cache* cache = malloc(sizeof(*cache));
+    if (!cache)
+        return NULL;
+
+    INIT_LISTP(&cache->pages);
+    cache->partial    = NULL;
+    cache->generation = 0;
+    return cache;
+}
+
+void file_cache_invalidate(struct shim_file_cache* cache) {
+    if (!cache)
+        return;
+
+    lock(&g_file_cache_lock);
+    cache->generation++;
+    struct file_cache_page* page;
+    struct file_cache_page* tmp;
+    LISTP_FOR_EACH_ENTRY_SAFE(page, tmp, &cache->pages, list) {
+        drop_page(page);
+    }
+    unlock(&g_file_cache_lock);
+}
+
+void file_cache_destroy(struct shim_file_cache* cache) {
+    if (!cache)
+        return;
+
+    file_cache_invalidate(cache);
+    free(cache);
+}
+
+/*
+ * Reads the read-ahead window starting at page `index` from the host, adds it to the cache and
+ * copies the part requested by the caller (starting at `in_page` bytes into the first page) into
+ * `buf`. Copying from the freshly read data (and not from the cache) guarantees progress even if
+ * the pages get evicted right away. Returns the number of bytes copied, 0 at end of file.
+ */
+static ssize_t fill_pages(struct shim_file_cache* cache, PAL_HANDLE pal_handle, uint64_t index,
+                          size_t in_page, void* buf, size_t count) {
+    size_t window = MIN((size_t)FILE_CACHE_READAHEAD, g_file_cache_max_pages);
+    size_t size = window * FILE_CACHE_PAGE_SIZE;
+
+    char* tmp = malloc(size);
+    if (!tmp)
+        return -ENOMEM;
+
+    lock(&g_file_cache_lock);
+    uint64_t generation = cache->generation;
+    unlock(&g_file_cache_lock);
+
+    size_t read = 0;
+    while (read < size) {
+        size_t want  = size - read;
+        size_t chunk = want;
+        int ret = DkStreamRead(pal_handle, index * FILE_CACHE_PAGE_SIZE + read, &chunk, tmp + read,
+                               NULL, 0);
+        if (ret < 0) {
+            free(tmp);
+            return pal_to_unix_errno(ret);
+        }
+        read += chunk;
+        /* regular files return short reads only at end of file */
+        if (chunk < want)
+            break;
+    }
+
+    lock(&g_file_cache_lock);
+    for (size_t off = 0; off < read || (off == read && read < size); off += FILE_CACHE_PAGE_SIZE) {
+        if (cache->generation != generation)
+            break;
+        /* the (possibly empty) page containing end of file is cached too, it records the EOF */
+        insert_page(cache, index + off / FILE_CACHE_PAGE_SIZE, tmp + off,
+                    MIN((size_t)FILE_CACHE_PAGE_SIZE, read - off));
+        if (read - off < FILE_CACHE_PAGE_SIZE)
+            break;
+    }
+    unlock(&g_file_cache_lock);
+
+    size_t copied = 0;
+    if (in_page < read) {
+        copied = MIN(count, read - in_page);
+        memcpy(buf, tmp + in_page, copied);
+    }
+    free(tmp);
+    return copied;
+}
+
+ssize_t file_cache_read(struct shim_file_cache* cache, PAL_HANDLE pal_handle, file_off_t pos,
+                        void* buf, size_t count) {
+    if (count >= FILE_CACHE_READAHEAD * FILE_CACHE_PAGE_SIZE) {
+        /* large reads gain nothing from the cache, read directly into the user buffer */
+        int ret = DkStreamRead(pal_handle, pos, &count, buf, NULL, 0);
+        return ret < 0 ? pal_to_unix_errno(ret) : (ssize_t)count;
+    }
+
+    size_t done = 0;
+    while (done < count) {
+        uint64_t index = (pos + done) / FILE_CACHE_PAGE_SIZE;
+        size_t in_page = (pos + done) % FILE_CACHE_PAGE_SIZE;
+
+        lock(&g_file_cache_lock);
+        struct file_cache_page* page = find_page(cache, index);
+        if (page) {
+            LISTP_DEL(page, &g_file_cache_lru, lru);
+            LISTP_ADD(page, &g_file_cache_lru, lru);
+
+            size_t n = 0;
+            if (in_page < page->valid) {
+                n = MIN(page->valid - in_page, count - done);
+                memcpy((char*)buf + done, page->data + in_page, n);
+            }
+            bool eof = page->valid < FILE_CACHE_PAGE_SIZE && in_page + n >= page->valid;
+            unlock(&g_file_cache_lock);
+
+            done += n;
+            if (eof)
+                break;
+            continue;
+        }
+        unlock(&g_file_cache_lock);
+
+        ssize_t ret = fill_pages(cache, pal_handle, index, in_page, (char*)buf + done,
+                                 count - done);
+        if (ret < 0)
+            return done ? (ssize_t)done : ret;
+        if (!ret)
+            break;
+        /* if this was a short read, the next iteration finds the cached end of file */
+        done += ret;
+    }
+
+    return done;
+}
+
+void file_cache_write(struct shim_file_cache* cache, file_off_t pos, const void* buf,
+                      size_t count) {
+    if (!cache || !count)
+        return;
+
+    uint64_t first = pos / FILE_CACHE_PAGE_SIZE;
+    uint64_t last  = (pos + count - 1) / FILE_CACHE_PAGE_SIZE;
+
+    lock(&g_file_cache_lock);
+    cache->generation++;
+
+    /* Writing past the cached end of file turns the rest of its page into a (zero-filled) hole. */
+    if (cache->partial && cache->partial->index < first)
+        drop_page(cache->partial);
+
+    for (uint64_t index = first; index <= last; index++) {
+        struct file_cache_page* page = find_page(cache, index);
+        if (!page)
+            continue;
+
+        size_t start = index == first ? pos % FILE_CACHE_PAGE_SIZE : 0;
+        size_t end   = index == last ? (pos + count - 1) % FILE_CACHE_PAGE_SIZE + 1
+                                     : FILE_CACHE_PAGE_SIZE;
+        if (start > page->valid) {
+            /* hole between the old end of file and the write */
+            drop_page(page);
+            continue;
+        }
+
+        memcpy(page->data + start, (const char*)buf + (index * FILE_CACHE_PAGE_SIZE + start - pos),
+               end - start);
+        if (end > page->valid) {
+            page->valid = end;
+            if (end == FILE_CACHE_PAGE_SIZE && cache->partial == page)
+                cache->partial = NULL;
+        }
+    }
+
+    unlock(&g_file_cache_lock);
+}
+
+void file_cache_truncate(struct shim_file_cache* cache, file_off_t len) {
+    if (!cache)
+        return;
+
+    uint64_t eof_index = len / FILE_CACHE_PAGE_SIZE;
+    size_t eof_in_page = len % FILE_CACHE_PAGE_SIZE;
+
+    lock(&g_file_cache_lock);
+    cache->generation++;
+
+    struct file_cache_page* page;
+    struct file_cache_page* tmp;
+    LISTP_FOR_EACH_ENTRY_SAFE(page, tmp, &cache->pages, list) {
+        if (page->index > eof_index || (page->index == eof_index && page->valid < eof_in_page)) {
+            /* past the new end of file, or extended with a hole */
+            drop_page(page);
+        } else if (page->index == eof_index) {
+            page->valid = eof_in_page;
+            cache->partial = page;
+        } else if (page->valid < FILE_CACHE_PAGE_SIZE) {
+            /* old end of file before the new one: the rest of the page is now a hole */
+            drop_page(page);
+        }
+    }
+
+    unlock(&g_file_cache_lock);
+}
@@ -8,29 +8,69 @@
 #include "shim_fs.h"
 #include "shim_internal.h"
 
-HASHTYPE hash_str(const char* p) {
-    HASHTYPE hash = 0;
-    HASHTYPE tmp;
+/*
+ * The hashes below follow the structure of wyhash: the input is consumed in little-endian 64-bit
+ * words, each one folded into the state with a 64x64->128-bit multiply whose halves are XOR-ed
+ * together. This mixes every input bit into the whole state, so names that differ only in a few
+ * characters (e.g. `shard-000123` and `shard-000124`) do not collide, unlike with the previous
+ * add-and-multiply hash. `hash_buf` and `hash_path_component` produce identical values.
+ */
+
+#define HASH_SEED 0xa0761d6478bd642fULL
+#define HASH_MUL1 0xe7037ed1a0b428dbULL
+#define HASH_MUL2 0x8ebc6af09c88c6e3ULL
 
-    size_t len = strlen(p);
+static inline uint64_t hash_mix(uint64_t a, uint64_t b) {
+    __uint128_t r = (__uint128_t)a * b;
+    return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+static inline uint64_t hash_word(uint64_t state, uint64_t word) {
+    return hash_mix(state ^ word, HASH_MUL1);
+}
 
-    for (; len >= sizeof(hash); p += sizeof(hash), len -= sizeof(hash)) {
-        memcpy(&tmp, p, sizeof(tmp)); /* avoid pointer alignment issues */
-        hash += tmp;
-        hash *= 9;
+static inline uint64_t hash_final(uint64_t state, uint64_t tail, size_t len) {
+    return hash_mix(state ^ tail ^ HASH_MUL2, HASH_MUL1 ^ len);
+}
+
+HASHTYPE hash_buf(const char* p, size_t len) {
+    uint64_t state = HASH_SEED;
+    size_t left = len;
+
+    for (; left >= sizeof(uint64_t); p += sizeof(uint64_t), left -= sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, p, sizeof(word)); /* avoid pointer alignment issues */
+        state = hash_word(state, word);
     }
 
-    if (len) {
-        HASHTYPE rest = 0;
-        for (; len > 0; p++, len--) {
-            rest <<= 8;
-            rest += (HASHTYPE)*p;
+    uint64_t tail = 0;
+    for (size_t i = 0; i < left; i++)
+        tail |= (uint64_t)(unsigned char)p[i] << (8 * i);
+
+    return hash_final(state, tail, len);
+}
+
+HASHTYPE hash_path_component(const char* name, size_t* out_len) {
+    uint64_t state = HASH_SEED;
+    uint64_t word  = 0;
+    size_t len = 0;
+
+    /* Cannot read ahead word-at-a-time here: the component may end right before an unmapped page,
+     * so bytes are gathered one by one and mixed in as soon as a word is complete. */
+    for (; name[len] != '\0' && name[len] != '/'; len++) {
+        word |= (uint64_t)(unsigned char)name[len] << (8 * (len % sizeof(uint64_t)));
+        if (len % sizeof(uint64_t) == sizeof(uint64_t) - 1) {
+            state = hash_word(state, word);
+            word  = 0;
         }
-        hash += rest;
-        hash *= 9;
     }
 
-    return hash;
+    *out_len = len;
+    return hash_final(state, word, len);
+}
+
+HASHTYPE hash_str(const char* p) {
+    return hash_buf(p, strlen(p));
 }
 
 HASHTYPE hash_name(HASHTYPE parent_hbuf, const char* name) {
@@ -45,7 +85,25 @@ HASHTYPE hash_abs_path(struct shim_dentry* dent) {
         if (!up)
             break;
 
-        digest += hash_str(dent->name);
+        digest += dent->name_hash;
+        digest *= 9;
+        dent = up;
+    }
+    return digest;
+}
+
+HASHTYPE hash_abs_path_child(struct shim_dentry* dir, HASHTYPE name_hash) {
+    /* Same as the first iteration of `hash_abs_path` for the child, followed by the rest of
+     * iterations for `dir`. */
+    HASHTYPE digest = name_hash * 9;
+
+    struct shim_dentry* dent = dir;
+    while (true) {
+        struct shim_dentry* up = dentry_up(dent);
+        if (!up)
+            break;
+
+        digest += dent->name_hash;
         digest *= 9;
         dent = up;
     }
@@ -39,15 +39,31 @@ struct posix_lock_request {
     LIST_TYPE(posix_lock_request) list;
 };
 
+/*
+ * POSIX locks held by a single PID on a file. The ranges of a single PID do not overlap, so a tree
+ * ordered by range lets us find the locks overlapping a given range in logarithmic time, both when
+ * merging/splitting the locks of that PID and when looking for conflicts with other PIDs.
+ */
+DEFINE_LISTP(posix_lock_owner);
+DEFINE_LIST(posix_lock_owner);
+struct posix_lock_owner {
+    IDTYPE pid;
+
+    /* Locks ordered by position (see `posix_lock_cmp`). */
+    struct avl_tree locks;
+    size_t locks_cnt;
+
+    LIST_TYPE(posix_lock_owner) list;
+};
+
 /* Describes file lock details for a given dentry. Currently holds only POSIX locks. */
 DEFINE_LISTP(fs_lock);
 DEFINE_LIST(fs_lock);
 struct fs_lock {
     struct shim_dentry* dent;
 
-    /* POSIX locks, sorted by PID and then by start position (so that we are able to merge and split
-     * locks). The ranges do not overlap within a given PID. Protected by `dent->lock`. */
-    LISTP_TYPE(posix_lock) posix_locks;
+    /* POSIX locks, grouped by PID. Protected by `dent->lock`. */
+    LISTP_TYPE(posix_lock_owner) posix_lock_owners;
 
     /* Pending requests. Protected by `dent->lock`. */
     LISTP_TYPE(posix_lock_request) posix_lock_requests;
@@ -62,6 +78,60 @@ static LISTP_TYPE(fs_lock) g_fs_lock_list = LISTP_INIT;
 /* Global lock for `g_fs_lock_list`. */
 static struct shim_lock g_fs_lock_lock;
 
+static bool posix_lock_cmp(struct avl_tree_node* node_a, struct avl_tree_node* node_b) {
+    struct posix_lock* a = container_of(node_a, struct posix_lock, tree_node);
+    struct posix_lock* b = container_of(node_b, struct posix_lock, tree_node);
+
+    /* The ranges do not overlap, so ordering by end is the same as ordering by start. */
+    return a->end <= b->end;
+}
+
+/* Returns whether `pos` is smaller than or inside a lock (`node`). */
+static bool cmp_pos_to_posix_lock(void* pos, struct avl_tree_node* node) {
+    struct posix_lock* pl = container_of(node, struct posix_lock, tree_node);
+
+    return *(uint64_t*)pos <= pl->end;
+}
+
+static struct posix_lock* node2posix_lock(struct avl_tree_node* node) {
+    if (!node)
+        return NULL;
+    return container_of(node, struct posix_lock, tree_node);
+}
+
+/* Returns the first lock of `owner` that ends at or after `pos`. */
+static struct posix_lock* posix_lock_lower_bound(struct posix_lock_owner* owner, uint64_t pos) {
+    return node2posix_lock(avl_tree_lower_bound_fn(&owner->locks, &pos, cmp_pos_to_posix_lock));
+}
+
+static struct posix_lock* posix_lock_next(struct posix_lock* pl) {
+    return node2posix_lock(avl_tree_next(&pl->tree_node));
+}
+
+static struct posix_lock_owner* find_posix_lock_owner(struct fs_lock* fs_lock, IDTYPE pid) {
+    assert(locked(&fs_lock->dent->lock));
+
+    struct posix_lock_owner* owner;
+    LISTP_FOR_EACH_ENTRY(owner, &fs_lock->posix_lock_owners, list) {
+        if (owner->pid == pid)
+            return owner;
+    }
+    return NULL;
+}
+
+/* Removes all locks of `owner`, and `owner` itself. */
+static void destroy_posix_lock_owner(struct fs_lock* fs_lock, struct posix_lock_owner* owner) {
+    assert(locked(&fs_lock->dent->lock));
+
+    struct avl_tree_node* node;
+    while ((node = avl_tree_first(&owner->locks))) {
+        avl_tree_delete(&owner->locks, node);
+        free(node2posix_lock(node));
+    }
+    LISTP_DEL(owner, &fs_lock->posix_lock_owners, list);
+    free(owner);
+}
+
 int init_fs_lock(void) {
     if (g_process_ipc_ids.leader_vmid)
         return 0;
@@ -77,7 +147,7 @@ static int find_fs_lock(struct shim_dentry* dent, bool create, struct fs_lock**
             return -ENOMEM;
         fs_lock->dent = dent;
         get_dentry(dent);
-        INIT_LISTP(&fs_lock->posix_locks);
+        INIT_LISTP(&fs_lock->posix_lock_owners);
         INIT_LISTP(&fs_lock->posix_lock_requests);
         dent->fs_lock = fs_lock;
 
@@ -99,33 +169,31 @@ static int posix_lock_dump_write_all(const char* str, size_t size, void* arg) {
 static void posix_lock_dump(struct fs_lock* fs_lock) {
     assert(locked(&fs_lock->dent->lock));
     struct print_buf buf = INIT_PRINT_BUF(&posix_lock_dump_write_all);
-    IDTYPE pid = 0;
-
-    struct posix_lock* pl;
-    LISTP_FOR_EACH_ENTRY(pl, &fs_lock->posix_locks, list) {
-        if (pl->pid != pid) {
-            if (pid != 0)
-                buf_flush(&buf);
-            pid = pl->pid;
-            buf_printf(&buf, "%d:", pid);
-        }
 
-        char c;
-        switch (pl->type) {
-            case F_RDLCK: c = 'r'; break;
-            case F_WRLCK: c = 'w'; break;
-            default: c = '?'; break;
-        }
-        if (pl->end == FS_LOCK_EOF) {
-            buf_printf(&buf, " %c[%lu..end]", c, pl->start);
-        } else {
-            buf_printf(&buf, " %c[%lu..%lu]", c, pl->start, pl->end);
+    struct posix_lock_owner* owner;
+    LISTP_FOR_EACH_ENTRY(owner, &fs_lock->posix_lock_owners, list) {
+        buf_printf(&buf, "%d:", owner->pid);
+
+        for (struct posix_lock* pl = node2posix_lock(avl_tree_first(&owner->locks)); pl;
+                pl = posix_lock_next(pl)) {
+            char c;
+            switch (pl->type) {
+                case F_RDLCK: c = 'r'; break;
+                case F_WRLCK: c = 'w'; break;
+                default: c = '?'; break;
+            }
+            if (pl->end == FS_LOCK_EOF) {
+                buf_printf(&buf, " %c[%lu..end]", c, pl->start);
+            } else {
+                buf_printf(&buf, " %c[%lu..%lu]", c, pl->start, pl->end);
+            }
         }
+        buf_flush(&buf);
     }
-    if (LISTP_EMPTY(&fs_lock->posix_locks)) {
+    if (LISTP_EMPTY(&fs_lock->posix_lock_owners)) {
         buf_printf(&buf, "no locks");
+        buf_flush(&buf);
     }
-    buf_flush(&buf);
 }
 
 /* Removes `fs_lock` if it's not necessary (i.e. no locks are held or requested for a file). */
@@ -133,7 +201,8 @@ static void fs_lock_gc(struct fs_lock* fs_lock) {
     assert(locked(&fs_lock->dent->lock));
     if (g_log_level >= LOG_LEVEL_TRACE)
         posix_lock_dump(fs_lock);
-    if (LISTP_EMPTY(&fs_lock->posix_locks) && LISTP_EMPTY(&fs_lock->posix_lock_requests)) {
+    if (LISTP_EMPTY(&fs_lock->posix_lock_owners)
+            && LISTP_EMPTY(&fs_lock->posix_lock_requests)) {
         struct shim_dentry* dent = fs_lock->dent;
         dent->fs_lock = NULL;
 
@@ -154,11 +223,18 @@ static struct posix_lock* posix_lock_find_conflict(struct fs_lock* fs_lock, stru
     assert(locked(&fs_lock->dent->lock));
     assert(pl->type != F_UNLCK);
 
-    struct posix_lock* cur;
-    LISTP_FOR_EACH_ENTRY(cur, &fs_lock->posix_locks, list) {
-        if (cur->pid != pl->pid && pl->start <= cur->end && cur->start <= pl->end
-               && (cur->type == F_WRLCK || pl->type == F_WRLCK))
-            return cur;
+    struct posix_lock_owner* owner;
+    LISTP_FOR_EACH_ENTRY(owner, &fs_lock->posix_lock_owners, list) {
+        if (owner->pid == pl->pid)
+            continue;
+
+        /* Visit the locks of `owner` overlapping with `pl`, starting from the first one that ends
+         * inside or after `pl`. */
+        for (struct posix_lock* cur = posix_lock_lower_bound(owner, pl->start);
+                cur && cur->start <= pl->end; cur = posix_lock_next(cur)) {
+            if (cur->type == F_WRLCK || pl->type == F_WRLCK)
+                return cur;
+        }
     }
     return NULL;
 }
@@ -191,7 +267,13 @@ static int posix_lock_add_request(struct fs_lock* fs_lock, struct posix_lock* pl
 static int _posix_lock_set(struct fs_lock* fs_lock, struct posix_lock* pl) {
     assert(locked(&fs_lock->dent->lock));
 
-    /* Preallocate new locks first, so that we don't fail after modifying something. */
+    struct posix_lock_owner* owner = find_posix_lock_owner(fs_lock, pl->pid);
+    if (!owner && pl->type == F_UNLCK) {
+        /* Nothing to unlock. */
+        return 0;
+    }
+
+    /* Preallocate new objects first, so that we don't fail after modifying something. */
 
     /* Lock to be added. Not necessary for F_UNLCK, because we're only removing existing locks. */
     struct posix_lock* new = NULL;
@@ -208,55 +290,59 @@ static int _posix_lock_set(struct fs_lock* fs_lock, struct posix_lock* pl) {
         return -ENOMEM;
     }
 
+    if (!owner) {
+        owner = malloc(sizeof(*owner));
+        if (!owner) {
+            free(new);
+            free(extra);
+            return -ENOMEM;
+        }
+        owner->pid = pl->pid;
+        owner->locks.root = NULL;
+        owner->locks.cmp = posix_lock_cmp;
+        owner->locks_cnt = 0;
+        LISTP_ADD(owner, &fs_lock->posix_lock_owners, list);
+    }
+
     /* Target range: we will be changing it when merging existing locks. */
     uint64_t start = pl->start;
     uint64_t end   = pl->end;
 
-    /* `prev` will be set to the last lock before target range, so that we add the new lock just
-     * after `prev`. */
-    struct posix_lock* prev = NULL;
-
-    struct posix_lock* cur;
-    struct posix_lock* tmp;
-    LISTP_FOR_EACH_ENTRY_SAFE(cur, tmp, &fs_lock->posix_locks, list) {
-        if (cur->pid < pl->pid) {
-            prev = cur;
-            continue;
-        }
-        if (pl->pid < cur->pid) {
-            break;
-        }
+    /* Locks ending before `start - 1` can be neither merged with the target range nor overlap it, so
+     * start with the first lock that ends later. */
+    struct posix_lock* cur = posix_lock_lower_bound(owner, start > 0 ? start - 1 : 0);
+    while (cur) {
+        /* `cur` might get deleted below */
+        struct posix_lock* next = posix_lock_next(cur);
 
         if (cur->type == pl->type) {
             /* Same lock type: we can possibly merge the locks. */
 
-            if (start > 0 && cur->end < start - 1) {
-                /* `cur` ends before target range begins, and is not even adjacent */
-                prev = cur;
-            } else if (end < FS_LOCK_EOF && end + 1 < cur->start) {
+            if (end < FS_LOCK_EOF && end + 1 < cur->start) {
                 /* `cur` begins after target range ends, and is not even adjacent - we're
                  * done */
                 break;
-            } else {
-                /* `cur` is either adjacent to target range, or overlaps with it. Delete it, and
-                 * expand the target range. */
-                start = MIN(start, cur->start);
-                end = MAX(end, cur->end);
-                LISTP_DEL(cur, &fs_lock->posix_locks, list);
-                free(cur);
             }
+
+            /* `cur` is either adjacent to target range, or overlaps with it. Delete it, and
+             * expand the target range. */
+            start = MIN(start, cur->start);
+            end = MAX(end, cur->end);
+            avl_tree_delete(&owner->locks, &cur->tree_node);
+            owner->locks_cnt--;
+            free(cur);
         } else {
             /* Different lock types: if they overlap, we delete the target range. */
 
             if (cur->end < start) {
-                /* `cur` ends before target range begins */
-                prev = cur;
+                /* `cur` ends before target range begins (it's adjacent) */
             } else if (end < cur->start) {
                 /* `cur` begins after target range ends - we're done */
                 break;
             } else if (cur->start < start && cur->end <= end) {
                 /*
-                 * `cur` overlaps with beginning of target range. Shorten `cur`.
+                 * `cur` overlaps with beginning of target range. Shorten `cur` (this does not
+                 * change its position in the tree).
                  *
                  * cur:  =======
                  * tgt:    -------
@@ -265,7 +351,6 @@ static int _posix_lock_set(struct fs_lock* fs_lock, struct posix_lock* pl) {
                  */
                 assert(start > 0);
                 cur->end = start - 1;
-                prev = cur;
             } else if (cur->start < start && cur->end > end) {
                 /*
                  * The target range is inside `cur`. Split `cur` and finish.
@@ -286,10 +371,9 @@ static int _posix_lock_set(struct fs_lock* fs_lock, struct posix_lock* pl) {
                 extra->end = cur->end;
                 extra->pid = cur->pid;
                 cur->end = start - 1;
-                LISTP_ADD_AFTER(extra, cur, &fs_lock->posix_locks, list);
+                avl_tree_insert(&owner->locks, &extra->tree_node);
+                owner->locks_cnt++;
                 extra = NULL;
-                /* We're done: the new lock, if any, will be added after `cur`. */
-                prev = cur;
                 break;
             } else if (start <= cur->start && cur->end <= end) {
                 /*
@@ -298,7 +382,8 @@ static int _posix_lock_set(struct fs_lock* fs_lock, struct posix_lock* pl) {
                  * cur:    ====
                  * tgt:  --------
                  */
-                LISTP_DEL(cur, &fs_lock->posix_locks, list);
+                avl_tree_delete(&owner->locks, &cur->tree_node);
+                owner->locks_cnt--;
                 free(cur);
             } else {
                 /*
@@ -315,34 +400,31 @@ static int _posix_lock_set(struct fs_lock* fs_lock, struct posix_lock* pl) {
                 break;
             }
         }
+        cur = next;
     }
 
     if (new) {
         assert(pl->type != F_UNLCK);
 
-
         new->type = pl->type;
         new->start = start;
         new->end = end;
         new->pid = pl->pid;
 
 #ifdef DEBUG
-        /* Assert that list order is preserved */
-        struct posix_lock* next = prev ? LISTP_NEXT_ENTRY(prev, &fs_lock->posix_locks, list)
-            : LISTP_FIRST_ENTRY(&fs_lock->posix_locks, struct posix_lock, list);
-        if (prev)
-            assert(prev->pid < pl->pid || (prev->pid == pl->pid && prev->end < start));
+        /* Assert that the new lock does not overlap with its neighbours */
+        struct posix_lock* next = posix_lock_lower_bound(owner, start);
         if (next)
-            assert(pl->pid < next->pid || (pl->pid == next->pid && end < next->start));
+            assert(end < next->start);
 #endif
 
-        if (prev) {
-            LISTP_ADD_AFTER(new, prev, &fs_lock->posix_locks, list);
-        } else {
-            LISTP_ADD(new, &fs_lock->posix_locks, list);
-        }
+        avl_tree_insert(&owner->locks, &new->tree_node);
+        owner->locks_cnt++;
     }
 
+    if (owner->locks_cnt == 0)
+        destroy_posix_lock_owner(fs_lock, owner);
+
     if (extra)
         free(extra);
     return 0;
@@ -642,14 +724,10 @@ static int posix_lock_clear_pid_from_dentry(struct shim_dentry* dent, IDTYPE pid
 
     bool changed = false;
 
-    struct posix_lock* pl;
-    struct posix_lock* pl_tmp;
-    LISTP_FOR_EACH_ENTRY_SAFE(pl, pl_tmp, &fs_lock->posix_locks, list) {
-        if (pl->pid == pid) {
-            LISTP_DEL(pl, &fs_lock->posix_locks, list);
-            free(pl);
-            changed = true;
-        }
+    struct posix_lock_owner* owner = find_posix_lock_owner(fs_lock, pid);
+    if (owner) {
+        destroy_posix_lock_owner(fs_lock, owner);
+        changed = true;
     }
 
     struct posix_lock_request* req;
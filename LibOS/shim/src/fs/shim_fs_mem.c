@@ -96,3 +96,164 @@ int mem_file_poll(struct shim_mem_file* mem, file_off_t pos, int poll_type) {
         ret |= FS_POLL_WR;
     return ret;
 }
+
+void extent_file_init(struct shim_extent_file* file) {
+    file->extents = NULL;
+    file->extents_cnt = 0;
+    file->first_extent_size = 0;
+    file->size = 0;
+}
+
+void extent_file_destroy(struct shim_extent_file* file) {
+    for (size_t i = 0; i < file->extents_cnt; i++)
+        free(file->extents[i]);
+    free(file->extents);
+}
+
+/* Returns the allocated size of extent `idx` (0 for a hole). */
+static size_t extent_size(struct shim_extent_file* file, size_t idx) {
+    if (idx >= file->extents_cnt || !file->extents[idx])
+        return 0;
+    return idx == 0 ? file->first_extent_size : MEM_EXTENT_SIZE;
+}
+
+/* Makes sure that the first `needed` bytes of extent `idx` are allocated (new memory is zeroed). */
+static int extent_file_reserve(struct shim_extent_file* file, size_t idx, size_t needed) {
+    if (idx >= file->extents_cnt) {
+        size_t cnt = MAX(file->extents_cnt * 2, 4UL);
+        while (cnt <= idx)
+            cnt *= 2;
+
+        char** extents = malloc(cnt * sizeof(*extents));
+        if (!extents)
+            return -ENOMEM;
+        if (file->extents_cnt)
+            memcpy(extents, file->extents, file->extents_cnt * sizeof(*extents));
+        memset(extents + file->extents_cnt, 0, (cnt - file->extents_cnt) * sizeof(*extents));
+        free(file->extents);
+        file->extents = extents;
+        file->extents_cnt = cnt;
+    }
+
+    size_t cur_size = extent_size(file, idx);
+    if (cur_size >= needed)
+        return 0;
+
+    size_t new_size = MEM_EXTENT_SIZE;
+    if (idx == 0) {
+        new_size = MAX(cur_size, 64UL);
+        while (new_size < needed)
+            new_size *= 2;
+        new_size = MIN(new_size, (size_t)MEM_EXTENT_SIZE);
+    }
+
+    char* extent = malloc(new_size);
+    if (!extent)
+        return -ENOMEM;
+    if (cur_size)
+        memcpy(extent, file->extents[idx], cur_size);
+    memset(extent + cur_size, 0, new_size - cur_size);
+
+    free(file->extents[idx]);
+    file->extents[idx] = extent;
+    if (idx == 0)
+        file->first_extent_size = new_size;
+    return 0;
+}
+
+ssize_t extent_file_read(struct shim_extent_file* file, file_off_t pos_start, void* buf,
+                         size_t size) {
+    assert(pos_start >= 0);
+
+    file_off_t pos_end;
+    if (__builtin_add_overflow(pos_start, size, &pos_end) || pos_end > file->size)
+        pos_end = file->size;
+    if (pos_end <= pos_start)
+        return 0;
+
+    for (file_off_t pos = pos_start; pos < pos_end;) {
+        size_t idx = pos / MEM_EXTENT_SIZE;
+        size_t off = pos % MEM_EXTENT_SIZE;
+        size_t len = MIN((size_t)(pos_end - pos), MEM_EXTENT_SIZE - off);
+
+        /* copy what is allocated, the rest of the range is a hole */
+        size_t allocated = extent_size(file, idx);
+        size_t from_extent = off < allocated ? MIN(len, allocated - off) : 0;
+        if (from_extent)
+            memcpy((char*)buf + (pos - pos_start), file->extents[idx] + off, from_extent);
+        memset((char*)buf + (pos - pos_start) + from_extent, 0, len - from_extent);
+
+        pos += len;
+    }
+    return pos_end - pos_start;
+}
+
+ssize_t extent_file_write(struct shim_extent_file* file, file_off_t pos_start, const void* buf,
+                          size_t size) {
+    assert(pos_start >= 0);
+
+    file_off_t pos_end;
+    if (__builtin_add_overflow(pos_start, size, &pos_end))
+        return -EFBIG;
+
+    if (OVERFLOWS(size_t, pos_end))
+        return -EFBIG;
+
+    for (file_off_t pos = pos_start; pos < pos_end;) {
+        size_t idx = pos / MEM_EXTENT_SIZE;
+        size_t off = pos % MEM_EXTENT_SIZE;
+        size_t len = MIN((size_t)(pos_end - pos), MEM_EXTENT_SIZE - off);
+
+        int ret = extent_file_reserve(file, idx, off + len);
+        if (ret < 0) {
+            /* report a partial write if some data got in */
+            if (pos == pos_start)
+                return ret;
+            break;
+        }
+        memcpy(file->extents[idx] + off, (const char*)buf + (pos - pos_start), len);
+
+        pos += len;
+        if (pos > file->size)
+            file->size = pos;
+    }
+
+    return MIN(pos_end, file->size) - pos_start;
+}
+
+int extent_file_truncate(struct shim_extent_file* file, file_off_t size) {
+    assert(size >= 0);
+
+    if (OVERFLOWS(size_t, size))
+        return -EFBIG;
+
+    if (size < file->size) {
+        /* Free the extents past the new end, and zero the tail of the last one, so that extending
+         * the file later exposes zeroes and not the old data. */
+        size_t last_idx = size / MEM_EXTENT_SIZE;
+        size_t last_off = size % MEM_EXTENT_SIZE;
+        for (size_t i = last_idx + (last_off ? 1 : 0); i < file->extents_cnt; i++) {
+            free(file->extents[i]);
+            file->extents[i] = NULL;
+        }
+        if (last_off) {
+            size_t allocated = extent_size(file, last_idx);
+            if (last_off < allocated)
+                memset(file->extents[last_idx] + last_off, 0, allocated - last_off);
+        }
+        if (!file->extents_cnt || !file->extents[0])
+            file->first_extent_size = 0;
+    }
+
+    file->size = size;
+    return 0;
+}
+
+int extent_file_poll(struct shim_extent_file* file, file_off_t pos, int poll_type) {
+    int ret = 0;
+    if ((poll_type & FS_POLL_RD) && (pos < file->size))
+        ret |= FS_POLL_RD;
+    if (poll_type & FS_POLL_WR)
+        ret |= FS_POLL_WR;
+    return ret;
+}
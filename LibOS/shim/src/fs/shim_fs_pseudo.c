@@ -15,6 +15,25 @@
 
 LISTP_TYPE(pseudo_node) g_pseudo_roots = LISTP_INIT;
 
+/* Data of a PSEUDO_STR file with `str.cache_usec` set, see `pseudo_load_cached`. */
+struct pseudo_cache_entry {
+    LIST_TYPE(pseudo_cache_entry) list;
+    /* Holds a reference, so that the dentry (and its address used as the key) stays around. */
+    struct shim_dentry* dent;
+    char* data;
+    size_t size;
+    uint64_t time;
+};
+
+/* Protects `str.cache` of all nodes. */
+static struct shim_lock g_pseudo_cache_lock;
+
+int init_pseudo_fs(void) {
+    if (!create_lock(&g_pseudo_cache_lock))
+        return -ENOMEM;
+    return 0;
+}
+
 /* Find a root node with given name. */
 static struct pseudo_node* pseudo_find_root(const char* name) {
     struct pseudo_node* node;
@@ -94,6 +113,90 @@ static int pseudo_mount(const char* uri, void** mount_data) {
     return 0;
 }
 
+static struct pseudo_cache_entry* pseudo_find_cached(struct pseudo_node* node,
+                                                     struct shim_dentry* dent) {
+    assert(locked(&g_pseudo_cache_lock));
+
+    struct pseudo_cache_entry* entry;
+    LISTP_FOR_EACH_ENTRY(entry, &node->str.cache, list) {
+        if (entry->dent == dent)
+            return entry;
+    }
+    return NULL;
+}
+
+/*
+ * Runtimes (OpenMP, JVM, glibc's `get_nprocs`) open files such as `/proc/cpuinfo` or the CPU
+ * topology in `/sys` many times during startup. For nodes with `str.cache_usec`, the result of
+ * `load` is remembered for each dentry, and served as a copy until it gets older than
+ * `str.cache_usec`.
+ */
+static int pseudo_load_cached(struct pseudo_node* node, struct shim_dentry* dent, char** out_data,
+                              size_t* out_size) {
+    int ret;
+    uint64_t now = 0;
+    if (node->str.cache_usec != PSEUDO_CACHE_FOREVER) {
+        ret = DkSystemTimeQuery(&now);
+        if (ret < 0)
+            return pal_to_unix_errno(ret);
+    }
+
+    lock(&g_pseudo_cache_lock);
+    struct pseudo_cache_entry* entry = pseudo_find_cached(node, dent);
+    if (entry && (node->str.cache_usec == PSEUDO_CACHE_FOREVER
+                      || now - entry->time < node->str.cache_usec)) {
+        char* data = malloc(entry->size);
+        if (!data) {
+            unlock(&g_pseudo_cache_lock);
+            return -ENOMEM;
+        }
+        memcpy(data, entry->data, entry->size);
+        *out_data = data;
+        *out_size = entry->size;
+        unlock(&g_pseudo_cache_lock);
+        return 0;
+    }
+    unlock(&g_pseudo_cache_lock);
+
+    /* Generate the data without holding the lock: `load` might take other locks or do IPC. */
+    char* data;
+    size_t size;
+    ret = node->str.load(dent, &data, &size);
+    if (ret < 0)
+        return ret;
+
+    /* Failing to cache the data is not an error, the file just gets regenerated next time. */
+    char* cached = malloc(size);
+    if (!cached)
+        goto out;
+    memcpy(cached, data, size);
+
+    lock(&g_pseudo_cache_lock);
+    entry = pseudo_find_cached(node, dent);
+    if (!entry) {
+        entry = malloc(sizeof(*entry));
+        if (!entry) {
+            unlock(&g_pseudo_cache_lock);
+            free(cached);
+            goto out;
+        }
+        get_dentry(dent);
+        entry->dent = dent;
+        LISTP_ADD(entry, &node->str.cache, list);
+    } else {
+        free(entry->data);
+    }
+    entry->data = cached;
+    entry->size = size;
+    entry->time = now;
+    unlock(&g_pseudo_cache_lock);
+
+out:
+    *out_data = data;
+    *out_size = size;
+    return 0;
+}
+
 static int pseudo_open(struct shim_handle* hdl, struct shim_dentry* dent, int flags) {
     int ret;
     struct pseudo_node* node = pseudo_find(dent);
@@ -112,8 +215,14 @@ static int pseudo_open(struct shim_handle* hdl, struct shim_dentry* dent, int fl
         case PSEUDO_STR: {
             char* str;
             size_t len;
+            assert(!(node->str.load && node->str.generate));
             if (node->str.load) {
-                ret = node->str.load(dent, &str, &len);
+                assert(!(node->str.cache_usec && node->str.save));
+                if (node->str.cache_usec) {
+                    ret = pseudo_load_cached(node, dent, &str, &len);
+                } else {
+                    ret = node->str.load(dent, &str, &len);
+                }
                 if (ret < 0)
                     return ret;
                 assert(str);
@@ -126,6 +235,8 @@ static int pseudo_open(struct shim_handle* hdl, struct shim_dentry* dent, int fl
             mem_file_init(&hdl->info.str.mem, str, len);
             hdl->info.str.dirty = false;
             hdl->info.str.pos = 0;
+            hdl->info.str.gen_pos = 0;
+            hdl->info.str.gen_cursor = 0;
             break;
         }
 
@@ -272,6 +383,70 @@ static int pseudo_readdir(struct shim_dentry* dent, readdir_callback_t callback,
     return 0;
 }
 
+#define PSEUDO_GEN_BUF_SIZE 4096
+
+/*
+ * Reads from a file with a `generate` callback. Only a window of such a file is kept in `str.mem`,
+ * starting at file offset `str.gen_pos`. Reading past the window generates the next records in its
+ * place, and reading before it restarts the generation from the beginning of the file.
+ */
+static ssize_t pseudo_str_gen_read(struct pseudo_node* node, struct shim_handle* hdl, char* buf,
+                                   size_t size) {
+    assert(locked(&hdl->lock));
+
+    struct shim_str_handle* str = &hdl->info.str;
+    struct shim_mem_file* mem = &str->mem;
+    file_off_t pos = str->pos;
+
+    if (pos < str->gen_pos) {
+        str->gen_pos = 0;
+        str->gen_cursor = 0;
+        mem->size = 0;
+    }
+
+    size_t copied = 0;
+    while (copied < size) {
+        if (pos < str->gen_pos + mem->size) {
+            size_t count = MIN(size - copied, (size_t)(str->gen_pos + mem->size - pos));
+            memcpy(buf + copied, mem->buf + (pos - str->gen_pos), count);
+            copied += count;
+            pos += count;
+            continue;
+        }
+
+        if (!mem->buf) {
+            mem->buf = malloc(PSEUDO_GEN_BUF_SIZE);
+            if (!mem->buf)
+                return copied ? (ssize_t)copied : -ENOMEM;
+            mem->buf_size = PSEUDO_GEN_BUF_SIZE;
+        }
+
+        str->gen_pos += mem->size;
+        mem->size = 0;
+
+        size_t len;
+        int ret = node->str.generate(hdl->dentry, &str->gen_cursor, mem->buf, mem->buf_size, &len);
+        if (ret == -ENOSPC) {
+            /* A single record does not fit in the window, retry with a bigger one. */
+            char* new_buf = malloc(mem->buf_size * 2);
+            if (!new_buf)
+                return copied ? (ssize_t)copied : -ENOMEM;
+            free(mem->buf);
+            mem->buf = new_buf;
+            mem->buf_size *= 2;
+            continue;
+        }
+        if (ret < 0)
+            return copied ? (ssize_t)copied : ret;
+        assert(len <= mem->buf_size);
+
+        if (len == 0)
+            break;
+        mem->size = len;
+    }
+    return copied;
+}
+
 static ssize_t pseudo_read(struct shim_handle* hdl, void* buf, size_t size) {
     assert(hdl->dentry);
     struct pseudo_node* node = pseudo_find(hdl->dentry);
@@ -281,7 +456,12 @@ static ssize_t pseudo_read(struct shim_handle* hdl, void* buf, size_t size) {
         case PSEUDO_STR: {
             assert(hdl->type == TYPE_STR);
             lock(&hdl->lock);
-            ssize_t ret = mem_file_read(&hdl->info.str.mem, hdl->info.str.pos, buf, size);
+            ssize_t ret;
+            if (node->str.generate) {
+                ret = pseudo_str_gen_read(node, hdl, buf, size);
+            } else {
+                ret = mem_file_read(&hdl->info.str.mem, hdl->info.str.pos, buf, size);
+            }
             if (ret > 0)
                 hdl->info.str.pos += ret;
             unlock(&hdl->lock);
@@ -306,6 +486,8 @@ static ssize_t pseudo_write(struct shim_handle* hdl, const void* buf, size_t siz
     switch (node->type) {
         case PSEUDO_STR: {
             assert(hdl->type == TYPE_STR);
+            if (node->str.generate)
+                return -EACCES;
             lock(&hdl->lock);
             ssize_t ret = mem_file_write(&hdl->info.str.mem, hdl->info.str.pos, buf, size);
             if (ret > 0) {
@@ -335,6 +517,9 @@ static file_off_t pseudo_seek(struct shim_handle* hdl, file_off_t offset, int wh
         return -ENOENT;
     switch (node->type) {
         case PSEUDO_STR: {
+            /* The size of a generated file is not known without generating all of it. */
+            if (node->str.generate && whence == SEEK_END)
+                return -EINVAL;
             lock(&hdl->lock);
             file_off_t pos = hdl->info.str.pos;
             ret = generic_seek(pos, hdl->info.str.mem.size, offset, whence, &pos);
@@ -364,6 +549,8 @@ static int pseudo_truncate(struct shim_handle* hdl, file_off_t size) {
     switch (node->type) {
         case PSEUDO_STR:
             assert(hdl->type == TYPE_STR);
+            if (node->str.generate)
+                return -EACCES;
             lock(&hdl->lock);
             int ret = mem_file_truncate(&hdl->info.str.mem, size);
             if (ret == 0)
@@ -449,6 +636,8 @@ static int pseudo_poll(struct shim_handle* hdl, int poll_type) {
     switch (node->type) {
         case PSEUDO_STR: {
             assert(hdl->type == TYPE_STR);
+            if (node->str.generate)
+                return poll_type & FS_POLL_RD;
             lock(&hdl->lock);
             int ret = mem_file_poll(&hdl->info.str.mem, hdl->info.str.pos, poll_type);
             unlock(&hdl->lock);
@@ -40,11 +40,11 @@ int check_permissions(struct shim_dentry* dent, mode_t mask) {
 /* This function works like `lookup_dcache`, but if the dentry is not in cache, it creates a new,
  * not yet valid one. */
 static struct shim_dentry* lookup_dcache_or_create(struct shim_dentry* parent, const char* name,
-                                                   size_t name_len) {
+                                                   size_t name_len, HASHTYPE name_hash) {
     assert(locked(&g_dcache_lock));
     assert(parent);
 
-    struct shim_dentry* dent = lookup_dcache(parent, name, name_len);
+    struct shim_dentry* dent = __lookup_dcache(parent, name, name_len, name_hash);
     if (!dent)
         dent = get_new_dentry(parent->mount, parent, name, name_len);
     return dent;
@@ -94,6 +94,13 @@ static int validate_dentry(struct shim_dentry* dent) {
 
     reset_dentry(dent);
 
+    /* On an immutable mount, a fully listed directory knows all of its children: a name that is not
+     * among them does not exist, and there is no need to ask the host. */
+    if (dent->parent && (dent->parent->state & DENTRY_LISTED) && dent->mount->immutable) {
+        dent->state |= DENTRY_VALID | DENTRY_NEGATIVE;
+        return 0;
+    }
+
     /* This is an invalid dentry: either we just created it, or it got left over from a previous
      * failed lookup. Perform the lookup. */
     assert(dent->fs);
@@ -108,6 +115,8 @@ static int validate_dentry(struct shim_dentry* dent) {
     } else if (ret == -ENOENT) {
         /* File not found, mark dentry as negative */
         dent->state |= DENTRY_VALID | DENTRY_NEGATIVE;
+        if (g_negative_dentry_ttl_us && DkSystemTimeQuery(&dent->negative_time) < 0)
+            dent->negative_time = 0;
         return 0;
     } else {
         /* Lookup failed, keep dentry as invalid */
@@ -288,10 +297,10 @@ static int lookup_advance(struct lookup* lookup) {
     const char* name = lookup->name;
     assert(*name != '/' && *name != '\0');
 
-    const char* name_end = name;
-    while (*name_end != '\0' && *name_end != '/')
-        name_end++;
-    size_t name_len = name_end - name;
+    /* length and hash of the component are computed in a single pass */
+    size_t name_len;
+    HASHTYPE name_hash = hash_path_component(name, &name_len);
+    const char* name_end = name + name_len;
 
     if (name_len > NAME_MAX)
         return -ENAMETOOLONG;
@@ -306,7 +315,7 @@ static int lookup_advance(struct lookup* lookup) {
             next_dent = lookup->dent;
         get_dentry(next_dent);
     } else {
-        next_dent = lookup_dcache_or_create(lookup->dent, name, name_len);
+        next_dent = lookup_dcache_or_create(lookup->dent, name, name_len, name_hash);
         if (!next_dent)
             return -ENOMEM;
     }
@@ -468,7 +477,7 @@ int dentry_open(struct shim_handle* hdl, struct shim_dentry* dent, int flags) {
         /* Initialize directory handle */
         hdl->is_dir = true;
 
-        hdl->dir_info.dents = NULL;
+        hdl->dir_info.dot = NULL;
     }
 
     /* truncate regular writable file if O_TRUNC is given */
@@ -654,6 +663,9 @@ static int add_name(const char* name, void* arg) {
  * While `readdir` is callback-based, we don't look up the names inside of callback, but first
  * finish `readdir`. Otherwise, the two filesystem operations (`readdir` and `lookup`) might
  * deadlock.
+ *
+ * On immutable mounts, a directory is listed only once: afterwards it is marked as
+ * `DENTRY_LISTED`, and both its listing and lookups of its children are served from the dcache.
  */
 static int populate_directory(struct shim_dentry* dent) {
     assert(locked(&g_dcache_lock));
@@ -661,19 +673,27 @@ static int populate_directory(struct shim_dentry* dent) {
     if (dent->state & DENTRY_NEGATIVE)
         return -ENOENT;
 
+    if ((dent->state & DENTRY_LISTED) && dent->mount->immutable)
+        return 0;
+
     if (!dent->fs || !dent->fs->d_ops || !dent->fs->d_ops->readdir)
         return -EINVAL;
 
+    bool complete = true;
+
     LISTP_TYPE(temp_dirent) ents = LISTP_INIT;
     int ret = dent->fs->d_ops->readdir(dent, &add_name, &ents);
-    if (ret < 0)
+    if (ret < 0) {
         log_error("readdir error: %d", ret);
+        complete = false;
+    }
 
     struct temp_dirent* ent;
     struct temp_dirent* tmp;
 
     LISTP_FOR_EACH_ENTRY(ent, &ents, list) {
-        struct shim_dentry* child = lookup_dcache_or_create(dent, ent->name, ent->name_len);
+        struct shim_dentry* child = lookup_dcache_or_create(dent, ent->name, ent->name_len,
+                                                            hash_buf(ent->name, ent->name_len));
         if (!child) {
             ret = -ENOMEM;
             goto out;
@@ -689,10 +709,16 @@ static int populate_directory(struct shim_dentry* dent) {
                  * instead of reporting them to Graphene. */
                 goto out;
             }
+            complete = false;
             continue;
         }
     }
 
+    /* Children of a listed directory are never garbage-collected on an immutable mount (negative
+     * ones are kept too, see `dentry_gc`), so the dcache now has the complete listing. */
+    if (complete && dent->mount->immutable)
+        dent->state |= DENTRY_LISTED;
+
     ret = 0;
 out:
     LISTP_FOR_EACH_ENTRY_SAFE(ent, tmp, &ents, list) {
@@ -702,6 +728,61 @@ out:
     return ret;
 }
 
+/* A growing array of names, for `populate_directory_handle`. */
+struct dir_names {
+    char* buf;
+    size_t size;
+    size_t capacity;
+
+    size_t* offs;
+    size_t count;
+    size_t offs_capacity;
+};
+
+static int add_dir_name(const char* name, void* arg) {
+    struct dir_names* names = arg;
+
+    size_t name_size = strlen(name) + 1;
+    if (names->size + name_size > names->capacity) {
+        size_t capacity = MAX(names->capacity * 2, 1024UL);
+        while (names->size + name_size > capacity)
+            capacity *= 2;
+        char* buf = malloc(capacity);
+        if (!buf)
+            return -ENOMEM;
+        if (names->size)
+            memcpy(buf, names->buf, names->size);
+        free(names->buf);
+        names->buf = buf;
+        names->capacity = capacity;
+    }
+    if (names->count == names->offs_capacity) {
+        size_t offs_capacity = MAX(names->offs_capacity * 2, 64UL);
+        size_t* offs = malloc(offs_capacity * sizeof(*offs));
+        if (!offs)
+            return -ENOMEM;
+        if (names->count)
+            memcpy(offs, names->offs, names->count * sizeof(*offs));
+        free(names->offs);
+        names->offs = offs;
+        names->offs_capacity = offs_capacity;
+    }
+
+    memcpy(names->buf + names->size, name, name_size);
+    names->offs[names->count++] = names->size;
+    names->size += name_size;
+    return 0;
+}
+
+/*
+ * Note that we store only the names returned by `readdir`, without creating (and validating) a
+ * dentry for every entry: for large directories, that would cost a lookup per entry (on SGX, an
+ * OCALL) before `getdents` can return anything, and a dentry per entry in memory. The dentries get
+ * created only for the names the application later looks up.
+ *
+ * The exception are immutable mounts, where the directory is fully populated once, so that later
+ * listings and lookups are served from the dcache (see `populate_directory`).
+ */
 int populate_directory_handle(struct shim_handle* hdl) {
     struct shim_dir_handle* dirhdl = &hdl->dir_info;
 
@@ -711,65 +792,69 @@ int populate_directory_handle(struct shim_handle* hdl) {
 
     int ret;
 
-    if (dirhdl->dents)
+    if (dirhdl->dot)
         return 0;
 
-    if ((ret = populate_directory(hdl->dentry)) < 0)
-        goto err;
-
-    size_t capacity = hdl->dentry->nchildren + 2; // +2 for ".", ".."
-
-    dirhdl->dents = malloc(sizeof(struct shim_dentry) * capacity);
-    if (!dirhdl->dents) {
-        ret = -ENOMEM;
-        goto err;
-    }
-    dirhdl->count = 0;
+    struct shim_dentry* dent = hdl->dentry;
+    struct dir_names names = {0};
 
-    struct shim_dentry* dot = hdl->dentry;
-    get_dentry(dot);
-    dirhdl->dents[dirhdl->count++] = dot;
-
-    struct shim_dentry* dotdot = hdl->dentry->parent ?: hdl->dentry;
-    get_dentry(dotdot);
-    dirhdl->dents[dirhdl->count++] = dotdot;
-
-    struct shim_dentry* tmp;
-    struct shim_dentry* dent;
-    LISTP_FOR_EACH_ENTRY_SAFE(dent, tmp, &hdl->dentry->children, siblings) {
-        if (dent->state & DENTRY_VALID) {
-            /* Traverse mount */
-            struct shim_dentry* cur_dent = dent;
-            while (cur_dent->attached_mount) {
-                cur_dent = cur_dent->attached_mount->root;
-            }
+    if (dent->mount->immutable) {
+        if ((ret = populate_directory(dent)) < 0)
+            goto err;
 
-            assert(cur_dent->state & DENTRY_VALID);
-            if (!(cur_dent->state & DENTRY_NEGATIVE)) {
-                get_dentry(cur_dent);
-                assert(dirhdl->count < capacity);
-                dirhdl->dents[dirhdl->count++] = cur_dent;
+        struct shim_dentry* child;
+        struct shim_dentry* tmp;
+        LISTP_FOR_EACH_ENTRY_SAFE(child, tmp, &dent->children, siblings) {
+            if ((child->state & DENTRY_VALID) && !(child->state & DENTRY_NEGATIVE)) {
+                if ((ret = add_dir_name(child->name, &names)) < 0)
+                    goto err;
             }
+            dentry_gc(child);
+        }
+    } else {
+        if (dent->state & DENTRY_NEGATIVE) {
+            ret = -ENOENT;
+            goto err;
+        }
+        if (!dent->fs || !dent->fs->d_ops || !dent->fs->d_ops->readdir) {
+            ret = -EINVAL;
+            goto err;
+        }
+        if ((ret = dent->fs->d_ops->readdir(dent, &add_dir_name, &names)) < 0) {
+            log_error("readdir error: %d", ret);
+            goto err;
         }
-        dentry_gc(dent);
     }
 
+    dirhdl->dot = dent;
+    get_dentry(dirhdl->dot);
+    dirhdl->dotdot = dent->parent ?: dent;
+    get_dentry(dirhdl->dotdot);
+
+    dirhdl->names = names.buf;
+    dirhdl->name_offs = names.offs;
+    dirhdl->count = names.count + 2; // +2 for ".", ".."
     return 0;
 
 err:
-    clear_directory_handle(hdl);
+    free(names.buf);
+    free(names.offs);
     return ret;
 }
 
 void clear_directory_handle(struct shim_handle* hdl) {
     struct shim_dir_handle* dirhdl = &hdl->dir_info;
-    if (!dirhdl->dents)
+    if (!dirhdl->dot)
         return;
 
-    for (size_t i = 0; i < dirhdl->count; i++)
-        put_dentry(dirhdl->dents[i]);
-    free(dirhdl->dents);
-    dirhdl->dents = NULL;
+    put_dentry(dirhdl->dot);
+    put_dentry(dirhdl->dotdot);
+    free(dirhdl->names);
+    free(dirhdl->name_offs);
+    dirhdl->dot = NULL;
+    dirhdl->dotdot = NULL;
+    dirhdl->names = NULL;
+    dirhdl->name_offs = NULL;
     dirhdl->count = 0;
 }
 
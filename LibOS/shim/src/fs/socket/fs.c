@@ -202,7 +202,7 @@ static int socket_setflags(struct shim_handle* hdl, int flags) {
 
     PAL_STREAM_ATTR attr;
 
-    int ret = DkStreamAttributesQueryByHandle(hdl->pal_handle, &attr);
+    int ret = DkStreamAttributesQueryCachedByHandle(hdl->pal_handle, &attr);
     if (ret < 0) {
         return pal_to_unix_errno(ret);
     }
@@ -100,9 +100,17 @@ int sys_load(const char* str, char** out_data, size_t* out_size) {
     return 0;
 }
 
+/* All files here describe the topology provided by the PAL at startup, which never changes. */
+static struct pseudo_node* add_topology_str(struct pseudo_node* parent_node, const char* name,
+                                            int (*load)(struct shim_dentry*, char**, size_t*)) {
+    struct pseudo_node* node = pseudo_add_str(parent_node, name, load);
+    node->str.cache_usec = PSEUDO_CACHE_FOREVER;
+    return node;
+}
+
 static void init_cpu_dir(struct pseudo_node* cpu) {
-    pseudo_add_str(cpu, "online", &sys_cpu_general_load);
-    pseudo_add_str(cpu, "possible", &sys_cpu_general_load);
+    add_topology_str(cpu, "online", &sys_cpu_general_load);
+    add_topology_str(cpu, "possible", &sys_cpu_general_load);
 
     struct pseudo_node* cpuX = pseudo_add_dir(cpu, NULL);
     cpuX->name_exists = &sys_resource_name_exists;
@@ -110,44 +118,44 @@ static void init_cpu_dir(struct pseudo_node* cpu) {
 
     /* Create a node for `cpu/cpuX/online`. We provide name callbacks instead of a hardcoded name,
      * because we want the file to exist for all CPUs *except* `cpu0`. */
-    struct pseudo_node* online = pseudo_add_str(cpuX, NULL, &sys_cpu_load);
+    struct pseudo_node* online = add_topology_str(cpuX, NULL, &sys_cpu_load);
     online->name_exists = &sys_cpu_online_name_exists;
     online->list_names = &sys_cpu_online_list_names;
 
     struct pseudo_node* topology = pseudo_add_dir(cpuX, "topology");
-    pseudo_add_str(topology, "core_id", &sys_cpu_load);
-    pseudo_add_str(topology, "physical_package_id", &sys_cpu_load);
-    pseudo_add_str(topology, "core_siblings", &sys_cpu_load);
-    pseudo_add_str(topology, "thread_siblings", &sys_cpu_load);
+    add_topology_str(topology, "core_id", &sys_cpu_load);
+    add_topology_str(topology, "physical_package_id", &sys_cpu_load);
+    add_topology_str(topology, "core_siblings", &sys_cpu_load);
+    add_topology_str(topology, "thread_siblings", &sys_cpu_load);
 
     struct pseudo_node* cache = pseudo_add_dir(cpuX, "cache");
     struct pseudo_node* indexX = pseudo_add_dir(cache, NULL);
     indexX->name_exists = &sys_resource_name_exists;
     indexX->list_names = &sys_resource_list_names;
 
-    pseudo_add_str(indexX, "shared_cpu_map", &sys_cache_load);
-    pseudo_add_str(indexX, "level", &sys_cache_load);
-    pseudo_add_str(indexX, "type", &sys_cache_load);
-    pseudo_add_str(indexX, "size", &sys_cache_load);
-    pseudo_add_str(indexX, "coherency_line_size", &sys_cache_load);
-    pseudo_add_str(indexX, "physical_line_partition", &sys_cache_load);
+    add_topology_str(indexX, "shared_cpu_map", &sys_cache_load);
+    add_topology_str(indexX, "level", &sys_cache_load);
+    add_topology_str(indexX, "type", &sys_cache_load);
+    add_topology_str(indexX, "size", &sys_cache_load);
+    add_topology_str(indexX, "coherency_line_size", &sys_cache_load);
+    add_topology_str(indexX, "physical_line_partition", &sys_cache_load);
 }
 
 static void init_node_dir(struct pseudo_node* node) {
-    pseudo_add_str(node, "online", &sys_node_general_load);
+    add_topology_str(node, "online", &sys_node_general_load);
 
     struct pseudo_node* nodeX = pseudo_add_dir(node, NULL);
     nodeX->name_exists = &sys_resource_name_exists;
     nodeX->list_names = &sys_resource_list_names;
 
-    pseudo_add_str(nodeX, "cpumap", &sys_node_load);
-    pseudo_add_str(nodeX, "distance", &sys_node_load);
+    add_topology_str(nodeX, "cpumap", &sys_node_load);
+    add_topology_str(nodeX, "distance", &sys_node_load);
 
     struct pseudo_node* hugepages = pseudo_add_dir(nodeX, "hugepages");
     struct pseudo_node* hugepages_2m = pseudo_add_dir(hugepages, "hugepages-2048kB");
-    pseudo_add_str(hugepages_2m, "nr_hugepages", &sys_node_load);
+    add_topology_str(hugepages_2m, "nr_hugepages", &sys_node_load);
     struct pseudo_node* hugepages_1g = pseudo_add_dir(hugepages, "hugepages-1048576kB");
-    pseudo_add_str(hugepages_1g, "nr_hugepages", &sys_node_load);
+    add_topology_str(hugepages_1g, "nr_hugepages", &sys_node_load);
 }
 
 int init_sysfs(void) {
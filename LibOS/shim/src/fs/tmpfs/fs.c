@@ -10,6 +10,10 @@
  *
  * The tmpfs files are directly represented by their dentries (i.e. a file exists whenever
  * corresponding dentry exists). The file data is stored in the dentries.
+ *
+ * The exception is a tmpfs mounted with URI `shared:`: its files are kept in the shared tmpfs store
+ * in the main process (see `shim_fs_tmpfs.h`), and the dentries only cache the file type and
+ * permissions.
  */
 
 #include <asm/mman.h>
@@ -19,6 +23,7 @@
 #include "perm.h"
 #include "shim_flags_conv.h"
 #include "shim_fs.h"
+#include "shim_fs_tmpfs.h"
 #include "shim_handle.h"
 #include "shim_internal.h"
 #include "shim_lock.h"
@@ -28,7 +33,7 @@
 #define USEC_IN_SEC 1000000
 
 struct shim_tmpfs_data {
-    struct shim_mem_file mem;
+    struct shim_extent_file mem;
     time_t ctime;
     time_t mtime;
     time_t atime;
@@ -48,7 +53,7 @@ static int tmpfs_get_data(struct shim_dentry* dent, struct shim_tmpfs_data** out
     if (!data)
         return -ENOMEM;
 
-    mem_file_init(&data->mem, /*data=*/NULL, /*size=*/0);
+    extent_file_init(&data->mem);
 
     uint64_t time_us;
     if (DkSystemTimeQuery(&time_us) < 0) {
@@ -65,6 +70,35 @@ static int tmpfs_get_data(struct shim_dentry* dent, struct shim_tmpfs_data** out
     return 0;
 }
 
+static bool tmpfs_is_shared(struct shim_mount* mount) {
+    return mount->uri && !strcmp(mount->uri, TMPFS_SHARED_URI);
+}
+
+static int tmpfs_shared_stat(struct shim_dentry* dent, struct tmpfs_store_attr* attr) {
+    char* path;
+    int ret = dentry_abs_path(dent, &path, /*size=*/NULL);
+    if (ret < 0)
+        return ret;
+    ret = tmpfs_store_stat(path, attr);
+    free(path);
+    return ret;
+}
+
+static int tmpfs_shared_create(struct shim_dentry* dent, mode_t type, mode_t perm) {
+    char* path;
+    int ret = dentry_abs_path(dent, &path, /*size=*/NULL);
+    if (ret < 0)
+        return ret;
+    ret = tmpfs_store_create(path, type, perm);
+    free(path);
+    if (ret < 0)
+        return ret;
+
+    dent->type = type;
+    dent->perm = perm;
+    return 0;
+}
+
 static int tmpfs_mount(const char* uri, void** mount_data) {
     __UNUSED(uri);
     __UNUSED(mount_data);
@@ -83,6 +117,16 @@ static int tmpfs_lookup(struct shim_dentry* dent) {
         dent->perm = PERM_rwx______;
         return 0;
     }
+
+    if (tmpfs_is_shared(dent->mount)) {
+        struct tmpfs_store_attr attr;
+        int ret = tmpfs_shared_stat(dent, &attr);
+        if (ret < 0)
+            return ret;
+        dent->type = attr.type;
+        dent->perm = attr.perm;
+        return 0;
+    }
     /* Looking up for other detries should fail: if a dentry has not been already created by `creat`
      * or `mkdir`, the corresponding file does not exist. */
     return -ENOENT;
@@ -103,6 +147,13 @@ static int tmpfs_creat(struct shim_handle* hdl, struct shim_dentry* dir, struct
 
     int ret;
 
+    if (tmpfs_is_shared(dent->mount)) {
+        ret = tmpfs_shared_create(dent, S_IFREG, mode & ~S_IFMT);
+        if (ret < 0)
+            return ret;
+        return tmpfs_open(hdl, dent, flags);
+    }
+
     /* Trigger creating dentry data to ensure right timestamp. */
     lock(&dent->lock);
     struct shim_tmpfs_data* data;
@@ -126,6 +177,9 @@ static int tmpfs_mkdir(struct shim_dentry* dir, struct shim_dentry* dent, mode_t
 
     int ret;
 
+    if (tmpfs_is_shared(dent->mount))
+        return tmpfs_shared_create(dent, S_IFDIR, mode & ~S_IFMT);
+
     /* Trigger creating dentry data to ensure right timestamp. */
     lock(&dent->lock);
     struct shim_tmpfs_data* data;
@@ -145,6 +199,22 @@ out:
 static int tmpfs_stat(struct shim_dentry* dent, struct stat* buf) {
     int ret;
 
+    if (tmpfs_is_shared(dent->mount) && dent != dent->mount->root) {
+        struct tmpfs_store_attr attr;
+        ret = tmpfs_shared_stat(dent, &attr);
+        if (ret < 0)
+            return ret;
+
+        memset(buf, 0, sizeof(*buf));
+        buf->st_mode  = attr.perm | attr.type;
+        buf->st_size  = attr.size;
+        buf->st_nlink = attr.type == S_IFDIR ? 2 : 1;
+        buf->st_ctime = attr.ctime;
+        buf->st_mtime = attr.mtime;
+        buf->st_atime = attr.atime;
+        return 0;
+    }
+
     lock(&dent->lock);
     struct shim_tmpfs_data* data;
     ret = tmpfs_get_data(dent, &data);
@@ -168,6 +238,16 @@ out:
 static int tmpfs_readdir(struct shim_dentry* dent, readdir_callback_t callback, void* arg) {
     assert(locked(&g_dcache_lock));
 
+    if (tmpfs_is_shared(dent->mount)) {
+        char* path;
+        int ret = dentry_abs_path(dent, &path, /*size=*/NULL);
+        if (ret < 0)
+            return ret;
+        ret = tmpfs_store_readdir(path, callback, arg);
+        free(path);
+        return ret;
+    }
+
     struct shim_dentry* child;
     LISTP_FOR_EACH_ENTRY(child, &dent->children, siblings) {
         if ((child->state & DENTRY_VALID) && !(child->state & DENTRY_NEGATIVE)) {
@@ -182,6 +262,16 @@ static int tmpfs_readdir(struct shim_dentry* dent, readdir_callback_t callback,
 static int tmpfs_unlink(struct shim_dentry* dir, struct shim_dentry* dent) {
     __UNUSED(dir);
 
+    if (tmpfs_is_shared(dent->mount)) {
+        char* path;
+        int ret = dentry_abs_path(dent, &path, /*size=*/NULL);
+        if (ret < 0)
+            return ret;
+        ret = tmpfs_store_unlink(path);
+        free(path);
+        return ret;
+    }
+
     if (dent->type == S_IFDIR) {
         /* TODO: the whole unlink operation should be wrapped in a lock; otherwise there's a race:
          * new files can be created before we delete the directory */
@@ -206,7 +296,7 @@ static int tmpfs_unlink(struct shim_dentry* dir, struct shim_dentry* dent) {
     struct shim_tmpfs_data* data = dent->data;
     if (data) {
         dent->data = NULL;
-        mem_file_destroy(&data->mem);
+        extent_file_destroy(&data->mem);
         free(data);
     }
     unlock(&dent->lock);
@@ -237,7 +327,34 @@ static void unlock_two_dentries(struct shim_dentry* dent1, struct shim_dentry* d
     }
 }
 
+static int tmpfs_shared_rename(struct shim_dentry* old, struct shim_dentry* new) {
+    char* old_path = NULL;
+    char* new_path = NULL;
+    int ret = dentry_abs_path(old, &old_path, /*size=*/NULL);
+    if (ret < 0)
+        goto out;
+    ret = dentry_abs_path(new, &new_path, /*size=*/NULL);
+    if (ret < 0)
+        goto out;
+
+    ret = tmpfs_store_rename(old_path, new_path);
+    if (ret < 0)
+        goto out;
+
+    /* TODO: this should be done in the syscall handler, not here */
+    new->type = old->type;
+    new->perm = old->perm;
+    ret = 0;
+out:
+    free(old_path);
+    free(new_path);
+    return ret;
+}
+
 static int tmpfs_rename(struct shim_dentry* old, struct shim_dentry* new) {
+    if (tmpfs_is_shared(old->mount))
+        return tmpfs_shared_rename(old, new);
+
     uint64_t time_us;
     if (DkSystemTimeQuery(&time_us) < 0)
         return -EPERM;
@@ -250,7 +367,7 @@ static int tmpfs_rename(struct shim_dentry* old, struct shim_dentry* new) {
 
     if (new->data) {
         struct shim_tmpfs_data* data = new->data;
-        mem_file_destroy(&data->mem);
+        extent_file_destroy(&data->mem);
         free(data);
     }
     new->data = old->data;
@@ -264,15 +381,65 @@ static int tmpfs_rename(struct shim_dentry* old, struct shim_dentry* new) {
 }
 
 static int tmpfs_chmod(struct shim_dentry* dent, mode_t mode) {
+    if (tmpfs_is_shared(dent->mount)) {
+        char* path;
+        int ret = dentry_abs_path(dent, &path, /*size=*/NULL);
+        if (ret < 0)
+            return ret;
+        ret = tmpfs_store_chmod(path, mode & ~S_IFMT);
+        free(path);
+        if (ret < 0)
+            return ret;
+    }
     dent->perm = mode & ~S_IFMT;
     return 0;
 }
 
+/* Read, write or truncate a file in a shared tmpfs. `hdl->lock` has to be held, to keep the file
+ * position consistent. */
+static ssize_t tmpfs_shared_io(struct shim_handle* hdl, int op, void* buf, size_t size,
+                               file_off_t pos) {
+    assert(locked(&hdl->lock));
+
+    char* path;
+    ssize_t ret = dentry_abs_path(hdl->dentry, &path, /*size=*/NULL);
+    if (ret < 0)
+        return ret;
+
+    switch (op) {
+        case TMPFS_STORE_READ:
+            ret = tmpfs_store_read(path, pos, buf, size);
+            break;
+        case TMPFS_STORE_WRITE:
+            ret = tmpfs_store_write(path, pos, buf, size);
+            break;
+        case TMPFS_STORE_TRUNCATE:
+            ret = tmpfs_store_truncate(path, pos);
+            break;
+        default:
+            BUG();
+    }
+    free(path);
+    return ret;
+}
+
+static ssize_t tmpfs_shared_read_write(struct shim_handle* hdl, int op, void* buf, size_t size) {
+    lock(&hdl->lock);
+    ssize_t ret = tmpfs_shared_io(hdl, op, buf, size, hdl->info.tmpfs.pos);
+    if (ret > 0)
+        hdl->info.tmpfs.pos += ret;
+    unlock(&hdl->lock);
+    return ret;
+}
+
 static ssize_t tmpfs_read(struct shim_handle* hdl, void* buf, size_t size) {
     ssize_t ret;
 
     assert(hdl->type == TYPE_TMPFS);
 
+    if (tmpfs_is_shared(hdl->dentry->mount))
+        return tmpfs_shared_read_write(hdl, TMPFS_STORE_READ, buf, size);
+
     lock(&hdl->lock);
     lock(&hdl->dentry->lock);
     struct shim_tmpfs_data* data;
@@ -280,7 +447,7 @@ static ssize_t tmpfs_read(struct shim_handle* hdl, void* buf, size_t size) {
     if (ret < 0)
         goto out;
 
-    ret = mem_file_read(&data->mem, hdl->info.tmpfs.pos, buf, size);
+    ret = extent_file_read(&data->mem, hdl->info.tmpfs.pos, buf, size);
     if (ret < 0)
         goto out;
 
@@ -302,6 +469,9 @@ static ssize_t tmpfs_write(struct shim_handle* hdl, const void* buf, size_t size
 
     assert(hdl->type == TYPE_TMPFS);
 
+    if (tmpfs_is_shared(hdl->dentry->mount))
+        return tmpfs_shared_read_write(hdl, TMPFS_STORE_WRITE, (void*)buf, size);
+
     uint64_t time_us;
     if (DkSystemTimeQuery(&time_us) < 0)
         return -EPERM;
@@ -313,7 +483,7 @@ static ssize_t tmpfs_write(struct shim_handle* hdl, const void* buf, size_t size
     if (ret < 0)
         goto out;
 
-    ret = mem_file_write(&data->mem, hdl->info.tmpfs.pos, buf, size);
+    ret = extent_file_write(&data->mem, hdl->info.tmpfs.pos, buf, size);
     if (ret < 0)
         goto out;
 
@@ -336,6 +506,13 @@ static int tmpfs_truncate(struct shim_handle* hdl, file_off_t size) {
 
     assert(hdl->type == TYPE_TMPFS);
 
+    if (tmpfs_is_shared(hdl->dentry->mount)) {
+        lock(&hdl->lock);
+        ret = tmpfs_shared_io(hdl, TMPFS_STORE_TRUNCATE, /*buf=*/NULL, /*size=*/0, size);
+        unlock(&hdl->lock);
+        return ret;
+    }
+
     lock(&hdl->lock);
     lock(&hdl->dentry->lock);
     struct shim_tmpfs_data* data;
@@ -343,7 +520,7 @@ static int tmpfs_truncate(struct shim_handle* hdl, file_off_t size) {
     if (ret < 0)
         goto out;
 
-    ret = mem_file_truncate(&data->mem, size);
+    ret = extent_file_truncate(&data->mem, size);
     if (ret < 0)
         goto out;
 
@@ -361,6 +538,22 @@ static file_off_t tmpfs_seek(struct shim_handle* hdl, file_off_t offset, int whe
 
     assert(hdl->type == TYPE_TMPFS);
 
+    if (tmpfs_is_shared(hdl->dentry->mount)) {
+        struct tmpfs_store_attr attr;
+        lock(&hdl->lock);
+        ret = tmpfs_shared_stat(hdl->dentry, &attr);
+        if (ret == 0) {
+            file_off_t pos = hdl->info.tmpfs.pos;
+            ret = generic_seek(pos, attr.size, offset, whence, &pos);
+            if (ret == 0) {
+                hdl->info.tmpfs.pos = pos;
+                ret = pos;
+            }
+        }
+        unlock(&hdl->lock);
+        return ret;
+    }
+
     lock(&hdl->lock);
     lock(&hdl->dentry->lock);
     struct shim_tmpfs_data* data;
@@ -408,6 +601,20 @@ static int tmpfs_poll(struct shim_handle* hdl, int poll_type) {
 
     assert(hdl->type == TYPE_TMPFS);
 
+    if (tmpfs_is_shared(hdl->dentry->mount)) {
+        struct tmpfs_store_attr attr;
+        lock(&hdl->lock);
+        ret = tmpfs_shared_stat(hdl->dentry, &attr);
+        if (ret == 0) {
+            if ((poll_type & FS_POLL_RD) && hdl->info.tmpfs.pos < attr.size)
+                ret |= FS_POLL_RD;
+            if (poll_type & FS_POLL_WR)
+                ret |= FS_POLL_WR;
+        }
+        unlock(&hdl->lock);
+        return ret;
+    }
+
     lock(&hdl->lock);
     lock(&hdl->dentry->lock);
     struct shim_tmpfs_data* data;
@@ -415,7 +622,7 @@ static int tmpfs_poll(struct shim_handle* hdl, int poll_type) {
     if (ret < 0)
         goto out;
 
-    ret = mem_file_poll(&data->mem, hdl->info.tmpfs.pos, poll_type);
+    ret = extent_file_poll(&data->mem, hdl->info.tmpfs.pos, poll_type);
 
 out:
     unlock(&hdl->dentry->lock);
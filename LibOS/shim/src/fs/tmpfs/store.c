@@ -0,0 +1,457 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/*
+ * Shared tmpfs store (see `shim_fs_tmpfs.h`). The store itself exists only in the main process;
+ * other processes forward every operation to it over IPC.
+ */
+
+#include <errno.h>
+
+#include "shim_fs.h"
+#include "shim_fs_mem.h"
+#include "shim_fs_tmpfs.h"
+#include "shim_internal.h"
+#include "shim_ipc.h"
+#include "shim_lock.h"
+#include "stat.h"
+
+#define USEC_IN_SEC 1000000
+
+struct tmpfs_store_entry {
+    char* path;
+    mode_t type;
+    mode_t perm;
+    struct shim_extent_file mem;
+    time_t ctime;
+    time_t mtime;
+    time_t atime;
+
+    UT_hash_handle hh;
+};
+
+/* Only used in the main process. Protects the whole store. */
+static struct shim_lock g_store_lock;
+static struct tmpfs_store_entry* g_store_entries = NULL;
+
+int init_tmpfs_store(void) {
+    if (g_process_ipc_ids.leader_vmid)
+        return 0;
+
+    return create_lock(&g_store_lock);
+}
+
+static int get_time(time_t* out_time) {
+    uint64_t time_us;
+    if (DkSystemTimeQuery(&time_us) < 0)
+        return -EPERM;
+    *out_time = time_us / USEC_IN_SEC;
+    return 0;
+}
+
+static struct tmpfs_store_entry* find_entry(const char* path) {
+    assert(locked(&g_store_lock));
+
+    struct tmpfs_store_entry* entry;
+    HASH_FIND_STR(g_store_entries, path, entry);
+    return entry;
+}
+
+static void destroy_entry(struct tmpfs_store_entry* entry) {
+    assert(locked(&g_store_lock));
+
+    HASH_DEL(g_store_entries, entry);
+    extent_file_destroy(&entry->mem);
+    free(entry->path);
+    free(entry);
+}
+
+/* Returns true if `path` is inside directory `dir` (of length `dir_len`). If `direct` is set, it has
+ * to be a direct child. */
+static bool is_in_dir(const char* dir, size_t dir_len, const char* path, bool direct) {
+    /* the root directory is "/", all other paths do not end with a slash */
+    size_t prefix_len = (dir_len == 1 && dir[0] == '/') ? 0 : dir_len;
+    if (strncmp(path, dir, prefix_len) || path[prefix_len] != '/' || !path[prefix_len + 1])
+        return false;
+    return !direct || !strchr(path + prefix_len + 1, '/');
+}
+
+static int store_create(const char* path, mode_t type, mode_t perm) {
+    if (find_entry(path))
+        return -EEXIST;
+
+    struct tmpfs_store_entry* entry = malloc(sizeof(*entry));
+    if (!entry)
+        return -ENOMEM;
+
+    entry->path = strdup(path);
+    if (!entry->path) {
+        free(entry);
+        return -ENOMEM;
+    }
+
+    int ret = get_time(&entry->ctime);
+    if (ret < 0) {
+        free(entry->path);
+        free(entry);
+        return ret;
+    }
+    entry->mtime = entry->ctime;
+    entry->atime = entry->ctime;
+    entry->type = type;
+    entry->perm = perm;
+    extent_file_init(&entry->mem);
+
+    HASH_ADD_KEYPTR(hh, g_store_entries, entry->path, strlen(entry->path), entry);
+    return 0;
+}
+
+static int store_unlink(const char* path) {
+    struct tmpfs_store_entry* entry = find_entry(path);
+    if (!entry)
+        return -ENOENT;
+
+    if (entry->type == S_IFDIR) {
+        size_t path_len = strlen(path);
+        struct tmpfs_store_entry* child;
+        struct tmpfs_store_entry* tmp;
+        HASH_ITER(hh, g_store_entries, child, tmp) {
+            if (is_in_dir(path, path_len, child->path, /*direct=*/true))
+                return -ENOTEMPTY;
+        }
+    }
+
+    destroy_entry(entry);
+    return 0;
+}
+
+static int rename_entry(struct tmpfs_store_entry* entry, const char* new_path) {
+    char* path = strdup(new_path);
+    if (!path)
+        return -ENOMEM;
+
+    HASH_DEL(g_store_entries, entry);
+    free(entry->path);
+    entry->path = path;
+    HASH_ADD_KEYPTR(hh, g_store_entries, entry->path, strlen(entry->path), entry);
+    return 0;
+}
+
+static int store_rename(const char* old_path, const char* new_path) {
+    struct tmpfs_store_entry* entry = find_entry(old_path);
+    if (!entry)
+        return -ENOENT;
+
+    if (!strcmp(old_path, new_path))
+        return 0;
+
+    time_t time;
+    int ret = get_time(&time);
+    if (ret < 0)
+        return ret;
+
+    size_t old_len = strlen(old_path);
+    size_t new_len = strlen(new_path);
+
+    struct tmpfs_store_entry* target = find_entry(new_path);
+    if (target) {
+        if (target->type == S_IFDIR) {
+            struct tmpfs_store_entry* child;
+            struct tmpfs_store_entry* tmp;
+            HASH_ITER(hh, g_store_entries, child, tmp) {
+                if (is_in_dir(new_path, new_len, child->path, /*direct=*/true))
+                    return -ENOTEMPTY;
+            }
+        }
+        destroy_entry(target);
+    }
+
+    if (entry->type == S_IFDIR) {
+        /* Move the directory contents. Renamed entries get re-added to the table, and could be
+         * visited again by `HASH_ITER`, so collect them first. */
+        size_t count = 0;
+        struct tmpfs_store_entry* child;
+        struct tmpfs_store_entry* tmp;
+        HASH_ITER(hh, g_store_entries, child, tmp) {
+            if (is_in_dir(old_path, old_len, child->path, /*direct=*/false))
+                count++;
+        }
+
+        if (count > 0) {
+            struct tmpfs_store_entry** children = malloc(count * sizeof(*children));
+            if (!children)
+                return -ENOMEM;
+
+            size_t i = 0;
+            HASH_ITER(hh, g_store_entries, child, tmp) {
+                if (is_in_dir(old_path, old_len, child->path, /*direct=*/false))
+                    children[i++] = child;
+            }
+
+            for (i = 0; i < count; i++) {
+                const char* suffix = children[i]->path + old_len;
+                size_t suffix_len = strlen(suffix);
+                char* child_path = malloc(new_len + suffix_len + 1);
+                if (!child_path) {
+                    free(children);
+                    return -ENOMEM;
+                }
+                memcpy(child_path, new_path, new_len);
+                memcpy(child_path + new_len, suffix, suffix_len + 1);
+
+                ret = rename_entry(children[i], child_path);
+                free(child_path);
+                if (ret < 0) {
+                    free(children);
+                    return ret;
+                }
+            }
+            free(children);
+        }
+    }
+
+    ret = rename_entry(entry, new_path);
+    if (ret < 0)
+        return ret;
+    entry->mtime = time;
+    return 0;
+}
+
+/* Lists the direct children of `path`. The directory itself is not checked: the caller already
+ * looked it up, and the mount root has no entry in the store. */
+static int store_readdir(const char* path, void** out_data, size_t* out_size) {
+    size_t path_len = strlen(path);
+    /* names of direct children start after "<path>/" (or after "/" for the root) */
+    size_t name_offset = (path_len == 1 && path[0] == '/') ? 1 : path_len + 1;
+    size_t size = 0;
+    struct tmpfs_store_entry* child;
+    struct tmpfs_store_entry* tmp;
+    HASH_ITER(hh, g_store_entries, child, tmp) {
+        if (is_in_dir(path, path_len, child->path, /*direct=*/true))
+            size += strlen(child->path + name_offset) + 1;
+    }
+
+    char* data = NULL;
+    if (size > 0) {
+        data = malloc(size);
+        if (!data)
+            return -ENOMEM;
+
+        char* ptr = data;
+        HASH_ITER(hh, g_store_entries, child, tmp) {
+            if (is_in_dir(path, path_len, child->path, /*direct=*/true)) {
+                const char* name = child->path + name_offset;
+                size_t name_size = strlen(name) + 1;
+                memcpy(ptr, name, name_size);
+                ptr += name_size;
+            }
+        }
+    }
+
+    *out_data = data;
+    *out_size = size;
+    return 0;
+}
+
+ssize_t tmpfs_store_do(struct tmpfs_store_req* req, struct tmpfs_store_attr* attr,
+                       void** out_data, size_t* out_size) {
+    assert(!g_process_ipc_ids.leader_vmid);
+
+    ssize_t ret;
+    lock(&g_store_lock);
+
+    struct tmpfs_store_entry* entry = NULL;
+    switch (req->op) {
+        case TMPFS_STORE_CREATE:
+            ret = store_create(req->path, req->type, req->perm);
+            goto out;
+        case TMPFS_STORE_UNLINK:
+            ret = store_unlink(req->path);
+            goto out;
+        case TMPFS_STORE_RENAME:
+            ret = store_rename(req->path, req->new_path);
+            goto out;
+        case TMPFS_STORE_READDIR:
+            ret = store_readdir(req->path, out_data, out_size);
+            goto out;
+        default:
+            entry = find_entry(req->path);
+            if (!entry) {
+                ret = -ENOENT;
+                goto out;
+            }
+            break;
+    }
+
+    time_t time;
+    switch (req->op) {
+        case TMPFS_STORE_STAT:
+            attr->type  = entry->type;
+            attr->perm  = entry->perm;
+            attr->size  = entry->mem.size;
+            attr->ctime = entry->ctime;
+            attr->mtime = entry->mtime;
+            attr->atime = entry->atime;
+            ret = 0;
+            break;
+
+        case TMPFS_STORE_CHMOD:
+            entry->perm = req->perm;
+            ret = 0;
+            break;
+
+        case TMPFS_STORE_READ: {
+            size_t size = MIN(req->size, (size_t)TMPFS_STORE_MAX_IO);
+            void* data = malloc(size ?: 1);
+            if (!data) {
+                ret = -ENOMEM;
+                break;
+            }
+            ret = extent_file_read(&entry->mem, req->pos, data, size);
+            if (ret < 0) {
+                free(data);
+                break;
+            }
+            *out_data = data;
+            *out_size = ret;
+            break;
+        }
+
+        case TMPFS_STORE_WRITE:
+            ret = get_time(&time);
+            if (ret < 0)
+                break;
+            ret = extent_file_write(&entry->mem, req->pos, req->data, req->size);
+            if (ret >= 0)
+                entry->mtime = time;
+            break;
+
+        case TMPFS_STORE_TRUNCATE:
+            ret = get_time(&time);
+            if (ret < 0)
+                break;
+            ret = extent_file_truncate(&entry->mem, req->pos);
+            if (ret == 0)
+                entry->mtime = time;
+            break;
+
+        default:
+            ret = -EINVAL;
+            break;
+    }
+
+out:
+    unlock(&g_store_lock);
+    return ret;
+}
+
+/* Execute the operation locally in the main process, or send it to the main process. */
+static ssize_t store_call(struct tmpfs_store_req* req, struct tmpfs_store_attr* attr,
+                          void** out_data, size_t* out_size) {
+    if (g_process_ipc_ids.leader_vmid)
+        return ipc_tmpfs_store_request(req, attr, out_data, out_size);
+    return tmpfs_store_do(req, attr, out_data, out_size);
+}
+
+int tmpfs_store_stat(const char* path, struct tmpfs_store_attr* attr) {
+    struct tmpfs_store_req req = { .op = TMPFS_STORE_STAT, .path = path };
+    return store_call(&req, attr, /*out_data=*/NULL, /*out_size=*/NULL);
+}
+
+int tmpfs_store_create(const char* path, mode_t type, mode_t perm) {
+    struct tmpfs_store_req req = {
+        .op = TMPFS_STORE_CREATE,
+        .path = path,
+        .type = type,
+        .perm = perm,
+    };
+    return store_call(&req, /*attr=*/NULL, /*out_data=*/NULL, /*out_size=*/NULL);
+}
+
+int tmpfs_store_chmod(const char* path, mode_t perm) {
+    struct tmpfs_store_req req = { .op = TMPFS_STORE_CHMOD, .path = path, .perm = perm };
+    return store_call(&req, /*attr=*/NULL, /*out_data=*/NULL, /*out_size=*/NULL);
+}
+
+int tmpfs_store_unlink(const char* path) {
+    struct tmpfs_store_req req = { .op = TMPFS_STORE_UNLINK, .path = path };
+    return store_call(&req, /*attr=*/NULL, /*out_data=*/NULL, /*out_size=*/NULL);
+}
+
+int tmpfs_store_rename(const char* old_path, const char* new_path) {
+    struct tmpfs_store_req req = {
+        .op = TMPFS_STORE_RENAME,
+        .path = old_path,
+        .new_path = new_path,
+    };
+    return store_call(&req, /*attr=*/NULL, /*out_data=*/NULL, /*out_size=*/NULL);
+}
+
+int tmpfs_store_readdir(const char* path, readdir_callback_t callback, void* arg) {
+    struct tmpfs_store_req req = { .op = TMPFS_STORE_READDIR, .path = path };
+    void* data = NULL;
+    size_t size = 0;
+    int ret = store_call(&req, /*attr=*/NULL, &data, &size);
+    if (ret < 0)
+        return ret;
+
+    /* call `callback` after the store lock is released */
+    const char* name = data;
+    while (name < (const char*)data + size) {
+        ret = callback(name, arg);
+        if (ret < 0)
+            break;
+        name += strlen(name) + 1;
+    }
+    free(data);
+    return ret;
+}
+
+ssize_t tmpfs_store_read(const char* path, file_off_t pos, void* buf, size_t size) {
+    size_t total = 0;
+    while (total < size) {
+        struct tmpfs_store_req req = {
+            .op = TMPFS_STORE_READ,
+            .path = path,
+            .pos = pos + total,
+            .size = MIN(size - total, (size_t)TMPFS_STORE_MAX_IO),
+        };
+        void* data = NULL;
+        size_t data_size = 0;
+        ssize_t ret = store_call(&req, /*attr=*/NULL, &data, &data_size);
+        if (ret < 0)
+            return total > 0 ? (ssize_t)total : ret;
+
+        memcpy((char*)buf + total, data, data_size);
+        free(data);
+        total += data_size;
+        if (data_size < req.size)
+            break;
+    }
+    return total;
+}
+
+ssize_t tmpfs_store_write(const char* path, file_off_t pos, const void* buf, size_t size) {
+    size_t total = 0;
+    do {
+        struct tmpfs_store_req req = {
+            .op = TMPFS_STORE_WRITE,
+            .path = path,
+            .pos = pos + total,
+            .size = MIN(size - total, (size_t)TMPFS_STORE_MAX_IO),
+            .data = (const char*)buf + total,
+        };
+        ssize_t ret = store_call(&req, /*attr=*/NULL, /*out_data=*/NULL, /*out_size=*/NULL);
+        if (ret < 0)
+            return total > 0 ? (ssize_t)total : ret;
+
+        total += ret;
+        if ((size_t)ret < req.size)
+            break;
+    } while (total < size);
+    return total;
+}
+
+int tmpfs_store_truncate(const char* path, file_off_t size) {
+    struct tmpfs_store_req req = { .op = TMPFS_STORE_TRUNCATE, .path = path, .pos = size };
+    return store_call(&req, /*attr=*/NULL, /*out_data=*/NULL, /*out_size=*/NULL);
+}
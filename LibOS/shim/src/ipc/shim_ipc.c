@@ -22,6 +22,27 @@
 #include "shim_thread.h"
 #include "shim_types.h"
 #include "shim_utils.h"
+#include "spinlock.h"
+
+/* Messages up to this size are copied into the connection's batch buffer and written together with
+ * other queued messages; bigger ones are written straight from the sender's buffer. */
+#define IPC_BATCH_COPY_MAX 0x400
+#define IPC_BATCH_BUF_SIZE 0x1000
+
+/* Outgoing connections kept open; when a new one would exceed this, the least recently used peer
+ * connection is closed. */
+#define IPC_MAX_PEER_CONNECTIONS 32
+
+/* Message queued for sending, lives on the sender's stack until `done` is set. */
+DEFINE_LIST(ipc_send_req);
+DEFINE_LISTP(ipc_send_req);
+struct ipc_send_req {
+    LIST_TYPE(ipc_send_req) list;
+    struct shim_ipc_msg* msg;
+    size_t size;
+    bool done;
+    int ret;
+};
 
 struct shim_ipc_connection {
     struct avl_tree_node node;
@@ -29,9 +50,16 @@ struct shim_ipc_connection {
     int seen_error;
     REFTYPE ref_count;
     PAL_HANDLE handle;
-    /* This lock guards concurrent accesses to `handle` and `seen_error`. If you need both this lock
-     * and `g_ipc_connections_lock`, take the latter first. */
+    /* This lock guards concurrent accesses to `handle`, `seen_error` and `batch_buf`. Whoever holds
+     * it writes out all messages queued so far, so senders which waited for it usually find their
+     * message already sent. If you need both this lock and `g_ipc_connections_lock`, take the
+     * latter first. */
     struct shim_lock lock;
+    spinlock_t send_queue_lock;
+    LISTP_TYPE(ipc_send_req) send_queue;
+    char* batch_buf;
+    /* Value of `g_ipc_use_clock` at the last lookup, protected by `g_ipc_connections_lock`. */
+    uint64_t last_used;
 };
 
 static bool ipc_connection_cmp(struct avl_tree_node* _a, struct avl_tree_node* _b) {
@@ -43,6 +71,8 @@ static bool ipc_connection_cmp(struct avl_tree_node* _a, struct avl_tree_node* _
 /* Tree of outgoing IPC connections, to be accessed only with `g_ipc_connections_lock` taken. */
 static struct avl_tree g_ipc_connections = { .cmp = ipc_connection_cmp };
 static struct shim_lock g_ipc_connections_lock;
+static size_t g_ipc_connections_cnt = 0;
+static uint64_t g_ipc_use_clock = 0;
 
 struct ipc_msg_waiter {
     struct avl_tree_node node;
@@ -84,6 +114,7 @@ static void put_ipc_connection(struct shim_ipc_connection* conn) {
     if (!ref_count) {
         DkObjectClose(conn->handle);
         destroy_lock(&conn->lock);
+        free(conn->batch_buf);
         free(conn);
     }
 }
@@ -95,6 +126,45 @@ static struct shim_ipc_connection* node2conn(struct avl_tree_node* node) {
     return container_of(node, struct shim_ipc_connection, node);
 }
 
+static int ipc_send_message_to_conn(struct shim_ipc_connection* conn, struct shim_ipc_msg* msg);
+
+static void _remove_ipc_connection(struct shim_ipc_connection* conn) {
+    assert(locked(&g_ipc_connections_lock));
+    avl_tree_delete(&g_ipc_connections, &conn->node);
+    g_ipc_connections_cnt--;
+    put_ipc_connection(conn);
+}
+
+/* Closes the least recently used connection which nobody is using right now. Connections to the
+ * IPC leader and to the parent are never closed: these processes treat a closed connection as our
+ * death (e.g. they drop our sync handles). Other peers are told that we are still alive, so they
+ * just reconnect when needed. */
+static void evict_peer_connection(void) {
+    assert(locked(&g_ipc_connections_lock));
+
+    struct shim_ipc_connection* victim = NULL;
+    struct shim_ipc_connection* conn = node2conn(avl_tree_first(&g_ipc_connections));
+    while (conn) {
+        if (conn->vmid != g_process_ipc_ids.leader_vmid
+                && conn->vmid != g_process_ipc_ids.parent_vmid
+                && REF_GET(conn->ref_count) == 1 && !conn->seen_error
+                && (!victim || conn->last_used < victim->last_used)) {
+            victim = conn;
+        }
+        conn = node2conn(avl_tree_next(&conn->node));
+    }
+    if (!victim) {
+        return;
+    }
+
+    log_debug("Closing idle IPC connection to %u", victim->vmid);
+    size_t msg_size = get_ipc_msg_size(0);
+    struct shim_ipc_msg* msg = __alloca(msg_size);
+    init_ipc_msg(msg, IPC_MSG_CONN_CLOSE, msg_size);
+    (void)ipc_send_message_to_conn(victim, msg);
+    _remove_ipc_connection(victim);
+}
+
 static int ipc_connect(IDTYPE dest, struct shim_ipc_connection** conn_ptr) {
     struct shim_ipc_connection dummy = { .vmid = dest };
     int ret = 0;
@@ -102,6 +172,10 @@ static int ipc_connect(IDTYPE dest, struct shim_ipc_connection** conn_ptr) {
     lock(&g_ipc_connections_lock);
     struct shim_ipc_connection* conn = node2conn(avl_tree_find(&g_ipc_connections, &dummy.node));
     if (!conn) {
+        if (g_ipc_connections_cnt >= IPC_MAX_PEER_CONNECTIONS) {
+            evict_peer_connection();
+        }
+
         conn = calloc(1, sizeof(*conn));
         if (!conn) {
             ret = -ENOMEM;
@@ -111,6 +185,8 @@ static int ipc_connect(IDTYPE dest, struct shim_ipc_connection** conn_ptr) {
             ret = -ENOMEM;
             goto out;
         }
+        spinlock_init(&conn->send_queue_lock);
+        INIT_LISTP(&conn->send_queue);
 
         char uri[PIPE_URI_SIZE];
         if (vmid_to_uri(dest, uri, sizeof(uri)) < 0) {
@@ -131,8 +207,10 @@ static int ipc_connect(IDTYPE dest, struct shim_ipc_connection** conn_ptr) {
         conn->vmid = dest;
         REF_SET(conn->ref_count, 1);
         avl_tree_insert(&g_ipc_connections, &conn->node);
+        g_ipc_connections_cnt++;
     }
 
+    conn->last_used = ++g_ipc_use_clock;
     get_ipc_connection(conn);
     *conn_ptr = conn;
     conn = NULL;
@@ -152,12 +230,6 @@ out:
     return ret;
 }
 
-static void _remove_ipc_connection(struct shim_ipc_connection* conn) {
-    assert(locked(&g_ipc_connections_lock));
-    avl_tree_delete(&g_ipc_connections, &conn->node);
-    put_ipc_connection(conn);
-}
-
 int connect_to_process(IDTYPE dest) {
     struct shim_ipc_connection* conn = NULL;
     int ret = ipc_connect(dest, &conn);
@@ -205,27 +277,100 @@ void init_ipc_response(struct shim_ipc_msg* msg, uint64_t seq, size_t size) {
     SET_UNALIGNED(msg->header.seq, seq);
 }
 
-static int ipc_send_message_to_conn(struct shim_ipc_connection* conn, struct shim_ipc_msg* msg) {
-    log_debug("Sending ipc message to %u", conn->vmid);
+/* Writes out `size` bytes of `conn->batch_buf`, which hold the messages of requests from `first` up
+ * to (excluding) `end`. */
+static void write_batch(struct shim_ipc_connection* conn, LISTP_TYPE(ipc_send_req)* reqs,
+                        struct ipc_send_req* first, struct ipc_send_req* end, size_t size) {
+    int ret = write_exact(conn->handle, conn->batch_buf, size);
+    if (ret < 0) {
+        conn->seen_error = ret;
+    }
+    for (struct ipc_send_req* req = first; req != end; req = LISTP_NEXT_ENTRY(req, reqs, list)) {
+        req->ret = ret;
+    }
+}
 
-    int ret = 0;
-    lock(&conn->lock);
-    if (conn->seen_error) {
-        ret = conn->seen_error;
-        log_debug("%s: returning previously seen error: %d", __func__, ret);
-        goto out;
+/* Writes out everything queued on `conn`, coalescing small messages into as few writes as possible.
+ * Must be called with `conn->lock` held. */
+static void flush_send_queue(struct shim_ipc_connection* conn) {
+    assert(locked(&conn->lock));
+
+    LISTP_TYPE(ipc_send_req) reqs = LISTP_INIT;
+    spinlock_lock(&conn->send_queue_lock);
+    LISTP_SPLICE_INIT(&conn->send_queue, &reqs, list, ipc_send_req);
+    spinlock_unlock(&conn->send_queue_lock);
+
+    if (!conn->batch_buf) {
+        /* If this fails, every message is simply written on its own. */
+        conn->batch_buf = malloc(IPC_BATCH_BUF_SIZE);
     }
 
-    ret = write_exact(conn->handle, msg,  GET_UNALIGNED(msg->header.size));
-    if (ret < 0) {
-        log_error("Failed to send IPC msg to %u: %d", conn->vmid, ret);
-        conn->seen_error = ret;
-        goto out;
+    struct ipc_send_req* req;
+    struct ipc_send_req* tmp;
+    struct ipc_send_req* batch_first = NULL;
+    size_t batch_size = 0;
+    LISTP_FOR_EACH_ENTRY(req, &reqs, list) {
+        bool batchable = conn->batch_buf && req->size <= IPC_BATCH_COPY_MAX;
+        if (batch_first && (!batchable || batch_size + req->size > IPC_BATCH_BUF_SIZE)) {
+            write_batch(conn, &reqs, batch_first, req, batch_size);
+            batch_first = NULL;
+            batch_size = 0;
+        }
+
+        if (conn->seen_error) {
+            req->ret = conn->seen_error;
+        } else if (batchable) {
+            if (!batch_first) {
+                batch_first = req;
+            }
+            memcpy(conn->batch_buf + batch_size, req->msg, req->size);
+            batch_size += req->size;
+        } else {
+            /* Big message, write it straight from the sender's buffer. */
+            req->ret = write_exact(conn->handle, req->msg, req->size);
+            if (req->ret < 0) {
+                conn->seen_error = req->ret;
+            }
+        }
+    }
+    if (batch_first) {
+        write_batch(conn, &reqs, batch_first, /*end=*/NULL, batch_size);
     }
 
-out:
+    /* The senders wait for `conn->lock`, so their requests stay valid until we release it. */
+    LISTP_FOR_EACH_ENTRY_SAFE(req, tmp, &reqs, list) {
+        LISTP_DEL(req, &reqs, list);
+        if (req->ret < 0) {
+            log_error("Failed to send IPC msg to %u: %d", conn->vmid, req->ret);
+        }
+        req->done = true;
+    }
+}
+
+static int ipc_send_message_to_conn(struct shim_ipc_connection* conn, struct shim_ipc_msg* msg) {
+    log_debug("Sending ipc message to %u", conn->vmid);
+
+    struct ipc_send_req req = {
+        .msg = msg,
+        .size = GET_UNALIGNED(msg->header.size),
+        .done = false,
+        .ret = 0,
+    };
+    INIT_LIST_HEAD(&req, list);
+
+    spinlock_lock(&conn->send_queue_lock);
+    LISTP_ADD_TAIL(&req, &conn->send_queue, list);
+    spinlock_unlock(&conn->send_queue_lock);
+
+    lock(&conn->lock);
+    if (!req.done) {
+        /* Nobody picked our message up while we waited for the lock, send it along with whatever
+         * got queued in the meantime. */
+        flush_send_queue(conn);
+        assert(req.done);
+    }
     unlock(&conn->lock);
-    return ret;
+    return req.ret;
 }
 
 int ipc_send_message(IDTYPE dest, struct shim_ipc_msg* msg) {
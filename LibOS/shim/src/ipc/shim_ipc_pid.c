@@ -11,6 +11,7 @@
 #include "shim_ipc.h"
 #include "shim_lock.h"
 #include "shim_types.h"
+#include "spinlock.h"
 
 /* Represents a range of ids `[start; end]` (i.e. `end` is included). There is no representation of
  * an empty range, but it's not needed. */
@@ -29,6 +30,9 @@ struct ipc_id_range_msg {
 struct ipc_id_owner_msg {
     IDTYPE id;
     IDTYPE owner;
+    /* block of IDs that changes owner along with `id`; `block_start` is 0 if there is none */
+    IDTYPE block_start;
+    IDTYPE block_end;
 };
 
 static bool id_range_cmp(struct avl_tree_node* _a, struct avl_tree_node* _b) {
@@ -49,6 +53,27 @@ static struct avl_tree g_id_owners_tree = { .cmp = id_range_cmp };
 static struct shim_lock g_id_owners_tree_lock;
 static IDTYPE g_last_id = 0;
 
+struct ipc_id_owner_resp {
+    IDTYPE owner;
+    /* whole range owned by `owner` that contains the requested ID */
+    IDTYPE start;
+    IDTYPE end;
+};
+
+/* Ranges of IDs with owners recently learned from the IPC leader (or from messages sent by the
+ * owner itself), so that e.g. repeated signals to the same process, or to any of its threads, go
+ * straight to the owner. An entry goes stale only when its owner gives away or releases an ID;
+ * users that get -ESRCH from the cached owner or cannot reach it drop the entry with
+ * #ipc_forget_id_owner and ask again. Only used in processes other than the IPC leader. */
+#define ID_OWNER_CACHE_SIZE 64
+static struct {
+    IDTYPE start; /* 0 marks an empty entry */
+    IDTYPE end;
+    IDTYPE owner;
+} g_id_owner_cache[ID_OWNER_CACHE_SIZE];
+static size_t g_id_owner_cache_next = 0;
+static spinlock_t g_id_owner_cache_lock = INIT_SPINLOCK_UNLOCKED;
+
 int init_ipc_ids(void) {
     if (!create_lock(&g_id_owners_tree_lock)) {
         return -ENOMEM;
@@ -57,7 +82,7 @@ int init_ipc_ids(void) {
 }
 
 /* If a free range was found, sets `*start` and `*end` and returns `true`, if nothing was found
- * returns `false`. If a range was returned, it is not larger than `MAX_RANGE_SIZE`. */
+ * returns `false`. If a range was returned, it is not larger than `ID_BLOCK_SIZE`. */
 static bool _find_free_id_range(IDTYPE* start, IDTYPE* end) {
     assert(locked(&g_id_owners_tree_lock));
     static_assert(!IS_SIGNED(IDTYPE), "IDTYPE must be unsigned");
@@ -73,7 +98,7 @@ static bool _find_free_id_range(IDTYPE* start, IDTYPE* end) {
         if (next_id < range->start) {
             /* `next_id` does not overlap any existing range. */
             *start = next_id;
-            if (__builtin_add_overflow(next_id, MAX_RANGE_SIZE - 1, end)) {
+            if (__builtin_add_overflow(next_id, ID_BLOCK_SIZE - 1, end)) {
                 *end = IDTYPE_MAX;
             }
             *end = MIN(*end, range->start - 1);
@@ -91,7 +116,7 @@ static bool _find_free_id_range(IDTYPE* start, IDTYPE* end) {
     }
     /* There are no ids greater or equal to `next_id`. */
     *start = next_id;
-    if (__builtin_add_overflow(next_id, MAX_RANGE_SIZE - 1, end)) {
+    if (__builtin_add_overflow(next_id, ID_BLOCK_SIZE - 1, end)) {
         *end = IDTYPE_MAX;
     }
     return true;
@@ -128,88 +153,106 @@ static int alloc_id_range(IDTYPE owner, IDTYPE* start, IDTYPE* end) {
     return ret;
 }
 
-static int change_id_owner(IDTYPE id, IDTYPE new_owner) {
-    struct id_range* new_range1 = malloc(sizeof(*new_range1));
-    if (!new_range1) {
-        return -ENOMEM;
-    }
-    struct id_range* new_range2 = malloc(sizeof(*new_range1));
-    if (!new_range2) {
-        free(new_range1);
-        return -ENOMEM;
+/* Makes `owner` the owner of all IDs in `[start; end]` that are in use, or releases them if `owner`
+ * is 0. Ranges that overlap `[start; end]` only partially are split first. Sets `*out_count` to the
+ * number of ranges that were changed. */
+static int set_ids_owner(IDTYPE start, IDTYPE end, IDTYPE owner, size_t* out_count) {
+    assert(start && start <= end);
+
+    /* only the first and the last overlapping range can need a split */
+    struct id_range* spare[2];
+    size_t spare_cnt = 0;
+    for (; spare_cnt < ARRAY_SIZE(spare); spare_cnt++) {
+        spare[spare_cnt] = malloc(sizeof(*spare[spare_cnt]));
+        if (!spare[spare_cnt]) {
+            while (spare_cnt)
+                free(spare[--spare_cnt]);
+            return -ENOMEM;
+        }
     }
-    new_range1->start = id;
-    new_range1->end = id;
-    new_range1->owner = new_owner;
 
+    size_t count = 0;
     lock(&g_id_owners_tree_lock);
     struct id_range dummy = {
-        .start = id,
-        .end = id,
+        .start = start,
+        .end = start,
     };
     struct avl_tree_node* node = avl_tree_lower_bound(&g_id_owners_tree, &dummy.node);
-    if (!node) {
-        log_debug("ID %u unknown!", id);
-        BUG();
-    }
-    struct id_range* range = container_of(node, struct id_range, node);
-    if (id < range->start || range->end < id) {
-        log_debug("ID %u unknown!", id);
-        BUG();
-    }
-
-    /* These `range` modifications are in place since we know they won't change the position of
-     * `range` inside `g_id_owners_tree`. Otherwise we would have to remove it, modify and then
-     * re-add. */
-    if (range->start == range->end) {
-        assert(id == range->start);
-        range->owner = new_owner;
-    } else if (range->start == id) {
-        range->start++;
-        avl_tree_insert(&g_id_owners_tree, &new_range1->node);
-        new_range1 = NULL;
-    } else if (range->end == id) {
-        range->end--;
-        avl_tree_insert(&g_id_owners_tree, &new_range1->node);
-        new_range1 = NULL;
-    } else {
-        assert(range->end - range->start + 1 >= 3);
-        new_range2->start = id + 1;
-        new_range2->end = range->end;
-        new_range2->owner = range->owner;
-        range->end = id - 1;
-        avl_tree_insert(&g_id_owners_tree, &new_range1->node);
-        avl_tree_insert(&g_id_owners_tree, &new_range2->node);
-        new_range1 = NULL;
-        new_range2 = NULL;
-    }
+    while (node) {
+        struct id_range* range = container_of(node, struct id_range, node);
+        if (range->start > end) {
+            break;
+        }
+        node = avl_tree_next(node);
 
+        /* These `range` modifications are in place since we know they won't change the position
+         * of `range` inside `g_id_owners_tree`. Otherwise we would have to remove it, modify and
+         * then re-add. */
+        if (range->start < start) {
+            struct id_range* head = spare[--spare_cnt];
+            head->start = range->start;
+            head->end = start - 1;
+            head->owner = range->owner;
+            range->start = start;
+            avl_tree_insert(&g_id_owners_tree, &head->node);
+        }
+        if (range->end > end) {
+            struct id_range* tail = spare[--spare_cnt];
+            tail->start = end + 1;
+            tail->end = range->end;
+            tail->owner = range->owner;
+            range->end = end;
+            avl_tree_insert(&g_id_owners_tree, &tail->node);
+        }
+
+        if (owner) {
+            range->owner = owner;
+        } else {
+            avl_tree_delete(&g_id_owners_tree, &range->node);
+            free(range);
+        }
+        count++;
+    }
     unlock(&g_id_owners_tree_lock);
-    free(new_range1);
-    free(new_range2);
+
+    while (spare_cnt)
+        free(spare[--spare_cnt]);
+    *out_count = count;
     return 0;
 }
 
-static void release_id_range(IDTYPE start, IDTYPE end) {
-    lock(&g_id_owners_tree_lock);
-    struct id_range dummy = {
-        .start = start,
-        .end = end,
-    };
-    struct avl_tree_node* node = avl_tree_find(&g_id_owners_tree, &dummy.node);
-    if (!node) {
-        log_debug("Releasing invalid ID range!");
-        BUG();
+static int change_id_owner(IDTYPE id, IDTYPE block_start, IDTYPE block_end, IDTYPE new_owner) {
+    size_t count;
+    int ret;
+    if (id) {
+        ret = set_ids_owner(id, id, new_owner, &count);
+        if (ret < 0) {
+            return ret;
+        }
+        if (!count) {
+            log_debug("ID %u unknown!", id);
+            BUG();
+        }
     }
-    struct id_range* range = container_of(node, struct id_range, node);
-    assert(range->start == start && range->end == end);
-    avl_tree_delete(&g_id_owners_tree, &range->node);
+    if (block_start) {
+        /* IDs of the block that the previous owner has already released stay free */
+        ret = set_ids_owner(block_start, block_end, new_owner, &count);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+    return 0;
+}
 
-    unlock(&g_id_owners_tree_lock);
-    free(range);
+static int release_id_range(IDTYPE start, IDTYPE end) {
+    /* Parts of a delegated block may have been released by the process it was delegated to, so
+     * `[start; end]` does not have to be in use as a whole. */
+    size_t count;
+    return set_ids_owner(start, end, /*owner=*/0, &count);
 }
 
-static IDTYPE find_id_owner(IDTYPE id) {
+/* If `out_start` and `out_end` are not NULL, they are set to the range containing `id`. */
+static IDTYPE find_id_owner(IDTYPE id, IDTYPE* out_start, IDTYPE* out_end) {
     IDTYPE owner = 0;
 
     struct id_range dummy = {
@@ -226,6 +269,10 @@ static IDTYPE find_id_owner(IDTYPE id) {
         goto out;
     }
     owner = range->owner;
+    if (out_start && out_end) {
+        *out_start = range->start;
+        *out_end = range->end;
+    }
 
 out:
     unlock(&g_id_owners_tree_lock);
@@ -295,8 +342,7 @@ int ipc_alloc_id_range_callback(IDTYPE src, void* data, uint64_t seq) {
 
 int ipc_release_id_range(IDTYPE start, IDTYPE end) {
     if (!g_process_ipc_ids.leader_vmid) {
-        release_id_range(start, end);
-        return 0;
+        return release_id_range(start, end);
     }
 
     struct ipc_id_range_msg range = {
@@ -323,19 +369,29 @@ int ipc_release_id_range_callback(IDTYPE src, void* data, uint64_t seq) {
     __UNUSED(src);
     __UNUSED(seq);
     struct ipc_id_range_msg* range = data;
-    release_id_range(range->start, range->end);
-    log_debug("%s: release_id_range(%u..%u)", __func__, range->start, range->end);
-    return 0;
+    int ret = release_id_range(range->start, range->end);
+    log_debug("%s: release_id_range(%u..%u): %d", __func__, range->start, range->end, ret);
+    return ret;
 }
 
 int ipc_change_id_owner(IDTYPE id, IDTYPE new_owner) {
+    return ipc_change_id_owner_with_block(id, /*block_start=*/0, /*block_end=*/0, new_owner);
+}
+
+int ipc_change_id_owner_with_block(IDTYPE id, IDTYPE block_start, IDTYPE block_end,
+                                   IDTYPE new_owner) {
+    if (id) {
+        (void)ipc_forget_id_owner(id);
+    }
     if (!g_process_ipc_ids.leader_vmid) {
-        return change_id_owner(id, new_owner);
+        return change_id_owner(id, block_start, block_end, new_owner);
     }
 
     struct ipc_id_owner_msg owner_msg = {
         .id = id,
         .owner = new_owner,
+        .block_start = block_start,
+        .block_end = block_end,
     };
     size_t msg_size = get_ipc_msg_size(sizeof(owner_msg));
     struct shim_ipc_msg* msg = malloc(msg_size);
@@ -345,7 +401,8 @@ int ipc_change_id_owner(IDTYPE id, IDTYPE new_owner) {
     init_ipc_msg(msg, IPC_MSG_CHANGE_ID_OWNER, msg_size);
     memcpy(&msg->data, &owner_msg, sizeof(owner_msg));
 
-    log_debug("%s: sending a request (%u..%u)", __func__, id, new_owner);
+    log_debug("%s: sending a request (%u, [%u..%u], %u)", __func__, id, block_start, block_end,
+              new_owner);
 
     int ret = ipc_send_msg_and_get_response(g_process_ipc_ids.leader_vmid, msg, /*resp=*/NULL);
     log_debug("%s: ipc_send_msg_and_get_response: %d", __func__, ret);
@@ -355,8 +412,10 @@ int ipc_change_id_owner(IDTYPE id, IDTYPE new_owner) {
 
 int ipc_change_id_owner_callback(IDTYPE src, void* data, uint64_t seq) {
     struct ipc_id_owner_msg* owner_msg = data;
-    int ret = change_id_owner(owner_msg->id, owner_msg->owner);
-    log_debug("%s: change_id_owner(%u..%u): %d", __func__, owner_msg->id, owner_msg->owner, ret);
+    int ret = change_id_owner(owner_msg->id, owner_msg->block_start, owner_msg->block_end,
+                              owner_msg->owner);
+    log_debug("%s: change_id_owner(%u, [%u..%u], %u): %d", __func__, owner_msg->id,
+              owner_msg->block_start, owner_msg->block_end, owner_msg->owner, ret);
     if (ret < 0) {
         return ret;
     }
@@ -368,9 +427,69 @@ int ipc_change_id_owner_callback(IDTYPE src, void* data, uint64_t seq) {
     return ipc_send_message(src, msg);
 }
 
+static IDTYPE lookup_cached_id_owner(IDTYPE id) {
+    IDTYPE owner = 0;
+    spinlock_lock(&g_id_owner_cache_lock);
+    for (size_t i = 0; i < ID_OWNER_CACHE_SIZE; i++) {
+        if (g_id_owner_cache[i].start && g_id_owner_cache[i].start <= id
+                && id <= g_id_owner_cache[i].end) {
+            owner = g_id_owner_cache[i].owner;
+            break;
+        }
+    }
+    spinlock_unlock(&g_id_owner_cache_lock);
+    return owner;
+}
+
+static void remember_id_owner(IDTYPE start, IDTYPE end, IDTYPE owner) {
+    assert(start && start <= end);
+
+    spinlock_lock(&g_id_owner_cache_lock);
+    /* Entries must not overlap, otherwise an older one could shadow this one. */
+    for (size_t i = 0; i < ID_OWNER_CACHE_SIZE; i++) {
+        if (g_id_owner_cache[i].start && g_id_owner_cache[i].start <= end
+                && start <= g_id_owner_cache[i].end) {
+            g_id_owner_cache[i].start = 0;
+        }
+    }
+    size_t slot = g_id_owner_cache_next;
+    g_id_owner_cache_next = (slot + 1) % ID_OWNER_CACHE_SIZE;
+    g_id_owner_cache[slot].start = start;
+    g_id_owner_cache[slot].end = end;
+    g_id_owner_cache[slot].owner = owner;
+    spinlock_unlock(&g_id_owner_cache_lock);
+}
+
+void ipc_learn_id_owner(IDTYPE id, IDTYPE owner) {
+    if (!g_process_ipc_ids.leader_vmid || !id || !owner) {
+        return;
+    }
+    remember_id_owner(id, id, owner);
+}
+
+bool ipc_forget_id_owner(IDTYPE id) {
+    bool found = false;
+    spinlock_lock(&g_id_owner_cache_lock);
+    for (size_t i = 0; i < ID_OWNER_CACHE_SIZE; i++) {
+        if (g_id_owner_cache[i].start && g_id_owner_cache[i].start <= id
+                && id <= g_id_owner_cache[i].end) {
+            g_id_owner_cache[i].start = 0;
+            found = true;
+        }
+    }
+    spinlock_unlock(&g_id_owner_cache_lock);
+    return found;
+}
+
 int ipc_get_id_owner(IDTYPE id, IDTYPE* out_owner) {
     if (!g_process_ipc_ids.leader_vmid) {
-        *out_owner = find_id_owner(id);
+        *out_owner = find_id_owner(id, /*out_start=*/NULL, /*out_end=*/NULL);
+        return 0;
+    }
+
+    IDTYPE cached_owner = lookup_cached_id_owner(id);
+    if (cached_owner) {
+        *out_owner = cached_owner;
         return 0;
     }
 
@@ -390,10 +509,16 @@ int ipc_get_id_owner(IDTYPE id, IDTYPE* out_owner) {
         goto out;
     }
 
-    *out_owner = *(IDTYPE*)resp;
+    struct ipc_id_owner_resp* owner_resp = resp;
+    *out_owner = owner_resp->owner;
     ret = 0;
 
-    log_debug("%s: got a response: %u", __func__, *out_owner);
+    log_debug("%s: got a response: %u [%u..%u]", __func__, owner_resp->owner, owner_resp->start,
+              owner_resp->end);
+
+    if (owner_resp->owner) {
+        remember_id_owner(owner_resp->start, owner_resp->end, owner_resp->owner);
+    }
 
 out:
     free(resp);
@@ -403,13 +528,14 @@ out:
 
 int ipc_get_id_owner_callback(IDTYPE src, void* data, uint64_t seq) {
     IDTYPE* id = data;
-    IDTYPE owner = find_id_owner(*id);
-    log_debug("%s: find_id_owner(%u): %u", __func__, *id, owner);
+    struct ipc_id_owner_resp owner_resp = { 0 };
+    owner_resp.owner = find_id_owner(*id, &owner_resp.start, &owner_resp.end);
+    log_debug("%s: find_id_owner(%u): %u", __func__, *id, owner_resp.owner);
 
-    size_t msg_size = get_ipc_msg_size(sizeof(owner));
+    size_t msg_size = get_ipc_msg_size(sizeof(owner_resp));
     struct shim_ipc_msg* msg = __alloca(msg_size);
     init_ipc_response(msg, seq, msg_size);
-    memcpy(&msg->data, &owner, sizeof(owner));
+    memcpy(&msg->data, &owner_resp, sizeof(owner_resp));
 
     return ipc_send_message(src, msg);
 }
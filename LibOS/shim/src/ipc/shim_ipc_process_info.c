@@ -25,7 +25,9 @@ static const char* pid_meta_code_str[4] = {
 int ipc_pid_getmeta(IDTYPE pid, enum pid_meta_code code, struct shim_ipc_pid_retmeta** data) {
     IDTYPE dest;
     int ret;
+    bool retried = false;
 
+again:
     if ((ret = ipc_get_id_owner(pid, &dest)) < 0)
         return ret;
 
@@ -49,11 +51,20 @@ int ipc_pid_getmeta(IDTYPE pid, enum pid_meta_code code, struct shim_ipc_pid_ret
     struct shim_ipc_pid_retmeta* resp = NULL;
     ret = ipc_send_msg_and_get_response(dest, msg, (void**)&resp);
     if (ret < 0) {
+        /* the cached owner may be gone, then ask the IPC leader again */
+        if (!retried && ipc_forget_id_owner(pid)) {
+            retried = true;
+            goto again;
+        }
         return ret;
     }
     if (resp->ret_val != 0) {
         ret = resp->ret_val;
         free(resp);
+        if (ret == -ESRCH && !retried && ipc_forget_id_owner(pid)) {
+            retried = true;
+            goto again;
+        }
         return ret;
     }
 
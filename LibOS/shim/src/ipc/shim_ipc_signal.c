@@ -16,7 +16,9 @@
 static int ipc_pid_kill_send(enum kill_type type, IDTYPE sender, IDTYPE dest_pid, IDTYPE target,
                              int sig) {
     int ret;
+    bool retried = false;
 
+again:;
     IDTYPE dest = 0;
     if (type == KILL_ALL) {
         if (g_process_ipc_ids.leader_vmid) {
@@ -61,6 +63,11 @@ static int ipc_pid_kill_send(enum kill_type type, IDTYPE sender, IDTYPE dest_pid
 
         void* resp = NULL;
         ret = ipc_send_msg_and_get_response(dest, msg, &resp);
+        if (ret < 0 && type != KILL_ALL && !retried && ipc_forget_id_owner(dest_pid)) {
+            /* the cached owner is gone, ask the IPC leader again */
+            retried = true;
+            goto again;
+        }
         if (ret < 0) {
             /* During sending the message to destination process, it may have terminated and became
              * a zombie; kill shouldn't fail in this case. The below logic checks if the destination
@@ -84,6 +91,11 @@ static int ipc_pid_kill_send(enum kill_type type, IDTYPE sender, IDTYPE dest_pid
         } else {
             ret = *(int*)resp;
             free(resp);
+            if (ret == -ESRCH && type != KILL_ALL && !retried && ipc_forget_id_owner(dest_pid)) {
+                /* the cached owner no longer has `dest_pid`, ask the IPC leader again */
+                retried = true;
+                goto again;
+            }
         }
     }
 
@@ -115,6 +127,12 @@ int ipc_pid_kill_callback(IDTYPE src, void* data, uint64_t seq) {
     int ret = 0;
     bool response_expected = true;
 
+    if (msgin->type == KILL_THREAD || msgin->type == KILL_PROCESS) {
+        /* These come straight from the sending process, so it owns `sender`; a signal sent back
+         * will not need to ask the IPC leader. */
+        ipc_learn_id_owner(msgin->sender, src);
+    }
+
     switch (msgin->type) {
         case KILL_THREAD:
             if (msgin->pid != g_process.pid) {
@@ -124,9 +142,13 @@ int ipc_pid_kill_callback(IDTYPE src, void* data, uint64_t seq) {
             }
             break;
         case KILL_PROCESS:
-            assert(g_process.pid == msgin->pid);
-            assert(g_process.pid == msgin->id);
-            ret = do_kill_proc(msgin->sender, msgin->id, msgin->signum);
+            assert(msgin->pid == msgin->id);
+            if (msgin->pid != g_process.pid) {
+                /* the sender used a stale cached owner of the PID */
+                ret = -ESRCH;
+            } else {
+                ret = do_kill_proc(msgin->sender, msgin->id, msgin->signum);
+            }
             break;
         case KILL_PGROUP:
             ret = do_kill_pgroup(msgin->sender, msgin->id, msgin->signum);
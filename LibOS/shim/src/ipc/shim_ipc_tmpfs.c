@@ -0,0 +1,117 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/*
+ * IPC glue code for the shared tmpfs store.
+ */
+
+#include "shim_fs_tmpfs.h"
+#include "shim_ipc.h"
+
+ssize_t ipc_tmpfs_store_request(struct tmpfs_store_req* req, struct tmpfs_store_attr* attr,
+                                void** out_data, size_t* out_size) {
+    assert(g_process_ipc_ids.leader_vmid);
+
+    struct shim_ipc_tmpfs_store msgin = {
+        .op = req->op,
+        .type = req->type,
+        .perm = req->perm,
+        .pos = req->pos,
+        .size = req->size,
+        .path_size = strlen(req->path) + 1,
+        .new_path_size = req->new_path ? strlen(req->new_path) + 1 : 0,
+    };
+    size_t write_size = req->op == TMPFS_STORE_WRITE ? req->size : 0;
+
+    /* The message can carry up to `TMPFS_STORE_MAX_IO` bytes of data, so it's not allocated on
+     * stack. */
+    size_t total_msg_size = get_ipc_msg_size(sizeof(msgin) + msgin.path_size + msgin.new_path_size
+                                             + write_size);
+    struct shim_ipc_msg* msg = malloc(total_msg_size);
+    if (!msg)
+        return -ENOMEM;
+    init_ipc_msg(msg, IPC_MSG_TMPFS_STORE, total_msg_size);
+    memcpy(msg->data, &msgin, sizeof(msgin));
+
+    /* `msg->data` is unaligned, so we have to compute the offset manually */
+    char* ptr = (char*)&msg->data + offsetof(struct shim_ipc_tmpfs_store, data);
+    memcpy(ptr, req->path, msgin.path_size);
+    ptr += msgin.path_size;
+    if (req->new_path) {
+        memcpy(ptr, req->new_path, msgin.new_path_size);
+        ptr += msgin.new_path_size;
+    }
+    if (write_size)
+        memcpy(ptr, req->data, write_size);
+
+    void* data;
+    int ret = ipc_send_msg_and_get_response(g_process_ipc_ids.leader_vmid, msg, &data);
+    free(msg);
+    if (ret < 0)
+        return ret;
+
+    struct shim_ipc_tmpfs_store_resp* resp = data;
+    ssize_t result = resp->result;
+    if (result >= 0) {
+        if (attr)
+            *attr = resp->attr;
+        if (out_data) {
+            void* out = NULL;
+            if (resp->data_size) {
+                out = malloc(resp->data_size);
+                if (!out) {
+                    free(data);
+                    return -ENOMEM;
+                }
+                memcpy(out, resp->data, resp->data_size);
+            }
+            *out_data = out;
+            *out_size = resp->data_size;
+        }
+    }
+    free(data);
+    return result;
+}
+
+int ipc_tmpfs_store_callback(IDTYPE src, void* data, unsigned long seq) {
+    struct shim_ipc_tmpfs_store* msgin = data;
+
+    const char* ptr = msgin->data;
+    struct tmpfs_store_req req = {
+        .op = msgin->op,
+        .path = ptr,
+        .new_path = msgin->new_path_size ? ptr + msgin->path_size : NULL,
+        .type = msgin->type,
+        .perm = msgin->perm,
+        .pos = msgin->pos,
+        .size = msgin->size,
+        .data = ptr + msgin->path_size + msgin->new_path_size,
+    };
+
+    struct tmpfs_store_attr attr = {0};
+    void* out_data = NULL;
+    size_t out_size = 0;
+    ssize_t result = tmpfs_store_do(&req, &attr, &out_data, &out_size);
+
+    struct shim_ipc_tmpfs_store_resp msgout = {
+        .result = result,
+        .attr = attr,
+        .data_size = out_size,
+    };
+
+    size_t total_msg_size = get_ipc_msg_size(sizeof(msgout) + out_size);
+    struct shim_ipc_msg* msg = malloc(total_msg_size);
+    if (!msg) {
+        free(out_data);
+        return -ENOMEM;
+    }
+    init_ipc_response(msg, seq, total_msg_size);
+    memcpy(msg->data, &msgout, sizeof(msgout));
+    if (out_size)
+        memcpy((char*)&msg->data + offsetof(struct shim_ipc_tmpfs_store_resp, data), out_data,
+               out_size);
+    free(out_data);
+
+    int ret = ipc_send_message(src, msg);
+    free(msg);
+    return ret;
+}
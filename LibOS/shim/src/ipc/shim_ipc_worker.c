@@ -13,6 +13,7 @@
 #include "cpu.h"
 #include "list.h"
 #include "pal.h"
+#include "shim_executor.h"
 #include "shim_handle.h"
 #include "shim_internal.h"
 #include "shim_ipc.h"
@@ -23,12 +24,39 @@
 
 #define LOG_PREFIX "IPC worker: "
 
+#define IPC_RECV_BUF_SIZE 0x1000
+#define IPC_MSG_ARENA_MIN_SIZE 0x400
+
+/* Message received on a connection and waiting to be handled by an executor job. */
+DEFINE_LIST(ipc_queued_msg);
+DEFINE_LISTP(ipc_queued_msg);
+struct ipc_queued_msg {
+    LIST_TYPE(ipc_queued_msg) list;
+    /* Marks the end of the connection: run disconnect callbacks and free the connection. */
+    bool disconnect;
+    unsigned char code;
+    uint64_t seq;
+    void* data;
+};
+
 DEFINE_LIST(shim_ipc_connection);
 DEFINE_LISTP(shim_ipc_connection);
 struct shim_ipc_connection {
     LIST_TYPE(shim_ipc_connection) list;
     PAL_HANDLE handle;
     IDTYPE vmid;
+    /* The peer announced closing this connection (`IPC_MSG_CONN_CLOSE`), its end is not a death. */
+    bool peer_alive;
+
+    /* Below fields are used only if the executor runs jobs asynchronously and are protected by
+     * `g_ipc_dispatch_lock`. `scheduled` is set from the moment `job` is submitted until the job
+     * finds `pending_msgs` empty, so at most one job handles messages of a given connection at
+     * a time (keeping them in order). */
+    LISTP_TYPE(ipc_queued_msg) pending_msgs;
+    struct shim_job job;
+    bool scheduled;
+    /* Preallocated, so that closing a connection cannot fail. */
+    struct ipc_queued_msg disconnect_msg;
 };
 
 /* List of incoming IPC connections, fully managed by this IPC worker thread (hence no locking
@@ -36,6 +64,12 @@ struct shim_ipc_connection {
 static LISTP_TYPE(shim_ipc_connection) g_ipc_connections;
 static size_t g_ipc_connections_cnt = 0;
 
+/* With executor threads (`libos.internal_threads`), the callbacks run in executor jobs, so that
+ * a slow callback (e.g. a sync server or a tmpfs request) does not hold up messages from other
+ * connections. This thread then only receives messages and queues them on their connection. */
+static bool g_ipc_dispatch_async = false;
+static struct shim_lock g_ipc_dispatch_lock;
+
 static struct shim_thread* g_worker_thread = NULL;
 static AEVENTTYPE exit_notification_event;
 /* Used by `DkThreadExit` to indicate that the thread really exited and is not using any resources
@@ -65,6 +99,8 @@ static ipc_callback ipc_callbacks[] = {
     [IPC_MSG_POSIX_LOCK_SET]       = ipc_posix_lock_set_callback,
     [IPC_MSG_POSIX_LOCK_GET]       = ipc_posix_lock_get_callback,
     [IPC_MSG_POSIX_LOCK_CLEAR_PID] = ipc_posix_lock_clear_pid_callback,
+
+    [IPC_MSG_TMPFS_STORE] = ipc_tmpfs_store_callback,
 };
 
 static void ipc_leader_died_callback(void) {
@@ -94,6 +130,8 @@ static void disconnect_callbacks(struct shim_ipc_connection* conn) {
     remove_outgoing_ipc_connection(conn->vmid);
 }
 
+static void ipc_conn_job(struct shim_job* job);
+
 static int add_ipc_connection(PAL_HANDLE handle, IDTYPE id) {
     struct shim_ipc_connection* conn = malloc(sizeof(*conn));
     if (!conn) {
@@ -102,19 +140,149 @@ static int add_ipc_connection(PAL_HANDLE handle, IDTYPE id) {
 
     conn->handle = handle;
     conn->vmid = id;
+    conn->peer_alive = false;
+    INIT_LISTP(&conn->pending_msgs);
+    conn->job.run = ipc_conn_job;
+    conn->scheduled = false;
+    conn->disconnect_msg.disconnect = true;
 
     LISTP_ADD(conn, &g_ipc_connections, list);
     g_ipc_connections_cnt++;
     return 0;
 }
 
+static void destroy_ipc_connection(struct shim_ipc_connection* conn) {
+    if (!conn->peer_alive) {
+        disconnect_callbacks(conn);
+    }
+    DkObjectClose(conn->handle);
+    free(conn);
+}
+
+/* Must be called with `g_ipc_dispatch_lock` held. */
+static void queue_ipc_msg(struct shim_ipc_connection* conn, struct ipc_queued_msg* msg) {
+    assert(locked(&g_ipc_dispatch_lock));
+
+    LISTP_ADD_TAIL(msg, &conn->pending_msgs, list);
+    if (!conn->scheduled) {
+        conn->scheduled = true;
+        executor_submit(&conn->job);
+    }
+}
+
 static void del_ipc_connection(struct shim_ipc_connection* conn) {
     LISTP_DEL(conn, &g_ipc_connections, list);
     g_ipc_connections_cnt--;
 
-    DkObjectClose(conn->handle);
+    if (!g_ipc_dispatch_async) {
+        destroy_ipc_connection(conn);
+        return;
+    }
 
-    free(conn);
+    /* Messages received before the disconnect might still be pending, let the job which handles
+     * them also close the connection. */
+    lock(&g_ipc_dispatch_lock);
+    queue_ipc_msg(conn, &conn->disconnect_msg);
+    unlock(&g_ipc_dispatch_lock);
+}
+
+static void run_ipc_callback(IDTYPE src, unsigned char code, void* data, uint64_t seq) {
+    if (code < ARRAY_SIZE(ipc_callbacks) && ipc_callbacks[code]) {
+        int ret = ipc_callbacks[code](src, data, seq);
+        if (ret < 0) {
+            log_error(LOG_PREFIX "error running IPC callback %u: %d", code, ret);
+            DkProcessExit(1);
+        }
+    } else {
+        log_error(LOG_PREFIX "received unknown IPC msg type: %u", code);
+    }
+}
+
+/* `data` of responses is handed over to the waiting thread, other messages are freed here (unless
+ * received into the message arena). */
+static int dispatch_ipc_msg(struct shim_ipc_connection* conn, unsigned char code, void* data,
+                            uint64_t seq, bool in_arena) {
+    if (!g_ipc_dispatch_async) {
+        run_ipc_callback(conn->vmid, code, data, seq);
+        if (code != IPC_MSG_RESP && !in_arena) {
+            free(data);
+        }
+        return 0;
+    }
+    assert(!in_arena);
+
+    lock(&g_ipc_dispatch_lock);
+    if (code == IPC_MSG_RESP && !conn->scheduled) {
+        /* Nothing from this connection is pending, so waking the response waiter right away keeps
+         * the order and saves a round trip through the executor. */
+        unlock(&g_ipc_dispatch_lock);
+        run_ipc_callback(conn->vmid, code, data, seq);
+        return 0;
+    }
+
+    struct ipc_queued_msg* msg = malloc(sizeof(*msg));
+    if (!msg) {
+        unlock(&g_ipc_dispatch_lock);
+        if (code != IPC_MSG_RESP) {
+            free(data);
+        }
+        return -ENOMEM;
+    }
+    msg->disconnect = false;
+    msg->code = code;
+    msg->seq = seq;
+    msg->data = data;
+
+    queue_ipc_msg(conn, msg);
+    unlock(&g_ipc_dispatch_lock);
+    return 0;
+}
+
+/* Executor job handling all pending messages of a connection, in order. */
+static void ipc_conn_job(struct shim_job* job) {
+    struct shim_ipc_connection* conn = container_of(job, struct shim_ipc_connection, job);
+
+    lock(&g_ipc_dispatch_lock);
+    while (!LISTP_EMPTY(&conn->pending_msgs)) {
+        struct ipc_queued_msg* msg = LISTP_FIRST_ENTRY(&conn->pending_msgs, struct ipc_queued_msg,
+                                                       list);
+        LISTP_DEL(msg, &conn->pending_msgs, list);
+        unlock(&g_ipc_dispatch_lock);
+
+        if (msg->disconnect) {
+            /* Always the last message of a connection. */
+            destroy_ipc_connection(conn);
+            return;
+        }
+
+        run_ipc_callback(conn->vmid, msg->code, msg->data, msg->seq);
+        if (msg->code != IPC_MSG_RESP) {
+            free(msg->data);
+        }
+        free(msg);
+        lock(&g_ipc_dispatch_lock);
+    }
+    conn->scheduled = false;
+    unlock(&g_ipc_dispatch_lock);
+}
+
+/* Returns a buffer of at least `size` bytes for payloads of messages handled inline, reused across
+ * messages. Used only by this thread. */
+static void* get_msg_arena(size_t size) {
+    static void* arena = NULL;
+    static size_t arena_size = 0;
+
+    if (size > arena_size) {
+        size_t new_size = MAX(size, (size_t)IPC_MSG_ARENA_MIN_SIZE);
+        void* new_arena = malloc(new_size);
+        if (!new_arena) {
+            return NULL;
+        }
+        free(arena);
+        arena = new_arena;
+        arena_size = new_size;
+    }
+    return arena;
 }
 
 /*
@@ -124,15 +292,13 @@ static void del_ipc_connection(struct shim_ipc_connection* conn) {
  */
 static int receive_ipc_messages(struct shim_ipc_connection* conn) {
     size_t size = 0;
-    /* Try to get more bytes that strictly required in case there are more messages waiting.
-     * `0x40` as a random estimation of "couple of ints" + message header size to get the next
-     * message header if possible. */
-#define READAHEAD_SIZE (0x40 + sizeof(struct ipc_msg_header))
-    union {
+    /* Try to get more bytes than strictly required, senders coalesce small messages into one write
+     * (see `flush_send_queue()`), so a single read usually gets a whole batch. Used only by this
+     * thread, hence static. */
+    static union {
         struct ipc_msg_header msg_header;
-        char buf[sizeof(struct ipc_msg_header) + READAHEAD_SIZE];
+        char buf[IPC_RECV_BUF_SIZE];
     } buf;
-#undef READAHEAD_SIZE
 
     do {
         /* Receive at least the message header. */
@@ -163,14 +329,17 @@ static int receive_ipc_messages(struct shim_ipc_connection* conn) {
         size_t msg_size = GET_UNALIGNED(buf.msg_header.size);
         assert(msg_size >= sizeof(struct ipc_msg_header));
         size_t data_size = msg_size - sizeof(struct ipc_msg_header);
-        void* msg_data = malloc(data_size);
+        unsigned char msg_code = GET_UNALIGNED(buf.msg_header.code);
+        unsigned long msg_seq = GET_UNALIGNED(buf.msg_header.seq);
+
+        /* Messages handled right here don't outlive this iteration, unlike responses (handed over
+         * to the waiting thread) and messages queued for executor jobs. */
+        bool in_arena = !g_ipc_dispatch_async && msg_code != IPC_MSG_RESP;
+        void* msg_data = in_arena ? get_msg_arena(data_size) : malloc(data_size);
         if (!msg_data) {
             return -ENOMEM;
         }
 
-        unsigned char msg_code = GET_UNALIGNED(buf.msg_header.code);
-        unsigned long msg_seq = GET_UNALIGNED(buf.msg_header.seq);
-
         if (msg_size <= size) {
             /* Already got the whole message (and possibly part of the next one). */
             memcpy(msg_data, buf.buf + sizeof(struct ipc_msg_header), data_size);
@@ -185,7 +354,9 @@ static int receive_ipc_messages(struct shim_ipc_connection* conn) {
             int ret = read_exact(conn->handle, (char*)msg_data + current_size,
                                  data_size - current_size);
             if (ret < 0) {
-                free(msg_data);
+                if (!in_arena) {
+                    free(msg_data);
+                }
                 log_error(LOG_PREFIX "receiving message from %u failed: %d", conn->vmid, ret);
                 return ret;
             }
@@ -195,19 +366,19 @@ static int receive_ipc_messages(struct shim_ipc_connection* conn) {
         log_debug(LOG_PREFIX "received IPC message from %u: code=%d size=%lu seq=%lu", conn->vmid,
                   msg_code, msg_size, msg_seq);
 
-        int ret = 0;
-        if (msg_code < ARRAY_SIZE(ipc_callbacks) && ipc_callbacks[msg_code]) {
-            ret = ipc_callbacks[msg_code](conn->vmid, msg_data, msg_seq);
-            if (ret < 0) {
-                log_error(LOG_PREFIX "error running IPC callback %u: %d", msg_code, ret);
-                DkProcessExit(1);
+        if (msg_code == IPC_MSG_CONN_CLOSE) {
+            /* Handled here, so that it is seen before the EOF which follows it. */
+            conn->peer_alive = true;
+            if (!in_arena) {
+                free(msg_data);
             }
-        } else {
-            log_error(LOG_PREFIX "received unknown IPC msg type: %u", msg_code);
+            continue;
         }
 
-        if (msg_code != IPC_MSG_RESP) {
-            free(msg_data);
+        int ret = dispatch_ipc_msg(conn, msg_code, msg_data, msg_seq, in_arena);
+        if (ret < 0) {
+            log_error(LOG_PREFIX "queueing message from %u failed: %d", conn->vmid, ret);
+            return ret;
         }
     } while (size > 0);
 
@@ -296,6 +467,7 @@ static noreturn void ipc_worker_main(void) {
             cur_thread->shim_tcb->tp = NULL;
             put_thread(cur_thread);
 
+            destroy_thread_slab_cache();
             DkThreadExit(&g_clear_on_worker_exit);
             /* Unreachable. */
         }
@@ -333,7 +505,6 @@ static noreturn void ipc_worker_main(void) {
                 ret = receive_ipc_messages(conn);
                 if (ret == 1) {
                     /* Connection closed. */
-                    disconnect_callbacks(conn);
                     del_ipc_connection(conn);
                     continue;
                 }
@@ -347,7 +518,6 @@ static noreturn void ipc_worker_main(void) {
             /* If there was something else other than error reported, let the loop spin at least one
              * more time - in case there are messages left to be read. */
             if (ret_events[i] == PAL_WAIT_ERROR) {
-                disconnect_callbacks(conn);
                 del_ipc_connection(conn);
             }
         }
@@ -408,6 +578,13 @@ int init_ipc_worker(void) {
     }
 
     enable_locking();
+
+    if (executor_is_async()) {
+        if (!create_lock(&g_ipc_dispatch_lock)) {
+            return -ENOMEM;
+        }
+        g_ipc_dispatch_async = true;
+    }
     return create_ipc_worker();
 }
 
@@ -422,4 +599,7 @@ void terminate_ipc_worker(void) {
     g_worker_thread = NULL;
     DkObjectClose(g_self_ipc_handle);
     g_self_ipc_handle = NULL;
+
+    /* Messages still queued are dropped (see `terminate_executor()`), same as the ones not yet
+     * received. */
 }
@@ -7,6 +7,7 @@
 
 #include "list.h"
 #include "pal.h"
+#include "shim_executor.h"
 #include "shim_internal.h"
 #include "shim_lock.h"
 #include "shim_thread.h"
@@ -24,10 +25,46 @@ struct async_event {
     void* arg;
     PAL_HANDLE object;    /* handle (async IO) to wait on */
     uint64_t expire_time; /* alarm/timer to wait on */
+    uint64_t tick;        /* `expire_time` rounded up to timer ticks */
+    LISTP_TYPE(async_event)* wheel_slot; /* slot of the timer wheel holding the alarm/timer */
+    bool is_timer;        /* LibOS-internal timer, not cancelled by alarm/timer events */
+    struct shim_job job;  /* runs the callback of a one-off event, see `async_event_job()` */
 };
 DEFINE_LISTP(async_event);
+/* async IO and exit-child events; alarms/timers are kept in `g_timer_wheel` */
 static LISTP_TYPE(async_event) async_list;
 
+/*
+ * Alarms/timers are kept in a hierarchical timer wheel, so that installing, cancelling and expiring
+ * one takes constant time no matter how many are pending. Deadlines are rounded up to whole ticks,
+ * so that timers expiring close to each other are handled in one wakeup of the async worker.
+ *
+ * Each level has TIMER_WHEEL_SLOTS slots; a slot of level L holds timers expiring in a range of
+ * TIMER_WHEEL_SLOTS^L ticks. When the wheel reaches the range of a slot of level L > 0, its timers
+ * are redistributed ("cascaded") to lower levels. Timers beyond the range of the top level are
+ * parked in its farthest slot and cascaded again later.
+ *
+ * Protected by `async_worker_lock`.
+ */
+#define TIMER_TICK_US      1000
+#define TIMER_WHEEL_BITS   6
+#define TIMER_WHEEL_SLOTS  (1UL << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 5
+#define TIMER_NONE         UINT64_MAX
+
+static struct {
+    uint64_t cur_tick; /* all timers with earlier ticks have expired */
+    size_t cnt;
+    LISTP_TYPE(async_event) slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+} g_timer_wheel;
+
+/* the pending alarm()/setitimer() event; there is at most one, each new one cancels the previous */
+static struct async_event* g_alarm_event = NULL;
+
+/* tick until which the async worker sleeps (unless woken up), TIMER_NONE if it waits for IO only;
+ * 0 while it is not sleeping */
+static uint64_t g_async_worker_wakeup_tick = 0;
+
 /* Should be accessed with async_worker_lock held. */
 static enum { WORKER_NOTALIVE, WORKER_ALIVE } async_worker_state;
 
@@ -38,6 +75,112 @@ static AEVENTTYPE install_new_event;
 
 static int create_async_worker(void);
 
+static uint64_t level_span(size_t level) {
+    return 1UL << (TIMER_WHEEL_BITS * level);
+}
+
+static void timer_wheel_insert(struct async_event* event) {
+    uint64_t tick = MAX(event->tick, g_timer_wheel.cur_tick);
+    uint64_t delta = tick - g_timer_wheel.cur_tick;
+
+    size_t level = 0;
+    while (level < TIMER_WHEEL_LEVELS - 1 && delta >= level_span(level + 1))
+        level++;
+    if (delta >= level_span(TIMER_WHEEL_LEVELS))
+        tick = g_timer_wheel.cur_tick + level_span(TIMER_WHEEL_LEVELS) - 1;
+
+    size_t idx = (tick >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1);
+    event->wheel_slot = &g_timer_wheel.slots[level][idx];
+    LISTP_ADD_TAIL(event, event->wheel_slot, list);
+    g_timer_wheel.cnt++;
+}
+
+static void timer_wheel_remove(struct async_event* event) {
+    LISTP_DEL(event, event->wheel_slot, list);
+    event->wheel_slot = NULL;
+    g_timer_wheel.cnt--;
+}
+
+/* Returns the earliest tick at which the wheel has work to do: a timer of level 0 expires or a slot
+ * of a higher level must be cascaded. */
+static uint64_t timer_wheel_next_tick(void) {
+    if (!g_timer_wheel.cnt)
+        return TIMER_NONE;
+
+    uint64_t next = TIMER_NONE;
+    for (size_t level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        /* the current slot of a higher level was already cascaded, if it is not empty then it holds
+         * timers one full turn later, so it is checked last */
+        uint64_t cur_range = g_timer_wheel.cur_tick >> (TIMER_WHEEL_BITS * level);
+        for (size_t i = level ? 1 : 0; i < TIMER_WHEEL_SLOTS + (level ? 1 : 0); i++) {
+            uint64_t range = cur_range + i;
+            if (LISTP_EMPTY(&g_timer_wheel.slots[level][range & (TIMER_WHEEL_SLOTS - 1)]))
+                continue;
+            next = MIN(next, range << (TIMER_WHEEL_BITS * level));
+            break;
+        }
+    }
+    return next;
+}
+
+/* Advances the wheel to `tick`. All slots whose ranges start between the current tick and `tick`
+ * must be empty, except for the ones starting at `tick`: these are cascaded to lower levels. */
+static void timer_wheel_set_tick(uint64_t tick) {
+    if (tick == g_timer_wheel.cur_tick)
+        return;
+    g_timer_wheel.cur_tick = tick;
+
+    for (size_t level = TIMER_WHEEL_LEVELS - 1; level > 0; level--) {
+        if (tick & (level_span(level) - 1))
+            continue;
+
+        size_t idx = (tick >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1);
+        LISTP_TYPE(async_event) cascaded;
+        INIT_LISTP(&cascaded);
+        LISTP_SPLICE(&g_timer_wheel.slots[level][idx], &cascaded, list, async_event);
+        INIT_LISTP(&g_timer_wheel.slots[level][idx]);
+        while (!LISTP_EMPTY(&cascaded)) {
+            struct async_event* event = LISTP_FIRST_ENTRY(&cascaded, struct async_event, list);
+            LISTP_DEL(event, &cascaded, list);
+            g_timer_wheel.cnt--;
+            timer_wheel_insert(event);
+        }
+    }
+}
+
+/* Moves all timers with ticks up to `now_tick` to `expired` (via `triggered_list`). */
+static void timer_wheel_expire(uint64_t now_tick, LISTP_TYPE(async_event)* expired) {
+    while (g_timer_wheel.cur_tick <= now_tick) {
+        uint64_t next = timer_wheel_next_tick();
+        if (next > now_tick) {
+            /* nothing to do until `now_tick`, skip the empty slots */
+            timer_wheel_set_tick(now_tick + 1);
+            break;
+        }
+        timer_wheel_set_tick(next);
+
+        LISTP_TYPE(async_event)* slot =
+            &g_timer_wheel.slots[0][g_timer_wheel.cur_tick & (TIMER_WHEEL_SLOTS - 1)];
+        while (!LISTP_EMPTY(slot)) {
+            struct async_event* event = LISTP_FIRST_ENTRY(slot, struct async_event, list);
+            timer_wheel_remove(event);
+            if (event == g_alarm_event)
+                g_alarm_event = NULL;
+            LISTP_ADD_TAIL(event, expired, triggered_list);
+        }
+        timer_wheel_set_tick(g_timer_wheel.cur_tick + 1);
+    }
+}
+
+/* One-off (exit-child and alarm/timer) events are done after their callback, which may take
+ * a while (e.g. `cleanup_thread()` waits for the host thread to exit), so it runs in the executor
+ * and the async worker moves on to the next events. */
+static void async_event_job(struct shim_job* job) {
+    struct async_event* event = container_of(job, struct async_event, job);
+    event->callback(event->caller, event->arg);
+    free(event);
+}
+
 /* Threads register async events like alarm(), setitimer(), ioctl(FIOASYNC)
  * using this function. These events are enqueued in async_list and delivered
  * to async worker thread by triggering install_new_event. When event is
@@ -53,8 +196,9 @@ static int create_async_worker(void);
  * Function returns remaining usecs for alarm/timer events (same as alarm())
  * or 0 for async IO events. On error, it returns a negated error code.
  */
-int64_t install_async_event(PAL_HANDLE object, uint64_t time,
-                            void (*callback)(IDTYPE caller, void* arg), void* arg) {
+static int64_t install_event(PAL_HANDLE object, uint64_t time,
+                             void (*callback)(IDTYPE caller, void* arg), void* arg,
+                             bool is_timer) {
     /* if event happens on object, time must be zero */
     assert(!object || (object && !time));
 
@@ -76,23 +220,22 @@ int64_t install_async_event(PAL_HANDLE object, uint64_t time,
     event->caller      = get_cur_tid();
     event->object      = object;
     event->expire_time = time ? now + time : 0;
+    event->tick        = ALIGN_UP(event->expire_time, TIMER_TICK_US) / TIMER_TICK_US;
+    event->wheel_slot  = NULL;
+    event->is_timer    = is_timer;
+    event->job.run     = async_event_job;
 
     lock(&async_worker_lock);
 
-    if (callback != &cleanup_thread && !object) {
+    if (callback != &cleanup_thread && !object && !is_timer) {
         /* This is alarm() or setitimer() emulation, treat both according to
          * alarm() syscall semantics: cancel any pending alarm/timer. */
-        struct async_event* tmp;
-        struct async_event* n;
-        LISTP_FOR_EACH_ENTRY_SAFE(tmp, n, &async_list, list) {
-            if (tmp->expire_time) {
-                /* this is a pending alarm/timer, cancel it and save its expiration time */
-                if (max_prev_expire_time < tmp->expire_time)
-                    max_prev_expire_time = tmp->expire_time;
-
-                LISTP_DEL(tmp, &async_list, list);
-                free(tmp);
-            }
+        if (g_alarm_event) {
+            /* save the expiration time of the cancelled alarm/timer */
+            max_prev_expire_time = MAX(max_prev_expire_time, g_alarm_event->expire_time);
+            timer_wheel_remove(g_alarm_event);
+            free(g_alarm_event);
+            g_alarm_event = NULL;
         }
 
         if (!time) {
@@ -105,7 +248,20 @@ int64_t install_async_event(PAL_HANDLE object, uint64_t time,
     }
 
     INIT_LIST_HEAD(event, list);
-    LISTP_ADD_TAIL(event, &async_list, list);
+    /* the worker needs a wakeup only if it would oversleep this event */
+    bool wake_worker = true;
+    if (event->expire_time) {
+        if (!g_timer_wheel.cnt) {
+            /* nothing pending, the wheel may have fallen behind while idle */
+            g_timer_wheel.cur_tick = MAX(g_timer_wheel.cur_tick, now / TIMER_TICK_US);
+        }
+        timer_wheel_insert(event);
+        if (!is_timer)
+            g_alarm_event = event;
+        wake_worker = event->tick < g_async_worker_wakeup_tick;
+    } else {
+        LISTP_ADD_TAIL(event, &async_list, list);
+    }
 
     if (async_worker_state == WORKER_NOTALIVE) {
         int ret = create_async_worker();
@@ -118,10 +274,23 @@ int64_t install_async_event(PAL_HANDLE object, uint64_t time,
     unlock(&async_worker_lock);
 
     log_debug("Installed async event at %lu", now);
-    set_event(&install_new_event, 1);
+    if (wake_worker)
+        set_event(&install_new_event, 1);
     return max_prev_expire_time - now;
 }
 
+int64_t install_async_event(PAL_HANDLE object, uint64_t time,
+                            void (*callback)(IDTYPE caller, void* arg), void* arg) {
+    return install_event(object, time, callback, arg, /*is_timer=*/false);
+}
+
+/* Unlike alarm/timer events above, LibOS-internal timers do not cancel each other. */
+int install_async_timer(uint64_t time, void (*callback)(IDTYPE caller, void* arg), void* arg) {
+    assert(time);
+    int64_t ret = install_event(/*object=*/NULL, time, callback, arg, /*is_timer=*/true);
+    return ret < 0 ? (int)ret : 0;
+}
+
 int init_async_worker(void) {
     /* early enough in init, can write global vars without the lock */
     async_worker_state = WORKER_NOTALIVE;
@@ -155,6 +324,7 @@ static void shim_async_worker(void* arg) {
 
     if (notme) {
         put_thread(self);
+        destroy_thread_slab_cache();
         DkThreadExit(/*clear_child_tid=*/NULL);
         /* UNREACHABLE */
     }
@@ -202,6 +372,7 @@ static void shim_async_worker(void* arg) {
         lock(&async_worker_lock);
         if (async_worker_state != WORKER_ALIVE) {
             async_worker_thread = NULL;
+            g_async_worker_wakeup_tick = 0;
             unlock(&async_worker_lock);
             break;
         }
@@ -213,7 +384,7 @@ static void shim_async_worker(void* arg) {
         struct async_event* n;
         bool other_event = false;
         LISTP_FOR_EACH_ENTRY_SAFE(tmp, n, &async_list, list) {
-            /* repopulate `pals` with IO events and find the next expiring alarm/timer */
+            /* repopulate `pals` with IO events */
             if (tmp->object) {
                 if (pals_cnt == pals_max_cnt) {
                     /* grow `pals` to accommodate more objects */
@@ -250,20 +421,21 @@ static void shim_async_worker(void* arg) {
                 pal_events[pals_cnt + 1] = PAL_WAIT_READ;
                 ret_events[pals_cnt + 1] = 0;
                 pals_cnt++;
-            } else if (tmp->expire_time && tmp->expire_time > now) {
-                if (!next_expire_time || next_expire_time > tmp->expire_time) {
-                    /* use time of the next expiring alarm/timer */
-                    next_expire_time = tmp->expire_time;
-                }
             } else {
                 /* cleanup events do not have an object nor a timeout */
                 other_event = true;
             }
         }
 
+        /* the next expiring alarm/timer (or the next cascade of the timer wheel) */
+        uint64_t next_tick = timer_wheel_next_tick();
+        if (next_tick != TIMER_NONE)
+            next_expire_time = next_tick * TIMER_TICK_US;
+        g_async_worker_wakeup_tick = next_tick;
+
         uint64_t sleep_time;
         if (next_expire_time) {
-            sleep_time  = next_expire_time - now;
+            sleep_time  = next_expire_time > now ? next_expire_time - now : 0;
             idle_cycles = 0;
         } else if (pals_cnt || other_event) {
             sleep_time = NO_TIMEOUT;
@@ -277,6 +449,7 @@ static void shim_async_worker(void* arg) {
         if (idle_cycles == MAX_IDLE_CYCLES) {
             async_worker_state  = WORKER_NOTALIVE;
             async_worker_thread = NULL;
+            g_async_worker_wakeup_tick = 0;
             unlock(&async_worker_lock);
             log_debug("Async worker thread has been idle for some time; stopping it");
             break;
@@ -325,29 +498,29 @@ static void shim_async_worker(void* arg) {
             }
         }
 
-        /* check if exit-child or alarm/timer events were triggered */
+        /* check if exit-child events were triggered */
         LISTP_FOR_EACH_ENTRY_SAFE(tmp, n, &async_list, list) {
             if (tmp->callback == &cleanup_thread) {
                 log_debug("Thread exited, cleaning up");
                 LISTP_DEL(tmp, &async_list, list);
                 LISTP_ADD_TAIL(tmp, &triggered, triggered_list);
-            } else if (tmp->expire_time && tmp->expire_time <= now) {
-                log_debug("Alarm/timer triggered at %lu (expired at %lu)", now, tmp->expire_time);
-                LISTP_DEL(tmp, &async_list, list);
-                LISTP_ADD_TAIL(tmp, &triggered, triggered_list);
             }
         }
 
+        /* check if alarm/timer events were triggered */
+        timer_wheel_expire(now / TIMER_TICK_US, &triggered);
+
         unlock(&async_worker_lock);
 
         /* call callbacks for all triggered events */
         if (!LISTP_EMPTY(&triggered)) {
             LISTP_FOR_EACH_ENTRY_SAFE(tmp, n, &triggered, triggered_list) {
                 LISTP_DEL(tmp, &triggered, triggered_list);
-                tmp->callback(tmp->caller, tmp->arg);
                 if (!tmp->object) {
-                    /* this is a one-off exit-child or alarm/timer event */
-                    free(tmp);
+                    /* this is a one-off exit-child or alarm/timer event, the job frees it */
+                    executor_submit(&tmp->job);
+                } else {
+                    tmp->callback(tmp->caller, tmp->arg);
                 }
             }
         }
@@ -359,6 +532,7 @@ static void shim_async_worker(void* arg) {
     free(pals);
     free(pal_events);
 
+    destroy_thread_slab_cache();
     DkThreadExit(/*clear_child_tid=*/NULL);
     /* UNREACHABLE */
 
@@ -12,7 +12,6 @@
 #include <stdarg.h>
 #include <stdint.h>
 
-#include "list.h"
 #include "pal.h"
 #include "pal_error.h"
 #include "shim_fs.h"
@@ -20,45 +19,32 @@
 #include "shim_internal.h"
 #include "shim_ipc.h"
 #include "shim_lock.h"
+#include "shim_lz4.h"
 #include "shim_process.h"
 #include "shim_thread.h"
 #include "shim_utils.h"
 #include "shim_vma.h"
 
 #define CP_MMAP_FLAGS    (MAP_PRIVATE | MAP_ANONYMOUS | VMA_INTERNAL)
-#define CP_MAP_ENTRY_NUM 64
-#define CP_HASH_SIZE     256
+#define CP_MAP_INIT_SIZE 256
 
-DEFINE_LIST(cp_map_entry);
-struct cp_map_entry {
-    LIST_TYPE(cp_map_entry) hlist;
-    struct shim_cp_map_entry entry;
-};
+/* Memory entries are cut into slices of this size, which are distributed round-robin over the
+ * streams that carry checkpoint memory (see `libos.checkpoint_streams` in the manifest). */
+#define CP_MEM_SLICE_SIZE  (4 * 1024 * 1024)
+#define CP_MAX_MEM_STREAMS 16
 
-DEFINE_LISTP(cp_map_entry);
+/* Checkpoint map: an open-addressing hash table (linear probing) from object addresses to their
+ * offsets in the checkpoint. It doubles in size once it is 3/4 full, so lookups stay O(1) even for
+ * processes with hundreds of thousands of handles, dentries and VMAs. Empty slots have `addr ==
+ * NULL`; the NULL address itself (never a real object, but not forbidden) has a dedicated slot. */
 struct cp_map {
-    struct cp_map_buffer {
-        struct cp_map_buffer* next;
-        size_t num;
-        size_t cnt;
-        struct cp_map_entry entries[0];
-    }* buffers;
-    LISTP_TYPE(cp_map_entry) head[CP_HASH_SIZE];
+    struct shim_cp_map_entry* entries;
+    size_t size; /* always a power of two */
+    size_t cnt;
+    bool null_used;
+    struct shim_cp_map_entry null_entry;
 };
 
-static struct cp_map_buffer* extend_cp_map(struct cp_map* map) {
-    struct cp_map_buffer* buffer = malloc(sizeof(struct cp_map_buffer) +
-                                          sizeof(struct cp_map_entry) * CP_MAP_ENTRY_NUM);
-    if (!buffer)
-        return NULL;
-
-    buffer->next = map->buffers;
-    buffer->num  = CP_MAP_ENTRY_NUM;
-    buffer->cnt  = 0;
-    map->buffers = buffer;
-    return buffer;
-}
-
 void* create_cp_map(void) {
     struct cp_map* map = malloc(sizeof(*map));
     if (!map)
@@ -66,11 +52,12 @@ void* create_cp_map(void) {
 
     memset(map, 0, sizeof(*map));
 
-    struct cp_map_buffer* buffer = extend_cp_map(map);
-    if (!buffer) {
+    map->entries = calloc(CP_MAP_INIT_SIZE, sizeof(*map->entries));
+    if (!map->entries) {
         free(map);
         return NULL;
     }
+    map->size = CP_MAP_INIT_SIZE;
 
     return (void*)map;
 }
@@ -78,52 +65,71 @@ void* create_cp_map(void) {
 void destroy_cp_map(void* _map) {
     struct cp_map* map = (struct cp_map*)_map;
 
-    struct cp_map_buffer* buffer = map->buffers;
-    while (buffer) {
-        struct cp_map_buffer* next = buffer->next;
-        free(buffer);
-        buffer = next;
+    free(map->entries);
+    free(map);
+}
+
+static struct shim_cp_map_entry* find_cp_map_slot(struct shim_cp_map_entry* entries, size_t size,
+                                                  void* addr) {
+    size_t mask = size - 1;
+    size_t idx  = hash64((uint64_t)addr) & mask;
+    while (entries[idx].addr && entries[idx].addr != addr)
+        idx = (idx + 1) & mask;
+    return &entries[idx];
+}
+
+static int extend_cp_map(struct cp_map* map) {
+    size_t new_size = map->size * 2;
+    struct shim_cp_map_entry* new_entries = calloc(new_size, sizeof(*new_entries));
+    if (!new_entries)
+        return -ENOMEM;
+
+    for (size_t i = 0; i < map->size; i++) {
+        if (!map->entries[i].addr)
+            continue;
+        *find_cp_map_slot(new_entries, new_size, map->entries[i].addr) = map->entries[i];
     }
 
-    free(map);
+    free(map->entries);
+    map->entries = new_entries;
+    map->size    = new_size;
+    return 0;
 }
 
+/* The returned entry is valid only until the next call with `create == true`, which may move all
+ * entries. */
 struct shim_cp_map_entry* get_cp_map_entry(void* _map, void* addr, bool create) {
     struct cp_map* map = (struct cp_map*)_map;
 
-    struct shim_cp_map_entry* e = NULL;
+    if (!addr) {
+        if (!map->null_used && !create)
+            return NULL;
+        if (!map->null_used) {
+            map->null_used      = true;
+            map->null_entry.off = 0;
+        }
+        return &map->null_entry;
+    }
 
     /* check if object at this addr was already added to the checkpoint */
-    uint64_t hash = hash64((uint64_t)addr) % CP_HASH_SIZE;
-    LISTP_TYPE(cp_map_entry)* head = &map->head[hash];
-
-    struct cp_map_entry* tmp;
-    LISTP_FOR_EACH_ENTRY(tmp, head, hlist)
-        if (tmp->entry.addr == addr)
-            e = &tmp->entry;
-
-    if (e)
+    struct shim_cp_map_entry* e = find_cp_map_slot(map->entries, map->size, addr);
+    if (e->addr)
         return e;
 
     /* object at this addr wasn't yet added to the checkpoint */
     if (!create)
         return NULL;
 
-    struct cp_map_buffer* buffer = map->buffers;
-
-    if (buffer->cnt == buffer->num) {
-        buffer = extend_cp_map(map);
-        if (!buffer)
+    if ((map->cnt + 1) * 4 > map->size * 3) {
+        if (extend_cp_map(map) < 0)
             return NULL;
+        e = find_cp_map_slot(map->entries, map->size, addr);
     }
 
-    struct cp_map_entry* new = &buffer->entries[buffer->cnt++];
-    INIT_LIST_HEAD(new, hlist);
-    LISTP_ADD(new, head, hlist);
-
-    new->entry.addr = addr;
-    new->entry.off  = 0;
-    return &new->entry;
+    map->cnt++;
+    e->addr = addr;
+    e->off  = 0;
+    return e;
 }
 
 BEGIN_CP_FUNC(memory) {
@@ -239,51 +245,439 @@ BEGIN_CP_FUNC(str) {
 }
 END_CP_FUNC_NO_RS(str)
 
-static int send_memory_on_stream(PAL_HANDLE stream, struct shim_cp_store* store) {
-    int ret = 0;
+/* Memory entries are not sent as a whole: only runs of pages which contain non-zero data are sent,
+ * each preceded by this header, and a header with zero `size` terminates the slice. The child
+ * allocates zeroed memory, so skipped pages need no transfer at all, and the amount of data copied
+ * through the (possibly encrypted) stream follows the memory the process has actually touched
+ * rather than everything it has mapped. A page identical to one sent earlier on the same stream is
+ * sent as a run with non-NULL `src` instead, and the child copies it from its own memory. With
+ * `libos.checkpoint_compression`, the data of a run is LZ4-compressed if that makes it smaller. */
+struct shim_mem_run {
+    size_t offset; /* from the beginning of the slice */
+    size_t size;
+    void* src;     /* if not NULL, no data follows and the run is a copy of [src, src + size) */
+    size_t compressed_size; /* if not 0, the data follows LZ4-compressed in this many bytes */
+};
 
-    struct shim_mem_entry* entry = store->first_mem_entry;
-    while (entry) {
-        size_t mem_size = entry->size;
-        void* mem_addr  = entry->addr;
-        int mem_prot    = entry->prot;
+/* Direct-mapped cache of pages already sent on a stream, indexed by page hash. */
+#define CP_PAGE_CACHE_SIZE 4096
 
-        if (!(mem_prot & PAL_PROT_READ) && mem_size > 0) {
-            /* make the area readable */
-            ret = DkVirtualMemoryProtect(mem_addr, mem_size, mem_prot | PAL_PROT_READ);
-            if (ret < 0) {
-                return pal_to_unix_errno(ret);
+struct cp_page_cache_entry {
+    uint64_t hash;
+    void* addr;
+};
+
+struct cp_mem_stream {
+    PAL_HANDLE handle;
+    size_t idx;
+    size_t streams_cnt;
+    struct shim_mem_entry* first_mem_entry;
+    bool send;
+    struct cp_page_cache_entry* page_cache; /* may be NULL, then pages are not deduplicated */
+    /* sender: compressed data (if NULL, nothing is compressed); receiver: compressed data read
+     * from the stream, allocated on the first compressed run; CP_MEM_SLICE_SIZE bytes */
+    void* lz4_buf;
+    uint32_t* lz4_hash_table; /* sender only, LZ4_HASH_TABLE_SIZE bytes */
+    int ret;
+    struct shim_thread* thread;
+    int clear_on_exit; /* reset to 0 by PAL once the helper thread no longer uses its stack */
+};
+
+static bool is_zero_mem(const void* addr, size_t size) {
+    const uint64_t* words = addr;
+    size_t words_cnt = size / sizeof(*words);
+    size_t i = 0;
+
+    /* OR-reduce a cache line at a time without branching on every word, which lets the compiler
+     * vectorize the loop */
+    for (; i + 8 <= words_cnt; i += 8) {
+        uint64_t acc = words[i] | words[i + 1] | words[i + 2] | words[i + 3] | words[i + 4]
+                       | words[i + 5] | words[i + 6] | words[i + 7];
+        if (acc)
+            return false;
+    }
+    for (; i < words_cnt; i++)
+        if (words[i])
+            return false;
+
+    const char* tail = (const char*)(words + words_cnt);
+    for (i = 0; i < size % sizeof(*words); i++)
+        if (tail[i])
+            return false;
+
+    return true;
+}
+
+static uint64_t hash_page(const void* addr) {
+    const uint64_t* words = addr;
+    uint64_t hash = 0;
+    for (size_t i = 0; i < PAGE_SIZE / sizeof(*words); i++)
+        hash = (hash ^ words[i]) * 0x100000001b3UL;
+    return hash64(hash);
+}
+
+/* Returns an earlier sent page with the same contents as the page at `addr`, or NULL; in the latter
+ * case, remembers `addr` for subsequent pages. */
+static void* find_sent_page(struct cp_mem_stream* stream, void* addr) {
+    if (!stream->page_cache)
+        return NULL;
+
+    uint64_t hash = hash_page(addr);
+    struct cp_page_cache_entry* cache_entry = &stream->page_cache[hash % CP_PAGE_CACHE_SIZE];
+    if (cache_entry->addr && cache_entry->hash == hash
+            && !memcmp(cache_entry->addr, addr, PAGE_SIZE))
+        return cache_entry->addr;
+
+    cache_entry->hash = hash;
+    cache_entry->addr = addr;
+    return NULL;
+}
+
+/* Sends `run` followed by its data at `data`, compressed if that is enabled and saves space. */
+static int send_data_run(struct cp_mem_stream* stream, struct shim_mem_run* run, void* data) {
+    void* payload = data;
+    size_t payload_size = run->size;
+
+    run->compressed_size = 0;
+    if (stream->lz4_buf) {
+        assert(run->size <= CP_MEM_SLICE_SIZE);
+        size_t compressed_size = lz4_compress(data, run->size, stream->lz4_buf, run->size - 1,
+                                              stream->lz4_hash_table);
+        if (compressed_size) {
+            run->compressed_size = compressed_size;
+            payload = stream->lz4_buf;
+            payload_size = compressed_size;
+        }
+    }
+
+    int ret = write_exact(stream->handle, run, sizeof(*run));
+    if (ret < 0)
+        return ret;
+    return write_exact(stream->handle, payload, payload_size);
+}
+
+static int send_sparse_memory(struct cp_mem_stream* stream, void* mem_addr, size_t mem_size) {
+    struct shim_mem_run run = { .offset = 0, .size = 0, .src = NULL, .compressed_size = 0 };
+    int ret;
+
+    for (size_t off = 0;; off += PAGE_SIZE) {
+        size_t chunk = off < mem_size ? MIN(mem_size - off, (size_t)PAGE_SIZE) : 0;
+        void* src = NULL;
+        if (chunk && !is_zero_mem((char*)mem_addr + off, chunk)) {
+            if (chunk == PAGE_SIZE)
+                src = find_sent_page(stream, (char*)mem_addr + off);
+            if (!src) {
+                if (!run.size)
+                    run.offset = off;
+                run.size += chunk;
+                continue;
             }
         }
 
-        ret = write_exact(stream, mem_addr, mem_size);
+        /* reached a zero or duplicate page or the end of the slice, flush the pending run */
+        if (run.size) {
+            ret = send_data_run(stream, &run, (char*)mem_addr + run.offset);
+            if (ret < 0)
+                return ret;
+            run.size = 0;
+        }
 
-        if (!(mem_prot & PAL_PROT_READ) && mem_size > 0) {
-            /* the area was made readable above; revert to original permissions */
-            int ret2 = DkVirtualMemoryProtect(mem_addr, mem_size, mem_prot);
-            if (ret2 < 0 && !ret) {
-                ret = pal_to_unix_errno(ret2);
+        if (src) {
+            struct shim_mem_run copy_run = { .offset = off, .size = chunk, .src = src,
+                                             .compressed_size = 0 };
+            ret = write_exact(stream->handle, &copy_run, sizeof(copy_run));
+            if (ret < 0)
+                return ret;
+        }
+
+        if (!chunk)
+            break;
+    }
+
+    /* terminating run */
+    run.offset = mem_size;
+    run.size   = 0;
+    run.compressed_size = 0;
+    return write_exact(stream->handle, &run, sizeof(run));
+}
+
+static int receive_sparse_memory(struct cp_mem_stream* stream, void* mem_addr, size_t mem_size) {
+    while (true) {
+        struct shim_mem_run run;
+        int ret = read_exact(stream->handle, &run, sizeof(run));
+        if (ret < 0)
+            return ret;
+
+        if (!run.size)
+            return 0;
+
+        if (run.offset > mem_size || run.size > mem_size - run.offset) {
+            log_error("invalid memory run %lu+%lu in slice of size %lu", run.offset, run.size,
+                      mem_size);
+            return -EINVAL;
+        }
+
+        if (run.src) {
+            /* the source page was received earlier on this stream, see find_sent_page() */
+            memcpy((char*)mem_addr + run.offset, run.src, run.size);
+            continue;
+        }
+
+        if (run.compressed_size) {
+            if (run.compressed_size >= run.size) {
+                log_error("invalid compressed size %lu of memory run of size %lu",
+                          run.compressed_size, run.size);
+                return -EINVAL;
+            }
+            if (!stream->lz4_buf) {
+                stream->lz4_buf = malloc(CP_MEM_SLICE_SIZE);
+                if (!stream->lz4_buf)
+                    return -ENOMEM;
+            }
+            ret = read_exact(stream->handle, stream->lz4_buf, run.compressed_size);
+            if (ret < 0)
+                return ret;
+            ret = lz4_decompress(stream->lz4_buf, run.compressed_size,
+                                 (char*)mem_addr + run.offset, run.size);
+            if (ret < 0) {
+                log_error("corrupted compressed memory run %lu+%lu", run.offset, run.size);
+                return ret;
             }
+            continue;
         }
 
-        if (ret < 0) {
+        ret = read_exact(stream->handle, (char*)mem_addr + run.offset, run.size);
+        if (ret < 0)
             return ret;
+    }
+}
+
+static int transfer_mem_slices(struct cp_mem_stream* stream) {
+    size_t slice = 0;
+    for (struct shim_mem_entry* entry = stream->first_mem_entry; entry; entry = entry->next) {
+        for (size_t off = 0; off < entry->size; off += CP_MEM_SLICE_SIZE, slice++) {
+            if (slice % stream->streams_cnt != stream->idx)
+                continue;
+
+            void* addr  = (char*)entry->addr + off;
+            size_t size = MIN(entry->size - off, (size_t)CP_MEM_SLICE_SIZE);
+            int ret = stream->send ? send_sparse_memory(stream, addr, size)
+                                   : receive_sparse_memory(stream, addr, size);
+            if (ret < 0)
+                return ret;
+        }
+    }
+    return 0;
+}
+
+static void mem_stream_thread(void* arg) {
+    struct cp_mem_stream* stream = arg;
+
+    shim_tcb_init();
+    set_cur_thread(stream->thread);
+
+    stream->ret = transfer_mem_slices(stream);
+
+    struct shim_thread* cur_thread = get_cur_thread();
+    cur_thread->shim_tcb->tp = NULL;
+    put_thread(cur_thread);
+
+    destroy_thread_slab_cache();
+    DkThreadExit(&stream->clear_on_exit);
+    /* UNREACHABLE */
+}
+
+/* Transfers all memory entries over `streams`. Stream 0 is served by the current thread, all other
+ * streams by helper threads (each one encrypts/decrypts its own data on SGX, so they scale with the
+ * number of cores). If a helper thread cannot be created, e.g. because the enclave is out of
+ * threads, the current thread serves that stream itself after stream 0; both sides walk the slices
+ * of a stream in the same order, so this cannot deadlock. */
+static int transfer_memory_on_streams(struct cp_mem_stream* streams, size_t streams_cnt) {
+    if (streams_cnt > 1)
+        enable_locking();
+
+    for (size_t i = 1; i < streams_cnt; i++) {
+        streams[i].thread = get_new_internal_thread();
+        if (!streams[i].thread)
+            continue;
+
+        __atomic_store_n(&streams[i].clear_on_exit, 1, __ATOMIC_RELAXED);
+        PAL_HANDLE handle = NULL;
+        if (DkThreadCreate(mem_stream_thread, &streams[i], &handle) < 0) {
+            log_debug("cannot create helper thread for checkpoint stream %lu, serving it inline", i);
+            __atomic_store_n(&streams[i].clear_on_exit, 0, __ATOMIC_RELAXED);
+            put_thread(streams[i].thread);
+            streams[i].thread = NULL;
+            continue;
+        }
+        streams[i].thread->pal_handle = handle;
+    }
+
+    int ret = transfer_mem_slices(&streams[0]);
+
+    for (size_t i = 1; i < streams_cnt; i++) {
+        if (!streams[i].thread) {
+            int ret2 = transfer_mem_slices(&streams[i]);
+            if (ret2 < 0 && !ret)
+                ret = ret2;
+            continue;
         }
 
-        entry = entry->next;
+        while (__atomic_load_n(&streams[i].clear_on_exit, __ATOMIC_ACQUIRE))
+            DkThreadYieldExecution();
+
+        put_thread(streams[i].thread);
+        streams[i].thread = NULL;
+        if (streams[i].ret < 0 && !ret)
+            ret = streams[i].ret;
     }
 
+    return ret;
+}
+
+/* Upper bound on buffers collected for one `process_write_memory` call */
+#define CP_DIRECT_IOV_MAX 1024
+
+/*
+ * Without an enclave boundary (non-SGX PALs), the memory can be written straight into the child's
+ * address space, see `PAL_CONTROL::process_write_memory`. This is one host copy instead of writing
+ * the memory through the process stream and reading it back in the child. As with the streams,
+ * pages which contain only zeroes are skipped, the child allocates zeroed memory. The child first
+ * reports that it has allocated the memory; we then reply whether the memory was written, so that
+ * both sides fall back to the streams if the host denies access to the child.
+ */
+static int send_memory_directly(PAL_HANDLE process, struct shim_cp_store* store, bool* out_sent) {
+    *out_sent = false;
+
+    char status;
+    int ret = read_exact(process, &status, sizeof(status));
+    if (ret < 0)
+        return ret;
+
+    PAL_IOVEC* iov = malloc(CP_DIRECT_IOV_MAX * sizeof(*iov));
+    int pal_ret = iov ? 0 : -PAL_ERROR_NOMEM;
+    size_t iov_cnt = 0;
+
+    for (struct shim_mem_entry* entry = store->first_mem_entry; entry && !pal_ret;
+             entry = entry->next) {
+        for (size_t off = 0; off < entry->size && !pal_ret; off += PAGE_SIZE) {
+            char* addr = (char*)entry->addr + off;
+            size_t chunk = MIN(entry->size - off, (size_t)PAGE_SIZE);
+            if (is_zero_mem(addr, chunk))
+                continue;
+
+            if (iov_cnt && (char*)iov[iov_cnt - 1].iov_base + iov[iov_cnt - 1].iov_len == addr) {
+                iov[iov_cnt - 1].iov_len += chunk;
+                continue;
+            }
+            if (iov_cnt == CP_DIRECT_IOV_MAX) {
+                pal_ret = g_pal_control->process_write_memory(process, iov, iov_cnt);
+                iov_cnt = 0;
+            }
+            iov[iov_cnt].iov_base = addr;
+            iov[iov_cnt].iov_len  = chunk;
+            iov_cnt++;
+        }
+    }
+    if (!pal_ret && iov_cnt)
+        pal_ret = g_pal_control->process_write_memory(process, iov, iov_cnt);
+    free(iov);
+
+    if (pal_ret < 0)
+        log_debug("cannot write memory of the child directly (%d), using streams", pal_ret);
+
+    status = pal_ret < 0;
+    ret = write_exact(process, &status, sizeof(status));
+    if (ret < 0)
+        return ret;
+
+    *out_sent = !status;
     return 0;
 }
 
-static int send_checkpoint_on_stream(PAL_HANDLE stream, struct shim_cp_store* store) {
+static int send_memory_on_streams(PAL_HANDLE* handles, size_t handles_cnt,
+                                  struct shim_cp_store* store, bool direct, bool compress) {
+    int ret = 0;
+
+    /* make unreadable areas readable for the duration of the transfer */
+    struct shim_mem_entry* entry;
+    for (entry = store->first_mem_entry; entry; entry = entry->next) {
+        if (!(entry->prot & PAL_PROT_READ) && entry->size > 0) {
+            ret = DkVirtualMemoryProtect(entry->addr, entry->size, entry->prot | PAL_PROT_READ);
+            if (ret < 0) {
+                ret = pal_to_unix_errno(ret);
+                break;
+            }
+        }
+    }
+    struct shim_mem_entry* readable_end = entry;
+
+    bool sent = false;
+    if (!ret && direct)
+        ret = send_memory_directly(handles[0], store, &sent);
+
+    if (!ret && !sent) {
+        struct cp_mem_stream streams[CP_MAX_MEM_STREAMS] = { 0 };
+        for (size_t i = 0; i < handles_cnt; i++) {
+            streams[i].handle          = handles[i];
+            streams[i].idx             = i;
+            streams[i].streams_cnt     = handles_cnt;
+            streams[i].first_mem_entry = store->first_mem_entry;
+            streams[i].send            = true;
+            /* deduplication is an optimization, so just go without it if there is no memory */
+            streams[i].page_cache = calloc(CP_PAGE_CACHE_SIZE, sizeof(*streams[i].page_cache));
+            if (compress) {
+                /* as with deduplication, a stream without memory just sends uncompressed data */
+                streams[i].lz4_buf        = malloc(CP_MEM_SLICE_SIZE);
+                streams[i].lz4_hash_table = malloc(LZ4_HASH_TABLE_SIZE);
+                if (!streams[i].lz4_buf || !streams[i].lz4_hash_table) {
+                    free(streams[i].lz4_buf);
+                    free(streams[i].lz4_hash_table);
+                    streams[i].lz4_buf        = NULL;
+                    streams[i].lz4_hash_table = NULL;
+                }
+            }
+        }
+        ret = transfer_memory_on_streams(streams, handles_cnt);
+        for (size_t i = 0; i < handles_cnt; i++) {
+            free(streams[i].page_cache);
+            free(streams[i].lz4_buf);
+            free(streams[i].lz4_hash_table);
+        }
+    }
+
+    /* revert the areas made readable above to their original permissions */
+    for (entry = store->first_mem_entry; entry != readable_end; entry = entry->next) {
+        if (!(entry->prot & PAL_PROT_READ) && entry->size > 0) {
+            int ret2 = DkVirtualMemoryProtect(entry->addr, entry->size, entry->prot);
+            if (ret2 < 0 && !ret) {
+                ret = pal_to_unix_errno(ret2);
+            }
+        }
+    }
+
+    return ret;
+}
+
+static int send_checkpoint_on_stream(PAL_HANDLE stream, PAL_HANDLE* mem_streams,
+                                     PAL_HANDLE* child_mem_streams, size_t mem_streams_cnt,
+                                     struct shim_cp_store* store, bool mem_direct,
+                                     bool mem_compress) {
     /* first send non-memory entries found at [store->base, store->base + store->offset) */
     int ret = write_exact(stream, (void*)store->base, store->offset);
     if (ret < 0) {
         return ret;
     }
 
-    return send_memory_on_stream(stream, store);
+    /* then the child's ends of additional memory streams (stream 0 is the process stream) */
+    for (size_t i = 1; i < mem_streams_cnt; i++) {
+        ret = DkSendHandle(stream, child_mem_streams[i]);
+        if (ret < 0) {
+            return pal_to_unix_errno(ret);
+        }
+    }
+
+    return send_memory_on_streams(mem_streams, mem_streams_cnt, store, mem_direct, mem_compress);
 }
 
 static int send_handles_on_stream(PAL_HANDLE stream, struct shim_cp_store* store) {
@@ -294,8 +688,11 @@ static int send_handles_on_stream(PAL_HANDLE stream, struct shim_cp_store* store
         return 0;
 
     struct shim_palhdl_entry** entries = malloc(sizeof(*entries) * entries_cnt);
-    if (!entries)
-        return -ENOMEM;
+    PAL_HANDLE* handles = malloc(sizeof(*handles) * entries_cnt);
+    if (!entries || !handles) {
+        ret = -ENOMEM;
+        goto out;
+    }
 
     /* PAL-handle entries were added in reverse order, let's first populate them */
     struct shim_palhdl_entry* entry = store->last_palhdl_entry;
@@ -306,29 +703,50 @@ static int send_handles_on_stream(PAL_HANDLE stream, struct shim_cp_store* store
     }
     assert(!entry);
 
-    /* now we can traverse PAL-handle entries in correct order and send them one by one */
-    for (size_t i = 0; i < entries_cnt; i++) {
-        /* we need to abort migration if DkSendHandle() returned error, otherwise app may fail */
-        ret = DkSendHandle(stream, entries[i]->handle);
-        if (ret < 0) {
-            ret = pal_to_unix_errno(ret);
-            goto out;
-        }
+    /* now we can send the PAL handles in correct order, the PAL batches them if it can */
+    for (size_t i = 0; i < entries_cnt; i++)
+        handles[i] = entries[i]->handle;
+
+    /* we need to abort migration if DkSendHandles() returned error, otherwise app may fail */
+    ret = DkSendHandles(stream, handles, entries_cnt);
+    if (ret < 0) {
+        ret = pal_to_unix_errno(ret);
+        goto out;
     }
 
     ret = 0;
 out:
     free(entries);
+    free(handles);
     return ret;
 }
 
 static int receive_memory_on_stream(PAL_HANDLE handle, struct checkpoint_hdr* hdr, uintptr_t base) {
     ssize_t rebase = base - (uintptr_t)hdr->addr;
+    int ret = 0;
+
+    size_t streams_cnt = hdr->mem_streams_cnt ?: 1;
+    if (streams_cnt > CP_MAX_MEM_STREAMS) {
+        log_error("checkpoint uses too many memory streams (%lu)", streams_cnt);
+        return -EINVAL;
+    }
 
+    struct cp_mem_stream streams[CP_MAX_MEM_STREAMS] = { 0 };
+    streams[0].handle = handle;
+    for (size_t i = 1; i < streams_cnt; i++) {
+        ret = DkReceiveHandle(handle, &streams[i].handle);
+        if (ret < 0) {
+            log_error("failed receiving checkpoint memory stream %lu", i);
+            ret = pal_to_unix_errno(ret);
+            goto out;
+        }
+    }
+
+    struct shim_mem_entry* first_entry = NULL;
     if (hdr->mem_entries_cnt) {
-        struct shim_mem_entry* entry = (struct shim_mem_entry*)(base + hdr->mem_offset);
+        first_entry = (struct shim_mem_entry*)(base + hdr->mem_offset);
 
-        for (; entry; entry = entry->next) {
+        for (struct shim_mem_entry* entry = first_entry; entry; entry = entry->next) {
             CP_REBASE(entry->next);
 
             log_debug("memory entry [%p]: %p-%p", entry, entry->addr, entry->addr + entry->size);
@@ -337,28 +755,62 @@ static int receive_memory_on_stream(PAL_HANDLE handle, struct checkpoint_hdr* hd
             PAL_NUM size = (char*)ALLOC_ALIGN_UP_PTR(entry->addr + entry->size) - (char*)addr;
             PAL_FLG prot = entry->prot;
 
-            int ret = DkVirtualMemoryAlloc(&addr, size, 0, prot | PAL_PROT_WRITE);
+            ret = DkVirtualMemoryAlloc(&addr, size, 0, prot | PAL_PROT_WRITE);
             if (ret < 0) {
                 log_error("failed allocating %p-%p", addr, addr + size);
-                return pal_to_unix_errno(ret);
+                ret = pal_to_unix_errno(ret);
+                goto out;
             }
+        }
+    }
 
-            ret = read_exact(handle, entry->addr, entry->size);
-            if (ret < 0) {
-                return ret;
-            }
+    bool received = false;
+    if (hdr->mem_direct) {
+        /* tell the parent that the memory is allocated, see send_memory_directly() */
+        char status = 0;
+        ret = write_exact(handle, &status, sizeof(status));
+        if (ret < 0)
+            goto out;
+        ret = read_exact(handle, &status, sizeof(status));
+        if (ret < 0)
+            goto out;
+        received = !status;
+    }
 
-            if (!(prot & PAL_PROT_WRITE)) {
-                ret = DkVirtualMemoryProtect(addr, size, prot);
-                if (ret < 0) {
-                    log_error("failed protecting %p-%p", addr, addr + size);
-                    return pal_to_unix_errno(ret);
-                }
+    if (!received) {
+        for (size_t i = 0; i < streams_cnt; i++) {
+            streams[i].idx             = i;
+            streams[i].streams_cnt     = streams_cnt;
+            streams[i].first_mem_entry = first_entry;
+            streams[i].send            = false;
+        }
+        ret = transfer_memory_on_streams(streams, streams_cnt);
+        if (ret < 0) {
+            goto out;
+        }
+    }
+
+    for (struct shim_mem_entry* entry = first_entry; entry; entry = entry->next) {
+        if (!(entry->prot & PAL_PROT_WRITE)) {
+            PAL_PTR addr = ALLOC_ALIGN_DOWN_PTR(entry->addr);
+            PAL_NUM size = (char*)ALLOC_ALIGN_UP_PTR(entry->addr + entry->size) - (char*)addr;
+            ret = DkVirtualMemoryProtect(addr, size, entry->prot);
+            if (ret < 0) {
+                log_error("failed protecting %p-%p", addr, addr + size);
+                ret = pal_to_unix_errno(ret);
+                goto out;
             }
         }
     }
 
-    return 0;
+    ret = 0;
+out:
+    for (size_t i = 0; i < streams_cnt; i++) {
+        free(streams[i].lz4_buf);
+        if (i > 0 && streams[i].handle)
+            DkObjectClose(streams[i].handle);
+    }
+    return ret;
 }
 
 static int restore_checkpoint(struct checkpoint_hdr* hdr, uintptr_t base) {
@@ -403,6 +855,11 @@ static int receive_handles_on_stream(struct checkpoint_hdr* hdr, void* base, ssi
     log_debug("receiving %lu PAL handles", entries_cnt);
 
     struct shim_palhdl_entry** entries = malloc(sizeof(*entries) * entries_cnt);
+    PAL_HANDLE* handles = malloc(sizeof(*handles) * entries_cnt);
+    if (!entries || !handles) {
+        ret = -ENOMEM;
+        goto out;
+    }
 
     /* entries are extracted from checkpoint in reverse order, let's first populate them */
     struct shim_palhdl_entry* entry = palhdl_entries;
@@ -415,25 +872,25 @@ static int receive_handles_on_stream(struct checkpoint_hdr* hdr, void* base, ssi
     }
     assert(!entry);
 
-    /* now we can traverse PAL-handle entries in correct order and receive them one by one */
-    for (size_t i = 0; i < entries_cnt; i++) {
-        entry = entries[i];
-        if (!entry->handle)
-            continue;
+    /* the parent sent a handle for each entry which had one, in this order */
+    size_t handles_cnt = 0;
+    for (size_t i = 0; i < entries_cnt; i++)
+        if (entries[i]->handle)
+            entries[handles_cnt++] = entries[i];
 
-        PAL_HANDLE hdl = NULL;
-        ret = DkReceiveHandle(g_pal_control->parent_process, &hdl);
-        /* need to abort migration if DkReceiveHandle() returned error, otherwise app may fail */
-        if (ret < 0) {
-            ret = pal_to_unix_errno(ret);
-            goto out;
-        }
-        *entry->phandle = hdl;
+    /* need to abort migration if DkReceiveHandles() returned error, otherwise app may fail */
+    ret = DkReceiveHandles(g_pal_control->parent_process, handles, handles_cnt);
+    if (ret < 0) {
+        ret = pal_to_unix_errno(ret);
+        goto out;
     }
+    for (size_t i = 0; i < handles_cnt; i++)
+        *entries[i]->phandle = handles[i];
 
     ret = 0;
 out:
     free(entries);
+    free(handles);
     return ret;
 }
 
@@ -484,6 +941,173 @@ static void* cp_alloc(void* addr, size_t size) {
     return addr;
 }
 
+/* Pool of pre-created child processes (see `libos.process_pool_size` in the manifest). A pooled
+ * child has completed its creation (on SGX: enclave build, attestation and stream handshake) and
+ * sits in shim_init() waiting for the checkpoint header, so claiming one leaves only the checkpoint
+ * transfer and restore on the critical path of fork/execve. Claimed children are replaced in the
+ * background by a helper thread. */
+#define PROCESS_POOL_MAX_SIZE 16
+
+static size_t g_process_pool_size;
+static PAL_HANDLE g_process_pool[PROCESS_POOL_MAX_SIZE];
+static size_t g_process_pool_cnt;
+static struct shim_lock g_process_pool_lock;
+static AEVENTTYPE g_process_pool_refill_event;
+static struct shim_thread* g_process_pool_thread;
+
+static void process_pool_thread(void* arg) {
+    __UNUSED(arg);
+    assert(g_process_pool_thread);
+
+    shim_tcb_init();
+    set_cur_thread(g_process_pool_thread);
+
+    log_debug("process pool thread started");
+
+    while (true) {
+        lock(&g_process_pool_lock);
+        bool full = g_process_pool_cnt == g_process_pool_size;
+        unlock(&g_process_pool_lock);
+
+        if (!full) {
+            PAL_HANDLE handle = NULL;
+            int ret = DkProcessCreate(/*args=*/NULL, &handle);
+            if (ret >= 0) {
+                lock(&g_process_pool_lock);
+                assert(g_process_pool_cnt < g_process_pool_size);
+                g_process_pool[g_process_pool_cnt++] = handle;
+                unlock(&g_process_pool_lock);
+                continue;
+            }
+            /* don't keep hammering the host, retry when the next child is claimed */
+            log_warning("failed pre-creating a child process: %ld", pal_to_unix_errno(ret));
+        }
+
+        int ret = wait_event(&g_process_pool_refill_event);
+        if (ret < 0) {
+            log_error("process pool thread failed waiting for refill event: %d", ret);
+            DkProcessExit(1);
+        }
+    }
+}
+
+/* Must be called with `g_process_pool_lock` held. */
+static int start_process_pool_thread(void) {
+    assert(locked(&g_process_pool_lock));
+
+    if (g_process_pool_thread)
+        return 0;
+
+    g_process_pool_thread = get_new_internal_thread();
+    if (!g_process_pool_thread)
+        return -ENOMEM;
+
+    PAL_HANDLE handle = NULL;
+    int ret = DkThreadCreate(process_pool_thread, NULL, &handle);
+    if (ret < 0) {
+        put_thread(g_process_pool_thread);
+        g_process_pool_thread = NULL;
+        return pal_to_unix_errno(ret);
+    }
+
+    g_process_pool_thread->pal_handle = handle;
+    return 0;
+}
+
+int init_process_pool(void) {
+    int64_t pool_size = 0;
+    int ret = toml_int_in(g_manifest_root, "libos.process_pool_size", /*defaultval=*/0, &pool_size);
+    if (ret < 0 || pool_size < 0 || pool_size > PROCESS_POOL_MAX_SIZE) {
+        log_error("Cannot parse 'libos.process_pool_size' (the value must be between 0 and %d)",
+                  PROCESS_POOL_MAX_SIZE);
+        return -EINVAL;
+    }
+
+    g_process_pool_size = pool_size;
+    if (!g_process_pool_size)
+        return 0;
+
+    if (!create_lock(&g_process_pool_lock))
+        return -ENOMEM;
+
+    ret = create_event(&g_process_pool_refill_event);
+    if (ret < 0)
+        return ret;
+
+    /* Only the first process fills its pool eagerly, children start doing so on their first fork;
+     * otherwise each pooled child would create a pool of its own as soon as it is claimed. */
+    if (g_pal_control->parent_process)
+        return 0;
+
+    lock(&g_process_pool_lock);
+    ret = start_process_pool_thread();
+    unlock(&g_process_pool_lock);
+    return ret;
+}
+
+/* Returns a pre-created child process or NULL if none is available. */
+static PAL_HANDLE claim_pooled_process(void) {
+    if (!g_process_pool_size)
+        return NULL;
+
+    PAL_HANDLE handle = NULL;
+
+    lock(&g_process_pool_lock);
+    if (g_process_pool_cnt) {
+        /* take the oldest one, it is the most likely to have finished initializing */
+        handle = g_process_pool[0];
+        g_process_pool_cnt--;
+        memmove(&g_process_pool[0], &g_process_pool[1], g_process_pool_cnt * sizeof(handle));
+    }
+    int ret = start_process_pool_thread();
+    unlock(&g_process_pool_lock);
+
+    if (ret < 0) {
+        log_warning("failed starting process pool thread: %d", ret);
+    } else {
+        (void)set_event(&g_process_pool_refill_event, 1);
+    }
+
+    return handle;
+}
+
+/* Creates a connected pair of pipe ends: `*out_local` stays with this process, `*out_remote` is sent
+ * to the child. The remote end is the accepted one, whose secure handshake (on SGX) has completed by
+ * the time DkStreamWaitForClient() returns, so it can be serialized right away. */
+static int create_mem_stream(PAL_HANDLE* out_local, PAL_HANDLE* out_remote) {
+    char uri[PIPE_URI_SIZE];
+    PAL_HANDLE srv = NULL;
+    PAL_HANDLE local = NULL;
+    PAL_HANDLE remote = NULL;
+
+    int ret = create_pipe(/*name=*/NULL, uri, sizeof(uri), &srv, /*qstr=*/NULL,
+                          /*use_vmid_for_name=*/false);
+    if (ret < 0) {
+        return ret;
+    }
+
+    ret = DkStreamOpen(uri, 0, 0, 0, 0, &local);
+    if (ret < 0) {
+        ret = pal_to_unix_errno(ret);
+        goto out;
+    }
+
+    ret = DkStreamWaitForClient(srv, &remote);
+    if (ret < 0) {
+        ret = pal_to_unix_errno(ret);
+        DkObjectClose(local);
+        goto out;
+    }
+
+    *out_local  = local;
+    *out_remote = remote;
+    ret = 0;
+out:
+    DkStreamDelete(srv, 0);
+    DkObjectClose(srv);
+    return ret;
+}
+
 int create_process_and_send_checkpoint(migrate_func_t migrate_func,
                                        struct shim_child_process* child_process,
                                        struct shim_process* process_description,
@@ -492,13 +1116,30 @@ int create_process_and_send_checkpoint(migrate_func_t migrate_func,
 
     int ret = 0;
 
-    /* FIXME: Child process requires some time to initialize before starting to receive checkpoint
-     * data. Parallelizing process creation and checkpointing could improve latency of forking. */
-    PAL_HANDLE pal_process = NULL;
-    ret = DkProcessCreate(/*args=*/NULL, &pal_process);
-    if (ret < 0) {
-        ret = pal_to_unix_errno(ret);
-        goto out;
+    struct shim_ipc_ids process_ipc_ids = {
+        .self_vmid = child_process->vmid,
+        .parent_vmid = g_process_ipc_ids.self_vmid,
+        .leader_vmid = g_process_ipc_ids.leader_vmid ?: g_process_ipc_ids.self_vmid,
+    };
+    /* not fatal: without a block of its own, the child asks the IPC leader for IDs */
+    if (delegate_id_block(&process_ipc_ids.id_block_start, &process_ipc_ids.id_block_end) < 0) {
+        process_ipc_ids.id_block_start = 0;
+        process_ipc_ids.id_block_end = 0;
+    }
+
+    PAL_HANDLE mem_streams[CP_MAX_MEM_STREAMS];
+    PAL_HANDLE child_mem_streams[CP_MAX_MEM_STREAMS];
+    size_t mem_streams_cnt = 0;
+
+    /* Child process requires some time to initialize before starting to receive checkpoint data;
+     * with a process pool configured, this was already done in the background. */
+    PAL_HANDLE pal_process = claim_pooled_process();
+    if (!pal_process) {
+        ret = DkProcessCreate(/*args=*/NULL, &pal_process);
+        if (ret < 0) {
+            ret = pal_to_unix_errno(ret);
+            goto out;
+        }
     }
 
     /* allocate a space for dumping the checkpoint data */
@@ -524,11 +1165,6 @@ int create_process_and_send_checkpoint(migrate_func_t migrate_func,
         goto out;
     }
 
-    struct shim_ipc_ids process_ipc_ids = {
-        .self_vmid = child_process->vmid,
-        .parent_vmid = g_process_ipc_ids.self_vmid,
-        .leader_vmid = g_process_ipc_ids.leader_vmid ?: g_process_ipc_ids.self_vmid,
-    };
     va_list ap;
     va_start(ap, thread_description);
     ret = (*migrate_func)(&cpstore, process_description, thread_description, &process_ipc_ids, ap);
@@ -556,6 +1192,47 @@ int create_process_and_send_checkpoint(migrate_func_t migrate_func,
         hdr.palhdl_entries_cnt = cpstore.palhdl_entries_cnt;
     }
 
+    int64_t streams_cnt = 1;
+    ret = toml_int_in(g_manifest_root, "libos.checkpoint_streams", /*defaultval=*/1, &streams_cnt);
+    if (ret < 0 || streams_cnt < 1 || streams_cnt > CP_MAX_MEM_STREAMS) {
+        log_error("Cannot parse 'libos.checkpoint_streams' (the value must be between 1 and %d)",
+                  CP_MAX_MEM_STREAMS);
+        ret = -EINVAL;
+        goto out;
+    }
+
+    /* stream 0 is the process stream itself, the others are dedicated pipes */
+    mem_streams[0] = pal_process;
+    for (mem_streams_cnt = 1; mem_streams_cnt < (size_t)streams_cnt; mem_streams_cnt++) {
+        ret = create_mem_stream(&mem_streams[mem_streams_cnt], &child_mem_streams[mem_streams_cnt]);
+        if (ret < 0) {
+            log_error("failed creating checkpoint memory stream (ret = %d)", ret);
+            goto out;
+        }
+    }
+    hdr.mem_streams_cnt = mem_streams_cnt;
+
+    bool direct_memory = true;
+    ret = toml_bool_in(g_manifest_root, "libos.checkpoint_direct_memory", /*defaultval=*/true,
+                       &direct_memory);
+    if (ret < 0) {
+        log_error("Cannot parse 'libos.checkpoint_direct_memory' (the value must be `true` or "
+                  "`false`)");
+        ret = -EINVAL;
+        goto out;
+    }
+    hdr.mem_direct = direct_memory && g_pal_control->process_write_memory;
+
+    bool compress_memory = false;
+    ret = toml_bool_in(g_manifest_root, "libos.checkpoint_compression", /*defaultval=*/false,
+                       &compress_memory);
+    if (ret < 0) {
+        log_error("Cannot parse 'libos.checkpoint_compression' (the value must be `true` or "
+                  "`false`)");
+        ret = -EINVAL;
+        goto out;
+    }
+
     /* send a checkpoint header to child process to notify it to start receiving checkpoint */
     ret = write_exact(pal_process, &hdr, sizeof(hdr));
     if (ret < 0) {
@@ -563,7 +1240,8 @@ int create_process_and_send_checkpoint(migrate_func_t migrate_func,
         goto out;
     }
 
-    ret = send_checkpoint_on_stream(pal_process, &cpstore);
+    ret = send_checkpoint_on_stream(pal_process, mem_streams, child_mem_streams, mem_streams_cnt,
+                                    &cpstore, hdr.mem_direct, compress_memory);
     if (ret < 0) {
         log_error("failed sending checkpoint (ret = %d)", ret);
         goto out;
@@ -613,11 +1291,21 @@ int create_process_and_send_checkpoint(migrate_func_t migrate_func,
 
     ret = 0;
 out:
+    for (size_t i = 1; i < mem_streams_cnt; i++) {
+        DkObjectClose(mem_streams[i]);
+        DkObjectClose(child_mem_streams[i]);
+    }
+
     if (pal_process)
         DkObjectClose(pal_process);
 
     if (ret < 0) {
         log_error("process creation failed");
+        if (process_ipc_ids.id_block_start) {
+            /* the child might have already taken the block over, release whatever is left */
+            (void)ipc_release_id_range(process_ipc_ids.id_block_start,
+                                       process_ipc_ids.id_block_end);
+        }
     }
 
     return ret;
@@ -0,0 +1,215 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/*
+ * Pool of LibOS-internal threads running jobs of the IPC and async workers (see `shim_executor.h`).
+ *
+ * Jobs submitted by a pool thread go to its own queue (and are taken newest-first, while their data
+ * is still in cache), other jobs are spread over the queues round-robin. A pool thread without jobs
+ * takes the oldest job of another queue before going to sleep on `g_executor_event`.
+ */
+
+#include <stdnoreturn.h>
+
+#include "assert.h"
+#include "cpu.h"
+#include "pal.h"
+#include "shim_executor.h"
+#include "shim_internal.h"
+#include "shim_lock.h"
+#include "shim_thread.h"
+#include "shim_utils.h"
+#include "spinlock.h"
+
+#define EXECUTOR_MAX_THREADS 16
+
+struct executor_thread {
+    struct shim_thread* thread;
+    int clear_on_exit;
+    spinlock_t lock; /* protects `jobs` */
+    LISTP_TYPE(shim_job) jobs;
+};
+
+static struct executor_thread g_executor_threads[EXECUTOR_MAX_THREADS];
+static size_t g_executor_threads_cnt = 0;
+/* Auto-clear; set on each submission and passed on by a woken thread while jobs remain queued. */
+static PAL_HANDLE g_executor_event = NULL;
+static size_t g_pending_jobs = 0;
+static size_t g_next_queue = 0;
+static bool g_executor_exiting = false;
+
+bool executor_is_async(void) {
+    return g_executor_threads_cnt > 0;
+}
+
+static struct executor_thread* get_cur_executor_thread(void) {
+    struct shim_thread* cur_thread = get_cur_thread();
+    for (size_t i = 0; i < g_executor_threads_cnt; i++) {
+        if (g_executor_threads[i].thread == cur_thread) {
+            return &g_executor_threads[i];
+        }
+    }
+    return NULL;
+}
+
+void executor_submit(struct shim_job* job) {
+    if (!g_executor_threads_cnt) {
+        job->run(job);
+        return;
+    }
+
+    struct executor_thread* et = get_cur_executor_thread();
+    if (!et) {
+        size_t idx = __atomic_fetch_add(&g_next_queue, 1, __ATOMIC_RELAXED);
+        et = &g_executor_threads[idx % g_executor_threads_cnt];
+    }
+
+    INIT_LIST_HEAD(job, list);
+    spinlock_lock(&et->lock);
+    LISTP_ADD_TAIL(job, &et->jobs, list);
+    spinlock_unlock(&et->lock);
+
+    __atomic_add_fetch(&g_pending_jobs, 1, __ATOMIC_RELEASE);
+    DkEventSet(g_executor_event);
+}
+
+static struct shim_job* take_job(struct executor_thread* self) {
+    struct shim_job* job = NULL;
+
+    spinlock_lock(&self->lock);
+    if (!LISTP_EMPTY(&self->jobs)) {
+        job = LISTP_LAST_ENTRY(&self->jobs, struct shim_job, list);
+        LISTP_DEL(job, &self->jobs, list);
+    }
+    spinlock_unlock(&self->lock);
+
+    size_t self_idx = self - g_executor_threads;
+    for (size_t i = 1; !job && i < g_executor_threads_cnt; i++) {
+        struct executor_thread* victim = &g_executor_threads[(self_idx + i)
+                                                             % g_executor_threads_cnt];
+        if (LISTP_EMPTY(&victim->jobs)) {
+            /* racy peek, avoids taking locks of idle threads; a job missed here comes with an event
+             * set by its submitter */
+            continue;
+        }
+        spinlock_lock(&victim->lock);
+        if (!LISTP_EMPTY(&victim->jobs)) {
+            job = LISTP_FIRST_ENTRY(&victim->jobs, struct shim_job, list);
+            LISTP_DEL(job, &victim->jobs, list);
+        }
+        spinlock_unlock(&victim->lock);
+    }
+
+    if (job) {
+        __atomic_sub_fetch(&g_pending_jobs, 1, __ATOMIC_ACQ_REL);
+    }
+    return job;
+}
+
+static noreturn void executor_thread_main(struct executor_thread* self) {
+    while (!__atomic_load_n(&g_executor_exiting, __ATOMIC_ACQUIRE)) {
+        struct shim_job* job = take_job(self);
+        if (!job) {
+            int ret = DkEventWait(g_executor_event, /*timeout=*/NULL);
+            if (ret < 0 && ret != -PAL_ERROR_INTERRUPTED) {
+                log_error("Executor: waiting for jobs failed: %d", ret);
+                DkProcessExit(1);
+            }
+            continue;
+        }
+
+        if (__atomic_load_n(&g_pending_jobs, __ATOMIC_ACQUIRE)) {
+            /* The event is auto-clear, pass the wakeup on to another pool thread. */
+            DkEventSet(g_executor_event);
+        }
+        job->run(job);
+    }
+
+    struct shim_thread* cur_thread = get_cur_thread();
+    assert(self->thread == cur_thread);
+    assert(cur_thread->shim_tcb->tp == cur_thread);
+    cur_thread->shim_tcb->tp = NULL;
+    put_thread(cur_thread);
+
+    destroy_thread_slab_cache();
+    DkThreadExit(&self->clear_on_exit);
+    /* Unreachable. */
+}
+
+static void executor_thread_wrapper(void* arg) {
+    struct executor_thread* self = arg;
+    assert(self->thread);
+
+    shim_tcb_init();
+    set_cur_thread(self->thread);
+
+    log_setprefix(shim_get_tcb());
+
+    log_debug("Executor thread started");
+    executor_thread_main(self);
+    /* Unreachable. */
+}
+
+int init_executor(void) {
+    int64_t threads_cnt = 0;
+    int ret = toml_int_in(g_manifest_root, "libos.internal_threads", /*defaultval=*/0,
+                          &threads_cnt);
+    if (ret < 0 || threads_cnt < 0 || threads_cnt > EXECUTOR_MAX_THREADS) {
+        log_error("Cannot parse 'libos.internal_threads' (the value must be between 0 and %d)",
+                  EXECUTOR_MAX_THREADS);
+        return -EINVAL;
+    }
+    if (!threads_cnt) {
+        return 0;
+    }
+
+    ret = DkEventCreate(&g_executor_event, /*init_signaled=*/false, /*auto_clear=*/true);
+    if (ret < 0) {
+        return pal_to_unix_errno(ret);
+    }
+
+    enable_locking();
+
+    /* All slots are set up before any pool thread starts, pool threads steal from each other. */
+    for (size_t i = 0; i < (size_t)threads_cnt; i++) {
+        struct executor_thread* et = &g_executor_threads[i];
+        spinlock_init(&et->lock);
+        INIT_LISTP(&et->jobs);
+        et->clear_on_exit = 1;
+        et->thread = get_new_internal_thread();
+        if (!et->thread) {
+            return -ENOMEM;
+        }
+    }
+    g_executor_threads_cnt = threads_cnt;
+
+    for (size_t i = 0; i < g_executor_threads_cnt; i++) {
+        struct executor_thread* et = &g_executor_threads[i];
+        PAL_HANDLE handle = NULL;
+        ret = DkThreadCreate(executor_thread_wrapper, et, &handle);
+        if (ret < 0) {
+            /* fatal, LibOS initialization fails */
+            return pal_to_unix_errno(ret);
+        }
+        et->thread->pal_handle = handle;
+    }
+
+    return 0;
+}
+
+/* Jobs still queued are dropped. */
+void terminate_executor(void) {
+    if (!g_executor_threads_cnt) {
+        return;
+    }
+
+    __atomic_store_n(&g_executor_exiting, true, __ATOMIC_RELEASE);
+
+    for (size_t i = 0; i < g_executor_threads_cnt; i++) {
+        while (__atomic_load_n(&g_executor_threads[i].clear_on_exit, __ATOMIC_RELAXED)) {
+            DkEventSet(g_executor_event);
+            CPU_RELAX();
+        }
+        put_thread(g_executor_threads[i].thread);
+        g_executor_threads[i].thread = NULL;
+    }
+}
@@ -16,8 +16,11 @@
 #include "shim_checkpoint.h"
 #include "shim_context.h"
 #include "shim_defs.h"
+#include "shim_executor.h"
 #include "shim_fs.h"
+#include "shim_fs_cache.h"
 #include "shim_fs_lock.h"
+#include "shim_fs_tmpfs.h"
 #include "shim_handle.h"
 #include "shim_internal.h"
 #include "shim_ipc.h"
@@ -89,6 +92,11 @@ void* migrated_memory_start;
 void* migrated_memory_end;
 
 const char** migrated_envp __attribute_migratable;
+/* set only in children spawned to run a new executable, see shim_fork.c; the strings of
+ * `migrated_envp` and `migrated_argv` are then packed in `migrated_args_strs` (envp first) */
+const char** migrated_argv;
+const char* migrated_args_strs;
+size_t migrated_args_strs_size;
 
 /* `g_library_paths` is populated with LD_PRELOAD entries once during LibOS initialization and is
  * used in `__load_interp_object()` to search for ELF program interpreter in specific paths. Once
@@ -161,9 +169,11 @@ out_fail:;
 
 /* populate already-allocated stack with copied argv and envp and space for auxv;
  * returns a pointer to first stack frame (starting with argc, then argv pointers, and so on)
- * and a pointer inside first stack frame (with auxv[0], auxv[1], and so on) */
+ * and a pointer inside first stack frame (with auxv[0], auxv[1], and so on); if `strs` is not
+ * NULL, it holds all envp strings followed by all argv strings and is copied in one go */
 static int populate_stack(void* stack, size_t stack_size, const char** argv, const char** envp,
-                          const char*** out_argp, elf_auxv_t** out_auxv) {
+                          const char* strs, size_t strs_size, const char*** out_argp,
+                          elf_auxv_t** out_auxv) {
     void* stack_low_addr  = stack;
     void* stack_high_addr = stack + stack_size;
 
@@ -202,12 +212,9 @@ static int populate_stack(void* stack, size_t stack_size, const char** argv, con
      *                 |  ...              |
      *                 +-------------------+
      */
-    size_t argc      = 0;
-    size_t argv_size = 0;
-    for (const char** a = argv; *a; a++) {
-        argv_size += strlen(*a) + 1;
+    size_t argc = 0;
+    for (const char** a = argv; *a; a++)
         argc++;
-    }
 
     /* we populate the stack memory region from two ends:
      *   - memory at high addresses contains buffers with argv + envp strings
@@ -215,38 +222,63 @@ static int populate_stack(void* stack, size_t stack_size, const char** argv, con
     long* argc_ptr = ALLOCATE_FROM_LOW_ADDR(sizeof(long));
     *argc_ptr = argc;
 
-    /* pre-allocate enough space to hold all argv strings */
-    char* argv_str = ALLOCATE_FROM_HIGH_ADDR(argv_size);
-
     /* Even though the SysV ABI does not specify the order of argv strings, some applications
      * (notably Node.js's libuv) assume the compact encoding of argv where (1) all strings are
      * located adjacently and (2) in increasing order. */
-    const char** new_argv = stack_low_addr;
-    for (const char** a = argv; *a; a++) {
-        size_t size = strlen(*a) + 1;
-        const char** argv_ptr = ALLOCATE_FROM_LOW_ADDR(sizeof(const char*));  /* ptr to argv[i] */
-        memcpy(argv_str, *a, size);                                           /* argv[i] string */
-        *argv_ptr = argv_str;
-        argv_str += size;
-    }
-    *((const char**)ALLOCATE_FROM_LOW_ADDR(sizeof(const char*))) = NULL;
-
-    /* populate envp on stack similarly to argv */
-    size_t envp_size = 0;
-    for (const char** e = envp; *e; e++) {
-        envp_size += strlen(*e) + 1;
-    }
-    char* envp_str = ALLOCATE_FROM_HIGH_ADDR(envp_size);
+    const char** new_argv;
+    const char** new_envp;
+    if (strs) {
+        /* packed by the parent in exactly this layout, only the pointers must be shifted */
+        char* new_strs = ALLOCATE_FROM_HIGH_ADDR(strs_size);
+        memcpy(new_strs, strs, strs_size);
+        ptrdiff_t diff = new_strs - strs;
+
+        new_argv = stack_low_addr;
+        for (const char** a = argv; *a; a++)
+            *((const char**)ALLOCATE_FROM_LOW_ADDR(sizeof(const char*))) = *a + diff;
+        *((const char**)ALLOCATE_FROM_LOW_ADDR(sizeof(const char*))) = NULL;
+
+        new_envp = stack_low_addr;
+        for (const char** e = envp; *e; e++)
+            *((const char**)ALLOCATE_FROM_LOW_ADDR(sizeof(const char*))) = *e + diff;
+        *((const char**)ALLOCATE_FROM_LOW_ADDR(sizeof(const char*))) = NULL;
+    } else {
+        size_t argv_size = 0;
+        for (const char** a = argv; *a; a++)
+            argv_size += strlen(*a) + 1;
+
+        /* pre-allocate enough space to hold all argv strings */
+        char* argv_str = ALLOCATE_FROM_HIGH_ADDR(argv_size);
+
+        new_argv = stack_low_addr;
+        for (const char** a = argv; *a; a++) {
+            size_t size = strlen(*a) + 1;
+            /* ptr to argv[i] and argv[i] string */
+            const char** argv_ptr = ALLOCATE_FROM_LOW_ADDR(sizeof(const char*));
+            memcpy(argv_str, *a, size);
+            *argv_ptr = argv_str;
+            argv_str += size;
+        }
+        *((const char**)ALLOCATE_FROM_LOW_ADDR(sizeof(const char*))) = NULL;
 
-    const char** new_envp = stack_low_addr;
-    for (const char** e = envp; *e; e++) {
-        size_t size = strlen(*e) + 1;
-        const char** envp_ptr = ALLOCATE_FROM_LOW_ADDR(sizeof(const char*)); /* ptr to envp[i] */
-        memcpy(envp_str, *e, size);                                          /* envp[i] string */
-        *envp_ptr = envp_str;
-        envp_str += size;
+        /* populate envp on stack similarly to argv */
+        size_t envp_size = 0;
+        for (const char** e = envp; *e; e++) {
+            envp_size += strlen(*e) + 1;
+        }
+        char* envp_str = ALLOCATE_FROM_HIGH_ADDR(envp_size);
+
+        new_envp = stack_low_addr;
+        for (const char** e = envp; *e; e++) {
+            size_t size = strlen(*e) + 1;
+            /* ptr to envp[i] and envp[i] string */
+            const char** envp_ptr = ALLOCATE_FROM_LOW_ADDR(sizeof(const char*));
+            memcpy(envp_str, *e, size);
+            *envp_ptr = envp_str;
+            envp_str += size;
+        }
+        *((const char**)ALLOCATE_FROM_LOW_ADDR(sizeof(const char*))) = NULL;
     }
-    *((const char**)ALLOCATE_FROM_LOW_ADDR(sizeof(const char*))) = NULL;
 
     /* reserve space for ELF aux vectors, populated later in execute_elf_object() */
     elf_auxv_t* new_auxv = ALLOCATE_FROM_LOW_ADDR(REQUIRED_ELF_AUXV * sizeof(elf_auxv_t) +
@@ -307,10 +339,15 @@ int init_stack(const char** argv, const char** envp, const char*** out_argp,
     if (!stack)
         return -ENOMEM;
 
-    /* if there is envp inherited from parent, use it */
+    /* if there is argv/envp inherited from parent, use it */
+    argv = migrated_argv ?: argv;
     envp = migrated_envp ?: envp;
 
-    ret = populate_stack(stack, stack_size, argv, envp, out_argp, out_auxv);
+    ret = populate_stack(stack, stack_size, argv, envp, migrated_args_strs,
+                         migrated_args_strs_size, out_argp, out_auxv);
+    /* consumed, a later in-process execve() passes its own arguments */
+    migrated_argv = NULL;
+    migrated_args_strs = NULL;
     if (ret < 0)
         return ret;
 
@@ -369,6 +406,7 @@ static int read_environs(const char** envp) {
             log_error("Error during shim_init() in " #func " (%d)", _err);   \
             DkProcessExit(-_err);                                            \
         }                                                                    \
+        DkStartupTrace("LibOS: " #func);                                     \
     } while (0)
 
 noreturn void* shim_init(int argc, void* args) {
@@ -403,11 +441,14 @@ noreturn void* shim_init(int argc, void* args) {
 
     RUN_INIT(init_vma);
     RUN_INIT(init_slab);
+    RUN_INIT(init_syscall_stats);
+    RUN_INIT(init_lock_stats);
     RUN_INIT(read_environs, envp);
-    RUN_INIT(init_str_mgr);
     RUN_INIT(init_rlimit);
     RUN_INIT(init_fs);
     RUN_INIT(init_fs_lock);
+    RUN_INIT(init_file_cache);
+    RUN_INIT(init_tmpfs_store);
     RUN_INIT(init_dcache);
     RUN_INIT(init_handle);
     RUN_INIT(init_r_debug);
@@ -418,6 +459,11 @@ noreturn void* shim_init(int argc, void* args) {
         struct checkpoint_hdr hdr;
 
         int ret = read_exact(g_pal_control->parent_process, &hdr, sizeof(hdr));
+        if (ret == -ENODATA) {
+            /* pre-created (pooled) child whose parent exited without ever claiming it */
+            log_debug("shim_init: parent closed the stream before sending a checkpoint");
+            DkProcessExit(0);
+        }
         if (ret < 0) {
             log_error("shim_init: failed to read the whole checkpoint header: %d", ret);
             DkProcessExit(1);
@@ -433,12 +479,16 @@ noreturn void* shim_init(int argc, void* args) {
     RUN_INIT(init_ipc);
     RUN_INIT(init_process, argc, argv);
     RUN_INIT(init_threading);
+    RUN_INIT(init_futex);
+    RUN_INIT(init_sleep);
     RUN_INIT(init_mount);
     RUN_INIT(init_important_handles);
 
     /* Update log prefix after we initialized `g_process.exec` */
     log_setprefix(shim_get_tcb());
 
+    RUN_INIT(init_executor);
+    RUN_INIT(init_log_writer);
     RUN_INIT(init_async_worker);
 
     const char** new_argp;
@@ -457,8 +507,11 @@ noreturn void* shim_init(int argc, void* args) {
         }
 
         /* This has also a (very much desired) side effect of the IPC leader making a connection to
-         * this process, so that it's included in all broadcast messages. */
-        ret = ipc_change_id_owner(g_process.pid, g_process_ipc_ids.self_vmid);
+         * this process, so that it's included in all broadcast messages. The IDs delegated by the
+         * parent change owner in the same round-trip. */
+        ret = ipc_change_id_owner_with_block(g_process.pid, g_process_ipc_ids.id_block_start,
+                                             g_process_ipc_ids.id_block_end,
+                                             g_process_ipc_ids.self_vmid);
         if (ret < 0) {
             log_debug("shim_init: failed to change child process PID ownership: %d", ret);
             DkProcessExit(1);
@@ -485,9 +538,15 @@ noreturn void* shim_init(int argc, void* args) {
     /* Note that in the main process, we initialize both sync server and sync client, and the client
      * communicates with server over a "loopback" IPC connection. */
     RUN_INIT(init_sync_client);
+    RUN_INIT(init_process_pool);
 
     log_debug("Shim process initialized");
 
+    if (g_spawned_exit_code >= 0) {
+        /* the vfork child exited before execve, see shim_fork.c */
+        process_exit(g_spawned_exit_code, /*term_signal=*/0);
+    }
+
     shim_tcb_t* cur_tcb = shim_get_tcb();
 
     if (cur_tcb->context.regs) {
@@ -497,6 +556,8 @@ noreturn void* shim_init(int argc, void* args) {
 
     set_default_tls();
 
+    DkStartupTrace("LibOS: entering application");
+
     /* At this point, the exec map has been either copied from checkpoint, or initialized in
      * `init_loader`. */
     execute_elf_object(/*exec_map=*/NULL, new_argp, new_auxv);
@@ -7,6 +7,10 @@
  *
  * When existing slabs are not sufficient, or a large (4k or greater) allocation is requested, it
  * ends up here (__system_alloc and __system_free).
+ *
+ * Small allocations and frees go through a per-thread slab cache (kept in the LibOS TCB), so that
+ * the global slab lock is only taken to move objects between the cache and the slab manager in
+ * batches.
  */
 
 #include <asm/mman.h>
@@ -15,8 +19,10 @@
 #include "shim_checkpoint.h"
 #include "shim_internal.h"
 #include "shim_lock.h"
+#include "shim_tcb.h"
 #include "shim_utils.h"
 #include "shim_vma.h"
+#include "toml.h"
 
 static struct shim_lock slab_mgr_lock;
 
@@ -31,55 +37,347 @@ static struct shim_lock slab_mgr_lock;
 
 static SLAB_MGR slab_mgr = NULL;
 
-/* Returns NULL on failure */
-void* __system_malloc(size_t size) {
-    size_t alloc_size = ALLOC_ALIGN_UP(size);
-    void* addr = NULL;
+/* print allocator stats at exit, enabled together with other stats by `sgx.enable_stats` */
+static bool g_malloc_stats_enabled = false;
 
-    int ret = bkeep_mmap_any(alloc_size, PROT_READ | PROT_WRITE,
-                             MAP_PRIVATE | MAP_ANONYMOUS | VMA_INTERNAL, NULL, 0, "slab", &addr);
-    if (ret < 0) {
-        return NULL;
+/* Returns the slab cache of the current thread, creating it on first use. Returns NULL if it cannot
+ * be allocated; callers then fall back to the global slab lists. */
+static SLAB_CACHE get_slab_cache(void) {
+    SLAB_CACHE cache = SHIM_TCB_GET(slab_cache);
+    if (!cache) {
+        cache = slab_alloc(slab_mgr, sizeof(*cache));
+        if (!cache)
+            return NULL;
+        memset(cache, 0, sizeof(*cache));
+        SHIM_TCB_SET(slab_cache, cache);
+    }
+    return cache;
+}
+
+/*
+ * Arena for system allocations (slab areas and large objects) of up to ARENA_MAX_BLOCK_SIZE bytes.
+ *
+ * Memory is obtained from the system in chunks of ARENA_CHUNK_SIZE bytes (aligned to their size)
+ * and split into power-of-two blocks by a buddy allocator, so that allocating and freeing large
+ * buffers does not go through VMA bookkeeping and the PAL every time. The first block of each chunk
+ * holds the chunk header. A chunk that becomes completely free is returned to the system only if
+ * the arena has more than ARENA_HIGH_WATERMARK bytes of free memory.
+ */
+#define ARENA_MIN_BLOCK_SHIFT 12
+#define ARENA_MIN_BLOCK_SIZE  (1ul << ARENA_MIN_BLOCK_SHIFT)
+#define ARENA_CHUNK_ORDER     10
+#define ARENA_CHUNK_BLOCKS    (1ul << ARENA_CHUNK_ORDER)
+#define ARENA_CHUNK_SIZE      (ARENA_MIN_BLOCK_SIZE << ARENA_CHUNK_ORDER)
+/* the first block of a chunk holds the header, so the largest free block is the second half */
+#define ARENA_ORDERS          ARENA_CHUNK_ORDER
+#define ARENA_MAX_BLOCK_SIZE  (ARENA_CHUNK_SIZE / 2)
+#define ARENA_HIGH_WATERMARK  (4 * ARENA_CHUNK_SIZE)
+
+struct arena_chunk {
+    size_t free_size;
+    /* for each minimal block: order + 1 of the free block starting at it, 0 if there is none */
+    uint8_t free_order[ARENA_CHUNK_BLOCKS];
+};
+static_assert(sizeof(struct arena_chunk) <= ARENA_MIN_BLOCK_SIZE,
+              "arena chunk header must fit in the first block");
+
+DEFINE_LIST(arena_block);
+struct arena_block {
+    LIST_TYPE(arena_block) list;
+};
+DEFINE_LISTP(arena_block);
+
+static struct shim_lock arena_lock;
+static bool g_arena_enabled = false;
+static LISTP_TYPE(arena_block) g_arena_free_blocks[ARENA_ORDERS];
+static size_t g_arena_free_size = 0;
+static size_t g_arena_chunks_cnt = 0;
+
+static void unreserve_mem(void* addr, size_t size) {
+    void* tmp_vma = NULL;
+    if (bkeep_munmap(addr, size, /*is_internal=*/true, &tmp_vma) < 0) {
+        BUG();
     }
+    bkeep_remove_tmp_vma(tmp_vma);
+}
 
-    ret = DkVirtualMemoryAlloc(&addr, alloc_size, 0, PAL_PROT_WRITE | PAL_PROT_READ);
+static void* system_mem_alloc(void* addr, size_t size) {
+    int ret = DkVirtualMemoryAlloc(&addr, size, 0, PAL_PROT_WRITE | PAL_PROT_READ);
     if (ret < 0) {
         log_error("failed to allocate memory (%ld)", pal_to_unix_errno(ret));
-        void* tmp_vma = NULL;
-        if (bkeep_munmap(addr, alloc_size, /*is_internal=*/true, &tmp_vma) < 0) {
-            BUG();
-        }
-        bkeep_remove_tmp_vma(tmp_vma);
+        unreserve_mem(addr, size);
         return NULL;
     }
-
     return addr;
 }
 
-void __system_free(void* addr, size_t size) {
+static void system_mem_free(void* addr, size_t size) {
     void* tmp_vma = NULL;
-    if (bkeep_munmap(addr, ALLOC_ALIGN_UP(size), /*is_internal=*/true, &tmp_vma) < 0) {
+    if (bkeep_munmap(addr, size, /*is_internal=*/true, &tmp_vma) < 0) {
         BUG();
     }
-    if (DkVirtualMemoryFree(addr, ALLOC_ALIGN_UP(size)) < 0) {
+    if (DkVirtualMemoryFree(addr, size) < 0) {
         BUG();
     }
     bkeep_remove_tmp_vma(tmp_vma);
 }
 
+static struct arena_chunk* block_to_chunk(void* block) {
+    return (struct arena_chunk*)ALIGN_DOWN_PTR_POW2(block, ARENA_CHUNK_SIZE);
+}
+
+static size_t block_index(struct arena_chunk* chunk, void* block) {
+    return ((uintptr_t)block - (uintptr_t)chunk) >> ARENA_MIN_BLOCK_SHIFT;
+}
+
+static size_t block_order(size_t size) {
+    size_t order = 0;
+    while ((ARENA_MIN_BLOCK_SIZE << order) < size)
+        order++;
+    return order;
+}
+
+static void add_free_block(struct arena_chunk* chunk, size_t idx, size_t order) {
+    assert(locked(&arena_lock));
+    struct arena_block* block = (void*)chunk + (idx << ARENA_MIN_BLOCK_SHIFT);
+    INIT_LIST_HEAD(block, list);
+    LISTP_ADD(block, &g_arena_free_blocks[order], list);
+    chunk->free_order[idx] = order + 1;
+}
+
+static void del_free_block(struct arena_chunk* chunk, size_t idx, size_t order) {
+    assert(locked(&arena_lock));
+    assert(chunk->free_order[idx] == order + 1);
+    struct arena_block* block = (void*)chunk + (idx << ARENA_MIN_BLOCK_SHIFT);
+    LISTP_DEL(block, &g_arena_free_blocks[order], list);
+    chunk->free_order[idx] = 0;
+}
+
+static struct arena_chunk* create_arena_chunk(void) {
+    void* addr = NULL;
+
+    /* reserve twice the chunk size to find an aligned chunk in it, then give back the rest */
+    int ret = bkeep_mmap_any(2 * ARENA_CHUNK_SIZE, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS | VMA_INTERNAL, NULL, 0, "slab", &addr);
+    if (ret < 0) {
+        return NULL;
+    }
+
+    void* chunk = ALIGN_UP_PTR_POW2(addr, ARENA_CHUNK_SIZE);
+    if (chunk != addr)
+        unreserve_mem(addr, chunk - addr);
+    if (chunk != addr + ARENA_CHUNK_SIZE)
+        unreserve_mem(chunk + ARENA_CHUNK_SIZE, addr + ARENA_CHUNK_SIZE - chunk);
+
+    /* the memory is zeroed, so the header does not need to be initialized */
+    return system_mem_alloc(chunk, ARENA_CHUNK_SIZE);
+}
+
+static void* arena_alloc(size_t order) {
+    assert(order < ARENA_ORDERS);
+
+    lock(&arena_lock);
+    size_t k = order;
+    while (k < ARENA_ORDERS && LISTP_EMPTY(&g_arena_free_blocks[k]))
+        k++;
+
+    if (k == ARENA_ORDERS) {
+        /* creating a chunk may need to allocate memory for VMA bookkeeping, so drop the lock */
+        unlock(&arena_lock);
+        struct arena_chunk* chunk = create_arena_chunk();
+        if (!chunk)
+            return NULL;
+        lock(&arena_lock);
+
+        for (size_t i = 0; i < ARENA_ORDERS; i++)
+            add_free_block(chunk, 1ul << i, i);
+        chunk->free_size = ARENA_CHUNK_SIZE - ARENA_MIN_BLOCK_SIZE;
+        g_arena_free_size += chunk->free_size;
+        g_arena_chunks_cnt++;
+
+        /* someone might have taken the block we've just added, but not the whole chunk */
+        k = order;
+        while (LISTP_EMPTY(&g_arena_free_blocks[k]))
+            k++;
+    }
+
+    struct arena_block* block = LISTP_FIRST_ENTRY(&g_arena_free_blocks[k], struct arena_block,
+                                                  list);
+    struct arena_chunk* chunk = block_to_chunk(block);
+    size_t idx = block_index(chunk, block);
+    del_free_block(chunk, idx, k);
+
+    /* split the block, keeping its first part and freeing the buddies */
+    while (k > order) {
+        k--;
+        add_free_block(chunk, idx + (1ul << k), k);
+    }
+
+    size_t size = ARENA_MIN_BLOCK_SIZE << order;
+    chunk->free_size  -= size;
+    g_arena_free_size -= size;
+    unlock(&arena_lock);
+    return block;
+}
+
+static void arena_free(void* addr, size_t order) {
+    assert(order < ARENA_ORDERS);
+
+    struct arena_chunk* chunk = block_to_chunk(addr);
+    size_t idx = block_index(chunk, addr);
+    size_t size = ARENA_MIN_BLOCK_SIZE << order;
+    bool release_chunk = false;
+
+    lock(&arena_lock);
+    chunk->free_size  += size;
+    g_arena_free_size += size;
+
+    /* merge with free buddies; the buddy of the largest block is the chunk header, never free */
+    while (order < ARENA_ORDERS - 1) {
+        size_t buddy = idx ^ (1ul << order);
+        if (chunk->free_order[buddy] != order + 1)
+            break;
+        del_free_block(chunk, buddy, order);
+        idx &= ~(1ul << order);
+        order++;
+    }
+    add_free_block(chunk, idx, order);
+
+    if (chunk->free_size == ARENA_CHUNK_SIZE - ARENA_MIN_BLOCK_SIZE
+            && g_arena_free_size > ARENA_HIGH_WATERMARK) {
+        /* completely free chunk consists of exactly one free block of each order */
+        for (size_t i = 0; i < ARENA_ORDERS; i++)
+            del_free_block(chunk, 1ul << i, i);
+        g_arena_free_size -= chunk->free_size;
+        g_arena_chunks_cnt--;
+        release_chunk = true;
+    }
+    unlock(&arena_lock);
+
+    if (release_chunk)
+        system_mem_free(chunk, ARENA_CHUNK_SIZE);
+}
+
+/* Returns NULL on failure */
+void* __system_malloc(size_t size) {
+    size_t alloc_size = ALLOC_ALIGN_UP(size);
+    if (g_arena_enabled && alloc_size <= ARENA_MAX_BLOCK_SIZE)
+        return arena_alloc(block_order(alloc_size));
+
+    void* addr = NULL;
+    int ret = bkeep_mmap_any(alloc_size, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS | VMA_INTERNAL, NULL, 0, "slab", &addr);
+    if (ret < 0) {
+        return NULL;
+    }
+    return system_mem_alloc(addr, alloc_size);
+}
+
+void __system_free(void* addr, size_t size) {
+    size_t alloc_size = ALLOC_ALIGN_UP(size);
+    if (g_arena_enabled && alloc_size <= ARENA_MAX_BLOCK_SIZE) {
+        arena_free(addr, block_order(alloc_size));
+        return;
+    }
+    system_mem_free(addr, alloc_size);
+}
+
 int init_slab(void) {
-    if (!create_lock(&slab_mgr_lock)) {
+    if (!create_lock(&slab_mgr_lock) || !create_lock(&arena_lock)) {
         return -ENOMEM;
     }
+    /* the arena needs its minimal block to be a multiple of the allocation alignment */
+    g_arena_enabled = ALLOC_ALIGNMENT <= ARENA_MIN_BLOCK_SIZE;
+
     slab_mgr = create_slab_mgr();
     if (!slab_mgr) {
         return -ENOMEM;
     }
+
+    int ret = toml_bool_in(g_manifest_root, "sgx.enable_stats", /*defaultval=*/false,
+                           &g_malloc_stats_enabled);
+    if (ret < 0) {
+        log_error("Cannot parse 'sgx.enable_stats' (the value must be `true` or `false`)");
+        return -EINVAL;
+    }
     return 0;
 }
 
+/* Returns a newly allocated human-readable summary of LibOS and PAL allocator statistics (used for
+ * `/proc/graphene/malloc`). */
+int get_malloc_stats(char** out_data, size_t* out_size) {
+    size_t max = 2048;
+
+    while (true) {
+        char* str = malloc(max);
+        if (!str)
+            return -ENOMEM;
+
+        size_t len = snprintf(str, max, "LibOS allocator:\n");
+        len += slab_print_stats(slab_mgr, str + len, max - len);
+        if (len < max) {
+            lock(&arena_lock);
+            len += snprintf(str + len, max - len, "arena: %lu chunks (%lu bytes free)\n",
+                            g_arena_chunks_cnt, g_arena_free_size);
+            unlock(&arena_lock);
+        }
+        if (len < max)
+            len += snprintf(str + len, max - len, "PAL allocator:\n");
+        if (len < max) {
+            PAL_NUM pal_len = max - len;
+            int ret = DkMemoryStatsQuery(str + len, &pal_len);
+            if (ret < 0) {
+                free(str);
+                return pal_to_unix_errno(ret);
+            }
+            len += pal_len;
+        }
+
+        if (len < max) {
+            *out_data = str;
+            *out_size = len;
+            return 0;
+        }
+
+        /* stats may change between the tries, leave some room for that */
+        free(str);
+        max = len + 256;
+    }
+}
+
+void print_malloc_stats(void) {
+    if (!g_malloc_stats_enabled)
+        return;
+
+    char* str;
+    size_t size;
+    int ret = get_malloc_stats(&str, &size);
+    if (ret < 0) {
+        log_warning("Getting allocator stats failed: %d", ret);
+        return;
+    }
+
+    /* strip the last newline, log_always() adds one */
+    if (size && str[size - 1] == '\n')
+        str[size - 1] = '\0';
+    log_always("----- Memory allocator stats -----\n%s", str);
+    free(str);
+}
+
+/* Returns objects cached by the current thread to the global slab lists. Must be called before the
+ * thread exits, after its last malloc()/free(). */
+void destroy_thread_slab_cache(void) {
+    SLAB_CACHE cache = SHIM_TCB_GET(slab_cache);
+    if (!cache)
+        return;
+
+    SHIM_TCB_SET(slab_cache, NULL);
+    slab_cache_drain(slab_mgr, cache);
+    slab_free(slab_mgr, cache);
+}
+
 void* malloc(size_t size) {
-    void* mem = slab_alloc(slab_mgr, size);
+    void* mem = slab_alloc_cached(slab_mgr, get_slab_cache(), size);
 
     if (!mem) {
         /*
@@ -143,5 +441,8 @@ void free(void* mem) {
         return;
     }
 
-    slab_free(slab_mgr, mem);
+    if (!mem)
+        return;
+
+    slab_free_cached(slab_mgr, get_slab_cache(), mem);
 }
@@ -1536,6 +1536,45 @@ static void print_syscall_name(struct print_buf* buf, const char* name, unsigned
     }
 }
 
+const char* get_syscall_name(unsigned long sysno) {
+    if (sysno >= ARRAY_SIZE(syscall_parser_table))
+        return NULL;
+    return syscall_parser_table[sysno].name;
+}
+
+/* For the binary syscall trace (see `libos.syscall_trace_file`): tells the offline decoder how to
+ * print the return value and the arguments of `sysno`, one letter per entry of `parser`: `i` (int),
+ * `l` (long), `p` (pointer), `s` (pointer to a string), `r` (pointer or negative error code), `x`
+ * (anything else, printed in hex). Returns the number of letters written (0 if unknown). */
+size_t get_syscall_arg_kinds(unsigned long sysno, char* kinds, size_t size) {
+    if (sysno >= ARRAY_SIZE(syscall_parser_table) || !syscall_parser_table[sysno].name)
+        return 0;
+
+    static const struct {
+        void (*parser)(struct print_buf*, va_list*);
+        char kind;
+    } kinds_table[] = {
+        {parse_integer_arg, 'i'}, {parse_long_arg, 'l'},   {parse_pointer_arg, 'p'},
+        {parse_string_arg, 's'},  {parse_pointer_ret, 'r'}, {parse_at_fdcwd, 'i'},
+        {parse_signum, 'i'},      {parse_exec_args, 'p'},   {parse_exec_envp, 'p'},
+        {parse_pipe_fds, 'p'},    {parse_sigmask, 'p'},     {parse_timespec, 'p'},
+        {parse_sockaddr, 'p'},
+    };
+
+    size_t cnt = 0;
+    struct parser_table* parser = &syscall_parser_table[sysno];
+    for (; cnt < ARRAY_SIZE(parser->parser) && parser->parser[cnt] && cnt < size; cnt++) {
+        kinds[cnt] = 'x';
+        for (size_t i = 0; i < ARRAY_SIZE(kinds_table); i++) {
+            if (kinds_table[i].parser == parser->parser[cnt]) {
+                kinds[cnt] = kinds_table[i].kind;
+                break;
+            }
+        }
+    }
+    return cnt;
+}
+
 void warn_unsupported_syscall(unsigned long sysno) {
     if (sysno < ARRAY_SIZE(syscall_parser_table) && syscall_parser_table[sysno].name)
         log_warning("Unsupported system call %s", syscall_parser_table[sysno].name);
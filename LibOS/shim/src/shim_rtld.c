@@ -36,6 +36,7 @@
 #include "shim_vdso.h"
 #include "shim_vdso-arch.h"
 #include "shim_vma.h"
+#include "spinlock.h"
 
 /*
  * Structure describing a loaded ELF object. Originally based on glibc link_map structure.
@@ -100,6 +101,17 @@ struct loadcmd {
     int prot;
 };
 
+/* Beginning of an ELF file, read at once. Large enough for the ELF header and (in virtually all
+ * binaries) the program header table that directly follows it, which then does not need to be read
+ * separately. Same size as glibc's `struct filebuf`. */
+struct elf_filebuf {
+    size_t len;
+    union {
+        ElfW(Ehdr) ehdr;
+        char buf[832];
+    };
+};
+
 static struct link_map* g_exec_map = NULL;
 static struct link_map* g_interp_map = NULL;
 
@@ -304,8 +316,10 @@ static int execute_loadcmd(const struct loadcmd* c, ElfW(Addr) load_addr,
     return 0;
 }
 
-static struct link_map* map_elf_object(struct shim_handle* file, ElfW(Ehdr)* ehdr) {
+static struct link_map* map_elf_object(struct shim_handle* file, struct elf_filebuf* fbp) {
+    const ElfW(Ehdr)* ehdr = &fbp->ehdr;
     ElfW(Phdr)* phdr = NULL;
+    ElfW(Phdr)* phdr_alloc = NULL;
     ElfW(Addr) interp_libname_vaddr = 0;
     struct loadcmd* loadcmds = NULL;
     size_t n_loadcmds = 0;
@@ -331,15 +345,20 @@ static struct link_map* map_elf_object(struct shim_handle* file, ElfW(Ehdr)* ehd
     /* Load the program header table. */
 
     size_t phdr_size = ehdr->e_phnum * sizeof(ElfW(Phdr));
-    phdr = (ElfW(Phdr)*)malloc(phdr_size);
-    if (!phdr) {
-        errstring = "phdr malloc failure";
-        ret = -ENOMEM;
-        goto err;
-    }
-    if ((ret = read_file_fragment(file, phdr, phdr_size, ehdr->e_phoff)) < 0) {
-        errstring = "cannot read phdr";
-        goto err;
+    if (ehdr->e_phoff <= fbp->len && phdr_size <= fbp->len - ehdr->e_phoff) {
+        phdr = (ElfW(Phdr)*)(fbp->buf + ehdr->e_phoff);
+    } else {
+        phdr_alloc = (ElfW(Phdr)*)malloc(phdr_size);
+        if (!phdr_alloc) {
+            errstring = "phdr malloc failure";
+            ret = -ENOMEM;
+            goto err;
+        }
+        if ((ret = read_file_fragment(file, phdr_alloc, phdr_size, ehdr->e_phoff)) < 0) {
+            errstring = "cannot read phdr";
+            goto err;
+        }
+        phdr = phdr_alloc;
     }
 
     /* Scan the program header table load commands and additional information. */
@@ -455,13 +474,13 @@ static struct link_map* map_elf_object(struct shim_handle* file, ElfW(Ehdr)* ehd
 
     l->l_phnum = ehdr->e_phnum;
 
-    free(phdr);
+    free(phdr_alloc);
     free(loadcmds);
     return l;
 
 err:
     log_debug("loading %s: %s (%d)", l->l_name, errstring, ret);
-    free(phdr);
+    free(phdr_alloc);
     free(loadcmds);
     free(l);
     return NULL;
@@ -472,7 +491,7 @@ static void remove_elf_object(struct link_map* l) {
     free(l);
 }
 
-static int check_elf_header(ElfW(Ehdr)* ehdr) {
+static int check_elf_header(const ElfW(Ehdr)* ehdr) {
     const char* errstring __attribute__((unused));
 
 #if __ELF_NATIVE_CLASS == 32
@@ -540,7 +559,9 @@ verify_failed:
     return -EINVAL;
 }
 
-static int read_file_fragment(struct shim_handle* file, void* buf, size_t size, file_off_t offset) {
+/* Reads up to `size` bytes at `offset`, returns the number of bytes read. */
+static ssize_t read_file_prefix(struct shim_handle* file, void* buf, size_t size,
+                                file_off_t offset) {
     if (!file)
         return -EINVAL;
 
@@ -557,7 +578,11 @@ static int read_file_fragment(struct shim_handle* file, void* buf, size_t size,
     if (seek_ret < 0)
         return seek_ret;
 
-    ssize_t read_ret = read(file, buf, size);
+    return read(file, buf, size);
+}
+
+static int read_file_fragment(struct shim_handle* file, void* buf, size_t size, file_off_t offset) {
+    ssize_t read_ret = read_file_prefix(file, buf, size, offset);
     if (read_ret < 0)
         return read_ret;
 
@@ -566,16 +591,18 @@ static int read_file_fragment(struct shim_handle* file, void* buf, size_t size,
     return 0;
 }
 
-static int load_elf_header(struct shim_handle* file, ElfW(Ehdr)* ehdr) {
+static int load_elf_header(struct shim_handle* file, struct elf_filebuf* fbp) {
     const char* errstring = NULL;
-    int ret = read_file_fragment(file, ehdr, sizeof(*ehdr), /*offset=*/0);
-    if (ret < 0) {
+    int ret;
+    ssize_t read_ret = read_file_prefix(file, fbp->buf, sizeof(fbp->buf), /*offset=*/0);
+    if (read_ret < (ssize_t)sizeof(fbp->ehdr)) {
         errstring = "Failed to read ELF header from %s";
         ret = -ENOEXEC;
         goto err;
     }
+    fbp->len = read_ret;
 
-    ret = check_elf_header(ehdr);
+    ret = check_elf_header(&fbp->ehdr);
     if (ret < 0) {
         errstring = "%s is not an ELF executable. Please note that Graphene doesn't support "
                     "executing scripts as executables.";
@@ -596,8 +623,8 @@ err:;
 }
 
 int check_elf_object(struct shim_handle* file) {
-    ElfW(Ehdr) ehdr;
-    return load_elf_header(file, &ehdr);
+    struct elf_filebuf fb;
+    return load_elf_header(file, &fb);
 }
 
 int load_elf_object(struct shim_handle* file, struct link_map** out_map) {
@@ -607,11 +634,11 @@ int load_elf_object(struct shim_handle* file, struct link_map** out_map) {
     assert(file);
     log_debug("loading \"%s\"", fname);
 
-    ElfW(Ehdr) ehdr;
-    if ((ret = load_elf_header(file, &ehdr)) < 0)
+    struct elf_filebuf fb;
+    if ((ret = load_elf_header(file, &fb)) < 0)
         return ret;
 
-    struct link_map* map = map_elf_object(file, &ehdr);
+    struct link_map* map = map_elf_object(file, &fb);
     if (!map) {
         log_error("Failed to map %s. This may be caused by the binary being non-PIE, in which "
                   "case Graphene requires a specially-crafted memory layout. You can enable it "
@@ -726,6 +753,40 @@ void remove_loaded_elf_objects(void) {
  */
 
 static void* vdso_addr __attribute_migratable = NULL;
+static spinlock_t vdso_time_data_lock = INIT_SPINLOCK_UNLOCKED;
+
+/* Called after each DkSystemTimeQuery() on the syscall path; most of the time the parameters did
+ * not change and nothing is written. */
+void update_vdso_time_data(void) {
+    if (!vdso_addr)
+        return;
+
+    PAL_TSC_TIME_BASE base;
+    if (DkSystemTimeBaseQuery(&base) < 0)
+        return;
+
+    struct vdso_time_data* data = vdso_addr - VDSO_DATA_SIZE;
+    if (__atomic_load_n(&data->base_tsc, __ATOMIC_RELAXED) == base.base_tsc
+            && __atomic_load_n(&data->tsc_hz, __ATOMIC_RELAXED) == base.tsc_hz) {
+        return;
+    }
+
+    /* some other thread is publishing (about) the same parameters */
+    if (spinlock_trylock(&vdso_time_data_lock))
+        return;
+
+    /* `seq` may be odd if the page was copied to this process in the middle of an update */
+    uint32_t seq = __atomic_load_n(&data->seq, __ATOMIC_RELAXED) | 1;
+    __atomic_store_n(&data->seq, seq, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&data->tsc_hz, base.tsc_hz, __ATOMIC_RELAXED);
+    __atomic_store_n(&data->base_tsc, base.base_tsc, __ATOMIC_RELAXED);
+    __atomic_store_n(&data->base_usec, base.base_usec, __ATOMIC_RELAXED);
+    __atomic_store_n(&data->max_tsc_delta, base.max_tsc_delta, __ATOMIC_RELAXED);
+    __atomic_store_n(&data->seq, seq + 1, __ATOMIC_RELEASE);
+
+    spinlock_unlock(&vdso_time_data_lock);
+}
 
 static int vdso_map_init(void) {
     /*
@@ -734,30 +795,44 @@ static int vdso_map_init(void) {
      * In host child process, LibOS may or may not be loaded at the same address.
      * When LibOS is loaded at different address, it may overlap with the old vDSO
      * area.
+     *
+     * The vDSO image is preceded by a data page (see `struct vdso_time_data`), which the vDSO
+     * reads and LibOS updates.
      */
+    size_t size = VDSO_DATA_SIZE + ALLOC_ALIGN_UP(vdso_so_size);
     void* addr = NULL;
-    int ret = bkeep_mmap_any_aslr(ALLOC_ALIGN_UP(vdso_so_size), PROT_READ | PROT_EXEC,
-                                  MAP_PRIVATE | MAP_ANONYMOUS, NULL, 0, LINUX_VDSO_FILENAME,
-                                  &addr);
+    int ret = bkeep_mmap_any_aslr(size, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, NULL,
+                                  0, LINUX_VDSO_FILENAME, &addr);
+    if (ret < 0) {
+        return ret;
+    }
+    ret = bkeep_mprotect(addr, VDSO_DATA_SIZE, PROT_READ | PROT_WRITE, /*is_internal=*/false);
     if (ret < 0) {
         return ret;
     }
 
-    ret = DkVirtualMemoryAlloc(&addr, ALLOC_ALIGN_UP(vdso_so_size), /*alloc_type=*/0,
-                               PAL_PROT_READ | PAL_PROT_WRITE);
+    ret = DkVirtualMemoryAlloc(&addr, size, /*alloc_type=*/0, PAL_PROT_READ | PAL_PROT_WRITE);
     if (ret < 0) {
         return pal_to_unix_errno(ret);
     }
 
-    memcpy(addr, &vdso_so, vdso_so_size);
-    memset(addr + vdso_so_size, 0, ALLOC_ALIGN_UP(vdso_so_size) - vdso_so_size);
+    void* image = addr + VDSO_DATA_SIZE;
+    memset(addr, 0, VDSO_DATA_SIZE);
+    memcpy(image, &vdso_so, vdso_so_size);
+    memset(image + vdso_so_size, 0, ALLOC_ALIGN_UP(vdso_so_size) - vdso_so_size);
 
-    ret = DkVirtualMemoryProtect(addr, ALLOC_ALIGN_UP(vdso_so_size), PAL_PROT_READ | PAL_PROT_EXEC);
+    ret = DkVirtualMemoryProtect(image, ALLOC_ALIGN_UP(vdso_so_size),
+                                 PAL_PROT_READ | PAL_PROT_EXEC);
     if (ret < 0) {
         return pal_to_unix_errno(ret);
     }
 
-    vdso_addr = addr;
+    vdso_addr = image;
+
+    /* make the vDSO fast path usable right away */
+    uint64_t usec;
+    if (DkSystemTimeQuery(&usec) == 0)
+        update_vdso_time_data();
     return 0;
 }
 
@@ -774,9 +849,8 @@ int init_elf_objects(void) {
         return 0;
 
     if (!g_exec_map) {
-        /* Child processes should have received `g_exec_map` from parent */
-        assert(!g_pal_control->parent_process);
-
+        /* Child processes received `g_exec_map` from parent, unless they were spawned to run a new
+         * executable by the vfork+execve fast path */
         ret = load_elf_object(exec, &g_exec_map);
         if (ret < 0)
             goto out;
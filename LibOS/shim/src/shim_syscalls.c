@@ -3,16 +3,335 @@
  *                    Borys Popławski <borysp@invisiblethingslab.com>
  */
 
+#include "cpu.h"
 #include "shim_defs.h"
 #include "shim_internal.h"
 #include "shim_table.h"
+#include "shim_lock.h"
+#include "shim_process.h"
 #include "shim_tcb.h"
+#include "shim_thread.h"
 #include "shim_types.h"
+#include "shim_utils.h"
+#include "toml.h"
 
 typedef arch_syscall_arg_t (*six_args_syscall_t)(arch_syscall_arg_t, arch_syscall_arg_t,
                                                  arch_syscall_arg_t, arch_syscall_arg_t,
                                                  arch_syscall_arg_t, arch_syscall_arg_t);
 
+/* Per-syscall statistics enabled by `libos.syscall_stats`. Latencies are measured in TSC cycles;
+ * bucket 0 of the histogram counts calls shorter than 2^SYSCALL_STATS_MIN_SHIFT cycles, each next
+ * bucket covers 4 times longer calls and the last one counts all calls longer than that. */
+#define SYSCALL_STATS_BUCKETS   10
+#define SYSCALL_STATS_MIN_SHIFT 10
+
+struct syscall_stats {
+    uint64_t count;
+    uint64_t cycles;
+    uint64_t hist[SYSCALL_STATS_BUCKETS];
+};
+
+static struct syscall_stats g_syscall_stats[LIBOS_SYSCALL_BOUND];
+static bool g_syscall_stats_enabled = false;
+
+/*
+ * Binary syscall trace enabled by `libos.syscall_trace_file`. Each thread collects fixed-size
+ * records in its own buffer (no locking on the syscall path) and appends the whole buffer to
+ * `<path>.<pid>` when it fills up and when the thread exits. The file starts with
+ * `struct syscall_trace_header`, followed by `names_size` bytes of text with one line per known
+ * syscall:
+ *
+ *     <number> <name> <kinds>
+ *
+ * where `<kinds>` is the output of `get_syscall_arg_kinds()` (how to print the return value and
+ * the arguments, taken from the same table as the `trace` log level), and then by the records.
+ * Records of different threads are not ordered; use the timestamps. Decode the file with
+ * `graphene-syscall-trace`.
+ */
+#define SYSCALL_TRACE_MAGIC   "GSYSTRC1"
+#define SYSCALL_TRACE_VERSION 1
+#define SYSCALL_TRACE_RECORDS 512
+
+struct syscall_trace_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t pid;
+    uint32_t names_size;
+    uint64_t tsc_hz; /* 0 if unknown */
+};
+
+struct syscall_trace_record {
+    uint64_t start_tsc;
+    uint64_t end_tsc;
+    uint32_t tid;
+    uint32_t sysno;
+    int64_t ret;
+    uint64_t args[6];
+};
+
+struct syscall_trace_buf {
+    size_t cnt;
+    struct syscall_trace_record records[SYSCALL_TRACE_RECORDS];
+};
+
+static bool g_syscall_trace_enabled = false;
+static char* g_syscall_trace_path = NULL;
+static struct shim_lock g_syscall_trace_lock;
+static PAL_HANDLE g_syscall_trace_handle = NULL; /* opened on first flush, under the lock */
+static uint64_t g_syscall_trace_offset = 0;
+
+static int init_syscall_trace(void) {
+    int ret = toml_string_in(g_manifest_root, "libos.syscall_trace_file", &g_syscall_trace_path);
+    if (ret < 0) {
+        log_error("Cannot parse 'libos.syscall_trace_file' (the value must be put in double "
+                  "quotes!)");
+        return -EINVAL;
+    }
+    if (!g_syscall_trace_path)
+        return 0;
+
+    if (!create_lock(&g_syscall_trace_lock))
+        return -ENOMEM;
+    g_syscall_trace_enabled = true;
+    return 0;
+}
+
+int init_syscall_stats(void) {
+    int ret = toml_bool_in(g_manifest_root, "libos.syscall_stats", /*defaultval=*/false,
+                           &g_syscall_stats_enabled);
+    if (ret < 0) {
+        log_error("Cannot parse 'libos.syscall_stats' (the value must be `true` or `false`)");
+        return -EINVAL;
+    }
+    return init_syscall_trace();
+}
+
+static int write_trace_at(PAL_HANDLE handle, uint64_t offset, const void* buf, size_t size) {
+    while (size) {
+        size_t count = size;
+        int ret = DkStreamWrite(handle, offset, &count, (void*)buf, NULL);
+        if (ret < 0) {
+            if (ret == -PAL_ERROR_INTERRUPTED || ret == -PAL_ERROR_TRYAGAIN)
+                continue;
+            return pal_to_unix_errno(ret);
+        }
+        if (!count)
+            return -EIO;
+        buf = (const char*)buf + count;
+        offset += count;
+        size -= count;
+    }
+    return 0;
+}
+
+/* Creates `<path>.<pid>` and writes the header; the pid is only known after LibOS init, hence not
+ * done in init_syscall_trace(). Returns NULL (and disables the trace) on errors. */
+static PAL_HANDLE get_trace_handle(void) {
+    PAL_HANDLE handle = __atomic_load_n(&g_syscall_trace_handle, __ATOMIC_ACQUIRE);
+    if (handle)
+        return handle;
+
+    char* uri = NULL;
+    char* names = NULL;
+
+    lock(&g_syscall_trace_lock);
+    handle = g_syscall_trace_handle;
+    if (handle || !g_syscall_trace_enabled)
+        goto out;
+
+    size_t uri_size = static_strlen(URI_PREFIX_FILE) + strlen(g_syscall_trace_path) + 16;
+    size_t names_max = LIBOS_SYSCALL_BOUND * 48;
+    uri = malloc(uri_size);
+    names = malloc(names_max);
+    if (!uri || !names)
+        goto fail;
+    snprintf(uri, uri_size, URI_PREFIX_FILE "%s.%u", g_syscall_trace_path, g_process.pid);
+
+    size_t names_size = 0;
+    for (unsigned long i = 0; i < LIBOS_SYSCALL_BOUND; i++) {
+        const char* name = get_syscall_name(i);
+        if (!name)
+            continue;
+        char kinds[8];
+        size_t kinds_cnt = get_syscall_arg_kinds(i, kinds, sizeof(kinds));
+        names_size += snprintf(names + names_size, names_max - names_size, "%lu %s %.*s\n", i,
+                               name, (int)kinds_cnt, kinds);
+        if (names_size >= names_max)
+            goto fail;
+    }
+
+    PAL_TSC_TIME_BASE time_base;
+    struct syscall_trace_header header = {
+        .magic       = SYSCALL_TRACE_MAGIC,
+        .version     = SYSCALL_TRACE_VERSION,
+        .record_size = sizeof(struct syscall_trace_record),
+        .pid         = g_process.pid,
+        .names_size  = names_size,
+        .tsc_hz      = DkSystemTimeBaseQuery(&time_base) < 0 ? 0 : time_base.tsc_hz,
+    };
+
+    PAL_HANDLE new_handle;
+    int ret = DkStreamOpen(uri, PAL_ACCESS_WRONLY, PAL_SHARE_OWNER_R | PAL_SHARE_OWNER_W,
+                           PAL_CREATE_TRY, PAL_OPTION_CLOEXEC, &new_handle);
+    if (ret < 0) {
+        log_error("Cannot open syscall trace file %s: %ld", uri, pal_to_unix_errno(ret));
+        goto fail;
+    }
+    ret = DkStreamSetLength(new_handle, 0);
+    if (ret >= 0)
+        ret = write_trace_at(new_handle, 0, &header, sizeof(header));
+    if (ret >= 0)
+        ret = write_trace_at(new_handle, sizeof(header), names, names_size);
+    if (ret < 0) {
+        log_error("Cannot write syscall trace file %s: %d", uri, ret);
+        DkObjectClose(new_handle);
+        goto fail;
+    }
+
+    g_syscall_trace_offset = sizeof(header) + names_size;
+    handle = new_handle;
+    __atomic_store_n(&g_syscall_trace_handle, handle, __ATOMIC_RELEASE);
+    goto out;
+
+fail:
+    g_syscall_trace_enabled = false;
+out:
+    unlock(&g_syscall_trace_lock);
+    free(names);
+    free(uri);
+    return handle;
+}
+
+/* Appends the records collected by `thread` to the trace file; called by `thread` itself or when
+ * nobody else can access it any more. */
+void syscall_trace_flush(struct shim_thread* thread) {
+    struct syscall_trace_buf* buf = thread->syscall_trace;
+    if (!buf || !buf->cnt)
+        return;
+
+    PAL_HANDLE handle = get_trace_handle();
+    if (handle) {
+        size_t size = buf->cnt * sizeof(buf->records[0]);
+        uint64_t offset = __atomic_fetch_add(&g_syscall_trace_offset, size, __ATOMIC_RELAXED);
+        int ret = write_trace_at(handle, offset, buf->records, size);
+        if (ret < 0)
+            log_warning("Writing syscall trace failed: %d", ret);
+    }
+    buf->cnt = 0;
+}
+
+static void trace_syscall(unsigned long sysnr, uint64_t start_tsc, arch_syscall_arg_t ret,
+                          const arch_syscall_arg_t* args) {
+    uint64_t end_tsc = get_tsc();
+    struct shim_thread* cur_thread = get_cur_thread();
+    if (!cur_thread)
+        return;
+
+    struct syscall_trace_buf* buf = cur_thread->syscall_trace;
+    if (!buf) {
+        buf = malloc(sizeof(*buf));
+        if (!buf)
+            return;
+        buf->cnt = 0;
+        cur_thread->syscall_trace = buf;
+    }
+
+    struct syscall_trace_record* record = &buf->records[buf->cnt++];
+    record->start_tsc = start_tsc;
+    record->end_tsc   = end_tsc;
+    record->tid       = cur_thread->tid;
+    record->sysno     = sysnr;
+    record->ret       = ret;
+    for (size_t i = 0; i < ARRAY_SIZE(record->args); i++)
+        record->args[i] = args[i];
+
+    if (buf->cnt == SYSCALL_TRACE_RECORDS)
+        syscall_trace_flush(cur_thread);
+}
+
+static void account_syscall(unsigned long sysnr, uint64_t cycles) {
+    size_t bucket = 0;
+    if (cycles >> SYSCALL_STATS_MIN_SHIFT) {
+        bucket = (63 - __builtin_clzl(cycles) - SYSCALL_STATS_MIN_SHIFT) / 2 + 1;
+        bucket = MIN(bucket, (size_t)SYSCALL_STATS_BUCKETS - 1);
+    }
+
+    struct syscall_stats* stats = &g_syscall_stats[sysnr];
+    __atomic_add_fetch(&stats->count, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&stats->cycles, cycles, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&stats->hist[bucket], 1, __ATOMIC_RELAXED);
+}
+
+static size_t print_syscall_stats_to(char* str, size_t max) {
+    size_t len = snprintf(str, max, "# syscall calls cycles avg_cycles | calls with latency <1K <4K"
+                          " <16K <64K <256K <1M <4M <16M <64M >=64M cycles\n");
+    for (size_t i = 0; i < LIBOS_SYSCALL_BOUND && len < max; i++) {
+        struct syscall_stats* stats = &g_syscall_stats[i];
+        uint64_t count = __atomic_load_n(&stats->count, __ATOMIC_RELAXED);
+        if (!count)
+            continue;
+
+        uint64_t cycles = __atomic_load_n(&stats->cycles, __ATOMIC_RELAXED);
+        const char* name = get_syscall_name(i);
+        if (name) {
+            len += snprintf(str + len, max - len, "%s", name);
+        } else {
+            len += snprintf(str + len, max - len, "syscall_%lu", i);
+        }
+        if (len < max)
+            len += snprintf(str + len, max - len, " %lu %lu %lu |", count, cycles, cycles / count);
+        for (size_t j = 0; j < SYSCALL_STATS_BUCKETS && len < max; j++) {
+            len += snprintf(str + len, max - len, " %lu",
+                            __atomic_load_n(&stats->hist[j], __ATOMIC_RELAXED));
+        }
+        if (len < max)
+            len += snprintf(str + len, max - len, "\n");
+    }
+    return len;
+}
+
+/* Returns a newly allocated summary of per-syscall statistics (used for
+ * `/proc/graphene/syscalls`, which only has the header line if the stats are disabled). */
+int get_syscall_stats(char** out_data, size_t* out_size) {
+    size_t max = 4096;
+    while (true) {
+        char* str = malloc(max);
+        if (!str)
+            return -ENOMEM;
+
+        size_t len = print_syscall_stats_to(str, max);
+        if (len < max) {
+            *out_data = str;
+            *out_size = len;
+            return 0;
+        }
+
+        /* stats may change between the tries, leave some room for that */
+        free(str);
+        max = len + 256;
+    }
+}
+
+void print_syscall_stats(void) {
+    if (!g_syscall_stats_enabled)
+        return;
+
+    char* str;
+    size_t size;
+    int ret = get_syscall_stats(&str, &size);
+    if (ret < 0) {
+        log_warning("Getting syscall stats failed: %d", ret);
+        return;
+    }
+
+    /* strip the last newline, log_always() adds one */
+    if (size && str[size - 1] == '\n')
+        str[size - 1] = '\0';
+    log_always("----- Syscall stats -----\n%s", str);
+    free(str);
+}
+
 /*
  * `context` is expected to be placed at the bottom of Graphene-internal stack.
  * If you change this function please also look at `shim_do_rt_sigsuspend`!
@@ -33,7 +352,15 @@ noreturn void shim_emulate_syscall(PAL_CONTEXT* context) {
     six_args_syscall_t syscall_func = (six_args_syscall_t)shim_table[sysnr];
 
     debug_print_syscall_before(sysnr, ALL_SYSCALL_ARGS(context));
+    /* the arguments are saved before the call, some syscalls (e.g. `rt_sigreturn`) change the
+     * context */
+    arch_syscall_arg_t trace_args[6] = {ALL_SYSCALL_ARGS(context)};
+    uint64_t start_tsc = g_syscall_stats_enabled || g_syscall_trace_enabled ? get_tsc() : 0;
     ret = syscall_func(ALL_SYSCALL_ARGS(context));
+    if (g_syscall_stats_enabled)
+        account_syscall(sysnr, get_tsc() - start_tsc);
+    if (g_syscall_trace_enabled)
+        trace_syscall(sysnr, start_tsc, ret, trace_args);
     debug_print_syscall_after(sysnr, ret, ALL_SYSCALL_ARGS(context));
 
 out:
@@ -14,6 +14,7 @@
 #include "shim_lock.h"
 #include "shim_process.h"
 #include "shim_sync.h"
+#include "shim_utils.h"
 
 #define FATAL(fmt...)                                   \
     do {                                                \
@@ -21,6 +22,12 @@
         DkProcessExit(1);                               \
     } while (0)
 
+/* Bounds of the adaptive lease hold time (see `sync_handle.hold_us`). */
+#define SYNC_HOLD_MIN_US 50
+#define SYNC_HOLD_MAX_US 2000
+/* Re-requesting a handle this soon after the server took it away counts as ping-pong. */
+#define SYNC_PINGPONG_US 10000
+
 static bool g_sync_enabled = false;
 
 static struct sync_handle* g_client_handles = NULL;
@@ -109,6 +116,65 @@ static void sync_downgrade(struct sync_handle* handle) {
     handle->server_req_state = SYNC_STATE_NONE;
 }
 
+static uint64_t sync_time(void) {
+    uint64_t now = 0;
+    if (DkSystemTimeQuery(&now) < 0)
+        FATAL("querying time");
+    return now;
+}
+
+static void sync_downgrade_timer(IDTYPE caller, void* arg);
+
+/* Handle a downgrade requested by the server while the handle is not used: downgrade right away, or
+ * keep the lease until its hold time ends. */
+static void sync_downgrade_or_defer(struct sync_handle* handle) {
+    assert(locked(&handle->prop_lock));
+
+    uint64_t now = 0;
+    if (handle->hold_us) {
+        now = sync_time();
+        uint64_t hold_end = handle->acquired_time + handle->hold_us;
+        if (now < hold_end) {
+            if (handle->downgrade_timer)
+                return;
+            get_sync_handle(handle);
+            if (install_async_timer(hold_end - now, &sync_downgrade_timer, handle) == 0) {
+                handle->downgrade_deferred = true;
+                handle->downgrade_timer = true;
+                return;
+            }
+            /* No timer, cannot defer. The caller holds a reference, so this one is not the last. */
+            put_sync_handle(handle);
+        }
+
+        if (handle->downgrade_deferred && !handle->used_while_deferred) {
+            /* Nobody needed the handle while we kept it. */
+            handle->hold_us /= 2;
+            if (handle->hold_us < SYNC_HOLD_MIN_US)
+                handle->hold_us = 0;
+        }
+    }
+    handle->downgrade_deferred = false;
+    handle->used_while_deferred = false;
+
+    sync_downgrade(handle);
+    handle->downgraded_time = now ?: sync_time();
+}
+
+static void sync_downgrade_timer(IDTYPE caller, void* arg) {
+    __UNUSED(caller);
+    struct sync_handle* handle = arg;
+
+    lock(&handle->prop_lock);
+    handle->downgrade_timer = false;
+    if (handle->phase == SYNC_PHASE_OPEN && !handle->used
+            && handle->server_req_state != SYNC_STATE_NONE
+            && handle->server_req_state < handle->cur_state)
+        sync_downgrade_or_defer(handle);
+    unlock(&handle->prop_lock);
+    put_sync_handle(handle);
+}
+
 static void update_handle_data(struct sync_handle* handle, size_t data_size, void* data) {
     assert(locked(&handle->prop_lock));
     assert(data_size > 0);
@@ -141,6 +207,10 @@ int init_sync_client(void) {
     return 0;
 }
 
+bool sync_is_enabled(void) {
+    return g_sync_enabled;
+}
+
 static int sync_init(struct sync_handle* handle, uint64_t id) {
     int ret;
 
@@ -172,6 +242,11 @@ static int sync_init(struct sync_handle* handle, uint64_t id) {
     handle->server_req_state = SYNC_STATE_NONE;
     handle->used = false;
 
+    handle->hold_us = 0;
+    handle->downgrade_deferred = false;
+    handle->downgrade_timer = false;
+    handle->used_while_deferred = false;
+
     REF_SET(handle->ref_count, 1);
 
     lock_client();
@@ -274,7 +349,16 @@ bool sync_lock(struct sync_handle* handle, int state, void* data, size_t data_si
 
     bool updated = false;
 
+    if (handle->downgrade_deferred)
+        handle->used_while_deferred = true;
+
     if (handle->cur_state < state) {
+        if (handle->downgraded_time && sync_time() - handle->downgraded_time < SYNC_PINGPONG_US) {
+            /* We gave the handle away and need it back already, keep it longer next time. */
+            handle->hold_us = MIN(MAX(handle->hold_us * 2, (uint64_t)SYNC_HOLD_MIN_US),
+                                  (uint64_t)SYNC_HOLD_MAX_US);
+        }
+
         do {
             if (handle->phase == SYNC_PHASE_CLOSING || handle->phase == SYNC_PHASE_CLOSED)
                 FATAL("sync_lock() on a closed handle");
@@ -317,7 +401,7 @@ void sync_unlock(struct sync_handle* handle, void* data, size_t data_size) {
     handle->used = false;
     if (handle->phase == SYNC_PHASE_OPEN && handle->server_req_state < handle->cur_state
             && handle->server_req_state != SYNC_STATE_NONE)
-        sync_downgrade(handle);
+        sync_downgrade_or_defer(handle);
     unlock(&handle->prop_lock);
     unlock(&handle->use_lock);
 }
@@ -383,7 +467,7 @@ static void do_request_downgrade(uint64_t id, int state) {
             && (handle->server_req_state > state || handle->server_req_state == SYNC_STATE_NONE)) {
         handle->server_req_state = state;
         if (!handle->used)
-            sync_downgrade(handle);
+            sync_downgrade_or_defer(handle);
     }
     unlock(&handle->prop_lock);
     put_sync_handle(handle);
@@ -398,6 +482,8 @@ static void do_confirm_upgrade(uint64_t id, int state, size_t data_size, void* d
     if (handle->phase == SYNC_PHASE_OPEN && handle->cur_state < state) {
         handle->cur_state = state;
         handle->client_req_state = SYNC_STATE_NONE;
+        if (handle->hold_us)
+            handle->acquired_time = sync_time();
         sync_notify(handle);
     }
 
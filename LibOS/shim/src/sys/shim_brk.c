@@ -5,11 +5,21 @@
 
 /*
  * Implementation of system call "brk".
+ *
+ * The whole brk area (up to `sys.brk.max_size`) is reserved at startup as an unmapped "heap" VMA.
+ * Memory is committed (allocated in the PAL) in steps of at least BRK_COMMIT_CHUNK, so that glibc
+ * malloc growing the heap in small increments does not need a PAL allocation (with EDMM, adding
+ * and accepting enclave pages) each time. Committed memory above the brk is kept inaccessible
+ * (PROT_NONE), as on Linux; moving the brk within the committed part only changes permissions
+ * (with EDMM, extending them is done by the enclave alone). Shrinking keeps up to BRK_COMMIT_CHUNK
+ * committed above the new brk. The part given up by the application is discarded (released to the
+ * host where the PAL supports it, zeroed otherwise), as fresh brk memory must read as zeros.
  */
 
 #include <sys/mman.h>
 
 #include "pal.h"
+#include "pal_error.h"
 #include "shim_checkpoint.h"
 #include "shim_internal.h"
 #include "shim_lock.h"
@@ -18,15 +28,21 @@
 #include "shim_vma.h"
 #include "toml.h"
 
+#define BRK_COMMIT_CHUNK (1024 * 1024)
+
 static struct {
     size_t data_segment_size;
     char* brk_start;
     char* brk_current;
+    char* brk_committed; /* end of the committed part, allocation-aligned */
     char* brk_end;
 } brk_region;
 
 static struct shim_lock brk_lock;
 
+/* Set once the PAL turns out to be unable to release memory (e.g. SGX without EDMM). */
+static bool g_brk_discard_unsupported = false;
+
 int init_brk_region(void* brk_start, size_t data_segment_size) {
     int ret;
 
@@ -107,6 +123,7 @@ int init_brk_region(void* brk_start, size_t data_segment_size) {
 
     brk_region.brk_start         = brk_start;
     brk_region.brk_current       = brk_region.brk_start;
+    brk_region.brk_committed     = brk_region.brk_start;
     brk_region.brk_end           = (char*)brk_start + brk_max_size;
     brk_region.data_segment_size = data_segment_size;
 
@@ -119,7 +136,7 @@ void reset_brk(void) {
     lock(&brk_lock);
 
     void* tmp_vma = NULL;
-    size_t allocated_size = ALLOC_ALIGN_UP_PTR(brk_region.brk_current) - brk_region.brk_start;
+    size_t allocated_size = brk_region.brk_committed - brk_region.brk_start;
     if (bkeep_munmap(brk_region.brk_start, brk_region.brk_end - brk_region.brk_start,
                      /*is_internal=*/false, &tmp_vma) < 0) {
         BUG();
@@ -134,6 +151,7 @@ void reset_brk(void) {
 
     brk_region.brk_start         = NULL;
     brk_region.brk_current       = NULL;
+    brk_region.brk_committed     = NULL;
     brk_region.brk_end           = NULL;
     brk_region.data_segment_size = 0;
     unlock(&brk_lock);
@@ -141,61 +159,147 @@ void reset_brk(void) {
     destroy_lock(&brk_lock);
 }
 
+/* Releases the committed memory above `new_end`; the caller holds `brk_lock`. */
+static int uncommit_brk(char* new_end) {
+    int ret = bkeep_mmap_fixed(new_end, brk_region.brk_end - new_end, PROT_NONE,
+                               MAP_FIXED | VMA_UNMAPPED, NULL, 0, "heap");
+    if (ret < 0)
+        return ret;
+
+    if (DkVirtualMemoryFree(new_end, brk_region.brk_committed - new_end) < 0) {
+        BUG();
+    }
+    brk_region.brk_committed = new_end;
+    return 0;
+}
+
+/* Makes committed memory in [addr, end) accessible or not; the caller holds `brk_lock`. */
+static int protect_brk(char* addr, char* end, bool accessible) {
+    int prot     = accessible ? PROT_READ | PROT_WRITE : PROT_NONE;
+    int old_prot = accessible ? PROT_NONE : PROT_READ | PROT_WRITE;
+    int ret = bkeep_mprotect(addr, end - addr, prot, /*is_internal=*/false);
+    if (ret < 0)
+        return ret;
+
+    ret = DkVirtualMemoryProtect(addr, end - addr,
+                                 accessible ? PAL_PROT_READ | PAL_PROT_WRITE : PAL_PROT_NONE);
+    if (ret < 0) {
+        if (bkeep_mprotect(addr, end - addr, old_prot, /*is_internal=*/false) < 0) {
+            BUG();
+        }
+        return pal_to_unix_errno(ret);
+    }
+    return 0;
+}
+
+/* Makes committed memory in [addr, end) inaccessible, or releases all committed memory above `addr`
+ * if that fails; the caller holds `brk_lock`. */
+static int hide_brk(char* addr, char* end) {
+    if (protect_brk(addr, end, /*accessible=*/false) == 0)
+        return 0;
+    return uncommit_brk(addr);
+}
+
+/* Commits `size` bytes at `brk_region.brk_committed`, of which only the part below
+ * `accessible_end` is accessible; the caller holds `brk_lock`. */
+static int commit_brk(size_t size, char* accessible_end) {
+    char* addr = brk_region.brk_committed;
+    char* end  = addr + size;
+    assert(addr < accessible_end && accessible_end <= end);
+
+    int ret = bkeep_mmap_fixed(addr, size, PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, NULL, 0, "heap");
+    if (ret < 0)
+        return ret;
+
+    ret = DkVirtualMemoryAlloc((void**)&addr, size, 0, PAL_PROT_READ | PAL_PROT_WRITE);
+    if (ret < 0) {
+        if (bkeep_mmap_fixed(addr, brk_region.brk_end - addr, PROT_NONE,
+                             MAP_FIXED | VMA_UNMAPPED, NULL, 0, "heap") < 0) {
+            BUG();
+        }
+        return pal_to_unix_errno(ret);
+    }
+    brk_region.brk_committed = end;
+
+    /* the PAL may not allocate inaccessible memory (e.g. SGX, where committed pages get full
+     * permissions), so the part above the brk is restricted afterwards; if even that fails, the
+     * memory stays accessible, which is harmless as it is still zero */
+    if (accessible_end < end)
+        (void)hide_brk(accessible_end, end);
+    return 0;
+}
+
+/* Zeroes memory in [addr, end) given up by the application, releasing it to the host if the PAL
+ * supports that; the caller holds `brk_lock`. */
+static void discard_brk(char* addr, char* end) {
+    if (!g_brk_discard_unsupported) {
+        int ret = DkVirtualMemoryDiscard(addr, end - addr, PAL_PROT_READ | PAL_PROT_WRITE);
+        if (ret == 0)
+            return;
+        if (ret == -PAL_ERROR_NOTIMPLEMENTED)
+            g_brk_discard_unsupported = true;
+    }
+    memset(addr, 0, end - addr);
+}
+
 void* shim_do_brk(void* _brk) {
     char* brk = _brk;
-    size_t size = 0;
     char* brk_aligned = ALLOC_ALIGN_UP_PTR(brk);
 
     lock(&brk_lock);
 
     char* brk_current = ALLOC_ALIGN_UP_PTR(brk_region.brk_current);
 
-    if (brk < brk_region.brk_start) {
+    if (brk < brk_region.brk_start || brk > brk_region.brk_end) {
         goto out;
     } else if (brk <= brk_current) {
-        size = brk_current - brk_aligned;
-
-        if (size) {
-            if (bkeep_mmap_fixed(brk_aligned, brk_region.brk_end - brk_aligned, PROT_NONE,
-                                 MAP_FIXED | VMA_UNMAPPED, NULL, 0, "heap")) {
+        char* keep_end = brk_region.brk_committed;
+        if ((size_t)(keep_end - brk_aligned) > BRK_COMMIT_CHUNK) {
+            keep_end = brk_aligned + BRK_COMMIT_CHUNK;
+            if (uncommit_brk(keep_end) < 0) {
                 goto out;
             }
-
-            if (DkVirtualMemoryFree(brk_aligned, size) < 0) {
-                BUG();
-            }
+        }
+        /* the committed memory above `brk_current` is already zero and inaccessible; if it cannot
+         * be made inaccessible here, the zeroed memory simply stays accessible */
+        char* used_end = MIN(brk_current, keep_end);
+        if (brk_aligned < used_end) {
+            discard_brk(brk_aligned, used_end);
+            (void)hide_brk(brk_aligned, used_end);
         }
 
         brk_region.brk_current = brk;
         goto out;
-    } else if (brk > brk_region.brk_end) {
-        goto out;
     }
 
     uint64_t rlim_data = get_rlimit_cur(RLIMIT_DATA);
-    size = brk_aligned - brk_region.brk_start;
+    size_t size = brk_aligned - brk_region.brk_start;
 
     if (rlim_data < brk_region.data_segment_size
             || rlim_data - brk_region.data_segment_size < size) {
         goto out;
     }
 
-    size = brk_aligned - brk_current;
-    /* brk_aligned >= brk > brk_current */
-    assert(size);
-
-    if (bkeep_mmap_fixed(brk_current, size, PROT_READ | PROT_WRITE,
-                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, NULL, 0, "heap") < 0) {
-        goto out;
+    char* committed = brk_region.brk_committed;
+    char* exposed_end = MIN(brk_aligned, committed);
+    if (brk_current < exposed_end) {
+        if (protect_brk(brk_current, exposed_end, /*accessible=*/true) < 0) {
+            goto out;
+        }
     }
 
-    int ret = DkVirtualMemoryAlloc((void**)&brk_current, size, 0, PAL_PROT_READ | PAL_PROT_WRITE);
-    if (ret < 0) {
-        if (bkeep_mmap_fixed(brk_current, brk_region.brk_end - brk_current, PROT_NONE,
-                             MAP_FIXED | VMA_UNMAPPED, NULL, 0, "heap") < 0) {
-            BUG();
+    if (brk_aligned > committed) {
+        size_t needed = brk_aligned - committed;
+        size_t chunk = MIN(MAX(needed, (size_t)BRK_COMMIT_CHUNK),
+                           (size_t)(brk_region.brk_end - committed));
+        /* close to the memory limit (e.g. the enclave size), the whole chunk may not fit */
+        if (commit_brk(chunk, brk_aligned) < 0
+                && (chunk == needed || commit_brk(needed, brk_aligned) < 0)) {
+            if (brk_current < exposed_end)
+                (void)hide_brk(brk_current, exposed_end);
+            goto out;
         }
-        goto out;
     }
 
     brk_region.brk_current = brk;
@@ -214,6 +318,7 @@ BEGIN_CP_FUNC(brk) {
     ADD_CP_ENTRY(SIZE, brk_region.brk_current - brk_region.brk_start);
     ADD_CP_ENTRY(SIZE, brk_region.brk_end - brk_region.brk_start);
     ADD_CP_ENTRY(SIZE, brk_region.data_segment_size);
+    ADD_CP_ENTRY(SIZE, brk_region.brk_committed - brk_region.brk_start);
 }
 END_CP_FUNC(brk)
 
@@ -223,5 +328,6 @@ BEGIN_RS_FUNC(brk) {
     brk_region.brk_current       = brk_region.brk_start + GET_CP_ENTRY(SIZE);
     brk_region.brk_end           = brk_region.brk_start + GET_CP_ENTRY(SIZE);
     brk_region.data_segment_size = GET_CP_ENTRY(SIZE);
+    brk_region.brk_committed     = brk_region.brk_start + GET_CP_ENTRY(SIZE);
 }
 END_RS_FUNC(brk)
@@ -17,6 +17,7 @@
 #include "shim_internal.h"
 #include "shim_ipc.h"
 #include "shim_lock.h"
+#include "shim_process.h"
 #include "shim_table.h"
 #include "shim_thread.h"
 #include "shim_types.h"
@@ -276,6 +277,11 @@ long shim_do_clone(unsigned long flags, unsigned long user_stack_addr, int* pare
     }
 
     if (flags & CLONE_VFORK) {
+        if (can_use_vfork_fast_path(flags)) {
+            return vfork_fast_path_begin(flags, user_stack_addr,
+                                         (flags & CLONE_PARENT_SETTID) ? parent_tidptr : NULL);
+        }
+
         /* Instead of trying to support Linux semantics for vfork() -- which requires adding
          * corner-cases in signal handling and syscalls -- we simply treat vfork() as fork(). We
          * assume that performance hit is negligible (Graphene has to migrate internal state anyway
@@ -29,11 +29,199 @@
 #define EPOLLRDHUP  0x2000
 #endif
 
-/* TODO: 1024 handles/FDs is a small number for high-load servers (e.g., Linux has ~3M) */
+/* TODO: 1024 handles/FDs is a small number for high-load servers (e.g., Linux has ~3M); the limit
+ * does not apply to epolls backed by a PAL wait set */
 #define MAX_EPOLL_HANDLES 1024
 
+/* Upper bound on events fetched from a PAL wait set at once. */
+#define MAX_WAITSET_EVENTS 1024
+
 struct shim_fs epoll_builtin_fs;
 
+/*
+ * Snapshot of the epoll's monitored PAL handles, in the layout DkStreamsWaitEvents() expects, with
+ * the epoll's own "event" handle last. `items[i]` is the epoll item of `handles[i]`, so the results
+ * map back to items without searching `fds`. The snapshot is rebuilt only when the set of monitored
+ * handles changes; waiters hold a reference while they are blocked in the PAL.
+ */
+struct shim_epoll_pal_set {
+    REFTYPE ref_count;
+    size_t cnt; /* not counting the "event" handle */
+    PAL_HANDLE* handles;
+    struct shim_epoll_item** items;
+    PAL_FLG* events; /* without EPOLLET masking, which changes on every wait */
+    size_t* et_idx;  /* indices of EPOLLET items */
+    size_t et_cnt;
+};
+
+static void put_pal_set(struct shim_epoll_pal_set* set) {
+    if (!REF_DEC(set->ref_count))
+        free(set);
+}
+
+static void invalidate_pal_set(struct shim_epoll_handle* epoll) {
+    if (epoll->pal_set) {
+        put_pal_set(epoll->pal_set);
+        epoll->pal_set = NULL;
+    }
+}
+
+static struct shim_epoll_pal_set* build_pal_set(struct shim_epoll_handle* epoll) {
+    size_t cnt = epoll->fds_count;
+    struct shim_epoll_pal_set* set = malloc(sizeof(*set)
+                                            + (cnt + 1) * sizeof(*set->handles)
+                                            + cnt * sizeof(*set->items)
+                                            + cnt * sizeof(*set->et_idx)
+                                            + (cnt + 1) * sizeof(*set->events));
+    if (!set)
+        return NULL;
+
+    REF_SET(set->ref_count, 1);
+    set->handles = (PAL_HANDLE*)(set + 1);
+    set->items   = (struct shim_epoll_item**)(set->handles + cnt + 1);
+    set->et_idx  = (size_t*)(set->items + cnt);
+    set->events  = (PAL_FLG*)(set->et_idx + cnt);
+    set->cnt     = 0;
+    set->et_cnt  = 0;
+
+    struct shim_epoll_item* epoll_item;
+    LISTP_FOR_EACH_ENTRY(epoll_item, &epoll->fds, list) {
+        assert(epoll_item->handle != NULL);
+        /* note that pipe and socket may not have pal_handle yet (e.g. before bind()) */
+        if (!epoll_item->handle->pal_handle)
+            continue;
+
+        size_t i = set->cnt++;
+        set->handles[i] = epoll_item->handle->pal_handle;
+        set->items[i]   = epoll_item;
+        set->events[i]  = (epoll_item->events & (EPOLLIN | EPOLLRDNORM)) ? PAL_WAIT_READ : 0;
+        set->events[i] |= (epoll_item->events & (EPOLLOUT | EPOLLWRNORM)) ? PAL_WAIT_WRITE : 0;
+        if (epoll_item->events & EPOLLET)
+            set->et_idx[set->et_cnt++] = i;
+    }
+    assert(set->cnt <= cnt);
+
+    /* "event" handle waits on read (meaning epoll-update signal arrived) */
+    set->handles[set->cnt] = epoll->event.event;
+    set->events[set->cnt]  = PAL_WAIT_READ;
+    return set;
+}
+
+/* Returns a reference to an up-to-date snapshot of `epoll`, building it if necessary. */
+static struct shim_epoll_pal_set* get_pal_set(struct shim_epoll_handle* epoll) {
+    if (__atomic_exchange_n(&epoll->pal_set_stale, false, __ATOMIC_ACQ_REL))
+        invalidate_pal_set(epoll);
+
+    if (!epoll->pal_set) {
+        epoll->pal_set = build_pal_set(epoll);
+        if (!epoll->pal_set)
+            return NULL;
+    }
+
+    REF_INC(epoll->pal_set->ref_count);
+    return epoll->pal_set;
+}
+
+static void add_item_revents(struct shim_epoll_handle* epoll, struct shim_epoll_item* epoll_item,
+                             unsigned int revents) {
+    if (!revents)
+        return;
+    if (!epoll_item->revents) {
+        INIT_LIST_HEAD(epoll_item, ready);
+        LISTP_ADD_TAIL(epoll_item, &epoll->ready, ready);
+    }
+    epoll_item->revents |= revents;
+}
+
+static void clear_item_revents(struct shim_epoll_handle* epoll, struct shim_epoll_item* epoll_item,
+                               unsigned int revents) {
+    if (!epoll_item->revents)
+        return;
+    epoll_item->revents &= ~revents;
+    if (!epoll_item->revents)
+        LISTP_DEL(epoll_item, &epoll->ready, ready);
+}
+
+static PAL_FLG epoll_item_pal_events(struct shim_epoll_item* epoll_item) {
+    PAL_FLG events = (epoll_item->events & (EPOLLIN | EPOLLRDNORM)) ? PAL_WAIT_READ : 0;
+    events |= (epoll_item->events & (EPOLLOUT | EPOLLWRNORM)) ? PAL_WAIT_WRITE : 0;
+    /* the host reports each new readiness once, which is what EPOLLET asks for */
+    if (events && (epoll_item->events & EPOLLET))
+        events |= PAL_WAIT_EDGE;
+    return mem_pipe_pal_events(epoll_item->handle, events);
+}
+
+static void disable_waitset(struct shim_epoll_handle* epoll) {
+    /* `pal_waitset` itself stays until the epoll is closed, current waiters may still use it */
+    epoll->use_waitset = false;
+    invalidate_pal_set(epoll);
+}
+
+/* (Re-)registers the current PAL handle of `epoll_item` in the epoll's wait set. */
+static void waitset_register(struct shim_epoll_handle* epoll, struct shim_epoll_item* epoll_item) {
+    if (!epoll->use_waitset)
+        return;
+
+    /* note that pipe and socket may not have pal_handle yet (e.g. before bind()) */
+    PAL_HANDLE pal_handle = epoll_item->handle->pal_handle;
+    epoll_item->pal_registered = NULL;
+    if (!pal_handle)
+        return;
+
+    int ret = DkWaitSetUpdate(epoll->pal_waitset, pal_handle, epoll_item_pal_events(epoll_item),
+                              (PAL_NUM)(uintptr_t)epoll_item);
+    if (ret < 0) {
+        log_debug("cannot add handle to PAL wait set (%d), falling back to polling", ret);
+        disable_waitset(epoll);
+        return;
+    }
+    epoll_item->pal_registered = pal_handle;
+}
+
+static void waitset_unregister(struct shim_epoll_handle* epoll, struct shim_epoll_item* epoll_item) {
+    /* a PAL handle replaced in the meantime was already closed (and so dropped by the host) */
+    if (epoll->use_waitset && epoll_item->pal_registered
+            && epoll_item->pal_registered == epoll_item->handle->pal_handle) {
+        DkWaitSetUpdate(epoll->pal_waitset, epoll_item->pal_registered, 0, 0);
+    }
+    epoll_item->pal_registered = NULL;
+}
+
+/* Frees an item already unlinked from `fds` (and `ready`). */
+static void free_epoll_item(struct shim_epoll_handle* epoll, struct shim_epoll_item* epoll_item) {
+    if (epoll->pal_waitset && __atomic_load_n(&epoll->waiter_cnt, __ATOMIC_RELAXED)) {
+        /* a waiter may still get this item as a cookie from the wait set */
+        epoll_item->handle = NULL;
+        INIT_LIST_HEAD(epoll_item, list);
+        LISTP_ADD(epoll_item, &epoll->removed, list);
+        return;
+    }
+    free(epoll_item);
+}
+
+static void free_removed_epoll_items(struct shim_epoll_handle* epoll) {
+    struct shim_epoll_item* epoll_item;
+    struct shim_epoll_item* tmp_epoll_item;
+    LISTP_FOR_EACH_ENTRY_SAFE(epoll_item, tmp_epoll_item, &epoll->removed, list) {
+        LISTP_DEL(epoll_item, &epoll->removed, list);
+        free(epoll_item);
+    }
+}
+
+void create_epoll_waitset(struct shim_epoll_handle* epoll) {
+    assert(!epoll->pal_waitset);
+
+    /* cookie 0 stands for the "event" handle which signals epoll updates */
+    if (DkWaitSetCreate(&epoll->pal_waitset) == 0) {
+        if (DkWaitSetUpdate(epoll->pal_waitset, epoll->event.event, PAL_WAIT_READ, 0) == 0) {
+            epoll->use_waitset = true;
+        } else {
+            DkObjectClose(epoll->pal_waitset);
+            epoll->pal_waitset = NULL;
+        }
+    }
+}
+
 long shim_do_epoll_create1(int flags) {
     if ((flags & ~EPOLL_CLOEXEC))
         return -EINVAL;
@@ -49,6 +237,12 @@ long shim_do_epoll_create1(int flags) {
     epoll->fds_count = 0;
     __atomic_store_n(&epoll->waiter_cnt, 0, __ATOMIC_RELAXED);
     INIT_LISTP(&epoll->fds);
+    INIT_LISTP(&epoll->ready);
+    epoll->pal_set = NULL;
+    epoll->pal_set_stale = false;
+    epoll->pal_waitset = NULL;
+    epoll->use_waitset = false;
+    INIT_LISTP(&epoll->removed);
 
     int ret = create_event(&epoll->event);
     if (ret < 0) {
@@ -56,6 +250,8 @@ long shim_do_epoll_create1(int flags) {
         return ret;
     }
 
+    create_epoll_waitset(epoll);
+
     int vfd = set_new_fd_handle(hdl, (flags & EPOLL_CLOEXEC) ? FD_CLOEXEC : 0, NULL);
     put_handle(hdl);
     return vfd;
@@ -87,7 +283,24 @@ void _update_epolls(struct shim_handle* handle) {
 
     struct shim_epoll_item* epoll_item;
     LISTP_FOR_EACH_ENTRY(epoll_item, &handle->epolls, back) {
-        notify_epoll_waiters(&epoll_item->epoll->info.epoll);
+        struct shim_epoll_handle* epoll = &epoll_item->epoll->info.epoll;
+        /* we can't take the epoll lock here (it nests outside of handle locks), so the snapshot is
+         * only marked stale and rebuilt by the next waiter */
+        __atomic_store_n(&epoll->pal_set_stale, true, __ATOMIC_RELEASE);
+        notify_epoll_waiters(epoll);
+    }
+}
+
+void _forget_epoll_pal_handle(struct shim_handle* handle, PAL_HANDLE pal_handle) {
+    assert(locked(&handle->lock));
+
+    struct shim_epoll_item* epoll_item;
+    LISTP_FOR_EACH_ENTRY(epoll_item, &handle->epolls, back) {
+        struct shim_epoll_handle* epoll = &epoll_item->epoll->info.epoll;
+        /* the wait set lives as long as the epoll and removing an unregistered handle is harmless,
+         * so the epoll lock (which nests outside of handle locks) is not needed */
+        if (epoll->pal_waitset)
+            DkWaitSetUpdate(epoll->pal_waitset, pal_handle, 0, 0);
     }
 }
 
@@ -114,28 +327,36 @@ void delete_from_epoll_handles(struct shim_handle* handle) {
         struct shim_epoll_handle* epoll = &hdl->info.epoll;
 
         lock(&hdl->lock);
+        assert(epoll_item->handle == handle);
+        waitset_unregister(epoll, epoll_item);
+        clear_item_revents(epoll, epoll_item, epoll_item->revents);
         LISTP_DEL(epoll_item, &epoll->fds, list);
         epoll->fds_count--;
+        invalidate_pal_set(epoll);
         notify_epoll_waiters(epoll);
+        free_epoll_item(epoll, epoll_item);
         unlock(&hdl->lock);
-
-        assert(epoll_item->handle == handle);
-
-        free(epoll_item);
     }
 }
 
 void maybe_epoll_et_trigger(struct shim_handle* handle, int ret, bool in, bool was_partial) {
-    if (ret == -EAGAIN || ret == -EWOULDBLOCK || was_partial) {
-        if (in) {
-            __atomic_store_n(&handle->needs_et_poll_in, true, __ATOMIC_RELEASE);
-        } else {
-            __atomic_store_n(&handle->needs_et_poll_out, true, __ATOMIC_RELEASE);
-        }
-        lock(&handle->lock);
-        _update_epolls(handle);
-        unlock(&handle->lock);
+    if (ret != -EAGAIN && ret != -EWOULDBLOCK && !was_partial)
+        return;
+
+    /* only the transition to "needs poll" re-arms the handle; in ET loops, which read or write
+     * until -EAGAIN, the handle is usually already armed and there is nobody to wake up */
+    bool* needs_et_poll = in ? &handle->needs_et_poll_in : &handle->needs_et_poll_out;
+    if (__atomic_exchange_n(needs_et_poll, true, __ATOMIC_ACQ_REL))
+        return;
+
+    lock(&handle->lock);
+    struct shim_epoll_item* epoll_item;
+    LISTP_FOR_EACH_ENTRY(epoll_item, &handle->epolls, back) {
+        /* level-triggered registrations don't look at the flags */
+        if (epoll_item->events & EPOLLET)
+            notify_epoll_waiters(&epoll_item->epoll->info.epoll);
     }
+    unlock(&handle->lock);
 }
 
 long shim_do_epoll_ctl(int epfd, int op, int fd, struct __kernel_epoll_event* event) {
@@ -184,7 +405,7 @@ long shim_do_epoll_ctl(int epfd, int op, int fd, struct __kernel_epoll_event* ev
                 put_handle(hdl);
                 goto out;
             }
-            if (epoll->fds_count == MAX_EPOLL_HANDLES) {
+            if (!epoll->use_waitset && epoll->fds_count == MAX_EPOLL_HANDLES) {
                 ret = -ENOSPC;
                 put_handle(hdl);
                 goto out;
@@ -204,6 +425,7 @@ long shim_do_epoll_ctl(int epfd, int op, int fd, struct __kernel_epoll_event* ev
             epoll_item->revents   = 0;
             epoll_item->handle    = hdl;
             epoll_item->epoll     = epoll_hdl;
+            epoll_item->pal_registered = NULL;
 
             if (epoll_item->events & EPOLLET) {
                 __atomic_store_n(&hdl->needs_et_poll_in, true, __ATOMIC_RELEASE);
@@ -214,6 +436,16 @@ long shim_do_epoll_ctl(int epfd, int op, int fd, struct __kernel_epoll_event* ev
              * - bind hdl to epoll-item via the `back` list
              * - bind epoll-item to epoll via the `list` list */
             lock(&hdl->lock);
+            if (epoll->use_waitset) {
+                /* the wait set holds each PAL handle once, so dup-ed FDs need the snapshot */
+                struct shim_epoll_item* other_item;
+                LISTP_FOR_EACH_ENTRY(other_item, &hdl->epolls, back) {
+                    if (other_item->epoll == epoll_hdl) {
+                        disable_waitset(epoll);
+                        break;
+                    }
+                }
+            }
             INIT_LIST_HEAD(epoll_item, back);
             LISTP_ADD_TAIL(epoll_item, &hdl->epolls, back);
             unlock(&hdl->lock);
@@ -222,6 +454,8 @@ long shim_do_epoll_ctl(int epfd, int op, int fd, struct __kernel_epoll_event* ev
             INIT_LIST_HEAD(epoll_item, list);
             LISTP_ADD_TAIL(epoll_item, &epoll->fds, list);
             epoll->fds_count++;
+            waitset_register(epoll, epoll_item);
+            invalidate_pal_set(epoll);
             notify_epoll_waiters(epoll);
 
             put_handle(hdl);
@@ -241,6 +475,8 @@ long shim_do_epoll_ctl(int epfd, int op, int fd, struct __kernel_epoll_event* ev
                     }
 
                     log_debug("modified fd %d at epoll handle %p", fd, epoll);
+                    waitset_register(epoll, epoll_item);
+                    invalidate_pal_set(epoll);
                     notify_epoll_waiters(epoll);
                     goto out;
                 }
@@ -264,11 +500,14 @@ long shim_do_epoll_ctl(int epfd, int op, int fd, struct __kernel_epoll_event* ev
                     unlock(&hdl->lock);
 
                     /* note that we already grabbed epoll_hdl->lock so we can safely update epoll */
+                    waitset_unregister(epoll, epoll_item);
+                    clear_item_revents(epoll, epoll_item, epoll_item->revents);
                     LISTP_DEL(epoll_item, &epoll->fds, list);
                     epoll->fds_count--;
+                    invalidate_pal_set(epoll);
                     notify_epoll_waiters(epoll);
 
-                    free(epoll_item);
+                    free_epoll_item(epoll, epoll_item);
                     goto out;
                 }
             }
@@ -288,6 +527,186 @@ out:
     return ret;
 }
 
+/* Waits on the epoll's snapshot of PAL handles. Called and returns with the epoll lock held. */
+static long wait_on_pal_set(struct shim_handle* epoll_hdl, int timeout_ms, bool* updated,
+                            bool* retry) {
+    struct shim_epoll_handle* epoll = &epoll_hdl->info.epoll;
+
+    struct shim_epoll_pal_set* set = get_pal_set(epoll);
+    if (!set)
+        return -ENOMEM;
+
+    /* one memory region for the arrays passed to the PAL and the indices of their handles in the
+     * snapshot; the arrays hold only handles with something to wait for, so EPOLLET handles that
+     * were already reported (and not re-armed by maybe_epoll_et_trigger()) cost nothing */
+    size_t max_cnt = set->cnt + 1;
+    PAL_HANDLE* pals = malloc(max_cnt * (sizeof(PAL_HANDLE) + sizeof(size_t) + 2 * sizeof(PAL_FLG)));
+    if (!pals) {
+        put_pal_set(set);
+        return -ENOMEM;
+    }
+    size_t* pals_idx = (size_t*)(pals + max_cnt);
+    PAL_FLG* pal_events = (PAL_FLG*)(pals_idx + max_cnt);
+    PAL_FLG* ret_events = pal_events + max_cnt;
+
+    size_t et_pos = 0;
+    size_t pals_cnt = 0;
+    for (size_t i = 0; i < set->cnt; i++) {
+        PAL_FLG events = set->events[i];
+        if (et_pos < set->et_cnt && set->et_idx[et_pos] == i) {
+            struct shim_handle* hdl = set->items[i]->handle;
+            if (!__atomic_load_n(&hdl->needs_et_poll_in, __ATOMIC_ACQUIRE))
+                events &= ~PAL_WAIT_READ;
+            if (!__atomic_load_n(&hdl->needs_et_poll_out, __ATOMIC_ACQUIRE))
+                events &= ~PAL_WAIT_WRITE;
+            et_pos++;
+        }
+        if (!events)
+            continue;
+        pals[pals_cnt]       = set->handles[i];
+        pals_idx[pals_cnt]   = i;
+        pal_events[pals_cnt] = mem_pipe_pal_events(set->items[i]->handle, events);
+        pals_cnt++;
+    }
+    /* the "event" handle goes last */
+    pals[pals_cnt]       = set->handles[set->cnt];
+    pal_events[pals_cnt] = set->events[set->cnt];
+    memset(ret_events, 0, (pals_cnt + 1) * sizeof(PAL_FLG));
+
+    /* mark epoll as being waited on (so epoll-update signal is sent) */
+    __atomic_add_fetch(&epoll->waiter_cnt, 1, __ATOMIC_RELAXED);
+    unlock(&epoll_hdl->lock);
+
+    /* TODO: Timeout must be updated in case of retries; otherwise, we may wait for too long */
+    thread_block_begin();
+    long error = DkStreamsWaitEvents(pals_cnt + 1, pals, pal_events, ret_events,
+                                     timeout_ms * 1000);
+    thread_block_end();
+    bool polled = error == 0;
+    error = pal_to_unix_errno(error);
+
+    lock(&epoll_hdl->lock);
+
+    /* if the snapshot was replaced, its items may have been deleted meanwhile; the results are
+     * dropped and we wait again on the new one */
+    bool set_replaced = epoll->pal_set != set;
+
+    /* update user-supplied epoll items' revents with ret_events of polled PAL handles */
+    if (!ret_events[pals_cnt] && polled && !set_replaced) {
+        /* only if epoll was not updated concurrently and something was actually polled */
+        for (size_t i = 0; i < pals_cnt; i++) {
+            if (!ret_events[i])
+                continue;
+
+            struct shim_epoll_item* epoll_item = set->items[pals_idx[i]];
+            PAL_FLG pal_revents = mem_pipe_pal_events(epoll_item->handle, ret_events[i]);
+            unsigned int revents = 0;
+            if (pal_revents & PAL_WAIT_ERROR)
+                revents |= EPOLLERR | EPOLLHUP | EPOLLRDHUP;
+            if (pal_revents & PAL_WAIT_READ)
+                revents |= EPOLLIN | EPOLLRDNORM;
+            if (pal_revents & PAL_WAIT_WRITE)
+                revents |= EPOLLOUT | EPOLLWRNORM;
+            add_item_revents(epoll, epoll_item, revents);
+        }
+    }
+
+    if (!__atomic_sub_fetch(&epoll->waiter_cnt, 1, __ATOMIC_RELAXED))
+        free_removed_epoll_items(epoll);
+
+    *updated = !!ret_events[pals_cnt];
+    *retry = polled && set_replaced;
+    free(pals);
+    put_pal_set(set);
+    return error;
+}
+
+static bool has_pending_events(struct shim_epoll_handle* epoll) {
+    struct shim_epoll_item* epoll_item;
+    LISTP_FOR_EACH_ENTRY(epoll_item, &epoll->ready, ready) {
+        if (epoll_item->revents & (epoll_item->events | EPOLLERR | EPOLLHUP | EPOLLRDHUP))
+            return true;
+    }
+    return false;
+}
+
+/* Waits on the epoll's PAL wait set, which only returns ready handles. Called and returns with the
+ * epoll lock held. */
+static long wait_on_waitset(struct shim_handle* epoll_hdl, int maxevents, int timeout_ms,
+                            bool* updated, bool* retry) {
+    struct shim_epoll_handle* epoll = &epoll_hdl->info.epoll;
+
+    if (__atomic_exchange_n(&epoll->pal_set_stale, false, __ATOMIC_ACQ_REL)) {
+        /* some monitored handles got new PAL handles, register them */
+        struct shim_epoll_item* epoll_item;
+        LISTP_FOR_EACH_ENTRY(epoll_item, &epoll->fds, list) {
+            if (epoll_item->pal_registered != epoll_item->handle->pal_handle)
+                waitset_register(epoll, epoll_item);
+        }
+        if (!epoll->use_waitset) {
+            *retry = true;
+            return 0;
+        }
+    }
+
+    /* one more for the "event" handle */
+    size_t max_cnt = MIN((size_t)maxevents, (size_t)MAX_WAITSET_EVENTS) + 1;
+    PAL_NUM* cookies = malloc(max_cnt * (sizeof(*cookies) + sizeof(PAL_FLG)));
+    if (!cookies)
+        return -ENOMEM;
+    PAL_FLG* ret_events = (PAL_FLG*)(cookies + max_cnt);
+
+    /* EPOLLET items that did not fit into `maxevents` last time will not be reported by the host
+     * again, so don't block if some events are still pending */
+    PAL_NUM timeout_us = has_pending_events(epoll) ? 0 : (PAL_NUM)(timeout_ms * 1000);
+
+    /* mark epoll as being waited on (so epoll-update signal is sent) */
+    __atomic_add_fetch(&epoll->waiter_cnt, 1, __ATOMIC_RELAXED);
+    PAL_HANDLE waitset = epoll->pal_waitset;
+    unlock(&epoll_hdl->lock);
+
+    /* TODO: Timeout must be updated in case of retries; otherwise, we may wait for too long */
+    PAL_NUM cnt = max_cnt;
+    long error = DkWaitSetWait(waitset, &cnt, cookies, ret_events, timeout_us);
+    bool polled = error == 0;
+    error = pal_to_unix_errno(error);
+
+    lock(&epoll_hdl->lock);
+
+    bool added = false;
+    for (size_t i = 0; polled && i < cnt; i++) {
+        if (!cookies[i]) {
+            *updated = true;
+            continue;
+        }
+
+        struct shim_epoll_item* epoll_item = (struct shim_epoll_item*)(uintptr_t)cookies[i];
+        if (!epoll_item->handle) {
+            /* removed while we were waiting, see free_epoll_item() */
+            continue;
+        }
+
+        PAL_FLG pal_revents = mem_pipe_pal_events(epoll_item->handle, ret_events[i]);
+        unsigned int revents = 0;
+        if (pal_revents & PAL_WAIT_ERROR)
+            revents |= EPOLLERR | EPOLLHUP | EPOLLRDHUP;
+        if (pal_revents & PAL_WAIT_READ)
+            revents |= EPOLLIN | EPOLLRDNORM;
+        if (pal_revents & PAL_WAIT_WRITE)
+            revents |= EPOLLOUT | EPOLLWRNORM;
+        add_item_revents(epoll, epoll_item, revents);
+        added = true;
+    }
+
+    if (!__atomic_sub_fetch(&epoll->waiter_cnt, 1, __ATOMIC_RELAXED))
+        free_removed_epoll_items(epoll);
+
+    /* only removed items were reported, wait again */
+    *retry = polled && !added && !*updated;
+    free(cookies);
+    return error;
+}
+
 long shim_do_epoll_wait(int epfd, struct __kernel_epoll_event* events, int maxevents,
                         int timeout_ms) {
     if (maxevents <= 0)
@@ -311,103 +730,11 @@ long shim_do_epoll_wait(int epfd, struct __kernel_epoll_event* events, int maxev
 
     /* loop to retry on interrupted epoll waits (due to epoll being concurrently updated) */
     while (1) {
-        /* wait on epoll's PAL handles + one "event" handle that signals epoll updates */
-        PAL_HANDLE* pal_handles = malloc((epoll->fds_count + 1) * sizeof(PAL_HANDLE));
-        if (!pal_handles) {
-            unlock(&epoll_hdl->lock);
-            put_handle(epoll_hdl);
-            return -ENOMEM;
-        }
-
-        /* allocate one memory region to hold two PAL_FLG arrays: events and revents */
-        PAL_FLG* pal_events = malloc((epoll->fds_count + 1) * sizeof(PAL_FLG) * 2);
-        if (!pal_events) {
-            free(pal_handles);
-            unlock(&epoll_hdl->lock);
-            put_handle(epoll_hdl);
-            return -ENOMEM;
-        }
-        PAL_FLG* ret_events = pal_events + (epoll->fds_count + 1);
-
-        /* populate pal_events with read/write events from user-supplied epoll items */
-        size_t pal_cnt = 0;
-        struct shim_epoll_item* epoll_item;
-        LISTP_FOR_EACH_ENTRY(epoll_item, &epoll->fds, list) {
-            assert(epoll_item->handle != NULL);
-            if (!epoll_item->handle->pal_handle)
-                continue;
-
-            pal_handles[pal_cnt] = epoll_item->handle->pal_handle;
-            pal_events[pal_cnt] = (epoll_item->events & (EPOLLIN | EPOLLRDNORM))
-                                  ? PAL_WAIT_READ
-                                  : 0;
-            pal_events[pal_cnt] |= (epoll_item->events & (EPOLLOUT | EPOLLWRNORM))
-                                   ? PAL_WAIT_WRITE
-                                   : 0;
-            ret_events[pal_cnt] = 0;
-
-            if (epoll_item->events & EPOLLET) {
-                if (!__atomic_load_n(&epoll_item->handle->needs_et_poll_in, __ATOMIC_ACQUIRE)) {
-                    pal_events[pal_cnt] &= ~PAL_WAIT_READ;
-                }
-                if (!__atomic_load_n(&epoll_item->handle->needs_et_poll_out, __ATOMIC_ACQUIRE)) {
-                    pal_events[pal_cnt] &= ~PAL_WAIT_WRITE;
-                }
-            }
-
-            pal_cnt++;
-        }
-
-        assert(pal_cnt <= epoll->fds_count);
-
-        /* populate "event" handle so it waits on read (meaning epoll-update signal arrived);
-         * note that we don't increment pal_cnt because this is a special not-user-supplied item */
-        pal_handles[pal_cnt] = epoll->event.event;
-        pal_events[pal_cnt]  = PAL_WAIT_READ;
-        ret_events[pal_cnt]  = 0;
-
-        /* mark epoll as being waited on (so epoll-update signal is sent) */
-        __atomic_add_fetch(&epoll->waiter_cnt, 1, __ATOMIC_RELAXED);
-        unlock(&epoll_hdl->lock);
-
-        /* TODO: Timeout must be updated in case of retries; otherwise, we may wait for too long */
-        long error = DkStreamsWaitEvents(pal_cnt + 1, pal_handles, pal_events, ret_events,
-                                         timeout_ms * 1000);
-        bool polled = error == 0;
-        error = pal_to_unix_errno(error);
-
-        lock(&epoll_hdl->lock);
-        __atomic_sub_fetch(&epoll->waiter_cnt, 1, __ATOMIC_RELAXED);
-
-        /* update user-supplied epoll items' revents with ret_events of polled PAL handles */
-        if (!ret_events[pal_cnt] && polled) {
-            /* only if epoll was not updated concurrently and something was actually polled */
-            /* TODO: This loop is wrong. If there are 2 epoll_items with the same pal_handle (e.g.
-             * due to dup-ed fd), only the first will be updated.
-             * GH issue: https://github.com/oscarlab/graphene/issues/1848 */
-            for (size_t i = 0; i < pal_cnt; i++) {
-                LISTP_FOR_EACH_ENTRY(epoll_item, &epoll->fds, list) {
-                    assert(epoll_item->handle != NULL);
-                    if (!epoll_item->handle->pal_handle)
-                        continue;
-                    if (epoll_item->handle->pal_handle != pal_handles[i])
-                        continue;
-
-                    if (ret_events[i] & PAL_WAIT_ERROR) {
-                        epoll_item->revents  |= EPOLLERR | EPOLLHUP | EPOLLRDHUP;
-                    }
-                    if (ret_events[i] & PAL_WAIT_READ)
-                        epoll_item->revents |= EPOLLIN | EPOLLRDNORM;
-                    if (ret_events[i] & PAL_WAIT_WRITE)
-                        epoll_item->revents |= EPOLLOUT | EPOLLWRNORM;
-                    break;
-                }
-            }
-        }
-
-        PAL_FLG event_handle_update = ret_events[pal_cnt];
-        free(pal_handles);
-        free(pal_events);
+        bool updated = false;
+        bool retry = false;
+        long error = epoll->use_waitset
+                     ? wait_on_waitset(epoll_hdl, maxevents, timeout_ms, &updated, &retry)
+                     : wait_on_pal_set(epoll_hdl, timeout_ms, &updated, &retry);
 
         if (error && error != -EAGAIN) {
             unlock(&epoll_hdl->lock);
@@ -418,7 +745,7 @@ long shim_do_epoll_wait(int epfd, struct __kernel_epoll_event* events, int maxev
                 error = -ERESTARTNOHAND;
             }
             return error;
-        } else if (event_handle_update) {
+        } else if (updated) {
             /* retry if epoll was updated concurrently (similar to Linux semantics) */
             unlock(&epoll_hdl->lock);
             int ret = wait_event(&epoll->event);
@@ -427,6 +754,8 @@ long shim_do_epoll_wait(int epfd, struct __kernel_epoll_event* events, int maxev
                 return ret;
             }
             lock(&epoll_hdl->lock);
+        } else if (retry) {
+            continue;
         } else {
             /* no need to retry, exit the while loop */
             break;
@@ -436,7 +765,8 @@ long shim_do_epoll_wait(int epfd, struct __kernel_epoll_event* events, int maxev
     /* update user-supplied events array with all events detected till now on epoll */
     int nevents = 0;
     struct shim_epoll_item* epoll_item;
-    LISTP_FOR_EACH_ENTRY(epoll_item, &epoll->fds, list) {
+    struct shim_epoll_item* tmp_epoll_item;
+    LISTP_FOR_EACH_ENTRY_SAFE(epoll_item, tmp_epoll_item, &epoll->ready, ready) {
         if (nevents == maxevents)
             break;
 
@@ -450,7 +780,8 @@ long shim_do_epoll_wait(int epfd, struct __kernel_epoll_event* events, int maxev
             if (events[nevents].events & (EPOLLOUT | EPOLLWRNORM)) {
                 __atomic_store_n(&epoll_item->handle->needs_et_poll_out, false, __ATOMIC_RELEASE);
             }
-            epoll_item->revents &= ~epoll_item->events; /* informed user about revents, may clear */
+            /* informed user about revents, may clear */
+            clear_item_revents(epoll, epoll_item, epoll_item->events);
             nevents++;
         }
     }
@@ -483,10 +814,19 @@ static int epoll_close(struct shim_handle* epoll_hdl) {
         LISTP_DEL(epoll_item, &hdl->epolls, back);
         unlock(&hdl->lock);
 
+        clear_item_revents(epoll, epoll_item, epoll_item->revents);
         LISTP_DEL(epoll_item, &epoll->fds, list);
         epoll->fds_count--;
         free(epoll_item);
     }
+    invalidate_pal_set(epoll);
+    /* nobody can wait on a closed epoll, so all removed items can go */
+    free_removed_epoll_items(epoll);
+    if (epoll->pal_waitset) {
+        DkObjectClose(epoll->pal_waitset);
+        epoll->pal_waitset = NULL;
+        epoll->use_waitset = false;
+    }
 
     unlock(&epoll_hdl->lock);
 
@@ -526,6 +866,7 @@ BEGIN_CP_FUNC(epoll_item) {
         new_epoll_item->data      = epoll_item->data;
         new_epoll_item->revents   = epoll_item->revents;
         new_epoll_item->epoll     = NULL; // To be filled by epoll handle RS_FUNC
+        new_epoll_item->pal_registered = NULL;
 
         LISTP_ADD(new_epoll_item, new_list, list);
 
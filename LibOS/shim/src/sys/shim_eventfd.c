@@ -2,9 +2,10 @@
 /* Copyright (C) 2019 Intel Corporation */
 
 /*
- * Implementation of system calls "eventfd" and "eventfd2". Since eventfd emulation currently relies
- * on the host, these system calls are disallowed by default due to security concerns. To use them,
- * they must be explicitly allowed through the "sys.insecure__allow_eventfd" manifest key.
+ * Implementation of system calls "eventfd" and "eventfd2". Eventfds are emulated inside the LibOS
+ * (see "LibOS/shim/src/fs/eventfd/fs.c"). Sharing an eventfd with a child process requires a host
+ * eventfd, which is disallowed by default due to security concerns. To use it, it must be
+ * explicitly allowed through the "sys.insecure__allow_eventfd" manifest key.
  */
 
 #include <asm/fcntl.h>
@@ -19,7 +20,7 @@
 #include "shim_utils.h"
 #include "toml.h"
 
-static int create_eventfd(PAL_HANDLE* efd, unsigned count, int flags) {
+int create_host_eventfd(PAL_HANDLE* efd, bool nonblocking, bool semaphore) {
     int ret;
 
     assert(g_manifest_root);
@@ -33,20 +34,19 @@ static int create_eventfd(PAL_HANDLE* efd, unsigned count, int flags) {
     }
 
     if (!allow_eventfd) {
-        /* eventfd is not explicitly allowed in manifest */
+        /* host eventfd is not explicitly allowed in manifest */
         return -ENOSYS;
     }
 
     PAL_HANDLE hdl = NULL;
     int pal_flags  = 0;
 
-    pal_flags |= flags & EFD_NONBLOCK ? PAL_OPTION_NONBLOCK : 0;
-    pal_flags |= flags & EFD_CLOEXEC ? PAL_OPTION_CLOEXEC : 0;
-    pal_flags |= flags & EFD_SEMAPHORE ? PAL_OPTION_EFD_SEMAPHORE : 0;
+    pal_flags |= nonblocking ? PAL_OPTION_NONBLOCK : 0;
+    pal_flags |= semaphore ? PAL_OPTION_EFD_SEMAPHORE : 0;
 
-    /* eventfd() requires count (aka initval) but PAL's DkStreamOpen() doesn't have such an
-     * argument. Using create arg as a work-around (note: initval is uint32 but create is int32). */
-    ret = DkStreamOpen(URI_PREFIX_EVENTFD, 0, 0, count, pal_flags, &hdl);
+    /* the counter is set by the caller with a write, as the initial value passed to DkStreamOpen()
+     * is only 32-bit */
+    ret = DkStreamOpen(URI_PREFIX_EVENTFD, 0, 0, 0, pal_flags, &hdl);
     if (ret < 0) {
         log_error("eventfd open failure");
         return pal_to_unix_errno(ret);
@@ -67,11 +67,25 @@ long shim_do_eventfd2(unsigned int count, int flags) {
 
     hdl->type = TYPE_EVENTFD;
     hdl->fs = &eventfd_builtin_fs;
-    hdl->flags = O_RDWR;
+    hdl->flags = O_RDWR | (flags & EFD_NONBLOCK ? O_NONBLOCK : 0);
     hdl->acc_mode = MAY_READ | MAY_WRITE;
 
-    if ((ret = create_eventfd(&hdl->pal_handle, count, flags)) < 0)
+    struct shim_eventfd_handle* eventfd = &hdl->info.eventfd;
+    eventfd->on_host   = false;
+    eventfd->semaphore = !!(flags & EFD_SEMAPHORE);
+    eventfd->val       = count;
+    eventfd->signaled  = false;
+    INIT_LISTP(&eventfd->waiters);
+
+    if ((ret = create_event(&eventfd->event)) < 0)
         goto out;
+    hdl->pal_handle = event_handle(&eventfd->event);
+
+    if (count) {
+        if ((ret = set_event(&eventfd->event, 1)) < 0)
+            goto out;
+        eventfd->signaled = true;
+    }
 
     flags = flags & EFD_CLOEXEC ? FD_CLOEXEC : 0;
 
@@ -192,6 +192,18 @@ long shim_do_execve(const char* file, const char** argv, const char** envp) {
         return ret;
     }
 
+    if (is_vfork_child()) {
+        /* The child process is created from the current state instead of replacing this process
+         * (see shim_fork.c); the fd table and signal dispositions are the child's own copies. */
+        if ((ret = close_cloexec_handle(get_cur_thread()->handle_map)) < 0) {
+            put_handle(exec);
+            return ret;
+        }
+        thread_sigaction_reset_on_execve();
+        /* Passing ownership of `exec`. */
+        return vfork_fast_path_execve(exec, argv, envp);
+    }
+
     /* If `execve` is invoked concurrently by multiple threads, let only one succeed. From this
      * point errors are fatal. */
     static unsigned int first = 0;
@@ -8,6 +8,7 @@
 
 #include "pal.h"
 #include "pal_error.h"
+#include "shim_executor.h"
 #include "shim_fs_lock.h"
 #include "shim_handle.h"
 #include "shim_internal.h"
@@ -53,17 +54,26 @@ static noreturn void libos_clean_and_exit(int exit_code) {
      * do not expect that, init process is pretty special).
      */
     release_id(get_cur_thread()->tid);
+    release_id_pool();
 
     terminate_ipc_worker();
+    terminate_executor();
 
     log_debug("process %u exited with status %d", g_process_ipc_ids.self_vmid, exit_code);
 
+    print_malloc_stats();
+    print_syscall_stats();
+    print_lock_stats();
+    log_flush();
+
     /* TODO: We exit whole libos, but there are some objects that might need cleanup - we should do
      * a proper cleanup of everything. */
     DkProcessExit(exit_code);
 }
 
 noreturn void thread_exit(int error_code, int term_signal) {
+    syscall_trace_flush(get_cur_thread());
+
     /* Remove current thread from the threads list. */
     if (!check_last_thread(/*mark_self_dead=*/true)) {
         struct shim_thread* cur_thread = get_cur_thread();
@@ -87,10 +97,12 @@ noreturn void thread_exit(int error_code, int term_signal) {
             /* `cleanup_thread` did not get this reference, clean it. We have to be careful, as
              * this is most likely the last reference and will free this `cur_thread`. */
             put_thread(cur_thread);
+            destroy_thread_slab_cache();
             DkThreadExit(NULL);
             /* UNREACHABLE */
         }
 
+        destroy_thread_slab_cache();
         DkThreadExit(&cur_thread->clear_child_tid_pal);
         /* UNREACHABLE */
     }
@@ -172,6 +184,9 @@ long shim_do_exit_group(int error_code) {
 
     error_code &= 0xFF;
 
+    if (is_vfork_child())
+        return vfork_fast_path_exit(error_code);
+
     log_debug("---- shim_exit_group (returning %d)", error_code);
 
     process_exit(error_code, 0);
@@ -182,6 +197,9 @@ long shim_do_exit(int error_code) {
 
     error_code &= 0xFF;
 
+    if (is_vfork_child())
+        return vfork_fast_path_exit(error_code);
+
     log_debug("---- shim_exit (returning %d)", error_code);
 
     thread_exit(error_code, 0);
@@ -162,8 +162,9 @@ long shim_do_fcntl(int fd, int cmd, unsigned long arg) {
         /* F_SETFD (int) */
         case F_SETFD:
             lock(&handle_map->lock);
-            if (HANDLE_ALLOCATED(handle_map->map[fd]))
-                handle_map->map[fd]->flags = arg & FD_CLOEXEC;
+            struct shim_fd_handle* fd_handle = __get_fd_entry(handle_map, fd);
+            if (HANDLE_ALLOCATED(fd_handle))
+                __atomic_store_n(&fd_handle->flags, arg & FD_CLOEXEC, __ATOMIC_RELAXED);
             unlock(&handle_map->lock);
             ret = 0;
             break;
@@ -17,6 +17,7 @@
 #include "shim_internal.h"
 #include "shim_lock.h"
 #include "shim_process.h"
+#include "shim_signal.h"
 #include "shim_table.h"
 #include "shim_utils.h"
 #include "stat.h"
@@ -354,6 +355,24 @@ out:
     return ret;
 }
 
+/* Check whether `hdl` is a connected socket or a pipe, i.e., a destination that the PAL may be able
+ * to feed directly from a host file (the PAL makes the final decision, see `sendfile` fs callback) */
+static bool is_sendfile_fast_path_dest(struct shim_handle* hdl) {
+    if (hdl->type == TYPE_PIPE)
+        return hdl->info.pipe.ready_for_ops && !is_mem_pipe(hdl);
+
+    if (hdl->type != TYPE_SOCK)
+        return false;
+
+    lock(&hdl->lock);
+    struct shim_sock_handle* sock = &hdl->info.sock;
+    bool ret = (hdl->acc_mode & MAY_WRITE) && (sock->sock_state == SOCK_CONNECTED ||
+                                               sock->sock_state == SOCK_BOUNDCONNECTED ||
+                                               sock->sock_state == SOCK_ACCEPTED);
+    unlock(&hdl->lock);
+    return ret;
+}
+
 long shim_do_sendfile(int out_fd, int in_fd, off_t* offset, size_t count) {
     long ret;
     char* buf = NULL;
@@ -385,6 +404,35 @@ long shim_do_sendfile(int out_fd, int in_fd, off_t* offset, size_t count) {
         goto out;
     }
 
+    if (!count) {
+        ret = 0;
+        goto out;
+    }
+
+    /* fast path: host files (without encryption/integrity protection) can be copied into sockets
+     * and pipes by the host kernel, so that the data never enters the LibOS (nor the enclave) */
+    if (in_hdl->fs->fs_ops->sendfile && is_sendfile_fast_path_dest(out_hdl)) {
+        file_off_t pos = offset ? *offset : 0;
+        ret = in_hdl->fs->fs_ops->sendfile(in_hdl, out_hdl, offset ? &pos : NULL, count);
+        if (ret != -EOPNOTSUPP) {
+            maybe_epoll_et_trigger(out_hdl, ret < 0 ? ret : 0, /*in=*/false,
+                                   ret >= 0 && (size_t)ret < count);
+            if (ret == -EPIPE) {
+                siginfo_t info = {
+                    .si_signo = SIGPIPE,
+                    .si_pid = g_process.pid,
+                    .si_code = SI_USER,
+                };
+                if (kill_current_proc(&info) < 0) {
+                    log_error("sendfile: failed to deliver a signal");
+                }
+            }
+            if (ret >= 0 && offset)
+                *offset = pos;
+            goto out;
+        }
+    }
+
     /* FIXME: This sendfile() emulation is very simple and not particularly efficient: it reads from
      *        input FD in BUF_SIZE chunks and writes into output FD. Mmap-based emulation may be
      *        more efficient but adds complexity (not all handle types provide mmap callback).
@@ -398,11 +446,6 @@ long shim_do_sendfile(int out_fd, int in_fd, off_t* offset, size_t count) {
         goto out;
     }
 
-    if (!count) {
-        ret = 0;
-        goto out;
-    }
-
     file_off_t old_offset = 0;
 
     if (offset) {
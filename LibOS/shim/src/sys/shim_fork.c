@@ -3,12 +3,33 @@
  *                    Borys Popławski <borysp@invisiblethingslab.com>
  */
 
+/*
+ * Implementation of system calls "fork" and "vfork", including the vfork+execve fast path.
+ *
+ * Emulating vfork() as fork() checkpoints the whole address space, only for the child to throw it
+ * away in execve() right after. With `libos.vfork_exec_fast_path` enabled, a single-threaded
+ * process instead runs the vfork child on the calling thread, in the address space of the parent
+ * (which vfork() semantics allow, the parent is suspended anyway). The child gets its own copy of
+ * the fd table, signal dispositions and mask, credentials, PID/PGID and filesystem info, so that
+ * whatever it changes before execve() does not leak into the parent. Only when the child calls
+ * execve() or exits, a new process is created from a small checkpoint with exactly this state
+ * (plus the new executable and its arguments, or the exit code). Then the state of the parent is
+ * restored and it returns from vfork() with the PID of the child.
+ */
+
 #include <stddef.h> // without this header we are missing `size_t` definition in "signal.h" ...
 #include <linux/sched.h>
 #include <linux/signal.h>
 
+#include "shim_checkpoint.h"
 #include "shim_internal.h"
+#include "shim_ipc.h"
+#include "shim_lock.h"
+#include "shim_process.h"
+#include "shim_signal.h"
 #include "shim_table.h"
+#include "shim_thread.h"
+#include "shim_utils.h"
 
 long shim_do_fork(void) {
     return shim_do_clone(SIGCHLD, 0, NULL, NULL, 0);
@@ -17,3 +38,407 @@ long shim_do_fork(void) {
 long shim_do_vfork(void) {
     return shim_do_clone(CLONE_VFORK | CLONE_VM | SIGCHLD, 0, NULL, NULL, 0);
 }
+
+/* State of the parent saved while the vfork child runs on its thread. */
+struct vfork_state {
+    IDTYPE child_pid;
+    int child_termination_signal;
+
+    PAL_CONTEXT parent_regs;
+    unsigned long parent_tls;
+
+    struct shim_handle_map* parent_handle_map;
+    struct shim_signal_dispositions* parent_signal_dispositions;
+    __sigset_t parent_signal_mask;
+    IDTYPE parent_uid, parent_gid, parent_euid, parent_egid;
+
+    IDTYPE parent_pid, parent_ppid, parent_pgid;
+    struct shim_dentry* parent_root;
+    struct shim_dentry* parent_cwd;
+    mode_t parent_umask;
+};
+
+/* Only ever used by single-threaded processes, see `can_use_vfork_fast_path`. */
+static struct vfork_state* g_vfork_state;
+
+/* What a child spawned by the fast path does after initialization. */
+struct shim_spawn_args {
+    int exit_code; /* if non-negative, exit with this code instead of executing `g_process.exec` */
+    const char** argv;
+    const char** envp;
+    /* set only in the checkpoint: all envp strings followed by all argv strings, packed in the
+     * order in which init_stack() places them on the stack of the new executable */
+    const char* strs;
+    size_t strs_size;
+};
+
+int g_spawned_exit_code = -1;
+
+static size_t measure_strings(const char** strs, size_t* out_size) {
+    size_t cnt = 0;
+    for (; strs && strs[cnt]; cnt++)
+        *out_size += strlen(strs[cnt]) + 1;
+    return cnt;
+}
+
+static char* pack_strings(char* dst, const char** strs, size_t cnt, const char** new_strs) {
+    for (size_t i = 0; i < cnt; i++) {
+        size_t size = strlen(strs[i]) + 1;
+        memcpy(dst, strs[i], size);
+        new_strs[i] = dst;
+        dst += size;
+    }
+    new_strs[cnt] = NULL;
+    return dst;
+}
+
+/* Build systems spawn compilers with megabytes of arguments and environment, so instead of one
+ * checkpoint entry per string, argv and envp are packed into a single blob: the pointer arrays and
+ * then the strings. The child rebases the pointers and copies the strings to its stack at once. */
+BEGIN_CP_FUNC(spawn_args) {
+    __UNUSED(size);
+    __UNUSED(objp);
+    assert(size == sizeof(struct shim_spawn_args));
+
+    struct shim_spawn_args* args = (struct shim_spawn_args*)obj;
+
+    size_t strs_size = 0;
+    size_t argc = measure_strings(args->argv, &strs_size);
+    size_t envc = measure_strings(args->envp, &strs_size);
+
+    size_t off = ADD_CP_OFFSET(sizeof(*args) + (argc + 1 + envc + 1) * sizeof(char*)
+                               + strs_size);
+    struct shim_spawn_args* new_args = (struct shim_spawn_args*)(base + off);
+    new_args->exit_code = args->exit_code;
+    new_args->argv = (const char**)(new_args + 1);
+    new_args->envp = new_args->argv + argc + 1;
+    new_args->strs = (const char*)(new_args->envp + envc + 1);
+    new_args->strs_size = strs_size;
+
+    char* strs = (char*)new_args->strs;
+    strs = pack_strings(strs, args->envp, envc, new_args->envp);
+    strs = pack_strings(strs, args->argv, argc, new_args->argv);
+    assert(strs == new_args->strs + strs_size);
+
+    ADD_CP_FUNC_ENTRY(off);
+}
+END_CP_FUNC(spawn_args)
+
+BEGIN_RS_FUNC(spawn_args) {
+    __UNUSED(offset);
+
+    struct shim_spawn_args* args = (void*)(base + GET_CP_FUNC_ENTRY());
+    CP_REBASE(args->argv);
+    CP_REBASE(args->envp);
+    CP_REBASE(args->strs);
+    for (const char** a = args->argv; *a; a++)
+        CP_REBASE(*a);
+    for (const char** e = args->envp; *e; e++)
+        CP_REBASE(*e);
+
+    if (args->exit_code >= 0) {
+        g_spawned_exit_code = args->exit_code;
+    } else {
+        /* picked up by init_stack() */
+        migrated_argv = args->argv;
+        migrated_envp = args->envp;
+        migrated_args_strs = args->strs;
+        migrated_args_strs_size = args->strs_size;
+    }
+}
+END_RS_FUNC(spawn_args)
+
+static BEGIN_MIGRATION_DEF(spawn, struct shim_process* process_description,
+                           struct shim_thread* thread_description,
+                           struct shim_ipc_ids* process_ipc_ids, struct shim_spawn_args* args) {
+    DEFINE_MIGRATE(process_ipc_ids, process_ipc_ids, sizeof(*process_ipc_ids));
+    DEFINE_MIGRATE(dentry_root, NULL, 0);
+    DEFINE_MIGRATE(all_mounts, NULL, 0);
+    DEFINE_MIGRATE(process_description, process_description, sizeof(*process_description));
+    DEFINE_MIGRATE(thread, thread_description, sizeof(*thread_description));
+    DEFINE_MIGRATE(migratable, NULL, 0);
+    /* must come after `migratable`, which carries the stale `migrated_envp` of this process */
+    DEFINE_MIGRATE(spawn_args, args, sizeof(*args));
+}
+END_MIGRATION_DEF(spawn)
+
+static int migrate_spawn(struct shim_cp_store* store, struct shim_process* process_description,
+                         struct shim_thread* thread_description,
+                         struct shim_ipc_ids* process_ipc_ids, va_list ap) {
+    struct shim_spawn_args* args = va_arg(ap, struct shim_spawn_args*);
+    return START_MIGRATE(store, spawn, process_description, thread_description, process_ipc_ids,
+                         args);
+}
+
+bool can_use_vfork_fast_path(unsigned long flags) {
+    /* what vfork() and posix_spawn() use; anything else takes the generic path */
+    if (flags & ~(CLONE_VFORK | CLONE_VM | CLONE_PARENT_SETTID | CSIGNAL))
+        return false;
+    if (!(flags & CLONE_VM))
+        return false;
+    if (g_vfork_state)
+        return false;
+
+    bool enabled = false;
+    int ret = toml_bool_in(g_manifest_root, "libos.vfork_exec_fast_path", /*defaultval=*/false,
+                           &enabled);
+    if (ret < 0) {
+        log_warning("Cannot parse 'libos.vfork_exec_fast_path' (the value must be `true` or "
+                    "`false`), ignoring it");
+        return false;
+    }
+    if (!enabled)
+        return false;
+
+    /* other threads would observe the state of the child (e.g. its PID) */
+    return check_last_thread(/*mark_self_dead=*/false);
+}
+
+bool is_vfork_child(void) {
+    return !!g_vfork_state;
+}
+
+long vfork_fast_path_begin(unsigned long flags, unsigned long user_stack_addr,
+                           int* set_parent_tid) {
+    assert(!g_vfork_state);
+
+    struct shim_thread* cur_thread = get_cur_thread();
+    struct vfork_state* state = calloc(1, sizeof(*state));
+    if (!state)
+        return -ENOMEM;
+
+    struct shim_handle_map* child_handle_map = NULL;
+    int ret = dup_handle_map(&child_handle_map, get_thread_handle_map(cur_thread));
+    if (ret < 0)
+        goto out_free;
+
+    struct shim_signal_dispositions* child_dispositions =
+        copy_signal_dispositions(cur_thread->signal_dispositions);
+    if (!child_dispositions) {
+        ret = -ENOMEM;
+        goto out_put_map;
+    }
+
+    state->child_pid = get_new_id(/*remove_from_owned=*/true);
+    if (!state->child_pid) {
+        log_error("Could not allocate a tid!");
+        ret = -EAGAIN;
+        goto out_put_dispositions;
+    }
+    state->child_termination_signal = flags & CSIGNAL;
+
+    pal_context_copy(&state->parent_regs, shim_get_tcb()->context.regs);
+    state->parent_tls = get_tls();
+
+    lock(&cur_thread->lock);
+    state->parent_handle_map = cur_thread->handle_map;
+    get_handle_map(state->parent_handle_map);
+    set_handle_map(cur_thread, child_handle_map);
+
+    state->parent_signal_dispositions = cur_thread->signal_dispositions;
+    cur_thread->signal_dispositions = child_dispositions;
+
+    state->parent_signal_mask = cur_thread->signal_mask;
+    state->parent_uid  = cur_thread->uid;
+    state->parent_gid  = cur_thread->gid;
+    state->parent_euid = cur_thread->euid;
+    state->parent_egid = cur_thread->egid;
+    unlock(&cur_thread->lock);
+    put_handle_map(child_handle_map);
+
+    lock(&g_process.fs_lock);
+    state->parent_root  = g_process.root;
+    state->parent_cwd   = g_process.cwd;
+    state->parent_umask = g_process.umask;
+    get_dentry(g_process.root);
+    get_dentry(g_process.cwd);
+    unlock(&g_process.fs_lock);
+
+    state->parent_pid  = g_process.pid;
+    state->parent_ppid = g_process.ppid;
+    state->parent_pgid = __atomic_load_n(&g_process.pgid, __ATOMIC_ACQUIRE);
+    g_process.ppid = g_process.pid;
+    g_process.pid  = state->child_pid;
+
+    if (set_parent_tid)
+        *set_parent_tid = state->child_pid;
+
+    g_vfork_state = state;
+
+    log_debug("vfork: running child %u on the parent's thread until execve", state->child_pid);
+
+    if (user_stack_addr)
+        pal_context_set_sp(shim_get_tcb()->context.regs, user_stack_addr);
+    return 0;
+
+out_put_dispositions:
+    put_signal_dispositions(child_dispositions);
+out_put_map:
+    put_handle_map(child_handle_map);
+out_free:
+    free(state);
+    return ret;
+}
+
+/* Undoes vfork_fast_path_begin() and makes the current syscall return `ret` from vfork() in the
+ * parent. */
+static long vfork_resume_parent(long ret) {
+    struct vfork_state* state = g_vfork_state;
+    assert(state);
+
+    struct shim_thread* cur_thread = get_cur_thread();
+
+    lock(&cur_thread->lock);
+    set_handle_map(cur_thread, state->parent_handle_map);
+    put_handle_map(state->parent_handle_map);
+
+    put_signal_dispositions(cur_thread->signal_dispositions);
+    cur_thread->signal_dispositions = state->parent_signal_dispositions;
+
+    set_sig_mask(cur_thread, &state->parent_signal_mask);
+    cur_thread->uid  = state->parent_uid;
+    cur_thread->gid  = state->parent_gid;
+    cur_thread->euid = state->parent_euid;
+    cur_thread->egid = state->parent_egid;
+    unlock(&cur_thread->lock);
+
+    lock(&g_process.fs_lock);
+    put_dentry(g_process.root);
+    put_dentry(g_process.cwd);
+    g_process.root  = state->parent_root;
+    g_process.cwd   = state->parent_cwd;
+    g_process.umask = state->parent_umask;
+    unlock(&g_process.fs_lock);
+
+    g_process.pid  = state->parent_pid;
+    g_process.ppid = state->parent_ppid;
+    __atomic_store_n(&g_process.pgid, state->parent_pgid, __ATOMIC_RELEASE);
+
+    pal_context_copy(shim_get_tcb()->context.regs, &state->parent_regs);
+    set_tls(state->parent_tls);
+
+    g_vfork_state = NULL;
+    free(state);
+    return ret;
+}
+
+/* Creates the real child process from the current (child) state. Takes ownership of `exec`. */
+static long spawn_vfork_child(struct shim_handle* exec, struct shim_spawn_args* args) {
+    struct vfork_state* state = g_vfork_state;
+
+    struct shim_child_process* child_process = create_child_process();
+    if (!child_process) {
+        if (exec)
+            put_handle(exec);
+        return -ENOMEM;
+    }
+
+    /* inherits handle map, signal dispositions and mask and credentials of the child */
+    struct shim_thread* thread = get_new_thread();
+    if (!thread) {
+        if (exec)
+            put_handle(exec);
+        destroy_child_process(child_process);
+        return -ENOMEM;
+    }
+    thread->tid = state->child_pid;
+    /* the child starts from scratch: a fresh stack and no context to resume */
+    thread->stack     = NULL;
+    thread->stack_top = NULL;
+    thread->stack_red = NULL;
+
+    lock(&g_process.fs_lock);
+    struct shim_process process_description = {
+        .pid = g_process.pid,
+        .ppid = g_process.ppid,
+        .pgid = __atomic_load_n(&g_process.pgid, __ATOMIC_ACQUIRE),
+        .root = g_process.root,
+        .cwd = g_process.cwd,
+        .umask = g_process.umask,
+        .exec = exec,
+    };
+    get_dentry(process_description.root);
+    get_dentry(process_description.cwd);
+    unlock(&g_process.fs_lock);
+
+    INIT_LISTP(&process_description.children);
+    INIT_LISTP(&process_description.zombies);
+
+    clear_lock(&process_description.fs_lock);
+    clear_lock(&process_description.children_lock);
+
+    child_process->pid = process_description.pid;
+    child_process->child_termination_signal = state->child_termination_signal;
+    child_process->uid = thread->uid;
+    long ret = ipc_get_new_vmid(&child_process->vmid);
+    if (!ret) {
+        ret = create_process_and_send_checkpoint(&migrate_spawn, child_process,
+                                                 &process_description, thread, args);
+    }
+
+    if (exec)
+        put_handle(exec);
+    put_dentry(process_description.cwd);
+    put_dentry(process_description.root);
+
+    /* the child process owns the PID now, don't let `put_thread` release it */
+    thread->tid = 0;
+    put_thread(thread);
+
+    if (ret < 0) {
+        destroy_child_process(child_process);
+        /* the child process might have already taken the ownership of the PID, take it back */
+        int tmp_ret = ipc_change_id_owner(state->child_pid, g_process_ipc_ids.self_vmid);
+        if (tmp_ret < 0) {
+            log_debug("Failed to change back ID %u owner: %d", state->child_pid, tmp_ret);
+            /* No way to recover gracefully. */
+            DkProcessExit(1);
+        }
+        return ret;
+    }
+    return state->child_pid;
+}
+
+long vfork_fast_path_execve(struct shim_handle* exec, const char** argv, const char** envp) {
+    assert(g_vfork_state);
+
+    struct shim_spawn_args args = {
+        .exit_code = -1,
+        .argv = argv,
+        .envp = envp,
+    };
+    long ret = spawn_vfork_child(exec, &args);
+    if (ret < 0) {
+        /* like a failed execve(), the child continues and typically exits */
+        log_warning("vfork: spawning child for execve failed: %ld", ret);
+        return ret;
+    }
+
+    return vfork_resume_parent(ret);
+}
+
+long vfork_fast_path_exit(int error_code) {
+    assert(g_vfork_state);
+
+    /* the child exited without execve(); the parent must still see a child process with this exit
+     * code, so spawn one that exits right after initialization */
+    struct shim_spawn_args args = {
+        .exit_code = error_code,
+        .argv = NULL,
+        .envp = NULL,
+    };
+    long ret = spawn_vfork_child(/*exec=*/NULL, &args);
+    if (ret < 0) {
+        log_warning("vfork: spawning exited child failed: %ld", ret);
+        /* there is no child to hand the PID over to, release it */
+        IDTYPE child_pid = g_vfork_state->child_pid;
+        int tmp_ret = ipc_release_id_range(child_pid, child_pid);
+        if (tmp_ret < 0) {
+            log_debug("Failed to release ID %u: %d", child_pid, tmp_ret);
+            /* No way to recover gracefully. */
+            DkProcessExit(1);
+        }
+    }
+
+    return vfork_resume_parent(ret);
+}
@@ -33,7 +33,7 @@
 #include "spinlock.h"
 
 struct shim_futex;
-struct futex_waiter;
+struct futex_bucket;
 
 DEFINE_LIST(futex_waiter);
 DEFINE_LISTP(futex_waiter);
@@ -41,10 +41,14 @@ struct futex_waiter {
     struct shim_thread* thread;
     uint32_t bitset;
     LIST_TYPE(futex_waiter) list;
-    /* futex field is guarded by g_futex_tree_lock, do not use it without taking that lock first.
-     * This is needed to ensure that a waiter knows what futex they were sleeping on, after they
-     * wake-up (because they could have been requeued to another futex).*/
+    /* futex and bucket fields are guarded by the lock of `bucket`. A requeue can move the waiter to
+     * another futex (and bucket), so after waking up the waiter has to find its current bucket with
+     * `lock_waiter_bucket()`. This is needed to ensure that a waiter knows what futex they were
+     * sleeping on, after they wake-up. */
     struct shim_futex* futex;
+    struct futex_bucket* bucket;
+    /* For FUTEX_WAIT_REQUEUE_PI: the PI futex this waiter may only be requeued to. */
+    uint32_t* requeue_pi_uaddr;
 };
 
 struct shim_futex {
@@ -52,9 +56,6 @@ struct shim_futex {
     LISTP_TYPE(futex_waiter) waiters;
     struct avl_tree_node tree_node;
     bool in_tree;
-    /* This lock guards every access to *uaddr (futex word value) and waiters (above).
-     * Always take g_futex_tree_lock before taking this lock. */
-    spinlock_t lock;
     REFTYPE _ref_count;
 };
 
@@ -65,172 +66,148 @@ static bool futex_tree_cmp(struct avl_tree_node* node_a, struct avl_tree_node* n
     return (uintptr_t)a->uaddr <= (uintptr_t)b->uaddr;
 }
 
-static struct avl_tree g_futex_tree = { .cmp = futex_tree_cmp };
+/* Futexes are spread over buckets by their address, each with its own lock (as in Linux), so that
+ * operations on unrelated futexes do not contend. The lock of a bucket guards its tree and every
+ * access to *uaddr (futex word value) and waiters of the futexes in it. Buckets are never freed,
+ * which lets a woken waiter safely take the lock of a bucket it might have been requeued away
+ * from. */
+#define FUTEX_BUCKETS_SHIFT 8
+#define FUTEX_BUCKETS_NUM (1 << FUTEX_BUCKETS_SHIFT)
 
-static spinlock_t g_futex_tree_lock = INIT_SPINLOCK_UNLOCKED;
+struct futex_bucket {
+    struct avl_tree tree;
+    spinlock_t lock;
+} __attribute__((aligned(64)));
 
-static void get_futex(struct shim_futex* futex) {
-    REF_INC(futex->_ref_count);
+static struct futex_bucket g_futex_buckets[FUTEX_BUCKETS_NUM] = {
+    [0 ... FUTEX_BUCKETS_NUM - 1] = {
+        .tree = { .cmp = futex_tree_cmp },
+        .lock = INIT_SPINLOCK_UNLOCKED,
+    },
+};
+
+static struct futex_bucket* futex_bucket(uint32_t* uaddr) {
+    /* Fibonacci hashing, futex words are at least 4-byte aligned. */
+    uint64_t key = (uintptr_t)uaddr >> 2;
+    return &g_futex_buckets[(key * 0x9e3779b97f4a7c15ull) >> (64 - FUTEX_BUCKETS_SHIFT)];
 }
 
-static void put_futex(struct shim_futex* futex) {
-    if (!REF_DEC(futex->_ref_count)) {
-        free(futex);
+/* How long `futex_wait` spins before blocking; spinning only makes sense with more than one CPU. */
+#define FUTEX_SPIN_ITERATIONS 200
+static size_t g_futex_spin_iterations = 0;
+
+int init_futex(void) {
+    if (g_pal_control->cpu_info.online_logical_cores > 1) {
+        g_futex_spin_iterations = FUTEX_SPIN_ITERATIONS;
     }
+    return 0;
 }
 
-/* Since we distinguish futexes by their virtual address, we can as well create a total ordering
- * based on it. */
-static int cmp_futexes(struct shim_futex* futex1, struct shim_futex* futex2) {
-    uintptr_t f1 = (uintptr_t)futex1->uaddr;
-    uintptr_t f2 = (uintptr_t)futex2->uaddr;
+static void get_futex(struct shim_futex* futex) {
+    REF_INC(futex->_ref_count);
+}
 
-    if (f1 < f2) {
-        return -1;
-    } else if (f1 == f2) {
-        return 0;
-    } else {
-        return 1;
+static void put_futex(struct shim_futex* futex) {
+    if (!REF_DEC(futex->_ref_count)) {
+        /* Keep one for the next wait of this thread, a contended lock creates and frees a futex on
+         * nearly every wait. */
+        struct shim_thread* cur_thread = get_cur_thread();
+        if (cur_thread && !cur_thread->spare_futex) {
+            cur_thread->spare_futex = futex;
+        } else {
+            free(futex);
+        }
     }
 }
 
 /*
- * Locks two futexes in ascending order (defined by cmp_futexes).
- * If a futex is NULL, it is just skipped.
+ * Locks two buckets in ascending order of their addresses. If both are the same bucket, takes its
+ * lock once.
  */
-static void lock_two_futexes(struct shim_futex* futex1, struct shim_futex* futex2) {
-    if (!futex1 && !futex2) {
-        return;
-    } else if (futex1 && !futex2) {
-        spinlock_lock(&futex1->lock);
-        return;
-    } else if (!futex1 && futex2) {
-        spinlock_lock(&futex2->lock);
-        return;
-    }
-    /* Both are not NULL. */
-
-    /* To avoid deadlocks we always take the locks in ascending order of futexes.
-     * If both futexes are equal, just take one lock. */
-    int cmp = cmp_futexes(futex1, futex2);
-    if (cmp < 0) {
-        spinlock_lock(&futex1->lock);
-        spinlock_lock(&futex2->lock);
-    } else if (cmp == 0) {
-        spinlock_lock(&futex1->lock);
+static void lock_two_buckets(struct futex_bucket* bucket1, struct futex_bucket* bucket2) {
+    if (bucket1 == bucket2) {
+        spinlock_lock(&bucket1->lock);
+    } else if ((uintptr_t)bucket1 < (uintptr_t)bucket2) {
+        spinlock_lock(&bucket1->lock);
+        spinlock_lock(&bucket2->lock);
     } else {
-        spinlock_lock(&futex2->lock);
-        spinlock_lock(&futex1->lock);
+        spinlock_lock(&bucket2->lock);
+        spinlock_lock(&bucket1->lock);
     }
 }
 
-static void unlock_two_futexes(struct shim_futex* futex1, struct shim_futex* futex2) {
-    if (!futex1 && !futex2) {
-        return;
-    } else if (futex1 && !futex2) {
-        spinlock_unlock(&futex1->lock);
-        return;
-    } else if (!futex1 && futex2) {
-        spinlock_unlock(&futex2->lock);
-        return;
+static void unlock_two_buckets(struct futex_bucket* bucket1, struct futex_bucket* bucket2) {
+    spinlock_unlock(&bucket1->lock);
+    if (bucket1 != bucket2) {
+        spinlock_unlock(&bucket2->lock);
     }
-    /* Both are not NULL. */
+}
 
-    /* For unlocking order does not matter. */
-    int cmp = cmp_futexes(futex1, futex2);
-    if (cmp) {
-        spinlock_unlock(&futex1->lock);
-        spinlock_unlock(&futex2->lock);
-    } else {
-        spinlock_unlock(&futex1->lock);
+/*
+ * Takes the lock of the bucket `waiter` currently belongs to and returns that bucket.
+ */
+static struct futex_bucket* lock_waiter_bucket(struct futex_waiter* waiter) {
+    while (true) {
+        struct futex_bucket* bucket = __atomic_load_n(&waiter->bucket, __ATOMIC_ACQUIRE);
+        spinlock_lock(&bucket->lock);
+        if (__atomic_load_n(&waiter->bucket, __ATOMIC_RELAXED) == bucket) {
+            return bucket;
+        }
+        /* Requeued to another bucket in the meantime. */
+        spinlock_unlock(&bucket->lock);
     }
 }
 
 /*
- * Adds `futex` to `g_futex_tree`.
+ * Adds `futex` to the tree of `bucket`.
  *
- * `g_futex_tree_lock` should be held while calling this function and you must ensure that nobody
+ * `bucket->lock` should be held while calling this function and you must ensure that nobody
  * is using `futex` (e.g. you have just created it).
  */
-static void enqueue_futex(struct shim_futex* futex) {
-    assert(spinlock_is_locked(&g_futex_tree_lock));
+static void enqueue_futex(struct futex_bucket* bucket, struct shim_futex* futex) {
+    assert(spinlock_is_locked(&bucket->lock));
 
     get_futex(futex);
-    avl_tree_insert(&g_futex_tree, &futex->tree_node);
+    avl_tree_insert(&bucket->tree, &futex->tree_node);
     futex->in_tree = true;
 }
 
 /*
- * Checks whether `futex` has no waiters and is on `g_futex_tree`.
+ * If `futex` has no waiters and is on the tree of `bucket`, takes it off that tree.
  *
- * This requires only `futex->lock` to be held.
+ * `bucket->lock` needs to be held and the caller must hold a reference to `futex`.
  */
-static bool check_dequeue_futex(struct shim_futex* futex) {
-    assert(spinlock_is_locked(&futex->lock));
-
-    return LISTP_EMPTY(&futex->waiters) && futex->in_tree;
-}
+static void maybe_dequeue_futex(struct futex_bucket* bucket, struct shim_futex* futex) {
+    assert(spinlock_is_locked(&bucket->lock));
 
-static void _maybe_dequeue_futex(struct shim_futex* futex) {
-    assert(spinlock_is_locked(&futex->lock));
-    assert(spinlock_is_locked(&g_futex_tree_lock));
-
-    if (check_dequeue_futex(futex)) {
-        avl_tree_delete(&g_futex_tree, &futex->tree_node);
+    if (LISTP_EMPTY(&futex->waiters) && futex->in_tree) {
+        avl_tree_delete(&bucket->tree, &futex->tree_node);
         futex->in_tree = false;
         /* We still hold this futex reference (in the caller), so this won't call free. */
         put_futex(futex);
     }
 }
 
-/*
- * If `futex` has no waiters and is on `g_futex_tree`, takes it off that tree.
- *
- * Neither `g_futex_tree_lock` nor `futex->lock` should be held while calling this,
- * it acquires these locks itself.
- */
-static void maybe_dequeue_futex(struct shim_futex* futex) {
-    spinlock_lock(&g_futex_tree_lock);
-    spinlock_lock(&futex->lock);
-    _maybe_dequeue_futex(futex);
-    spinlock_unlock(&futex->lock);
-    spinlock_unlock(&g_futex_tree_lock);
-}
-
-/*
- * Same as `maybe_dequeue_futex`, but works for two futexes, any of which might be NULL.
- */
-static void maybe_dequeue_two_futexes(struct shim_futex* futex1, struct shim_futex* futex2) {
-    spinlock_lock(&g_futex_tree_lock);
-    lock_two_futexes(futex1, futex2);
-    if (futex1) {
-        _maybe_dequeue_futex(futex1);
-    }
-    if (futex2) {
-        _maybe_dequeue_futex(futex2);
-    }
-    unlock_two_futexes(futex1, futex2);
-    spinlock_unlock(&g_futex_tree_lock);
-}
-
 /*
  * Adds `waiter` to `futex` waiters list.
- * You need to make sure that this futex is still on `g_futex_tree`, but in most cases it follows
- * from the program control flow.
+ * You need to make sure that this futex is still on the tree of `bucket`, but in most cases it
+ * follows from the program control flow.
  *
- * `futex->lock` needs to be held.
+ * `bucket->lock` needs to be held.
  */
-static void add_futex_waiter(struct futex_waiter* waiter, struct shim_futex* futex,
-                             uint32_t bitset) {
-    assert(spinlock_is_locked(&futex->lock));
+static void add_futex_waiter(struct futex_waiter* waiter, struct futex_bucket* bucket,
+                             struct shim_futex* futex, uint32_t bitset) {
+    assert(spinlock_is_locked(&bucket->lock));
 
     waiter->thread = get_cur_thread();
     get_thread(waiter->thread);
 
     INIT_LIST_HEAD(waiter, list);
     waiter->bitset = bitset;
+    waiter->requeue_pi_uaddr = NULL;
     get_futex(futex);
     waiter->futex = futex;
+    waiter->bucket = bucket;
     LISTP_ADD_TAIL(waiter, &futex->waiters, list);
 }
 
@@ -238,31 +215,30 @@ static void add_futex_waiter(struct futex_waiter* waiter, struct shim_futex* fut
  * Ownership of the `waiter->thread` is passed to the caller; we do not change its refcount because
  * we take it of `futex->waiters` list (-1) and give it to caller (+1).
  *
- * `futex->lock` needs to be held.
+ * The lock of the bucket of `futex` needs to be held.
  */
 static struct shim_thread* remove_futex_waiter(struct futex_waiter* waiter,
                                                struct shim_futex* futex) {
-    assert(spinlock_is_locked(&futex->lock));
-
     LISTP_DEL_INIT(waiter, &futex->waiters, list);
     return waiter->thread;
 }
 
 /*
- * Moves waiter from `futex1` to `futex2`.
- * As in `add_futex_waiter`, `futex2` needs to be on `g_futex_tree`.
+ * Moves waiter from `futex1` to `futex2`, which lives in `bucket2`.
+ * As in `add_futex_waiter`, `futex2` needs to be on the tree of `bucket2`.
  *
- * `futex1->lock` and `futex2->lock` need to be held.
+ * Locks of both buckets need to be held.
  */
 static void move_futex_waiter(struct futex_waiter* waiter, struct shim_futex* futex1,
-                              struct shim_futex* futex2) {
-    assert(spinlock_is_locked(&futex1->lock));
-    assert(spinlock_is_locked(&futex2->lock));
+                              struct futex_bucket* bucket2, struct shim_futex* futex2) {
+    assert(spinlock_is_locked(&waiter->bucket->lock));
+    assert(spinlock_is_locked(&bucket2->lock));
 
     LISTP_DEL_INIT(waiter, &futex1->waiters, list);
     get_futex(futex2);
     put_futex(waiter->futex);
     waiter->futex = futex2;
+    __atomic_store_n(&waiter->bucket, bucket2, __ATOMIC_RELEASE);
     LISTP_ADD_TAIL(waiter, &futex2->waiters, list);
 }
 
@@ -273,9 +249,16 @@ static void move_futex_waiter(struct futex_waiter* waiter, struct shim_futex* fu
 static struct shim_futex* create_new_futex(uint32_t* uaddr) {
     struct shim_futex* futex;
 
-    futex = calloc(1, sizeof(*futex));
-    if (!futex) {
-        return NULL;
+    struct shim_thread* cur_thread = get_cur_thread();
+    if (cur_thread && cur_thread->spare_futex) {
+        futex = cur_thread->spare_futex;
+        cur_thread->spare_futex = NULL;
+        memset(futex, 0, sizeof(*futex));
+    } else {
+        futex = calloc(1, sizeof(*futex));
+        if (!futex) {
+            return NULL;
+        }
     }
 
     REF_SET(futex->_ref_count, 1);
@@ -283,23 +266,22 @@ static struct shim_futex* create_new_futex(uint32_t* uaddr) {
     futex->uaddr = uaddr;
     futex->in_tree = false;
     INIT_LISTP(&futex->waiters);
-    spinlock_init(&futex->lock);
 
     return futex;
 }
 
 /*
- * Finds a futex in `g_futex_tree`.
- * Must be called with `g_futex_tree_lock` held.
+ * Finds a futex in the tree of `bucket`.
+ * Must be called with `bucket->lock` held.
  * Increases refcount of futex by 1.
  */
-static struct shim_futex* find_futex(uint32_t* uaddr) {
-    assert(spinlock_is_locked(&g_futex_tree_lock));
+static struct shim_futex* find_futex(struct futex_bucket* bucket, uint32_t* uaddr) {
+    assert(spinlock_is_locked(&bucket->lock));
     struct shim_futex* futex = NULL;
     struct shim_futex cmp_arg = {
         .uaddr = uaddr
     };
-    struct avl_tree_node* node = avl_tree_find(&g_futex_tree, &cmp_arg.tree_node);
+    struct avl_tree_node* node = avl_tree_find(&bucket->tree, &cmp_arg.tree_node);
     if (!node) {
         return NULL;
     }
@@ -309,57 +291,87 @@ static struct shim_futex* find_futex(uint32_t* uaddr) {
     return futex;
 }
 
+/*
+ * Finds a futex in the tree of `bucket`, creating it if needed. `*tmp` is a spare futex that is
+ * used if we have to create one; if it is NULL, it gets allocated (with `bucket->lock` temporarily
+ * released). An unused spare stays in `*tmp` and must be put by the caller.
+ * Must be called with `bucket->lock` held. Increases refcount of the returned futex by 1.
+ */
+static struct shim_futex* find_or_create_futex(struct futex_bucket* bucket, uint32_t* uaddr,
+                                               struct shim_futex** tmp) {
+    assert(spinlock_is_locked(&bucket->lock));
+
+    struct shim_futex* futex = find_futex(bucket, uaddr);
+    if (futex) {
+        return futex;
+    }
+
+    if (!*tmp) {
+        spinlock_unlock(&bucket->lock);
+        *tmp = create_new_futex(uaddr);
+        spinlock_lock(&bucket->lock);
+        if (!*tmp) {
+            return NULL;
+        }
+
+        futex = find_futex(bucket, uaddr);
+        if (futex) {
+            return futex;
+        }
+    }
+
+    futex = *tmp;
+    *tmp = NULL;
+    enqueue_futex(bucket, futex);
+    return futex;
+}
+
 static int futex_wait(uint32_t* uaddr, uint32_t val, uint64_t timeout, uint32_t bitset) {
     int ret = 0;
     struct shim_futex* futex = NULL;
     struct shim_thread* thread = NULL;
     struct shim_futex* tmp = NULL;
+    struct futex_bucket* bucket = futex_bucket(uaddr);
 
-    spinlock_lock(&g_futex_tree_lock);
-    futex = find_futex(uaddr);
+    spinlock_lock(&bucket->lock);
+    futex = find_or_create_futex(bucket, uaddr, &tmp);
     if (!futex) {
-        spinlock_unlock(&g_futex_tree_lock);
-        tmp = create_new_futex(uaddr);
-        if (!tmp) {
-            return -ENOMEM;
-        }
-        spinlock_lock(&g_futex_tree_lock);
-        futex = find_futex(uaddr);
-        if (!futex) {
-            enqueue_futex(tmp);
-            futex = tmp;
-            tmp = NULL;
-        }
+        spinlock_unlock(&bucket->lock);
+        return -ENOMEM;
     }
-    spinlock_lock(&futex->lock);
-    spinlock_unlock(&g_futex_tree_lock);
 
     if (__atomic_load_n(uaddr, __ATOMIC_RELAXED) != val) {
         ret = -EAGAIN;
-        goto out_with_futex_lock;
+        goto out_with_bucket_lock;
     }
 
     thread_prepare_wait();
 
     struct futex_waiter waiter = {0};
-    add_futex_waiter(&waiter, futex, bitset);
+    add_futex_waiter(&waiter, bucket, futex, bitset);
 
-    spinlock_unlock(&futex->lock);
+    spinlock_unlock(&bucket->lock);
 
     /* Give up this futex reference - we have no idea what futex we will be on once we wake up
      * (due to possible requeues). */
     put_futex(futex);
     futex = NULL;
 
-    ret = thread_wait(timeout != NO_TIMEOUT ? &timeout : NULL, /*ignore_pending_signals=*/false);
+    /* A short critical section of another thread often ends (with a wakeup) before blocking would
+     * even start, so spin a little first. Then the waker does not need to signal a sleeping thread
+     * either, which on SGX saves an OCALL on both sides. */
+    if (g_futex_spin_iterations && thread_spin_wait(g_futex_spin_iterations)) {
+        ret = 0;
+    } else {
+        ret = thread_wait(timeout != NO_TIMEOUT ? &timeout : NULL,
+                          /*ignore_pending_signals=*/false);
+    }
 
-    spinlock_lock(&g_futex_tree_lock);
     /* We might have been requeued. Grab the (possibly new) futex reference. */
+    bucket = lock_waiter_bucket(&waiter);
     futex = waiter.futex;
     assert(futex);
     get_futex(futex);
-    spinlock_lock(&futex->lock);
-    spinlock_unlock(&g_futex_tree_lock);
 
     if (!LIST_EMPTY(&waiter, list)) {
         /* If we woke up due to time out or a signal, we were not removed from the waiters list
@@ -379,16 +391,9 @@ static int futex_wait(uint32_t* uaddr, uint32_t val, uint64_t timeout, uint32_t
      * NB: actually `futex` and this point to the same futex, so this won't call free. */
     put_futex(waiter.futex);
 
-out_with_futex_lock:; // C is awesome!
-    /* Because dequeuing a futex requires `g_futex_tree_lock` which we do not hold at this moment,
-     * we check if we actually need to do it now (locks acquisition and dequeuing). */
-    bool needs_dequeue = check_dequeue_futex(futex);
-
-    spinlock_unlock(&futex->lock);
-
-    if (needs_dequeue) {
-        maybe_dequeue_futex(futex);
-    }
+out_with_bucket_lock:
+    maybe_dequeue_futex(bucket, futex);
+    spinlock_unlock(&bucket->lock);
 
     if (thread) {
         put_thread(thread);
@@ -406,14 +411,12 @@ out_with_futex_lock:; // C is awesome!
  * In the Linux kernel the number of waiters to wake has type `int` and we follow that here.
  * Normally `bitset` has to be non-zero, here zero means: do not even check it.
  *
- * Must be called with `futex->lock` held.
+ * Must be called with the lock of the bucket of `futex` held.
  *
  * Returns number of threads woken.
  */
 static int move_to_wake_queue(struct shim_futex* futex, uint32_t bitset, int to_wake,
                               struct wake_queue_head* queue) {
-    assert(spinlock_is_locked(&futex->lock));
-
     struct futex_waiter* waiter;
     struct futex_waiter* wtmp;
     struct shim_thread* thread;
@@ -442,29 +445,23 @@ static int futex_wake(uint32_t* uaddr, int to_wake, uint32_t bitset) {
     struct shim_futex* futex;
     struct wake_queue_head queue = {.first = WAKE_QUEUE_TAIL};
     int woken = 0;
+    struct futex_bucket* bucket = futex_bucket(uaddr);
 
     if (!bitset) {
         return -EINVAL;
     }
 
-    spinlock_lock(&g_futex_tree_lock);
-    futex = find_futex(uaddr);
+    spinlock_lock(&bucket->lock);
+    futex = find_futex(bucket, uaddr);
     if (!futex) {
-        spinlock_unlock(&g_futex_tree_lock);
+        spinlock_unlock(&bucket->lock);
         return 0;
     }
-    spinlock_lock(&futex->lock);
-    spinlock_unlock(&g_futex_tree_lock);
 
     woken = move_to_wake_queue(futex, bitset, to_wake, &queue);
 
-    bool needs_dequeue = check_dequeue_futex(futex);
-
-    spinlock_unlock(&futex->lock);
-
-    if (needs_dequeue) {
-        maybe_dequeue_futex(futex);
-    }
+    maybe_dequeue_futex(bucket, futex);
+    spinlock_unlock(&bucket->lock);
 
     wake_queue(&queue);
 
@@ -489,15 +486,12 @@ static int futex_wake_op(uint32_t* uaddr1, uint32_t* uaddr2, int to_wake1, int t
     struct shim_futex* futex2 = NULL;
     struct wake_queue_head queue = {.first = WAKE_QUEUE_TAIL};
     int ret = 0;
-    bool needs_dequeue1 = false;
-    bool needs_dequeue2 = false;
+    struct futex_bucket* bucket1 = futex_bucket(uaddr1);
+    struct futex_bucket* bucket2 = futex_bucket(uaddr2);
 
-    spinlock_lock(&g_futex_tree_lock);
-    futex1 = find_futex(uaddr1);
-    futex2 = find_futex(uaddr2);
-
-    lock_two_futexes(futex1, futex2);
-    spinlock_unlock(&g_futex_tree_lock);
+    lock_two_buckets(bucket1, bucket2);
+    futex1 = find_futex(bucket1, uaddr1);
+    futex2 = find_futex(bucket2, uaddr2);
 
     unsigned int op = (val3 >> 28) & 0x7; // highest bit is for FUTEX_OP_OPARG_SHIFT
     unsigned int cmp = (val3 >> 24) & 0xf;
@@ -567,19 +561,15 @@ static int futex_wake_op(uint32_t* uaddr1, uint32_t* uaddr2, int to_wake1, int t
 
     if (futex1) {
         ret += move_to_wake_queue(futex1, 0, to_wake1, &queue);
-        needs_dequeue1 = check_dequeue_futex(futex1);
+        maybe_dequeue_futex(bucket1, futex1);
     }
     if (futex2 && cmpval) {
         ret += move_to_wake_queue(futex2, 0, to_wake2, &queue);
-        needs_dequeue2 = check_dequeue_futex(futex2);
+        maybe_dequeue_futex(bucket2, futex2);
     }
 
 out_unlock:
-    unlock_two_futexes(futex1, futex2);
-
-    if (needs_dequeue1 || needs_dequeue2) {
-        maybe_dequeue_two_futexes(futex1, futex2);
-    }
+    unlock_two_buckets(bucket1, bucket2);
 
     if (ret > 0) {
         wake_queue(&queue);
@@ -594,6 +584,32 @@ out_unlock:
     return ret;
 }
 
+/*
+ * Locks the buckets of `uaddr1` and `uaddr2` and finds the futexes of both addresses for a requeue.
+ * The target futex is created if needed, `*futex1` is NULL if nobody waits on `uaddr1`. On success
+ * both bucket locks are held; an unused spare futex is left in `*tmp` and must be put by the caller.
+ */
+static int lock_requeue_futexes(struct futex_bucket* bucket1, uint32_t* uaddr1,
+                                struct futex_bucket* bucket2, uint32_t* uaddr2,
+                                struct shim_futex** futex1, struct shim_futex** futex2,
+                                struct shim_futex** tmp) {
+    lock_two_buckets(bucket1, bucket2);
+    *futex2 = find_futex(bucket2, uaddr2);
+    if (!*futex2) {
+        /* `find_or_create_futex` would drop only one of the bucket locks, allocate here. */
+        unlock_two_buckets(bucket1, bucket2);
+        *tmp = create_new_futex(uaddr2);
+        if (!*tmp) {
+            return -ENOMEM;
+        }
+        lock_two_buckets(bucket1, bucket2);
+        *futex2 = find_or_create_futex(bucket2, uaddr2, tmp);
+    }
+    assert(*futex2);
+    *futex1 = find_futex(bucket1, uaddr1);
+    return 0;
+}
+
 static int futex_requeue(uint32_t* uaddr1, uint32_t* uaddr2, int to_wake, int to_requeue,
                          uint32_t* val) {
     struct shim_futex* futex1 = NULL;
@@ -606,35 +622,17 @@ static int futex_requeue(uint32_t* uaddr1, uint32_t* uaddr2, int to_wake, int to
     struct futex_waiter* waiter;
     struct futex_waiter* wtmp;
     struct shim_thread* thread;
-    bool needs_dequeue1 = false;
-    bool needs_dequeue2 = false;
+    struct futex_bucket* bucket1 = futex_bucket(uaddr1);
+    struct futex_bucket* bucket2 = futex_bucket(uaddr2);
 
     if (to_wake < 0 || to_requeue < 0) {
         return -EINVAL;
     }
 
-    spinlock_lock(&g_futex_tree_lock);
-    futex2 = find_futex(uaddr2);
-    if (!futex2) {
-        spinlock_unlock(&g_futex_tree_lock);
-        tmp = create_new_futex(uaddr2);
-        if (!tmp) {
-            return -ENOMEM;
-        }
-        needs_dequeue2 = true;
-
-        spinlock_lock(&g_futex_tree_lock);
-        futex2 = find_futex(uaddr2);
-        if (!futex2) {
-            enqueue_futex(tmp);
-            futex2 = tmp;
-            tmp = NULL;
-        }
+    ret = lock_requeue_futexes(bucket1, uaddr1, bucket2, uaddr2, &futex1, &futex2, &tmp);
+    if (ret < 0) {
+        return ret;
     }
-    futex1 = find_futex(uaddr1);
-
-    lock_two_futexes(futex1, futex2);
-    spinlock_unlock(&g_futex_tree_lock);
 
     if (val != NULL) {
         if (__atomic_load_n(uaddr1, __ATOMIC_RELAXED) != *val) {
@@ -654,26 +652,379 @@ static int futex_requeue(uint32_t* uaddr1, uint32_t* uaddr2, int to_wake, int to
                 put_thread(thread);
                 ++woken;
             } else if (requeued < to_requeue) {
-                move_futex_waiter(waiter, futex1, futex2);
+                move_futex_waiter(waiter, futex1, bucket2, futex2);
                 ++requeued;
             } else {
                 break;
             }
         }
 
-        needs_dequeue1 = check_dequeue_futex(futex1);
-        needs_dequeue2 = check_dequeue_futex(futex2);
-
         ret = woken + requeued;
     }
 
 out_unlock:
-    unlock_two_futexes(futex1, futex2);
+    if (futex1) {
+        maybe_dequeue_futex(bucket1, futex1);
+    }
+    maybe_dequeue_futex(bucket2, futex2);
+    unlock_two_buckets(bucket1, bucket2);
 
-    if (needs_dequeue1 || needs_dequeue2) {
-        maybe_dequeue_two_futexes(futex1, futex2);
+    if (woken > 0) {
+        wake_queue(&queue);
     }
 
+    if (futex1) {
+        put_futex(futex1);
+    }
+    put_futex(futex2);
+
+    if (tmp) {
+        put_futex(tmp);
+    }
+
+    return ret;
+}
+
+/*
+ * PI futexes. The futex word holds the TID of the owner, FUTEX_WAITERS if there may be threads
+ * queued on it and FUTEX_OWNER_DIED. Graphene does not schedule threads by priority, so there is no
+ * priority to inherit; what we implement is the ownership protocol. An unlock hands the lock over
+ * to the first waiter directly (by writing its TID to the futex word), so each unlock wakes exactly
+ * one thread, and that thread does not have to compete for the lock again.
+ */
+
+/*
+ * Takes the PI futex at `uaddr` for the thread `tid` if it is free, setting FUTEX_WAITERS if
+ * `has_waiters`. If the futex is owned by another thread and `mark` is set, sets FUTEX_WAITERS, so
+ * that the owner has to unlock it via FUTEX_UNLOCK_PI.
+ *
+ * The lock of the bucket of `uaddr` needs to be held.
+ *
+ * Returns 1 if the futex was taken, 0 if it is owned by another thread, -EDEADLK if it is already
+ * owned by `tid`.
+ */
+static int futex_pi_take_or_mark(uint32_t* uaddr, uint32_t tid, bool has_waiters, bool mark) {
+    uint32_t val = __atomic_load_n(uaddr, __ATOMIC_RELAXED);
+    while (true) {
+        uint32_t new_val;
+        if (!(val & FUTEX_TID_MASK)) {
+            new_val = tid | (val & FUTEX_OWNER_DIED) | (has_waiters ? FUTEX_WAITERS : 0);
+        } else if ((val & FUTEX_TID_MASK) == tid) {
+            return -EDEADLK;
+        } else if (!mark || (val & FUTEX_WAITERS)) {
+            return 0;
+        } else {
+            new_val = val | FUTEX_WAITERS;
+        }
+
+        if (__atomic_compare_exchange_n(uaddr, &val, new_val, /*weak=*/false, __ATOMIC_ACQUIRE,
+                                        __ATOMIC_RELAXED)) {
+            return (new_val & FUTEX_TID_MASK) == tid ? 1 : 0;
+        }
+    }
+}
+
+static int futex_lock_pi(uint32_t* uaddr, uint64_t timeout, bool trylock) {
+    int ret;
+    uint32_t tid = get_cur_thread()->tid;
+    struct shim_futex* tmp = NULL;
+    struct futex_bucket* bucket = futex_bucket(uaddr);
+
+    while (true) {
+        spinlock_lock(&bucket->lock);
+        struct shim_futex* futex = find_or_create_futex(bucket, uaddr, &tmp);
+        if (!futex) {
+            spinlock_unlock(&bucket->lock);
+            return -ENOMEM;
+        }
+
+        ret = futex_pi_take_or_mark(uaddr, tid, !LISTP_EMPTY(&futex->waiters), /*mark=*/!trylock);
+        if (ret != 0 || trylock) {
+            maybe_dequeue_futex(bucket, futex);
+            spinlock_unlock(&bucket->lock);
+            put_futex(futex);
+            ret = ret == 1 ? 0 : (ret == 0 ? -EAGAIN : ret);
+            break;
+        }
+
+        thread_prepare_wait();
+
+        struct futex_waiter waiter = {0};
+        add_futex_waiter(&waiter, bucket, futex, FUTEX_BITSET_MATCH_ANY);
+
+        spinlock_unlock(&bucket->lock);
+        put_futex(futex);
+
+        if (g_futex_spin_iterations && thread_spin_wait(g_futex_spin_iterations)) {
+            ret = 0;
+        } else {
+            ret = thread_wait(timeout != NO_TIMEOUT ? &timeout : NULL,
+                              /*ignore_pending_signals=*/false);
+        }
+
+        /* PI waiters are never requeued away from their futex, but keep to the usual protocol. */
+        bucket = lock_waiter_bucket(&waiter);
+        futex = waiter.futex;
+        get_futex(futex);
+
+        bool owner = (__atomic_load_n(uaddr, __ATOMIC_RELAXED) & FUTEX_TID_MASK) == tid;
+        struct shim_thread* thread = NULL;
+        if (!LIST_EMPTY(&waiter, list)) {
+            thread = remove_futex_waiter(&waiter, futex);
+        }
+        put_futex(waiter.futex);
+
+        maybe_dequeue_futex(bucket, futex);
+        spinlock_unlock(&bucket->lock);
+
+        if (thread) {
+            put_thread(thread);
+        }
+        put_futex(futex);
+
+        if (owner) {
+            /* The lock was handed over to us, even if we timed out in the meantime. */
+            ret = 0;
+            break;
+        }
+        if (ret == -EINTR) {
+            ret = -ERESTARTNOINTR;
+            break;
+        }
+        if (ret < 0) {
+            break;
+        }
+        /* Woken up without getting the lock (e.g. its owner died), try again. */
+    }
+
+    if (tmp) {
+        put_futex(tmp);
+    }
+    return ret;
+}
+
+static int futex_unlock_pi(uint32_t* uaddr) {
+    int ret = 0;
+    uint32_t tid = get_cur_thread()->tid;
+    struct wake_queue_head queue = {.first = WAKE_QUEUE_TAIL};
+    struct futex_waiter* waiter = NULL;
+    struct futex_bucket* bucket = futex_bucket(uaddr);
+
+    spinlock_lock(&bucket->lock);
+    struct shim_futex* futex = find_futex(bucket, uaddr);
+    if (futex) {
+        waiter = LISTP_FIRST_ENTRY(&futex->waiters, struct futex_waiter, list);
+    }
+
+    uint32_t val = __atomic_load_n(uaddr, __ATOMIC_RELAXED);
+    while (true) {
+        if ((val & FUTEX_TID_MASK) != tid) {
+            ret = -EPERM;
+            goto out;
+        }
+
+        uint32_t new_val = 0;
+        if (waiter) {
+            new_val = waiter->thread->tid;
+            if (LISTP_NEXT_ENTRY(waiter, &futex->waiters, list)) {
+                new_val |= FUTEX_WAITERS;
+            }
+        }
+        if (__atomic_compare_exchange_n(uaddr, &val, new_val, /*weak=*/false, __ATOMIC_RELEASE,
+                                        __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+
+    if (waiter) {
+        struct shim_thread* thread = remove_futex_waiter(waiter, futex);
+        add_thread_to_queue(&queue, thread);
+        put_thread(thread);
+    }
+
+out:
+    if (futex) {
+        maybe_dequeue_futex(bucket, futex);
+    }
+    spinlock_unlock(&bucket->lock);
+
+    wake_queue(&queue);
+
+    if (futex) {
+        put_futex(futex);
+    }
+    return ret;
+}
+
+/*
+ * Waits on `uaddr` (like FUTEX_WAIT) until FUTEX_CMP_REQUEUE_PI makes this thread the owner of the
+ * PI futex `uaddr2` or requeues it there.
+ */
+static int futex_wait_requeue_pi(uint32_t* uaddr, uint32_t val, uint64_t timeout,
+                                 uint32_t* uaddr2) {
+    int ret = 0;
+    uint32_t tid = get_cur_thread()->tid;
+    struct shim_futex* tmp = NULL;
+    struct futex_bucket* bucket = futex_bucket(uaddr);
+
+    if (uaddr == uaddr2) {
+        return -EINVAL;
+    }
+
+    spinlock_lock(&bucket->lock);
+    struct shim_futex* futex = find_or_create_futex(bucket, uaddr, &tmp);
+    if (!futex) {
+        spinlock_unlock(&bucket->lock);
+        return -ENOMEM;
+    }
+
+    if (__atomic_load_n(uaddr, __ATOMIC_RELAXED) != val) {
+        maybe_dequeue_futex(bucket, futex);
+        spinlock_unlock(&bucket->lock);
+        put_futex(futex);
+        if (tmp) {
+            put_futex(tmp);
+        }
+        return -EAGAIN;
+    }
+
+    thread_prepare_wait();
+
+    struct futex_waiter waiter = {0};
+    add_futex_waiter(&waiter, bucket, futex, FUTEX_BITSET_MATCH_ANY);
+    waiter.requeue_pi_uaddr = uaddr2;
+
+    spinlock_unlock(&bucket->lock);
+    put_futex(futex);
+    if (tmp) {
+        put_futex(tmp);
+    }
+
+    if (g_futex_spin_iterations && thread_spin_wait(g_futex_spin_iterations)) {
+        ret = 0;
+    } else {
+        ret = thread_wait(timeout != NO_TIMEOUT ? &timeout : NULL,
+                          /*ignore_pending_signals=*/false);
+    }
+
+    bucket = lock_waiter_bucket(&waiter);
+    futex = waiter.futex;
+    get_futex(futex);
+
+    /* `uaddr2` is taken on our behalf with both bucket locks held and handed over with the lock of
+     * its bucket held, so this check is stable whichever of the two buckets we are on now. */
+    bool owner = (__atomic_load_n(uaddr2, __ATOMIC_RELAXED) & FUTEX_TID_MASK) == tid;
+    bool requeued = futex->uaddr == uaddr2;
+    struct shim_thread* thread = NULL;
+    if (!LIST_EMPTY(&waiter, list)) {
+        thread = remove_futex_waiter(&waiter, futex);
+    }
+    put_futex(waiter.futex);
+
+    maybe_dequeue_futex(bucket, futex);
+    spinlock_unlock(&bucket->lock);
+
+    if (thread) {
+        put_thread(thread);
+    }
+    put_futex(futex);
+
+    if (owner) {
+        return 0;
+    }
+    if (thread) {
+        /* Timed out or interrupted while still queued. Once requeued, a restart would just fail the
+         * `val` check, so report that right away (as Linux does). */
+        if (ret == -ETIMEDOUT) {
+            return ret;
+        }
+        return requeued ? -EAGAIN : -ERESTARTNOINTR;
+    }
+    if (requeued) {
+        /* Woken up on `uaddr2` without getting it (e.g. its owner died), take it the usual way. */
+        return futex_lock_pi(uaddr2, timeout, /*trylock=*/false);
+    }
+    /* Woken up by a plain FUTEX_WAKE on `uaddr`. */
+    return -EAGAIN;
+}
+
+/*
+ * Wakes one waiter of `uaddr1` as the owner of the PI futex `uaddr2`, if it can be taken right
+ * away, and requeues at most `to_requeue` waiters (including that one, if it could not) to `uaddr2`.
+ * This is what a condition variable broadcast with a PI mutex does: only one thread runs, others
+ * wait for the mutex instead of all of them waking up and fighting for it.
+ */
+static int futex_cmp_requeue_pi(uint32_t* uaddr1, uint32_t* uaddr2, int to_wake, int to_requeue,
+                                uint32_t val) {
+    struct shim_futex* futex1 = NULL;
+    struct shim_futex* futex2 = NULL;
+    struct shim_futex* tmp = NULL;
+    struct wake_queue_head queue = {.first = WAKE_QUEUE_TAIL};
+    int ret = 0;
+    int woken = 0;
+    int requeued = 0;
+    struct futex_waiter* waiter;
+    struct futex_waiter* wtmp;
+    struct futex_bucket* bucket1 = futex_bucket(uaddr1);
+    struct futex_bucket* bucket2 = futex_bucket(uaddr2);
+
+    /* Linux allows waking only one waiter, the rest has to wait for the mutex anyway. */
+    if (to_wake != 1 || to_requeue < 0 || uaddr1 == uaddr2) {
+        return -EINVAL;
+    }
+
+    ret = lock_requeue_futexes(bucket1, uaddr1, bucket2, uaddr2, &futex1, &futex2, &tmp);
+    if (ret < 0) {
+        return ret;
+    }
+
+    if (__atomic_load_n(uaddr1, __ATOMIC_RELAXED) != val) {
+        ret = -EAGAIN;
+        goto out_unlock;
+    }
+
+    if (futex1) {
+        bool first = true;
+        LISTP_FOR_EACH_ENTRY_SAFE(waiter, wtmp, &futex1->waiters, list) {
+            if (waiter->requeue_pi_uaddr != uaddr2) {
+                continue;
+            }
+
+            if (first) {
+                first = false;
+                bool has_waiters = to_requeue > 0 || !LISTP_EMPTY(&futex2->waiters);
+                ret = futex_pi_take_or_mark(uaddr2, waiter->thread->tid, has_waiters,
+                                            /*mark=*/true);
+                if (ret < 0) {
+                    goto out_unlock;
+                }
+                if (ret == 1) {
+                    struct shim_thread* thread = remove_futex_waiter(waiter, futex1);
+                    add_thread_to_queue(&queue, thread);
+                    put_thread(thread);
+                    ++woken;
+                    continue;
+                }
+                /* The owner of `uaddr2` now has to unlock it through us. */
+            }
+
+            if (requeued >= to_requeue) {
+                break;
+            }
+            move_futex_waiter(waiter, futex1, bucket2, futex2);
+            ++requeued;
+        }
+    }
+
+    ret = woken + requeued;
+
+out_unlock:
+    if (futex1) {
+        maybe_dequeue_futex(bucket1, futex1);
+    }
+    maybe_dequeue_futex(bucket2, futex2);
+    unlock_two_buckets(bucket1, bucket2);
+
     if (woken > 0) {
         wake_queue(&queue);
     }
@@ -681,7 +1032,6 @@ out_unlock:
     if (futex1) {
         put_futex(futex1);
     }
-    assert(futex2);
     put_futex(futex2);
 
     if (tmp) {
@@ -794,11 +1144,29 @@ static int _shim_do_futex(uint32_t* uaddr, int op, uint32_t val, void* utime, ui
             return futex_requeue(uaddr, uaddr2, val, val2, &val3);
         case FUTEX_LOCK_PI:
         case FUTEX_TRYLOCK_PI:
+            ret = is_valid_futex_ptr(uaddr, FUTEX_CHECK_WRITE);
+            if (ret) {
+                return ret;
+            }
+            return futex_lock_pi(uaddr, timeout, cmd == FUTEX_TRYLOCK_PI);
         case FUTEX_UNLOCK_PI:
+            ret = is_valid_futex_ptr(uaddr, FUTEX_CHECK_WRITE);
+            if (ret) {
+                return ret;
+            }
+            return futex_unlock_pi(uaddr);
         case FUTEX_CMP_REQUEUE_PI:
+            ret = is_valid_futex_ptr(uaddr2, FUTEX_CHECK_WRITE);
+            if (ret) {
+                return ret;
+            }
+            return futex_cmp_requeue_pi(uaddr, uaddr2, val, val2, val3);
         case FUTEX_WAIT_REQUEUE_PI:
-            log_warning("PI futexes are not yet supported!");
-            return -ENOSYS;
+            ret = is_valid_futex_ptr(uaddr2, FUTEX_CHECK_WRITE);
+            if (ret) {
+                return ret;
+            }
+            return futex_wait_requeue_pi(uaddr, val, timeout, uaddr2);
         default:
             log_warning("Invalid futex op: %d", cmd);
             return -ENOSYS;
@@ -850,24 +1218,22 @@ out:
 }
 
 /*
- * Process one robust futex, waking a waiter if present.
+ * Process one robust futex of the dead thread `tid`, waking a waiter if present.
  * Returns 0 on success, negative value otherwise.
  */
-static bool handle_futex_death(uint32_t* uaddr) {
+static int handle_futex_death(uint32_t* uaddr, IDTYPE tid) {
     uint32_t val;
 
-    if (!IS_ALIGNED_PTR(uaddr, alignof(*uaddr))) {
-        return -EINVAL;
-    }
-    if (!is_valid_futex_ptr(uaddr, FUTEX_CHECK_WRITE)) {
-        return -EFAULT;
+    int ret = is_valid_futex_ptr(uaddr, FUTEX_CHECK_WRITE);
+    if (ret < 0) {
+        return ret;
     }
 
     /* Loop until we successfully set the futex word or see someone else taking this futex. */
     while (1) {
         val = __atomic_load_n(uaddr, __ATOMIC_RELAXED);
 
-        if ((val & FUTEX_TID_MASK) != get_cur_thread()->tid) {
+        if ((val & FUTEX_TID_MASK) != tid) {
             /* Someone else is holding this futex. */
             return 0;
         }
@@ -891,15 +1257,16 @@ static bool handle_futex_death(uint32_t* uaddr) {
 }
 
 /*
- * Fetches robust list entry from user memory, checking invalid pointers.
+ * Fetches robust list entry from user memory, checking invalid pointers. Bit 0 of the pointer marks
+ * an entry of a PI futex; we handle both kinds the same way, so it is just dropped.
  * Returns 0 on success, negative value on error.
  */
-static bool fetch_robust_entry(struct robust_list** entry, struct robust_list** head) {
+static int fetch_robust_entry(struct robust_list** entry, struct robust_list** head) {
     if (!is_user_memory_readable(head, sizeof(*head))) {
         return -EFAULT;
     }
 
-    *entry = *head;
+    *entry = (struct robust_list*)((uintptr_t)*head & ~1UL);
     return 0;
 }
 
@@ -908,11 +1275,12 @@ static uint32_t* entry_to_futex(struct robust_list* entry, long futex_offset) {
 }
 
 /*
- * Release all robust futexes.
+ * Release all robust futexes of the thread `tid`, which has exited (this does not run on that
+ * thread).
  * The list itself is in user provided memory - we need to check each pointer before dereferencing
  * it. If any check fails, we silently return and ignore the rest.
  */
-void release_robust_list(struct robust_list_head* head) {
+void release_robust_list(struct robust_list_head* head, IDTYPE tid) {
     struct robust_list* entry;
     struct robust_list* pending;
     long futex_offset;
@@ -937,10 +1305,10 @@ void release_robust_list(struct robust_list_head* head) {
         struct robust_list* next_entry;
 
         /* Fetch the next entry before waking the next thread. */
-        bool ret = fetch_robust_entry(&next_entry, &entry->next);
+        int ret = fetch_robust_entry(&next_entry, &entry->next);
 
         if (entry != pending) {
-            if (handle_futex_death(entry_to_futex(entry, futex_offset))) {
+            if (handle_futex_death(entry_to_futex(entry, futex_offset), tid)) {
                 return;
             }
         }
@@ -958,7 +1326,7 @@ void release_robust_list(struct robust_list_head* head) {
     }
 
     if (pending) {
-        if (handle_futex_death(entry_to_futex(pending, futex_offset))) {
+        if (handle_futex_death(entry_to_futex(pending, futex_offset), tid)) {
             return;
         }
     }
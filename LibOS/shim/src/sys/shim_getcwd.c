@@ -18,11 +18,59 @@
 #include "shim_thread.h"
 #include "shim_utils.h"
 #include "stat.h"
+#include "seqlock.h"
 
 #ifndef ERANGE
 #define ERANGE 34
 #endif
 
+/*
+ * Formatted path of the last cwd seen by getcwd(), so that repeated calls (some interpreters call
+ * it for every import) copy a string instead of walking the dentry tree and allocating. The cache
+ * holds a reference to its dentry and is valid while `g_process.cwd` is that dentry. Dentries are
+ * never moved (rename() is supported only for regular files), so the path of a dentry never
+ * changes; if directory renames are ever implemented, they must reset `g_cwd_cache.dent`.
+ */
+static struct {
+    seqlock_t lock;
+    struct shim_dentry* dent;
+    size_t size; /* including the null terminator */
+    char path[PATH_MAX];
+} g_cwd_cache = { .lock = INIT_SEQLOCK_UNLOCKED };
+
+/* Copies the cached path of `cwd` into `buf`. Returns the size, -ERANGE or 0 on a cache miss. */
+static long copy_cached_cwd(struct shim_dentry* cwd, char* buf, size_t buf_size) {
+    long ret;
+    uint32_t seq;
+    do {
+        seq = read_seqbegin(&g_cwd_cache.lock);
+        if (g_cwd_cache.dent != cwd) {
+            ret = 0;
+        } else if (g_cwd_cache.size > buf_size) {
+            ret = -ERANGE;
+        } else {
+            /* may copy a torn path, which is then overwritten on retry */
+            memcpy(buf, g_cwd_cache.path, g_cwd_cache.size);
+            ret = g_cwd_cache.size;
+        }
+    } while (read_seqretry(&g_cwd_cache.lock, seq));
+    return ret;
+}
+
+static void update_cwd_cache(struct shim_dentry* cwd, const char* path, size_t size) {
+    get_dentry(cwd);
+
+    write_seqbegin(&g_cwd_cache.lock);
+    struct shim_dentry* old = g_cwd_cache.dent;
+    g_cwd_cache.dent = cwd;
+    g_cwd_cache.size = size;
+    memcpy(g_cwd_cache.path, path, size);
+    write_seqend(&g_cwd_cache.lock);
+
+    if (old)
+        put_dentry(old);
+}
+
 long shim_do_getcwd(char* buf, size_t buf_size) {
     if (!buf || !buf_size)
         return -EINVAL;
@@ -30,6 +78,11 @@ long shim_do_getcwd(char* buf, size_t buf_size) {
     if (!is_user_memory_writable(buf, buf_size))
         return -EFAULT;
 
+    /* only compared against the cached dentry, never dereferenced without `fs_lock` */
+    long ret = copy_cached_cwd(__atomic_load_n(&g_process.cwd, __ATOMIC_ACQUIRE), buf, buf_size);
+    if (ret)
+        return ret;
+
     lock(&g_process.fs_lock);
     struct shim_dentry* cwd = g_process.cwd;
     get_dentry(cwd);
@@ -37,17 +90,20 @@ long shim_do_getcwd(char* buf, size_t buf_size) {
 
     char* path = NULL;
     size_t size;
-    int ret = dentry_abs_path(cwd, &path, &size);
+    ret = dentry_abs_path(cwd, &path, &size);
     if (ret < 0)
         goto out;
 
     if (size > PATH_MAX) {
         ret = -ENAMETOOLONG;
-    } else if (size > buf_size) {
-        ret = -ERANGE;
     } else {
-        ret = size;
-        memcpy(buf, path, size);
+        update_cwd_cache(cwd, path, size);
+        if (size > buf_size) {
+            ret = -ERANGE;
+        } else {
+            ret = size;
+            memcpy(buf, path, size);
+        }
     }
 
     free(path);
@@ -75,7 +131,7 @@ long shim_do_chdir(const char* filename) {
 
     lock(&g_process.fs_lock);
     put_dentry(g_process.cwd);
-    g_process.cwd = dent;
+    __atomic_store_n(&g_process.cwd, dent, __ATOMIC_RELEASE);
     unlock(&g_process.fs_lock);
     return 0;
 }
@@ -100,7 +156,7 @@ long shim_do_fchdir(int fd) {
     lock(&g_process.fs_lock);
     get_dentry(dent);
     put_dentry(g_process.cwd);
-    g_process.cwd = dent;
+    __atomic_store_n(&g_process.cwd, dent, __ATOMIC_RELEASE);
     unlock(&g_process.fs_lock);
     put_handle(hdl);
     return 0;
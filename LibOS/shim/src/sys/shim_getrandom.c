@@ -8,6 +8,7 @@
 
 #include "shim_internal.h"
 #include "shim_table.h"
+#include "shim_utils.h"
 
 long shim_do_getrandom(char* buf, size_t count, unsigned int flags) {
     if (flags & ~(GRND_NONBLOCK | GRND_RANDOM | GRND_INSECURE))
@@ -23,12 +24,12 @@ long shim_do_getrandom(char* buf, size_t count, unsigned int flags) {
     if (!is_user_memory_writable(buf, count))
         return -EFAULT;
 
-    /* In theory, DkRandomBitsRead may block on some PALs (which conflicts with GRND_NONBLOCK flag),
-     * but this shouldn't be possible in practice, so we don't care.
+    /* In theory, seeding from DkRandomBitsRead may block on some PALs (which conflicts with
+     * GRND_NONBLOCK flag), but this shouldn't be possible in practice, so we don't care. There is
+     * no separate blocking pool either (as in Linux 5.6+), GRND_RANDOM gets the same bytes.
      */
-    int ret = DkRandomBitsRead(buf, count);
+    int ret = get_random_bytes(buf, count);
     if (ret < 0) {
-        ret = pal_to_unix_errno(ret);
         if (ret == -EINTR) {
             ret = -ERESTARTSYS;
         }
@@ -12,42 +12,29 @@
 #include "shim_thread.h"
 #include "shim_types.h"
 
+/* Credentials of a thread are changed only by the thread itself (other threads read them under
+ * `thread->lock`), so the getters below need no lock. */
+
 long shim_do_getuid(void) {
-    struct shim_thread* current = get_cur_thread();
-    lock(&current->lock);
-    uid_t uid = current->uid;
-    unlock(&current->lock);
-    return uid;
+    return __atomic_load_n(&get_cur_thread()->uid, __ATOMIC_RELAXED);
 }
 
 long shim_do_getgid(void) {
-    struct shim_thread* current = get_cur_thread();
-    lock(&current->lock);
-    gid_t gid = current->gid;
-    unlock(&current->lock);
-    return gid;
+    return __atomic_load_n(&get_cur_thread()->gid, __ATOMIC_RELAXED);
 }
 
 long shim_do_geteuid(void) {
-    struct shim_thread* current = get_cur_thread();
-    lock(&current->lock);
-    uid_t euid = current->euid;
-    unlock(&current->lock);
-    return euid;
+    return __atomic_load_n(&get_cur_thread()->euid, __ATOMIC_RELAXED);
 }
 
 long shim_do_getegid(void) {
-    struct shim_thread* current = get_cur_thread();
-    lock(&current->lock);
-    gid_t egid = current->egid;
-    unlock(&current->lock);
-    return egid;
+    return __atomic_load_n(&get_cur_thread()->egid, __ATOMIC_RELAXED);
 }
 
 long shim_do_setuid(uid_t uid) {
     struct shim_thread* current = get_cur_thread();
     lock(&current->lock);
-    current->euid = uid;
+    __atomic_store_n(&current->euid, uid, __ATOMIC_RELAXED);
     unlock(&current->lock);
     return 0;
 }
@@ -55,7 +42,7 @@ long shim_do_setuid(uid_t uid) {
 long shim_do_setgid(gid_t gid) {
     struct shim_thread* current = get_cur_thread();
     lock(&current->lock);
-    current->egid = gid;
+    __atomic_store_n(&current->egid, gid, __ATOMIC_RELAXED);
     unlock(&current->lock);
     return 0;
 }
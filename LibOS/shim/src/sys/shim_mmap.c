@@ -46,6 +46,28 @@
                        | MAP_HUGE_2MB           \
                        | MAP_HUGE_1GB)
 
+/* Maps a file read-only outside of `user_address` without copying it, if the PAL supports it for
+ * this file (see `file_map_untrusted` in PAL_CONTROL); returns -EOPNOTSUPP if it does not. */
+static int mmap_zero_copy(struct shim_handle* hdl, void** addr, size_t length, int flags,
+                          uint64_t offset) {
+    void* mapped = NULL;
+    int ret = hdl->fs->fs_ops->mmap(hdl, &mapped, length, PROT_READ, flags | VMA_ZERO_COPY,
+                                    offset);
+    if (ret < 0)
+        return ret;
+
+    ret = bkeep_mmap_fixed(mapped, length, PROT_READ, flags | VMA_ZERO_COPY | MAP_FIXED_NOREPLACE,
+                           hdl, offset, /*comment=*/NULL);
+    if (ret < 0) {
+        if (DkVirtualMemoryFree(mapped, length) < 0)
+            BUG();
+        return ret;
+    }
+
+    *addr = mapped;
+    return 0;
+}
+
 void* shim_do_mmap(void* addr, size_t length, int prot, int flags, int fd, unsigned long offset) {
     struct shim_handle* hdl = NULL;
     long ret = 0;
@@ -70,7 +92,7 @@ void* shim_do_mmap(void* addr, size_t length, int prot, int flags, int fd, unsig
         return (void*)-EINVAL;
 
     /* This check is Graphene specific. */
-    if (flags & (VMA_UNMAPPED | VMA_TAINTED | VMA_INTERNAL)) {
+    if (flags & (VMA_UNMAPPED | VMA_TAINTED | VMA_INTERNAL | VMA_ZERO_COPY)) {
         return (void*)-EINVAL;
     }
 
@@ -131,6 +153,15 @@ void* shim_do_mmap(void* addr, size_t length, int prot, int flags, int fd, unsig
         flags &= ~MAP_32BIT;
 #endif
 
+    if (hdl && prot == PROT_READ && g_pal_control->file_map_untrusted
+            && hdl->fs == &chroot_builtin_fs
+            && !(flags & (MAP_FIXED | MAP_FIXED_NOREPLACE | MAP_32BIT_IF_SUPPORTED))) {
+        ret = mmap_zero_copy(hdl, &addr, length, flags, offset);
+        if (ret != -EOPNOTSUPP)
+            goto out_handle;
+        ret = 0;
+    }
+
     if (flags & (MAP_FIXED | MAP_FIXED_NOREPLACE)) {
         /* We know that `addr + length` does not overflow (`access_ok` above). */
         if (addr < g_pal_control->user_address.start
@@ -391,7 +422,6 @@ long shim_do_madvise(unsigned long start, size_t len_in, int behavior) {
         case MADV_RANDOM:
         case MADV_SEQUENTIAL:
         case MADV_WILLNEED:
-        case MADV_FREE:
         case MADV_SOFT_OFFLINE:
         case MADV_MERGEABLE:
         case MADV_UNMERGEABLE:
@@ -412,6 +442,10 @@ long shim_do_madvise(unsigned long start, size_t len_in, int behavior) {
         case MADV_DONTNEED: {
             return madvise_dontneed_range(start, start + len);
         }
+
+        case MADV_FREE: {
+            return madvise_free_range(start, start + len);
+        }
     }
     return -EINVAL;
 }
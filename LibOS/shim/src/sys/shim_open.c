@@ -247,6 +247,11 @@ long shim_do_pread64(int fd, char* buf, size_t count, loff_t pos) {
         goto out;
     }
 
+    if (fs->fs_ops->pread) {
+        ret = fs->fs_ops->pread(hdl, buf, count, pos);
+        goto out;
+    }
+
     int offset = fs->fs_ops->seek(hdl, 0, SEEK_CUR);
     if (offset < 0) {
         ret = offset;
@@ -299,6 +304,11 @@ long shim_do_pwrite64(int fd, char* buf, size_t count, loff_t pos) {
         goto out;
     }
 
+    if (fs->fs_ops->pwrite) {
+        ret = fs->fs_ops->pwrite(hdl, buf, count, pos);
+        goto out;
+    }
+
     int offset = fs->fs_ops->seek(hdl, 0, SEEK_CUR);
     if (offset < 0) {
         ret = offset;
@@ -371,24 +381,39 @@ static ssize_t do_getdents(int fd, uint8_t* buf, size_t buf_size, bool is_getden
 
     size_t buf_pos = 0;
     while (dirhdl->pos < dirhdl->count) {
-        struct shim_dentry* dent = dirhdl->dents[dirhdl->pos];
         const char* name;
         size_t name_len;
-
-        if (dirhdl->pos == 0) {
-            name = ".";
-            name_len = 1;
-        } else if (dirhdl->pos == 1) {
-            name = "..";
-            name_len = 2;
+        uint64_t d_ino;
+        char d_type;
+
+        if (dirhdl->pos < 2) {
+            struct shim_dentry* dent = dirhdl->pos == 0 ? dirhdl->dot : dirhdl->dotdot;
+            name = dirhdl->pos == 0 ? "." : "..";
+            name_len = dirhdl->pos + 1;
+            d_ino = dentry_ino(dent);
+            d_type = get_dirent_type(dent->type);
         } else {
-            name = dent->name;
-            name_len = dent->name_len;
+            name = dirhdl->names + dirhdl->name_offs[dirhdl->pos - 2];
+            name_len = strlen(name);
+
+            /* Same as `dentry_ino` of the child, without creating a dentry for it */
+            HASHTYPE name_hash = hash_buf(name, name_len);
+            d_ino = hash_abs_path_child(dirhdl->dot, name_hash);
+
+            /* The entries are not looked up when listing the directory, so report the type only if
+             * the child is already in the dcache. */
+            d_type = LINUX_DT_UNKNOWN;
+            struct shim_dentry* child = __lookup_dcache(dirhdl->dot, name, name_len, name_hash);
+            if (child) {
+                struct shim_dentry* cur = child;
+                while (cur->attached_mount)
+                    cur = cur->attached_mount->root;
+                if ((cur->state & DENTRY_VALID) && !(cur->state & DENTRY_NEGATIVE))
+                    d_type = get_dirent_type(cur->type);
+                put_dentry(child);
+            }
         }
 
-        uint64_t d_ino = dentry_ino(dent);
-        char d_type = get_dirent_type(dent->type);
-
         size_t ent_size;
 
         if (is_getdents64) {
@@ -20,8 +20,8 @@
 #include "shim_utils.h"
 #include "stat.h"
 
-static int create_pipes(struct shim_handle* srv, struct shim_handle* cli, int flags, char* name,
-                        struct shim_qstr* qstr) {
+int create_pipes(struct shim_handle* srv, struct shim_handle* cli, int flags, char* name,
+                 struct shim_qstr* qstr) {
     int ret = 0;
     char uri[PIPE_URI_SIZE];
 
@@ -124,13 +124,12 @@ long shim_do_pipe2(int* filedes, int flags) {
     hdl1->info.pipe.ready_for_ops = true;
     hdl2->info.pipe.ready_for_ops = true;
 
-    ret = create_pipes(hdl1, hdl2, flags, hdl1->info.pipe.name, &hdl1->uri);
+    /* both ends start in this process, so keep the data in LibOS memory; the pipe is moved to a
+     * host pipe only when an end is inherited by a child (see mem_pipe_move_to_host) */
+    ret = mem_pipe_create(hdl1, hdl2, flags);
     if (ret < 0)
         goto out;
 
-    memcpy(hdl2->info.pipe.name, hdl1->info.pipe.name, sizeof(hdl2->info.pipe.name));
-    qstrcopy(&hdl2->uri, &hdl1->uri);
-
     vfd1 = set_new_fd_handle(hdl1, flags & O_CLOEXEC ? FD_CLOEXEC : 0, NULL);
     if (vfd1 < 0) {
         ret = vfd1;
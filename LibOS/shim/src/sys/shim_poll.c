@@ -45,6 +45,130 @@ typedef unsigned long __fd_mask;
 
 #define POLL_NOTIMEOUT ((uint64_t)-1)
 
+/* Up to this many FDs, poll() keeps all its bookkeeping on the stack. */
+#define POLL_STACK_FDS 16
+
+/* for bookkeeping, need to have a mapping FD -> {shim handle, index-in-pals} */
+struct fds_mapping_t {
+    struct shim_handle* hdl; /* NULL if no mapping (handle is not used in polling) */
+    nfds_t idx;              /* index from fds array to pals array */
+};
+
+/*
+ * Per-thread scratch space of poll() and select(). It is kept across calls, so that applications
+ * looping over the same large FD sets do not pay for malloc/free on every iteration.
+ *
+ * select() additionally remembers the fd_sets it was last called with and their translation to
+ * an array of pollfds; if the next call passes identical sets, the translation is reused as is.
+ * Only FD numbers are cached, never handles: every call still looks up the current handle of each
+ * FD, so closing or reusing FDs between calls is always observed.
+ */
+struct shim_poll_cache {
+    /* arrays of `_shim_do_poll()`, all with room for `cap` FDs (`pal_events` holds events followed
+     * by revents, so it is twice as long) */
+    size_t cap;
+    struct fds_mapping_t* fds_mapping;
+    PAL_HANDLE* pals;
+    PAL_FLG* pal_events;
+
+    /* translation of the fd_sets of the last select() call */
+    size_t select_cap;
+    struct pollfd* select_fds;
+    nfds_t select_fds_cnt;
+    bool select_valid;
+    int select_nfds;
+    bool select_has_read;
+    bool select_has_write;
+    fd_set select_readfds;
+    fd_set select_writefds;
+};
+
+static struct shim_poll_cache* get_poll_cache(void) {
+    struct shim_thread* cur_thread = get_cur_thread();
+    if (!cur_thread->poll_cache)
+        cur_thread->poll_cache = calloc(1, sizeof(*cur_thread->poll_cache));
+    return cur_thread->poll_cache;
+}
+
+void free_poll_cache(struct shim_poll_cache* cache) {
+    if (!cache)
+        return;
+    free(cache->fds_mapping);
+    free(cache->select_fds);
+    free(cache);
+}
+
+static int reserve_poll_arrays(struct shim_poll_cache* cache, size_t nfds) {
+    if (nfds <= cache->cap)
+        return 0;
+
+    size_t cap = MAX(nfds, cache->cap * 2);
+    /* one memory region for all arrays, ordered by decreasing alignment */
+    void* mem = malloc(cap * (sizeof(struct fds_mapping_t) + sizeof(PAL_HANDLE)
+                              + 2 * sizeof(PAL_FLG)));
+    if (!mem)
+        return -ENOMEM;
+
+    free(cache->fds_mapping);
+    cache->cap         = cap;
+    cache->fds_mapping = mem;
+    cache->pals        = (PAL_HANDLE*)(cache->fds_mapping + cap);
+    cache->pal_events  = (PAL_FLG*)(cache->pals + cap);
+    return 0;
+}
+
+static int reserve_select_fds(struct shim_poll_cache* cache, size_t nfds) {
+    if (nfds <= cache->select_cap)
+        return 0;
+
+    size_t cap = MAX(nfds, cache->select_cap * 2);
+    struct pollfd* fds = malloc(cap * sizeof(*fds));
+    if (!fds)
+        return -ENOMEM;
+
+    free(cache->select_fds);
+    cache->select_cap = cap;
+    cache->select_fds = fds;
+    cache->select_valid = false;
+    return 0;
+}
+
+static size_t fd_set_words(int nfds) {
+    return ((size_t)nfds + __NFDBITS - 1) / __NFDBITS;
+}
+
+static bool select_translation_matches(struct shim_poll_cache* cache, int nfds, fd_set* readfds,
+                                       fd_set* writefds) {
+    if (!cache->select_valid || cache->select_nfds != nfds
+            || cache->select_has_read != !!readfds || cache->select_has_write != !!writefds)
+        return false;
+
+    size_t size = fd_set_words(nfds) * sizeof(__fd_mask);
+    if (readfds && memcmp(readfds, &cache->select_readfds, size))
+        return false;
+    if (writefds && memcmp(writefds, &cache->select_writefds, size))
+        return false;
+    return true;
+}
+
+static void save_select_translation(struct shim_poll_cache* cache, int nfds, fd_set* readfds,
+                                    fd_set* writefds, nfds_t fds_cnt) {
+    /* sets larger than `fd_set` are still handled, just never cached */
+    cache->select_valid = (size_t)nfds <= sizeof(fd_set) * 8;
+    if (!cache->select_valid)
+        return;
+
+    size_t size = fd_set_words(nfds) * sizeof(__fd_mask);
+    cache->select_nfds      = nfds;
+    cache->select_fds_cnt   = fds_cnt;
+    cache->select_has_read  = !!readfds;
+    cache->select_has_write = !!writefds;
+    if (readfds)
+        memcpy(&cache->select_readfds, readfds, size);
+    if (writefds)
+        memcpy(&cache->select_writefds, writefds, size);
+}
+
 static long _shim_do_poll(struct pollfd* fds, nfds_t nfds, int timeout_ms) {
     if ((uint64_t)nfds > get_rlimit_cur(RLIMIT_NOFILE))
         return -EINVAL;
@@ -54,27 +178,23 @@ static long _shim_do_poll(struct pollfd* fds, nfds_t nfds, int timeout_ms) {
     uint64_t timeout_us = timeout_ms < 0 ? POLL_NOTIMEOUT : timeout_ms * 1000ULL;
 
     /* nfds is the upper limit for actual number of handles */
-    PAL_HANDLE* pals = malloc(nfds * sizeof(PAL_HANDLE));
-    if (!pals)
-        return -ENOMEM;
-
-    /* for bookkeeping, need to have a mapping FD -> {shim handle, index-in-pals} */
-    struct fds_mapping_t {
-        struct shim_handle* hdl; /* NULL if no mapping (handle is not used in polling) */
-        nfds_t idx;              /* index from fds array to pals array */
-    };
-    struct fds_mapping_t* fds_mapping = malloc(nfds * sizeof(struct fds_mapping_t));
-    if (!fds_mapping) {
-        free(pals);
-        return -ENOMEM;
-    }
-
-    /* allocate one memory region to hold two PAL_FLG arrays: events and revents */
-    PAL_FLG* pal_events = malloc(nfds * sizeof(PAL_FLG) * 2);
-    if (!pal_events) {
-        free(pals);
-        free(fds_mapping);
-        return -ENOMEM;
+    struct fds_mapping_t stack_fds_mapping[POLL_STACK_FDS];
+    PAL_HANDLE stack_pals[POLL_STACK_FDS];
+    PAL_FLG stack_pal_events[POLL_STACK_FDS * 2];
+
+    struct fds_mapping_t* fds_mapping = stack_fds_mapping;
+    PAL_HANDLE* pals = stack_pals;
+    PAL_FLG* pal_events = stack_pal_events;
+    if (nfds > POLL_STACK_FDS) {
+        struct shim_poll_cache* cache = get_poll_cache();
+        if (!cache)
+            return -ENOMEM;
+        int ret = reserve_poll_arrays(cache, nfds);
+        if (ret < 0)
+            return ret;
+        fds_mapping = cache->fds_mapping;
+        pals = cache->pals;
+        pal_events = cache->pal_events;
     }
     PAL_FLG* ret_events = pal_events + nfds;
 
@@ -151,7 +271,7 @@ static long _shim_do_poll(struct pollfd* fds, nfds_t nfds, int timeout_ms) {
         fds_mapping[i].hdl = hdl;
         fds_mapping[i].idx = pal_cnt;
         pals[pal_cnt] = hdl->pal_handle;
-        pal_events[pal_cnt] = allowed_events;
+        pal_events[pal_cnt] = mem_pipe_pal_events(hdl, allowed_events);
         ret_events[pal_cnt] = 0;
         pal_cnt++;
     }
@@ -161,7 +281,9 @@ static long _shim_do_poll(struct pollfd* fds, nfds_t nfds, int timeout_ms) {
     bool polled = false;
     long error = 0;
     if (pal_cnt) {
+        thread_block_begin();
         error = DkStreamsWaitEvents(pal_cnt, pals, pal_events, ret_events, timeout_us);
+        thread_block_end();
         polled = error == 0;
         error = pal_to_unix_errno(error);
     }
@@ -172,12 +294,14 @@ static long _shim_do_poll(struct pollfd* fds, nfds_t nfds, int timeout_ms) {
 
         /* update fds.revents, but only if something was actually polled */
         if (polled) {
+            PAL_FLG pal_revents = mem_pipe_pal_events(fds_mapping[i].hdl,
+                                                      ret_events[fds_mapping[i].idx]);
             fds[i].revents = 0;
-            if (ret_events[fds_mapping[i].idx] & PAL_WAIT_ERROR)
+            if (pal_revents & PAL_WAIT_ERROR)
                 fds[i].revents |= POLLERR | POLLHUP;
-            if (ret_events[fds_mapping[i].idx] & PAL_WAIT_READ)
+            if (pal_revents & PAL_WAIT_READ)
                 fds[i].revents |= fds[i].events & (POLLIN | POLLRDNORM);
-            if (ret_events[fds_mapping[i].idx] & PAL_WAIT_WRITE)
+            if (pal_revents & PAL_WAIT_WRITE)
                 fds[i].revents |= fds[i].events & (POLLOUT | POLLWRNORM);
 
             if (fds[i].revents)
@@ -187,10 +311,6 @@ static long _shim_do_poll(struct pollfd* fds, nfds_t nfds, int timeout_ms) {
         put_handle(fds_mapping[i].hdl);
     }
 
-    free(pals);
-    free(pal_events);
-    free(fds_mapping);
-
     if (error == -EAGAIN) {
         /* `poll` returns 0 on timeout. */
         error = 0;
@@ -239,27 +359,41 @@ long shim_do_select(int nfds, fd_set* readfds, fd_set* writefds, fd_set* errorfd
         nfds = __NFDBITS;
     }
 
-    /* nfds is the upper limit for actual number of fds for poll */
-    struct pollfd* fds_poll = malloc(nfds * sizeof(struct pollfd));
-    if (!fds_poll)
+    struct shim_poll_cache* cache = get_poll_cache();
+    if (!cache)
         return -ENOMEM;
 
-    /* populate array of pollfd's based on user-supplied readfds & writefds */
-    nfds_t nfds_poll = 0;
-    for (int fd = 0; fd < nfds; fd++) {
-        short events = 0;
-        if (readfds && __FD_ISSET(fd, readfds))
-            events |= POLLIN;
-        if (writefds && __FD_ISSET(fd, writefds))
-            events |= POLLOUT;
-
-        if (!events)
-            continue;
+    struct pollfd* fds_poll;
+    nfds_t nfds_poll;
+    if (select_translation_matches(cache, nfds, readfds, writefds)) {
+        fds_poll  = cache->select_fds;
+        nfds_poll = cache->select_fds_cnt;
+    } else {
+        /* nfds is the upper limit for actual number of fds for poll */
+        int err = reserve_select_fds(cache, nfds);
+        if (err < 0)
+            return err;
+        fds_poll = cache->select_fds;
+
+        /* populate array of pollfd's based on user-supplied readfds & writefds */
+        nfds_poll = 0;
+        for (int fd = 0; fd < nfds; fd++) {
+            short events = 0;
+            if (readfds && __FD_ISSET(fd, readfds))
+                events |= POLLIN;
+            if (writefds && __FD_ISSET(fd, writefds))
+                events |= POLLOUT;
+
+            if (!events)
+                continue;
+
+            fds_poll[nfds_poll].fd      = fd;
+            fds_poll[nfds_poll].events  = events;
+            fds_poll[nfds_poll].revents = 0;
+            nfds_poll++;
+        }
 
-        fds_poll[nfds_poll].fd      = fd;
-        fds_poll[nfds_poll].events  = events;
-        fds_poll[nfds_poll].revents = 0;
-        nfds_poll++;
+        save_select_translation(cache, nfds, readfds, writefds, nfds_poll);
     }
 
     /* select()/pselect() return -EBADF if invalid FD was given by user in readfds/writefds;
@@ -270,7 +404,6 @@ long shim_do_select(int nfds, fd_set* readfds, fd_set* writefds, fd_set* errorfd
         struct shim_handle* hdl = __get_fd_handle(fds_poll[i].fd, NULL, map);
         if (!hdl || !hdl->fs || !hdl->fs->fs_ops) {
             /* the corresponding handle doesn't exist or doesn't provide FS-like semantics */
-            free(fds_poll);
             unlock(&map->lock);
             return -EBADF;
         }
@@ -280,10 +413,8 @@ long shim_do_select(int nfds, fd_set* readfds, fd_set* writefds, fd_set* errorfd
     uint64_t timeout_ms = tsv ? tsv->tv_sec * 1000ULL + tsv->tv_usec / 1000 : POLL_NOTIMEOUT;
     long ret = _shim_do_poll(fds_poll, nfds_poll, timeout_ms);
 
-    if (ret < 0) {
-        free(fds_poll);
+    if (ret < 0)
         return ret;
-    }
 
     /* modify readfds, writefds, and errorfds in-place with returned events */
     if (readfds)
@@ -309,7 +440,6 @@ long shim_do_select(int nfds, fd_set* readfds, fd_set* writefds, fd_set* errorfd
         }
     }
 
-    free(fds_poll);
     return ret;
 }
 
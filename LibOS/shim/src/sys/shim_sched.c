@@ -15,10 +15,30 @@
 #include "api.h"
 #include "pal.h"
 #include "shim_internal.h"
+#include "shim_lock.h"
 #include "shim_table.h"
 #include "shim_thread.h"
 
+/* Yielding to the host costs a host syscall (on SGX also an enclave exit), and user-space spinlocks
+ * call `sched_yield()` in tight loops. If there are not more runnable threads in this process than
+ * CPUs, no thread of ours can be waiting for a CPU, so pausing for a moment is enough. Every
+ * SCHED_YIELD_HOST_INTERVAL-th call still yields to the host, so that threads of other processes
+ * sharing the CPUs make progress. */
+#define SCHED_YIELD_PAUSE_CNT     64
+#define SCHED_YIELD_HOST_INTERVAL 32
+
 long shim_do_sched_yield(void) {
+    struct shim_thread* cur_thread = get_cur_thread();
+    int runnable = __atomic_load_n(&g_runnable_threads_cnt, __ATOMIC_RELAXED);
+
+    if (runnable <= (int)g_pal_control->cpu_info.online_logical_cores
+            && ++cur_thread->yields_skipped < SCHED_YIELD_HOST_INTERVAL) {
+        for (size_t i = 0; i < SCHED_YIELD_PAUSE_CNT; i++)
+            CPU_RELAX();
+        return 0;
+    }
+
+    cur_thread->yields_skipped = 0;
     DkThreadYieldExecution();
     return 0;
 }
@@ -163,7 +183,14 @@ long shim_do_sched_setaffinity(pid_t pid, unsigned int cpumask_size, unsigned lo
         return -ESRCH;
     }
 
+    /* under the lock, so that a concurrent `sched_getaffinity()` cannot cache the old mask */
+    lock(&thread->lock);
     ret = DkThreadSetCpuAffinity(thread->pal_handle, cpumask_size, user_mask_ptr);
+    if (ret >= 0) {
+        free(thread->cpu_affinity);
+        thread->cpu_affinity = NULL;
+    }
+    unlock(&thread->lock);
     if (ret < 0) {
         put_thread(thread);
         return pal_to_unix_errno(ret);
@@ -211,12 +238,30 @@ long shim_do_sched_getaffinity(pid_t pid, unsigned int cpumask_size, unsigned lo
     }
 
     memset(user_mask_ptr, 0, cpumask_size);
+
+    /* The mask changes only through `sched_setaffinity()`, so only the first query goes to the PAL
+     * (on SGX, an OCALL) and the rest is served from `thread->cpu_affinity`. */
+    lock(&thread->lock);
+    if (thread->cpu_affinity) {
+        memcpy(user_mask_ptr, thread->cpu_affinity, bitmask_size_in_bytes);
+        unlock(&thread->lock);
+        put_thread(thread);
+        return bitmask_size_in_bytes;
+    }
+
     ret = DkThreadGetCpuAffinity(thread->pal_handle, bitmask_size_in_bytes, user_mask_ptr);
     if (ret < 0) {
+        unlock(&thread->lock);
         put_thread(thread);
         return pal_to_unix_errno(ret);
     }
 
+    /* failing to cache the mask is not an error, the next call just asks the PAL again */
+    thread->cpu_affinity = malloc(bitmask_size_in_bytes);
+    if (thread->cpu_affinity)
+        memcpy(thread->cpu_affinity, user_mask_ptr, bitmask_size_in_bytes);
+    unlock(&thread->lock);
+
     put_thread(thread);
     /* on success, imitate Linux kernel implementation: see SYSCALL_DEFINE3(sched_getaffinity) */
     return bitmask_size_in_bytes;
@@ -73,9 +73,7 @@ long shim_do_rt_sigreturn(void) {
     clear_illegal_signals(&new_mask);
 
     struct shim_thread* current = get_cur_thread();
-    lock(&current->lock);
     set_sig_mask(current, &new_mask);
-    unlock(&current->lock);
 
     /* We restored user context, it's not a syscall. */
     SHIM_TCB_SET(context.syscall_nr, -1);
@@ -98,10 +96,10 @@ long shim_do_rt_sigprocmask(int how, const __sigset_t* set, __sigset_t* oldset,
     if (oldset && !is_user_memory_readable(oldset, sizeof(*oldset)))
         return -EFAULT;
 
+    /* Only this thread writes its signal mask, so no locks are needed. If a blocked signal is
+     * pending and becomes unblocked here, it is delivered on return from this syscall. */
     struct shim_thread* cur = get_cur_thread();
 
-    lock(&cur->lock);
-
     get_sig_mask(cur, &old);
 
     if (oldset) {
@@ -110,7 +108,7 @@ long shim_do_rt_sigprocmask(int how, const __sigset_t* set, __sigset_t* oldset,
 
     /* If set is NULL, then the signal mask is unchanged. */
     if (!set)
-        goto out;
+        return 0;
 
     switch (how) {
         case SIG_BLOCK:
@@ -129,9 +127,6 @@ long shim_do_rt_sigprocmask(int how, const __sigset_t* set, __sigset_t* oldset,
     clear_illegal_signals(&old);
     set_sig_mask(cur, &old);
 
-out:
-    unlock(&cur->lock);
-
     return 0;
 }
 
@@ -195,10 +190,8 @@ long shim_do_rt_sigsuspend(const __sigset_t* mask_ptr, size_t setsize) {
 
     struct shim_thread* current = get_cur_thread();
     __sigset_t old;
-    lock(&current->lock);
     get_sig_mask(current, &old);
     set_sig_mask(current, &mask);
-    unlock(&current->lock);
 
     thread_prepare_wait();
     while (!have_pending_signals()) {
@@ -260,11 +253,9 @@ long shim_do_rt_sigtimedwait(const __sigset_t* unblocked_ptr, siginfo_t* info,
     __sigset_t old;
 
     struct shim_thread* current = get_cur_thread();
-    lock(&current->lock);
     get_sig_mask(current, &old);
     __signotset(&new, &old, &unblocked);
     set_sig_mask(current, &new);
-    unlock(&current->lock);
 
     uint64_t timeout_us = timeout ? timespec_to_us(timeout) : NO_TIMEOUT;
     int thread_wait_res = -EINTR;
@@ -299,9 +290,7 @@ long shim_do_rt_sigtimedwait(const __sigset_t* unblocked_ptr, siginfo_t* info,
         ret = (thread_wait_res == -ETIMEDOUT ? -EAGAIN : -EINTR);
     }
 
-    lock(&current->lock);
     set_sig_mask(current, &old);
-    unlock(&current->lock);
 
     return ret;
 }
@@ -317,9 +306,9 @@ long shim_do_rt_sigpending(__sigset_t* set, size_t sigsetsize) {
 
     struct shim_thread* current = get_cur_thread();
     /* We are interested only in blocked signals... */
-    lock(&current->lock);
-    __sigandset(set, set, &current->signal_mask);
-    unlock(&current->lock);
+    __sigset_t mask;
+    get_sig_mask(current, &mask);
+    __sigandset(set, set, &mask);
 
     /* ...and not ignored. */
     lock(&current->signal_dispositions->lock);
@@ -343,12 +332,11 @@ static int _wakeup_one_thread(struct shim_thread* thread, void* arg) {
 
     lock(&thread->lock);
 
-    if (!__sigismember(&thread->signal_mask, sig)) {
-        thread_wakeup(thread);
-        ret = DkThreadResume(thread->pal_handle);
-        if (ret < 0) {
-            ret = pal_to_unix_errno(ret);
-        } else {
+    __sigset_t mask;
+    get_sig_mask(thread, &mask);
+    if (!__sigismember(&mask, sig)) {
+        ret = thread_signal_kick(thread);
+        if (ret == 0) {
             ret = 1;
         }
     }
@@ -371,13 +359,12 @@ int kill_current_proc(siginfo_t* info) {
     struct shim_thread* current = get_cur_thread();
     if (!is_internal(current)) {
         /* Can we handle this signal? */
-        lock(&current->lock);
-        if (!__sigismember(&current->signal_mask, sig)) {
+        __sigset_t mask;
+        get_sig_mask(current, &mask);
+        if (!__sigismember(&mask, sig)) {
             /* Yes we can. */
-            unlock(&current->lock);
             return 0;
         }
-        unlock(&current->lock);
     }
 
     ret = walk_thread_list(_wakeup_one_thread, (void*)(long)sig, /*one_shot=*/true);
@@ -488,8 +475,7 @@ int do_kill_thread(IDTYPE sender, IDTYPE tgid, IDTYPE tid, int sig) {
         return ret;
     }
     if (thread != get_cur_thread()) {
-        thread_wakeup(thread);
-        ret = pal_to_unix_errno(DkThreadResume(thread->pal_handle));
+        ret = thread_signal_kick(thread);
     }
 
     put_thread(thread);
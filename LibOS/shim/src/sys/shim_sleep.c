@@ -12,6 +12,61 @@
 #include "shim_thread.h"
 #include "shim_utils.h"
 
+/* Sleeps shorter than this are done by spinning on the TSC instead of waiting in the PAL, which on
+ * SGX costs an enclave exit that takes longer than the sleep itself (see
+ * `libos.sleep_spin_threshold_ns`). 0 means that all sleeps wait in the PAL. */
+static uint64_t g_sleep_spin_threshold_ns = 0;
+static uint64_t g_sleep_spin_tsc_hz = 0;
+
+int init_sleep(void) {
+    int64_t threshold_ns;
+    int ret = toml_int_in(g_manifest_root, "libos.sleep_spin_threshold_ns", /*defaultval=*/0,
+                          &threshold_ns);
+    if (ret < 0 || threshold_ns < 0 || threshold_ns > (int64_t)TIME_NS_IN_S) {
+        log_error("Cannot parse 'libos.sleep_spin_threshold_ns' (the value must be between 0 and "
+                  "1000000000)");
+        return -EINVAL;
+    }
+    if (!threshold_ns)
+        return 0;
+
+    /* the TSC parameters are known only after the PAL computed the time at least once */
+    uint64_t now;
+    PAL_TSC_TIME_BASE base;
+    if (DkSystemTimeQuery(&now) < 0 || DkSystemTimeBaseQuery(&base) < 0 || !base.tsc_hz) {
+        log_warning("'libos.sleep_spin_threshold_ns' is ignored because the PAL does not compute "
+                    "time from the TSC");
+        return 0;
+    }
+    g_sleep_spin_tsc_hz = base.tsc_hz;
+    g_sleep_spin_threshold_ns = threshold_ns;
+    return 0;
+}
+
+/* Short sleep that never leaves the LibOS (and the enclave); stops early if a signal arrives. */
+static int spin_nanosleep(uint64_t timeout_ns, struct __kernel_timespec* rem) {
+    /* doesn't overflow: `timeout_ns` is at most 1s and the TSC frequency is way below 10^10 */
+    uint64_t cycles = timeout_ns * g_sleep_spin_tsc_hz / TIME_NS_IN_S;
+    uint64_t start = get_tsc();
+    uint64_t elapsed;
+    int ret = 0;
+
+    while ((elapsed = get_tsc() - start) < cycles) {
+        if (have_pending_signals()) {
+            ret = -EINTR;
+            break;
+        }
+        CPU_RELAX();
+    }
+
+    if (rem) {
+        uint64_t left_ns = ret < 0 ? (cycles - elapsed) * TIME_NS_IN_S / g_sleep_spin_tsc_hz : 0;
+        rem->tv_sec = 0;
+        rem->tv_nsec = left_ns;
+    }
+    return ret;
+}
+
 long shim_do_pause(void) {
     thread_prepare_wait();
     while (!have_pending_signals()) {
@@ -68,7 +123,9 @@ long shim_do_nanosleep(struct __kernel_timespec* req, struct __kernel_timespec*
     if (ret < 0) {
         return ret;
     }
-    return do_nanosleep(timespec_to_us(req), rem);;
+    if (!req->tv_sec && (uint64_t)req->tv_nsec < g_sleep_spin_threshold_ns)
+        return spin_nanosleep(req->tv_nsec, rem);
+    return do_nanosleep(timespec_to_us(req), rem);
 }
 
 long shim_do_clock_nanosleep(clockid_t clock_id, int flags, struct __kernel_timespec* req,
@@ -83,6 +140,11 @@ long shim_do_clock_nanosleep(clockid_t clock_id, int flags, struct __kernel_time
         return ret;
     }
 
+    if (!(flags & TIMER_ABSTIME) && !req->tv_sec
+            && (uint64_t)req->tv_nsec < g_sleep_spin_threshold_ns) {
+        return spin_nanosleep(req->tv_nsec, rem);
+    }
+
     uint64_t timeout_us = timespec_to_us(req);
     if (flags & TIMER_ABSTIME) {
         uint64_t current_time = 0;
@@ -97,6 +159,8 @@ long shim_do_clock_nanosleep(clockid_t clock_id, int flags, struct __kernel_time
             return 0;
         }
         timeout_us -= current_time;
+        if (timeout_us < g_sleep_spin_threshold_ns / TIME_NS_IN_US)
+            return spin_nanosleep(timeout_us * TIME_NS_IN_US, /*rem=*/NULL);
         rem = NULL;
     }
 
@@ -381,6 +381,26 @@ static void inet_save_addr(int domain, struct addr_inet* addr, const struct sock
     }
 }
 
+/* Converts the address passed by the user into the binary address the host expects. */
+static size_t inet_host_addr(int domain, const struct sockaddr* saddr, struct sockaddr* host_addr,
+                             size_t host_addr_len) {
+    struct addr_inet addr;
+    inet_save_addr(domain, &addr, saddr);
+    inet_rebase_port(false, domain, &addr, false);
+    addr.port = addr.ext_port; /* the host sees the external port */
+    return inet_copy_addr(domain, host_addr, host_addr_len, &addr);
+}
+
+/* Converts a binary address reported by the host into the address returned to the user. */
+static size_t inet_user_addr(int domain, const struct sockaddr* host_addr, struct sockaddr* saddr,
+                             size_t saddr_len) {
+    struct addr_inet addr;
+    inet_save_addr(domain, &addr, host_addr);
+    addr.ext_port = addr.port; /* the host reports the external port */
+    inet_rebase_port(true, domain, &addr, false);
+    return inet_copy_addr(domain, saddr, saddr_len, &addr);
+}
+
 static int create_socket_uri(struct shim_handle* hdl) {
     assert(hdl->type == TYPE_SOCK);
     struct shim_sock_handle* sock = &hdl->info.sock;
@@ -933,7 +953,7 @@ static int __do_accept(struct shim_handle* hdl, int flags, struct sockaddr* addr
     if (flags & O_NONBLOCK) {
         PAL_STREAM_ATTR attr;
 
-        ret = DkStreamAttributesQueryByHandle(accepted, &attr);
+        ret = DkStreamAttributesQueryCachedByHandle(accepted, &attr);
         if (ret < 0) {
             ret = pal_to_unix_errno(ret);
             goto out;
@@ -1049,8 +1069,13 @@ long shim_do_accept4(int fd, struct sockaddr* addr, int* addrlen, int flags) {
     return ret;
 }
 
-static ssize_t do_sendmsg(int fd, struct iovec* bufs, int nbufs, int flags,
-                          const struct sockaddr* addr, int addrlen) {
+static_assert(sizeof(PAL_IOVEC) == sizeof(struct iovec) &&
+                  offsetof(PAL_IOVEC, iov_base) == offsetof(struct iovec, iov_base) &&
+                  offsetof(PAL_IOVEC, iov_len) == offsetof(struct iovec, iov_len),
+              "PAL_IOVEC must have the same layout as struct iovec");
+
+ssize_t do_sendmsg(int fd, struct iovec* bufs, int nbufs, int flags, const struct sockaddr* addr,
+                   int addrlen) {
     struct shim_handle* hdl = get_fd_handle(fd, NULL, NULL);
     if (!hdl)
         return -EBADF;
@@ -1086,7 +1111,7 @@ static ssize_t do_sendmsg(int fd, struct iovec* bufs, int nbufs, int flags,
     }
 
     PAL_HANDLE pal_hdl = hdl->pal_handle;
-    char* uri          = NULL;
+    bool unconnected   = false;
 
     /* Data gram sock need not be conneted or bound at all */
     if (sock->sock_type == SOCK_STREAM && sock->sock_state != SOCK_CONNECTED &&
@@ -1129,49 +1154,46 @@ static ssize_t do_sendmsg(int fd, struct iovec* bufs, int nbufs, int flags,
             goto out_locked;
         }
 
-        uri = __alloca(SOCK_URI_SIZE);
+        unconnected = true;
     }
 
     unlock(&hdl->lock);
 
-    if (uri) {
-        struct addr_inet addr_buf;
-        inet_save_addr(sock->domain, &addr_buf, addr);
-        inet_rebase_port(false, sock->domain, &addr_buf, false);
-        size_t prefix_len = static_strlen(URI_PREFIX_UDP);
-        memcpy(uri, URI_PREFIX_UDP, prefix_len + 1);
-        if ((ret = inet_translate_addr(sock->domain, uri + prefix_len, SOCK_URI_SIZE - prefix_len,
-                                       &addr_buf, NULL)) < 0) {
-            lock(&hdl->lock);
-            goto out_locked;
-        }
+    /* unconnected datagram socket: the destination goes to the PAL as a binary address, so no URI
+     * is formatted (and parsed again by the PAL) for every packet */
+    struct sockaddr_storage dest_addr;
+    size_t dest_addrlen = 0;
+    if (unconnected)
+        dest_addrlen = inet_host_addr(sock->domain, addr, (struct sockaddr*)&dest_addr,
+                                      sizeof(dest_addr));
 
-        log_debug("next packet send to %s", uri);
-    }
+    /* send all buffers in one PAL call (and one host syscall) */
+    size_t total_size = 0;
+    for (int i = 0; i < nbufs; i++)
+        total_size += bufs[i].iov_len;
 
     int bytes = 0;
-    ret = 0;
-
-    for (int i = 0; i < nbufs; i++) {
-        size_t this_size = bufs[i].iov_len;
-        ret = DkStreamWrite(pal_hdl, 0, &this_size, bufs[i].iov_base, uri);
-        ret = ret == -PAL_ERROR_STREAMEXIST ? -ECONNABORTED : pal_to_unix_errno(ret);
-        maybe_epoll_et_trigger(hdl, ret, /*in=*/false, !ret ? this_size < bufs[i].iov_len : false);
-        if (ret < 0) {
-            if (ret == -EPIPE && !(flags & MSG_NOSIGNAL)) {
-                siginfo_t info = {
-                    .si_signo = SIGPIPE,
-                    .si_pid = g_process.pid,
-                    .si_code = SI_USER,
-                };
-                if (kill_current_proc(&info) < 0) {
-                    log_error("do_sendmsg: failed to deliver a signal");
-                }
-            }
-            break;
+    PAL_NUM this_size = 0;
+    if (unconnected) {
+        ret = DkStreamSendTo(pal_hdl, (PAL_IOVEC*)bufs, nbufs, &this_size, &dest_addr,
+                             dest_addrlen);
+    } else {
+        ret = DkStreamWriteV(pal_hdl, (PAL_IOVEC*)bufs, nbufs, &this_size);
+    }
+    ret = ret == -PAL_ERROR_STREAMEXIST ? -ECONNABORTED : pal_to_unix_errno(ret);
+    maybe_epoll_et_trigger(hdl, ret, /*in=*/false, !ret ? this_size < total_size : false);
+    if (!ret)
+        bytes = this_size;
+
+    if (ret == -EPIPE && !(flags & MSG_NOSIGNAL)) {
+        siginfo_t info = {
+            .si_signo = SIGPIPE,
+            .si_pid = g_process.pid,
+            .si_code = SI_USER,
+        };
+        if (kill_current_proc(&info) < 0) {
+            log_error("do_sendmsg: failed to deliver a signal");
         }
-
-        bytes += this_size;
     }
 
     if (bytes)
@@ -1264,6 +1286,106 @@ long shim_do_sendmsg(int sockfd, struct msghdr* msg, int flags) {
                       msg->msg_namelen);
 }
 
+/* Datagrams passed to the PAL per DkStreamSendBatch()/DkStreamRecvBatch() call */
+#define MMSG_BATCH 32
+
+/* Checks whether the datagrams of sendmmsg()/recvmmsg() on `hdl` can go to the PAL in batches;
+ * otherwise they take the generic do_sendmsg()/do_recvmsg() path one by one, which also reports
+ * any error. */
+static bool can_batch_dgrams(struct shim_handle* hdl, bool is_recv, PAL_HANDLE* pal_hdl,
+                             bool* connected) {
+    if (hdl->type != TYPE_SOCK)
+        return false;
+
+    struct shim_sock_handle* sock = &hdl->info.sock;
+    bool ok = false;
+
+    lock(&hdl->lock);
+    if (sock->sock_type != SOCK_DGRAM || (sock->domain != AF_INET && sock->domain != AF_INET6))
+        goto out;
+    if (!hdl->pal_handle || sock->sock_state == SOCK_SHUTDOWN)
+        goto out;
+    if (!(hdl->acc_mode & (is_recv ? MAY_READ : MAY_WRITE)))
+        goto out;
+    if (is_recv && (sock->peek_buffer || sock->sock_state == SOCK_CREATED))
+        goto out;
+
+    *pal_hdl   = hdl->pal_handle;
+    *connected = sock->sock_state == SOCK_CONNECTED || sock->sock_state == SOCK_BOUNDCONNECTED;
+    ok = true;
+out:
+    unlock(&hdl->lock);
+    return ok;
+}
+
+/* Sends up to MMSG_BATCH datagrams in one PAL call. Returns the number of datagrams sent, or 0 if
+ * the first one has to take the generic path. */
+static ssize_t do_sendmmsg_batch(int fd, struct mmsghdr* msg, size_t vlen, int flags) {
+    struct shim_handle* hdl = get_fd_handle(fd, NULL, NULL);
+    if (!hdl)
+        return -EBADF;
+
+    ssize_t ret = 0;
+    PAL_HANDLE pal_hdl;
+    bool connected;
+    if ((flags & ~(MSG_NOSIGNAL | MSG_DONTWAIT)) ||
+            !can_batch_dgrams(hdl, /*is_recv=*/false, &pal_hdl, &connected))
+        goto out;
+
+    struct shim_sock_handle* sock = &hdl->info.sock;
+    PAL_MSG pal_msgs[MMSG_BATCH];
+    struct sockaddr_in6 addrs[MMSG_BATCH];
+    size_t cnt = 0;
+    size_t total_size[MMSG_BATCH];
+
+    size_t max_cnt = MIN(vlen, (size_t)MMSG_BATCH);
+    for (; cnt < max_cnt; cnt++) {
+        struct msghdr* m = &msg[cnt].msg_hdr;
+        pal_msgs[cnt].iov     = (PAL_IOVEC*)m->msg_iov;
+        pal_msgs[cnt].iov_cnt = m->msg_iovlen;
+        pal_msgs[cnt].addr    = NULL;
+        pal_msgs[cnt].addrlen = 0;
+        pal_msgs[cnt].len     = 0;
+
+        total_size[cnt] = 0;
+        for (size_t i = 0; i < m->msg_iovlen; i++)
+            total_size[cnt] += m->msg_iov[i].iov_len;
+
+        if (!connected) {
+            const struct sockaddr* addr = m->msg_name;
+            if (!addr || (size_t)m->msg_namelen < minimal_addrlen(sock->domain) ||
+                    addr->sa_family != sock->domain)
+                break;
+            pal_msgs[cnt].addr    = &addrs[cnt];
+            pal_msgs[cnt].addrlen = inet_host_addr(sock->domain, addr,
+                                                   (struct sockaddr*)&addrs[cnt],
+                                                   sizeof(addrs[cnt]));
+        }
+    }
+    if (!cnt)
+        goto out;
+
+    PAL_NUM sent = 0;
+    ret = DkStreamSendBatch(pal_hdl, pal_msgs, cnt, &sent);
+    ret = ret == -PAL_ERROR_STREAMEXIST ? -ECONNABORTED : pal_to_unix_errno(ret);
+    maybe_epoll_et_trigger(hdl, ret, /*in=*/false,
+                           !ret ? sent < cnt || pal_msgs[sent - 1].len < total_size[sent - 1]
+                                : false);
+    if (ret < 0) {
+        lock(&hdl->lock);
+        sock->error = -ret;
+        unlock(&hdl->lock);
+        goto out;
+    }
+
+    for (size_t i = 0; i < sent; i++)
+        msg[i].msg_len = pal_msgs[i].len;
+    ret = sent;
+out:
+    put_handle(hdl);
+    return ret;
+}
+
 long shim_do_sendmmsg(int sockfd, struct mmsghdr* msg, unsigned int vlen, int flags) {
     if (!is_user_memory_writable(msg, sizeof(*msg) * vlen)) {
         return -EFAULT;
@@ -1278,23 +1400,34 @@ long shim_do_sendmmsg(int sockfd, struct mmsghdr* msg, unsigned int vlen, int fl
     }
 
     ssize_t total = 0;
-    for (size_t i = 0; i < vlen; i++) {
-        struct msghdr* m = &msg[i].msg_hdr;
-
-        ssize_t bytes =
-            do_sendmsg(sockfd, m->msg_iov, m->msg_iovlen, flags, m->msg_name, m->msg_namelen);
-        if (bytes < 0)
-            return total > 0 ? total : bytes;
+    while ((size_t)total < vlen) {
+        ssize_t sent = do_sendmmsg_batch(sockfd, &msg[total], vlen - total, flags);
+        if (!sent) {
+            struct msghdr* m = &msg[total].msg_hdr;
+
+            ssize_t bytes =
+                do_sendmsg(sockfd, m->msg_iov, m->msg_iovlen, flags, m->msg_name, m->msg_namelen);
+            if (bytes >= 0) {
+                msg[total].msg_len = bytes;
+                sent = 1;
+            } else {
+                sent = bytes;
+            }
+        }
+        if (sent < 0) {
+            if (sent == -EINTR)
+                sent = -ERESTARTSYS;
+            return total > 0 ? total : sent;
+        }
 
-        msg[i].msg_len = bytes;
-        total++;
+        total += sent;
     }
 
     return total;
 }
 
-static ssize_t do_recvmsg(int fd, struct iovec* bufs, size_t nbufs, int flags,
-                          struct sockaddr* addr, int* addrlen) {
+ssize_t do_recvmsg(int fd, struct iovec* bufs, size_t nbufs, int flags, struct sockaddr* addr,
+                   int* addrlen) {
     struct shim_handle* hdl = get_fd_handle(fd, NULL, NULL);
     if (!hdl)
         return -EBADF;
@@ -1346,7 +1479,7 @@ static ssize_t do_recvmsg(int fd, struct iovec* bufs, size_t nbufs, int flags,
     peek_buffer        = sock->peek_buffer;
     sock->peek_buffer  = NULL;
     PAL_HANDLE pal_hdl = hdl->pal_handle;
-    char* uri          = NULL;
+    bool unconnected   = false;
 
     if (sock->sock_type == SOCK_STREAM && sock->sock_state != SOCK_CONNECTED &&
         sock->sock_state != SOCK_BOUNDCONNECTED && sock->sock_state != SOCK_ACCEPTED) {
@@ -1366,11 +1499,15 @@ static ssize_t do_recvmsg(int fd, struct iovec* bufs, size_t nbufs, int flags,
             goto out_locked;
         }
 
-        uri = __alloca(SOCK_URI_SIZE);
+        unconnected = true;
     }
 
     unlock(&hdl->lock);
 
+    /* source address of an unconnected datagram socket, as a binary address from the PAL */
+    struct sockaddr_storage src_addr;
+    PAL_NUM src_addrlen = 0;
+
     if (flags & MSG_PEEK) {
         if (!peek_buffer) {
             /* create new peek buffer with expected read size */
@@ -1380,9 +1517,10 @@ static ssize_t do_recvmsg(int fd, struct iovec* bufs, size_t nbufs, int flags,
                 lock(&hdl->lock);
                 goto out_locked;
             }
-            peek_buffer->size  = expected_size;
-            peek_buffer->start = 0;
-            peek_buffer->end   = 0;
+            peek_buffer->size    = expected_size;
+            peek_buffer->start   = 0;
+            peek_buffer->end     = 0;
+            peek_buffer->addrlen = 0;
         } else {
             /* realloc peek buffer to accommodate expected read size */
             if (expected_size > peek_buffer->size - peek_buffer->start) {
@@ -1404,8 +1542,16 @@ static ssize_t do_recvmsg(int fd, struct iovec* bufs, size_t nbufs, int flags,
             /* fill peek buffer if this MSG_PEEK read request cannot be satisfied with data already
              * present in peek buffer; note that buffer can hold expected read size at this point */
             size_t left_to_read = expected_size - (peek_buffer->end - peek_buffer->start);
-            ret = DkStreamRead(pal_hdl, /*offset=*/0, &left_to_read,
-                               &peek_buffer->buf[peek_buffer->end], uri, uri ? SOCK_URI_SIZE : 0);
+            if (unconnected) {
+                PAL_IOVEC iov = {.iov_base = &peek_buffer->buf[peek_buffer->end],
+                                 .iov_len  = left_to_read};
+                src_addrlen = sizeof(peek_buffer->addr);
+                ret = DkStreamRecvFrom(pal_hdl, &iov, 1, &left_to_read, &peek_buffer->addr,
+                                       &src_addrlen);
+            } else {
+                ret = DkStreamRead(pal_hdl, /*offset=*/0, &left_to_read,
+                                   &peek_buffer->buf[peek_buffer->end], NULL, 0);
+            }
             /* TODO: shouldn't we call `maybe_epoll_et_trigger` here? */
             if (ret < 0) {
                 ret = ret == -PAL_ERROR_STREAMNOTEXIST ? -ECONNABORTED : pal_to_unix_errno(ret);
@@ -1414,8 +1560,8 @@ static ssize_t do_recvmsg(int fd, struct iovec* bufs, size_t nbufs, int flags,
             }
 
             peek_buffer->end += left_to_read;
-            if (uri)
-                memcpy(peek_buffer->uri, uri, SOCK_URI_SIZE);
+            if (unconnected)
+                peek_buffer->addrlen = src_addrlen;
         }
     }
 
@@ -1426,24 +1572,44 @@ static ssize_t do_recvmsg(int fd, struct iovec* bufs, size_t nbufs, int flags,
 
     for (size_t i = 0; i < nbufs; i++) {
         size_t iov_bytes = 0;
+        bool vectored    = false;
         if (peek_buffer) {
             /* some data left to read from peek buffer */
             assert(total_bytes < peek_buffer->end - peek_buffer->start);
             iov_bytes = MIN(bufs[i].iov_len, peek_buffer->end - peek_buffer->start - total_bytes);
             memcpy(bufs[i].iov_base, &peek_buffer->buf[peek_buffer->start + total_bytes],
                    iov_bytes);
-            uri = peek_buffer->uri;
+            if (unconnected) {
+                src_addrlen = peek_buffer->addrlen;
+                memcpy(&src_addr, &peek_buffer->addr, src_addrlen);
+            }
+        } else if (!unconnected) {
+            /* no source address needed: scatter all buffers in one PAL call (and one host
+             * syscall) */
+            PAL_NUM read_size = 0;
+            ret = DkStreamReadV(pal_hdl, (PAL_IOVEC*)bufs, nbufs, &read_size);
+            ret = ret == -PAL_ERROR_STREAMNOTEXIST ? -ECONNABORTED : pal_to_unix_errno(ret);
+            maybe_epoll_et_trigger(hdl, ret, /*in=*/true,
+                                   ret == 0 ? read_size < expected_size : false);
+            if (ret < 0) {
+                break;
+            }
+            iov_bytes = read_size;
+            vectored  = true;
         } else {
-            size_t read_size = bufs[i].iov_len;
-            ret = DkStreamRead(pal_hdl, 0, &read_size, bufs[i].iov_base, uri,
-                               uri ? SOCK_URI_SIZE : 0);
+            /* one datagram with its source address, scattered over all buffers at once */
+            PAL_NUM read_size = 0;
+            src_addrlen = sizeof(src_addr);
+            ret = DkStreamRecvFrom(pal_hdl, (PAL_IOVEC*)bufs, nbufs, &read_size, &src_addr,
+                                   &src_addrlen);
             ret = ret == -PAL_ERROR_STREAMNOTEXIST ? -ECONNABORTED : pal_to_unix_errno(ret);
             maybe_epoll_et_trigger(hdl, ret, /*in=*/true,
-                                   ret == 0 ? read_size < bufs[i].iov_len : false);
+                                   ret == 0 ? read_size < expected_size : false);
             if (ret < 0) {
                 break;
             }
             iov_bytes = read_size;
+            vectored  = true;
         }
 
         total_bytes += iov_bytes;
@@ -1460,19 +1626,9 @@ static ssize_t do_recvmsg(int fd, struct iovec* bufs, size_t nbufs, int flags,
             }
 
             if (sock->domain == AF_INET || sock->domain == AF_INET6) {
-                if (uri) {
-                    struct addr_inet conn;
-
-                    if ((ret = inet_parse_addr(sock->domain, sock->sock_type, uri, &conn, NULL))
-                            < 0) {
-                        lock(&hdl->lock);
-                        goto out_locked;
-                    }
-
-                    log_debug("last packet received from %s", uri);
-
-                    inet_rebase_port(true, sock->domain, &conn, false);
-                    *addrlen = inet_copy_addr(sock->domain, addr, *addrlen, &conn);
+                if (unconnected && src_addrlen) {
+                    *addrlen = inet_user_addr(sock->domain, (struct sockaddr*)&src_addr, addr,
+                                              *addrlen);
                 } else {
                     *addrlen = inet_copy_addr(sock->domain, addr, *addrlen, &sock->addr.in.conn);
                 }
@@ -1481,6 +1637,10 @@ static ssize_t do_recvmsg(int fd, struct iovec* bufs, size_t nbufs, int flags,
             address_received = true;
         }
 
+        /* all buffers were filled at once */
+        if (vectored)
+            break;
+
         /* gap in iovecs is not allowed, return a partial read to user; it is the responsibility of
          * user application to deal with partial reads */
         if (iov_bytes < bufs[i].iov_len)
@@ -1580,6 +1740,75 @@ long shim_do_recvmsg(int sockfd, struct msghdr* msg, int flags) {
                       &msg->msg_namelen);
 }
 
+/* Receives up to MMSG_BATCH datagrams in one PAL call, waiting only for the first one. Returns the
+ * number of datagrams received, or 0 if they have to take the generic path. */
+static ssize_t do_recvmmsg_batch(int fd, struct mmsghdr* msg, size_t vlen, int flags) {
+    struct shim_handle* hdl = get_fd_handle(fd, NULL, NULL);
+    if (!hdl)
+        return -EBADF;
+
+    ssize_t ret = 0;
+    PAL_HANDLE pal_hdl;
+    bool connected;
+    /* MSG_DONTWAIT cannot be honored on a blocking socket, the generic path warns about it */
+    if ((flags & ~MSG_DONTWAIT) || ((flags & MSG_DONTWAIT) && !(hdl->flags & O_NONBLOCK)) ||
+            !can_batch_dgrams(hdl, /*is_recv=*/true, &pal_hdl, &connected))
+        goto out;
+
+    struct shim_sock_handle* sock = &hdl->info.sock;
+    PAL_MSG pal_msgs[MMSG_BATCH];
+    struct sockaddr_in6 addrs[MMSG_BATCH];
+    size_t cnt = MIN(vlen, (size_t)MMSG_BATCH);
+
+    for (size_t i = 0; i < cnt; i++) {
+        struct msghdr* m = &msg[i].msg_hdr;
+        if (m->msg_name && (size_t)m->msg_namelen < minimal_addrlen(sock->domain)) {
+            /* let the generic path report the error for this one */
+            cnt = i;
+            break;
+        }
+        pal_msgs[i].iov     = (PAL_IOVEC*)m->msg_iov;
+        pal_msgs[i].iov_cnt = m->msg_iovlen;
+        pal_msgs[i].addr    = connected ? NULL : &addrs[i];
+        pal_msgs[i].addrlen = connected ? 0 : sizeof(addrs[i]);
+        pal_msgs[i].len     = 0;
+    }
+    if (!cnt)
+        goto out;
+
+    PAL_NUM received = 0;
+    ret = DkStreamRecvBatch(pal_hdl, pal_msgs, cnt, &received);
+    ret = ret == -PAL_ERROR_STREAMNOTEXIST ? -ECONNABORTED : pal_to_unix_errno(ret);
+    /* fewer datagrams than asked for means the receive queue was drained */
+    maybe_epoll_et_trigger(hdl, ret, /*in=*/true, !ret ? received < cnt : false);
+    if (ret < 0) {
+        lock(&hdl->lock);
+        sock->error = -ret;
+        unlock(&hdl->lock);
+        goto out;
+    }
+
+    for (size_t i = 0; i < received; i++) {
+        struct msghdr* m = &msg[i].msg_hdr;
+        msg[i].msg_len = pal_msgs[i].len;
+        if (!m->msg_name)
+            continue;
+        if (!connected && pal_msgs[i].addrlen) {
+            m->msg_namelen = inet_user_addr(sock->domain, (struct sockaddr*)&addrs[i],
+                                            m->msg_name, m->msg_namelen);
+        } else {
+            lock(&hdl->lock);
+            m->msg_namelen = inet_copy_addr(sock->domain, m->msg_name, m->msg_namelen,
+                                            &sock->addr.in.conn);
+            unlock(&hdl->lock);
+        }
+    }
+    ret = received;
+out:
+    put_handle(hdl);
+    return ret;
+}
+
 long shim_do_recvmmsg(int sockfd, struct mmsghdr* msg, unsigned int vlen, int flags,
                       struct __kernel_timespec* timeout) {
     if (!is_user_memory_writable(msg, sizeof(*msg) * vlen))
@@ -1601,17 +1830,35 @@ long shim_do_recvmmsg(int sockfd, struct mmsghdr* msg, unsigned int vlen, int fl
         return -EOPNOTSUPP;
     }
 
-    ssize_t total = 0;
-    for (size_t i = 0; i < vlen; i++) {
-        struct msghdr* m = &msg[i].msg_hdr;
+    bool wait_for_one = flags & MSG_WAITFORONE;
+    flags &= ~MSG_WAITFORONE;
 
-        ssize_t bytes =
-            do_recvmsg(sockfd, m->msg_iov, m->msg_iovlen, flags, m->msg_name, &m->msg_namelen);
-        if (bytes < 0)
-            return total > 0 ? total : bytes;
+    ssize_t total = 0;
+    while ((size_t)total < vlen) {
+        ssize_t received = do_recvmmsg_batch(sockfd, &msg[total], vlen - total, flags);
+        if (!received) {
+            struct msghdr* m = &msg[total].msg_hdr;
+
+            ssize_t bytes =
+                do_recvmsg(sockfd, m->msg_iov, m->msg_iovlen, flags, m->msg_name, &m->msg_namelen);
+            if (bytes >= 0) {
+                msg[total].msg_len = bytes;
+                received = 1;
+            } else {
+                received = bytes;
+            }
+        }
+        if (received < 0) {
+            if (received == -EINTR)
+                received = -ERESTARTSYS;
+            return total > 0 ? total : received;
+        }
 
-        msg[i].msg_len = bytes;
-        total++;
+        total += received;
+        /* the first call already took what was queued after the first datagram (a batch at a
+         * time), going on could block */
+        if (wait_for_one)
+            break;
     }
 
     return total;
@@ -1787,6 +2034,7 @@ static void __populate_addr_with_defaults(PAL_STREAM_ATTR* attr) {
     attr->socket.tcp_cork       = PAL_FALSE;
     attr->socket.tcp_keepalive  = PAL_FALSE;
     attr->socket.tcp_nodelay    = PAL_FALSE;
+    attr->socket.busy_poll      = 0;
 }
 
 static bool __update_attr(PAL_STREAM_ATTR* attr, int level, int optname, char* optval) {
@@ -1837,6 +2085,12 @@ static bool __update_attr(PAL_STREAM_ATTR* attr, int level, int optname, char* o
                     need_set_attr = true;
                 }
                 break;
+            case SO_BUSY_POLL:
+                if (intval != (int)attr->socket.busy_poll) {
+                    attr->socket.busy_poll = intval;
+                    need_set_attr = true;
+                }
+                break;
             case SO_REUSEADDR:
                 /* PAL always does REUSEADDR, no need to check or update */
                 break;
@@ -1884,6 +2138,10 @@ static int __do_setsockopt(struct shim_handle* hdl, int level, int optname, char
             case SO_SNDTIMEO:
             case SO_REUSEADDR:
                 break;
+            case SO_BUSY_POLL:
+                if (*(int*)optval < 0)
+                    return -EINVAL;
+                break;
             default:
                 return -ENOPROTOOPT;
         }
@@ -1898,7 +2156,7 @@ static int __do_setsockopt(struct shim_handle* hdl, int level, int optname, char
     PAL_STREAM_ATTR local_attr;
     if (!attr) {
         attr = &local_attr;
-        int ret = DkStreamAttributesQueryByHandle(hdl->pal_handle, attr);
+        int ret = DkStreamAttributesQueryCachedByHandle(hdl->pal_handle, attr);
         if (ret < 0) {
             return pal_to_unix_errno(ret);
         }
@@ -1924,7 +2182,7 @@ static int __process_pending_options(struct shim_handle* hdl) {
 
     PAL_STREAM_ATTR attr;
 
-    int ret = DkStreamAttributesQueryByHandle(hdl->pal_handle, &attr);
+    int ret = DkStreamAttributesQueryCachedByHandle(hdl->pal_handle, &attr);
     if (ret < 0) {
         return pal_to_unix_errno(ret);
     }
@@ -2056,6 +2314,7 @@ long shim_do_getsockopt(int fd, int level, int optname, char* optval, int* optle
             case SO_RCVTIMEO:
             case SO_SNDTIMEO:
             case SO_REUSEADDR:
+            case SO_BUSY_POLL:
                 break;
             default:
                 goto unknown_opt;
@@ -2099,8 +2358,8 @@ long shim_do_getsockopt(int fd, int level, int optname, char* optval, int* optle
             o = o->next;
         }
     } else {
-        /* query PAL to get current attributes */
-        ret = DkStreamAttributesQueryByHandle(hdl->pal_handle, &attr);
+        /* socket options are cached in the PAL handle, no need to ask the host */
+        ret = DkStreamAttributesQueryCachedByHandle(hdl->pal_handle, &attr);
         if (ret < 0) {
             ret = pal_to_unix_errno(ret);
             goto out;
@@ -2133,6 +2392,9 @@ long shim_do_getsockopt(int fd, int level, int optname, char* optval, int* optle
             case SO_REUSEADDR:
                 *intval = 1;
                 break;
+            case SO_BUSY_POLL:
+                *intval = attr.socket.busy_poll;
+                break;
         }
     }
 
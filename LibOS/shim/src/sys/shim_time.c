@@ -13,6 +13,8 @@
 #include "shim_handle.h"
 #include "shim_internal.h"
 #include "shim_table.h"
+#include "shim_utils.h"
+#include "shim_vdso.h"
 
 long shim_do_gettimeofday(struct __kernel_timeval* tv, struct __kernel_timezone* tz) {
     if (!tv)
@@ -29,6 +31,7 @@ long shim_do_gettimeofday(struct __kernel_timeval* tv, struct __kernel_timezone*
     if (ret < 0) {
         return pal_to_unix_errno(ret);
     }
+    update_vdso_time_data();
 
     tv->tv_sec  = time / 1000000;
     tv->tv_usec = time % 1000000;
@@ -44,6 +47,7 @@ long shim_do_time(time_t* tloc) {
     if (ret < 0) {
         return pal_to_unix_errno(ret);
     }
+    update_vdso_time_data();
 
     time_t t = time / 1000000;
 
@@ -53,8 +57,69 @@ long shim_do_time(time_t* tloc) {
     return t;
 }
 
+/*
+ * Coarse clocks are served from `g_coarse_time_usec`, refreshed every COARSE_CLOCK_TICK_US by an
+ * async timer. The timer runs only while coarse clocks are in use: it is started by the first
+ * coarse clock query and stops after a tick without queries. Reading a coarse clock while the
+ * timer runs costs a couple of loads and no PAL calls.
+ */
+#define COARSE_CLOCK_TICK_US 4000
+
+static uint64_t g_coarse_time_usec = 0;
+static bool g_coarse_clock_ticking = false;
+static bool g_coarse_clock_used = false;
+
+static void coarse_clock_tick(IDTYPE caller, void* arg) {
+    __UNUSED(caller);
+    __UNUSED(arg);
+
+    uint64_t time = 0;
+    if (DkSystemTimeQuery(&time) == 0)
+        __atomic_store_n(&g_coarse_time_usec, time, __ATOMIC_RELAXED);
+
+    if (__atomic_exchange_n(&g_coarse_clock_used, false, __ATOMIC_RELAXED)
+            && install_async_timer(COARSE_CLOCK_TICK_US, &coarse_clock_tick, NULL) == 0) {
+        return;
+    }
+    __atomic_store_n(&g_coarse_clock_ticking, false, __ATOMIC_RELEASE);
+}
+
+static int get_coarse_time(uint64_t* out_time) {
+    if (__atomic_load_n(&g_coarse_clock_ticking, __ATOMIC_ACQUIRE)) {
+        /* avoid dirtying the cache line when other threads already marked the clock as used */
+        if (!__atomic_load_n(&g_coarse_clock_used, __ATOMIC_RELAXED))
+            __atomic_store_n(&g_coarse_clock_used, true, __ATOMIC_RELAXED);
+        *out_time = __atomic_load_n(&g_coarse_time_usec, __ATOMIC_RELAXED);
+        return 0;
+    }
+
+    uint64_t time = 0;
+    int ret = DkSystemTimeQuery(&time);
+    if (ret < 0) {
+        return pal_to_unix_errno(ret);
+    }
+    update_vdso_time_data();
+
+    bool ticking = false;
+    if (__atomic_compare_exchange_n(&g_coarse_clock_ticking, &ticking, true, /*weak=*/false,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&g_coarse_time_usec, time, __ATOMIC_RELAXED);
+        if (install_async_timer(COARSE_CLOCK_TICK_US, &coarse_clock_tick, NULL) < 0) {
+            /* not fatal, coarse clocks just keep going through PAL */
+            __atomic_store_n(&g_coarse_clock_ticking, false, __ATOMIC_RELEASE);
+        }
+    }
+
+    *out_time = time;
+    return 0;
+}
+
+static bool is_coarse_clock(clockid_t which_clock) {
+    return which_clock == CLOCK_REALTIME_COARSE || which_clock == CLOCK_MONOTONIC_COARSE;
+}
+
 long shim_do_clock_gettime(clockid_t which_clock, struct timespec* tp) {
-    /* all clocks are the same */
+    /* all clocks are the same, except that coarse clocks are cheaper and less precise */
     if (!(0 <= which_clock && which_clock < MAX_CLOCKS))
         return -EINVAL;
 
@@ -65,9 +130,16 @@ long shim_do_clock_gettime(clockid_t which_clock, struct timespec* tp) {
         return -EFAULT;
 
     uint64_t time = 0;
-    int ret = DkSystemTimeQuery(&time);
-    if (ret < 0) {
-        return pal_to_unix_errno(ret);
+    if (is_coarse_clock(which_clock)) {
+        int ret = get_coarse_time(&time);
+        if (ret < 0)
+            return ret;
+    } else {
+        int ret = DkSystemTimeQuery(&time);
+        if (ret < 0) {
+            return pal_to_unix_errno(ret);
+        }
+        update_vdso_time_data();
     }
 
     tp->tv_sec  = time / 1000000;
@@ -85,7 +157,7 @@ long shim_do_clock_getres(clockid_t which_clock, struct timespec* tp) {
             return -EFAULT;
 
         tp->tv_sec  = 0;
-        tp->tv_nsec = 1000;
+        tp->tv_nsec = is_coarse_clock(which_clock) ? COARSE_CLOCK_TICK_US * 1000 : 1000;
     }
     return 0;
 }
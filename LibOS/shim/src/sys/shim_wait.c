@@ -22,58 +22,18 @@
 /* For wait4() return value */
 #define WCOREFLAG 0x80
 
-static bool child_matches_flags(struct shim_child_process* child, int flags) {
-    if (flags & __WALL) {
-        return true;
-    }
-
-    return (!!(flags & __WCLONE)) ^ (child->child_termination_signal == SIGCHLD);
-}
-
-static bool child_matches(struct shim_child_process* child, int which, IDTYPE id, int flags) {
-    if (!child_matches_flags(child, flags)) {
-        return false;
-    }
-
-    bool ret = false;
-    switch (which) {
-        case P_PID:
-            if (child->pid == id) {
-                ret = true;
-            }
-            break;
-        case P_PGID:
-            /* TODO: this makes no sense, until we implement IPC pgid change. */
-            break;
-        case P_ALL:
-            ret = true;
-            break;
-        default:
-            /* Impossible. */
-            BUG();
-            break;
-    }
-
-    return ret;
-}
-
-static void remove_qnode_from_wait_queue(struct shim_thread_queue* qnode) {
+static void remove_waiter_from_wait_queue(struct shim_child_waiter* waiter) {
     lock(&g_process.children_lock);
 
     bool seen = false;
-    if (g_process.wait_queue == qnode) {
-        g_process.wait_queue = qnode->next;
-        seen = true;
-    } else if (g_process.wait_queue) {
-        struct shim_thread_queue* tmp = g_process.wait_queue;
-        while (tmp->next) {
-            if (tmp->next == qnode) {
-                tmp->next = qnode->next;
-                seen = true;
-                break;
-            }
-            tmp = tmp->next;
+    struct shim_child_waiter** waiter_ptr = &g_process.wait_queue;
+    while (*waiter_ptr) {
+        if (*waiter_ptr == waiter) {
+            *waiter_ptr = waiter->next;
+            seen = true;
+            break;
         }
+        waiter_ptr = &(*waiter_ptr)->next;
     }
 
     unlock(&g_process.children_lock);
@@ -83,21 +43,58 @@ static void remove_qnode_from_wait_queue(struct shim_thread_queue* qnode) {
             thread_prepare_wait();
             /* Check `mark_child_exited` for explanation why we might need this compiler barrier. */
             COMPILER_BARRIER();
-            /* Check if `qnode` is no longer used. */
-            if (!__atomic_load_n(&qnode->in_use, __ATOMIC_ACQUIRE)) {
+            /* Check if `waiter` is no longer used. */
+            if (!__atomic_load_n(&waiter->in_use, __ATOMIC_ACQUIRE)) {
                 break;
             }
             int ret = thread_wait(/*timeout_us=*/NULL, /*ignore_pending_signals=*/true);
             if (ret < 0 && ret != -EINTR) {
                 /* We cannot handle any errors here. */
-                log_error("remove_qnode_from_wait_queue: thread_wait failed with: %d", ret);
+                log_error("remove_waiter_from_wait_queue: thread_wait failed with: %d", ret);
             }
         }
     } else {
-        put_thread(qnode->thread);
+        put_thread(waiter->thread);
     }
 }
 
+/* Returns an exited child matching the arguments, or NULL. Sets `*out_have_running` if there is
+ * a running one. Only P_ALL with children of both `__WCLONE` kinds has to look past the first list
+ * entries, a specific PID is looked up in the hash. */
+static struct shim_child_process* find_waitable_child(int which, IDTYPE id, int options,
+                                                      bool* out_have_running) {
+    assert(locked(&g_process.children_lock));
+
+    *out_have_running = false;
+    struct shim_child_process* child;
+
+    if (which == P_PID) {
+        child = find_child_process(id);
+        if (!child || !child_matches_wait(child, which, id, options))
+            return NULL;
+        if (child->exited)
+            return child;
+        *out_have_running = true;
+        return NULL;
+    }
+
+    /* First search already exited children. */
+    LISTP_FOR_EACH_ENTRY(child, &g_process.zombies, list) {
+        if (child_matches_wait(child, which, id, options)) {
+            return child;
+        }
+    }
+
+    /* Do we have any non-exited child to wait for? */
+    LISTP_FOR_EACH_ENTRY(child, &g_process.children, list) {
+        if (child_matches_wait(child, which, id, options)) {
+            *out_have_running = true;
+            break;
+        }
+    }
+    return NULL;
+}
+
 static long do_waitid(int which, pid_t id, siginfo_t* infop, int options) {
     if (options & __WALL) {
         options &= ~__WCLONE;
@@ -126,35 +123,24 @@ static long do_waitid(int which, pid_t id, siginfo_t* infop, int options) {
     do {
         lock(&g_process.children_lock);
 
-        struct shim_child_process* child;
-        /* First search already exited children. */
-        LISTP_FOR_EACH_ENTRY(child, &g_process.zombies, list) {
-            if (child_matches(child, which, id, options)) {
-                /* We have a match! */
-                if (infop) {
-                    infop->si_pid = child->pid;
-                    infop->si_uid = child->uid;
-                    infop->si_signo = SIGCHLD;
-
-                    fill_siginfo_code_and_status(infop, child->term_signal, child->exit_code);
-                }
-
-                if (!(options & WNOWAIT)) {
-                    LISTP_DEL_INIT(child, &g_process.zombies, list);
-                    destroy_child_process(child);
-                }
-                ret = 0;
-                goto out;
+        bool have_waitable_child;
+        struct shim_child_process* child = find_waitable_child(which, id, options,
+                                                               &have_waitable_child);
+        if (child) {
+            /* We have a match! */
+            if (infop) {
+                infop->si_pid = child->pid;
+                infop->si_uid = child->uid;
+                infop->si_signo = SIGCHLD;
+
+                fill_siginfo_code_and_status(infop, child->term_signal, child->exit_code);
             }
-        }
 
-        /* Do we have any non-exited child to wait for? */
-        bool have_waitable_child = false;
-        LISTP_FOR_EACH_ENTRY(child, &g_process.children, list) {
-            if (child_matches(child, which, id, options)) {
-                have_waitable_child = true;
-                break;
+            if (!(options & WNOWAIT)) {
+                reap_child_process(child);
             }
+            ret = 0;
+            goto out;
         }
 
         if (!have_waitable_child) {
@@ -172,15 +158,18 @@ static long do_waitid(int which, pid_t id, siginfo_t* infop, int options) {
             goto out;
         }
 
-        /* Ok, let's wait. */
+        /* Ok, let's wait. Only an exit of a child we can reap wakes us up. */
         struct shim_thread* self = get_cur_thread();
-        struct shim_thread_queue qnode = {
-            .thread = self,
+        struct shim_child_waiter waiter = {
             .next = g_process.wait_queue,
+            .thread = self,
+            .which = which,
+            .id = id,
+            .options = options,
         };
-        get_thread(qnode.thread);
-        __atomic_store_n(&qnode.in_use, true, __ATOMIC_RELEASE);
-        g_process.wait_queue = &qnode;
+        get_thread(waiter.thread);
+        __atomic_store_n(&waiter.in_use, true, __ATOMIC_RELEASE);
+        g_process.wait_queue = &waiter;
 
         unlock(&g_process.children_lock);
 
@@ -188,7 +177,7 @@ static long do_waitid(int which, pid_t id, siginfo_t* infop, int options) {
         /* Check `mark_child_exited` for explanation why we might need this compiler barrier. */
         COMPILER_BARRIER();
         /* Check that we are still supposed to sleep. */
-        if (!__atomic_load_n(&qnode.in_use, __ATOMIC_ACQUIRE)) {
+        if (!__atomic_load_n(&waiter.in_use, __ATOMIC_ACQUIRE)) {
             /* Something woke us up and took of the list in the meantime. */
             ret = -ERESTARTSYS;
             break;
@@ -196,14 +185,14 @@ static long do_waitid(int which, pid_t id, siginfo_t* infop, int options) {
         ret = thread_wait(/*timeout_us=*/NULL, /*ignore_pending_signals=*/false);
         if (ret < 0 && ret != -EINTR) {
             log_warning("thread_wait failed in waitid");
-            remove_qnode_from_wait_queue(&qnode);
+            remove_waiter_from_wait_queue(&waiter);
             /* `ret` is already set. */
             goto out;
         }
 
         ret = -ERESTARTSYS;
 
-        remove_qnode_from_wait_queue(&qnode);
+        remove_waiter_from_wait_queue(&waiter);
     } while (!have_pending_signals());
 
 out:
@@ -39,6 +39,13 @@ long shim_do_readv(unsigned long fd, const struct iovec* vec, unsigned long vlen
         goto out;
     }
 
+    if (hdl->type == TYPE_SOCK) {
+        /* sockets support vectored I/O natively, no need to loop over buffers */
+        put_handle(hdl);
+        return do_recvmsg(fd, (struct iovec*)vec, vlen, /*flags=*/0, /*addr=*/NULL,
+                          /*addrlen=*/NULL);
+    }
+
     if (!(hdl->acc_mode & MAY_READ) || !hdl->fs || !hdl->fs->fs_ops || !hdl->fs->fs_ops->read) {
         ret = -EACCES;
         goto out;
@@ -107,6 +114,12 @@ long shim_do_writev(unsigned long fd, const struct iovec* vec, unsigned long vle
         goto out;
     }
 
+    if (hdl->type == TYPE_SOCK) {
+        /* sockets support vectored I/O natively, no need to loop over buffers */
+        put_handle(hdl);
+        return do_sendmsg(fd, (struct iovec*)vec, vlen, /*flags=*/0, /*addr=*/NULL, /*addrlen=*/0);
+    }
+
     if (!(hdl->acc_mode & MAY_WRITE) || !hdl->fs || !hdl->fs->fs_ops || !hdl->fs->fs_ops->write) {
         ret = -EACCES;
         goto out;
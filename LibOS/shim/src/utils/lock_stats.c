@@ -0,0 +1,149 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/*
+ * Lock contention stats, enabled by `libos.lock_stats`. Acquisitions of LibOS locks (`lock()` in
+ * `shim_lock.h`) are accounted per call site. A site is identified by the file and line of the
+ * `lock()` call, so e.g. all acquisitions of `g_dcache_lock` in one function are one site. Wait
+ * times are measured in TSC cycles.
+ */
+
+#include "cpu.h"
+#include "shim_internal.h"
+#include "shim_lock.h"
+#include "shim_utils.h"
+#include "spinlock.h"
+#include "toml.h"
+
+#define LOCK_STATS_SITES 512
+
+struct lock_site {
+    const char* file;
+    int line;
+    bool ready; /* set (with release semantics) once `file` and `line` are valid */
+    uint64_t acquired;
+    uint64_t contended;
+    uint64_t wait_cycles;
+    uint64_t max_wait_cycles;
+};
+
+bool g_lock_stats_enabled = false;
+
+static struct lock_site g_lock_sites[LOCK_STATS_SITES];
+/* Serializes adding new sites; lookups of existing sites are lock-free. */
+static spinlock_t g_lock_sites_lock = INIT_SPINLOCK_UNLOCKED;
+/* Acquisitions not accounted because the table was full. */
+static uint64_t g_lock_sites_dropped = 0;
+
+int init_lock_stats(void) {
+    int ret = toml_bool_in(g_manifest_root, "libos.lock_stats", /*defaultval=*/false,
+                           &g_lock_stats_enabled);
+    if (ret < 0) {
+        log_error("Cannot parse 'libos.lock_stats' (the value must be `true` or `false`)");
+        return -EINVAL;
+    }
+    return 0;
+}
+
+static struct lock_site* find_lock_site(const char* file, int line) {
+    size_t hash = ((uintptr_t)file >> 3) * 31 + (size_t)line;
+    for (size_t i = 0; i < LOCK_STATS_SITES; i++) {
+        struct lock_site* site = &g_lock_sites[(hash + i) % LOCK_STATS_SITES];
+        if (!__atomic_load_n(&site->ready, __ATOMIC_ACQUIRE)) {
+            spinlock_lock(&g_lock_sites_lock);
+            if (!site->ready) {
+                site->file = file;
+                site->line = line;
+                __atomic_store_n(&site->ready, true, __ATOMIC_RELEASE);
+            }
+            spinlock_unlock(&g_lock_sites_lock);
+        }
+        if (site->file == file && site->line == line) {
+            return site;
+        }
+    }
+    return NULL;
+}
+
+void account_lock(const char* file, int line, bool contended, uint64_t wait_cycles) {
+    struct lock_site* site = find_lock_site(file, line);
+    if (!site) {
+        __atomic_add_fetch(&g_lock_sites_dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    __atomic_add_fetch(&site->acquired, 1, __ATOMIC_RELAXED);
+    if (contended)
+        __atomic_add_fetch(&site->contended, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&site->wait_cycles, wait_cycles, __ATOMIC_RELAXED);
+
+    uint64_t max = __atomic_load_n(&site->max_wait_cycles, __ATOMIC_RELAXED);
+    while (wait_cycles > max && !__atomic_compare_exchange_n(&site->max_wait_cycles, &max,
+                                                             wait_cycles, /*weak=*/true,
+                                                             __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+static size_t print_lock_stats_to(char* str, size_t max) {
+    size_t len = snprintf(str, max, "# site acquired contended wait_cycles avg_wait_cycles"
+                          " max_wait_cycles\n");
+    for (size_t i = 0; i < LOCK_STATS_SITES && len < max; i++) {
+        struct lock_site* site = &g_lock_sites[i];
+        if (!__atomic_load_n(&site->ready, __ATOMIC_ACQUIRE))
+            continue;
+
+        uint64_t acquired = __atomic_load_n(&site->acquired, __ATOMIC_RELAXED);
+        if (!acquired)
+            continue;
+        uint64_t wait_cycles = __atomic_load_n(&site->wait_cycles, __ATOMIC_RELAXED);
+        len += snprintf(str + len, max - len, "%s:%d %lu %lu %lu %lu %lu\n", site->file,
+                        site->line, acquired, __atomic_load_n(&site->contended, __ATOMIC_RELAXED),
+                        wait_cycles, wait_cycles / acquired,
+                        __atomic_load_n(&site->max_wait_cycles, __ATOMIC_RELAXED));
+    }
+
+    uint64_t dropped = __atomic_load_n(&g_lock_sites_dropped, __ATOMIC_RELAXED);
+    if (dropped && len < max)
+        len += snprintf(str + len, max - len, "# %lu acquisitions at untracked sites\n", dropped);
+    return len;
+}
+
+/* Returns a newly allocated summary of lock stats (used for `/proc/graphene/locks`, which only has
+ * the header line if the stats are disabled). */
+int get_lock_stats(char** out_data, size_t* out_size) {
+    size_t max = 4096;
+    while (true) {
+        char* str = malloc(max);
+        if (!str)
+            return -ENOMEM;
+
+        size_t len = print_lock_stats_to(str, max);
+        if (len < max) {
+            *out_data = str;
+            *out_size = len;
+            return 0;
+        }
+
+        /* stats may change between the tries, leave some room for that */
+        free(str);
+        max = len + 256;
+    }
+}
+
+void print_lock_stats(void) {
+    if (!g_lock_stats_enabled)
+        return;
+
+    char* str;
+    size_t size;
+    int ret = get_lock_stats(&str, &size);
+    if (ret < 0) {
+        log_warning("Getting lock stats failed: %d", ret);
+        return;
+    }
+
+    /* strip the last newline, log_always() adds one */
+    if (size && str[size - 1] == '\n')
+        str[size - 1] = '\0';
+    log_always("----- Lock stats -----\n%s", str);
+    free(str);
+}
@@ -4,6 +4,19 @@
  *                    Michał Kowalczyk <mkow@invisiblethingslab.com>
  */
 
+/*
+ * LibOS logging.
+ *
+ * By default every message is written with DkDebugLog() (on SGX, one OCALL per line). With
+ * `libos.log_buffer_size`, `debug` and `trace` messages are instead appended to a ring buffer in
+ * memory, which a LibOS-internal thread drains in batches every LOG_FLUSH_INTERVAL_US (or sooner,
+ * when the buffer gets half full). Errors and warnings still go out immediately, after whatever is
+ * buffered, so that they are not lost if the process dies right after.
+ *
+ * `shim_log` may be called from a signal upcall that interrupted the same thread in the middle of
+ * logging, so it only ever try-locks; if a lock is taken, the message is written directly.
+ */
+
 #include <stdarg.h>
 #include <stdint.h>
 
@@ -15,9 +28,24 @@
 #include "shim_ipc.h"
 #include "shim_lock.h"
 #include "shim_process.h"
+#include "shim_thread.h"
+#include "spinlock.h"
+
+#define LOG_FLUSH_INTERVAL_US (100 * 1000)
 
 int g_log_level = LOG_LEVEL_NONE;
 
+/* Ring buffer of pending messages, NULL if logging is synchronous. Bytes `[start, start + len)`
+ * (modulo `size`) are pending; only the drainer advances `start`, and only after writing. */
+static char* g_log_buf = NULL;
+static size_t g_log_buf_size = 0;
+static size_t g_log_buf_start = 0;
+static size_t g_log_buf_len = 0;
+static spinlock_t g_log_buf_lock = INIT_SPINLOCK_UNLOCKED;
+/* Held while draining, keeps the order of messages in the log. */
+static spinlock_t g_log_write_lock = INIT_SPINLOCK_UNLOCKED;
+static PAL_HANDLE g_log_event = NULL;
+
 /* NOTE: We could add "libos" prefix to the below strings for more fine-grained log info */
 static const char* log_level_to_prefix[] = {
     [LOG_LEVEL_NONE]    = "",
@@ -76,15 +104,93 @@ void log_setprefix(shim_tcb_t* tcb) {
     unlock(&g_process.fs_lock);
 }
 
+/* Must be called with `g_log_write_lock` held. */
+static void log_drain_locked(void) {
+    while (true) {
+        spinlock_lock(&g_log_buf_lock);
+        size_t start = g_log_buf_start;
+        size_t chunk = MIN(g_log_buf_len, g_log_buf_size - start);
+        spinlock_unlock(&g_log_buf_lock);
+        if (!chunk)
+            break;
+
+        /* producers only append after `start + len`, this part stays as it is */
+        DkDebugLog(g_log_buf + start, chunk);
+
+        spinlock_lock(&g_log_buf_lock);
+        g_log_buf_start = (start + chunk) % g_log_buf_size;
+        g_log_buf_len -= chunk;
+        spinlock_unlock(&g_log_buf_lock);
+    }
+}
+
+/* Writes out buffered messages and then `str`; if another thread (or the interrupted context of
+ * this one) is draining right now, just writes `str`. */
+static void log_write_through(const char* str, size_t size) {
+    if (g_log_buf && spinlock_trylock(&g_log_write_lock) == 0) {
+        log_drain_locked();
+        if (size)
+            DkDebugLog((PAL_PTR)str, size);
+        spinlock_unlock(&g_log_write_lock);
+        return;
+    }
+    if (size)
+        DkDebugLog((PAL_PTR)str, size);
+}
+
+void log_flush(void) {
+    if (!g_log_buf)
+        return;
+    spinlock_lock(&g_log_write_lock);
+    log_drain_locked();
+    spinlock_unlock(&g_log_write_lock);
+}
+
 static int buf_write_all(const char* str, size_t size, void* arg) {
     __UNUSED(arg);
     DkDebugLog((PAL_PTR)str, size);
     return 0;
 }
 
+static int buf_write_through(const char* str, size_t size, void* arg) {
+    __UNUSED(arg);
+    log_write_through(str, size);
+    return 0;
+}
+
+static int buf_append(const char* str, size_t size, void* arg) {
+    __UNUSED(arg);
+
+    if (spinlock_trylock(&g_log_buf_lock) != 0) {
+        log_write_through(str, size);
+        return 0;
+    }
+    if (g_log_buf_size - g_log_buf_len < size) {
+        /* full, make the message wait for the writer no longer */
+        spinlock_unlock(&g_log_buf_lock);
+        log_write_through(str, size);
+        return 0;
+    }
+
+    size_t end = (g_log_buf_start + g_log_buf_len) % g_log_buf_size;
+    size_t first = MIN(size, g_log_buf_size - end);
+    memcpy(g_log_buf + end, str, first);
+    memcpy(g_log_buf, str + first, size - first);
+    bool wake = g_log_buf_len < g_log_buf_size / 2 && g_log_buf_len + size >= g_log_buf_size / 2;
+    g_log_buf_len += size;
+    spinlock_unlock(&g_log_buf_lock);
+
+    if (wake)
+        DkEventSet(g_log_event);
+    return 0;
+}
+
 void shim_log(int level, const char* fmt, ...) {
     if (level <= g_log_level) {
-        struct print_buf buf = INIT_PRINT_BUF(buf_write_all);
+        int (*write_all)(const char*, size_t, void*) = buf_write_all;
+        if (g_log_buf)
+            write_all = level > LOG_LEVEL_WARNING ? buf_append : buf_write_through;
+        struct print_buf buf = INIT_PRINT_BUF(write_all);
 
         buf_puts(&buf, shim_get_tcb()->log_prefix);
         buf_puts(&buf, log_level_to_prefix[level]);
@@ -98,3 +204,69 @@ void shim_log(int level, const char* fmt, ...) {
         buf_flush(&buf);
     }
 }
+
+static void log_writer_main(void* arg) {
+    struct shim_thread* thread = arg;
+
+    shim_tcb_init();
+    set_cur_thread(thread);
+    log_setprefix(shim_get_tcb());
+
+    while (true) {
+        uint64_t timeout_us = LOG_FLUSH_INTERVAL_US;
+        int ret = DkEventWait(g_log_event, &timeout_us);
+        if (ret < 0 && ret != -PAL_ERROR_INTERRUPTED && ret != -PAL_ERROR_TRYAGAIN) {
+            log_error("Log writer: waiting failed: %d", ret);
+            DkProcessExit(1);
+        }
+        log_flush();
+    }
+}
+
+int init_log_writer(void) {
+    if (g_log_level < LOG_LEVEL_DEBUG)
+        return 0;
+
+    assert(g_manifest_root);
+    uint64_t buf_size;
+    int ret = toml_sizestring_in(g_manifest_root, "libos.log_buffer_size", /*defaultval=*/0,
+                                 &buf_size);
+    if (ret < 0) {
+        log_error("Cannot parse 'libos.log_buffer_size'");
+        return -EINVAL;
+    }
+    if (!buf_size)
+        return 0;
+
+    char* buf = malloc(buf_size);
+    if (!buf)
+        return -ENOMEM;
+
+    ret = DkEventCreate(&g_log_event, /*init_signaled=*/false, /*auto_clear=*/true);
+    if (ret < 0) {
+        free(buf);
+        return pal_to_unix_errno(ret);
+    }
+
+    struct shim_thread* thread = get_new_internal_thread();
+    if (!thread) {
+        DkObjectClose(g_log_event);
+        g_log_event = NULL;
+        free(buf);
+        return -ENOMEM;
+    }
+
+    enable_locking();
+
+    g_log_buf_size = buf_size;
+    __atomic_store_n(&g_log_buf, buf, __ATOMIC_RELEASE);
+
+    PAL_HANDLE handle = NULL;
+    ret = DkThreadCreate(log_writer_main, thread, &handle);
+    if (ret < 0) {
+        /* fatal, LibOS initialization fails */
+        return pal_to_unix_errno(ret);
+    }
+    thread->pal_handle = handle;
+    return 0;
+}
@@ -0,0 +1,182 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/*
+ * Compressor and decompressor for the LZ4 block format (see the LZ4 block format description in
+ * the upstream lz4 repository), used to shrink checkpoint memory before it goes through the
+ * (possibly encrypted) process streams. The compressor is the simple greedy one with a single hash
+ * table of 4-byte sequences: fast, with a ratio close to the reference LZ4 at its default level.
+ * Blocks are never streamed, each call works on one self-contained buffer.
+ */
+
+#include <errno.h>
+
+#include "api.h"
+#include "shim_lz4.h"
+
+#define LZ4_MIN_MATCH     4
+/* the last 5 bytes are always literals and the last match starts at least 12 bytes before the
+ * end of the block (required by the format) */
+#define LZ4_LAST_LITERALS 5
+#define LZ4_MF_LIMIT      12
+#define LZ4_MAX_DISTANCE  65535
+#define LZ4_RUN_MASK      15
+/* literals found without a match make the compressor skip faster over incompressible data */
+#define LZ4_SKIP_TRIGGER  6
+
+static inline uint32_t read32(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t lz4_hash(uint32_t v) {
+    return (v * 2654435761u) >> (32 - LZ4_HASH_LOG);
+}
+
+static uint8_t* write_length_ext(uint8_t* op, size_t len) {
+    for (; len >= 255; len -= 255)
+        *op++ = 255;
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+/* upper bound of bytes needed for a sequence with `literals` literals and a match of `match_len` */
+static inline size_t sequence_size(size_t literals, size_t match_len) {
+    return 1 + literals / 255 + 1 + literals + 2 + match_len / 255 + 1;
+}
+
+size_t lz4_compress(const void* src, size_t src_size, void* dst, size_t dst_size,
+                    uint32_t* hash_table) {
+    const uint8_t* base   = src;
+    const uint8_t* ip     = base;
+    const uint8_t* anchor = base;
+    const uint8_t* iend   = base + src_size;
+    uint8_t* op   = dst;
+    uint8_t* oend = op + dst_size;
+
+    if (src_size > LZ4_MF_LIMIT) {
+        const uint8_t* mflimit    = iend - LZ4_MF_LIMIT;
+        const uint8_t* matchlimit = iend - LZ4_LAST_LITERALS;
+
+        memset(hash_table, 0, sizeof(*hash_table) << LZ4_HASH_LOG);
+        ip++;
+
+        while (ip <= mflimit) {
+            uint32_t h = lz4_hash(read32(ip));
+            const uint8_t* ref = base + hash_table[h];
+            hash_table[h] = ip - base;
+
+            if (ip - ref > LZ4_MAX_DISTANCE || read32(ref) != read32(ip)) {
+                ip += 1 + ((ip - anchor) >> LZ4_SKIP_TRIGGER);
+                continue;
+            }
+
+            while (ip > anchor && ref > base && ip[-1] == ref[-1]) {
+                ip--;
+                ref--;
+            }
+
+            size_t len = LZ4_MIN_MATCH;
+            while (ip + len < matchlimit && ip[len] == ref[len])
+                len++;
+
+            size_t literals  = ip - anchor;
+            size_t match_len = len - LZ4_MIN_MATCH;
+            if (sequence_size(literals, match_len) > (size_t)(oend - op))
+                return 0;
+
+            uint8_t* token = op++;
+            *token = (uint8_t)(MIN(literals, (size_t)LZ4_RUN_MASK) << 4);
+            if (literals >= LZ4_RUN_MASK)
+                op = write_length_ext(op, literals - LZ4_RUN_MASK);
+            memcpy(op, anchor, literals);
+            op += literals;
+
+            size_t offset = ip - ref;
+            *op++ = (uint8_t)offset;
+            *op++ = (uint8_t)(offset >> 8);
+
+            *token |= (uint8_t)MIN(match_len, (size_t)LZ4_RUN_MASK);
+            if (match_len >= LZ4_RUN_MASK)
+                op = write_length_ext(op, match_len - LZ4_RUN_MASK);
+
+            ip += len;
+            anchor = ip;
+            if (ip <= mflimit)
+                hash_table[lz4_hash(read32(ip - 2))] = ip - 2 - base;
+        }
+    }
+
+    size_t literals = iend - anchor;
+    if (sequence_size(literals, 0) > (size_t)(oend - op))
+        return 0;
+
+    *op++ = (uint8_t)(MIN(literals, (size_t)LZ4_RUN_MASK) << 4);
+    if (literals >= LZ4_RUN_MASK)
+        op = write_length_ext(op, literals - LZ4_RUN_MASK);
+    memcpy(op, anchor, literals);
+    op += literals;
+
+    return op - (uint8_t*)dst;
+}
+
+static bool read_length_ext(const uint8_t** ip, const uint8_t* iend, size_t* len) {
+    uint8_t b;
+    do {
+        if (*ip >= iend)
+            return false;
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return true;
+}
+
+int lz4_decompress(const void* src, size_t src_size, void* dst, size_t dst_size) {
+    const uint8_t* ip   = src;
+    const uint8_t* iend = ip + src_size;
+    uint8_t* op   = dst;
+    uint8_t* oend = op + dst_size;
+
+    while (ip < iend) {
+        uint8_t token = *ip++;
+
+        size_t len = token >> 4;
+        if (len == LZ4_RUN_MASK && !read_length_ext(&ip, iend, &len))
+            return -EINVAL;
+        if (len > (size_t)(iend - ip) || len > (size_t)(oend - op))
+            return -EINVAL;
+        memcpy(op, ip, len);
+        op += len;
+        ip += len;
+
+        /* the last sequence has only literals */
+        if (ip == iend)
+            break;
+
+        if (iend - ip < 2)
+            return -EINVAL;
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (!offset || offset > (size_t)(op - (uint8_t*)dst))
+            return -EINVAL;
+
+        len = token & LZ4_RUN_MASK;
+        if (len == LZ4_RUN_MASK && !read_length_ext(&ip, iend, &len))
+            return -EINVAL;
+        len += LZ4_MIN_MATCH;
+        if (len > (size_t)(oend - op))
+            return -EINVAL;
+
+        const uint8_t* match = op - offset;
+        if (offset >= len) {
+            memcpy(op, match, len);
+            op += len;
+        } else {
+            /* overlapping match, repeats the last `offset` bytes */
+            for (size_t i = 0; i < len; i++)
+                *op++ = match[i];
+        }
+    }
+
+    return op == oend ? 0 : -EINVAL;
+}
@@ -0,0 +1,131 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/*
+ * Per-thread random number generator behind `getrandom()` and `/dev/[u]random`. Asking the PAL for
+ * every few bytes is slow (on SGX, each call runs RDRAND in a loop; on Linux it is a host read of
+ * /dev/urandom), and TLS libraries or UUID generators do it all the time.
+ *
+ * Each thread runs its own ChaCha20 generator in the "fast key erasure" construction: a refill
+ * computes RANDOM_BLOCKS blocks of keystream, the first 32 bytes replace the key and the rest is
+ * handed out. Bytes are wiped as soon as they are returned, so a leak of the state does not reveal
+ * earlier output. The key is seeded with PAL randomness on the first use and re-seeded after
+ * every RANDOM_RESEED_REFILLS refills (about 1 MB of output). The state is not inherited by
+ * child processes, so they never repeat the output of the parent.
+ */
+
+#include "shim_internal.h"
+#include "shim_thread.h"
+#include "shim_utils.h"
+
+#define RANDOM_BLOCKS         4
+#define RANDOM_BLOCK_SIZE     64
+#define RANDOM_KEY_SIZE       32
+#define RANDOM_RESEED_REFILLS 4096
+
+struct shim_random_state {
+    uint32_t key[RANDOM_KEY_SIZE / sizeof(uint32_t)];
+    uint8_t buf[RANDOM_BLOCKS * RANDOM_BLOCK_SIZE];
+    size_t pos; /* bytes of `buf` already used (or wiped) */
+    size_t refills_left; /* until the next re-seed */
+};
+
+#define ROTL32(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+
+#define CHACHA_QUARTERROUND(a, b, c, d) \
+    do {                                \
+        a += b; d ^= a; d = ROTL32(d, 16); \
+        c += d; b ^= c; b = ROTL32(b, 12); \
+        a += b; d ^= a; d = ROTL32(d, 8);  \
+        c += d; b ^= c; b = ROTL32(b, 7);  \
+    } while (0)
+
+/* ChaCha20 block function (RFC 8439) with an all-zero nonce */
+static void chacha20_block(const uint32_t key[8], uint32_t counter, uint8_t* out) {
+    uint32_t in[16] = {
+        0x61707865, 0x3320646e, 0x79622d32, 0x6b206574,
+        key[0], key[1], key[2], key[3], key[4], key[5], key[6], key[7],
+        counter, 0, 0, 0,
+    };
+    uint32_t x[16];
+    memcpy(x, in, sizeof(x));
+
+    for (int i = 0; i < 10; i++) {
+        CHACHA_QUARTERROUND(x[0], x[4], x[8], x[12]);
+        CHACHA_QUARTERROUND(x[1], x[5], x[9], x[13]);
+        CHACHA_QUARTERROUND(x[2], x[6], x[10], x[14]);
+        CHACHA_QUARTERROUND(x[3], x[7], x[11], x[15]);
+        CHACHA_QUARTERROUND(x[0], x[5], x[10], x[15]);
+        CHACHA_QUARTERROUND(x[1], x[6], x[11], x[12]);
+        CHACHA_QUARTERROUND(x[2], x[7], x[8], x[13]);
+        CHACHA_QUARTERROUND(x[3], x[4], x[9], x[14]);
+    }
+
+    /* x86 is little-endian, so this is the serialization required by the RFC */
+    for (int i = 0; i < 16; i++)
+        x[i] += in[i];
+    memcpy(out, x, sizeof(x));
+    erase_memory(x, sizeof(x));
+}
+
+static int refill(struct shim_random_state* state) {
+    if (!state->refills_left) {
+        uint32_t seed[ARRAY_SIZE(state->key)];
+        int ret = DkRandomBitsRead(seed, sizeof(seed));
+        if (ret < 0)
+            return pal_to_unix_errno(ret);
+        /* mixed into the old key, so a weak seed cannot make things worse */
+        for (size_t i = 0; i < ARRAY_SIZE(state->key); i++)
+            state->key[i] ^= seed[i];
+        erase_memory(seed, sizeof(seed));
+        state->refills_left = RANDOM_RESEED_REFILLS;
+    }
+    state->refills_left--;
+
+    for (uint32_t i = 0; i < RANDOM_BLOCKS; i++)
+        chacha20_block(state->key, i, &state->buf[i * RANDOM_BLOCK_SIZE]);
+    memcpy(state->key, state->buf, RANDOM_KEY_SIZE);
+    memset(state->buf, 0, RANDOM_KEY_SIZE);
+    state->pos = RANDOM_KEY_SIZE;
+    return 0;
+}
+
+/* Fills `buf` with `size` cryptographically secure random bytes. Returns 0 or a negative errno. */
+int get_random_bytes(void* buf, size_t size) {
+    struct shim_thread* cur_thread = get_cur_thread();
+    if (!cur_thread) {
+        /* too early in LibOS init (or an internal thread without one) */
+        int ret = DkRandomBitsRead(buf, size);
+        return ret < 0 ? pal_to_unix_errno(ret) : 0;
+    }
+
+    struct shim_random_state* state = cur_thread->random_state;
+    if (!state) {
+        state = calloc(1, sizeof(*state));
+        if (!state)
+            return -ENOMEM;
+        state->pos = sizeof(state->buf);
+        cur_thread->random_state = state;
+    }
+
+    while (size) {
+        if (state->pos == sizeof(state->buf)) {
+            int ret = refill(state);
+            if (ret < 0)
+                return ret;
+        }
+        size_t copy = MIN(size, sizeof(state->buf) - state->pos);
+        memcpy(buf, &state->buf[state->pos], copy);
+        memset(&state->buf[state->pos], 0, copy);
+        state->pos += copy;
+        buf = (char*)buf + copy;
+        size -= copy;
+    }
+    return 0;
+}
+
+void free_random_state(struct shim_random_state* state) {
+    if (!state)
+        return;
+    erase_memory(state, sizeof(*state));
+    free(state);
+}
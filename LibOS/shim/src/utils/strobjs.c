@@ -2,46 +2,36 @@
 /* Copyright (C) 2014 Stony Brook University */
 
 /*
- * This file contains functions to allocate / free a fixed-size string object.
+ * This file contains functions to allocate / free string objects (used for long qstr strings).
+ *
+ * Objects come in power-of-two size classes between STR_OBJ_MIN_SIZE and STR_SIZE, so that a qstr
+ * can be set to another string of similar length without reallocating (see `qstr_get_buf`). They
+ * are allocated with malloc(), whose slab allocator keeps per-thread caches of freed objects of
+ * each size; this matters for path-heavy workloads, which set and free lots of short URIs.
  */
 
 #include "shim_internal.h"
-#include "shim_lock.h"
 #include "shim_utils.h"
 
-static struct shim_lock str_mgr_lock;
+#define STR_OBJ_MIN_SIZE 64
 
-#define SYSTEM_LOCK()   lock(&str_mgr_lock)
-#define SYSTEM_UNLOCK() unlock(&str_mgr_lock)
-#define SYSTEM_LOCKED() locked(&str_mgr_lock)
+size_t str_obj_size(size_t size) {
+    assert(size <= STR_SIZE);
 
-#define STR_MGR_ALLOC 32
-
-#define OBJ_TYPE struct shim_str
-#include "memmgr.h"
-
-static MEM_MGR str_mgr = NULL;
-
-int init_str_mgr(void) {
-    if (!create_lock(&str_mgr_lock)) {
-        return -ENOMEM;
-    }
-    str_mgr = create_mem_mgr(init_align_up(STR_MGR_ALLOC));
-    if (!str_mgr) {
-        destroy_lock(&str_mgr_lock);
-        return -ENOMEM;
-    }
-    return 0;
+    size_t obj_size = STR_OBJ_MIN_SIZE;
+    while (obj_size < size)
+        obj_size *= 2;
+    return obj_size;
 }
 
-struct shim_str* get_str_obj(void) {
-    return get_mem_obj_from_mgr_enlarge(str_mgr, size_align_up(STR_MGR_ALLOC));
+struct shim_str* get_str_obj(size_t size) {
+    return malloc(str_obj_size(size));
 }
 
 int free_str_obj(struct shim_str* str) {
     if (str == NULL)
         return 0;
 
-    free_mem_obj_to_mgr(str_mgr, str);
+    free(str);
     return 0;
 }
@@ -7,7 +7,10 @@
  */
 
 #include <asm/unistd.h>
+#include <stdbool.h>
 
+#include "cpu.h"
+#include "shim_vdso-arch.h"
 #include "vdso.h"
 #include "vdso_syscall.h"
 
@@ -20,17 +23,70 @@
 #define EXPORT_WEAK_SYMBOL(name) \
     __typeof__(__vdso_##name) name __attribute__((weak, alias("__vdso_" #name)))
 
+/* Defined in `vdso.lds` to be the page right before the vDSO image; hidden, so that it is
+ * addressed relative to RIP and needs no relocation. */
+extern const struct vdso_time_data vdso_time_data __attribute__((visibility("hidden")));
+
+/* Same computation as in DkSystemTimeQuery(), with parameters published by LibOS. Returns false if
+ * they are not available or out of date; the syscall path then refreshes them. */
+static bool vdso_time_usec(uint64_t* out_usec) {
+    uint32_t seq;
+    uint64_t tsc_hz;
+    uint64_t base_tsc;
+    uint64_t base_usec;
+    uint64_t max_tsc_delta;
+    do {
+        seq = __atomic_load_n(&vdso_time_data.seq, __ATOMIC_ACQUIRE);
+        if (seq & 1)
+            return false;
+        tsc_hz        = __atomic_load_n(&vdso_time_data.tsc_hz, __ATOMIC_RELAXED);
+        base_tsc      = __atomic_load_n(&vdso_time_data.base_tsc, __ATOMIC_RELAXED);
+        base_usec     = __atomic_load_n(&vdso_time_data.base_usec, __ATOMIC_RELAXED);
+        max_tsc_delta = __atomic_load_n(&vdso_time_data.max_tsc_delta, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (seq != __atomic_load_n(&vdso_time_data.seq, __ATOMIC_RELAXED));
+
+    if (!tsc_hz)
+        return false;
+
+    uint64_t tsc_delta = get_tsc() - base_tsc;
+    if (tsc_delta >= max_tsc_delta)
+        return false;
+
+    *out_usec = base_usec + tsc_delta * 1000000 / tsc_hz;
+    return true;
+}
+
 int __vdso_clock_gettime(clockid_t clock, struct timespec* t) {
+    uint64_t usec;
+    /* all clocks are the same, see shim_do_clock_gettime() */
+    if (0 <= clock && clock < MAX_CLOCKS && t && vdso_time_usec(&usec)) {
+        t->tv_sec  = usec / 1000000;
+        t->tv_nsec = (usec % 1000000) * 1000;
+        return 0;
+    }
     return vdso_arch_syscall(__NR_clock_gettime, (long)clock, (long)t);
 }
 EXPORT_WEAK_SYMBOL(clock_gettime);
 
 int __vdso_gettimeofday(struct timeval* tv, struct timezone* tz) {
+    uint64_t usec;
+    if (tv && !tz && vdso_time_usec(&usec)) {
+        tv->tv_sec  = usec / 1000000;
+        tv->tv_usec = usec % 1000000;
+        return 0;
+    }
     return vdso_arch_syscall(__NR_gettimeofday, (long)tv, (long)tz);
 }
 EXPORT_WEAK_SYMBOL(gettimeofday);
 
 time_t __vdso_time(time_t* t) {
+    uint64_t usec;
+    if (vdso_time_usec(&usec)) {
+        if (t)
+            *t = usec / 1000000;
+        return usec / 1000000;
+    }
     return vdso_arch_syscall(__NR_time, (long)t, 0);
 }
 EXPORT_WEAK_SYMBOL(time);
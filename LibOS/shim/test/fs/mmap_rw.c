@@ -0,0 +1,39 @@
+#include "common.h"
+
+#define PAGE_SIZE 4096
+
+/* inverts the first byte of every third page, starting at page `first_page` */
+static void modify_pages(uint8_t* buf, size_t size, size_t first_page) {
+    for (size_t offset = first_page * PAGE_SIZE; offset < size; offset += 3 * PAGE_SIZE)
+        buf[offset] = ~buf[offset];
+}
+
+static void mmap_rw(const char* file_path, size_t size) {
+    int fd = open_output_fd(file_path, /*rdwr=*/true);
+    printf("open(%s) RW OK\n", file_path);
+
+    uint8_t* buf = mmap_fd(file_path, fd, PROT_READ | PROT_WRITE, 0, size);
+    printf("mmap_fd(%zu) RW OK\n", size);
+
+    modify_pages(buf, size, 0);
+    if (fsync(fd) != 0)
+        fatal_error("fsync(%s) failed: %s\n", file_path, strerror(errno));
+    printf("fsync(%s) RW OK\n", file_path);
+
+    /* pages modified after the previous flush must be flushed too */
+    modify_pages(buf, size, 1);
+    munmap_fd(file_path, buf, size);
+    printf("munmap_fd(%zu) RW OK\n", size);
+
+    close_fd(file_path, fd);
+    printf("close(%s) RW OK\n", file_path);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3)
+        fatal_error("Usage: %s <file_path> <size>\n", argv[0]);
+
+    setup();
+    mmap_rw(argv[1], strtoul(argv[2], NULL, 10));
+    return 0;
+}
@@ -283,6 +283,30 @@ class TC_00_FileSystem(RegressionTestCase):
                                          timeout=timeout)
         self.verify_copy(stdout, stderr, self.INPUT_DIR, executable)
 
+    def do_mmap_rw_test(self, input_path, output_path, size):
+        self.copy_input(input_path, output_path)
+        stdout, stderr = self.run_binary(['mmap_rw', output_path, str(size)])
+        self.assertNotIn('ERROR: ', stderr)
+        self.assertIn('fsync(' + output_path + ') RW OK', stdout)
+        self.assertIn('munmap_fd(' + str(size) + ') RW OK', stdout)
+        self.assertIn('close(' + output_path + ') RW OK', stdout)
+
+        # mmap_rw inverts the first byte of each page, except every third one
+        with open(input_path, 'rb') as file:
+            expected = bytearray(file.read())
+        for offset in range(0, size, 4096):
+            if (offset // 4096) % 3 != 2:
+                expected[offset] ^= 0xff
+        expected_path = output_path + '.expected'
+        with open(expected_path, 'wb') as file:
+            file.write(expected)
+        self.verify_copy_content(expected_path, output_path)
+
+    @expectedFailureIf(HAS_SGX)
+    def test_160_mmap_rw(self):
+        self.do_mmap_rw_test(self.INPUT_FILES[-1], os.path.join(self.OUTPUT_DIR, 'test_160'),
+                             self.FILE_SIZES[-1])
+
     def test_200_copy_dir_whole(self):
         self.do_copy_test('copy_whole', 30)
 
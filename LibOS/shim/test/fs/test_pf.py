@@ -160,6 +160,11 @@ class TC_50_ProtectedFiles(test_fs.TC_00_FileSystem):
             print('[!] Fail: successfully decrypted renamed file: ' + path2)
             self.fail()
 
+    # overrides TC_00_FileSystem to not skip this on SGX
+    def test_160_mmap_rw(self):
+        self.do_mmap_rw_test(self.INPUT_FILES[-1], os.path.join(self.OUTPUT_DIR, 'test_160'),
+                             self.FILE_SIZES[-1])
+
     # overrides TC_00_FileSystem to decrypt output
     def verify_copy_content(self, input_path, output_path):
         dec_path = os.path.join(self.OUTPUT_DIR, os.path.basename(output_path) + '.dec')
@@ -0,0 +1,199 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/*
+ * Test for the eventfd semantics which Graphene emulates in the LibOS: semaphore mode, EAGAIN on
+ * non-blocking eventfds (empty counter on read, overflow on write), readiness reported by poll()
+ * and wakeups of blocked readers and writers by another thread.
+ */
+
+#include <err.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#define EVENTFD_MAX_VAL (UINT64_MAX - 1)
+
+static void efd_write(int efd, uint64_t val) {
+    if (write(efd, &val, sizeof(val)) != sizeof(val))
+        err(1, "write(%lu)", val);
+}
+
+static uint64_t efd_read(int efd) {
+    uint64_t val;
+    if (read(efd, &val, sizeof(val)) != sizeof(val))
+        err(1, "read");
+    return val;
+}
+
+static void expect_eagain(ssize_t ret, const char* what) {
+    if (ret != -1 || errno != EAGAIN)
+        errx(1, "%s returned %ld (errno %d), expected EAGAIN", what, ret, errno);
+}
+
+static void expect_revents(int efd, short expected) {
+    struct pollfd pfd = {.fd = efd, .events = POLLIN | POLLOUT};
+    int ret = poll(&pfd, 1, 0);
+    if (ret < 0)
+        err(1, "poll");
+    if (ret != (expected ? 1 : 0) || pfd.revents != expected)
+        errx(1, "poll returned %d with revents 0x%x, expected revents 0x%x", ret, pfd.revents,
+             expected);
+}
+
+static void test_semaphore(void) {
+    int efd = eventfd(0, EFD_SEMAPHORE | EFD_NONBLOCK);
+    if (efd < 0)
+        err(1, "eventfd");
+
+    efd_write(efd, 3);
+    for (int i = 0; i < 3; i++) {
+        uint64_t val = efd_read(efd);
+        if (val != 1)
+            errx(1, "semaphore read #%d returned %lu", i, val);
+    }
+
+    uint64_t val;
+    expect_eagain(read(efd, &val, sizeof(val)), "read of an empty semaphore");
+
+    if (close(efd) < 0)
+        err(1, "close");
+    printf("semaphore mode OK\n");
+}
+
+static void test_nonblock(void) {
+    int efd = eventfd(0, EFD_NONBLOCK);
+    if (efd < 0)
+        err(1, "eventfd");
+
+    uint64_t val;
+    expect_eagain(read(efd, &val, sizeof(val)), "read of an empty eventfd");
+
+    /* the counter can hold at most UINT64_MAX - 1 */
+    efd_write(efd, EVENTFD_MAX_VAL);
+    val = 1;
+    expect_eagain(write(efd, &val, sizeof(val)), "write overflowing the counter");
+
+    val = UINT64_MAX;
+    if (write(efd, &val, sizeof(val)) != -1 || errno != EINVAL)
+        errx(1, "write of UINT64_MAX didn't fail with EINVAL");
+
+    val = efd_read(efd);
+    if (val != EVENTFD_MAX_VAL)
+        errx(1, "read returned %lu, expected %lu", val, EVENTFD_MAX_VAL);
+    expect_eagain(read(efd, &val, sizeof(val)), "read of a drained eventfd");
+
+    if (close(efd) < 0)
+        err(1, "close");
+    printf("EFD_NONBLOCK OK\n");
+}
+
+static void test_poll(void) {
+    int efd = eventfd(0, EFD_NONBLOCK);
+    if (efd < 0)
+        err(1, "eventfd");
+
+    expect_revents(efd, POLLOUT);
+    efd_write(efd, 1);
+    expect_revents(efd, POLLIN | POLLOUT);
+    efd_write(efd, EVENTFD_MAX_VAL - 1);
+    expect_revents(efd, POLLIN);
+    efd_read(efd);
+    expect_revents(efd, POLLOUT);
+
+    if (close(efd) < 0)
+        err(1, "close");
+    printf("poll readiness OK\n");
+}
+
+static void* writer_thread(void* arg) {
+    int efd = *(int*)arg;
+    usleep(100 * 1000);
+    efd_write(efd, 2);
+    return NULL;
+}
+
+static void* semaphore_reader_thread(void* arg) {
+    int efd = *(int*)arg;
+    return (void*)(uintptr_t)efd_read(efd);
+}
+
+static void* blocked_writer_thread(void* arg) {
+    int efd = *(int*)arg;
+    efd_write(efd, 1);
+    return NULL;
+}
+
+static void test_wakeups(void) {
+    pthread_t threads[2];
+
+    /* poll() sleeping on an empty eventfd wakes up on a write by another thread */
+    int efd = eventfd(0, 0);
+    if (efd < 0)
+        err(1, "eventfd");
+    if (pthread_create(&threads[0], NULL, writer_thread, &efd))
+        errx(1, "pthread_create failed");
+    struct pollfd pfd = {.fd = efd, .events = POLLIN};
+    int ret = poll(&pfd, 1, 10 * 1000);
+    if (ret != 1 || !(pfd.revents & POLLIN))
+        errx(1, "poll returned %d with revents 0x%x, expected POLLIN", ret, pfd.revents);
+    if (pthread_join(threads[0], NULL))
+        errx(1, "pthread_join failed");
+    if (efd_read(efd) != 2)
+        errx(1, "wrong counter after poll");
+    if (close(efd) < 0)
+        err(1, "close");
+
+    /* both readers blocked on a semaphore get one unit of a single write */
+    efd = eventfd(0, EFD_SEMAPHORE);
+    if (efd < 0)
+        err(1, "eventfd");
+    for (int i = 0; i < 2; i++)
+        if (pthread_create(&threads[i], NULL, semaphore_reader_thread, &efd))
+            errx(1, "pthread_create failed");
+    usleep(100 * 1000);
+    efd_write(efd, 2);
+    for (int i = 0; i < 2; i++) {
+        void* val;
+        if (pthread_join(threads[i], &val))
+            errx(1, "pthread_join failed");
+        if ((uintptr_t)val != 1)
+            errx(1, "blocked semaphore reader got %lu", (uintptr_t)val);
+    }
+    if (close(efd) < 0)
+        err(1, "close");
+
+    /* a writer blocked on a full counter wakes up once it is read */
+    efd = eventfd(0, 0);
+    if (efd < 0)
+        err(1, "eventfd");
+    efd_write(efd, EVENTFD_MAX_VAL);
+    if (pthread_create(&threads[0], NULL, blocked_writer_thread, &efd))
+        errx(1, "pthread_create failed");
+    usleep(100 * 1000);
+    if (efd_read(efd) != EVENTFD_MAX_VAL)
+        errx(1, "wrong counter of a full eventfd");
+    if (pthread_join(threads[0], NULL))
+        errx(1, "pthread_join failed");
+    if (efd_read(efd) != 1)
+        errx(1, "blocked write was lost");
+    if (close(efd) < 0)
+        err(1, "close");
+    printf("wakeups OK\n");
+}
+
+int main(void) {
+    setbuf(stdout, NULL);
+
+    test_semaphore();
+    test_nonblock();
+    test_poll();
+    test_wakeups();
+
+    printf("TEST OK\n");
+    return 0;
+}
@@ -0,0 +1,113 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/*
+ * Test for fork with `libos.checkpoint_compression` (see fork_compressed.manifest.template): the
+ * child must see exactly the memory of the parent, whether it compresses well (zeros, repeated
+ * patterns), not at all (random data) or is a mix of both within the same pages.
+ */
+
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define REGION_SIZE (8 * 1024 * 1024)
+
+static uint64_t g_rand_state = 0x2545f4914f6cdd1d;
+
+static uint64_t rand64(void) {
+    g_rand_state ^= g_rand_state << 13;
+    g_rand_state ^= g_rand_state >> 7;
+    g_rand_state ^= g_rand_state << 17;
+    return g_rand_state;
+}
+
+enum pattern { ZEROS, REPEATED, RANDOM, MIXED, PATTERNS_CNT };
+
+static const char* g_pattern_names[] = {"zeros", "repeated", "random", "mixed"};
+
+static uint8_t* g_regions[PATTERNS_CNT];
+static uint8_t* g_expected[PATTERNS_CNT];
+
+static void fill(uint8_t* buf, enum pattern pattern) {
+    for (size_t i = 0; i < REGION_SIZE; i += sizeof(uint64_t)) {
+        uint64_t val;
+        switch (pattern) {
+            case ZEROS:
+                val = 0;
+                break;
+            case REPEATED:
+                val = 0x0123456789abcdef + i / 4096;
+                break;
+            case RANDOM:
+                val = rand64();
+                break;
+            default:
+                /* a random quarter of each page, the rest compresses well */
+                val = i % 4096 < 1024 ? rand64() : i;
+                break;
+        }
+        memcpy(buf + i, &val, sizeof(val));
+    }
+}
+
+int main(void) {
+    setbuf(stdout, NULL);
+
+    for (enum pattern pattern = ZEROS; pattern < PATTERNS_CNT; pattern++) {
+        /* the reference copy is on the heap, the region itself is a separate mapping */
+        g_regions[pattern] = mmap(NULL, REGION_SIZE, PROT_READ | PROT_WRITE,
+                                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (g_regions[pattern] == MAP_FAILED)
+            err(1, "mmap");
+        g_expected[pattern] = malloc(REGION_SIZE);
+        if (!g_expected[pattern])
+            err(1, "malloc");
+
+        fill(g_expected[pattern], pattern);
+        memcpy(g_regions[pattern], g_expected[pattern], REGION_SIZE);
+    }
+    /* a mapping with only some pages touched */
+    uint8_t* sparse = mmap(NULL, REGION_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                           -1, 0);
+    if (sparse == MAP_FAILED)
+        err(1, "mmap");
+    for (size_t i = 0; i < REGION_SIZE; i += 16 * 4096)
+        sparse[i] = (uint8_t)(i / 4096 + 1);
+
+    pid_t pid = fork();
+    if (pid < 0)
+        err(1, "fork");
+
+    if (pid == 0) {
+        for (enum pattern pattern = ZEROS; pattern < PATTERNS_CNT; pattern++) {
+            if (memcmp(g_regions[pattern], g_expected[pattern], REGION_SIZE))
+                errx(1, "child: %s region differs", g_pattern_names[pattern]);
+        }
+        for (size_t i = 0; i < REGION_SIZE; i++) {
+            uint8_t expected = i % (16 * 4096) ? 0 : (uint8_t)(i / 4096 + 1);
+            if (sparse[i] != expected)
+                errx(1, "child: sparse region differs at offset %zu", i);
+        }
+        /* the child's writes must not show up in the parent */
+        memset(g_regions[RANDOM], 0, REGION_SIZE);
+        printf("child: memory OK\n");
+        exit(0);
+    }
+
+    int status;
+    if (waitpid(pid, &status, 0) < 0)
+        err(1, "waitpid");
+    if (!WIFEXITED(status) || WEXITSTATUS(status))
+        errx(1, "child failed (status 0x%x)", status);
+
+    if (memcmp(g_regions[RANDOM], g_expected[RANDOM], REGION_SIZE))
+        errx(1, "parent: random region changed by the child");
+
+    printf("TEST OK\n");
+    return 0;
+}
@@ -0,0 +1,274 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static int futex(uint32_t* uaddr, int futex_op, int val, const struct timespec* timeout,
+                 uint32_t* uaddr2, int val3) {
+    return syscall(SYS_futex, uaddr, futex_op, val, timeout, uaddr2, val3);
+}
+
+static int futex_wait_requeue_pi(uint32_t* uaddr, uint32_t val, uint32_t* pi_uaddr) {
+    return futex(uaddr, FUTEX_WAIT_REQUEUE_PI | FUTEX_PRIVATE_FLAG, val, NULL, pi_uaddr, 0);
+}
+
+static int futex_cmp_requeue_pi(uint32_t* uaddr, uint32_t val, uint32_t* pi_uaddr,
+                                int max_requeue) {
+    return futex(uaddr, FUTEX_CMP_REQUEUE_PI | FUTEX_PRIVATE_FLAG, /*to_wake=*/1,
+                 (struct timespec*)(unsigned long)max_requeue, pi_uaddr, val);
+}
+
+static int futex_unlock_pi(uint32_t* uaddr) {
+    return futex(uaddr, FUTEX_UNLOCK_PI | FUTEX_PRIVATE_FLAG, 0, NULL, NULL, 0);
+}
+
+static void fail(const char* msg, int x) {
+    printf("%s failed with %d (%s)\n", msg, x, strerror(x));
+    exit(1);
+}
+
+static void check(int x) {
+    if (x) {
+        fail("pthread", x);
+    }
+}
+
+static uint32_t gettid_u32(void) {
+    return (uint32_t)syscall(SYS_gettid);
+}
+
+/* Contention: threads increment a counter under a priority-inheritance mutex, which glibc
+ * implements with FUTEX_LOCK_PI and FUTEX_UNLOCK_PI once the mutex is contended. */
+
+#define CONTENTION_THREADS    4
+#define CONTENTION_ITERATIONS 10000
+
+static pthread_mutex_t g_pi_mutex;
+static long g_counter = 0;
+
+static void* contention_thread(void* arg) {
+    (void)arg;
+    for (int i = 0; i < CONTENTION_ITERATIONS; i++) {
+        check(pthread_mutex_lock(&g_pi_mutex));
+        long val = g_counter;
+        if (i % 64 == 0) {
+            /* give the others a chance to block on the futex */
+            sched_yield();
+        }
+        g_counter = val + 1;
+        check(pthread_mutex_unlock(&g_pi_mutex));
+    }
+    return NULL;
+}
+
+static void test_contention(void) {
+    pthread_mutexattr_t attr;
+    check(pthread_mutexattr_init(&attr));
+    check(pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT));
+    check(pthread_mutex_init(&g_pi_mutex, &attr));
+    check(pthread_mutexattr_destroy(&attr));
+
+    pthread_t threads[CONTENTION_THREADS];
+    for (int i = 0; i < CONTENTION_THREADS; i++) {
+        check(pthread_create(&threads[i], NULL, contention_thread, NULL));
+    }
+    for (int i = 0; i < CONTENTION_THREADS; i++) {
+        check(pthread_join(threads[i], NULL));
+    }
+
+    if (g_counter != CONTENTION_THREADS * CONTENTION_ITERATIONS) {
+        printf("PI mutex contention: counter is %ld, expected %d\n", g_counter,
+               CONTENTION_THREADS * CONTENTION_ITERATIONS);
+        exit(1);
+    }
+    check(pthread_mutex_destroy(&g_pi_mutex));
+    printf("PI mutex contention OK\n");
+}
+
+/* Owner death: a thread exits holding a robust PI mutex, the next locker gets EOWNERDEAD. */
+
+static pthread_mutex_t g_robust_mutex;
+static int g_owner_locked = 0;
+
+static void* dying_owner_thread(void* arg) {
+    int delay_us = *(int*)arg;
+    check(pthread_mutex_lock(&g_robust_mutex));
+    __atomic_store_n(&g_owner_locked, 1, __ATOMIC_SEQ_CST);
+    /* let the main thread block on the mutex (if it is to wait for us) */
+    usleep(delay_us);
+    return NULL;
+}
+
+static void owner_death(int delay_us) {
+    __atomic_store_n(&g_owner_locked, 0, __ATOMIC_SEQ_CST);
+
+    pthread_t thread;
+    check(pthread_create(&thread, NULL, dying_owner_thread, &delay_us));
+    while (!__atomic_load_n(&g_owner_locked, __ATOMIC_SEQ_CST)) {
+        sched_yield();
+    }
+    if (!delay_us) {
+        /* the owner is gone before we try to lock */
+        check(pthread_join(thread, NULL));
+    }
+
+    int ret = pthread_mutex_lock(&g_robust_mutex);
+    if (ret != EOWNERDEAD) {
+        printf("locking a mutex of a dead owner returned %d, expected EOWNERDEAD\n", ret);
+        exit(1);
+    }
+    check(pthread_mutex_consistent(&g_robust_mutex));
+    check(pthread_mutex_unlock(&g_robust_mutex));
+
+    /* consistent again, no more EOWNERDEAD */
+    check(pthread_mutex_lock(&g_robust_mutex));
+    check(pthread_mutex_unlock(&g_robust_mutex));
+
+    if (delay_us) {
+        check(pthread_join(thread, NULL));
+    }
+}
+
+static void test_owner_death(void) {
+    pthread_mutexattr_t attr;
+    check(pthread_mutexattr_init(&attr));
+    check(pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT));
+    check(pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST));
+    check(pthread_mutex_init(&g_robust_mutex, &attr));
+    check(pthread_mutexattr_destroy(&attr));
+
+    owner_death(/*delay_us=*/0);
+    /* the main thread sleeps in FUTEX_LOCK_PI when the owner dies */
+    owner_death(/*delay_us=*/200 * 1000);
+
+    check(pthread_mutex_destroy(&g_robust_mutex));
+    printf("PI mutex owner death OK\n");
+}
+
+/* Requeue-PI: waiters of a condition futex are requeued to a PI futex (what a condition variable
+ * broadcast with a PI mutex does) and get the PI futex one after another. */
+
+#define REQUEUE_THREADS 5
+
+static uint32_t g_cond = 0;
+static uint32_t g_pi_futex = 0;
+static int g_waiters_ready = 0;
+static int g_in_critical = 0;
+static int g_owners = 0;
+
+static void pi_futex_unlock(void) {
+    uint32_t tid = gettid_u32();
+    if (__atomic_compare_exchange_n(&g_pi_futex, &tid, 0, /*weak=*/false, __ATOMIC_SEQ_CST,
+                                    __ATOMIC_SEQ_CST)) {
+        return;
+    }
+    /* FUTEX_WAITERS is set, the kernel hands the futex over */
+    if (futex_unlock_pi(&g_pi_futex) < 0) {
+        fail("FUTEX_UNLOCK_PI", errno);
+    }
+}
+
+static void* requeue_waiter_thread(void* arg) {
+    (void)arg;
+    __atomic_add_fetch(&g_waiters_ready, 1, __ATOMIC_SEQ_CST);
+
+    if (futex_wait_requeue_pi(&g_cond, 0, &g_pi_futex) < 0) {
+        fail("FUTEX_WAIT_REQUEUE_PI", errno);
+    }
+    if ((__atomic_load_n(&g_pi_futex, __ATOMIC_SEQ_CST) & FUTEX_TID_MASK) != gettid_u32()) {
+        printf("FUTEX_WAIT_REQUEUE_PI returned without the PI futex being owned\n");
+        exit(1);
+    }
+    if (__atomic_add_fetch(&g_in_critical, 1, __ATOMIC_SEQ_CST) != 1) {
+        printf("two owners of the PI futex at once\n");
+        exit(1);
+    }
+    __atomic_add_fetch(&g_owners, 1, __ATOMIC_SEQ_CST);
+    __atomic_sub_fetch(&g_in_critical, 1, __ATOMIC_SEQ_CST);
+
+    pi_futex_unlock();
+    return NULL;
+}
+
+static void requeue_pi(bool locked) {
+    pthread_t threads[REQUEUE_THREADS];
+
+    __atomic_store_n(&g_waiters_ready, 0, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&g_owners, 0, __ATOMIC_SEQ_CST);
+    if (locked) {
+        __atomic_store_n(&g_pi_futex, gettid_u32(), __ATOMIC_SEQ_CST);
+    }
+
+    for (int i = 0; i < REQUEUE_THREADS; i++) {
+        check(pthread_create(&threads[i], NULL, requeue_waiter_thread, NULL));
+    }
+    while (__atomic_load_n(&g_waiters_ready, __ATOMIC_SEQ_CST) != REQUEUE_THREADS) {
+        sched_yield();
+    }
+
+    /* a waiter may not be queued yet, so repeat until all of them were woken or requeued */
+    int total = 0;
+    bool woke_one = false;
+    while (total < REQUEUE_THREADS) {
+        usleep(10 * 1000);
+        int ret = futex_cmp_requeue_pi(&g_cond, 0, &g_pi_futex, INT_MAX);
+        if (ret < 0) {
+            fail("FUTEX_CMP_REQUEUE_PI", errno);
+        }
+        if (ret > 0 && !locked && !woke_one) {
+            /* the first waiter gets the free PI futex right away */
+            woke_one = true;
+        }
+        total += ret;
+    }
+    if (!locked && !woke_one) {
+        printf("FUTEX_CMP_REQUEUE_PI didn't hand over a free PI futex\n");
+        exit(1);
+    }
+
+    if (locked) {
+        if (__atomic_load_n(&g_owners, __ATOMIC_SEQ_CST)) {
+            printf("a requeued waiter got the PI futex while it was owned\n");
+            exit(1);
+        }
+        pi_futex_unlock();
+    }
+
+    for (int i = 0; i < REQUEUE_THREADS; i++) {
+        check(pthread_join(threads[i], NULL));
+    }
+    if (g_owners != REQUEUE_THREADS) {
+        printf("%d of %d requeued waiters got the PI futex\n", g_owners, REQUEUE_THREADS);
+        exit(1);
+    }
+    if (__atomic_load_n(&g_pi_futex, __ATOMIC_SEQ_CST) != 0) {
+        printf("PI futex is 0x%x after the last unlock\n", g_pi_futex);
+        exit(1);
+    }
+}
+
+static void test_requeue_pi(void) {
+    requeue_pi(/*locked=*/true);
+    requeue_pi(/*locked=*/false);
+    printf("requeue-PI OK\n");
+}
+
+int main(void) {
+    setbuf(stdout, NULL);
+
+    test_contention();
+    test_owner_death();
+    test_requeue_pi();
+
+    printf("Test successful!\n");
+    return 0;
+}
@@ -0,0 +1,142 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/*
+ * Round-trip test of the LZ4 codec of the LibOS (used for `libos.checkpoint_compression`), built
+ * natively against the host libc: compressible and incompressible buffers of various sizes must
+ * decompress to the original, incompressible data must be reported as not fitting into a smaller
+ * buffer and malformed input must be rejected.
+ */
+
+#include <err.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "shim_lz4.h"
+
+#define MAX_SIZE (256 * 1024)
+
+static uint32_t g_hash_table[LZ4_HASH_TABLE_SIZE / sizeof(uint32_t)];
+static uint8_t g_src[MAX_SIZE];
+static uint8_t g_dst[MAX_SIZE + MAX_SIZE / 255 + 16];
+static uint8_t g_out[MAX_SIZE];
+
+static uint64_t g_rand_state = 0x9e3779b97f4a7c15;
+
+static uint8_t rand_byte(void) {
+    /* xorshift64, deterministic so that failures can be reproduced */
+    g_rand_state ^= g_rand_state << 13;
+    g_rand_state ^= g_rand_state >> 7;
+    g_rand_state ^= g_rand_state << 17;
+    return (uint8_t)g_rand_state;
+}
+
+enum pattern { ZEROS, REPEATED, TEXT, MIXED, RANDOM };
+
+static const char* g_pattern_names[] = {"zeros", "repeated", "text", "mixed", "random"};
+
+static void fill(enum pattern pattern, size_t size) {
+    static const char text[] = "The quick brown fox jumps over the lazy dog. ";
+    for (size_t i = 0; i < size; i++) {
+        switch (pattern) {
+            case ZEROS:
+                g_src[i] = 0;
+                break;
+            case REPEATED:
+                /* short period, decompressed by overlapping matches */
+                g_src[i] = "abc"[i % 3];
+                break;
+            case TEXT:
+                g_src[i] = text[i % (sizeof(text) - 1)] ^ (i / 4096 % 2 ? 0x20 : 0);
+                break;
+            case MIXED:
+                /* compressible runs separated by random data, matches further apart than 64K */
+                g_src[i] = i % 8192 < 4096 ? (uint8_t)(i / 8192) : rand_byte();
+                break;
+            case RANDOM:
+                g_src[i] = rand_byte();
+                break;
+        }
+    }
+}
+
+static void roundtrip(enum pattern pattern, size_t size) {
+    fill(pattern, size);
+
+    size_t compressed = lz4_compress(g_src, size, g_dst, sizeof(g_dst), g_hash_table);
+    if (!compressed)
+        errx(1, "%s/%zu: compression failed", g_pattern_names[pattern], size);
+    if (pattern <= TEXT && size >= 1024 && compressed >= size / 4)
+        errx(1, "%s/%zu: compressed only to %zu bytes", g_pattern_names[pattern], size,
+             compressed);
+
+    memset(g_out, 0xcc, size);
+    int ret = lz4_decompress(g_dst, compressed, g_out, size);
+    if (ret < 0)
+        errx(1, "%s/%zu: decompression failed: %d", g_pattern_names[pattern], size, ret);
+    if (memcmp(g_src, g_out, size))
+        errx(1, "%s/%zu: round trip changed the data", g_pattern_names[pattern], size);
+
+    /* the checkpoint code sends data uncompressed if it does not shrink */
+    if (size && lz4_compress(g_src, size, g_dst, size - 1, g_hash_table) >= size)
+        errx(1, "%s/%zu: compressed size exceeds the buffer", g_pattern_names[pattern], size);
+}
+
+static void test_roundtrips(void) {
+    static const size_t sizes[] = {0, 1, 5, 12, 13, 17, 100, 4096, 65535, 65536, 65537,
+                                   MAX_SIZE};
+    for (enum pattern pattern = ZEROS; pattern <= RANDOM; pattern++)
+        for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+            roundtrip(pattern, sizes[i]);
+
+    /* incompressible data does not fit into a smaller buffer */
+    fill(RANDOM, 4096);
+    if (lz4_compress(g_src, 4096, g_dst, 4095, g_hash_table) != 0)
+        errx(1, "random data compressed into a smaller buffer");
+
+    printf("round trips OK\n");
+}
+
+static void test_malformed(void) {
+    fill(TEXT, 4096);
+    size_t compressed = lz4_compress(g_src, 4096, g_dst, sizeof(g_dst), g_hash_table);
+    if (!compressed)
+        errx(1, "compression failed");
+
+    /* wrong output size */
+    if (lz4_decompress(g_dst, compressed, g_out, 4095) != -EINVAL)
+        errx(1, "decompression into a too small buffer not rejected");
+    if (lz4_decompress(g_dst, compressed, g_out, 4097) != -EINVAL)
+        errx(1, "decompression into a too large buffer not rejected");
+
+    /* truncated input */
+    for (size_t size = 1; size < compressed; size += 7)
+        if (lz4_decompress(g_dst, size, g_out, 4096) != -EINVAL)
+            errx(1, "truncated input of %zu bytes not rejected", size);
+
+    /* a match reaching before the start of the output */
+    static const uint8_t bad_offset[] = {0x10, 'a', 0x05, 0x00, 0x00};
+    if (lz4_decompress(bad_offset, sizeof(bad_offset), g_out, 5) != -EINVAL)
+        errx(1, "match before the start of the output not rejected");
+
+    /* random garbage must not crash the decompressor */
+    for (int i = 0; i < 1000; i++) {
+        for (size_t j = 0; j < 256; j++)
+            g_dst[j] = rand_byte();
+        lz4_decompress(g_dst, 256, g_out, 4096);
+    }
+
+    printf("malformed input OK\n");
+}
+
+int main(void) {
+    setbuf(stdout, NULL);
+
+    test_roundtrips();
+    test_malformed();
+
+    printf("TEST OK\n");
+    return 0;
+}
@@ -0,0 +1,178 @@
+/* Test sendfile() from a regular (allowed) file into a TCP socket, with and without explicit
+ * offset. */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define SRV_IP    "127.0.0.1"
+#define PORT      11114
+#define FILE_PATH "tmp/sendfile_socket.dat"
+#define FILE_SIZE (64 * 1024)
+
+static int recv_all(int fd, char* buf, size_t count) {
+    size_t done = 0;
+    while (done < count) {
+        ssize_t ret = recv(fd, buf + done, count - done, 0);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("recv");
+            return -1;
+        }
+        if (ret == 0) {
+            fprintf(stderr, "unexpected EOF after %zu bytes\n", done);
+            return -1;
+        }
+        done += ret;
+    }
+    return 0;
+}
+
+static int send_all(int out_fd, int in_fd, off_t* offset, size_t count) {
+    size_t done = 0;
+    while (done < count) {
+        ssize_t ret = sendfile(out_fd, in_fd, offset, count - done);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("sendfile");
+            return -1;
+        }
+        if (ret == 0) {
+            fprintf(stderr, "sendfile: unexpected EOF after %zu bytes\n", done);
+            return -1;
+        }
+        done += ret;
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    static char data[FILE_SIZE];
+    static char received[FILE_SIZE];
+
+    for (size_t i = 0; i < sizeof(data); i++)
+        data[i] = (char)(i * 7 + i / 4096);
+
+    int file_fd = open(FILE_PATH, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (file_fd < 0) {
+        perror("open");
+        return 1;
+    }
+    for (size_t done = 0; done < sizeof(data);) {
+        ssize_t ret = write(file_fd, data + done, sizeof(data) - done);
+        if (ret < 0) {
+            perror("write");
+            return 1;
+        }
+        done += ret;
+    }
+
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        perror("socket");
+        return 1;
+    }
+
+    int enable = 1;
+    if (setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable)) < 0) {
+        perror("setsockopt");
+        return 1;
+    }
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port   = htons(PORT);
+    if (inet_pton(AF_INET, SRV_IP, &address.sin_addr) != 1) {
+        perror("inet_pton");
+        return 1;
+    }
+
+    if (bind(listen_fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
+        perror("bind");
+        return 1;
+    }
+
+    if (listen(listen_fd, 1) < 0) {
+        perror("listen");
+        return 1;
+    }
+
+    int client_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (client_fd < 0) {
+        perror("socket(client)");
+        return 1;
+    }
+
+    if (connect(client_fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
+        perror("connect");
+        return 1;
+    }
+
+    int server_fd = accept(listen_fd, NULL, NULL);
+    if (server_fd < 0) {
+        perror("accept");
+        return 1;
+    }
+
+    /* explicit offset: must not modify the file position; send only a quarter of the file at a time
+     * so that the socket buffer does not fill up before we start receiving */
+    off_t offset = FILE_SIZE / 2;
+    if (lseek(file_fd, 0, SEEK_SET) < 0) {
+        perror("lseek");
+        return 1;
+    }
+    if (send_all(server_fd, file_fd, &offset, FILE_SIZE / 4) < 0)
+        return 1;
+    if (recv_all(client_fd, received, FILE_SIZE / 4) < 0)
+        return 1;
+    if (offset != FILE_SIZE / 2 + FILE_SIZE / 4) {
+        fprintf(stderr, "wrong offset after sendfile: %ld\n", (long)offset);
+        return 1;
+    }
+    if (lseek(file_fd, 0, SEEK_CUR) != 0) {
+        fprintf(stderr, "sendfile with offset modified the file position\n");
+        return 1;
+    }
+    if (memcmp(received, data + FILE_SIZE / 2, FILE_SIZE / 4)) {
+        fprintf(stderr, "data mismatch (sendfile with offset)\n");
+        return 1;
+    }
+    printf("sendfile with offset OK\n");
+
+    /* no offset: uses and advances the file position */
+    if (lseek(file_fd, FILE_SIZE / 4, SEEK_SET) < 0) {
+        perror("lseek");
+        return 1;
+    }
+    if (send_all(server_fd, file_fd, NULL, FILE_SIZE / 4) < 0)
+        return 1;
+    if (recv_all(client_fd, received, FILE_SIZE / 4) < 0)
+        return 1;
+    if (lseek(file_fd, 0, SEEK_CUR) != FILE_SIZE / 2) {
+        fprintf(stderr, "sendfile without offset did not advance the file position\n");
+        return 1;
+    }
+    if (memcmp(received, data + FILE_SIZE / 4, FILE_SIZE / 4)) {
+        fprintf(stderr, "data mismatch (sendfile without offset)\n");
+        return 1;
+    }
+    printf("sendfile without offset OK\n");
+
+    close(server_fd);
+    close(client_fd);
+    close(listen_fd);
+    close(file_fd);
+    unlink(FILE_PATH);
+    printf("test completed successfully\n");
+    return 0;
+}
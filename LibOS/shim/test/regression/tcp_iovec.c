@@ -0,0 +1,129 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define SRV_IP "127.0.0.1"
+#define PORT   11113
+
+static int read_exact_iov(int fd, struct iovec* iov, int iov_cnt, size_t total, int use_msg) {
+    ssize_t ret;
+    if (use_msg) {
+        struct msghdr msg = {.msg_iov = iov, .msg_iovlen = iov_cnt};
+        ret = recvmsg(fd, &msg, MSG_WAITALL);
+    } else {
+        ret = readv(fd, iov, iov_cnt);
+    }
+    if (ret < 0) {
+        perror(use_msg ? "recvmsg" : "readv");
+        return -1;
+    }
+    if ((size_t)ret != total) {
+        /* readv on a stream socket may legitimately return less; this test sends small messages
+         * over loopback, so a short read here most likely means the iovecs were not honored */
+        fprintf(stderr, "short read: %zd instead of %zu\n", ret, total);
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    int listen_fd, client_fd, server_fd;
+
+    if ((listen_fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+        perror("socket");
+        return 1;
+    }
+
+    int enable = 1;
+    if (setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable)) < 0) {
+        perror("setsockopt");
+        return 1;
+    }
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port   = htons(PORT);
+    if (inet_pton(AF_INET, SRV_IP, &address.sin_addr) != 1) {
+        perror("inet_pton");
+        return 1;
+    }
+
+    if (bind(listen_fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
+        perror("bind");
+        return 1;
+    }
+
+    if (listen(listen_fd, 1) < 0) {
+        perror("listen");
+        return 1;
+    }
+
+    if ((client_fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+        perror("socket(client)");
+        return 1;
+    }
+
+    if (connect(client_fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
+        perror("connect");
+        return 1;
+    }
+
+    if ((server_fd = accept(listen_fd, NULL, NULL)) < 0) {
+        perror("accept");
+        return 1;
+    }
+
+    /* writev() with several iovecs, read back with readv() into differently split buffers */
+    char part1[] = "Hello";
+    char part2[] = ", vectored";
+    char part3[] = " world!";
+    struct iovec wiov[3] = {
+        {.iov_base = part1, .iov_len = strlen(part1)},
+        {.iov_base = part2, .iov_len = strlen(part2)},
+        {.iov_base = part3, .iov_len = strlen(part3)},
+    };
+    size_t total = wiov[0].iov_len + wiov[1].iov_len + wiov[2].iov_len;
+
+    ssize_t ret = writev(client_fd, wiov, 3);
+    if (ret < 0 || (size_t)ret != total) {
+        perror("writev");
+        return 1;
+    }
+
+    char buf1[8] = {0};
+    char buf2[64] = {0};
+    struct iovec riov[2] = {
+        {.iov_base = buf1, .iov_len = sizeof(buf1)},
+        {.iov_base = buf2, .iov_len = total - sizeof(buf1)},
+    };
+    if (read_exact_iov(server_fd, riov, 2, total, /*use_msg=*/0) < 0)
+        return 1;
+    printf("readv: %.*s%s\n", (int)sizeof(buf1), buf1, buf2);
+
+    /* same in the opposite direction using sendmsg() and recvmsg() */
+    struct msghdr msg = {.msg_iov = wiov, .msg_iovlen = 3};
+    ret = sendmsg(server_fd, &msg, 0);
+    if (ret < 0 || (size_t)ret != total) {
+        perror("sendmsg");
+        return 1;
+    }
+
+    memset(buf1, 0, sizeof(buf1));
+    memset(buf2, 0, sizeof(buf2));
+    if (read_exact_iov(client_fd, riov, 2, total, /*use_msg=*/1) < 0)
+        return 1;
+    printf("recvmsg: %.*s%s\n", (int)sizeof(buf1), buf1, buf2);
+
+    close(server_fd);
+    close(client_fd);
+    close(listen_fd);
+    printf("test completed successfully\n");
+    return 0;
+}
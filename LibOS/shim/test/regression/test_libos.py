@@ -19,6 +19,12 @@ class TC_00_Unittests(RegressionTestCase):
 
         self.assertIn('Test successful!', stdout)
 
+    def test_001_lz4_roundtrip(self):
+        stdout, _ = self.run_binary(['lz4_roundtrip'], timeout=60)
+        self.assertIn('round trips OK', stdout)
+        self.assertIn('malformed input OK', stdout)
+        self.assertIn('TEST OK', stdout)
+
     def test_010_shim_run_test(self):
         stdout, _ = self.run_binary(['run_test', 'pass'])
         self.assertIn('shim_run_test("pass") = 0', stdout)
@@ -166,6 +172,11 @@ class TC_01_Bootstrap(RegressionTestCase):
         self.assertIn('TEST OK', stdout)
         self.assertNotIn('grandchild', stderr)
 
+    def test_206_fork_compressed(self):
+        stdout, _ = self.run_binary(['fork_compressed'], timeout=60)
+        self.assertIn('child: memory OK', stdout)
+        self.assertIn('TEST OK', stdout)
+
     def test_210_exec_invalid_args(self):
         stdout, _ = self.run_binary(['exec_invalid_args'])
 
@@ -518,6 +529,10 @@ class TC_30_Syscall(RegressionTestCase):
         stdout, _ = self.run_binary(['rename', file1, file2])
         self.assertIn('TEST OK', stdout)
 
+    def test_035_tmpfs_shared(self):
+        stdout, _ = self.run_binary(['tmpfs_shared'])
+        self.assertIn('TEST OK', stdout)
+
     def test_040_futex_bitset(self):
         stdout, _ = self.run_binary(['futex_bitset'])
 
@@ -540,6 +555,14 @@ class TC_30_Syscall(RegressionTestCase):
 
         self.assertIn('Test successful!', stdout)
 
+    def test_044_futex_pi(self):
+        stdout, _ = self.run_binary(['futex_pi'])
+
+        self.assertIn('PI mutex contention OK', stdout)
+        self.assertIn('PI mutex owner death OK', stdout)
+        self.assertIn('requeue-PI OK', stdout)
+        self.assertIn('Test successful!', stdout)
+
     def test_050_mmap(self):
         stdout, _ = self.run_binary(['mmap_file'], timeout=60)
 
@@ -620,6 +643,14 @@ class TC_30_Syscall(RegressionTestCase):
         self.assertIn('eventfd_using_various_flags completed successfully', stdout)
         self.assertIn('eventfd_using_fork completed successfully', stdout)
 
+    def test_071_eventfd_semantics(self):
+        stdout, _ = self.run_binary(['eventfd_semantics'])
+        self.assertIn('semaphore mode OK', stdout)
+        self.assertIn('EFD_NONBLOCK OK', stdout)
+        self.assertIn('poll readiness OK', stdout)
+        self.assertIn('wakeups OK', stdout)
+        self.assertIn('TEST OK', stdout)
+
     def test_080_sched(self):
         stdout, _ = self.run_binary(['sched'])
 
@@ -1002,6 +1033,14 @@ class TC_80_Socket(RegressionTestCase):
         self.assertIn('This is packet 8', stdout)
         self.assertIn('This is packet 9', stdout)
 
+    def test_201_socket_udp_mmsg(self):
+        stdout, _ = self.run_binary(['udp_mmsg'], timeout=50)
+        self.assertIn('batches OK', stdout)
+        self.assertIn('truncation OK', stdout)
+        self.assertIn('partial send OK', stdout)
+        self.assertIn('connected OK', stdout)
+        self.assertIn('TEST OK', stdout)
+
     def test_300_socket_tcp_msg_peek(self):
         stdout, _ = self.run_binary(['tcp_msg_peek'], timeout=50)
         self.assertIn('[client] receiving with MSG_PEEK: Hello from server!', stdout)
@@ -1015,6 +1054,18 @@ class TC_80_Socket(RegressionTestCase):
         stdout, _ = self.run_binary(['tcp_ipv6_v6only'], timeout=50)
         self.assertIn('test completed successfully', stdout)
 
+    def test_320_socket_tcp_iovec(self):
+        stdout, _ = self.run_binary(['tcp_iovec'], timeout=50)
+        self.assertIn('readv: Hello, vectored world!', stdout)
+        self.assertIn('recvmsg: Hello, vectored world!', stdout)
+        self.assertIn('test completed successfully', stdout)
+
+    def test_330_socket_sendfile(self):
+        stdout, _ = self.run_binary(['sendfile_socket'], timeout=50)
+        self.assertIn('sendfile with offset OK', stdout)
+        self.assertIn('sendfile without offset OK', stdout)
+        self.assertIn('test completed successfully', stdout)
+
 @unittest.skipUnless(HAS_SGX,
     'This test is only meaningful on SGX PAL because only SGX emulates CPUID.')
 class TC_90_CpuidSGX(RegressionTestCase):
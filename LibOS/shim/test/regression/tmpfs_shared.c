@@ -0,0 +1,124 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/*
+ * Test for tmpfs mounted with `uri = "shared:"`: files created by one process must be visible
+ * (also via readdir) in the other processes of the instance. The parent is the main process, which
+ * holds the store; the child accesses it over IPC.
+ */
+
+#include <dirent.h>
+#include <err.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* shared tmpfs mount, see tmpfs_shared.manifest.template */
+#define TEST_ROOT   "/mnt/tmpfs_shared"
+#define TEST_DIR    TEST_ROOT "/dir"
+#define TEST_SUBDIR TEST_DIR "/sub"
+
+static void create_file(const char* path, const char* content) {
+    int fd = open(path, O_CREAT | O_EXCL | O_WRONLY, 0644);
+    if (fd < 0)
+        err(1, "open(%s)", path);
+    size_t size = strlen(content);
+    if (write(fd, content, size) != (ssize_t)size)
+        err(1, "write(%s)", path);
+    if (close(fd) < 0)
+        err(1, "close(%s)", path);
+}
+
+static void check_file(const char* path, const char* content) {
+    char buf[64] = {0};
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        err(1, "open(%s)", path);
+    if (read(fd, buf, sizeof(buf) - 1) < 0)
+        err(1, "read(%s)", path);
+    if (close(fd) < 0)
+        err(1, "close(%s)", path);
+    if (strcmp(buf, content))
+        errx(1, "%s: wrong content: \"%s\" (expected \"%s\")", path, buf, content);
+}
+
+/* checks that `dir` contains exactly the entries in `names` (besides "." and "..") */
+static void check_dir(const char* dir, const char** names, size_t count) {
+    bool seen[count];
+    memset(seen, 0, sizeof(seen));
+
+    DIR* d = opendir(dir);
+    if (!d)
+        err(1, "opendir(%s)", dir);
+
+    struct dirent* dent;
+    while ((dent = readdir(d))) {
+        if (!strcmp(dent->d_name, ".") || !strcmp(dent->d_name, ".."))
+            continue;
+
+        size_t i;
+        for (i = 0; i < count; i++)
+            if (!strcmp(dent->d_name, names[i]))
+                break;
+        if (i == count)
+            errx(1, "%s: unexpected entry \"%s\"", dir, dent->d_name);
+        if (seen[i])
+            errx(1, "%s: duplicate entry \"%s\"", dir, dent->d_name);
+        seen[i] = true;
+    }
+    if (closedir(d) < 0)
+        err(1, "closedir(%s)", dir);
+
+    for (size_t i = 0; i < count; i++)
+        if (!seen[i])
+            errx(1, "%s: missing entry \"%s\"", dir, names[i]);
+}
+
+int main(void) {
+    if (mkdir(TEST_DIR, 0755) < 0)
+        err(1, "mkdir(%s)", TEST_DIR);
+    if (mkdir(TEST_SUBDIR, 0755) < 0)
+        err(1, "mkdir(%s)", TEST_SUBDIR);
+    create_file(TEST_DIR "/a", "a");
+    create_file(TEST_DIR "/b", "b");
+    create_file(TEST_SUBDIR "/c", "c");
+
+    /* in the main process, readdir goes to the store directly */
+    check_dir(TEST_ROOT, (const char*[]){"dir"}, 1);
+    check_dir(TEST_DIR, (const char*[]){"a", "b", "sub"}, 3);
+    check_dir(TEST_SUBDIR, (const char*[]){"c"}, 1);
+
+    pid_t pid = fork();
+    if (pid < 0)
+        err(1, "fork");
+
+    if (pid == 0) {
+        /* in the child, the same operations go over IPC */
+        check_dir(TEST_ROOT, (const char*[]){"dir"}, 1);
+        check_dir(TEST_DIR, (const char*[]){"a", "b", "sub"}, 3);
+        check_dir(TEST_SUBDIR, (const char*[]){"c"}, 1);
+        check_file(TEST_DIR "/a", "a");
+
+        create_file(TEST_DIR "/d", "from child");
+        if (unlink(TEST_DIR "/b") < 0)
+            err(1, "unlink(%s)", TEST_DIR "/b");
+        check_dir(TEST_DIR, (const char*[]){"a", "d", "sub"}, 3);
+        exit(0);
+    }
+
+    int status;
+    if (waitpid(pid, &status, 0) < 0)
+        err(1, "waitpid");
+    if (!WIFEXITED(status) || WEXITSTATUS(status))
+        errx(1, "child failed (status %d)", status);
+
+    check_dir(TEST_DIR, (const char*[]){"a", "d", "sub"}, 3);
+    check_file(TEST_DIR "/d", "from child");
+
+    puts("TEST OK");
+    return 0;
+}
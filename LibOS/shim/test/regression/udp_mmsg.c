@@ -0,0 +1,267 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/*
+ * Test for sendmmsg() and recvmmsg() on UDP sockets: more datagrams than fit into one batch of the
+ * LibOS, datagrams of different sizes (including empty and truncated ones), partial batches (a
+ * receive queue holding fewer datagrams than asked for, a message which cannot be sent in the
+ * middle of the array) and the per-message `msg_len`.
+ */
+
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <err.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/* more than the LibOS hands to the PAL in one call */
+#define MSG_CNT  40
+#define MAX_SIZE 128
+
+static char g_send_bufs[MSG_CNT][MAX_SIZE];
+static char g_recv_bufs[MSG_CNT][MAX_SIZE];
+
+static size_t msg_size(size_t i) {
+    return i * 3 % MAX_SIZE; /* the first datagram is empty */
+}
+
+static int create_socket(struct sockaddr_in* addr) {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0)
+        err(1, "socket");
+
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family      = AF_INET;
+    addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr->sin_port        = 0;
+    if (bind(fd, (struct sockaddr*)addr, sizeof(*addr)) < 0)
+        err(1, "bind");
+
+    socklen_t addrlen = sizeof(*addr);
+    if (getsockname(fd, (struct sockaddr*)addr, &addrlen) < 0)
+        err(1, "getsockname");
+    return fd;
+}
+
+/* the datagrams are sent in two iovecs each, to check that they are not split */
+static void prepare_send(struct mmsghdr* msgs, struct iovec (*iovs)[2], size_t first, size_t cnt,
+                         struct sockaddr_in* dst) {
+    memset(msgs, 0, sizeof(*msgs) * cnt);
+    for (size_t i = 0; i < cnt; i++) {
+        size_t idx  = first + i;
+        size_t size = msg_size(idx);
+        memset(g_send_bufs[idx], 'a' + idx % 26, size);
+
+        iovs[i][0].iov_base = g_send_bufs[idx];
+        iovs[i][0].iov_len  = size / 2;
+        iovs[i][1].iov_base = g_send_bufs[idx] + size / 2;
+        iovs[i][1].iov_len  = size - size / 2;
+        msgs[i].msg_hdr.msg_iov    = iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 2;
+        if (dst) {
+            msgs[i].msg_hdr.msg_name    = dst;
+            msgs[i].msg_hdr.msg_namelen = sizeof(*dst);
+        }
+    }
+}
+
+static void prepare_recv(struct mmsghdr* msgs, struct iovec* iovs, struct sockaddr_in* addrs,
+                         size_t cnt, size_t buf_size) {
+    memset(msgs, 0, sizeof(*msgs) * cnt);
+    for (size_t i = 0; i < cnt; i++) {
+        memset(g_recv_bufs[i], 0, sizeof(g_recv_bufs[i]));
+        iovs[i].iov_base = g_recv_bufs[i];
+        iovs[i].iov_len  = buf_size;
+        msgs[i].msg_len  = (unsigned int)-1;
+        msgs[i].msg_hdr.msg_iov    = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        if (addrs) {
+            msgs[i].msg_hdr.msg_name    = &addrs[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+        }
+    }
+}
+
+/* checks received datagram `i` (of the array) against sent datagram `idx` */
+static void check_recv(struct mmsghdr* msgs, struct sockaddr_in* addrs, size_t i, size_t idx,
+                       size_t buf_size, struct sockaddr_in* src) {
+    size_t expected = msg_size(idx) < buf_size ? msg_size(idx) : buf_size;
+    if (msgs[i].msg_len != expected)
+        errx(1, "datagram %zu: msg_len is %u, expected %zu", idx, msgs[i].msg_len, expected);
+    if (memcmp(g_recv_bufs[i], g_send_bufs[idx], expected))
+        errx(1, "datagram %zu: wrong content", idx);
+    if (addrs && (msgs[i].msg_hdr.msg_namelen != sizeof(*src)
+                  || addrs[i].sin_port != src->sin_port
+                  || addrs[i].sin_addr.s_addr != src->sin_addr.s_addr))
+        errx(1, "datagram %zu: wrong source address", idx);
+}
+
+static void test_batches(int snd, struct sockaddr_in* snd_addr, int rcv,
+                         struct sockaddr_in* rcv_addr) {
+    struct mmsghdr msgs[MSG_CNT];
+    struct iovec send_iovs[MSG_CNT][2];
+    struct iovec recv_iovs[MSG_CNT];
+    struct sockaddr_in addrs[MSG_CNT];
+
+    prepare_send(msgs, send_iovs, 0, MSG_CNT, rcv_addr);
+    int ret = sendmmsg(snd, msgs, MSG_CNT, 0);
+    if (ret != MSG_CNT)
+        err(1, "sendmmsg returned %d", ret);
+    for (size_t i = 0; i < MSG_CNT; i++)
+        if (msgs[i].msg_len != msg_size(i))
+            errx(1, "sendmmsg: msg_len of datagram %zu is %u", i, msgs[i].msg_len);
+
+    /* a partial batch: only the first 10 of the queued datagrams */
+    prepare_recv(msgs, recv_iovs, addrs, 10, MAX_SIZE);
+    ret = recvmmsg(rcv, msgs, 10, 0, NULL);
+    if (ret != 10)
+        err(1, "recvmmsg returned %d", ret);
+    for (size_t i = 0; i < 10; i++)
+        check_recv(msgs, addrs, i, i, MAX_SIZE, snd_addr);
+
+    /* the rest, with more slots than queued datagrams */
+    size_t received = 10;
+    while (received < MSG_CNT) {
+        prepare_recv(msgs, recv_iovs, addrs, MSG_CNT, MAX_SIZE);
+        ret = recvmmsg(rcv, msgs, MSG_CNT, MSG_WAITFORONE, NULL);
+        if (ret <= 0)
+            err(1, "recvmmsg returned %d", ret);
+        if (received + ret > MSG_CNT)
+            errx(1, "recvmmsg returned too many datagrams: %d", ret);
+        for (size_t i = 0; i < (size_t)ret; i++)
+            check_recv(msgs, addrs, i, received + i, MAX_SIZE, snd_addr);
+        for (size_t i = ret; i < MSG_CNT; i++)
+            if (msgs[i].msg_len != (unsigned int)-1)
+                errx(1, "recvmmsg touched msg_len of unused slot %zu", i);
+        received += ret;
+    }
+
+    /* nothing left */
+    prepare_recv(msgs, recv_iovs, addrs, 1, MAX_SIZE);
+    ret = recvmmsg(rcv, msgs, 1, MSG_DONTWAIT, NULL);
+    if (ret != -1 || (errno != EAGAIN && errno != EWOULDBLOCK))
+        errx(1, "recvmmsg on an empty socket returned %d (errno %d)", ret, errno);
+
+    printf("batches OK\n");
+}
+
+static void test_truncation(int snd, int rcv, struct sockaddr_in* rcv_addr) {
+    struct mmsghdr msgs[4];
+    struct iovec send_iovs[4][2];
+    struct iovec recv_iovs[4];
+
+    /* datagrams 30..33 are 90..99 bytes long, received into 50-byte buffers */
+    prepare_send(msgs, send_iovs, 30, 4, rcv_addr);
+    int ret = sendmmsg(snd, msgs, 4, 0);
+    if (ret != 4)
+        err(1, "sendmmsg returned %d", ret);
+
+    prepare_recv(msgs, recv_iovs, NULL, 4, 50);
+    size_t received = 0;
+    while (received < 4) {
+        ret = recvmmsg(rcv, msgs + received, 4 - received, MSG_WAITFORONE, NULL);
+        if (ret <= 0)
+            err(1, "recvmmsg returned %d", ret);
+        received += ret;
+    }
+    for (size_t i = 0; i < 4; i++) {
+        if (msgs[i].msg_len != 50)
+            errx(1, "truncated datagram %zu: msg_len is %u", i, msgs[i].msg_len);
+        if (memcmp(g_recv_bufs[i], g_send_bufs[30 + i], 50))
+            errx(1, "truncated datagram %zu: wrong content", i);
+    }
+
+    printf("truncation OK\n");
+}
+
+static void test_partial_send(int snd, struct sockaddr_in* snd_addr, int rcv,
+                              struct sockaddr_in* rcv_addr) {
+    struct mmsghdr msgs[6];
+    struct iovec send_iovs[6][2];
+    struct iovec recv_iovs[6];
+    struct sockaddr_in addrs[6];
+
+    /* the unconnected socket cannot send the fourth datagram (no address), sendmmsg() reports the
+     * three sent before it */
+    prepare_send(msgs, send_iovs, 1, 6, rcv_addr);
+    msgs[3].msg_hdr.msg_name    = NULL;
+    msgs[3].msg_hdr.msg_namelen = 0;
+    int ret = sendmmsg(snd, msgs, 6, 0);
+    if (ret != 3)
+        errx(1, "sendmmsg with an invalid fourth message returned %d (errno %d)", ret, errno);
+
+    /* the error shows up when the bad message comes first */
+    ret = sendmmsg(snd, &msgs[3], 3, 0);
+    if (ret != -1)
+        errx(1, "sendmmsg starting with an invalid message returned %d", ret);
+
+    prepare_recv(msgs, recv_iovs, addrs, 6, MAX_SIZE);
+    size_t received = 0;
+    while (received < 3) {
+        ret = recvmmsg(rcv, msgs + received, 6 - received, MSG_WAITFORONE, NULL);
+        if (ret <= 0)
+            err(1, "recvmmsg returned %d", ret);
+        received += ret;
+    }
+    if (received != 3)
+        errx(1, "received %zu datagrams, expected 3", received);
+    for (size_t i = 0; i < 3; i++)
+        check_recv(msgs, addrs, i, 1 + i, MAX_SIZE, snd_addr);
+
+    printf("partial send OK\n");
+}
+
+static void test_connected(int snd, struct sockaddr_in* snd_addr, int rcv,
+                           struct sockaddr_in* rcv_addr) {
+    struct mmsghdr msgs[MSG_CNT];
+    struct iovec send_iovs[MSG_CNT][2];
+    struct iovec recv_iovs[MSG_CNT];
+    struct sockaddr_in addrs[MSG_CNT];
+
+    if (connect(snd, (struct sockaddr*)rcv_addr, sizeof(*rcv_addr)) < 0)
+        err(1, "connect");
+    if (connect(rcv, (struct sockaddr*)snd_addr, sizeof(*snd_addr)) < 0)
+        err(1, "connect");
+
+    prepare_send(msgs, send_iovs, 0, MSG_CNT, /*dst=*/NULL);
+    int ret = sendmmsg(snd, msgs, MSG_CNT, 0);
+    if (ret != MSG_CNT)
+        err(1, "sendmmsg on a connected socket returned %d", ret);
+
+    size_t received = 0;
+    while (received < MSG_CNT) {
+        prepare_recv(msgs, recv_iovs, addrs, MSG_CNT - received, MAX_SIZE);
+        ret = recvmmsg(rcv, msgs, MSG_CNT - received, MSG_WAITFORONE, NULL);
+        if (ret <= 0)
+            err(1, "recvmmsg on a connected socket returned %d", ret);
+        for (size_t i = 0; i < (size_t)ret; i++)
+            check_recv(msgs, addrs, i, received + i, MAX_SIZE, snd_addr);
+        received += ret;
+    }
+
+    printf("connected OK\n");
+}
+
+int main(void) {
+    setbuf(stdout, NULL);
+
+    struct sockaddr_in snd_addr;
+    struct sockaddr_in rcv_addr;
+    int snd = create_socket(&snd_addr);
+    int rcv = create_socket(&rcv_addr);
+
+    test_batches(snd, &snd_addr, rcv, &rcv_addr);
+    test_truncation(snd, rcv, &rcv_addr);
+    test_partial_send(snd, &snd_addr, rcv, &rcv_addr);
+    test_connected(snd, &snd_addr, rcv, &rcv_addr);
+
+    if (close(snd) < 0 || close(rcv) < 0)
+        err(1, "close");
+
+    printf("TEST OK\n");
+    return 0;
+}
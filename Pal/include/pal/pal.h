@@ -105,6 +105,7 @@ enum {
     PAL_TYPE_THREAD,
     PAL_TYPE_EVENT,
     PAL_TYPE_EVENTFD,
+    PAL_TYPE_WAITSET,
     PAL_HANDLE_TYPE_BOUND,
 };
 
@@ -120,6 +121,12 @@ typedef struct PAL_MEM_INFO_ {
     PAL_NUM mem_total;
 } PAL_MEM_INFO;
 
+/*! A buffer of vectored operations; same layout as `struct iovec`. */
+typedef struct PAL_IOVEC_ {
+    PAL_PTR iov_base;
+    PAL_NUM iov_len;
+} PAL_IOVEC;
+
 /********** PAL APIs **********/
 typedef struct PAL_CONTROL_ {
     PAL_STR host_type;
@@ -162,6 +169,42 @@ typedef struct PAL_CONTROL_ {
     PAL_CPU_INFO cpu_info; /*!< CPU information (only required ones) */
     PAL_MEM_INFO mem_info; /*!< memory information (only required ones) */
     PAL_TOPO_INFO topo_info; /*!< Topology information (only required ones) */
+
+    /*
+     * Fast paths
+     */
+
+    /*!
+     * \brief Positional read/write of a file handle, bypassing the stream dispatch of
+     * DkStreamRead() and DkStreamWrite().
+     *
+     * Set only by PALs in which a file handle is a thin wrapper around a host file descriptor
+     * (Linux), NULL otherwise. Return the number of bytes transferred or a negative PAL error code;
+     * `handle` must have been opened with a `file:` URI.
+     */
+    int64_t (*file_read)(PAL_HANDLE handle, PAL_NUM offset, PAL_NUM count, PAL_PTR buffer);
+    int64_t (*file_write)(PAL_HANDLE handle, PAL_NUM offset, PAL_NUM count, const void* buffer);
+
+    /*!
+     * \brief Copy memory of the current process to the same addresses in a child process.
+     *
+     * \p process must be a handle returned by DkProcessCreate(). Each buffer of \p iov is copied
+     * to its own address in the child, where it must already be mapped writable. Set only by PALs
+     * which can access the memory of their children directly (Linux), NULL otherwise. Returns 0 or
+     * a negative PAL error code, e.g. if the host does not allow access to the child.
+     */
+    int (*process_write_memory)(PAL_HANDLE process, const PAL_IOVEC* iov, PAL_NUM iov_cnt);
+
+    /*!
+     * \brief Map a file read-only outside of `user_address`, without copying its contents.
+     *
+     * Set only by PALs which can let the process read a host file mapping directly and where this
+     * is enabled (Linux-SGX with `sgx.zero_copy_allowed_files`), NULL otherwise. If `*addr` is
+     * NULL, the PAL chooses the address, otherwise the file is mapped exactly at `*addr`, which
+     * must be free. Returns -PAL_ERROR_NOTSUPPORT if \p handle cannot be mapped this way (e.g. its
+     * contents must be verified first). The mapping is released with DkVirtualMemoryFree().
+     */
+    int (*file_map_untrusted)(PAL_HANDLE handle, PAL_PTR* addr, PAL_NUM offset, PAL_NUM size);
 } PAL_CONTROL;
 
 const PAL_CONTROL* DkGetPalControl(void);
@@ -225,6 +268,22 @@ int DkVirtualMemoryFree(PAL_PTR addr, PAL_NUM size);
  */
 int DkVirtualMemoryProtect(PAL_PTR addr, PAL_NUM size, PAL_FLG prot);
 
+/*!
+ * \brief Discard the contents of a previously allocated memory mapping and release the memory
+ *        backing it.
+ *
+ * \param addr the address
+ * \param size the size
+ * \param prot current permissions of the mapping, see #DkVirtualMemoryAlloc; must include
+ *             #PAL_PROT_WRITE
+ *
+ * The mapping stays allocated with the same permissions and reads as zeroes afterwards; its pages
+ * are backed by memory again only once they are accessed. Both `addr` and `size` must be non-zero
+ * and aligned at the allocation alignment. Returns -PAL_ERROR_NOTIMPLEMENTED if the PAL cannot
+ * release the memory (the caller then has to zero the memory itself, if needed).
+ */
+int DkVirtualMemoryDiscard(PAL_PTR addr, PAL_NUM size, PAL_FLG prot);
+
 /*
  * PROCESS CREATION
  */
@@ -378,6 +437,118 @@ int DkStreamRead(PAL_HANDLE handle, PAL_NUM offset, PAL_NUM* count, PAL_PTR buff
  */
 int DkStreamWrite(PAL_HANDLE handle, PAL_NUM offset, PAL_NUM* count, PAL_PTR buffer, PAL_STR dest);
 
+/*!
+ * \brief Read data from an open stream into multiple buffers (scatter read).
+ *
+ * \param handle handle to the stream; must be a socket or a pipe.
+ * \param iov array of buffers to read into, filled in order.
+ * \param iov_cnt number of elements in \p iov.
+ * \param[out] count on successful return contains the total number of bytes read.
+ *
+ * \return 0 on success, negative error code on failure.
+ *
+ * Unlike calling DkStreamRead on each buffer, this reads at most one message (datagram) and, if the
+ * PAL supports it for \p handle, costs only one host call.
+ */
+int DkStreamReadV(PAL_HANDLE handle, PAL_IOVEC* iov, PAL_NUM iov_cnt, PAL_NUM* count);
+
+/*!
+ * \brief Write data from multiple buffers to an open stream (gather write).
+ *
+ * \param handle handle to the stream; must be a socket or a pipe.
+ * \param iov array of buffers to write from, in order.
+ * \param iov_cnt number of elements in \p iov.
+ * \param[out] count on successful return contains the total number of bytes written.
+ *
+ * \return 0 on success, negative error code on failure.
+ */
+int DkStreamWriteV(PAL_HANDLE handle, PAL_IOVEC* iov, PAL_NUM iov_cnt, PAL_NUM* count);
+
+/*!
+ * \brief Receive one datagram on an unconnected socket, together with its source address.
+ *
+ * \param handle handle to the socket; must be opened with `udp.srv:...`.
+ * \param iov array of buffers to read into, filled in order.
+ * \param iov_cnt number of elements in \p iov.
+ * \param[out] count on successful return contains the total number of bytes read.
+ * \param[out] addr buffer for the source address, a `struct sockaddr_in` or `struct sockaddr_in6`.
+ * \param[in,out] addrlen on function call should contain the size of \p addr. On successful
+ *                return contains the size of the source address.
+ *
+ * \return 0 on success, negative error code on failure.
+ *
+ * Unlike DkStreamRead with a `source` buffer, the address is not formatted as a URI.
+ */
+int DkStreamRecvFrom(PAL_HANDLE handle, PAL_IOVEC* iov, PAL_NUM iov_cnt, PAL_NUM* count,
+                     PAL_PTR addr, PAL_NUM* addrlen);
+
+/*!
+ * \brief Send one datagram on an unconnected socket to the given address.
+ *
+ * \param handle handle to the socket; must be opened with `udp.srv:...`.
+ * \param iov array of buffers to write from, in order.
+ * \param iov_cnt number of elements in \p iov.
+ * \param[out] count on successful return contains the total number of bytes written.
+ * \param addr destination address, a `struct sockaddr_in` or `struct sockaddr_in6`.
+ * \param addrlen size of \p addr.
+ *
+ * \return 0 on success, negative error code on failure.
+ */
+int DkStreamSendTo(PAL_HANDLE handle, PAL_IOVEC* iov, PAL_NUM iov_cnt, PAL_NUM* count,
+                   PAL_PTR addr, PAL_NUM addrlen);
+
+/*! One datagram of DkStreamSendBatch or DkStreamRecvBatch. */
+typedef struct PAL_MSG_ {
+    PAL_IOVEC* iov;  /*!< buffers of the datagram */
+    PAL_NUM iov_cnt; /*!< number of elements in `iov` */
+    PAL_PTR addr;    /*!< binary socket address of the peer; NULL on connected sockets */
+    PAL_NUM addrlen; /*!< size of `addr`; on receive, updated to the size of the source address */
+    PAL_NUM len;     /*!< on successful return, number of bytes sent or received */
+} PAL_MSG;
+
+/*!
+ * \brief Send several datagrams on a UDP socket, with as few host calls as possible.
+ *
+ * \param handle handle to the socket; opened with `udp:...` or `udp.srv:...`.
+ * \param msgs datagrams to send; on `udp.srv:...` handles each must have a destination address.
+ * \param msg_cnt number of elements in \p msgs.
+ * \param[out] count on successful return contains the number of datagrams sent, which may be less
+ *                   than \p msg_cnt.
+ *
+ * \return 0 on success, negative error code if not even the first datagram could be sent.
+ */
+int DkStreamSendBatch(PAL_HANDLE handle, PAL_MSG* msgs, PAL_NUM msg_cnt, PAL_NUM* count);
+
+/*!
+ * \brief Receive several datagrams on a UDP socket, with as few host calls as possible.
+ *
+ * \param handle handle to the socket; opened with `udp:...` or `udp.srv:...`.
+ * \param msgs buffers for the datagrams; on `udp.srv:...` handles each receives the source address.
+ * \param msg_cnt number of elements in \p msgs.
+ * \param[out] count on successful return contains the number of datagrams received.
+ *
+ * \return 0 on success, negative error code on failure.
+ *
+ * Waits (unless \p handle is non-blocking) only for the first datagram, then takes the ones that are
+ * already queued, like `recvmmsg(MSG_WAITFORONE)`.
+ */
+int DkStreamRecvBatch(PAL_HANDLE handle, PAL_MSG* msgs, PAL_NUM msg_cnt, PAL_NUM* count);
+
+/*!
+ * \brief Copy data from a file directly into another stream, without passing it through the caller.
+ *
+ * \param out_handle handle to the destination stream (e.g. a connected socket).
+ * \param in_handle handle to the source; must be a file.
+ * \param offset offset in \p in_handle to start copying from.
+ * \param[in,out] count contains the maximum number of bytes to copy; on successful return contains
+ *                      the number of bytes copied.
+ *
+ * \return 0 on success, negative error code on failure. Returns -PAL_ERROR_NOTSUPPORT if the PAL
+ *         cannot copy between these two handles on the host (e.g. because the data must be
+ *         decrypted or verified first); the caller is expected to fall back to read + write.
+ */
+int DkStreamSendFile(PAL_HANDLE out_handle, PAL_HANDLE in_handle, PAL_NUM offset, PAL_NUM* count);
+
 enum PAL_DELETE {
     PAL_DELETE_RD = 1, /*!< shut down the read side only */
     PAL_DELETE_WR = 2, /*!< shut down the write side only */
@@ -446,6 +617,25 @@ int DkSendHandle(PAL_HANDLE handle, PAL_HANDLE cargo);
  */
 int DkReceiveHandle(PAL_HANDLE handle, PAL_HANDLE* cargo);
 
+/*!
+ * \brief Send several PAL handles over a process handle at once.
+ *
+ * Same as calling DkSendHandle() on each of \p cargos in order, but the PAL may pass the host
+ * resources of many handles in one host message (on Linux, the host FDs of up to 64 handles go in
+ * one `SCM_RIGHTS` message). The handles must be received with DkReceiveHandles() with the same
+ * \p count.
+ *
+ * \return 0 on success, negative error code on failure.
+ */
+int DkSendHandles(PAL_HANDLE handle, PAL_HANDLE* cargos, PAL_NUM count);
+
+/*!
+ * \brief Receive \p count PAL handles sent with DkSendHandles() into \p cargos.
+ *
+ * \return 0 on success, negative error code on failure (some of \p cargos may already be set).
+ */
+int DkReceiveHandles(PAL_HANDLE handle, PAL_HANDLE* cargos, PAL_NUM count);
+
 /* stream attribute structure */
 typedef struct _PAL_STREAM_ATTR {
     PAL_IDX handle_type;
@@ -464,6 +654,7 @@ typedef struct _PAL_STREAM_ATTR {
             PAL_BOL tcp_cork;
             PAL_BOL tcp_keepalive;
             PAL_BOL tcp_nodelay;
+            PAL_NUM busy_poll; /* SO_BUSY_POLL: microseconds to busy-wait for input, 0 = off */
         } socket;
     };
 } PAL_STREAM_ATTR;
@@ -482,11 +673,46 @@ int DkStreamAttributesQuery(PAL_STR uri, PAL_STREAM_ATTR* attr);
  */
 int DkStreamAttributesQueryByHandle(PAL_HANDLE handle, PAL_STREAM_ATTR* attr);
 
+/*!
+ * \brief Query the attributes of an open stream that the PAL keeps in the handle.
+ *
+ * Same as DkStreamAttributesQueryByHandle(), but does not ask the host for dynamic state:
+ * `pending_size`, `readable` and `writable` are zeroed. Intended for callers that only need
+ * blocking mode or socket options (e.g. fcntl() and getsockopt()), which on some PALs would
+ * otherwise cost several host calls. Falls back to a full query for streams whose PAL does not
+ * cache attributes.
+ */
+int DkStreamAttributesQueryCachedByHandle(PAL_HANDLE handle, PAL_STREAM_ATTR* attr);
+
 /*!
  * \brief Set the attributes of an open stream.
  */
 int DkStreamAttributesSetByHandle(PAL_HANDLE handle, PAL_STREAM_ATTR* attr);
 
+/*!
+ * \brief Read directory entries together with their attributes.
+ *
+ * \param handle handle to an open directory.
+ * \param[in,out] count on function call should contain the size of \p buffer. On successful return
+ *                contains the number of bytes read.
+ * \param buffer pointer to the buffer to read into; filled with null-terminated names of the
+ *               directory entries, the same as DkStreamRead does for directories.
+ * \param[out] attrs on successful return, `attrs[i]` holds the attributes of the i-th entry read
+ *                   into \p buffer. If the attributes of an entry could not be obtained, its
+ *                   `handle_type` is set to #PAL_HANDLE_TYPE_BOUND, and the caller should query it
+ *                   with DkStreamAttributesQuery.
+ * \param[in,out] attrs_cnt on function call should contain the number of elements in \p attrs. On
+ *                successful return contains the number of entries read.
+ *
+ * \return 0 on success, negative error code on failure. Returns -PAL_ERROR_NOTSUPPORT if the PAL
+ *         does not implement this operation; the caller is expected to fall back to DkStreamRead.
+ *
+ * This is meant for listings that stat every entry (such as `ls -l`), and allows the PAL to get all
+ * the attributes at once instead of making one host call per entry.
+ */
+int DkStreamReadDir(PAL_HANDLE handle, PAL_NUM* count, PAL_PTR buffer, PAL_STREAM_ATTR* attrs,
+                    PAL_NUM* attrs_cnt);
+
 /*!
  * \brief Query the name of an open stream. On success `buffer` contains a null-terminated string.
  */
@@ -656,6 +882,7 @@ enum PAL_WAIT {
     PAL_WAIT_READ   = 2,
     PAL_WAIT_WRITE  = 4,
     PAL_WAIT_ERROR  = 8, /*!< ignored in events */
+    PAL_WAIT_EDGE   = 16, /*!< only for #DkWaitSetUpdate: report each readiness change once */
 };
 
 /*!
@@ -673,6 +900,46 @@ enum PAL_WAIT {
 int DkStreamsWaitEvents(PAL_NUM count, PAL_HANDLE* handle_array, PAL_FLG* events,
                         PAL_FLG* ret_events, PAL_NUM timeout_us);
 
+/*!
+ * \brief Create a wait set
+ *
+ * A wait set is a persistent set of handles to poll, which (unlike #DkStreamsWaitEvents) does not
+ * have to be passed again on each wait. On Linux hosts it is backed by a host epoll instance.
+ * The wait set is closed with #DkObjectClose.
+ *
+ * \param[out] handle the created wait set
+ */
+int DkWaitSetCreate(PAL_HANDLE* handle);
+
+/*!
+ * \brief Add, modify or remove a handle in a wait set
+ *
+ * \param set the wait set
+ * \param handle the handle to poll; a handle is in a given wait set at most once, so this replaces
+ *  any previous `events` and `cookie` of `handle`
+ * \param events `PAL_WAIT_READ` and/or `PAL_WAIT_WRITE`, optionally with `PAL_WAIT_EDGE`; `0`
+ *  removes `handle` from the set
+ * \param cookie value reported by #DkWaitSetWait when `handle` is ready
+ *
+ * Handles must be removed from the wait set before they are closed.
+ */
+int DkWaitSetUpdate(PAL_HANDLE set, PAL_HANDLE handle, PAL_FLG events, PAL_NUM cookie);
+
+/*!
+ * \brief Wait until some handles in a wait set are ready
+ *
+ * \param set the wait set
+ * \param[in,out] count size of `cookies` and `ret_events` on input, number of reported events on
+ *  output
+ * \param[out] cookies cookies of the ready handles (a handle may be reported more than once)
+ * \param[out] ret_events events of the ready handles
+ * \param timeout_us maximum time to wait (in microseconds), or `NO_TIMEOUT`
+ * \return 0 if some handles are ready, -PAL_ERROR_TRYAGAIN on timeout, negative error code
+ *  otherwise
+ */
+int DkWaitSetWait(PAL_HANDLE set, PAL_NUM* count, PAL_NUM* cookies, PAL_FLG* ret_events,
+                  PAL_NUM timeout_us);
+
 /*!
  * \brief Close (deallocate) a PAL handle.
  */
@@ -699,6 +966,26 @@ int DkDebugLog(PAL_PTR buffer, PAL_NUM size);
  */
 int DkSystemTimeQuery(PAL_NUM* time);
 
+/* Parameters for computing the current time from RDTSC the same way as DkSystemTimeQuery() does:
+ * `base_usec + (rdtsc() - base_tsc) * 1000000 / tsc_hz`, as long as `rdtsc() - base_tsc` is less
+ * than `max_tsc_delta`. Past that point, DkSystemTimeQuery() must be called to refresh them. */
+typedef struct PAL_TSC_TIME_BASE_ {
+    PAL_NUM tsc_hz;
+    PAL_NUM base_tsc;
+    PAL_NUM base_usec;
+    PAL_NUM max_tsc_delta;
+} PAL_TSC_TIME_BASE;
+
+/*!
+ * \brief Get the parameters for computing the current time without calling into PAL
+ *
+ * \param[out] base on success, the parameters used by DkSystemTimeQuery()
+ *
+ * \return 0 on success, -PAL_ERROR_NOTIMPLEMENTED if the PAL does not compute time from RDTSC,
+ *         -PAL_ERROR_TRYAGAIN if DkSystemTimeQuery() was not called yet.
+ */
+int DkSystemTimeBaseQuery(PAL_TSC_TIME_BASE* base);
+
 /*!
  * \brief Cryptographically secure random.
  *
@@ -739,6 +1026,16 @@ int DkSegmentRegisterSet(PAL_FLG reg, PAL_PTR addr);
  */
 PAL_NUM DkMemoryAvailableQuota(void);
 
+/*!
+ * \brief Obtain a human-readable summary of PAL-internal memory allocator statistics
+ *
+ * \param buffer buffer for the summary, NULL-terminated and truncated if it is too small
+ * \param[in,out] size size of `buffer` on input, length of the full summary on output
+ *
+ * \return 0 on success, negative error value on failure
+ */
+int DkMemoryStatsQuery(PAL_PTR buffer, PAL_NUM* size);
+
 /*!
  * \brief Obtain the attestation report (local) with `user_report_data` embedded into it.
  *
@@ -821,4 +1118,14 @@ int DkCpuIdRetrieve(PAL_IDX leaf, PAL_IDX subleaf, PAL_IDX values[CPUID_WORD_NUM
 void DkDebugMapAdd(PAL_STR uri, PAL_PTR start_addr);
 void DkDebugMapRemove(PAL_PTR start_addr);
 
+/*!
+ * \brief Mark the end of a startup phase
+ *
+ * \param phase name of the phase that just ended, e.g. "LibOS: init_fs"
+ *
+ * Records a timestamped mark in the startup trace (`sgx.startup_trace` on Linux-SGX). Does nothing
+ * if the trace is disabled or the PAL does not support it.
+ */
+void DkStartupTrace(PAL_STR phase);
+
 #endif /* PAL_H */
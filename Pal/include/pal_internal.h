@@ -50,6 +50,32 @@ struct handle_ops {
     int64_t (*writebyaddr)(PAL_HANDLE handle, uint64_t offset, uint64_t count, const void* buffer,
                            const char* addr, size_t addrlen);
 
+    /* 'readv' and 'writev' are used by DkStreamReadV and DkStreamWriteV; they are optional, without
+     * them DkStreamReadV/DkStreamWriteV fall back to 'read'/'write' on each buffer */
+    int64_t (*readv)(PAL_HANDLE handle, PAL_IOVEC* iov, size_t iov_cnt);
+    int64_t (*writev)(PAL_HANDLE handle, const PAL_IOVEC* iov, size_t iov_cnt);
+
+    /* 'recvfrom' and 'sendto' are used by DkStreamRecvFrom and DkStreamSendTo on unconnected
+     * datagram sockets; `addr` is a binary socket address, not a URI */
+    int64_t (*recvfrom)(PAL_HANDLE handle, PAL_IOVEC* iov, size_t iov_cnt, void* addr,
+                        size_t* addrlen);
+    int64_t (*sendto)(PAL_HANDLE handle, const PAL_IOVEC* iov, size_t iov_cnt, const void* addr,
+                      size_t addrlen);
+
+    /* 'sendbatch' and 'recvbatch' are used by DkStreamSendBatch and DkStreamRecvBatch and return
+     * the number of datagrams processed; they are optional, without them one datagram is sent or
+     * received per 'sendto'/'writev' or 'recvfrom'/'readv' call */
+    int64_t (*sendbatch)(PAL_HANDLE handle, PAL_MSG* msgs, size_t msg_cnt);
+    int64_t (*recvbatch)(PAL_HANDLE handle, PAL_MSG* msgs, size_t msg_cnt);
+
+    /* 'readdir' is used by DkStreamReadDir on directory handles; it is optional */
+    int64_t (*readdir)(PAL_HANDLE handle, size_t count, void* buffer, PAL_STREAM_ATTR* attrs,
+                       size_t* attrs_cnt);
+
+    /* 'sendfile' is used by DkStreamSendFile on the source handle; it is optional */
+    int64_t (*sendfile)(PAL_HANDLE in_handle, PAL_HANDLE out_handle, uint64_t offset,
+                        uint64_t count);
+
     /* 'close' and 'delete' is used by DkObjectClose and DkStreamDelete, 'close' will close the
      * stream, while 'delete' actually destroy the stream, such as deleting a file or shutting
      * down a socket */
@@ -81,6 +107,10 @@ struct handle_ops {
      * a stream handle */
     int (*attrquerybyhdl)(PAL_HANDLE handle, PAL_STREAM_ATTR* attr);
 
+    /* 'attrquerycached' is used by DkStreamAttributesQueryCachedByHandle. It returns the
+     * attributes cached in the handle without querying the host; optional */
+    int (*attrquerycached)(PAL_HANDLE handle, PAL_STREAM_ATTR* attr);
+
     /* 'attrsetbyhdl' is used by DkStreamAttributesSetByHandle. It queries the attributes of
      * a stream handle */
     int (*attrsetbyhdl)(PAL_HANDLE handle, PAL_STREAM_ATTR* attr);
@@ -174,6 +204,18 @@ int64_t _DkStreamRead(PAL_HANDLE handle, uint64_t offset, uint64_t count, void*
                       int addrlen);
 int64_t _DkStreamWrite(PAL_HANDLE handle, uint64_t offset, uint64_t count, const void* buf,
                        const char* addr, int addrlen);
+int64_t _DkStreamReadV(PAL_HANDLE handle, PAL_IOVEC* iov, size_t iov_cnt);
+int64_t _DkStreamWriteV(PAL_HANDLE handle, const PAL_IOVEC* iov, size_t iov_cnt);
+int64_t _DkStreamRecvFrom(PAL_HANDLE handle, PAL_IOVEC* iov, size_t iov_cnt, void* addr,
+                          size_t* addrlen);
+int64_t _DkStreamSendTo(PAL_HANDLE handle, const PAL_IOVEC* iov, size_t iov_cnt, const void* addr,
+                        size_t addrlen);
+int64_t _DkStreamSendBatch(PAL_HANDLE handle, PAL_MSG* msgs, size_t msg_cnt);
+int64_t _DkStreamRecvBatch(PAL_HANDLE handle, PAL_MSG* msgs, size_t msg_cnt);
+int64_t _DkStreamSendFile(PAL_HANDLE out_handle, PAL_HANDLE in_handle, uint64_t offset,
+                          uint64_t count);
+int64_t _DkStreamReadDir(PAL_HANDLE handle, uint64_t count, void* buf, PAL_STREAM_ATTR* attrs,
+                         size_t* attrs_cnt);
 int _DkStreamAttributesQuery(const char* uri, PAL_STREAM_ATTR* attr);
 int _DkStreamAttributesQueryByHandle(PAL_HANDLE hdl, PAL_STREAM_ATTR* attr);
 int _DkStreamMap(PAL_HANDLE handle, void** addr, int prot, uint64_t offset, uint64_t size);
@@ -184,6 +226,8 @@ int _DkStreamGetName(PAL_HANDLE handle, char* buf, size_t size);
 const char* _DkStreamRealpath(PAL_HANDLE hdl);
 int _DkSendHandle(PAL_HANDLE hdl, PAL_HANDLE cargo);
 int _DkReceiveHandle(PAL_HANDLE hdl, PAL_HANDLE* cargo);
+int _DkSendHandles(PAL_HANDLE hdl, PAL_HANDLE* cargos, size_t count);
+int _DkReceiveHandles(PAL_HANDLE hdl, PAL_HANDLE* cargos, size_t count);
 
 /* DkProcess and DkThread calls */
 int _DkThreadCreate(PAL_HANDLE* handle, int (*callback)(void*), const void* param);
@@ -205,17 +249,23 @@ int _DkEventWait(PAL_HANDLE handle, uint64_t* timeout_us);
 int _DkVirtualMemoryAlloc(void** paddr, uint64_t size, int alloc_type, int prot);
 int _DkVirtualMemoryFree(void* addr, uint64_t size);
 int _DkVirtualMemoryProtect(void* addr, uint64_t size, int prot);
+int _DkVirtualMemoryDiscard(void* addr, uint64_t size, int prot);
 
 /* DkObject calls */
 int _DkObjectClose(PAL_HANDLE objectHandle);
 int _DkStreamsWaitEvents(size_t count, PAL_HANDLE* handle_array, PAL_FLG* events,
                          PAL_FLG* ret_events, int64_t timeout_us);
+int _DkWaitSetCreate(PAL_HANDLE* handle);
+int _DkWaitSetUpdate(PAL_HANDLE set, PAL_HANDLE handle, PAL_FLG events, uint64_t cookie);
+int _DkWaitSetWait(PAL_HANDLE set, size_t* count, uint64_t* cookies, PAL_FLG* ret_events,
+                   int64_t timeout_us);
 
 /* DkException calls & structures */
 PAL_EVENT_HANDLER _DkGetExceptionHandler(PAL_NUM event_num);
 
 /* other DK calls */
 int _DkSystemTimeQuery(uint64_t* out_usec);
+int _DkSystemTimeBaseQuery(PAL_TSC_TIME_BASE* base);
 
 /*
  * Cryptographically secure random.
@@ -254,6 +304,7 @@ int load_elf_object(const char* uri, enum object_type type);
 int load_elf_object_by_handle(PAL_HANDLE handle, enum object_type type, void** out_loading_base);
 
 void init_slab_mgr(size_t alignment);
+size_t print_slab_mgr_stats(char* buf, size_t size);
 void* malloc(size_t size);
 void* malloc_copy(const void* mem, size_t size);
 void* calloc(size_t nmem, size_t size);
@@ -270,6 +321,7 @@ void free(void* mem);
 
 int _DkInitDebugStream(const char* path);
 int _DkDebugLog(const void* buf, size_t size);
+void _DkStartupTrace(const char* phase);
 
 // TODO(mkow): We should make it cross-object-inlinable, ideally by enabling LTO, less ideally by
 // pasting it here and making `inline`, but our current linker scripts prevent both.
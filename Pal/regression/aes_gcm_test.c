@@ -0,0 +1,170 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* Copyright (C) 2021 Intel Corporation */
+
+/*
+ * Known-answer tests of the AES-128-GCM fast path (common/src/crypto/adapters/aesni_gcm.h). The
+ * vectors are test cases 1-4 of "The Galois/Counter Mode of Operation (GCM)" (McGrew, Viega), also
+ * used by NIST to validate GCM implementations; test case 4 has AAD and plaintext whose sizes are
+ * not multiples of the block size.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "aesni_gcm.h"
+#include "api.h"
+#include "pal.h"
+#include "pal_regression.h"
+
+#define MAX_DATA_SIZE 64
+
+struct gcm_case {
+    const char* key;
+    const char* iv;
+    const char* aad;
+    const char* plaintext;
+    const char* ciphertext;
+    const char* tag;
+};
+
+static const struct gcm_case g_cases[] = {
+    {
+        .key        = "00000000000000000000000000000000",
+        .iv         = "000000000000000000000000",
+        .aad        = "",
+        .plaintext  = "",
+        .ciphertext = "",
+        .tag        = "58e2fccefa7e3061367f1d57a4e7455a",
+    },
+    {
+        .key        = "00000000000000000000000000000000",
+        .iv         = "000000000000000000000000",
+        .aad        = "",
+        .plaintext  = "00000000000000000000000000000000",
+        .ciphertext = "0388dace60b6a392f328c2b971b2fe78",
+        .tag        = "ab6e47d42cec13bdf53a67b21257bddf",
+    },
+    {
+        .key        = "feffe9928665731c6d6a8f9467308308",
+        .iv         = "cafebabefacedbaddecaf888",
+        .aad        = "",
+        .plaintext  = "d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a72"
+                      "1c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b391aafd255",
+        .ciphertext = "42831ec2217774244b7221b784d0d49ce3aa212f2c02a4e035c17e2329aca12e"
+                      "21d514b25466931c7d8f6a5aac84aa051ba30b396a0aac973d58e091473f5985",
+        .tag        = "4d5c2af327cd64a62cf35abd2ba6fab4",
+    },
+    {
+        .key        = "feffe9928665731c6d6a8f9467308308",
+        .iv         = "cafebabefacedbaddecaf888",
+        .aad        = "feedfacedeadbeeffeedfacedeadbeefabaddad2",
+        .plaintext  = "d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a72"
+                      "1c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b39",
+        .ciphertext = "42831ec2217774244b7221b784d0d49ce3aa212f2c02a4e035c17e2329aca12e"
+                      "21d514b25466931c7d8f6a5aac84aa051ba30b396a0aac973d58e091",
+        .tag        = "5bc94fbc3221a5db94fae95ae7121a47",
+    },
+};
+
+static int hex_digit(char c) {
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return -1;
+}
+
+/* Returns the number of bytes written to `out`, aborts the test on malformed input. */
+static size_t from_hex(const char* hex, uint8_t* out, size_t out_size) {
+    size_t len = strlen(hex);
+    if (len % 2 || len / 2 > out_size) {
+        pal_printf("Malformed test vector: \"%s\"\n", hex);
+        DkProcessExit(1);
+    }
+    for (size_t i = 0; i < len / 2; i++) {
+        int hi = hex_digit(hex[2 * i]);
+        int lo = hex_digit(hex[2 * i + 1]);
+        if (hi < 0 || lo < 0) {
+            pal_printf("Malformed test vector: \"%s\"\n", hex);
+            DkProcessExit(1);
+        }
+        out[i] = hi << 4 | lo;
+    }
+    return len / 2;
+}
+
+static bool is_zeroed(const uint8_t* buf, size_t size) {
+    for (size_t i = 0; i < size; i++)
+        if (buf[i])
+            return false;
+    return true;
+}
+
+static int run_case(size_t i) {
+    const struct gcm_case* c = &g_cases[i];
+    uint8_t key[AESNI_GCM_KEY_SIZE];
+    uint8_t iv[AESNI_GCM_IV_SIZE];
+    uint8_t tag[AESNI_GCM_TAG_SIZE];
+    uint8_t aad[MAX_DATA_SIZE];
+    uint8_t plaintext[MAX_DATA_SIZE];
+    uint8_t ciphertext[MAX_DATA_SIZE];
+    uint8_t output[MAX_DATA_SIZE];
+    uint8_t out_tag[AESNI_GCM_TAG_SIZE];
+
+    if (from_hex(c->key, key, sizeof(key)) != sizeof(key)
+            || from_hex(c->iv, iv, sizeof(iv)) != sizeof(iv)
+            || from_hex(c->tag, tag, sizeof(tag)) != sizeof(tag)) {
+        pal_printf("case %lu: wrong size of key, IV or tag\n", i);
+        return 1;
+    }
+    size_t aad_size  = from_hex(c->aad, aad, sizeof(aad));
+    size_t data_size = from_hex(c->plaintext, plaintext, sizeof(plaintext));
+    if (from_hex(c->ciphertext, ciphertext, sizeof(ciphertext)) != data_size) {
+        pal_printf("case %lu: plaintext and ciphertext differ in size\n", i);
+        return 1;
+    }
+
+    aesni_gcm128_encrypt(key, iv, aad, aad_size, plaintext, data_size, output, out_tag);
+    if (memcmp(output, ciphertext, data_size) || memcmp(out_tag, tag, sizeof(tag))) {
+        pal_printf("case %lu: encryption gave wrong ciphertext or tag\n", i);
+        return 1;
+    }
+
+    if (!aesni_gcm128_decrypt(key, iv, aad, aad_size, ciphertext, data_size, output, tag)
+            || memcmp(output, plaintext, data_size)) {
+        pal_printf("case %lu: decryption failed or gave wrong plaintext\n", i);
+        return 1;
+    }
+
+    /* a modified tag, ciphertext or AAD must be rejected, without revealing the plaintext */
+    for (int what = 0; what < 3; what++) {
+        uint8_t* mangled = what == 0 ? tag : what == 1 ? ciphertext : aad;
+        size_t mangled_size = what == 0 ? sizeof(tag) : what == 1 ? data_size : aad_size;
+        if (!mangled_size)
+            continue;
+        mangled[mangled_size - 1] ^= 1;
+        memset(output, 0xff, sizeof(output));
+        bool ok = aesni_gcm128_decrypt(key, iv, aad, aad_size, ciphertext, data_size, output, tag);
+        mangled[mangled_size - 1] ^= 1;
+        if (ok || !is_zeroed(output, data_size)) {
+            pal_printf("case %lu: mismatching %s was not rejected\n", i,
+                       what == 0 ? "tag" : what == 1 ? "ciphertext" : "AAD");
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int main(void) {
+    if (!aesni_gcm_supported()) {
+        pal_printf("AES-NI/PCLMULQDQ not supported, skipping\n");
+        return 0;
+    }
+
+    for (size_t i = 0; i < ARRAY_SIZE(g_cases); i++)
+        if (run_case(i))
+            return 1;
+
+    pal_printf("Success!\n");
+    return 0;
+}
@@ -60,6 +60,12 @@ static bool cmp_gen(void* x, struct avl_tree_node* y) {
     return *(int64_t*)x <= node2struct(y)->key;
 }
 
+static inline bool cmp_key(int64_t x, struct avl_tree_node* y) {
+    return x <= node2struct(y)->key;
+}
+
+DEFINE_AVL_TREE_LOWER_BOUND_FN(lower_bound_key, int64_t, cmp_key)
+
 #define ELEMENTS_COUNT 0x1000
 #define RAND_DEL_COUNT 0x100
 static struct avl_tree tree = {.root = NULL, .cmp = cmp};
@@ -287,6 +293,53 @@ static void test_ordering(void) {
     }
 }
 
+static void test_build(void) {
+    static struct avl_tree_node* nodes[ELEMENTS_COUNT];
+    size_t count;
+    size_t i;
+
+    for (i = 0; i < ELEMENTS_COUNT; i++) {
+        /* Even keys with duplicates, so that odd ones can be looked up between them. */
+        t[i].key = (i / 3) * 2;
+        nodes[i] = &t[i].node;
+    }
+
+    for (count = 0; count <= ELEMENTS_COUNT; count = count * 2 + 1) {
+        avl_tree_build(&tree, nodes, count);
+        if (!debug_avl_tree_is_balanced(&tree)) {
+            EXIT_UNBALANCED();
+        }
+
+        /* In-order must be exactly the order of `nodes`. */
+        struct avl_tree_node* node = avl_tree_first(&tree);
+        for (i = 0; i < count; i++) {
+            if (node != nodes[i]) {
+                pal_printf("avl_tree_build: wrong node at position %lu\n", i);
+                DkProcessExit(1);
+            }
+            node = avl_tree_next(node);
+        }
+        if (node) {
+            pal_printf("avl_tree_build: too many nodes\n");
+            DkProcessExit(1);
+        }
+
+        for (int64_t key = -1; key <= (int64_t)count; key++) {
+            if (lower_bound_key(&tree, key) != avl_tree_lower_bound_fn(&tree, &key, cmp_gen)) {
+                pal_printf("Inlined lower bound differs for key %ld\n", key);
+                DkProcessExit(1);
+            }
+        }
+
+        for (i = 0; i < count; i++) {
+            avl_tree_delete(&tree, nodes[i]);
+            if (!debug_avl_tree_is_balanced(&tree)) {
+                EXIT_UNBALANCED();
+            }
+        }
+    }
+}
+
 static int32_t rand_mod(void) {
     return rand() % (ELEMENTS_COUNT / 4);
 }
@@ -294,6 +347,7 @@ static int32_t rand_mod(void) {
 int main(void) {
     pal_printf("Running static tests: ");
     test_ordering();
+    test_build();
     srand(1337);
     do_test(rand_mod);
     do_test(rand);
@@ -414,6 +414,7 @@ noreturn void pal_main(uint64_t instance_id,       /* current instance id */
         INIT_FAIL(-ret, "Inserting environment variables from the manifest failed");
 
     load_libraries();
+    _DkStartupTrace("PAL: LibOS loaded");
 
     // TODO: This is just an ugly, temporary hack for PAL regression tests and should only be used
     // there until we clean up the way LibOS is loaded.
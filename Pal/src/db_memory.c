@@ -66,6 +66,22 @@ int DkVirtualMemoryProtect(PAL_PTR addr, PAL_NUM size, PAL_FLG prot) {
     return _DkVirtualMemoryProtect((void*)addr, size, prot);
 }
 
+int DkVirtualMemoryDiscard(PAL_PTR addr, PAL_NUM size, PAL_FLG prot) {
+    if (!addr || !size || !(prot & PAL_PROT_WRITE)) {
+        return -PAL_ERROR_INVAL;
+    }
+
+    if (!IS_ALLOC_ALIGNED_PTR(addr) || !IS_ALLOC_ALIGNED(size)) {
+        return -PAL_ERROR_INVAL;
+    }
+
+    if (_DkCheckMemoryMappable((void*)addr, size)) {
+        return -PAL_ERROR_DENIED;
+    }
+
+    return _DkVirtualMemoryDiscard((void*)addr, size, prot);
+}
+
 int add_preloaded_range(uintptr_t start, uintptr_t end, const char* comment) {
     size_t new_cnt = g_pal_control.preloaded_ranges_cnt + 1;
     void* new_ranges = malloc(new_cnt * sizeof(*g_pal_control.preloaded_ranges));
@@ -15,6 +15,10 @@ int DkSystemTimeQuery(PAL_NUM* time) {
     return _DkSystemTimeQuery(time);
 }
 
+int DkSystemTimeBaseQuery(PAL_TSC_TIME_BASE* base) {
+    return _DkSystemTimeBaseQuery(base);
+}
+
 int DkRandomBitsRead(PAL_PTR buffer, PAL_NUM size) {
     return _DkRandomBitsRead((void*)buffer, size);
 }
@@ -37,6 +41,14 @@ PAL_NUM DkMemoryAvailableQuota(void) {
     return (PAL_NUM)quota;
 }
 
+int DkMemoryStatsQuery(PAL_PTR buffer, PAL_NUM* size) {
+    if (!size)
+        return -PAL_ERROR_INVAL;
+
+    *size = print_slab_mgr_stats(buffer, *size);
+    return 0;
+}
+
 int DkCpuIdRetrieve(PAL_IDX leaf, PAL_IDX subleaf, PAL_IDX values[4]) {
     unsigned int vals[4];
     int ret = _DkCpuIdRetrieve(leaf, subleaf, vals);
@@ -67,3 +79,7 @@ int DkAttestationQuote(PAL_PTR user_report_data, PAL_NUM user_report_data_size,
 int DkSetProtectedFilesKey(PAL_PTR pf_key_hex) {
     return _DkSetProtectedFilesKey(pf_key_hex);
 }
+
+void DkStartupTrace(PAL_STR phase) {
+    _DkStartupTrace(phase);
+}
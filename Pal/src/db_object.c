@@ -60,3 +60,31 @@ int DkStreamsWaitEvents(PAL_NUM count, PAL_HANDLE* handle_array, PAL_FLG* events
 
     return _DkStreamsWaitEvents(count, handle_array, events, ret_events, timeout_us);
 }
+
+int DkWaitSetCreate(PAL_HANDLE* handle) {
+    *handle = NULL;
+    return _DkWaitSetCreate(handle);
+}
+
+int DkWaitSetUpdate(PAL_HANDLE set, PAL_HANDLE handle, PAL_FLG events, PAL_NUM cookie) {
+    if (!set || PAL_GET_TYPE(set) != PAL_TYPE_WAITSET || !handle || UNKNOWN_HANDLE(handle))
+        return -PAL_ERROR_INVAL;
+    if (events & ~(PAL_WAIT_READ | PAL_WAIT_WRITE | PAL_WAIT_EDGE))
+        return -PAL_ERROR_INVAL;
+
+    return _DkWaitSetUpdate(set, handle, events, cookie);
+}
+
+int DkWaitSetWait(PAL_HANDLE set, PAL_NUM* count, PAL_NUM* cookies, PAL_FLG* ret_events,
+                  PAL_NUM timeout_us) {
+    if (!set || PAL_GET_TYPE(set) != PAL_TYPE_WAITSET || !*count)
+        return -PAL_ERROR_INVAL;
+
+    size_t cnt = *count;
+    int ret = _DkWaitSetWait(set, &cnt, cookies, ret_events, timeout_us);
+    if (ret < 0)
+        return ret;
+
+    *count = cnt;
+    return 0;
+}
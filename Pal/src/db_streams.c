@@ -25,6 +25,7 @@ extern struct handle_ops g_thread_ops;
 extern struct handle_ops g_proc_ops;
 extern struct handle_ops g_event_ops;
 extern struct handle_ops g_eventfd_ops;
+extern struct handle_ops g_waitset_ops;
 
 const struct handle_ops* g_pal_handle_ops[PAL_HANDLE_TYPE_BOUND] = {
     [PAL_TYPE_FILE]    = &g_file_ops,
@@ -42,6 +43,7 @@ const struct handle_ops* g_pal_handle_ops[PAL_HANDLE_TYPE_BOUND] = {
     [PAL_TYPE_THREAD]  = &g_thread_ops,
     [PAL_TYPE_EVENT]   = &g_event_ops,
     [PAL_TYPE_EVENTFD] = &g_eventfd_ops,
+    [PAL_TYPE_WAITSET] = &g_waitset_ops,
 };
 
 /* parse_stream_uri scan the uri, seperate prefix and search for
@@ -294,6 +296,291 @@ int DkStreamWrite(PAL_HANDLE handle, PAL_NUM offset, PAL_NUM* count, PAL_PTR buf
     return 0;
 }
 
+/* _DkStreamReadV for internal use. Streams without native scatter read fall back to reading into
+   the first non-empty buffer only, so that at most one message is consumed */
+int64_t _DkStreamReadV(PAL_HANDLE handle, PAL_IOVEC* iov, size_t iov_cnt) {
+    const struct handle_ops* ops = HANDLE_OPS(handle);
+
+    if (!ops)
+        return -PAL_ERROR_BADHANDLE;
+
+    if (ops->readv)
+        return ops->readv(handle, iov, iov_cnt);
+
+    if (!ops->read)
+        return -PAL_ERROR_NOTSUPPORT;
+
+    for (size_t i = 0; i < iov_cnt; i++) {
+        if (iov[i].iov_len)
+            return ops->read(handle, /*offset=*/0, iov[i].iov_len, iov[i].iov_base);
+    }
+    return 0;
+}
+
+int DkStreamReadV(PAL_HANDLE handle, PAL_IOVEC* iov, PAL_NUM iov_cnt, PAL_NUM* count) {
+    if (!handle || (!iov && iov_cnt)) {
+        return -PAL_ERROR_INVAL;
+    }
+
+    int64_t ret = _DkStreamReadV(handle, iov, iov_cnt);
+
+    if (ret < 0) {
+        return ret;
+    }
+
+    *count = ret;
+    return 0;
+}
+
+/* _DkStreamWriteV for internal use. Streams without native gather write fall back to writing the
+   buffers one by one, until the first error or short write */
+int64_t _DkStreamWriteV(PAL_HANDLE handle, const PAL_IOVEC* iov, size_t iov_cnt) {
+    const struct handle_ops* ops = HANDLE_OPS(handle);
+
+    if (!ops)
+        return -PAL_ERROR_BADHANDLE;
+
+    if (ops->writev)
+        return ops->writev(handle, iov, iov_cnt);
+
+    if (!ops->write)
+        return -PAL_ERROR_NOTSUPPORT;
+
+    int64_t total = 0;
+    for (size_t i = 0; i < iov_cnt; i++) {
+        if (!iov[i].iov_len)
+            continue;
+        int64_t ret = ops->write(handle, /*offset=*/0, iov[i].iov_len, iov[i].iov_base);
+        if (ret < 0)
+            return total ? total : ret;
+        total += ret;
+        if ((size_t)ret < iov[i].iov_len)
+            break;
+    }
+    return total;
+}
+
+int DkStreamWriteV(PAL_HANDLE handle, PAL_IOVEC* iov, PAL_NUM iov_cnt, PAL_NUM* count) {
+    if (!handle || (!iov && iov_cnt)) {
+        return -PAL_ERROR_INVAL;
+    }
+
+    int64_t ret = _DkStreamWriteV(handle, iov, iov_cnt);
+
+    if (ret < 0) {
+        return ret;
+    }
+
+    *count = ret;
+    return 0;
+}
+
+int64_t _DkStreamRecvFrom(PAL_HANDLE handle, PAL_IOVEC* iov, size_t iov_cnt, void* addr,
+                          size_t* addrlen) {
+    const struct handle_ops* ops = HANDLE_OPS(handle);
+
+    if (!ops)
+        return -PAL_ERROR_BADHANDLE;
+
+    if (!ops->recvfrom)
+        return -PAL_ERROR_NOTSUPPORT;
+
+    return ops->recvfrom(handle, iov, iov_cnt, addr, addrlen);
+}
+
+int DkStreamRecvFrom(PAL_HANDLE handle, PAL_IOVEC* iov, PAL_NUM iov_cnt, PAL_NUM* count,
+                     PAL_PTR addr, PAL_NUM* addrlen) {
+    if (!handle || (!iov && iov_cnt) || !addr || !addrlen) {
+        return -PAL_ERROR_INVAL;
+    }
+
+    size_t len = *addrlen;
+    int64_t ret = _DkStreamRecvFrom(handle, iov, iov_cnt, addr, &len);
+
+    if (ret < 0) {
+        return ret;
+    }
+
+    *count   = ret;
+    *addrlen = len;
+    return 0;
+}
+
+int64_t _DkStreamSendTo(PAL_HANDLE handle, const PAL_IOVEC* iov, size_t iov_cnt, const void* addr,
+                        size_t addrlen) {
+    const struct handle_ops* ops = HANDLE_OPS(handle);
+
+    if (!ops)
+        return -PAL_ERROR_BADHANDLE;
+
+    if (!ops->sendto)
+        return -PAL_ERROR_NOTSUPPORT;
+
+    return ops->sendto(handle, iov, iov_cnt, addr, addrlen);
+}
+
+int DkStreamSendTo(PAL_HANDLE handle, PAL_IOVEC* iov, PAL_NUM iov_cnt, PAL_NUM* count,
+                   PAL_PTR addr, PAL_NUM addrlen) {
+    if (!handle || (!iov && iov_cnt) || !addr || !addrlen) {
+        return -PAL_ERROR_INVAL;
+    }
+
+    int64_t ret = _DkStreamSendTo(handle, iov, iov_cnt, addr, addrlen);
+
+    if (ret < 0) {
+        return ret;
+    }
+
+    *count = ret;
+    return 0;
+}
+
+/* _DkStreamSendBatch for internal use. Streams without native batching send the datagrams one by
+   one, until the first error */
+int64_t _DkStreamSendBatch(PAL_HANDLE handle, PAL_MSG* msgs, size_t msg_cnt) {
+    const struct handle_ops* ops = HANDLE_OPS(handle);
+
+    if (!ops)
+        return -PAL_ERROR_BADHANDLE;
+
+    if (ops->sendbatch)
+        return ops->sendbatch(handle, msgs, msg_cnt);
+
+    size_t sent = 0;
+    for (; sent < msg_cnt; sent++) {
+        PAL_MSG* msg = &msgs[sent];
+        int64_t ret = msg->addr ? _DkStreamSendTo(handle, msg->iov, msg->iov_cnt, msg->addr,
+                                                  msg->addrlen)
+                                : _DkStreamWriteV(handle, msg->iov, msg->iov_cnt);
+        if (ret < 0)
+            return sent ? (int64_t)sent : ret;
+        msg->len = ret;
+    }
+    return sent;
+}
+
+int DkStreamSendBatch(PAL_HANDLE handle, PAL_MSG* msgs, PAL_NUM msg_cnt, PAL_NUM* count) {
+    if (!handle || (!msgs && msg_cnt)) {
+        return -PAL_ERROR_INVAL;
+    }
+
+    int64_t ret = _DkStreamSendBatch(handle, msgs, msg_cnt);
+
+    if (ret < 0) {
+        return ret;
+    }
+
+    *count = ret;
+    return 0;
+}
+
+/* _DkStreamRecvBatch for internal use. Streams without native batching receive only the first
+   datagram, so that the call never waits for more than one */
+int64_t _DkStreamRecvBatch(PAL_HANDLE handle, PAL_MSG* msgs, size_t msg_cnt) {
+    const struct handle_ops* ops = HANDLE_OPS(handle);
+
+    if (!ops)
+        return -PAL_ERROR_BADHANDLE;
+
+    if (ops->recvbatch)
+        return ops->recvbatch(handle, msgs, msg_cnt);
+
+    if (!msg_cnt)
+        return 0;
+
+    int64_t ret;
+    if (msgs[0].addr) {
+        size_t addrlen = msgs[0].addrlen;
+        ret = _DkStreamRecvFrom(handle, msgs[0].iov, msgs[0].iov_cnt, msgs[0].addr, &addrlen);
+        msgs[0].addrlen = addrlen;
+    } else {
+        ret = _DkStreamReadV(handle, msgs[0].iov, msgs[0].iov_cnt);
+    }
+    if (ret < 0)
+        return ret;
+
+    msgs[0].len = ret;
+    return 1;
+}
+
+int DkStreamRecvBatch(PAL_HANDLE handle, PAL_MSG* msgs, PAL_NUM msg_cnt, PAL_NUM* count) {
+    if (!handle || (!msgs && msg_cnt)) {
+        return -PAL_ERROR_INVAL;
+    }
+
+    int64_t ret = _DkStreamRecvBatch(handle, msgs, msg_cnt);
+
+    if (ret < 0) {
+        return ret;
+    }
+
+    *count = ret;
+    return 0;
+}
+
+/* _DkStreamSendFile for internal use. Copies data from a file into another stream entirely on the
+   host; the source handle decides whether this is possible for the given pair of handles */
+int64_t _DkStreamSendFile(PAL_HANDLE out_handle, PAL_HANDLE in_handle, uint64_t offset,
+                          uint64_t count) {
+    const struct handle_ops* ops = HANDLE_OPS(in_handle);
+
+    if (!ops || !HANDLE_OPS(out_handle))
+        return -PAL_ERROR_BADHANDLE;
+
+    if (!ops->sendfile)
+        return -PAL_ERROR_NOTSUPPORT;
+
+    return ops->sendfile(in_handle, out_handle, offset, count);
+}
+
+int DkStreamSendFile(PAL_HANDLE out_handle, PAL_HANDLE in_handle, PAL_NUM offset, PAL_NUM* count) {
+    if (!out_handle || !in_handle || !count) {
+        return -PAL_ERROR_INVAL;
+    }
+
+    int64_t ret = _DkStreamSendFile(out_handle, in_handle, offset, *count);
+
+    if (ret < 0) {
+        return ret;
+    }
+
+    *count = ret;
+    return 0;
+}
+
+/* _DkStreamReadDir for internal use. Reads directory entries along with their attributes; only
+   directory handles of PALs that can fetch the attributes in bulk support it */
+int64_t _DkStreamReadDir(PAL_HANDLE handle, uint64_t count, void* buf, PAL_STREAM_ATTR* attrs,
+                         size_t* attrs_cnt) {
+    const struct handle_ops* ops = HANDLE_OPS(handle);
+
+    if (!ops)
+        return -PAL_ERROR_BADHANDLE;
+
+    if (!ops->readdir)
+        return -PAL_ERROR_NOTSUPPORT;
+
+    return ops->readdir(handle, count, buf, attrs, attrs_cnt);
+}
+
+int DkStreamReadDir(PAL_HANDLE handle, PAL_NUM* count, PAL_PTR buffer, PAL_STREAM_ATTR* attrs,
+                    PAL_NUM* attrs_cnt) {
+    if (!handle || !count || !buffer || !attrs || !attrs_cnt) {
+        return -PAL_ERROR_INVAL;
+    }
+
+    size_t entries = *attrs_cnt;
+    int64_t ret = _DkStreamReadDir(handle, *count, (void*)buffer, attrs, &entries);
+
+    if (ret < 0) {
+        return ret;
+    }
+
+    *count = ret;
+    *attrs_cnt = entries;
+    return 0;
+}
+
 /* _DkStreamAttributesQuery of internal use. The function query attribute
    of streams by their URI */
 int _DkStreamAttributesQuery(const char* uri, PAL_STREAM_ATTR* attr) {
@@ -354,6 +641,23 @@ int DkStreamAttributesQueryByHandle(PAL_HANDLE handle, PAL_STREAM_ATTR* attr) {
     return _DkStreamAttributesQueryByHandle(handle, attr);
 }
 
+int DkStreamAttributesQueryCachedByHandle(PAL_HANDLE handle, PAL_STREAM_ATTR* attr) {
+    if (!handle || !attr) {
+        return -PAL_ERROR_INVAL;
+    }
+
+    const struct handle_ops* ops = HANDLE_OPS(handle);
+    if (!ops) {
+        return -PAL_ERROR_BADHANDLE;
+    }
+
+    if (!ops->attrquerycached) {
+        return _DkStreamAttributesQueryByHandle(handle, attr);
+    }
+
+    return ops->attrquerycached(handle, attr);
+}
+
 int DkStreamAttributesSetByHandle(PAL_HANDLE handle, PAL_STREAM_ATTR* attr) {
     if (!handle || !attr) {
         return -PAL_ERROR_INVAL;
@@ -531,6 +835,27 @@ int DkReceiveHandle(PAL_HANDLE handle, PAL_HANDLE* cargo) {
     return _DkReceiveHandle(handle, cargo);
 }
 
+int DkSendHandles(PAL_HANDLE handle, PAL_HANDLE* cargos, PAL_NUM count) {
+    if (!handle || (!cargos && count))
+        return -PAL_ERROR_INVAL;
+
+    for (size_t i = 0; i < count; i++)
+        if (!cargos[i])
+            return -PAL_ERROR_INVAL;
+
+    return count ? _DkSendHandles(handle, cargos, count) : 0;
+}
+
+int DkReceiveHandles(PAL_HANDLE handle, PAL_HANDLE* cargos, PAL_NUM count) {
+    if (!handle || (!cargos && count))
+        return -PAL_ERROR_INVAL;
+
+    for (size_t i = 0; i < count; i++)
+        cargos[i] = NULL;
+
+    return count ? _DkReceiveHandles(handle, cargos, count) : 0;
+}
+
 int DkStreamChangeName(PAL_HANDLE hdl, PAL_STR uri) {
     struct handle_ops* ops = NULL;
     char* type = NULL;
@@ -153,24 +153,16 @@ static int dev_attrquery(const char* type, const char* uri, PAL_STREAM_ATTR* att
         attr->pending_size = 0;
     } else {
         /* other devices must query the host */
-        int fd = ocall_open(uri, 0, 0);
-        if (fd < 0)
-            return unix_to_pal_error(fd);
-
         struct stat stat_buf;
-        int ret = ocall_fstat(fd, &stat_buf);
-        if (ret < 0) {
-            ocall_close(fd);
+        int ret = ocall_stat(uri, &stat_buf);
+        if (ret < 0)
             return unix_to_pal_error(ret);
-        }
 
         attr->readable     = stataccess(&stat_buf, ACCESS_R);
         attr->writable     = stataccess(&stat_buf, ACCESS_W);
         attr->runnable     = stataccess(&stat_buf, ACCESS_X);
         attr->share_flags  = stat_buf.st_mode;
         attr->pending_size = stat_buf.st_size;
-
-        ocall_close(fd);
     }
 
     attr->handle_type  = PAL_TYPE_DEV;
@@ -13,6 +13,7 @@
 #include "api.h"
 #include "cpu.h"
 #include "ecall_types.h"
+#include "enclave_lazy_map.h"
 #include "pal.h"
 #include "pal_defs.h"
 #include "pal_error.h"
@@ -181,6 +182,7 @@ void _DkExceptionHandler(unsigned int exit_info, sgx_cpu_context_t* uc,
     } ei = {.intval = exit_info};
 
     int event_num;
+    sgx_arch_exinfo_t* exinfo = NULL;
 
     if (!ei.info.valid) {
         event_num = exit_info;
@@ -209,6 +211,17 @@ void _DkExceptionHandler(unsigned int exit_info, sgx_cpu_context_t* uc,
             case SGX_EXCEPTION_VECTOR_AC:
                 event_num = PAL_EVENT_MEMFAULT;
                 break;
+            case SGX_EXCEPTION_VECTOR_PF:
+                /* #PF is reported only if EXINFO is enabled in MISCSELECT; the processor then saves
+                 * the faulting address and error code in the MISC region of the SSA frame, right
+                 * below the GPR area */
+                exinfo = (sgx_arch_exinfo_t*)((uint8_t*)GET_ENCLAVE_TLS(gpr) - sizeof(*exinfo));
+                if (lazy_map_handle_fault((void*)exinfo->maddr)) {
+                    restore_sgx_context(uc, xregs_state);
+                    /* NOTREACHED */
+                }
+                event_num = PAL_EVENT_MEMFAULT;
+                break;
             case SGX_EXCEPTION_VECTOR_DB:
             case SGX_EXCEPTION_VECTOR_BP:
             default:
@@ -238,11 +251,10 @@ void _DkExceptionHandler(unsigned int exit_info, sgx_cpu_context_t* uc,
     PAL_CONTEXT ctx;
     save_pal_context(&ctx, uc, xregs_state);
 
-    /* TODO: save EXINFO from MISC region and populate below fields */
-    ctx.err     = 0;
+    ctx.err     = exinfo ? exinfo->errcd : 0;
     ctx.trapno  = ei.info.valid ? ei.info.vector : 0;
     ctx.oldmask = 0;
-    ctx.cr2     = 0;
+    ctx.cr2     = exinfo ? exinfo->maddr : 0;
 
     PAL_NUM addr = 0;
     switch (event_num) {
@@ -250,7 +262,9 @@ void _DkExceptionHandler(unsigned int exit_info, sgx_cpu_context_t* uc,
             addr = uc->rip;
             break;
         case PAL_EVENT_MEMFAULT:
-            /* TODO: SGX1 doesn't provide fault address but SGX2 does (with lower bits masked) */
+            /* only #PF provides the fault address (see EXINFO above) */
+            if (exinfo)
+                addr = exinfo->maddr;
             break;
         default:
             break;
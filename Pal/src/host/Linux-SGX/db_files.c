@@ -25,6 +25,7 @@
 #include "perm.h"
 #include "stat.h"
 
+#include "enclave_lazy_map.h"
 #include "enclave_pages.h"
 
 /* this macro is used to emulate mmap() via pread() in chunks of 128MB (mmapped files may be many
@@ -89,18 +90,12 @@ static int file_open(PAL_HANDLE* handle, const char* type, const char* uri, int
         log_always("Allowing access to unknown file '%s' due to file_check_policy settings.",
                    hdl->file.realpath);
 
-        fd = ocall_open(uri, flags, pal_share);
+        fd = ocall_open_stat(uri, flags, pal_share, &st);
         if (fd < 0) {
             ret = unix_to_pal_error(fd);
             goto fail;
         }
 
-        ret = ocall_fstat(fd, &st);
-        if (ret < 0) {
-            ret = unix_to_pal_error(ret);
-            goto fail;
-        }
-
         hdl->file.fd = fd;
         hdl->file.seekable = !S_ISFIFO(st.st_mode);
         hdl->file.total = st.st_size;
@@ -129,18 +124,12 @@ static int file_open(PAL_HANDLE* handle, const char* type, const char* uri, int
             goto fail_pf_unlock;
         }
 
-        fd = ocall_open(uri, flags, pal_share);
+        fd = ocall_open_stat(uri, flags, pal_share, &st);
         if (fd < 0) {
             ret = unix_to_pal_error(fd);
             goto fail_pf_unlock;
         }
 
-        ret = ocall_fstat(fd, &st);
-        if (ret < 0) {
-            ret = unix_to_pal_error(ret);
-            goto fail_pf_unlock;
-        }
-
         hdl->file.fd = fd;
         hdl->file.seekable = !S_ISFIFO(st.st_mode);
 
@@ -173,18 +162,12 @@ static int file_open(PAL_HANDLE* handle, const char* type, const char* uri, int
         goto fail;
     }
 
-    fd = ocall_open(uri, flags, pal_share);
+    fd = ocall_open_stat(uri, flags, pal_share, &st);
     if (fd < 0) {
         ret = unix_to_pal_error(fd);
         goto fail;
     }
 
-    ret = ocall_fstat(fd, &st);
-    if (ret < 0) {
-        ret = unix_to_pal_error(ret);
-        goto fail;
-    }
-
     hdl->file.fd = fd;
     hdl->file.seekable = !S_ISFIFO(st.st_mode);
     hdl->file.total = st.st_size;
@@ -209,7 +192,7 @@ static int file_open(PAL_HANDLE* handle, const char* type, const char* uri, int
 fail_pf_unlock:
     pf_unlock();
 fail:
-    if (pf && pf->context && pf->refcount == 0)
+    if (pf && pf->context && pf->refcount == 0 && !pf->closed)
         unload_protected_file(pf);
 
     if (fd >= 0)
@@ -277,6 +260,8 @@ static int64_t file_read(PAL_HANDLE handle, uint64_t offset, uint64_t count, voi
     if (ret < 0)
         return ret;
 
+    mark_trusted_file_chunks_used(handle->file.realpath, offset, end);
+
     return end - offset;
 }
 
@@ -327,6 +312,42 @@ static int64_t file_write(PAL_HANDLE handle, uint64_t offset, uint64_t count, co
     return -PAL_ERROR_DENIED;
 }
 
+/* 'sendfile' operation for file streams. Only allowed files qualify: protected files must be
+   decrypted and trusted files must be verified inside the enclave. Similarly, only destinations that
+   are not encrypted by the PAL (TCP/UDP sockets and anonymous pipes) are supported. */
+static int64_t file_sendfile(PAL_HANDLE handle, PAL_HANDLE out_handle, uint64_t offset,
+                             uint64_t count) {
+    if (find_protected_file_handle(handle) || handle->file.chunk_hashes || !handle->file.seekable)
+        return -PAL_ERROR_NOTSUPPORT;
+
+    int out_fd;
+    switch (HANDLE_HDR(out_handle)->type) {
+        case PAL_TYPE_TCP:
+        case PAL_TYPE_UDP:
+            /* data queued in the socket's tx ring must go out first */
+            if (out_handle->sock.ring)
+                return -PAL_ERROR_NOTSUPPORT;
+            out_fd = out_handle->sock.fd;
+            break;
+        case PAL_TYPE_PIPEPRV:
+            /* pipeprv are currently not encrypted, see pipe_private() */
+            out_fd = out_handle->pipeprv.fds[1];
+            break;
+        default:
+            return -PAL_ERROR_NOTSUPPORT;
+    }
+
+    ssize_t ret = ocall_sendfile(out_fd, handle->file.fd, offset, count);
+    if (ret == -EINVAL) {
+        /* e.g. the file doesn't support mmap-like operations; let the caller copy the data */
+        return -PAL_ERROR_NOTSUPPORT;
+    }
+    if (ret < 0)
+        return unix_to_pal_error(ret);
+
+    return ret;
+}
+
 static int pf_file_close(struct protected_file* pf, PAL_HANDLE handle) {
     int fd = handle->file.fd;
 
@@ -394,10 +415,6 @@ static int pf_file_map(struct protected_file* pf, PAL_HANDLE handle, void** addr
         return -PAL_ERROR_INVAL;
 
     assert(WITHIN_MASK(prot, PAL_PROT_MASK));
-    if ((prot & PAL_PROT_READ) && (prot & PAL_PROT_WRITE)) {
-        log_warning("pf_file_map(PF fd %d): trying to map with R+W access", fd);
-        return -PAL_ERROR_NOTSUPPORT;
-    }
 
     if (!pf->context) {
         log_warning("pf_file_map(PF fd %d): PF not initialized", fd);
@@ -421,23 +438,6 @@ static int pf_file_map(struct protected_file* pf, PAL_HANDLE handle, void** addr
         *addr = allocated_enclave_pages;
     }
 
-    if (prot & PAL_PROT_WRITE) {
-        struct pf_map* map = calloc(1, sizeof(*map));
-        if (!map) {
-            ret = -PAL_ERROR_NOMEM;
-            goto out;
-        }
-
-        map->pf     = pf;
-        map->size   = size;
-        map->offset = offset;
-        map->buffer = *addr;
-
-        pf_lock();
-        LISTP_ADD_TAIL(map, &g_pf_map_list, list);
-        pf_unlock();
-    }
-
     if (prot & PAL_PROT_READ) {
         /* we don't check this on writes since file size may be extended then */
         if (offset >= pf_size) {
@@ -463,7 +463,14 @@ static int pf_file_map(struct protected_file* pf, PAL_HANDLE handle, void** addr
         memset(*addr + copy_size, 0, size - copy_size);
     }
 
-    /* Writes will be flushed to the PF on close. */
+    if (prot & PAL_PROT_WRITE) {
+        /* Writes will be flushed to the PF on flush, unmap or close; for R+W maps, only the pages
+         * modified in the meantime. */
+        ret = register_pf_map(pf, *addr, offset, size, /*populated=*/prot & PAL_PROT_READ);
+        if (ret < 0)
+            goto out;
+    }
+
     ret = 0;
 out:
     if (ret < 0 && allocated_enclave_pages) {
@@ -514,10 +521,32 @@ static int file_map(PAL_HANDLE handle, void** addr, int prot, uint64_t offset, u
         return -PAL_ERROR_DENIED;
     }
 
+    if (chunk_hashes && g_lazy_mmap_trusted_files) {
+        /* pages are copied and verified on first access; if the range cannot be mapped lazily
+         * (it overlaps already allocated memory), fall back to copying it right away */
+        ret = lazy_map_trusted_file(&mem, size, pal_prot_to_sgx_prot(prot), handle->file.fd,
+                                    offset, chunk_hashes, handle->file.total);
+        if (ret == 0) {
+            /* pages are verified only when touched, but the whole range counts as used */
+            mark_trusted_file_chunks_used(handle->file.realpath, offset,
+                                          MIN(offset + size, handle->file.total));
+            *addr = mem;
+            return 0;
+        }
+        mem = *addr;
+    }
+
     mem = get_enclave_pages(mem, size, /*is_pal_internal=*/false);
     if (!mem)
         return -PAL_ERROR_NOMEM;
 
+    if (g_edmm_enabled && *addr) {
+        /* the range may overlap with committed pages whose permissions were restricted earlier */
+        ret = protect_enclave_pages(mem, size, SGX_SECINFO_FLAGS_RWX);
+        if (ret < 0)
+            goto out;
+    }
+
     if (chunk_hashes) {
         /* case of trusted file: already mmaped in umem, copy from there into enclave memory and
          * verify hashes along the way */
@@ -539,6 +568,7 @@ static int file_map(PAL_HANDLE handle, void** addr, int prot, uint64_t offset, u
             log_error("file_map - copy & verify on trusted file returned %d", ret);
             goto out;
         }
+        mark_trusted_file_chunks_used(handle->file.realpath, offset, end);
     } else {
         /* case of allowed file: simply read from underlying file descriptor into enclave memory */
         size_t bytes_read = 0;
@@ -576,6 +606,29 @@ out:
     return ret;
 }
 
+/* Fast path exported through `g_pal_control.file_map_untrusted` if `sgx.zero_copy_allowed_files` is
+ * enabled: allowed files are not verified anyway, so the enclave can read them directly from a host
+ * mapping instead of copying them into enclave pages */
+int pal_file_map_untrusted(PAL_HANDLE handle, PAL_PTR* addr, PAL_NUM offset, PAL_NUM size) {
+    if (HANDLE_HDR(handle)->type != PAL_TYPE_FILE)
+        return -PAL_ERROR_BADHANDLE;
+    if (!IS_ALLOC_ALIGNED(offset) || !size || !IS_ALLOC_ALIGNED(size))
+        return -PAL_ERROR_INVAL;
+
+    /* trusted and protected files must be verified or decrypted inside the enclave */
+    if (handle->file.chunk_hashes || find_protected_file_handle(handle))
+        return -PAL_ERROR_NOTSUPPORT;
+
+    void* mem = *addr;
+    int flags = MAP_SHARED | (mem ? MAP_FIXED_NOREPLACE : 0);
+    int ret = ocall_mmap_untrusted(&mem, size, PROT_READ, flags, handle->file.fd, offset);
+    if (ret < 0)
+        return unix_to_pal_error(ret);
+
+    *addr = mem;
+    return 0;
+}
+
 static int64_t pf_file_setlength(struct protected_file* pf, PAL_HANDLE handle, uint64_t length) {
     int fd = handle->file.fd;
 
@@ -612,11 +665,9 @@ static int file_flush(PAL_HANDLE handle) {
             log_warning("file_flush(PF fd %d): flush_pf_maps returned %s", fd, pal_strerror(ret));
             return ret;
         }
-        pf_status_t pfs = pf_flush(pf->context);
-        if (PF_FAILURE(pfs)) {
-            log_warning("file_flush(PF fd %d): pf_flush returned %s", fd, pf_strerror(pfs));
-            return -PAL_ERROR_DENIED;
-        }
+        ret = flush_protected_file(pf, fd);
+        if (ret < 0)
+            return ret;
     } else {
         ocall_fsync(fd);
     }
@@ -675,9 +726,9 @@ static int pf_file_attrquery(struct protected_file* pf, int fd_from_attrquery, c
     assert(PF_SUCCESS(pfs));
 
     if (fd_from_attrquery == *(int*)pf_handle) { /* this is a PF opened just for us, close it */
-        pfs = pf_close(pf->context);
-        pf->context = NULL;
-        assert(PF_SUCCESS(pfs));
+        int ret = unload_protected_file(pf);
+        __UNUSED(ret);
+        assert(ret == 0);
     }
 
     return 0;
@@ -688,15 +739,10 @@ static int file_attrquery(const char* type, const char* uri, PAL_STREAM_ATTR* at
     if (strcmp(type, URI_TYPE_FILE) && strcmp(type, URI_TYPE_DIR))
         return -PAL_ERROR_INVAL;
 
-    /* open the file with O_NONBLOCK to avoid blocking the current thread if it is actually a FIFO
-     * pipe; O_NONBLOCK will be reset below if it is a regular file */
-    int fd = ocall_open(uri, O_NONBLOCK, 0);
-    if (fd < 0)
-        return unix_to_pal_error(fd);
-
+    int fd = -1;
     char* path = NULL;
     struct stat stat_buf;
-    int ret = ocall_fstat(fd, &stat_buf);
+    int ret = ocall_stat(uri, &stat_buf);
 
     /* if it failed, return the right error code */
     if (ret < 0) {
@@ -727,11 +773,10 @@ static int file_attrquery(const char* type, const char* uri, PAL_STREAM_ATTR* at
             goto out;
         }
 
-        /* reset O_NONBLOCK because pf_file_attrquery() may issue reads which don't expect
-         * non-blocking mode */
-        ret = ocall_fsetnonblock(fd, 0);
-        if (ret < 0) {
-            ret = unix_to_pal_error(ret);
+        /* the data size is stored in the PF itself, so (only) PFs have to be opened */
+        fd = ocall_open(uri, O_RDONLY, 0);
+        if (fd < 0) {
+            ret = unix_to_pal_error(fd);
             goto out;
         }
 
@@ -742,7 +787,8 @@ static int file_attrquery(const char* type, const char* uri, PAL_STREAM_ATTR* at
 
 out:
     free(path);
-    ocall_close(fd);
+    if (fd >= 0)
+        ocall_close(fd);
     return ret;
 }
 
@@ -831,6 +877,7 @@ struct handle_ops g_file_ops = {
     .open           = &file_open,
     .read           = &file_read,
     .write          = &file_write,
+    .sendfile       = &file_sendfile,
     .close          = &file_close,
     .delete         = &file_delete,
     .map            = &file_map,
@@ -883,28 +930,71 @@ static int dir_open(PAL_HANDLE* handle, const char* type, const char* uri, int a
     hdl->dir.buf         = (PAL_PTR)NULL;
     hdl->dir.ptr         = (PAL_PTR)NULL;
     hdl->dir.end         = (PAL_PTR)NULL;
+    hdl->dir.stats       = (PAL_PTR)NULL;
+    hdl->dir.stats_cnt   = 0;
+    hdl->dir.stat_idx    = 0;
     hdl->dir.endofstream = PAL_FALSE;
     *handle              = hdl;
     return 0;
 }
 
 #define DIRBUF_SIZE 1024
+/* maximum number of dirents in DIRBUF_SIZE bytes (the smallest dirent has a 1-character name) */
+#define DIRBUF_MAX_ENTRIES \
+    (DIRBUF_SIZE / ALIGN_UP(offsetof(struct linux_dirent64, d_name) + 2, 8))
+
 static inline bool is_dot_or_dotdot(const char* name) {
     return (name[0] == '.' && !name[1]) || (name[0] == '.' && name[1] == '.' && !name[2]);
 }
 
-/* 'read' operation for directory stream. Directory stream will not
-   need a 'write' operation. */
-static int64_t dir_read(PAL_HANDLE handle, uint64_t offset, size_t count, void* _buf) {
-    size_t bytes_written = 0;
-    char* buf            = (char*)_buf;
-
-    if (offset) {
-        return -PAL_ERROR_INVAL;
+/* Fill `attr` for the dirent at `stat_idx` in the current directory buffer, from the stat record
+ * prefetched by ocall_getdents_stat(). Entries without a usable record are marked with
+ * `handle_type == PAL_HANDLE_TYPE_BOUND`, the caller has to query them separately. */
+static void dir_entry_attr(PAL_HANDLE handle, struct linux_dirent64* dirent, size_t stat_idx,
+                           PAL_STREAM_ATTR* attr) {
+    memset(attr, 0, sizeof(*attr));
+    attr->handle_type = PAL_HANDLE_TYPE_BOUND;
+
+    if (stat_idx >= handle->dir.stats_cnt)
+        return;
+    struct stat* stat = &((struct stat*)handle->dir.stats)[stat_idx];
+    if (!stat->st_mode)
+        return;
+
+    if (!S_ISDIR(stat->st_mode)) {
+        /* for protected files, only file_attrquery() can report the data size */
+        size_t dir_len = strlen(handle->dir.realpath);
+        size_t name_len = strlen(dirent->d_name);
+        size_t path_size = dir_len + 1 + name_len + 1;
+        char* path = malloc(path_size * 2);
+        if (!path)
+            return;
+        char* norm_path = path + path_size;
+        memcpy(path, handle->dir.realpath, dir_len);
+        path[dir_len] = '/';
+        memcpy(path + dir_len + 1, dirent->d_name, name_len + 1);
+
+        bool is_pf = get_norm_path(path, norm_path, &path_size) < 0 ||
+                     get_protected_file(norm_path);
+        free(path);
+        if (is_pf)
+            return;
     }
 
+    file_attrcopy(attr, stat);
+}
+
+/* Fills `buf` with the null-terminated names of the next directory entries (names of directories
+ * end with '/'). If `attrs` is not NULL, also fills `attrs[i]` with the attributes of the i-th
+ * returned entry; then at most `*attrs_cnt` entries are returned, and `*attrs_cnt` is set to their
+ * number. */
+static int64_t dir_read_entries(PAL_HANDLE handle, size_t count, char* buf, PAL_STREAM_ATTR* attrs,
+                                size_t* attrs_cnt) {
+    size_t bytes_written = 0;
+    size_t entries = 0;
+
     if (handle->dir.endofstream == PAL_TRUE) {
-        return 0;
+        goto out;
     }
 
     while (1) {
@@ -921,6 +1011,11 @@ static int64_t dir_read(PAL_HANDLE handle, uint64_t offset, size_t count, void*
             if (len + 1 + (is_dir ? 1 : 0) > count) {
                 goto out;
             }
+            if (attrs) {
+                if (entries == *attrs_cnt)
+                    goto out;
+                dir_entry_attr(handle, dirent, handle->dir.stat_idx, &attrs[entries]);
+            }
 
             memcpy(buf, dirent->d_name, len);
             if (is_dir) {
@@ -931,11 +1026,13 @@ static int64_t dir_read(PAL_HANDLE handle, uint64_t offset, size_t count, void*
             buf += len;
             bytes_written += len;
             count -= len;
+            entries++;
         skip:
             handle->dir.ptr = (char*)handle->dir.ptr + dirent->d_reclen;
+            handle->dir.stat_idx++;
         }
 
-        if (!count) {
+        if (!count || (attrs && entries == *attrs_cnt)) {
             /* No space left, returning */
             goto out;
         }
@@ -947,14 +1044,29 @@ static int64_t dir_read(PAL_HANDLE handle, uint64_t offset, size_t count, void*
             }
         }
 
-        int size = ocall_getdents(handle->dir.fd, handle->dir.buf, DIRBUF_SIZE);
+        int size;
+        if (attrs) {
+            if (!handle->dir.stats) {
+                handle->dir.stats = (PAL_PTR)malloc(DIRBUF_MAX_ENTRIES * sizeof(struct stat));
+                if (!handle->dir.stats) {
+                    return -PAL_ERROR_NOMEM;
+                }
+            }
+            size_t stats_cnt = DIRBUF_MAX_ENTRIES;
+            size = ocall_getdents_stat(handle->dir.fd, handle->dir.buf, DIRBUF_SIZE,
+                                       handle->dir.stats, &stats_cnt);
+            handle->dir.stats_cnt = stats_cnt;
+        } else {
+            size = ocall_getdents(handle->dir.fd, handle->dir.buf, DIRBUF_SIZE);
+            handle->dir.stats_cnt = 0;
+        }
         if (size < 0) {
             /*
              * If something was written just return that and pretend no error
              * was seen - it will be caught next time.
              */
             if (bytes_written) {
-                return bytes_written;
+                goto out;
             }
             return unix_to_pal_error(size);
         }
@@ -964,14 +1076,34 @@ static int64_t dir_read(PAL_HANDLE handle, uint64_t offset, size_t count, void*
             goto out;
         }
 
-        handle->dir.ptr = handle->dir.buf;
-        handle->dir.end = (char*)handle->dir.buf + size;
+        handle->dir.ptr      = handle->dir.buf;
+        handle->dir.end      = (char*)handle->dir.buf + size;
+        handle->dir.stat_idx = 0;
     }
 
 out:
+    if (attrs)
+        *attrs_cnt = entries;
     return (int64_t)bytes_written;
 }
 
+/* 'read' operation for directory stream. Directory stream will not
+   need a 'write' operation. */
+static int64_t dir_read(PAL_HANDLE handle, uint64_t offset, size_t count, void* buf) {
+    if (offset) {
+        return -PAL_ERROR_INVAL;
+    }
+
+    return dir_read_entries(handle, count, buf, /*attrs=*/NULL, /*attrs_cnt=*/NULL);
+}
+
+/* 'readdir' operation for directory stream: reads the entries together with their attributes,
+   stat'ing a whole buffer of entries in a single OCALL */
+static int64_t dir_readdir(PAL_HANDLE handle, size_t count, void* buf, PAL_STREAM_ATTR* attrs,
+                           size_t* attrs_cnt) {
+    return dir_read_entries(handle, count, buf, attrs, attrs_cnt);
+}
+
 /* 'close' operation of directory streams */
 static int dir_close(PAL_HANDLE handle) {
     int fd = handle->dir.fd;
@@ -982,6 +1114,8 @@ static int dir_close(PAL_HANDLE handle) {
         free((void*)handle->dir.buf);
         handle->dir.buf = handle->dir.ptr = handle->dir.end = (PAL_PTR)NULL;
     }
+    free((void*)handle->dir.stats);
+    handle->dir.stats = (PAL_PTR)NULL;
 
     /* initial realpath is part of handle object and will be freed with it */
     if (handle->dir.realpath && handle->dir.realpath != (void*)handle + HANDLE_SIZE(dir))
@@ -1052,6 +1186,7 @@ struct handle_ops g_dir_ops = {
     .getrealpath    = &dir_getrealpath,
     .open           = &dir_open,
     .read           = &dir_read,
+    .readdir        = &dir_readdir,
     .close          = &dir_close,
     .delete         = &dir_delete,
     .attrquery      = &file_attrquery,
@@ -18,6 +18,7 @@
 #include "api.h"
 #include "ecall_types.h"
 #include "elf/elf.h"
+#include "enclave_lazy_map.h"
 #include "enclave_pages.h"
 #include "enclave_pf.h"
 #include "enclave_tf.h"
@@ -510,6 +511,64 @@ static int parse_host_topo_info(struct pal_sec* sec_info) {
     return 0;
 }
 
+/* Heap preheating (see `sgx.preheat_enclave`): threads claim chunks of heap pages going from the
+ * current heap top downwards, i.e. in the same order in which anonymous allocations are served. */
+#define PREHEAT_CHUNK_PAGES 256
+
+static uintptr_t g_preheat_next_top;
+static uintptr_t g_preheat_bottom;
+static struct atomic_int g_preheat_threads_running = ATOMIC_INIT(0);
+
+static void preheat_heap_chunks(void) {
+    size_t chunk_size = PREHEAT_CHUNK_PAGES * g_page_size;
+    while (true) {
+        uintptr_t top = __atomic_fetch_sub(&g_preheat_next_top, chunk_size, __ATOMIC_RELAXED);
+        if (top <= g_preheat_bottom)
+            break;
+        uintptr_t bottom = top - g_preheat_bottom > chunk_size ? top - chunk_size
+                                                                : g_preheat_bottom;
+        for (uintptr_t addr = bottom; addr < top; addr += g_page_size)
+            READ_ONCE(*(size_t*)addr);
+    }
+}
+
+static int preheat_thread_main(void* arg) {
+    __UNUSED(arg);
+    preheat_heap_chunks();
+    __atomic_sub_fetch(&g_preheat_threads_running.counter, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/* Pre-faults all free heap pages using `threads_num` threads (including the current one, unless
+ * `background` is set, in which case this function returns immediately). Must be called after the
+ * enclave is initialized, since only then new enclave threads can start. */
+static void preheat_enclave_heap(size_t threads_num, bool background) {
+    g_preheat_bottom   = (uintptr_t)g_pal_sec.heap_min;
+    g_preheat_next_top = (uintptr_t)get_enclave_heap_top();
+
+    size_t helpers_num = background ? threads_num : threads_num - 1;
+    for (size_t i = 0; i < helpers_num; i++) {
+        /* thread handles are never freed: PAL threads cannot be joined, and the exiting thread
+         * still uses its handle */
+        PAL_HANDLE thread;
+        __atomic_add_fetch(&g_preheat_threads_running.counter, 1, __ATOMIC_ACQUIRE);
+        int ret = _DkThreadCreate(&thread, preheat_thread_main, /*param=*/NULL);
+        if (ret < 0) {
+            __atomic_sub_fetch(&g_preheat_threads_running.counter, 1, __ATOMIC_RELEASE);
+            log_warning("Cannot create enclave preheating thread (%d), using %lu thread(s)", ret,
+                        background ? i : i + 1);
+            break;
+        }
+    }
+
+    if (background && __atomic_load_n(&g_preheat_threads_running.counter, __ATOMIC_ACQUIRE))
+        return;
+
+    preheat_heap_chunks();
+    while (__atomic_load_n(&g_preheat_threads_running.counter, __ATOMIC_ACQUIRE))
+        CPU_RELAX();
+}
+
 extern void* g_enclave_base;
 extern void* g_enclave_top;
 
@@ -605,6 +664,7 @@ noreturn void pal_linux_main(char* uptr_libpal_uri, size_t libpal_uri_len, char*
     init_untrusted_slab_mgr();
     init_enclave_pages();
     init_cpuid();
+    init_xsave_xinuse();
 
     /* now we can add a link map for PAL itself */
     setup_pal_map(&g_pal_map);
@@ -688,6 +748,24 @@ noreturn void pal_linux_main(char* uptr_libpal_uri, size_t libpal_uri_len, char*
     g_pal_state.raw_manifest_data = manifest_addr;
     g_pal_state.manifest_root = manifest_root;
 
+    /* the host opens the trace file, here we only need to know whether to report phases */
+    char* startup_trace = NULL;
+    ret = toml_string_in(g_pal_state.manifest_root, "sgx.startup_trace", &startup_trace);
+    if (ret < 0) {
+        log_error("Cannot parse 'sgx.startup_trace'");
+        ocall_exit(1, true);
+    }
+    g_startup_trace_enabled = !!startup_trace;
+    free(startup_trace);
+
+    ret = toml_bool_in(g_pal_state.manifest_root, "sgx.enable_stats", /*defaultval=*/false,
+                       &g_enclave_stats_enabled);
+    if (ret < 0) {
+        log_error("Cannot parse 'sgx.enable_stats' (the value must be `true` or `false`)");
+        ocall_exit(1, true);
+    }
+    _DkStartupTrace("PAL: enclave memory and manifest initialized");
+
     bool preheat_enclave;
     ret = toml_bool_in(g_pal_state.manifest_root, "sgx.preheat_enclave", /*defaultval=*/false,
                        &preheat_enclave);
@@ -695,11 +773,95 @@ noreturn void pal_linux_main(char* uptr_libpal_uri, size_t libpal_uri_len, char*
         log_error("Cannot parse 'sgx.preheat_enclave' (the value must be `true` or `false`)");
         ocall_exit(1, true);
     }
-    if (preheat_enclave) {
-        for (uint8_t* i = g_pal_sec.heap_min; i < (uint8_t*)g_pal_sec.heap_max; i += g_page_size)
-            READ_ONCE(*(size_t*)i);
+    if (preheat_enclave && g_edmm_enabled) {
+        /* touching the heap would commit all of it, which defeats the purpose of EDMM */
+        log_warning("'sgx.preheat_enclave' is ignored because 'sgx.edmm_enable' is set");
+        preheat_enclave = false;
     }
 
+    int64_t preheat_threads_num;
+    ret = toml_int_in(g_pal_state.manifest_root, "sgx.preheat_enclave_threads", /*defaultval=*/1,
+                      &preheat_threads_num);
+    if (ret < 0 || preheat_threads_num < 1) {
+        log_error("Cannot parse 'sgx.preheat_enclave_threads' (the value must be a positive "
+                  "integer)");
+        ocall_exit(1, true);
+    }
+
+    bool preheat_background;
+    ret = toml_bool_in(g_pal_state.manifest_root, "sgx.preheat_enclave_background",
+                       /*defaultval=*/false, &preheat_background);
+    if (ret < 0) {
+        log_error("Cannot parse 'sgx.preheat_enclave_background' (the value must be `true` or "
+                  "`false`)");
+        ocall_exit(1, true);
+    }
+
+    bool lazy_mmap_trusted_files;
+    ret = toml_bool_in(g_pal_state.manifest_root, "sgx.lazy_mmap_trusted_files",
+                       /*defaultval=*/false, &lazy_mmap_trusted_files);
+    if (ret < 0) {
+        log_error("Cannot parse 'sgx.lazy_mmap_trusted_files' (the value must be `true` or "
+                  "`false`)");
+        ocall_exit(1, true);
+    }
+    /* the manifest is measured, so it reliably tells whether MISCSELECT.EXINFO is set */
+    bool support_exinfo;
+    ret = toml_bool_in(g_pal_state.manifest_root, "sgx.support_exinfo", /*defaultval=*/false,
+                       &support_exinfo);
+    if (ret < 0) {
+        log_error("Cannot parse 'sgx.support_exinfo' (the value must be `true` or `false`)");
+        ocall_exit(1, true);
+    }
+    /* pages can be left uncommitted only if page faults are reported to the enclave */
+    g_lazy_map_enabled = g_edmm_enabled && support_exinfo;
+
+    if (lazy_mmap_trusted_files) {
+        if (!g_lazy_map_enabled) {
+            log_warning("'sgx.lazy_mmap_trusted_files' is ignored because it requires both "
+                        "'sgx.edmm_enable' and 'sgx.support_exinfo'");
+        } else {
+            g_lazy_mmap_trusted_files = true;
+        }
+    }
+
+    bool zero_copy_allowed_files;
+    ret = toml_bool_in(g_pal_state.manifest_root, "sgx.zero_copy_allowed_files",
+                       /*defaultval=*/false, &zero_copy_allowed_files);
+    if (ret < 0) {
+        log_error("Cannot parse 'sgx.zero_copy_allowed_files' (the value must be `true` or "
+                  "`false`)");
+        ocall_exit(1, true);
+    }
+    if (zero_copy_allowed_files)
+        g_pal_control.file_map_untrusted = &pal_file_map_untrusted;
+
+    ret = toml_bool_in(g_pal_state.manifest_root, "sgx.socket_rings", /*defaultval=*/false,
+                       &g_sock_rings_enabled);
+    if (ret < 0) {
+        log_error("Cannot parse 'sgx.socket_rings' (the value must be `true` or `false`)");
+        ocall_exit(1, true);
+    }
+
+    int64_t thread_num;
+    ret = toml_int_in(g_pal_state.manifest_root, "sgx.thread_num", /*defaultval=*/1, &thread_num);
+    if (ret < 0 || thread_num < 0 || thread_num > UINT32_MAX) {
+        log_error("Cannot parse 'sgx.thread_num'");
+        ocall_exit(1, true);
+    }
+    /* the loader treats 0 as 1 */
+    g_enclave_tcs_cnt = thread_num ?: 1;
+
+    int64_t max_threads;
+    ret = toml_int_in(g_pal_state.manifest_root, "sgx.max_threads",
+                      /*defaultval=*/g_enclave_tcs_cnt, &max_threads);
+    if (ret < 0 || max_threads < g_enclave_tcs_cnt || max_threads > UINT32_MAX) {
+        log_error("Cannot parse 'sgx.max_threads' (the value must not be less than "
+                  "'sgx.thread_num')");
+        ocall_exit(1, true);
+    }
+    g_enclave_max_tcs_cnt = g_edmm_enabled ? max_threads : g_enclave_tcs_cnt;
+
     ret = toml_sizestring_in(g_pal_state.manifest_root, "loader.pal_internal_mem_size",
                              /*defaultval=*/0, &g_pal_internal_mem_size);
     if (ret < 0) {
@@ -707,6 +869,16 @@ noreturn void pal_linux_main(char* uptr_libpal_uri, size_t libpal_uri_len, char*
         ocall_exit(1, true);
     }
 
+    if ((ret = init_rpc_policy()) < 0) {
+        log_error("Failed to initialize the exitless policy: %d", ret);
+        ocall_exit(1, true);
+    }
+
+    if ((ret = init_untrusted_io_pool()) < 0) {
+        log_error("Failed to initialize the untrusted I/O buffer pool: %d", ret);
+        ocall_exit(1, true);
+    }
+
     if ((ret = init_file_check_policy()) < 0) {
         log_error("Failed to load the file check policy: %d", ret);
         ocall_exit(1, true);
@@ -721,11 +893,13 @@ noreturn void pal_linux_main(char* uptr_libpal_uri, size_t libpal_uri_len, char*
         log_error("Failed to initialize trusted files: %d", ret);
         ocall_exit(1, true);
     }
+    _DkStartupTrace("PAL: trusted and allowed files initialized");
 
     if ((ret = init_protected_files()) < 0) {
         log_error("Failed to initialize protected files: %d", ret);
         ocall_exit(1, true);
     }
+    _DkStartupTrace("PAL: protected files initialized");
 
     /* set up thread handle */
     PAL_HANDLE first_thread = malloc(HANDLE_SIZE(thread));
@@ -751,6 +925,11 @@ noreturn void pal_linux_main(char* uptr_libpal_uri, size_t libpal_uri_len, char*
     assert(!g_pal_sec.enclave_flags); /* currently only PAL_ENCLAVE_INITIALIZED */
     g_pal_sec.enclave_flags |= PAL_ENCLAVE_INITIALIZED;
 
+    if (preheat_enclave) {
+        preheat_enclave_heap(preheat_threads_num, preheat_background);
+        _DkStartupTrace("PAL: enclave heap preheated");
+    }
+
     /* call main function */
     pal_main(instance_id, parent, first_thread, arguments, environments);
 }
@@ -6,6 +6,7 @@
  */
 
 #include "api.h"
+#include "enclave_lazy_map.h"
 #include "enclave_pages.h"
 #include "pal.h"
 #include "pal_defs.h"
@@ -15,9 +16,22 @@
 #include "pal_linux.h"
 #include "pal_linux_defs.h"
 #include "pal_security.h"
+#include "sgx_arch.h"
 
 extern struct atomic_int g_allocated_pages;
 
+uint64_t pal_prot_to_sgx_prot(int prot) {
+    /* EPCM does not allow write-only pages */
+    uint64_t sgx_prot = 0;
+    if (prot & (PAL_PROT_READ | PAL_PROT_WRITE))
+        sgx_prot |= SGX_SECINFO_FLAGS_R;
+    if (prot & PAL_PROT_WRITE)
+        sgx_prot |= SGX_SECINFO_FLAGS_W;
+    if (prot & PAL_PROT_EXEC)
+        sgx_prot |= SGX_SECINFO_FLAGS_X;
+    return sgx_prot;
+}
+
 bool _DkCheckMemoryMappable(const void* addr, size_t size) {
     if (addr < DATA_END && addr + size > TEXT_START) {
         log_error("Address %p-%p is not mappable", addr, addr + size);
@@ -39,17 +53,9 @@ int _DkVirtualMemoryAlloc(void** paddr, uint64_t size, int alloc_type, int prot)
     if (!size)
         return -PAL_ERROR_INVAL;
 
-    void* addr = *paddr;
-
-    void* mem = get_enclave_pages(addr, size, alloc_type & PAL_ALLOC_INTERNAL);
-    if (!mem)
-        return addr ? -PAL_ERROR_DENIED : -PAL_ERROR_NOMEM;
-
-    /* initialize contents of new memory region to zero (LibOS layer expects zeroed-out memory) */
-    memset(mem, 0, size);
-
-    *paddr = mem;
-    return 0;
+    /* LibOS expects zeroed-out memory; only pages which may have been used before are zeroed (so
+     * that e.g. a huge anonymous mapping does not touch all its pages) */
+    return get_enclave_pages_zeroed(paddr, size, alloc_type & PAL_ALLOC_INTERNAL);
 }
 
 int _DkVirtualMemoryFree(void* addr, uint64_t size) {
@@ -66,12 +72,12 @@ int _DkVirtualMemoryFree(void* addr, uint64_t size) {
 }
 
 int _DkVirtualMemoryProtect(void* addr, uint64_t size, int prot) {
-    __UNUSED(addr);
-    __UNUSED(size);
-    __UNUSED(prot);
-
     assert(WITHIN_MASK(prot, PAL_PROT_MASK));
 
+    if (g_edmm_enabled && addr >= g_pal_sec.heap_min && addr + size <= g_pal_sec.heap_max) {
+        return protect_enclave_pages(addr, size, pal_prot_to_sgx_prot(prot));
+    }
+
     static struct atomic_int at_cnt = {.counter = 0};
     int64_t t = 0;
     if (__atomic_compare_exchange_n(&at_cnt.counter, &t, 1, /*weak=*/false, __ATOMIC_SEQ_CST,
@@ -80,6 +86,14 @@ int _DkVirtualMemoryProtect(void* addr, uint64_t size, int prot) {
     return 0;
 }
 
+int _DkVirtualMemoryDiscard(void* addr, uint64_t size, int prot) {
+    /* without lazily committed pages, trimmed pages would have to be committed again right away */
+    if (!g_lazy_map_enabled || addr < g_pal_sec.heap_min || addr + size > g_pal_sec.heap_max)
+        return -PAL_ERROR_NOTIMPLEMENTED;
+
+    return discard_enclave_pages(addr, size, pal_prot_to_sgx_prot(prot));
+}
+
 uint64_t _DkMemoryQuota(void) {
     return g_pal_sec.heap_max - g_pal_sec.heap_min;
 }
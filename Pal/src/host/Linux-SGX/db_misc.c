@@ -22,18 +22,31 @@
 #include "pal_linux.h"
 #include "pal_linux_defs.h"
 #include "pal_security.h"
-#include "seqlock.h"
 #include "sgx_api.h"
 #include "sgx_attest.h"
 #include "spinlock.h"
 #include "toml.h"
 
 #define TSC_REFINE_INIT_TIMEOUT_USECS 10000000
+/* the baseline is refreshed by a single thread once it is this old, so that other threads never
+ * hit TSC_REFINE_INIT_TIMEOUT_USECS and never have to do the OCALL themselves */
+#define TSC_RESYNC_USECS (TSC_REFINE_INIT_TIMEOUT_USECS / 2)
 
 uint64_t g_tsc_hz = 0; /* TSC frequency for fast and accurate time ("invariant TSC" HW feature) */
-static uint64_t g_start_tsc = 0;
-static uint64_t g_start_usec = 0;
-static seqlock_t g_tsc_lock = INIT_SEQLOCK_UNLOCKED;
+
+/*
+ * Baseline TSC/usec pair. The thread refreshing it writes the slot not in use and then bumps
+ * `g_tsc_base_gen`, whose lowest bit selects the current slot. Each thread keeps its own copy of
+ * the baseline in its TLS and re-reads the slot only when the generation changes, so the common
+ * path reads a single shared, rarely written word and takes no locks.
+ */
+struct tsc_base {
+    uint64_t tsc;
+    uint64_t usec;
+};
+static struct tsc_base g_tsc_base[2];
+static uint64_t g_tsc_base_gen = 0;
+static bool g_tsc_resync_in_progress = false;
 
 /**
  * Initialize the data structures used for date/time emulation using TSC
@@ -44,6 +57,54 @@ void init_tsc(void) {
     }
 }
 
+/* Reads the current baseline, returns its generation. A reader racing with two consecutive
+ * refreshes may see a half-written slot, which is caught by re-checking the generation. */
+static uint64_t read_tsc_base(struct tsc_base* out_base) {
+    while (true) {
+        uint64_t gen = __atomic_load_n(&g_tsc_base_gen, __ATOMIC_ACQUIRE);
+        struct tsc_base* slot = &g_tsc_base[gen & 1];
+        out_base->tsc  = __atomic_load_n(&slot->tsc, __ATOMIC_RELAXED);
+        out_base->usec = __atomic_load_n(&slot->usec, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&g_tsc_base_gen, __ATOMIC_RELAXED) - gen < 2)
+            return gen;
+    }
+}
+
+/* Must be called by the thread that set `g_tsc_resync_in_progress`. */
+static void publish_tsc_base(uint64_t tsc, uint64_t usec) {
+    uint64_t gen = __atomic_load_n(&g_tsc_base_gen, __ATOMIC_RELAXED);
+    struct tsc_base* cur = &g_tsc_base[gen & 1];
+    if (cur->tsc >= tsc) {
+        /* a later baseline is already published */
+        return;
+    }
+
+    struct tsc_base* next = &g_tsc_base[(gen + 1) & 1];
+    __atomic_store_n(&next->tsc, tsc, __ATOMIC_RELAXED);
+    __atomic_store_n(&next->usec, usec, __ATOMIC_RELAXED);
+    __atomic_store_n(&g_tsc_base_gen, gen + 1, __ATOMIC_RELEASE);
+}
+
+/* Gets the host time via OCALL, together with the matching TSC value. */
+static int query_host_time(uint64_t* out_tsc, uint64_t* out_usec) {
+    uint64_t tsc_cyc1 = get_tsc();
+    int ret = ocall_gettime(out_usec);
+    if (ret < 0)
+        return -PAL_ERROR_DENIED;
+    uint64_t tsc_cyc2 = get_tsc();
+
+    /* we need to match the OCALL-obtained timestamp (`usec`) with the RDTSC-obtained number of
+     * cycles (`tsc_cyc`); since OCALL is a time-consuming operation, we estimate `tsc_cyc` as a
+     * mid-point between the RDTSC values obtained right-before and right-after the OCALL. */
+    uint64_t tsc_cyc = tsc_cyc1 + (tsc_cyc2 - tsc_cyc1) / 2;
+    if (tsc_cyc < tsc_cyc1)
+        return -PAL_ERROR_OVERFLOW;
+
+    *out_tsc = tsc_cyc;
+    return 0;
+}
+
 /* TODO: result comes from the untrusted host, introduce some schielding */
 int _DkSystemTimeQuery(uint64_t* out_usec) {
     int ret;
@@ -53,22 +114,24 @@ int _DkSystemTimeQuery(uint64_t* out_usec) {
         return ocall_gettime(out_usec);
     }
 
-    uint32_t seq;
-    uint64_t start_tsc;
-    uint64_t start_usec;
-    do {
-        seq = read_seqbegin(&g_tsc_lock);
-        start_tsc  = g_start_tsc;
-        start_usec = g_start_usec;
-    } while (read_seqretry(&g_tsc_lock, seq));
+    struct enclave_tls* tls = get_tcb_trts();
+    if (tls->tsc_base_gen != __atomic_load_n(&g_tsc_base_gen, __ATOMIC_ACQUIRE)) {
+        struct tsc_base base;
+        tls->tsc_base_gen  = read_tsc_base(&base);
+        tls->tsc_base_tsc  = base.tsc;
+        tls->tsc_base_usec = base.usec;
+    }
+    uint64_t start_tsc  = tls->tsc_base_tsc;
+    uint64_t start_usec = tls->tsc_base_usec;
 
     uint64_t usec = 0;
+    uint64_t diff_usec = 0;
     if (start_tsc > 0 && start_usec > 0) {
         /* baseline TSC/usec pair was initialized, can calculate time via RDTSC (but should be
          * careful with integer overflow during calculations) */
         uint64_t diff_tsc = get_tsc() - start_tsc;
         if (diff_tsc < UINT64_MAX / 1000000) {
-            uint64_t diff_usec = diff_tsc * 1000000 / g_tsc_hz;
+            diff_usec = diff_tsc * 1000000 / g_tsc_hz;
             if (diff_usec < TSC_REFINE_INIT_TIMEOUT_USECS) {
                 /* less than TSC_REFINE_INIT_TIMEOUT_USECS passed from the previous update of
                  * TSC/usec pair (time drift is contained), use the RDTSC-calculated time */
@@ -79,88 +142,98 @@ int _DkSystemTimeQuery(uint64_t* out_usec) {
         }
     }
 
-    if (usec) {
+    if (usec && diff_usec < TSC_RESYNC_USECS) {
         *out_usec = usec;
         return 0;
     }
 
-    /* if we are here, either the baseline TSC/usec pair was not yet initialized or too much time
-     * passed since the previous TSC/usec update, so let's refresh them to contain the time drift */
-    uint64_t tsc_cyc1 = get_tsc();
-    ret = ocall_gettime(&usec);
-    if (ret < 0)
-        return -PAL_ERROR_DENIED;
-    uint64_t tsc_cyc2 = get_tsc();
-
-    /* we need to match the OCALL-obtained timestamp (`usec`) with the RDTSC-obtained number of
-     * cycles (`tsc_cyc`); since OCALL is a time-consuming operation, we estimate `tsc_cyc` as a
-     * mid-point between the RDTSC values obtained right-before and right-after the OCALL. */
-    uint64_t tsc_cyc = tsc_cyc1 + (tsc_cyc2 - tsc_cyc1) / 2;
-    if (tsc_cyc < tsc_cyc1)
-        return -PAL_ERROR_OVERFLOW;
-
-    /* refresh the baseline data if no other thread updated g_start_tsc */
-    write_seqbegin(&g_tsc_lock);
-    if (g_start_tsc < tsc_cyc) {
-        g_start_tsc  = tsc_cyc;
-        g_start_usec = usec;
+    /* the baseline is either getting old (then only one thread refreshes it, others still use it)
+     * or it is unusable (then every thread has to ask the host, but only one publishes the result) */
+    bool resync = !__atomic_exchange_n(&g_tsc_resync_in_progress, true, __ATOMIC_ACQUIRE);
+    if (!resync && usec) {
+        *out_usec = usec;
+        return 0;
     }
-    write_seqend(&g_tsc_lock);
+
+    uint64_t tsc;
+    ret = query_host_time(&tsc, &usec);
+    if (ret == 0 && resync)
+        publish_tsc_base(tsc, usec);
+    if (resync)
+        __atomic_store_n(&g_tsc_resync_in_progress, false, __ATOMIC_RELEASE);
+    if (ret < 0)
+        return ret;
 
     *out_usec = usec;
     return 0;
 }
 
+int _DkSystemTimeBaseQuery(PAL_TSC_TIME_BASE* base) {
+    if (!g_tsc_hz)
+        return -PAL_ERROR_NOTIMPLEMENTED;
+
+    struct tsc_base cur;
+    read_tsc_base(&cur);
+    if (!cur.tsc || !cur.usec)
+        return -PAL_ERROR_TRYAGAIN;
+
+    base->tsc_hz    = g_tsc_hz;
+    base->base_tsc  = cur.tsc;
+    base->base_usec = cur.usec;
+    /* same limits as in _DkSystemTimeQuery() */
+    base->max_tsc_delta = MIN(TSC_REFINE_INIT_TIMEOUT_USECS * (g_tsc_hz / 1000000),
+                              UINT64_MAX / 1000000);
+    return 0;
+}
+
 #define CPUID_CACHE_SIZE 64 /* cache only 64 distinct CPUID entries; sufficient for most apps */
 static struct pal_cpuid {
     unsigned int leaf, subleaf;
     unsigned int values[4];
 } g_pal_cpuid_cache[CPUID_CACHE_SIZE];
 
+/* Entries are only ever appended, so lookups (done on each emulated CPUID, i.e. in the #UD handler)
+ * need no lock: an entry is complete before `g_pal_cpuid_cache_top` covers it. */
 static int g_pal_cpuid_cache_top   = 0;
 static spinlock_t g_cpuid_cache_lock = INIT_SPINLOCK_UNLOCKED;
 
 static int get_cpuid_from_cache(unsigned int leaf, unsigned int subleaf, unsigned int values[4]) {
-    int ret = -PAL_ERROR_DENIED;
-
-    spinlock_lock(&g_cpuid_cache_lock);
-    for (int i = 0; i < g_pal_cpuid_cache_top; i++) {
+    int top = __atomic_load_n(&g_pal_cpuid_cache_top, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < top; i++) {
         if (g_pal_cpuid_cache[i].leaf == leaf && g_pal_cpuid_cache[i].subleaf == subleaf) {
             values[0] = g_pal_cpuid_cache[i].values[0];
             values[1] = g_pal_cpuid_cache[i].values[1];
             values[2] = g_pal_cpuid_cache[i].values[2];
             values[3] = g_pal_cpuid_cache[i].values[3];
-            ret = 0;
-            break;
+            return 0;
         }
     }
-    spinlock_unlock(&g_cpuid_cache_lock);
-    return ret;
+    return -PAL_ERROR_DENIED;
 }
 
 static void add_cpuid_to_cache(unsigned int leaf, unsigned int subleaf, unsigned int values[4]) {
     spinlock_lock(&g_cpuid_cache_lock);
 
-    struct pal_cpuid* chosen = NULL;
-    if (g_pal_cpuid_cache_top < CPUID_CACHE_SIZE) {
-        for (int i = 0; i < g_pal_cpuid_cache_top; i++) {
-            if (g_pal_cpuid_cache[i].leaf == leaf && g_pal_cpuid_cache[i].subleaf == subleaf) {
-                /* this CPUID entry is already present in the cache, no need to add */
-                break;
-            }
+    int top = g_pal_cpuid_cache_top;
+    for (int i = 0; i < top; i++) {
+        if (g_pal_cpuid_cache[i].leaf == leaf && g_pal_cpuid_cache[i].subleaf == subleaf) {
+            /* this CPUID entry is already present in the cache, no need to add */
+            goto out;
         }
-        chosen = &g_pal_cpuid_cache[g_pal_cpuid_cache_top++];
     }
 
-    if (chosen) {
+    if (top < CPUID_CACHE_SIZE) {
+        struct pal_cpuid* chosen = &g_pal_cpuid_cache[top];
         chosen->leaf      = leaf;
         chosen->subleaf   = subleaf;
         chosen->values[0] = values[0];
         chosen->values[1] = values[1];
         chosen->values[2] = values[2];
         chosen->values[3] = values[3];
+        __atomic_store_n(&g_pal_cpuid_cache_top, top + 1, __ATOMIC_RELEASE);
     }
 
+out:
     spinlock_unlock(&g_cpuid_cache_lock);
 }
 
@@ -179,6 +252,19 @@ void init_cpuid(void) {
     memset(&target_info, 0, sizeof(target_info));
     memset(&report_data, 0, sizeof(report_data));
     sgx_report(&target_info, &report_data, &report);
+
+    /* Fill the cache with the (cacheable) leaves that runtimes and libraries query at startup for
+     * feature detection, so that their emulation after #UD needs no OCALL. */
+    static const struct {
+        unsigned int leaf, subleaf;
+    } hot_leaves[] = {
+        {0x00, 0}, {0x07, 0}, {0x07, 1}, {0x0D, 0}, {0x0D, 1},
+        {0x80000000, 0}, {0x80000001, 0}, {0x80000007, 0}, {0x80000008, 0},
+    };
+    for (size_t i = 0; i < ARRAY_SIZE(hot_leaves); i++) {
+        unsigned int values[4];
+        (void)_DkCpuIdRetrieve(hot_leaves[i].leaf, hot_leaves[i].subleaf, values);
+    }
 }
 
 /**
@@ -477,12 +563,105 @@ out:
     return 0;
 }
 
+/* Recently generated quotes, keyed by report data. Getting a quote takes a round trip to the
+ * AESM/quoting enclave, while e.g. RA-TLS regenerates a quote for the same key repeatedly. */
+#define QUOTE_CACHE_SIZE 8
+
+struct cached_quote {
+    sgx_report_data_t report_data;
+    char* quote; /* NULL if the slot is unused */
+    size_t quote_size;
+    uint64_t expiry_usec;
+};
+
+static struct cached_quote g_quote_cache[QUOTE_CACHE_SIZE];
+static spinlock_t g_quote_cache_lock = INIT_SPINLOCK_UNLOCKED;
+
+/* Copies a cached, not yet expired quote for `report_data` into `quote`. Returns -PAL_ERROR_NOMEM
+ * (and the required size in `*quote_size`) if `quote` is too small, 0 on success and a positive
+ * value if there is no such quote. */
+static int get_cached_quote(const sgx_report_data_t* report_data, uint64_t now_usec, void* quote,
+                            size_t* quote_size) {
+    int ret = 1;
+    spinlock_lock(&g_quote_cache_lock);
+    for (size_t i = 0; i < QUOTE_CACHE_SIZE; i++) {
+        struct cached_quote* cq = &g_quote_cache[i];
+        if (!cq->quote || cq->expiry_usec <= now_usec
+                || memcmp(&cq->report_data, report_data, sizeof(*report_data)))
+            continue;
+
+        if (*quote_size < cq->quote_size) {
+            ret = -PAL_ERROR_NOMEM;
+        } else {
+            /* quote may be NULL if caller only wants to know the size of the quote */
+            if (quote)
+                memcpy(quote, cq->quote, cq->quote_size);
+            ret = 0;
+        }
+        *quote_size = cq->quote_size;
+        break;
+    }
+    spinlock_unlock(&g_quote_cache_lock);
+    return ret;
+}
+
+/* Takes ownership of `quote`. Replaces the entry for the same report data, an unused one or the one
+ * expiring first. */
+static void cache_quote(const sgx_report_data_t* report_data, char* quote, size_t quote_size,
+                        uint64_t expiry_usec) {
+    spinlock_lock(&g_quote_cache_lock);
+    struct cached_quote* victim = &g_quote_cache[0];
+    for (size_t i = 0; i < QUOTE_CACHE_SIZE; i++) {
+        struct cached_quote* cq = &g_quote_cache[i];
+        if (cq->quote && !memcmp(&cq->report_data, report_data, sizeof(*report_data))) {
+            victim = cq;
+            break;
+        }
+        if (!cq->quote) {
+            if (victim->quote)
+                victim = cq;
+        } else if (victim->quote && cq->expiry_usec < victim->expiry_usec) {
+            victim = cq;
+        }
+    }
+
+    char* old_quote = victim->quote;
+    memcpy(&victim->report_data, report_data, sizeof(*report_data));
+    victim->quote       = quote;
+    victim->quote_size  = quote_size;
+    victim->expiry_usec = expiry_usec;
+    spinlock_unlock(&g_quote_cache_lock);
+
+    free(old_quote);
+}
+
 int _DkAttestationQuote(const PAL_PTR user_report_data, PAL_NUM user_report_data_size,
                         PAL_PTR quote, PAL_NUM* quote_size) {
     if (user_report_data_size != sizeof(sgx_report_data_t))
         return -PAL_ERROR_INVAL;
 
     int ret;
+    uint64_t now_usec = 0;
+
+    int64_t cache_ttl_ms;
+    ret = toml_int_in(g_pal_state.manifest_root, "sgx.quote_cache_ttl_ms", /*defaultval=*/0,
+                      &cache_ttl_ms);
+    if (ret < 0 || cache_ttl_ms < 0) {
+        log_error("Cannot parse 'sgx.quote_cache_ttl_ms' (the value must be a non-negative "
+                  "integer)");
+        return -PAL_ERROR_INVAL;
+    }
+
+    if (cache_ttl_ms) {
+        ret = _DkSystemTimeQuery(&now_usec);
+        if (ret < 0)
+            return ret;
+
+        ret = get_cached_quote(user_report_data, now_usec, quote, quote_size);
+        if (ret <= 0)
+            return ret;
+    }
+
     bool is_epid;
     sgx_spid_t spid = {0};
     bool linkable;
@@ -549,26 +728,40 @@ int _DkAttestationQuote(const PAL_PTR user_report_data, PAL_NUM user_report_data
         return ret;
 
     if (*quote_size < pal_quote_size) {
-        *quote_size = pal_quote_size;
-        free(pal_quote);
-        return -PAL_ERROR_NOMEM;
+        ret = -PAL_ERROR_NOMEM;
+    } else {
+        if (quote) {
+            /* quote may be NULL if caller only wants to know the size of the quote */
+            assert(pal_quote);
+            memcpy(quote, pal_quote, pal_quote_size);
+        }
+        ret = 0;
     }
+    *quote_size = pal_quote_size;
 
-    if (quote) {
-        /* quote may be NULL if caller only wants to know the size of the quote */
-        assert(pal_quote);
-        memcpy(quote, pal_quote, pal_quote_size);
+    /* also cached if the caller's buffer was too small: the caller typically asks again, with a
+     * large enough buffer */
+    if (cache_ttl_ms) {
+        cache_quote(user_report_data, pal_quote, pal_quote_size,
+                    now_usec + (uint64_t)cache_ttl_ms * 1000);
+    } else {
+        free(pal_quote);
     }
-
-    *quote_size = pal_quote_size;
-    free(pal_quote);
-    return 0;
+    return ret;
 }
 
 int _DkSetProtectedFilesKey(const PAL_PTR pf_key_hex) {
     return set_protected_files_key(pf_key_hex);
 }
 
+bool g_startup_trace_enabled = false;
+
+void _DkStartupTrace(const char* phase) {
+    /* the host timestamps the mark, so that all marks share one clock */
+    if (g_startup_trace_enabled)
+        ocall_startup_trace(phase);
+}
+
 /* Rest is moved from old `db_main-x86_64.c`. */
 
 #define FOUR_CHARS_VALUE(s, w)      \
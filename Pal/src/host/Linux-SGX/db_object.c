@@ -18,6 +18,17 @@
 #include "pal_linux_defs.h"
 #include "pal_linux_error.h"
 
+/* In-enclave pipe channels ring the doorbell on the host FD only while it is watched, see
+ * "Pal/src/host/Linux-SGX/db_pipes.c". */
+static bool is_local_pipe(PAL_HANDLE handle) {
+    if (PAL_GET_TYPE(handle) != PAL_TYPE_PIPE && PAL_GET_TYPE(handle) != PAL_TYPE_PIPECLI)
+        return false;
+    /* the handshake decides whether the channel is used (the peer may write to it right after) */
+    while (!__atomic_load_n(&handle->pipe.handshake_done, __ATOMIC_ACQUIRE))
+        CPU_RELAX();
+    return handle->pipe.local;
+}
+
 /* TODO: this should take into account `handle->pipe.handshake_done`. For more details see
  * "Pal/src/host/Linux-SGX/db_pipes.c". */
 /* Wait for specific events on all handles in the handle array and return multiple events
@@ -49,6 +60,9 @@ int _DkStreamsWaitEvents(size_t count, PAL_HANDLE* handle_array, PAL_FLG* events
         if (!hdl)
             continue;
 
+        if ((events[i] & PAL_WAIT_READ) && is_local_pipe(hdl))
+            pipe_local_watch(hdl, /*watch=*/true);
+
         /* collect all internal-handle FDs (only those which are readable/writable) */
         for (size_t j = 0; j < MAX_FDS; j++) {
             PAL_FLG flags = HANDLE_HDR(hdl)->flags;
@@ -119,7 +133,208 @@ int _DkStreamsWaitEvents(size_t count, PAL_HANDLE* handle_array, PAL_FLG* events
 
     ret = 0;
 out:
+    for (size_t i = 0; i < count; i++)
+        if (handle_array[i] && (events[i] & PAL_WAIT_READ) && is_local_pipe(handle_array[i]))
+            pipe_local_watch(handle_array[i], /*watch=*/false);
     free(fds);
     free(offsets);
     return ret;
 }
+
+/* Upper bound on host events fetched by one _DkWaitSetWait(), to bound its untrusted stack use. */
+#define WAITSET_MAX_EVENTS 1024
+
+/*
+ * Trusted copy of a wait set's registrations, indexed by host FD. The host epoll instance only
+ * carries the FD as event data, so a malicious host can at worst report spurious readiness of a
+ * registered handle; the cookies (which the LibOS may use as pointers) never leave the enclave.
+ */
+struct waitset_entry {
+    uint64_t cookie;
+    PAL_FLG events; /* 0 if the FD is not in the wait set */
+};
+
+int _DkWaitSetCreate(PAL_HANDLE* handle) {
+    PAL_HANDLE set = malloc(HANDLE_SIZE(waitset));
+    if (!set)
+        return -PAL_ERROR_NOMEM;
+
+    int fd = ocall_epoll_create();
+    if (fd < 0) {
+        free(set);
+        return unix_to_pal_error(fd);
+    }
+
+    init_handle_hdr(HANDLE_HDR(set), PAL_TYPE_WAITSET);
+    set->waitset.fd = fd;
+    spinlock_init(&set->waitset.lock);
+    set->waitset.entries = NULL;
+    set->waitset.entries_cnt = 0;
+    *handle = set;
+    return 0;
+}
+
+/* Sets the registration of `fd`, returns its previous events in `old_events` if not NULL. */
+static int set_waitset_entry(PAL_HANDLE set, int fd, uint64_t cookie, PAL_FLG events,
+                             PAL_FLG* old_events) {
+    spinlock_lock(&set->waitset.lock);
+
+    struct waitset_entry* entries = set->waitset.entries;
+    size_t cnt = set->waitset.entries_cnt;
+    if (old_events)
+        *old_events = (size_t)fd < cnt ? entries[fd].events : 0;
+    if ((size_t)fd >= cnt) {
+        if (!events) {
+            spinlock_unlock(&set->waitset.lock);
+            return 0;
+        }
+
+        size_t new_cnt = MAX(MAX(cnt * 2, (size_t)fd + 1), (size_t)64);
+        struct waitset_entry* new_entries = calloc(new_cnt, sizeof(*new_entries));
+        if (!new_entries) {
+            spinlock_unlock(&set->waitset.lock);
+            return -PAL_ERROR_NOMEM;
+        }
+        if (entries)
+            memcpy(new_entries, entries, cnt * sizeof(*entries));
+        free(entries);
+        entries = new_entries;
+        set->waitset.entries = new_entries;
+        set->waitset.entries_cnt = new_cnt;
+    }
+
+    entries[fd].cookie = cookie;
+    entries[fd].events = events;
+
+    spinlock_unlock(&set->waitset.lock);
+    return 0;
+}
+
+int _DkWaitSetUpdate(PAL_HANDLE set, PAL_HANDLE handle, PAL_FLG events, uint64_t cookie) {
+    PAL_FLG flags = HANDLE_HDR(handle)->flags;
+
+    for (size_t j = 0; j < MAX_FDS; j++) {
+        /* only FDs marked readable/writable are valid, `fds[j]` may alias other fields otherwise */
+        if (!(flags & (RFD(j) | WFD(j))) || handle->generic.fds[j] == PAL_IDX_POISON)
+            continue;
+
+        int fd = handle->generic.fds[j];
+        if (fd < 0)
+            return -PAL_ERROR_INVAL;
+
+        PAL_FLG fd_events = 0;
+        fd_events |= (flags & RFD(j)) ? (events & PAL_WAIT_READ) : 0;
+        fd_events |= (flags & WFD(j)) ? (events & PAL_WAIT_WRITE) : 0;
+
+        int ret;
+        PAL_FLG old_events;
+        if (!fd_events) {
+            /* forget the cookie first, so that a racing wait cannot report it after we return */
+            ret = set_waitset_entry(set, fd, 0, 0, &old_events);
+            if (ret < 0)
+                return ret;
+            if ((old_events & PAL_WAIT_READ) && is_local_pipe(handle))
+                pipe_local_watch(handle, /*watch=*/false);
+            ret = ocall_epoll_ctl(set->waitset.fd, EPOLL_CTL_DEL, fd, 0, 0);
+            if (ret < 0 && ret != -ENOENT)
+                return unix_to_pal_error(ret);
+            continue;
+        }
+
+        ret = set_waitset_entry(set, fd, cookie, fd_events, &old_events);
+        if (ret < 0)
+            return ret;
+
+        uint32_t host_events = 0;
+        host_events |= (fd_events & PAL_WAIT_READ) ? EPOLLIN : 0;
+        host_events |= (fd_events & PAL_WAIT_WRITE) ? EPOLLOUT : 0;
+        host_events |= (events & PAL_WAIT_EDGE) ? EPOLLET : 0;
+        ret = ocall_epoll_ctl(set->waitset.fd, EPOLL_CTL_MOD, fd, host_events, fd);
+        if (ret == -ENOENT)
+            ret = ocall_epoll_ctl(set->waitset.fd, EPOLL_CTL_ADD, fd, host_events, fd);
+        if (ret < 0) {
+            set_waitset_entry(set, fd, 0, 0, /*old_events=*/NULL);
+            if ((old_events & PAL_WAIT_READ) && is_local_pipe(handle))
+                pipe_local_watch(handle, /*watch=*/false);
+            return unix_to_pal_error(ret);
+        }
+
+        /* the registration lasts until removed (a wait set that is closed with the handle still in
+         * it only leaves the doorbell of the channel on) */
+        bool was_read = old_events & PAL_WAIT_READ;
+        bool is_read  = fd_events & PAL_WAIT_READ;
+        if (was_read != is_read && is_local_pipe(handle))
+            pipe_local_watch(handle, /*watch=*/is_read);
+    }
+
+    return 0;
+}
+
+int _DkWaitSetWait(PAL_HANDLE set, size_t* count, uint64_t* cookies, PAL_FLG* ret_events,
+                   int64_t timeout_us) {
+    size_t max_events = MIN(*count, (size_t)WAITSET_MAX_EVENTS);
+    struct epoll_event* evs = malloc(max_events * sizeof(*evs));
+    if (!evs)
+        return -PAL_ERROR_NOMEM;
+
+    int ret;
+    size_t n = 0;
+    /* retry if all reported FDs were removed concurrently (or the host made them up) */
+    while (!n) {
+        /* TODO: Timeout must be updated in case of retries; otherwise, we may wait for too long */
+        ret = ocall_epoll_wait(set->waitset.fd, evs, max_events, timeout_us);
+        if (ret < 0) {
+            ret = unix_to_pal_error(ret);
+            goto out;
+        }
+        if (!ret) {
+            /* timed out */
+            ret = -PAL_ERROR_TRYAGAIN;
+            goto out;
+        }
+
+        spinlock_lock(&set->waitset.lock);
+        struct waitset_entry* entries = set->waitset.entries;
+        for (int i = 0; i < ret; i++) {
+            uint64_t fd = evs[i].data;
+            if (fd >= set->waitset.entries_cnt || !entries[fd].events)
+                continue;
+
+            PAL_FLG revents = 0;
+            if (evs[i].events & EPOLLIN)
+                revents |= PAL_WAIT_READ;
+            if (evs[i].events & EPOLLOUT)
+                revents |= PAL_WAIT_WRITE;
+            revents &= entries[fd].events;
+            if (evs[i].events & (EPOLLHUP | EPOLLERR))
+                revents |= PAL_WAIT_ERROR;
+            if (!revents)
+                continue;
+
+            cookies[n] = entries[fd].cookie;
+            ret_events[n] = revents;
+            n++;
+        }
+        spinlock_unlock(&set->waitset.lock);
+    }
+
+    *count = n;
+    ret = 0;
+out:
+    free(evs);
+    return ret;
+}
+
+static int waitset_close(PAL_HANDLE handle) {
+    if (handle->waitset.fd != PAL_IDX_POISON) {
+        ocall_close(handle->waitset.fd);
+        handle->waitset.fd = PAL_IDX_POISON;
+    }
+    free(handle->waitset.entries);
+    handle->waitset.entries = NULL;
+    return 0;
+}
+
+struct handle_ops g_waitset_ops = {
+    .close = &waitset_close,
+};
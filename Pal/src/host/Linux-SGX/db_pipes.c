@@ -7,6 +7,8 @@
 
 #include <asm/fcntl.h>
 #include <asm/poll.h>
+#include <limits.h>
+#include <linux/futex.h>
 #include <linux/types.h>
 #include <linux/un.h>
 
@@ -29,6 +31,708 @@ static int pipe_session_key(PAL_PIPE_NAME* name, PAL_SESSION_KEY* session_key) {
                            (uint8_t*)session_key, sizeof(*session_key));
 }
 
+/*
+ * In-enclave channels.
+ *
+ * If both ends of a pipe live in this enclave (e.g. the two ends of `pipe()` or `socketpair()`, or
+ * a UNIX socket connected to a server of the same process), data does not need to leave the
+ * enclave: each direction gets a ring buffer in enclave memory and the TLS session is not used for
+ * data. The host socket connecting the two ends stays open but carries only one-byte "doorbells",
+ * and only while somebody watches the reading end's host FD (a blocking read, DkStreamsWaitEvents()
+ * or a wait set): after publishing new data, the writer checks the watcher count of the ring under
+ * the channel lock and rings the doorbell only if it is non-zero and no doorbell is pending yet. A
+ * new watcher rings it itself if data is already buffered, and the reader consumes it once the ring
+ * is drained. Thus a watched host FD is readable iff its ring is not empty, while a peer that is
+ * busy reading costs the writer no OCALL at all. Writability is always reported; a write to a full
+ * ring fails with TRYAGAIN or sleeps on a futex in untrusted memory until the reader frees space
+ * (or either end goes away).
+ *
+ * The connecting end proposes a channel if the pipe name is listened on in this enclave. It sends
+ * a random token over the (already established) TLS session, and the accepting end answers whether
+ * it found the channel with this token. The token is never visible to the host.
+ *
+ * An end cannot be sent to another process with the data in enclave memory, so before it is
+ * serialized, the channel is demoted: buffered data is pushed through the TLS sessions (whose state
+ * is still in sync, as they carried nothing since the handshake) and both ends fall back to the
+ * regular encrypted path for good.
+ */
+
+#define PIPE_LOCAL_RING_SIZE (64 * 1024)
+
+enum {
+    PIPE_LOCAL_PENDING = 0, /* proposed by the connecting end, not claimed yet */
+    PIPE_LOCAL_ACTIVE,
+    PIPE_LOCAL_DEMOTING,
+    PIPE_LOCAL_DEMOTED,
+};
+
+struct pipe_local_ring {
+    size_t head;
+    size_t used;
+    bool wr_closed;    /* writer shut down or closed its end, EOF once the ring is drained */
+    bool rd_closed;    /* reader shut down or closed its end, writes fail with EPIPE */
+    /* the host socket must signal EOF only after the reader drained the ring, so shutting down
+     * (or closing, if the writer end is already closed) `eof_fd` is deferred until then */
+    int eof_fd;
+    bool eof_fd_owned;
+    void* eof_ssl_ctx;
+    size_t rd_watchers;         /* watchers of the reading end's host FD, see pipe_local_watch() */
+    bool doorbell;              /* a doorbell is pending (or about to be) on the reading end */
+    size_t wr_waiters;          /* writers sleeping on a full ring */
+    uint32_t space_seq;         /* bumped whenever space is freed or the ring is closed */
+    uint32_t* space_untrusted;  /* futex word of the writers, mirrors `space_seq` */
+    char buf[PIPE_LOCAL_RING_SIZE];
+};
+
+struct pipe_local {
+    spinlock_t lock;
+    int state;
+    size_t busy;           /* operations in flight, demotion waits for them */
+    uint64_t token;
+    PAL_HANDLE ends[2];    /* [0] is the connecting end, [1] the accepted one; NULL when closed */
+    struct pipe_local_ring rings[2]; /* `rings[i]` carries data written by `ends[i]` */
+    struct pipe_local* next_pending;
+};
+
+static void pipe_local_dealloc(struct pipe_local* chan) {
+    for (size_t i = 0; i < ARRAY_SIZE(chan->rings); i++)
+        free_untrusted(chan->rings[i].space_untrusted);
+    free(chan);
+}
+
+struct pipe_local_listener {
+    PAL_HANDLE srv;
+    struct pipe_local_listener* next;
+};
+
+/* protects `g_pipe_local_listeners` and `g_pipe_local_pending` */
+static spinlock_t g_pipe_local_lock = INIT_SPINLOCK_UNLOCKED;
+static struct pipe_local_listener* g_pipe_local_listeners = NULL;
+static struct pipe_local* g_pipe_local_pending = NULL;
+
+static void pipe_local_add_listener(PAL_HANDLE srv) {
+    /* the registry is only a hint for the connecting end, so allocation failure is not an error */
+    struct pipe_local_listener* listener = malloc(sizeof(*listener));
+    if (!listener)
+        return;
+
+    listener->srv = srv;
+    spinlock_lock(&g_pipe_local_lock);
+    listener->next = g_pipe_local_listeners;
+    g_pipe_local_listeners = listener;
+    spinlock_unlock(&g_pipe_local_lock);
+}
+
+static void pipe_local_remove_listener(PAL_HANDLE srv) {
+    spinlock_lock(&g_pipe_local_lock);
+    for (struct pipe_local_listener** pos = &g_pipe_local_listeners; *pos; pos = &(*pos)->next) {
+        if ((*pos)->srv == srv) {
+            struct pipe_local_listener* listener = *pos;
+            *pos = listener->next;
+            free(listener);
+            break;
+        }
+    }
+    spinlock_unlock(&g_pipe_local_lock);
+}
+
+/* Called by the connecting end; sets `handle->pipe.local` if the other end may be in this enclave
+ * (the accepting end may still have moved to a child process, the negotiation decides). */
+static void pipe_local_propose(PAL_HANDLE handle) {
+    bool listened = false;
+    spinlock_lock(&g_pipe_local_lock);
+    for (struct pipe_local_listener* listener = g_pipe_local_listeners; listener;
+             listener = listener->next) {
+        if (!memcmp(&listener->srv->pipe.name, &handle->pipe.name, sizeof(handle->pipe.name))) {
+            listened = true;
+            break;
+        }
+    }
+    spinlock_unlock(&g_pipe_local_lock);
+    if (!listened)
+        return;
+
+    struct pipe_local* chan = malloc(sizeof(*chan));
+    if (!chan)
+        return;
+
+    for (size_t i = 0; i < ARRAY_SIZE(chan->rings); i++)
+        chan->rings[i].space_untrusted = NULL;
+    for (size_t i = 0; i < ARRAY_SIZE(chan->rings); i++) {
+        chan->rings[i].space_untrusted = malloc_untrusted(sizeof(uint32_t));
+        if (!chan->rings[i].space_untrusted) {
+            pipe_local_dealloc(chan);
+            return;
+        }
+    }
+
+    do {
+        if (_DkRandomBitsRead(&chan->token, sizeof(chan->token)) < 0) {
+            pipe_local_dealloc(chan);
+            return;
+        }
+    } while (!chan->token);
+
+    spinlock_init(&chan->lock);
+    chan->state = PIPE_LOCAL_PENDING;
+    chan->busy  = 0;
+    chan->ends[0] = handle;
+    chan->ends[1] = NULL;
+    for (size_t i = 0; i < ARRAY_SIZE(chan->rings); i++) {
+        struct pipe_local_ring* ring = &chan->rings[i];
+        ring->head = 0;
+        ring->used = 0;
+        ring->wr_closed = false;
+        ring->rd_closed = false;
+        ring->eof_fd = -1;
+        ring->eof_fd_owned = false;
+        ring->eof_ssl_ctx = NULL;
+        ring->rd_watchers = 0;
+        ring->doorbell = false;
+        ring->wr_waiters = 0;
+        ring->space_seq = 0;
+        __atomic_store_n(ring->space_untrusted, 0, __ATOMIC_RELEASE);
+    }
+
+    spinlock_lock(&g_pipe_local_lock);
+    chan->next_pending = g_pipe_local_pending;
+    g_pipe_local_pending = chan;
+    spinlock_unlock(&g_pipe_local_lock);
+
+    handle->pipe.local = chan;
+    handle->pipe.local_side = 0;
+}
+
+static struct pipe_local* pipe_local_unlink_pending(uint64_t token) {
+    struct pipe_local* chan = NULL;
+    spinlock_lock(&g_pipe_local_lock);
+    for (struct pipe_local** pos = &g_pipe_local_pending; *pos; pos = &(*pos)->next_pending) {
+        if ((*pos)->token == token) {
+            chan = *pos;
+            *pos = chan->next_pending;
+            break;
+        }
+    }
+    spinlock_unlock(&g_pipe_local_lock);
+    return chan;
+}
+
+static int pipe_secure_read_all(PAL_HANDLE handle, void* buf, size_t size) {
+    for (size_t done = 0; done < size;) {
+        int ret = _DkStreamSecureRead(handle->pipe.ssl_ctx, (uint8_t*)buf + done, size - done,
+                                      /*is_blocking=*/true);
+        if (ret == -PAL_ERROR_INTERRUPTED || ret == -PAL_ERROR_TRYAGAIN) {
+            /* the host FD may be non-blocking */
+            struct pollfd pfd = {.fd = handle->pipe.fd, .events = POLLIN, .revents = 0};
+            ocall_poll(&pfd, 1, -1);
+            continue;
+        }
+        if (ret <= 0)
+            return ret < 0 ? ret : -PAL_ERROR_CONNFAILED;
+        done += ret;
+    }
+    return 0;
+}
+
+static int pipe_secure_write_all(void* ssl_ctx, int fd, const void* buf, size_t size) {
+    for (size_t done = 0; done < size;) {
+        int ret = _DkStreamSecureWrite(ssl_ctx, (const uint8_t*)buf + done, size - done,
+                                       /*is_blocking=*/true);
+        if (ret == -PAL_ERROR_INTERRUPTED || ret == -PAL_ERROR_TRYAGAIN) {
+            /* the host FD may be non-blocking */
+            struct pollfd pfd = {.fd = fd, .events = POLLOUT, .revents = 0};
+            ocall_poll(&pfd, 1, -1);
+            continue;
+        }
+        if (ret <= 0)
+            return ret < 0 ? ret : -PAL_ERROR_CONNFAILED;
+        done += ret;
+    }
+    return 0;
+}
+
+/* Runs right after the TLS handshake of the connecting end. */
+static int pipe_local_negotiate_connect(PAL_HANDLE handle) {
+    struct pipe_local* chan = handle->pipe.local;
+    uint64_t token = chan ? chan->token : 0;
+    int ret = pipe_secure_write_all(handle->pipe.ssl_ctx, handle->pipe.fd, &token, sizeof(token));
+    if (ret < 0)
+        return ret;
+
+    uint8_t accepted;
+    ret = pipe_secure_read_all(handle, &accepted, sizeof(accepted));
+    if (ret < 0)
+        return ret;
+
+    if (chan && !accepted) {
+        /* the accepting end is not in this enclave (anymore) */
+        pipe_local_unlink_pending(chan->token);
+        pipe_local_dealloc(chan);
+        handle->pipe.local = NULL;
+    }
+    return 0;
+}
+
+/* Runs right after the TLS handshake of the accepting end. */
+static int pipe_local_negotiate_accept(PAL_HANDLE handle) {
+    uint64_t token;
+    int ret = pipe_secure_read_all(handle, &token, sizeof(token));
+    if (ret < 0)
+        return ret;
+
+    struct pipe_local* chan = token ? pipe_local_unlink_pending(token) : NULL;
+    if (chan) {
+        spinlock_lock(&chan->lock);
+        chan->ends[1] = handle;
+        chan->state = PIPE_LOCAL_ACTIVE;
+        spinlock_unlock(&chan->lock);
+        handle->pipe.local = chan;
+        handle->pipe.local_side = 1;
+    }
+
+    uint8_t accepted = !!chan;
+    return pipe_secure_write_all(handle->pipe.ssl_ctx, handle->pipe.fd, &accepted,
+                                 sizeof(accepted));
+}
+
+/* Waits out a demotion in progress. Returns false (with the lock released) if the channel is
+ * demoted, otherwise returns true with the lock held. */
+static bool pipe_local_lock_active(struct pipe_local* chan) {
+    spinlock_lock(&chan->lock);
+    while (chan->state == PIPE_LOCAL_DEMOTING) {
+        spinlock_unlock(&chan->lock);
+        CPU_RELAX();
+        spinlock_lock(&chan->lock);
+    }
+    if (chan->state == PIPE_LOCAL_DEMOTED) {
+        spinlock_unlock(&chan->lock);
+        return false;
+    }
+    return true;
+}
+
+static void pipe_local_unbusy(struct pipe_local* chan) {
+    __atomic_sub_fetch(&chan->busy, 1, __ATOMIC_RELEASE);
+}
+
+static void pipe_local_ring_doorbell(int fd) {
+    char byte = 0;
+    /* may fail only if the reader closed its end concurrently, then nobody needs the doorbell */
+    ocall_send(fd, &byte, sizeof(byte), NULL, 0, NULL, 0);
+}
+
+static void pipe_local_consume_doorbell(int fd) {
+    char byte;
+    while (true) {
+        /* the writer may still be about to send it (or the host FD is non-blocking) */
+        ssize_t ret = ocall_recv(fd, &byte, sizeof(byte), NULL, NULL, NULL, NULL);
+        if (ret == -EAGAIN || ret == -EWOULDBLOCK) {
+            struct pollfd pfd = {.fd = fd, .events = POLLIN, .revents = 0};
+            ocall_poll(&pfd, 1, -1);
+            continue;
+        }
+        if (ret == -EINTR)
+            continue;
+        break;
+    }
+}
+
+/* Must be called with the channel lock held whenever `ring` gets free space or is closed. Returns
+ * true if sleeping writers must be woken up with pipe_local_wake_writers() after unlocking. */
+static bool pipe_local_space_freed(struct pipe_local_ring* ring) {
+    ring->space_seq++;
+    __atomic_store_n(ring->space_untrusted, ring->space_seq, __ATOMIC_RELEASE);
+    return ring->wr_waiters > 0;
+}
+
+static void pipe_local_wake_writers(struct pipe_local_ring* ring) {
+    int ret;
+    do {
+        ret = ocall_futex(ring->space_untrusted, FUTEX_WAKE, INT_MAX, /*timeout=*/NULL);
+    } while (ret == -EINTR);
+    /* a malicious host may skip the wakeup, which is only a DoS */
+}
+
+struct pipe_local_eof {
+    int fd;
+    bool owned;
+    void* ssl_ctx;
+};
+
+/* Takes the deferred EOF of a drained `ring`, must be called with the channel lock held. */
+static void pipe_local_take_eof(struct pipe_local_ring* ring, struct pipe_local_eof* eof) {
+    eof->fd = -1;
+    if (ring->used || ring->eof_fd < 0)
+        return;
+    eof->fd      = ring->eof_fd;
+    eof->owned   = ring->eof_fd_owned;
+    eof->ssl_ctx = ring->eof_ssl_ctx;
+    ring->eof_fd = -1;
+    ring->eof_fd_owned = false;
+    ring->eof_ssl_ctx  = NULL;
+}
+
+static void pipe_local_do_eof(struct pipe_local_eof* eof) {
+    if (eof->fd < 0)
+        return;
+    if (eof->owned) {
+        if (eof->ssl_ctx)
+            _DkStreamSecureFree((LIB_SSL_CONTEXT*)eof->ssl_ctx);
+        ocall_close(eof->fd);
+    } else {
+        ocall_shutdown(eof->fd, SHUT_WR);
+    }
+}
+
+static void pipe_local_ring_copy_out(struct pipe_local_ring* ring, void* buf, size_t size) {
+    size_t first = MIN(size, PIPE_LOCAL_RING_SIZE - ring->head);
+    memcpy(buf, ring->buf + ring->head, first);
+    memcpy((char*)buf + first, ring->buf, size - first);
+    ring->head = (ring->head + size) % PIPE_LOCAL_RING_SIZE;
+    ring->used -= size;
+}
+
+static void pipe_local_ring_copy_in(struct pipe_local_ring* ring, const void* buf, size_t size) {
+    size_t tail  = (ring->head + ring->used) % PIPE_LOCAL_RING_SIZE;
+    size_t first = MIN(size, PIPE_LOCAL_RING_SIZE - tail);
+    memcpy(ring->buf + tail, buf, first);
+    memcpy(ring->buf, (const char*)buf + first, size - first);
+    ring->used += size;
+}
+
+/* Returns false if the channel is demoted and the secure session must be used instead. */
+static bool pipe_local_read(PAL_HANDLE handle, void* buf, size_t size, int64_t* out) {
+    struct pipe_local* chan = handle->pipe.local;
+    struct pipe_local_ring* ring = &chan->rings[!handle->pipe.local_side];
+
+    while (true) {
+        if (!pipe_local_lock_active(chan))
+            return false;
+
+        if (ring->used) {
+            size_t bytes = MIN(size, ring->used);
+            pipe_local_ring_copy_out(ring, buf, bytes);
+            bool doorbell = !ring->used && ring->doorbell;
+            if (doorbell)
+                ring->doorbell = false;
+            bool wake = pipe_local_space_freed(ring);
+            struct pipe_local_eof eof;
+            pipe_local_take_eof(ring, &eof);
+            __atomic_add_fetch(&chan->busy, 1, __ATOMIC_ACQUIRE);
+            spinlock_unlock(&chan->lock);
+
+            if (wake)
+                pipe_local_wake_writers(ring);
+            if (doorbell)
+                pipe_local_consume_doorbell(handle->pipe.fd);
+            pipe_local_do_eof(&eof);
+            pipe_local_unbusy(chan);
+            *out = bytes;
+            return true;
+        }
+
+        if (ring->wr_closed || !size) {
+            spinlock_unlock(&chan->lock);
+            *out = 0;
+            return true;
+        }
+        if (handle->pipe.nonblocking) {
+            spinlock_unlock(&chan->lock);
+            *out = -PAL_ERROR_TRYAGAIN;
+            return true;
+        }
+
+        /* wait for a doorbell (or for the writer end to go away); the ring is empty, so the writer
+         * rings it for the next data seen after our registration */
+        ring->rd_watchers++;
+        spinlock_unlock(&chan->lock);
+
+        struct pollfd pfd = {.fd = handle->pipe.fd, .events = POLLIN, .revents = 0};
+        int ret = ocall_poll(&pfd, 1, -1);
+
+        /* not pipe_local_lock_active(), the channel may have been demoted meanwhile */
+        spinlock_lock(&chan->lock);
+        ring->rd_watchers--;
+        spinlock_unlock(&chan->lock);
+        if (ret < 0) {
+            *out = unix_to_pal_error(ret);
+            return true;
+        }
+    }
+}
+
+/* Returns false if the channel is demoted and the secure session must be used instead. */
+static bool pipe_local_write(PAL_HANDLE handle, const void* buf, size_t size, int64_t* out) {
+    struct pipe_local* chan = handle->pipe.local;
+    struct pipe_local_ring* ring = &chan->rings[handle->pipe.local_side];
+
+    while (true) {
+        if (!pipe_local_lock_active(chan))
+            return false;
+
+        if (ring->rd_closed || ring->wr_closed) {
+            spinlock_unlock(&chan->lock);
+            *out = -PAL_ERROR_CONNFAILED_PIPE;
+            return true;
+        }
+
+        size_t bytes = MIN(size, PIPE_LOCAL_RING_SIZE - ring->used);
+        if (bytes || !size) {
+            pipe_local_ring_copy_in(ring, buf, bytes);
+            /* the data is published, only a reader watching its host FD needs a doorbell */
+            bool doorbell = bytes && ring->rd_watchers && !ring->doorbell;
+            if (doorbell)
+                ring->doorbell = true;
+            __atomic_add_fetch(&chan->busy, 1, __ATOMIC_ACQUIRE);
+            spinlock_unlock(&chan->lock);
+
+            if (doorbell)
+                pipe_local_ring_doorbell(handle->pipe.fd);
+            pipe_local_unbusy(chan);
+            *out = bytes;
+            return true;
+        }
+
+        if (handle->pipe.nonblocking) {
+            spinlock_unlock(&chan->lock);
+            *out = -PAL_ERROR_TRYAGAIN;
+            return true;
+        }
+
+        /* sleep until the reader frees space; `space_seq` is read under the lock, so a wakeup
+         * between unlocking and FUTEX_WAIT is not lost */
+        uint32_t seq = ring->space_seq;
+        ring->wr_waiters++;
+        spinlock_unlock(&chan->lock);
+
+        int ret = ocall_futex(ring->space_untrusted, FUTEX_WAIT, seq, /*timeout=*/NULL);
+
+        /* not pipe_local_lock_active(), the channel may have been demoted meanwhile */
+        spinlock_lock(&chan->lock);
+        ring->wr_waiters--;
+        spinlock_unlock(&chan->lock);
+        if (ret < 0 && ret != -EAGAIN && ret != -EINTR) {
+            *out = unix_to_pal_error(ret);
+            return true;
+        }
+    }
+}
+
+/* Marks one or both directions of `handle` as shut down. Returns the `how` of the host-level
+ * shutdown still to be done (-1 for none). */
+static int pipe_local_shutdown(PAL_HANDLE handle, int how) {
+    struct pipe_local* chan = handle->pipe.local;
+    if (!pipe_local_lock_active(chan))
+        return how;
+
+    struct pipe_local_ring* out_ring = &chan->rings[handle->pipe.local_side];
+    struct pipe_local_ring* in_ring  = &chan->rings[!handle->pipe.local_side];
+    bool shut_rd = how == SHUT_RD || how == SHUT_RDWR;
+    bool shut_wr = how == SHUT_WR || how == SHUT_RDWR;
+
+    bool wake_in = false;
+    bool wake_out = false;
+    if (shut_rd) {
+        in_ring->rd_closed = true;
+        wake_in = pipe_local_space_freed(in_ring);
+    }
+    if (shut_wr) {
+        out_ring->wr_closed = true;
+        wake_out = pipe_local_space_freed(out_ring);
+        if (out_ring->used) {
+            /* the peer gets EOF once it reads the remaining data, see pipe_local_read() */
+            if (out_ring->eof_fd < 0)
+                out_ring->eof_fd = handle->pipe.fd;
+            shut_wr = false;
+        }
+    }
+    spinlock_unlock(&chan->lock);
+
+    if (wake_in)
+        pipe_local_wake_writers(in_ring);
+    if (wake_out)
+        pipe_local_wake_writers(out_ring);
+
+    if (shut_rd && shut_wr)
+        return SHUT_RDWR;
+    return shut_rd ? SHUT_RD : (shut_wr ? SHUT_WR : -1);
+}
+
+/* Returns false if the channel is demoted and the host socket must be queried instead. */
+static bool pipe_local_query(PAL_HANDLE handle, PAL_STREAM_ATTR* attr) {
+    struct pipe_local* chan = handle->pipe.local;
+    if (!pipe_local_lock_active(chan))
+        return false;
+
+    struct pipe_local_ring* out_ring = &chan->rings[handle->pipe.local_side];
+    struct pipe_local_ring* in_ring  = &chan->rings[!handle->pipe.local_side];
+    attr->pending_size = in_ring->used;
+    attr->readable = in_ring->used > 0;
+    attr->writable = out_ring->used < PIPE_LOCAL_RING_SIZE && !out_ring->rd_closed
+                     && !out_ring->wr_closed;
+    spinlock_unlock(&chan->lock);
+    return true;
+}
+
+static void pipe_local_free(struct pipe_local* chan) {
+    for (size_t i = 0; i < ARRAY_SIZE(chan->rings); i++) {
+        struct pipe_local_ring* ring = &chan->rings[i];
+        if (ring->eof_fd >= 0 && ring->eof_fd_owned) {
+            struct pipe_local_eof eof = {.fd = ring->eof_fd, .owned = true,
+                                         .ssl_ctx = ring->eof_ssl_ctx};
+            pipe_local_do_eof(&eof);
+        }
+    }
+    pipe_local_dealloc(chan);
+}
+
+/* Detaches a closing `handle` from its channel. Returns true if the channel took over the host FD
+ * and the SSL context of `handle` (to close them only once the peer drained the data). */
+static bool pipe_local_close(PAL_HANDLE handle) {
+    struct pipe_local* chan = handle->pipe.local;
+    int side = handle->pipe.local_side;
+    struct pipe_local_ring* out_ring = &chan->rings[side];
+    struct pipe_local_ring* in_ring  = &chan->rings[!side];
+
+    bool active = pipe_local_lock_active(chan);
+    if (!active)
+        spinlock_lock(&chan->lock);
+
+    bool handed_over = false;
+    out_ring->wr_closed = true;
+    in_ring->rd_closed  = true;
+    if (active && out_ring->used && chan->ends[!side]) {
+        out_ring->eof_fd       = handle->pipe.fd;
+        out_ring->eof_fd_owned = true;
+        out_ring->eof_ssl_ctx  = handle->pipe.ssl_ctx;
+        handed_over = true;
+    } else if (out_ring->eof_fd == (int)handle->pipe.fd) {
+        /* pending shutdown of our FD, which is closed right away now */
+        out_ring->eof_fd = -1;
+    }
+    bool wake = pipe_local_space_freed(in_ring);
+    chan->ends[side] = NULL;
+    bool last = !chan->ends[!side];
+    spinlock_unlock(&chan->lock);
+
+    handle->pipe.local = NULL;
+    if (last) {
+        pipe_local_free(chan);
+        return handed_over;
+    }
+    /* sleeping writers of the peer now fail with EPIPE (they keep the peer open, so `chan` is
+     * still alive) */
+    if (wake)
+        pipe_local_wake_writers(in_ring);
+    return handed_over;
+}
+
+/*!
+ * \brief Start or stop watching the host FD of an in-enclave channel end for readability.
+ *
+ * The writer of the channel rings the doorbell only while the host FD of the reading end is
+ * watched, so this must bracket every wait for POLLIN on it (and every wait set registration for
+ * it) other than the ones of pipe_local_read(). Does nothing if the channel is demoted, the host FD
+ * carries the data itself then.
+ *
+ * \param handle  PAL handle of type `pipe` or `pipecli` with `pipe.local` set.
+ * \param watch   True to start watching, false to stop.
+ */
+void pipe_local_watch(PAL_HANDLE handle, bool watch) {
+    struct pipe_local* chan = handle->pipe.local;
+    assert(chan);
+    struct pipe_local_ring* ring = &chan->rings[!handle->pipe.local_side];
+
+    if (!pipe_local_lock_active(chan))
+        return;
+
+    int doorbell_fd = -1;
+    if (watch) {
+        ring->rd_watchers++;
+        /* data written before we started watching did not ring the doorbell; the writer's host FD
+         * stays open until the reader drained the ring and consumed the doorbell */
+        if (ring->used && !ring->doorbell) {
+            PAL_HANDLE writer = chan->ends[!handle->pipe.local_side];
+            doorbell_fd = writer ? (int)writer->pipe.fd : ring->eof_fd;
+            ring->doorbell = doorbell_fd >= 0;
+        }
+    } else if (ring->rd_watchers) {
+        ring->rd_watchers--;
+    }
+    __atomic_add_fetch(&chan->busy, 1, __ATOMIC_ACQUIRE);
+    spinlock_unlock(&chan->lock);
+
+    if (doorbell_fd >= 0)
+        pipe_local_ring_doorbell(doorbell_fd);
+    pipe_local_unbusy(chan);
+}
+
+/*!
+ * \brief Move the data of an in-enclave channel to the host and use the secure sessions from now on.
+ *
+ * Must be called before an end of the channel is serialized to be sent to another process.
+ *
+ * \param handle  PAL handle of type `pipe` or `pipecli` with `pipe.local` set.
+ * \return        0 on success, negative PAL error code otherwise.
+ */
+int pipe_local_demote(PAL_HANDLE handle) {
+    struct pipe_local* chan = handle->pipe.local;
+    assert(chan);
+
+    if (!pipe_local_lock_active(chan))
+        return 0;
+
+    chan->state = PIPE_LOCAL_DEMOTING;
+    spinlock_unlock(&chan->lock);
+
+    /* the secure sessions are used below, wait until nothing else uses the channel */
+    for (size_t i = 0; i < ARRAY_SIZE(chan->ends); i++) {
+        PAL_HANDLE end = chan->ends[i];
+        while (end && !__atomic_load_n(&end->pipe.handshake_done, __ATOMIC_ACQUIRE))
+            CPU_RELAX();
+    }
+    while (__atomic_load_n(&chan->busy, __ATOMIC_ACQUIRE))
+        CPU_RELAX();
+
+    int ret = 0;
+    for (size_t i = 0; i < ARRAY_SIZE(chan->rings); i++) {
+        struct pipe_local_ring* ring = &chan->rings[i];
+        PAL_HANDLE writer = chan->ends[i];
+        PAL_HANDLE reader = chan->ends[!i];
+
+        if (ring->doorbell && reader)
+            pipe_local_consume_doorbell(reader->pipe.fd);
+        ring->doorbell = false;
+
+        if (ring->used && reader && ret == 0) {
+            void* ssl_ctx = writer ? writer->pipe.ssl_ctx : ring->eof_ssl_ctx;
+            int fd = writer ? (int)writer->pipe.fd : ring->eof_fd;
+            size_t first = MIN(ring->used, PIPE_LOCAL_RING_SIZE - ring->head);
+            ret = pipe_secure_write_all(ssl_ctx, fd, ring->buf + ring->head, first);
+            if (ret == 0)
+                ret = pipe_secure_write_all(ssl_ctx, fd, ring->buf, ring->used - first);
+        }
+        ring->used = 0;
+
+        struct pipe_local_eof eof;
+        pipe_local_take_eof(ring, &eof);
+        pipe_local_do_eof(&eof);
+    }
+
+    bool wake[ARRAY_SIZE(chan->rings)];
+    spinlock_lock(&chan->lock);
+    chan->state = PIPE_LOCAL_DEMOTED;
+    for (size_t i = 0; i < ARRAY_SIZE(chan->rings); i++)
+        wake[i] = pipe_local_space_freed(&chan->rings[i]);
+    spinlock_unlock(&chan->lock);
+
+    /* sleeping writers retry on the secure session */
+    for (size_t i = 0; i < ARRAY_SIZE(chan->rings); i++)
+        if (wake[i])
+            pipe_local_wake_writers(&chan->rings[i]);
+    return ret;
+}
+
 static int thread_handshake_func(void* param) {
     PAL_HANDLE handle = (PAL_HANDLE)param;
 
@@ -44,6 +748,12 @@ static int thread_handshake_func(void* param) {
         _DkProcessExit(1);
     }
 
+    ret = pipe_local_negotiate_connect(handle);
+    if (ret < 0) {
+        log_error("Failed to initialize secure pipe %s: %d", handle->pipe.name.str, ret);
+        _DkProcessExit(1);
+    }
+
     __atomic_store_n(&handle->pipe.handshake_done, 1, __ATOMIC_RELEASE);
     return 0;
 }
@@ -99,6 +809,10 @@ static int pipe_listen(PAL_HANDLE* handle, const char* name, int options) {
     hdl->pipe.is_server      = false;
     hdl->pipe.handshake_done = 1; /* pipesrv doesn't do any handshake so consider it done */
     memset(hdl->pipe.session_key, 0, sizeof(hdl->pipe.session_key));
+    hdl->pipe.local          = NULL;
+    hdl->pipe.local_side     = 0;
+
+    pipe_local_add_listener(hdl);
 
     *handle = hdl;
     return 0;
@@ -146,6 +860,8 @@ static int pipe_waitforclient(PAL_HANDLE handle, PAL_HANDLE* client) {
     clnt->pipe.ssl_ctx        = NULL;
     clnt->pipe.is_server      = false;
     clnt->pipe.handshake_done = 0;
+    clnt->pipe.local          = NULL;
+    clnt->pipe.local_side     = 0;
 
     ret = pipe_session_key(&clnt->pipe.name, &clnt->pipe.session_key);
     if (ret < 0) {
@@ -161,6 +877,16 @@ static int pipe_waitforclient(PAL_HANDLE handle, PAL_HANDLE* client) {
         free(clnt);
         return ret;
     }
+
+    ret = pipe_local_negotiate_accept(clnt);
+    if (ret < 0) {
+        if (clnt->pipe.local)
+            pipe_local_close(clnt);
+        _DkStreamSecureFree((LIB_SSL_CONTEXT*)clnt->pipe.ssl_ctx);
+        ocall_close(clnt->pipe.fd);
+        free(clnt);
+        return ret;
+    }
     __atomic_store_n(&clnt->pipe.handshake_done, 1, __ATOMIC_RELEASE);
 
     *client = clnt;
@@ -223,6 +949,10 @@ static int pipe_connect(PAL_HANDLE* handle, const char* name, int options) {
     hdl->pipe.ssl_ctx        = NULL;
     hdl->pipe.is_server      = true;
     hdl->pipe.handshake_done = 0;
+    hdl->pipe.local          = NULL;
+    hdl->pipe.local_side     = 0;
+
+    pipe_local_propose(hdl);
 
     /* create a helper thread to initialize the SSL context (by performing SSL handshake);
      * we need a separate thread because the underlying handshake implementation is blocking
@@ -230,6 +960,13 @@ static int pipe_connect(PAL_HANDLE* handle, const char* name, int options) {
     PAL_HANDLE thread_hdl;
     ret = _DkThreadCreate(&thread_hdl, thread_handshake_func, /*param=*/hdl);
     if (ret < 0) {
+        if (hdl->pipe.local) {
+            struct pipe_local* chan =
+                pipe_local_unlink_pending(((struct pipe_local*)hdl->pipe.local)->token);
+            if (chan)
+                pipe_local_dealloc(chan);
+            hdl->pipe.local = NULL;
+        }
         ocall_close(hdl->pipe.fd);
         free(hdl);
         return -PAL_ERROR_DENIED;
@@ -332,6 +1069,11 @@ static int pipe_open(PAL_HANDLE* handle, const char* type, const char* uri, int
  * \param[in]  len     Size of user-supplied buffer.
  * \param[out] buffer  User-supplied buffer to read data to.
  * \return             Number of bytes read on success, negative PAL error code otherwise.
+ *
+ * LibOS passes the buffer of the application, so unencrypted data (`pipeprv`, local channels) is
+ * copied from untrusted memory straight into it. Encrypted data is first copied into the mbedTLS
+ * record buffer, since it must not be decrypted in untrusted memory (it could change between
+ * authentication and decryption), and only the plaintext is copied out of there.
  */
 static int64_t pipe_read(PAL_HANDLE handle, uint64_t offset, uint64_t len, void* buffer) {
     if (offset)
@@ -352,6 +1094,10 @@ static int64_t pipe_read(PAL_HANDLE handle, uint64_t offset, uint64_t len, void*
         while (!__atomic_load_n(&handle->pipe.handshake_done, __ATOMIC_ACQUIRE))
             CPU_RELAX();
 
+        int64_t local_bytes;
+        if (handle->pipe.local && pipe_local_read(handle, buffer, len, &local_bytes))
+            return local_bytes;
+
         if (!handle->pipe.ssl_ctx)
             return -PAL_ERROR_NOTCONNECTION;
 
@@ -390,6 +1136,10 @@ static int64_t pipe_write(PAL_HANDLE handle, uint64_t offset, uint64_t len, cons
         while (!__atomic_load_n(&handle->pipe.handshake_done, __ATOMIC_ACQUIRE))
             CPU_RELAX();
 
+        int64_t local_bytes;
+        if (handle->pipe.local && pipe_local_write(handle, buffer, len, &local_bytes))
+            return local_bytes;
+
         if (!handle->pipe.ssl_ctx)
             return -PAL_ERROR_NOTCONNECTION;
 
@@ -420,6 +1170,16 @@ static int pipe_close(PAL_HANDLE handle) {
         while (!__atomic_load_n(&handle->pipe.handshake_done, __ATOMIC_ACQUIRE))
             CPU_RELAX();
 
+        if (HANDLE_HDR(handle)->type == PAL_TYPE_PIPESRV)
+            pipe_local_remove_listener(handle);
+
+        if (handle->pipe.local && pipe_local_close(handle)) {
+            /* the channel closes them once the other end drained the data */
+            handle->pipe.ssl_ctx = NULL;
+            handle->pipe.fd = PAL_IDX_POISON;
+            return 0;
+        }
+
         if (handle->pipe.ssl_ctx) {
             _DkStreamSecureFree((LIB_SSL_CONTEXT*)handle->pipe.ssl_ctx);
             handle->pipe.ssl_ctx = NULL;
@@ -471,8 +1231,11 @@ static int pipe_delete(PAL_HANDLE handle, int access) {
             CPU_RELAX();
         }
 
+        if (handle->pipe.local)
+            shutdown = pipe_local_shutdown(handle, shutdown);
+
         /* other types of pipes have a single underlying FD, shut it down */
-        if (handle->pipe.fd != PAL_IDX_POISON) {
+        if (handle->pipe.fd != PAL_IDX_POISON && shutdown >= 0) {
             ocall_shutdown(handle->pipe.fd, shutdown);
         }
     }
@@ -498,6 +1261,14 @@ static int pipe_attrquerybyhdl(PAL_HANDLE handle, PAL_STREAM_ATTR* attr) {
                                                                       : handle->pipe.nonblocking;
     attr->disconnected = HANDLE_HDR(handle)->flags & ERROR(0);
 
+    if (HANDLE_HDR(handle)->type != PAL_TYPE_PIPEPRV && handle->pipe.local) {
+        while (!__atomic_load_n(&handle->pipe.handshake_done, __ATOMIC_ACQUIRE)) {
+            CPU_RELAX();
+        }
+        if (handle->pipe.local && pipe_local_query(handle, attr))
+            return 0;
+    }
+
     /* get number of bytes available for reading (doesn't make sense for "listening" pipes) */
     attr->pending_size = 0;
     if (HANDLE_HDR(handle)->type != PAL_TYPE_PIPESRV) {
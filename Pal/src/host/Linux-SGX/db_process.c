@@ -16,6 +16,8 @@
 
 #include "api.h"
 #include "crypto.h"
+#include "enclave_pages.h"
+#include "enclave_tf.h"
 #include "pal.h"
 #include "pal_defs.h"
 #include "pal_error.h"
@@ -133,6 +135,8 @@ bool is_peer_enclave_ok(sgx_measurement_t* mr_enclave, sgx_report_data_t* expect
 int _DkProcessCreate(PAL_HANDLE* handle, const char** args) {
     int stream_fd;
     int nargs = 0, ret;
+    void* chunk_hashes = NULL;
+    size_t chunk_hashes_size = 0;
 
     if (args)
         for (const char** a = args; *a; a++)
@@ -201,10 +205,33 @@ int _DkProcessCreate(PAL_HANDLE* handle, const char** args) {
         goto failed;
     }
 
+    /* securely send the chunk hashes of trusted files verified so far, so that the child does not
+     * need to hash the same files again */
+    ret = serialize_trusted_files_chunk_hashes(&chunk_hashes, &chunk_hashes_size);
+    if (ret < 0)
+        goto failed;
+
+    uint64_t chunk_hashes_size_u64 = chunk_hashes_size;
+    ret = _DkStreamSecureWrite(child->process.ssl_ctx, (uint8_t*)&chunk_hashes_size_u64,
+                               sizeof(chunk_hashes_size_u64),
+                               /*is_blocking=*/!child->process.nonblocking);
+    if (ret != sizeof(chunk_hashes_size_u64))
+        goto failed;
+
+    for (size_t done = 0; done < chunk_hashes_size; done += ret) {
+        ret = _DkStreamSecureWrite(child->process.ssl_ctx, (uint8_t*)chunk_hashes + done,
+                                   chunk_hashes_size - done,
+                                   /*is_blocking=*/!child->process.nonblocking);
+        if (ret <= 0)
+            goto failed;
+    }
+    free(chunk_hashes);
+
     *handle = child;
     return 0;
 
 failed:
+    free(chunk_hashes);
     free(child);
     return ret < 0 ? ret : -PAL_ERROR_DENIED;
 }
@@ -274,6 +301,31 @@ int init_child_process(PAL_HANDLE* parent_handle, uint64_t* instance_id_ptr) {
         goto out_error;
     }
 
+    uint64_t chunk_hashes_size;
+    ret = _DkStreamSecureRead(parent->process.ssl_ctx, (uint8_t*)&chunk_hashes_size,
+                              sizeof(chunk_hashes_size),
+                              /*is_blocking=*/!parent->process.nonblocking);
+    if (ret != sizeof(chunk_hashes_size))
+        goto out_error;
+
+    if (chunk_hashes_size) {
+        uint8_t* chunk_hashes = malloc(chunk_hashes_size);
+        if (!chunk_hashes) {
+            ret = -PAL_ERROR_NOMEM;
+            goto out_error;
+        }
+        for (size_t done = 0; done < chunk_hashes_size; done += ret) {
+            ret = _DkStreamSecureRead(parent->process.ssl_ctx, chunk_hashes + done,
+                                      chunk_hashes_size - done,
+                                      /*is_blocking=*/!parent->process.nonblocking);
+            if (ret <= 0) {
+                free(chunk_hashes);
+                goto out_error;
+            }
+        }
+        set_inherited_trusted_files_chunk_hashes(chunk_hashes, chunk_hashes_size);
+    }
+
     *parent_handle = parent;
     *instance_id_ptr = instance_id;
     return 0;
@@ -283,9 +335,24 @@ out_error:
     return ret < 0 ? ret : -PAL_ERROR_DENIED;
 }
 
+bool g_enclave_stats_enabled = false;
+
+static void print_enclave_stats(void) {
+    size_t peak_pages = get_enclave_peak_allocated_pages();
+    log_always("----- Enclave stats for process %u -----\n"
+               "  Peak enclave heap usage: %lu MB (%lu pages)",
+               g_pal_sec.pid, peak_pages * g_page_size / 1024 / 1024, peak_pages);
+    log_used_trusted_files();
+}
+
 noreturn void _DkProcessExit(int exitcode) {
     if (exitcode)
         log_debug("DkProcessExit: Returning exit code %d", exitcode);
+    if (g_enclave_stats_enabled)
+        print_enclave_stats();
+    int ret = write_trusted_files_usage_log();
+    if (ret < 0)
+        log_warning("Writing the trusted files usage log failed: %s", pal_strerror(ret));
     ocall_exit(exitcode, /*is_exitgroup=*/true);
     /* Unreachable. */
 }
@@ -8,12 +8,15 @@
 
 #include <asm-generic/socket.h>
 #include <asm/fcntl.h>
+#include <linux/futex.h>
 #include <linux/in.h>
 #include <linux/in6.h>
 #include <linux/poll.h>
 #include <linux/types.h>
+#include <sys/eventfd.h>
 
 #include "api.h"
+#include "ocall_types.h"
 #include "pal.h"
 #include "pal_defs.h"
 #include "pal_error.h"
@@ -22,6 +25,7 @@
 #include "pal_linux_defs.h"
 #include "pal_linux_error.h"
 #include "pal_security.h"
+#include "spinlock.h"
 
 #ifndef SOL_TCP
 #define SOL_TCP 6
@@ -247,6 +251,10 @@ static inline PAL_HANDLE socket_create_handle(int type, int fd, int options,
         hdl->sock.conn = (PAL_PTR)NULL;
     }
 
+    hdl->sock.bell        = PAL_IDX_POISON;
+    hdl->sock.accepted    = NULL;
+    hdl->sock.ring        = NULL;
+    hdl->sock.parked      = NULL;
     hdl->sock.nonblocking = (options & PAL_OPTION_NONBLOCK) ? PAL_TRUE : PAL_FALSE;
 
     hdl->sock.linger         = sock_options->linger;
@@ -257,9 +265,12 @@ static inline PAL_HANDLE socket_create_handle(int type, int fd, int options,
     hdl->sock.tcp_cork       = sock_options->tcp_cork;
     hdl->sock.tcp_keepalive  = sock_options->tcp_keepalive;
     hdl->sock.tcp_nodelay    = sock_options->tcp_nodelay;
+    hdl->sock.busy_poll      = 0;
     return hdl;
 }
 
+static void sock_ring_attach(PAL_HANDLE handle);
+
 static inline int sock_type(int type, int options) {
     if (options & PAL_OPTION_NONBLOCK)
         type |= SOCK_NONBLOCK;
@@ -296,9 +307,117 @@ static int tcp_listen(PAL_HANDLE* handle, char* uri, int create, int options) {
         return -PAL_ERROR_NOMEM;
     }
 
+    /* without the doorbell, pollers could not see connections accepted ahead, so such a listener
+     * simply accepts one connection at a time */
+    int bell = ocall_eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (bell >= 0) {
+        (*handle)->sock.bell = bell;
+        HANDLE_HDR(*handle)->flags |= RFD(1);
+    }
+
+    return 0;
+}
+
+/* Non-blocking listeners accept up to this many connections per OCALL. The surplus is parked in
+ * the handle and handed out by later tcp_accept() calls without leaving the enclave; the
+ * `bell` eventfd is kept readable while anything is parked, so that poll and epoll
+ * report the listener as ready even though the host backlog is already drained. */
+#define TCP_ACCEPT_BATCH 8
+
+struct accept_cache {
+    spinlock_t lock;
+    unsigned int head;
+    unsigned int count;
+    unsigned int reserved; /* slots promised to accepts currently in the OCALL */
+    struct ocall_accepted_conn conns[TCP_ACCEPT_BATCH];
+};
+
+static struct accept_cache* get_accept_cache(PAL_HANDLE handle) {
+    struct accept_cache* cache = __atomic_load_n((struct accept_cache**)&handle->sock.accepted,
+                                                 __ATOMIC_ACQUIRE);
+    if (cache)
+        return cache;
+
+    cache = malloc(sizeof(*cache));
+    if (!cache)
+        return NULL;
+    spinlock_init(&cache->lock);
+    cache->head = cache->count = cache->reserved = 0;
+
+    struct accept_cache* expected = NULL;
+    if (!__atomic_compare_exchange_n((struct accept_cache**)&handle->sock.accepted, &expected,
+                                     cache, /*weak=*/false, __ATOMIC_ACQ_REL,
+                                     __ATOMIC_ACQUIRE)) {
+        free(cache);
+        cache = expected;
+    }
+    return cache;
+}
+
+/* must be called with `cache->lock` held; the doorbell only changes on empty <-> non-empty */
+static void ring_accept_bell(PAL_HANDLE handle, bool readable) {
+    uint64_t val = 1;
+    if (readable)
+        ocall_write(handle->sock.bell, &val, sizeof(val));
+    else
+        ocall_read(handle->sock.bell, &val, sizeof(val));
+}
+
+static int accept_batched(PAL_HANDLE handle, struct ocall_accepted_conn* out) {
+    struct accept_cache* cache = get_accept_cache(handle);
+    if (!cache)
+        return -PAL_ERROR_NOMEM;
+
+    spinlock_lock(&cache->lock);
+    if (cache->count) {
+        *out = cache->conns[cache->head];
+        cache->head = (cache->head + 1) % TCP_ACCEPT_BATCH;
+        if (!--cache->count)
+            ring_accept_bell(handle, /*readable=*/false);
+        spinlock_unlock(&cache->lock);
+        return 0;
+    }
+    /* a blocking listener takes just one connection: the accepts after it would block too */
+    unsigned int extra = handle->sock.nonblocking
+                         ? TCP_ACCEPT_BATCH - cache->count - cache->reserved
+                         : 0;
+    cache->reserved += extra;
+    spinlock_unlock(&cache->lock);
+
+    struct ocall_accepted_conn conns[TCP_ACCEPT_BATCH + 1];
+    int ret = ocall_accept_batch(handle->sock.fd, conns, extra + 1);
+
+    spinlock_lock(&cache->lock);
+    cache->reserved -= extra;
+    if (ret > 1) {
+        bool was_empty = !cache->count;
+        for (int i = 1; i < ret; i++) {
+            cache->conns[(cache->head + cache->count) % TCP_ACCEPT_BATCH] = conns[i];
+            cache->count++;
+        }
+        if (was_empty)
+            ring_accept_bell(handle, /*readable=*/true);
+    }
+    spinlock_unlock(&cache->lock);
+
+    if (ret < 0)
+        return unix_to_pal_error(ret);
+
+    *out = conns[0];
     return 0;
 }
 
+static void drop_accept_cache(PAL_HANDLE handle) {
+    struct accept_cache* cache = handle->sock.accepted;
+    if (!cache)
+        return;
+
+    for (unsigned int i = 0; i < cache->count; i++)
+        ocall_close(cache->conns[(cache->head + i) % TCP_ACCEPT_BATCH].fd);
+    free(cache);
+    handle->sock.accepted = NULL;
+}
+
 /* accept a tcp connection */
 static int tcp_accept(PAL_HANDLE handle, PAL_HANDLE* client) {
     if (HANDLE_HDR(handle)->type != PAL_TYPE_TCPSRV || !handle->sock.bind || handle->sock.conn)
@@ -318,9 +437,21 @@ static int tcp_accept(PAL_HANDLE handle, PAL_HANDLE* client) {
     memset(&sock_options, 0, sizeof(sock_options));
     sock_options.reuseaddr = 1; /* sockets are always set as reusable in Graphene */
 
-    ret = ocall_accept(handle->sock.fd, (struct sockaddr*)&dest_addr, &dest_addrlen, &sock_options);
-    if (ret < 0)
-        return unix_to_pal_error(ret);
+    if (handle->sock.bell != PAL_IDX_POISON) {
+        struct ocall_accepted_conn conn;
+        ret = accept_batched(handle, &conn);
+        if (ret < 0)
+            return ret;
+
+        ret = conn.fd;
+        dest_addrlen = conn.addrlen;
+        memcpy(&dest_addr, &conn.addr, dest_addrlen);
+    } else {
+        ret = ocall_accept(handle->sock.fd, (struct sockaddr*)&dest_addr, &dest_addrlen,
+                           &sock_options);
+        if (ret < 0)
+            return unix_to_pal_error(ret);
+    }
 
     *client = socket_create_handle(PAL_TYPE_TCP, ret, 0, bind_addr, bind_addrlen,
                                    (struct sockaddr*)&dest_addr, dest_addrlen, &sock_options);
@@ -330,6 +461,7 @@ static int tcp_accept(PAL_HANDLE handle, PAL_HANDLE* client) {
         return -PAL_ERROR_NOMEM;
     }
 
+    sock_ring_attach(*client);
     return 0;
 }
 
@@ -371,6 +503,7 @@ static int tcp_connect(PAL_HANDLE* handle, char* uri, int options) {
         return -PAL_ERROR_NOMEM;
     }
 
+    sock_ring_attach(*handle);
     return 0;
 }
 
@@ -402,18 +535,618 @@ static int tcp_open(PAL_HANDLE* handle, const char* type, const char* uri, int a
     return -PAL_ERROR_NOTSUPPORT;
 }
 
-/* 'read' operation of tcp stream */
-static int64_t tcp_read(PAL_HANDLE handle, uint64_t offset, uint64_t len, void* buf) {
-    if (offset)
+/* Socket rings, enabled for every connected socket with `sgx.socket_rings` or per socket with
+ * SO_BUSY_POLL. An untrusted proxy thread moves data between the host socket and two rings in
+ * untrusted memory (see `struct sock_ring`): it receives into `rx` and sends what the enclave
+ * queues in `tx`. Reads and writes on the handle only copy to or from the rings, without leaving
+ * the enclave; blocking calls spin for `busy_poll` microseconds and only then sleep on the ring's
+ * futex. As the proxy drains the host socket, readiness for reads comes from the `bell` eventfd,
+ * which the proxy keeps readable while `rx` is not empty.
+ *
+ * When the socket is sent to another process (fork), the proxy must not go on receiving what is
+ * meant for the other process, so it is asked to stop receiving: the input it has received but
+ * nobody read goes along with the socket (see sock_handover_input()) and this process receives from
+ * the host socket with OCALLs from then on. The proxy keeps sending. */
+#define SOCK_RING_CLOCK_SPINS 64 /* empty polls between two reads of the clock */
+#define SOCK_RING_MIN_SPIN_US 20 /* proxy spin after each transfer, saves kicks on bursts of sends */
+
+struct sock_ring_ctx {
+    spinlock_t lock;        /* serializes readers of the ring */
+    struct sock_ring* ring; /* untrusted */
+    uint32_t head;          /* trusted copy of `ring->rx.head` */
+    uint32_t offset;        /* TCP only: bytes of the head slot already read */
+    spinlock_t tx_lock;     /* serializes writers of the ring */
+    uint32_t tx_tail;       /* trusted copy of `ring->tx.tail` */
+    bool rx_handed;         /* rx was handed over, see sock_ring_handover() */
+};
+
+bool g_sock_rings_enabled = false;
+
+static int sock_ring_start(PAL_HANDLE handle, uint64_t budget_us) {
+    struct sock_ring_ctx* rc = malloc(sizeof(*rc));
+    if (!rc)
+        return -PAL_ERROR_NOMEM;
+
+    spinlock_init(&rc->lock);
+    rc->head   = 0;
+    rc->offset = 0;
+    spinlock_init(&rc->tx_lock);
+    rc->tx_tail = 0;
+    rc->rx_handed = false;
+
+    int bell = ocall_eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (bell < 0) {
+        free(rc);
+        return unix_to_pal_error(bell);
+    }
+
+    int ret = ocall_sock_ring_start(handle->sock.fd, bell, HANDLE_HDR(handle)->type == PAL_TYPE_TCP,
+                                    MAX(budget_us, SOCK_RING_MIN_SPIN_US), &rc->ring);
+    if (ret < 0) {
+        ocall_close(bell);
+        free(rc);
+        return unix_to_pal_error(ret);
+    }
+
+    handle->sock.bell = bell;
+    handle->sock.ring = rc;
+    /* reads are served from the ring from now on; writability is still the host socket's */
+    HANDLE_HDR(handle)->flags = (HANDLE_HDR(handle)->flags & ~RFD(0)) | RFD(1);
+    return 0;
+}
+
+/* Called on every new connected or bound socket; without `sgx.socket_rings`, rings are only
+ * started by SO_BUSY_POLL. A socket whose proxy cannot be started keeps using plain OCALLs. */
+static void sock_ring_attach(PAL_HANDLE handle) {
+    if (!g_sock_rings_enabled)
+        return;
+
+    int ret = sock_ring_start(handle, /*budget_us=*/0);
+    if (ret < 0)
+        log_debug("Cannot start socket rings (%d), falling back to OCALLs", ret);
+}
+
+static void sock_ring_stop(PAL_HANDLE handle) {
+    struct sock_ring_ctx* rc = handle->sock.ring;
+    if (!rc)
+        return;
+
+    ocall_sock_ring_stop(rc->ring);
+    free(rc);
+    handle->sock.ring = NULL;
+}
+
+/* Waits until the proxy moves the index `word` of `q` away from `val`: spins for `budget_us`, then
+ * sleeps. Used for a new rx slot (`rx.tail`) and for a free tx slot (`tx.head`). */
+static int sock_ring_wait(struct sock_ring_queue* q, uint32_t* word, uint32_t val,
+                          uint64_t budget_us) {
+    uint64_t start_us = 0;
+    uint64_t now_us   = 0;
+    if (budget_us && _DkSystemTimeQuery(&start_us) < 0)
+        budget_us = 0;
+
+    for (unsigned int i = 1; budget_us; i++) {
+        if (__atomic_load_n(word, __ATOMIC_ACQUIRE) != val)
+            return 0;
+        CPU_RELAX();
+        if (i % SOCK_RING_CLOCK_SPINS == 0
+                && (_DkSystemTimeQuery(&now_us) < 0 || now_us - start_us >= budget_us))
+            break;
+    }
+
+    /* the proxy clears `waiters` and wakes us after moving the index, see sock_ring_advance() */
+    __atomic_store_n(&q->waiters, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(word, __ATOMIC_SEQ_CST) != val)
+        return 0;
+
+    int ret = ocall_futex(word, FUTEX_WAIT, val, /*timeout_us=*/NULL);
+    return ret == -EINTR ? -PAL_ERROR_INTERRUPTED : 0;
+}
+
+static void sock_ring_pop(struct sock_ring_ctx* rc) {
+    rc->offset = 0;
+    rc->head++;
+    __atomic_store_n(&rc->ring->rx.head, rc->head, __ATOMIC_RELEASE);
+}
+
+/* Reads from the head slot of a non-empty ring; must be called with `rc->lock` held. */
+static int64_t sock_ring_take(struct sock_ring_ctx* rc, bool stream, PAL_IOVEC* iov, size_t iov_cnt,
+                              void* addr, size_t* addrlen) {
+    struct sock_ring_slot* slot = &rc->ring->rx.slots[rc->head % SOCK_RING_SLOTS];
+    uint32_t len = READ_ONCE(slot->len);
+    int32_t err  = READ_ONCE(slot->err);
+    if (len > SOCK_RING_SLOT_SIZE || rc->offset > len || err > 0)
+        return -PAL_ERROR_DENIED;
+
+    if (err) {
+        sock_ring_pop(rc);
+        return unix_to_pal_error(err);
+    }
+
+    /* end of stream stays at the head, so that all later reads see it as well */
+    if (stream && !len)
+        return 0;
+
+    size_t avail  = len - rc->offset;
+    size_t copied = 0;
+    for (size_t i = 0; i < iov_cnt && copied < avail; i++) {
+        size_t n = MIN(iov[i].iov_len, avail - copied);
+        memcpy(iov[i].iov_base, slot->data + rc->offset + copied, n);
+        copied += n;
+    }
+
+    if (stream && copied < avail) {
+        rc->offset += copied;
+        return copied;
+    }
+
+    if (!stream && addr) {
+        uint32_t slot_addrlen = READ_ONCE(slot->addrlen);
+        if (slot_addrlen > sizeof(slot->addr))
+            return -PAL_ERROR_DENIED;
+        *addrlen = MIN(*addrlen, (size_t)slot_addrlen);
+        memcpy(addr, &slot->addr, *addrlen);
+    }
+
+    /* a datagram is consumed even if it did not fit, like recv() without MSG_PEEK */
+    sock_ring_pop(rc);
+    return copied;
+}
+
+/* Receives from the host socket once rx was handed over to another process. The host socket has
+ * the blocking mode of the handle, so a non-blocking receive on a blocking socket cannot wait. */
+static int64_t sock_host_recv(PAL_HANDLE handle, PAL_IOVEC* iov, size_t iov_cnt, void* addr,
+                              size_t* addrlen, bool nonblocking) {
+    if (nonblocking && !handle->sock.nonblocking)
+        return -PAL_ERROR_TRYAGAIN;
+
+    ssize_t bytes = ocall_recvmsg(handle->sock.fd, iov, iov_cnt, addr, addrlen, NULL, NULL);
+    return bytes < 0 ? unix_to_pal_error(bytes) : bytes;
+}
+
+static int64_t sock_ring_recv(PAL_HANDLE handle, PAL_IOVEC* iov, size_t iov_cnt, void* addr,
+                              size_t* addrlen, bool nonblocking) {
+    struct sock_ring_ctx* rc = handle->sock.ring;
+    bool stream = HANDLE_HDR(handle)->type == PAL_TYPE_TCP;
+
+    while (true) {
+        spinlock_lock(&rc->lock);
+        uint32_t head = rc->head;
+        uint32_t tail = __atomic_load_n(&rc->ring->rx.tail, __ATOMIC_ACQUIRE);
+        if (tail - head > SOCK_RING_SLOTS) {
+            spinlock_unlock(&rc->lock);
+            return -PAL_ERROR_DENIED;
+        }
+        /* the SOCK_RING_RX_STOPPED slot stays at the head until sock_ring_handover() takes it */
+        if (rc->rx_handed || (tail != head && READ_ONCE(rc->ring->rx.slots[head % SOCK_RING_SLOTS]
+                                                            .err) == SOCK_RING_RX_STOPPED)) {
+            spinlock_unlock(&rc->lock);
+            return sock_host_recv(handle, iov, iov_cnt, addr, addrlen, nonblocking);
+        }
+        if (tail != head) {
+            int64_t ret = sock_ring_take(rc, stream, iov, iov_cnt, addr, addrlen);
+            spinlock_unlock(&rc->lock);
+            return ret;
+        }
+        spinlock_unlock(&rc->lock);
+
+        if (nonblocking)
+            return -PAL_ERROR_TRYAGAIN;
+
+        int ret = sock_ring_wait(&rc->ring->rx, &rc->ring->rx.tail, head, handle->sock.busy_poll);
+        if (ret < 0)
+            return ret;
+    }
+}
+
+/* Returns what FIONREAD would report for the ring: all queued bytes for TCP, the size of the next
+ * datagram for UDP. */
+static size_t sock_ring_pending(struct sock_ring_ctx* rc, bool stream, bool* readable) {
+    spinlock_lock(&rc->lock);
+    uint32_t cnt = __atomic_load_n(&rc->ring->rx.tail, __ATOMIC_ACQUIRE) - rc->head;
+    if (cnt > SOCK_RING_SLOTS)
+        cnt = 0;
+
+    size_t pending = 0;
+    for (uint32_t i = 0; i < cnt; i++) {
+        struct sock_ring_slot* slot = &rc->ring->rx.slots[(rc->head + i) % SOCK_RING_SLOTS];
+        pending += MIN(READ_ONCE(slot->len), (uint32_t)SOCK_RING_SLOT_SIZE);
+        if (!stream)
+            break;
+    }
+    if (stream)
+        pending -= MIN(pending, (size_t)rc->offset);
+    spinlock_unlock(&rc->lock);
+
+    *readable = cnt != 0;
+    return pending;
+}
+
+/* Queues data for the proxy to send: a TCP write is split over as many slots as it needs, a UDP
+ * datagram takes exactly one. Like send(), a blocking call returns once all data is queued (not
+ * sent), a non-blocking one queues what fits. A TCP send error is reported by the next write. */
+static int64_t sock_ring_send(PAL_HANDLE handle, const PAL_IOVEC* iov, size_t iov_cnt,
+                              const void* addr, size_t addrlen, bool nonblocking) {
+    struct sock_ring_ctx* rc = handle->sock.ring;
+    struct sock_ring* ring = rc->ring;
+    bool stream = HANDLE_HDR(handle)->type == PAL_TYPE_TCP;
+
+    size_t total = 0;
+    for (size_t i = 0; i < iov_cnt; i++)
+        total += iov[i].iov_len;
+
+    if (!stream && total > SOCK_RING_SLOT_SIZE)
+        return -PAL_ERROR_TOOLONG;
+    if (addr && addrlen > sizeof(ring->tx.slots[0].addr))
         return -PAL_ERROR_INVAL;
+    if (stream && !total)
+        return 0;
+
+    size_t sent = 0;
+    size_t iov_idx = 0;
+    size_t iov_off = 0;
+    spinlock_lock(&rc->tx_lock);
+    while (sent < total) {
+        int32_t err = READ_ONCE(ring->tx_err);
+        if (stream && err) {
+            spinlock_unlock(&rc->tx_lock);
+            if (sent)
+                return sent;
+            return err < 0 ? unix_to_pal_error(err) : -PAL_ERROR_DENIED;
+        }
+
+        uint32_t tail = rc->tx_tail;
+        uint32_t head = __atomic_load_n(&ring->tx.head, __ATOMIC_ACQUIRE);
+        if (tail - head > SOCK_RING_SLOTS) {
+            spinlock_unlock(&rc->tx_lock);
+            return -PAL_ERROR_DENIED;
+        }
+
+        if (tail - head == SOCK_RING_SLOTS) {
+            spinlock_unlock(&rc->tx_lock);
+            if (nonblocking)
+                return sent ? (int64_t)sent : -PAL_ERROR_TRYAGAIN;
+
+            int ret = sock_ring_wait(&ring->tx, &ring->tx.head, head, handle->sock.busy_poll);
+            if (ret < 0)
+                return sent ? (int64_t)sent : ret;
+
+            spinlock_lock(&rc->tx_lock);
+            continue;
+        }
+
+        struct sock_ring_slot* slot = &ring->tx.slots[tail % SOCK_RING_SLOTS];
+        size_t len = MIN(total - sent, (size_t)SOCK_RING_SLOT_SIZE);
+        for (size_t copied = 0; copied < len; ) {
+            size_t n = MIN(iov[iov_idx].iov_len - iov_off, len - copied);
+            memcpy(slot->data + copied, (char*)iov[iov_idx].iov_base + iov_off, n);
+            copied  += n;
+            iov_off += n;
+            if (iov_off == iov[iov_idx].iov_len) {
+                iov_idx++;
+                iov_off = 0;
+            }
+        }
+        slot->len     = len;
+        slot->err     = 0;
+        slot->addrlen = addr ? addrlen : 0;
+        if (addr)
+            memcpy(&slot->addr, addr, addrlen);
+
+        rc->tx_tail = tail + 1;
+        __atomic_store_n(&ring->tx.tail, rc->tx_tail, __ATOMIC_SEQ_CST);
+        /* the proxy sets `asleep` and then re-checks `tx.tail` before blocking in the host */
+        if (__atomic_exchange_n(&ring->asleep, 0, __ATOMIC_SEQ_CST)) {
+            uint64_t val = 1;
+            ocall_write(READ_ONCE(ring->kickfd), &val, sizeof(val));
+        }
+        sent += len;
+    }
+    spinlock_unlock(&rc->tx_lock);
+    return sent;
+}
+
+/* Waits until the proxy has sent everything queued in tx (or failed to), e.g. before the write
+ * side of the socket is shut down. */
+static void sock_ring_flush(PAL_HANDLE handle) {
+    struct sock_ring_ctx* rc = handle->sock.ring;
+    struct sock_ring* ring = rc->ring;
+    uint32_t tail = __atomic_load_n(&rc->tx_tail, __ATOMIC_RELAXED);
+    uint32_t head;
+
+    while ((head = __atomic_load_n(&ring->tx.head, __ATOMIC_ACQUIRE)) != tail
+            && !READ_ONCE(ring->tx_err)) {
+        if (sock_ring_wait(&ring->tx, &ring->tx.head, head, handle->sock.busy_poll) < 0)
+            break;
+    }
+}
+
+/* Input handed over with a socket is a sequence of records: `struct sock_input_rec`, the peer
+ * address (UDP only) and the data. The receiving process keeps it in `sock.parked`, serves it
+ * before the host socket and keeps `bell` readable until it is drained. */
+struct sock_input_rec {
+    uint32_t len;
+    uint32_t addrlen;
+};
+
+struct sock_input_buf {
+    char* data;
+    size_t size;
+    size_t cap;
+};
+
+struct sock_parked {
+    spinlock_t lock;
+    size_t size;
+    size_t pos;        /* offset of the first record not consumed yet */
+    size_t rec_offset; /* TCP only: bytes of that record already read */
+    char data[];
+};
+
+static int sock_input_append(struct sock_input_buf* buf, const void* addr, uint32_t addrlen,
+                             const void* data, uint32_t len) {
+    size_t need = sizeof(struct sock_input_rec) + addrlen + len;
+    if (buf->cap - buf->size < need) {
+        size_t cap = MAX(buf->cap * 2, buf->size + need);
+        char* new_data = malloc(cap);
+        if (!new_data)
+            return -PAL_ERROR_NOMEM;
+        if (buf->size)
+            memcpy(new_data, buf->data, buf->size);
+        free(buf->data);
+        buf->data = new_data;
+        buf->cap  = cap;
+    }
+
+    struct sock_input_rec rec = {.len = len, .addrlen = addrlen};
+    memcpy(buf->data + buf->size, &rec, sizeof(rec));
+    memcpy(buf->data + buf->size + sizeof(rec), addr, addrlen);
+    memcpy(buf->data + buf->size + sizeof(rec) + addrlen, data, len);
+    buf->size += need;
+    return 0;
+}
+
+/* Asks the proxy to stop receiving and takes everything it published before the
+ * SOCK_RING_RX_STOPPED slot. Errors and end of stream are not taken: the receiving process gets
+ * them from the host socket again. */
+static int sock_ring_handover(PAL_HANDLE handle, struct sock_input_buf* buf) {
+    struct sock_ring_ctx* rc = handle->sock.ring;
+    struct sock_ring* ring = rc->ring;
+    bool stream = HANDLE_HDR(handle)->type == PAL_TYPE_TCP;
+
+    __atomic_store_n(&ring->rx_stop, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_exchange_n(&ring->asleep, 0, __ATOMIC_SEQ_CST)) {
+        uint64_t val = 1;
+        ocall_write(READ_ONCE(ring->kickfd), &val, sizeof(val));
+    }
+
+    while (true) {
+        int ret = 0;
+        spinlock_lock(&rc->lock);
+        bool stopped = rc->rx_handed;
+        uint32_t tail = __atomic_load_n(&ring->rx.tail, __ATOMIC_ACQUIRE);
+        if (tail - rc->head > SOCK_RING_SLOTS)
+            ret = -PAL_ERROR_DENIED;
+        while (!ret && !stopped && rc->head != tail) {
+            struct sock_ring_slot* slot = &ring->rx.slots[rc->head % SOCK_RING_SLOTS];
+            uint32_t len     = READ_ONCE(slot->len);
+            int32_t err      = READ_ONCE(slot->err);
+            uint32_t addrlen = stream ? 0 : READ_ONCE(slot->addrlen);
+            if (len > SOCK_RING_SLOT_SIZE || rc->offset > len || addrlen > sizeof(slot->addr)) {
+                ret = -PAL_ERROR_DENIED;
+                break;
+            }
+            if (err == SOCK_RING_RX_STOPPED) {
+                stopped = true;
+            } else if (!err && len > rc->offset) {
+                ret = sock_input_append(buf, &slot->addr, addrlen, slot->data + rc->offset,
+                                        len - rc->offset);
+                if (ret < 0)
+                    break;
+            }
+            sock_ring_pop(rc);
+        }
+        if (stopped && !rc->rx_handed) {
+            __atomic_store_n(&rc->rx_handed, true, __ATOMIC_RELEASE);
+            /* the proxy does not drain the host socket anymore, so it reports input itself */
+            HANDLE_HDR(handle)->flags = (HANDLE_HDR(handle)->flags & ~RFD(1)) | RFD(0);
+        }
+        uint32_t head = rc->head;
+        spinlock_unlock(&rc->lock);
+
+        if (ret < 0 || stopped)
+            return ret;
+
+        ret = sock_ring_wait(&ring->rx, &ring->rx.tail, head, /*budget_us=*/0);
+        if (ret < 0 && ret != -PAL_ERROR_INTERRUPTED)
+            return ret;
+    }
+}
+
+/* Takes the parked input that was not read yet, to hand it over once more. */
+static int sock_parked_handover(PAL_HANDLE handle, struct sock_input_buf* buf) {
+    struct sock_parked* parked = handle->sock.parked;
+    int ret = 0;
 
+    spinlock_lock(&parked->lock);
+    bool had_input = parked->pos < parked->size;
+    while (parked->pos < parked->size) {
+        struct sock_input_rec rec;
+        memcpy(&rec, parked->data + parked->pos, sizeof(rec));
+        const char* addr = parked->data + parked->pos + sizeof(rec);
+        ret = sock_input_append(buf, addr, rec.addrlen, addr + rec.addrlen + parked->rec_offset,
+                                rec.len - parked->rec_offset);
+        if (ret < 0)
+            break;
+        parked->pos += sizeof(rec) + rec.addrlen + rec.len;
+        parked->rec_offset = 0;
+    }
+    if (had_input && parked->pos == parked->size) {
+        uint64_t val;
+        ocall_read(handle->sock.bell, &val, sizeof(val));
+    }
+    spinlock_unlock(&parked->lock);
+    return ret;
+}
+
+/*!
+ * \brief Take the input of a socket that this process received but did not read yet.
+ *
+ * Must be called before a TCP or UDP socket is serialized to be sent to another process. Stops
+ * receiving into the rx ring of the socket (if any) and takes the input from it and from
+ * `sock.parked`, in the order it was received.
+ *
+ * \param handle    PAL handle of type `tcp`, `udp` or `udpsrv`.
+ * \param out_data  On success, malloc'ed input records to be passed to sock_park_input() in the
+ *                  receiving process, or NULL if there is no input.
+ * \param out_size  On success, size of `out_data`.
+ * \return          0 on success, negative PAL error code otherwise.
+ */
+int sock_handover_input(PAL_HANDLE handle, void** out_data, size_t* out_size) {
+    struct sock_input_buf buf = {.data = NULL, .size = 0, .cap = 0};
+    int ret = 0;
+
+    if (handle->sock.parked)
+        ret = sock_parked_handover(handle, &buf);
+    struct sock_ring_ctx* rc = handle->sock.ring;
+    if (ret == 0 && rc && !__atomic_load_n(&rc->rx_handed, __ATOMIC_ACQUIRE))
+        ret = sock_ring_handover(handle, &buf);
+
+    if (ret < 0) {
+        free(buf.data);
+        return ret;
+    }
+    *out_data = buf.data;
+    *out_size = buf.size;
+    return 0;
+}
+
+/*!
+ * \brief Keep the input handed over with a deserialized socket, to be read before the host socket.
+ *
+ * \param handle  Deserialized PAL handle of type `tcp`, `udp` or `udpsrv`.
+ * \param data    Input records from sock_handover_input() in the sending process.
+ * \param size    Size of `data`.
+ * \return        0 on success, negative PAL error code otherwise.
+ */
+int sock_park_input(PAL_HANDLE handle, const void* data, size_t size) {
+    if (!size)
+        return 0;
+
+    for (size_t pos = 0; pos < size;) {
+        struct sock_input_rec rec;
+        if (size - pos < sizeof(rec))
+            return -PAL_ERROR_DENIED;
+        memcpy(&rec, (const char*)data + pos, sizeof(rec));
+        if (rec.addrlen > sizeof(struct sockaddr_storage) || rec.len > SOCK_RING_SLOT_SIZE
+                || size - pos - sizeof(rec) < (size_t)rec.addrlen + rec.len)
+            return -PAL_ERROR_DENIED;
+        pos += sizeof(rec) + rec.addrlen + rec.len;
+    }
+
+    struct sock_parked* parked = malloc(sizeof(*parked) + size);
+    if (!parked)
+        return -PAL_ERROR_NOMEM;
+    spinlock_init(&parked->lock);
+    parked->size = size;
+    parked->pos  = 0;
+    parked->rec_offset = 0;
+    memcpy(parked->data, data, size);
+
+    int bell = ocall_eventfd(/*initval=*/1, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (bell < 0) {
+        free(parked);
+        return unix_to_pal_error(bell);
+    }
+
+    handle->sock.bell   = bell;
+    handle->sock.parked = parked;
+    HANDLE_HDR(handle)->flags |= RFD(1);
+    return 0;
+}
+
+/* Reads from the head record of the parked input. Returns false if there is none left. */
+static bool sock_parked_recv(PAL_HANDLE handle, PAL_IOVEC* iov, size_t iov_cnt, void* addr,
+                             size_t* addrlen, int64_t* out) {
+    struct sock_parked* parked = handle->sock.parked;
+    if (!parked)
+        return false;
+
+    bool stream = HANDLE_HDR(handle)->type == PAL_TYPE_TCP;
+    spinlock_lock(&parked->lock);
+    if (parked->pos == parked->size) {
+        spinlock_unlock(&parked->lock);
+        return false;
+    }
+
+    struct sock_input_rec rec;
+    memcpy(&rec, parked->data + parked->pos, sizeof(rec));
+    const char* rec_addr = parked->data + parked->pos + sizeof(rec);
+    const char* rec_data = rec_addr + rec.addrlen + parked->rec_offset;
+    size_t avail  = rec.len - parked->rec_offset;
+    size_t copied = 0;
+    for (size_t i = 0; i < iov_cnt && copied < avail; i++) {
+        size_t n = MIN(iov[i].iov_len, avail - copied);
+        memcpy(iov[i].iov_base, rec_data + copied, n);
+        copied += n;
+    }
+
+    if (stream && copied < avail) {
+        parked->rec_offset += copied;
+    } else {
+        if (!stream && addr) {
+            *addrlen = MIN(*addrlen, (size_t)rec.addrlen);
+            memcpy(addr, rec_addr, *addrlen);
+        }
+        /* a datagram is consumed even if it did not fit, like recv() without MSG_PEEK */
+        parked->pos += sizeof(rec) + rec.addrlen + rec.len;
+        parked->rec_offset = 0;
+        if (parked->pos == parked->size) {
+            uint64_t val;
+            ocall_read(handle->sock.bell, &val, sizeof(val));
+        }
+    }
+    spinlock_unlock(&parked->lock);
+
+    *out = copied;
+    return true;
+}
+
+/* Returns what FIONREAD would report for the parked input (see sock_ring_pending()). */
+static size_t sock_parked_pending(struct sock_parked* parked, bool stream, bool* readable) {
+    spinlock_lock(&parked->lock);
+    size_t pending = 0;
+    for (size_t pos = parked->pos; pos < parked->size;) {
+        struct sock_input_rec rec;
+        memcpy(&rec, parked->data + pos, sizeof(rec));
+        pending += rec.len;
+        if (!stream)
+            break;
+        pos += sizeof(rec) + rec.addrlen + rec.len;
+    }
+    if (stream)
+        pending -= MIN(pending, parked->rec_offset);
+    *readable = parked->pos < parked->size;
+    spinlock_unlock(&parked->lock);
+    return pending;
+}
+
+/* 'readv' and 'read' operations of tcp stream */
+static int64_t tcp_readv(PAL_HANDLE handle, PAL_IOVEC* iov, size_t iov_cnt) {
     if (HANDLE_HDR(handle)->type != PAL_TYPE_TCP || !handle->sock.conn)
         return -PAL_ERROR_NOTCONNECTION;
 
     if (handle->sock.fd == PAL_IDX_POISON)
         return 0;
 
-    ssize_t bytes = ocall_recv(handle->sock.fd, buf, len, NULL, NULL, NULL, NULL);
+    int64_t parked_bytes;
+    if (sock_parked_recv(handle, iov, iov_cnt, NULL, NULL, &parked_bytes))
+        return parked_bytes;
+
+    if (handle->sock.ring)
+        return sock_ring_recv(handle, iov, iov_cnt, NULL, NULL, handle->sock.nonblocking);
+
+    ssize_t bytes = ocall_recvmsg(handle->sock.fd, iov, iov_cnt, NULL, NULL, NULL, NULL);
 
     if (bytes < 0)
         return unix_to_pal_error(bytes);
@@ -421,24 +1154,40 @@ static int64_t tcp_read(PAL_HANDLE handle, uint64_t offset, uint64_t len, void*
     return bytes;
 }
 
-/* write' operation of tcp stream */
-static int64_t tcp_write(PAL_HANDLE handle, uint64_t offset, uint64_t len, const void* buf) {
+static int64_t tcp_read(PAL_HANDLE handle, uint64_t offset, uint64_t len, void* buf) {
     if (offset)
         return -PAL_ERROR_INVAL;
 
+    PAL_IOVEC iov = {.iov_base = buf, .iov_len = len};
+    return tcp_readv(handle, &iov, 1);
+}
+
+/* 'writev' and 'write' operations of tcp stream */
+static int64_t tcp_writev(PAL_HANDLE handle, const PAL_IOVEC* iov, size_t iov_cnt) {
     if (HANDLE_HDR(handle)->type != PAL_TYPE_TCP || !handle->sock.conn)
         return -PAL_ERROR_NOTCONNECTION;
 
     if (handle->sock.fd == PAL_IDX_POISON)
         return -PAL_ERROR_CONNFAILED;
 
-    ssize_t bytes = ocall_send(handle->sock.fd, buf, len, NULL, 0, NULL, 0);
+    if (handle->sock.ring)
+        return sock_ring_send(handle, iov, iov_cnt, NULL, 0, handle->sock.nonblocking);
+
+    ssize_t bytes = ocall_sendmsg(handle->sock.fd, iov, iov_cnt, NULL, 0, NULL, 0);
     if (bytes < 0)
         return unix_to_pal_error(bytes);
 
     return bytes;
 }
 
+static int64_t tcp_write(PAL_HANDLE handle, uint64_t offset, uint64_t len, const void* buf) {
+    if (offset)
+        return -PAL_ERROR_INVAL;
+
+    PAL_IOVEC iov = {.iov_base = (void*)buf, .iov_len = len};
+    return tcp_writev(handle, &iov, 1);
+}
+
 /* used by 'open' operation of tcp stream for bound socket */
 static int udp_bind(PAL_HANDLE* handle, char* uri, int create, int options) {
     struct sockaddr_storage buffer;
@@ -472,6 +1221,7 @@ static int udp_bind(PAL_HANDLE* handle, char* uri, int create, int options) {
         return -PAL_ERROR_NOMEM;
     }
 
+    sock_ring_attach(*handle);
     return 0;
 }
 
@@ -508,6 +1258,7 @@ static int udp_connect(PAL_HANDLE* handle, char* uri, int create, int options) {
         return -PAL_ERROR_NOMEM;
     }
 
+    sock_ring_attach(*handle);
     return 0;
 }
 
@@ -538,39 +1289,63 @@ static int udp_open(PAL_HANDLE* hdl, const char* type, const char* uri, int acce
     return -PAL_ERROR_NOTSUPPORT;
 }
 
-static int64_t udp_receive(PAL_HANDLE handle, uint64_t offset, uint64_t len, void* buf) {
-    if (offset)
-        return -PAL_ERROR_INVAL;
-
+static int64_t udp_receivev(PAL_HANDLE handle, PAL_IOVEC* iov, size_t iov_cnt) {
     if (HANDLE_HDR(handle)->type != PAL_TYPE_UDP)
         return -PAL_ERROR_NOTCONNECTION;
 
     if (handle->sock.fd == PAL_IDX_POISON)
         return -PAL_ERROR_BADHANDLE;
 
-    ssize_t ret = ocall_recv(handle->sock.fd, buf, len, NULL, NULL, NULL, NULL);
+    int64_t parked_bytes;
+    if (sock_parked_recv(handle, iov, iov_cnt, NULL, NULL, &parked_bytes))
+        return parked_bytes;
+
+    if (handle->sock.ring)
+        return sock_ring_recv(handle, iov, iov_cnt, NULL, NULL, handle->sock.nonblocking);
+
+    ssize_t ret = ocall_recvmsg(handle->sock.fd, iov, iov_cnt, NULL, NULL, NULL, NULL);
     return ret < 0 ? unix_to_pal_error(ret) : ret;
 }
 
-static int64_t udp_receivebyaddr(PAL_HANDLE handle, uint64_t offset, uint64_t len, void* buf,
-                                 char* addr, size_t addrlen) {
+static int64_t udp_receive(PAL_HANDLE handle, uint64_t offset, uint64_t len, void* buf) {
     if (offset)
         return -PAL_ERROR_INVAL;
 
+    PAL_IOVEC iov = {.iov_base = buf, .iov_len = len};
+    return udp_receivev(handle, &iov, 1);
+}
+
+static int64_t udp_recvfrom(PAL_HANDLE handle, PAL_IOVEC* iov, size_t iov_cnt, void* addr,
+                            size_t* addrlen) {
     if (HANDLE_HDR(handle)->type != PAL_TYPE_UDPSRV)
         return -PAL_ERROR_NOTCONNECTION;
 
     if (handle->sock.fd == PAL_IDX_POISON)
         return -PAL_ERROR_BADHANDLE;
 
+    int64_t parked_bytes;
+    if (sock_parked_recv(handle, iov, iov_cnt, addr, addrlen, &parked_bytes))
+        return parked_bytes;
+
+    if (handle->sock.ring)
+        return sock_ring_recv(handle, iov, iov_cnt, addr, addrlen, handle->sock.nonblocking);
+
+    ssize_t bytes = ocall_recvmsg(handle->sock.fd, iov, iov_cnt, addr, addrlen, NULL, NULL);
+    return bytes < 0 ? unix_to_pal_error(bytes) : bytes;
+}
+
+static int64_t udp_receivebyaddr(PAL_HANDLE handle, uint64_t offset, uint64_t len, void* buf,
+                                 char* addr, size_t addrlen) {
+    if (offset)
+        return -PAL_ERROR_INVAL;
+
     struct sockaddr_storage conn_addr;
     size_t conn_addrlen = sizeof(conn_addr);
 
-    ssize_t bytes = ocall_recv(handle->sock.fd, buf, len, (struct sockaddr*)&conn_addr,
-                               &conn_addrlen, NULL, NULL);
-
+    PAL_IOVEC iov = {.iov_base = buf, .iov_len = len};
+    int64_t bytes = udp_recvfrom(handle, &iov, 1, &conn_addr, &conn_addrlen);
     if (bytes < 0)
-        return unix_to_pal_error(bytes);
+        return bytes;
 
     char* addr_uri = strcpy_static(addr, URI_PREFIX_UDP, addrlen);
     if (!addr_uri)
@@ -584,34 +1359,54 @@ static int64_t udp_receivebyaddr(PAL_HANDLE handle, uint64_t offset, uint64_t le
     return bytes;
 }
 
-static int64_t udp_send(PAL_HANDLE handle, uint64_t offset, uint64_t len, const void* buf) {
-    if (offset)
-        return -PAL_ERROR_INVAL;
-
+static int64_t udp_sendv(PAL_HANDLE handle, const PAL_IOVEC* iov, size_t iov_cnt) {
     if (HANDLE_HDR(handle)->type != PAL_TYPE_UDP)
         return -PAL_ERROR_NOTCONNECTION;
 
     if (handle->sock.fd == PAL_IDX_POISON)
         return -PAL_ERROR_BADHANDLE;
 
-    ssize_t bytes = ocall_send(handle->sock.fd, buf, len, NULL, 0, NULL, 0);
+    if (handle->sock.ring)
+        return sock_ring_send(handle, iov, iov_cnt, NULL, 0, handle->sock.nonblocking);
+
+    ssize_t bytes = ocall_sendmsg(handle->sock.fd, iov, iov_cnt, NULL, 0, NULL, 0);
     if (bytes < 0)
         return unix_to_pal_error(bytes);
 
     return bytes;
 }
 
-static int64_t udp_sendbyaddr(PAL_HANDLE handle, uint64_t offset, uint64_t len, const void* buf,
-                              const char* addr, size_t addrlen) {
+static int64_t udp_send(PAL_HANDLE handle, uint64_t offset, uint64_t len, const void* buf) {
     if (offset)
         return -PAL_ERROR_INVAL;
 
+    PAL_IOVEC iov = {.iov_base = (void*)buf, .iov_len = len};
+    return udp_sendv(handle, &iov, 1);
+}
+
+static int64_t udp_sendto(PAL_HANDLE handle, const PAL_IOVEC* iov, size_t iov_cnt,
+                          const void* addr, size_t addrlen) {
     if (HANDLE_HDR(handle)->type != PAL_TYPE_UDPSRV)
         return -PAL_ERROR_NOTCONNECTION;
 
     if (handle->sock.fd == PAL_IDX_POISON)
         return -PAL_ERROR_BADHANDLE;
 
+    if (handle->sock.ring)
+        return sock_ring_send(handle, iov, iov_cnt, addr, addrlen, handle->sock.nonblocking);
+
+    ssize_t bytes = ocall_sendmsg(handle->sock.fd, iov, iov_cnt, addr, addrlen, NULL, 0);
+    if (bytes < 0)
+        return unix_to_pal_error(bytes);
+
+    return bytes;
+}
+
+static int64_t udp_sendbyaddr(PAL_HANDLE handle, uint64_t offset, uint64_t len, const void* buf,
+                              const char* addr, size_t addrlen) {
+    if (offset)
+        return -PAL_ERROR_INVAL;
+
     if (!strstartswith(addr, URI_PREFIX_UDP))
         return -PAL_ERROR_INVAL;
 
@@ -628,12 +1423,68 @@ static int64_t udp_sendbyaddr(PAL_HANDLE handle, uint64_t offset, uint64_t len,
     if (ret < 0)
         return ret;
 
-    ssize_t bytes = ocall_send(handle->sock.fd, buf, len, (struct sockaddr*)&conn_addr,
-                               conn_addrlen, NULL, 0);
-    if (bytes < 0)
-        return unix_to_pal_error(bytes);
+    PAL_IOVEC iov = {.iov_base = (void*)buf, .iov_len = len};
+    return udp_sendto(handle, &iov, 1, &conn_addr, conn_addrlen);
+}
 
-    return bytes;
+static int64_t udp_sendbatch(PAL_HANDLE handle, PAL_MSG* msgs, size_t msg_cnt) {
+    if (handle->sock.fd == PAL_IDX_POISON)
+        return -PAL_ERROR_BADHANDLE;
+
+    if (handle->sock.ring) {
+        /* like sendmmsg(), block for the first datagram only */
+        size_t i;
+        for (i = 0; i < msg_cnt; i++) {
+            int64_t bytes = sock_ring_send(handle, msgs[i].iov, msgs[i].iov_cnt, msgs[i].addr,
+                                           msgs[i].addrlen, handle->sock.nonblocking || i > 0);
+            if (bytes < 0) {
+                if (i == 0)
+                    return bytes;
+                break;
+            }
+            msgs[i].len = bytes;
+        }
+        return i;
+    }
+
+    ssize_t ret = ocall_sendmmsg(handle->sock.fd, msgs, msg_cnt);
+    return ret < 0 ? unix_to_pal_error(ret) : ret;
+}
+
+static int64_t udp_recvbatch(PAL_HANDLE handle, PAL_MSG* msgs, size_t msg_cnt) {
+    if (handle->sock.fd == PAL_IDX_POISON)
+        return -PAL_ERROR_BADHANDLE;
+
+    /* parked datagrams are handed out one at a time, there are at most a few of them */
+    size_t parked_addrlen = msg_cnt ? msgs[0].addrlen : 0;
+    int64_t parked_bytes;
+    if (msg_cnt && sock_parked_recv(handle, msgs[0].iov, msgs[0].iov_cnt, msgs[0].addr,
+                                    &parked_addrlen, &parked_bytes)) {
+        msgs[0].addrlen = parked_addrlen;
+        msgs[0].len     = parked_bytes;
+        return 1;
+    }
+
+    if (handle->sock.ring) {
+        /* wait for the first datagram only, then take what the poller has already queued */
+        size_t i;
+        for (i = 0; i < msg_cnt; i++) {
+            size_t addrlen = msgs[i].addrlen;
+            int64_t bytes = sock_ring_recv(handle, msgs[i].iov, msgs[i].iov_cnt, msgs[i].addr,
+                                           &addrlen, handle->sock.nonblocking || i > 0);
+            if (bytes < 0) {
+                if (i == 0)
+                    return bytes;
+                break;
+            }
+            msgs[i].addrlen = addrlen;
+            msgs[i].len     = bytes;
+        }
+        return i;
+    }
+
+    ssize_t ret = ocall_recvmmsg(handle->sock.fd, msgs, msg_cnt);
+    return ret < 0 ? unix_to_pal_error(ret) : ret;
 }
 
 static int socket_delete(PAL_HANDLE handle, int access) {
@@ -659,6 +1510,9 @@ static int socket_delete(PAL_HANDLE handle, int access) {
                 return -PAL_ERROR_INVAL;
         }
 
+        if (handle->sock.ring && shutdown != SHUT_RD)
+            sock_ring_flush(handle);
+
         ocall_shutdown(handle->sock.fd, shutdown);
     }
 
@@ -666,11 +1520,25 @@ static int socket_delete(PAL_HANDLE handle, int access) {
 }
 
 static int socket_close(PAL_HANDLE handle) {
+    /* the proxy must have flushed tx and be gone before its host FD is closed and reused */
+    sock_ring_stop(handle);
+
     if (handle->sock.fd != PAL_IDX_POISON) {
         ocall_close(handle->sock.fd);
         handle->sock.fd = PAL_IDX_POISON;
     }
 
+    free(handle->sock.parked);
+    handle->sock.parked = NULL;
+
+    if (HANDLE_HDR(handle)->type == PAL_TYPE_TCPSRV)
+        drop_accept_cache(handle);
+
+    if (handle->sock.bell != PAL_IDX_POISON) {
+        ocall_close(handle->sock.bell);
+        handle->sock.bell = PAL_IDX_POISON;
+    }
+
     if (handle->sock.bind)
         handle->sock.bind = (PAL_PTR)NULL;
 
@@ -680,9 +1548,9 @@ static int socket_close(PAL_HANDLE handle) {
     return 0;
 }
 
-static int socket_attrquerybyhdl(PAL_HANDLE handle, PAL_STREAM_ATTR* attr) {
-    int ret;
-
+/* Blocking mode and socket options are only changed through socket_attrsetbyhdl(), so the values
+ * cached in the handle are authoritative and need no host call. */
+static int socket_attrquerycached(PAL_HANDLE handle, PAL_STREAM_ATTR* attr) {
     if (handle->sock.fd == PAL_IDX_POISON)
         return -PAL_ERROR_BADHANDLE;
 
@@ -698,10 +1566,28 @@ static int socket_attrquerybyhdl(PAL_HANDLE handle, PAL_STREAM_ATTR* attr) {
     attr->socket.tcp_cork       = handle->sock.tcp_cork;
     attr->socket.tcp_keepalive  = handle->sock.tcp_keepalive;
     attr->socket.tcp_nodelay    = handle->sock.tcp_nodelay;
+    attr->socket.busy_poll      = handle->sock.busy_poll;
 
-    /* get number of bytes available for reading (doesn't make sense for listening sockets) */
     attr->pending_size = 0;
-    if (HANDLE_HDR(handle)->type != PAL_TYPE_TCPSRV) {
+    attr->readable     = PAL_FALSE;
+    attr->writable     = PAL_FALSE;
+    return 0;
+}
+
+static int socket_attrquerybyhdl(PAL_HANDLE handle, PAL_STREAM_ATTR* attr) {
+    int ret = socket_attrquerycached(handle, attr);
+    if (ret < 0)
+        return ret;
+
+    /* get number of bytes available for reading (doesn't make sense for listening sockets) */
+    struct sock_ring_ctx* rc = handle->sock.ring;
+    if (rc && __atomic_load_n(&rc->rx_handed, __ATOMIC_ACQUIRE))
+        rc = NULL; /* the host socket holds all input again */
+    bool ring_readable = false;
+    if (rc) {
+        attr->pending_size = sock_ring_pending(rc, HANDLE_HDR(handle)->type == PAL_TYPE_TCP,
+                                               &ring_readable);
+    } else if (HANDLE_HDR(handle)->type != PAL_TYPE_TCPSRV) {
         ret = ocall_fionread(handle->sock.fd);
         if (ret < 0)
             return unix_to_pal_error(ret);
@@ -717,6 +1603,27 @@ static int socket_attrquerybyhdl(PAL_HANDLE handle, PAL_STREAM_ATTR* attr) {
 
     attr->readable = ret == 1 && (pfd.revents & (POLLIN | POLLERR | POLLHUP)) == POLLIN;
     attr->writable = ret == 1 && (pfd.revents & (POLLOUT | POLLERR | POLLHUP)) == POLLOUT;
+
+    /* the proxy drains the host socket, so only the ring knows whether there is input */
+    if (rc)
+        attr->readable = ring_readable;
+
+    /* input handed over by the sending process comes first */
+    if (handle->sock.parked) {
+        bool stream = HANDLE_HDR(handle)->type == PAL_TYPE_TCP;
+        bool parked_readable = false;
+        size_t parked_pending = sock_parked_pending(handle->sock.parked, stream,
+                                                    &parked_readable);
+        if (parked_readable) {
+            attr->pending_size = stream ? attr->pending_size + parked_pending : parked_pending;
+            attr->readable = true;
+        }
+    }
+
+    struct accept_cache* cache = handle->sock.accepted;
+    if (HANDLE_HDR(handle)->type == PAL_TYPE_TCPSRV && cache &&
+            __atomic_load_n(&cache->count, __ATOMIC_RELAXED))
+        attr->readable = true;
     return 0;
 }
 
@@ -787,6 +1694,24 @@ static int socket_attrsetbyhdl(PAL_HANDLE handle, PAL_STREAM_ATTR* attr) {
 
             handle->sock.sendtimeout = attr->socket.sendtimeout;
         }
+
+        if (attr->socket.busy_poll != handle->sock.busy_poll) {
+            struct sock_ring_ctx* rc = handle->sock.ring;
+            if (rc) {
+                /* turning busy polling off only stops the spinning: the proxy stays attached
+                 * until close, so that nothing it has already received gets lost */
+                __atomic_store_n(&rc->ring->budget_us,
+                                 MAX(attr->socket.busy_poll, SOCK_RING_MIN_SPIN_US),
+                                 __ATOMIC_RELAXED);
+            } else if (attr->socket.busy_poll && !handle->sock.parked) {
+                /* (a socket with handed over input keeps `bell` for it and stays on OCALLs) */
+                ret = sock_ring_start(handle, attr->socket.busy_poll);
+                if (ret < 0)
+                    return ret;
+            }
+
+            handle->sock.busy_poll = attr->socket.busy_poll;
+        }
     }
 
     if (HANDLE_TYPE(handle) == PAL_TYPE_TCP || HANDLE_TYPE(handle) == PAL_TYPE_TCPSRV) {
@@ -906,9 +1831,12 @@ struct handle_ops g_tcp_ops = {
     .waitforclient  = &tcp_accept,
     .read           = &tcp_read,
     .write          = &tcp_write,
+    .readv          = &tcp_readv,
+    .writev         = &tcp_writev,
     .delete         = &socket_delete,
     .close          = &socket_close,
     .attrquerybyhdl = &socket_attrquerybyhdl,
+    .attrquerycached = &socket_attrquerycached,
     .attrsetbyhdl   = &socket_attrsetbyhdl,
 };
 
@@ -917,9 +1845,14 @@ struct handle_ops g_udp_ops = {
     .open           = &udp_open,
     .read           = &udp_receive,
     .write          = &udp_send,
+    .readv          = &udp_receivev,
+    .writev         = &udp_sendv,
+    .sendbatch      = &udp_sendbatch,
+    .recvbatch      = &udp_recvbatch,
     .delete         = &socket_delete,
     .close          = &socket_close,
     .attrquerybyhdl = &socket_attrquerybyhdl,
+    .attrquerycached = &socket_attrquerycached,
     .attrsetbyhdl   = &socket_attrsetbyhdl,
 };
 
@@ -928,8 +1861,13 @@ struct handle_ops g_udpsrv_ops = {
     .open           = &udp_open,
     .readbyaddr     = &udp_receivebyaddr,
     .writebyaddr    = &udp_sendbyaddr,
+    .recvfrom       = &udp_recvfrom,
+    .sendto         = &udp_sendto,
+    .sendbatch      = &udp_sendbatch,
+    .recvbatch      = &udp_recvbatch,
     .delete         = &socket_delete,
     .close          = &socket_close,
     .attrquerybyhdl = &socket_attrquerybyhdl,
+    .attrquerycached = &socket_attrquerycached,
     .attrsetbyhdl   = &socket_attrsetbyhdl,
 };
@@ -15,6 +15,7 @@
 #include <linux/socket.h>
 #include <linux/types.h>
 #include <linux/wait.h>
+#include <sys/eventfd.h>
 
 #include "api.h"
 #include "crypto.h"
@@ -83,16 +84,19 @@ int _DkStreamUnmap(void* addr, uint64_t size) {
 }
 
 static ssize_t handle_serialize(PAL_HANDLE handle, void** data) {
-    int ret;
+    int ret = 0;
     const void* d1;
     const void* d2;
+    void* d3 = NULL;
     size_t dsz1 = 0;
     size_t dsz2 = 0;
+    size_t dsz3 = 0;
     bool free_d1 = false;
     bool free_d2 = false;
 
     /* find fields to serialize (depends on the handle type) and assign them to d1/d2; note that
-     * no handle type has more than two such fields, and some have none at all */
+     * no handle type has more than two such fields, and some have none at all; sockets also carry
+     * the input not read yet in d3 */
     switch (PAL_GET_TYPE(handle)) {
         case PAL_TYPE_FILE:
             d1   = handle->file.realpath;
@@ -100,6 +104,12 @@ static ssize_t handle_serialize(PAL_HANDLE handle, void** data) {
             break;
         case PAL_TYPE_PIPE:
         case PAL_TYPE_PIPECLI:
+            /* data buffered inside the enclave can't go with the handle, move it to the host */
+            if (handle->pipe.local) {
+                ret = pipe_local_demote(handle);
+                if (ret < 0)
+                    return ret;
+            }
             /* session key is part of handle but need to serialize SSL context */
             if (handle->pipe.ssl_ctx) {
                 free_d1 = true;
@@ -132,6 +142,11 @@ static ssize_t handle_serialize(PAL_HANDLE handle, void** data) {
                 d2   = (const void*)handle->sock.conn;
                 dsz2 = addr_size(handle->sock.conn);
             }
+            if (PAL_GET_TYPE(handle) != PAL_TYPE_TCPSRV) {
+                ret = sock_handover_input(handle, &d3, &dsz3);
+                if (ret < 0)
+                    return ret;
+            }
             break;
         case PAL_TYPE_PROCESS:
             /* session key is part of handle but need to serialize SSL context */
@@ -149,7 +164,7 @@ static ssize_t handle_serialize(PAL_HANDLE handle, void** data) {
     }
 
     size_t hdlsz = handle_size(handle);
-    void* buffer = malloc(hdlsz + dsz1 + dsz2);
+    void* buffer = malloc(hdlsz + dsz1 + dsz2 + dsz3);
     if (!buffer) {
         ret = -PAL_ERROR_NOMEM;
         goto out;
@@ -161,16 +176,19 @@ static ssize_t handle_serialize(PAL_HANDLE handle, void** data) {
         memcpy(buffer + hdlsz, d1, dsz1);
     if (dsz2)
         memcpy(buffer + hdlsz + dsz1, d2, dsz2);
+    if (dsz3)
+        memcpy(buffer + hdlsz + dsz1 + dsz2, d3, dsz3);
 out:
     if (free_d1)
         free((void*)d1);
     if (free_d2)
         free((void*)d2);
+    free(d3);
     if (ret < 0)
         return ret;
 
     *data = buffer;
-    return hdlsz + dsz1 + dsz2;
+    return hdlsz + dsz1 + dsz2 + dsz3;
 }
 
 static int handle_deserialize(PAL_HANDLE* handle, const void* data, size_t size, int* fds) {
@@ -193,6 +211,7 @@ static int handle_deserialize(PAL_HANDLE* handle, const void* data, size_t size,
         case PAL_TYPE_PIPECLI:
             /* session key is part of handle but need to deserialize SSL context */
             hdl->pipe.fd = fds[0]; /* correct host FD must be passed to SSL context */
+            hdl->pipe.local = NULL; /* demoted before sending, see handle_serialize() */
             ret = _DkStreamSecureInit(hdl, hdl->pipe.is_server, &hdl->pipe.session_key,
                                       (LIB_SSL_CONTEXT**)&hdl->pipe.ssl_ctx,
                                       (const uint8_t*)hdl + hdlsz, size - hdlsz);
@@ -218,7 +237,32 @@ static int handle_deserialize(PAL_HANDLE* handle, const void* data, size_t size,
             if (s1)
                 hdl->sock.bind = (PAL_PTR)hdl + hdlsz;
             if (s2)
-                hdl->sock.conn = (PAL_PTR)hdl + hdlsz + s2;
+                hdl->sock.conn = (PAL_PTR)hdl + hdlsz + s1;
+            /* connections accepted ahead stay with the sender; input the sender took out of its
+             * socket ring (or did not read from its own parked input) comes after the addresses */
+            HANDLE_HDR(hdl)->flags &= ~RFD(1);
+            hdl->sock.bell      = PAL_IDX_POISON;
+            hdl->sock.accepted  = NULL;
+            hdl->sock.ring      = NULL;
+            hdl->sock.parked    = NULL;
+            hdl->sock.busy_poll = 0;
+            HANDLE_HDR(hdl)->flags |= RFD(0);
+            if (size > hdlsz + s1 + s2) {
+                ret = sock_park_input(hdl, (const char*)hdl + hdlsz + s1 + s2,
+                                      size - hdlsz - s1 - s2);
+                if (ret < 0) {
+                    free(hdl);
+                    return ret;
+                }
+            }
+            if (HANDLE_HDR(hdl)->type == PAL_TYPE_TCPSRV) {
+                /* start with a fresh doorbell */
+                int bell = ocall_eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+                if (bell >= 0) {
+                    hdl->sock.bell = bell;
+                    HANDLE_HDR(hdl)->flags |= RFD(1);
+                }
+            }
             break;
         }
         case PAL_TYPE_PROCESS:
@@ -271,6 +315,12 @@ int _DkSendHandle(PAL_HANDLE hdl, PAL_HANDLE cargo) {
     int nfds = 0;
     for (int i = 0; i < MAX_FDS; i++)
         if (HANDLE_HDR(cargo)->flags & (RFD(i) | WFD(i))) {
+            /* the socket doorbell tracks input parked in this process only */
+            if (i == 1 && (HANDLE_HDR(cargo)->type == PAL_TYPE_TCP
+                           || HANDLE_HDR(cargo)->type == PAL_TYPE_TCPSRV
+                           || HANDLE_HDR(cargo)->type == PAL_TYPE_UDP
+                           || HANDLE_HDR(cargo)->type == PAL_TYPE_UDPSRV))
+                continue;
             hdl_hdr.fds |= 1U << i;
             fds[nfds++] = cargo->generic.fds[i];
         }
@@ -360,8 +410,11 @@ int _DkReceiveHandle(PAL_HANDLE hdl, PAL_HANDLE* cargo) {
     if (ret < 0)
         return unix_to_pal_error(ret);
 
-    /* finally receive the serialized cargo as payload (possibly encrypted) */
-    char hdl_data[hdl_hdr.data_size];
+    /* finally receive the serialized cargo as payload (possibly encrypted); it may carry the
+     * input of a socket, too large for the stack */
+    char* hdl_data = malloc(hdl_hdr.data_size);
+    if (!hdl_data)
+        return -PAL_ERROR_NOMEM;
 
     if (hdl->process.ssl_ctx) {
         ret = _DkStreamSecureRead(hdl->process.ssl_ctx, (uint8_t*)hdl_data, hdl_hdr.data_size,
@@ -370,19 +423,24 @@ int _DkReceiveHandle(PAL_HANDLE hdl, PAL_HANDLE* cargo) {
         ret = ocall_read(fd, hdl_data, hdl_hdr.data_size);
         ret = ret < 0 ? unix_to_pal_error(ret) : ret;
     }
-    if (ret < 0)
+    if (ret < 0) {
+        free(hdl_data);
         return ret;
+    }
 
     /* prepare array of FDs from the received FDs-to-transfer */
     struct cmsghdr* control_hdr = (struct cmsghdr*)control_buf;
-    if (!control_hdr || control_hdr->cmsg_type != SCM_RIGHTS)
+    if (!control_hdr || control_hdr->cmsg_type != SCM_RIGHTS) {
+        free(hdl_data);
         return -PAL_ERROR_DENIED;
+    }
 
     int* fds = (int*)CMSG_DATA(control_hdr);
 
     /* deserialize cargo handle from a blob hdl_data */
     PAL_HANDLE handle = NULL;
     ret = handle_deserialize(&handle, hdl_data, hdl_hdr.data_size, fds);
+    free(hdl_data);
     if (ret < 0)
         return ret;
 
@@ -402,6 +460,26 @@ int _DkReceiveHandle(PAL_HANDLE hdl, PAL_HANDLE* cargo) {
     return 0;
 }
 
+/* Handles are sent one by one here: the data of each handle goes through the (possibly encrypted)
+ * process stream, with its own framing for the host FDs. */
+int _DkSendHandles(PAL_HANDLE hdl, PAL_HANDLE* cargos, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        int ret = _DkSendHandle(hdl, cargos[i]);
+        if (ret < 0)
+            return ret;
+    }
+    return 0;
+}
+
+int _DkReceiveHandles(PAL_HANDLE hdl, PAL_HANDLE* cargos, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        int ret = _DkReceiveHandle(hdl, &cargos[i]);
+        if (ret < 0)
+            return ret;
+    }
+    return 0;
+}
+
 int _DkInitDebugStream(const char* path) {
     int ret;
 
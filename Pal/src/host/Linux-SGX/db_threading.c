@@ -14,6 +14,8 @@
 
 #include "api.h"
 #include "ecall_types.h"
+#include "enclave_edmm.h"
+#include "enclave_pages.h"
 #include "list.h"
 #include "pal.h"
 #include "pal_defs.h"
@@ -34,6 +36,14 @@ struct thread_param {
 };
 
 extern void* g_enclave_base;
+extern void enclave_entry(void);
+
+uint32_t g_enclave_tcs_cnt = 1;
+uint32_t g_enclave_max_tcs_cnt = 1;
+
+/* enclave threads that hold or are about to take a TCS slot, including the first thread; protected
+ * by `g_thread_list_lock` (as is `g_enclave_tcs_cnt`) */
+static uint32_t g_enclave_threads_cnt = 1;
 
 /*
  * We do not currently handle tid counter wrap-around, and could, in
@@ -93,6 +103,105 @@ void pal_start_thread(void) {
     /* UNREACHABLE */
 }
 
+/*
+ * Creates a new thread context with EDMM: TCS, TLS and SSA pages, stack and signal stack, all taken
+ * from the enclave heap, set up the same way the loader sets up the static ones (see sgx_main.c).
+ * The host cannot see or change the contents before the TCS is accepted, and after that the TCS
+ * page is not accessible to anybody. Thread contexts are never freed, a TCS slot is reused by later
+ * threads once its thread exits.
+ */
+static int create_tcs(uint32_t thread_idx, void** out_tcs) {
+    struct enclave_tls* cur_tls = get_tcb_trts();
+    size_t ssa_frame_size = (void*)cur_tls->gpr + sizeof(*cur_tls->gpr) - cur_tls->ssa;
+    size_t ssa_size = ssa_frame_size * SSA_FRAME_NUM;
+    size_t size = ENCLAVE_SIG_STACK_SIZE + ENCLAVE_STACK_SIZE + ssa_size + 2 * g_page_size;
+
+    void* addr = get_enclave_pages(/*addr=*/NULL, size, /*is_pal_internal=*/true);
+    if (!addr)
+        return -PAL_ERROR_NOMEM;
+
+    void* sig_stack = addr;
+    void* stack     = sig_stack + ENCLAVE_SIG_STACK_SIZE;
+    void* ssa       = stack + ENCLAVE_STACK_SIZE;
+    struct enclave_tls* tls = ssa + ssa_size;
+    sgx_arch_tcs_t* tcs = (void*)tls + g_page_size;
+
+    memset(tls, 0, g_page_size);
+    tls->common.self = (PAL_TCB*)tls;
+    tls->common.stack_protector_canary = STACK_PROTECTOR_CANARY_DEFAULT;
+    tls->enclave_size = cur_tls->enclave_size;
+    tls->tcs_offset = (void*)tcs - g_enclave_base;
+    tls->thread_idx = thread_idx;
+    tls->initial_stack_addr = (uint64_t)stack + ENCLAVE_STACK_SIZE;
+    tls->sig_stack_low = (uint64_t)sig_stack;
+    tls->sig_stack_high = (uint64_t)sig_stack + ENCLAVE_SIG_STACK_SIZE;
+    tls->ssa = ssa;
+    tls->gpr = ssa + ssa_frame_size - sizeof(sgx_pal_gpr_t);
+    tls->manifest_size = cur_tls->manifest_size;
+    tls->heap_min = cur_tls->heap_min;
+    tls->heap_max = cur_tls->heap_max;
+    tls->edmm_enabled = cur_tls->edmm_enabled;
+    tls->thread = NULL;
+
+    memset(tcs, 0, g_page_size);
+    /* .ossa, .oentry, .ofs_base and .ogs_base are offsets from enclave base, not VAs */
+    tcs->ossa      = ssa - g_enclave_base;
+    tcs->nssa      = SSA_FRAME_NUM;
+    tcs->oentry    = (void*)&enclave_entry - g_enclave_base;
+    tcs->ofs_base  = 0;
+    tcs->ogs_base  = (void*)tls - g_enclave_base;
+    tcs->ofs_limit = 0xfff;
+    tcs->ogs_limit = 0xfff;
+
+    int ret = sgx_edmm_convert_to_tcs((uint64_t)tcs);
+    if (ret < 0) {
+        /* the page may be in any state now, so leak the whole context rather than reuse it */
+        return ret;
+    }
+
+    *out_tcs = tcs;
+    return 0;
+}
+
+/*
+ * Accounts for a new enclave thread. If all TCS slots may be taken, adds a new one (only possible
+ * with EDMM) and returns it in `*out_tcs`, so that the host can use it for the new thread.
+ */
+static int reserve_thread_slot(void** out_tcs) {
+    *out_tcs = NULL;
+
+    spinlock_lock(&g_thread_list_lock);
+    g_enclave_threads_cnt++;
+    bool need_tcs = g_enclave_threads_cnt > g_enclave_tcs_cnt
+                    && g_enclave_tcs_cnt < g_enclave_max_tcs_cnt;
+    uint32_t thread_idx = g_enclave_tcs_cnt;
+    if (need_tcs)
+        g_enclave_tcs_cnt++;
+    spinlock_unlock(&g_thread_list_lock);
+
+    if (!need_tcs) {
+        /* a TCS is free, or about to be freed by an exiting thread; if there is none, the host
+         * reports the failure */
+        return 0;
+    }
+
+    int ret = create_tcs(thread_idx, out_tcs);
+    if (ret < 0) {
+        log_warning("Cannot add a TCS for a new thread: %d", ret);
+        spinlock_lock(&g_thread_list_lock);
+        g_enclave_threads_cnt--;
+        spinlock_unlock(&g_thread_list_lock);
+        return ret;
+    }
+    return 0;
+}
+
+static void release_thread_slot(void) {
+    spinlock_lock(&g_thread_list_lock);
+    g_enclave_threads_cnt--;
+    spinlock_unlock(&g_thread_list_lock);
+}
+
 int _DkThreadCreate(PAL_HANDLE* handle, int (*callback)(void*), const void* param) {
     int ret;
     PAL_HANDLE new_thread = malloc(HANDLE_SIZE(thread));
@@ -115,16 +224,22 @@ int _DkThreadCreate(PAL_HANDLE* handle, int (*callback)(void*), const void* para
     thread_param->param    = param;
     new_thread->thread.param = (void*)thread_param;
 
+    void* new_tcs;
+    ret = reserve_thread_slot(&new_tcs);
+    if (ret < 0)
+        goto out_err;
+
     spinlock_lock(&g_thread_list_lock);
     LISTP_ADD_TAIL(&new_thread->thread, &g_thread_list, list);
     spinlock_unlock(&g_thread_list_lock);
 
-    ret = ocall_clone_thread();
+    ret = ocall_clone_thread(new_tcs);
     if (ret < 0) {
         ret = unix_to_pal_error(ret);
         spinlock_lock(&g_thread_list_lock);
         LISTP_DEL(&new_thread->thread, &g_thread_list, list);
         spinlock_unlock(&g_thread_list_lock);
+        release_thread_slot();
         goto out_err;
     }
 
@@ -158,11 +273,12 @@ noreturn void _DkThreadExit(int* clear_child_tid) {
     static_assert(sizeof(*clear_child_tid) == 4, "unexpected clear_child_tid size");
 
     /* main thread is not part of the g_thread_list */
+    spinlock_lock(&g_thread_list_lock);
     if (exiting_thread != &g_pal_control.first_thread->thread) {
-        spinlock_lock(&g_thread_list_lock);
         LISTP_DEL(exiting_thread, &g_thread_list, list);
-        spinlock_unlock(&g_thread_list_lock);
     }
+    g_enclave_threads_cnt--;
+    spinlock_unlock(&g_thread_list_lock);
 
     ocall_exit(0, /*is_exitgroup=*/false);
 }
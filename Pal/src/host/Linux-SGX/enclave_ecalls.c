@@ -76,7 +76,8 @@ void handle_ecall(long ecall_index, void* ecall_args, void* exit_target, void* e
     SET_ENCLAVE_TLS(ustack,          ursp);
     SET_ENCLAVE_TLS(ustack_top,      ursp);
     SET_ENCLAVE_TLS(clear_child_tid, NULL);
-    SET_ENCLAVE_TLS(untrusted_area_cache.in_use, 0UL);
+    for (size_t i = 0; i < UNTRUSTED_AREA_POOL_SIZE; i++)
+        get_tcb_trts()->untrusted_area_pool[i].in_use = 0;
 
     int64_t t = 0;
     if (__atomic_compare_exchange_n(&g_enclave_start_called.counter, &t, 1, /*weak=*/false,
@@ -0,0 +1,123 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* Copyright (C) 2021 Intel Corporation */
+
+/*
+ * SGX2 EDMM flows. The host (in-kernel SGX driver) performs the privileged part of each operation
+ * (EAUG on page fault, EMODPR, EMODT, final removal) and the enclave confirms it with EACCEPT. The
+ * host is untrusted: each confirmation checks that EPCM state is exactly as expected, so a host
+ * that skipped or faked its part makes EACCEPT fail and we bail out.
+ */
+
+#include "enclave_edmm.h"
+
+#include <stdalign.h>
+
+#include "api.h"
+#include "enclave_ocalls.h"
+#include "pal_error.h"
+#include "pal_internal.h"
+#include "pal_linux.h"
+#include "sgx_api.h"
+#include "sgx_arch.h"
+
+static int accept_pages(uint64_t addr, size_t count, uint64_t flags) {
+    alignas(64) sgx_arch_sec_info_t secinfo = {.flags = flags};
+
+    for (size_t i = 0; i < count; i++) {
+        int64_t ret = sgx_accept(&secinfo, (void*)(addr + i * g_page_size));
+        if (ret) {
+            log_error("EDMM: EACCEPT of page %#lx (flags %#lx) failed: %ld",
+                      addr + i * g_page_size, flags, ret);
+            return -PAL_ERROR_DENIED;
+        }
+    }
+    return 0;
+}
+
+static void extend_pages_permissions(uint64_t addr, size_t count, uint64_t prot) {
+    alignas(64) sgx_arch_sec_info_t secinfo = {.flags = prot};
+
+    for (size_t i = 0; i < count; i++)
+        sgx_modpe(&secinfo, (void*)(addr + i * g_page_size));
+}
+
+int sgx_edmm_add_pages(uint64_t addr, size_t count, uint64_t prot) {
+    /* EAUG always creates RW regular pages; the first touch (EACCEPT itself) makes the host
+     * augment the page in its page-fault handler */
+    int ret = accept_pages(addr, count,
+                           SGX_SECINFO_FLAGS_R | SGX_SECINFO_FLAGS_W | SGX_SECINFO_FLAGS_REG |
+                               SGX_SECINFO_FLAGS_PENDING);
+    if (ret < 0)
+        return ret;
+
+    if ((prot & SGX_SECINFO_FLAGS_RWX) == (SGX_SECINFO_FLAGS_R | SGX_SECINFO_FLAGS_W))
+        return 0;
+
+    return sgx_edmm_set_page_permissions(addr, count, prot);
+}
+
+int sgx_edmm_add_page_with_content(uint64_t addr, const void* src, uint64_t prot) {
+    alignas(64) sgx_arch_sec_info_t secinfo = {.flags = prot | SGX_SECINFO_FLAGS_REG};
+
+    int64_t ret = sgx_accept_copy(&secinfo, (void*)addr, src);
+    if (ret) {
+        log_error("EDMM: EACCEPTCOPY of page %#lx (flags %#lx) failed: %ld", addr, secinfo.flags,
+                  ret);
+        return -PAL_ERROR_DENIED;
+    }
+    return 0;
+}
+
+int sgx_edmm_remove_pages(uint64_t addr, size_t count) {
+    int ret = ocall_edmm_modify_pages_type(addr, count * g_page_size, SGX_PAGE_TYPE_TRIM);
+    if (ret < 0) {
+        log_error("EDMM: cannot trim pages %#lx-%#lx: %d", addr, addr + count * g_page_size, ret);
+        return -PAL_ERROR_DENIED;
+    }
+
+    ret = accept_pages(addr, count, SGX_SECINFO_FLAGS_TRIM | SGX_SECINFO_FLAGS_MODIFIED);
+    if (ret < 0)
+        return ret;
+
+    ret = ocall_edmm_remove_pages(addr, count * g_page_size);
+    if (ret < 0) {
+        /* pages are already trimmed and thus inaccessible to the enclave, so this is only a leak
+         * of EPC on the host side */
+        log_warning("EDMM: host failed to remove trimmed pages %#lx-%#lx: %d", addr,
+                    addr + count * g_page_size, ret);
+    }
+    return 0;
+}
+
+int sgx_edmm_convert_to_tcs(uint64_t addr) {
+    /* EMODT to TCS requires a read-write page; committed heap pages are RWX */
+    int ret = sgx_edmm_set_page_permissions(addr, 1, SGX_SECINFO_FLAGS_R | SGX_SECINFO_FLAGS_W);
+    if (ret < 0)
+        return ret;
+
+    ret = ocall_edmm_modify_pages_type(addr, g_page_size, SGX_PAGE_TYPE_TCS);
+    if (ret < 0) {
+        log_error("EDMM: cannot change type of page %#lx to TCS: %d", addr, ret);
+        return -PAL_ERROR_DENIED;
+    }
+
+    return accept_pages(addr, 1, SGX_SECINFO_FLAGS_TCS | SGX_SECINFO_FLAGS_MODIFIED);
+}
+
+int sgx_edmm_set_page_permissions(uint64_t addr, size_t count, uint64_t prot) {
+    /* EMODPE is a no-op for permissions the page already has, so extend first (in case some
+     * pages are narrower than `prot`) and only then ask the host to restrict the rest */
+    extend_pages_permissions(addr, count, prot);
+
+    if ((prot & SGX_SECINFO_FLAGS_RWX) == SGX_SECINFO_FLAGS_RWX)
+        return 0;
+
+    int ret = ocall_edmm_restrict_pages_perm(addr, count * g_page_size, prot);
+    if (ret < 0) {
+        log_error("EDMM: cannot restrict permissions of pages %#lx-%#lx: %d", addr,
+                  addr + count * g_page_size, ret);
+        return -PAL_ERROR_DENIED;
+    }
+
+    return accept_pages(addr, count, prot | SGX_SECINFO_FLAGS_REG | SGX_SECINFO_FLAGS_PR);
+}
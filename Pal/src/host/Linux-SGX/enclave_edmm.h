@@ -0,0 +1,33 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* Copyright (C) 2021 Intel Corporation */
+
+/* Helpers for SGX2 Enclave Dynamic Memory Management (EDMM). All functions operate on whole pages
+ * and return 0 on success or negative PAL error code otherwise. */
+
+#ifndef ENCLAVE_EDMM_H
+#define ENCLAVE_EDMM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Accepts `count` pages starting at `addr` that were augmented (EAUG) by the host and extends
+ * their permissions to `prot` (combination of SGX_SECINFO_FLAGS_R/W/X). */
+int sgx_edmm_add_pages(uint64_t addr, size_t count, uint64_t prot);
+
+/* Accepts the page at `addr` that was augmented (EAUG) by the host, initializing it with the
+ * contents of the enclave page at `src` and with permissions `prot` (must include
+ * SGX_SECINFO_FLAGS_R). */
+int sgx_edmm_add_page_with_content(uint64_t addr, const void* src, uint64_t prot);
+
+/* Trims `count` committed pages starting at `addr` and returns them to the host. */
+int sgx_edmm_remove_pages(uint64_t addr, size_t count);
+
+/* Turns the committed regular page at `addr`, already filled with valid TCS contents, into a TCS
+ * page. */
+int sgx_edmm_convert_to_tcs(uint64_t addr);
+
+/* Sets EPCM permissions of `count` committed pages starting at `addr` to `prot`; pages are
+ * assumed to currently have RWX or narrower permissions. */
+int sgx_edmm_set_page_permissions(uint64_t addr, size_t count, uint64_t prot);
+
+#endif /* ENCLAVE_EDMM_H */
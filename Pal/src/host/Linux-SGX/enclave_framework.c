@@ -1,3 +1,5 @@
+#include <asm/fcntl.h>
+#include <stdarg.h>
 #include <stdbool.h>
 
 #include "api.h"
@@ -21,7 +23,9 @@
 void* g_enclave_base;
 void* g_enclave_top;
 
-static int register_file(const char* uri, const char* checksum_str, bool check_duplicates);
+static int register_file(const char* uri, const char* checksum_str,
+                         const char* chunk_hashes_sha256_str, uint64_t chunk_hashes_offset,
+                         bool check_duplicates);
 
 bool sgx_is_completely_within_enclave(const void* addr, size_t size) {
     if ((uintptr_t)addr > UINTPTR_MAX - size) {
@@ -123,6 +127,51 @@ bool sgx_copy_to_enclave(void* ptr, size_t maxsize, const void* uptr, size_t usi
     return true;
 }
 
+size_t g_nontemporal_copy_threshold = 0;
+
+/* Copies `size` bytes with non-temporal stores, 64 bytes per iteration (the unaligned head and the
+ * tail are copied by memcpy). */
+static void memcpy_nontemporal(void* dest, const void* src, size_t size) {
+    char* d = dest;
+    const char* s = src;
+
+    size_t head = MIN(ALIGN_UP((uintptr_t)d, 16) - (uintptr_t)d, size);
+    memcpy(d, s, head);
+    d += head;
+    s += head;
+    size -= head;
+
+    for (; size >= 64; size -= 64, d += 64, s += 64) {
+        __asm__ volatile(
+            "movdqu 0(%1), %%xmm0\n"
+            "movdqu 16(%1), %%xmm1\n"
+            "movdqu 32(%1), %%xmm2\n"
+            "movdqu 48(%1), %%xmm3\n"
+            "movntdq %%xmm0, 0(%0)\n"
+            "movntdq %%xmm1, 16(%0)\n"
+            "movntdq %%xmm2, 32(%0)\n"
+            "movntdq %%xmm3, 48(%0)\n"
+            :: "r"(d), "r"(s) : "xmm0", "xmm1", "xmm2", "xmm3", "memory");
+    }
+    /* non-temporal stores are weakly ordered, make them visible before the host reads the buffer */
+    __asm__ volatile("sfence" ::: "memory");
+
+    memcpy(d, s, size);
+}
+
+bool sgx_copy_from_enclave(void* uptr, const void* ptr, size_t size) {
+    if (!sgx_is_completely_outside_enclave(uptr, size) ||
+        !sgx_is_completely_within_enclave(ptr, size)) {
+        return false;
+    }
+    if (g_nontemporal_copy_threshold && size >= g_nontemporal_copy_threshold) {
+        memcpy_nontemporal(uptr, ptr, size);
+    } else {
+        memcpy(uptr, ptr, size);
+    }
+    return true;
+}
+
 static void print_report(sgx_report_t* r) {
     log_debug("  cpu_svn:     %s",     ALLOCA_BYTES2HEXSTR(r->body.cpu_svn.svn));
     log_debug("  mr_enclave:  %s",     ALLOCA_BYTES2HEXSTR(r->body.mr_enclave.m));
@@ -188,34 +237,135 @@ int sgx_verify_report(sgx_report_t* report) {
     return 0;
 }
 
-DEFINE_LISTP(trusted_file);
-static LISTP_TYPE(trusted_file) g_trusted_file_list = LISTP_INIT;
+/* Trusted and allowed files are kept in two hash tables keyed by path, both protected by
+ * `g_trusted_file_lock`. Trusted files are matched exactly, allowed files are matched by looking up
+ * each parent directory of the path (see find_allowed_file()), so that lookups do not depend on the
+ * number of files in the manifest. */
+static struct trusted_file* g_allowed_file_map = NULL;
+static struct trusted_file* g_trusted_file_map = NULL;
 static spinlock_t g_trusted_file_lock = INIT_SPINLOCK_UNLOCKED;
 static int g_file_check_policy = FILE_CHECK_POLICY_STRICT;
 
-/* assumes `path` is normalized */
-static bool path_is_equal_or_subpath(const struct trusted_file* tf, const char* path,
-                                     size_t path_len) {
-    const char* tf_path = tf->uri + URI_PREFIX_FILE_LEN;
-    size_t tf_path_len  = tf->uri_len - URI_PREFIX_FILE_LEN;
+/* host path of the file with precomputed chunk hashes ("sgx.trusted_chunk_hashes_file"), or NULL */
+static char* g_trusted_chunk_hashes_path = NULL;
+
+/* host path prefix of the log of used trusted files ("sgx.trusted_files_usage_log"), or NULL */
+static char* g_trusted_files_usage_log_path = NULL;
+
+/*
+ * Cache of verified trusted-file chunks, enabled by `sgx.trusted_files_cache_size`. Programs (and
+ * LibOS on execve) map the same libraries again and again; with the cache, a chunk that was
+ * already verified is copied from enclave memory instead of being copied from the host and hashed
+ * again. The cache is direct-mapped: a chunk is identified by its entry in the chunk hashes of its
+ * trusted file (these arrays live as long as the enclave), which also picks its slot.
+ */
+struct chunk_cache_slot {
+    const sgx_chunk_hash_t* key; /* NULL if the slot is empty */
+    size_t size;
+};
+
+static struct chunk_cache_slot* g_chunk_cache_slots = NULL;
+static uint8_t* g_chunk_cache_data = NULL; /* TRUSTED_CHUNK_SIZE bytes per slot */
+static size_t g_chunk_cache_slots_cnt = 0;
+static spinlock_t g_chunk_cache_lock = INIT_SPINLOCK_UNLOCKED;
+
+static size_t chunk_cache_slot(const sgx_chunk_hash_t* key) {
+    return ((uintptr_t)key / sizeof(*key)) % g_chunk_cache_slots_cnt;
+}
 
-    if (tf_path_len > path_len || memcmp(tf_path, path, tf_path_len)) {
-        /* tf path is not a prefix of `path` */
+bool trusted_chunk_cache_get(const sgx_chunk_hash_t* key, uint8_t* buf, size_t size) {
+    if (!g_chunk_cache_slots_cnt)
         return false;
+
+    size_t idx = chunk_cache_slot(key);
+    bool found = false;
+    spinlock_lock(&g_chunk_cache_lock);
+    if (g_chunk_cache_slots[idx].key == key && g_chunk_cache_slots[idx].size == size) {
+        memcpy(buf, g_chunk_cache_data + idx * TRUSTED_CHUNK_SIZE, size);
+        found = true;
     }
-    if (tf_path_len == path_len) {
-        /* Both are equal */
-        return true;
+    spinlock_unlock(&g_chunk_cache_lock);
+    return found;
+}
+
+void trusted_chunk_cache_put(const sgx_chunk_hash_t* key, const uint8_t* data, size_t size) {
+    if (!g_chunk_cache_slots_cnt)
+        return;
+
+    size_t idx = chunk_cache_slot(key);
+    spinlock_lock(&g_chunk_cache_lock);
+    memcpy(g_chunk_cache_data + idx * TRUSTED_CHUNK_SIZE, data, size);
+    g_chunk_cache_slots[idx].key  = key;
+    g_chunk_cache_slots[idx].size = size;
+    spinlock_unlock(&g_chunk_cache_lock);
+}
+
+static int init_chunk_cache(void) {
+    uint64_t cache_size;
+    int ret = toml_sizestring_in(g_pal_state.manifest_root, "sgx.trusted_files_cache_size",
+                                 /*defaultval=*/0, &cache_size);
+    if (ret < 0) {
+        log_error("Cannot parse 'sgx.trusted_files_cache_size'");
+        return -PAL_ERROR_INVAL;
     }
-    if (tf_path[tf_path_len - 1] == '/') {
-        /* tf path is a subpath of `path` (with slash), e.g. "foo/" and "foo/bar" */
-        return true;
+
+    size_t slots_cnt = cache_size / TRUSTED_CHUNK_SIZE;
+    if (!slots_cnt)
+        return 0;
+
+    g_chunk_cache_slots = calloc(slots_cnt, sizeof(*g_chunk_cache_slots));
+    g_chunk_cache_data = malloc(slots_cnt * TRUSTED_CHUNK_SIZE);
+    if (!g_chunk_cache_slots || !g_chunk_cache_data) {
+        log_error("Cannot allocate %lu bytes for 'sgx.trusted_files_cache_size' (increase "
+                  "'loader.pal_internal_mem_size')", cache_size);
+        free(g_chunk_cache_slots);
+        free(g_chunk_cache_data);
+        g_chunk_cache_slots = NULL;
+        g_chunk_cache_data = NULL;
+        return -PAL_ERROR_NOMEM;
     }
-    if (path[tf_path_len] == '/') {
-        /* tf path is a subpath of `path` (without slash), e.g. "foo" and "foo/bar" */
-        return true;
+    g_chunk_cache_slots_cnt = slots_cnt;
+    return 0;
+}
+
+/* chunk hashes received from the parent process, applied in init_trusted_files() */
+static void* g_inherited_chunk_hashes = NULL;
+static size_t g_inherited_chunk_hashes_size = 0;
+
+/* header of one trusted file in the serialized chunk hashes, followed by the URI (without NULL
+ * terminator) and DIV_ROUND_UP(size, TRUSTED_CHUNK_SIZE) chunk hashes */
+struct chunk_hashes_record {
+    uint64_t uri_len;
+    uint64_t size;
+};
+
+/* Finds the allowed file entry for `path` itself or for one of its parent directories (registered
+ * with or without trailing slash, e.g. "foo" or "foo/" for "foo/bar"). Assumes `path` is normalized;
+ * must be called with `g_trusted_file_lock` held. */
+static struct trusted_file* find_allowed_file(const char* path, size_t path_len) {
+    struct trusted_file* tf;
+    HASH_FIND(hh, g_allowed_file_map, path, path_len, tf);
+
+    for (size_t i = 0; !tf && i < path_len; i++) {
+        if (path[i] != '/')
+            continue;
+        if (i > 0)
+            HASH_FIND(hh, g_allowed_file_map, path, i, tf);
+        if (!tf)
+            HASH_FIND(hh, g_allowed_file_map, path, i + 1, tf);
     }
-    return false;
+    return tf;
+}
+
+/* assumes `uri` starts with URI_PREFIX_FILE; must be called with `g_trusted_file_lock` held */
+static struct trusted_file* find_registered_file(const char* uri, size_t uri_len) {
+    struct trusted_file* tf;
+    HASH_FIND(hh, g_trusted_file_map, uri + URI_PREFIX_FILE_LEN, uri_len - URI_PREFIX_FILE_LEN,
+              tf);
+    if (!tf)
+        HASH_FIND(hh, g_allowed_file_map, uri + URI_PREFIX_FILE_LEN, uri_len - URI_PREFIX_FILE_LEN,
+                  tf);
+    return tf;
 }
 
 struct trusted_file* get_trusted_or_allowed_file(const char* path) {
@@ -225,30 +375,101 @@ struct trusted_file* get_trusted_or_allowed_file(const char* path) {
 
     spinlock_lock(&g_trusted_file_lock);
 
-    struct trusted_file* tmp;
-    LISTP_FOR_EACH_ENTRY(tmp, &g_trusted_file_list, list) {
-        if (tmp->allowed) {
-            /* allowed files: must be a subfolder or file */
-            if (path_is_equal_or_subpath(tmp, path, path_len)) {
-                tf = tmp;
-                break;
-            }
-        } else {
-            /* trusted files: must be exactly the same URI */
-            const char* tf_path = tmp->uri + URI_PREFIX_FILE_LEN;
-            size_t tf_path_len  = tmp->uri_len - URI_PREFIX_FILE_LEN;
-            if (tf_path_len == path_len && !memcmp(tf_path, path, path_len + 1)) {
-                tf = tmp;
-                break;
-            }
-        }
-    }
+    /* allowed files: must be a subfolder or file; they are registered before trusted files and
+     * thus take precedence */
+    tf = find_allowed_file(path, path_len);
+
+    /* trusted files: must be exactly the same path */
+    if (!tf)
+        HASH_FIND(hh, g_trusted_file_map, path, path_len, tf);
 
     spinlock_unlock(&g_trusted_file_lock);
 
     return tf;
 }
 
+/* The size of a trusted file is only needed once the file is opened, so it is taken then (from the
+ * stat of the opened host file) instead of being queried at startup, where it would cost one OCALL
+ * per trusted file in the manifest. */
+static void get_trusted_file_size(struct trusted_file* tf, uint64_t host_size, uint64_t* out_size) {
+    /* another thread may have opened the same file in the meantime, the first size wins */
+    spinlock_lock(&g_trusted_file_lock);
+    if (!tf->size_known) {
+        tf->size = host_size;
+        tf->size_known = true;
+    }
+    *out_size = tf->size;
+    spinlock_unlock(&g_trusted_file_lock);
+}
+
+/* Reads the chunk hashes of a trusted file precomputed by the signer into `chunk_hashes` and
+ * verifies them against the root hash from the manifest. This is O(number of chunks) instead of
+ * O(file size); the file contents are verified lazily, chunk by chunk, in
+ * copy_and_verify_trusted_file(). */
+static int load_precomputed_chunk_hashes(struct trusted_file* tf, sgx_chunk_hash_t* chunk_hashes,
+                                         size_t chunks_cnt) {
+    int ret;
+
+    if (!g_trusted_chunk_hashes_path) {
+        log_error("Trusted file %s has precomputed chunk hashes, but the manifest does not "
+                  "specify 'sgx.trusted_chunk_hashes_file'", tf->uri);
+        return -PAL_ERROR_DENIED;
+    }
+
+    int fd = ocall_open(g_trusted_chunk_hashes_path, O_RDONLY | O_CLOEXEC, 0);
+    if (fd < 0) {
+        log_error("Cannot open chunk hashes file %s: %d", g_trusted_chunk_hashes_path, fd);
+        return unix_to_pal_error(fd);
+    }
+
+    /* the chunk hashes are read directly into enclave memory, so they cannot be modified by the
+     * host after being verified */
+    size_t chunk_hashes_size = chunks_cnt * sizeof(*chunk_hashes);
+    size_t done = 0;
+    while (done < chunk_hashes_size) {
+        ssize_t bytes = ocall_pread(fd, (uint8_t*)chunk_hashes + done, chunk_hashes_size - done,
+                                    tf->chunk_hashes_offset + done);
+        if (bytes == -EINTR)
+            continue;
+        if (bytes <= 0) {
+            log_error("Cannot read chunk hashes of trusted file %s", tf->uri);
+            ret = bytes < 0 ? unix_to_pal_error(bytes) : -PAL_ERROR_DENIED;
+            goto out;
+        }
+        done += bytes;
+    }
+
+    /* the root hash also covers the file size, so that the file cannot be truncated or extended
+     * within its last chunk without notice */
+    LIB_SHA256_CONTEXT root_sha;
+    sgx_file_hash_t root_hash;
+    uint64_t file_size = tf->size;
+
+    ret = lib_SHA256Init(&root_sha);
+    if (ret < 0)
+        goto out;
+    ret = lib_SHA256Update(&root_sha, (uint8_t*)&file_size, sizeof(file_size));
+    if (ret < 0)
+        goto out;
+    ret = lib_SHA256Update(&root_sha, (uint8_t*)chunk_hashes, chunk_hashes_size);
+    if (ret < 0)
+        goto out;
+    ret = lib_SHA256Final(&root_sha, root_hash.bytes);
+    if (ret < 0)
+        goto out;
+
+    if (memcmp(&root_hash, &tf->chunk_hashes_root, sizeof(root_hash))) {
+        log_error("Chunk hashes of trusted file %s do not match the manifest", tf->uri);
+        ret = -PAL_ERROR_DENIED;
+        goto out;
+    }
+
+    ret = 0;
+out:
+    ocall_close(fd);
+    return ret;
+}
+
 int load_trusted_or_allowed_file(struct trusted_file* tf, PAL_HANDLE file, bool create,
                                  sgx_chunk_hash_t** out_chunk_hashes, uint64_t* out_size,
                                  void** out_umem) {
@@ -271,7 +492,8 @@ int load_trusted_or_allowed_file(struct trusted_file* tf, PAL_HANDLE file, bool
             return ret;
         }
 
-        ret = register_file(uri, /*checksum_str=*/NULL, /*check_duplicates=*/true);
+        ret = register_file(uri, /*checksum_str=*/NULL, /*chunk_hashes_sha256_str=*/NULL,
+                            /*chunk_hashes_offset=*/0, /*check_duplicates=*/true);
 
         free(uri);
         return ret;
@@ -282,6 +504,10 @@ int load_trusted_or_allowed_file(struct trusted_file* tf, PAL_HANDLE file, bool
         return 0;
     }
 
+    /* only reported with `sgx.enable_stats`, but cheap enough to always track */
+    if (!__atomic_load_n(&tf->used, __ATOMIC_RELAXED))
+        __atomic_store_n(&tf->used, true, __ATOMIC_RELAXED);
+
     /* trusted files: need integrity, so calculate chunk hashes and compare with hash in manifest */
     if (!file->file.seekable)
         return -PAL_ERROR_DENIED;
@@ -289,11 +515,21 @@ int load_trusted_or_allowed_file(struct trusted_file* tf, PAL_HANDLE file, bool
     sgx_chunk_hash_t* chunk_hashes = NULL;
     uint8_t* tmp_chunk = NULL; /* scratch buf to calculate whole-file and chunk-of-file hashes */
 
+    /* the caller set `file->file.total` from the stat of the opened file */
+    get_trusted_file_size(tf, file->file.total, out_size);
+
+    /* If the whole file is about to be hashed (first open, no precomputed chunk hashes), let the
+     * host read it in and populate the mapping at once: otherwise hashing takes one host page fault,
+     * and thus one enclave exit, per page of the file. This is a hint only, so it is fine to check
+     * `tf->chunk_hashes` without the lock. */
+    int map_flags = MAP_SHARED;
+    if (!tf->has_chunk_hashes_root && !READ_ONCE(tf->chunk_hashes))
+        map_flags |= MAP_POPULATE;
+
     /* mmap the whole trusted file in untrusted memory for future reads/writes; it is
      * caller's responsibility to unmap those areas after use */
-    *out_size = tf->size;
     if (*out_size) {
-        ret = ocall_mmap_untrusted(out_umem, tf->size, PROT_READ, MAP_SHARED, file->file.fd,
+        ret = ocall_mmap_untrusted(out_umem, tf->size, PROT_READ, map_flags, file->file.fd,
                                    /*offset=*/0);
         if (ret < 0) {
             *out_umem = NULL;
@@ -310,12 +546,20 @@ int load_trusted_or_allowed_file(struct trusted_file* tf, PAL_HANDLE file, bool
     }
     spinlock_unlock(&g_trusted_file_lock);
 
-    chunk_hashes = malloc(sizeof(sgx_chunk_hash_t) * DIV_ROUND_UP(tf->size, TRUSTED_CHUNK_SIZE));
+    size_t chunks_cnt = DIV_ROUND_UP(tf->size, TRUSTED_CHUNK_SIZE);
+    chunk_hashes = malloc(sizeof(sgx_chunk_hash_t) * chunks_cnt);
     if (!chunk_hashes) {
         ret = -PAL_ERROR_NOMEM;
         goto fail;
     }
 
+    if (tf->has_chunk_hashes_root) {
+        ret = load_precomputed_chunk_hashes(tf, chunk_hashes, chunks_cnt);
+        if (ret < 0)
+            goto fail;
+        goto out_publish;
+    }
+
     tmp_chunk = malloc(TRUSTED_CHUNK_SIZE);
     if (!tmp_chunk) {
         ret = -PAL_ERROR_NOMEM;
@@ -372,6 +616,7 @@ int load_trusted_or_allowed_file(struct trusted_file* tf, PAL_HANDLE file, bool
         goto fail;
     }
 
+out_publish:
     spinlock_lock(&g_trusted_file_lock);
     if (tf->chunk_hashes) {
         *out_chunk_hashes = tf->chunk_hashes;
@@ -427,33 +672,41 @@ int copy_and_verify_trusted_file(const char* path, uint8_t* buf, const void* ume
         size_t chunk_size = MIN(file_size - chunk_offset, TRUSTED_CHUNK_SIZE);
         off_t chunk_end   = chunk_offset + chunk_size;
 
-        sgx_chunk_hash_t chunk_hash[2]; /* each chunk_hash is 128 bits in size but we need 256 */
+        /* if current chunk-to-copy completely resides in the requested region-to-copy, directly
+         * copy into buf (without a scratch buffer) and hash in-place; otherwise read the file
+         * contents into a scratch buffer, verify hash and then copy only the part needed by the
+         * caller */
+        bool whole_chunk = chunk_offset >= offset && chunk_end <= end;
+        uint8_t* chunk_buf = whole_chunk ? buf_pos : tmp_chunk;
 
-        LIB_SHA256_CONTEXT chunk_sha;
-        ret = lib_SHA256Init(&chunk_sha);
-        if (ret < 0)
-            goto failed;
+        if (!trusted_chunk_cache_get(chunk_hashes_item, chunk_buf, chunk_size)) {
+            memcpy(chunk_buf, umem + chunk_offset, chunk_size);
 
-        if (chunk_offset >= offset && chunk_end <= end) {
-            /* if current chunk-to-copy completely resides in the requested region-to-copy,
-             * directly copy into buf (without a scratch buffer) and hash in-place */
-            memcpy(buf_pos, umem + chunk_offset, chunk_size);
-
-            ret = lib_SHA256Update(&chunk_sha, buf_pos, chunk_size);
+            /* each chunk_hash is 128 bits in size but we need 256 */
+            sgx_chunk_hash_t chunk_hash[2];
+            LIB_SHA256_CONTEXT chunk_sha;
+            ret = lib_SHA256Init(&chunk_sha);
             if (ret < 0)
                 goto failed;
-
-            buf_pos += chunk_size;
-        } else {
-            /* if current chunk-to-copy only partially overlaps with the requested region-to-copy,
-             * read the file contents into a scratch buffer, verify hash and then copy only the part
-             * needed by the caller */
-            memcpy(tmp_chunk, umem + chunk_offset, chunk_size);
-
-            ret = lib_SHA256Update(&chunk_sha, tmp_chunk, chunk_size);
+            ret = lib_SHA256Update(&chunk_sha, chunk_buf, chunk_size);
+            if (ret < 0)
+                goto failed;
+            ret = lib_SHA256Final(&chunk_sha, (uint8_t*)&chunk_hash[0]);
             if (ret < 0)
                 goto failed;
 
+            if (memcmp(chunk_hashes_item, &chunk_hash[0], sizeof(*chunk_hashes_item))) {
+                log_error("Accessing file '%s' is denied: incorrect hash of file chunk at "
+                          "%lu-%lu.", path, chunk_offset, chunk_end);
+                ret = -PAL_ERROR_DENIED;
+                goto failed;
+            }
+            trusted_chunk_cache_put(chunk_hashes_item, chunk_buf, chunk_size);
+        }
+
+        if (whole_chunk) {
+            buf_pos += chunk_size;
+        } else {
             /* determine which part of the chunk is needed by the caller */
             off_t copy_start = MAX(chunk_offset, offset);
             off_t copy_end   = MIN(chunk_offset + (off_t)chunk_size, end);
@@ -462,17 +715,6 @@ int copy_and_verify_trusted_file(const char* path, uint8_t* buf, const void* ume
             memcpy(buf_pos, tmp_chunk + copy_start - chunk_offset, copy_end - copy_start);
             buf_pos += copy_end - copy_start;
         }
-
-        ret = lib_SHA256Final(&chunk_sha, (uint8_t*)&chunk_hash[0]);
-        if (ret < 0)
-            goto failed;
-
-        if (memcmp(chunk_hashes_item, &chunk_hash[0], sizeof(*chunk_hashes_item))) {
-            log_error("Accessing file '%s' is denied: incorrect hash of file chunk at %lu-%lu.",
-                      path, chunk_offset, chunk_end);
-            ret = -PAL_ERROR_DENIED;
-            goto failed;
-        }
     }
 
     free(tmp_chunk);
@@ -484,7 +726,327 @@ failed:
     return ret;
 }
 
-static int register_file(const char* uri, const char* checksum_str, bool check_duplicates) {
+static size_t chunk_hashes_record_size(const struct trusted_file* tf) {
+    return sizeof(struct chunk_hashes_record) + tf->uri_len +
+           DIV_ROUND_UP(tf->size, TRUSTED_CHUNK_SIZE) * sizeof(sgx_chunk_hash_t);
+}
+
+void log_used_trusted_files(void) {
+    struct trusted_file* tf;
+    struct trusted_file* tmp;
+
+    spinlock_lock(&g_trusted_file_lock);
+    HASH_ITER(hh, g_trusted_file_map, tf, tmp) {
+        if (!tf->allowed && __atomic_load_n(&tf->used, __ATOMIC_RELAXED))
+            log_always("  Used trusted file: %s", tf->uri);
+    }
+    spinlock_unlock(&g_trusted_file_lock);
+}
+
+void mark_trusted_file_chunks_used(const char* path, uint64_t offset, uint64_t end) {
+    if (!g_trusted_files_usage_log_path || offset >= end)
+        return;
+
+    struct trusted_file* tf = get_trusted_or_allowed_file(path);
+    if (!tf || tf->allowed)
+        return;
+
+    /* the file is open, so its size is known and does not change anymore */
+    uint64_t chunks_cnt = DIV_ROUND_UP(tf->size, TRUSTED_CHUNK_SIZE);
+    uint64_t* used_chunks = __atomic_load_n(&tf->used_chunks, __ATOMIC_ACQUIRE);
+    if (!used_chunks) {
+        used_chunks = calloc(DIV_ROUND_UP(chunks_cnt, 64), sizeof(*used_chunks));
+        if (!used_chunks)
+            return; /* it is only a log, do not fail the read */
+        uint64_t* expected = NULL;
+        if (!__atomic_compare_exchange_n(&tf->used_chunks, &expected, used_chunks,
+                                         /*weak=*/false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            free(used_chunks);
+            used_chunks = expected;
+        }
+    }
+
+    uint64_t end_chunk = MIN(DIV_ROUND_UP(end, TRUSTED_CHUNK_SIZE), chunks_cnt);
+    for (uint64_t i = offset / TRUSTED_CHUNK_SIZE; i < end_chunk; i++)
+        __atomic_fetch_or(&used_chunks[i / 64], 1UL << (i % 64), __ATOMIC_RELAXED);
+}
+
+struct usage_log {
+    int fd;
+    size_t len;
+    char buf[URI_MAX + 256];
+};
+
+static int usage_log_flush(struct usage_log* log) {
+    size_t done = 0;
+    while (done < log->len) {
+        ssize_t ret = ocall_write(log->fd, log->buf + done, log->len - done);
+        if (ret == -EINTR)
+            continue;
+        if (ret < 0)
+            return unix_to_pal_error(ret);
+        done += ret;
+    }
+    log->len = 0;
+    return 0;
+}
+
+__attribute__((format(printf, 2, 3)))
+static int usage_log_printf(struct usage_log* log, const char* fmt, ...) {
+    while (true) {
+        size_t avail = sizeof(log->buf) - log->len;
+        va_list ap;
+        va_start(ap, fmt);
+        int len = vsnprintf(log->buf + log->len, avail, fmt, ap);
+        va_end(ap);
+        if (len < 0)
+            return -PAL_ERROR_INVAL;
+        if ((size_t)len < avail) {
+            log->len += len;
+            return 0;
+        }
+        if (!log->len)
+            return -PAL_ERROR_INVAL; /* does not fit even into an empty buffer */
+
+        int ret = usage_log_flush(log);
+        if (ret < 0)
+            return ret;
+    }
+}
+
+static bool chunk_used(const uint64_t* used_chunks, uint64_t idx) {
+    return __atomic_load_n(&used_chunks[idx / 64], __ATOMIC_RELAXED) & (1UL << (idx % 64));
+}
+
+static int write_trusted_file_usage(struct usage_log* log, struct trusted_file* tf) {
+    int ret = usage_log_printf(log, "%lu ", tf->size);
+    if (ret < 0)
+        return ret;
+
+    uint64_t* used_chunks = __atomic_load_n(&tf->used_chunks, __ATOMIC_ACQUIRE);
+    uint64_t chunks_cnt = DIV_ROUND_UP(tf->size, TRUSTED_CHUNK_SIZE);
+    bool any_used = false;
+    for (uint64_t i = 0; used_chunks && i < chunks_cnt; i++) {
+        if (!chunk_used(used_chunks, i))
+            continue;
+        uint64_t first = i;
+        while (i + 1 < chunks_cnt && chunk_used(used_chunks, i + 1))
+            i++;
+        if (first == i) {
+            ret = usage_log_printf(log, "%s%lu", any_used ? "," : "", first);
+        } else {
+            ret = usage_log_printf(log, "%s%lu-%lu", any_used ? "," : "", first, i);
+        }
+        if (ret < 0)
+            return ret;
+        any_used = true;
+    }
+
+    return usage_log_printf(log, "%s %s\n", any_used ? "" : "-", tf->uri);
+}
+
+int write_trusted_files_usage_log(void) {
+    if (!g_trusted_files_usage_log_path)
+        return 0;
+
+    struct usage_log* log = malloc(sizeof(*log));
+    if (!log)
+        return -PAL_ERROR_NOMEM;
+
+    int ret = snprintf(log->buf, sizeof(log->buf), "%s.%u", g_trusted_files_usage_log_path,
+                       g_pal_sec.pid);
+    if (ret < 0 || (size_t)ret >= sizeof(log->buf)) {
+        ret = -PAL_ERROR_INVAL;
+        goto out;
+    }
+    log->fd = ocall_open(log->buf, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (log->fd < 0) {
+        ret = unix_to_pal_error(log->fd);
+        goto out;
+    }
+    log->len = 0;
+
+    ret = usage_log_printf(log, "# chunk size %u; <file size> <read chunks> <uri>\n",
+                           TRUSTED_CHUNK_SIZE);
+    if (ret < 0)
+        goto out_close;
+
+    /* trusted files are only registered at startup, so the map can be walked without the lock
+     * (which must not be held over OCALLs) */
+    struct trusted_file* tf;
+    struct trusted_file* tmp;
+    HASH_ITER(hh, g_trusted_file_map, tf, tmp) {
+        if (!__atomic_load_n(&tf->used, __ATOMIC_RELAXED))
+            continue;
+        ret = write_trusted_file_usage(log, tf);
+        if (ret < 0)
+            goto out_close;
+    }
+    ret = usage_log_flush(log);
+
+out_close:
+    ocall_close(log->fd);
+out:
+    free(log);
+    return ret;
+}
+
+int serialize_trusted_files_chunk_hashes(void** out_buf, size_t* out_size) {
+    struct trusted_file* tf;
+    struct trusted_file* tmp;
+    size_t size = 0;
+
+    spinlock_lock(&g_trusted_file_lock);
+    HASH_ITER(hh, g_trusted_file_map, tf, tmp) {
+        if (tf->chunk_hashes)
+            size += chunk_hashes_record_size(tf);
+    }
+    spinlock_unlock(&g_trusted_file_lock);
+
+    *out_buf = NULL;
+    *out_size = 0;
+    if (!size)
+        return 0;
+
+    uint8_t* buf = malloc(size);
+    if (!buf)
+        return -PAL_ERROR_NOMEM;
+
+    /* more files may have been verified in the meantime, only take the ones that still fit */
+    size_t pos = 0;
+    spinlock_lock(&g_trusted_file_lock);
+    HASH_ITER(hh, g_trusted_file_map, tf, tmp) {
+        if (!tf->chunk_hashes)
+            continue;
+        size_t record_size = chunk_hashes_record_size(tf);
+        if (record_size > size - pos)
+            continue;
+
+        struct chunk_hashes_record record = {.uri_len = tf->uri_len, .size = tf->size};
+        memcpy(buf + pos, &record, sizeof(record));
+        memcpy(buf + pos + sizeof(record), tf->uri, tf->uri_len);
+        memcpy(buf + pos + sizeof(record) + tf->uri_len, tf->chunk_hashes,
+               record_size - sizeof(record) - tf->uri_len);
+        pos += record_size;
+    }
+    spinlock_unlock(&g_trusted_file_lock);
+
+    *out_buf = buf;
+    *out_size = pos;
+    return 0;
+}
+
+void set_inherited_trusted_files_chunk_hashes(void* buf, size_t size) {
+    assert(!g_inherited_chunk_hashes);
+    g_inherited_chunk_hashes = buf;
+    g_inherited_chunk_hashes_size = size;
+}
+
+/* Installs the chunk hashes received from the parent, which has already verified the files. The
+ * parent is an attested enclave with the same measurement, so the hashes can be trusted as if this
+ * enclave had computed them itself. Files whose size changed since then are skipped (they will be
+ * verified anew on open). */
+static int apply_inherited_chunk_hashes(void) {
+    int ret = 0;
+    uint8_t* buf = g_inherited_chunk_hashes;
+    size_t size = g_inherited_chunk_hashes_size;
+    size_t pos = 0;
+
+    while (pos < size) {
+        struct chunk_hashes_record record;
+        if (size - pos < sizeof(record)) {
+            ret = -PAL_ERROR_INVAL;
+            goto out;
+        }
+        memcpy(&record, buf + pos, sizeof(record));
+        pos += sizeof(record);
+
+        if (record.uri_len > size - pos) {
+            ret = -PAL_ERROR_INVAL;
+            goto out;
+        }
+        const char* uri = (const char*)buf + pos;
+        pos += record.uri_len;
+
+        size_t chunk_hashes_size = DIV_ROUND_UP(record.size, TRUSTED_CHUNK_SIZE) *
+                                   sizeof(sgx_chunk_hash_t);
+        if (chunk_hashes_size > size - pos) {
+            ret = -PAL_ERROR_INVAL;
+            goto out;
+        }
+        const uint8_t* chunk_hashes = buf + pos;
+        pos += chunk_hashes_size;
+
+        if (record.uri_len < URI_PREFIX_FILE_LEN || memcmp(uri, URI_PREFIX_FILE,
+                                                           URI_PREFIX_FILE_LEN))
+            continue;
+
+        struct trusted_file* found = NULL;
+        spinlock_lock(&g_trusted_file_lock);
+        HASH_FIND(hh, g_trusted_file_map, uri + URI_PREFIX_FILE_LEN,
+                  record.uri_len - URI_PREFIX_FILE_LEN, found);
+        spinlock_unlock(&g_trusted_file_lock);
+
+        if (!found || found->chunk_hashes)
+            continue;
+
+        /* only files inherited from the parent are looked up on the host already at startup */
+        if (!found->size_known) {
+            PAL_STREAM_ATTR attr;
+            if (_DkStreamAttributesQuery(found->uri, &attr) < 0)
+                continue;
+            spinlock_lock(&g_trusted_file_lock);
+            if (!found->size_known) {
+                found->size = attr.pending_size;
+                found->size_known = true;
+            }
+            spinlock_unlock(&g_trusted_file_lock);
+        }
+        if (found->size != record.size)
+            continue;
+
+        sgx_chunk_hash_t* copy = malloc(chunk_hashes_size);
+        if (!copy) {
+            ret = -PAL_ERROR_NOMEM;
+            goto out;
+        }
+        memcpy(copy, chunk_hashes, chunk_hashes_size);
+
+        spinlock_lock(&g_trusted_file_lock);
+        if (!found->chunk_hashes) {
+            found->chunk_hashes = copy;
+            copy = NULL;
+        }
+        spinlock_unlock(&g_trusted_file_lock);
+        free(copy);
+    }
+
+out:
+    free(g_inherited_chunk_hashes);
+    g_inherited_chunk_hashes = NULL;
+    g_inherited_chunk_hashes_size = 0;
+    return ret;
+}
+
+static int parse_file_hash(const char* str, sgx_file_hash_t* out_hash) {
+    if (strlen(str) != sizeof(*out_hash) * 2)
+        return -PAL_ERROR_INVAL;
+
+    for (size_t i = 0; i < sizeof(*out_hash); i++) {
+        int8_t byte1 = hex2dec(str[i * 2]);
+        int8_t byte2 = hex2dec(str[i * 2 + 1]);
+
+        if (byte1 < 0 || byte2 < 0)
+            return -PAL_ERROR_INVAL;
+
+        out_hash->bytes[i] = byte1 * 16 + byte2;
+    }
+    return 0;
+}
+
+static int register_file(const char* uri, const char* checksum_str,
+                         const char* chunk_hashes_sha256_str, uint64_t chunk_hashes_offset,
+                         bool check_duplicates) {
     int ret;
 
     if (checksum_str && strlen(checksum_str) != sizeof(sgx_file_hash_t) * 2) {
@@ -492,6 +1054,8 @@ static int register_file(const char* uri, const char* checksum_str, bool check_d
         return -PAL_ERROR_INVAL;
     }
 
+    assert(checksum_str || !chunk_hashes_sha256_str);
+
     size_t uri_len = strlen(uri);
     if (uri_len >= URI_MAX) {
         log_error("Size of file exceeds maximum %dB: %s", URI_MAX, uri);
@@ -503,49 +1067,42 @@ static int register_file(const char* uri, const char* checksum_str, bool check_d
          * initialization (because manifest is assumed to have no duplicates); skipping this check
          * significantly improves startup time */
         spinlock_lock(&g_trusted_file_lock);
-        struct trusted_file* tf;
-        LISTP_FOR_EACH_ENTRY(tf, &g_trusted_file_list, list) {
-            if (tf->uri_len == uri_len && !memcmp(tf->uri, uri, uri_len)) {
-                spinlock_unlock(&g_trusted_file_lock);
-                return 0;
-            }
-        }
+        struct trusted_file* tf = find_registered_file(uri, uri_len);
         spinlock_unlock(&g_trusted_file_lock);
+        if (tf)
+            return 0;
     }
 
     struct trusted_file* new = malloc(sizeof(*new) + uri_len + 1);
     if (!new)
         return -PAL_ERROR_NOMEM;
 
-    INIT_LIST_HEAD(new, list);
     new->size = 0;
+    new->size_known = false;
     new->chunk_hashes = NULL;
+    new->has_chunk_hashes_root = false;
+    new->chunk_hashes_offset = 0;
     new->allowed = false;
     new->uri_len = uri_len;
     memcpy(new->uri, uri, uri_len + 1);
 
     if (checksum_str) {
-        PAL_STREAM_ATTR attr;
-        ret = _DkStreamAttributesQuery(uri, &attr);
+        ret = parse_file_hash(checksum_str, &new->file_hash);
         if (ret < 0) {
-            log_error("Could not find size of file: %s", uri);
+            log_error("Could not parse checksum of file: %s", uri);
             free(new);
             return ret;
         }
-        new->size = attr.pending_size;
-
-        assert(strlen(checksum_str) == sizeof(sgx_file_hash_t) * 2);
-        for (size_t i = 0; i < sizeof(sgx_file_hash_t); i++) {
-            int8_t byte1 = hex2dec(checksum_str[i * 2]);
-            int8_t byte2 = hex2dec(checksum_str[i * 2 + 1]);
 
-            if (byte1 < 0 || byte2 < 0) {
-                log_error("Could not parse checksum of file: %s", uri);
+        if (chunk_hashes_sha256_str) {
+            ret = parse_file_hash(chunk_hashes_sha256_str, &new->chunk_hashes_root);
+            if (ret < 0) {
+                log_error("Could not parse hash of chunk hashes of file: %s", uri);
                 free(new);
-                return -PAL_ERROR_INVAL;
+                return ret;
             }
-
-            new->file_hash.bytes[i] = byte1 * 16 + byte2;
+            new->has_chunk_hashes_root = true;
+            new->chunk_hashes_offset = chunk_hashes_offset;
         }
     } else {
         memset(&new->file_hash, 0, sizeof(new->file_hash));
@@ -557,23 +1114,28 @@ static int register_file(const char* uri, const char* checksum_str, bool check_d
     if (check_duplicates) {
         /* this check is only done during runtime and not needed during initialization (see above);
          * we check again because same file could have been added by another thread in meantime */
-        struct trusted_file* tf;
-        LISTP_FOR_EACH_ENTRY(tf, &g_trusted_file_list, list) {
-            if (tf->uri_len == uri_len && !memcmp(tf->uri, uri, uri_len)) {
-                spinlock_unlock(&g_trusted_file_lock);
-                free(new);
-                return 0;
-            }
+        if (find_registered_file(uri, uri_len)) {
+            spinlock_unlock(&g_trusted_file_lock);
+            free(new);
+            return 0;
         }
     }
 
-    LISTP_ADD_TAIL(new, &g_trusted_file_list, list);
+    if (new->allowed) {
+        HASH_ADD_KEYPTR(hh, g_allowed_file_map, new->uri + URI_PREFIX_FILE_LEN,
+                        uri_len - URI_PREFIX_FILE_LEN, new);
+    } else {
+        HASH_ADD_KEYPTR(hh, g_trusted_file_map, new->uri + URI_PREFIX_FILE_LEN,
+                        uri_len - URI_PREFIX_FILE_LEN, new);
+    }
     spinlock_unlock(&g_trusted_file_lock);
 
     return 0;
 }
 
-static int normalize_and_register_file(const char* uri, const char* checksum_str) {
+static int normalize_and_register_file(const char* uri, const char* checksum_str,
+                                       const char* chunk_hashes_sha256_str,
+                                       uint64_t chunk_hashes_offset) {
     int ret;
 
     if (!strstartswith(uri, URI_PREFIX_FILE)) {
@@ -595,7 +1157,8 @@ static int normalize_and_register_file(const char* uri, const char* checksum_str
         goto out;
     }
 
-    ret = register_file(norm_uri, checksum_str, /*check_duplicates=*/false);
+    ret = register_file(norm_uri, checksum_str, chunk_hashes_sha256_str, chunk_hashes_offset,
+                        /*check_duplicates=*/false);
 out:
     free(norm_uri);
     return ret;
@@ -661,7 +1224,9 @@ static int init_trusted_files_from_toml_table(void) {
             goto out;
         }
 
-        ret = normalize_and_register_file(toml_trusted_file_str, toml_trusted_checksum_str);
+        ret = normalize_and_register_file(toml_trusted_file_str, toml_trusted_checksum_str,
+                                          /*chunk_hashes_sha256_str=*/NULL,
+                                          /*chunk_hashes_offset=*/0);
         if (ret < 0)
             goto out;
 
@@ -703,6 +1268,24 @@ static int init_trusted_files_from_toml_array(void) {
 
     char* toml_trusted_uri_str = NULL;
     char* toml_trusted_sha256_str = NULL;
+    char* toml_chunk_hashes_sha256_str = NULL;
+
+    ret = toml_string_in(g_pal_state.manifest_root, "sgx.trusted_chunk_hashes_file",
+                         &g_trusted_chunk_hashes_path);
+    if (ret < 0) {
+        log_error("Cannot parse 'sgx.trusted_chunk_hashes_file'");
+        return -PAL_ERROR_INVAL;
+    }
+    if (g_trusted_chunk_hashes_path) {
+        if (!strstartswith(g_trusted_chunk_hashes_path, URI_PREFIX_FILE)) {
+            log_error("Invalid URI [%s]: 'sgx.trusted_chunk_hashes_file' must start with 'file:'",
+                      g_trusted_chunk_hashes_path);
+            return -PAL_ERROR_INVAL;
+        }
+        /* strip the "file:" prefix in place, only the host path is needed */
+        memmove(g_trusted_chunk_hashes_path, g_trusted_chunk_hashes_path + URI_PREFIX_FILE_LEN,
+                strlen(g_trusted_chunk_hashes_path) - URI_PREFIX_FILE_LEN + 1);
+    }
 
     for (ssize_t i = 0; i < toml_trusted_files_cnt; i++) {
         /* read `sgx.trusted_file = {uri = "file:foo", sha256 = "deadbeef"}` entry from manifest */
@@ -742,20 +1325,46 @@ static int init_trusted_files_from_toml_array(void) {
             goto out;
         }
 
-        ret = normalize_and_register_file(toml_trusted_uri_str, toml_trusted_sha256_str);
+        /* optional `chunk_hashes_sha256 = "..", chunk_hashes_offset = ..` keys, generated by the
+         * signer for files with precomputed chunk hashes (see "sgx.lazy_trusted_files") */
+        ret = toml_string_in(toml_trusted_file, "chunk_hashes_sha256",
+                             &toml_chunk_hashes_sha256_str);
+        if (ret < 0) {
+            log_error("Invalid trusted file in manifest at index %ld ('chunk_hashes_sha256' is not "
+                      "a string)", i);
+            ret = -PAL_ERROR_INVAL;
+            goto out;
+        }
+
+        int64_t chunk_hashes_offset;
+        ret = toml_int_in(toml_trusted_file, "chunk_hashes_offset", /*defaultval=*/0,
+                          &chunk_hashes_offset);
+        if (ret < 0 || chunk_hashes_offset < 0) {
+            log_error("Invalid trusted file in manifest at index %ld ('chunk_hashes_offset' is not "
+                      "a non-negative integer)", i);
+            ret = -PAL_ERROR_INVAL;
+            goto out;
+        }
+
+        ret = normalize_and_register_file(toml_trusted_uri_str, toml_trusted_sha256_str,
+                                          toml_chunk_hashes_sha256_str,
+                                          (uint64_t)chunk_hashes_offset);
         if (ret < 0)
             goto out;
 
         free(toml_trusted_uri_str);
         free(toml_trusted_sha256_str);
+        free(toml_chunk_hashes_sha256_str);
         toml_trusted_uri_str = NULL;
         toml_trusted_sha256_str = NULL;
+        toml_chunk_hashes_sha256_str = NULL;
     }
 
     ret = 0;
 out:
     free(toml_trusted_uri_str);
     free(toml_trusted_sha256_str);
+    free(toml_chunk_hashes_sha256_str);
     return ret;
 }
 
@@ -797,7 +1406,9 @@ static int init_allowed_files_from_toml_table(void) {
             goto out;
         }
 
-        ret = normalize_and_register_file(toml_allowed_file_str, /*checksum_str=*/NULL);
+        ret = normalize_and_register_file(toml_allowed_file_str, /*checksum_str=*/NULL,
+                                          /*chunk_hashes_sha256_str=*/NULL,
+                                          /*chunk_hashes_offset=*/0);
         if (ret < 0)
             goto out;
 
@@ -848,7 +1459,9 @@ static int init_allowed_files_from_toml_array(void) {
             goto out;
         }
 
-        ret = normalize_and_register_file(toml_allowed_file_str, /*checksum_str=*/NULL);
+        ret = normalize_and_register_file(toml_allowed_file_str, /*checksum_str=*/NULL,
+                                          /*chunk_hashes_sha256_str=*/NULL,
+                                          /*chunk_hashes_offset=*/0);
         if (ret < 0)
             goto out;
 
@@ -865,6 +1478,17 @@ out:
 int init_trusted_files(void) {
     int ret;
 
+    ret = init_chunk_cache();
+    if (ret < 0)
+        return ret;
+
+    ret = toml_string_in(g_pal_state.manifest_root, "sgx.trusted_files_usage_log",
+                         &g_trusted_files_usage_log_path);
+    if (ret < 0) {
+        log_error("Cannot parse 'sgx.trusted_files_usage_log'");
+        return -PAL_ERROR_INVAL;
+    }
+
     /* first try legacy manifest syntax with TOML tables, i.e. `sgx.trusted_files.key = "file"` */
     ret = init_trusted_files_from_toml_table();
     if (ret < 0) {
@@ -881,6 +1505,15 @@ int init_trusted_files(void) {
         return ret;
     }
 
+    if (g_inherited_chunk_hashes) {
+        ret = apply_inherited_chunk_hashes();
+        if (ret < 0) {
+            log_error("Applying trusted files' chunk hashes inherited from parent failed: %s",
+                      pal_strerror(ret));
+            return ret;
+        }
+    }
+
     return 0;
 }
 
@@ -1318,7 +1951,8 @@ int _DkStreamSecureRead(LIB_SSL_CONTEXT* ssl_ctx, uint8_t* buf, size_t len, bool
 
 int _DkStreamSecureWrite(LIB_SSL_CONTEXT* ssl_ctx, const uint8_t* buf, size_t len,
                          bool is_blocking) {
-    int ret = lib_SSLWrite(ssl_ctx, buf, len);
+    /* on blocking streams, several records go to the host with a single OCALL */
+    int ret = is_blocking ? lib_SSLWriteBatched(ssl_ctx, buf, len) : lib_SSLWrite(ssl_ctx, buf, len);
     if (is_blocking && ret == -PAL_ERROR_TRYAGAIN) {
         /* See the explanation in `_DkStreamSecureRead`. */
         return -PAL_ERROR_INTERRUPTED;
@@ -0,0 +1,442 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* Copyright (C) 2021 Intel Corporation */
+
+/*
+ * Lazy memory mappings of trusted files and discarded anonymous memory, see enclave_lazy_map.h.
+ *
+ * Each mapping keeps a bitmap of its pages which are reserved (covered by a heap VMA) but not
+ * committed yet; a page is pending in at most one mapping. All state is protected by
+ * `g_lazy_map_lock`, which is also taken in the exception handler; hence no OCALLs and no memory
+ * allocations are done while holding it (the only "host interaction" is EAUG, which the host does
+ * transparently when EACCEPT or EACCEPTCOPY touches the page). Populating a chunk is serialized on
+ * the lock, which also prevents two threads faulting on the same chunk from populating it twice.
+ */
+
+#include "enclave_lazy_map.h"
+
+#include "api.h"
+#include "crypto.h"
+#include "enclave_edmm.h"
+#include "enclave_ocalls.h"
+#include "enclave_pages.h"
+#include "enclave_tf.h"
+#include "list.h"
+#include "pal_error.h"
+#include "pal_internal.h"
+#include "pal_linux.h"
+#include "pal_linux_defs.h"
+#include "pal_linux_error.h"
+#include "sgx_arch.h"
+#include "spinlock.h"
+
+bool g_lazy_map_enabled = false;
+bool g_lazy_mmap_trusted_files = false;
+
+#define BITS_PER_WORD (sizeof(uint64_t) * 8)
+
+DEFINE_LIST(lazy_map);
+struct lazy_map {
+    LIST_TYPE(lazy_map) list;
+    void* addr;                      /* start of the mapping in the enclave, page-aligned */
+    size_t size;                     /* size of the mapping, page-aligned */
+    uint64_t offset;                 /* file offset corresponding to `addr` */
+    uint64_t prot;                   /* EPCM permissions of populated pages */
+    void* umem;                      /* untrusted mapping of the file, starting at `umem_offset` */
+    uint64_t umem_offset;            /* file offset of `umem`, aligned to TRUSTED_CHUNK_SIZE */
+    size_t umem_size;
+    sgx_chunk_hash_t* chunk_hashes;  /* chunk hashes of the whole file (owned by trusted file);
+                                      * NULL for discarded anonymous memory, populated with zeroes */
+    uint64_t file_size;
+    bool discarding;                 /* pending pages may still be committed, wait for the trim */
+    size_t pending_cnt;              /* number of not yet populated pages */
+    uint64_t pending[];              /* bitmap of not yet populated pages */
+};
+DEFINE_LISTP(lazy_map);
+
+static LISTP_TYPE(lazy_map) g_lazy_map_list = LISTP_INIT;
+static spinlock_t g_lazy_map_lock = INIT_SPINLOCK_UNLOCKED;
+
+/* scratch buffer to copy a file chunk into the enclave, verify it and commit pages from it */
+static uint8_t g_chunk_buf[TRUSTED_CHUNK_SIZE] __attribute__((aligned(PRESET_PAGESIZE)));
+
+static bool __page_pending(struct lazy_map* map, size_t idx) {
+    return map->pending[idx / BITS_PER_WORD] & (1UL << (idx % BITS_PER_WORD));
+}
+
+static void __clear_page_pending(struct lazy_map* map, size_t idx) {
+    assert(__page_pending(map, idx));
+    map->pending[idx / BITS_PER_WORD] &= ~(1UL << (idx % BITS_PER_WORD));
+    map->pending_cnt--;
+}
+
+/* returns the mapping in which `page` is pending, if any */
+static struct lazy_map* __lookup_map(void* page) {
+    assert(spinlock_is_locked(&g_lazy_map_lock));
+
+    struct lazy_map* map;
+    LISTP_FOR_EACH_ENTRY(map, &g_lazy_map_list, list) {
+        if (map->pending_cnt && map->addr <= page && page < map->addr + map->size
+                && __page_pending(map, (page - map->addr) / g_page_size))
+            return map;
+    }
+    return NULL;
+}
+
+/* same as __lookup_map(), but if the page belongs to a discard in progress, waits until its pages
+ * are trimmed (they cannot be committed before); may temporarily release the lock */
+static struct lazy_map* __lookup_settled_map(void* page) {
+    assert(spinlock_is_locked(&g_lazy_map_lock));
+
+    struct lazy_map* map;
+    while ((map = __lookup_map(page)) && map->discarding) {
+        spinlock_unlock(&g_lazy_map_lock);
+        CPU_RELAX();
+        spinlock_lock(&g_lazy_map_lock);
+    }
+    return map;
+}
+
+/* returns whether any page in [addr, addr + size) may be pending */
+static bool __any_map_overlaps(void* addr, size_t size) {
+    assert(spinlock_is_locked(&g_lazy_map_lock));
+
+    struct lazy_map* map;
+    LISTP_FOR_EACH_ENTRY(map, &g_lazy_map_list, list) {
+        if (map->pending_cnt && map->addr < addr + size && addr < map->addr + map->size)
+            return true;
+    }
+    return false;
+}
+
+/* copies and verifies the file chunk containing the pending page `page` and commits all pending
+ * pages of the mapping that belong to this chunk */
+static int __populate_chunk(struct lazy_map* map, void* page) {
+    assert(spinlock_is_locked(&g_lazy_map_lock));
+
+    uint64_t file_off  = map->offset + (page - map->addr);
+    uint64_t chunk_off = ALIGN_DOWN(file_off, TRUSTED_CHUNK_SIZE);
+    size_t chunk_len   = chunk_off < map->file_size ? MIN(map->file_size - chunk_off,
+                                                          TRUSTED_CHUNK_SIZE)
+                                                    : 0;
+
+    const sgx_chunk_hash_t* expected_hash = &map->chunk_hashes[chunk_off / TRUSTED_CHUNK_SIZE];
+    if (chunk_len && !trusted_chunk_cache_get(expected_hash, g_chunk_buf, chunk_len)) {
+        /* to prevent TOCTOU attacks, copy file contents into the enclave before hashing */
+        assert(chunk_off >= map->umem_offset &&
+               chunk_off + chunk_len <= map->umem_offset + map->umem_size);
+        memcpy(g_chunk_buf, map->umem + (chunk_off - map->umem_offset), chunk_len);
+
+        sgx_chunk_hash_t chunk_hash[2]; /* each chunk_hash is 128 bits in size but we need 256 */
+        LIB_SHA256_CONTEXT chunk_sha;
+        int ret = lib_SHA256Init(&chunk_sha);
+        if (ret < 0)
+            return ret;
+        ret = lib_SHA256Update(&chunk_sha, g_chunk_buf, chunk_len);
+        if (ret < 0)
+            return ret;
+        ret = lib_SHA256Final(&chunk_sha, (uint8_t*)&chunk_hash[0]);
+        if (ret < 0)
+            return ret;
+
+        if (memcmp(expected_hash, &chunk_hash[0], sizeof(chunk_hash[0]))) {
+            log_error("Accessing lazily mapped trusted file is denied: incorrect hash of file "
+                      "chunk at %lu-%lu.", chunk_off, chunk_off + chunk_len);
+            return -PAL_ERROR_DENIED;
+        }
+        trusted_chunk_cache_put(expected_hash, g_chunk_buf, chunk_len);
+    }
+    /* the part of the chunk beyond the end of file is zeroed, same as in eager mappings */
+    memset(g_chunk_buf + chunk_len, 0, TRUSTED_CHUNK_SIZE - chunk_len);
+
+    void* chunk_addr = page - (file_off - chunk_off);
+    void* bottom = MAX(chunk_addr, map->addr);
+    void* top    = MIN(chunk_addr + TRUSTED_CHUNK_SIZE, map->addr + map->size);
+    for (void* p = bottom; p < top; p += g_page_size) {
+        size_t idx = (p - map->addr) / g_page_size;
+        if (!__page_pending(map, idx))
+            continue;
+        int ret = sgx_edmm_add_page_with_content((uint64_t)p, g_chunk_buf + (p - chunk_addr),
+                                                 map->prot);
+        if (ret < 0) {
+            /* the host refused to give us the page or tampered with it */
+            log_error("Cannot commit lazily mapped page %p", p);
+            ocall_exit(/*exitcode=*/1, /*is_exitgroup=*/true);
+        }
+        __clear_page_pending(map, idx);
+    }
+    return 0;
+}
+
+/* commits a pending page of discarded anonymous memory; its contents are zeroes, same as after
+ * the initial allocation */
+static void __populate_zero_page(struct lazy_map* map, void* page) {
+    assert(spinlock_is_locked(&g_lazy_map_lock));
+    assert(!map->chunk_hashes);
+
+    /* `map->prot` always allows writing, so this needs no OCALL */
+    if (sgx_edmm_add_pages((uint64_t)page, 1, map->prot) < 0) {
+        log_error("Cannot commit discarded page %p", page);
+        ocall_exit(/*exitcode=*/1, /*is_exitgroup=*/true);
+    }
+    __clear_page_pending(map, (page - map->addr) / g_page_size);
+}
+
+static int __populate_page(struct lazy_map* map, void* page) {
+    if (!map->chunk_hashes) {
+        __populate_zero_page(map, page);
+        return 0;
+    }
+    return __populate_chunk(map, page);
+}
+
+/* unlinks all fully populated (or removed) mappings; must be called without holding any locks */
+static void release_done_maps(void) {
+    LISTP_TYPE(lazy_map) done = LISTP_INIT;
+
+    spinlock_lock(&g_lazy_map_lock);
+    struct lazy_map* map;
+    struct lazy_map* tmp;
+    LISTP_FOR_EACH_ENTRY_SAFE(map, tmp, &g_lazy_map_list, list) {
+        if (!map->pending_cnt) {
+            LISTP_DEL(map, &g_lazy_map_list, list);
+            LISTP_ADD(map, &done, list);
+        }
+    }
+    spinlock_unlock(&g_lazy_map_lock);
+
+    LISTP_FOR_EACH_ENTRY_SAFE(map, tmp, &done, list) {
+        LISTP_DEL(map, &done, list);
+        if (map->umem)
+            ocall_munmap_untrusted(map->umem, map->umem_size);
+        free(map);
+    }
+}
+
+int lazy_map_trusted_file(void** addr, size_t size, uint64_t prot, int fd, uint64_t offset,
+                          sgx_chunk_hash_t* chunk_hashes, uint64_t file_size) {
+    int ret;
+
+    assert(g_lazy_map_enabled);
+    assert(IS_ALIGNED(size, g_page_size) && IS_ALIGNED(offset, g_page_size));
+
+    release_done_maps();
+
+    size_t pages_cnt = size / g_page_size;
+    size_t words_cnt = DIV_ROUND_UP(pages_cnt, BITS_PER_WORD);
+    struct lazy_map* map = malloc(sizeof(*map) + words_cnt * sizeof(map->pending[0]));
+    if (!map)
+        return -PAL_ERROR_NOMEM;
+
+    INIT_LIST_HEAD(map, list);
+    map->size         = size;
+    map->offset       = offset;
+    map->prot         = prot | SGX_SECINFO_FLAGS_R; /* EACCEPTCOPY requires readable pages */
+    map->umem         = NULL;
+    map->umem_offset  = ALIGN_DOWN(offset, TRUSTED_CHUNK_SIZE);
+    map->umem_size    = 0;
+    map->chunk_hashes = chunk_hashes;
+    map->file_size    = file_size;
+    map->discarding   = false;
+    map->pending_cnt  = pages_cnt;
+    memset(map->pending, 0xff, words_cnt * sizeof(map->pending[0]));
+    if (pages_cnt % BITS_PER_WORD)
+        map->pending[words_cnt - 1] = (1UL << (pages_cnt % BITS_PER_WORD)) - 1;
+
+    /* the mapping of the file handle goes away when the file is closed, but the memory mapping may
+     * outlive it, so map the (chunk-aligned) part of the file needed by this mapping separately */
+    if (offset < file_size) {
+        uint64_t umem_end = ALIGN_UP(MIN(offset + size, file_size), TRUSTED_CHUNK_SIZE);
+        map->umem_size = umem_end - map->umem_offset;
+        ret = ocall_mmap_untrusted(&map->umem, map->umem_size, PROT_READ, MAP_SHARED, fd,
+                                   map->umem_offset);
+        if (ret < 0) {
+            map->umem = NULL;
+            ret = unix_to_pal_error(ret);
+            goto fail;
+        }
+    }
+
+    map->addr = get_enclave_pages_uncommitted(*addr, size);
+    if (!map->addr) {
+        ret = -PAL_ERROR_DENIED;
+        goto fail;
+    }
+
+    spinlock_lock(&g_lazy_map_lock);
+    LISTP_ADD(map, &g_lazy_map_list, list);
+    spinlock_unlock(&g_lazy_map_lock);
+
+    *addr = map->addr;
+    return 0;
+
+fail:
+    if (map->umem)
+        ocall_munmap_untrusted(map->umem, map->umem_size);
+    free(map);
+    return ret;
+}
+
+bool lazy_map_handle_fault(void* addr) {
+    if (!g_lazy_map_enabled)
+        return false;
+
+    void* page = ALIGN_DOWN_PTR(addr, g_page_size);
+    bool handled = false;
+
+    spinlock_lock(&g_lazy_map_lock);
+    struct lazy_map* map = __lookup_settled_map(page);
+    if (map)
+        handled = __populate_page(map, page) == 0;
+    spinlock_unlock(&g_lazy_map_lock);
+
+    return handled;
+}
+
+int lazy_map_populate_range(void* addr, size_t size) {
+    if (!g_lazy_map_enabled)
+        return 0;
+
+    int ret = 0;
+    spinlock_lock(&g_lazy_map_lock);
+    if (!__any_map_overlaps(addr, size))
+        goto out;
+    for (void* page = addr; page < addr + size; page += g_page_size) {
+        struct lazy_map* map = __lookup_settled_map(page);
+        if (!map)
+            continue;
+        ret = __populate_page(map, page);
+        if (ret < 0)
+            break;
+    }
+out:
+    spinlock_unlock(&g_lazy_map_lock);
+    return ret;
+}
+
+int lazy_map_remove_pages(void* addr, size_t size) {
+    if (!g_lazy_map_enabled)
+        return sgx_edmm_remove_pages((uint64_t)addr, size / g_page_size);
+
+    /* common case: no lazy mapping in the range, so the whole range is trimmed at once */
+    spinlock_lock(&g_lazy_map_lock);
+    bool any_pending = __any_map_overlaps(addr, size);
+    spinlock_unlock(&g_lazy_map_lock);
+    if (!any_pending)
+        return sgx_edmm_remove_pages((uint64_t)addr, size / g_page_size);
+
+    /* walk the range in runs of pages in the same state; pending pages are simply forgotten (they
+     * were never committed), committed runs are trimmed outside of the lock (trimming needs
+     * OCALLs) */
+    void* page = addr;
+    while (page < addr + size) {
+        void* run_top = page;
+        bool pending = false;
+
+        spinlock_lock(&g_lazy_map_lock);
+        pending = !!__lookup_settled_map(page);
+        while (run_top < addr + size) {
+            struct lazy_map* cur = __lookup_map(run_top);
+            /* a discard in progress ends the run, the next run waits for it */
+            if (cur && cur->discarding && run_top > page)
+                break;
+            bool cur_pending = !!cur;
+            if (cur_pending != pending)
+                break;
+            if (cur_pending)
+                __clear_page_pending(cur, (run_top - cur->addr) / g_page_size);
+            run_top += g_page_size;
+        }
+        spinlock_unlock(&g_lazy_map_lock);
+
+        if (!pending) {
+            int ret = sgx_edmm_remove_pages((uint64_t)page, (run_top - page) / g_page_size);
+            if (ret < 0)
+                return ret;
+        }
+        page = run_top;
+    }
+    return 0;
+}
+
+int lazy_map_discard_pages(void* addr, size_t size, uint64_t prot) {
+    int ret;
+
+    assert(g_lazy_map_enabled);
+    assert(IS_ALIGNED_PTR(addr, g_page_size) && IS_ALIGNED(size, g_page_size));
+    assert(prot & SGX_SECINFO_FLAGS_W);
+
+    release_done_maps();
+
+    size_t pages_cnt = size / g_page_size;
+    size_t words_cnt = DIV_ROUND_UP(pages_cnt, BITS_PER_WORD);
+    struct lazy_map* map = malloc(sizeof(*map) + words_cnt * sizeof(map->pending[0]));
+    if (!map)
+        return -PAL_ERROR_NOMEM;
+    /* pages which were committed and thus have to be trimmed */
+    uint64_t* trim = calloc(words_cnt, sizeof(*trim));
+    if (!trim) {
+        free(map);
+        return -PAL_ERROR_NOMEM;
+    }
+
+    INIT_LIST_HEAD(map, list);
+    map->addr         = addr;
+    map->size         = size;
+    map->offset       = 0;
+    map->prot         = prot | SGX_SECINFO_FLAGS_R;
+    map->umem         = NULL;
+    map->umem_offset  = 0;
+    map->umem_size    = 0;
+    map->chunk_hashes = NULL;
+    map->file_size    = 0;
+    map->discarding   = true;
+    map->pending_cnt  = pages_cnt;
+    memset(map->pending, 0xff, words_cnt * sizeof(map->pending[0]));
+    if (pages_cnt % BITS_PER_WORD)
+        map->pending[words_cnt - 1] = (1UL << (pages_cnt % BITS_PER_WORD)) - 1;
+
+    /* pages already pending in another mapping were never committed; they are taken over by this
+     * mapping (so they read as zeroes too), all other pages are trimmed below */
+    spinlock_lock(&g_lazy_map_lock);
+    for (size_t idx = 0; idx < pages_cnt; idx++) {
+        struct lazy_map* other = __lookup_settled_map(addr + idx * g_page_size);
+        if (other) {
+            __clear_page_pending(other, (addr + idx * g_page_size - other->addr) / g_page_size);
+        } else {
+            trim[idx / BITS_PER_WORD] |= 1UL << (idx % BITS_PER_WORD);
+        }
+    }
+    LISTP_ADD(map, &g_lazy_map_list, list);
+    spinlock_unlock(&g_lazy_map_lock);
+
+    /* trim runs of committed pages; a thread touching one of them meanwhile waits in the exception
+     * handler until `discarding` is cleared */
+    ret = 0;
+    size_t idx = 0;
+    while (idx < pages_cnt) {
+        if (!(trim[idx / BITS_PER_WORD] & (1UL << (idx % BITS_PER_WORD)))) {
+            idx++;
+            continue;
+        }
+        size_t run_end = idx + 1;
+        while (run_end < pages_cnt && (trim[run_end / BITS_PER_WORD] &
+                                       (1UL << (run_end % BITS_PER_WORD))))
+            run_end++;
+
+        ret = sgx_edmm_remove_pages((uint64_t)(addr + idx * g_page_size), run_end - idx);
+        if (ret < 0) {
+            /* the pages are marked as pending, so we cannot go back */
+            log_error("Cannot trim discarded enclave pages in range %p - %p",
+                      addr + idx * g_page_size, addr + run_end * g_page_size);
+            ocall_exit(/*exitcode=*/1, /*is_exitgroup=*/true);
+        }
+        idx = run_end;
+    }
+
+    spinlock_lock(&g_lazy_map_lock);
+    map->discarding = false;
+    spinlock_unlock(&g_lazy_map_lock);
+
+    free(trim);
+    return ret;
+}
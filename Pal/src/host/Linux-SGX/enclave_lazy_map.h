@@ -0,0 +1,81 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* Copyright (C) 2021 Intel Corporation */
+
+/*
+ * Lazy memory mappings of trusted files (see "sgx.lazy_mmap_trusted_files") and of discarded
+ * anonymous memory.
+ *
+ * Instead of copying and verifying the whole mapped range of a trusted file at mmap time, the
+ * range is reserved on the enclave heap but its pages are left uncommitted (this requires EDMM).
+ * The first access to such a page raises #PF, reported to the enclave thanks to EXINFO; the
+ * exception handler then copies and verifies the file chunk containing the page (TRUSTED_CHUNK_SIZE
+ * bytes) and commits its pages with EACCEPTCOPY, so the enclave never observes unverified contents.
+ *
+ * Discarded anonymous memory (see DkVirtualMemoryDiscard()) works the same way, except that its
+ * pages are trimmed right away, returning EPC to the host, and a page is committed again as a fresh
+ * zeroed page on its first access.
+ *
+ * Enclave heap code must not assume that pages of such a mapping are committed: protecting such
+ * pages populates them first (lazy_map_populate_range()), and freeing them only trims the pages that
+ * were actually committed (lazy_map_remove_pages()).
+ */
+
+#ifndef ENCLAVE_LAZY_MAP_H
+#define ENCLAVE_LAZY_MAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "enclave_tf.h"
+
+/* set during PAL initialization if lazy mappings are supported (EDMM and EXINFO) */
+extern bool g_lazy_map_enabled;
+
+/* set during PAL initialization if trusted files should be mapped lazily */
+extern bool g_lazy_mmap_trusted_files;
+
+/*!
+ * \brief Lazily map a range of a trusted file into the enclave
+ *
+ * \param[in,out] addr          requested address (or NULL); on success, address of the mapping
+ * \param size                  size of the mapping, page-aligned
+ * \param prot                  EPCM permissions of the pages (combination of SGX_SECINFO_FLAGS_*)
+ * \param fd                    host file descriptor of the trusted file
+ * \param offset                offset in the file, page-aligned
+ * \param chunk_hashes          verified chunk hashes of the file
+ * \param file_size             size of the file
+ *
+ * \return 0 on success, negative error code on failure. Fails if the requested range overlaps
+ *         already allocated memory; the caller is then expected to fall back to an eager mapping.
+ */
+int lazy_map_trusted_file(void** addr, size_t size, uint64_t prot, int fd, uint64_t offset,
+                          sgx_chunk_hash_t* chunk_hashes, uint64_t file_size);
+
+/*!
+ * \brief Handle a page fault at `addr`
+ *
+ * \return true if `addr` belongs to a not yet populated page of a lazy mapping and the page was
+ *         successfully populated (the faulting instruction may then be restarted), false otherwise
+ */
+bool lazy_map_handle_fault(void* addr);
+
+/* Populates all not yet populated pages of lazy mappings in [addr, addr + size). */
+int lazy_map_populate_range(void* addr, size_t size);
+
+/* Trims the committed pages in [addr, addr + size) and forgets the not yet populated ones. */
+int lazy_map_remove_pages(void* addr, size_t size);
+
+/*!
+ * \brief Discard the contents of committed heap pages and return them to the host
+ *
+ * \param addr  start of the range, page-aligned; the whole range must be covered by heap VMAs
+ * \param size  size of the range, page-aligned
+ * \param prot  EPCM permissions of the pages (combination of SGX_SECINFO_FLAGS_*), must include
+ *              SGX_SECINFO_FLAGS_W
+ *
+ * The pages stay reserved and are committed again (zeroed, with permissions `prot`) on access.
+ */
+int lazy_map_discard_pages(void* addr, size_t size, uint64_t prot);
+
+#endif /* ENCLAVE_LAZY_MAP_H */
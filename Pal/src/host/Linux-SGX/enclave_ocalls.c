@@ -21,6 +21,7 @@
 #include "enclave_ocalls.h"
 
 #include <asm/errno.h>
+#include <limits.h>
 #include <linux/futex.h>
 #include <stdalign.h>
 #include <stdbool.h>
@@ -44,46 +45,268 @@
  * size of 8MB. Thus, 512KB limit also works well for the main thread. */
 #define MAX_UNTRUSTED_STACK_BUF (THREAD_STACK_SIZE / 4)
 
-/* global pointer to a single untrusted queue, all accesses must be protected by g_rpc_queue->lock
- */
+/* global pointer to a single untrusted queue; each enclave thread enqueues only into its own ring
+ * (selected by the thread's TCS slot index), so no lock is taken on the OCALL path */
 rpc_queue_t* g_rpc_queue;
 
-static long sgx_exitless_ocall(uint64_t code, void* ms) {
-    /* perform OCALL with enclave exit if no RPC queue (i.e., no exitless); no need for atomics
-     * because this pointer is set only once at enclave initialization */
-    if (!g_rpc_queue)
-        return sgx_ocall(code, ms);
+/* Spin policy for exitless OCALLs (see `sgx.rpc_spin_policy` in the manifest). With the "fixed"
+ * policy, every OCALL spins for `g_rpc_max_spin` iterations before sleeping on a futex. With the
+ * "adaptive" policy, each OCALL index keeps its own spin budget learned from recent latencies (in
+ * the spirit of adaptive mutexes), and OCALLs that are expected to block skip spinning entirely.
+ * Budgets are heuristics, so they are updated with relaxed atomics and races are benign. */
+#define RPC_ADAPTIVE_SPIN_MIN 1000 /* floor so that a budget can grow back after decaying */
+
+static bool g_rpc_adaptive_spin = false;
+static unsigned long g_rpc_max_spin = RPC_SPINLOCK_TIMEOUT;
+static unsigned long g_rpc_spin_budget[OCALL_NR];
+
+/* OCALLs that must not go through RPC threads even if Exitless is enabled (see `sgx.rpc_ocalls` in
+ * the manifest); by default all exitless-capable OCALLs use RPC threads */
+static bool g_rpc_ocall_disabled[OCALL_NR];
+
+/* names of OCALLs as used in `sgx.rpc_ocalls` manifest option */
+static const char* const g_ocall_names[OCALL_NR] = {
+    [OCALL_EXIT]              = "exit",
+    [OCALL_MMAP_UNTRUSTED]    = "mmap_untrusted",
+    [OCALL_MUNMAP_UNTRUSTED]  = "munmap_untrusted",
+    [OCALL_CPUID]             = "cpuid",
+    [OCALL_OPEN]              = "open",
+    [OCALL_CLOSE]             = "close",
+    [OCALL_READ]              = "read",
+    [OCALL_WRITE]             = "write",
+    [OCALL_PREAD]             = "pread",
+    [OCALL_PWRITE]            = "pwrite",
+    [OCALL_FSTAT]             = "fstat",
+    [OCALL_STAT]              = "stat",
+    [OCALL_OPEN_STAT]         = "open_stat",
+    [OCALL_FIONREAD]          = "fionread",
+    [OCALL_FSETNONBLOCK]      = "fsetnonblock",
+    [OCALL_FCHMOD]            = "fchmod",
+    [OCALL_FSYNC]             = "fsync",
+    [OCALL_FTRUNCATE]         = "ftruncate",
+    [OCALL_MKDIR]             = "mkdir",
+    [OCALL_GETDENTS]          = "getdents",
+    [OCALL_GETDENTS_STAT]     = "getdents_stat",
+    [OCALL_RESUME_THREAD]     = "resume_thread",
+    [OCALL_SCHED_SETAFFINITY] = "sched_setaffinity",
+    [OCALL_SCHED_GETAFFINITY] = "sched_getaffinity",
+    [OCALL_CLONE_THREAD]      = "clone_thread",
+    [OCALL_CREATE_PROCESS]    = "create_process",
+    [OCALL_FUTEX]             = "futex",
+    [OCALL_SOCKETPAIR]        = "socketpair",
+    [OCALL_LISTEN]            = "listen",
+    [OCALL_ACCEPT]            = "accept",
+    [OCALL_ACCEPT_BATCH]      = "accept_batch",
+    [OCALL_CONNECT]           = "connect",
+    [OCALL_RECV]              = "recv",
+    [OCALL_SEND]              = "send",
+    [OCALL_SENDMMSG]          = "sendmmsg",
+    [OCALL_RECVMMSG]          = "recvmmsg",
+    [OCALL_SOCK_RING_START]   = "sock_ring_start",
+    [OCALL_SOCK_RING_STOP]    = "sock_ring_stop",
+    [OCALL_SETSOCKOPT]        = "setsockopt",
+    [OCALL_SHUTDOWN]          = "shutdown",
+    [OCALL_SENDFILE]          = "sendfile",
+    [OCALL_GETTIME]           = "gettime",
+    [OCALL_SCHED_YIELD]       = "sched_yield",
+    [OCALL_POLL]              = "poll",
+    [OCALL_EPOLL_CREATE]      = "epoll_create",
+    [OCALL_EPOLL_CTL]         = "epoll_ctl",
+    [OCALL_EPOLL_WAIT]        = "epoll_wait",
+    [OCALL_RENAME]            = "rename",
+    [OCALL_DELETE]            = "delete",
+    [OCALL_DEBUG_MAP_ADD]     = "debug_map_add",
+    [OCALL_DEBUG_MAP_REMOVE]  = "debug_map_remove",
+    [OCALL_STARTUP_TRACE]     = "startup_trace",
+    [OCALL_EVENTFD]           = "eventfd",
+    [OCALL_GET_QUOTE]         = "get_quote",
+    [OCALL_BATCH]             = "batch",
+    [OCALL_EDMM_RESTRICT_PAGES_PERM] = "edmm_restrict_pages_perm",
+    [OCALL_EDMM_MODIFY_PAGES_TYPE]   = "edmm_modify_pages_type",
+    [OCALL_EDMM_REMOVE_PAGES]        = "edmm_remove_pages",
+};
+
+static int ocall_index_by_name(const char* name) {
+    for (int i = 0; i < OCALL_NR; i++)
+        if (g_ocall_names[i] && !strcmp(g_ocall_names[i], name))
+            return i;
+    return -1;
+}
 
-    /* allocate request in a new stack frame on OCALL stack; note that request's lock is used in
-     * futex() and must be aligned to at least 4B */
-    void* old_ustack = sgx_prepare_ustack();
-    rpc_request_t* req = sgx_alloc_on_ustack_aligned(sizeof(*req), alignof(*req));
-    if (!req) {
-        sgx_reset_ustack(old_ustack);
-        return -ENOMEM;
+/* recv() is not listed: on busy sockets the data is usually already there and the call returns
+ * quickly, so it learns its own budget, which decays to the minimum if it mostly blocks */
+static bool is_blocking_ocall(uint64_t code) {
+    switch (code) {
+        case OCALL_ACCEPT:
+        case OCALL_CONNECT:
+        case OCALL_FUTEX:
+        case OCALL_POLL:
+            return true;
+        default:
+            return false;
     }
+}
 
-    WRITE_ONCE(req->ocall_index, code);
-    WRITE_ONCE(req->buffer, ms);
-    spinlock_init(&req->lock);
+static unsigned long rpc_spin_budget(uint64_t code) {
+    if (!g_rpc_adaptive_spin)
+        return g_rpc_max_spin;
+    if (is_blocking_ocall(code))
+        return 0;
+    return __atomic_load_n(&g_rpc_spin_budget[code], __ATOMIC_RELAXED);
+}
 
-    /* grab the lock on this request (it is the responsibility of RPC thread to unlock it when
-     * done); this always succeeds immediately since enclave thread is currently the only owner
-     * of the lock */
-    spinlock_lock(&req->lock);
+static void rpc_spin_update(uint64_t code, unsigned long spent, bool timedout) {
+    if (!g_rpc_adaptive_spin || is_blocking_ocall(code))
+        return;
+
+    /* move the budget 1/8 of the way towards twice the observed latency; if spinning timed out,
+     * it was wasted CPU time, so decay the budget towards the minimum instead */
+    long budget = __atomic_load_n(&g_rpc_spin_budget[code], __ATOMIC_RELAXED);
+    long target = timedout ? RPC_ADAPTIVE_SPIN_MIN
+                           : (long)MIN(2 * spent + RPC_ADAPTIVE_SPIN_MIN, g_rpc_max_spin);
+    budget += (target - budget) / 8;
+    budget = MAX(budget, (long)MIN(RPC_ADAPTIVE_SPIN_MIN, g_rpc_max_spin));
+    __atomic_store_n(&g_rpc_spin_budget[code], (unsigned long)budget, __ATOMIC_RELAXED);
+}
 
-    /* enqueue OCALL request into RPC queue; some RPC thread will dequeue it, issue a syscall
-     * and, after syscall is finished, release the request's spinlock */
-    bool enqueued = rpc_enqueue(g_rpc_queue, req);
-    if (!enqueued) {
-        /* no space in queue: all RPC threads are busy with outstanding ocalls; fallback to normal
-         * syscall path with enclave exit */
-        sgx_reset_ustack(old_ustack);
-        return sgx_ocall(code, ms);
+static int init_rpc_spin_policy(void) {
+    int ret;
+    char* policy_str = NULL;
+
+    ret = toml_string_in(g_pal_state.manifest_root, "sgx.rpc_spin_policy", &policy_str);
+    if (ret < 0) {
+        log_error("Cannot parse 'sgx.rpc_spin_policy'");
+        return -PAL_ERROR_INVAL;
+    }
+
+    if (!policy_str || !strcmp(policy_str, "fixed")) {
+        g_rpc_adaptive_spin = false;
+    } else if (!strcmp(policy_str, "adaptive")) {
+        g_rpc_adaptive_spin = true;
+    } else {
+        log_error("Unknown 'sgx.rpc_spin_policy' (allowed: `fixed`, `adaptive`)");
+        free(policy_str);
+        return -PAL_ERROR_INVAL;
+    }
+    free(policy_str);
+
+    int64_t max_spin;
+    ret = toml_int_in(g_pal_state.manifest_root, "sgx.rpc_max_spin", RPC_SPINLOCK_TIMEOUT,
+                      &max_spin);
+    if (ret < 0 || max_spin < 0) {
+        log_error("Cannot parse 'sgx.rpc_max_spin' (the value must be a non-negative integer)");
+        return -PAL_ERROR_INVAL;
+    }
+    g_rpc_max_spin = max_spin;
+
+    for (size_t i = 0; i < OCALL_NR; i++)
+        g_rpc_spin_budget[i] = g_rpc_max_spin;
+
+    return 0;
+}
+
+static int init_rpc_ocalls(void) {
+    int ret;
+
+    toml_table_t* manifest_sgx = toml_table_in(g_pal_state.manifest_root, "sgx");
+    if (!manifest_sgx)
+        return 0;
+
+    toml_array_t* toml_rpc_ocalls = toml_array_in(manifest_sgx, "rpc_ocalls");
+    if (!toml_rpc_ocalls) {
+        /* option not set: all exitless-capable OCALLs go through RPC threads */
+        return 0;
     }
 
+    ssize_t toml_rpc_ocalls_cnt = toml_array_nelem(toml_rpc_ocalls);
+    if (toml_rpc_ocalls_cnt < 0)
+        return -PAL_ERROR_INVAL;
+
+    bool enabled[OCALL_NR] = {0};
+    for (ssize_t i = 0; i < toml_rpc_ocalls_cnt; i++) {
+        toml_raw_t toml_rpc_ocall_raw = toml_raw_at(toml_rpc_ocalls, i);
+        if (!toml_rpc_ocall_raw) {
+            log_error("Invalid 'sgx.rpc_ocalls' entry at index %ld", i);
+            return -PAL_ERROR_INVAL;
+        }
+
+        char* toml_rpc_ocall_str = NULL;
+        ret = toml_rtos(toml_rpc_ocall_raw, &toml_rpc_ocall_str);
+        if (ret < 0) {
+            log_error("Invalid 'sgx.rpc_ocalls' entry at index %ld (not a string)", i);
+            return -PAL_ERROR_INVAL;
+        }
+
+        int idx = ocall_index_by_name(toml_rpc_ocall_str);
+        if (idx < 0) {
+            log_error("Unknown OCALL '%s' in 'sgx.rpc_ocalls'", toml_rpc_ocall_str);
+            free(toml_rpc_ocall_str);
+            return -PAL_ERROR_INVAL;
+        }
+        free(toml_rpc_ocall_str);
+        enabled[idx] = true;
+    }
+
+    for (size_t i = 0; i < OCALL_NR; i++)
+        g_rpc_ocall_disabled[i] = !enabled[i];
+
+    return 0;
+}
+
+/* asynchronous OCALLs, see `struct async_ocall` below */
+static bool g_rpc_async_ocalls = false;
+
+static int init_rpc_async_ocalls(void) {
+    int ret = toml_bool_in(g_pal_state.manifest_root, "sgx.rpc_async_ocalls",
+                           /*defaultval=*/false, &g_rpc_async_ocalls);
+    if (ret < 0) {
+        log_error("Cannot parse 'sgx.rpc_async_ocalls' (the value must be `true` or `false`)");
+        return -PAL_ERROR_INVAL;
+    }
+    return 0;
+}
+
+int init_rpc_policy(void) {
+    int ret = init_rpc_spin_policy();
+    if (ret < 0)
+        return ret;
+    ret = init_rpc_ocalls();
+    if (ret < 0)
+        return ret;
+    return init_rpc_async_ocalls();
+}
+
+/* Wakes up one parked RPC thread if none is available; must be called after a request was enqueued.
+ * Allocates on the untrusted stack, so the caller must have prepared it. */
+static void rpc_wake_parked_thread(void) {
+    /* handshake with parking RPC threads (see rpc_thread_park() in sgx_enclave.c): either a parking
+     * RPC thread sees our published request, or we see that no RPC thread is available (awake and
+     * not blocked in a host syscall) and must wake up a parked one; this costs an enclave exit but
+     * only when the RPC thread pool was idle or saturated, and is skipped if no thread is parked */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    size_t awake = READ_ONCE(g_rpc_queue->awake_cnt);
+    if (awake > READ_ONCE(g_rpc_queue->blocked_cnt)
+            || awake >= READ_ONCE(g_rpc_queue->rpc_threads_cnt))
+        return;
+
+    ms_ocall_futex_t* ms_wake = sgx_alloc_on_ustack_aligned(sizeof(*ms_wake), alignof(*ms_wake));
+    if (ms_wake) {
+        __atomic_add_fetch(&g_rpc_queue->wakeup, 1, __ATOMIC_RELEASE);
+        WRITE_ONCE(ms_wake->ms_futex, &g_rpc_queue->wakeup);
+        WRITE_ONCE(ms_wake->ms_op, FUTEX_WAKE_PRIVATE);
+        WRITE_ONCE(ms_wake->ms_val, 1);
+        WRITE_ONCE(ms_wake->ms_timeout_us, (uint64_t)-1);
+        (void)sgx_ocall(OCALL_FUTEX, ms_wake);
+    }
+}
+
+/* Waits until an RPC thread is done with the enqueued request `req` and returns its result.
+ * Allocates on the untrusted stack, so the caller must have prepared it. */
+static long rpc_wait_request(uint64_t code, rpc_request_t* req) {
     /* wait till request processing is finished; try spinlock first */
-    int timedout = spinlock_lock_timeout(&req->lock, RPC_SPINLOCK_TIMEOUT);
+    unsigned long spent;
+    int timedout = spinlock_lock_timeout_spent(&req->lock, rpc_spin_budget(code), &spent);
+    rpc_spin_update(code, spent, timedout);
 
     /* at this point:
      * - either RPC thread is done with OCALL and released the request's spinlock,
@@ -103,10 +326,8 @@ static long sgx_exitless_ocall(uint64_t code, void* ms) {
         if (!spinlock_cmpxchg(&req->lock, &c, SPINLOCK_LOCKED_NO_WAITERS)) {
             /* allocate futex args on OCALL stack */
             ms_ocall_futex_t* ms = sgx_alloc_on_ustack_aligned(sizeof(*ms), alignof(*ms));
-            if (!ms) {
-                sgx_reset_ustack(old_ustack);
+            if (!ms)
                 return -ENOMEM;
-            }
 
             WRITE_ONCE(ms->ms_futex, &req->lock.lock);
             WRITE_ONCE(ms->ms_op, FUTEX_WAIT_PRIVATE);
@@ -123,10 +344,8 @@ static long sgx_exitless_ocall(uint64_t code, void* ms) {
                      * immediately returns */
                     WRITE_ONCE(ms->ms_val, SPINLOCK_LOCKED_WITH_WAITERS);
                     int ret = sgx_ocall(OCALL_FUTEX, ms);
-                    if (ret < 0 && ret != -EAGAIN) {
-                        sgx_reset_ustack(old_ustack);
+                    if (ret < 0 && ret != -EAGAIN)
                         return -EPERM;
-                    }
                 }
                 c = SPINLOCK_UNLOCKED;
             } while (!spinlock_cmpxchg(&req->lock, &c, SPINLOCK_LOCKED_WITH_WAITERS));
@@ -136,10 +355,176 @@ static long sgx_exitless_ocall(uint64_t code, void* ms) {
         }
     }
 
-    sgx_reset_ustack(old_ustack);
     return READ_ONCE(req->result);
 }
 
+/*
+ * Asynchronous ("fire-and-forget") OCALLs, enabled with `sgx.rpc_async_ocalls`: OCALLs whose result
+ * the caller does not need (closing a host FD, waking futex waiters, updating the debugger's map of
+ * loaded objects) are posted to the RPC queue and the enclave thread continues without waiting for
+ * an RPC thread to execute them.
+ *
+ * Such a request cannot live on the untrusted stack, so each enclave thread (TCS slot) has one
+ * request slot in untrusted memory. A thread has at most one asynchronous OCALL in flight: before
+ * issuing any other exitless OCALL (synchronous or not), it waits for the previous asynchronous one
+ * to finish. This keeps the host-visible order of OCALLs of one thread unchanged (e.g., a closed
+ * FD is never inherited by a child process created afterwards), while the round trip of the
+ * asynchronous OCALL overlaps with the enclave code running until the next OCALL. Errors of
+ * asynchronous OCALLs are only logged when the thread waits for them.
+ */
+struct async_ocall {
+    rpc_request_t req;
+    union {
+        ms_ocall_close_t close;
+        ms_ocall_futex_t futex;
+        ms_ocall_debug_map_add_t debug_map_add;
+        ms_ocall_debug_map_remove_t debug_map_remove;
+    } ms;
+    char name[URI_MAX]; /* copy of the name for OCALL_DEBUG_MAP_ADD */
+};
+
+struct async_ocall_slot {
+    struct async_ocall* ocall; /* in untrusted memory, allocated on first use */
+    uint64_t code;             /* OCALL in flight (kept in enclave memory) */
+    bool pending;
+    bool busy; /* slot is being used by this thread; guards against nesting in signal handling */
+};
+
+static struct async_ocall_slot g_async_ocall_slots[RPC_QUEUE_SIZE];
+
+static struct async_ocall_slot* get_async_ocall_slot(void) {
+    uint64_t idx = GET_ENCLAVE_TLS(thread_idx);
+    return idx < RPC_QUEUE_SIZE ? &g_async_ocall_slots[idx] : NULL;
+}
+
+/* Waits for the asynchronous OCALL in flight in `slot`, if any; the caller must own `slot`. */
+static void async_ocall_finish(struct async_ocall_slot* slot) {
+    if (!slot->pending)
+        return;
+
+    void* old_ustack = sgx_prepare_ustack();
+    long ret = rpc_wait_request(slot->code, &slot->ocall->req);
+    sgx_reset_ustack(old_ustack);
+    slot->pending = false;
+
+    if (ret < 0)
+        log_debug("Asynchronous OCALL %s failed: %ld", g_ocall_names[slot->code], ret);
+}
+
+/* Waits for the asynchronous OCALL in flight of the current thread, if any. */
+static void async_ocall_wait(void) {
+    struct async_ocall_slot* slot = get_async_ocall_slot();
+    if (!slot || !slot->pending)
+        return;
+
+    if (__atomic_exchange_n(&slot->busy, true, __ATOMIC_ACQUIRE)) {
+        /* interrupted code of this thread is already waiting for (or submitting) it */
+        return;
+    }
+    async_ocall_finish(slot);
+    __atomic_store_n(&slot->busy, false, __ATOMIC_RELEASE);
+}
+
+/* Returns the untrusted request of the current thread for asynchronous OCALL `code` (the caller
+ * fills its `ms` and must post it with async_ocall_submit()), or NULL if the OCALL must be
+ * performed synchronously. */
+static struct async_ocall* async_ocall_prepare(uint64_t code) {
+    if (!g_rpc_async_ocalls || !g_rpc_queue || g_rpc_ocall_disabled[code])
+        return NULL;
+
+    struct async_ocall_slot* slot = get_async_ocall_slot();
+    if (!slot || __atomic_exchange_n(&slot->busy, true, __ATOMIC_ACQUIRE))
+        return NULL;
+
+    async_ocall_finish(slot);
+
+    if (!slot->ocall) {
+        void* addr = NULL;
+        int ret = ocall_mmap_untrusted(&addr, ALIGN_UP(sizeof(*slot->ocall), g_page_size),
+                                       PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE,
+                                       /*fd=*/-1, /*offset=*/0);
+        if (ret < 0) {
+            __atomic_store_n(&slot->busy, false, __ATOMIC_RELEASE);
+            return NULL;
+        }
+        slot->ocall = addr;
+    }
+    return slot->ocall;
+}
+
+/* Posts asynchronous OCALL `code` prepared in `ocall` to the RPC queue. Returns 0 if the OCALL was
+ * posted or, if the ring is full, the result of performing it synchronously. */
+static long async_ocall_submit(struct async_ocall* ocall, uint64_t code) {
+    struct async_ocall_slot* slot = get_async_ocall_slot();
+    assert(slot && slot->ocall == ocall);
+
+    rpc_request_t* req = &ocall->req;
+    WRITE_ONCE(req->ocall_index, code);
+    WRITE_ONCE(req->buffer, &ocall->ms);
+    spinlock_init(&req->lock);
+    spinlock_lock(&req->lock);
+
+    long ret = 0;
+    if (rpc_enqueue(g_rpc_queue, GET_ENCLAVE_TLS(thread_idx), req)) {
+        slot->code    = code;
+        slot->pending = true;
+
+        void* old_ustack = sgx_prepare_ustack();
+        rpc_wake_parked_thread();
+        sgx_reset_ustack(old_ustack);
+    } else {
+        ret = sgx_ocall(code, &ocall->ms);
+    }
+
+    __atomic_store_n(&slot->busy, false, __ATOMIC_RELEASE);
+    return ret;
+}
+
+static long sgx_exitless_ocall(uint64_t code, void* ms) {
+    /* keep the order of OCALLs of this thread, see async_ocall_prepare() */
+    async_ocall_wait();
+
+    /* perform OCALL with enclave exit if no RPC queue (i.e., no exitless) or if this OCALL is not
+     * selected for exitless; no need for atomics because these are set only once at enclave
+     * initialization */
+    if (!g_rpc_queue || g_rpc_ocall_disabled[code])
+        return sgx_ocall(code, ms);
+
+    /* allocate request in a new stack frame on OCALL stack; note that request's lock is used in
+     * futex() and must be aligned to at least 4B */
+    void* old_ustack = sgx_prepare_ustack();
+    rpc_request_t* req = sgx_alloc_on_ustack_aligned(sizeof(*req), alignof(*req));
+    if (!req) {
+        sgx_reset_ustack(old_ustack);
+        return -ENOMEM;
+    }
+
+    WRITE_ONCE(req->ocall_index, code);
+    WRITE_ONCE(req->buffer, ms);
+    spinlock_init(&req->lock);
+
+    /* grab the lock on this request (it is the responsibility of RPC thread to unlock it when
+     * done); this always succeeds immediately since enclave thread is currently the only owner
+     * of the lock */
+    spinlock_lock(&req->lock);
+
+    /* enqueue OCALL request into this thread's ring of RPC queue; some RPC thread will dequeue it,
+     * issue a syscall and, after syscall is finished, release the request's spinlock */
+    bool enqueued = rpc_enqueue(g_rpc_queue, GET_ENCLAVE_TLS(thread_idx), req);
+    if (!enqueued) {
+        /* no space in ring (should not happen with synchronous OCALLs unless the untrusted ring was
+         * tampered with); fallback to normal syscall path with enclave exit */
+        sgx_reset_ustack(old_ustack);
+        return sgx_ocall(code, ms);
+    }
+
+    rpc_wake_parked_thread();
+
+    long ret = rpc_wait_request(code, req);
+    sgx_reset_ustack(old_ustack);
+    return ret;
+}
+
 noreturn void ocall_exit(int exitcode, int is_exitgroup) {
     ms_ocall_exit_t* ms;
 
@@ -181,7 +566,7 @@ int ocall_mmap_untrusted(void** addrptr, size_t size, int prot, int flags, int f
 
     void* requested_addr = *addrptr;
 
-    if (flags & MAP_FIXED) {
+    if (flags & (MAP_FIXED | MAP_FIXED_NOREPLACE)) {
         if (!sgx_is_completely_outside_enclave(requested_addr, size) ||
                 !IS_ALLOC_ALIGNED_PTR(requested_addr)) {
             sgx_reset_ustack(old_ustack);
@@ -203,8 +588,9 @@ int ocall_mmap_untrusted(void** addrptr, size_t size, int prot, int flags, int f
     } while (retval == -EINTR);
 
     if (retval < 0) {
-        if (retval != -EACCES && retval != -EAGAIN && retval != -EBADF && retval != -EINVAL &&
-                retval != -ENFILE && retval != -ENODEV && retval != -ENOMEM && retval != -EPERM) {
+        if (retval != -EACCES && retval != -EAGAIN && retval != -EBADF && retval != -EEXIST &&
+                retval != -EINVAL && retval != -ENFILE && retval != -ENODEV && retval != -ENOMEM &&
+                retval != -EPERM) {
             retval = -EPERM;
         }
         sgx_reset_ustack(old_ustack);
@@ -212,10 +598,15 @@ int ocall_mmap_untrusted(void** addrptr, size_t size, int prot, int flags, int f
     }
 
     void* returned_addr = READ_ONCE(ms->ms_addr);
-    if (flags & MAP_FIXED) {
+    if (flags & (MAP_FIXED | MAP_FIXED_NOREPLACE)) {
         /* addrptr already contains the mmap'ed address, no need to update it */
         if (returned_addr != requested_addr) {
             sgx_reset_ustack(old_ustack);
+            if (flags & MAP_FIXED_NOREPLACE) {
+                /* host kernels older than 4.17 treat MAP_FIXED_NOREPLACE as a mere hint */
+                ocall_munmap_untrusted(returned_addr, size);
+                return -EEXIST;
+            }
             return -EPERM;
         }
     } else {
@@ -260,72 +651,139 @@ int ocall_munmap_untrusted(const void* addr, size_t size) {
 }
 
 /*
- * Memorize untrusted memory area to avoid mmap/munmap per each read/write IO. Because this cache
- * is per-thread, we don't worry about concurrency. The cache will be carried over thread
- * exit/creation. On fork/exec emulation, untrusted code does vfork/exec, so the mmapped cache
- * will be released by exec host syscall.
+ * Memorize untrusted memory areas to avoid mmap/munmap per each read/write IO. Each thread has a
+ * small pool of such areas (buffers); because the pool is per-thread, we don't worry about
+ * concurrency. The pool will be carried over thread exit/creation. On fork/exec emulation,
+ * untrusted code does vfork/exec, so the mmapped buffers will be released by exec host syscall.
  *
  * In case of AEX and consequent signal handling, current thread may be interrupted in the middle
- * of using the cache. If there are OCALLs during signal handling, they could interfere with the
- * normal-execution use of the cache, so 'in_use' atomic protects against it. OCALLs during signal
- * handling do not use the cache and always explicitly mmap/munmap untrusted memory; 'need_munmap'
- * indicates whether explicit munmap is needed at the end of such OCALL.
+ * of using a buffer. If there are OCALLs during signal handling, they must not interfere with the
+ * normal-execution use of the buffer, so each buffer has an 'in_use' atomic and nested OCALLs take
+ * another buffer from the pool. Only if all buffers are in use (deeply nested signal handling), a
+ * one-off buffer is allocated; 'need_munmap' indicates whether this buffer must be freed at the end
+ * of such OCALL.
+ *
+ * Buffers are allocated with at least `sgx.untrusted_io_buffer_size` bytes, so that workloads with
+ * large transfers don't repeatedly replace a buffer with a slightly larger one. Buffers come from the
+ * size-classed untrusted allocator (see alloc_untrusted_io_buf()), which recycles replaced buffers
+ * instead of munmapping them.
  */
-static int ocall_mmap_untrusted_cache(size_t size, void** addrptr, bool* need_munmap) {
-    int ret;
+static size_t g_untrusted_io_buffer_size = 0;
+
+int init_untrusted_io_pool(void) {
+    uint64_t size;
+    int ret = toml_sizestring_in(g_pal_state.manifest_root, "sgx.untrusted_io_buffer_size",
+                                 /*defaultval=*/0, &size);
+    if (ret < 0) {
+        log_error("Cannot parse 'sgx.untrusted_io_buffer_size'");
+        return -PAL_ERROR_INVAL;
+    }
+    g_untrusted_io_buffer_size = ALLOC_ALIGN_UP(size);
+
+    uint64_t prealloc_size;
+    ret = toml_sizestring_in(g_pal_state.manifest_root, "sgx.untrusted_io_prealloc_size",
+                             /*defaultval=*/0, &prealloc_size);
+    if (ret < 0) {
+        log_error("Cannot parse 'sgx.untrusted_io_prealloc_size'");
+        return -PAL_ERROR_INVAL;
+    }
+
+    uint64_t nontemporal_copy_threshold;
+    ret = toml_sizestring_in(g_pal_state.manifest_root, "sgx.nontemporal_copy_threshold",
+                             /*defaultval=*/0, &nontemporal_copy_threshold);
+    if (ret < 0) {
+        log_error("Cannot parse 'sgx.nontemporal_copy_threshold'");
+        return -PAL_ERROR_INVAL;
+    }
+    g_nontemporal_copy_threshold = nontemporal_copy_threshold;
 
+    bool huge_pages;
+    ret = toml_bool_in(g_pal_state.manifest_root, "sgx.untrusted_huge_pages", /*defaultval=*/false,
+                       &huge_pages);
+    if (ret < 0) {
+        log_error("Cannot parse 'sgx.untrusted_huge_pages' (the value must be `true` or `false`)");
+        return -PAL_ERROR_INVAL;
+    }
+    return init_untrusted_io_bufs(prealloc_size, huge_pages);
+}
+
+static bool untrusted_area_claim(struct untrusted_area* area) {
+    uint64_t in_use = 0;
+    return __atomic_compare_exchange_n(&area->in_use, &in_use, 1, /*weak=*/false,
+                                       __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+
+static void untrusted_area_release(struct untrusted_area* area) {
+    __atomic_store_n(&area->in_use, 0, __ATOMIC_RELAXED);
+}
+
+static int ocall_mmap_untrusted_cache(size_t size, void** addrptr, bool* need_munmap) {
     *addrptr = NULL;
     *need_munmap = false;
 
-    struct untrusted_area* cache = &get_tcb_trts()->untrusted_area_cache;
+    struct untrusted_area* pool = get_tcb_trts()->untrusted_area_pool;
 
-    uint64_t in_use = 0;
-    if (!__atomic_compare_exchange_n(&cache->in_use, &in_use, 1, /*weak=*/false, __ATOMIC_RELAXED,
-                                     __ATOMIC_RELAXED)) {
-        /* AEX signal handling case: cache is in use, so make explicit mmap/munmap */
-        ret = ocall_mmap_untrusted(addrptr, size, PROT_READ | PROT_WRITE,
-                                   MAP_ANONYMOUS | MAP_PRIVATE, /*fd=*/-1, /*offset=*/0);
-        if (ret < 0) {
-            return ret;
+    /* common case: some free buffer is already large enough */
+    for (size_t i = 0; i < UNTRUSTED_AREA_POOL_SIZE; i++) {
+        struct untrusted_area* area = &pool[i];
+        if (!area->valid || area->size < size || !untrusted_area_claim(area))
+            continue;
+        if (area->valid && area->size >= size) {
+            *addrptr = area->addr;
+            return 0;
+        }
+        /* buffer was replaced by a nested OCALL between the check and the claim */
+        untrusted_area_release(area);
+    }
+
+    /* no fitting buffer, (re)allocate a free one */
+    struct untrusted_area* area = NULL;
+    for (size_t i = 0; i < UNTRUSTED_AREA_POOL_SIZE; i++) {
+        if (untrusted_area_claim(&pool[i])) {
+            area = &pool[i];
+            break;
         }
+    }
+
+    size_t alloc_size;
+    if (!area) {
+        /* deeply nested signal handling: all buffers are in use, so take a one-off buffer */
+        *addrptr = alloc_untrusted_io_buf(size, &alloc_size);
+        if (!*addrptr)
+            return -ENOMEM;
         *need_munmap = true;
         return 0;
     }
 
-    /* normal execution case: cache was not in use, so use it/allocate new one for reuse */
-    if (cache->valid) {
-        if (cache->size >= size) {
-            *addrptr = cache->addr;
-            return 0;
-        }
-        ret = ocall_munmap_untrusted(cache->addr, cache->size);
-        if (ret < 0) {
-            cache->valid = false;
-            __atomic_store_n(&cache->in_use, 0, __ATOMIC_RELAXED);
-            return ret;
-        }
+    if (area->valid) {
+        free_untrusted_io_buf(area->addr, area->size);
+        area->valid = false;
     }
 
-    ret = ocall_mmap_untrusted(addrptr, size, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE,
-                               /*fd=*/-1, /*offset=*/0);
-    if (ret < 0) {
-        cache->valid = false;
-        __atomic_store_n(&cache->in_use, 0, __ATOMIC_RELAXED);
-    } else {
-        cache->valid = true;
-        cache->addr  = *addrptr;
-        cache->size  = size;
+    *addrptr = alloc_untrusted_io_buf(MAX(size, g_untrusted_io_buffer_size), &alloc_size);
+    if (!*addrptr) {
+        untrusted_area_release(area);
+        return -ENOMEM;
     }
-    return ret;
+
+    area->valid = true;
+    area->addr  = *addrptr;
+    area->size  = alloc_size;
+    return 0;
 }
 
 static void ocall_munmap_untrusted_cache(void* addr, size_t size, bool need_munmap) {
     if (need_munmap) {
-        ocall_munmap_untrusted(addr, size);
-        /* there is not much we can do in case of error */
-    } else {
-        struct untrusted_area* cache = &get_tcb_trts()->untrusted_area_cache;
-        __atomic_store_n(&cache->in_use, 0, __ATOMIC_RELAXED);
+        free_untrusted_io_buf(addr, size);
+        return;
+    }
+
+    struct untrusted_area* pool = get_tcb_trts()->untrusted_area_pool;
+    for (size_t i = 0; i < UNTRUSTED_AREA_POOL_SIZE; i++) {
+        if (pool[i].valid && pool[i].addr == addr) {
+            untrusted_area_release(&pool[i]);
+            return;
+        }
     }
 }
 
@@ -405,6 +863,14 @@ int ocall_close(int fd) {
     int retval = 0;
     ms_ocall_close_t* ms;
 
+    struct async_ocall* async = async_ocall_prepare(OCALL_CLOSE);
+    if (async) {
+        /* `sgx_ocall_close` never reports errors, so there is nothing to wait for */
+        WRITE_ONCE(async->ms.close.ms_fd, fd);
+        retval = async_ocall_submit(async, OCALL_CLOSE);
+        return retval < 0 && retval != -EBADF && retval != -EIO ? -EPERM : retval;
+    }
+
     void* old_ustack = sgx_prepare_ustack();
     ms = sgx_alloc_on_ustack_aligned(sizeof(*ms), alignof(*ms));
     if (!ms) {
@@ -429,6 +895,37 @@ int ocall_close(int fd) {
     return retval;
 }
 
+/* Sanitize return value of read/write/pread/pwrite OCALLs: only errors that the LibOS expects are
+ * passed through, and the number of transferred bytes must not exceed the requested `count`. */
+static long sanitize_io_retval(uint64_t code, long retval, size_t count) {
+    if (retval >= 0)
+        return (size_t)retval > count ? -EPERM : retval;
+
+    switch (retval) {
+        case -EAGAIN:
+#if EWOULDBLOCK != EAGAIN
+        case -EWOULDBLOCK:
+#endif
+        case -EBADF:
+        case -EINTR:
+        case -EINVAL:
+        case -EIO:
+            return retval;
+        case -EISDIR:
+            return (code == OCALL_READ || code == OCALL_PREAD) ? retval : -EPERM;
+        case -EFBIG:
+        case -ENOSPC:
+        case -EPIPE:
+            return (code == OCALL_WRITE || code == OCALL_PWRITE) ? retval : -EPERM;
+        case -ENXIO:
+        case -EOVERFLOW:
+        case -ESPIPE:
+            return (code == OCALL_PREAD || code == OCALL_PWRITE) ? retval : -EPERM;
+        default:
+            return -EPERM;
+    }
+}
+
 ssize_t ocall_read(int fd, void* buf, size_t count) {
     ssize_t retval = 0;
     void* obuf = NULL;
@@ -463,17 +960,9 @@ ssize_t ocall_read(int fd, void* buf, size_t count) {
     WRITE_ONCE(ms->ms_buf, ms_buf);
 
     retval = sgx_exitless_ocall(OCALL_READ, ms);
-
-    if (retval < 0 && retval != -EAGAIN && retval != -EWOULDBLOCK && retval != -EBADF &&
-            retval != -EINTR && retval != -EINVAL && retval != -EIO && retval != -EISDIR) {
-        retval = -EPERM;
-    }
+    retval = sanitize_io_retval(OCALL_READ, retval, count);
 
     if (retval > 0) {
-        if ((size_t)retval > count) {
-            retval = -EPERM;
-            goto out;
-        }
         if (!sgx_copy_to_enclave(buf, count, READ_ONCE(ms->ms_buf), retval)) {
             retval = -EPERM;
             goto out;
@@ -508,7 +997,7 @@ ssize_t ocall_write(int fd, const void* buf, size_t count) {
                 sgx_reset_ustack(old_ustack);
                 return retval;
             }
-            memcpy(obuf, buf, count);
+            sgx_copy_from_enclave(obuf, buf, count);
             ms_buf = obuf;
         } else {
             ms_buf = sgx_copy_to_ustack(buf, count);
@@ -533,17 +1022,7 @@ ssize_t ocall_write(int fd, const void* buf, size_t count) {
     WRITE_ONCE(ms->ms_buf, ms_buf);
 
     retval = sgx_exitless_ocall(OCALL_WRITE, ms);
-
-    if (retval < 0 && retval != -EAGAIN && retval != -EWOULDBLOCK && retval != -EBADF &&
-            retval != -EFBIG && retval != -EINTR && retval != -EINVAL && retval != -EIO &&
-            retval != -ENOSPC && retval != -EPIPE) {
-        retval = -EPERM;
-    }
-
-    if (retval > 0 && (size_t)retval > count) {
-        retval = -EPERM;
-        goto out;
-    }
+    retval = sanitize_io_retval(OCALL_WRITE, retval, count);
 
 out:
     sgx_reset_ustack(old_ustack);
@@ -587,18 +1066,9 @@ ssize_t ocall_pread(int fd, void* buf, size_t count, off_t offset) {
     WRITE_ONCE(ms->ms_buf, ms_buf);
 
     retval = sgx_exitless_ocall(OCALL_PREAD, ms);
-
-    if (retval < 0 && retval != -EAGAIN && retval != -EWOULDBLOCK && retval != -EBADF &&
-            retval != -EINTR && retval != -EINVAL && retval != -EIO && retval != -EISDIR &&
-            retval != -ENXIO && retval != -EOVERFLOW && retval != -ESPIPE) {
-        retval = -EPERM;
-    }
+    retval = sanitize_io_retval(OCALL_PREAD, retval, count);
 
     if (retval > 0) {
-        if ((size_t)retval > count) {
-            retval = -EPERM;
-            goto out;
-        }
         if (!sgx_copy_to_enclave(buf, count, READ_ONCE(ms->ms_buf), retval)) {
             retval = -EPERM;
         }
@@ -632,7 +1102,7 @@ ssize_t ocall_pwrite(int fd, const void* buf, size_t count, off_t offset) {
                 sgx_reset_ustack(old_ustack);
                 return retval;
             }
-            memcpy(obuf, buf, count);
+            sgx_copy_from_enclave(obuf, buf, count);
             ms_buf = obuf;
         } else {
             ms_buf = sgx_copy_to_ustack(buf, count);
@@ -658,29 +1128,250 @@ ssize_t ocall_pwrite(int fd, const void* buf, size_t count, off_t offset) {
     WRITE_ONCE(ms->ms_buf, ms_buf);
 
     retval = sgx_exitless_ocall(OCALL_PWRITE, ms);
+    retval = sanitize_io_retval(OCALL_PWRITE, retval, count);
 
-    if (retval < 0 && retval != -EAGAIN && retval != -EWOULDBLOCK && retval != -EBADF &&
-            retval != -EFBIG && retval != -EINTR && retval != -EINVAL && retval != -EIO &&
-            retval != -ENOSPC && retval != -ENXIO && retval != -EOVERFLOW && retval != -EPIPE &&
-            retval != -ESPIPE) {
+out:
+    sgx_reset_ustack(old_ustack);
+    if (obuf)
+        ocall_munmap_untrusted_cache(obuf, ALLOC_ALIGN_UP(count), need_munmap);
+    return retval;
+}
+
+static const uint64_t g_io_op_to_ocall[] = {
+    [OCALL_IO_READ]   = OCALL_READ,
+    [OCALL_IO_WRITE]  = OCALL_WRITE,
+    [OCALL_IO_PREAD]  = OCALL_PREAD,
+    [OCALL_IO_PWRITE] = OCALL_PWRITE,
+};
+
+int ocall_io_batch(struct ocall_io_req* reqs, size_t count) {
+    int ret;
+    void* obuf = NULL;
+    bool need_munmap = false;
+    size_t total_size = 0;
+
+    if (!count)
+        return 0;
+    if (count > OCALL_IO_BATCH_MAX)
+        return -EINVAL;
+
+    for (size_t i = 0; i < count; i++) {
+        if (reqs[i].op != OCALL_IO_READ && reqs[i].op != OCALL_IO_WRITE &&
+                reqs[i].op != OCALL_IO_PREAD && reqs[i].op != OCALL_IO_PWRITE)
+            return -EINVAL;
+        if (!sgx_is_completely_within_enclave(reqs[i].buf, reqs[i].count))
+            return -EINVAL;
+        if (__builtin_add_overflow(total_size, ALIGN_UP(reqs[i].count, 16), &total_size))
+            return -EINVAL;
+    }
+
+    void* old_ustack = sgx_prepare_ustack();
+
+    /* all payloads are marshalled into one untrusted buffer: on the untrusted stack if they fit,
+     * otherwise in the per-thread cached untrusted mapping */
+    char* ubuf;
+    if (total_size > MAX_UNTRUSTED_STACK_BUF) {
+        ret = ocall_mmap_untrusted_cache(ALLOC_ALIGN_UP(total_size), &obuf, &need_munmap);
+        if (ret < 0) {
+            sgx_reset_ustack(old_ustack);
+            return ret;
+        }
+        ubuf = obuf;
+    } else {
+        ubuf = sgx_alloc_on_ustack_aligned(total_size, 16);
+        if (!ubuf) {
+            ret = -EPERM;
+            goto out;
+        }
+    }
+
+    ms_ocall_batch_t* ms = sgx_alloc_on_ustack_aligned(sizeof(*ms), alignof(*ms));
+    ocall_batch_entry_t* entries = sgx_alloc_on_ustack_aligned(sizeof(*entries) * count,
+                                                               alignof(*entries));
+    if (!ms || !entries) {
+        ret = -EPERM;
+        goto out;
+    }
+
+    char* ubuf_pos = ubuf;
+    for (size_t i = 0; i < count; i++) {
+        struct ocall_io_req* req = &reqs[i];
+        void* req_ms;
+
+        if (req->op == OCALL_IO_WRITE || req->op == OCALL_IO_PWRITE)
+            sgx_copy_from_enclave(ubuf_pos, req->buf, req->count);
+
+        switch (req->op) {
+            case OCALL_IO_READ: {
+                ms_ocall_read_t* ms_read = sgx_alloc_on_ustack_aligned(sizeof(*ms_read),
+                                                                       alignof(*ms_read));
+                if (!ms_read) {
+                    ret = -EPERM;
+                    goto out;
+                }
+                WRITE_ONCE(ms_read->ms_fd, req->fd);
+                WRITE_ONCE(ms_read->ms_count, req->count);
+                WRITE_ONCE(ms_read->ms_buf, ubuf_pos);
+                req_ms = ms_read;
+                break;
+            }
+            case OCALL_IO_WRITE: {
+                ms_ocall_write_t* ms_write = sgx_alloc_on_ustack_aligned(sizeof(*ms_write),
+                                                                         alignof(*ms_write));
+                if (!ms_write) {
+                    ret = -EPERM;
+                    goto out;
+                }
+                WRITE_ONCE(ms_write->ms_fd, req->fd);
+                WRITE_ONCE(ms_write->ms_count, req->count);
+                WRITE_ONCE(ms_write->ms_buf, ubuf_pos);
+                req_ms = ms_write;
+                break;
+            }
+            case OCALL_IO_PREAD: {
+                ms_ocall_pread_t* ms_pread = sgx_alloc_on_ustack_aligned(sizeof(*ms_pread),
+                                                                         alignof(*ms_pread));
+                if (!ms_pread) {
+                    ret = -EPERM;
+                    goto out;
+                }
+                WRITE_ONCE(ms_pread->ms_fd, req->fd);
+                WRITE_ONCE(ms_pread->ms_count, req->count);
+                WRITE_ONCE(ms_pread->ms_offset, req->offset);
+                WRITE_ONCE(ms_pread->ms_buf, ubuf_pos);
+                req_ms = ms_pread;
+                break;
+            }
+            default: {
+                ms_ocall_pwrite_t* ms_pwrite = sgx_alloc_on_ustack_aligned(sizeof(*ms_pwrite),
+                                                                           alignof(*ms_pwrite));
+                if (!ms_pwrite) {
+                    ret = -EPERM;
+                    goto out;
+                }
+                WRITE_ONCE(ms_pwrite->ms_fd, req->fd);
+                WRITE_ONCE(ms_pwrite->ms_count, req->count);
+                WRITE_ONCE(ms_pwrite->ms_offset, req->offset);
+                WRITE_ONCE(ms_pwrite->ms_buf, ubuf_pos);
+                req_ms = ms_pwrite;
+                break;
+            }
+        }
+
+        WRITE_ONCE(entries[i].ocall_index, g_io_op_to_ocall[req->op]);
+        WRITE_ONCE(entries[i].ms, req_ms);
+        WRITE_ONCE(entries[i].result, -EINVAL);
+        ubuf_pos += ALIGN_UP(req->count, 16);
+    }
+
+    WRITE_ONCE(ms->ms_count, count);
+    WRITE_ONCE(ms->ms_entries, entries);
+
+    /* not retried on -EINTR: some entries may have been executed already, so the caller must decide
+     * how to redo the operations (e.g. positional writes can be simply re-issued) */
+    ret = sgx_exitless_ocall(OCALL_BATCH, ms);
+    if (ret < 0) {
+        ret = (ret == -EINTR) ? -EINTR : -EPERM;
+        goto out;
+    }
+
+    /* reap completions; the untrusted buffer pointers may have been tampered with, so data is
+     * copied from our own view of `ubuf` and not from the marshalled `ms_buf` fields */
+    ubuf_pos = ubuf;
+    for (size_t i = 0; i < count; i++) {
+        struct ocall_io_req* req = &reqs[i];
+        bool is_read = req->op == OCALL_IO_READ || req->op == OCALL_IO_PREAD;
+        long retval = sanitize_io_retval(g_io_op_to_ocall[req->op], READ_ONCE(entries[i].result),
+                                         req->count);
+
+        if (retval > 0 && is_read) {
+            if (!sgx_copy_to_enclave(req->buf, req->count, ubuf_pos, retval))
+                retval = -EPERM;
+        }
+
+        req->result = retval;
+        ubuf_pos += ALIGN_UP(req->count, 16);
+    }
+
+    ret = 0;
+out:
+    sgx_reset_ustack(old_ustack);
+    if (obuf)
+        ocall_munmap_untrusted_cache(obuf, ALLOC_ALIGN_UP(total_size), need_munmap);
+    return ret;
+}
+
+int ocall_fstat(int fd, struct stat* buf) {
+    int retval = 0;
+    ms_ocall_fstat_t* ms;
+
+    void* old_ustack = sgx_prepare_ustack();
+    ms = sgx_alloc_on_ustack_aligned(sizeof(*ms), alignof(*ms));
+    if (!ms) {
+        sgx_reset_ustack(old_ustack);
+        return -EPERM;
+    }
+
+    WRITE_ONCE(ms->ms_fd, fd);
+
+    do {
+        retval = sgx_exitless_ocall(OCALL_FSTAT, ms);
+    } while (retval == -EINTR);
+
+    if (retval < 0 && retval != -EACCES && retval != -EBADF && retval != -ELOOP &&
+            retval != -ENAMETOOLONG && retval != -ENOENT && retval != -ENOMEM &&
+            retval != -ENOTDIR) {
         retval = -EPERM;
     }
 
-    if (retval > 0 && (size_t)retval > count) {
+    if (!retval) {
+        memcpy(buf, &ms->ms_stat, sizeof(struct stat));
+    }
+
+    sgx_reset_ustack(old_ustack);
+    return retval;
+}
+
+int ocall_stat(const char* pathname, struct stat* buf) {
+    int retval = 0;
+    size_t path_size = pathname ? strlen(pathname) + 1 : 0;
+    ms_ocall_stat_t* ms;
+
+    void* old_ustack = sgx_prepare_ustack();
+    ms = sgx_alloc_on_ustack_aligned(sizeof(*ms), alignof(*ms));
+    if (!ms) {
+        sgx_reset_ustack(old_ustack);
+        return -EPERM;
+    }
+
+    void* untrusted_pathname = sgx_copy_to_ustack(pathname, path_size);
+    if (!untrusted_pathname) {
+        sgx_reset_ustack(old_ustack);
+        return -EPERM;
+    }
+    WRITE_ONCE(ms->ms_pathname, untrusted_pathname);
+
+    do {
+        retval = sgx_exitless_ocall(OCALL_STAT, ms);
+    } while (retval == -EINTR);
+
+    if (retval < 0 && retval != -EACCES && retval != -ELOOP && retval != -ENAMETOOLONG &&
+            retval != -ENOENT && retval != -ENOMEM && retval != -ENOTDIR) {
         retval = -EPERM;
-        goto out;
     }
 
-out:
+    if (!retval) {
+        memcpy(buf, &ms->ms_stat, sizeof(struct stat));
+    }
+
     sgx_reset_ustack(old_ustack);
-    if (obuf)
-        ocall_munmap_untrusted_cache(obuf, ALLOC_ALIGN_UP(count), need_munmap);
     return retval;
 }
 
-int ocall_fstat(int fd, struct stat* buf) {
+int ocall_open_stat(const char* pathname, int flags, unsigned short mode, struct stat* buf) {
     int retval = 0;
-    ms_ocall_fstat_t* ms;
+    size_t path_size = pathname ? strlen(pathname) + 1 : 0;
+    ms_ocall_open_stat_t* ms;
 
     void* old_ustack = sgx_prepare_ustack();
     ms = sgx_alloc_on_ustack_aligned(sizeof(*ms), alignof(*ms));
@@ -689,19 +1380,29 @@ int ocall_fstat(int fd, struct stat* buf) {
         return -EPERM;
     }
 
-    WRITE_ONCE(ms->ms_fd, fd);
+    WRITE_ONCE(ms->ms_flags, flags);
+    WRITE_ONCE(ms->ms_mode, mode);
+    void* untrusted_pathname = sgx_copy_to_ustack(pathname, path_size);
+    if (!untrusted_pathname) {
+        sgx_reset_ustack(old_ustack);
+        return -EPERM;
+    }
+    WRITE_ONCE(ms->ms_pathname, untrusted_pathname);
 
     do {
-        retval = sgx_exitless_ocall(OCALL_FSTAT, ms);
+        retval = sgx_exitless_ocall(OCALL_OPEN_STAT, ms);
     } while (retval == -EINTR);
 
-    if (retval < 0 && retval != -EACCES && retval != -EBADF && retval != -ELOOP &&
-            retval != -ENAMETOOLONG && retval != -ENOENT && retval != -ENOMEM &&
-            retval != -ENOTDIR) {
+    /* same errors as ocall_open() */
+    if (retval < 0 && retval != -EACCES && retval != -EEXIST && retval != -EINVAL &&
+            retval != -EISDIR && retval != -ELOOP && retval != -EMFILE &&
+            retval != -ENAMETOOLONG && retval != -ENFILE && retval != -ENODEV &&
+            retval != -ENOENT && retval != -ENOMEM && retval != -ENOTDIR && retval != -EROFS &&
+            retval != -EWOULDBLOCK) {
         retval = -EPERM;
     }
 
-    if (!retval) {
+    if (retval >= 0) {
         memcpy(buf, &ms->ms_stat, sizeof(struct stat));
     }
 
@@ -877,6 +1578,24 @@ int ocall_mkdir(const char* pathname, unsigned short mode) {
     return retval;
 }
 
+/* Validates the layout of the dirents copied into the enclave; returns their number, or -1 */
+static ssize_t count_dirents(struct linux_dirent64* dirp, size_t size) {
+    ssize_t cnt = 0;
+    size_t size_left = size;
+    while (size_left > offsetof(struct linux_dirent64, d_name)) {
+        /* `drip->d_off` is understandable only by the fs driver in kernel, we have no way of
+         * validating it. */
+        if (dirp->d_reclen > size_left)
+            return -1;
+        size_left -= dirp->d_reclen;
+        dirp = (struct linux_dirent64*)((char*)dirp + dirp->d_reclen);
+        cnt++;
+    }
+    if (size_left != 0)
+        return -1;
+    return cnt;
+}
+
 int ocall_getdents(int fd, struct linux_dirent64* dirp, size_t dirp_size) {
     int retval = 0;
     ms_ocall_getdents_t* ms;
@@ -917,18 +1636,7 @@ int ocall_getdents(int fd, struct linux_dirent64* dirp, size_t dirp_size) {
             goto out;
         }
 
-        size_t size_left = size;
-        while (size_left > offsetof(struct linux_dirent64, d_name)) {
-            /* `drip->d_off` is understandable only by the fs driver in kernel, we have no way of
-             * validating it. */
-            if (dirp->d_reclen > size_left) {
-                retval = -EPERM;
-                goto out;
-            }
-            size_left -= dirp->d_reclen;
-            dirp = (struct linux_dirent64*)((char*)dirp + dirp->d_reclen);
-        }
-        if (size_left != 0) {
+        if (count_dirents(dirp, size) < 0) {
             retval = -EPERM;
             goto out;
         }
@@ -939,6 +1647,75 @@ out:
     return retval;
 }
 
+int ocall_getdents_stat(int fd, struct linux_dirent64* dirp, size_t dirp_size, struct stat* stats,
+                        size_t* stats_cnt) {
+    int retval = 0;
+    ms_ocall_getdents_stat_t* ms;
+
+    void* old_ustack = sgx_prepare_ustack();
+    ms = sgx_alloc_on_ustack_aligned(sizeof(*ms), alignof(*ms));
+    if (!ms) {
+        retval = -EPERM;
+        goto out;
+    }
+
+    WRITE_ONCE(ms->ms_fd, fd);
+    WRITE_ONCE(ms->ms_size, dirp_size);
+    WRITE_ONCE(ms->ms_stats_cnt, *stats_cnt);
+    void* untrusted_dirp = sgx_alloc_on_ustack_aligned(dirp_size, alignof(*dirp));
+    void* untrusted_stats = sgx_alloc_on_ustack_aligned(*stats_cnt * sizeof(*stats),
+                                                        alignof(*stats));
+    if (!untrusted_dirp || !untrusted_stats) {
+        retval = -EPERM;
+        goto out;
+    }
+    WRITE_ONCE(ms->ms_dirp, untrusted_dirp);
+    WRITE_ONCE(ms->ms_stats, untrusted_stats);
+
+    do {
+        retval = sgx_exitless_ocall(OCALL_GETDENTS_STAT, ms);
+    } while (retval == -EINTR);
+
+    if (retval < 0 && retval != -EBADF && retval != -EINVAL && retval != -ENOENT &&
+            retval != -ENOTDIR) {
+        retval = -EPERM;
+    }
+
+    if (retval <= 0) {
+        *stats_cnt = 0;
+        goto out;
+    }
+
+    size_t size = (size_t)retval;
+    if (size > dirp_size) {
+        retval = -EPERM;
+        goto out;
+    }
+    if (!sgx_copy_to_enclave(dirp, dirp_size, READ_ONCE(ms->ms_dirp), size)) {
+        retval = -EPERM;
+        goto out;
+    }
+
+    ssize_t dirents_cnt = count_dirents(dirp, size);
+    if (dirents_cnt < 0) {
+        retval = -EPERM;
+        goto out;
+    }
+
+    /* the stat records are only as trustworthy as the ones returned by ocall_fstat() */
+    if ((size_t)dirents_cnt < *stats_cnt)
+        *stats_cnt = dirents_cnt;
+    if (!sgx_copy_to_enclave(stats, *stats_cnt * sizeof(*stats), READ_ONCE(ms->ms_stats),
+                             *stats_cnt * sizeof(*stats))) {
+        retval = -EPERM;
+        goto out;
+    }
+
+out:
+    sgx_reset_ustack(old_ustack);
+    return retval;
+}
+
 int ocall_resume_thread(void* tcs) {
     int retval = 0;
     do {
@@ -952,15 +1729,25 @@ int ocall_resume_thread(void* tcs) {
     return retval;
 }
 
-int ocall_clone_thread(void) {
+int ocall_clone_thread(void* tcs) {
     int retval = 0;
-    void* dummy = NULL;
+    ms_ocall_clone_thread_t* ms;
+
+    void* old_ustack = sgx_prepare_ustack();
+    ms = sgx_alloc_on_ustack_aligned(sizeof(*ms), alignof(*ms));
+    if (!ms) {
+        sgx_reset_ustack(old_ustack);
+        return -EPERM;
+    }
+
+    WRITE_ONCE(ms->ms_tcs, tcs);
+
     /* FIXME: if there was an EINTR, there may be an untrusted thread left over */
     do {
         /* clone must happen in the context of current (enclave) thread, cannot use exitless;
          * in particular, the new (enclave) thread must have the same signal mask as the current
          * enclave thread (and NOT signal mask of the RPC thread) */
-        retval = sgx_ocall(OCALL_CLONE_THREAD, dummy);
+        retval = sgx_ocall(OCALL_CLONE_THREAD, ms);
     } while (retval == -EINTR);
 
     if (retval < 0 && retval != -ENOMEM && retval != -EAGAIN && retval != -EINVAL &&
@@ -968,6 +1755,7 @@ int ocall_clone_thread(void) {
         retval = -EPERM;
     }
 
+    sgx_reset_ustack(old_ustack);
     return retval;
 }
 
@@ -1030,6 +1818,19 @@ int ocall_futex(uint32_t* futex, int op, int val, uint64_t* timeout_us) {
         return -EINVAL;
     }
 
+    struct async_ocall* async = op == FUTEX_WAKE ? async_ocall_prepare(OCALL_FUTEX) : NULL;
+    if (async) {
+        /* callers don't need the number of woken-up waiters, so don't wait for it */
+        WRITE_ONCE(async->ms.futex.ms_futex, futex);
+        WRITE_ONCE(async->ms.futex.ms_op, op);
+        WRITE_ONCE(async->ms.futex.ms_val, val);
+        WRITE_ONCE(async->ms.futex.ms_timeout_us, (uint64_t)-1);
+        retval = async_ocall_submit(async, OCALL_FUTEX);
+        if (retval < 0 && retval != -EINTR && retval != -EINVAL && retval != -ENOSYS)
+            retval = -EPERM;
+        return retval;
+    }
+
     void* old_ustack = sgx_prepare_ustack();
     ms = sgx_alloc_on_ustack_aligned(sizeof(*ms), alignof(*ms));
     if (!ms) {
@@ -1211,6 +2012,62 @@ int ocall_accept(int sockfd, struct sockaddr* addr, size_t* addrlen, struct sock
     return retval;
 }
 
+int ocall_accept_batch(int sockfd, struct ocall_accepted_conn* conns, unsigned int max) {
+    int retval = 0;
+    ms_ocall_accept_batch_t* ms;
+
+    if (!max)
+        return -EINVAL;
+
+    void* old_ustack = sgx_prepare_ustack();
+    ms = sgx_alloc_on_ustack_aligned(sizeof(*ms), alignof(*ms));
+    if (!ms) {
+        sgx_reset_ustack(old_ustack);
+        return -EPERM;
+    }
+
+    struct ocall_accepted_conn* untrusted_conns =
+        sgx_alloc_on_ustack_aligned(sizeof(*conns) * max, alignof(*conns));
+    if (!untrusted_conns) {
+        sgx_reset_ustack(old_ustack);
+        return -EPERM;
+    }
+
+    WRITE_ONCE(ms->ms_sockfd, sockfd);
+    WRITE_ONCE(ms->ms_max, max);
+    WRITE_ONCE(ms->ms_conns, untrusted_conns);
+
+    retval = sgx_exitless_ocall(OCALL_ACCEPT_BATCH, ms);
+
+    if (retval < 0 && retval != -EAGAIN && retval != -EWOULDBLOCK && retval != -EBADF &&
+            retval != -ECONNABORTED && retval != -EINTR && retval != -EINVAL && retval != -EMFILE &&
+            retval != -ENFILE && retval != -ENOMEM && retval != -ENOBUFS && retval != -ENOTSOCK &&
+            retval != -EPROTO && retval != -EPERM && retval != -ENOPROTOOPT) {
+        retval = -EPERM;
+    }
+
+    if (retval > 0) {
+        if ((unsigned int)retval > max) {
+            sgx_reset_ustack(old_ustack);
+            return -EPERM;
+        }
+
+        for (int i = 0; i < retval; i++) {
+            conns[i].fd = READ_ONCE(untrusted_conns[i].fd);
+            size_t addrlen = READ_ONCE(untrusted_conns[i].addrlen);
+            if (conns[i].fd < 0 || !sgx_copy_to_enclave(&conns[i].addr, sizeof(conns[i].addr),
+                                                        &untrusted_conns[i].addr, addrlen)) {
+                sgx_reset_ustack(old_ustack);
+                return -EPERM;
+            }
+            conns[i].addrlen = addrlen;
+        }
+    }
+
+    sgx_reset_ustack(old_ustack);
+    return retval;
+}
+
 int ocall_connect(int domain, int type, int protocol, int ipv6_v6only, const struct sockaddr* addr,
                   size_t addrlen, struct sockaddr* bind_addr, size_t* bind_addrlen,
                   struct sockopt* sockopt) {
@@ -1275,8 +2132,21 @@ int ocall_connect(int domain, int type, int protocol, int ipv6_v6only, const str
     return retval;
 }
 
-ssize_t ocall_recv(int sockfd, void* buf, size_t count, struct sockaddr* addr, size_t* addrlenptr,
-                   void* control, size_t* controllenptr) {
+/* returns total size of buffers in `iov` or -EINVAL if it overflows; optionally checks that all
+ * buffers are inside the enclave (-EPERM otherwise) */
+static ssize_t iov_total_size(const PAL_IOVEC* iov, size_t iov_cnt, bool check_in_enclave) {
+    size_t total = 0;
+    for (size_t i = 0; i < iov_cnt; i++) {
+        if (check_in_enclave && !sgx_is_completely_within_enclave(iov[i].iov_base, iov[i].iov_len))
+            return -EPERM;
+        if (__builtin_add_overflow(total, iov[i].iov_len, &total) || (ssize_t)total < 0)
+            return -EINVAL;
+    }
+    return total;
+}
+
+ssize_t ocall_recvmsg(int sockfd, PAL_IOVEC* iov, size_t iov_cnt, struct sockaddr* addr,
+                      size_t* addrlenptr, void* control, size_t* controllenptr) {
     ssize_t retval = 0;
     void* obuf = NULL;
     bool is_obuf_mapped = false;
@@ -1285,6 +2155,11 @@ ssize_t ocall_recv(int sockfd, void* buf, size_t count, struct sockaddr* addr, s
     ms_ocall_recv_t* ms;
     bool need_munmap = false;
 
+    ssize_t total = iov_total_size(iov, iov_cnt, /*check_in_enclave=*/false);
+    if (total < 0)
+        return total;
+    size_t count = total;
+
     void* old_ustack = sgx_prepare_ustack();
 
     if ((count + addrlen + controllen) > MAX_UNTRUSTED_STACK_BUF) {
@@ -1351,12 +2226,239 @@ ssize_t ocall_recv(int sockfd, void* buf, size_t count, struct sockaddr* addr, s
                 retval = -EPERM;
                 goto out;
             }
-            *controllenptr = untrusted_controllen;
-        }
+            *controllenptr = untrusted_controllen;
+        }
+
+        /* scatter received data into enclave buffers; use the enclave's own copy of the buffer
+         * pointer instead of re-reading `ms->ms_buf` from untrusted memory */
+        size_t copied = 0;
+        for (size_t i = 0; i < iov_cnt && copied < (size_t)retval; i++) {
+            size_t chunk = MIN(iov[i].iov_len, (size_t)retval - copied);
+            if (!sgx_copy_to_enclave(iov[i].iov_base, chunk, (char*)obuf + copied, chunk)) {
+                retval = -EPERM;
+                goto out;
+            }
+            copied += chunk;
+        }
+    }
+
+out:
+    sgx_reset_ustack(old_ustack);
+    if (is_obuf_mapped)
+        ocall_munmap_untrusted_cache(obuf, ALLOC_ALIGN_UP(count), need_munmap);
+    return retval;
+}
+
+/* Lays out up to OCALL_MMSG_MAX datagrams of `msgs` back to back in one untrusted buffer (on the
+ * untrusted stack if it fits); `sizes` receives the size of each datagram. Returns the total size
+ * or a negative error code. */
+static ssize_t mmsg_alloc_buf(PAL_MSG* msgs, size_t cnt, bool is_send, size_t* sizes,
+                              void** obuf, bool* is_obuf_mapped, bool* need_munmap) {
+    size_t count = 0;
+    for (size_t i = 0; i < cnt; i++) {
+        ssize_t size = iov_total_size(msgs[i].iov, msgs[i].iov_cnt, /*check_in_enclave=*/is_send);
+        if (size < 0)
+            return size;
+        if (__builtin_add_overflow(count, (size_t)size, &count) || (ssize_t)count < 0)
+            return -EINVAL;
+        sizes[i] = size;
+    }
+
+    if (count > MAX_UNTRUSTED_STACK_BUF) {
+        int ret = ocall_mmap_untrusted_cache(ALLOC_ALIGN_UP(count), obuf, need_munmap);
+        if (ret < 0)
+            return ret;
+        *is_obuf_mapped = true;
+    } else {
+        *obuf = sgx_alloc_on_ustack(count);
+        if (!*obuf)
+            return -EPERM;
+    }
+    return count;
+}
+
+ssize_t ocall_sendmmsg(int sockfd, PAL_MSG* msgs, size_t msg_cnt) {
+    ssize_t retval = 0;
+    void* obuf = NULL;
+    bool is_obuf_mapped = false;
+    bool need_munmap = false;
+    size_t sizes[OCALL_MMSG_MAX];
+    size_t count = 0;
+
+    size_t cnt = MIN(msg_cnt, OCALL_MMSG_MAX);
+    if (!cnt)
+        return 0;
+
+    void* old_ustack = sgx_prepare_ustack();
+
+    retval = mmsg_alloc_buf(msgs, cnt, /*is_send=*/true, sizes, &obuf, &is_obuf_mapped,
+                            &need_munmap);
+    if (retval < 0)
+        goto out;
+    count = retval;
+
+    ms_ocall_mmsg_t* ms = sgx_alloc_on_ustack_aligned(sizeof(*ms), alignof(*ms));
+    struct ocall_mmsg* umsgs = sgx_alloc_on_ustack_aligned(sizeof(*umsgs) * cnt, alignof(*umsgs));
+    if (!ms || !umsgs) {
+        retval = -EPERM;
+        goto out;
+    }
+
+    char* buf = obuf;
+    for (size_t i = 0; i < cnt; i++) {
+        void* untrusted_addr = NULL;
+        if (msgs[i].addr) {
+            untrusted_addr = sgx_copy_to_ustack(msgs[i].addr, msgs[i].addrlen);
+            if (!untrusted_addr) {
+                retval = -EPERM;
+                goto out;
+            }
+        }
+
+        WRITE_ONCE(umsgs[i].buf, buf);
+        WRITE_ONCE(umsgs[i].len, sizes[i]);
+        WRITE_ONCE(umsgs[i].addr, untrusted_addr);
+        WRITE_ONCE(umsgs[i].addrlen, untrusted_addr ? msgs[i].addrlen : 0);
+        WRITE_ONCE(umsgs[i].bytes, 0);
+        for (size_t j = 0; j < msgs[i].iov_cnt; j++) {
+            memcpy(buf, msgs[i].iov[j].iov_base, msgs[i].iov[j].iov_len);
+            buf += msgs[i].iov[j].iov_len;
+        }
+    }
+
+    WRITE_ONCE(ms->ms_sockfd, sockfd);
+    WRITE_ONCE(ms->ms_msgs, umsgs);
+    WRITE_ONCE(ms->ms_vlen, cnt);
+
+    retval = sgx_exitless_ocall(OCALL_SENDMMSG, ms);
+
+    if (retval < 0 && retval != -EACCES && retval != -EAGAIN && retval != -EWOULDBLOCK &&
+            retval != -EALREADY && retval != -EBADF && retval != -ECONNRESET &&
+            retval != -EINTR && retval != -EINVAL && retval != -EISCONN && retval != -EMSGSIZE &&
+            retval != -ENOMEM && retval != -ENOBUFS && retval != -ENOTCONN && retval != -ENOTSOCK &&
+            retval != -EOPNOTSUPP && retval != -EPIPE && retval != -EDESTADDRREQ) {
+        retval = -EPERM;
+    }
+
+    if (retval > 0) {
+        if ((size_t)retval > cnt) {
+            retval = -EPERM;
+            goto out;
+        }
+        for (ssize_t i = 0; i < retval; i++) {
+            size_t bytes = READ_ONCE(umsgs[i].bytes);
+            if (bytes > sizes[i]) {
+                retval = -EPERM;
+                goto out;
+            }
+            msgs[i].len = bytes;
+        }
+    }
+
+out:
+    sgx_reset_ustack(old_ustack);
+    if (is_obuf_mapped)
+        ocall_munmap_untrusted_cache(obuf, ALLOC_ALIGN_UP(count), need_munmap);
+    return retval;
+}
+
+ssize_t ocall_recvmmsg(int sockfd, PAL_MSG* msgs, size_t msg_cnt) {
+    ssize_t retval = 0;
+    void* obuf = NULL;
+    bool is_obuf_mapped = false;
+    bool need_munmap = false;
+    size_t sizes[OCALL_MMSG_MAX];
+    void* untrusted_addrs[OCALL_MMSG_MAX];
+    size_t count = 0;
+
+    size_t cnt = MIN(msg_cnt, OCALL_MMSG_MAX);
+    if (!cnt)
+        return 0;
+
+    void* old_ustack = sgx_prepare_ustack();
+
+    retval = mmsg_alloc_buf(msgs, cnt, /*is_send=*/false, sizes, &obuf, &is_obuf_mapped,
+                            &need_munmap);
+    if (retval < 0)
+        goto out;
+    count = retval;
+
+    ms_ocall_mmsg_t* ms = sgx_alloc_on_ustack_aligned(sizeof(*ms), alignof(*ms));
+    struct ocall_mmsg* umsgs = sgx_alloc_on_ustack_aligned(sizeof(*umsgs) * cnt, alignof(*umsgs));
+    if (!ms || !umsgs) {
+        retval = -EPERM;
+        goto out;
+    }
+
+    char* buf = obuf;
+    for (size_t i = 0; i < cnt; i++) {
+        untrusted_addrs[i] = NULL;
+        if (msgs[i].addr) {
+            untrusted_addrs[i] = sgx_alloc_on_ustack_aligned(msgs[i].addrlen,
+                                                             alignof(struct sockaddr));
+            if (!untrusted_addrs[i]) {
+                retval = -EPERM;
+                goto out;
+            }
+        }
+
+        WRITE_ONCE(umsgs[i].buf, buf);
+        WRITE_ONCE(umsgs[i].len, sizes[i]);
+        WRITE_ONCE(umsgs[i].addr, untrusted_addrs[i]);
+        WRITE_ONCE(umsgs[i].addrlen, untrusted_addrs[i] ? msgs[i].addrlen : 0);
+        WRITE_ONCE(umsgs[i].bytes, 0);
+        buf += sizes[i];
+    }
+
+    WRITE_ONCE(ms->ms_sockfd, sockfd);
+    WRITE_ONCE(ms->ms_msgs, umsgs);
+    WRITE_ONCE(ms->ms_vlen, cnt);
+
+    retval = sgx_exitless_ocall(OCALL_RECVMMSG, ms);
+
+    if (retval < 0 && retval != -EAGAIN && retval != -EWOULDBLOCK && retval != -EBADF &&
+            retval != -ECONNREFUSED && retval != -EINTR && retval != -EINVAL && retval != -ENOMEM &&
+            retval != -ENOTCONN && retval != -ENOTSOCK) {
+        retval = -EPERM;
+    }
+
+    if (retval > 0) {
+        if ((size_t)retval > cnt) {
+            retval = -EPERM;
+            goto out;
+        }
+
+        /* scatter each datagram into its enclave buffers; use the enclave's own copies of the
+         * untrusted pointers instead of re-reading them from untrusted memory */
+        buf = obuf;
+        for (ssize_t i = 0; i < retval; i++) {
+            size_t bytes = READ_ONCE(umsgs[i].bytes);
+            if (bytes > sizes[i]) {
+                retval = -EPERM;
+                goto out;
+            }
 
-        if (retval > 0 && !sgx_copy_to_enclave(buf, count, READ_ONCE(ms->ms_buf), retval)) {
-            retval = -EPERM;
-            goto out;
+            if (untrusted_addrs[i]) {
+                size_t untrusted_addrlen = READ_ONCE(umsgs[i].addrlen);
+                if (!sgx_copy_to_enclave(msgs[i].addr, msgs[i].addrlen, untrusted_addrs[i],
+                                         untrusted_addrlen)) {
+                    retval = -EPERM;
+                    goto out;
+                }
+                msgs[i].addrlen = untrusted_addrlen;
+            }
+
+            size_t copied = 0;
+            for (size_t j = 0; j < msgs[i].iov_cnt && copied < bytes; j++) {
+                size_t chunk = MIN(msgs[i].iov[j].iov_len, bytes - copied);
+                if (!sgx_copy_to_enclave(msgs[i].iov[j].iov_base, chunk, buf + copied, chunk)) {
+                    retval = -EPERM;
+                    goto out;
+                }
+                copied += chunk;
+            }
+            msgs[i].len = bytes;
+            buf += sizes[i];
         }
     }
 
@@ -1367,34 +2469,55 @@ out:
     return retval;
 }
 
-ssize_t ocall_send(int sockfd, const void* buf, size_t count, const struct sockaddr* addr,
-                   size_t addrlen, void* control, size_t controllen) {
+ssize_t ocall_recv(int sockfd, void* buf, size_t count, struct sockaddr* addr, size_t* addrlenptr,
+                   void* control, size_t* controllenptr) {
+    PAL_IOVEC iov = {.iov_base = buf, .iov_len = count};
+    return ocall_recvmsg(sockfd, &iov, 1, addr, addrlenptr, control, controllenptr);
+}
+
+ssize_t ocall_sendmsg(int sockfd, const PAL_IOVEC* iov, size_t iov_cnt,
+                      const struct sockaddr* addr, size_t addrlen, void* control,
+                      size_t controllen) {
     ssize_t retval = 0;
     void* obuf = NULL;
     bool is_obuf_mapped = false;
     ms_ocall_send_t* ms;
     bool need_munmap;
+    size_t count;
 
     void* old_ustack = sgx_prepare_ustack();
 
-    if (sgx_is_completely_outside_enclave(buf, count)) {
+    if (iov_cnt == 1 && sgx_is_completely_outside_enclave(iov[0].iov_base, iov[0].iov_len)) {
         /* buf is in untrusted memory (e.g., allowed file mmaped in untrusted memory) */
-        obuf = (void*)buf;
-    } else if (sgx_is_completely_within_enclave(buf, count)) {
-        /* typical case of buf inside of enclave memory */
+        obuf = iov[0].iov_base;
+        count = iov[0].iov_len;
+    } else {
+        /* typical case of buffers inside of enclave memory; they are gathered in one untrusted
+         * buffer, which costs no more than copying a single buffer out of the enclave */
+        ssize_t total = iov_total_size(iov, iov_cnt, /*check_in_enclave=*/true);
+        if (total < 0) {
+            /* some buffer is partially in/out of enclave memory, or the total size overflows */
+            retval = total;
+            goto out;
+        }
+        count = total;
+
         if ((count + addrlen + controllen) > MAX_UNTRUSTED_STACK_BUF) {
-            /* buf is too big and may overflow untrusted stack, so use untrusted heap */
+            /* buffers are too big and may overflow untrusted stack, so use untrusted heap */
             retval = ocall_mmap_untrusted_cache(ALLOC_ALIGN_UP(count), &obuf, &need_munmap);
             if (retval < 0)
                 goto out;
             is_obuf_mapped = true;
-            memcpy(obuf, buf, count);
         } else {
-            obuf = sgx_copy_to_ustack(buf, count);
+            obuf = sgx_alloc_on_ustack(count);
+        }
+        if (obuf) {
+            size_t copied = 0;
+            for (size_t i = 0; i < iov_cnt; i++) {
+                memcpy((char*)obuf + copied, iov[i].iov_base, iov[i].iov_len);
+                copied += iov[i].iov_len;
+            }
         }
-    } else {
-        /* buf is partially in/out of enclave memory */
-        obuf = NULL;
     }
     if (!obuf) {
         retval = -EPERM;
@@ -1443,6 +2566,72 @@ out:
     return retval;
 }
 
+ssize_t ocall_send(int sockfd, const void* buf, size_t count, const struct sockaddr* addr,
+                   size_t addrlen, void* control, size_t controllen) {
+    PAL_IOVEC iov = {.iov_base = (void*)buf, .iov_len = count};
+    return ocall_sendmsg(sockfd, &iov, 1, addr, addrlen, control, controllen);
+}
+
+int ocall_sock_ring_start(int sockfd, int bellfd, bool stream, uint64_t budget_us,
+                          struct sock_ring** out_ring) {
+    int retval = 0;
+    ms_ocall_sock_ring_start_t* ms;
+
+    void* old_ustack = sgx_prepare_ustack();
+    ms = sgx_alloc_on_ustack_aligned(sizeof(*ms), alignof(*ms));
+    if (!ms) {
+        sgx_reset_ustack(old_ustack);
+        return -EPERM;
+    }
+
+    WRITE_ONCE(ms->ms_sockfd, sockfd);
+    WRITE_ONCE(ms->ms_bellfd, bellfd);
+    WRITE_ONCE(ms->ms_stream, stream);
+    WRITE_ONCE(ms->ms_budget_us, budget_us);
+    WRITE_ONCE(ms->ms_ring, NULL);
+
+    retval = sgx_exitless_ocall(OCALL_SOCK_RING_START, ms);
+
+    if (retval < 0 && retval != -EAGAIN && retval != -EMFILE && retval != -ENFILE &&
+            retval != -ENOMEM) {
+        retval = -EPERM;
+    }
+
+    if (!retval) {
+        struct sock_ring* ring = READ_ONCE(ms->ms_ring);
+        if (!IS_ALIGNED_PTR(ring, alignof(*ring))
+                || !sgx_is_completely_outside_enclave(ring, sizeof(*ring))) {
+            retval = -EPERM;
+        } else {
+            *out_ring = ring;
+        }
+    }
+
+    sgx_reset_ustack(old_ustack);
+    return retval;
+}
+
+int ocall_sock_ring_stop(struct sock_ring* ring) {
+    int retval = 0;
+    ms_ocall_sock_ring_stop_t* ms;
+
+    void* old_ustack = sgx_prepare_ustack();
+    ms = sgx_alloc_on_ustack_aligned(sizeof(*ms), alignof(*ms));
+    if (!ms) {
+        sgx_reset_ustack(old_ustack);
+        return -EPERM;
+    }
+
+    WRITE_ONCE(ms->ms_ring, ring);
+
+    retval = sgx_exitless_ocall(OCALL_SOCK_RING_STOP, ms);
+    if (retval < 0)
+        retval = -EPERM;
+
+    sgx_reset_ustack(old_ustack);
+    return retval;
+}
+
 int ocall_setsockopt(int sockfd, int level, int optname, const void* optval, size_t optlen) {
     int retval = 0;
     ms_ocall_setsockopt_t* ms;
@@ -1510,6 +2699,38 @@ int ocall_shutdown(int sockfd, int how) {
     return retval;
 }
 
+ssize_t ocall_sendfile(int out_fd, int in_fd, off_t offset, size_t count) {
+    ssize_t retval = 0;
+    ms_ocall_sendfile_t* ms;
+
+    void* old_ustack = sgx_prepare_ustack();
+    ms = sgx_alloc_on_ustack_aligned(sizeof(*ms), alignof(*ms));
+    if (!ms) {
+        sgx_reset_ustack(old_ustack);
+        return -EPERM;
+    }
+
+    WRITE_ONCE(ms->ms_out_fd, out_fd);
+    WRITE_ONCE(ms->ms_in_fd, in_fd);
+    WRITE_ONCE(ms->ms_offset, offset);
+    WRITE_ONCE(ms->ms_count, count);
+
+    retval = sgx_exitless_ocall(OCALL_SENDFILE, ms);
+
+    if (retval >= 0) {
+        if ((size_t)retval > count)
+            retval = -EPERM;
+    } else if (retval != -EAGAIN && retval != -EWOULDBLOCK && retval != -EBADF &&
+               retval != -EINTR && retval != -EINVAL && retval != -EIO && retval != -EPIPE &&
+               retval != -ECONNRESET && retval != -ENOSPC && retval != -EOVERFLOW &&
+               retval != -ESPIPE) {
+        retval = -EPERM;
+    }
+
+    sgx_reset_ustack(old_ustack);
+    return retval;
+}
+
 int ocall_gettime(uint64_t* microsec_ptr) {
     int retval = 0;
     ms_ocall_gettime_t* ms;
@@ -1606,6 +2827,95 @@ out:
     return retval;
 }
 
+int ocall_epoll_create(void) {
+    void* old_ustack = sgx_prepare_ustack();
+
+    int retval = sgx_ocall(OCALL_EPOLL_CREATE, NULL);
+    if (retval < 0 && retval != -EMFILE && retval != -ENFILE && retval != -ENOMEM) {
+        retval = -EPERM;
+    }
+
+    sgx_reset_ustack(old_ustack);
+    return retval;
+}
+
+int ocall_epoll_ctl(int epfd, int op, int fd, uint32_t events, uint64_t data) {
+    int retval = 0;
+    ms_ocall_epoll_ctl_t* ms;
+
+    void* old_ustack = sgx_prepare_ustack();
+    ms = sgx_alloc_on_ustack_aligned(sizeof(*ms), alignof(*ms));
+    if (!ms) {
+        sgx_reset_ustack(old_ustack);
+        return -EPERM;
+    }
+
+    WRITE_ONCE(ms->ms_epfd, epfd);
+    WRITE_ONCE(ms->ms_op, op);
+    WRITE_ONCE(ms->ms_fd, fd);
+    WRITE_ONCE(ms->ms_events, events);
+    WRITE_ONCE(ms->ms_data, data);
+
+    retval = sgx_exitless_ocall(OCALL_EPOLL_CTL, ms);
+
+    if (retval < 0 && retval != -EBADF && retval != -EEXIST && retval != -EINVAL &&
+            retval != -ENOENT && retval != -ENOMEM && retval != -ENOSPC && retval != -EPERM) {
+        retval = -EPERM;
+    }
+
+    sgx_reset_ustack(old_ustack);
+    return retval;
+}
+
+int ocall_epoll_wait(int epfd, struct epoll_event* events, size_t maxevents, int64_t timeout_us) {
+    int retval = 0;
+    size_t events_bytes = maxevents * sizeof(*events);
+    ms_ocall_epoll_wait_t* ms;
+
+    if (maxevents > INT_MAX)
+        return -EINVAL;
+
+    void* old_ustack = sgx_prepare_ustack();
+    ms = sgx_alloc_on_ustack_aligned(sizeof(*ms), alignof(*ms));
+    if (!ms) {
+        retval = -EPERM;
+        goto out;
+    }
+
+    void* untrusted_events = sgx_alloc_on_ustack_aligned(events_bytes, alignof(*events));
+    if (!untrusted_events) {
+        retval = -EPERM;
+        goto out;
+    }
+
+    WRITE_ONCE(ms->ms_epfd, epfd);
+    WRITE_ONCE(ms->ms_events, untrusted_events);
+    WRITE_ONCE(ms->ms_maxevents, maxevents);
+    WRITE_ONCE(ms->ms_timeout_us, timeout_us);
+
+    retval = sgx_exitless_ocall(OCALL_EPOLL_WAIT, ms);
+
+    if (retval < 0 && retval != -EINTR && retval != -EINVAL && retval != -EBADF) {
+        retval = -EPERM;
+    }
+
+    if (retval > 0) {
+        if ((size_t)retval > maxevents) {
+            retval = -EPERM;
+            goto out;
+        }
+        size_t ret_bytes = retval * sizeof(*events);
+        if (!sgx_copy_to_enclave(events, ret_bytes, untrusted_events, ret_bytes)) {
+            retval = -EPERM;
+            goto out;
+        }
+    }
+
+out:
+    sgx_reset_ustack(old_ustack);
+    return retval;
+}
+
 int ocall_rename(const char* oldpath, const char* newpath) {
     int retval = 0;
     size_t old_size = oldpath ? strlen(oldpath) + 1 : 0;
@@ -1685,6 +2995,14 @@ int ocall_debug_map_add(const char* name, void* addr) {
     size_t size = strlen(name) + 1;
     ms_ocall_debug_map_add_t* ms;
 
+    struct async_ocall* async = size <= URI_MAX ? async_ocall_prepare(OCALL_DEBUG_MAP_ADD) : NULL;
+    if (async) {
+        memcpy(async->name, name, size);
+        WRITE_ONCE(async->ms.debug_map_add.ms_name, async->name);
+        WRITE_ONCE(async->ms.debug_map_add.ms_addr, addr);
+        return async_ocall_submit(async, OCALL_DEBUG_MAP_ADD);
+    }
+
     void* old_ustack = sgx_prepare_ustack();
     ms = sgx_alloc_on_ustack_aligned(sizeof(*ms), alignof(*ms));
     if (!ms) {
@@ -1720,6 +3038,12 @@ int ocall_debug_map_remove(void* addr) {
 #ifdef DEBUG
     ms_ocall_debug_map_remove_t* ms;
 
+    struct async_ocall* async = async_ocall_prepare(OCALL_DEBUG_MAP_REMOVE);
+    if (async) {
+        WRITE_ONCE(async->ms.debug_map_remove.ms_addr, addr);
+        return async_ocall_submit(async, OCALL_DEBUG_MAP_REMOVE);
+    }
+
     void* old_ustack = sgx_prepare_ustack();
     ms = sgx_alloc_on_ustack_aligned(sizeof(*ms), alignof(*ms));
     if (!ms) {
@@ -1741,6 +3065,34 @@ int ocall_debug_map_remove(void* addr) {
     return retval;
 }
 
+int ocall_startup_trace(const char* phase) {
+    int retval = 0;
+    size_t size = strlen(phase) + 1;
+    ms_ocall_startup_trace_t* ms;
+
+    void* old_ustack = sgx_prepare_ustack();
+    ms = sgx_alloc_on_ustack_aligned(sizeof(*ms), alignof(*ms));
+    if (!ms) {
+        sgx_reset_ustack(old_ustack);
+        return -EPERM;
+    }
+
+    void* untrusted_phase = sgx_copy_to_ustack(phase, size);
+    if (!untrusted_phase) {
+        sgx_reset_ustack(old_ustack);
+        return -EPERM;
+    }
+
+    WRITE_ONCE(ms->ms_phase, untrusted_phase);
+
+    do {
+        retval = sgx_exitless_ocall(OCALL_STARTUP_TRACE, ms);
+    } while (retval == -EINTR);
+
+    sgx_reset_ustack(old_ustack);
+    return retval;
+}
+
 int ocall_eventfd(unsigned int initval, int flags) {
     int retval = 0;
     ms_ocall_eventfd_t* ms;
@@ -1934,3 +3286,85 @@ int ocall_sched_getaffinity(void* tcs, size_t cpumask_size, void* cpu_mask) {
     sgx_reset_ustack(old_ustack);
     return retval;
 }
+
+int ocall_edmm_restrict_pages_perm(uint64_t addr, size_t size, uint64_t prot) {
+    int retval = 0;
+    ms_ocall_edmm_restrict_pages_perm_t* ms;
+
+    void* old_ustack = sgx_prepare_ustack();
+    ms = sgx_alloc_on_ustack_aligned(sizeof(*ms), alignof(*ms));
+    if (!ms) {
+        sgx_reset_ustack(old_ustack);
+        return -EPERM;
+    }
+
+    WRITE_ONCE(ms->ms_addr, addr);
+    WRITE_ONCE(ms->ms_size, size);
+    WRITE_ONCE(ms->ms_prot, prot);
+
+    do {
+        retval = sgx_exitless_ocall(OCALL_EDMM_RESTRICT_PAGES_PERM, ms);
+    } while (retval == -EINTR);
+
+    /* the result is not trusted anyway: the enclave verifies the change with EACCEPT */
+    if (retval < 0 && retval != -EINVAL && retval != -ENOSYS && retval != -EFAULT) {
+        retval = -EPERM;
+    }
+
+    sgx_reset_ustack(old_ustack);
+    return retval;
+}
+
+int ocall_edmm_modify_pages_type(uint64_t addr, size_t size, uint64_t type) {
+    int retval = 0;
+    ms_ocall_edmm_modify_pages_type_t* ms;
+
+    void* old_ustack = sgx_prepare_ustack();
+    ms = sgx_alloc_on_ustack_aligned(sizeof(*ms), alignof(*ms));
+    if (!ms) {
+        sgx_reset_ustack(old_ustack);
+        return -EPERM;
+    }
+
+    WRITE_ONCE(ms->ms_addr, addr);
+    WRITE_ONCE(ms->ms_size, size);
+    WRITE_ONCE(ms->ms_type, type);
+
+    do {
+        retval = sgx_exitless_ocall(OCALL_EDMM_MODIFY_PAGES_TYPE, ms);
+    } while (retval == -EINTR);
+
+    /* the result is not trusted anyway: the enclave verifies the change with EACCEPT */
+    if (retval < 0 && retval != -EINVAL && retval != -ENOSYS && retval != -EFAULT) {
+        retval = -EPERM;
+    }
+
+    sgx_reset_ustack(old_ustack);
+    return retval;
+}
+
+int ocall_edmm_remove_pages(uint64_t addr, size_t size) {
+    int retval = 0;
+    ms_ocall_edmm_remove_pages_t* ms;
+
+    void* old_ustack = sgx_prepare_ustack();
+    ms = sgx_alloc_on_ustack_aligned(sizeof(*ms), alignof(*ms));
+    if (!ms) {
+        sgx_reset_ustack(old_ustack);
+        return -EPERM;
+    }
+
+    WRITE_ONCE(ms->ms_addr, addr);
+    WRITE_ONCE(ms->ms_size, size);
+
+    do {
+        retval = sgx_exitless_ocall(OCALL_EDMM_REMOVE_PAGES, ms);
+    } while (retval == -EINTR);
+
+    if (retval < 0 && retval != -EINVAL && retval != -ENOSYS && retval != -EFAULT) {
+        retval = -EPERM;
+    }
+
+    sgx_reset_ustack(old_ustack);
+    return retval;
+}
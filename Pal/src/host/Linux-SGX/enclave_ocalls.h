@@ -2,14 +2,21 @@
  * This is for enclave to make ocalls to untrusted runtime.
  */
 
+#ifndef ENCLAVE_OCALLS_H_
+#define ENCLAVE_OCALLS_H_
+
 #include <asm/stat.h>
 #include <linux/poll.h>
 #include <linux/socket.h>
 
 #include "linux_types.h"
+#include "pal.h"
 #include "pal_linux.h"
 #include "sgx_attest.h"
 
+int init_rpc_policy(void);
+int init_untrusted_io_pool(void);
+
 noreturn void ocall_exit(int exitcode, int is_exitgroup);
 
 int ocall_mmap_untrusted(void** addrptr, size_t size, int prot, int flags, int fd, off_t offset);
@@ -30,8 +37,40 @@ ssize_t ocall_pread(int fd, void* buf, size_t count, off_t offset);
 
 ssize_t ocall_pwrite(int fd, const void* buf, size_t count, off_t offset);
 
+/* Batched I/O OCALLs: up to OCALL_IO_BATCH_MAX independent read/write/pread/pwrite operations
+ * are marshalled together and executed by the untrusted runtime in order, in a single enclave exit
+ * (or a single RPC-queue round trip with Exitless). Execution stops at the first failed operation
+ * or short write; the operations after it are not executed. All buffers must be in enclave
+ * memory. */
+#define OCALL_IO_BATCH_MAX 64
+
+enum ocall_io_op {
+    OCALL_IO_READ,
+    OCALL_IO_WRITE,
+    OCALL_IO_PREAD,
+    OCALL_IO_PWRITE,
+};
+
+struct ocall_io_req {
+    enum ocall_io_op op;
+    int fd;
+    void* buf;      /* source for writes, destination for reads */
+    size_t count;
+    off_t offset;   /* used only by OCALL_IO_PREAD and OCALL_IO_PWRITE */
+    ssize_t result; /* filled on completion, same semantics as returned by ocall_read() etc. */
+};
+
+/* Returns 0 if the batch was executed (per-request results are in `reqs[i].result`), or a negative
+ * error if the batch could not be submitted at all. */
+int ocall_io_batch(struct ocall_io_req* reqs, size_t count);
+
 int ocall_fstat(int fd, struct stat* buf);
 
+int ocall_stat(const char* pathname, struct stat* buf);
+
+/* Opens `pathname` and stats the new fd with a single OCALL; returns the fd or a negative errno */
+int ocall_open_stat(const char* pathname, int flags, unsigned short mode, struct stat* buf);
+
 int ocall_fionread(int fd);
 
 int ocall_fsetnonblock(int fd, int nonblocking);
@@ -46,15 +85,45 @@ int ocall_mkdir(const char* pathname, unsigned short mode);
 
 int ocall_getdents(int fd, struct linux_dirent64* dirp, size_t size);
 
+/* Like ocall_getdents(), but also stats each returned entry (relative to `fd`, following symlinks)
+ * in the same OCALL. `*stats_cnt` is the capacity of `stats` on input and the number of filled
+ * records on output; `stats[i]` belongs to the i-th dirent and has `st_mode == 0` if the entry
+ * could not be stat'ed. */
+int ocall_getdents_stat(int fd, struct linux_dirent64* dirp, size_t size, struct stat* stats,
+                        size_t* stats_cnt);
+
 int ocall_listen(int domain, int type, int protocol, int ipv6_v6only, struct sockaddr* addr,
                  size_t* addrlen, struct sockopt* sockopt);
 
 int ocall_accept(int sockfd, struct sockaddr* addr, size_t* addrlen, struct sockopt* opt);
 
+struct ocall_accepted_conn;
+int ocall_accept_batch(int sockfd, struct ocall_accepted_conn* conns, unsigned int max);
+
 int ocall_connect(int domain, int type, int protocol, int ipv6_v6only, const struct sockaddr* addr,
                   size_t addrlen, struct sockaddr* bind_addr, size_t* bind_addrlen,
                   struct sockopt* sockopt);
 
+ssize_t ocall_recvmsg(int sockfd, PAL_IOVEC* iov, size_t iov_cnt, struct sockaddr* addr,
+                      size_t* addrlenptr, void* control, size_t* controllenptr);
+
+ssize_t ocall_sendmsg(int sockfd, const PAL_IOVEC* iov, size_t iov_cnt,
+                      const struct sockaddr* addr, size_t addrlen, void* control,
+                      size_t controllen);
+
+ssize_t ocall_sendmmsg(int sockfd, PAL_MSG* msgs, size_t msg_cnt);
+
+ssize_t ocall_recvmmsg(int sockfd, PAL_MSG* msgs, size_t msg_cnt);
+
+struct sock_ring;
+/* Starts an untrusted proxy thread that moves data between `sockfd` and shared rx/tx rings (see
+ * `struct sock_ring`), spinning for `budget_us` after the last transfer before it sleeps. */
+int ocall_sock_ring_start(int sockfd, int bellfd, bool stream, uint64_t budget_us,
+                          struct sock_ring** out_ring);
+
+/* Stops the proxy of `ring` once it has flushed tx, and frees the ring. */
+int ocall_sock_ring_stop(struct sock_ring* ring);
+
 ssize_t ocall_recv(int sockfd, void* buf, size_t count, struct sockaddr* addr, size_t* addrlenptr,
                    void* control, size_t* controllenptr);
 
@@ -65,13 +134,17 @@ int ocall_setsockopt(int sockfd, int level, int optname, const void* optval, siz
 
 int ocall_shutdown(int sockfd, int how);
 
+/* Copies up to `count` bytes of `in_fd` starting at `offset` into `out_fd` entirely on the host;
+ * the data never enters the enclave. `in_fd` must be a regular (seekable) host file. */
+ssize_t ocall_sendfile(int out_fd, int in_fd, off_t offset, size_t count);
+
 int ocall_resume_thread(void* tcs);
 
 int ocall_sched_setaffinity(void* tcs, size_t cpumask_size, void* cpu_mask);
 
 int ocall_sched_getaffinity(void* tcs, size_t cpumask_size, void* cpu_mask);
 
-int ocall_clone_thread(void);
+int ocall_clone_thread(void* tcs);
 
 int ocall_create_process(size_t nargs, const char** args, int* stream_fd);
 
@@ -85,6 +158,12 @@ int ocall_socketpair(int domain, int type, int protocol, int sockfds[2]);
 
 int ocall_poll(struct pollfd* fds, size_t nfds, int64_t timeout_us);
 
+int ocall_epoll_create(void);
+
+int ocall_epoll_ctl(int epfd, int op, int fd, uint32_t events, uint64_t data);
+
+int ocall_epoll_wait(int epfd, struct epoll_event* events, size_t maxevents, int64_t timeout_us);
+
 int ocall_rename(const char* oldpath, const char* newpath);
 
 int ocall_delete(const char* pathname);
@@ -93,8 +172,16 @@ int ocall_debug_map_add(const char* name, void* addr);
 
 int ocall_debug_map_remove(void* addr);
 
+int ocall_startup_trace(const char* phase);
+
 int ocall_eventfd(unsigned int initval, int flags);
 
+/* EDMM (SGX2) OCALLs: the untrusted runtime asks the SGX driver to execute EMODPR/EMODT/page
+ * removal on [addr, addr + size); the enclave must EACCEPT the changes (except page removal) */
+int ocall_edmm_restrict_pages_perm(uint64_t addr, size_t size, uint64_t prot);
+int ocall_edmm_modify_pages_type(uint64_t addr, size_t size, uint64_t type);
+int ocall_edmm_remove_pages(uint64_t addr, size_t size);
+
 /*!
  * \brief Execute untrusted code in PAL to obtain a quote from the Quoting Enclave.
  *
@@ -113,3 +200,5 @@ int ocall_eventfd(unsigned int initval, int flags);
  */
 int ocall_get_quote(const sgx_spid_t* spid, bool linkable, const sgx_report_t* report,
                     const sgx_quote_nonce_t* nonce, char** quote, size_t* quote_len);
+
+#endif /* ENCLAVE_OCALLS_H_ */
@@ -1,7 +1,9 @@
 #include "enclave_pages.h"
 
 #include "api.h"
-#include "list.h"
+#include "avl_tree.h"
+#include "enclave_edmm.h"
+#include "enclave_lazy_map.h"
 #include "pal_error.h"
 #include "pal_internal.h"
 #include "pal_linux.h"
@@ -9,111 +11,292 @@
 #include "spinlock.h"
 
 struct atomic_int g_allocated_pages;
+/* highest value of `g_allocated_pages` so far, protected by `g_heap_vma_lock` */
+static size_t g_peak_allocated_pages;
 
 static void* g_heap_bottom;
 static void* g_heap_top;
 
 static size_t g_pal_internal_mem_used = 0;
 
-/* list of VMAs of used memory areas kept in DESCENDING order; note that preallocated PAL internal
- * memory relies on this descending order of allocations (from high addresses to low), see
- * _DkGetAvailableUserAddressRange() for more details */
-DEFINE_LIST(heap_vma);
+/* with EDMM, heap pages are committed (EACCEPTed) on allocation and trimmed on deallocation; a
+ * heap page is committed if and only if it is covered by some VMA from the tree below */
+bool g_edmm_enabled = false;
+
+/* Without EDMM, the whole heap is EADDed as zero pages when the enclave is created; pages in
+ * [g_pristine_bottom, g_pristine_top) have never been handed out since then, so they still contain
+ * only zeros. Anonymous allocations are served top-down, so this range usually shrinks from above.
+ * With EDMM it is not needed: pages not covered by any VMA are not committed, and newly committed
+ * pages are zeroed by the CPU. Protected by `g_heap_vma_lock`. */
+static void* g_pristine_bottom;
+static void* g_pristine_top;
+
+/* ranges of at least this size are zeroed with non-temporal stores, so that zeroing a huge mapping
+ * does not evict the whole cache (and the EPC pages being zeroed are not read in first) */
+#define ZERO_NONTEMPORAL_MIN_SIZE (256 * 1024)
+
+/* VMAs of used memory areas, sorted by address; VMAs never overlap and adjacent VMAs of the same
+ * type are always merged. Anonymous allocations are served from high addresses to low; note that
+ * preallocated PAL internal memory relies on this (see _DkGetAvailableUserAddressRange()). */
 struct heap_vma {
-    LIST_TYPE(heap_vma) list;
+    union {
+        /* if this `heap_vma` is used, it is included in `g_heap_vma_tree` using this node */
+        struct avl_tree_node tree_node;
+        /* otherwise it is in the list of free `heap_vma` objects */
+        struct heap_vma* next_free;
+    };
     void* bottom;
     void* top;
     bool is_pal_internal;
 };
-DEFINE_LISTP(heap_vma);
 
-static LISTP_TYPE(heap_vma) g_heap_vma_list = LISTP_INIT;
+static bool vma_tree_cmp(struct avl_tree_node* node_a, struct avl_tree_node* node_b) {
+    struct heap_vma* a = container_of(node_a, struct heap_vma, tree_node);
+    struct heap_vma* b = container_of(node_b, struct heap_vma, tree_node);
+
+    return a->top <= b->top;
+}
+
+/* Returns whether `addr` is below the end of a vma (`node`). */
+static inline bool cmp_addr_to_vma(void* addr, struct avl_tree_node* node) {
+    struct heap_vma* vma = container_of(node, struct heap_vma, tree_node);
+
+    return addr < vma->top;
+}
+
+/* Returns whether `addr` is below or at the end of a vma (`node`). */
+static inline bool cmp_addr_to_vma_inclusive(void* addr, struct avl_tree_node* node) {
+    struct heap_vma* vma = container_of(node, struct heap_vma, tree_node);
+
+    return addr <= vma->top;
+}
+
+DEFINE_AVL_TREE_LOWER_BOUND_FN(heap_vma_lower_bound, void*, cmp_addr_to_vma)
+DEFINE_AVL_TREE_LOWER_BOUND_FN(heap_vma_lower_bound_inclusive, void*, cmp_addr_to_vma_inclusive)
+
+static struct avl_tree g_heap_vma_tree = {.cmp = vma_tree_cmp};
 static spinlock_t g_heap_vma_lock = INIT_SPINLOCK_UNLOCKED;
 
-/* heap_vma objects are taken from pre-allocated pool to avoid recursive mallocs */
-#define MAX_HEAP_VMAS 100000
-static struct heap_vma g_heap_vma_pool[MAX_HEAP_VMAS];
-static size_t g_heap_vma_num = 0;
-static struct heap_vma* g_free_vma = NULL;
+static struct heap_vma* node2vma(struct avl_tree_node* node) {
+    if (!node) {
+        return NULL;
+    }
+    return container_of(node, struct heap_vma, tree_node);
+}
 
-/* returns uninitialized heap_vma, the caller is responsible for setting at least bottom/top */
-static struct heap_vma* __alloc_vma(void) {
+static struct heap_vma* __next_vma(struct heap_vma* vma) {
     assert(spinlock_is_locked(&g_heap_vma_lock));
+    return node2vma(avl_tree_next(&vma->tree_node));
+}
 
-    if (g_free_vma) {
-        /* simple optimization: if there is a cached free vma object, use it */
-        assert((uintptr_t)g_free_vma >= (uintptr_t)&g_heap_vma_pool[0]);
-        assert((uintptr_t)g_free_vma <= (uintptr_t)&g_heap_vma_pool[MAX_HEAP_VMAS - 1]);
+static struct heap_vma* __prev_vma(struct heap_vma* vma) {
+    assert(spinlock_is_locked(&g_heap_vma_lock));
+    return node2vma(avl_tree_prev(&vma->tree_node));
+}
 
-        struct heap_vma* ret = g_free_vma;
-        g_free_vma = NULL;
-        g_heap_vma_num++;
-        return ret;
-    }
+static struct heap_vma* __last_vma(void) {
+    assert(spinlock_is_locked(&g_heap_vma_lock));
+    return node2vma(avl_tree_last(&g_heap_vma_tree));
+}
 
-    /* FIXME: this loop may become perf bottleneck on large number of vma objects; however,
-     * experiments show that this number typically does not exceed 20 (thanks to VMA merging) */
-    for (size_t i = 0; i < MAX_HEAP_VMAS; i++) {
-        if (!g_heap_vma_pool[i].bottom && !g_heap_vma_pool[i].top) {
-            /* found empty slot in the pool, use it */
-            g_heap_vma_num++;
-            return &g_heap_vma_pool[i];
-        }
-    }
+/* Returns the VMA that contains `addr`. If there is no such VMA, returns the closest VMA with
+ * higher address. */
+static struct heap_vma* __lookup_vma(void* addr) {
+    assert(spinlock_is_locked(&g_heap_vma_lock));
+    return node2vma(heap_vma_lower_bound(&g_heap_vma_tree, addr));
+}
 
-    return NULL;
+/* Same as __lookup_vma(), but also returns the VMA ending exactly at `addr` (if any). */
+static struct heap_vma* __lookup_vma_inclusive(void* addr) {
+    assert(spinlock_is_locked(&g_heap_vma_lock));
+    return node2vma(heap_vma_lower_bound_inclusive(&g_heap_vma_tree, addr));
 }
 
-static void __free_vma(struct heap_vma* vma) {
+/* heap_vma objects are allocated with malloc() in batches and never returned to it. malloc() may
+ * itself need new enclave pages (and thus a new VMA), so a static reserve is kept for the VMAs
+ * created while the free list is being refilled. */
+#define HEAP_VMA_RESERVE      64
+#define HEAP_VMA_REFILL_BATCH 64
+static struct heap_vma g_heap_vma_reserve[HEAP_VMA_RESERVE];
+static struct heap_vma* g_free_vmas = NULL;
+static size_t g_free_vmas_cnt = 0;
+static bool g_free_vmas_refilling = false;
+
+static void __push_free_vma(struct heap_vma* vma) {
+    assert(spinlock_is_locked(&g_heap_vma_lock));
+    vma->next_free = g_free_vmas;
+    g_free_vmas = vma;
+    g_free_vmas_cnt++;
+}
+
+/* returns uninitialized heap_vma, the caller is responsible for setting at least bottom/top */
+static struct heap_vma* __alloc_vma(void) {
     assert(spinlock_is_locked(&g_heap_vma_lock));
-    assert((uintptr_t)vma >= (uintptr_t)&g_heap_vma_pool[0]);
-    assert((uintptr_t)vma <= (uintptr_t)&g_heap_vma_pool[MAX_HEAP_VMAS - 1]);
 
-    g_free_vma  = vma;
+    struct heap_vma* vma = g_free_vmas;
+    if (vma) {
+        g_free_vmas = vma->next_free;
+        g_free_vmas_cnt--;
+    }
+    return vma;
+}
+
+static void __free_vma(struct heap_vma* vma) {
+    assert(spinlock_is_locked(&g_heap_vma_lock));
     vma->top    = 0;
     vma->bottom = 0;
-    g_heap_vma_num--;
+    __push_free_vma(vma);
+}
+
+/* makes sure that there are enough free heap_vma objects for the next operations; must be called
+ * without holding `g_heap_vma_lock` */
+static void refill_free_vmas(void) {
+    if (__atomic_load_n(&g_free_vmas_cnt, __ATOMIC_RELAXED) >= HEAP_VMA_RESERVE / 2)
+        return;
+
+    /* if some thread (possibly this one, recursively from malloc()) is already refilling, just
+     * use the reserve */
+    if (__atomic_exchange_n(&g_free_vmas_refilling, true, __ATOMIC_ACQUIRE))
+        return;
+
+    struct heap_vma* vmas = malloc(sizeof(*vmas) * HEAP_VMA_REFILL_BATCH);
+    if (vmas) {
+        spinlock_lock(&g_heap_vma_lock);
+        for (size_t i = 0; i < HEAP_VMA_REFILL_BATCH; i++)
+            __push_free_vma(&vmas[i]);
+        spinlock_unlock(&g_heap_vma_lock);
+    }
+
+    __atomic_store_n(&g_free_vmas_refilling, false, __ATOMIC_RELEASE);
 }
 
 int init_enclave_pages(void) {
     g_heap_bottom = g_pal_sec.heap_min;
     g_heap_top    = g_pal_sec.heap_max;
+    g_pristine_bottom = g_heap_bottom;
+    g_pristine_top    = g_heap_top;
+    /* this TLS field is part of the enclave measurement, so it can be trusted before the manifest
+     * is parsed (and first allocations happen before that) */
+    g_edmm_enabled = !!GET_ENCLAVE_TLS(edmm_enabled);
+
+    spinlock_lock(&g_heap_vma_lock);
+    for (size_t i = 0; i < HEAP_VMA_RESERVE; i++)
+        __push_free_vma(&g_heap_vma_reserve[i]);
+    spinlock_unlock(&g_heap_vma_lock);
     return 0;
 }
 
-static void* __create_vma_and_merge(void* addr, size_t size, bool is_pal_internal,
-                                    struct heap_vma* vma_above) {
+/* commits pages in [addr, addr + size) that are not covered by any VMA yet (these are exactly the
+ * ones which are not committed yet) */
+static void __edmm_commit_uncovered_pages(void* addr, size_t size) {
     assert(spinlock_is_locked(&g_heap_vma_lock));
-    assert(addr && size);
 
-    if (addr < g_heap_bottom)
-        return NULL;
+    /* walk the range from bottom to top, committing gaps between VMAs */
+    void* gap_bottom = addr;
+    for (struct heap_vma* vma = __lookup_vma(addr); vma && vma->bottom < addr + size;
+            vma = __next_vma(vma)) {
+        if (vma->bottom > gap_bottom) {
+            if (sgx_edmm_add_pages((uint64_t)gap_bottom, (vma->bottom - gap_bottom) / g_page_size,
+                                   SGX_SECINFO_FLAGS_RWX) < 0)
+                goto fail;
+        }
+        gap_bottom = vma->top;
+    }
 
-    /* find enclosing VMAs and check that pal-internal VMAs do not overlap with normal VMAs */
-    struct heap_vma* vma_below;
-    if (vma_above) {
-        vma_below = LISTP_NEXT_ENTRY(vma_above, &g_heap_vma_list, list);
-    } else {
-        /* no VMA above `addr`; VMA right below `addr` must be the first (highest-address) in list */
-        vma_below = LISTP_FIRST_ENTRY(&g_heap_vma_list, struct heap_vma, list);
+    if (gap_bottom < addr + size) {
+        if (sgx_edmm_add_pages((uint64_t)gap_bottom, (addr + size - gap_bottom) / g_page_size,
+                               SGX_SECINFO_FLAGS_RWX) < 0)
+            goto fail;
     }
+    return;
 
-    /* check whether [addr, addr + size) overlaps with above VMAs of different type */
-    struct heap_vma* check_vma_above = vma_above;
-    while (check_vma_above && addr + size > check_vma_above->bottom) {
-        if (check_vma_above->is_pal_internal != is_pal_internal) {
-            return NULL;
-        }
-        check_vma_above = LISTP_PREV_ENTRY(check_vma_above, &g_heap_vma_list, list);
+fail:
+    /* the host refused to give us memory or tampered with it; we cannot keep the page invariant */
+    log_error("Cannot commit enclave pages in range %p - %p", addr, addr + size);
+    ocall_exit(/*exitcode=*/1, /*is_exitgroup=*/true);
+}
+
+/* finds the highest part of [bottom, top) covered by VMAs; returns false if there is none */
+static bool find_highest_covered_range(void* bottom, void* top, void** out_bottom,
+                                       void** out_top) {
+    bool found = false;
+
+    if (bottom >= top)
+        return false;
+
+    spinlock_lock(&g_heap_vma_lock);
+    /* the lowest VMA ending at or above `top`; if it does not reach below `top`, the VMA right
+     * before it is the highest one that can overlap the range */
+    struct heap_vma* vma = __lookup_vma_inclusive(top);
+    if (!vma) {
+        vma = __last_vma();
+    } else if (vma->bottom >= top) {
+        vma = __prev_vma(vma);
+    }
+
+    if (vma && vma->top > bottom) {
+        *out_top    = MIN(vma->top, top);
+        *out_bottom = MAX(vma->bottom, bottom);
+        found = true;
+    }
+    spinlock_unlock(&g_heap_vma_lock);
+
+    return found;
+}
+
+/* Finds the part of [addr, addr + size) (about to be allocated) which is known to contain only
+ * zeros and returns it in `out_zero_bottom` and `out_zero_top` (empty if there is none). The pages
+ * of the range stop being pristine. */
+static void __claim_zeroed_range(void* addr, size_t size, void** out_zero_bottom,
+                                 void** out_zero_top) {
+    assert(spinlock_is_locked(&g_heap_vma_lock));
+    void* top = addr + size;
+
+    *out_zero_bottom = addr;
+    *out_zero_top    = addr;
+
+    if (g_edmm_enabled) {
+        /* uncovered pages are committed only now; to keep things simple, only a range without any
+         * VMA in it is reported (overlaps happen only with fixed-address allocations) */
+        struct heap_vma* vma = __lookup_vma(addr);
+        if (!vma || vma->bottom >= top)
+            *out_zero_top = top;
+        return;
     }
 
-    /* check whether [addr, addr + size) overlaps with below VMAs of different type */
-    struct heap_vma* check_vma_below = vma_below;
-    while (check_vma_below && addr < check_vma_below->top) {
-        if (check_vma_below->is_pal_internal != is_pal_internal) {
+    if (addr >= g_pristine_top || top <= g_pristine_bottom)
+        return;
+
+    *out_zero_bottom = MAX(addr, g_pristine_bottom);
+    *out_zero_top    = MIN(top, g_pristine_top);
+
+    /* keep the larger of the pristine parts below and above the range */
+    if (*out_zero_bottom - g_pristine_bottom >= g_pristine_top - *out_zero_top) {
+        g_pristine_top = *out_zero_bottom;
+    } else {
+        g_pristine_bottom = *out_zero_top;
+    }
+}
+
+/* if `commit` is false, the pages of the new VMA are left uncommitted (they are populated lazily,
+ * see enclave_lazy_map.c); such a VMA must not overlap any existing VMA */
+static void* __create_vma_and_merge(void* addr, size_t size, bool is_pal_internal, bool commit,
+                                    void** out_zero_bottom, void** out_zero_top) {
+    assert(spinlock_is_locked(&g_heap_vma_lock));
+    assert(addr && size);
+
+    if (addr < g_heap_bottom)
+        return NULL;
+
+    /* the lowest VMA overlapping with or adjacent to [addr, addr + size) */
+    struct heap_vma* first_vma = __lookup_vma_inclusive(addr);
+
+    /* check whether [addr, addr + size) overlaps with VMAs of different type */
+    for (struct heap_vma* vma = first_vma; vma && vma->bottom < addr + size;
+            vma = __next_vma(vma)) {
+        if (vma->top > addr && (vma->is_pal_internal != is_pal_internal || !commit)) {
             return NULL;
         }
-        check_vma_below = LISTP_NEXT_ENTRY(check_vma_below, &g_heap_vma_list, list);
     }
 
     /* create VMA with [addr, addr+size); in case of existing overlapping VMAs, the created VMA is
@@ -125,43 +308,32 @@ static void* __create_vma_and_merge(void* addr, size_t size, bool is_pal_interna
     vma->top             = addr + size;
     vma->is_pal_internal = is_pal_internal;
 
+    __claim_zeroed_range(addr, size, out_zero_bottom, out_zero_top);
+
+    if (g_edmm_enabled && commit)
+        __edmm_commit_uncovered_pages(addr, size);
+
     /* how much memory was freed because [addr, addr + size) overlapped with VMAs */
     size_t freed = 0;
 
-    /* Try to merge VMAs as an optimization:
-     *   (1) start from `vma_above` and iterate through VMAs with higher-addresses for merges
-     *   (2) start from `vma_below` and iterate through VMAs with lower-addresses for merges.
-     * Note that we never merge normal VMAs with pal-internal VMAs. */
-    while (vma_above && vma_above->bottom <= vma->top &&
-           vma_above->is_pal_internal == vma->is_pal_internal) {
-        /* newly created VMA grows into above VMA; expand newly created VMA and free above-VMA */
-        freed += vma_above->top - vma_above->bottom;
-        struct heap_vma* vma_above_above = LISTP_PREV_ENTRY(vma_above, &g_heap_vma_list, list);
-
-        vma->bottom = MIN(vma_above->bottom, vma->bottom);
-        vma->top    = MAX(vma_above->top, vma->top);
-        LISTP_DEL(vma_above, &g_heap_vma_list, list);
-
-        __free_vma(vma_above);
-        vma_above = vma_above_above;
-    }
-
-    while (vma_below && vma_below->top >= vma->bottom &&
-           vma_below->is_pal_internal == vma->is_pal_internal) {
-        /* newly created VMA grows into below VMA; expand newly create VMA and free below-VMA */
-        freed += vma_below->top - vma_below->bottom;
-        struct heap_vma* vma_below_below = LISTP_NEXT_ENTRY(vma_below, &g_heap_vma_list, list);
+    /* Merge the new VMA with all overlapping VMAs and with adjacent VMAs of the same type (as an
+     * optimization). Note that we never merge normal VMAs with pal-internal VMAs. */
+    struct heap_vma* merge_vma = first_vma;
+    while (merge_vma && merge_vma->bottom <= vma->top) {
+        struct heap_vma* next_vma = __next_vma(merge_vma);
+        if (merge_vma->is_pal_internal == vma->is_pal_internal) {
+            freed += merge_vma->top - merge_vma->bottom;
 
-        vma->bottom = MIN(vma_below->bottom, vma->bottom);
-        vma->top    = MAX(vma_below->top, vma->top);
-        LISTP_DEL(vma_below, &g_heap_vma_list, list);
+            vma->bottom = MIN(merge_vma->bottom, vma->bottom);
+            vma->top    = MAX(merge_vma->top, vma->top);
+            avl_tree_delete(&g_heap_vma_tree, &merge_vma->tree_node);
 
-        __free_vma(vma_below);
-        vma_below = vma_below_below;
+            __free_vma(merge_vma);
+        }
+        merge_vma = next_vma;
     }
 
-    INIT_LIST_HEAD(vma, list);
-    LISTP_ADD_AFTER(vma, vma_above, &g_heap_vma_list, list);
+    avl_tree_insert(&g_heap_vma_tree, &vma->tree_node);
 
     if (vma->bottom >= vma->top) {
         log_error("Bad memory bookkeeping: %p - %p", vma->bottom, vma->top);
@@ -170,7 +342,9 @@ static void* __create_vma_and_merge(void* addr, size_t size, bool is_pal_interna
 
     assert(vma->top - vma->bottom >= (ptrdiff_t)freed);
     size_t allocated = vma->top - vma->bottom - freed;
-    __atomic_add_fetch(&g_allocated_pages.counter, allocated / g_page_size, __ATOMIC_SEQ_CST);
+    size_t allocated_pages = __atomic_add_fetch(&g_allocated_pages.counter,
+                                                allocated / g_page_size, __ATOMIC_SEQ_CST);
+    g_peak_allocated_pages = MAX(g_peak_allocated_pages, allocated_pages);
 
     if (is_pal_internal) {
         assert(allocated <= g_pal_internal_mem_size - g_pal_internal_mem_used);
@@ -180,7 +354,8 @@ static void* __create_vma_and_merge(void* addr, size_t size, bool is_pal_interna
     return addr;
 }
 
-void* get_enclave_pages(void* addr, size_t size, bool is_pal_internal) {
+static void* allocate_enclave_pages(void* addr, size_t size, bool is_pal_internal, bool commit,
+                                    void** out_zero_bottom, void** out_zero_top) {
     void* ret = NULL;
 
     if (!size)
@@ -191,8 +366,7 @@ void* get_enclave_pages(void* addr, size_t size, bool is_pal_internal) {
 
     assert(access_ok(addr, size));
 
-    struct heap_vma* vma_above = NULL;
-    struct heap_vma* vma;
+    refill_free_vmas();
 
     spinlock_lock(&g_heap_vma_lock);
 
@@ -202,35 +376,29 @@ void* get_enclave_pages(void* addr, size_t size, bool is_pal_internal) {
     }
 
     if (addr) {
-        /* caller specified concrete address; find VMA right-above this address */
+        /* caller specified concrete address */
         if (addr < g_heap_bottom || addr + size > g_heap_top)
             goto out;
 
-        LISTP_FOR_EACH_ENTRY(vma, &g_heap_vma_list, list) {
-            if (vma->bottom < addr) {
-                /* current VMA is not above `addr`, thus vma_above is VMA right-above `addr` */
-                break;
-            }
-            vma_above = vma;
-        }
-        ret = __create_vma_and_merge(addr, size, is_pal_internal, vma_above);
+        ret = __create_vma_and_merge(addr, size, is_pal_internal, commit, out_zero_bottom,
+                                     out_zero_top);
     } else {
         /* caller did not specify address; find first (highest-address) empty slot that fits */
         void* vma_above_bottom = g_heap_top;
 
-        LISTP_FOR_EACH_ENTRY(vma, &g_heap_vma_list, list) {
+        for (struct heap_vma* vma = __last_vma(); vma; vma = __prev_vma(vma)) {
             if (vma->top < vma_above_bottom - size) {
                 ret = __create_vma_and_merge(vma_above_bottom - size, size, is_pal_internal,
-                                             vma_above);
+                                             commit, out_zero_bottom, out_zero_top);
                 goto out;
             }
-            vma_above = vma;
-            vma_above_bottom = vma_above->bottom;
+            vma_above_bottom = vma->bottom;
         }
 
         /* corner case: there may be enough space between heap bottom and the lowest-address VMA */
         if (g_heap_bottom < vma_above_bottom - size)
-            ret = __create_vma_and_merge(vma_above_bottom - size, size, is_pal_internal, vma_above);
+            ret = __create_vma_and_merge(vma_above_bottom - size, size, is_pal_internal, commit,
+                                         out_zero_bottom, out_zero_top);
     }
 
 out:
@@ -238,38 +406,81 @@ out:
     return ret;
 }
 
-int free_enclave_pages(void* addr, size_t size) {
-    int ret = 0;
+void* get_enclave_pages(void* addr, size_t size, bool is_pal_internal) {
+    void* zero_bottom;
+    void* zero_top;
+    return allocate_enclave_pages(addr, size, is_pal_internal, /*commit=*/true, &zero_bottom,
+                                  &zero_top);
+}
 
-    if (!size)
-        return -PAL_ERROR_NOMEM;
+static void zero_memory(void* addr, size_t size) {
+    if (size < ZERO_NONTEMPORAL_MIN_SIZE) {
+        memset(addr, 0, size);
+        return;
+    }
 
-    size = ALIGN_UP(size, g_page_size);
+    /* `addr` and `size` are page-aligned here */
+    for (uint64_t* p = addr; (void*)p < addr + size; p += 4) {
+        __asm__ volatile(
+            "movnti %1, 0(%0)\n"
+            "movnti %1, 8(%0)\n"
+            "movnti %1, 16(%0)\n"
+            "movnti %1, 24(%0)\n"
+            :
+            : "r"(p), "r"(0UL)
+            : "memory");
+    }
+    __asm__ volatile("sfence" ::: "memory");
+}
 
-    if (!access_ok(addr, size) || !IS_ALIGNED_PTR(addr, g_page_size) || addr < g_heap_bottom ||
-            addr + size > g_heap_top) {
-        return -PAL_ERROR_INVAL;
+/* Allocates pages like get_enclave_pages() (at `*paddr` if it is not NULL) and makes sure that they
+ * are writable and contain only zeros. Returns 0 or a negative PAL error code. */
+int get_enclave_pages_zeroed(void** paddr, size_t size, bool is_pal_internal) {
+    void* addr = *paddr;
+    void* zero_bottom;
+    void* zero_top;
+    void* mem = allocate_enclave_pages(addr, size, is_pal_internal, /*commit=*/true, &zero_bottom,
+                                       &zero_top);
+    if (!mem)
+        return addr ? -PAL_ERROR_DENIED : -PAL_ERROR_NOMEM;
+
+    if (g_edmm_enabled && addr) {
+        /* the range may overlap with committed pages whose permissions were restricted earlier;
+         * extending them back to RWX does not require help from the host */
+        int ret = protect_enclave_pages(mem, size, SGX_SECINFO_FLAGS_RWX);
+        if (ret < 0)
+            return ret;
     }
 
-    spinlock_lock(&g_heap_vma_lock);
+    /* only the parts that may have been used before need zeroing */
+    void* top = mem + ALIGN_UP(size, g_page_size);
+    if (zero_bottom > mem)
+        zero_memory(mem, zero_bottom - mem);
+    if (zero_top < top)
+        zero_memory(zero_top, top - zero_top);
 
-    /* VMA list contains both normal and pal-internal VMAs; it is impossible to free an area
-     * that overlaps with VMAs of two types at the same time, so we fail in such cases */
-    bool is_pal_internal_set = false;
-    bool is_pal_internal = false;
+    *paddr = mem;
+    return 0;
+}
 
-    /* how much memory was actually freed, since [addr, addr + size) can overlap with VMAs */
-    size_t freed = 0;
+void* get_enclave_pages_uncommitted(void* addr, size_t size) {
+    assert(g_edmm_enabled);
+    void* zero_bottom;
+    void* zero_top;
+    return allocate_enclave_pages(addr, size, /*is_pal_internal=*/false, /*commit=*/false,
+                                  &zero_bottom, &zero_top);
+}
 
-    struct heap_vma* vma;
-    struct heap_vma* p;
-    LISTP_FOR_EACH_ENTRY_SAFE(vma, p, &g_heap_vma_list, list) {
-        if (vma->bottom >= addr + size)
-            continue;
-        if (vma->top <= addr)
-            break;
+/* checks that [addr, addr + size) does not overlap with both normal and pal-internal VMAs (it is
+ * impossible to free such an area) and returns whether the overlapping VMAs are pal-internal */
+static int __check_area_to_free(void* addr, size_t size, bool* out_is_pal_internal) {
+    assert(spinlock_is_locked(&g_heap_vma_lock));
 
-        /* found VMA overlapping with area to free; check it is either normal or pal-internal */
+    bool is_pal_internal_set = false;
+    bool is_pal_internal = false;
+
+    for (struct heap_vma* vma = __lookup_vma(addr); vma && vma->bottom < addr + size;
+            vma = __next_vma(vma)) {
         if (!is_pal_internal_set) {
             is_pal_internal = vma->is_pal_internal;
             is_pal_internal_set = true;
@@ -279,39 +490,102 @@ int free_enclave_pages(void* addr, size_t size) {
             log_error("Area to free (address %p, size %lu) overlaps with both normal and "
                       "pal-internal VMAs",
                       addr, size);
-            ret = -PAL_ERROR_INVAL;
-            goto out;
+            return -PAL_ERROR_INVAL;
+        }
+    }
+
+    *out_is_pal_internal = is_pal_internal;
+    return 0;
+}
+
+int free_enclave_pages(void* addr, size_t size) {
+    int ret = 0;
+
+    if (!size)
+        return -PAL_ERROR_NOMEM;
+
+    size = ALIGN_UP(size, g_page_size);
+
+    if (!access_ok(addr, size) || !IS_ALIGNED_PTR(addr, g_page_size) || addr < g_heap_bottom ||
+            addr + size > g_heap_top) {
+        return -PAL_ERROR_INVAL;
+    }
+
+    refill_free_vmas();
+
+    bool is_pal_internal;
+
+    if (g_edmm_enabled) {
+        /* pages must be trimmed before the VMAs go away (otherwise a concurrent allocation could
+         * try to commit them again), but a failing free must not trim anything, so check first */
+        spinlock_lock(&g_heap_vma_lock);
+        ret = __check_area_to_free(addr, size, &is_pal_internal);
+        spinlock_unlock(&g_heap_vma_lock);
+        if (ret < 0)
+            return ret;
+
+        /* OCALLs cannot be issued under the heap lock, so trim one covered range at a time */
+        void* trim_top = addr + size;
+        void* range_bottom;
+        void* range_top;
+        while (find_highest_covered_range(addr, trim_top, &range_bottom, &range_top)) {
+            ret = lazy_map_remove_pages(range_bottom, range_top - range_bottom);
+            if (ret < 0) {
+                log_error("Cannot trim enclave pages in range %p - %p", range_bottom, range_top);
+                ocall_exit(/*exitcode=*/1, /*is_exitgroup=*/true);
+            }
+            trim_top = range_bottom;
         }
+    }
+
+    spinlock_lock(&g_heap_vma_lock);
+
+    ret = __check_area_to_free(addr, size, &is_pal_internal);
+    if (ret < 0)
+        goto out;
+
+    /* how much memory was actually freed, since [addr, addr + size) can overlap with VMAs */
+    size_t freed = 0;
+
+    struct heap_vma* vma = __lookup_vma(addr);
+    while (vma && vma->bottom < addr + size) {
+        struct heap_vma* next_vma = __next_vma(vma);
 
         freed += MIN(vma->top, addr + size) - MAX(vma->bottom, addr);
 
-        if (vma->bottom < addr) {
-            /* create VMA [vma->bottom, addr); this may leave VMA [addr + size, vma->top), see below */
+        if (vma->bottom < addr && vma->top > addr + size) {
+            /* area to free is strictly inside the VMA; create VMA [addr + size, vma->top) */
             struct heap_vma* new = __alloc_vma();
             if (!new) {
                 log_error("Cannot create split VMA during freeing of address %p", addr);
                 ret = -PAL_ERROR_NOMEM;
                 goto out;
             }
-            new->top             = addr;
-            new->bottom          = vma->bottom;
+            new->bottom          = addr + size;
+            new->top             = vma->top;
             new->is_pal_internal = vma->is_pal_internal;
-            INIT_LIST_HEAD(new, list);
-            LIST_ADD(new, vma, list);
-        }
 
-        /* compress overlapping VMA to [addr + size, vma->top) */
-        vma->bottom = addr + size;
-        if (vma->top <= addr + size) {
-            /* memory area to free completely covers/extends above the rest of the VMA */
-            LISTP_DEL(vma, &g_heap_vma_list, list);
+            /* shrinking the VMA from above keeps its position in the tree */
+            vma->top = addr;
+            avl_tree_insert(&g_heap_vma_tree, &new->tree_node);
+        } else if (vma->bottom < addr) {
+            /* compress overlapping VMA to [vma->bottom, addr) */
+            vma->top = addr;
+        } else if (vma->top > addr + size) {
+            /* compress overlapping VMA to [addr + size, vma->top) */
+            vma->bottom = addr + size;
+        } else {
+            /* memory area to free completely covers the VMA */
+            avl_tree_delete(&g_heap_vma_tree, &vma->tree_node);
             __free_vma(vma);
         }
+
+        vma = next_vma;
     }
 
     __atomic_sub_fetch(&g_allocated_pages.counter, freed / g_page_size, __ATOMIC_SEQ_CST);
 
-    if (is_pal_internal_set && is_pal_internal) {
+    if (is_pal_internal) {
         assert(g_pal_internal_mem_used >= freed);
         g_pal_internal_mem_used -= freed;
     }
@@ -321,20 +595,68 @@ out:
     return ret;
 }
 
+int protect_enclave_pages(void* addr, size_t size, uint64_t prot) {
+    assert(g_edmm_enabled);
+
+    size = ALIGN_UP(size, g_page_size);
+    if (!IS_ALIGNED_PTR(addr, g_page_size) || addr < g_heap_bottom || addr + size > g_heap_top)
+        return -PAL_ERROR_INVAL;
+
+    /* pages of lazy mappings must be committed before their permissions can be changed */
+    int ret = lazy_map_populate_range(addr, size);
+    if (ret < 0)
+        return ret;
+
+    /* only committed pages have EPCM permissions; the rest get RWX when they are allocated */
+    void* top = addr + size;
+    void* range_bottom;
+    void* range_top;
+    while (find_highest_covered_range(addr, top, &range_bottom, &range_top)) {
+        ret = sgx_edmm_set_page_permissions((uint64_t)range_bottom,
+                                                (range_top - range_bottom) / g_page_size, prot);
+        if (ret < 0)
+            return ret;
+        top = range_bottom;
+    }
+    return 0;
+}
+
+int discard_enclave_pages(void* addr, size_t size, uint64_t prot) {
+    assert(g_lazy_map_enabled);
+
+    size = ALIGN_UP(size, g_page_size);
+    if (!IS_ALIGNED_PTR(addr, g_page_size) || addr < g_heap_bottom || addr + size > g_heap_top)
+        return -PAL_ERROR_INVAL;
+
+    /* pages not covered by VMAs are not committed, so there is nothing to discard there */
+    void* top = addr + size;
+    void* range_bottom;
+    void* range_top;
+    while (find_highest_covered_range(addr, top, &range_bottom, &range_top)) {
+        int ret = lazy_map_discard_pages(range_bottom, range_top - range_bottom, prot);
+        if (ret < 0)
+            return ret;
+        top = range_bottom;
+    }
+    return 0;
+}
+
 /* returns current highest available address on the enclave heap */
 void* get_enclave_heap_top(void) {
     spinlock_lock(&g_heap_vma_lock);
 
     void* addr = g_heap_top;
-    struct heap_vma* vma;
-    LISTP_FOR_EACH_ENTRY(vma, &g_heap_vma_list, list) {
-        if (vma->top < addr) {
-            goto out;
-        }
+    for (struct heap_vma* vma = __last_vma(); vma && vma->top >= addr; vma = __prev_vma(vma)) {
         addr = vma->bottom;
     }
 
-out:
     spinlock_unlock(&g_heap_vma_lock);
     return addr;
 }
+
+size_t get_enclave_peak_allocated_pages(void) {
+    spinlock_lock(&g_heap_vma_lock);
+    size_t peak = g_peak_allocated_pages;
+    spinlock_unlock(&g_heap_vma_lock);
+    return peak;
+}
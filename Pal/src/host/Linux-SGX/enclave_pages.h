@@ -1,7 +1,15 @@
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 int init_enclave_pages(void);
 void* get_enclave_heap_top(void);
 void* get_enclave_pages(void* addr, size_t size, bool is_pal_internal);
+int get_enclave_pages_zeroed(void** paddr, size_t size, bool is_pal_internal);
+void* get_enclave_pages_uncommitted(void* addr, size_t size);
 int free_enclave_pages(void* addr, size_t size);
+int protect_enclave_pages(void* addr, size_t size, uint64_t prot);
+int discard_enclave_pages(void* addr, size_t size, uint64_t prot);
+size_t get_enclave_peak_allocated_pages(void);
+
+extern bool g_edmm_enabled;
@@ -88,6 +88,50 @@ static pf_status_t cb_write(pf_handle_t handle, const void* buffer, uint64_t off
     return PF_STATUS_SUCCESS;
 }
 
+static pf_status_t cb_write_batch(pf_handle_t handle, const pf_write_req_t* reqs, size_t count) {
+    int fd = *(int*)handle;
+    struct ocall_io_req io_reqs[OCALL_IO_BATCH_MAX];
+
+    while (count > 0) {
+        size_t batch_cnt = MIN(count, (size_t)OCALL_IO_BATCH_MAX);
+        for (size_t i = 0; i < batch_cnt; i++) {
+            io_reqs[i] = (struct ocall_io_req){
+                .op     = OCALL_IO_PWRITE,
+                .fd     = fd,
+                .buf    = (void*)reqs[i].buffer,
+                .count  = reqs[i].size,
+                .offset = reqs[i].offset,
+            };
+        }
+
+        int ret = ocall_io_batch(io_reqs, batch_cnt);
+
+        /* the host stops at the first write which failed or was short, so all writes before it are
+         * done and none after it (the batch may also have been interrupted as a whole, then some
+         * writes may be done twice, which is harmless for positional writes) */
+        size_t done = 0;
+        if (ret == 0) {
+            while (done < batch_cnt && io_reqs[done].result == (ssize_t)reqs[done].size)
+                done++;
+        }
+
+        if (done < batch_cnt) {
+            /* redo this write with the regular write path before any of the following ones is
+             * submitted: protected files rely on data and MHT nodes reaching the disk before the
+             * metadata node for crash consistency */
+            pf_status_t status = cb_write(handle, reqs[done].buffer, reqs[done].offset,
+                                          reqs[done].size);
+            if (PF_FAILURE(status))
+                return status;
+            done++;
+        }
+
+        reqs  += done;
+        count -= done;
+    }
+    return PF_STATUS_SUCCESS;
+}
+
 static pf_status_t cb_truncate(pf_handle_t handle, uint64_t size) {
     int fd = *(int*)handle;
     int ret = ocall_ftruncate(fd, size);
@@ -115,6 +159,10 @@ static pf_status_t cb_aes_cmac(const pf_key_t* key, const void* input, size_t in
     return PF_STATUS_SUCCESS;
 }
 
+/* The GCM callbacks take raw keys on purpose: protected files encrypt every node with a fresh random
+ * key (stored in its parent node), so a key is used for one encryption and the decryptions of that
+ * node version only. A cached key schedule would not be reused; the AES-NI path of
+ * lib_AESGCMEncrypt() expands the key on the stack, without allocations. */
 static pf_status_t cb_aes_gcm_encrypt(const pf_key_t* key, const pf_iv_t* iv, const void* aad,
                                       size_t aad_size, const void* input, size_t input_size,
                                       void* output, pf_mac_t* mac) {
@@ -158,6 +206,17 @@ static struct protected_file* g_protected_dirs = NULL;
 /* Lock for operations on global PF structures */
 static spinlock_t g_protected_file_lock = INIT_SPINLOCK_UNLOCKED;
 
+/* Closed PFs whose contexts are kept for fast reopening, least recently closed first. Has its own
+ * lock as PFs are loaded both with and without the global PF lock held. */
+#define PF_DEFAULT_CLOSED_CACHE 8
+static LISTP_TYPE(protected_file) g_closed_pfs = LISTP_INIT;
+static size_t g_closed_pfs_cnt = 0;
+static size_t g_closed_pfs_max = PF_DEFAULT_CLOSED_CACHE;
+static spinlock_t g_closed_pfs_lock = INIT_SPINLOCK_UNLOCKED;
+
+/* "sgx.protected_files_group_commit" */
+static bool g_pf_group_commit = false;
+
 /* Take ownership of the global PF lock */
 void pf_lock(void) {
     spinlock_lock(&g_protected_file_lock);
@@ -248,36 +307,18 @@ out:
 #define S_ISDIR(m) ((m & 0170000) == 0040000)
 
 static int is_directory(const char* path, bool* is_dir) {
-    int fd = -1;
     struct stat st;
 
     *is_dir = false;
-    int ret = ocall_open(path, O_RDONLY, 0);
+    int ret = ocall_stat(path, &st);
     if (ret < 0) {
         /* this can be called on a path without the file existing, assume non-dir for now */
-        ret = 0;
-        goto out;
-    }
-
-    fd = ret;
-    ret = ocall_fstat(fd, &st);
-    if (ret < 0) {
-        log_warning("is_directory(%s): fstat failed: %d", path, ret);
-        goto out;
+        return 0;
     }
 
     if (S_ISDIR(st.st_mode))
         *is_dir = true;
-
-out:
-    if (fd >= 0) {
-        int rv = ocall_close(fd);
-        if (rv < 0) {
-            log_warning("is_directory(%s): close failed: %d", path, rv);
-        }
-    }
-
-    return ret < 0 ? unix_to_pal_error(ret) : ret;
+    return 0;
 }
 
 /* Register all files from the given directory recursively */
@@ -390,6 +431,7 @@ static int register_protected_path(const char* path, struct protected_file** new
     memcpy(new->path, path, new->path_len + 1);
     new->refcount = 0;
     new->writable_fd = -1;
+    spinlock_init(&new->commit_lock);
 
     bool is_dir;
     ret = is_directory(path, &is_dir);
@@ -571,6 +613,65 @@ int init_protected_files(void) {
 
     pf_set_callbacks(cb_read, cb_write, cb_truncate, cb_aes_cmac, cb_aes_gcm_encrypt,
                      cb_aes_gcm_decrypt, cb_random, debug_callback);
+    pf_set_write_batch_callback(cb_write_batch);
+
+    uint64_t cache_size;
+    ret = toml_sizestring_in(g_pal_state.manifest_root, "sgx.protected_files_cache_size",
+                             /*defaultval=*/PF_DEFAULT_CACHE_NODES * PF_NODE_SIZE, &cache_size);
+    if (ret < 0 || cache_size < PF_NODE_SIZE) {
+        log_error("Cannot parse 'sgx.protected_files_cache_size' (the value must be at least "
+                  "%u bytes)", PF_NODE_SIZE);
+        return -PAL_ERROR_INVAL;
+    }
+
+    char* cache_policy_str = NULL;
+    ret = toml_string_in(g_pal_state.manifest_root, "sgx.protected_files_cache_policy",
+                         &cache_policy_str);
+    if (ret < 0) {
+        log_error("Cannot parse 'sgx.protected_files_cache_policy'");
+        return -PAL_ERROR_INVAL;
+    }
+
+    pf_cache_policy_t cache_policy = PF_CACHE_POLICY_2Q;
+    if (cache_policy_str) {
+        if (!strcmp(cache_policy_str, "lru")) {
+            cache_policy = PF_CACHE_POLICY_LRU;
+        } else if (strcmp(cache_policy_str, "2q")) {
+            log_error("Unknown 'sgx.protected_files_cache_policy' (allowed: `lru`, `2q`)");
+            free(cache_policy_str);
+            return -PAL_ERROR_INVAL;
+        }
+        free(cache_policy_str);
+    }
+    pf_set_cache_params(cache_size / PF_NODE_SIZE, cache_policy);
+
+    uint64_t node_size;
+    ret = toml_sizestring_in(g_pal_state.manifest_root, "sgx.protected_files_node_size",
+                             /*defaultval=*/PF_NODE_SIZE, &node_size);
+    if (ret < 0 || node_size > PF_MAX_DATA_NODE_SIZE
+            || PF_FAILURE(pf_set_data_node_size((uint32_t)node_size))) {
+        log_error("Cannot parse 'sgx.protected_files_node_size' (the value must be a power of two "
+                  "between %u and %u bytes)", PF_NODE_SIZE, PF_MAX_DATA_NODE_SIZE);
+        return -PAL_ERROR_INVAL;
+    }
+
+    int64_t closed_cache;
+    ret = toml_int_in(g_pal_state.manifest_root, "sgx.protected_files_closed_cache",
+                      /*defaultval=*/PF_DEFAULT_CLOSED_CACHE, &closed_cache);
+    if (ret < 0 || closed_cache < 0) {
+        log_error("Cannot parse 'sgx.protected_files_closed_cache' (the value must be 0 or "
+                  "greater)");
+        return -PAL_ERROR_INVAL;
+    }
+    g_closed_pfs_max = closed_cache;
+
+    ret = toml_bool_in(g_pal_state.manifest_root, "sgx.protected_files_group_commit",
+                       /*defaultval=*/false, &g_pf_group_commit);
+    if (ret < 0) {
+        log_error("Cannot parse 'sgx.protected_files_group_commit' (the value must be `true` or "
+                  "`false`)");
+        return -PAL_ERROR_INVAL;
+    }
 
     /* if wrap key is not hard-coded in the manifest, assume that it was received from parent or
      * it will be provisioned after local/remote attestation; otherwise read it from manifest */
@@ -641,6 +742,30 @@ struct protected_file* load_protected_file(const char* path, int* fd, uint64_t s
         pf = get_protected_file(path);
 
     if (pf) {
+        pf_context_t* closed_context = NULL;
+        spinlock_lock(&g_closed_pfs_lock);
+        if (pf->closed) {
+            LISTP_DEL_INIT(pf, &g_closed_pfs, closed_list);
+            g_closed_pfs_cnt--;
+            pf->closed = false;
+            closed_context = pf->context;
+        }
+        spinlock_unlock(&g_closed_pfs_lock);
+
+        if (closed_context) {
+            pf_status_t pfs = PF_STATUS_FILE_CHANGED;
+            if (!create && g_pf_wrap_key_set)
+                pfs = pf_reopen(closed_context, (pf_handle_t)fd, size, mode, &g_pf_wrap_key);
+            if (PF_SUCCESS(pfs)) {
+                log_debug("load_protected_file: %s, fd %d: reopening closed PF %p", path, *fd, pf);
+                return pf;
+            }
+            log_debug("load_protected_file: %s, fd %d: cannot reopen closed PF %p: %s", path, *fd,
+                      pf, pf_strerror(pfs));
+            pf_close(closed_context);
+            pf->context = NULL;
+        }
+
         if (!pf->context) {
             log_debug("load_protected_file: %s, fd %d: opening new PF %p", path, *fd, pf);
             int ret = open_protected_file(path, pf, (pf_handle_t)fd, size, mode, create);
@@ -659,11 +784,128 @@ struct protected_file* load_protected_file(const char* path, int* fd, uint64_t s
  * If buffer is NULL, process all maps for given pf.
  * If both pf and buffer are NULL, process all maps for all PFs.
  */
+static int hash_pf_map_page(const void* page, size_t size, pf_map_page_hash_t* out_hash) {
+    uint8_t hash[32];
+    LIB_SHA256_CONTEXT sha;
+    int ret = lib_SHA256Init(&sha);
+    if (ret < 0)
+        return ret;
+    ret = lib_SHA256Update(&sha, page, size);
+    if (ret < 0)
+        return ret;
+    ret = lib_SHA256Final(&sha, hash);
+    if (ret < 0)
+        return ret;
+
+    static_assert(sizeof(out_hash->bytes) <= sizeof(hash), "page hash is too long");
+    memcpy(out_hash->bytes, hash, sizeof(out_hash->bytes));
+    return 0;
+}
+
+int register_pf_map(struct protected_file* pf, void* buffer, uint64_t offset, uint64_t size,
+                    bool populated) {
+    struct pf_map* map = calloc(1, sizeof(*map));
+    if (!map)
+        return -PAL_ERROR_NOMEM;
+
+    size_t pages_cnt = ALIGN_UP(size, g_page_size) / g_page_size;
+    map->page_hashes = calloc(pages_cnt, sizeof(*map->page_hashes));
+    if (!map->page_hashes) {
+        free(map);
+        return -PAL_ERROR_NOMEM;
+    }
+
+    map->pf     = pf;
+    map->size   = size;
+    map->offset = offset;
+    map->buffer = buffer;
+
+    if (populated) {
+        for (size_t i = 0; i < pages_cnt; i++) {
+            uint64_t page_off = i * g_page_size;
+            int ret = hash_pf_map_page(buffer + page_off, MIN(g_page_size, size - page_off),
+                                       &map->page_hashes[i]);
+            if (ret < 0) {
+                free(map->page_hashes);
+                free(map);
+                return ret;
+            }
+        }
+        map->page_hashes_valid = true;
+    }
+
+    pf_lock();
+    LISTP_ADD_TAIL(map, &g_pf_map_list, list);
+    pf_unlock();
+    return 0;
+}
+
+static int flush_pf_map_run(struct protected_file* pf, struct pf_map* map, uint64_t start,
+                            uint64_t end) {
+    pf_status_t pfs = pf_write(pf->context, map->offset + start, end - start,
+                               map->buffer + start);
+    if (PF_FAILURE(pfs)) {
+        log_error("flush_pf_maps: pf_write failed: %s", pf_strerror(pfs));
+        /* we don't know what was written, so flush everything next time */
+        map->page_hashes_valid = false;
+        return -PAL_ERROR_INVAL;
+    }
+    return 0;
+}
+
+/* Writes the pages of the map buffer which were modified since they were read from or last
+ * written to the PF (all pages if this is not known), coalescing runs of adjacent modified pages
+ * into single writes. The part of the buffer beyond the end of the PF is not written; the hash of
+ * a page cut by the end of the PF covers only its part inside the PF. */
+static int flush_pf_map(struct protected_file* pf, struct pf_map* map) {
+    int ret;
+    uint64_t pf_size;
+    pf_status_t pfs = pf_get_size(pf->context, &pf_size);
+    __UNUSED(pfs);
+    assert(PF_SUCCESS(pfs));
+
+    assert(pf_size >= map->offset);
+    uint64_t map_size = MIN(map->size, pf_size - map->offset);
+
+    bool hashes_valid = map->page_hashes_valid;
+    uint64_t run_start = 0;
+    uint64_t run_end   = 0;
+    for (uint64_t page_off = 0; page_off < map_size; page_off += g_page_size) {
+        pf_map_page_hash_t* page_hash = &map->page_hashes[page_off / g_page_size];
+        pf_map_page_hash_t hash;
+        ret = hash_pf_map_page(map->buffer + page_off, MIN(g_page_size, map_size - page_off),
+                               &hash);
+        if (ret < 0)
+            return ret;
+
+        if (hashes_valid && !memcmp(&hash, page_hash, sizeof(hash))) {
+            /* page not modified, write out the preceding run of modified pages (if any) */
+            if (run_end > run_start) {
+                ret = flush_pf_map_run(pf, map, run_start, run_end);
+                if (ret < 0)
+                    return ret;
+            }
+            run_start = run_end = page_off + g_page_size;
+            continue;
+        }
+
+        memcpy(page_hash, &hash, sizeof(hash));
+        run_end = MIN(page_off + g_page_size, map_size);
+    }
+
+    if (run_end > run_start) {
+        ret = flush_pf_map_run(pf, map, run_start, run_end);
+        if (ret < 0)
+            return ret;
+    }
+
+    map->page_hashes_valid = true;
+    return 0;
+}
+
 int flush_pf_maps(struct protected_file* pf, void* buffer, bool remove) {
     struct pf_map* map;
     struct pf_map* tmp;
-    uint64_t pf_size;
-    pf_status_t pfs;
 
     pf_lock();
     LISTP_FOR_EACH_ENTRY_SAFE(map, tmp, &g_pf_map_list, list) {
@@ -673,27 +915,15 @@ int flush_pf_maps(struct protected_file* pf, void* buffer, bool remove) {
         if (buffer && map->buffer != buffer)
             continue;
 
-        size_t map_size = map->size;
-        struct protected_file* map_pf = pf ? pf : map->pf;
-
-        pfs = pf_get_size(map_pf->context, &pf_size);
-        assert(PF_SUCCESS(pfs));
-
-        assert(pf_size >= map->offset);
-        if (map->offset + map_size > pf_size)
-            map_size = pf_size - map->offset;
-
-        if (map_size > 0) {
-            pfs = pf_write(map_pf->context, map->offset, map_size, map->buffer);
-            if (PF_FAILURE(pfs)) {
-                log_error("flush_pf_maps: pf_write failed: %s", pf_strerror(pfs));
-                pf_unlock();
-                return -PAL_ERROR_INVAL;
-            }
+        int ret = flush_pf_map(pf ? pf : map->pf, map);
+        if (ret < 0) {
+            pf_unlock();
+            return ret;
         }
 
         if (remove) {
             LISTP_DEL(map, &g_pf_map_list, list);
+            free(map->page_hashes);
             free(map);
         }
     }
@@ -702,12 +932,97 @@ int flush_pf_maps(struct protected_file* pf, void* buffer, bool remove) {
     return 0;
 }
 
+/* Keep the context of a flushed PF for fast reopening (see load_protected_file()), closing the
+ * least recently closed PF if there are too many of them */
+static void keep_closed_protected_file(struct protected_file* pf) {
+    struct protected_file* evicted = NULL;
+    pf_context_t* evicted_context = NULL;
+
+    spinlock_lock(&g_closed_pfs_lock);
+    pf->closed = true;
+    LISTP_ADD_TAIL(pf, &g_closed_pfs, closed_list);
+    if (++g_closed_pfs_cnt > g_closed_pfs_max) {
+        evicted = LISTP_FIRST_ENTRY(&g_closed_pfs, struct protected_file, closed_list);
+        LISTP_DEL_INIT(evicted, &g_closed_pfs, closed_list);
+        g_closed_pfs_cnt--;
+        evicted->closed = false;
+        evicted_context = evicted->context;
+        evicted->context = NULL;
+    }
+    spinlock_unlock(&g_closed_pfs_lock);
+
+    if (evicted_context) {
+        /* nothing to write, the context was flushed before it was kept */
+        pf_status_t pfs = pf_close(evicted_context);
+        if (PF_FAILURE(pfs)) {
+            log_warning("keep_closed_protected_file: closing %p failed: %s", evicted,
+                        pf_strerror(pfs));
+        }
+    }
+}
+
+static int flush_and_sync_protected_file(struct protected_file* pf, int fd) {
+    pf_status_t pfs = pf_flush(pf->context);
+    if (PF_FAILURE(pfs)) {
+        log_warning("flush_protected_file(PF fd %d): pf_flush returned %s", fd, pf_strerror(pfs));
+        return -PAL_ERROR_DENIED;
+    }
+    if (!g_pf_group_commit)
+        return 0;
+
+    int ret = ocall_fsync(fd);
+    return ret < 0 ? unix_to_pal_error(ret) : 0;
+}
+
+int flush_protected_file(struct protected_file* pf, int fd) {
+    if (!g_pf_group_commit)
+        return flush_and_sync_protected_file(pf, fd);
+
+    /* Each flush takes a ticket after its writes. A flush which finds no commit running becomes the
+     * leader and commits all tickets taken so far with a single PF flush and host fsync. Flushes
+     * arriving meanwhile wait for it: they are done if it covered their ticket and lead the next
+     * commit otherwise. So a database fsyncing from many threads pays for one MHT update and host
+     * fsync per round instead of one per call. */
+    spinlock_lock(&pf->commit_lock);
+    uint64_t ticket = ++pf->commit_requested;
+    while (pf->commit_running && pf->commit_done < ticket) {
+        spinlock_unlock(&pf->commit_lock);
+        while (__atomic_load_n(&pf->commit_running, __ATOMIC_ACQUIRE)
+                && __atomic_load_n(&pf->commit_done, __ATOMIC_ACQUIRE) < ticket)
+            CPU_RELAX();
+        spinlock_lock(&pf->commit_lock);
+    }
+    if (pf->commit_done >= ticket) {
+        int ret = pf->commit_result;
+        spinlock_unlock(&pf->commit_lock);
+        return ret;
+    }
+    uint64_t commit_target = pf->commit_requested;
+    __atomic_store_n(&pf->commit_running, true, __ATOMIC_RELEASE);
+    spinlock_unlock(&pf->commit_lock);
+
+    int ret = flush_and_sync_protected_file(pf, fd);
+
+    spinlock_lock(&pf->commit_lock);
+    pf->commit_result = ret;
+    __atomic_store_n(&pf->commit_done, commit_target, __ATOMIC_RELEASE);
+    __atomic_store_n(&pf->commit_running, false, __ATOMIC_RELEASE);
+    spinlock_unlock(&pf->commit_lock);
+    return ret;
+}
+
 /* Flush map buffers and unload/close the PF */
 int unload_protected_file(struct protected_file* pf) {
     /* flush all pf's maps and delete them */
     int ret = flush_pf_maps(pf, NULL, true);
     if (ret < 0)
         return ret;
+
+    if (g_closed_pfs_max > 0 && PF_SUCCESS(pf_flush(pf->context))) {
+        keep_closed_protected_file(pf);
+        return 0;
+    }
+
     pf_status_t pfs = pf_close(pf->context);
     if (PF_FAILURE(pfs)) {
         log_warning("unload_protected_file(%p) failed: %s", pf, pf_strerror(pfs));
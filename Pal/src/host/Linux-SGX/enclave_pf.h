@@ -29,6 +29,12 @@
 #include "pal.h"
 #include "pal_internal.h"
 #include "protected_files.h"
+#include "spinlock.h"
+
+/* Truncated SHA256 hash of a page of a map buffer */
+typedef struct {
+    uint8_t bytes[16];
+} pf_map_page_hash_t;
 
 /* Used to track map buffers for protected files */
 DEFINE_LIST(pf_map);
@@ -38,6 +44,10 @@ struct pf_map {
     void* buffer;
     uint64_t size;
     uint64_t offset; /* offset in PF, needed for write buffers when flushing to the PF */
+    /* hashes of the pages as they are in the PF, used to flush only pages modified since then;
+     * not valid until the first flush if the buffer was not populated from the PF */
+    pf_map_page_hash_t* page_hashes;
+    bool page_hashes_valid;
 };
 DEFINE_LISTP(pf_map);
 
@@ -45,6 +55,7 @@ DEFINE_LISTP(pf_map);
 extern LISTP_TYPE(pf_map) g_pf_map_list;
 
 /* Data of a protected file */
+DEFINE_LIST(protected_file);
 struct protected_file {
     UT_hash_handle hh;
     size_t path_len;
@@ -52,7 +63,17 @@ struct protected_file {
     pf_context_t* context; /* NULL until PF is opened */
     int64_t refcount; /* used for deciding when to call unload_protected_file() */
     int writable_fd; /* fd of underlying file for writable PF, -1 if no writable handles are open */
+    /* PF was closed but its context was kept for fast reopening (see unload_protected_file()) */
+    bool closed;
+    LIST_TYPE(protected_file) closed_list;
+    /* group commit of flushes (see flush_protected_file()), protected by `commit_lock` */
+    spinlock_t commit_lock;
+    uint64_t commit_requested; /* number of flushes started so far */
+    uint64_t commit_done;      /* flushes up to this number are committed */
+    bool commit_running;
+    int commit_result;         /* result of the last commit */
 };
+DEFINE_LISTP(protected_file);
 
 /* Take ownership of the global PF lock */
 void pf_lock(void);
@@ -81,11 +102,22 @@ struct protected_file* load_protected_file(const char* path, int* fd, size_t siz
                                            pf_file_mode_t mode, bool create,
                                            struct protected_file* pf);
 
+/* Register a writable map buffer of a PF, to be flushed to the PF on flush, unmap or close.
+ * If `populated` is true, the buffer currently holds the PF contents (and so only the pages
+ * modified later need to be flushed). */
+int register_pf_map(struct protected_file* pf, void* buffer, uint64_t offset, uint64_t size,
+                    bool populated);
+
 /* Flush PF map buffers and optionally remove and free them.
    If pf is NULL, process all maps containing given buffer.
    If buffer is NULL, process all maps for given pf. */
 int flush_pf_maps(struct protected_file* pf, void* buffer, bool remove);
 
+/* Write all changes of the PF to the host file (map buffers must be flushed by the caller). With
+ * "sgx.protected_files_group_commit", also syncs the host file, and concurrent flushes of the same
+ * PF share one PF flush and host fsync. `fd` is a host fd of the PF. */
+int flush_protected_file(struct protected_file* pf, int fd);
+
 /* Flush map buffers and unload/close the PF */
 int unload_protected_file(struct protected_file* pf);
 
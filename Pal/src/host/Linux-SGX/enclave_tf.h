@@ -13,6 +13,14 @@
  * verification in future reads, to avoid re-verifying the whole file again or the need of caching
  * file contents.
  *
+ * For large files, hashing the whole file on first open may be too slow. If the manifest was signed
+ * with "sgx.lazy_trusted_files", the signer additionally stores the per-chunk hashes of such files
+ * in a separate file next to the manifest ("sgx.trusted_chunk_hashes_file"), and the manifest entry
+ * of each such file contains the SHA256 hash over the file size and the list of its chunk hashes
+ * ("chunk_hashes_sha256"). On first open, Graphene then only loads and verifies the list of chunk
+ * hashes against this measured root hash; the file contents are verified chunk by chunk, when they
+ * are actually read.
+ *
  * Perhaps confusingly, `struct trusted_file` describes not only "sgx.trusted_files" but also
  * "sgx.allowed_files". For allowed files, `allowed = true`, `chunk_hashes = NULL`, and `uri` can be
  * not only a file but also a directory. TODO: Perhaps split "allowed_files" into a separate struct?
@@ -30,6 +38,7 @@
 
 #include "api.h"
 #include "pal.h"
+#include "pal_internal.h"
 
 enum {
     FILE_CHECK_POLICY_STRICT = 0,
@@ -48,13 +57,18 @@ typedef struct {
     uint8_t bytes[16];
 } sgx_chunk_hash_t;
 
-DEFINE_LIST(trusted_file);
 struct trusted_file {
-    LIST_TYPE(trusted_file) list;
+    UT_hash_handle hh;                 /* keyed by path (`uri` without prefix) */
     uint64_t size;
+    bool size_known;                   /* `size` is queried on first open, not at startup */
     bool allowed;
-    sgx_file_hash_t file_hash;      /* hash over the whole file, retrieved from the manifest */
-    sgx_chunk_hash_t* chunk_hashes; /* array of hashes over separate file chunks */
+    bool used;                         /* opened at least once (only for trusted files) */
+    uint64_t* used_chunks;             /* bitmap of read chunks ("sgx.trusted_files_usage_log") */
+    sgx_file_hash_t file_hash;         /* hash over the whole file, retrieved from the manifest */
+    sgx_chunk_hash_t* chunk_hashes;    /* array of hashes over separate file chunks */
+    bool has_chunk_hashes_root;        /* chunk hashes were precomputed by the signer */
+    sgx_file_hash_t chunk_hashes_root; /* hash over file size and chunk hashes, from the manifest */
+    uint64_t chunk_hashes_offset;      /* offset of chunk hashes in the chunk-hashes file */
     size_t uri_len;
     char uri[]; /* must be NULL-terminated */
 };
@@ -103,6 +117,72 @@ int copy_and_verify_trusted_file(const char* path, uint8_t* buf, const void* ume
                                  off_t aligned_offset, off_t aligned_end, off_t offset, off_t end,
                                  sgx_chunk_hash_t* chunk_hashes, size_t file_size);
 
+/*!
+ * \brief Look up a verified chunk in the cache of trusted-file chunks
+ *
+ * \param key   Entry of the chunk in the chunk hashes of its trusted file.
+ * \param buf   Buffer in enclave memory to copy the chunk into.
+ * \param size  Size of the chunk.
+ *
+ * \return true if the chunk was cached and copied into \p buf, false otherwise.
+ */
+bool trusted_chunk_cache_get(const sgx_chunk_hash_t* key, uint8_t* buf, size_t size);
+
+/*!
+ * \brief Add a chunk to the cache of trusted-file chunks (no-op if the cache is disabled)
+ *
+ * \param key   Entry of the chunk in the chunk hashes of its trusted file.
+ * \param data  Chunk contents; must be in enclave memory and already verified against \p key.
+ * \param size  Size of the chunk.
+ */
+void trusted_chunk_cache_put(const sgx_chunk_hash_t* key, const uint8_t* data, size_t size);
+
+/*!
+ * \brief Log the URIs of all trusted files opened by this process so far (for `sgx.enable_stats`)
+ */
+void log_used_trusted_files(void);
+
+/*!
+ * \brief Record that a range of a trusted file was read (for "sgx.trusted_files_usage_log")
+ *
+ * No-op if the usage log is disabled or \p path is not a trusted file.
+ *
+ * \param path    Normalized path of the file (as for get_trusted_or_allowed_file()).
+ * \param offset  Start of the range read.
+ * \param end     End of the range read.
+ */
+void mark_trusted_file_chunks_used(const char* path, uint64_t offset, uint64_t end);
+
+/*!
+ * \brief Write the trusted files opened by this process, with the chunks read from them, to
+ *        `<sgx.trusted_files_usage_log>.<pid>` on the host (no-op if the option is not set)
+ *
+ * \return 0 on success, negative error code on failure
+ */
+int write_trusted_files_usage_log(void);
+
+/*!
+ * \brief Serialize the chunk hashes of all already verified trusted files
+ *
+ * Used to send them to a child process, so that it does not need to verify the same files again.
+ *
+ * \param out_buf   on success, contains newly allocated buffer (or NULL if there is nothing to send)
+ * \param out_size  on success, contains size of `*out_buf`
+ *
+ * \return 0 on success, negative error code on failure
+ */
+int serialize_trusted_files_chunk_hashes(void** out_buf, size_t* out_size);
+
+/*!
+ * \brief Remember the chunk hashes received from the parent process
+ *
+ * They are installed into the trusted files by init_trusted_files(). Takes ownership of `buf`.
+ *
+ * \param buf   buffer produced by serialize_trusted_files_chunk_hashes() in the parent
+ * \param size  size of `buf`
+ */
+void set_inherited_trusted_files_chunk_hashes(void* buf, size_t size);
+
 int init_trusted_files(void);
 int init_allowed_files(void);
 
@@ -52,3 +52,114 @@ void* malloc_untrusted(size_t size) {
 void free_untrusted(void* ptr) {
     slab_free(untrusted_slabmgr, ptr);
 }
+
+/*
+ * Size-classed allocator of large untrusted buffers for OCALL payloads that don't fit on the
+ * untrusted stack (see ocall_mmap_untrusted_cache()). Buffers are rounded up to a power of two and
+ * freed buffers are kept on per-class free lists instead of being munmapped, so that under bursty
+ * load (e.g. many threads doing large reads at once) getting a buffer does not cost an
+ * ocall_mmap_untrusted/ocall_munmap_untrusted round trip. Optionally, a region of untrusted memory
+ * is preallocated at startup (`sgx.untrusted_io_prealloc_size`) and buffers are carved out of it;
+ * with `sgx.untrusted_huge_pages`, this region is backed by host huge pages.
+ *
+ * Free lists are kept in enclave memory: untrusted memory is never trusted to hold allocator
+ * metadata.
+ */
+#define UNTRUSTED_IO_MIN_SHIFT 16 /* 64KB */
+#define UNTRUSTED_IO_CLASSES   11 /* 64KB .. 64MB */
+#define UNTRUSTED_IO_FREE_MAX  8  /* free buffers kept per size class */
+
+static spinlock_t g_io_bufs_lock = INIT_SPINLOCK_UNLOCKED;
+static void* g_io_free_bufs[UNTRUSTED_IO_CLASSES][UNTRUSTED_IO_FREE_MAX];
+static size_t g_io_free_cnt[UNTRUSTED_IO_CLASSES];
+static char* g_io_arena_cur = NULL; /* preallocated region, buffers are carved from its start */
+static char* g_io_arena_end = NULL;
+static char* g_io_arena_start = NULL;
+static bool g_io_arena_huge = false; /* parts of a huge-page mapping cannot be munmapped */
+
+/* returns size class of a buffer of `size` bytes or -1 if it's too large to be cached */
+static int io_buf_class(size_t size) {
+    for (int cls = 0; cls < UNTRUSTED_IO_CLASSES; cls++)
+        if (size <= (1UL << (UNTRUSTED_IO_MIN_SHIFT + cls)))
+            return cls;
+    return -1;
+}
+
+int init_untrusted_io_bufs(size_t prealloc_size, bool huge_pages) {
+    if (!prealloc_size)
+        return 0;
+
+    void* addr = NULL;
+    if (huge_pages) {
+        size_t huge_size = ALIGN_UP(prealloc_size, HUGE_PAGE_SIZE);
+        int ret = ocall_mmap_untrusted(&addr, huge_size, PROT_READ | PROT_WRITE,
+                                       MAP_ANONYMOUS | MAP_PRIVATE | MAP_HUGETLB, /*fd=*/-1,
+                                       /*offset=*/0);
+        if (ret < 0) {
+            log_warning("Cannot allocate untrusted I/O buffers in huge pages (no free huge pages on "
+                        "the host?), falling back to regular pages");
+            addr = NULL;
+        } else {
+            prealloc_size = huge_size;
+            g_io_arena_huge = true;
+        }
+    }
+
+    if (!addr) {
+        prealloc_size = ALLOC_ALIGN_UP(prealloc_size);
+        addr = __malloc(prealloc_size);
+        if (!addr)
+            return -PAL_ERROR_NOMEM;
+    }
+
+    g_io_arena_start = addr;
+    g_io_arena_cur = addr;
+    g_io_arena_end = (char*)addr + prealloc_size;
+    return 0;
+}
+
+void* alloc_untrusted_io_buf(size_t size, size_t* alloc_size) {
+    int cls = io_buf_class(size);
+    if (cls < 0) {
+        *alloc_size = ALLOC_ALIGN_UP(size);
+        return __malloc(*alloc_size);
+    }
+
+    size_t cls_size = 1UL << (UNTRUSTED_IO_MIN_SHIFT + cls);
+    void* addr = NULL;
+
+    spinlock_lock(&g_io_bufs_lock);
+    if (g_io_free_cnt[cls]) {
+        addr = g_io_free_bufs[cls][--g_io_free_cnt[cls]];
+    } else if ((size_t)(g_io_arena_end - g_io_arena_cur) >= cls_size) {
+        addr = g_io_arena_cur;
+        g_io_arena_cur += cls_size;
+    }
+    spinlock_unlock(&g_io_bufs_lock);
+
+    if (!addr)
+        addr = __malloc(cls_size);
+
+    *alloc_size = cls_size;
+    return addr;
+}
+
+void free_untrusted_io_buf(void* addr, size_t alloc_size) {
+    int cls = io_buf_class(alloc_size);
+    if (cls >= 0) {
+        spinlock_lock(&g_io_bufs_lock);
+        if (g_io_free_cnt[cls] < UNTRUSTED_IO_FREE_MAX) {
+            g_io_free_bufs[cls][g_io_free_cnt[cls]++] = addr;
+            addr = NULL;
+        }
+        spinlock_unlock(&g_io_bufs_lock);
+    }
+
+    /* note that munmap of a buffer carved from the preallocated region is fine, unless the region
+     * is backed by huge pages; such a buffer is dropped (and its part of the region is lost) */
+    if (addr && g_io_arena_huge && (char*)addr >= g_io_arena_start
+            && (char*)addr < g_io_arena_end)
+        return;
+    if (addr)
+        __free(addr, alloc_size);
+}
@@ -38,6 +38,7 @@
 #include <stdbool.h>
 
 #include "api.h"
+#include "cpu.h"
 #include "crypto.h"
 #include "enclave_pages.h"
 #include "list.h"
@@ -51,6 +52,8 @@
 int g_xsave_enabled = 0;
 uint64_t g_xsave_features = 0;
 uint32_t g_xsave_size = 0;
+/* XGETBV with ECX = 1 (XINUSE) is available, see save_xregs() */
+int g_xsave_xinuse = 0;
 // FXRSTOR only cares about the first 512 bytes, while XRSTOR in compacted mode will ignore
 // the first 512 bytes.
 const uint32_t g_xsave_reset_state[XSAVE_RESET_STATE_SIZE / sizeof(uint32_t)] __attribute__((
@@ -97,3 +100,19 @@ void init_xsave_size(uint64_t xfrm) {
     }
     log_debug("xsave is enabled with g_xsave_size: %u", g_xsave_size);
 }
+
+/* Must be called after init_xsave_size(). CPUID comes from the host here; if it lies about XINUSE,
+ * the enclave gets #UD on the next OCALL, which is not worse than the host refusing to run it. */
+void init_xsave_xinuse(void) {
+    g_xsave_xinuse = 0;
+    if (!g_xsave_enabled)
+        return;
+
+    unsigned int values[4];
+    if (_DkCpuIdRetrieve(/*leaf=*/0xd, /*subleaf=*/1, values) < 0)
+        return;
+    /* CPUID.(EAX=0DH,ECX=1):EAX[2] */
+    g_xsave_xinuse = !!(values[CPUID_WORD_EAX] & (1u << 2));
+    log_debug("xsave of only in-use state components is %s",
+              g_xsave_xinuse ? "enabled" : "disabled");
+}
@@ -97,6 +97,7 @@ __attribute__((__used__)) static void dummy(void) {
     OFFSET(SGX_MANIFEST_SIZE, enclave_tls, manifest_size);
     OFFSET(SGX_HEAP_MIN, enclave_tls, heap_min);
     OFFSET(SGX_HEAP_MAX, enclave_tls, heap_max);
+    OFFSET(SGX_EDMM_ENABLED, enclave_tls, edmm_enabled);
     OFFSET(SGX_CLEAR_CHILD_TID, enclave_tls, clear_child_tid);
 
     /* struct pal_tcb_urts aka PAL_TCB_URTS */
@@ -155,6 +156,7 @@ __attribute__((__used__)) static void dummy(void) {
     DEFINE(ENCLAVE_SIG_STACK_SIZE, ENCLAVE_SIG_STACK_SIZE);
     DEFINE(DEFAULT_ENCLAVE_BASE, DEFAULT_ENCLAVE_BASE);
     DEFINE(MMAP_MIN_ADDR, MMAP_MIN_ADDR);
+    DEFINE(TRUSTED_CHUNK_SIZE, TRUSTED_CHUNK_SIZE);
 
     /* pal_linux.h */
     DEFINE(PAGESIZE, PRESET_PAGESIZE);
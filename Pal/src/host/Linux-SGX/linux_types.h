@@ -4,6 +4,7 @@
 #include <asm/fcntl.h>
 #include <asm/posix_types.h>
 #include <asm/stat.h>
+#include <linux/eventpoll.h>
 #include <linux/poll.h>
 #include <linux/sched.h>
 #include <linux/socket.h>
@@ -73,6 +74,10 @@ struct sockaddr {
 #define SOCK_CLOEXEC 02000000
 #endif
 
+#ifndef MSG_DONTWAIT
+#define MSG_DONTWAIT 0x40
+#endif
+
 #ifndef MSG_NOSIGNAL
 #define MSG_NOSIGNAL 0x4000
 #endif
@@ -99,6 +104,15 @@ struct msghdr {
     int msg_flags;
 };
 
+struct mmsghdr {
+    struct msghdr msg_hdr;
+    unsigned int msg_len;
+};
+
+#ifndef MSG_WAITFORONE
+#define MSG_WAITFORONE 0x10000
+#endif
+
 struct cmsghdr {
     size_t cmsg_len;
     int cmsg_level;
@@ -32,6 +32,8 @@ enum {
     OCALL_PREAD,
     OCALL_PWRITE,
     OCALL_FSTAT,
+    OCALL_STAT,
+    OCALL_OPEN_STAT,
     OCALL_FIONREAD,
     OCALL_FSETNONBLOCK,
     OCALL_FCHMOD,
@@ -39,6 +41,7 @@ enum {
     OCALL_FTRUNCATE,
     OCALL_MKDIR,
     OCALL_GETDENTS,
+    OCALL_GETDENTS_STAT,
     OCALL_RESUME_THREAD,
     OCALL_SCHED_SETAFFINITY,
     OCALL_SCHED_GETAFFINITY,
@@ -48,20 +51,34 @@ enum {
     OCALL_SOCKETPAIR,
     OCALL_LISTEN,
     OCALL_ACCEPT,
+    OCALL_ACCEPT_BATCH,
     OCALL_CONNECT,
     OCALL_RECV,
     OCALL_SEND,
+    OCALL_SENDMMSG,
+    OCALL_RECVMMSG,
+    OCALL_SOCK_RING_START,
+    OCALL_SOCK_RING_STOP,
     OCALL_SETSOCKOPT,
     OCALL_SHUTDOWN,
+    OCALL_SENDFILE,
     OCALL_GETTIME,
     OCALL_SCHED_YIELD,
     OCALL_POLL,
+    OCALL_EPOLL_CREATE,
+    OCALL_EPOLL_CTL,
+    OCALL_EPOLL_WAIT,
     OCALL_RENAME,
     OCALL_DELETE,
     OCALL_DEBUG_MAP_ADD,
     OCALL_DEBUG_MAP_REMOVE,
+    OCALL_STARTUP_TRACE,
     OCALL_EVENTFD,
     OCALL_GET_QUOTE,
+    OCALL_BATCH,
+    OCALL_EDMM_RESTRICT_PAGES_PERM,
+    OCALL_EDMM_MODIFY_PAGES_TYPE,
+    OCALL_EDMM_REMOVE_PAGES,
     OCALL_NR,
 };
 
@@ -131,6 +148,19 @@ typedef struct {
     struct stat ms_stat;
 } ms_ocall_fstat_t;
 
+typedef struct {
+    const char* ms_pathname;
+    struct stat ms_stat;
+} ms_ocall_stat_t;
+
+/* open() followed by fstat() of the new fd, in one transition */
+typedef struct {
+    const char* ms_pathname;
+    int ms_flags;
+    unsigned short ms_mode;
+    struct stat ms_stat;
+} ms_ocall_open_stat_t;
+
 typedef struct {
     int ms_fd;
 } ms_ocall_fionread_t;
@@ -165,6 +195,18 @@ typedef struct {
     size_t ms_size;
 } ms_ocall_getdents_t;
 
+typedef struct {
+    int ms_fd;
+    struct linux_dirent64* ms_dirp;
+    size_t ms_size;
+    struct stat* ms_stats;
+    size_t ms_stats_cnt;
+} ms_ocall_getdents_stat_t;
+
+typedef struct {
+    void* ms_tcs;
+} ms_ocall_clone_thread_t;
+
 typedef struct {
     int ms_stream_fd;
     size_t ms_nargs;
@@ -211,6 +253,50 @@ typedef struct {
     struct sockopt ms_sockopt;
 } ms_ocall_accept_t;
 
+struct ocall_accepted_conn {
+    int fd;
+    size_t addrlen;
+    struct sockaddr_storage addr;
+};
+
+typedef struct {
+    int ms_sockfd;
+    unsigned int ms_max;
+    struct ocall_accepted_conn* ms_conns;
+} ms_ocall_accept_batch_t;
+
+/* datagrams per OCALL_SENDMMSG/OCALL_RECVMMSG, bounded to keep the host headers on the stack */
+#define OCALL_MMSG_MAX 64
+
+/* one datagram of OCALL_SENDMMSG/OCALL_RECVMMSG; `addrlen` and `bytes` are updated on receive */
+struct ocall_mmsg {
+    void* buf;
+    size_t len;
+    void* addr;
+    size_t addrlen;
+    size_t bytes;
+};
+
+typedef struct {
+    int ms_sockfd;
+    struct ocall_mmsg* ms_msgs;
+    unsigned int ms_vlen;
+} ms_ocall_mmsg_t;
+
+struct sock_ring;
+
+typedef struct {
+    int ms_sockfd;
+    int ms_bellfd;
+    bool ms_stream;
+    uint64_t ms_budget_us;
+    struct sock_ring* ms_ring;
+} ms_ocall_sock_ring_start_t;
+
+typedef struct {
+    struct sock_ring* ms_ring;
+} ms_ocall_sock_ring_stop_t;
+
 typedef struct {
     int ms_domain;
     int ms_type;
@@ -256,6 +342,13 @@ typedef struct {
     int ms_how;
 } ms_ocall_shutdown_t;
 
+typedef struct {
+    int ms_out_fd;
+    int ms_in_fd;
+    off_t ms_offset;
+    size_t ms_count;
+} ms_ocall_sendfile_t;
+
 typedef struct {
     uint64_t ms_microsec;
 } ms_ocall_gettime_t;
@@ -266,6 +359,21 @@ typedef struct {
     int64_t ms_timeout_us;
 } ms_ocall_poll_t;
 
+typedef struct {
+    int ms_epfd;
+    int ms_op;
+    int ms_fd;
+    uint32_t ms_events;
+    uint64_t ms_data;
+} ms_ocall_epoll_ctl_t;
+
+typedef struct {
+    int ms_epfd;
+    struct epoll_event* ms_events;
+    int ms_maxevents;
+    int64_t ms_timeout_us;
+} ms_ocall_epoll_wait_t;
+
 typedef struct {
     const char* ms_oldpath;
     const char* ms_newpath;
@@ -288,6 +396,10 @@ typedef struct {
     void* ms_addr;
 } ms_ocall_debug_map_remove_t;
 
+typedef struct {
+    const char* ms_phase;
+} ms_ocall_startup_trace_t;
+
 typedef struct {
     unsigned int ms_initval;
     int          ms_flags;
@@ -303,4 +415,71 @@ typedef struct {
     size_t            ms_quote_len;
 } ms_ocall_get_quote_t;
 
+typedef struct {
+    uint64_t ocall_index; /* only OCALL_READ, OCALL_WRITE, OCALL_PREAD and OCALL_PWRITE allowed */
+    void* ms;             /* marshalled arguments of the corresponding OCALL */
+    long result;          /* return value of the corresponding OCALL */
+} ocall_batch_entry_t;
+
+typedef struct {
+    uint64_t ms_count;
+    ocall_batch_entry_t* ms_entries;
+} ms_ocall_batch_t;
+
+typedef struct {
+    uint64_t ms_addr;
+    size_t ms_size;
+    uint64_t ms_prot;
+} ms_ocall_edmm_restrict_pages_perm_t;
+
+typedef struct {
+    uint64_t ms_addr;
+    size_t ms_size;
+    uint64_t ms_type;
+} ms_ocall_edmm_modify_pages_type_t;
+
+typedef struct {
+    uint64_t ms_addr;
+    size_t ms_size;
+} ms_ocall_edmm_remove_pages_t;
+
 #pragma pack(pop)
+
+/* Rings of a socket that is served by an untrusted proxy thread (see OCALL_SOCK_RING_START). They
+ * are not OCALL arguments but live in untrusted memory shared by enclave threads and the proxy
+ * thread, so they keep natural alignment: queue indices and `tid` are futex words. Each queue has
+ * a single producer that writes `tail` and the slots it publishes, and a single consumer that
+ * writes `head`; on the enclave side, several threads take turns under a lock. */
+#define SOCK_RING_SLOTS     32    /* must be a power of 2 */
+#define SOCK_RING_SLOT_SIZE 65536 /* large enough for any UDP datagram */
+#define SOCK_RING_RX_STOPPED 1    /* `err` of the last rx slot published after `rx_stop` */
+
+struct sock_ring_slot {
+    uint32_t len;     /* bytes in `data`; zero with zero `err` means end of stream for TCP */
+    int32_t err;      /* rx only: negated errno of a failed receive, or zero */
+    uint32_t addrlen; /* UDP only: size of the peer address in `addr` (none on connected UDP) */
+    struct sockaddr_storage addr;
+    char data[SOCK_RING_SLOT_SIZE];
+};
+
+struct sock_ring_queue {
+    uint32_t tail __attribute__((aligned(64))); /* slots published by the producer */
+    uint32_t head __attribute__((aligned(64))); /* slots released by the consumer */
+    uint32_t waiters; /* set by enclave threads about to sleep on `tail` (rx) or `head` (tx) */
+    struct sock_ring_slot slots[SOCK_RING_SLOTS];
+};
+
+struct sock_ring {
+    struct sock_ring_queue rx; /* filled by the proxy from the host socket */
+    struct sock_ring_queue tx; /* filled by the enclave, sent to the host socket by the proxy */
+    uint32_t stop __attribute__((aligned(64))); /* asks the proxy to flush tx and exit */
+    uint32_t rx_stop; /* asks the proxy to stop receiving, see SOCK_RING_RX_STOPPED */
+    uint32_t asleep;  /* set while the proxy is blocked in the host; tx producers then kick it */
+    int32_t tx_err;   /* TCP only: negated errno of a failed send, reported by later sends */
+    int tid;          /* proxy thread ID, cleared by the host kernel once the thread is gone */
+    int kickfd;       /* eventfd that wakes the proxy from its idle wait */
+    int sockfd;
+    int bellfd;       /* eventfd kept readable by the proxy while `rx` is not empty */
+    bool stream;
+    uint64_t budget_us; /* how long the proxy keeps spinning after the last transfer */
+};
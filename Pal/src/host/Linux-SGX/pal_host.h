@@ -69,6 +69,8 @@ typedef struct pal_handle {
             PAL_SESSION_KEY session_key;
             PAL_NUM handshake_done;
             void* ssl_ctx;
+            void* local;        /* in-enclave channel if the other end is in this enclave */
+            PAL_IDX local_side; /* index of this end in the channel */
         } pipe;
 
         struct {
@@ -93,13 +95,22 @@ typedef struct pal_handle {
             PAL_PTR buf;
             PAL_PTR ptr;
             PAL_PTR end;
+            /* stat records of the dirents in `buf`, filled by ocall_getdents_stat() */
+            PAL_PTR stats;
+            PAL_NUM stats_cnt;
+            PAL_NUM stat_idx;
             PAL_BOL endofstream;
         } dir;
 
         struct {
             PAL_IDX fd;
+            /* host eventfd that is readable while the PAL holds input the host socket no longer
+             * reports: connections in `accepted` (TCPSRV), data in the rx ring of `ring` or in
+             * `parked` (aliases `generic.fds[1]` so that polls and wait sets see it) */
+            PAL_IDX bell;
             PAL_PTR bind;
             PAL_PTR conn;
+            void* accepted; /* TCPSRV only: connections accepted ahead by tcp_accept() */
             PAL_BOL nonblocking;
             PAL_NUM linger;
             PAL_NUM receivebuf;
@@ -109,6 +120,9 @@ typedef struct pal_handle {
             PAL_BOL tcp_cork;
             PAL_BOL tcp_keepalive;
             PAL_BOL tcp_nodelay;
+            PAL_NUM busy_poll;
+            void* ring; /* rings served by an untrusted proxy thread, see db_sockets.c */
+            void* parked; /* input handed over by the sending process, see db_sockets.c */
         } sock;
 
         struct {
@@ -137,6 +151,14 @@ typedef struct pal_handle {
              * word on the untrusted host. */
             uint32_t* signaled_untrusted;
         } event;
+
+        struct {
+            PAL_IDX fd; /* host epoll instance */
+            /* Guards `entries`, the trusted registrations indexed by host FD (see db_object.c). */
+            spinlock_t lock;
+            PAL_PTR entries;
+            PAL_NUM entries_cnt;
+        } waitset;
     };
 }* PAL_HANDLE;
 
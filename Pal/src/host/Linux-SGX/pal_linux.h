@@ -58,8 +58,15 @@ int init_child_process(PAL_HANDLE* parent, uint64_t* instance_id_ptr);
 #ifdef IN_ENCLAVE
 
 int init_enclave(void);
+
+/* converts PAL_PROT_* flags to EPCM permissions (SGX_SECINFO_FLAGS_*) */
+uint64_t pal_prot_to_sgx_prot(int prot);
 void init_untrusted_slab_mgr(void);
 
+int init_untrusted_io_bufs(size_t prealloc_size, bool huge_pages);
+void* alloc_untrusted_io_buf(size_t size, size_t* alloc_size);
+void free_untrusted_io_buf(void* addr, size_t alloc_size);
+
 extern const size_t g_page_size;
 extern size_t g_pal_internal_mem_size;
 
@@ -78,13 +85,37 @@ extern char __text_start, __text_end, __data_start, __data_end;
 #define DATA_START ((void*)(&__data_start))
 #define DATA_END   ((void*)(&__data_end))
 
+/* MAP_FIXED_NOREPLACE is fairly new and might not be defined */
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
+
+/* map allowed files outside of the enclave without copying, see `sgx.zero_copy_allowed_files` */
+int pal_file_map_untrusted(PAL_HANDLE handle, PAL_PTR* addr, PAL_NUM offset, PAL_NUM size);
+
+/* serve all connected sockets through untrusted proxy threads, see `sgx.socket_rings` */
+extern bool g_sock_rings_enabled;
+
+/* report startup phases to the host, see `sgx.startup_trace` */
+extern bool g_startup_trace_enabled;
+
+/* print enclave-side stats (peak heap usage, used trusted files) on exit, see `sgx.enable_stats` */
+extern bool g_enclave_stats_enabled;
+
+/* TCS slots of the enclave: `sgx.thread_num` are created with it, with EDMM more are added on
+ * demand up to `sgx.max_threads` */
+extern uint32_t g_enclave_tcs_cnt;
+extern uint32_t g_enclave_max_tcs_cnt;
+
 extern int g_xsave_enabled;
 extern uint64_t g_xsave_features;
 extern uint32_t g_xsave_size;
+extern int g_xsave_xinuse;
 #define XSAVE_RESET_STATE_SIZE (512 + 64)  // 512 for legacy regs, 64 for xsave header
 extern const uint32_t g_xsave_reset_state[];
 
 void init_xsave_size(uint64_t xfrm);
+void init_xsave_xinuse(void);
 void save_xregs(PAL_XREGS_STATE* xsave_area);
 void restore_xregs(const PAL_XREGS_STATE* xsave_area);
 noreturn void _restore_sgx_context(sgx_cpu_context_t* uc, PAL_XREGS_STATE* xsave_area);
@@ -177,6 +208,11 @@ int _DkStreamSecureWrite(LIB_SSL_CONTEXT* ssl_ctx, const uint8_t* buf, size_t le
                          bool is_blocking);
 int _DkStreamSecureSave(LIB_SSL_CONTEXT* ssl_ctx, const uint8_t** obuf, size_t* olen);
 
+void pipe_local_watch(PAL_HANDLE handle, bool watch);
+int pipe_local_demote(PAL_HANDLE handle);
+int sock_handover_input(PAL_HANDLE handle, void** out_data, size_t* out_size);
+int sock_park_input(PAL_HANDLE handle, const void* data, size_t size);
+
 #endif /* IN_ENCLAVE */
 
 #endif /* PAL_LINUX_H */
@@ -7,6 +7,8 @@
 #define ALT_STACK_SIZE    (PRESET_PAGESIZE * 16)  /* 64KB untrusted signal stack */
 #define RPC_STACK_SIZE    (PRESET_PAGESIZE * 2)
 
+#define HUGE_PAGE_SIZE (PRESET_PAGESIZE * 512) /* 2MB host huge page, see `sgx.untrusted_huge_pages` */
+
 /* one SSA frame stores all GPRs + enabled XSAVE area + SGX.SSA.MISC region + padding; we
  * overapproximate to 4 pages which is enough for even feature-rich Intel CPUs from year 2021 */
 #define SSA_FRAME_SIZE (PRESET_PAGESIZE * 4)
@@ -25,10 +25,18 @@
 #include "uthash.h"
 #endif
 
+enum lruc_queue {
+    LRUC_QUEUE_MAIN,
+    LRUC_QUEUE_PROBATION,
+    LRUC_QUEUE_PINNED,
+    LRUC_QUEUE_NUM,
+};
+
 DEFINE_LIST(_lruc_list_node);
 typedef struct _lruc_list_node {
     LIST_TYPE(_lruc_list_node) list;
     uint64_t key;
+    enum lruc_queue queue;
 } lruc_list_node_t;
 DEFINE_LISTP(_lruc_list_node);
 
@@ -40,22 +48,31 @@ typedef struct _lruc_map_node {
 } lruc_map_node_t;
 
 struct lruc_context {
-    /* list and map both contain the same objects (list contains keys, map contains actual data).
-     * They're kept in sync so that map is used for fast lookups and list is used for fast LRU.
+    /* lists and map contain the same objects (lists contain keys, map contains actual data).
+     * They're kept in sync so that map is used for fast lookups and lists are used for fast LRU.
+     * Each list is ordered from the most to the least recently used object.
      */
-    LISTP_TYPE(_lruc_list_node) list;
+    LISTP_TYPE(_lruc_list_node) queues[LRUC_QUEUE_NUM];
+    size_t queue_sizes[LRUC_QUEUE_NUM];
+    lruc_policy_t policy;
+    size_t probation_limit;
     lruc_map_node_t* map;
     lruc_list_node_t* current; /* current head of the cache */
 };
 
-lruc_context_t* lruc_create(void) {
+lruc_context_t* lruc_create(lruc_policy_t policy, size_t probation_limit) {
     lruc_context_t* lruc = calloc(1, sizeof(*lruc));
     if (!lruc)
         return NULL;
 
-    INIT_LISTP(&lruc->list);
-    lruc->map     = NULL;
-    lruc->current = NULL;
+    for (size_t i = 0; i < LRUC_QUEUE_NUM; i++) {
+        INIT_LISTP(&lruc->queues[i]);
+        lruc->queue_sizes[i] = 0;
+    }
+    lruc->policy          = policy;
+    lruc->probation_limit = probation_limit;
+    lruc->map             = NULL;
+    lruc->current         = NULL;
     return lruc;
 }
 
@@ -65,27 +82,41 @@ static lruc_map_node_t* get_map_node(lruc_context_t* lruc, uint64_t key) {
     return mn;
 }
 
+static void queue_add(lruc_context_t* lruc, lruc_list_node_t* ln, enum lruc_queue queue) {
+    ln->queue = queue;
+    LISTP_ADD(ln, &lruc->queues[queue], list);
+    lruc->queue_sizes[queue]++;
+}
+
+static void queue_del(lruc_context_t* lruc, lruc_list_node_t* ln) {
+    assert(lruc->queue_sizes[ln->queue] > 0);
+    LISTP_DEL(ln, &lruc->queues[ln->queue], list);
+    lruc->queue_sizes[ln->queue]--;
+}
+
 void lruc_destroy(lruc_context_t* lruc) {
     struct _lruc_list_node* ln;
     struct _lruc_list_node* tmp;
     lruc_map_node_t* mn;
 
-    LISTP_FOR_EACH_ENTRY_SAFE(ln, tmp, &lruc->list, list) {
-        mn = get_map_node(lruc, ln->key);
-        if (mn) {
-            HASH_DEL(lruc->map, mn);
-            free(mn);
+    for (size_t i = 0; i < LRUC_QUEUE_NUM; i++) {
+        LISTP_FOR_EACH_ENTRY_SAFE(ln, tmp, &lruc->queues[i], list) {
+            mn = get_map_node(lruc, ln->key);
+            if (mn) {
+                HASH_DEL(lruc->map, mn);
+                free(mn);
+            }
+            queue_del(lruc, ln);
+            free(ln);
         }
-        LISTP_DEL(ln, &lruc->list, list);
-        free(ln);
+        assert(LISTP_EMPTY(&lruc->queues[i]));
     }
 
-    assert(LISTP_EMPTY(&lruc->list));
     assert(HASH_COUNT(lruc->map) == 0);
     free(lruc);
 }
 
-bool lruc_add(lruc_context_t* lruc, uint64_t key, void* data) {
+static bool add_to_queue(lruc_context_t* lruc, uint64_t key, void* data, enum lruc_queue queue) {
     if (get_map_node(lruc, key))
         return false;
 
@@ -101,13 +132,23 @@ bool lruc_add(lruc_context_t* lruc, uint64_t key, void* data) {
 
     list_node->key = key;
     map_node->key = key;
-    LISTP_ADD(list_node, &lruc->list, list);
+    queue_add(lruc, list_node, queue);
     map_node->data     = data;
     map_node->list_ptr = list_node;
     HASH_ADD(hh, lruc->map, key, sizeof(key), map_node);
     return true;
 }
 
+bool lruc_add(lruc_context_t* lruc, uint64_t key, void* data) {
+    return add_to_queue(lruc, key, data,
+                        lruc->policy == LRUC_POLICY_2Q ? LRUC_QUEUE_PROBATION : LRUC_QUEUE_MAIN);
+}
+
+bool lruc_add_pinned(lruc_context_t* lruc, uint64_t key, void* data) {
+    return add_to_queue(lruc, key, data,
+                        lruc->policy == LRUC_POLICY_2Q ? LRUC_QUEUE_PINNED : LRUC_QUEUE_MAIN);
+}
+
 void* lruc_find(lruc_context_t* lruc, uint64_t key) {
     lruc_map_node_t* mn = get_map_node(lruc, key);
     if (mn)
@@ -121,9 +162,10 @@ void* lruc_get(lruc_context_t* lruc, uint64_t key) {
         return NULL;
     lruc_list_node_t* ln = mn->list_ptr;
     assert(ln != NULL);
-    // move node to the front of the list
-    LISTP_DEL(ln, &lruc->list, list);
-    LISTP_ADD(ln, &lruc->list, list);
+    // move node to the front of its list; objects on probation are promoted to the main list
+    enum lruc_queue queue = ln->queue == LRUC_QUEUE_PROBATION ? LRUC_QUEUE_MAIN : ln->queue;
+    queue_del(lruc, ln);
+    queue_add(lruc, ln, queue);
     return mn->data;
 }
 
@@ -131,21 +173,34 @@ size_t lruc_size(lruc_context_t* lruc) {
     return HASH_COUNT(lruc->map);
 }
 
+/* iteration goes over the main, probation and pinned lists, in this order */
+static lruc_list_node_t* first_in_queues_from(lruc_context_t* lruc, size_t queue) {
+    for (; queue < LRUC_QUEUE_NUM; queue++) {
+        if (!LISTP_EMPTY(&lruc->queues[queue]))
+            return LISTP_FIRST_ENTRY(&lruc->queues[queue], /*unused*/ 0, list);
+    }
+    return NULL;
+}
+
 void* lruc_get_first(lruc_context_t* lruc) {
-    if (LISTP_EMPTY(&lruc->list))
+    lruc->current = first_in_queues_from(lruc, 0);
+    if (!lruc->current)
         return NULL;
 
-    lruc->current = LISTP_FIRST_ENTRY(&lruc->list, /*unused*/ 0, list);
     lruc_map_node_t* mn = get_map_node(lruc, lruc->current->key);
     assert(mn != NULL);
     return mn ? mn->data : NULL;
 }
 
 void* lruc_get_next(lruc_context_t* lruc) {
-    if (LISTP_EMPTY(&lruc->list) || !lruc->current)
+    if (!lruc->current)
         return NULL;
 
-    lruc->current = LISTP_NEXT_ENTRY(lruc->current, &lruc->list, list);
+    lruc_list_node_t* next = LISTP_NEXT_ENTRY(lruc->current, &lruc->queues[lruc->current->queue],
+                                              list);
+    if (!next)
+        next = first_in_queues_from(lruc, lruc->current->queue + 1);
+    lruc->current = next;
     if (!lruc->current)
         return NULL;
 
@@ -154,22 +209,40 @@ void* lruc_get_next(lruc_context_t* lruc) {
     return mn ? mn->data : NULL;
 }
 
+/* returns the list node of the object to be evicted next */
+static lruc_list_node_t* get_victim(lruc_context_t* lruc) {
+    enum lruc_queue queue;
+    if (lruc->queue_sizes[LRUC_QUEUE_PROBATION] > lruc->probation_limit ||
+            (lruc->queue_sizes[LRUC_QUEUE_PROBATION] && !lruc->queue_sizes[LRUC_QUEUE_MAIN])) {
+        queue = LRUC_QUEUE_PROBATION;
+    } else if (lruc->queue_sizes[LRUC_QUEUE_MAIN]) {
+        queue = LRUC_QUEUE_MAIN;
+    } else if (lruc->queue_sizes[LRUC_QUEUE_PINNED]) {
+        queue = LRUC_QUEUE_PINNED;
+    } else {
+        return NULL;
+    }
+    return LISTP_LAST_ENTRY(&lruc->queues[queue], /*unused*/ 0, list);
+}
+
 void* lruc_get_last(lruc_context_t* lruc) {
-    if (LISTP_EMPTY(&lruc->list))
+    lruc_list_node_t* ln = get_victim(lruc);
+    if (!ln)
         return NULL;
 
-    lruc_list_node_t* ln = LISTP_LAST_ENTRY(&lruc->list, /*unused*/ 0, list);
     lruc_map_node_t* mn = get_map_node(lruc, ln->key);
     assert(mn != NULL);
     return mn ? mn->data : NULL;
 }
 
 void lruc_remove_last(lruc_context_t* lruc) {
-    if (LISTP_EMPTY(&lruc->list))
+    lruc_list_node_t* ln = get_victim(lruc);
+    if (!ln)
         return;
 
-    lruc_list_node_t* ln = LISTP_LAST_ENTRY(&lruc->list, /*unused*/ 0, list);
-    LISTP_DEL(ln, &lruc->list, list);
+    if (lruc->current == ln)
+        lruc->current = NULL;
+    queue_del(lruc, ln);
     lruc_map_node_t* mn = get_map_node(lruc, ln->key);
     assert(mn != NULL);
     if (mn)
@@ -17,17 +17,30 @@
 struct lruc_context;
 typedef struct lruc_context lruc_context_t;
 
-lruc_context_t* lruc_create(void);
+typedef enum {
+    /* plain LRU: all objects are kept in a single queue (pinned objects are not special) */
+    LRUC_POLICY_LRU,
+    /* simplified 2Q: added objects first go to a probation queue and move to the main queue only
+     * when accessed again, so that objects touched once (e.g. by a sequential scan) are evicted
+     * before the frequently used ones; pinned objects are evicted only when both queues are
+     * empty */
+    LRUC_POLICY_2Q,
+} lruc_policy_t;
+
+/* `probation_limit` is the number of objects in the probation queue above which objects are
+ * evicted from it rather than from the main queue (only used by LRUC_POLICY_2Q) */
+lruc_context_t* lruc_create(lruc_policy_t policy, size_t probation_limit);
 void lruc_destroy(lruc_context_t* context);
 bool lruc_add(lruc_context_t* context, uint64_t key, void* data); // key must not already exist
+bool lruc_add_pinned(lruc_context_t* context, uint64_t key, void* data); // same as above
 void* lruc_get(lruc_context_t* context, uint64_t key);
 void* lruc_find(lruc_context_t* context,
                 uint64_t key); // only returns the object, does not bump it to the head
 size_t lruc_size(lruc_context_t* context);
 void* lruc_get_first(lruc_context_t* context);
 void* lruc_get_next(lruc_context_t* context);
-void* lruc_get_last(lruc_context_t* context);
-void lruc_remove_last(lruc_context_t* context);
+void* lruc_get_last(lruc_context_t* context); // returns the object to be evicted next
+void lruc_remove_last(lruc_context_t* context); // evicts the object returned by lruc_get_last()
 
 void lruc_test(void);
 
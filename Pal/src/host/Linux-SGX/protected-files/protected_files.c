@@ -17,10 +17,12 @@
 #include "protected_files_internal.h"
 
 #include "api.h"
+#include "cpu.h"
 
 /* Host callbacks */
 static pf_read_f     g_cb_read     = NULL;
 static pf_write_f    g_cb_write    = NULL;
+static pf_write_batch_f g_cb_write_batch = NULL;
 static pf_truncate_f g_cb_truncate = NULL;
 static pf_debug_f    g_cb_debug    = NULL;
 
@@ -29,6 +31,13 @@ static pf_aes_gcm_encrypt_f g_cb_aes_gcm_encrypt = NULL;
 static pf_aes_gcm_decrypt_f g_cb_aes_gcm_decrypt = NULL;
 static pf_random_f          g_cb_random          = NULL;
 
+/* Node cache parameters, see pf_set_cache_params() */
+static size_t            g_cache_max_nodes = PF_DEFAULT_CACHE_NODES;
+static pf_cache_policy_t g_cache_policy    = PF_CACHE_POLICY_2Q;
+
+/* Data node size of new files, see pf_set_data_node_size() */
+static uint32_t g_data_node_size = PF_NODE_SIZE;
+
 #ifdef DEBUG
 #define PF_DEBUG_PRINT_SIZE_MAX 4096
 
@@ -78,6 +87,7 @@ static const char* g_pf_error_list[] = {
     [-PF_STATUS_CRYPTO_ERROR] = "Crypto error",
     [-PF_STATUS_CORRUPTED] = "File is corrupted",
     [-PF_STATUS_WRITE_TO_DISK_FAILED] = "Write to disk failed",
+    [-PF_STATUS_FILE_CHANGED] = "File changed on disk",
 };
 
 const char* pf_strerror(int err) {
@@ -168,6 +178,9 @@ static bool ipf_init_fields(pf_context_t* pf) {
     memset(&pf->root_mht, 0, sizeof(pf->root_mht));
 
     pf->root_mht.type                 = FILE_MHT_NODE_TYPE;
+    pf->root_mht.node_size            = PF_NODE_SIZE;
+    pf->root_mht.encrypted            = pf->root_mht_buffers;
+    pf->root_mht.decrypted.mht        = (mht_node_t*)(pf->root_mht_buffers + PF_NODE_SIZE);
     pf->root_mht.physical_node_number = 1;
     pf->root_mht.node_number          = 0;
     pf->root_mht.new_node             = true;
@@ -180,8 +193,33 @@ static bool ipf_init_fields(pf_context_t* pf) {
     pf->file_status    = PF_STATUS_UNINITIALIZED;
     pf->last_error     = PF_STATUS_SUCCESS;
     pf->real_file_size = 0;
+    pf->data_node_size = g_data_node_size; // for existing files, replaced by their node size
+
+    pf->read_ahead_next_node = 0; // physical node 0 is the metadata node, it never matches
+    pf->lock_state        = 0;
+    pf->exclusive_waiters = 0;
+    pf->cache_lock        = 0;
+
+    INIT_LISTP(&pf->dirty_nodes);
+    pf->dirty_count  = 0;
+    pf->dirty_sorted = true;
+    return true;
+}
 
-    pf->cache = lruc_create();
+/* creates the node cache once the data node size of the file is known: the cache limit is set in
+ * PF_NODE_SIZE nodes, so that it bounds the memory used by the cache regardless of the node size */
+static bool ipf_init_cache(pf_context_t* pf) {
+    pf->cache_max_nodes = MAX(g_cache_max_nodes / (pf->data_node_size / PF_NODE_SIZE),
+                              MIN(g_cache_max_nodes, PF_MIN_CACHE_NODES));
+
+    /* MHT nodes are needed to access any of their data nodes, so they are pinned in the cache
+     * ahead of data nodes */
+    pf->cache = lruc_create(g_cache_policy == PF_CACHE_POLICY_2Q ? LRUC_POLICY_2Q : LRUC_POLICY_LRU,
+                            /*probation_limit=*/pf->cache_max_nodes / 4);
+    if (!pf->cache) {
+        pf->last_error = PF_STATUS_NO_MEMORY;
+        return false;
+    }
     return true;
 }
 
@@ -244,6 +282,9 @@ static pf_context_t* ipf_open(const char* path, pf_file_mode_t mode, bool create
             goto out;
     }
 
+    if (!ipf_init_cache(pf))
+        goto out;
+
     pf->last_error = pf->file_status = PF_STATUS_SUCCESS;
     DEBUG_PF("OK (data size %lu)\n", pf->encrypted_part_plain.size);
 
@@ -260,9 +301,10 @@ out:
     return pf;
 }
 
+/* reads/writes the first `node_size` bytes of the slot of physical node `node_number` */
 static bool ipf_read_node(pf_context_t* pf, pf_handle_t handle, uint64_t node_number, void* buffer,
                           uint32_t node_size) {
-    uint64_t offset = node_number * node_size;
+    uint64_t offset = node_number * pf->data_node_size;
 
     pf_status_t status = g_cb_read(handle, buffer, offset, node_size);
     if (PF_FAILURE(status)) {
@@ -286,7 +328,7 @@ static bool ipf_write_file(pf_context_t* pf, pf_handle_t handle, uint64_t offset
 
 static bool ipf_write_node(pf_context_t* pf, pf_handle_t handle, uint64_t node_number, void* buffer,
                            uint32_t node_size) {
-    return ipf_write_file(pf, handle, node_number * node_size, buffer, node_size);
+    return ipf_write_file(pf, handle, node_number * pf->data_node_size, buffer, node_size);
 }
 
 static bool ipf_init_existing_file(pf_context_t* pf, const char* path) {
@@ -304,17 +346,33 @@ static bool ipf_init_existing_file(pf_context_t* pf, const char* path) {
         return false;
     }
 
-    if (pf->file_metadata.plain_part.major_version != PF_MAJOR_VERSION) {
+    if (pf->file_metadata.plain_part.major_version != PF_MAJOR_VERSION
+            || pf->file_metadata.plain_part.minor_version > PF_MINOR_VERSION_NODE_SIZE) {
         pf->last_error = PF_STATUS_INVALID_VERSION;
         return false;
     }
 
+    // the data node size is authenticated below, as additional data of the metadata decryption
+    const void* aad = NULL;
+    uint32_t aad_size = 0;
+    pf->data_node_size = PF_NODE_SIZE;
+    if (pf->file_metadata.plain_part.minor_version == PF_MINOR_VERSION_NODE_SIZE) {
+        uint32_t size = pf->file_metadata.data_node_size;
+        if (size <= PF_NODE_SIZE || size > PF_MAX_DATA_NODE_SIZE || (size & (size - 1))) {
+            pf->last_error = PF_STATUS_INVALID_HEADER;
+            return false;
+        }
+        pf->data_node_size = size;
+        aad = &pf->file_metadata.data_node_size;
+        aad_size = sizeof(pf->file_metadata.data_node_size);
+    }
+
     pf_key_t key;
     if (!ipf_restore_current_metadata_key(pf, &key))
         return false;
 
     // decrypt the encrypted part of the meta-data
-    status = g_cb_aes_gcm_decrypt(&key, &g_empty_iv, NULL, 0,
+    status = g_cb_aes_gcm_decrypt(&key, &g_empty_iv, aad, aad_size,
                                   &pf->file_metadata.encrypted_part,
                                   sizeof(pf->file_metadata.encrypted_part),
                                   &pf->encrypted_part_plain,
@@ -338,15 +396,15 @@ static bool ipf_init_existing_file(pf_context_t* pf, const char* path) {
 
     if (pf->encrypted_part_plain.size > MD_USER_DATA_SIZE) {
         // read the root node of the mht
-        if (!ipf_read_node(pf, pf->file, /*node_number=*/1, &pf->root_mht.encrypted.cipher,
+        if (!ipf_read_node(pf, pf->file, /*node_number=*/1, pf->root_mht.encrypted,
                            PF_NODE_SIZE))
             return false;
 
         // this also verifies the root mht gmac against the gmac in the meta-data encrypted part
         status = g_cb_aes_gcm_decrypt(&pf->encrypted_part_plain.mht_key, &g_empty_iv,
                                       NULL, 0, // aad
-                                      &pf->root_mht.encrypted.cipher, PF_NODE_SIZE,
-                                      &pf->root_mht.decrypted.mht,
+                                      pf->root_mht.encrypted, PF_NODE_SIZE,
+                                      pf->root_mht.decrypted.mht,
                                       &pf->encrypted_part_plain.mht_gmac);
         if (PF_FAILURE(status)) {
             pf->last_error = status;
@@ -363,6 +421,11 @@ static bool ipf_init_new_file(pf_context_t* pf, const char* path) {
     pf->file_metadata.plain_part.file_id       = PF_FILE_ID;
     pf->file_metadata.plain_part.major_version = PF_MAJOR_VERSION;
     pf->file_metadata.plain_part.minor_version = PF_MINOR_VERSION;
+    // files with the default node size keep the original format, readable by older versions
+    if (pf->data_node_size != PF_NODE_SIZE) {
+        pf->file_metadata.plain_part.minor_version = PF_MINOR_VERSION_NODE_SIZE;
+        pf->file_metadata.data_node_size = pf->data_node_size;
+    }
 
     // path length is checked in ipf_open()
     memcpy(pf->encrypted_part_plain.path, path, strlen(path) + 1);
@@ -390,9 +453,7 @@ static bool ipf_close(pf_context_t* pf) {
     pf->file_status = PF_STATUS_UNINITIALIZED;
 
     while ((data = lruc_get_last(pf->cache)) != NULL) {
-        file_node_t* file_node = (file_node_t*)data;
-        erase_memory(&file_node->decrypted, sizeof(file_node->decrypted));
-        free(file_node);
+        ipf_free_node((file_node_t*)data);
         lruc_remove_last(pf->cache);
     }
 
@@ -459,9 +520,9 @@ static size_t partition(file_node_t** data, size_t low, size_t high) {
     size_t j = high;
 
     while (true) {
-        while (data[i]->node_number < pivot->node_number)
+        while (data[i]->physical_node_number < pivot->physical_node_number)
             i++;
-        while (data[j]->node_number > pivot->node_number)
+        while (data[j]->physical_node_number > pivot->physical_node_number)
             j--;
         if (i >= j)
             return j;
@@ -471,9 +532,11 @@ static size_t partition(file_node_t** data, size_t low, size_t high) {
     }
 }
 
+/* sorts nodes by their position in the file (for nodes of the same type, this is the same as
+ * sorting by node number) */
 static void sort_nodes(file_node_t** data, size_t low, size_t high) {
     if (high - low == 1) {
-        if (data[low]->node_number > data[high]->node_number)
+        if (data[low]->physical_node_number > data[high]->physical_node_number)
             swap_nodes(data, low, high);
         return;
     }
@@ -485,105 +548,123 @@ static void sort_nodes(file_node_t** data, size_t low, size_t high) {
     }
 }
 
-static bool ipf_update_all_data_and_mht_nodes(pf_context_t* pf) {
-    bool ret = false;
-    file_node_t** mht_array = NULL;
-    file_node_t* file_mht_node;
-    pf_status_t status;
-    void* data = lruc_get_first(pf->cache);
+/* marks a node as needing to be written; appends keep the dirty list ordered by position in the
+ * file, other writes make the next flush sort it */
+static void ipf_mark_dirty(pf_context_t* pf, file_node_t* node) {
+    assert(!node->need_writing && node != &pf->root_mht);
 
-    // 1. encrypt the changed data
-    // 2. set the IV+GMAC in the parent MHT
-    // [3. set the need_writing flag for all the parents]
-    while (data != NULL) {
-        if (((file_node_t*)data)->type == FILE_DATA_NODE_TYPE) {
-            file_node_t* data_node = (file_node_t*)data;
+    if (!LISTP_EMPTY(&pf->dirty_nodes)) {
+        file_node_t* last = LISTP_LAST_ENTRY(&pf->dirty_nodes, file_node_t, list);
+        if (last->physical_node_number > node->physical_node_number)
+            pf->dirty_sorted = false;
+    }
 
-            if (data_node->need_writing) {
-                gcm_crypto_data_t* gcm_crypto_data =
-                    &data_node->parent->decrypted.mht
-                         .data_nodes_crypto[data_node->node_number % ATTACHED_DATA_NODES_COUNT];
+    node->need_writing = true;
+    LISTP_ADD_TAIL(node, &pf->dirty_nodes, list);
+    pf->dirty_count++;
+}
 
-                if (!ipf_generate_random_key(pf, &gcm_crypto_data->key))
-                    goto out;
+static void ipf_mark_clean(pf_context_t* pf, file_node_t* node) {
+    assert(node->need_writing);
 
-                // encrypt the data, this also saves the gmac of the operation in the mht crypto
-                // node
-                status = g_cb_aes_gcm_encrypt(&gcm_crypto_data->key, &g_empty_iv, NULL, 0,  // aad
-                                              data_node->decrypted.data.data, PF_NODE_SIZE,
-                                              data_node->encrypted.cipher, &gcm_crypto_data->gmac);
-                if (PF_FAILURE(status)) {
-                    pf->last_error = status;
-                    goto out;
-                }
+    node->need_writing = false;
+    node->new_node = false;
+    LISTP_DEL_INIT(node, &pf->dirty_nodes, list);
+    pf->dirty_count--;
+}
 
-                file_mht_node = data_node->parent;
-#ifdef DEBUG
-                // this loop should do nothing, add it here just to be safe
-                while (file_mht_node->node_number != 0) {
-                    assert(file_mht_node->need_writing == true);
-                    file_mht_node = file_mht_node->parent;
-                }
-#endif
-            }
+/* marks a data node and all its MHT parents as needing to be written, parents first (they precede
+ * their children in the file, so appends don't break the order of the dirty list) */
+static void ipf_mark_path_dirty(pf_context_t* pf, file_node_t* file_data_node) {
+    while (!file_data_node->need_writing) {
+        file_node_t* topmost_clean = file_data_node;
+        for (file_node_t* node = file_data_node->parent; node != &pf->root_mht;
+                node = node->parent) {
+            if (!node->need_writing)
+                topmost_clean = node;
         }
-        data = lruc_get_next(pf->cache);
+        ipf_mark_dirty(pf, topmost_clean);
     }
+    pf->root_mht.need_writing = true;
+    pf->need_writing = true;
+}
 
-    size_t dirty_count = 0;
+/* returns an array of the dirty nodes ordered by their position in the file (the dirty list is
+ * re-linked in that order if it wasn't already) */
+static file_node_t** ipf_get_sorted_dirty_nodes(pf_context_t* pf) {
+    assert(pf->dirty_count > 0);
 
-    // count dirty mht nodes
-    data = lruc_get_first(pf->cache);
-    while (data != NULL) {
-        if (((file_node_t*)data)->type == FILE_MHT_NODE_TYPE) {
-            if (((file_node_t*)data)->need_writing)
-                dirty_count++;
-        }
-        data = lruc_get_next(pf->cache);
-    }
-
-    // add all the mht nodes that needs writing to a list
-    mht_array = malloc(dirty_count * sizeof(*mht_array));
-    if (!mht_array) {
+    file_node_t** dirty = malloc(pf->dirty_count * sizeof(*dirty));
+    if (!dirty) {
         pf->last_error = PF_STATUS_NO_MEMORY;
-        goto out;
+        return NULL;
     }
 
-    data = lruc_get_first(pf->cache);
-    uint64_t dirty_idx = 0;
-    while (data != NULL) {
-        if (((file_node_t*)data)->type == FILE_MHT_NODE_TYPE) {
-            file_mht_node = (file_node_t*)data;
+    size_t dirty_idx = 0;
+    file_node_t* node;
+    LISTP_FOR_EACH_ENTRY(node, &pf->dirty_nodes, list) {
+        dirty[dirty_idx++] = node;
+    }
+    assert(dirty_idx == pf->dirty_count);
 
-            if (file_mht_node->need_writing)
-                mht_array[dirty_idx++] = file_mht_node;
-        }
+    if (!pf->dirty_sorted) {
+        sort_nodes(dirty, 0, pf->dirty_count - 1);
+        INIT_LISTP(&pf->dirty_nodes);
+        for (dirty_idx = 0; dirty_idx < pf->dirty_count; dirty_idx++)
+            LISTP_ADD_TAIL(dirty[dirty_idx], &pf->dirty_nodes, list);
+        pf->dirty_sorted = true;
+    }
+    return dirty;
+}
 
-        data = lruc_get_next(pf->cache);
+/* encrypts a data or (non-root) MHT node with a new random key, saving the key and the gmac in its
+ * parent MHT node */
+static bool ipf_encrypt_node(pf_context_t* pf, file_node_t* node) {
+    gcm_crypto_data_t* gcm_crypto_data;
+    if (node->type == FILE_DATA_NODE_TYPE) {
+        gcm_crypto_data = &node->parent->decrypted.mht
+                               ->data_nodes_crypto[node->node_number % ATTACHED_DATA_NODES_COUNT];
+    } else {
+        gcm_crypto_data = &node->parent->decrypted.mht
+                               ->mht_nodes_crypto[(node->node_number - 1) % CHILD_MHT_NODES_COUNT];
     }
 
-    if (dirty_count > 0)
-        sort_nodes(mht_array, 0, dirty_count - 1);
+#ifdef DEBUG
+    // the new gmac changes the parent, so it must be written too
+    for (file_node_t* parent = node->parent; parent != &pf->root_mht; parent = parent->parent)
+        assert(parent->need_writing == true);
+#endif
+
+    if (!ipf_generate_random_key(pf, &gcm_crypto_data->key))
+        return false;
 
-    // update the gmacs in the parents from last node to first (bottom layers first)
-    for (dirty_idx = dirty_count; dirty_idx > 0; dirty_idx--) {
-        file_mht_node = mht_array[dirty_idx - 1];
+    pf_status_t status = g_cb_aes_gcm_encrypt(&gcm_crypto_data->key, &g_empty_iv, NULL, 0, // aad
+                                              node->decrypted.data, node->node_size,
+                                              node->encrypted, &gcm_crypto_data->gmac);
+    if (PF_FAILURE(status)) {
+        pf->last_error = status;
+        return false;
+    }
+    return true;
+}
 
-        gcm_crypto_data_t* gcm_crypto_data =
-            &file_mht_node->parent->decrypted.mht
-                 .mht_nodes_crypto[(file_mht_node->node_number - 1) % CHILD_MHT_NODES_COUNT];
+static bool ipf_update_all_data_and_mht_nodes(pf_context_t* pf) {
+    bool ret = false;
+    file_node_t** dirty = NULL;
+    pf_status_t status;
 
-        if (!ipf_generate_random_key(pf, &gcm_crypto_data->key)) {
+    if (pf->dirty_count > 0) {
+        dirty = ipf_get_sorted_dirty_nodes(pf);
+        if (!dirty)
             goto out;
-        }
+    }
 
-        status = g_cb_aes_gcm_encrypt(&gcm_crypto_data->key, &g_empty_iv, NULL, 0,
-                                      &file_mht_node->decrypted.mht, PF_NODE_SIZE,
-                                      &file_mht_node->encrypted.cipher, &gcm_crypto_data->gmac);
-        if (PF_FAILURE(status)) {
-            pf->last_error = status;
+    // encrypt the changed nodes from the end of the file, which updates their IV+GMAC in their
+    // parents: parent MHT nodes precede their data nodes and child MHT nodes in the file, so they
+    // are encrypted only after all their children (bottom layers first)
+    for (size_t dirty_idx = pf->dirty_count; dirty_idx > 0; dirty_idx--) {
+        if (!ipf_encrypt_node(pf, dirty[dirty_idx - 1]))
             goto out;
-        }
     }
 
     // update mht root gmac in the meta data node
@@ -592,8 +673,8 @@ static bool ipf_update_all_data_and_mht_nodes(pf_context_t* pf) {
 
     status = g_cb_aes_gcm_encrypt(&pf->encrypted_part_plain.mht_key, &g_empty_iv,
                                   NULL, 0,
-                                  &pf->root_mht.decrypted.mht, PF_NODE_SIZE,
-                                  &pf->root_mht.encrypted.cipher,
+                                  pf->root_mht.decrypted.mht, PF_NODE_SIZE,
+                                  pf->root_mht.encrypted,
                                   &pf->encrypted_part_plain.mht_gmac);
     if (PF_FAILURE(status)) {
         pf->last_error = status;
@@ -603,7 +684,7 @@ static bool ipf_update_all_data_and_mht_nodes(pf_context_t* pf) {
     ret = true;
 
 out:
-    free(mht_array);
+    free(dirty);
     return ret;
 }
 
@@ -617,8 +698,15 @@ static bool ipf_update_metadata_node(pf_context_t* pf) {
         return false;
     }
 
+    const void* aad = NULL;
+    uint32_t aad_size = 0;
+    if (pf->file_metadata.plain_part.minor_version == PF_MINOR_VERSION_NODE_SIZE) {
+        aad = &pf->file_metadata.data_node_size;
+        aad_size = sizeof(pf->file_metadata.data_node_size);
+    }
+
     // encrypt meta data encrypted part, also updates the gmac in the meta data plain part
-    status = g_cb_aes_gcm_encrypt(&key, &g_empty_iv, NULL, 0, &pf->encrypted_part_plain,
+    status = g_cb_aes_gcm_encrypt(&key, &g_empty_iv, aad, aad_size, &pf->encrypted_part_plain,
                                   sizeof(metadata_encrypted_t), &pf->file_metadata.encrypted_part,
                                   &pf->file_metadata.plain_part.metadata_gmac);
     if (PF_FAILURE(status)) {
@@ -629,31 +717,146 @@ static bool ipf_update_metadata_node(pf_context_t* pf) {
     return true;
 }
 
-static bool ipf_write_all_changes_to_disk(pf_context_t* pf) {
-    if (pf->encrypted_part_plain.size > MD_USER_DATA_SIZE && pf->root_mht.need_writing) {
-        void* data = NULL;
-        uint8_t* data_to_write;
-        uint64_t node_number;
-        file_node_t* file_node;
+#define PF_WRITE_BATCH_MAX 32
 
-        for (data = lruc_get_first(pf->cache); data != NULL; data = lruc_get_next(pf->cache)) {
-            file_node = (file_node_t*)data;
-            if (!file_node->need_writing)
-                continue;
+/* maximum size of data nodes read from disk at once by sequential reads */
+#define PF_READ_AHEAD_MAX_SIZE (64 * PF_NODE_SIZE)
 
-            data_to_write = (uint8_t*)&file_node->encrypted;
-            node_number = file_node->physical_node_number;
+/* maximum size of adjacent dirty nodes written with a single request, and maximum size of the
+ * staging buffer used to make them contiguous */
+#define PF_WRITE_COALESCE_MAX_SIZE (64 * PF_NODE_SIZE)
+#define PF_WRITE_STAGING_MAX_SIZE  (256 * PF_NODE_SIZE)
 
-            if (!ipf_write_node(pf, pf->file, node_number, data_to_write, PF_NODE_SIZE)) {
-                return false;
+/* accumulates node writes and submits them via the batched write callback */
+struct pf_write_batch {
+    pf_write_req_t reqs[PF_WRITE_BATCH_MAX];
+    size_t count;
+};
+
+static bool ipf_write_batch_flush(pf_context_t* pf, struct pf_write_batch* batch) {
+    if (!batch->count)
+        return true;
+
+    pf_status_t status = g_cb_write_batch(pf->file, batch->reqs, batch->count);
+    batch->count = 0;
+    if (PF_FAILURE(status)) {
+        pf->last_error = status;
+        return false;
+    }
+    return true;
+}
+
+static bool ipf_write_batched(pf_context_t* pf, struct pf_write_batch* batch, uint64_t offset,
+                              void* buffer, uint32_t size) {
+    if (!g_cb_write_batch)
+        return ipf_write_file(pf, pf->file, offset, buffer, size);
+
+    if (batch->count == PF_WRITE_BATCH_MAX && !ipf_write_batch_flush(pf, batch))
+        return false;
+
+    batch->reqs[batch->count++] = (pf_write_req_t){
+        .buffer = buffer,
+        .offset = offset,
+        .size   = size,
+    };
+    return true;
+}
+
+static bool ipf_write_node_batched(pf_context_t* pf, struct pf_write_batch* batch,
+                                   uint64_t node_number, void* buffer, uint32_t node_size) {
+    if (!g_cb_write_batch)
+        return ipf_write_node(pf, pf->file, node_number, buffer, node_size);
+
+    return ipf_write_batched(pf, batch, node_number * pf->data_node_size, buffer, node_size);
+}
+
+/* writes dirty data and MHT nodes in the order of their position in the file, coalescing runs of
+ * adjacent nodes into single writes (via a staging buffer, as nodes are not contiguous in memory);
+ * a run may only continue after nodes which fill their slots, i.e. not after MHT nodes of files
+ * with bigger data nodes */
+static bool ipf_write_dirty_nodes(pf_context_t* pf, struct pf_write_batch* batch) {
+    bool ret = false;
+    size_t dirty_count = pf->dirty_count;
+    file_node_t** dirty = NULL;
+    uint8_t* staging = NULL;
+
+    if (!dirty_count)
+        return true;
+
+    // normally already sorted by ipf_update_all_data_and_mht_nodes()
+    dirty = ipf_get_sorted_dirty_nodes(pf);
+    if (!dirty)
+        return false;
+
+    size_t dirty_size = 0;
+    for (size_t i = 0; i < dirty_count; i++)
+        dirty_size += dirty[i]->node_size;
+
+    /* coalescing is only an optimization, so proceed without it if there is no memory */
+    size_t staging_cap = MIN(dirty_size, PF_WRITE_STAGING_MAX_SIZE);
+    staging = malloc(staging_cap);
+    size_t staging_used = 0;
+
+    for (size_t i = 0; i < dirty_count;) {
+        size_t run = 1;
+        size_t run_size = dirty[i]->node_size;
+        while (i + run < dirty_count
+                && dirty[i + run]->physical_node_number == dirty[i]->physical_node_number + run
+                && dirty[i + run - 1]->node_size == pf->data_node_size
+                && run_size + dirty[i + run]->node_size <= PF_WRITE_COALESCE_MAX_SIZE) {
+            run_size += dirty[i + run]->node_size;
+            run++;
+        }
+
+        if (run > 1 && staging) {
+            if (staging_used + run_size > staging_cap) {
+                /* staging buffer is referenced by pending requests until they are submitted */
+                if (!ipf_write_batch_flush(pf, batch))
+                    goto out;
+                staging_used = 0;
             }
 
-            file_node->need_writing = false;
-            file_node->new_node = false;
+            uint8_t* run_buffer = staging + staging_used;
+            size_t run_offset = 0;
+            for (size_t j = 0; j < run; j++) {
+                memcpy(run_buffer + run_offset, dirty[i + j]->encrypted, dirty[i + j]->node_size);
+                run_offset += dirty[i + j]->node_size;
+            }
+            if (!ipf_write_batched(pf, batch, dirty[i]->physical_node_number * pf->data_node_size,
+                                   run_buffer, run_size))
+                goto out;
+            staging_used += run_size;
+        } else {
+            run = 1;
+            if (!ipf_write_node_batched(pf, batch, dirty[i]->physical_node_number,
+                                        dirty[i]->encrypted, dirty[i]->node_size))
+                goto out;
         }
 
-        if (!ipf_write_node(pf, pf->file, /*node_number=*/1, &pf->root_mht.encrypted,
-                            PF_NODE_SIZE)) {
+        for (size_t j = 0; j < run; j++)
+            ipf_mark_clean(pf, dirty[i + j]);
+        i += run;
+    }
+
+    /* submit requests referencing the staging buffer before it is freed */
+    ret = ipf_write_batch_flush(pf, batch);
+out:
+    free(staging);
+    free(dirty);
+    return ret;
+}
+
+static bool ipf_write_all_changes_to_disk(pf_context_t* pf) {
+    /* nodes are written in the same order as without batching: data and MHT nodes first, then
+     * root MHT node, then metadata node */
+    struct pf_write_batch batch = { .count = 0 };
+
+    if (pf->encrypted_part_plain.size > MD_USER_DATA_SIZE && pf->root_mht.need_writing) {
+        if (!ipf_write_dirty_nodes(pf, &batch))
+            return false;
+
+        if (!ipf_write_node_batched(pf, &batch, /*node_number=*/1, pf->root_mht.encrypted,
+                                    PF_NODE_SIZE)) {
             return false;
         }
 
@@ -661,11 +864,12 @@ static bool ipf_write_all_changes_to_disk(pf_context_t* pf) {
         pf->root_mht.new_node = false;
     }
 
-    if (!ipf_write_node(pf, pf->file, /*node_number=*/0, &pf->file_metadata, PF_NODE_SIZE)) {
+    if (!ipf_write_node_batched(pf, &batch, /*node_number=*/0, &pf->file_metadata,
+                                PF_NODE_SIZE)) {
         return false;
     }
 
-    return true;
+    return ipf_write_batch_flush(pf, &batch);
 }
 
 // seek to a specified file offset from the beginning
@@ -684,7 +888,7 @@ static bool ipf_seek(pf_context_t* pf, uint64_t new_offset) {
         result = true;
     } else if (pf->mode & PF_FILE_MODE_WRITE) {
         // need to extend the file
-        result = PF_SUCCESS(pf_set_size(pf, new_offset));
+        result = PF_SUCCESS(ipf_set_size(pf, new_offset));
     }
 
     if (result)
@@ -782,11 +986,11 @@ static size_t ipf_write(pf_context_t* pf, const void* ptr, size_t size) {
             break;
         }
 
-        size_t offset_in_node = (size_t)((pf->offset - MD_USER_DATA_SIZE) % PF_NODE_SIZE);
-        size_t empty_place_left_in_node = PF_NODE_SIZE - offset_in_node;
+        size_t offset_in_node = (size_t)((pf->offset - MD_USER_DATA_SIZE) % pf->data_node_size);
+        size_t empty_place_left_in_node = pf->data_node_size - offset_in_node;
         size_t size_to_write = MIN(data_left_to_write, empty_place_left_in_node);
 
-        memcpy_or_zero_initialize(&file_data_node->decrypted.data.data[offset_in_node],
+        memcpy_or_zero_initialize(&file_data_node->decrypted.data[offset_in_node],
                                   data_to_write, size_to_write);
         pf->offset += size_to_write;
         if (data_to_write)
@@ -797,17 +1001,8 @@ static size_t ipf_write(pf_context_t* pf, const void* ptr, size_t size) {
             pf->encrypted_part_plain.size = pf->offset; // file grew, update the new file size
         }
 
-        if (!file_data_node->need_writing) {
-            file_data_node->need_writing = true;
-            file_node_t* file_mht_node = file_data_node->parent;
-            while (file_mht_node->node_number != 0) {
-                // set all the mht parent nodes as 'need writing'
-                file_mht_node->need_writing = true;
-                file_mht_node = file_mht_node->parent;
-            }
-            pf->root_mht.need_writing = true;
-            pf->need_writing = true;
-        }
+        if (!file_data_node->need_writing)
+            ipf_mark_path_dirty(pf, file_data_node);
     }
 
     return size - data_left_to_write;
@@ -861,11 +1056,11 @@ static size_t ipf_read(pf_context_t* pf, void* ptr, size_t size) {
         if (file_data_node == NULL)
             break;
 
-        size_t offset_in_node = (pf->offset - MD_USER_DATA_SIZE) % PF_NODE_SIZE;
-        size_t data_left_in_node = PF_NODE_SIZE - offset_in_node;
+        size_t offset_in_node = (pf->offset - MD_USER_DATA_SIZE) % pf->data_node_size;
+        size_t data_left_in_node = pf->data_node_size - offset_in_node;
         size_t size_to_read = MIN(data_left_to_read, data_left_in_node);
 
-        memcpy(out_buffer, &file_data_node->decrypted.data.data[offset_in_node], size_to_read);
+        memcpy(out_buffer, &file_data_node->decrypted.data[offset_in_node], size_to_read);
         pf->offset += size_to_read;
         out_buffer += size_to_read;
         data_left_to_read -= size_to_read;
@@ -882,8 +1077,8 @@ static size_t ipf_read(pf_context_t* pf, void* ptr, size_t size) {
 
 // this is a very 'specific' function, tied to the architecture of the file layout,
 // returning the node numbers according to the data offset in the file
-static void get_node_numbers(uint64_t offset, uint64_t* mht_node_number, uint64_t* data_node_number,
-                             uint64_t* physical_mht_node_number,
+static void get_node_numbers(pf_context_t* pf, uint64_t offset, uint64_t* mht_node_number,
+                             uint64_t* data_node_number, uint64_t* physical_mht_node_number,
                              uint64_t* physical_data_node_number) {
     // physical nodes (file layout):
     // node 0 - meta data node
@@ -901,7 +1096,7 @@ static void get_node_numbers(uint64_t offset, uint64_t* mht_node_number, uint64_
 
     assert(offset >= MD_USER_DATA_SIZE);
 
-    _data_node_number = (offset - MD_USER_DATA_SIZE) / PF_NODE_SIZE;
+    _data_node_number = (offset - MD_USER_DATA_SIZE) / pf->data_node_size;
     _mht_node_number = _data_node_number / ATTACHED_DATA_NODES_COUNT;
     _physical_data_node_number = _data_node_number
                                  + 1 // meta data node
@@ -923,6 +1118,89 @@ static void get_node_numbers(uint64_t offset, uint64_t* mht_node_number, uint64_
         *physical_data_node_number = _physical_data_node_number;
 }
 
+/* allocates a node of the given type together with its (zeroed) encrypted and decrypted buffers;
+ * does not touch the state of the file (the caller reports allocation failures) */
+static file_node_t* ipf_alloc_node(pf_context_t* pf, uint8_t type) {
+    uint32_t node_size = type == FILE_DATA_NODE_TYPE ? pf->data_node_size : PF_NODE_SIZE;
+    file_node_t* node = calloc(1, sizeof(*node) + 2 * (size_t)node_size);
+    if (!node)
+        return NULL;
+
+    node->type           = type;
+    node->node_size      = node_size;
+    node->encrypted      = (uint8_t*)(node + 1);
+    node->decrypted.data = node->encrypted + node_size;
+    return node;
+}
+
+/* frees a node allocated by ipf_alloc_node(), scrubbing its plaintext */
+static void ipf_free_node(file_node_t* node) {
+    erase_memory(node->decrypted.data, node->node_size);
+    free(node);
+}
+
+/* whether a dirty node can be written before the rest of the file: a data node appended after the
+ * last flush lies beyond the end of the file on disk, where writing it does not break the
+ * consistency of the file; only nodes which are already full are written, as the last node is
+ * likely to be modified by further appends */
+static bool ipf_is_sealable(pf_context_t* pf, file_node_t* node) {
+    return node->type == FILE_DATA_NODE_TYPE && node->new_node
+           && MD_USER_DATA_SIZE + (node->node_number + 1) * pf->data_node_size
+                  <= pf->encrypted_part_plain.size;
+}
+
+/* encrypts and writes a sealable node (see ipf_is_sealable()) so that it can be evicted without
+ * flushing the whole file, which makes the cost of appends independent of the number of cached
+ * nodes; its gmac stays in its parent MHT node, which is written by the next flush */
+static bool ipf_seal_appended_node(pf_context_t* pf, file_node_t* node) {
+    if (!ipf_encrypt_node(pf, node))
+        return false;
+
+    if (!ipf_write_node(pf, pf->file, node->physical_node_number, node->encrypted,
+                        node->node_size))
+        return false;
+
+    ipf_mark_clean(pf, node);
+    return true;
+}
+
+/* evicts nodes from the cache until there is room for a new node (a few more nodes may be added
+ * while reading a data node, so the cache size may exceed its limit temporarily); this is done
+ * before fetching the data node so that neither the returned node nor its parents get evicted */
+static bool ipf_shrink_cache(pf_context_t* pf) {
+    while (lruc_size(pf->cache) >= pf->cache_max_nodes) {
+        void* data = lruc_get_last(pf->cache);
+        assert(data != NULL);
+        // for production -
+        if (data == NULL) {
+            pf->last_error = PF_STATUS_UNKNOWN_ERROR;
+            return false;
+        }
+
+        file_node_t* file_node = (file_node_t*)data;
+        if (file_node->need_writing && ipf_is_sealable(pf, file_node)) {
+            // on failure, the whole file is flushed below
+            ipf_seal_appended_node(pf, file_node);
+        }
+
+        if (!file_node->need_writing) {
+            lruc_remove_last(pf->cache);
+
+            // before deleting the memory, need to scrub the plain secrets
+            ipf_free_node(file_node);
+        } else {
+            if (!ipf_internal_flush(pf)) {
+                // error, can't flush cache, file status changed to error
+                assert(pf->file_status != PF_STATUS_SUCCESS);
+                if (pf->file_status == PF_STATUS_SUCCESS)
+                    pf->file_status = PF_STATUS_FLUSH_ERROR; // for release set this anyway
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
 static file_node_t* ipf_get_data_node(pf_context_t* pf) {
     file_node_t* file_data_node = NULL;
 
@@ -931,7 +1209,10 @@ static file_node_t* ipf_get_data_node(pf_context_t* pf) {
         return NULL;
     }
 
-    if ((pf->offset - MD_USER_DATA_SIZE) % PF_NODE_SIZE == 0
+    if (!ipf_shrink_cache(pf))
+        return NULL;
+
+    if ((pf->offset - MD_USER_DATA_SIZE) % pf->data_node_size == 0
         && pf->offset == pf->encrypted_part_plain.size) {
         // new node
         file_data_node = ipf_append_data_node(pf);
@@ -950,34 +1231,6 @@ static file_node_t* ipf_get_data_node(pf_context_t* pf) {
         }
     }
 
-    // even if we didn't get the required data_node, we might have read other nodes in the process
-    while (lruc_size(pf->cache) > MAX_PAGES_IN_CACHE) {
-        void* data = lruc_get_last(pf->cache);
-        assert(data != NULL);
-        // for production -
-        if (data == NULL) {
-            pf->last_error = PF_STATUS_UNKNOWN_ERROR;
-            return NULL;
-        }
-
-        if (!((file_node_t*)data)->need_writing) {
-            lruc_remove_last(pf->cache);
-
-            // before deleting the memory, need to scrub the plain secrets
-            file_node_t* file_node = (file_node_t*)data;
-            erase_memory(&file_node->decrypted, sizeof(file_node->decrypted));
-            free(file_node);
-        } else {
-            if (!ipf_internal_flush(pf)) {
-                // error, can't flush cache, file status changed to error
-                assert(pf->file_status != PF_STATUS_SUCCESS);
-                if (pf->file_status == PF_STATUS_SUCCESS)
-                    pf->file_status = PF_STATUS_FLUSH_ERROR; // for release set this anyway
-                return NULL;                                 // even if we got the data_node!
-            }
-        }
-    }
-
     return file_data_node;
 }
 
@@ -988,23 +1241,22 @@ static file_node_t* ipf_append_data_node(pf_context_t* pf) {
 
     file_node_t* new_file_data_node = NULL;
 
-    new_file_data_node = calloc(1, sizeof(*new_file_data_node));
+    new_file_data_node = ipf_alloc_node(pf, FILE_DATA_NODE_TYPE);
     if (!new_file_data_node) {
         pf->last_error = PF_STATUS_NO_MEMORY;
         return NULL;
     }
 
     uint64_t node_number, physical_node_number;
-    get_node_numbers(pf->offset, NULL, &node_number, NULL, &physical_node_number);
+    get_node_numbers(pf, pf->offset, NULL, &node_number, NULL, &physical_node_number);
 
-    new_file_data_node->type = FILE_DATA_NODE_TYPE;
     new_file_data_node->new_node = true;
     new_file_data_node->parent = file_mht_node;
     new_file_data_node->node_number = node_number;
     new_file_data_node->physical_node_number = physical_node_number;
 
     if (!lruc_add(pf->cache, new_file_data_node->physical_node_number, new_file_data_node)) {
-        free(new_file_data_node);
+        ipf_free_node(new_file_data_node);
         pf->last_error = PF_STATUS_NO_MEMORY;
         return NULL;
     }
@@ -1012,17 +1264,60 @@ static file_node_t* ipf_append_data_node(pf_context_t* pf) {
     return new_file_data_node;
 }
 
+/* decrypts a data node from its encrypted contents, checking its integrity; does not touch the
+ * state of the file (the node may be read ahead and never actually be accessed) */
+static pf_status_t ipf_decrypt_data_node(file_node_t* file_data_node) {
+    gcm_crypto_data_t* gcm_crypto_data =
+        &file_data_node->parent->decrypted.mht
+             ->data_nodes_crypto[file_data_node->node_number % ATTACHED_DATA_NODES_COUNT];
+
+    // this function decrypt the data _and_ checks the integrity of the data against the gmac
+    return g_cb_aes_gcm_decrypt(&gcm_crypto_data->key, &g_empty_iv, NULL, 0,
+                                file_data_node->encrypted, file_data_node->node_size,
+                                file_data_node->decrypted.data, &gcm_crypto_data->gmac);
+}
+
+/* returns how many data nodes (including the requested one) to read from disk at once: if the
+ * requested node directly follows the previously read ones, the next nodes which are attached to
+ * the same MHT node, belong to the file and are not cached yet are read ahead; their number is
+ * capped to a quarter of the cache (the probation queue of the 2Q policy), so that they are not
+ * evicted before being accessed */
+static size_t ipf_read_ahead_count(pf_context_t* pf, uint64_t data_node_number,
+                                   uint64_t physical_node_number) {
+    if (physical_node_number != pf->read_ahead_next_node)
+        return 1;
+
+    uint64_t data_nodes_cnt = DIV_ROUND_UP(pf->encrypted_part_plain.size - MD_USER_DATA_SIZE,
+                                           pf->data_node_size);
+    uint64_t count = MIN(PF_READ_AHEAD_MAX_SIZE / pf->data_node_size, pf->cache_max_nodes / 4);
+    count = MIN(count, ATTACHED_DATA_NODES_COUNT - data_node_number % ATTACHED_DATA_NODES_COUNT);
+    count = MIN(count, data_nodes_cnt - data_node_number);
+
+    for (uint64_t i = 1; i < count; i++) {
+        if (lruc_find(pf->cache, physical_node_number + i))
+            return i;
+    }
+    return count ? count : 1;
+}
+
 static file_node_t* ipf_read_data_node(pf_context_t* pf) {
     uint64_t data_node_number;
     uint64_t physical_node_number;
     file_node_t* file_mht_node;
     pf_status_t status;
 
-    get_node_numbers(pf->offset, NULL, &data_node_number, NULL, &physical_node_number);
+    get_node_numbers(pf, pf->offset, NULL, &data_node_number, NULL, &physical_node_number);
 
-    file_node_t* file_data_node = (file_node_t*)lruc_get(pf->cache, physical_node_number);
-    if (file_data_node != NULL)
+    file_node_t* file_data_node = (file_node_t*)lruc_find(pf->cache, physical_node_number);
+    if (file_data_node != NULL) {
+        if (file_data_node->read_ahead) {
+            // first actual access to a node read ahead, it is not a re-reference
+            file_data_node->read_ahead = false;
+        } else {
+            lruc_get(pf->cache, physical_node_number);
+        }
         return file_data_node;
+    }
 
     // need to read the data node from the disk
 
@@ -1030,44 +1325,72 @@ static file_node_t* ipf_read_data_node(pf_context_t* pf) {
     if (file_mht_node == NULL) // some error happened
         return NULL;
 
-    file_data_node = calloc(1, sizeof(*file_data_node));
+    file_data_node = ipf_alloc_node(pf, FILE_DATA_NODE_TYPE);
     if (!file_data_node) {
         pf->last_error = PF_STATUS_NO_MEMORY;
         return NULL;
     }
-
-    file_data_node->type = FILE_DATA_NODE_TYPE;
-    file_data_node->node_number = data_node_number;
+    file_data_node->node_number          = data_node_number;
     file_data_node->physical_node_number = physical_node_number;
-    file_data_node->parent = file_mht_node;
+    file_data_node->parent               = file_mht_node;
+
+    uint32_t node_size = pf->data_node_size;
+    uint8_t* nodes = NULL;
+    size_t nodes_cnt = ipf_read_ahead_count(pf, data_node_number, physical_node_number);
+    if (nodes_cnt > 1) {
+        // one host read for all nodes; read-ahead is only an optimization, so on any failure we
+        // fall back to reading the requested node alone
+        nodes = malloc(nodes_cnt * node_size);
+        if (!nodes || PF_FAILURE(g_cb_read(pf->file, nodes, physical_node_number * node_size,
+                                           nodes_cnt * node_size))) {
+            free(nodes);
+            nodes = NULL;
+            nodes_cnt = 1;
+        }
+    }
 
-    if (!ipf_read_node(pf, pf->file, file_data_node->physical_node_number,
-                       file_data_node->encrypted.cipher, PF_NODE_SIZE)) {
-        free(file_data_node);
+    if (nodes) {
+        memcpy(file_data_node->encrypted, nodes, node_size);
+    } else if (!ipf_read_node(pf, pf->file, physical_node_number, file_data_node->encrypted,
+                              node_size)) {
+        ipf_free_node(file_data_node);
         return NULL;
     }
 
-    gcm_crypto_data_t* gcm_crypto_data =
-        &file_data_node->parent->decrypted.mht
-             .data_nodes_crypto[file_data_node->node_number % ATTACHED_DATA_NODES_COUNT];
-
-    // this function decrypt the data _and_ checks the integrity of the data against the gmac
-    status = g_cb_aes_gcm_decrypt(&gcm_crypto_data->key, &g_empty_iv, NULL, 0,
-                                  file_data_node->encrypted.cipher, PF_NODE_SIZE,
-                                  file_data_node->decrypted.data.data, &gcm_crypto_data->gmac);
+    // nodes read ahead are added to the cache farthest first, so that in LRU order they directly
+    // follow the requested node and are evicted after the nodes accessed before; errors are
+    // reported only if such a node is actually accessed
+    for (size_t i = nodes_cnt - 1; i > 0; i--) {
+        file_node_t* node = ipf_alloc_node(pf, FILE_DATA_NODE_TYPE);
+        if (!node)
+            continue;
+        node->node_number          = data_node_number + i;
+        node->physical_node_number = physical_node_number + i;
+        node->parent               = file_mht_node;
+        node->read_ahead           = true;
+        memcpy(node->encrypted, nodes + i * node_size, node_size);
+
+        if (PF_FAILURE(ipf_decrypt_data_node(node))
+                || !lruc_add(pf->cache, node->physical_node_number, node)) {
+            ipf_free_node(node);
+        }
+    }
+    free(nodes);
 
+    status = ipf_decrypt_data_node(file_data_node);
     if (PF_FAILURE(status)) {
-        free(file_data_node);
+        ipf_free_node(file_data_node);
         pf->last_error = status;
         if (status == PF_STATUS_MAC_MISMATCH)
             pf->file_status = PF_STATUS_CORRUPTED;
         return NULL;
     }
 
+    pf->read_ahead_next_node = physical_node_number + nodes_cnt;
+
     if (!lruc_add(pf->cache, file_data_node->physical_node_number, file_data_node)) {
         // scrub the plaintext data
-        erase_memory(&file_data_node->decrypted, sizeof(file_data_node->decrypted));
-        free(file_data_node);
+        ipf_free_node(file_data_node);
         pf->last_error = PF_STATUS_NO_MEMORY;
         return NULL;
     }
@@ -1085,14 +1408,13 @@ static file_node_t* ipf_get_mht_node(pf_context_t* pf) {
         return NULL;
     }
 
-    get_node_numbers(pf->offset, &mht_node_number, NULL, &physical_mht_node_number, NULL);
+    get_node_numbers(pf, pf->offset, &mht_node_number, NULL, &physical_mht_node_number, NULL);
 
     if (mht_node_number == 0)
         return &pf->root_mht;
 
-    // file is constructed from (ATTACHED_DATA_NODES_COUNT + CHILD_MHT_NODES_COUNT) * PF_NODE_SIZE
-    // bytes per MHT node
-    if ((pf->offset - MD_USER_DATA_SIZE) % (ATTACHED_DATA_NODES_COUNT * PF_NODE_SIZE) == 0 &&
+    // file is constructed from ATTACHED_DATA_NODES_COUNT * data node size bytes per MHT node
+    if ((pf->offset - MD_USER_DATA_SIZE) % (ATTACHED_DATA_NODES_COUNT * pf->data_node_size) == 0 &&
             pf->offset == pf->encrypted_part_plain.size) {
         file_mht_node = ipf_append_mht_node(pf, mht_node_number);
     } else {
@@ -1115,20 +1437,19 @@ static file_node_t* ipf_append_mht_node(pf_context_t* pf, uint64_t mht_node_numb
                                     mht_node_number * (1 + ATTACHED_DATA_NODES_COUNT);
 
     file_node_t* new_file_mht_node = NULL;
-    new_file_mht_node = calloc(1, sizeof(*new_file_mht_node));
+    new_file_mht_node = ipf_alloc_node(pf, FILE_MHT_NODE_TYPE);
     if (!new_file_mht_node) {
         pf->last_error = PF_STATUS_NO_MEMORY;
         return NULL;
     }
 
-    new_file_mht_node->type = FILE_MHT_NODE_TYPE;
     new_file_mht_node->new_node = true;
     new_file_mht_node->parent = parent_file_mht_node;
     new_file_mht_node->node_number = mht_node_number;
     new_file_mht_node->physical_node_number = physical_node_number;
 
-    if (!lruc_add(pf->cache, new_file_mht_node->physical_node_number, new_file_mht_node)) {
-        free(new_file_mht_node);
+    if (!lruc_add_pinned(pf->cache, new_file_mht_node->physical_node_number, new_file_mht_node)) {
+        ipf_free_node(new_file_mht_node);
         pf->last_error = PF_STATUS_NO_MEMORY;
         return NULL;
     }
@@ -1156,42 +1477,40 @@ static file_node_t* ipf_read_mht_node(pf_context_t* pf, uint64_t mht_node_number
     if (parent_file_mht_node == NULL) // some error happened
         return NULL;
 
-    file_mht_node = calloc(1, sizeof(*file_mht_node));
+    file_mht_node = ipf_alloc_node(pf, FILE_MHT_NODE_TYPE);
     if (!file_mht_node) {
         pf->last_error = PF_STATUS_NO_MEMORY;
         return NULL;
     }
 
-    file_mht_node->type                 = FILE_MHT_NODE_TYPE;
     file_mht_node->node_number          = mht_node_number;
     file_mht_node->physical_node_number = physical_node_number;
     file_mht_node->parent               = parent_file_mht_node;
 
     if (!ipf_read_node(pf, pf->file, file_mht_node->physical_node_number,
-                       file_mht_node->encrypted.cipher, PF_NODE_SIZE)) {
-        free(file_mht_node);
+                       file_mht_node->encrypted, PF_NODE_SIZE)) {
+        ipf_free_node(file_mht_node);
         return NULL;
     }
 
     gcm_crypto_data_t* gcm_crypto_data =
         &file_mht_node->parent->decrypted.mht
-             .mht_nodes_crypto[(file_mht_node->node_number - 1) % CHILD_MHT_NODES_COUNT];
+             ->mht_nodes_crypto[(file_mht_node->node_number - 1) % CHILD_MHT_NODES_COUNT];
 
     // this function decrypt the data _and_ checks the integrity of the data against the gmac
     status = g_cb_aes_gcm_decrypt(&gcm_crypto_data->key, &g_empty_iv, NULL, 0,
-                                  file_mht_node->encrypted.cipher, PF_NODE_SIZE,
-                                  &file_mht_node->decrypted.mht, &gcm_crypto_data->gmac);
+                                  file_mht_node->encrypted, PF_NODE_SIZE,
+                                  file_mht_node->decrypted.mht, &gcm_crypto_data->gmac);
     if (PF_FAILURE(status)) {
-        free(file_mht_node);
+        ipf_free_node(file_mht_node);
         pf->last_error = status;
         if (status == PF_STATUS_MAC_MISMATCH)
             pf->file_status = PF_STATUS_CORRUPTED;
         return NULL;
     }
 
-    if (!lruc_add(pf->cache, file_mht_node->physical_node_number, file_mht_node)) {
-        erase_memory(&file_mht_node->decrypted, sizeof(file_mht_node->decrypted));
-        free(file_mht_node);
+    if (!lruc_add_pinned(pf->cache, file_mht_node->physical_node_number, file_mht_node)) {
+        ipf_free_node(file_mht_node);
         pf->last_error = PF_STATUS_NO_MEMORY;
         return NULL;
     }
@@ -1199,6 +1518,159 @@ static file_node_t* ipf_read_mht_node(pf_context_t* pf, uint64_t mht_node_number
     return file_mht_node;
 }
 
+/* Per-file reader/writer lock. Reads which only access already cached MHT nodes are served under
+ * the shared lock, in parallel with other such reads; everything else (writes, flushes, cache
+ * eviction, reading MHT nodes, read-ahead) takes the exclusive lock. Hence cached nodes are neither
+ * modified nor freed while the shared lock is held and shared holders may read their contents
+ * without further synchronization; only the cache bookkeeping itself (LRU order, adding nodes) is
+ * serialized on `cache_lock`. This is a simple spinlock: the library is also used outside of PAL
+ * (in tools), so it cannot rely on PAL events. */
+static void ipf_lock_shared(pf_context_t* pf) {
+    while (true) {
+        // let waiting writers in first
+        while (__atomic_load_n(&pf->exclusive_waiters, __ATOMIC_RELAXED))
+            CPU_RELAX();
+
+        int64_t state = __atomic_load_n(&pf->lock_state, __ATOMIC_RELAXED);
+        if (state >= 0 && __atomic_compare_exchange_n(&pf->lock_state, &state, state + 1,
+                                                      /*weak=*/false, __ATOMIC_ACQUIRE,
+                                                      __ATOMIC_RELAXED)) {
+            return;
+        }
+        CPU_RELAX();
+    }
+}
+
+static void ipf_unlock_shared(pf_context_t* pf) {
+    __atomic_sub_fetch(&pf->lock_state, 1, __ATOMIC_RELEASE);
+}
+
+static void ipf_lock_exclusive(pf_context_t* pf) {
+    __atomic_add_fetch(&pf->exclusive_waiters, 1, __ATOMIC_RELAXED);
+    int64_t state = 0;
+    while (!__atomic_compare_exchange_n(&pf->lock_state, &state, -1, /*weak=*/false,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        state = 0;
+        CPU_RELAX();
+    }
+    __atomic_sub_fetch(&pf->exclusive_waiters, 1, __ATOMIC_RELAXED);
+}
+
+static void ipf_unlock_exclusive(pf_context_t* pf) {
+    __atomic_store_n(&pf->lock_state, 0, __ATOMIC_RELEASE);
+}
+
+static void ipf_lock_cache(pf_context_t* pf) {
+    while (__atomic_exchange_n(&pf->cache_lock, 1, __ATOMIC_ACQUIRE))
+        CPU_RELAX();
+}
+
+static void ipf_unlock_cache(pf_context_t* pf) {
+    __atomic_store_n(&pf->cache_lock, 0, __ATOMIC_RELEASE);
+}
+
+/* bumps a data node (unless it was read ahead and is accessed for the first time) and its parent
+ * MHT nodes in the cache, same as ipf_get_data_node() does */
+static void ipf_bump_data_node_shared(pf_context_t* pf, file_node_t* file_data_node) {
+    if (file_data_node->read_ahead) {
+        file_data_node->read_ahead = false;
+    } else {
+        lruc_get(pf->cache, file_data_node->physical_node_number);
+    }
+
+    file_node_t* file_mht_node = file_data_node->parent;
+    while (file_mht_node->node_number != 0) {
+        lruc_get(pf->cache, file_mht_node->physical_node_number);
+        file_mht_node = file_mht_node->parent;
+    }
+}
+
+/* reads [offset, offset + size) of the file, which must lie within the file, under the shared lock;
+ * stops at the first data node which cannot be read in shared mode: the MHT node it is attached to
+ * is not cached, the read is sequential (read-ahead is done in exclusive mode), the cache is
+ * overfull (it is only shrunk in exclusive mode) or any error occurred (the caller then retries in
+ * exclusive mode, which reports the error); never modifies the file offset or status
+ * returns the number of bytes read */
+static size_t ipf_read_shared(pf_context_t* pf, uint64_t offset, void* ptr, size_t size) {
+    unsigned char* out_buffer = (unsigned char*)ptr;
+    size_t data_left_to_read = size;
+
+    if (offset < MD_USER_DATA_SIZE) {
+        size_t size_to_read = MIN(data_left_to_read, MD_USER_DATA_SIZE - (size_t)offset);
+        memcpy(out_buffer, &pf->encrypted_part_plain.data[offset], size_to_read);
+        offset += size_to_read;
+        out_buffer += size_to_read;
+        data_left_to_read -= size_to_read;
+    }
+
+    while (data_left_to_read > 0) {
+        uint64_t mht_node_number, data_node_number;
+        uint64_t physical_mht_node_number, physical_node_number;
+        get_node_numbers(pf, offset, &mht_node_number, &data_node_number,
+                         &physical_mht_node_number, &physical_node_number);
+
+        ipf_lock_cache(pf);
+        file_node_t* file_data_node = (file_node_t*)lruc_find(pf->cache, physical_node_number);
+        if (!file_data_node) {
+            file_node_t* file_mht_node = mht_node_number == 0
+                                         ? &pf->root_mht
+                                         : (file_node_t*)lruc_find(pf->cache,
+                                                                   physical_mht_node_number);
+            if (!file_mht_node || physical_node_number == pf->read_ahead_next_node
+                    || lruc_size(pf->cache) >= 2 * pf->cache_max_nodes) {
+                ipf_unlock_cache(pf);
+                break;
+            }
+            ipf_unlock_cache(pf);
+
+            // other readers may proceed while we read and decrypt the node
+            file_node_t* new_node = ipf_alloc_node(pf, FILE_DATA_NODE_TYPE);
+            if (!new_node)
+                break;
+            new_node->node_number          = data_node_number;
+            new_node->physical_node_number = physical_node_number;
+            new_node->parent               = file_mht_node;
+
+            if (PF_FAILURE(g_cb_read(pf->file, new_node->encrypted,
+                                     physical_node_number * pf->data_node_size,
+                                     pf->data_node_size))
+                    || PF_FAILURE(ipf_decrypt_data_node(new_node))) {
+                ipf_free_node(new_node);
+                break;
+            }
+
+            ipf_lock_cache(pf);
+            file_data_node = (file_node_t*)lruc_find(pf->cache, physical_node_number);
+            if (!file_data_node && lruc_add(pf->cache, physical_node_number, new_node)) {
+                file_data_node = new_node;
+                new_node = NULL;
+            }
+            if (file_data_node)
+                pf->read_ahead_next_node = physical_node_number + 1;
+
+            if (new_node) {
+                // another reader was faster (or there is no memory)
+                ipf_free_node(new_node);
+            }
+            if (!file_data_node) {
+                ipf_unlock_cache(pf);
+                break;
+            }
+        }
+        ipf_bump_data_node_shared(pf, file_data_node);
+        ipf_unlock_cache(pf);
+
+        size_t offset_in_node = (offset - MD_USER_DATA_SIZE) % pf->data_node_size;
+        size_t size_to_read = MIN(data_left_to_read, pf->data_node_size - offset_in_node);
+        memcpy(out_buffer, &file_data_node->decrypted.data[offset_in_node], size_to_read);
+        offset += size_to_read;
+        out_buffer += size_to_read;
+        data_left_to_read -= size_to_read;
+    }
+
+    return size - data_left_to_read;
+}
+
 // public API
 
 void pf_set_callbacks(pf_read_f read_f, pf_write_f write_f, pf_truncate_f truncate_f,
@@ -1216,6 +1688,23 @@ void pf_set_callbacks(pf_read_f read_f, pf_write_f write_f, pf_truncate_f trunca
     g_initialized = true;
 }
 
+void pf_set_write_batch_callback(pf_write_batch_f write_batch_f) {
+    g_cb_write_batch = write_batch_f;
+}
+
+void pf_set_cache_params(size_t max_nodes, pf_cache_policy_t policy) {
+    g_cache_max_nodes = max_nodes ? max_nodes : 1;
+    g_cache_policy    = policy;
+}
+
+pf_status_t pf_set_data_node_size(uint32_t size) {
+    if (size < PF_NODE_SIZE || size > PF_MAX_DATA_NODE_SIZE || (size & (size - 1)))
+        return PF_STATUS_INVALID_PARAMETER;
+
+    g_data_node_size = size;
+    return PF_STATUS_SUCCESS;
+}
+
 pf_status_t pf_open(pf_handle_t handle, const char* path, uint64_t underlying_size,
                     pf_file_mode_t mode, bool create, const pf_key_t* key, pf_context_t** context) {
     if (!g_initialized)
@@ -1226,6 +1715,54 @@ pf_status_t pf_open(pf_handle_t handle, const char* path, uint64_t underlying_si
     return status;
 }
 
+static pf_status_t ipf_reopen(pf_context_t* pf, pf_handle_t handle, uint64_t underlying_size,
+                              pf_file_mode_t mode, const pf_key_t* key) {
+    if (PF_FAILURE(pf->file_status))
+        return pf->file_status;
+
+    if (pf->need_writing || !handle || underlying_size % PF_NODE_SIZE != 0)
+        return PF_STATUS_INVALID_PARAMETER;
+
+    if (memcmp(&pf->user_kdk_key, key, sizeof(pf->user_kdk_key)))
+        return PF_STATUS_FILE_CHANGED;
+
+    metadata_node_t* metadata = malloc(sizeof(*metadata));
+    if (!metadata)
+        return PF_STATUS_NO_MEMORY;
+
+    pf_status_t status = PF_STATUS_SUCCESS;
+    if (underlying_size < sizeof(*metadata)) {
+        status = PF_STATUS_FILE_CHANGED;
+    } else if (!ipf_read_node(pf, handle, /*node_number=*/0, metadata, sizeof(*metadata))) {
+        status = pf->last_error;
+    } else if (memcmp(metadata, &pf->file_metadata, sizeof(*metadata))) {
+        status = PF_STATUS_FILE_CHANGED;
+    }
+    free(metadata);
+    if (PF_FAILURE(status))
+        return status;
+
+    pf->file           = handle;
+    pf->mode           = mode;
+    pf->real_file_size = underlying_size;
+    pf->offset         = 0;
+    pf->end_of_file    = false;
+    pf->last_error     = PF_STATUS_SUCCESS;
+    pf->read_ahead_next_node = 0;
+    return PF_STATUS_SUCCESS;
+}
+
+pf_status_t pf_reopen(pf_context_t* pf, pf_handle_t handle, uint64_t underlying_size,
+                      pf_file_mode_t mode, const pf_key_t* key) {
+    if (!g_initialized)
+        return PF_STATUS_UNINITIALIZED;
+
+    ipf_lock_exclusive(pf);
+    pf_status_t status = ipf_reopen(pf, handle, underlying_size, mode, key);
+    ipf_unlock_exclusive(pf);
+    return status;
+}
+
 pf_status_t pf_close(pf_context_t* pf) {
     if (!g_initialized)
         return PF_STATUS_UNINITIALIZED;
@@ -1244,15 +1781,14 @@ pf_status_t pf_get_size(pf_context_t* pf, uint64_t* size) {
     if (!g_initialized)
         return PF_STATUS_UNINITIALIZED;
 
+    ipf_lock_shared(pf);
     *size = pf->encrypted_part_plain.size;
+    ipf_unlock_shared(pf);
     return PF_STATUS_SUCCESS;
 }
 
 // TODO: file truncation
-pf_status_t pf_set_size(pf_context_t* pf, uint64_t size) {
-    if (!g_initialized)
-        return PF_STATUS_UNINITIALIZED;
-
+static pf_status_t ipf_set_size(pf_context_t* pf, uint64_t size) {
     if (!(pf->mode & PF_FILE_MODE_WRITE))
         return PF_STATUS_INVALID_MODE;
 
@@ -1272,6 +1808,16 @@ pf_status_t pf_set_size(pf_context_t* pf, uint64_t size) {
     return PF_STATUS_NOT_IMPLEMENTED;
 }
 
+pf_status_t pf_set_size(pf_context_t* pf, uint64_t size) {
+    if (!g_initialized)
+        return PF_STATUS_UNINITIALIZED;
+
+    ipf_lock_exclusive(pf);
+    pf_status_t status = ipf_set_size(pf, size);
+    ipf_unlock_exclusive(pf);
+    return status;
+}
+
 pf_status_t pf_read(pf_context_t* pf, uint64_t offset, size_t size, void* output,
                     size_t* bytes_read) {
     if (!g_initialized)
@@ -1282,20 +1828,45 @@ pf_status_t pf_read(pf_context_t* pf, uint64_t offset, size_t size, void* output
         return PF_STATUS_SUCCESS;
     }
 
-    if (!ipf_seek(pf, offset))
-        return pf->last_error;
+    // first try to serve the request in parallel with other readers
+    size_t shared_bytes = 0;
+    ipf_lock_shared(pf);
+    if (PF_SUCCESS(pf->file_status) && (pf->mode & PF_FILE_MODE_READ)
+            && offset < pf->encrypted_part_plain.size) {
+        size_t size_to_read = MIN(size, pf->encrypted_part_plain.size - offset);
+        shared_bytes = ipf_read_shared(pf, offset, output, size_to_read);
+        if (shared_bytes == size_to_read) {
+            ipf_unlock_shared(pf);
+            *bytes_read = shared_bytes;
+            return PF_STATUS_SUCCESS;
+        }
+    }
+    ipf_unlock_shared(pf);
+
+    // the rest of the request needs the exclusive lock (it may modify the file context); if it
+    // fails after some bytes were already read, a short read is reported
+    pf_status_t status = PF_STATUS_SUCCESS;
+    size_t bytes = 0;
+    ipf_lock_exclusive(pf);
+    if (!ipf_seek(pf, offset + shared_bytes)) {
+        status = pf->last_error;
+        goto out;
+    }
 
     if (pf->end_of_file || pf->offset == pf->encrypted_part_plain.size) {
         pf->end_of_file = true;
-        *bytes_read = 0;
-        return PF_STATUS_SUCCESS;
+        goto out;
     }
 
-    size_t bytes = ipf_read(pf, output, size);
+    bytes = ipf_read(pf, (uint8_t*)output + shared_bytes, size - shared_bytes);
     if (!bytes)
-        return pf->last_error;
+        status = pf->last_error;
+out:
+    ipf_unlock_exclusive(pf);
+    if (PF_FAILURE(status) && !shared_bytes)
+        return status;
 
-    *bytes_read = bytes;
+    *bytes_read = shared_bytes + bytes;
     return PF_STATUS_SUCCESS;
 }
 
@@ -1303,21 +1874,24 @@ pf_status_t pf_write(pf_context_t* pf, uint64_t offset, size_t size, const void*
     if (!g_initialized)
         return PF_STATUS_UNINITIALIZED;
 
-    if (!ipf_seek(pf, offset))
-        return pf->last_error;
-
-    if (ipf_write(pf, input, size) != size)
-        return pf->last_error;
-    return PF_STATUS_SUCCESS;
+    pf_status_t status = PF_STATUS_SUCCESS;
+    ipf_lock_exclusive(pf);
+    if (!ipf_seek(pf, offset) || ipf_write(pf, input, size) != size)
+        status = pf->last_error;
+    ipf_unlock_exclusive(pf);
+    return status;
 }
 
 pf_status_t pf_flush(pf_context_t* pf) {
     if (!g_initialized)
         return PF_STATUS_UNINITIALIZED;
 
+    pf_status_t status = PF_STATUS_SUCCESS;
+    ipf_lock_exclusive(pf);
     if (!ipf_internal_flush(pf))
-        return pf->last_error;
-    return PF_STATUS_SUCCESS;
+        status = pf->last_error;
+    ipf_unlock_exclusive(pf);
+    return status;
 }
 
 pf_status_t pf_get_handle(pf_context_t* pf, pf_handle_t* handle) {
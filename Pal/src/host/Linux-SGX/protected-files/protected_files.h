@@ -49,6 +49,7 @@ typedef enum _pf_status_t {
     PF_STATUS_CRYPTO_ERROR         = -15,
     PF_STATUS_CORRUPTED            = -16,
     PF_STATUS_WRITE_TO_DISK_FAILED = -17,
+    PF_STATUS_FILE_CHANGED         = -18,
 } pf_status_t;
 
 #define PF_SUCCESS(status) ((status) == PF_STATUS_SUCCESS)
@@ -56,6 +57,12 @@ typedef enum _pf_status_t {
 
 #define PF_NODE_SIZE 4096U
 
+/*! Maximum size of data nodes of a file (see pf_set_data_node_size()) */
+#define PF_MAX_DATA_NODE_SIZE (1024U * 1024U)
+
+/*! Default maximum number of nodes cached per file */
+#define PF_DEFAULT_CACHE_NODES 48
+
 /*! PF open modes */
 typedef enum _pf_file_mode_t {
     PF_FILE_MODE_READ  = 1,
@@ -88,6 +95,24 @@ typedef pf_status_t (*pf_read_f)(pf_handle_t handle, void* buffer, uint64_t offs
 typedef pf_status_t (*pf_write_f)(pf_handle_t handle, const void* buffer, uint64_t offset,
                                   size_t size);
 
+/*! Single write request for the batched write callback */
+typedef struct _pf_write_req_t {
+    const void* buffer;
+    uint64_t offset;
+    size_t size;
+} pf_write_req_t;
+
+/*!
+ * \brief Batched file write callback (optional)
+ *
+ * \param [in] handle File handle
+ * \param [in] reqs Write requests, must be performed in order
+ * \param [in] count Number of write requests
+ * \return PF status
+ */
+typedef pf_status_t (*pf_write_batch_f)(pf_handle_t handle, const pf_write_req_t* reqs,
+                                        size_t count);
+
 /*!
  * \brief File truncate callback
  *
@@ -178,6 +203,52 @@ void pf_set_callbacks(pf_read_f read_f, pf_write_f write_f, pf_truncate_f trunca
                       pf_aes_gcm_decrypt_f aes_gcm_decrypt_f, pf_random_f random_f,
                       pf_debug_f debug_f);
 
+/*!
+ * \brief Initialize the optional batched write callback
+ *
+ * \param [in] write_batch_f Batched file write callback (NULL to write nodes one by one)
+ *
+ * \details If set, flushing a file submits all dirty nodes in a few batches instead of one write
+ *          callback invocation per node.
+ */
+void pf_set_write_batch_callback(pf_write_batch_f write_batch_f);
+
+/*! Eviction policy of the node cache */
+typedef enum _pf_cache_policy_t {
+    PF_CACHE_POLICY_LRU, /*!< Evict the least recently used node */
+    PF_CACHE_POLICY_2Q,  /*!< Keep MHT nodes and nodes used more than once over other nodes */
+} pf_cache_policy_t;
+
+/*!
+ * \brief Set parameters of the node cache
+ *
+ * \param [in] max_nodes Maximum number of (data and MHT) nodes cached per file
+ * \param [in] policy Eviction policy
+ *
+ * \details Applies to files opened afterwards. By default, files cache PF_DEFAULT_CACHE_NODES
+ *          nodes with the 2Q policy. `max_nodes` is given in PF_NODE_SIZE nodes, files with bigger
+ *          data nodes cache proportionally fewer nodes (but at least PF_MIN_CACHE_NODES).
+ */
+void pf_set_cache_params(size_t max_nodes, pf_cache_policy_t policy);
+
+/*! Minimum number of nodes cached per file, regardless of their size */
+#define PF_MIN_CACHE_NODES 4
+
+/*!
+ * \brief Set the size of data nodes of newly created files
+ *
+ * \param [in] size Data node size, a power of two between PF_NODE_SIZE and PF_MAX_DATA_NODE_SIZE
+ *
+ * \return PF status
+ *
+ * \details Applies to files created afterwards, existing files keep the data node size they were
+ *          created with. Bigger data nodes mean fewer MHT nodes, host I/O requests and GCM
+ *          operations for big sequential accesses, at the cost of more work for small random
+ *          accesses. Files with data nodes bigger than PF_NODE_SIZE use a newer format version
+ *          (PF_MINOR_VERSION_NODE_SIZE), which older implementations reject.
+ */
+pf_status_t pf_set_data_node_size(uint32_t size);
+
 /*! Context representing an open protected file */
 typedef struct pf_context pf_context_t;
 
@@ -206,6 +277,25 @@ const char* pf_strerror(int err);
 pf_status_t pf_open(pf_handle_t handle, const char* path, uint64_t underlying_size,
                     pf_file_mode_t mode, bool create, const pf_key_t* key, pf_context_t** context);
 
+/*!
+ * \brief Reuse the context of a protected file for a new handle of the same file
+ *
+ * \param [in] pf PF context, flushed and not used since (except by pf_close())
+ * \param [in] handle New file handle
+ * \param [in] underlying_size Underlying file size
+ * \param [in] mode New access mode
+ * \param [in] key Wrap key
+ * \return PF status, PF_STATUS_FILE_CHANGED if the file was changed since the context was flushed
+ *
+ * \details Allows keeping the contexts of closed files, so that their metadata and cached nodes
+ *          need not be read and decrypted again when they are reopened. The metadata node of the
+ *          file is read and compared with the one of the context: every flush writes a different
+ *          metadata node (it contains a new key nonce) and its GMAC covers the whole MHT, so the
+ *          cached nodes are valid if they match. On failure, the context should be closed.
+ */
+pf_status_t pf_reopen(pf_context_t* pf, pf_handle_t handle, uint64_t underlying_size,
+                      pf_file_mode_t mode, const pf_key_t* key);
+
 /*!
  * \brief Close a protected file and commit all changes to disk
  *
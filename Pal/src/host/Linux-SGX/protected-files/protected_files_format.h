@@ -21,6 +21,9 @@
 #define PF_FILE_ID       0x46505f5346415247 /* GRAFS_PF */
 #define PF_MAJOR_VERSION 0x01
 #define PF_MINOR_VERSION 0x00
+/* files with data nodes bigger than PF_NODE_SIZE; the data node size is stored in the metadata node
+ * and authenticated together with its encrypted part */
+#define PF_MINOR_VERSION_NODE_SIZE 0x01
 
 #define METADATA_KEY_NAME "SGX-PROTECTED-FS-METADATA-KEY"
 #define MAX_LABEL_SIZE    64
@@ -57,11 +60,13 @@ typedef uint8_t metadata_encrypted_blob_t[sizeof(metadata_encrypted_t)];
 #define METADATA_NODE_SIZE PF_NODE_SIZE
 
 typedef uint8_t metadata_padding_t[METADATA_NODE_SIZE -
-                                   (sizeof(metadata_plain_t) + sizeof(metadata_encrypted_blob_t))];
+                                   (sizeof(metadata_plain_t) + sizeof(metadata_encrypted_blob_t)
+                                    + sizeof(uint32_t))];
 
 typedef struct _metadata_node {
     metadata_plain_t          plain_part;
     metadata_encrypted_blob_t encrypted_part;
+    uint32_t                  data_node_size; // only valid for PF_MINOR_VERSION_NODE_SIZE
     metadata_padding_t        padding;
 } metadata_node_t;
 
@@ -89,44 +94,31 @@ typedef struct _mht_node {
 
 static_assert(sizeof(mht_node_t) == PF_NODE_SIZE, "sizeof(mht_node_t)");
 
-typedef struct _data_node {
-    uint8_t data[PF_NODE_SIZE];
-} data_node_t;
-
-static_assert(sizeof(data_node_t) == PF_NODE_SIZE, "sizeof(data_node_t)");
-
-typedef struct _encrypted_node {
-    uint8_t cipher[PF_NODE_SIZE];
-} encrypted_node_t;
-
-static_assert(sizeof(encrypted_node_t) == PF_NODE_SIZE, "sizeof(encrypted_node_t)");
-
-#define MAX_PAGES_IN_CACHE 48
-
 typedef enum {
     FILE_MHT_NODE_TYPE  = 1,
     FILE_DATA_NODE_TYPE = 2,
 } mht_node_type_e;
 
-// make sure these are the same size
-static_assert(sizeof(mht_node_t) == sizeof(data_node_t),
-              "sizeof(mht_node_t) == sizeof(data_node_t)");
-
+// Physical layout of the file: every node occupies a slot of the data node size of the file
+// (PF_NODE_SIZE unless the file has PF_MINOR_VERSION_NODE_SIZE), the metadata and MHT nodes only
+// use the first PF_NODE_SIZE bytes of their slots (the rest is a hole in the host file).
 DEFINE_LIST(_file_node);
 typedef struct _file_node {
-    LIST_TYPE(_file_node) list;
+    LIST_TYPE(_file_node) list; // in pf_context::dirty_nodes while need_writing is set
     uint8_t type;
     uint64_t node_number;
     struct _file_node* parent;
     bool need_writing;
     bool new_node;
+    bool read_ahead; // read ahead from disk and not accessed yet
+    uint32_t node_size; // PF_NODE_SIZE for MHT nodes, data node size of the file for data nodes
     struct {
         uint64_t physical_node_number;
-        encrypted_node_t encrypted; // the actual data from the disk
+        uint8_t* encrypted; // the actual data from the disk
     };
     union { // decrypted data
-        mht_node_t mht;
-        data_node_t data;
+        mht_node_t* mht;
+        uint8_t* data;
     } decrypted;
 } file_node_t;
 DEFINE_LISTP(_file_node);
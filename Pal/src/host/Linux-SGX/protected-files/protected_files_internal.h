@@ -19,6 +19,8 @@ struct pf_context {
     pf_status_t last_error;
     metadata_encrypted_t encrypted_part_plain; // encrypted part of metadata node, decrypted
     file_node_t root_mht; // the root of the mht is always needed (for files bigger than 3KB)
+    uint8_t root_mht_buffers[2 * PF_NODE_SIZE]; // encrypted and decrypted contents of root_mht
+    uint32_t data_node_size; // also the size of the slots of all nodes in the file
     pf_handle_t file;
     pf_file_mode_t mode;
     uint64_t offset; // current file position (user's view)
@@ -29,6 +31,19 @@ struct pf_context {
     pf_key_t user_kdk_key;
     pf_key_t cur_key;
     lruc_context_t* cache;
+    size_t cache_max_nodes; // maximum number of data and MHT nodes kept in the cache
+    // dirty data and MHT nodes (except the root MHT node), in the order in which they became dirty;
+    // for appends this is also their order in the file, so flushes need not look at clean nodes
+    // nor sort the dirty ones
+    LISTP_TYPE(_file_node) dirty_nodes;
+    size_t dirty_count;
+    bool dirty_sorted; // `dirty_nodes` is ordered by position in the file
+    uint64_t read_ahead_next_node; // physical number of the node following the last read ones
+    // per-file reader/writer lock (see ipf_lock_shared()): number of shared holders, or -1 if held
+    // exclusively; exclusive waiters block new shared holders to avoid starvation
+    int64_t lock_state;
+    uint32_t exclusive_waiters;
+    uint32_t cache_lock; // protects `cache` and `read_ahead_next_node` under the shared lock
 #ifdef DEBUG
     char* debug_buffer; // buffer for debug output
 #endif
@@ -48,6 +63,12 @@ static bool ipf_import_metadata_key(pf_context_t* pf, bool restore, pf_key_t* ou
 static bool ipf_generate_random_key(pf_context_t* pf, pf_key_t* output);
 static bool ipf_restore_current_metadata_key(pf_context_t* pf, pf_key_t* output);
 
+static bool ipf_init_cache(pf_context_t* pf);
+static file_node_t* ipf_alloc_node(pf_context_t* pf, uint8_t type);
+static void ipf_free_node(file_node_t* node);
+static void ipf_mark_dirty(pf_context_t* pf, file_node_t* node);
+static bool ipf_seal_appended_node(pf_context_t* pf, file_node_t* node);
+static bool ipf_shrink_cache(pf_context_t* pf);
 static file_node_t* ipf_get_data_node(pf_context_t* pf);
 static file_node_t* ipf_read_data_node(pf_context_t* pf);
 static file_node_t* ipf_append_data_node(pf_context_t* pf);
@@ -64,8 +85,10 @@ static pf_context_t* ipf_open(const char* path, pf_file_mode_t mode, bool create
                               size_t real_size, const pf_key_t* kdk_key, pf_status_t* status);
 static bool ipf_close(pf_context_t* pf);
 static size_t ipf_read(pf_context_t* pf, void* ptr, size_t size);
+static size_t ipf_read_shared(pf_context_t* pf, uint64_t offset, void* ptr, size_t size);
 static size_t ipf_write(pf_context_t* pf, const void* ptr, size_t size);
 static bool ipf_seek(pf_context_t* pf, uint64_t new_offset);
+static pf_status_t ipf_set_size(pf_context_t* pf, uint64_t size);
 static void ipf_try_clear_error(pf_context_t* pf);
 
 #endif /* PROTECTED_FILES_INTERNAL_H_ */
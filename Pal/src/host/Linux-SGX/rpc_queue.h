@@ -10,21 +10,41 @@
  * threads. If user specifies "0" or omits this directive, then no RPC threads are created and all
  * syscalls perform an enclave exit (as in previous versions of Graphene).
  *
+ * By default, all syscalls that support exitless are sent to RPC threads. The user can restrict
+ * this to a list of OCALLs via "sgx.rpc_ocalls = [...]"; all other OCALLs then perform a normal
+ * enclave exit (see `init_rpc_policy()` in enclave_ocalls.c).
+ *
  * All enclave and RPC threads work on a single shared RPC queue (global variable `g_rpc_queue`).
- * To issue a syscall, enclave thread enqueues syscall request in the queue and spins waiting for
- * result. RPC threads spin waiting for syscall requests; when request comes, first lucky RPC
- * thread grabs request, issues syscall to OS, and notifies enclave thread by releasing the request
- * lock. RPC queue is implemented as a FIFO ring buffer with one global lock.
+ * The queue consists of per-enclave-thread rings: each enclave thread (identified by the index of
+ * its TCS slot) owns exactly one ring and is the only producer on it. To issue a syscall, enclave
+ * thread enqueues syscall request in its own ring and spins waiting for result. RPC threads spin
+ * waiting for syscall requests; each RPC thread starts scanning the rings from its "home" ring and
+ * steals requests from other rings when its home ring is empty. The first lucky RPC thread grabs
+ * the request by atomically advancing the ring's front index, issues syscall to OS, and notifies
+ * enclave thread by releasing the request lock. No global lock is taken on the OCALL path; the
+ * queue-wide lock only protects registration of RPC threads at startup.
  *
- * The RPC queue with its ring buffer resides in *untrusted memory*. The enclave code accessing the
+ * The RPC queue with its rings resides in *untrusted memory*. The enclave code accessing the
  * RPC queue must be carefully written to withstand attacks tampering with the queue.
  *
- * RPC queue can have up to RPC_QUEUE_SIZE requests simultaneously. All requests are allocated on
- * the untrusted stack of the enclave thread; enclave thread owns its requests and pops them off
- * stack when done with the system call. After enqueuing the request, enclave thread first spins
+ * RPC queue can have up to RPC_QUEUE_SIZE rings (one per enclave thread), each holding up to
+ * RPC_RING_SIZE requests (in practice, an enclave thread has at most two outstanding requests: a
+ * synchronous OCALL and possibly one asynchronous OCALL, see `sgx.rpc_async_ocalls`). Synchronous
+ * requests are allocated on the untrusted stack of the enclave thread; enclave thread owns its
+ * requests and pops them off stack when done with the system call. After enqueuing the request, enclave thread first spins
  * for some time in hope the system call returns immediately (fast path), then sleeps waiting on
  * futex (slow path, useful for blocking syscalls).
  *
+ * RPC threads that found the queue empty for "sgx.rpc_idle_timeout_ms" park on a futex; an enclave
+ * thread that enqueues a request while no RPC thread is available (i.e., all are parked or blocked
+ * in a host syscall) wakes a parked one up (this costs one enclave exit). An RPC thread about to
+ * execute a potentially blocking OCALL (accept, recv, poll, futex wait...) first makes sure that
+ * another RPC thread stays available, by unparking one or creating a new one (up to
+ * "sgx.rpc_thread_max"); busy RPC threads do the same when there are more outstanding requests
+ * than available RPC threads. The pool never shrinks: parked RPC threads are not destroyed (they
+ * keep their untrusted stack and slot in `rpc_threads`, which is needed to interrupt them with
+ * SIGUSR2) but they consume no CPU time.
+ *
  * NOTE: number of created RPC threads must match max number of simultaneous enclave threads. If
  * there are more RPC threads, CPU time is wasted. If there are less, some enclave threads may
  * starve, especially if there are many blocking syscalls by other enclave threads.
@@ -40,22 +60,27 @@
 #ifndef QUEUE_H_
 #define QUEUE_H_
 
+#include <assert.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
 #include "spinlock.h"
 
-/* Number of iterations to spin before sleeping. We choose 1M as follows: we want to sleep on
+/* Default number of iterations to spin before sleeping (can be changed via `sgx.rpc_max_spin`,
+ * see also `sgx.rpc_spin_policy`). We choose 1M as follows: we want to sleep on
  * blocking syscalls but we want to allow ample time for fast syscalls to complete. We choose
  * 1 millisecond -- more than enough time to complete any non-blocking syscall. Assuming a 1GHz
  * CPU and no pipelining (and ignoring the pause instruction), 1 millisecond is 1M cycles. This
  * works well in practice. */
 #define RPC_SPINLOCK_TIMEOUT 1000000
 
-#define RPC_QUEUE_SIZE  1024 /* max # of requests in RPC queue */
+#define RPC_QUEUE_SIZE  1024 /* max # of per-thread rings in RPC queue (= max # of enclave threads) */
+#define RPC_RING_SIZE   4    /* max # of requests in one per-thread ring, must be a power of 2 */
 #define MAX_RPC_THREADS 256  /* max number of RPC threads */
 
+static_assert((RPC_RING_SIZE & (RPC_RING_SIZE - 1)) == 0, "RPC_RING_SIZE must be a power of 2");
+
 typedef struct {
     spinlock_t lock; /* can be UNLOCKED / LOCKED_NO_WAITERS / LOCKED_WITH_WAITERS */
     long result;
@@ -63,90 +88,122 @@ typedef struct {
     void* buffer;
 } rpc_request_t;
 
+/* Single-producer (owning enclave thread), multi-consumer (RPC threads) ring. Aligned to a cache
+ * line so that enclave threads spinning on neighbouring rings do not falsely share lines. */
+typedef struct {
+    uint64_t front;                 /* advanced by RPC threads via compare-and-swap */
+    uint64_t rear;                  /* advanced only by the owning enclave thread */
+    rpc_request_t* q[RPC_RING_SIZE]; /* ring of syscall requests */
+} __attribute__((aligned(64))) rpc_ring_t;
+
 typedef struct rpc_queue {
-    spinlock_t lock;                  /* global lock for enclave and RPC threads */
-    uint64_t front, rear;             /* indexes into front and rear ends of q */
-    rpc_request_t* q[RPC_QUEUE_SIZE]; /* queue of syscall requests */
+    rpc_ring_t rings[RPC_QUEUE_SIZE]; /* per-enclave-thread rings of syscall requests */
+    size_t rings_cnt;                 /* number of rings in use (= max number of enclave threads) */
+    size_t awake_cnt;                 /* number of RPC threads that are not parked */
+    size_t blocked_cnt;               /* number of RPC threads in potentially blocking OCALLs */
+    uint32_t wakeup;                  /* futex word that parked RPC threads wait on */
+    spinlock_t lock;                  /* protects RPC threads registration only */
     int rpc_threads[MAX_RPC_THREADS]; /* RPC threads (thread IDs) */
     size_t rpc_threads_cnt;           /* number of RPC threads */
 } rpc_queue_t;
 
 extern rpc_queue_t* g_rpc_queue;  /* global RPC queue */
 
-static inline void rpc_queue_init(rpc_queue_t* q) {
+static inline void rpc_queue_init(rpc_queue_t* q, size_t rings_cnt) {
     spinlock_init(&q->lock);
-    q->front = 0;
-    q->rear  = 0;
-    for (size_t i = 0; i < RPC_QUEUE_SIZE; i++)
-        q->q[i] = NULL;
+    for (size_t i = 0; i < RPC_QUEUE_SIZE; i++) {
+        q->rings[i].front = 0;
+        q->rings[i].rear  = 0;
+        for (size_t j = 0; j < RPC_RING_SIZE; j++)
+            q->rings[i].q[j] = NULL;
+    }
+    q->rings_cnt = rings_cnt;
+    q->awake_cnt   = 0;
+    q->blocked_cnt = 0;
+    q->wakeup      = 0;
+    q->rpc_threads_cnt = 0;
 }
 
 /*!
- * \brief Enqueue OCALL request `req` in the shared RPC queue `q`.
+ * \brief Enqueue OCALL request `req` in the ring `ring_idx` of the shared RPC queue `q`.
  *
  * This function is called from the enclave code and thus must be written carefully to withstand
  * attacks tampering with untrusted `req` and untrusted `q`. In particular, `req` and `q` must not
  * have arbitrary pointers (or alternatively the code below must sanitize possible pointer values)
- * to prevent arbitrary writes to/reads from the enclave memory. Similarly, `q->q[idx]` code must
- * ensure that `idx` points inside the `q->q` array to prevent buffer overflows.
+ * to prevent arbitrary writes to/reads from the enclave memory. Similarly, `ring->q[idx]` code must
+ * ensure that `idx` points inside the `ring->q` array to prevent buffer overflows.
+ *
+ * Only the enclave thread owning the ring `ring_idx` may call this function, so no lock is needed
+ * on the producer side.
  */
-static inline bool rpc_enqueue(rpc_queue_t* q, rpc_request_t* req) {
-    bool ret = false;
-    spinlock_lock(&q->lock);
-
-    if (q->rear - q->front >= RPC_QUEUE_SIZE) {
-        /* queue is full, cannot enqueue */
-        goto out;
+static inline bool rpc_enqueue(rpc_queue_t* q, size_t ring_idx, rpc_request_t* req) {
+    rpc_ring_t* ring = &q->rings[ring_idx % RPC_QUEUE_SIZE];
+
+    uint64_t rear  = __atomic_load_n(&ring->rear, __ATOMIC_RELAXED);
+    uint64_t front = __atomic_load_n(&ring->front, __ATOMIC_ACQUIRE);
+    if (rear - front >= RPC_RING_SIZE) {
+        /* ring is full (or tampered with), cannot enqueue */
+        return false;
     }
 
-    if (q->q[q->rear % RPC_QUEUE_SIZE]) {
-        /* current slot is occupied, cannot enqueue but the caller can try again */
-        q->rear++;
-        goto out;
-    }
+    __atomic_store_n(&ring->q[rear % RPC_RING_SIZE], req, __ATOMIC_RELAXED);
+    /* publish the request to RPC threads */
+    __atomic_store_n(&ring->rear, rear + 1, __ATOMIC_RELEASE);
+    return true;
+}
 
-    q->q[q->rear % RPC_QUEUE_SIZE] = req;
-    q->rear++;
-    ret = true;
-out:
-    spinlock_unlock(&q->lock);
-    return ret;
+/* Try to grab one request from `ring`; returns NULL if the ring is empty. */
+static inline rpc_request_t* rpc_ring_dequeue(rpc_ring_t* ring) {
+    uint64_t front = __atomic_load_n(&ring->front, __ATOMIC_ACQUIRE);
+    while (1) {
+        uint64_t rear = __atomic_load_n(&ring->rear, __ATOMIC_ACQUIRE);
+        if (front == rear) {
+            /* ring is empty, nothing to dequeue */
+            return NULL;
+        }
+
+        /* the slot cannot be overwritten by the producer until `front` is advanced past it, so if
+         * the CAS below succeeds, `req` is exactly the request published at index `front` */
+        rpc_request_t* req = __atomic_load_n(&ring->q[front % RPC_RING_SIZE], __ATOMIC_RELAXED);
+        if (__atomic_compare_exchange_n(&ring->front, &front, front + 1, /*weak=*/false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            return req;
+        }
+        /* another RPC thread stole this request, `front` was updated by CAS; retry */
+    }
 }
 
 /*!
- * \brief Dequeue OCALL request `req` from the shared RPC queue `q`.
+ * \brief Return the number of outstanding (not yet dequeued) requests in all rings of `q`.
  *
  * This function is called only from the untrusted code and thus has no security implications.
  */
-static inline rpc_request_t* rpc_dequeue(rpc_queue_t* q) {
-    if (__atomic_load_n(&q->front, __ATOMIC_RELAXED) ==
-            __atomic_load_n(&q->rear,  __ATOMIC_RELAXED)) {
-        /* quick check that queue is empty; this doesn't acquire a spinlock and thus lowers latency
-         * on rpc_enqueue() performed by enclave threads (they don't have to wait for spinlock
-         * release); note that untrusted RPC threads will simply retry again if this check fails */
-        return NULL;
-    }
-
-    rpc_request_t* ret = NULL;
-    spinlock_lock(&q->lock);
-
-    if (q->front == q->rear) {
-        /* queue is empty, nothing to dequeue */
-        goto out;
+static inline size_t rpc_pending_requests(rpc_queue_t* q) {
+    size_t pending = 0;
+    for (size_t i = 0; i < q->rings_cnt; i++) {
+        rpc_ring_t* ring = &q->rings[i];
+        pending += __atomic_load_n(&ring->rear, __ATOMIC_SEQ_CST)
+                   - __atomic_load_n(&ring->front, __ATOMIC_SEQ_CST);
     }
+    return pending;
+}
 
-    if (!q->q[q->front % RPC_QUEUE_SIZE]) {
-        /* current slot is empty, cannot dequeue but the caller can try next one */
-        q->front++;
-        goto out;
+/*!
+ * \brief Dequeue OCALL request `req` from the shared RPC queue `q`.
+ *
+ * Scans all rings starting from `home_idx` (the "home" ring of the calling RPC thread), stealing
+ * requests from other enclave threads' rings if the home ring is empty.
+ *
+ * This function is called only from the untrusted code and thus has no security implications.
+ */
+static inline rpc_request_t* rpc_dequeue(rpc_queue_t* q, size_t home_idx) {
+    size_t cnt = q->rings_cnt;
+    for (size_t i = 0; i < cnt; i++) {
+        rpc_request_t* req = rpc_ring_dequeue(&q->rings[(home_idx + i) % cnt]);
+        if (req)
+            return req;
     }
-
-    ret = q->q[q->front % RPC_QUEUE_SIZE];
-    q->q[q->front % RPC_QUEUE_SIZE] = NULL;
-    q->front++;
-out:
-    spinlock_unlock(&q->lock);
-    return ret;
+    return NULL;
 }
 
 #endif /* QUEUE_H_ */
@@ -20,6 +20,12 @@ void sgx_reset_ustack(const void* old_ustack);
 bool sgx_copy_ptr_to_enclave(void** ptr, void* uptr, size_t size);
 bool sgx_copy_to_enclave(void* ptr, size_t maxsize, const void* uptr, size_t usize);
 
+/* Copies from the enclave to untrusted memory; copies of at least `g_nontemporal_copy_threshold`
+ * bytes (`sgx.nontemporal_copy_threshold`, 0 means never) bypass the cache, so that large I/O
+ * payloads don't evict the enclave's working set. */
+extern size_t g_nontemporal_copy_threshold;
+bool sgx_copy_from_enclave(void* uptr, const void* ptr, size_t size);
+
 /*!
  * \brief Low-level wrapper around EREPORT instruction leaf.
  *
@@ -50,4 +56,53 @@ static inline int64_t sgx_getkey(sgx_key_request_t* keyrequest, sgx_key_128bit_t
     return rax;
 }
 
+/*!
+ * \brief Low-level wrapper around EACCEPT instruction leaf (SGX2).
+ *
+ * Caller is responsible for 64B alignment of `secinfo`. Returns 0 on success and SGX error code
+ * otherwise.
+ */
+static inline int64_t sgx_accept(sgx_arch_sec_info_t* secinfo, const void* addr) {
+    int64_t rax = EACCEPT;
+    __asm__ volatile(
+        ENCLU "\n"
+        : "+a"(rax)
+        : "b"(secinfo), "c"(addr)
+        : "memory");
+    return rax;
+}
+
+/*!
+ * \brief Low-level wrapper around EMODPE instruction leaf (SGX2).
+ *
+ * Extends EPCM permissions of the page at `addr` with the permissions in `secinfo`. Caller is
+ * responsible for 64B alignment of `secinfo`.
+ */
+static inline void sgx_modpe(sgx_arch_sec_info_t* secinfo, const void* addr) {
+    uint64_t rax = EMODPE;
+    __asm__ volatile(
+        ENCLU "\n"
+        : "+a"(rax)
+        : "b"(secinfo), "c"(addr)
+        : "memory");
+}
+
+/*!
+ * \brief Low-level wrapper around EACCEPTCOPY instruction leaf (SGX2).
+ *
+ * Initializes the pending page at `addr` with the contents of the enclave page at `src` and with
+ * the permissions in `secinfo`. Caller is responsible for 64B alignment of `secinfo` and page
+ * alignment of `addr` and `src`. Returns 0 on success and SGX error code otherwise.
+ */
+static inline int64_t sgx_accept_copy(sgx_arch_sec_info_t* secinfo, const void* addr,
+                                      const void* src) {
+    int64_t rax = EACCEPTCOPY;
+    __asm__ volatile(
+        ENCLU "\n"
+        : "+a"(rax)
+        : "b"(secinfo), "c"(addr), "d"(src)
+        : "memory");
+    return rax;
+}
+
 #endif /* SGX_API_H */
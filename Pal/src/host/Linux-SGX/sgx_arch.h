@@ -184,10 +184,19 @@ typedef struct {
 #define SGX_EXCEPTION_VECTOR_BP 3UL  /* INT 3 instruction */
 #define SGX_EXCEPTION_VECTOR_BR 5UL  /* BOUND instruction */
 #define SGX_EXCEPTION_VECTOR_UD 6UL  /* UD2 instruction or reserved opcodes */
+#define SGX_EXCEPTION_VECTOR_GP 13UL /* General protection, only with MISCSELECT.EXINFO (SGX2) */
+#define SGX_EXCEPTION_VECTOR_PF 14UL /* Page fault, only with MISCSELECT.EXINFO (SGX2) */
 #define SGX_EXCEPTION_VECTOR_MF 16UL /* x87 FPU floating-point or WAIT/FWAIT instruction */
 #define SGX_EXCEPTION_VECTOR_AC 17UL /* Any data reference in memory */
 #define SGX_EXCEPTION_VECTOR_XM 19UL /* Any SIMD floating-point exceptions */
 
+/* EXINFO part of the SSA MISC region, located right below GPRSGX (SGX2) */
+typedef struct {
+    uint64_t maddr; /* faulting linear address (lower 12 bits are cleared for #PF) */
+    uint32_t errcd; /* exception error code */
+    uint32_t reserved;
+} sgx_arch_exinfo_t;
+
 typedef struct {
     uint64_t lin_addr;
     uint64_t src_pge;
@@ -200,12 +209,22 @@ typedef struct {
     uint64_t reserved[7];
 } sgx_arch_sec_info_t;
 
-#define SGX_SECINFO_FLAGS_R    0x001
-#define SGX_SECINFO_FLAGS_W    0x002
-#define SGX_SECINFO_FLAGS_X    0x004
-#define SGX_SECINFO_FLAGS_SECS 0x000
-#define SGX_SECINFO_FLAGS_TCS  0x100
-#define SGX_SECINFO_FLAGS_REG  0x200
+#define SGX_SECINFO_FLAGS_R        0x001
+#define SGX_SECINFO_FLAGS_W        0x002
+#define SGX_SECINFO_FLAGS_X        0x004
+#define SGX_SECINFO_FLAGS_PENDING  0x008
+#define SGX_SECINFO_FLAGS_MODIFIED 0x010
+#define SGX_SECINFO_FLAGS_PR       0x020
+#define SGX_SECINFO_FLAGS_SECS     0x000
+#define SGX_SECINFO_FLAGS_TCS      0x100
+#define SGX_SECINFO_FLAGS_REG      0x200
+#define SGX_SECINFO_FLAGS_TRIM     0x400
+
+#define SGX_SECINFO_FLAGS_RWX (SGX_SECINFO_FLAGS_R | SGX_SECINFO_FLAGS_W | SGX_SECINFO_FLAGS_X)
+
+/* page type as passed to SGX_IOC_ENCLAVE_MODIFY_TYPES (bits 15:8 of SECINFO flags) */
+#define SGX_PAGE_TYPE_TCS  1
+#define SGX_PAGE_TYPE_TRIM 4
 
 typedef struct _css_header_t {
     uint8_t  header[12];
@@ -365,6 +384,9 @@ typedef uint8_t sgx_key_128bit_t[16];
 #define EREPORT 0
 #define EGETKEY 1
 #define EEXIT   4
+#define EACCEPT     5
+#define EMODPE      6
+#define EACCEPTCOPY 7
 
 #define LAUNCH_KEY         0
 #define PROVISION_KEY      1
@@ -14,6 +14,7 @@
 #include <linux/in6.h>
 #include <linux/signal.h>
 #include <math.h>
+#include <sys/eventfd.h>
 #include <sys/wait.h>
 
 #include "cpu.h"
@@ -28,6 +29,7 @@
 #include "sgx_log.h"
 #include "sgx_process.h"
 #include "sgx_tls.h"
+#include "sgx_uring.h"
 #include "sigset.h"
 
 #define DEFAULT_BACKLOG 2048
@@ -72,6 +74,9 @@ static long sgx_ocall_exit(void* pms) {
         die_or_inf_loop();
     }
 
+    /* returns only if this host thread cannot be kept for a later enclave thread */
+    park_thread();
+
     thread_exit((int)ms->ms_exitcode);
     return 0;
 }
@@ -167,6 +172,30 @@ static long sgx_ocall_fstat(void* pms) {
     return ret;
 }
 
+static long sgx_ocall_stat(void* pms) {
+    ms_ocall_stat_t* ms = (ms_ocall_stat_t*)pms;
+    ODEBUG(OCALL_STAT, ms);
+    return DO_SYSCALL_INTERRUPTIBLE(stat, ms->ms_pathname, &ms->ms_stat);
+}
+
+static long sgx_ocall_open_stat(void* pms) {
+    ms_ocall_open_stat_t* ms = (ms_ocall_open_stat_t*)pms;
+    long ret;
+    ODEBUG(OCALL_OPEN_STAT, ms);
+    /* O_CLOEXEC as in sgx_ocall_open() */
+    long fd = DO_SYSCALL_INTERRUPTIBLE(open, ms->ms_pathname, ms->ms_flags | O_CLOEXEC,
+                                       ms->ms_mode);
+    if (fd < 0)
+        return fd;
+
+    ret = DO_SYSCALL(fstat, fd, &ms->ms_stat);
+    if (ret < 0) {
+        DO_SYSCALL(close, fd);
+        return ret;
+    }
+    return fd;
+}
+
 static long sgx_ocall_fionread(void* pms) {
     ms_ocall_fionread_t* ms = (ms_ocall_fionread_t*)pms;
     long ret;
@@ -237,6 +266,27 @@ static long sgx_ocall_getdents(void* pms) {
     return ret;
 }
 
+static long sgx_ocall_getdents_stat(void* pms) {
+    ms_ocall_getdents_stat_t* ms = (ms_ocall_getdents_stat_t*)pms;
+    long ret;
+    ODEBUG(OCALL_GETDENTS_STAT, ms);
+    unsigned int count = ms->ms_size <= UINT_MAX ? ms->ms_size : UINT_MAX;
+    ret = DO_SYSCALL_INTERRUPTIBLE(getdents64, ms->ms_fd, ms->ms_dirp, count);
+    if (ret <= 0)
+        return ret;
+
+    /* stat each returned entry relative to the directory fd; entries that cannot be stat'ed (e.g.
+     * deleted in the meantime, or dangling symlinks) are marked with `st_mode == 0` */
+    size_t offset = 0;
+    for (size_t i = 0; i < ms->ms_stats_cnt && offset < (size_t)ret; i++) {
+        struct linux_dirent64* dirent = (struct linux_dirent64*)((char*)ms->ms_dirp + offset);
+        if (DO_SYSCALL(newfstatat, ms->ms_fd, dirent->d_name, &ms->ms_stats[i], 0) < 0)
+            ms->ms_stats[i].st_mode = 0;
+        offset += dirent->d_reclen;
+    }
+    return ret;
+}
+
 static long sgx_ocall_resume_thread(void* pms) {
     ODEBUG(OCALL_RESUME_THREAD, pms);
     int tid = get_tid_from_tcs(pms);
@@ -270,8 +320,15 @@ static long sgx_ocall_sched_getaffinity(void* pms) {
 }
 
 static long sgx_ocall_clone_thread(void* pms) {
-    __UNUSED(pms);
-    ODEBUG(OCALL_CLONE_THREAD, pms);
+    ms_ocall_clone_thread_t* ms = (ms_ocall_clone_thread_t*)pms;
+    ODEBUG(OCALL_CLONE_THREAD, ms);
+
+    if (ms->ms_tcs) {
+        /* the enclave has just added a TCS page (EDMM), make it available to new threads */
+        int ret = add_tcs(ms->ms_tcs);
+        if (ret < 0)
+            return ret;
+    }
     return clone_thread();
 }
 
@@ -434,6 +491,31 @@ err:
     return ret;
 }
 
+/* Accepts up to `ms_max` pending connections on a non-blocking listening socket in one OCALL.
+ * Stops at the first failing accept; its error is returned only if nothing was accepted. */
+static long sgx_ocall_accept_batch(void* pms) {
+    ms_ocall_accept_batch_t* ms = (ms_ocall_accept_batch_t*)pms;
+    long ret = 0;
+    unsigned int count = 0;
+    ODEBUG(OCALL_ACCEPT_BATCH, ms);
+
+    while (count < ms->ms_max) {
+        struct ocall_accepted_conn* conn = &ms->ms_conns[count];
+        int addrlen = sizeof(conn->addr);
+
+        ret = DO_SYSCALL_INTERRUPTIBLE(accept4, ms->ms_sockfd, (void*)&conn->addr, &addrlen,
+                                       O_CLOEXEC);
+        if (ret < 0)
+            break;
+
+        conn->fd = ret;
+        conn->addrlen = addrlen;
+        count++;
+    }
+
+    return count ? (long)count : ret;
+}
+
 static long sgx_ocall_connect(void* pms) {
     ms_ocall_connect_t* ms = (ms_ocall_connect_t*)pms;
     long ret;
@@ -503,73 +585,421 @@ err:
     return ret;
 }
 
+static int recv_prepare_msghdr(ms_ocall_recv_t* ms, struct msghdr* hdr, struct iovec* iov) {
+    if (ms->ms_addr && ms->ms_addrlen > INT_MAX) {
+        return -EINVAL;
+    }
+    int addrlen = ms->ms_addr ? ms->ms_addrlen : 0;
+
+    iov->iov_base       = ms->ms_buf;
+    iov->iov_len        = ms->ms_count;
+    hdr->msg_name       = ms->ms_addr;
+    hdr->msg_namelen    = addrlen;
+    hdr->msg_iov        = iov;
+    hdr->msg_iovlen     = 1;
+    hdr->msg_control    = ms->ms_control;
+    hdr->msg_controllen = ms->ms_controllen;
+    hdr->msg_flags      = 0;
+    return 0;
+}
+
+static void recv_finish(ms_ocall_recv_t* ms, struct msghdr* hdr, long ret) {
+    if (ret >= 0 && hdr->msg_name) {
+        /* note that ms->ms_addr is filled by recvmsg() itself */
+        ms->ms_addrlen = hdr->msg_namelen;
+    }
+
+    if (ret >= 0 && hdr->msg_control) {
+        /* note that ms->ms_control is filled by recvmsg() itself */
+        ms->ms_controllen = hdr->msg_controllen;
+    }
+}
+
 static long sgx_ocall_recv(void* pms) {
     ms_ocall_recv_t* ms = (ms_ocall_recv_t*)pms;
     long ret;
     ODEBUG(OCALL_RECV, ms);
-    struct sockaddr* addr = ms->ms_addr;
 
+    struct msghdr hdr;
+    struct iovec iov[1];
+
+    ret = recv_prepare_msghdr(ms, &hdr, iov);
+    if (ret < 0)
+        return ret;
+
+    ret = DO_SYSCALL_INTERRUPTIBLE(recvmsg, ms->ms_sockfd, &hdr, 0);
+    recv_finish(ms, &hdr, ret);
+    return ret;
+}
+
+static int send_prepare_msghdr(ms_ocall_send_t* ms, struct msghdr* hdr, struct iovec* iov) {
     if (ms->ms_addr && ms->ms_addrlen > INT_MAX) {
         return -EINVAL;
     }
     int addrlen = ms->ms_addr ? ms->ms_addrlen : 0;
 
+    iov->iov_base       = (void*)ms->ms_buf;
+    iov->iov_len        = ms->ms_count;
+    hdr->msg_name       = (void*)ms->ms_addr;
+    hdr->msg_namelen    = addrlen;
+    hdr->msg_iov        = iov;
+    hdr->msg_iovlen     = 1;
+    hdr->msg_control    = ms->ms_control;
+    hdr->msg_controllen = ms->ms_controllen;
+    hdr->msg_flags      = 0;
+    return 0;
+}
+
+static long sgx_ocall_send(void* pms) {
+    ms_ocall_send_t* ms = (ms_ocall_send_t*)pms;
+    long ret;
+    ODEBUG(OCALL_SEND, ms);
+
     struct msghdr hdr;
     struct iovec iov[1];
 
-    iov[0].iov_base    = ms->ms_buf;
-    iov[0].iov_len     = ms->ms_count;
-    hdr.msg_name       = addr;
-    hdr.msg_namelen    = addrlen;
-    hdr.msg_iov        = iov;
-    hdr.msg_iovlen     = 1;
-    hdr.msg_control    = ms->ms_control;
-    hdr.msg_controllen = ms->ms_controllen;
-    hdr.msg_flags      = 0;
+    ret = send_prepare_msghdr(ms, &hdr, iov);
+    if (ret < 0)
+        return ret;
 
-    ret = DO_SYSCALL_INTERRUPTIBLE(recvmsg, ms->ms_sockfd, &hdr, 0);
+    ret = DO_SYSCALL_INTERRUPTIBLE(sendmsg, ms->ms_sockfd, &hdr, MSG_NOSIGNAL);
+    return ret;
+}
 
-    if (ret >= 0 && hdr.msg_name) {
-        /* note that ms->ms_addr is filled by recvmsg() itself */
-        ms->ms_addrlen = hdr.msg_namelen;
-    }
+static int mmsg_prepare_hdrs(ms_ocall_mmsg_t* ms, struct mmsghdr* hdrs, struct iovec* iovs) {
+    if (ms->ms_vlen > OCALL_MMSG_MAX)
+        return -EINVAL;
 
-    if (ret >= 0 && hdr.msg_control) {
-        /* note that ms->ms_control is filled by recvmsg() itself */
-        ms->ms_controllen = hdr.msg_controllen;
+    for (unsigned int i = 0; i < ms->ms_vlen; i++) {
+        struct ocall_mmsg* msg = &ms->ms_msgs[i];
+        if (msg->addr && msg->addrlen > INT_MAX)
+            return -EINVAL;
+
+        iovs[i].iov_base = msg->buf;
+        iovs[i].iov_len  = msg->len;
+        hdrs[i].msg_hdr.msg_name       = msg->addr;
+        hdrs[i].msg_hdr.msg_namelen    = msg->addr ? msg->addrlen : 0;
+        hdrs[i].msg_hdr.msg_iov        = &iovs[i];
+        hdrs[i].msg_hdr.msg_iovlen     = 1;
+        hdrs[i].msg_hdr.msg_control    = NULL;
+        hdrs[i].msg_hdr.msg_controllen = 0;
+        hdrs[i].msg_hdr.msg_flags      = 0;
+        hdrs[i].msg_len                = 0;
     }
+    return 0;
+}
+
+static long sgx_ocall_sendmmsg(void* pms) {
+    ms_ocall_mmsg_t* ms = (ms_ocall_mmsg_t*)pms;
+    long ret;
+    ODEBUG(OCALL_SENDMMSG, ms);
+
+    struct mmsghdr hdrs[OCALL_MMSG_MAX];
+    struct iovec iovs[OCALL_MMSG_MAX];
+
+    ret = mmsg_prepare_hdrs(ms, hdrs, iovs);
+    if (ret < 0)
+        return ret;
 
+    ret = DO_SYSCALL_INTERRUPTIBLE(sendmmsg, ms->ms_sockfd, hdrs, ms->ms_vlen, MSG_NOSIGNAL);
+    for (long i = 0; i < ret; i++)
+        ms->ms_msgs[i].bytes = hdrs[i].msg_len;
     return ret;
 }
 
-static long sgx_ocall_send(void* pms) {
-    ms_ocall_send_t* ms = (ms_ocall_send_t*)pms;
+static long sgx_ocall_recvmmsg(void* pms) {
+    ms_ocall_mmsg_t* ms = (ms_ocall_mmsg_t*)pms;
     long ret;
-    ODEBUG(OCALL_SEND, ms);
-    const struct sockaddr* addr = ms->ms_addr;
+    ODEBUG(OCALL_RECVMMSG, ms);
 
-    if (ms->ms_addr && ms->ms_addrlen > INT_MAX) {
-        return -EINVAL;
+    struct mmsghdr hdrs[OCALL_MMSG_MAX];
+    struct iovec iovs[OCALL_MMSG_MAX];
+
+    ret = mmsg_prepare_hdrs(ms, hdrs, iovs);
+    if (ret < 0)
+        return ret;
+
+    ret = DO_SYSCALL_INTERRUPTIBLE(recvmmsg, ms->ms_sockfd, hdrs, ms->ms_vlen, MSG_WAITFORONE,
+                                   NULL);
+    for (long i = 0; i < ret; i++) {
+        ms->ms_msgs[i].bytes = hdrs[i].msg_len;
+        if (ms->ms_msgs[i].addr)
+            ms->ms_msgs[i].addrlen = hdrs[i].msg_hdr.msg_namelen;
     }
-    int addrlen = ms->ms_addr ? ms->ms_addrlen : 0;
+    return ret;
+}
 
-    struct msghdr hdr;
-    struct iovec iov[1];
+#define SOCK_RING_STACK_SIZE (64 * 1024)
+#define SOCK_RING_MAP_SIZE \
+    ALIGN_UP(sizeof(struct sock_ring) + SOCK_RING_STACK_SIZE, PRESET_PAGESIZE)
+#define SOCK_RING_CLOCK_SPINS 64 /* empty polls between two reads of the clock */
+#define SOCK_RING_FLUSH_TIMEOUT_US TIME_US_IN_S /* how long stopping waits for queued tx data */
 
-    iov[0].iov_base    = (void*)ms->ms_buf;
-    iov[0].iov_len     = ms->ms_count;
-    hdr.msg_name       = (void*)addr;
-    hdr.msg_namelen    = addrlen;
-    hdr.msg_iov        = iov;
-    hdr.msg_iovlen     = 1;
-    hdr.msg_control    = ms->ms_control;
-    hdr.msg_controllen = ms->ms_controllen;
-    hdr.msg_flags      = 0;
+static uint64_t sock_ring_now_us(void) {
+    struct timespec ts;
+    DO_SYSCALL(clock_gettime, CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * TIME_US_IN_S + ts.tv_nsec / TIME_NS_IN_US;
+}
 
-    ret = DO_SYSCALL_INTERRUPTIBLE(sendmsg, ms->ms_sockfd, &hdr, MSG_NOSIGNAL);
+/* Publishes index `idx` in the futex word `word` of `q` and wakes enclave threads that gave up
+ * spinning on it. */
+static void sock_ring_advance(struct sock_ring_queue* q, uint32_t* word, uint32_t idx) {
+    __atomic_store_n(word, idx, __ATOMIC_SEQ_CST);
+    if (__atomic_exchange_n(&q->waiters, 0, __ATOMIC_SEQ_CST))
+        DO_SYSCALL(futex, word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+/* Receives once from the host socket into the next free rx slot. Returns true if a slot was
+ * published; sets `*done` once the socket will not deliver anything more. */
+static bool sock_ring_rx(struct sock_ring* ring, bool* done) {
+    struct sock_ring_queue* q = &ring->rx;
+    uint32_t tail = q->tail;
+    if (tail - __atomic_load_n(&q->head, __ATOMIC_ACQUIRE) >= SOCK_RING_SLOTS)
+        return false;
+
+    struct sock_ring_slot* slot = &q->slots[tail % SOCK_RING_SLOTS];
+    int addrlen = sizeof(slot->addr);
+    long ret = DO_SYSCALL(recvfrom, ring->sockfd, slot->data, sizeof(slot->data), MSG_DONTWAIT,
+                          ring->stream ? NULL : &slot->addr, ring->stream ? NULL : &addrlen);
+    if (ret == -EAGAIN || ret == -EINTR)
+        return false;
+
+    slot->len     = ret > 0 ? ret : 0;
+    slot->err     = ret < 0 ? ret : 0;
+    slot->addrlen = (ring->stream || ret < 0) ? 0 : addrlen;
+    sock_ring_advance(q, &q->tail, tail + 1);
+    /* TCP ends at EOF or on error; UDP errors (e.g. ECONNREFUSED) are per datagram */
+    *done = ring->stream ? ret <= 0 : (ret == -EBADF || ret == -ENOTSOCK);
+    return true;
+}
+
+/* Publishes the SOCK_RING_RX_STOPPED slot after the enclave set `rx_stop`, from then on the host
+ * socket is left to the process it was handed over to. Returns false if rx is full. */
+static bool sock_ring_rx_stop(struct sock_ring* ring) {
+    struct sock_ring_queue* q = &ring->rx;
+    uint32_t tail = q->tail;
+    if (tail - __atomic_load_n(&q->head, __ATOMIC_ACQUIRE) >= SOCK_RING_SLOTS)
+        return false;
+
+    struct sock_ring_slot* slot = &q->slots[tail % SOCK_RING_SLOTS];
+    slot->len     = 0;
+    slot->err     = SOCK_RING_RX_STOPPED;
+    slot->addrlen = 0;
+    sock_ring_advance(q, &q->tail, tail + 1);
+    return true;
+}
+
+/* Sends the oldest tx slot (for TCP, what is left of it after `*offset`) to the host socket.
+ * Returns true on progress; sets `*blocked` if the host socket buffer is full. */
+static bool sock_ring_tx(struct sock_ring* ring, uint32_t* offset, bool* blocked) {
+    struct sock_ring_queue* q = &ring->tx;
+    uint32_t head = q->head;
+    uint32_t tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+    if (tail == head)
+        return false;
+
+    struct sock_ring_slot* slot = &q->slots[head % SOCK_RING_SLOTS];
+    uint32_t len = MIN(slot->len, sizeof(slot->data));
+    uint32_t addrlen = MIN(slot->addrlen, sizeof(slot->addr));
+    long ret = DO_SYSCALL(sendto, ring->sockfd, slot->data + *offset, len - *offset,
+                          MSG_DONTWAIT | MSG_NOSIGNAL, addrlen ? &slot->addr : NULL, addrlen);
+    if (ret == -EAGAIN || ret == -EINTR) {
+        *blocked = ret == -EAGAIN;
+        return false;
+    }
+
+    if (ring->stream) {
+        if (ret < 0) {
+            /* the connection is broken: report it to the enclave and drop everything queued */
+            int32_t ok = 0;
+            __atomic_compare_exchange_n(&ring->tx_err, &ok, ret, /*weak=*/false,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+            *offset = 0;
+            sock_ring_advance(q, &q->head, tail);
+            return true;
+        }
+        if (*offset + ret < len) {
+            *offset += ret;
+            return true;
+        }
+    }
+
+    /* a failed UDP send drops the datagram, as if it was lost on the wire */
+    *offset = 0;
+    sock_ring_advance(q, &q->head, head + 1);
+    return true;
+}
+
+/* Proxy thread of a socket with rings: moves data between the host socket and the rx/tx rings
+ * without blocking, spins for `budget_us` after the last transfer, then sleeps until the socket is
+ * ready or the enclave kicks it. It also keeps the bell eventfd readable exactly while rx holds
+ * data, because poll and epoll on the (drained) host socket can no longer tell. */
+static int sock_ring_thread_loop(void* arg) {
+    struct sock_ring* ring = (struct sock_ring*)arg;
+
+    __sigset_t mask;
+    __sigfillset(&mask);
+    DO_SYSCALL(rt_sigprocmask, SIG_SETMASK, &mask, NULL, sizeof(mask));
+
+    bool rx_done  = false; /* stream ended or socket failed, nothing more to receive */
+    bool rx_stopped = false; /* SOCK_RING_RX_STOPPED published, see sock_ring_rx_stop() */
+    bool bell_set = false;
+    uint32_t tx_offset  = 0;
+    uint64_t idle_since = 0;
+    unsigned int spins  = 0;
+
+    while (!__atomic_load_n(&ring->stop, __ATOMIC_ACQUIRE)) {
+        bool tx_blocked = false;
+        bool progress = false;
+        if (!rx_stopped && __atomic_load_n(&ring->rx_stop, __ATOMIC_ACQUIRE)) {
+            rx_stopped = sock_ring_rx_stop(ring);
+            rx_done |= rx_stopped;
+            progress = rx_stopped;
+        } else if (!rx_done) {
+            progress = sock_ring_rx(ring, &rx_done);
+        }
+        progress |= sock_ring_tx(ring, &tx_offset, &tx_blocked);
+
+        uint32_t rx_tail = ring->rx.tail;
+        uint32_t rx_head = __atomic_load_n(&ring->rx.head, __ATOMIC_ACQUIRE);
+        bool rx_pending = rx_tail != rx_head;
+        if (rx_pending != bell_set) {
+            uint64_t val = 1;
+            if (rx_pending)
+                DO_SYSCALL(write, ring->bellfd, &val, sizeof(val));
+            else
+                DO_SYSCALL(read, ring->bellfd, &val, sizeof(val));
+            bell_set = rx_pending;
+        }
+
+        if (progress) {
+            idle_since = 0;
+            spins = 0;
+            continue;
+        }
+
+        if (++spins % SOCK_RING_CLOCK_SPINS) {
+            CPU_RELAX();
+            continue;
+        }
+        uint64_t now = sock_ring_now_us();
+        if (!idle_since)
+            idle_since = now;
+        if (now - idle_since < __atomic_load_n(&ring->budget_us, __ATOMIC_RELAXED)) {
+            CPU_RELAX();
+            continue;
+        }
+
+        /* idle for the whole budget: announce that we sleep, so that the enclave kicks us after
+         * queueing tx data or setting `rx_stop`, and re-check both to not miss a change made just
+         * before that */
+        __atomic_store_n(&ring->asleep, 1, __ATOMIC_SEQ_CST);
+        if ((!tx_blocked && __atomic_load_n(&ring->tx.tail, __ATOMIC_SEQ_CST) != ring->tx.head)
+                || (!rx_stopped && __atomic_load_n(&ring->rx_stop, __ATOMIC_SEQ_CST))) {
+            __atomic_store_n(&ring->asleep, 0, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        /* while rx holds data, wake up every millisecond to clear the bell once it is drained */
+        bool rx_full = rx_tail - rx_head >= SOCK_RING_SLOTS;
+        short events = (rx_done || rx_full ? 0 : POLLIN) | (tx_blocked ? POLLOUT : 0);
+        struct pollfd pfds[2] = {
+            {.fd = ring->kickfd, .events = POLLIN, .revents = 0},
+            {.fd = ring->sockfd, .events = events, .revents = 0},
+        };
+        struct timespec timeout = {.tv_sec = 0, .tv_nsec = 1000 * TIME_NS_IN_US};
+        DO_SYSCALL(ppoll, pfds, events ? 2 : 1, rx_pending ? &timeout : NULL, NULL, 0);
+
+        __atomic_store_n(&ring->asleep, 0, __ATOMIC_RELAXED);
+        if (pfds[0].revents & POLLIN) {
+            uint64_t val;
+            DO_SYSCALL(read, ring->kickfd, &val, sizeof(val));
+        }
+        idle_since = 0;
+        spins = 0;
+    }
+
+    /* send what the enclave queued before it closed the socket, but do not hang on a dead peer */
+    uint64_t deadline = sock_ring_now_us() + SOCK_RING_FLUSH_TIMEOUT_US;
+    while (sock_ring_now_us() < deadline) {
+        bool tx_blocked = false;
+        if (sock_ring_tx(ring, &tx_offset, &tx_blocked))
+            continue;
+        if (!tx_blocked)
+            break;
+        struct pollfd pfd = {.fd = ring->sockfd, .events = POLLOUT, .revents = 0};
+        struct timespec timeout = {.tv_sec = 0, .tv_nsec = 10 * 1000 * TIME_NS_IN_US};
+        DO_SYSCALL(ppoll, &pfd, 1, &timeout, NULL, 0);
+    }
+
+    return 0;
+}
+
+static void sock_ring_thread_exit(int status) {
+    /* the stack is part of the ring mapping, which sgx_ocall_sock_ring_stop() unmaps only after
+     * the kernel has cleared `tid` */
+    DO_SYSCALL(exit, status);
+    __builtin_unreachable();
+}
+
+static long sgx_ocall_sock_ring_start(void* pms) {
+    ms_ocall_sock_ring_start_t* ms = (ms_ocall_sock_ring_start_t*)pms;
+    long ret;
+    ODEBUG(OCALL_SOCK_RING_START, ms);
+
+    struct sock_ring* ring = (struct sock_ring*)DO_SYSCALL(mmap, NULL, SOCK_RING_MAP_SIZE,
+                                                           PROT_READ | PROT_WRITE,
+                                                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (IS_PTR_ERR(ring))
+        return PTR_TO_ERR(ring);
+
+    ret = DO_SYSCALL(eventfd2, 0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (ret < 0)
+        goto out_unmap;
+
+    ring->kickfd    = ret;
+    ring->sockfd    = ms->ms_sockfd;
+    ring->bellfd    = ms->ms_bellfd;
+    ring->stream    = ms->ms_stream;
+    ring->budget_us = ms->ms_budget_us;
+
+    void* stack_top = ALIGN_DOWN_PTR((void*)ring + SOCK_RING_MAP_SIZE, 16);
+    ret = clone(sock_ring_thread_loop, stack_top,
+                CLONE_VM | CLONE_FS | CLONE_FILES | CLONE_SYSVSEM | CLONE_THREAD | CLONE_SIGHAND |
+                CLONE_PTRACE | CLONE_PARENT_SETTID | CLONE_CHILD_CLEARTID,
+                ring, &ring->tid, /*tls=*/NULL, &ring->tid, sock_ring_thread_exit);
+    if (ret < 0) {
+        DO_SYSCALL(close, ring->kickfd);
+        goto out_unmap;
+    }
+
+    ms->ms_ring = ring;
+    return 0;
+
+out_unmap:
+    DO_SYSCALL(munmap, ring, SOCK_RING_MAP_SIZE);
     return ret;
 }
 
+static long sgx_ocall_sock_ring_stop(void* pms) {
+    ms_ocall_sock_ring_stop_t* ms = (ms_ocall_sock_ring_stop_t*)pms;
+    ODEBUG(OCALL_SOCK_RING_STOP, ms);
+
+    struct sock_ring* ring = ms->ms_ring;
+    __atomic_store_n(&ring->stop, 1, __ATOMIC_RELEASE);
+
+    uint64_t val = 1;
+    DO_SYSCALL(write, ring->kickfd, &val, sizeof(val));
+
+    int tid;
+    while ((tid = __atomic_load_n(&ring->tid, __ATOMIC_ACQUIRE)) != 0)
+        DO_SYSCALL(futex, &ring->tid, FUTEX_WAIT, tid, NULL, NULL, 0);
+
+    DO_SYSCALL(close, ring->kickfd);
+    DO_SYSCALL(munmap, ring, SOCK_RING_MAP_SIZE);
+    return 0;
+}
+
 static long sgx_ocall_setsockopt(void* pms) {
     ms_ocall_setsockopt_t* ms = (ms_ocall_setsockopt_t*)pms;
     long ret;
@@ -589,6 +1019,13 @@ static long sgx_ocall_shutdown(void* pms) {
     return 0;
 }
 
+static long sgx_ocall_sendfile(void* pms) {
+    ms_ocall_sendfile_t* ms = (ms_ocall_sendfile_t*)pms;
+    ODEBUG(OCALL_SENDFILE, ms);
+    return DO_SYSCALL_INTERRUPTIBLE(sendfile, ms->ms_out_fd, ms->ms_in_fd, &ms->ms_offset,
+                                    ms->ms_count);
+}
+
 static long sgx_ocall_gettime(void* pms) {
     ms_ocall_gettime_t* ms = (ms_ocall_gettime_t*)pms;
     ODEBUG(OCALL_GETTIME, ms);
@@ -619,6 +1056,33 @@ static long sgx_ocall_poll(void* pms) {
     return ret;
 }
 
+static long sgx_ocall_epoll_create(void* pms) {
+    __UNUSED(pms);
+    ODEBUG(OCALL_EPOLL_CREATE, pms);
+    return DO_SYSCALL(epoll_create1, EPOLL_CLOEXEC);
+}
+
+static long sgx_ocall_epoll_ctl(void* pms) {
+    ms_ocall_epoll_ctl_t* ms = (ms_ocall_epoll_ctl_t*)pms;
+    ODEBUG(OCALL_EPOLL_CTL, ms);
+    struct epoll_event ev = {
+        .events = ms->ms_events,
+        .data   = ms->ms_data,
+    };
+    return DO_SYSCALL(epoll_ctl, ms->ms_epfd, ms->ms_op, ms->ms_fd,
+                      ms->ms_op == EPOLL_CTL_DEL ? NULL : &ev);
+}
+
+static long sgx_ocall_epoll_wait(void* pms) {
+    ms_ocall_epoll_wait_t* ms = (ms_ocall_epoll_wait_t*)pms;
+    ODEBUG(OCALL_EPOLL_WAIT, ms);
+    int timeout_ms = -1;
+    if (ms->ms_timeout_us >= 0)
+        timeout_ms = MIN((ms->ms_timeout_us + 999) / 1000, (int64_t)INT_MAX);
+    return DO_SYSCALL_INTERRUPTIBLE(epoll_wait, ms->ms_epfd, ms->ms_events, ms->ms_maxevents,
+                                    timeout_ms);
+}
+
 static long sgx_ocall_rename(void* pms) {
     ms_ocall_rename_t* ms = (ms_ocall_rename_t*)pms;
     long ret;
@@ -678,6 +1142,13 @@ static long sgx_ocall_debug_map_remove(void* pms) {
     return 0;
 }
 
+static long sgx_ocall_startup_trace(void* pms) {
+    ms_ocall_startup_trace_t* ms = (ms_ocall_startup_trace_t*)pms;
+    ODEBUG(OCALL_STARTUP_TRACE, ms);
+    startup_trace(ms->ms_phase);
+    return 0;
+}
+
 static long sgx_ocall_get_quote(void* pms) {
     ms_ocall_get_quote_t* ms = (ms_ocall_get_quote_t*)pms;
     ODEBUG(OCALL_GET_QUOTE, ms);
@@ -685,6 +1156,63 @@ static long sgx_ocall_get_quote(void* pms) {
                           &ms->ms_nonce, &ms->ms_quote, &ms->ms_quote_len);
 }
 
+static long sgx_ocall_batch(void* pms) {
+    ms_ocall_batch_t* ms = (ms_ocall_batch_t*)pms;
+    ODEBUG(OCALL_BATCH, ms);
+
+    /* entries are executed sequentially and in order, so that the enclave may rely on ordering of
+     * e.g. writes to the same file; for the same reason, execution stops at the first failed or
+     * short write (the remaining entries are not executed and keep their result) */
+    for (uint64_t i = 0; i < ms->ms_count; i++) {
+        ocall_batch_entry_t* entry = &ms->ms_entries[i];
+        switch (entry->ocall_index) {
+            case OCALL_READ:
+                entry->result = sgx_ocall_read(entry->ms);
+                break;
+            case OCALL_WRITE:
+                entry->result = sgx_ocall_write(entry->ms);
+                break;
+            case OCALL_PREAD:
+                entry->result = sgx_ocall_pread(entry->ms);
+                break;
+            case OCALL_PWRITE:
+                entry->result = sgx_ocall_pwrite(entry->ms);
+                break;
+            default:
+                entry->result = -EINVAL;
+                break;
+        }
+
+        if (entry->result < 0)
+            break;
+        if (entry->ocall_index == OCALL_WRITE
+                && entry->result < (long)((ms_ocall_write_t*)entry->ms)->ms_count)
+            break;
+        if (entry->ocall_index == OCALL_PWRITE
+                && entry->result < (long)((ms_ocall_pwrite_t*)entry->ms)->ms_count)
+            break;
+    }
+    return 0;
+}
+
+static long sgx_ocall_edmm_restrict_pages_perm(void* pms) {
+    ms_ocall_edmm_restrict_pages_perm_t* ms = (ms_ocall_edmm_restrict_pages_perm_t*)pms;
+    ODEBUG(OCALL_EDMM_RESTRICT_PAGES_PERM, ms);
+    return edmm_restrict_pages_perm(ms->ms_addr, ms->ms_size, ms->ms_prot);
+}
+
+static long sgx_ocall_edmm_modify_pages_type(void* pms) {
+    ms_ocall_edmm_modify_pages_type_t* ms = (ms_ocall_edmm_modify_pages_type_t*)pms;
+    ODEBUG(OCALL_EDMM_MODIFY_PAGES_TYPE, ms);
+    return edmm_modify_pages_type(ms->ms_addr, ms->ms_size, ms->ms_type);
+}
+
+static long sgx_ocall_edmm_remove_pages(void* pms) {
+    ms_ocall_edmm_remove_pages_t* ms = (ms_ocall_edmm_remove_pages_t*)pms;
+    ODEBUG(OCALL_EDMM_REMOVE_PAGES, ms);
+    return edmm_remove_pages(ms->ms_addr, ms->ms_size);
+}
+
 sgx_ocall_fn_t ocall_table[OCALL_NR] = {
     [OCALL_EXIT]             = sgx_ocall_exit,
     [OCALL_MMAP_UNTRUSTED]   = sgx_ocall_mmap_untrusted,
@@ -697,6 +1225,8 @@ sgx_ocall_fn_t ocall_table[OCALL_NR] = {
     [OCALL_PREAD]            = sgx_ocall_pread,
     [OCALL_PWRITE]           = sgx_ocall_pwrite,
     [OCALL_FSTAT]            = sgx_ocall_fstat,
+    [OCALL_STAT]             = sgx_ocall_stat,
+    [OCALL_OPEN_STAT]        = sgx_ocall_open_stat,
     [OCALL_FIONREAD]         = sgx_ocall_fionread,
     [OCALL_FSETNONBLOCK]     = sgx_ocall_fsetnonblock,
     [OCALL_FCHMOD]           = sgx_ocall_fchmod,
@@ -704,6 +1234,7 @@ sgx_ocall_fn_t ocall_table[OCALL_NR] = {
     [OCALL_FTRUNCATE]        = sgx_ocall_ftruncate,
     [OCALL_MKDIR]            = sgx_ocall_mkdir,
     [OCALL_GETDENTS]         = sgx_ocall_getdents,
+    [OCALL_GETDENTS_STAT]    = sgx_ocall_getdents_stat,
     [OCALL_RESUME_THREAD]    = sgx_ocall_resume_thread,
     [OCALL_SCHED_SETAFFINITY]= sgx_ocall_sched_setaffinity,
     [OCALL_SCHED_GETAFFINITY]= sgx_ocall_sched_getaffinity,
@@ -713,20 +1244,34 @@ sgx_ocall_fn_t ocall_table[OCALL_NR] = {
     [OCALL_SOCKETPAIR]       = sgx_ocall_socketpair,
     [OCALL_LISTEN]           = sgx_ocall_listen,
     [OCALL_ACCEPT]           = sgx_ocall_accept,
+    [OCALL_ACCEPT_BATCH]     = sgx_ocall_accept_batch,
     [OCALL_CONNECT]          = sgx_ocall_connect,
     [OCALL_RECV]             = sgx_ocall_recv,
     [OCALL_SEND]             = sgx_ocall_send,
+    [OCALL_SENDMMSG]         = sgx_ocall_sendmmsg,
+    [OCALL_RECVMMSG]         = sgx_ocall_recvmmsg,
+    [OCALL_SOCK_RING_START]  = sgx_ocall_sock_ring_start,
+    [OCALL_SOCK_RING_STOP]   = sgx_ocall_sock_ring_stop,
     [OCALL_SETSOCKOPT]       = sgx_ocall_setsockopt,
     [OCALL_SHUTDOWN]         = sgx_ocall_shutdown,
+    [OCALL_SENDFILE]         = sgx_ocall_sendfile,
     [OCALL_GETTIME]          = sgx_ocall_gettime,
     [OCALL_SCHED_YIELD]      = sgx_ocall_sched_yield,
     [OCALL_POLL]             = sgx_ocall_poll,
+    [OCALL_EPOLL_CREATE]     = sgx_ocall_epoll_create,
+    [OCALL_EPOLL_CTL]        = sgx_ocall_epoll_ctl,
+    [OCALL_EPOLL_WAIT]       = sgx_ocall_epoll_wait,
     [OCALL_RENAME]           = sgx_ocall_rename,
     [OCALL_DELETE]           = sgx_ocall_delete,
     [OCALL_DEBUG_MAP_ADD]    = sgx_ocall_debug_map_add,
     [OCALL_DEBUG_MAP_REMOVE] = sgx_ocall_debug_map_remove,
+    [OCALL_STARTUP_TRACE]    = sgx_ocall_startup_trace,
     [OCALL_EVENTFD]          = sgx_ocall_eventfd,
     [OCALL_GET_QUOTE]        = sgx_ocall_get_quote,
+    [OCALL_BATCH]            = sgx_ocall_batch,
+    [OCALL_EDMM_RESTRICT_PAGES_PERM] = sgx_ocall_edmm_restrict_pages_perm,
+    [OCALL_EDMM_MODIFY_PAGES_TYPE]   = sgx_ocall_edmm_modify_pages_type,
+    [OCALL_EDMM_REMOVE_PAGES]        = sgx_ocall_edmm_remove_pages,
 };
 
 #define EDEBUG(code, ms) \
@@ -735,6 +1280,486 @@ sgx_ocall_fn_t ocall_table[OCALL_NR] = {
 
 rpc_queue_t* g_rpc_queue = NULL; /* pointer to untrusted queue */
 
+/* number of RPC threads created so far (some may not have registered in `g_rpc_queue` yet);
+ * protected by `g_rpc_queue->lock` */
+static size_t g_rpc_threads_spawned = 0;
+
+/* RPC threads check whether the pool must grow every so many served requests */
+#define RPC_POOL_CHECK_INTERVAL 64
+
+uint64_t g_rpc_numa_repin_cnt = 0;
+
+static struct ocall_stats g_ocall_stats_local[OCALL_NR];
+/* points into the live stats file if there is one */
+struct ocall_stats* g_ocall_stats = g_ocall_stats_local;
+
+static long call_ocall_handler_with_stats(unsigned long code, void* ms, bool exitless) {
+    struct ocall_stats* stats = &g_ocall_stats[code];
+    __atomic_add_fetch(exitless ? &stats->exitless_cnt : &stats->cnt, 1, __ATOMIC_RELAXED);
+
+    uint64_t start_tsc = get_tsc();
+    long ret = ocall_table[code](ms);
+    __atomic_add_fetch(&stats->cycles, get_tsc() - start_tsc, __ATOMIC_RELAXED);
+    return ret;
+}
+
+long sgx_ocall_with_stats(unsigned long code, void* ms) {
+    publish_thread_stats(code);
+    long ret = call_ocall_handler_with_stats(code, ms, /*exitless=*/false);
+    publish_thread_stats(/*ocall=*/-1);
+    return ret;
+}
+
+/* CPU masks of NUMA nodes, used to keep RPC threads on the node of the enclave thread they serve;
+ * NULL on single-node hosts (or if topology is unknown) */
+#define RPC_CPUMASK_WORDS (1024 / (8 * sizeof(unsigned long)))
+typedef unsigned long rpc_cpumask_t[RPC_CPUMASK_WORDS];
+static rpc_cpumask_t* g_numa_cpumasks = NULL;
+static size_t g_numa_nodes_cnt = 0;
+
+/* Parses a sysfs cpumap string like "00000000,0000ffff\n" (most significant 32-bit group first). */
+static void parse_cpumap(const char* str, unsigned long* mask) {
+    memset(mask, 0, sizeof(rpc_cpumask_t));
+    size_t bit = 0;
+    for (size_t i = strlen(str); i > 0 && bit < RPC_CPUMASK_WORDS * 8 * sizeof(unsigned long); i--) {
+        char c = str[i - 1];
+        unsigned long digit;
+        if (c >= '0' && c <= '9')
+            digit = c - '0';
+        else if (c >= 'a' && c <= 'f')
+            digit = c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F')
+            digit = c - 'A' + 10;
+        else
+            continue; /* commas and trailing newline */
+
+        size_t word = bit / (8 * sizeof(unsigned long));
+        mask[word] |= digit << (bit % (8 * sizeof(unsigned long)));
+        bit += 4;
+    }
+}
+
+static void init_numa_cpumasks(void) {
+    PAL_TOPO_INFO* topo = &g_pal_enclave.pal_sec.topo_info;
+    if (topo->num_online_nodes <= 1 || !topo->numa_topology)
+        return;
+
+    size_t size = ALIGN_UP(sizeof(rpc_cpumask_t) * topo->num_online_nodes, PRESET_PAGESIZE);
+    rpc_cpumask_t* masks = (rpc_cpumask_t*)DO_SYSCALL(mmap, NULL, size, PROT_READ | PROT_WRITE,
+                                                      MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (IS_PTR_ERR(masks)) {
+        /* not fatal, RPC threads are simply left to the host scheduler */
+        return;
+    }
+
+    for (size_t i = 0; i < topo->num_online_nodes; i++)
+        parse_cpumap(topo->numa_topology[i].cpumap, masks[i]);
+
+    g_numa_nodes_cnt = topo->num_online_nodes;
+    g_numa_cpumasks  = masks;
+}
+
+/* Moves the calling RPC thread to the NUMA node of the enclave thread owning ring `home_idx`, so
+ * that both sides of the ring (and the untrusted buffers the enclave thread allocated, which are
+ * first-touched on its node) are local to each other. Rings are indexed by enclave thread index,
+ * which equals the TCS slot index for all but dynamically added TCSes, so this is a best-effort
+ * hint. `pinned_node` keeps the node the thread is currently restricted to (-1 if none). */
+static void rpc_follow_home_node(size_t home_idx, int* pinned_node) {
+    if (!g_numa_cpumasks)
+        return;
+
+    int node = get_tcs_numa_node(home_idx);
+    if (node < 0 || (size_t)node >= g_numa_nodes_cnt || node == *pinned_node)
+        return;
+
+    int ret = DO_SYSCALL(sched_setaffinity, /*pid=*/0, sizeof(rpc_cpumask_t),
+                         g_numa_cpumasks[node]);
+    if (ret < 0)
+        return;
+
+    if (*pinned_node >= 0)
+        __atomic_add_fetch(&g_rpc_numa_repin_cnt, 1, __ATOMIC_RELAXED);
+    *pinned_node = node;
+}
+
+static int spawn_rpc_thread(void);
+
+/* Park the calling RPC thread on a futex until some enclave thread (or a busy RPC thread) wakes it
+ * up. The handshake with rpc_enqueue() callers is Dekker-style: we first announce that we are not
+ * awake and then re-check the rings, while enclave threads first publish their request and then
+ * check whether any RPC thread is awake. Thus, a request is never left without an RPC thread. */
+static void rpc_thread_park(void) {
+    uint32_t wakeup = __atomic_load_n(&g_rpc_queue->wakeup, __ATOMIC_ACQUIRE);
+    __atomic_sub_fetch(&g_rpc_queue->awake_cnt, 1, __ATOMIC_SEQ_CST);
+
+    if (!rpc_pending_requests(g_rpc_queue)) {
+        /* if `wakeup` changed in the meantime, futex() returns immediately */
+        DO_SYSCALL(futex, &g_rpc_queue->wakeup, FUTEX_WAIT_PRIVATE, wakeup, NULL, NULL, 0);
+    }
+
+    __atomic_add_fetch(&g_rpc_queue->awake_cnt, 1, __ATOMIC_SEQ_CST);
+}
+
+static void rpc_wake_parked_thread(void) {
+    __atomic_add_fetch(&g_rpc_queue->wakeup, 1, __ATOMIC_RELEASE);
+    DO_SYSCALL(futex, &g_rpc_queue->wakeup, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+/* Make one more RPC thread available: unpark a parked RPC thread, and if there is none, create a
+ * new one (up to `sgx.rpc_thread_max`). */
+static void rpc_pool_add_thread(void) {
+    size_t awake = __atomic_load_n(&g_rpc_queue->awake_cnt, __ATOMIC_SEQ_CST);
+
+    spinlock_lock(&g_rpc_queue->lock);
+    size_t registered = g_rpc_queue->rpc_threads_cnt;
+    size_t spawned    = g_rpc_threads_spawned;
+    spinlock_unlock(&g_rpc_queue->lock);
+
+    if (registered > awake) {
+        rpc_wake_parked_thread();
+        return;
+    }
+
+    if (spawned == registered && spawned < g_pal_enclave.rpc_thread_max) {
+        /* no RPC thread is starting up right now and the pool is not at its maximum */
+        int ret = spawn_rpc_thread();
+        if (ret < 0)
+            log_warning("Failed to create an additional RPC thread: %d", ret);
+    }
+}
+
+/* Number of RPC threads that can pick up new requests right now (awake and not blocked in a host
+ * syscall). */
+static size_t rpc_available_threads(void) {
+    size_t awake   = __atomic_load_n(&g_rpc_queue->awake_cnt, __ATOMIC_SEQ_CST);
+    size_t blocked = __atomic_load_n(&g_rpc_queue->blocked_cnt, __ATOMIC_SEQ_CST);
+    return awake > blocked ? awake - blocked : 0;
+}
+
+/* Grow the pool if there are more outstanding requests than available RPC threads. */
+static void rpc_pool_maybe_grow(void) {
+    if (rpc_pending_requests(g_rpc_queue) > rpc_available_threads())
+        rpc_pool_add_thread();
+}
+
+/* OCALLs which may keep the RPC thread in the host kernel for an unbounded time. */
+static bool rpc_ocall_may_block(rpc_request_t* req) {
+    switch (req->ocall_index) {
+        case OCALL_ACCEPT:
+        case OCALL_ACCEPT_BATCH:
+        case OCALL_CONNECT:
+        case OCALL_RECV:
+        case OCALL_RECVMMSG:
+        case OCALL_POLL:
+        case OCALL_EPOLL_WAIT:
+            return true;
+        case OCALL_FUTEX: {
+            ms_ocall_futex_t* ms = req->buffer;
+            return (ms->ms_op & ~FUTEX_PRIVATE_FLAG) == FUTEX_WAIT;
+        }
+        default:
+            return false;
+    }
+}
+
+/* Called by an RPC thread before it executes a potentially blocking OCALL. Nothing else would grow
+ * the pool while all RPC threads are blocked (the periodic check in rpc_thread_loop() runs only
+ * when requests are served), so if this was the last available RPC thread, make another one
+ * available right away. Pairs with the check in rpc_wake_parked_thread() of the enclave: either
+ * the enclave thread sees this thread as blocked and wakes a parked one, or this thread sees the
+ * pool exhausted and adds a thread itself. */
+static void rpc_thread_block_begin(void) {
+    __atomic_add_fetch(&g_rpc_queue->blocked_cnt, 1, __ATOMIC_SEQ_CST);
+    if (!rpc_available_threads())
+        rpc_pool_add_thread();
+}
+
+static void rpc_thread_block_end(void) {
+    __atomic_sub_fetch(&g_rpc_queue->blocked_cnt, 1, __ATOMIC_SEQ_CST);
+}
+
+static void rpc_complete_request(rpc_request_t* req, long result) {
+    req->result = result;
+
+    /* this code is based on Mutex 2 from Futexes are Tricky */
+    int old_lock_state = __atomic_fetch_sub(&req->lock.lock, 1, __ATOMIC_ACQ_REL);
+    if (old_lock_state == SPINLOCK_LOCKED_WITH_WAITERS) {
+        /* must unlock and wake waiters */
+        spinlock_unlock(&req->lock);
+        int ret = DO_SYSCALL(futex, &req->lock.lock, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+        if (ret == -1)
+            log_error("RPC thread failed to wake up enclave thread");
+    }
+}
+
+/* io_uring backend of RPC threads (`sgx.rpc_io_backend = "io_uring"`): read/write/pread/pwrite and
+ * send/recv requests are not executed one syscall at a time but turned into io_uring submissions.
+ * An RPC thread drains all requests currently available in the RPC queue, submits them in one
+ * io_uring_enter() and reaps completions directly from the (shared memory) completion queue, so
+ * that a burst of N requests costs one host syscall instead of N. Other OCALLs are executed
+ * synchronously as usual, after the queued entries were submitted; while an RPC thread is blocked
+ * in such an OCALL, other RPC threads reap the completions of its io_uring. */
+#define RPC_URING_ENTRIES 64
+#define RPC_URING_SUBMIT_BATCH 16 /* submit early under a continuous stream of requests */
+#define RPC_URING_CANCEL_TAG ((uint64_t)-1)
+
+struct rpc_uring_slot {
+    rpc_request_t* req; /* NULL if the slot is free */
+    struct msghdr hdr;
+    struct iovec iov;
+};
+
+struct rpc_uring {
+    struct sgx_uring ring;
+    struct rpc_uring_slot slots[RPC_URING_ENTRIES];
+    size_t inflight;
+    uint64_t interrupts; /* value of `g_rpc_interrupts` last seen by this RPC thread */
+    spinlock_t reap_lock; /* taken by other RPC threads reaping for the blocked owner */
+    bool blocked;         /* owner is in a blocking synchronous OCALL, protected by `reap_lock` */
+};
+
+/* io_urings of all RPC threads, so that completions of a thread blocked in a synchronous OCALL can
+ * be reaped by the other RPC threads (see rpc_uring_block_begin()) */
+static struct rpc_uring* g_rpc_urings[MAX_RPC_THREADS];
+static size_t g_rpc_urings_cnt = 0;
+static size_t g_rpc_urings_blocked_cnt = 0;
+
+static struct rpc_uring* rpc_uring_create(void) {
+    struct rpc_uring* ru = (struct rpc_uring*)DO_SYSCALL(mmap, NULL,
+                                                         ALIGN_UP(sizeof(*ru), PRESET_PAGESIZE),
+                                                         PROT_READ | PROT_WRITE,
+                                                         MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (IS_PTR_ERR(ru))
+        return NULL;
+
+    int ret = sgx_uring_init(&ru->ring, RPC_URING_ENTRIES);
+    if (ret < 0) {
+        log_warning("Cannot set up io_uring for RPC thread (%d), falling back to syscalls", ret);
+        DO_SYSCALL(munmap, ru, ALIGN_UP(sizeof(*ru), PRESET_PAGESIZE));
+        return NULL;
+    }
+    /* mmap() returned zeroed memory, so all slots are free */
+    ru->interrupts = __atomic_load_n(&g_rpc_interrupts, __ATOMIC_ACQUIRE);
+    spinlock_init(&ru->reap_lock);
+
+    /* at most MAX_RPC_THREADS RPC threads are ever created, and each creates one io_uring */
+    size_t idx = __atomic_fetch_add(&g_rpc_urings_cnt, 1, __ATOMIC_ACQ_REL);
+    __atomic_store_n(&g_rpc_urings[idx], ru, __ATOMIC_RELEASE);
+    return ru;
+}
+
+/* Returns 1 if the request was queued in the io_uring, 0 if it must be executed synchronously, or
+ * negative errno if the request is malformed (and must be completed with this error). */
+static int rpc_uring_queue(struct rpc_uring* ru, rpc_request_t* req) {
+    switch (req->ocall_index) {
+        case OCALL_READ:
+        case OCALL_WRITE:
+        case OCALL_PREAD:
+        case OCALL_PWRITE:
+        case OCALL_SEND:
+        case OCALL_RECV:
+            break;
+        default:
+            return 0;
+    }
+
+    if (ru->inflight == RPC_URING_ENTRIES)
+        return 0;
+
+    size_t idx = 0;
+    while (ru->slots[idx].req)
+        idx++;
+    struct rpc_uring_slot* slot = &ru->slots[idx];
+
+    struct io_uring_sqe* sqe = sgx_uring_get_sqe(&ru->ring);
+    if (!sqe)
+        return 0;
+
+    int ret;
+    switch (req->ocall_index) {
+        case OCALL_READ: {
+            ms_ocall_read_t* ms = req->buffer;
+            sqe->opcode = IORING_OP_READ;
+            sqe->fd     = ms->ms_fd;
+            sqe->addr   = (uint64_t)ms->ms_buf;
+            sqe->len    = ms->ms_count;
+            sqe->off    = (uint64_t)-1; /* use and update the file position, like read() */
+            break;
+        }
+        case OCALL_WRITE: {
+            ms_ocall_write_t* ms = req->buffer;
+            sqe->opcode = IORING_OP_WRITE;
+            sqe->fd     = ms->ms_fd;
+            sqe->addr   = (uint64_t)ms->ms_buf;
+            sqe->len    = ms->ms_count;
+            sqe->off    = (uint64_t)-1;
+            break;
+        }
+        case OCALL_PREAD: {
+            ms_ocall_pread_t* ms = req->buffer;
+            sqe->opcode = IORING_OP_READ;
+            sqe->fd     = ms->ms_fd;
+            sqe->addr   = (uint64_t)ms->ms_buf;
+            sqe->len    = ms->ms_count;
+            sqe->off    = ms->ms_offset;
+            break;
+        }
+        case OCALL_PWRITE: {
+            ms_ocall_pwrite_t* ms = req->buffer;
+            sqe->opcode = IORING_OP_WRITE;
+            sqe->fd     = ms->ms_fd;
+            sqe->addr   = (uint64_t)ms->ms_buf;
+            sqe->len    = ms->ms_count;
+            sqe->off    = ms->ms_offset;
+            break;
+        }
+        case OCALL_SEND: {
+            ms_ocall_send_t* ms = req->buffer;
+            ret = send_prepare_msghdr(ms, &slot->hdr, &slot->iov);
+            if (ret < 0)
+                goto err;
+            sqe->opcode    = IORING_OP_SENDMSG;
+            sqe->fd        = ms->ms_sockfd;
+            sqe->addr      = (uint64_t)&slot->hdr;
+            sqe->len       = 1;
+            sqe->msg_flags = MSG_NOSIGNAL;
+            break;
+        }
+        case OCALL_RECV: {
+            ms_ocall_recv_t* ms = req->buffer;
+            ret = recv_prepare_msghdr(ms, &slot->hdr, &slot->iov);
+            if (ret < 0)
+                goto err;
+            sqe->opcode = IORING_OP_RECVMSG;
+            sqe->fd     = ms->ms_sockfd;
+            sqe->addr   = (uint64_t)&slot->hdr;
+            sqe->len    = 1;
+            break;
+        }
+    }
+
+    sqe->user_data = idx;
+    slot->req = req;
+    ru->inflight++;
+    return 1;
+
+err:
+    /* turn the already obtained submission entry into a no-op */
+    sqe->opcode    = IORING_OP_NOP;
+    sqe->user_data = RPC_URING_CANCEL_TAG;
+    return ret;
+}
+
+/* Cancel all in-flight requests, so that e.g. a recv() on an idle socket doesn't prevent the
+ * enclave thread from handling a signal; cancelled requests are completed with -EINTR, exactly as
+ * if the synchronous syscall was interrupted by SIGUSR2. */
+static void rpc_uring_cancel_all(struct rpc_uring* ru) {
+    for (size_t i = 0; i < RPC_URING_ENTRIES; i++) {
+        if (!ru->slots[i].req)
+            continue;
+        struct io_uring_sqe* sqe = sgx_uring_get_sqe(&ru->ring);
+        if (!sqe)
+            break;
+        sqe->opcode    = IORING_OP_ASYNC_CANCEL;
+        sqe->addr      = i;
+        sqe->user_data = RPC_URING_CANCEL_TAG;
+    }
+    int ret = sgx_uring_submit_and_wait(&ru->ring, /*wait_nr=*/0);
+    if (ret < 0 && ret != -EINTR)
+        log_warning("RPC thread failed to cancel io_uring requests: %d", ret);
+}
+
+/* Reap all available completions without entering the host kernel; returns number of completed
+ * RPC requests. */
+static size_t rpc_uring_reap(struct rpc_uring* ru) {
+    size_t completed = 0;
+    struct io_uring_cqe* cqe;
+    while ((cqe = sgx_uring_peek_cqe(&ru->ring))) {
+        uint64_t idx = cqe->user_data;
+        long res = cqe->res;
+        sgx_uring_cqe_seen(&ru->ring);
+
+        if (idx == RPC_URING_CANCEL_TAG)
+            continue;
+
+        struct rpc_uring_slot* slot = &ru->slots[idx];
+        rpc_request_t* req = slot->req;
+        if (res == -ECANCELED)
+            res = -EINTR;
+        if (req->ocall_index == OCALL_RECV)
+            recv_finish(req->buffer, &slot->hdr, res);
+
+        slot->req = NULL;
+        ru->inflight--;
+        rpc_complete_request(req, res);
+        completed++;
+    }
+    return completed;
+}
+
+/* Submit all queued entries; must be called before the RPC thread goes idle. */
+static void rpc_uring_flush(struct rpc_uring* ru) {
+    uint64_t interrupts = __atomic_load_n(&g_rpc_interrupts, __ATOMIC_ACQUIRE);
+    if (interrupts != ru->interrupts) {
+        ru->interrupts = interrupts;
+        if (ru->inflight)
+            rpc_uring_cancel_all(ru);
+    }
+
+    int ret = sgx_uring_submit_and_wait(&ru->ring, /*wait_nr=*/0);
+    if (ret < 0 && ret != -EINTR)
+        log_warning("RPC thread failed to submit io_uring requests: %d", ret);
+}
+
+/* Called by the owner before it executes a potentially blocking synchronous OCALL while it has
+ * requests in flight: the enclave threads waiting for them must not depend on when the synchronous
+ * OCALL returns, so the other RPC threads reap this io_uring until rpc_uring_block_end(). All
+ * queued entries must be flushed before. If this was the last available RPC thread, another one is
+ * made available by rpc_thread_block_begin(). */
+static void rpc_uring_block_begin(struct rpc_uring* ru) {
+    spinlock_lock(&ru->reap_lock);
+    ru->blocked = true;
+    spinlock_unlock(&ru->reap_lock);
+    __atomic_add_fetch(&g_rpc_urings_blocked_cnt, 1, __ATOMIC_RELEASE);
+}
+
+static void rpc_uring_block_end(struct rpc_uring* ru) {
+    __atomic_sub_fetch(&g_rpc_urings_blocked_cnt, 1, __ATOMIC_RELEASE);
+    /* waits for other RPC threads that are still reaping this io_uring */
+    spinlock_lock(&ru->reap_lock);
+    ru->blocked = false;
+    spinlock_unlock(&ru->reap_lock);
+}
+
+static bool rpc_uring_any_blocked(void) {
+    return __atomic_load_n(&g_rpc_urings_blocked_cnt, __ATOMIC_ACQUIRE) > 0;
+}
+
+/* Reap completions of io_urings whose owners are blocked in synchronous OCALLs; returns number of
+ * completed RPC requests. */
+static size_t rpc_uring_reap_blocked(void) {
+    if (!rpc_uring_any_blocked())
+        return 0;
+
+    size_t completed = 0;
+    size_t cnt = __atomic_load_n(&g_rpc_urings_cnt, __ATOMIC_ACQUIRE);
+    for (size_t i = 0; i < cnt && i < MAX_RPC_THREADS; i++) {
+        struct rpc_uring* ru = __atomic_load_n(&g_rpc_urings[i], __ATOMIC_ACQUIRE);
+        if (!ru || !__atomic_load_n(&ru->blocked, __ATOMIC_RELAXED))
+            continue;
+        if (!spinlock_trylock(&ru->reap_lock))
+            continue;
+        if (ru->blocked) {
+            /* the kernel may have taken only part of the entries at the owner's last flush */
+            if (sgx_uring_unsubmitted(&ru->ring))
+                (void)sgx_uring_submit_and_wait(&ru->ring, /*wait_nr=*/0);
+            completed += rpc_uring_reap(ru);
+        }
+        spinlock_unlock(&ru->reap_lock);
+    }
+    return completed;
+}
+
 static int rpc_thread_loop(void* arg) {
     __UNUSED(arg);
     long mytid = DO_SYSCALL(gettid);
@@ -746,8 +1771,13 @@ static int rpc_thread_loop(void* arg) {
     DO_SYSCALL(rt_sigprocmask, SIG_SETMASK, &mask, NULL, sizeof(mask));
 
     spinlock_lock(&g_rpc_queue->lock);
+    /* home ring of this RPC thread; enclave threads are usually assigned low TCS slots, so the i-th
+     * RPC thread serves the i-th enclave thread's ring first and steals requests from other rings
+     * when its home ring is empty */
+    size_t home_idx = g_rpc_queue->rpc_threads_cnt % g_rpc_queue->rings_cnt;
     g_rpc_queue->rpc_threads[g_rpc_queue->rpc_threads_cnt] = mytid;
     g_rpc_queue->rpc_threads_cnt++;
+    __atomic_add_fetch(&g_rpc_queue->awake_cnt, 1, __ATOMIC_SEQ_CST);
     spinlock_unlock(&g_rpc_queue->lock);
 
     static const uint64_t SPIN_ATTEMPTS_MAX = 10000;     /* rather arbitrary */
@@ -757,16 +1787,55 @@ static int rpc_thread_loop(void* arg) {
     /* no races possible since vars are thread-local and RPC threads don't receive signals */
     uint64_t spin_attempts = 0;
     uint64_t sleep_time    = 0;
+    uint64_t idle_time     = 0; /* nanoseconds slept since the last served request */
+    uint64_t served        = 0;
+    int pinned_node        = -1;
+
+    rpc_follow_home_node(home_idx, &pinned_node);
+
+    uint64_t idle_timeout = g_pal_enclave.rpc_idle_timeout_ms * TIME_NS_IN_US * 1000;
+
+    struct rpc_uring* ru = g_pal_enclave.rpc_io_uring ? rpc_uring_create() : NULL;
 
     while (1) {
-        rpc_request_t* req = rpc_dequeue(g_rpc_queue);
+        rpc_request_t* req = rpc_dequeue(g_rpc_queue, home_idx);
+        if (!req && ru) {
+            /* the burst of requests is over: hand it to the host kernel and collect results */
+            rpc_uring_flush(ru);
+            if (rpc_uring_reap(ru)) {
+                spin_attempts = 0;
+                sleep_time    = 0;
+                idle_time     = 0;
+                continue;
+            }
+        }
+        if (!req && rpc_uring_reap_blocked()) {
+            spin_attempts = 0;
+            sleep_time    = 0;
+            idle_time     = 0;
+            continue;
+        }
+
         if (!req) {
             if (spin_attempts == SPIN_ATTEMPTS_MAX) {
-                if (sleep_time < SLEEP_TIME_MAX)
+                /* with I/O in flight, don't sleep for long: completions are reaped only by this
+                 * thread (or, if their owner is blocked, by any idle RPC thread) */
+                bool io_inflight = (ru && ru->inflight) || rpc_uring_any_blocked();
+                uint64_t sleep_time_max = io_inflight ? SLEEP_TIME_STEP : SLEEP_TIME_MAX;
+                if (sleep_time < sleep_time_max)
                     sleep_time += SLEEP_TIME_STEP;
 
                 struct timespec tv = {.tv_sec = 0, .tv_nsec = sleep_time};
                 (void)DO_SYSCALL(nanosleep, &tv, /*rem=*/NULL);
+
+                idle_time += sleep_time;
+                if (idle_timeout && idle_time >= idle_timeout && !io_inflight) {
+                    /* queue was empty for too long, stop burning CPU until there is work */
+                    rpc_thread_park();
+                    spin_attempts = 0;
+                    sleep_time    = 0;
+                    idle_time     = 0;
+                }
             } else {
                 spin_attempts++;
                 CPU_RELAX();
@@ -777,19 +1846,63 @@ static int rpc_thread_loop(void* arg) {
         /* new request came, reset spin/sleep heuristics */
         spin_attempts = 0;
         sleep_time    = 0;
+        idle_time     = 0;
+
+        if (ru) {
+            int ret = rpc_uring_queue(ru, req);
+            if (ret < 0)
+                rpc_complete_request(req, ret);
+            if (ret > 0 && g_sgx_enable_stats) {
+                /* runs asynchronously in the host kernel, so no cycles are accounted */
+                __atomic_add_fetch(&g_ocall_stats[req->ocall_index].exitless_cnt, 1,
+                                   __ATOMIC_RELAXED);
+            }
+            if (ret != 0) {
+                if (sgx_uring_unsubmitted(&ru->ring) >= RPC_URING_SUBMIT_BATCH
+                        || ru->inflight == RPC_URING_ENTRIES)
+                    rpc_uring_flush(ru);
+                rpc_uring_reap(ru);
+                if (++served % RPC_POOL_CHECK_INTERVAL == 0) {
+                    rpc_pool_maybe_grow();
+                    rpc_follow_home_node(home_idx, &pinned_node);
+                }
+                continue;
+            }
+        }
+
+        bool may_block = rpc_ocall_may_block(req);
+        bool uring_blocked = false;
+        if (ru) {
+            /* queued entries must not wait until this synchronous OCALL returns */
+            rpc_uring_flush(ru);
+            rpc_uring_reap(ru);
+            if (may_block && ru->inflight) {
+                rpc_uring_block_begin(ru);
+                uring_blocked = true;
+            }
+        }
+        if (may_block)
+            rpc_thread_block_begin();
 
         /* call actual function and notify awaiting enclave thread when done */
-        sgx_ocall_fn_t f = ocall_table[req->ocall_index];
-        req->result = f(req->buffer);
-
-        /* this code is based on Mutex 2 from Futexes are Tricky */
-        int old_lock_state = __atomic_fetch_sub(&req->lock.lock, 1, __ATOMIC_ACQ_REL);
-        if (old_lock_state == SPINLOCK_LOCKED_WITH_WAITERS) {
-            /* must unlock and wake waiters */
-            spinlock_unlock(&req->lock);
-            int ret = DO_SYSCALL(futex, &req->lock.lock, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
-            if (ret == -1)
-                log_error("RPC thread failed to wake up enclave thread");
+        long result;
+        if (g_sgx_enable_stats) {
+            result = call_ocall_handler_with_stats(req->ocall_index, req->buffer,
+                                                   /*exitless=*/true);
+        } else {
+            sgx_ocall_fn_t f = ocall_table[req->ocall_index];
+            result = f(req->buffer);
+        }
+
+        if (may_block)
+            rpc_thread_block_end();
+        if (uring_blocked)
+            rpc_uring_block_end(ru);
+        rpc_complete_request(req, result);
+
+        if (++served % RPC_POOL_CHECK_INTERVAL == 0) {
+            rpc_pool_maybe_grow();
+            rpc_follow_home_node(home_idx, &pinned_node);
         }
     }
 
@@ -797,37 +1910,72 @@ static int rpc_thread_loop(void* arg) {
     return 0;
 }
 
-static int start_rpc(size_t num_of_threads) {
-    g_rpc_queue = (rpc_queue_t*)DO_SYSCALL(mmap, NULL,
-                                           ALIGN_UP(sizeof(rpc_queue_t), PRESET_PAGESIZE),
-                                           PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE,
-                                           -1, 0);
-    if (IS_PTR_ERR(g_rpc_queue))
-        return -ENOMEM;
+static int spawn_rpc_thread(void) {
+    spinlock_lock(&g_rpc_queue->lock);
+    if (g_rpc_threads_spawned >= g_pal_enclave.rpc_thread_max) {
+        spinlock_unlock(&g_rpc_queue->lock);
+        return -EAGAIN;
+    }
+    g_rpc_threads_spawned++;
+    spinlock_unlock(&g_rpc_queue->lock);
 
-    /* initialize g_rpc_queue just for sanity, it will be overwritten by in-enclave code */
-    rpc_queue_init(g_rpc_queue);
+    void* stack = (void*)DO_SYSCALL(mmap, NULL, RPC_STACK_SIZE, PROT_READ | PROT_WRITE,
+                                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (IS_PTR_ERR(stack))
+        goto fail;
 
-    for (size_t i = 0; i < num_of_threads; i++) {
-        void* stack = (void*)DO_SYSCALL(mmap, NULL, RPC_STACK_SIZE, PROT_READ | PROT_WRITE,
-                                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-        if (IS_PTR_ERR(stack))
-            return -ENOMEM;
+    void* child_stack_top = stack + RPC_STACK_SIZE;
+    child_stack_top = ALIGN_DOWN_PTR(child_stack_top, 16);
 
-        void* child_stack_top = stack + RPC_STACK_SIZE;
-        child_stack_top = ALIGN_DOWN_PTR(child_stack_top, 16);
+    int dummy_parent_tid_field = 0;
+    int ret = clone(rpc_thread_loop, child_stack_top,
+                    CLONE_VM | CLONE_FS | CLONE_FILES | CLONE_SYSVSEM |
+                    CLONE_THREAD | CLONE_SIGHAND | CLONE_PTRACE | CLONE_PARENT_SETTID,
+                    /*arg=*/NULL, &dummy_parent_tid_field, /*tls=*/NULL, /*child_tid=*/NULL,
+                    thread_exit);
 
-        int dummy_parent_tid_field = 0;
-        int ret = clone(rpc_thread_loop, child_stack_top,
-                        CLONE_VM | CLONE_FS | CLONE_FILES | CLONE_SYSVSEM |
-                        CLONE_THREAD | CLONE_SIGHAND | CLONE_PTRACE | CLONE_PARENT_SETTID,
-                        /*arg=*/NULL, &dummy_parent_tid_field, /*tls=*/NULL, /*child_tid=*/NULL,
-                        thread_exit);
+    if (ret < 0) {
+        DO_SYSCALL(munmap, stack, RPC_STACK_SIZE);
+        goto fail;
+    }
+    return 0;
 
-        if (ret < 0) {
-            DO_SYSCALL(munmap, stack, RPC_STACK_SIZE);
+fail:
+    spinlock_lock(&g_rpc_queue->lock);
+    g_rpc_threads_spawned--;
+    spinlock_unlock(&g_rpc_queue->lock);
+    return -ENOMEM;
+}
+
+static int start_rpc(size_t num_of_threads) {
+    g_rpc_queue = (rpc_queue_t*)-ENOMEM;
+    if (g_pal_enclave.untrusted_huge_pages) {
+        /* the queue is touched by every exitless OCALL, keep it in a single host TLB entry */
+        g_rpc_queue = (rpc_queue_t*)DO_SYSCALL(mmap, NULL,
+                                               ALIGN_UP(sizeof(rpc_queue_t), HUGE_PAGE_SIZE),
+                                               PROT_READ | PROT_WRITE,
+                                               MAP_ANONYMOUS | MAP_PRIVATE | MAP_HUGETLB, -1, 0);
+        if (IS_PTR_ERR(g_rpc_queue))
+            log_warning("Cannot allocate RPC queue in huge pages (no free huge pages on the host?), "
+                        "falling back to regular pages");
+    }
+    if (IS_PTR_ERR(g_rpc_queue)) {
+        g_rpc_queue = (rpc_queue_t*)DO_SYSCALL(mmap, NULL,
+                                               ALIGN_UP(sizeof(rpc_queue_t), PRESET_PAGESIZE),
+                                               PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE,
+                                               -1, 0);
+        if (IS_PTR_ERR(g_rpc_queue))
             return -ENOMEM;
-        }
+    }
+
+    /* one ring per enclave thread (TCS slot), including the slots that may be added with EDMM */
+    rpc_queue_init(g_rpc_queue, g_pal_enclave.max_thread_num);
+    init_numa_cpumasks();
+
+    for (size_t i = 0; i < num_of_threads; i++) {
+        int ret = spawn_rpc_thread();
+        if (ret < 0)
+            return ret;
     }
 
     /* wait until all RPC threads are initialized in rpc_thread_loop */
@@ -835,7 +1983,7 @@ static int start_rpc(size_t num_of_threads) {
         spinlock_lock(&g_rpc_queue->lock);
         size_t n = g_rpc_queue->rpc_threads_cnt;
         spinlock_unlock(&g_rpc_queue->lock);
-        if (n == g_pal_enclave.rpc_thread_num)
+        if (n == num_of_threads)
             break;
         DO_SYSCALL(sched_yield);
     }
@@ -131,6 +131,11 @@ static void handle_sync_signal(int signum, siginfo_t* info, struct ucontext* uc)
     if (interrupted_in_enclave(uc)) {
         /* exception happened in app/LibOS/trusted PAL code, handle signal inside enclave */
         get_tcb_urts()->sync_signal_cnt++;
+        if (signum == SIGSEGV || signum == SIGBUS) {
+            get_tcb_urts()->memfault_signal_cnt++;
+        } else if (signum == SIGILL) {
+            get_tcb_urts()->illegal_signal_cnt++;
+        }
         sgx_raise(event);
         return;
     }
@@ -189,11 +194,14 @@ static void handle_async_signal(int signum, siginfo_t* info, struct ucontext* uc
     }
 }
 
+uint64_t g_rpc_interrupts = 0;
+
 static void handle_dummy_signal(int signum, siginfo_t* info, struct ucontext* uc) {
     __UNUSED(signum);
     __UNUSED(info);
     __UNUSED(uc);
     /* we need this handler to interrupt blocking syscalls in RPC threads */
+    __atomic_add_fetch(&g_rpc_interrupts, 1, __ATOMIC_RELEASE);
 }
 
 int sgx_signal_setup(void) {
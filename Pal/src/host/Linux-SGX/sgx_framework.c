@@ -13,6 +13,16 @@
 static int g_gsgx_device = -1;
 static int g_isgx_device = -1;
 
+/* Source of zero-filled enclave pages. With DCAP driver, a whole range of pages is added with one
+ * ioctl and the driver reads the source sequentially, so the source has to cover the range; we cap
+ * it and split bigger zero ranges (mostly the heap) into several ioctls instead of mapping (and
+ * faulting in) a zero source as big as the range itself. */
+#ifdef SGX_DCAP
+#define ZERO_PAGES_SIZE (16 * 1024 * 1024)
+#else
+#define ZERO_PAGES_SIZE PRESET_PAGESIZE
+#endif
+
 static void* g_zero_pages       = NULL;
 static size_t g_zero_pages_size = 0;
 
@@ -199,15 +209,14 @@ int add_pages_to_enclave(sgx_arch_secs_t* secs, void* addr, void* user_addr, uns
     int ret;
 
     if (!g_zero_pages) {
-        /* initialize with just one page */
-        g_zero_pages = (void*)DO_SYSCALL(mmap, NULL, g_page_size, PROT_READ,
+        g_zero_pages = (void*)DO_SYSCALL(mmap, NULL, ZERO_PAGES_SIZE, PROT_READ,
                                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
         if (IS_PTR_ERR(g_zero_pages)) {
             ret = PTR_TO_ERR(g_zero_pages);
             log_error("Cannot mmap zero pages: %d", ret);
             return ret;
         }
-        g_zero_pages_size = g_page_size;
+        g_zero_pages_size = ZERO_PAGES_SIZE;
     }
 
     memset(&secinfo, 0, sizeof(sgx_arch_sec_info_t));
@@ -249,30 +258,11 @@ int add_pages_to_enclave(sgx_arch_secs_t* secs, void* addr, void* user_addr, uns
                   comment, m);
 
 #ifdef SGX_DCAP
-    if (!user_addr && g_zero_pages_size < size) {
-        /* not enough contigious zero pages to back up enclave pages, allocate more */
-        /* TODO: this logic can be removed if we introduce a size cap in ENCLAVE_ADD_PAGES ioctl */
-        ret = DO_SYSCALL(munmap, g_zero_pages, g_zero_pages_size);
-        if (ret < 0) {
-            log_error("Cannot unmap zero pages %d", ret);
-            return ret;
-        }
-
-        g_zero_pages = (void*)DO_SYSCALL(mmap, NULL, size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS,
-                                         -1, 0);
-        if (IS_PTR_ERR(g_zero_pages)) {
-            ret = PTR_TO_ERR(g_zero_pages);
-            log_error("Cannot map zero pages: %d", ret);
-            return ret;
-        }
-        g_zero_pages_size = size;
-    }
-
     /* newer DCAP driver (version 1.6+) allows adding a range of pages for performance, use it */
     struct sgx_enclave_add_pages param = {
         .offset  = (uint64_t)addr - secs->base,
         .src     = (uint64_t)(user_addr ?: g_zero_pages),
-        .length  = size,
+        .length  = 0, /* set in the loop below */
         .secinfo = (uint64_t)&secinfo,
         .flags   = skip_eextend ? 0 : SGX_PAGE_MEASURE,
         .count   = 0, /* output parameter, will be checked after IOCTL */
@@ -289,7 +279,10 @@ int add_pages_to_enclave(sgx_arch_secs_t* secs, void* addr, void* user_addr, uns
      * field of struct and thus may stay redundant (and unused by driver v39). We hope that this
      * contrived logic won't be needed when the SGX driver stabilizes its ioctl interface.
      * (https://git.kernel.org/pub/scm/linux/kernel/git/jarkko/linux-sgx.git/tag/?h=v39) */
-    while (param.length > 0) {
+    uint64_t remaining_size = size;
+    while (remaining_size > 0) {
+        /* zero pages are always added from the same (capped) source */
+        param.length = user_addr ? remaining_size : MIN(remaining_size, g_zero_pages_size);
         ret = DO_SYSCALL(ioctl, g_isgx_device, SGX_IOC_ENCLAVE_ADD_PAGES, &param);
         if (ret < 0) {
             if (ret == -EINTR)
@@ -306,9 +299,9 @@ int add_pages_to_enclave(sgx_arch_secs_t* secs, void* addr, void* user_addr, uns
         }
 
         param.offset += added_size;
-        if (param.src != (uint64_t)g_zero_pages)
+        if (user_addr)
             param.src += added_size;
-        param.length -= added_size;
+        remaining_size -= added_size;
     }
 
     /* ask Intel SGX driver to actually mmap the added enclave pages */
@@ -420,6 +413,126 @@ int init_enclave(sgx_arch_secs_t* secs, sgx_arch_enclave_css_t* sigstruct,
     return 0;
 }
 
+#if defined(SGX_DCAP) && defined(SGX_IOC_ENCLAVE_REMOVE_PAGES)
+bool is_edmm_supported(void) {
+    uint32_t cpuinfo[4];
+    cpuid(0x12, 0, cpuinfo);
+
+    /* CPUID.(EAX=12H,ECX=0):EAX[1] indicates SGX2 instructions (EAUG, EACCEPT, EMODPR, ...) */
+    if (!(cpuinfo[0] & 0x2)) {
+        log_error("'sgx.edmm_enable' is set, but this CPU does not support SGX2 (EDMM)");
+        return false;
+    }
+
+    return true;
+}
+
+int map_dynamic_enclave_pages(void* addr, size_t size) {
+    /* pages are EAUGed by the driver on first access (EACCEPT) from within the enclave; the driver
+     * allows RWX mappings for such pages, the enclave itself restricts EPCM permissions */
+    uint64_t mapped = DO_SYSCALL(mmap, addr, size, PROT_READ | PROT_WRITE | PROT_EXEC,
+                                 MAP_FIXED | MAP_SHARED, g_isgx_device, 0);
+    if (IS_PTR_ERR(mapped)) {
+        int ret = PTR_TO_ERR(mapped);
+        log_error("Cannot map dynamic enclave pages %d", ret);
+        return ret;
+    }
+    return 0;
+}
+
+int edmm_restrict_pages_perm(uint64_t addr, size_t size, uint64_t prot) {
+    struct sgx_enclave_restrict_permissions param = {
+        .offset = addr - g_pal_enclave.baseaddr,
+        .length = size,
+        .permissions = prot,
+    };
+
+    while (param.length > 0) {
+        param.count = 0;
+        int ret = DO_SYSCALL(ioctl, g_isgx_device, SGX_IOC_ENCLAVE_RESTRICT_PERMISSIONS, &param);
+        if (ret < 0 && ret != -EINTR && ret != -EAGAIN) {
+            log_error("Enclave EMODPR returned %d (SGX result %lu)", ret, (uint64_t)param.result);
+            return ret;
+        }
+        param.offset += param.count;
+        param.length -= param.count;
+    }
+    return 0;
+}
+
+int edmm_modify_pages_type(uint64_t addr, size_t size, uint64_t type) {
+    struct sgx_enclave_modify_types param = {
+        .offset = addr - g_pal_enclave.baseaddr,
+        .length = size,
+        .page_type = type,
+    };
+
+    while (param.length > 0) {
+        param.count = 0;
+        int ret = DO_SYSCALL(ioctl, g_isgx_device, SGX_IOC_ENCLAVE_MODIFY_TYPES, &param);
+        if (ret < 0 && ret != -EINTR && ret != -EAGAIN) {
+            log_error("Enclave EMODT returned %d (SGX result %lu)", ret, (uint64_t)param.result);
+            return ret;
+        }
+        param.offset += param.count;
+        param.length -= param.count;
+    }
+    return 0;
+}
+
+int edmm_remove_pages(uint64_t addr, size_t size) {
+    struct sgx_enclave_remove_pages param = {
+        .offset = addr - g_pal_enclave.baseaddr,
+        .length = size,
+    };
+
+    while (param.length > 0) {
+        param.count = 0;
+        int ret = DO_SYSCALL(ioctl, g_isgx_device, SGX_IOC_ENCLAVE_REMOVE_PAGES, &param);
+        if (ret < 0 && ret != -EINTR && ret != -EAGAIN) {
+            log_error("Removing enclave pages returned %d", ret);
+            return ret;
+        }
+        param.offset += param.count;
+        param.length -= param.count;
+    }
+    return 0;
+}
+#else
+/* EDMM requires the upstreamed in-kernel SGX driver (Linux 6.0+) */
+bool is_edmm_supported(void) {
+    log_error("'sgx.edmm_enable' is set, but Graphene was built without an EDMM-capable SGX "
+              "driver (upstream in-kernel driver from Linux 6.0+ is required)");
+    return false;
+}
+
+int map_dynamic_enclave_pages(void* addr, size_t size) {
+    __UNUSED(addr);
+    __UNUSED(size);
+    return -ENOSYS;
+}
+
+int edmm_restrict_pages_perm(uint64_t addr, size_t size, uint64_t prot) {
+    __UNUSED(addr);
+    __UNUSED(size);
+    __UNUSED(prot);
+    return -ENOSYS;
+}
+
+int edmm_modify_pages_type(uint64_t addr, size_t size, uint64_t type) {
+    __UNUSED(addr);
+    __UNUSED(size);
+    __UNUSED(type);
+    return -ENOSYS;
+}
+
+int edmm_remove_pages(uint64_t addr, size_t size) {
+    __UNUSED(addr);
+    __UNUSED(size);
+    return -ENOSYS;
+}
+#endif /* SGX_DCAP && SGX_IOC_ENCLAVE_REMOVE_PAGES */
+
 int destroy_enclave(void* base_addr, size_t length) {
     log_debug("destroying enclave...");
 
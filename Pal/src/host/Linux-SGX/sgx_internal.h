@@ -46,9 +46,18 @@ struct pal_enclave {
     unsigned long baseaddr;
     unsigned long size;
     unsigned long thread_num;
+    unsigned long max_thread_num; /* more TCSes can be added with EDMM, see `sgx.max_threads` */
     unsigned long rpc_thread_num;
+    unsigned long rpc_thread_max;
+    unsigned long rpc_idle_timeout_ms;
+    bool rpc_io_uring;
+    bool untrusted_huge_pages; /* back the RPC queue and untrusted I/O buffers with huge pages */
+    char* stats_file;          /* prefix of the live stats file, see `sgx.stats_file` */
+    bool preheat_enclave;      /* only for the EPC advice of `sgx.enable_stats` */
+    char* startup_trace;       /* prefix of the startup trace file, see `sgx.startup_trace` */
     unsigned long ssa_frame_size;
     bool nonpie_binary;
+    bool edmm_enabled;
     bool remote_attestation_enabled;
     bool use_epid_attestation; /* Valid only if `remote_attestation_enabled` is true, selects
                                 * EPID/DCAP attestation scheme. */
@@ -65,6 +74,7 @@ struct pal_enclave {
     int profile_mode;
     char profile_filename[64];
     bool profile_with_stack;
+    bool profile_frame_pointers; /* unwind stacks using frame pointers instead of copying them */
     int profile_frequency;
 #endif
 
@@ -74,6 +84,58 @@ struct pal_enclave {
 
 extern struct pal_enclave g_pal_enclave;
 
+/* incremented on each SIGUSR2 delivered to an RPC thread, i.e. each request to interrupt blocking
+ * syscalls; lets RPC threads notice interrupts that arrived outside of a syscall */
+extern uint64_t g_rpc_interrupts;
+
+/* number of times RPC threads moved to another NUMA node to follow their home enclave thread */
+extern uint64_t g_rpc_numa_repin_cnt;
+
+/* per-OCALL stats for `sgx.enable_stats`, indexed by OCALL code (see ocall_types.h) */
+struct ocall_stats {
+    uint64_t cnt;          /* # of OCALLs done with EEXIT */
+    uint64_t exitless_cnt; /* # of OCALLs served by RPC threads */
+    uint64_t cycles;       /* TSC cycles spent in the untrusted handler */
+};
+extern struct ocall_stats* g_ocall_stats;
+
+/* called from sgx_entry.S instead of the OCALL handler if `sgx.enable_stats` is set */
+long sgx_ocall_with_stats(unsigned long code, void* ms);
+
+/* Layout of the live stats file (`sgx.stats_file`), read by `graphene-sgx-stats`: the header, then
+ * `ocalls_cnt` entries of `struct ocall_stats`, then `threads_cnt` entries of
+ * `struct sgx_stats_thread` (one per TCS slot). Bump the version on any change. */
+#define SGX_STATS_MAGIC   0x5354415453584753UL /* "SGXSTATS" */
+#define SGX_STATS_VERSION 1
+
+struct sgx_stats_header {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t pid;
+    uint32_t ocalls_cnt;
+    uint32_t threads_cnt;
+    uint64_t start_time; /* usec since the Epoch */
+};
+
+struct sgx_stats_thread {
+    uint32_t tid;   /* host TID of the thread in this TCS slot, 0 if the slot is free */
+    int32_t ocall;  /* OCALL the thread is in, -1 if it runs in the enclave */
+    uint64_t eenter_cnt;
+    uint64_t eexit_cnt;
+    uint64_t aex_cnt;
+    uint64_t sync_signal_cnt;
+    uint64_t async_signal_cnt;
+};
+
+/* Record the baseline for the EPC paging stats; called once the enclave is initialized */
+void init_epc_stats(void);
+int init_stats_file(const char* path);
+void publish_thread_stats(int ocall);
+
+/* Mark the end of a startup phase, see sgx_startup_trace.c */
+void startup_trace(const char* phase);
+int init_startup_trace(const char* path);
+
 int open_sgx_driver(bool need_gsgx);
 bool is_wrfsbase_supported(void);
 
@@ -86,6 +148,13 @@ enum sgx_page_type { SGX_PAGE_SECS, SGX_PAGE_TCS, SGX_PAGE_REG };
 int add_pages_to_enclave(sgx_arch_secs_t* secs, void* addr, void* user_addr, unsigned long size,
                          enum sgx_page_type type, int prot, bool skip_eextend, const char* comment);
 
+/* EDMM (SGX2) helpers; they return -ENOSYS if the SGX driver does not support EDMM */
+bool is_edmm_supported(void);
+int map_dynamic_enclave_pages(void* addr, size_t size);
+int edmm_restrict_pages_perm(uint64_t addr, size_t size, uint64_t prot);
+int edmm_modify_pages_type(uint64_t addr, size_t size, uint64_t type);
+int edmm_remove_pages(uint64_t addr, size_t size);
+
 /*!
  * \brief Retrieve Quoting Enclave's sgx_target_info_t by talking to AESMD.
  *
@@ -124,14 +193,17 @@ void eresume_pointer(void);
 void async_exit_pointer_end(void);
 
 int get_tid_from_tcs(void* tcs);
+int get_tcs_numa_node(size_t index);
 int clone_thread(void);
 
-void create_tcs_mapper(void* tcs_base, unsigned int thread_num);
+void create_tcs_mapper(void* tcs_base, unsigned int thread_num, unsigned int max_thread_num);
+int add_tcs(void* tcs);
 int pal_thread_init(void* tcbptr);
 void map_tcs(unsigned int tid);
 void unmap_tcs(void);
 int current_enclave_thread_cnt(void);
 void thread_exit(int status);
+void park_thread(void);
 
 uint64_t sgx_edbgrd(void* addr);
 void sgx_edbgwr(void* addr, uint64_t data);
@@ -158,6 +230,7 @@ enum {
     SGX_PROFILE_MODE_AEX = 1,
     SGX_PROFILE_MODE_OCALL_INNER = 2,
     SGX_PROFILE_MODE_OCALL_OUTER = 3,
+    SGX_PROFILE_MODE_OFF_CPU = 4,
 };
 
 /* Filenames for saved data */
@@ -170,6 +243,9 @@ int sgx_profile_init(void);
 /* Finalize and close file */
 void sgx_profile_finish(void);
 
+/* Flush and free the sample buffer of the current thread, called on thread exit */
+void sgx_profile_thread_finish(void);
+
 /* Record a sample during AEX */
 void sgx_profile_sample_aex(void* tcs);
 
@@ -179,6 +255,12 @@ void sgx_profile_sample_ocall_inner(void* enclave_gpr);
 /* Record a sample during OCALL (function to be executed) */
 void sgx_profile_sample_ocall_outer(void* ocall_func);
 
+/* Remember the start of an OCALL (off-CPU mode) */
+void sgx_profile_ocall_wait_begin(void* enclave_gpr);
+
+/* Record the enclave state weighted by the OCALL duration (off-CPU mode) */
+void sgx_profile_ocall_wait_end(void);
+
 /* Record a new mapped ELF */
 void sgx_profile_report_elf(const char* filename, void* addr);
 
@@ -190,13 +272,25 @@ void sgx_profile_report_urts_elfs(void);
 
 #define PD_STACK_SIZE 8192
 
+/* Maximum number of entries in a callchain recorded by pd_event_sample_callchain() */
+#define PD_MAX_CALLCHAIN 64
+
 struct perf_data;
 
-struct perf_data* pd_open(const char* file_name, bool with_stack);
+/* `with_stack` records a copy of the stack with each sample (for unwinding by `perf report`),
+ * `with_callchain` records already unwound return addresses; at most one of them can be set */
+struct perf_data* pd_open(const char* file_name, bool with_stack, bool with_callchain);
 
-/* Finalize and close; returns resulting file size */
+/* Finalize and close, including thread buffers still open; returns resulting file size */
 ssize_t pd_close(struct perf_data* pd);
 
+/* Open a buffer for the samples of one thread; it is appended to `main_pd`'s file when full. Events
+ * written to a thread buffer need no locking, but a thread buffer may be used by one thread only. */
+struct perf_data* pd_open_thread(struct perf_data* main_pd);
+
+/* Flush and free a thread buffer */
+int pd_close_thread(struct perf_data* pd);
+
 /* Write PERF_RECORD_COMM (report command name) */
 int pd_event_command(struct perf_data* pd, const char* command, uint32_t pid, uint32_t tid);
 
@@ -208,6 +302,10 @@ int pd_event_mmap(struct perf_data* pd, const char* filename, uint32_t pid, uint
 int pd_event_sample_simple(struct perf_data* pd, uint64_t ip, uint32_t pid, uint32_t tid,
                            uint64_t period);
 
+/* Write PERF_RECORD_SAMPLE (with callchain, at most PD_MAX_CALLCHAIN addresses starting with `ip`) */
+int pd_event_sample_callchain(struct perf_data* pd, uint64_t ip, uint32_t pid, uint32_t tid,
+                              uint64_t period, const uint64_t* ips, size_t ips_cnt);
+
 /* Write PERF_RECORD_SAMPLE (with stack sample, at most PD_STACK_SIZE bytes) */
 int pd_event_sample_stack(struct perf_data* pd,  uint64_t ip, uint32_t pid, uint32_t tid,
                           uint64_t period, sgx_pal_gpr_t* gpr, void* stack, size_t stack_size);
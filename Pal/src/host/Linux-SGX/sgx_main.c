@@ -275,6 +275,7 @@ static int initialize_enclave(struct pal_enclave* enclave, const char* manifest_
         log_error("Creating enclave failed: %d", ret);
         goto out;
     }
+    startup_trace("host: ECREATE");
 
     /* SECS contains SSA frame size in pages, convert to size in bytes */
     enclave->ssa_frame_size = enclave_secs.ssa_frame_size * g_page_size;
@@ -405,7 +406,9 @@ static int initialize_enclave(struct pal_enclave* enclave, const char* manifest_
 
     enclave_entry_addr += pal_area->addr;
 
-    if (last_populated_addr > enclave_heap_min) {
+    /* with EDMM, the heap is not added at all: its pages are EAUGed on demand (and this must match
+     * the measurement computed by the signer, see `sgx.edmm_enable`) */
+    if (!enclave->edmm_enabled && last_populated_addr > enclave_heap_min) {
         areas[area_num] = (struct mem_area){.desc         = "free",
                                             .skip_eextend = true,
                                             .data_src     = ZERO,
@@ -447,6 +450,7 @@ static int initialize_enclave(struct pal_enclave* enclave, const char* manifest_
                 gs->common.stack_protector_canary = STACK_PROTECTOR_CANARY_DEFAULT;
                 gs->enclave_size = enclave->size;
                 gs->tcs_offset = tcs_area->addr - enclave->baseaddr + g_page_size * t;
+                gs->thread_idx = t;
                 gs->initial_stack_addr = stack_areas[t].addr + ENCLAVE_STACK_SIZE;
                 gs->sig_stack_low = sig_stack_areas[t].addr;
                 gs->sig_stack_high = sig_stack_areas[t].addr + ENCLAVE_SIG_STACK_SIZE;
@@ -455,6 +459,7 @@ static int initialize_enclave(struct pal_enclave* enclave, const char* manifest_
                 gs->manifest_size = manifest_size;
                 gs->heap_min = (void*)enclave_heap_min;
                 gs->heap_max = (void*)pal_area->addr;
+                gs->edmm_enabled = enclave->edmm_enabled;
                 gs->thread = NULL;
             }
         } else if (areas[i].data_src == TCS) {
@@ -491,13 +496,33 @@ static int initialize_enclave(struct pal_enclave* enclave, const char* manifest_
         }
     }
 
+    startup_trace("host: EADD/EEXTEND");
+
     ret = init_enclave(&enclave_secs, &enclave_sigstruct, &enclave_token);
     if (ret < 0) {
         log_error("Initializing enclave failed: %d", ret);
         goto out;
     }
+    startup_trace("host: EINIT");
+
+    if (enclave->edmm_enabled && last_populated_addr > enclave_heap_min) {
+        ret = map_dynamic_enclave_pages((void*)enclave_heap_min,
+                                        last_populated_addr - enclave_heap_min);
+        if (ret < 0) {
+            log_error("Mapping dynamic enclave heap failed: %d", ret);
+            goto out;
+        }
+    }
 
-    create_tcs_mapper((void*)tcs_area->addr, enclave->thread_num);
+    create_tcs_mapper((void*)tcs_area->addr, enclave->thread_num, enclave->max_thread_num);
+
+    if (enclave->stats_file) {
+        ret = init_stats_file(enclave->stats_file);
+        if (ret < 0) {
+            log_error("Cannot create the SGX stats file '%s.<pid>': %d", enclave->stats_file, ret);
+            goto out;
+        }
+    }
 
     struct enclave_dbginfo* dbg = (void*)DO_SYSCALL(mmap, DBGINFO_ADDR,
                                                     sizeof(struct enclave_dbginfo),
@@ -517,7 +542,12 @@ static int initialize_enclave(struct pal_enclave* enclave, const char* manifest_
             dbg->tcs_addrs[i] = tcs_addrs[i];
     }
 
-    if (g_sgx_enable_stats) {
+    bool dbgoptin = g_sgx_enable_stats;
+#ifdef DEBUG
+    /* SGX profiling is usually combined with hardware counters or tracing by the host `perf` */
+    dbgoptin = dbgoptin || enclave->profile_enable;
+#endif
+    if (dbgoptin) {
         /* set TCS.FLAGS.DBGOPTIN in all enclave threads to enable perf counters, Intel PT, etc */
         ret = DO_SYSCALL(open, "/proc/self/mem", O_RDWR | O_LARGEFILE, 0);
         if (ret < 0) {
@@ -653,12 +683,69 @@ static int parse_loader_config(char* manifest, struct pal_enclave* enclave_info)
         goto out;
     }
 
-    if (enclave_info->rpc_thread_num && enclave_info->thread_num > RPC_QUEUE_SIZE) {
-        log_error("Too many threads for exitless feature (more than capacity of RPC queue)");
+    int64_t rpc_thread_max_int64;
+    ret = toml_int_in(manifest_root, "sgx.rpc_thread_max",
+                      /*defaultval=*/(int64_t)enclave_info->rpc_thread_num, &rpc_thread_max_int64);
+    if (ret < 0) {
+        log_error("Cannot parse 'sgx.rpc_thread_max'");
         ret = -EINVAL;
         goto out;
     }
 
+    if (rpc_thread_max_int64 < (int64_t)enclave_info->rpc_thread_num
+            || rpc_thread_max_int64 > MAX_RPC_THREADS) {
+        log_error("'sgx.rpc_thread_max' must be between 'sgx.rpc_thread_num' and %d",
+                  MAX_RPC_THREADS);
+        ret = -EINVAL;
+        goto out;
+    }
+
+    enclave_info->rpc_thread_max = rpc_thread_max_int64;
+
+    int64_t rpc_idle_timeout_ms_int64;
+    ret = toml_int_in(manifest_root, "sgx.rpc_idle_timeout_ms", /*defaultval=*/0,
+                      &rpc_idle_timeout_ms_int64);
+    if (ret < 0 || rpc_idle_timeout_ms_int64 < 0) {
+        log_error("Cannot parse 'sgx.rpc_idle_timeout_ms' (the value must be a non-negative "
+                  "integer)");
+        ret = -EINVAL;
+        goto out;
+    }
+
+    enclave_info->rpc_idle_timeout_ms = rpc_idle_timeout_ms_int64;
+
+    char* rpc_io_backend_str = NULL;
+    ret = toml_string_in(manifest_root, "sgx.rpc_io_backend", &rpc_io_backend_str);
+    if (ret < 0) {
+        log_error("Cannot parse 'sgx.rpc_io_backend' "
+                  "(the value must be \"syscall\" or \"io_uring\")");
+        ret = -EINVAL;
+        goto out;
+    }
+
+    if (!rpc_io_backend_str || !strcmp(rpc_io_backend_str, "syscall")) {
+        enclave_info->rpc_io_uring = false;
+    } else if (!strcmp(rpc_io_backend_str, "io_uring")) {
+        enclave_info->rpc_io_uring = true;
+    } else {
+        log_error("Invalid 'sgx.rpc_io_backend' "
+                  "(the value must be \"syscall\" or \"io_uring\")");
+        free(rpc_io_backend_str);
+        ret = -EINVAL;
+        goto out;
+    }
+    free(rpc_io_backend_str);
+
+    bool untrusted_huge_pages;
+    ret = toml_bool_in(manifest_root, "sgx.untrusted_huge_pages", /*defaultval=*/false,
+                       &untrusted_huge_pages);
+    if (ret < 0) {
+        log_error("Cannot parse 'sgx.untrusted_huge_pages' (the value must be `true` or `false`)");
+        ret = -EINVAL;
+        goto out;
+    }
+    enclave_info->untrusted_huge_pages = untrusted_huge_pages;
+
     bool nonpie_binary;
     ret = toml_bool_in(manifest_root, "sgx.nonpie_binary", /*defaultval=*/false, &nonpie_binary);
     if (ret < 0) {
@@ -668,6 +755,41 @@ static int parse_loader_config(char* manifest, struct pal_enclave* enclave_info)
     }
     enclave_info->nonpie_binary = nonpie_binary;
 
+    bool edmm_enabled;
+    ret = toml_bool_in(manifest_root, "sgx.edmm_enable", /*defaultval=*/false, &edmm_enabled);
+    if (ret < 0) {
+        log_error("Cannot parse 'sgx.edmm_enable' (the value must be `true` or `false`)");
+        ret = -EINVAL;
+        goto out;
+    }
+    if (edmm_enabled && !is_edmm_supported()) {
+        ret = -EINVAL;
+        goto out;
+    }
+    enclave_info->edmm_enabled = edmm_enabled;
+
+    int64_t max_threads_int64;
+    ret = toml_int_in(manifest_root, "sgx.max_threads", /*defaultval=*/enclave_info->thread_num,
+                      &max_threads_int64);
+    if (ret < 0 || max_threads_int64 < (int64_t)enclave_info->thread_num
+            || max_threads_int64 > MAX_DBG_THREADS) {
+        log_error("Cannot parse 'sgx.max_threads' (the value must be between 'sgx.thread_num' "
+                  "and %d)", MAX_DBG_THREADS);
+        ret = -EINVAL;
+        goto out;
+    }
+    if (max_threads_int64 > (int64_t)enclave_info->thread_num && !edmm_enabled) {
+        log_warning("'sgx.max_threads' is ignored because 'sgx.edmm_enable' is not set");
+        max_threads_int64 = enclave_info->thread_num;
+    }
+    enclave_info->max_thread_num = max_threads_int64;
+
+    if (enclave_info->rpc_thread_num && enclave_info->max_thread_num > RPC_QUEUE_SIZE) {
+        log_error("Too many threads for exitless feature (more than number of RPC rings)");
+        ret = -EINVAL;
+        goto out;
+    }
+
     ret = toml_bool_in(manifest_root, "sgx.enable_stats", /*defaultval=*/false,
                        &g_sgx_enable_stats);
     if (ret < 0) {
@@ -676,6 +798,33 @@ static int parse_loader_config(char* manifest, struct pal_enclave* enclave_info)
         goto out;
     }
 
+    ret = toml_string_in(manifest_root, "sgx.stats_file", &enclave_info->stats_file);
+    if (ret < 0) {
+        log_error("Cannot parse 'sgx.stats_file'");
+        ret = -EINVAL;
+        goto out;
+    }
+    ret = toml_bool_in(manifest_root, "sgx.preheat_enclave", /*defaultval=*/false,
+                       &enclave_info->preheat_enclave);
+    if (ret < 0) {
+        log_error("Cannot parse 'sgx.preheat_enclave' (the value must be `true` or `false`)");
+        ret = -EINVAL;
+        goto out;
+    }
+
+    ret = toml_string_in(manifest_root, "sgx.startup_trace", &enclave_info->startup_trace);
+    if (ret < 0) {
+        log_error("Cannot parse 'sgx.startup_trace'");
+        ret = -EINVAL;
+        goto out;
+    }
+
+    if (enclave_info->stats_file && !g_sgx_enable_stats) {
+        log_error("'sgx.stats_file' requires 'sgx.enable_stats'");
+        ret = -EINVAL;
+        goto out;
+    }
+
     char* dummy_sigfile_str = NULL;
     ret = toml_string_in(manifest_root, "sgx.sigfile", &dummy_sigfile_str);
     if (ret < 0 || dummy_sigfile_str) {
@@ -755,7 +904,7 @@ static int parse_loader_config(char* manifest, struct pal_enclave* enclave_info)
     ret = toml_string_in(manifest_root, "sgx.profile.mode", &profile_mode_str);
     if (ret < 0) {
         log_error("Cannot parse 'sgx.profile.mode' "
-                  "(the value must be \"aex\", \"ocall_inner\" or \"ocall_outer\")");
+                  "(the value must be \"aex\", \"ocall_inner\", \"ocall_outer\" or \"off_cpu\")");
         ret = -EINVAL;
         goto out;
     }
@@ -767,9 +916,11 @@ static int parse_loader_config(char* manifest, struct pal_enclave* enclave_info)
         enclave_info->profile_mode = SGX_PROFILE_MODE_OCALL_INNER;
     } else if (!strcmp(profile_mode_str, "ocall_outer")) {
         enclave_info->profile_mode = SGX_PROFILE_MODE_OCALL_OUTER;
+    } else if (!strcmp(profile_mode_str, "off_cpu")) {
+        enclave_info->profile_mode = SGX_PROFILE_MODE_OFF_CPU;
     } else {
         log_error("Invalid 'sgx.profile.mode' "
-                  "(the value must be \"aex\", \"ocall_inner\" or \"ocall_outer\")");
+                  "(the value must be \"aex\", \"ocall_inner\", \"ocall_outer\" or \"off_cpu\")");
         ret = -EINVAL;
         goto out;
     }
@@ -793,6 +944,22 @@ static int parse_loader_config(char* manifest, struct pal_enclave* enclave_info)
         goto out;
     }
 
+    bool profile_frame_pointers;
+    ret = toml_bool_in(manifest_root, "sgx.profile.frame_pointers", /*defaultval=*/false,
+                       &profile_frame_pointers);
+    if (ret < 0) {
+        log_error("Cannot parse 'sgx.profile.frame_pointers' (the value must be `true` or "
+                  "`false`)");
+        ret = -EINVAL;
+        goto out;
+    }
+    if (profile_frame_pointers && !enclave_info->profile_with_stack) {
+        log_error("'sgx.profile.frame_pointers' requires 'sgx.profile.with_stack'");
+        ret = -EINVAL;
+        goto out;
+    }
+    enclave_info->profile_frame_pointers = profile_frame_pointers;
+
     int64_t profile_frequency;
     ret = toml_int_in(manifest_root, "sgx.profile.frequency", SGX_PROFILE_DEFAULT_FREQUENCY,
                       &profile_frequency);
@@ -885,10 +1052,19 @@ static int load_enclave(struct pal_enclave* enclave, char* args, size_t args_siz
         log_error("Parsing manifest failed");
         return -EINVAL;
     }
+    startup_trace("host: manifest parsed");
+
+    ret = init_startup_trace(enclave->startup_trace);
+    if (ret < 0) {
+        log_error("Cannot create the startup trace file '%s.<pid>': %d", enclave->startup_trace,
+                  ret);
+        return ret;
+    }
 
     ret = open_sgx_driver(need_gsgx);
     if (ret < 0)
         return ret;
+    startup_trace("host: SGX driver opened");
 
     if (!is_wrfsbase_supported())
         return -EPERM;
@@ -950,6 +1126,7 @@ static int load_enclave(struct pal_enclave* enclave, char* args, size_t args_siz
     ret = get_topology_info(&pal_sec->topo_info);
     if (ret < 0)
         return ret;
+    startup_trace("host: CPU topology read");
 
 #ifdef DEBUG
     size_t env_i = 0;
@@ -1006,6 +1183,9 @@ static int load_enclave(struct pal_enclave* enclave, char* args, size_t args_siz
     if (ret < 0)
         return ret;
 
+    if (g_sgx_enable_stats)
+        init_epc_stats();
+
     ret = sgx_signal_setup();
     if (ret < 0)
         return ret;
@@ -1017,6 +1197,7 @@ static int load_enclave(struct pal_enclave* enclave, char* args, size_t args_siz
         ret = init_quoting_enclave_targetinfo(is_epid, &pal_sec->qe_targetinfo);
         if (ret < 0)
             return ret;
+        startup_trace("host: Quoting Enclave target info");
     }
 
     void* alt_stack = (void*)DO_SYSCALL(mmap, NULL, ALT_STACK_SIZE, PROT_READ | PROT_WRITE,
@@ -1042,9 +1223,16 @@ static int load_enclave(struct pal_enclave* enclave, char* args, size_t args_siz
          */
         log_always("----- SGX enclave loading time = %10lu microseconds -----",
                    end_time - start_time);
+
+        /* CPUID.(EAX=12H,ECX=0):EBX is the set of supported MISCSELECT bits, bit 1 is AEXNOTIFY */
+        unsigned int cpuinfo[4];
+        cpuid(0x12, 0, cpuinfo);
+        log_always("----- AEX-Notify is %ssupported by this CPU (not used by Graphene) -----",
+                   (cpuinfo[1] & 0x2) ? "" : "not ");
     }
 
     /* start running trusted PAL */
+    startup_trace("host: enclave loaded");
     ecall_enclave_start(enclave->libpal_uri, args, args_size, env, env_size);
 
     unmap_tcs();
@@ -1081,6 +1269,8 @@ int main(int argc, char* argv[], char* envp[]) {
 
     force_linux_to_grow_stack();
 
+    startup_trace("host: start");
+
     if (argc < 4)
         print_usage_and_exit(argv[0]);
 
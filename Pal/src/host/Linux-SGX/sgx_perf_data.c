@@ -19,6 +19,12 @@
  * convenient to use because perf userspace tools recognize it only when reading from stdin. This
  * has been fixed in Linux 5.8: https://lkml.org/lkml/2020/5/7/294)
  *
+ * Samples of each thread are collected in a per-thread buffer (pd_open_thread) and appended to the
+ * file in one piece when the buffer fills up, so that sampling threads do not contend on the file.
+ * Records carry no timestamps, the order of samples between threads does not matter; the only
+ * ordering constraint is that ELF mappings (PERF_RECORD_MMAP) precede the samples that hit them,
+ * which holds because the main buffer is always flushed before a thread buffer.
+ *
  * To view the report, use 'perf report -i <filename>'.
  *
  * For debugging the output, you can use:
@@ -33,9 +39,11 @@
 #include <linux/perf_event.h>
 #include <linux/fs.h>
 
+#include "list.h"
 #include "perm.h"
 #include "sgx_internal.h"
 #include "sgx_log.h"
+#include "spinlock.h"
 
 #ifndef __x86_64__
 #error "Unsupported architecture"
@@ -47,6 +55,9 @@
  * flush to a file too often. */
 #define BUF_SIZE (32 * 1024 * 1024)
 
+/* Buffer size of per-thread sample buffers; each holds at least a hundred samples with stack. */
+#define THREAD_BUF_SIZE (1024 * 1024)
+
 /* Registers to sample - see arch/x86/include/uapi/asm/perf_regs.h */
 #define NUM_SAMPLE_REGS 18
 #define SAMPLE_REGS ((1 << PERF_REG_X86_AX)    | \
@@ -93,13 +104,25 @@ struct perf_file_attr {
     struct perf_file_section ids;
 };
 
+DEFINE_LIST(perf_data);
+DEFINE_LISTP(perf_data);
 struct perf_data {
     int fd;
+    bool with_stack;
+    bool with_callchain;
+
+    // Main buffer: protects `fd`, `buf` and `threads`. Unused in thread buffers.
+    spinlock_t lock;
+    LISTP_TYPE(perf_data) threads;
+
+    // Thread buffer: the main buffer it is flushed to, NULL for the main buffer itself
+    struct perf_data* main;
+    LIST_TYPE(perf_data) list;
+
     // Data to be flushed to a file
+    size_t buf_size;
     size_t buf_count;
-    uint8_t buf[BUF_SIZE];
-
-    bool with_stack;
+    uint8_t buf[];
 };
 
 static ssize_t write_all(int fd, const void* buf, size_t count) {
@@ -115,7 +138,11 @@ static ssize_t write_all(int fd, const void* buf, size_t count) {
     return 0;
 }
 
-static int pd_flush(struct perf_data* pd) {
+// Flush the main buffer; called with its lock held
+static int pd_flush_main(struct perf_data* pd) {
+    assert(!pd->main);
+    assert(spinlock_is_locked(&pd->lock));
+
     if (pd->buf_count == 0)
         return 0;
 
@@ -126,23 +153,63 @@ static int pd_flush(struct perf_data* pd) {
     return 0;
 }
 
+// Flush a thread buffer, after the main buffer; called with the lock of the main buffer held
+static int pd_flush_thread_locked(struct perf_data* pd) {
+    assert(pd->main);
+
+    if (pd->buf_count == 0)
+        return 0;
+
+    ssize_t ret = pd_flush_main(pd->main);
+    if (ret < 0)
+        return ret;
+    ret = write_all(pd->fd, pd->buf, pd->buf_count);
+    if (ret < 0)
+        return ret;
+    pd->buf_count = 0;
+    return 0;
+}
+
+static int pd_flush(struct perf_data* pd) {
+    if (!pd->main)
+        return pd_flush_main(pd);
+
+    spinlock_lock(&pd->main->lock);
+    int ret = pd_flush_thread_locked(pd);
+    spinlock_unlock(&pd->main->lock);
+    return ret;
+}
+
 // Add data to buffer; flush first if necessary
 static int pd_write(struct perf_data* pd, const void* data, size_t size) {
-    if (pd->buf_count + size > sizeof(pd->buf)) {
+    if (pd->buf_count + size > pd->buf_size) {
         int ret = pd_flush(pd);
         if (ret < 0)
             return ret;
     }
 
-    assert(pd->buf_count + size <= sizeof(pd->buf));
+    assert(pd->buf_count + size <= pd->buf_size);
     memcpy(pd->buf + pd->buf_count, data, size);
     pd->buf_count += size;
     return 0;
 }
 
-struct perf_data* pd_open(const char* file_name, bool with_stack) {
+// Events go to thread buffers without locking; the main buffer is shared by all threads
+static void pd_lock(struct perf_data* pd) {
+    if (!pd->main)
+        spinlock_lock(&pd->lock);
+}
+
+static void pd_unlock(struct perf_data* pd) {
+    if (!pd->main)
+        spinlock_unlock(&pd->lock);
+}
+
+struct perf_data* pd_open(const char* file_name, bool with_stack, bool with_callchain) {
     int ret;
 
+    assert(!(with_stack && with_callchain));
+
     int fd = DO_SYSCALL(open, file_name, O_WRONLY | O_TRUNC | O_CREAT, PERM_rw_r__r__);
     if (fd < 0) {
         log_error("pd_open: cannot open %s for writing: %d", file_name, fd);
@@ -162,15 +229,20 @@ struct perf_data* pd_open(const char* file_name, bool with_stack) {
     if (ret < 0)
         goto fail;
 
-    struct perf_data* pd = malloc(sizeof(*pd));
+    struct perf_data* pd = malloc(sizeof(*pd) + BUF_SIZE);
     if (!pd) {
         log_error("pd_open: out of memory");
         goto fail;
     }
 
     pd->fd = fd;
-    pd->buf_count = 0;
     pd->with_stack = with_stack;
+    pd->with_callchain = with_callchain;
+    spinlock_init(&pd->lock);
+    INIT_LISTP(&pd->threads);
+    pd->main = NULL;
+    pd->buf_size = BUF_SIZE;
+    pd->buf_count = 0;
     return pd;
 
 fail:
@@ -202,6 +274,8 @@ static int write_prologue_epilogue(struct perf_data* pd) {
     uint64_t sample_type = PERF_SAMPLE_IP | PERF_SAMPLE_TID | PERF_SAMPLE_PERIOD;
     if (pd->with_stack)
         sample_type |= PERF_SAMPLE_CALLCHAIN | PERF_SAMPLE_REGS_USER | PERF_SAMPLE_STACK_USER;
+    if (pd->with_callchain)
+        sample_type |= PERF_SAMPLE_CALLCHAIN;
 
     struct perf_file_attr attr = {
         .attr = {
@@ -266,11 +340,62 @@ static int write_prologue_epilogue(struct perf_data* pd) {
     return 0;
 }
 
+struct perf_data* pd_open_thread(struct perf_data* main_pd) {
+    assert(!main_pd->main);
+
+    struct perf_data* pd = malloc(sizeof(*pd) + THREAD_BUF_SIZE);
+    if (!pd) {
+        log_error("pd_open_thread: out of memory");
+        return NULL;
+    }
+
+    pd->fd = main_pd->fd;
+    pd->with_stack = main_pd->with_stack;
+    pd->with_callchain = main_pd->with_callchain;
+    pd->main = main_pd;
+    pd->buf_size = THREAD_BUF_SIZE;
+    pd->buf_count = 0;
+
+    spinlock_lock(&main_pd->lock);
+    LISTP_ADD(pd, &main_pd->threads, list);
+    spinlock_unlock(&main_pd->lock);
+    return pd;
+}
+
+int pd_close_thread(struct perf_data* pd) {
+    struct perf_data* main_pd = pd->main;
+    assert(main_pd);
+
+    spinlock_lock(&main_pd->lock);
+    int ret = pd_flush_thread_locked(pd);
+    LISTP_DEL(pd, &main_pd->threads, list);
+    spinlock_unlock(&main_pd->lock);
+
+    free(pd);
+    return ret;
+}
+
 ssize_t pd_close(struct perf_data* pd) {
     ssize_t ret = 0;
     int close_ret;
 
-    ret = pd_flush(pd);
+    assert(!pd->main);
+    spinlock_lock(&pd->lock);
+
+    // Thread buffers still open belong to threads that did not exit cleanly; flush them, too
+    struct perf_data* thread_pd;
+    struct perf_data* tmp;
+    LISTP_FOR_EACH_ENTRY_SAFE(thread_pd, tmp, &pd->threads, list) {
+        ssize_t flush_ret = pd_flush_thread_locked(thread_pd);
+        if (flush_ret < 0 && ret == 0)
+            ret = flush_ret;
+        LISTP_DEL(thread_pd, &pd->threads, list);
+        free(thread_pd);
+    }
+    if (ret < 0)
+        goto out;
+
+    ret = pd_flush_main(pd);
     if (ret < 0)
         goto out;
 
@@ -283,6 +408,7 @@ ssize_t pd_close(struct perf_data* pd) {
         goto out;
 
 out:
+    spinlock_unlock(&pd->lock);
     close_ret = DO_SYSCALL(close, pd->fd);
     if (close_ret < 0)
         log_error("pd_close: close failed: %d", close_ret);
@@ -308,13 +434,14 @@ int pd_event_command(struct perf_data* pd, const char* command, uint32_t pid, ui
         .tid = tid,
     };
     int ret;
+    pd_lock(pd);
     ret = pd_write(pd, &event, sizeof(event));
     if (ret < 0)
-        return ret;
+        goto out;
     ret = pd_write(pd, command, command_size);
-    if (ret < 0)
-        return ret;
-    return 0;
+out:
+    pd_unlock(pd);
+    return ret;
 }
 
 int pd_event_mmap(struct perf_data* pd, const char* filename, uint32_t pid, uint64_t addr,
@@ -339,13 +466,14 @@ int pd_event_mmap(struct perf_data* pd, const char* filename, uint32_t pid, uint
         .pgoff = pgoff,
     };
     int ret;
+    pd_lock(pd);
     ret = pd_write(pd, &event, sizeof(event));
     if (ret < 0)
-        return ret;
+        goto out;
     ret = pd_write(pd, filename, filename_size);
-    if (ret < 0)
-        return ret;
-    return 0;
+out:
+    pd_unlock(pd);
+    return ret;
 }
 
 static int pd_event_sample(struct perf_data* pd, uint64_t ip, uint32_t pid, uint32_t tid,
@@ -374,8 +502,40 @@ static int pd_event_sample(struct perf_data* pd, uint64_t ip, uint32_t pid, uint
 
 int pd_event_sample_simple(struct perf_data* pd, uint64_t ip, uint32_t pid, uint32_t tid,
                            uint64_t period) {
-    assert(!pd->with_stack);
-    return pd_event_sample(pd, ip, pid, tid, period, /*extra_size=*/0);
+    assert(!pd->with_stack && !pd->with_callchain);
+    pd_lock(pd);
+    int ret = pd_event_sample(pd, ip, pid, tid, period, /*extra_size=*/0);
+    pd_unlock(pd);
+    return ret;
+}
+
+int pd_event_sample_callchain(struct perf_data* pd, uint64_t ip, uint32_t pid, uint32_t tid,
+                              uint64_t period, const uint64_t* ips, size_t ips_cnt) {
+    assert(pd->with_callchain);
+    assert(ips_cnt <= PD_MAX_CALLCHAIN);
+
+    // The callchain starts with a context marker, like the ones recorded by the kernel
+    struct {
+        uint64_t nr;
+        uint64_t context;
+    } callchain = {
+        .nr = ips_cnt + 1,
+        .context = PERF_CONTEXT_USER,
+    };
+    size_t ips_size = ips_cnt * sizeof(*ips);
+    int ret;
+
+    pd_lock(pd);
+    ret = pd_event_sample(pd, ip, pid, tid, period, sizeof(callchain) + ips_size);
+    if (ret < 0)
+        goto out;
+    ret = pd_write(pd, &callchain, sizeof(callchain));
+    if (ret < 0)
+        goto out;
+    ret = pd_write(pd, ips, ips_size);
+out:
+    pd_unlock(pd);
+    return ret;
 }
 
 int pd_event_sample_stack(struct perf_data* pd, uint64_t ip, uint32_t pid, uint32_t tid,
@@ -423,27 +583,29 @@ int pd_event_sample_stack(struct perf_data* pd, uint64_t ip, uint32_t pid, uint3
     size_t extra_size = sizeof(extra) + stack_size + 2 * sizeof(uint64_t);
     int ret;
 
+    pd_lock(pd);
+
     // Common section
     ret = pd_event_sample(pd, ip, pid, tid, period, extra_size);
     if (ret < 0)
-        return ret;
+        goto out;
 
     // Callchain and regs sections
     ret = pd_write(pd, &extra, sizeof(extra));
     if (ret < 0)
-        return ret;
+        goto out;
 
     // Stack section (variable length)
     uint64_t size_field = stack_size;
     ret = pd_write(pd, &size_field, sizeof(size_field));  // uint64_t size
     if (ret < 0)
-        return ret;
+        goto out;
     ret = pd_write(pd, stack, stack_size);
     if (ret < 0)
-        return ret;
+        goto out;
     ret = pd_write(pd, &size_field, sizeof(size_field));  // uint64_t dyn_size = size
-    if (ret < 0)
-        return ret;
 
-    return 0;
+out:
+    pd_unlock(pd);
+    return ret;
 }
@@ -32,6 +32,7 @@ char* realpath(const char* path, char* resolved_path);
 
 #define NSEC_IN_SEC 1000000000
 
+/* protects `g_perf_data` against sgx_profile_finish() */
 static spinlock_t g_perf_data_lock = INIT_SPINLOCK_UNLOCKED;
 static struct perf_data* g_perf_data = NULL;
 
@@ -114,7 +115,9 @@ int sgx_profile_init(void) {
     }
     g_mem_fd = ret;
 
-    struct perf_data* pd = pd_open(g_pal_enclave.profile_filename, g_pal_enclave.profile_with_stack);
+    bool with_callchain = g_pal_enclave.profile_with_stack && g_pal_enclave.profile_frame_pointers;
+    bool with_stack = g_pal_enclave.profile_with_stack && !with_callchain;
+    struct perf_data* pd = pd_open(g_pal_enclave.profile_filename, with_stack, with_callchain);
     if (!pd) {
         log_error("sgx_profile_init: pd_open failed");
         ret = -EINVAL;
@@ -156,8 +159,12 @@ void sgx_profile_finish(void) {
     if (!g_profile_enabled)
         return;
 
+    /* stop new samples first, thread buffers are freed below */
+    g_profile_enabled = false;
+
     spinlock_lock(&g_perf_data_lock);
 
+    /* also flushes the sample buffers of threads that are still running */
     size = pd_close(g_perf_data);
     if (size < 0)
         log_error("sgx_profile_finish: pd_close failed: %ld", size);
@@ -171,33 +178,116 @@ void sgx_profile_finish(void) {
     g_mem_fd = -1;
 
     log_debug("Profile data written to %s (%lu bytes)", g_pal_enclave.profile_filename, size);
+}
 
-    g_profile_enabled = false;
+/* Returns the sample buffer of the current thread, opening it on first use. Falls back to the main
+ * buffer (which is slower, as it is shared by all threads) if the thread buffer cannot be opened. */
+static struct perf_data* get_thread_perf_data(void) {
+    PAL_TCB_URTS* tcb = get_tcb_urts();
+    if (!tcb->profile_pd) {
+        spinlock_lock(&g_perf_data_lock);
+        if (g_perf_data)
+            tcb->profile_pd = pd_open_thread(g_perf_data);
+        spinlock_unlock(&g_perf_data_lock);
+    }
+    return tcb->profile_pd ?: g_perf_data;
 }
 
-static void sample_simple(uint64_t rip) {
+void sgx_profile_thread_finish(void) {
+    PAL_TCB_URTS* tcb = get_tcb_urts();
+    if (!tcb->profile_pd)
+        return;
+
+    spinlock_lock(&g_perf_data_lock);
+    /* after sgx_profile_finish(), the thread buffer is already flushed and freed */
+    if (g_perf_data) {
+        int ret = pd_close_thread(tcb->profile_pd);
+        if (ret < 0)
+            log_error("sgx_profile_thread_finish: pd_close_thread failed: %d", ret);
+    }
+    spinlock_unlock(&g_perf_data_lock);
+    tcb->profile_pd = NULL;
+}
+
+static void sample_simple(uint64_t rip, uint64_t period) {
     int ret;
 
     // Report all events as the same PID so that they are grouped in report.
     pid_t pid = g_pal_enclave.pal_sec.pid;
     pid_t tid = pid;
 
-    spinlock_lock(&g_perf_data_lock);
-    ret = pd_event_sample_simple(g_perf_data, rip, pid, tid, g_profile_period);
-    spinlock_unlock(&g_perf_data_lock);
+    struct perf_data* pd = get_thread_perf_data();
+    if (!pd)
+        return;
+    ret = pd_event_sample_simple(pd, rip, pid, tid, period);
 
     if (ret < 0) {
         log_error("error recording sample: %d", ret);
     }
 }
 
-static void sample_stack(sgx_pal_gpr_t* gpr) {
+/*
+ * Walk the frame-pointer chain of the enclave thread and record only the return addresses. Reading
+ * enclave memory through /proc/self/mem goes through EDBGRD, 8 bytes at a time, so 16 bytes per
+ * frame are much cheaper than a copy of the whole stack (process_vm_readv() would batch better, but
+ * it cannot read enclave memory). Functions compiled without frame pointers are skipped together
+ * with their caller, and so is the caller of a function sampled before it set up its frame.
+ */
+static void sample_callchain(sgx_pal_gpr_t* gpr, uint64_t period) {
     int ret;
 
     // Report all events as the same PID so that they are grouped in report.
     pid_t pid = g_pal_enclave.pal_sec.pid;
     pid_t tid = pid;
 
+    uint64_t ips[PD_MAX_CALLCHAIN];
+    size_t ips_cnt = 0;
+    ips[ips_cnt++] = gpr->rip;
+
+    uint64_t fp = gpr->rbp;
+    while (ips_cnt < PD_MAX_CALLCHAIN) {
+        // Frames are 8-byte aligned and above the stack pointer; stop on anything else
+        if (!fp || fp % 8 || fp < gpr->rsp)
+            break;
+
+        struct {
+            uint64_t next_fp;
+            uint64_t ret_addr;
+        } frame;
+        if (debug_read_all(&frame, (void*)fp, sizeof(frame)) < 0)
+            break;
+        if (!frame.ret_addr)
+            break;
+        ips[ips_cnt++] = frame.ret_addr;
+
+        // Stack grows down, so caller frames are at higher addresses; this also stops loops
+        if (frame.next_fp <= fp)
+            break;
+        fp = frame.next_fp;
+    }
+
+    struct perf_data* pd = get_thread_perf_data();
+    if (!pd)
+        return;
+    ret = pd_event_sample_callchain(pd, gpr->rip, pid, tid, period, ips, ips_cnt);
+
+    if (ret < 0) {
+        log_error("error recording sample: %d", ret);
+    }
+}
+
+static void sample_stack(sgx_pal_gpr_t* gpr, uint64_t period) {
+    int ret;
+
+    if (g_pal_enclave.profile_frame_pointers) {
+        sample_callchain(gpr, period);
+        return;
+    }
+
+    // Report all events as the same PID so that they are grouped in report.
+    pid_t pid = g_pal_enclave.pal_sec.pid;
+    pid_t tid = pid;
+
     uint8_t stack[PD_STACK_SIZE];
     size_t stack_size;
     ret = debug_read(stack, (void*)gpr->rsp, sizeof(stack));
@@ -207,10 +297,10 @@ static void sample_stack(sgx_pal_gpr_t* gpr) {
     }
     stack_size = ret;
 
-    spinlock_lock(&g_perf_data_lock);
-    ret = pd_event_sample_stack(g_perf_data, gpr->rip, pid, tid, g_profile_period,
-                                gpr, stack, stack_size);
-    spinlock_unlock(&g_perf_data_lock);
+    struct perf_data* pd = get_thread_perf_data();
+    if (!pd)
+        return;
+    ret = pd_event_sample_stack(pd, gpr->rip, pid, tid, period, gpr, stack, stack_size);
 
     if (ret < 0) {
         log_error("error recording sample: %d", ret);
@@ -267,9 +357,9 @@ void sgx_profile_sample_aex(void* tcs) {
     }
 
     if (g_pal_enclave.profile_with_stack) {
-        sample_stack(&gpr);
+        sample_stack(&gpr, g_profile_period);
     } else {
-        sample_simple(gpr.rip);
+        sample_simple(gpr.rip, g_profile_period);
     }
 }
 
@@ -290,9 +380,9 @@ void sgx_profile_sample_ocall_inner(void* enclave_gpr) {
     }
 
     if (g_pal_enclave.profile_with_stack) {
-        sample_stack(&gpr);
+        sample_stack(&gpr, g_profile_period);
     } else {
-        sample_simple(gpr.rip);
+        sample_simple(gpr.rip, g_profile_period);
     }
 }
 
@@ -302,7 +392,69 @@ void sgx_profile_sample_ocall_outer(void* ocall_func) {
 
     assert(ocall_func);
     assert(!g_pal_enclave.profile_with_stack);
-    sample_simple((uint64_t)ocall_func);
+    sample_simple((uint64_t)ocall_func, g_profile_period);
+}
+
+/*
+ * Off-CPU mode: each OCALL is recorded as a sample of the enclave state at the OCALL, with the
+ * wall-clock duration of the OCALL (in nanoseconds) as the sample period. `perf report` weighs
+ * samples by their period, so it shows where enclave threads wait (futexes, poll, blocking I/O)
+ * instead of where they compute. The enclave state is read after the OCALL returns; it does not
+ * change in the meantime because the thread is outside of the enclave.
+ */
+void sgx_profile_ocall_wait_begin(void* enclave_gpr) {
+    if (!(g_profile_enabled && g_profile_mode == SGX_PROFILE_MODE_OFF_CPU))
+        return;
+
+    if (!enclave_gpr)
+        return;
+
+    struct timespec ts;
+    int ret = DO_SYSCALL(clock_gettime, CLOCK_MONOTONIC, &ts);
+    if (ret < 0) {
+        log_error("sgx_profile_ocall_wait_begin: clock_gettime failed: %d", ret);
+        return;
+    }
+
+    PAL_TCB_URTS* tcb = get_tcb_urts();
+    tcb->profile_ocall_gpr = enclave_gpr;
+    tcb->profile_ocall_start = ts.tv_sec * NSEC_IN_SEC + ts.tv_nsec;
+}
+
+void sgx_profile_ocall_wait_end(void) {
+    int ret;
+
+    PAL_TCB_URTS* tcb = get_tcb_urts();
+    void* enclave_gpr = tcb->profile_ocall_gpr;
+    if (!enclave_gpr)
+        return;
+    tcb->profile_ocall_gpr = NULL;
+
+    /* profiling may have been finished by another thread during the OCALL */
+    if (!g_profile_enabled)
+        return;
+
+    struct timespec ts;
+    ret = DO_SYSCALL(clock_gettime, CLOCK_MONOTONIC, &ts);
+    if (ret < 0) {
+        log_error("sgx_profile_ocall_wait_end: clock_gettime failed: %d", ret);
+        return;
+    }
+    uint64_t end = ts.tv_sec * NSEC_IN_SEC + ts.tv_nsec;
+    uint64_t period = end > tcb->profile_ocall_start ? end - tcb->profile_ocall_start : 1;
+
+    sgx_pal_gpr_t gpr;
+    ret = debug_read_all(&gpr, enclave_gpr, sizeof(gpr));
+    if (ret < 0) {
+        log_error("sgx_profile_ocall_wait_end: error reading GPR: %d", ret);
+        return;
+    }
+
+    if (g_pal_enclave.profile_with_stack) {
+        sample_stack(&gpr, period);
+    } else {
+        sample_simple(gpr.rip, period);
+    }
 }
 
 void sgx_profile_report_elf(const char* filename, void* addr) {
@@ -0,0 +1,109 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/*
+ * Startup tracing, enabled by `sgx.startup_trace`. The untrusted PAL, the trusted PAL (through
+ * OCALL_STARTUP_TRACE) and LibOS (through DkStartupTrace()) mark the end of each startup phase.
+ * The marks are timestamped here, so that all of them share one clock, and written to
+ * `<path>.<pid>`, one line per mark:
+ *
+ *     <usec since pal-sgx started> <usec since the previous mark> <phase>
+ *
+ * Marks made before the manifest is parsed (i.e. before we know whether the trace is enabled) are
+ * kept in memory and written out by init_startup_trace().
+ */
+
+#include <asm/errno.h>
+#include <asm/fcntl.h>
+#include <linux/limits.h>
+#include <linux/time.h>
+
+#include "sgx_internal.h"
+#include "sgx_log.h"
+#include "spinlock.h"
+
+#define STARTUP_TRACE_EARLY_MAX 16
+#define STARTUP_TRACE_LINE_MAX  256
+
+struct startup_mark {
+    const char* phase; /* a string literal of the untrusted PAL */
+    uint64_t time;
+};
+
+static struct startup_mark g_early_marks[STARTUP_TRACE_EARLY_MAX];
+static size_t g_early_marks_cnt = 0;
+
+static bool g_startup_trace_initialized = false;
+static int g_startup_trace_fd = -1;
+static uint64_t g_startup_time = 0;
+static uint64_t g_last_mark_time = 0;
+static spinlock_t g_startup_trace_lock = INIT_SPINLOCK_UNLOCKED;
+
+static uint64_t get_monotonic_usec(void) {
+    struct timespec ts;
+    if (DO_SYSCALL(clock_gettime, CLOCK_MONOTONIC, &ts) < 0)
+        return 0;
+    return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
+static void write_mark(const char* phase, uint64_t time) {
+    char line[STARTUP_TRACE_LINE_MAX];
+    /* `phase` may come from the enclave, bound it so that the line is never truncated */
+    int len = snprintf(line, sizeof(line), "%10lu %10lu %.200s\n", time - g_startup_time,
+                       time - g_last_mark_time, phase);
+    g_last_mark_time = time;
+    if (len > 0)
+        DO_SYSCALL(write, g_startup_trace_fd, line, len);
+}
+
+void startup_trace(const char* phase) {
+    uint64_t time = get_monotonic_usec();
+
+    spinlock_lock(&g_startup_trace_lock);
+    if (!g_startup_time)
+        g_startup_time = g_last_mark_time = time;
+
+    if (g_startup_trace_fd >= 0) {
+        write_mark(phase, time);
+    } else if (!g_startup_trace_initialized && g_early_marks_cnt < STARTUP_TRACE_EARLY_MAX) {
+        g_early_marks[g_early_marks_cnt].phase = phase;
+        g_early_marks[g_early_marks_cnt].time = time;
+        g_early_marks_cnt++;
+    }
+    spinlock_unlock(&g_startup_trace_lock);
+}
+
+/* Opens the trace file `<path>.<pid>` and writes out the marks made so far; with `path == NULL`
+ * (trace disabled) only drops them */
+int init_startup_trace(const char* path) {
+    int ret = 0;
+
+    spinlock_lock(&g_startup_trace_lock);
+    g_startup_trace_initialized = true;
+    if (!path)
+        goto out;
+
+    char filename[PATH_MAX];
+    if ((size_t)snprintf(filename, sizeof(filename), "%s.%d", path,
+                         (int)DO_SYSCALL(getpid)) >= sizeof(filename)) {
+        ret = -ENAMETOOLONG;
+        goto out;
+    }
+
+    int fd = DO_SYSCALL(open, filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        ret = fd;
+        goto out;
+    }
+    g_startup_trace_fd = fd;
+
+    static const char header[] = "# usec_since_start usec_since_previous phase\n";
+    DO_SYSCALL(write, fd, header, sizeof(header) - 1);
+    for (size_t i = 0; i < g_early_marks_cnt; i++)
+        write_mark(g_early_marks[i].phase, g_early_marks[i].time);
+
+    log_debug("Writing the startup trace to %s", filename);
+out:
+    g_early_marks_cnt = 0;
+    spinlock_unlock(&g_startup_trace_lock);
+    return ret;
+}
@@ -5,28 +5,148 @@
 #include <asm/prctl.h>
 #include <asm/signal.h>
 #include <linux/futex.h>
+#include <linux/limits.h>
+#include <linux/resource.h>
 #include <linux/signal.h>
 
 #include "assert.h"
 #include "gdb_integration/sgx_gdb.h"
+#include "ocall_types.h"
 #include "pal_internal.h"
 #include "pal_security.h"
 #include "sgx_enclave.h"
 #include "sgx_internal.h"
 #include "sgx_log.h"
 #include "spinlock.h"
+#include "topo_info.h"
 
 struct thread_map {
     unsigned int    tid;
     sgx_arch_tcs_t* tcs;
+    int             numa_node; /* node the host thread ran on when it took this TCS */
 };
 
 static sgx_arch_tcs_t* g_enclave_tcs;
+static int g_enclave_static_thread_num;
 static int g_enclave_thread_num;
 static struct thread_map* g_enclave_thread_map;
+/* number of TCS slots taken by host threads now and at most so far, protected by `tcs_lock` */
+static int g_mapped_tcs_cnt = 0;
+static int g_peak_mapped_tcs_cnt = 0;
+
+/* Host threads of exited enclave threads wait here to run the next enclave thread, which saves the
+ * stack mapping and the clone() of a new host thread each time the application creates a thread.
+ * There are never more of them than TCS slots, i.e. `g_enclave_thread_num`. */
+static PAL_TCB_URTS** g_parked_threads;
+static int g_parked_threads_cnt;
+static spinlock_t g_parked_threads_lock = INIT_SPINLOCK_UNLOCKED;
 
 bool g_sgx_enable_stats = false;
 
+/* per-TCS-slot entries of the live stats file, NULL if there is none */
+static struct sgx_stats_thread* g_stats_threads = NULL;
+
+static uint64_t get_time_usec(void) {
+    struct timeval tv;
+    if (DO_SYSCALL(gettimeofday, &tv, NULL) < 0)
+        return 0;
+    return tv.tv_sec * 1000000UL + tv.tv_usec;
+}
+
+/* AEXs not caused by a signal are interrupts (timer, IPIs, device) and EPC paging faults handled by
+ * the host kernel; a high rate of them means the enclave shares its cores with noisy neighbors */
+static unsigned long aex_without_signal_cnt(unsigned long aex_cnt, unsigned long sync_signal_cnt,
+                                            unsigned long async_signal_cnt) {
+    unsigned long signal_cnt = sync_signal_cnt + async_signal_cnt;
+    return aex_cnt > signal_cnt ? aex_cnt - signal_cnt : 0;
+}
+
+/* Host page faults and time when the enclave was initialized. EPC pages are resident after EADD, so
+ * later page faults of the process are mostly EPC paging (ELDU of evicted pages), handled by the
+ * host kernel without the enclave noticing anything but an AEX. The rest are first touches of
+ * untrusted memory. */
+static uint64_t g_epc_stats_start_faults;
+static uint64_t g_epc_stats_start_time;
+
+/* Report (and advise on) EPC paging if there were more page faults than that */
+#define EPC_STATS_FAULTS_THRESHOLD 10000
+
+static uint64_t get_host_page_faults(void) {
+    struct rusage ru;
+    if (DO_SYSCALL(getrusage, RUSAGE_SELF, &ru) < 0)
+        return 0;
+    return ru.ru_minflt + ru.ru_majflt;
+}
+
+static int read_uint_file(const char* path, uint64_t* out_val) {
+    char buf[32];
+    int ret = read_file_buffer(path, buf, sizeof(buf) - 1);
+    if (ret < 0)
+        return ret;
+    buf[ret] = '\0';
+    *out_val = strtoll(buf, NULL, 10);
+    return 0;
+}
+
+/* Returns the EPC size of the host in bytes, or 0 if unknown (in-kernel driver on Linux < 6.0 or no
+ * SGX driver info at all) */
+static uint64_t get_host_epc_size(void) {
+    uint64_t epc_size = 0;
+    uint64_t val;
+    /* the attribute exists for every online node since Linux 6.0, stop at the first missing one */
+    for (int node = 0; ; node++) {
+        char path[64];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/x86/sgx_total_bytes", node);
+        if (read_uint_file(path, &val) < 0)
+            break;
+        epc_size += val;
+    }
+    if (epc_size)
+        return epc_size;
+
+    /* legacy out-of-tree driver */
+    if (read_uint_file("/sys/module/isgx/parameters/sgx_nr_total_epc_pages", &val) < 0)
+        return 0;
+    return val * PRESET_PAGESIZE;
+}
+
+void init_epc_stats(void) {
+    g_epc_stats_start_faults = get_host_page_faults();
+    g_epc_stats_start_time = get_time_usec();
+}
+
+static void print_epc_stats(int pid) {
+    uint64_t faults = get_host_page_faults() - g_epc_stats_start_faults;
+    uint64_t now = get_time_usec();
+    uint64_t runtime_ms = now > g_epc_stats_start_time ? (now - g_epc_stats_start_time) / 1000 : 0;
+    uint64_t epc_size = get_host_epc_size();
+    uint64_t enclave_size = g_pal_enclave.size;
+
+    log_always("----- EPC stats for process %d -----\n"
+               "  Enclave size:        %lu MB%s\n"
+               "  Host EPC size:       %lu MB%s\n"
+               "  # of host page faults (mostly EPC paging): %lu (%lu per second)",
+               pid, enclave_size / 1024 / 1024, g_pal_enclave.edmm_enabled ? " (EDMM)" : "",
+               epc_size / 1024 / 1024, epc_size ? "" : " (unknown)",
+               faults, runtime_ms ? faults * 1000 / runtime_ms : 0);
+
+    if (faults < EPC_STATS_FAULTS_THRESHOLD)
+        return;
+
+    if (epc_size && enclave_size > epc_size && !g_pal_enclave.edmm_enabled) {
+        log_always("  Advice: the enclave is larger than EPC and its pages are being swapped. "
+                   "Decrease 'sgx.enclave_size' to what the application needs, ideally below "
+                   "%lu MB.%s", epc_size / 1024 / 1024,
+                   g_pal_enclave.preheat_enclave ? " Disable 'sgx.preheat_enclave', it touches "
+                   "all enclave pages and so forces paging." : "");
+    } else {
+        log_always("  Advice: many page faults although the enclave fits into EPC. Other enclaves "
+                   "on this host may compete for EPC, or the faults are first touches of untrusted "
+                   "memory (compare with a run that has 'sgx.enable_stats' and a smaller "
+                   "workload).");
+    }
+}
+
 /* this function is called only on thread/process exit (never in the middle of thread exec) */
 void update_and_print_stats(bool process_wide) {
     static atomic_ulong g_eenter_cnt       = 0;
@@ -34,6 +154,9 @@ void update_and_print_stats(bool process_wide) {
     static atomic_ulong g_aex_cnt          = 0;
     static atomic_ulong g_sync_signal_cnt  = 0;
     static atomic_ulong g_async_signal_cnt = 0;
+    static atomic_ulong g_memfault_signal_cnt = 0;
+    static atomic_ulong g_illegal_signal_cnt  = 0;
+    static atomic_ulong g_numa_migration_cnt = 0;
 
     if (!g_sgx_enable_stats)
         return;
@@ -42,20 +165,40 @@ void update_and_print_stats(bool process_wide) {
 
     int tid = DO_SYSCALL(gettid);
     assert(tid > 0);
+    unsigned int cpu;
+    unsigned int node;
+    if (DO_SYSCALL(getcpu, &cpu, &node, /*unused_cache=*/NULL) < 0)
+        node = (unsigned int)-1;
+
+    uint64_t now = get_time_usec();
+    uint64_t lifetime_ms = (tcb->start_time && now > tcb->start_time)
+                           ? (now - tcb->start_time) / 1000 : 0;
+
     log_always("----- SGX stats for thread %d -----\n"
                "  # of EENTERs:        %lu\n"
                "  # of EEXITs:         %lu\n"
-               "  # of AEXs:           %lu\n"
-               "  # of sync signals:   %lu\n"
-               "  # of async signals:  %lu",
+               "  # of AEXs:           %lu (%lu per second)\n"
+               "  # of sync signals:   %lu (page faults: %lu, illegal instructions: %lu)\n"
+               "  # of async signals:  %lu\n"
+               "  # of AEXs w/o signal (interrupts, EPC paging): %lu\n"
+               "  NUMA node (start):   %d\n"
+               "  NUMA node (exit):    %d",
                tid, tcb->eenter_cnt, tcb->eexit_cnt, tcb->aex_cnt,
-               tcb->sync_signal_cnt, tcb->async_signal_cnt);
+               lifetime_ms ? tcb->aex_cnt * 1000 / lifetime_ms : 0,
+               tcb->sync_signal_cnt, tcb->memfault_signal_cnt, tcb->illegal_signal_cnt,
+               tcb->async_signal_cnt,
+               aex_without_signal_cnt(tcb->aex_cnt, tcb->sync_signal_cnt, tcb->async_signal_cnt),
+               tcb->numa_node, (int)node);
 
     g_eenter_cnt       += tcb->eenter_cnt;
     g_eexit_cnt        += tcb->eexit_cnt;
     g_aex_cnt          += tcb->aex_cnt;
     g_sync_signal_cnt  += tcb->sync_signal_cnt;
     g_async_signal_cnt += tcb->async_signal_cnt;
+    g_memfault_signal_cnt += tcb->memfault_signal_cnt;
+    g_illegal_signal_cnt  += tcb->illegal_signal_cnt;
+    if (tcb->numa_node >= 0 && (int)node != tcb->numa_node)
+        g_numa_migration_cnt++;
 
     if (process_wide) {
         int pid = DO_SYSCALL(getpid);
@@ -64,13 +207,100 @@ void update_and_print_stats(bool process_wide) {
                    "  # of EENTERs:        %lu\n"
                    "  # of EEXITs:         %lu\n"
                    "  # of AEXs:           %lu\n"
-                   "  # of sync signals:   %lu\n"
-                   "  # of async signals:  %lu",
+                   "  # of sync signals:   %lu (page faults: %lu, illegal instructions: %lu)\n"
+                   "  # of async signals:  %lu\n"
+                   "  # of AEXs w/o signal (interrupts, EPC paging): %lu\n"
+                   "  # of NUMA migrations of enclave threads: %lu\n"
+                   "  # of NUMA re-pins of RPC threads:        %lu\n"
+                   "  Peak # of enclave threads: %d (of %d TCS slots)",
                    pid, g_eenter_cnt, g_eexit_cnt, g_aex_cnt,
-                   g_sync_signal_cnt, g_async_signal_cnt);
+                   g_sync_signal_cnt, g_memfault_signal_cnt, g_illegal_signal_cnt,
+                   g_async_signal_cnt,
+                   aex_without_signal_cnt(g_aex_cnt, g_sync_signal_cnt, g_async_signal_cnt),
+                   g_numa_migration_cnt,
+                   __atomic_load_n(&g_rpc_numa_repin_cnt, __ATOMIC_RELAXED),
+                   __atomic_load_n(&g_peak_mapped_tcs_cnt, __ATOMIC_RELAXED), g_enclave_thread_num);
+
+        print_epc_stats(pid);
+
+        /* one JSON object per line, for scripts comparing workloads */
+        log_always("----- Per-OCALL stats for process %d (JSON lines) -----", pid);
+        for (int i = 0; i < OCALL_NR; i++) {
+            struct ocall_stats* stats = &g_ocall_stats[i];
+            uint64_t cnt          = __atomic_load_n(&stats->cnt, __ATOMIC_RELAXED);
+            uint64_t exitless_cnt = __atomic_load_n(&stats->exitless_cnt, __ATOMIC_RELAXED);
+            if (!cnt && !exitless_cnt)
+                continue;
+            log_always("{\"pid\": %d, \"ocall\": %d, \"count\": %lu, \"exitless_count\": %lu, "
+                       "\"cycles\": %lu}", pid, i, cnt, exitless_cnt,
+                       __atomic_load_n(&stats->cycles, __ATOMIC_RELAXED));
+        }
     }
 }
 
+/* Maps the live stats file `<path>.<pid>` and moves the process-wide OCALL stats into it. Must be
+ * called after create_tcs_mapper() and before the enclave starts. */
+int init_stats_file(const char* path) {
+    int pid = DO_SYSCALL(getpid);
+    char filename[PATH_MAX];
+    if ((size_t)snprintf(filename, sizeof(filename), "%s.%d", path, pid) >= sizeof(filename))
+        return -ENAMETOOLONG;
+
+    size_t size = sizeof(struct sgx_stats_header) + OCALL_NR * sizeof(struct ocall_stats)
+                  + g_enclave_thread_num * sizeof(struct sgx_stats_thread);
+    size = ALIGN_UP_POW2(size, PRESET_PAGESIZE);
+
+    int fd = DO_SYSCALL(open, filename, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return fd;
+
+    int ret = DO_SYSCALL(ftruncate, fd, size);
+    if (ret < 0) {
+        DO_SYSCALL(close, fd);
+        return ret;
+    }
+
+    void* page = (void*)DO_SYSCALL(mmap, NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    DO_SYSCALL(close, fd);
+    if (IS_PTR_ERR(page))
+        return PTR_TO_ERR(page);
+
+    /* the file is zero-filled, i.e. all counters are zero and all TCS slots are free */
+    struct sgx_stats_header* header = page;
+    header->magic       = SGX_STATS_MAGIC;
+    header->version     = SGX_STATS_VERSION;
+    header->pid         = pid;
+    header->ocalls_cnt  = OCALL_NR;
+    header->threads_cnt = g_enclave_thread_num;
+    header->start_time  = get_time_usec();
+
+    struct ocall_stats* ocalls = (struct ocall_stats*)(header + 1);
+    memcpy(ocalls, g_ocall_stats, OCALL_NR * sizeof(*ocalls));
+    g_ocall_stats = ocalls;
+    g_stats_threads = (struct sgx_stats_thread*)(ocalls + OCALL_NR);
+    for (int i = 0; i < g_enclave_thread_num; i++)
+        g_stats_threads[i].ocall = -1;
+
+    log_debug("Publishing SGX stats in %s", filename);
+    return 0;
+}
+
+/* Copies the counters of the current thread to its slot in the live stats file; called by the
+ * thread itself on each OCALL, so the readers see values at most one OCALL old */
+void publish_thread_stats(int ocall) {
+    PAL_TCB_URTS* tcb = get_tcb_urts();
+    struct sgx_stats_thread* slot = tcb->stats_slot;
+    if (!slot)
+        return;
+
+    __atomic_store_n(&slot->eenter_cnt, tcb->eenter_cnt, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->eexit_cnt, tcb->eexit_cnt, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->aex_cnt, tcb->aex_cnt, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->sync_signal_cnt, tcb->sync_signal_cnt, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->async_signal_cnt, tcb->async_signal_cnt, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->ocall, ocall, __ATOMIC_RELAXED);
+}
+
 void pal_tcb_urts_init(PAL_TCB_URTS* tcb, void* stack, void* alt_stack) {
     tcb->self = tcb;
     tcb->tcs = NULL;    /* initialized by child thread */
@@ -82,55 +312,135 @@ void pal_tcb_urts_init(PAL_TCB_URTS* tcb, void* stack, void* alt_stack) {
     tcb->aex_cnt          = 0;
     tcb->sync_signal_cnt  = 0;
     tcb->async_signal_cnt = 0;
+    tcb->memfault_signal_cnt = 0;
+    tcb->illegal_signal_cnt  = 0;
+    tcb->start_time = g_sgx_enable_stats ? get_time_usec() : 0;
 
     tcb->profile_sample_time = 0;
+    tcb->profile_pd = NULL;
+    tcb->profile_ocall_gpr = NULL;
+    tcb->profile_ocall_start = 0;
 
     tcb->last_async_event = 0;
+    tcb->numa_node = -1;
+    tcb->stats_slot = NULL;
 }
 
 static spinlock_t tcs_lock = INIT_SPINLOCK_UNLOCKED;
 
-void create_tcs_mapper(void* tcs_base, unsigned int thread_num) {
-    size_t thread_map_size = ALIGN_UP_POW2(sizeof(struct thread_map) * thread_num, PRESET_PAGESIZE);
+/* Entries [0, thread_num) describe the TCSes created with the enclave. With EDMM, the enclave adds
+ * TCS pages at arbitrary (heap) addresses later on, they fill the entries up to `max_thread_num`.
+ * Unused entries have `tcs == NULL`. */
+void create_tcs_mapper(void* tcs_base, unsigned int thread_num, unsigned int max_thread_num) {
+    size_t thread_map_size = ALIGN_UP_POW2(sizeof(struct thread_map) * max_thread_num,
+                                           PRESET_PAGESIZE);
 
     g_enclave_tcs = tcs_base;
-    g_enclave_thread_num = thread_num;
+    g_enclave_static_thread_num = thread_num;
+    g_enclave_thread_num = max_thread_num;
     g_enclave_thread_map = (struct thread_map*)DO_SYSCALL(mmap, NULL, thread_map_size,
                                                           PROT_READ | PROT_WRITE,
                                                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
 
-    for (uint32_t i = 0; i < thread_num; i++) {
+    for (uint32_t i = 0; i < max_thread_num; i++) {
         g_enclave_thread_map[i].tid = 0;
-        g_enclave_thread_map[i].tcs = &g_enclave_tcs[i];
+        g_enclave_thread_map[i].numa_node = -1;
+        g_enclave_thread_map[i].tcs = i < thread_num ? &g_enclave_tcs[i] : NULL;
+    }
+
+    size_t parked_threads_size = ALIGN_UP_POW2(sizeof(*g_parked_threads) * max_thread_num,
+                                               PRESET_PAGESIZE);
+    g_parked_threads = (PAL_TCB_URTS**)DO_SYSCALL(mmap, NULL, parked_threads_size,
+                                                  PROT_READ | PROT_WRITE,
+                                                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (IS_PTR_ERR(g_parked_threads)) {
+        /* not fatal, exiting threads just won't be reused */
+        g_parked_threads = NULL;
     }
 }
 
+int add_tcs(void* tcs) {
+    int ret = -ENOMEM;
+    spinlock_lock(&tcs_lock);
+    for (int i = 0; i < g_enclave_thread_num; i++)
+        if (!g_enclave_thread_map[i].tcs) {
+            g_enclave_thread_map[i].tcs = tcs;
+            ((struct enclave_dbginfo*)DBGINFO_ADDR)->tcs_addrs[i] = tcs;
+            ret = 0;
+            break;
+        }
+    spinlock_unlock(&tcs_lock);
+    return ret;
+}
+
+static int tcs_index(sgx_arch_tcs_t* tcs) {
+    /* TCSes created with the enclave are contiguous, only the ones added later need a search */
+    if (tcs >= g_enclave_tcs && tcs < g_enclave_tcs + g_enclave_static_thread_num)
+        return tcs - g_enclave_tcs;
+
+    for (int i = g_enclave_static_thread_num; i < g_enclave_thread_num; i++)
+        if (g_enclave_thread_map[i].tcs == tcs)
+            return i;
+    return -1;
+}
+
 void map_tcs(unsigned int tid) {
+    unsigned int cpu;
+    unsigned int node;
+    int ret = DO_SYSCALL(getcpu, &cpu, &node, /*unused_cache=*/NULL);
+
     spinlock_lock(&tcs_lock);
     for (int i = 0; i < g_enclave_thread_num; i++)
-        if (!g_enclave_thread_map[i].tid) {
+        if (g_enclave_thread_map[i].tcs && !g_enclave_thread_map[i].tid) {
             g_enclave_thread_map[i].tid = tid;
+            g_enclave_thread_map[i].numa_node = ret < 0 ? -1 : (int)node;
             get_tcb_urts()->tcs = g_enclave_thread_map[i].tcs;
+            get_tcb_urts()->numa_node = g_enclave_thread_map[i].numa_node;
+            if (g_stats_threads) {
+                __atomic_store_n(&g_stats_threads[i].tid, tid, __ATOMIC_RELAXED);
+                get_tcb_urts()->stats_slot = &g_stats_threads[i];
+            }
             ((struct enclave_dbginfo*)DBGINFO_ADDR)->thread_tids[i] = tid;
+            g_mapped_tcs_cnt++;
+            g_peak_mapped_tcs_cnt = MAX(g_peak_mapped_tcs_cnt, g_mapped_tcs_cnt);
             break;
         }
     spinlock_unlock(&tcs_lock);
 }
 
 void unmap_tcs(void) {
+#ifdef DEBUG
+    sgx_profile_thread_finish();
+#endif
+
     spinlock_lock(&tcs_lock);
 
-    int index = get_tcb_urts()->tcs - g_enclave_tcs;
+    int index = tcs_index(get_tcb_urts()->tcs);
+    assert(index >= 0);
     struct thread_map* map = &g_enclave_thread_map[index];
 
-    assert(index < g_enclave_thread_num);
-
     get_tcb_urts()->tcs = NULL;
+    get_tcb_urts()->stats_slot = NULL;
+    if (g_stats_threads)
+        __atomic_store_n(&g_stats_threads[index].tid, 0, __ATOMIC_RELAXED);
     ((struct enclave_dbginfo*)DBGINFO_ADDR)->thread_tids[index] = 0;
     map->tid = 0;
+    g_mapped_tcs_cnt--;
     spinlock_unlock(&tcs_lock);
 }
 
+/* Returns the NUMA node of the host thread currently running in TCS slot `index`, or -1 if the slot
+ * is unused or the node is unknown. The node is sampled once, when the host thread takes the slot;
+ * the kernel may migrate the thread later on, so this is only a hint. */
+int get_tcs_numa_node(size_t index) {
+    int node = -1;
+    spinlock_lock(&tcs_lock);
+    if (index < (size_t)g_enclave_thread_num && g_enclave_thread_map[index].tid)
+        node = g_enclave_thread_map[index].numa_node;
+    spinlock_unlock(&tcs_lock);
+    return node;
+}
+
 int current_enclave_thread_cnt(void) {
     int ret = 0;
     spinlock_lock(&tcs_lock);
@@ -178,7 +488,7 @@ int pal_thread_init(void* tcbptr) {
     if (!tcb->tcs) {
         log_error(
             "There are no available TCS pages left for a new thread!\n"
-            "Please try to increase sgx.thread_num in the manifest.\n"
+            "Please try to increase sgx.thread_num (or sgx.max_threads) in the manifest.\n"
             "The current value is %d",
             g_enclave_thread_num);
         ret = -ENOMEM;
@@ -240,9 +550,84 @@ noreturn void thread_exit(int status) {
     __builtin_unreachable();
 }
 
+/* Runs a new enclave thread on a host thread taken out of the pool. */
+static noreturn void run_parked_thread(void) {
+    PAL_TCB_URTS* tcb = get_tcb_urts();
+
+    int tid = DO_SYSCALL(gettid);
+    map_tcs(tid); /* updates tcb->tcs */
+
+    if (!tcb->tcs) {
+        log_error(
+            "There are no available TCS pages left for a new thread!\n"
+            "Please try to increase sgx.thread_num (or sgx.max_threads) in the manifest.\n"
+            "The current value is %d",
+            g_enclave_thread_num);
+        thread_exit(-ENOMEM);
+    }
+
+    /* async signals were blocked by sgx_ocall_exit() of the previous enclave thread */
+    block_async_signals(false);
+
+    ecall_thread_start();
+
+    unmap_tcs();
+    thread_exit(0);
+}
+
+/*
+ * Called by an exiting child thread after its TCS was unmapped. Keeps the host thread waiting for
+ * `clone_thread()` to hand it a new enclave thread, in which case it does not return but starts
+ * over from the top of its stack. Returns if the thread cannot be kept.
+ */
+void park_thread(void) {
+    PAL_TCB_URTS* tcb = get_tcb_urts();
+
+    /* the first thread runs on the stack provided by Linux, we cannot restart on it */
+    if (!tcb->stack || !g_parked_threads)
+        return;
+
+    spinlock_lock(&g_parked_threads_lock);
+    if (g_parked_threads_cnt >= g_enclave_thread_num) {
+        spinlock_unlock(&g_parked_threads_lock);
+        return;
+    }
+    __atomic_store_n(&tcb->parked, 1, __ATOMIC_RELAXED);
+    g_parked_threads[g_parked_threads_cnt++] = tcb;
+    spinlock_unlock(&g_parked_threads_lock);
+
+    update_and_print_stats(/*process_wide=*/false);
+
+    while (__atomic_load_n(&tcb->parked, __ATOMIC_ACQUIRE))
+        DO_SYSCALL(futex, &tcb->parked, FUTEX_WAIT_PRIVATE, 1, NULL, NULL, 0);
+
+    /* reset the per-thread stats (already accounted above) */
+    pal_tcb_urts_init(tcb, tcb->stack, tcb->alt_stack);
+
+    /* nothing on the current stack is needed anymore, start from its top again */
+    void* stack_top = ALIGN_DOWN_PTR(tcb->stack + THREAD_STACK_SIZE, 16);
+    __asm__ volatile("movq %0, %%rsp \n"
+                     "call *%1 \n"
+                     "ud2 \n"
+                     :
+                     : "r" (stack_top), "r" (run_parked_thread)
+                     : "memory");
+    __builtin_unreachable();
+}
+
 int clone_thread(void) {
     int ret = 0;
 
+    spinlock_lock(&g_parked_threads_lock);
+    PAL_TCB_URTS* parked = g_parked_threads_cnt ? g_parked_threads[--g_parked_threads_cnt] : NULL;
+    spinlock_unlock(&g_parked_threads_lock);
+
+    if (parked) {
+        __atomic_store_n(&parked->parked, 0, __ATOMIC_RELEASE);
+        DO_SYSCALL(futex, &parked->parked, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+        return 0;
+    }
+
     void* stack = (void*)DO_SYSCALL(mmap, NULL, THREAD_STACK_SIZE + ALT_STACK_SIZE,
                                     PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
     if (IS_PTR_ERR(stack))
@@ -284,12 +669,12 @@ int clone_thread(void) {
 }
 
 int get_tid_from_tcs(void* tcs) {
-    int index = (sgx_arch_tcs_t*)tcs - g_enclave_tcs;
-    struct thread_map* map = &g_enclave_thread_map[index];
-    if (index >= g_enclave_thread_num)
-        return -EINVAL;
-    if (!map->tid)
-        return -EINVAL;
+    spinlock_lock(&tcs_lock);
+    int index = tcs_index(tcs);
+    int tid = index < 0 ? 0 : (int)g_enclave_thread_map[index].tid;
+    spinlock_unlock(&tcs_lock);
 
-    return map->tid;
+    if (!tid)
+        return -EINVAL;
+    return tid;
 }
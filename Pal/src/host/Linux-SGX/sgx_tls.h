@@ -8,6 +8,10 @@
 #include "pal.h"
 #include "sgx_arch.h"
 
+/* number of untrusted I/O buffers per enclave thread; more than one is needed only when OCALLs are
+ * nested, e.g. during signal handling */
+#define UNTRUSTED_AREA_POOL_SIZE 4
+
 struct untrusted_area {
     void* addr;
     size_t size;
@@ -28,6 +32,7 @@ struct enclave_tls {
     /* private to Linux-SGX PAL */
     uint64_t enclave_size;
     uint64_t tcs_offset;
+    uint64_t thread_idx; /* index of this thread's TCS slot, in [0, sgx.max_threads) */
     uint64_t initial_stack_addr;
     uint64_t tmp_rip;
     uint64_t sig_stack_low;
@@ -47,8 +52,13 @@ struct enclave_tls {
     uint64_t manifest_size;
     void*    heap_min;
     void*    heap_max;
+    uint64_t edmm_enabled; /* heap is committed on demand via EDMM, see `sgx.edmm_enable` */
     int*     clear_child_tid;
-    struct untrusted_area untrusted_area_cache;
+    struct untrusted_area untrusted_area_pool[UNTRUSTED_AREA_POOL_SIZE];
+    /* this thread's copy of the TSC/usec baseline for time queries (see db_misc.c) */
+    uint64_t tsc_base_gen;
+    uint64_t tsc_base_tsc;
+    uint64_t tsc_base_usec;
 };
 
 #ifndef DEBUG
@@ -104,8 +114,17 @@ typedef struct pal_tcb_urts {
     atomic_ulong aex_cnt;          /* # of AEXs, corresponds to # of interrupts/signals */
     atomic_ulong sync_signal_cnt;  /* # of sync signals, corresponds to # of SIGSEGV/SIGILL/.. */
     atomic_ulong async_signal_cnt; /* # of async signals, corresponds to # of SIGINT/SIGCONT/.. */
+    atomic_ulong memfault_signal_cnt; /* # of sync SIGSEGV/SIGBUS, i.e. enclave page faults */
+    atomic_ulong illegal_signal_cnt;  /* # of sync SIGILL, mostly emulated CPUID/RDTSC */
+    uint64_t start_time;           /* when the thread started (usec), for the AEX rate */
     uint64_t profile_sample_time;  /* last time sgx_profile_sample() recorded a sample */
+    struct perf_data* profile_pd;  /* per-thread buffer for profiling samples, or NULL */
+    void* profile_ocall_gpr;       /* in-enclave context of the current OCALL (off-CPU profiling) */
+    uint64_t profile_ocall_start;  /* when the current OCALL started (nsec, off-CPU profiling) */
     int32_t last_async_event;      /* last async signal, reported to the enclave on ocall return */
+    uint32_t parked;               /* futex word, non-zero while the thread waits for reuse */
+    int32_t numa_node;             /* NUMA node the thread ran on when it took its TCS, or -1 */
+    struct sgx_stats_thread* stats_slot; /* slot of its TCS in the live stats file, or NULL */
 } PAL_TCB_URTS;
 
 extern void pal_tcb_urts_init(PAL_TCB_URTS* tcb, void* stack, void* alt_stack);
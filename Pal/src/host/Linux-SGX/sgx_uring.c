@@ -0,0 +1,134 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+#include "sgx_uring.h"
+
+#include <asm/errno.h>
+#include <linux/mman.h>
+
+#include "api.h"
+#include "syscall.h"
+
+int sgx_uring_init(struct sgx_uring* ring, unsigned int entries) {
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    int fd = DO_SYSCALL(io_uring_setup, entries, &params);
+    if (fd < 0)
+        return fd;
+
+    int ret;
+    ring->fd = fd;
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_size    = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    ring->sq_ring_ptr = (void*)DO_SYSCALL(mmap, NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+                                          MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (IS_PTR_ERR(ring->sq_ring_ptr)) {
+        ret = PTR_TO_ERR(ring->sq_ring_ptr);
+        ring->sq_ring_ptr = NULL;
+        goto fail;
+    }
+
+    ring->cq_ring_ptr = (void*)DO_SYSCALL(mmap, NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+                                          MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    if (IS_PTR_ERR(ring->cq_ring_ptr)) {
+        ret = PTR_TO_ERR(ring->cq_ring_ptr);
+        ring->cq_ring_ptr = NULL;
+        goto fail;
+    }
+
+    ring->sqes = (struct io_uring_sqe*)DO_SYSCALL(mmap, NULL, ring->sqes_size,
+                                                  PROT_READ | PROT_WRITE,
+                                                  MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (IS_PTR_ERR(ring->sqes)) {
+        ret = PTR_TO_ERR(ring->sqes);
+        ring->sqes = NULL;
+        goto fail;
+    }
+
+    char* sq = ring->sq_ring_ptr;
+    ring->sq_head    = (unsigned int*)(sq + params.sq_off.head);
+    ring->sq_tail    = (unsigned int*)(sq + params.sq_off.tail);
+    ring->sq_mask    = (unsigned int*)(sq + params.sq_off.ring_mask);
+    ring->sq_array   = (unsigned int*)(sq + params.sq_off.array);
+    ring->sq_entries = params.sq_entries;
+    ring->sq_local_tail = *ring->sq_tail;
+    ring->sq_submitted  = ring->sq_local_tail;
+
+    char* cq = ring->cq_ring_ptr;
+    ring->cq_head = (unsigned int*)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned int*)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned int*)(cq + params.cq_off.ring_mask);
+    ring->cqes    = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    return 0;
+
+fail:
+    sgx_uring_destroy(ring);
+    return ret;
+}
+
+void sgx_uring_destroy(struct sgx_uring* ring) {
+    if (ring->sqes)
+        DO_SYSCALL(munmap, ring->sqes, ring->sqes_size);
+    if (ring->cq_ring_ptr)
+        DO_SYSCALL(munmap, ring->cq_ring_ptr, ring->cq_ring_size);
+    if (ring->sq_ring_ptr)
+        DO_SYSCALL(munmap, ring->sq_ring_ptr, ring->sq_ring_size);
+    if (ring->fd >= 0)
+        DO_SYSCALL(close, ring->fd);
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+}
+
+struct io_uring_sqe* sgx_uring_get_sqe(struct sgx_uring* ring) {
+    unsigned int head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (ring->sq_local_tail - head >= ring->sq_entries)
+        return NULL;
+
+    unsigned int idx = ring->sq_local_tail & *ring->sq_mask;
+    ring->sq_array[idx] = idx;
+    ring->sq_local_tail++;
+
+    struct io_uring_sqe* sqe = &ring->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+int sgx_uring_submit_and_wait(struct sgx_uring* ring, unsigned int wait_nr) {
+    unsigned int to_submit = ring->sq_local_tail - ring->sq_submitted;
+
+    /* publish new entries to the kernel; pairs with the acquire load of the tail in the kernel */
+    __atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+
+    if (!to_submit && !wait_nr)
+        return 0;
+
+    int ret = DO_SYSCALL(io_uring_enter, ring->fd, to_submit, wait_nr,
+                         wait_nr ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    if (ret >= 0) {
+        /* kernel may consume fewer entries than requested, the rest is picked up next time */
+        ring->sq_submitted += ret;
+    } else if (ret == -EINTR) {
+        /* entries are consumed by the kernel before it starts waiting, so on EINTR re-read how
+         * far the kernel got */
+        ring->sq_submitted = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    }
+    return ret;
+}
+
+struct io_uring_cqe* sgx_uring_peek_cqe(struct sgx_uring* ring) {
+    unsigned int head = *ring->cq_head;
+    /* pairs with the release store of the tail in the kernel, so that CQE contents are visible */
+    unsigned int tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    if (head == tail)
+        return NULL;
+    return &ring->cqes[head & *ring->cq_mask];
+}
+
+void sgx_uring_cqe_seen(struct sgx_uring* ring) {
+    __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,63 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/*
+ * Minimal io_uring wrapper for the untrusted runtime. Graphene's untrusted PAL does not link
+ * against liburing, so this only implements what RPC threads need: setting up a ring, grabbing
+ * submission entries, submitting them in one io_uring_enter() and reaping completions.
+ *
+ * None of the functions below are thread-safe: a ring is used by one thread at a time (RPC threads
+ * reap the io_uring of a blocked RPC thread only under a lock, see sgx_enclave.c).
+ */
+
+#ifndef SGX_URING_H_
+#define SGX_URING_H_
+
+#include <linux/io_uring.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+struct sgx_uring {
+    int fd;
+
+    unsigned int* sq_head;
+    unsigned int* sq_tail;
+    unsigned int* sq_mask;
+    unsigned int* sq_array;
+    unsigned int sq_entries;
+    unsigned int sq_local_tail; /* entries up to this index were handed out by sgx_uring_get_sqe() */
+    unsigned int sq_submitted;  /* entries up to this index were published to the kernel */
+
+    unsigned int* cq_head;
+    unsigned int* cq_tail;
+    unsigned int* cq_mask;
+    struct io_uring_cqe* cqes;
+
+    struct io_uring_sqe* sqes;
+
+    void* sq_ring_ptr;
+    size_t sq_ring_size;
+    void* cq_ring_ptr;
+    size_t cq_ring_size;
+    size_t sqes_size;
+};
+
+/* returns 0 on success or negative errno (e.g. -ENOSYS if the host kernel lacks io_uring) */
+int sgx_uring_init(struct sgx_uring* ring, unsigned int entries);
+void sgx_uring_destroy(struct sgx_uring* ring);
+
+/* returns a zeroed submission entry or NULL if the submission queue is full */
+struct io_uring_sqe* sgx_uring_get_sqe(struct sgx_uring* ring);
+
+static inline unsigned int sgx_uring_unsubmitted(struct sgx_uring* ring) {
+    return ring->sq_local_tail - ring->sq_submitted;
+}
+
+/* submits all entries obtained since the last call and waits for at least `wait_nr` completions;
+ * returns the number of submitted entries or negative errno (-EINTR if interrupted by a signal) */
+int sgx_uring_submit_and_wait(struct sgx_uring* ring, unsigned int wait_nr);
+
+/* returns the oldest unconsumed completion or NULL; must be followed by sgx_uring_cqe_seen() */
+struct io_uring_cqe* sgx_uring_peek_cqe(struct sgx_uring* ring);
+void sgx_uring_cqe_seen(struct sgx_uring* ring);
+
+#endif /* SGX_URING_H_ */
@@ -15,6 +15,7 @@
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include <mbedtls/cmac.h>
@@ -29,6 +30,9 @@
 
 /* High-level protected files helper functions. */
 
+/* Plaintext is read and written in chunks of this size, PF nodes are much smaller */
+#define PF_IO_CHUNK_SIZE (1024 * 1024)
+
 /* PF callbacks usable in a standard Linux environment.
    Assume that pf handle is a pointer to file's fd. */
 
@@ -96,6 +100,60 @@ static pf_status_t linux_write(pf_handle_t handle, const void* buffer, uint64_t
     return PF_STATUS_SUCCESS;
 }
 
+/* writes each run of requests that are adjacent in the file with a single writev() */
+static pf_status_t linux_write_batch(pf_handle_t handle, const pf_write_req_t* reqs,
+                                     size_t count) {
+    int fd = *(int*)handle;
+    struct iovec iov[64];
+
+    size_t i = 0;
+    while (i < count) {
+        uint64_t offset = reqs[i].offset;
+        size_t iov_cnt = 0;
+        size_t size = 0;
+        while (i < count && iov_cnt < ARRAY_SIZE(iov) && reqs[i].offset == offset + size) {
+            iov[iov_cnt].iov_base = (void*)reqs[i].buffer;
+            iov[iov_cnt].iov_len  = reqs[i].size;
+            size += reqs[i].size;
+            iov_cnt++;
+            i++;
+        }
+        DBG("linux_write_batch: fd %d, offset %zu, size %zu (%zu requests)\n", fd, offset, size,
+            iov_cnt);
+
+        if (lseek64(fd, offset, SEEK_SET) < 0) {
+            ERROR("lseek64 failed: %s\n", strerror(errno));
+            return PF_STATUS_CALLBACK_FAILED;
+        }
+
+        ssize_t ret = writev(fd, iov, iov_cnt);
+        if (ret < 0 && errno == EINTR)
+            ret = 0;
+        if (ret < 0) {
+            ERROR("writev failed: %s\n", strerror(errno));
+            return PF_STATUS_CALLBACK_FAILED;
+        }
+        /* short write (or EINTR), finish the run request by request */
+        size_t done = ret;
+        for (size_t j = 0; j < iov_cnt && done < size; j++) {
+            if (done >= iov[j].iov_len) {
+                done -= iov[j].iov_len;
+                size -= iov[j].iov_len;
+                offset += iov[j].iov_len;
+                continue;
+            }
+            pf_status_t pfs = linux_write(handle, (uint8_t*)iov[j].iov_base + done, offset + done,
+                                          iov[j].iov_len - done);
+            if (PF_FAILURE(pfs))
+                return pfs;
+            size -= iov[j].iov_len;
+            offset += iov[j].iov_len;
+            done = 0;
+        }
+    }
+    return PF_STATUS_SUCCESS;
+}
+
 static pf_status_t linux_truncate(pf_handle_t handle, uint64_t size) {
     int fd = *(int*)handle;
     DBG("linux_truncate: fd %d, size %zu\n", fd, size);
@@ -209,6 +267,7 @@ static int pf_set_linux_callbacks(pf_debug_f debug_f) {
 
     pf_set_callbacks(linux_read, linux_write, linux_truncate, mbedtls_aes_cmac,
                      mbedtls_aes_gcm_encrypt, mbedtls_aes_gcm_decrypt, mbedtls_random, debug_f);
+    pf_set_write_batch_callback(linux_write_batch);
     return 0;
 }
 
@@ -270,13 +329,14 @@ int pf_encrypt_file(const char* input_path, const char* output_path, const pf_ke
     int input = -1;
     int output = -1;
     pf_context_t* pf = NULL;
-    void* chunk = malloc(PF_NODE_SIZE);
+    void* chunk = malloc(PF_IO_CHUNK_SIZE);
     if (!chunk) {
         ERROR("Out of memory\n");
         goto out;
     }
 
-    input = open(input_path, O_RDONLY);
+    /* "-" encrypts the standard input, e.g. the output of a pipeline producing the data */
+    input = strcmp(input_path, "-") ? open(input_path, O_RDONLY) : STDIN_FILENO;
     if (input < 0) {
         ERROR("Failed to open input file '%s': %s\n", input_path, strerror(errno));
         goto out;
@@ -301,21 +361,15 @@ int pf_encrypt_file(const char* input_path, const char* output_path, const pf_ke
     }
 
     /* Process file contents */
-    uint64_t input_size = get_file_size(input);
-    if (input_size == (uint64_t)-1) {
-        ERROR("Failed to get size of input file '%s': %s\n", input_path, strerror(errno));
-        goto out;
-    }
-
     uint64_t input_offset = 0;
 
     while (true) {
-        ssize_t chunk_size = read(input, chunk, PF_NODE_SIZE);
+        ssize_t chunk_size = read(input, chunk, PF_IO_CHUNK_SIZE);
         if (chunk_size == 0) // EOF
             break;
 
         if (chunk_size < 0) {
-            if (errno == -EINTR)
+            if (errno == EINTR)
                 continue;
 
             ERROR("Failed to read file '%s': %s\n", input_path, strerror(errno));
@@ -342,7 +396,7 @@ out:
     }
 
     free(chunk);
-    if (input >= 0)
+    if (input >= 0 && input != STDIN_FILENO)
         close(input);
     if (output >= 0)
         close(output);
@@ -356,7 +410,7 @@ int pf_decrypt_file(const char* input_path, const char* output_path, bool verify
     int input = -1;
     int output = -1;
     pf_context_t* pf = NULL;
-    void* chunk = malloc(PF_NODE_SIZE);
+    void* chunk = malloc(PF_IO_CHUNK_SIZE);
     if (!chunk) {
         ERROR("Out of memory\n");
         goto out;
@@ -408,7 +462,7 @@ int pf_decrypt_file(const char* input_path, const char* output_path, bool verify
 
     while (true) {
         assert(input_offset <= data_size);
-        uint64_t chunk_size = MIN(data_size - input_offset, PF_NODE_SIZE);
+        uint64_t chunk_size = MIN(data_size - input_offset, PF_IO_CHUNK_SIZE);
         if (chunk_size == 0)
             break;
 
@@ -449,9 +503,113 @@ out:
     return ret;
 }
 
+/* Re-encrypt a single protected file, e.g. to change its data node size (see
+ * pf_set_data_node_size()); the output file embeds the output path */
+int pf_convert_file(const char* input_path, const char* output_path, bool verify_path,
+                    const pf_key_t* wrap_key) {
+    int ret = -1;
+    int input = -1;
+    int output = -1;
+    pf_context_t* input_pf = NULL;
+    pf_context_t* output_pf = NULL;
+    void* chunk = malloc(PF_MAX_DATA_NODE_SIZE);
+    if (!chunk) {
+        ERROR("Out of memory\n");
+        goto out;
+    }
+
+    input = open(input_path, O_RDONLY);
+    if (input < 0) {
+        ERROR("Failed to open input file '%s': %s\n", input_path, strerror(errno));
+        goto out;
+    }
+
+    output = open(output_path, O_RDWR | O_CREAT | O_TRUNC, PERM_rw_rw_r__);
+    if (output < 0) {
+        ERROR("Failed to create output file '%s': %s\n", output_path, strerror(errno));
+        goto out;
+    }
+
+    INFO("Converting: %s -> %s\n", input_path, output_path);
+    INFO("            (Graphene's sgx.protected_files must contain this exact path: \"%s\")\n",
+                      output_path);
+
+    uint64_t input_size = get_file_size(input);
+    if (input_size == (uint64_t)-1) {
+        ERROR("Failed to get size of input file '%s': %s\n", input_path, strerror(errno));
+        goto out;
+    }
+
+    const char* path = verify_path ? input_path : NULL;
+    pf_status_t pfs = pf_open((pf_handle_t)&input, path, input_size, PF_FILE_MODE_READ,
+                              /*create=*/false, wrap_key, &input_pf);
+    if (PF_FAILURE(pfs)) {
+        ERROR("Opening protected input file failed: %s\n", pf_strerror(pfs));
+        goto out;
+    }
+
+    pfs = pf_open((pf_handle_t)&output, output_path, /*size=*/0, PF_FILE_MODE_WRITE,
+                  /*create=*/true, wrap_key, &output_pf);
+    if (PF_FAILURE(pfs)) {
+        ERROR("Failed to open output PF: %s\n", pf_strerror(pfs));
+        goto out;
+    }
+
+    uint64_t data_size;
+    pfs = pf_get_size(input_pf, &data_size);
+    if (PF_FAILURE(pfs)) {
+        ERROR("pf_get_size failed: %s\n", pf_strerror(pfs));
+        goto out;
+    }
+
+    uint64_t offset = 0;
+    while (offset < data_size) {
+        uint64_t chunk_size = MIN(data_size - offset, PF_MAX_DATA_NODE_SIZE);
+
+        size_t bytes_read = 0;
+        pfs = pf_read(input_pf, offset, chunk_size, chunk, &bytes_read);
+        if (bytes_read != chunk_size) {
+            pfs = PF_STATUS_CORRUPTED;
+        }
+        if (PF_FAILURE(pfs)) {
+            ERROR("Read from protected file failed (offset %" PRIu64 ", size %" PRIu64 "): %s\n",
+                  offset, chunk_size, pf_strerror(pfs));
+            goto out;
+        }
+
+        pfs = pf_write(output_pf, offset, chunk_size, chunk);
+        if (PF_FAILURE(pfs)) {
+            ERROR("Failed to write to output PF: %s\n", pf_strerror(pfs));
+            goto out;
+        }
+
+        offset += chunk_size;
+    }
+
+    ret = 0;
+
+out:
+    if (output_pf) {
+        if (PF_FAILURE(pf_close(output_pf))) {
+            ERROR("failed to close PF\n");
+            ret = -1;
+        }
+    }
+    if (input_pf)
+        pf_close(input_pf);
+
+    free(chunk);
+    if (input >= 0)
+        close(input);
+    if (output >= 0)
+        close(output);
+    return ret;
+}
+
 enum processing_mode_t {
     MODE_ENCRYPT = 1,
     MODE_DECRYPT = 2,
+    MODE_CONVERT = 3,
 };
 
 static int process_files(const char* input_dir, const char* output_dir, const char* wrap_key_path,
@@ -462,7 +620,7 @@ static int process_files(const char* input_dir, const char* output_dir, const ch
     char* input_path  = NULL;
     char* output_path = NULL;
 
-    if (mode != MODE_ENCRYPT && mode != MODE_DECRYPT) {
+    if (mode != MODE_ENCRYPT && mode != MODE_DECRYPT && mode != MODE_CONVERT) {
         ERROR("Invalid mode: %d\n", mode);
         goto out;
     }
@@ -476,6 +634,9 @@ static int process_files(const char* input_dir, const char* output_dir, const ch
     if (ret != 0)
         goto out;
 
+    if (mode == MODE_ENCRYPT && !strcmp(input_dir, "-"))
+        return pf_encrypt_file(input_dir, output_dir, &wrap_key);
+
     if (stat(input_dir, &st) != 0) {
         ERROR("Failed to stat input path %s: %s\n", input_dir, strerror(errno));
         goto out;
@@ -485,8 +646,10 @@ static int process_files(const char* input_dir, const char* output_dir, const ch
     if (S_ISREG(st.st_mode)) {
         if (mode == MODE_ENCRYPT)
             return pf_encrypt_file(input_dir, output_dir, &wrap_key);
-        else
+        else if (mode == MODE_DECRYPT)
             return pf_decrypt_file(input_dir, output_dir, verify_path, &wrap_key);
+        else
+            return pf_convert_file(input_dir, output_dir, verify_path, &wrap_key);
     }
 
     ret = mkdir(output_dir, PERM_rwxrwxr_x);
@@ -536,8 +699,10 @@ static int process_files(const char* input_dir, const char* output_dir, const ch
         if (S_ISREG(st.st_mode)) {
             if (mode == MODE_ENCRYPT)
                 ret = pf_encrypt_file(input_path, output_path, &wrap_key);
-            else
+            else if (mode == MODE_DECRYPT)
                 ret = pf_decrypt_file(input_path, output_path, verify_path, &wrap_key);
+            else
+                ret = pf_convert_file(input_path, output_path, verify_path, &wrap_key);
 
             if (ret != 0)
                 goto out;
@@ -573,3 +738,9 @@ int pf_decrypt_files(const char* input_dir, const char* output_dir, bool verify_
                      const char* wrap_key_path) {
     return process_files(input_dir, output_dir, wrap_key_path, MODE_DECRYPT, verify_path);
 }
+
+/* Re-encrypt a protected file or directory (recursively), e.g. to change the data node size */
+int pf_convert_files(const char* input_dir, const char* output_dir, bool verify_path,
+                     const char* wrap_key_path) {
+    return process_files(input_dir, output_dir, wrap_key_path, MODE_CONVERT, verify_path);
+}
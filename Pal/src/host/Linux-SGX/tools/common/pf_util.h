@@ -25,6 +25,10 @@ int pf_encrypt_file(const char* input_path, const char* output_path, const pf_ke
 int pf_decrypt_file(const char* input_path, const char* output_path, bool verify_path,
                     const pf_key_t* wrap_key);
 
+/*! Re-encrypt a single protected file (with the current data node size for new files) */
+int pf_convert_file(const char* input_path, const char* output_path, bool verify_path,
+                    const pf_key_t* wrap_key);
+
 /*! Convert a file or directory (recursively) to the protected format */
 int pf_encrypt_files(const char* input_dir, const char* output_dir, const char* wrap_key_path);
 
@@ -32,6 +36,10 @@ int pf_encrypt_files(const char* input_dir, const char* output_dir, const char*
 int pf_decrypt_files(const char* input_dir, const char* output_dir, bool verify_path,
                      const char* wrap_key_path);
 
+/*! Re-encrypt a protected file or directory (recursively) */
+int pf_convert_files(const char* input_dir, const char* output_dir, bool verify_path,
+                     const char* wrap_key_path);
+
 /*! AES-CMAC */
 pf_status_t mbedtls_aes_cmac(const pf_key_t* key, const void* input, size_t input_size,
                              pf_mac_t* mac);
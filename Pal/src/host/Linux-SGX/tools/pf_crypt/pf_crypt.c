@@ -15,6 +15,7 @@ struct option g_options[] = {
     { "output", required_argument, 0, 'o' },
     { "wrap-key", required_argument, 0, 'w' },
     { "verify", no_argument, 0, 'V' },
+    { "node-size", required_argument, 0, 'n' },
     { "verbose", no_argument, 0, 'v' },
     { "help", no_argument, 0, 'h' },
     { 0, 0, 0, 0 }
@@ -26,24 +27,37 @@ static void usage(void) {
     INFO("  gen-key                 Generate and save wrap key to file\n");
     INFO("  encrypt                 Encrypt plaintext files\n");
     INFO("  decrypt                 Decrypt encrypted files\n");
+    INFO("  convert                 Re-encrypt encrypted files (e.g. with another node size)\n");
     INFO("\nAvailable general options:\n");
     INFO("  --help, -h              Display this help\n");
     INFO("  --verbose, -v           Verbose output\n");
     INFO("\nAvailable gen-key options:\n");
     INFO("  --wrap-key, -w PATH     Path to wrap key file\n");
     INFO("\nAvailable encrypt options:\n");
-    INFO("  --input, -i PATH        Single file or directory with input files to convert\n");
+    INFO("  --input, -i PATH        Single file or directory with input files to convert, '-'\n");
+    INFO("                          to encrypt the standard input into a single output file\n");
     INFO("  --output, -o PATH       Single file or directory to write output files to\n");
     INFO("  --wrap-key, -w PATH     Path to wrap key file, must exist\n");
+    INFO("  --node-size, -n SIZE    (optional) Size of data nodes of output files in bytes, a\n");
+    INFO("                          power of two between 4096 (default) and 1048576\n");
     INFO("\nAvailable decrypt options:\n");
     INFO("  --input, -i PATH        Single file or directory with input files to convert\n");
     INFO("  --output, -o PATH       Single file or directory to write output files to\n");
     INFO("  --wrap-key, -w PATH     Path to wrap key file, must exist\n");
     INFO("  --verify, -V            (optional) Verify that input path matches PF's allowed paths\n");
+    INFO("\nAvailable convert options:\n");
+    INFO("  --input, -i PATH        Single file or directory with input files to convert\n");
+    INFO("  --output, -o PATH       Single file or directory to write output files to\n");
+    INFO("  --wrap-key, -w PATH     Path to wrap key file, must exist\n");
+    INFO("  --node-size, -n SIZE    (optional) Size of data nodes of output files in bytes\n");
+    INFO("  --verify, -V            (optional) Verify that input path matches PF's allowed paths\n");
     INFO("\n");
     INFO("NOTE: Files encrypted using the 'encrypt' mode embed the output path string, exactly\n");
     INFO("      as specified in '-o PATH'. Therefore, the Graphene manifest must specify this\n");
     INFO("      exact path in sgx.protected_files.xyz = \"PATH\".\n");
+    INFO("NOTE: Files with node size other than 4096 can't be opened by Graphene versions older\n");
+    INFO("      than the one shipping this tool; 'convert' with the default node size converts\n");
+    INFO("      them back.\n");
 }
 
 int main(int argc, char* argv[]) {
@@ -54,9 +68,11 @@ int main(int argc, char* argv[]) {
     char* wrap_key_path = NULL;
     char* mode = NULL;
     bool verify = false;
+    unsigned long node_size = PF_NODE_SIZE;
+    char* endptr;
 
     while (true) {
-        this_option = getopt_long(argc, argv, "i:o:p:w:Vvh", g_options, NULL);
+        this_option = getopt_long(argc, argv, "i:o:p:w:n:Vvh", g_options, NULL);
         if (this_option == -1)
             break;
 
@@ -76,6 +92,13 @@ int main(int argc, char* argv[]) {
             case 'V':
                 verify = true;
                 break;
+            case 'n':
+                node_size = strtoul(optarg, &endptr, 10);
+                if (*optarg == '\0' || *endptr != '\0') {
+                    ERROR("Invalid node size: %s\n", optarg);
+                    goto out;
+                }
+                break;
             case 'h':
                 usage();
                 exit(0);
@@ -101,6 +124,12 @@ int main(int argc, char* argv[]) {
         goto out;
     }
 
+    if (node_size > PF_MAX_DATA_NODE_SIZE || PF_FAILURE(pf_set_data_node_size(node_size))) {
+        ERROR("Invalid node size %lu (must be a power of two between %u and %u)\n", node_size,
+              PF_NODE_SIZE, PF_MAX_DATA_NODE_SIZE);
+        goto out;
+    }
+
     mode = argv[optind];
 
     switch (mode[0]) {
@@ -126,6 +155,15 @@ int main(int argc, char* argv[]) {
             ret = pf_decrypt_files(input_path, output_path, verify, wrap_key_path);
             break;
 
+        case 'c': /* convert */
+            if (!input_path || !output_path) {
+                ERROR("Input or output path not specified\n");
+                usage();
+                goto out;
+            }
+            ret = pf_convert_files(input_path, output_path, verify, wrap_key_path);
+            break;
+
         default:
             usage();
             goto out;
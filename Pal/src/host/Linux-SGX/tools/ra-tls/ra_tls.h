@@ -23,6 +23,8 @@
 #define RA_TLS_CERT_TIMESTAMP_NOT_BEFORE "RA_TLS_CERT_TIMESTAMP_NOT_BEFORE"
 #define RA_TLS_CERT_TIMESTAMP_NOT_AFTER  "RA_TLS_CERT_TIMESTAMP_NOT_AFTER"
 
+#define RA_TLS_VERIFY_CACHE_TTL "RA_TLS_VERIFY_CACHE_TTL"
+
 #define SHA256_DIGEST_SIZE       32
 #define RSA_PUB_3072_KEY_LEN     3072
 #define RSA_PUB_3072_KEY_DER_LEN 422
@@ -53,6 +55,12 @@ int cmp_crt_pk_against_quote_report_data(mbedtls_x509_crt* crt, sgx_quote_t* quo
 __attribute__ ((visibility("hidden")))
 int verify_quote_against_envvar_measurements(const void* quote, size_t quote_size);
 
+__attribute__ ((visibility("hidden")))
+bool lookup_verified_crt(mbedtls_x509_crt* crt);
+
+__attribute__ ((visibility("hidden")))
+void remember_verified_crt(mbedtls_x509_crt* crt);
+
 /*!
  * \brief Callback for user-specific verification of measurements in SGX quote.
  *
@@ -12,6 +12,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <mbedtls/pk.h>
@@ -87,6 +88,90 @@ int getenv_allow_outdated_tcb(bool* allow_outdated_tcb) {
     return 0;
 }
 
+/* Cache of certs that passed verification, so that a client reconnecting to the same enclave does
+ * not verify the same SGX quote (with a round trip to IAS or a DCAP collateral check) again. Only
+ * successful verifications are cached, for RA_TLS_VERIFY_CACHE_TTL seconds (0 disables the cache,
+ * the default). Like the rest of this library, the cache is not thread-safe. */
+#define VERIFIED_CRT_CACHE_SIZE 16
+
+struct verified_crt {
+    uint8_t crt_sha[SHA256_DIGEST_SIZE];
+    time_t expiry; /* 0 if the slot is empty */
+};
+
+static struct verified_crt g_verified_crts[VERIFIED_CRT_CACHE_SIZE];
+static size_t g_verified_crts_next = 0;
+
+static time_t getenv_verify_cache_ttl(void) {
+    char* str = getenv(RA_TLS_VERIFY_CACHE_TTL);
+    if (!str)
+        return 0;
+
+    char* endptr;
+    long ttl = strtol(str, &endptr, 10);
+    if (*str == '\0' || *endptr != '\0' || ttl < 0)
+        return 0;
+
+    return (time_t)ttl;
+}
+
+/*! checks if \p crt (the same DER bytes) passed verification less than the cache TTL ago */
+bool lookup_verified_crt(mbedtls_x509_crt* crt) {
+    if (!getenv_verify_cache_ttl())
+        return false;
+
+    time_t now = time(NULL);
+    if (now == ((time_t)-1))
+        return false;
+
+    uint8_t crt_sha[SHA256_DIGEST_SIZE];
+    if (mbedtls_sha256_ret(crt->raw.p, crt->raw.len, crt_sha, /*is224=*/0) < 0)
+        return false;
+
+    for (size_t i = 0; i < VERIFIED_CRT_CACHE_SIZE; i++) {
+        struct verified_crt* v = &g_verified_crts[i];
+        if (v->expiry && memcmp(v->crt_sha, crt_sha, sizeof(crt_sha)) == 0) {
+            if (now < v->expiry)
+                return true;
+            v->expiry = 0;
+            return false;
+        }
+    }
+    return false;
+}
+
+/*! records that \p crt passed verification (no-op if the cache is disabled) */
+void remember_verified_crt(mbedtls_x509_crt* crt) {
+    time_t ttl = getenv_verify_cache_ttl();
+    if (!ttl)
+        return;
+
+    time_t now = time(NULL);
+    if (now == ((time_t)-1))
+        return;
+
+    uint8_t crt_sha[SHA256_DIGEST_SIZE];
+    if (mbedtls_sha256_ret(crt->raw.p, crt->raw.len, crt_sha, /*is224=*/0) < 0)
+        return;
+
+    /* reuse the slot of this cert if it is already cached, otherwise replace round-robin */
+    struct verified_crt* v = NULL;
+    for (size_t i = 0; i < VERIFIED_CRT_CACHE_SIZE; i++) {
+        if (g_verified_crts[i].expiry
+                && memcmp(g_verified_crts[i].crt_sha, crt_sha, sizeof(crt_sha)) == 0) {
+            v = &g_verified_crts[i];
+            break;
+        }
+    }
+    if (!v) {
+        v = &g_verified_crts[g_verified_crts_next];
+        g_verified_crts_next = (g_verified_crts_next + 1) % VERIFIED_CRT_CACHE_SIZE;
+    }
+
+    memcpy(v->crt_sha, crt_sha, sizeof(crt_sha));
+    v->expiry = now + ttl;
+}
+
 /*! searches for specific \p oid among \p exts and returns pointer to its value in \p val */
 int find_oid(const uint8_t* exts, size_t exts_len, const uint8_t* oid, size_t oid_len,
              uint8_t** val, size_t* len) {
@@ -91,6 +91,11 @@ int ra_tls_verify_callback(void* data, mbedtls_x509_crt* crt, int depth, uint32_
         *flags = 0;
     }
 
+    if (lookup_verified_crt(crt)) {
+        /* the same cert was fully verified recently, skip the (expensive) quote verification */
+        return 0;
+    }
+
     /* extract SGX quote from "quote" OID extension from crt */
     sgx_quote_t* quote;
     size_t quote_size;
@@ -166,6 +171,8 @@ int ra_tls_verify_callback(void* data, mbedtls_x509_crt* crt, int depth, uint32_
             ret = MBEDTLS_ERR_X509_CERT_VERIFY_FAILED;
             break;
     }
+    if (ret < 0)
+        goto out;
 
     /* verify all measurements from the SGX quote */
     if (g_verify_measurements_cb) {
@@ -183,6 +190,7 @@ int ra_tls_verify_callback(void* data, mbedtls_x509_crt* crt, int depth, uint32_
         goto out;
     }
 
+    remember_verified_crt(crt);
     ret = 0;
 out:
     free(supplemental_data);
@@ -147,6 +147,11 @@ int ra_tls_verify_callback(void* data, mbedtls_x509_crt* crt, int depth, uint32_
         *flags = 0;
     }
 
+    if (lookup_verified_crt(crt)) {
+        /* the same cert was fully verified recently, skip the (expensive) quote verification */
+        return 0;
+    }
+
     ret = init_from_env(&g_api_key, RA_TLS_EPID_API_KEY, /*default_val=*/NULL);
     if (ret < 0)
         goto out;
@@ -256,6 +261,7 @@ int ra_tls_verify_callback(void* data, mbedtls_x509_crt* crt, int depth, uint32_
         goto out;
     }
 
+    remember_verified_crt(crt);
     ret = 0;
 out:
     if (ias)
@@ -41,7 +41,8 @@ struct thread_info {
     secret_provision_cb_t f_cb;
 };
 
-/* SSL/TLS + RA-TLS handshake is not thread-safe, use coarse-grained lock */
+/* SSL/TLS + RA-TLS handshake is not thread-safe, use coarse-grained lock; it is held only while
+ * mbedTLS processes handshake messages, not while waiting for the client to send them */
 static pthread_mutex_t g_handshake_lock;
 
 static void* client_connection(void* data) {
@@ -58,6 +59,13 @@ static void* client_connection(void* data) {
 
     mbedtls_ssl_set_bio(&ssl, &ti->client_fd, mbedtls_net_send, mbedtls_net_recv, NULL);
 
+    /* the handshake runs on a non-blocking socket, so that a slow client does not stall the
+     * handshakes of other clients while holding the lock */
+    ret = mbedtls_net_set_nonblock(&ti->client_fd);
+    if (ret < 0) {
+        goto out;
+    }
+
     ret = -1;
     while (ret < 0) {
         /* FIXME: this coarse-grained locking is less than optimal; need to switch to thread-safe
@@ -66,6 +74,13 @@ static void* client_connection(void* data) {
         ret = mbedtls_ssl_handshake(&ssl);
         pthread_mutex_unlock(&g_handshake_lock);
         if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+            uint32_t poll_type = ret == MBEDTLS_ERR_SSL_WANT_READ ? MBEDTLS_NET_POLL_READ
+                                                                   : MBEDTLS_NET_POLL_WRITE;
+            int poll_ret = mbedtls_net_poll(&ti->client_fd, poll_type, /*timeout=*/(uint32_t)-1);
+            if (poll_ret < 0) {
+                ret = poll_ret;
+                goto out;
+            }
             continue;
         }
         if (ret < 0) {
@@ -73,6 +88,12 @@ static void* client_connection(void* data) {
         }
     }
 
+    /* the rest of the session (including the user-supplied callback) uses blocking I/O */
+    ret = mbedtls_net_set_block(&ti->client_fd);
+    if (ret < 0) {
+        goto out;
+    }
+
     uint32_t flags = mbedtls_ssl_get_verify_result(&ssl);
     if (flags != 0) {
         ret = MBEDTLS_ERR_X509_CERT_VERIFY_FAILED;
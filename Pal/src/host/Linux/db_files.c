@@ -112,6 +112,57 @@ static int64_t file_write(PAL_HANDLE handle, uint64_t offset, uint64_t count, co
     return ret;
 }
 
+/* Fast paths exported through `g_pal_control.file_read` and `g_pal_control.file_write`; a file
+   handle is just a host fd here, so LibOS can skip the stream dispatch for regular files */
+int64_t pal_file_read_direct(PAL_HANDLE handle, PAL_NUM offset, PAL_NUM count, PAL_PTR buffer) {
+    if (HANDLE_HDR(handle)->type != PAL_TYPE_FILE)
+        return -PAL_ERROR_BADHANDLE;
+    return file_read(handle, offset, count, buffer);
+}
+
+int64_t pal_file_write_direct(PAL_HANDLE handle, PAL_NUM offset, PAL_NUM count,
+                              const void* buffer) {
+    if (HANDLE_HDR(handle)->type != PAL_TYPE_FILE)
+        return -PAL_ERROR_BADHANDLE;
+    return file_write(handle, offset, count, buffer);
+}
+
+/* 'sendfile' operation for file streams: the host kernel copies data from the file directly into
+   `out_handle` */
+static int64_t file_sendfile(PAL_HANDLE handle, PAL_HANDLE out_handle, uint64_t offset,
+                             uint64_t count) {
+    if (!handle->file.seekable)
+        return -PAL_ERROR_NOTSUPPORT;
+
+    int out_fd;
+    switch (HANDLE_HDR(out_handle)->type) {
+        case PAL_TYPE_TCP:
+        case PAL_TYPE_UDP:
+            out_fd = out_handle->sock.fd;
+            break;
+        case PAL_TYPE_PIPE:
+        case PAL_TYPE_PIPECLI:
+            out_fd = out_handle->pipe.fd;
+            break;
+        case PAL_TYPE_PIPEPRV:
+            out_fd = out_handle->pipeprv.fds[1];
+            break;
+        default:
+            return -PAL_ERROR_NOTSUPPORT;
+    }
+
+    off_t off = offset;
+    int64_t ret = DO_SYSCALL(sendfile, out_fd, handle->file.fd, &off, count);
+    if (ret == -EINVAL) {
+        /* e.g. the file doesn't support mmap-like operations; let the caller copy the data */
+        return -PAL_ERROR_NOTSUPPORT;
+    }
+    if (ret < 0)
+        return unix_to_pal_error(ret);
+
+    return ret;
+}
+
 /* 'close' operation for file streams. In this case, it will only
    close the file withou deleting it. */
 static int file_close(PAL_HANDLE handle) {
@@ -302,6 +353,7 @@ struct handle_ops g_file_ops = {
     .open           = &file_open,
     .read           = &file_read,
     .write          = &file_write,
+    .sendfile       = &file_sendfile,
     .close          = &file_close,
     .delete         = &file_delete,
     .map            = &file_map,
@@ -363,18 +415,17 @@ static inline bool is_dot_or_dotdot(const char* name) {
     return (name[0] == '.' && !name[1]) || (name[0] == '.' && name[1] == '.' && !name[2]);
 }
 
-/* 'read' operation for directory stream. Directory stream will not
-   need a 'write' operation. */
-static int64_t dir_read(PAL_HANDLE handle, uint64_t offset, size_t count, void* _buf) {
+/* Fills `buf` with the null-terminated names of the next directory entries (names of directories
+ * end with '/'). If `attrs` is not NULL, also fills `attrs[i]` with the attributes of the i-th
+ * returned entry; then at most `*attrs_cnt` entries are returned, and `*attrs_cnt` is set to their
+ * number. */
+static int64_t dir_read_entries(PAL_HANDLE handle, size_t count, char* buf, PAL_STREAM_ATTR* attrs,
+                                size_t* attrs_cnt) {
     size_t bytes_written = 0;
-    char* buf = (char*)_buf;
-
-    if (offset) {
-        return -PAL_ERROR_INVAL;
-    }
+    size_t entries = 0;
 
     if (handle->dir.endofstream == PAL_TRUE) {
-        return 0;
+        goto out;
     }
 
     while (1) {
@@ -391,6 +442,18 @@ static int64_t dir_read(PAL_HANDLE handle, uint64_t offset, size_t count, void*
             if (len + 1 + (is_dir ? 1 : 0) > count) {
                 goto out;
             }
+            if (attrs) {
+                if (entries == *attrs_cnt)
+                    goto out;
+
+                struct stat stat_buf;
+                memset(&attrs[entries], 0, sizeof(attrs[entries]));
+                if (DO_SYSCALL(newfstatat, handle->dir.fd, dirent->d_name, &stat_buf, 0) < 0) {
+                    attrs[entries].handle_type = PAL_HANDLE_TYPE_BOUND;
+                } else {
+                    file_attrcopy(&attrs[entries], &stat_buf);
+                }
+            }
 
             memcpy(buf, dirent->d_name, len);
             if (is_dir) {
@@ -401,11 +464,12 @@ static int64_t dir_read(PAL_HANDLE handle, uint64_t offset, size_t count, void*
             buf += len;
             bytes_written += len;
             count -= len;
+            entries++;
         skip:
             handle->dir.ptr = (char*)handle->dir.ptr + dirent->d_reclen;
         }
 
-        if (!count) {
+        if (!count || (attrs && entries == *attrs_cnt)) {
             /* No space left, returning */
             goto out;
         }
@@ -422,7 +486,7 @@ static int64_t dir_read(PAL_HANDLE handle, uint64_t offset, size_t count, void*
             /* If something was written just return that and pretend
              * no error was seen - it will be caught next time. */
             if (bytes_written) {
-                return bytes_written;
+                goto out;
             }
             return unix_to_pal_error(size);
         }
@@ -437,9 +501,28 @@ static int64_t dir_read(PAL_HANDLE handle, uint64_t offset, size_t count, void*
     }
 
 out:
+    if (attrs)
+        *attrs_cnt = entries;
     return (int64_t)bytes_written;
 }
 
+/* 'read' operation for directory stream. Directory stream will not
+   need a 'write' operation. */
+static int64_t dir_read(PAL_HANDLE handle, uint64_t offset, size_t count, void* buf) {
+    if (offset) {
+        return -PAL_ERROR_INVAL;
+    }
+
+    return dir_read_entries(handle, count, buf, /*attrs=*/NULL, /*attrs_cnt=*/NULL);
+}
+
+/* 'readdir' operation for directory stream: reads the entries together with their attributes,
+   using fstatat() relative to the directory instead of resolving each path from scratch */
+static int64_t dir_readdir(PAL_HANDLE handle, size_t count, void* buf, PAL_STREAM_ATTR* attrs,
+                           size_t* attrs_cnt) {
+    return dir_read_entries(handle, count, buf, attrs, attrs_cnt);
+}
+
 /* 'close' operation of directory streams */
 static int dir_close(PAL_HANDLE handle) {
     int fd = handle->dir.fd;
@@ -523,6 +606,7 @@ struct handle_ops g_dir_ops = {
     .getrealpath    = &dir_getrealpath,
     .open           = &dir_open,
     .read           = &dir_read,
+    .readdir        = &dir_readdir,
     .close          = &dir_close,
     .delete         = &dir_delete,
     .attrquery      = &file_attrquery,
@@ -315,6 +315,10 @@ noreturn void pal_linux_main(void* initial_rsp, void* fini_callback) {
     }
     g_pal_internal_mem_addr = internal_mem_addr;
 
+    g_pal_control.file_read  = &pal_file_read_direct;
+    g_pal_control.file_write = &pal_file_write_direct;
+    g_pal_control.process_write_memory = &pal_process_write_memory;
+
     /* call to main function */
     pal_main(instance_id, parent, first_thread, first_process ? argv + 3 : argv + 4, envp);
 }
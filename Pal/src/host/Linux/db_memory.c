@@ -89,6 +89,13 @@ int _DkVirtualMemoryProtect(void* addr, size_t size, int prot) {
     return ret < 0 ? unix_to_pal_error(ret) : 0;
 }
 
+int _DkVirtualMemoryDiscard(void* addr, size_t size, int prot) {
+    __UNUSED(prot);
+    /* all memory allocated by this PAL is private, so the host zero-fills it on the next access */
+    int ret = DO_SYSCALL(madvise, addr, size, MADV_DONTNEED);
+    return ret < 0 ? unix_to_pal_error(ret) : 0;
+}
+
 static int read_proc_meminfo(const char* key, unsigned long* val) {
     int fd = DO_SYSCALL(open, "/proc/meminfo", O_RDONLY, 0);
 
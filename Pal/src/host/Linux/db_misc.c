@@ -36,6 +36,12 @@ int _DkSystemTimeQuery(uint64_t* out_usec) {
     return 0;
 }
 
+int _DkSystemTimeBaseQuery(PAL_TSC_TIME_BASE* base) {
+    __UNUSED(base);
+    /* time comes from the host vDSO, which has its own data */
+    return -PAL_ERROR_NOTIMPLEMENTED;
+}
+
 int _DkRandomBitsRead(void* buffer, size_t size) {
     if (!g_pal_sec.random_device) {
         int fd = DO_SYSCALL(open, RANDGEN_DEVICE, O_RDONLY, 0);
@@ -77,3 +83,7 @@ int _DkSetProtectedFilesKey(PAL_PTR pf_key_hex) {
     __UNUSED(pf_key_hex);
     return -PAL_ERROR_NOTIMPLEMENTED;
 }
+
+void _DkStartupTrace(const char* phase) {
+    __UNUSED(phase);
+}
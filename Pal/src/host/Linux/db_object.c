@@ -6,6 +6,7 @@
  */
 
 #include <asm/errno.h>
+#include <linux/eventpoll.h>
 #include <linux/poll.h>
 #include <linux/time.h>
 #include <linux/wait.h>
@@ -18,6 +19,10 @@
 #include "pal_linux.h"
 #include "pal_linux_defs.h"
 
+/* Waits on up to this many host FDs (or events) use on-stack arrays, so that the common case of
+ * poll() on a few handles does not allocate on every call */
+#define WAIT_STACK_FDS 32
+
 /* Wait for specific events on all handles in the handle array and return multiple events
  * (including errors) reported by the host. Return 0 on success, PAL error on failure. */
 int _DkStreamsWaitEvents(size_t count, PAL_HANDLE* handle_array, PAL_FLG* events,
@@ -27,15 +32,18 @@ int _DkStreamsWaitEvents(size_t count, PAL_HANDLE* handle_array, PAL_FLG* events
     if (count == 0)
         return 0;
 
-    struct pollfd* fds = malloc(count * MAX_FDS * sizeof(*fds));
-    if (!fds) {
-        return -PAL_ERROR_NOMEM;
-    }
-
-    size_t* offsets = malloc(count * MAX_FDS * sizeof(*offsets));
-    if (!offsets) {
-        free(fds);
-        return -PAL_ERROR_NOMEM;
+    struct pollfd fds_buf[WAIT_STACK_FDS];
+    size_t offsets_buf[WAIT_STACK_FDS];
+    struct pollfd* fds = fds_buf;
+    size_t* offsets = offsets_buf;
+    if (count * MAX_FDS > WAIT_STACK_FDS) {
+        fds = malloc(count * MAX_FDS * sizeof(*fds));
+        offsets = malloc(count * MAX_FDS * sizeof(*offsets));
+        if (!fds || !offsets) {
+            free(fds);
+            free(offsets);
+            return -PAL_ERROR_NOMEM;
+        }
     }
 
     /* collect all FDs of all PAL handles that may report read/write events */
@@ -126,7 +134,119 @@ int _DkStreamsWaitEvents(size_t count, PAL_HANDLE* handle_array, PAL_FLG* events
 
     ret = 0;
 out:
-    free(fds);
-    free(offsets);
+    if (fds != fds_buf) {
+        free(fds);
+        free(offsets);
+    }
+    return ret;
+}
+
+/* Upper bound on host events fetched by one _DkWaitSetWait(), to bound its allocation. */
+#define WAITSET_MAX_EVENTS 1024
+
+int _DkWaitSetCreate(PAL_HANDLE* handle) {
+    PAL_HANDLE set = malloc(HANDLE_SIZE(waitset));
+    if (!set)
+        return -PAL_ERROR_NOMEM;
+
+    int fd = DO_SYSCALL(epoll_create1, EPOLL_CLOEXEC);
+    if (fd < 0) {
+        free(set);
+        return unix_to_pal_error(fd);
+    }
+
+    init_handle_hdr(HANDLE_HDR(set), PAL_TYPE_WAITSET);
+    set->waitset.fd = fd;
+    *handle = set;
+    return 0;
+}
+
+int _DkWaitSetUpdate(PAL_HANDLE set, PAL_HANDLE handle, PAL_FLG events, uint64_t cookie) {
+    PAL_FLG flags = HANDLE_HDR(handle)->flags;
+
+    for (size_t j = 0; j < MAX_FDS; j++) {
+        /* only FDs marked readable/writable are valid, `fds[j]` may alias other fields otherwise */
+        if (!(flags & (RFD(j) | WFD(j))) || handle->generic.fds[j] == PAL_IDX_POISON)
+            continue;
+
+        struct epoll_event ev = {
+            .events = ((flags & RFD(j)) && (events & PAL_WAIT_READ)) ? EPOLLIN : 0,
+            .data = cookie,
+        };
+        ev.events |= ((flags & WFD(j)) && (events & PAL_WAIT_WRITE)) ? EPOLLOUT : 0;
+        if (ev.events && (events & PAL_WAIT_EDGE))
+            ev.events |= EPOLLET;
+
+        int fd = handle->generic.fds[j];
+        int ret;
+        if (!ev.events) {
+            ret = DO_SYSCALL(epoll_ctl, set->waitset.fd, EPOLL_CTL_DEL, fd, NULL);
+            if (ret == -ENOENT)
+                ret = 0;
+        } else {
+            ret = DO_SYSCALL(epoll_ctl, set->waitset.fd, EPOLL_CTL_MOD, fd, &ev);
+            if (ret == -ENOENT)
+                ret = DO_SYSCALL(epoll_ctl, set->waitset.fd, EPOLL_CTL_ADD, fd, &ev);
+        }
+        if (ret < 0)
+            return unix_to_pal_error(ret);
+    }
+
+    return 0;
+}
+
+int _DkWaitSetWait(PAL_HANDLE set, size_t* count, uint64_t* cookies, PAL_FLG* ret_events,
+                   int64_t timeout_us) {
+    size_t max_events = MIN(*count, (size_t)WAITSET_MAX_EVENTS);
+    struct epoll_event evs_buf[WAIT_STACK_FDS];
+    struct epoll_event* evs = evs_buf;
+    if (max_events > WAIT_STACK_FDS) {
+        evs = malloc(max_events * sizeof(*evs));
+        if (!evs)
+            return -PAL_ERROR_NOMEM;
+    }
+
+    int timeout_ms = -1;
+    if (timeout_us >= 0)
+        timeout_ms = MIN((timeout_us + 999) / 1000, (int64_t)INT32_MAX);
+
+    int ret = DO_SYSCALL(epoll_wait, set->waitset.fd, evs, max_events, timeout_ms);
+    if (ret < 0) {
+        ret = unix_to_pal_error(ret);
+        goto out;
+    }
+    if (!ret) {
+        /* timed out */
+        ret = -PAL_ERROR_TRYAGAIN;
+        goto out;
+    }
+
+    for (int i = 0; i < ret; i++) {
+        cookies[i] = evs[i].data;
+        ret_events[i] = 0;
+        if (evs[i].events & EPOLLIN)
+            ret_events[i] |= PAL_WAIT_READ;
+        if (evs[i].events & EPOLLOUT)
+            ret_events[i] |= PAL_WAIT_WRITE;
+        if (evs[i].events & (EPOLLHUP | EPOLLERR))
+            ret_events[i] |= PAL_WAIT_ERROR;
+    }
+    *count = ret;
+    ret = 0;
+out:
+    if (evs != evs_buf)
+        free(evs);
     return ret;
 }
+
+static int waitset_close(PAL_HANDLE handle) {
+    if (handle->waitset.fd != PAL_IDX_POISON) {
+        DO_SYSCALL(close, handle->waitset.fd);
+        handle->waitset.fd = PAL_IDX_POISON;
+    }
+    return 0;
+}
+
+struct handle_ops g_waitset_ops = {
+    .close = &waitset_close,
+};
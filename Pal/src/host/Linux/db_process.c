@@ -61,6 +61,7 @@ static inline int create_process_handle(PAL_HANDLE* parent, PAL_HANDLE* child) {
     HANDLE_HDR(phdl)->flags  |= RFD(0) | WFD(0);
     phdl->process.stream      = fds[0];
     phdl->process.nonblocking = PAL_FALSE;
+    phdl->process.pid         = 0;
 
     chdl = malloc(HANDLE_SIZE(process));
     if (!chdl) {
@@ -72,6 +73,7 @@ static inline int create_process_handle(PAL_HANDLE* parent, PAL_HANDLE* child) {
     HANDLE_HDR(chdl)->flags  |= RFD(0) | WFD(0);
     chdl->process.stream      = fds[1];
     chdl->process.nonblocking = PAL_FALSE;
+    chdl->process.pid         = 0;
 
     *parent = phdl;
     *child  = chdl;
@@ -196,6 +198,7 @@ int _DkProcessCreate(PAL_HANDLE* handle, const char** args) {
         ret = -PAL_ERROR_DENIED;
         goto out;
     }
+    child_handle->process.pid = ret;
 
     /* children unblock async signals by signal_setup() */
     ret = block_async_signals(false);
@@ -225,6 +228,36 @@ out:
     return ret;
 }
 
+/* Maximum number of buffers in one process_vm_writev() call (UIO_MAXIOV) */
+#define PROCESS_WRITE_IOV_MAX 1024
+
+/* Exported through `g_pal_control.process_write_memory`. The child is our descendant, so the host
+ * lets us write its memory (even with Yama's ptrace_scope=1). */
+int pal_process_write_memory(PAL_HANDLE process, const PAL_IOVEC* iov, PAL_NUM iov_cnt) {
+    if (HANDLE_HDR(process)->type != PAL_TYPE_PROCESS || !process->process.pid)
+        return -PAL_ERROR_BADHANDLE;
+
+    while (iov_cnt) {
+        size_t cnt = MIN(iov_cnt, (PAL_NUM)PROCESS_WRITE_IOV_MAX);
+        size_t size = 0;
+        for (size_t i = 0; i < cnt; i++)
+            size += iov[i].iov_len;
+
+        /* PAL_IOVEC has the layout of struct iovec; local and remote buffers are the same */
+        long ret = DO_SYSCALL(process_vm_writev, process->process.pid, iov, cnt, iov, cnt, 0);
+        if (ret < 0)
+            return unix_to_pal_error(ret);
+        if ((size_t)ret != size) {
+            /* the child's memory layout does not match (partial write) */
+            return -PAL_ERROR_DENIED;
+        }
+
+        iov += cnt;
+        iov_cnt -= cnt;
+    }
+    return 0;
+}
+
 void init_child_process(int parent_pipe_fd, PAL_HANDLE* parent_handle, char** manifest_out,
                         uint64_t* instance_id) {
     int ret = 0;
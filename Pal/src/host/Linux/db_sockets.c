@@ -9,6 +9,7 @@
 #include <asm/errno.h>
 #include <asm/fcntl.h>
 #include <asm/ioctls.h>
+#include <limits.h>
 #include <linux/in.h>
 #include <linux/in6.h>
 #include <linux/poll.h>
@@ -38,6 +39,16 @@
 #define TCP_CORK 3
 #endif
 
+#ifndef MSG_WAITFORONE
+#define MSG_WAITFORONE 0x10000
+#endif
+
+/* vectored operations pass PAL_IOVEC arrays directly to the host as `struct iovec` arrays */
+static_assert(sizeof(PAL_IOVEC) == sizeof(struct iovec) &&
+                  offsetof(PAL_IOVEC, iov_base) == offsetof(struct iovec, iov_base) &&
+                  offsetof(PAL_IOVEC, iov_len) == offsetof(struct iovec, iov_len),
+              "PAL_IOVEC must have the same layout as struct iovec");
+
 /* 96 bytes is the minimal size of buffer to store a IPv4/IPv6
    address */
 #define PAL_SOCKADDR_SIZE 96
@@ -271,6 +282,7 @@ static inline PAL_HANDLE socket_create_handle(int type, int fd, int options,
     hdl->sock.tcp_cork       = PAL_FALSE;
     hdl->sock.tcp_keepalive  = PAL_FALSE;
     hdl->sock.tcp_nodelay    = PAL_FALSE;
+    hdl->sock.busy_poll      = 0;
     return hdl;
 }
 
@@ -503,11 +515,8 @@ static int tcp_open(PAL_HANDLE* handle, const char* type, const char* uri, int a
     return -PAL_ERROR_NOTSUPPORT;
 }
 
-/* 'read' operation of tcp stream */
-static int64_t tcp_read(PAL_HANDLE handle, uint64_t offset, size_t len, void* buf) {
-    if (offset)
-        return -PAL_ERROR_INVAL;
-
+/* 'readv' and 'read' operations of tcp stream */
+static int64_t tcp_readv(PAL_HANDLE handle, PAL_IOVEC* iov, size_t iov_cnt) {
     if (HANDLE_HDR(handle)->type != PAL_TYPE_TCP || !handle->sock.conn)
         return -PAL_ERROR_NOTCONNECTION;
 
@@ -515,13 +524,10 @@ static int64_t tcp_read(PAL_HANDLE handle, uint64_t offset, size_t len, void* bu
         return 0;
 
     struct msghdr hdr;
-    struct iovec iov;
-    iov.iov_base       = buf;
-    iov.iov_len        = len;
     hdr.msg_name       = NULL;
     hdr.msg_namelen    = 0;
-    hdr.msg_iov        = &iov;
-    hdr.msg_iovlen     = 1;
+    hdr.msg_iov        = (struct iovec*)iov;
+    hdr.msg_iovlen     = iov_cnt;
     hdr.msg_control    = NULL;
     hdr.msg_controllen = 0;
     hdr.msg_flags      = 0;
@@ -534,11 +540,16 @@ static int64_t tcp_read(PAL_HANDLE handle, uint64_t offset, size_t len, void* bu
     return bytes;
 }
 
-/* write' operation of tcp stream */
-static int64_t tcp_write(PAL_HANDLE handle, uint64_t offset, size_t len, const void* buf) {
+static int64_t tcp_read(PAL_HANDLE handle, uint64_t offset, size_t len, void* buf) {
     if (offset)
         return -PAL_ERROR_INVAL;
 
+    PAL_IOVEC iov = {.iov_base = buf, .iov_len = len};
+    return tcp_readv(handle, &iov, 1);
+}
+
+/* 'writev' and 'write' operations of tcp stream */
+static int64_t tcp_writev(PAL_HANDLE handle, const PAL_IOVEC* iov, size_t iov_cnt) {
     if (HANDLE_HDR(handle)->type != PAL_TYPE_TCP || !handle->sock.conn)
         return -PAL_ERROR_NOTCONNECTION;
 
@@ -546,13 +557,10 @@ static int64_t tcp_write(PAL_HANDLE handle, uint64_t offset, size_t len, const v
         return -PAL_ERROR_CONNFAILED;
 
     struct msghdr hdr;
-    struct iovec iov;
-    iov.iov_base       = (void*)buf;
-    iov.iov_len        = len;
     hdr.msg_name       = NULL;
     hdr.msg_namelen    = 0;
-    hdr.msg_iov        = &iov;
-    hdr.msg_iovlen     = 1;
+    hdr.msg_iov        = (struct iovec*)iov;
+    hdr.msg_iovlen     = iov_cnt;
     hdr.msg_control    = NULL;
     hdr.msg_controllen = 0;
     hdr.msg_flags      = 0;
@@ -564,6 +572,14 @@ static int64_t tcp_write(PAL_HANDLE handle, uint64_t offset, size_t len, const v
     return bytes;
 }
 
+static int64_t tcp_write(PAL_HANDLE handle, uint64_t offset, size_t len, const void* buf) {
+    if (offset)
+        return -PAL_ERROR_INVAL;
+
+    PAL_IOVEC iov = {.iov_base = (void*)buf, .iov_len = len};
+    return tcp_writev(handle, &iov, 1);
+}
+
 /* used by 'open' operation of tcp stream for bound socket */
 static int udp_bind(PAL_HANDLE* handle, char* uri, int create, int options) {
     struct sockaddr_storage buffer;
@@ -712,10 +728,7 @@ static int udp_open(PAL_HANDLE* hdl, const char* type, const char* uri, int acce
     return -PAL_ERROR_NOTSUPPORT;
 }
 
-static int64_t udp_receive(PAL_HANDLE handle, uint64_t offset, size_t len, void* buf) {
-    if (offset)
-        return -PAL_ERROR_INVAL;
-
+static int64_t udp_receivev(PAL_HANDLE handle, PAL_IOVEC* iov, size_t iov_cnt) {
     if (HANDLE_HDR(handle)->type != PAL_TYPE_UDP)
         return -PAL_ERROR_NOTCONNECTION;
 
@@ -723,13 +736,10 @@ static int64_t udp_receive(PAL_HANDLE handle, uint64_t offset, size_t len, void*
         return -PAL_ERROR_BADHANDLE;
 
     struct msghdr hdr;
-    struct iovec iov;
-    iov.iov_base       = buf;
-    iov.iov_len        = len;
     hdr.msg_name       = NULL;
     hdr.msg_namelen    = 0;
-    hdr.msg_iov        = &iov;
-    hdr.msg_iovlen     = 1;
+    hdr.msg_iov        = (struct iovec*)iov;
+    hdr.msg_iovlen     = iov_cnt;
     hdr.msg_control    = NULL;
     hdr.msg_controllen = 0;
     hdr.msg_flags      = 0;
@@ -742,27 +752,27 @@ static int64_t udp_receive(PAL_HANDLE handle, uint64_t offset, size_t len, void*
     return bytes;
 }
 
-static int64_t udp_receivebyaddr(PAL_HANDLE handle, uint64_t offset, size_t len, void* buf,
-                                 char* addr, size_t addrlen) {
+static int64_t udp_receive(PAL_HANDLE handle, uint64_t offset, size_t len, void* buf) {
     if (offset)
         return -PAL_ERROR_INVAL;
 
+    PAL_IOVEC iov = {.iov_base = buf, .iov_len = len};
+    return udp_receivev(handle, &iov, 1);
+}
+
+static int64_t udp_recvfrom(PAL_HANDLE handle, PAL_IOVEC* iov, size_t iov_cnt, void* addr,
+                            size_t* addrlen) {
     if (HANDLE_HDR(handle)->type != PAL_TYPE_UDPSRV)
         return -PAL_ERROR_NOTCONNECTION;
 
     if (handle->sock.fd == PAL_IDX_POISON)
         return -PAL_ERROR_BADHANDLE;
 
-    struct sockaddr_storage conn_addr;
-
     struct msghdr hdr;
-    struct iovec iov;
-    iov.iov_base       = buf;
-    iov.iov_len        = len;
-    hdr.msg_name       = &conn_addr;
-    hdr.msg_namelen    = sizeof(conn_addr);
-    hdr.msg_iov        = &iov;
-    hdr.msg_iovlen     = 1;
+    hdr.msg_name       = addr;
+    hdr.msg_namelen    = MIN(*addrlen, (size_t)INT_MAX);
+    hdr.msg_iov        = (struct iovec*)iov;
+    hdr.msg_iovlen     = iov_cnt;
     hdr.msg_control    = NULL;
     hdr.msg_controllen = 0;
     hdr.msg_flags      = 0;
@@ -772,22 +782,36 @@ static int64_t udp_receivebyaddr(PAL_HANDLE handle, uint64_t offset, size_t len,
     if (bytes < 0)
         return unix_to_pal_error(bytes);
 
+    *addrlen = hdr.msg_namelen;
+    return bytes;
+}
+
+static int64_t udp_receivebyaddr(PAL_HANDLE handle, uint64_t offset, size_t len, void* buf,
+                                 char* addr, size_t addrlen) {
+    if (offset)
+        return -PAL_ERROR_INVAL;
+
+    struct sockaddr_storage conn_addr;
+    size_t conn_addrlen = sizeof(conn_addr);
+
+    PAL_IOVEC iov = {.iov_base = buf, .iov_len = len};
+    int64_t bytes = udp_recvfrom(handle, &iov, 1, &conn_addr, &conn_addrlen);
+    if (bytes < 0)
+        return bytes;
+
     char* addr_uri = strcpy_static(addr, URI_PREFIX_UDP, addrlen);
     if (!addr_uri)
         return -PAL_ERROR_OVERFLOW;
 
     int ret = inet_create_uri(addr_uri, addr + addrlen - addr_uri, (struct sockaddr*)&conn_addr,
-                              hdr.msg_namelen, NULL);
+                              conn_addrlen, NULL);
     if (ret < 0)
         return ret;
 
     return bytes;
 }
 
-static int64_t udp_send(PAL_HANDLE handle, uint64_t offset, size_t len, const void* buf) {
-    if (offset)
-        return -PAL_ERROR_INVAL;
-
+static int64_t udp_sendv(PAL_HANDLE handle, const PAL_IOVEC* iov, size_t iov_cnt) {
     if (HANDLE_HDR(handle)->type != PAL_TYPE_UDP)
         return -PAL_ERROR_NOTCONNECTION;
 
@@ -795,13 +819,10 @@ static int64_t udp_send(PAL_HANDLE handle, uint64_t offset, size_t len, const vo
         return -PAL_ERROR_BADHANDLE;
 
     struct msghdr hdr;
-    struct iovec iov;
-    iov.iov_base       = (void*)buf;
-    iov.iov_len        = len;
     hdr.msg_name       = (void*)handle->sock.conn;
     hdr.msg_namelen    = addr_size((struct sockaddr*)handle->sock.conn);
-    hdr.msg_iov        = &iov;
-    hdr.msg_iovlen     = 1;
+    hdr.msg_iov        = (struct iovec*)iov;
+    hdr.msg_iovlen     = iov_cnt;
     hdr.msg_control    = NULL;
     hdr.msg_controllen = 0;
     hdr.msg_flags      = 0;
@@ -813,17 +834,46 @@ static int64_t udp_send(PAL_HANDLE handle, uint64_t offset, size_t len, const vo
     return bytes;
 }
 
-static int64_t udp_sendbyaddr(PAL_HANDLE handle, uint64_t offset, size_t len, const void* buf,
-                              const char* addr, size_t addrlen) {
+static int64_t udp_send(PAL_HANDLE handle, uint64_t offset, size_t len, const void* buf) {
     if (offset)
         return -PAL_ERROR_INVAL;
 
+    PAL_IOVEC iov = {.iov_base = (void*)buf, .iov_len = len};
+    return udp_sendv(handle, &iov, 1);
+}
+
+static int64_t udp_sendto(PAL_HANDLE handle, const PAL_IOVEC* iov, size_t iov_cnt,
+                          const void* addr, size_t addrlen) {
     if (HANDLE_HDR(handle)->type != PAL_TYPE_UDPSRV)
         return -PAL_ERROR_NOTCONNECTION;
 
     if (handle->sock.fd == PAL_IDX_POISON)
         return -PAL_ERROR_BADHANDLE;
 
+    if (addrlen > INT_MAX)
+        return -PAL_ERROR_INVAL;
+
+    struct msghdr hdr;
+    hdr.msg_name       = (void*)addr;
+    hdr.msg_namelen    = addrlen;
+    hdr.msg_iov        = (struct iovec*)iov;
+    hdr.msg_iovlen     = iov_cnt;
+    hdr.msg_control    = NULL;
+    hdr.msg_controllen = 0;
+    hdr.msg_flags      = 0;
+
+    int64_t bytes = DO_SYSCALL(sendmsg, handle->sock.fd, &hdr, MSG_NOSIGNAL);
+    if (bytes < 0)
+        bytes = unix_to_pal_error(bytes);
+
+    return bytes;
+}
+
+static int64_t udp_sendbyaddr(PAL_HANDLE handle, uint64_t offset, size_t len, const void* buf,
+                              const char* addr, size_t addrlen) {
+    if (offset)
+        return -PAL_ERROR_INVAL;
+
     if (!strstartswith(addr, URI_PREFIX_UDP))
         return -PAL_ERROR_INVAL;
 
@@ -840,23 +890,80 @@ static int64_t udp_sendbyaddr(PAL_HANDLE handle, uint64_t offset, size_t len, co
     if (ret < 0)
         return ret;
 
-    struct msghdr hdr;
-    struct iovec iov;
-    iov.iov_base       = (void*)buf;
-    iov.iov_len        = len;
-    hdr.msg_name       = &conn_addr;
-    hdr.msg_namelen    = conn_addrlen;
-    hdr.msg_iov        = &iov;
-    hdr.msg_iovlen     = 1;
-    hdr.msg_control    = NULL;
-    hdr.msg_controllen = 0;
-    hdr.msg_flags      = 0;
+    PAL_IOVEC iov = {.iov_base = (void*)buf, .iov_len = len};
+    return udp_sendto(handle, &iov, 1, &conn_addr, conn_addrlen);
+}
 
-    int64_t bytes = DO_SYSCALL(sendmsg, handle->sock.fd, &hdr, MSG_NOSIGNAL);
-    if (bytes < 0)
-        bytes = unix_to_pal_error(bytes);
+/* datagrams per host sendmmsg()/recvmmsg() call; callers loop for bigger batches */
+#define UDP_BATCH_MAX 64
 
-    return bytes;
+/* same layout as `struct mmsghdr`, which glibc declares only with _GNU_SOURCE */
+struct host_mmsghdr {
+    struct msghdr msg_hdr;
+    unsigned int msg_len;
+};
+
+static void udp_prepare_mmsghdrs(PAL_HANDLE handle, PAL_MSG* msgs, size_t cnt,
+                                 struct host_mmsghdr* hdrs) {
+    for (size_t i = 0; i < cnt; i++) {
+        struct msghdr* hdr = &hdrs[i].msg_hdr;
+        if (HANDLE_HDR(handle)->type == PAL_TYPE_UDP) {
+            hdr->msg_name    = (void*)handle->sock.conn;
+            hdr->msg_namelen = addr_size((struct sockaddr*)handle->sock.conn);
+        } else {
+            hdr->msg_name    = msgs[i].addr;
+            hdr->msg_namelen = MIN(msgs[i].addrlen, (size_t)INT_MAX);
+        }
+        hdr->msg_iov        = (struct iovec*)msgs[i].iov;
+        hdr->msg_iovlen     = msgs[i].iov_cnt;
+        hdr->msg_control    = NULL;
+        hdr->msg_controllen = 0;
+        hdr->msg_flags      = 0;
+        hdrs[i].msg_len     = 0;
+    }
+}
+
+static int64_t udp_sendbatch(PAL_HANDLE handle, PAL_MSG* msgs, size_t msg_cnt) {
+    if (handle->sock.fd == PAL_IDX_POISON)
+        return -PAL_ERROR_BADHANDLE;
+
+    struct host_mmsghdr hdrs[UDP_BATCH_MAX];
+    size_t cnt = MIN(msg_cnt, UDP_BATCH_MAX);
+    udp_prepare_mmsghdrs(handle, msgs, cnt, hdrs);
+
+    int ret = DO_SYSCALL(sendmmsg, handle->sock.fd, hdrs, cnt, MSG_NOSIGNAL);
+    if (ret < 0)
+        return unix_to_pal_error(ret);
+
+    for (int i = 0; i < ret; i++)
+        msgs[i].len = hdrs[i].msg_len;
+    return ret;
+}
+
+static int64_t udp_recvbatch(PAL_HANDLE handle, PAL_MSG* msgs, size_t msg_cnt) {
+    if (handle->sock.fd == PAL_IDX_POISON)
+        return -PAL_ERROR_BADHANDLE;
+
+    struct host_mmsghdr hdrs[UDP_BATCH_MAX];
+    size_t cnt = MIN(msg_cnt, UDP_BATCH_MAX);
+    udp_prepare_mmsghdrs(handle, msgs, cnt, hdrs);
+    if (HANDLE_HDR(handle)->type == PAL_TYPE_UDP) {
+        for (size_t i = 0; i < cnt; i++) {
+            hdrs[i].msg_hdr.msg_name    = NULL;
+            hdrs[i].msg_hdr.msg_namelen = 0;
+        }
+    }
+
+    int ret = DO_SYSCALL(recvmmsg, handle->sock.fd, hdrs, cnt, MSG_WAITFORONE, NULL);
+    if (ret < 0)
+        return unix_to_pal_error(ret);
+
+    for (int i = 0; i < ret; i++) {
+        msgs[i].len = hdrs[i].msg_len;
+        if (msgs[i].addr)
+            msgs[i].addrlen = hdrs[i].msg_hdr.msg_namelen;
+    }
+    return ret;
 }
 
 static int socket_delete(PAL_HANDLE handle, int access) {
@@ -908,9 +1015,9 @@ static int socket_close(PAL_HANDLE handle) {
     return 0;
 }
 
-static int socket_attrquerybyhdl(PAL_HANDLE handle, PAL_STREAM_ATTR* attr) {
-    int ret;
-
+/* Blocking mode and socket options are only changed through socket_attrsetbyhdl(), so the values
+ * cached in the handle are authoritative and need no host call. */
+static int socket_attrquerycached(PAL_HANDLE handle, PAL_STREAM_ATTR* attr) {
     if (handle->sock.fd == PAL_IDX_POISON)
         return -PAL_ERROR_BADHANDLE;
 
@@ -926,9 +1033,20 @@ static int socket_attrquerybyhdl(PAL_HANDLE handle, PAL_STREAM_ATTR* attr) {
     attr->socket.tcp_cork       = handle->sock.tcp_cork;
     attr->socket.tcp_keepalive  = handle->sock.tcp_keepalive;
     attr->socket.tcp_nodelay    = handle->sock.tcp_nodelay;
+    attr->socket.busy_poll      = handle->sock.busy_poll;
 
-    /* get number of bytes available for reading (doesn't make sense for listening sockets) */
     attr->pending_size = 0;
+    attr->readable     = PAL_FALSE;
+    attr->writable     = PAL_FALSE;
+    return 0;
+}
+
+static int socket_attrquerybyhdl(PAL_HANDLE handle, PAL_STREAM_ATTR* attr) {
+    int ret = socket_attrquerycached(handle, attr);
+    if (ret < 0)
+        return ret;
+
+    /* get number of bytes available for reading (doesn't make sense for listening sockets) */
     if (HANDLE_HDR(handle)->type != PAL_TYPE_TCPSRV) {
         int val;
         ret = DO_SYSCALL(ioctl, handle->sock.fd, FIONREAD, &val);
@@ -1018,6 +1136,16 @@ static int socket_attrsetbyhdl(PAL_HANDLE handle, PAL_STREAM_ATTR* attr) {
 
             handle->sock.sendtimeout = attr->socket.sendtimeout;
         }
+
+        if (attr->socket.busy_poll != handle->sock.busy_poll) {
+            int val = attr->socket.busy_poll;
+            ret = DO_SYSCALL(setsockopt, fd, SOL_SOCKET, SO_BUSY_POLL, &val, sizeof(int));
+
+            if (ret < 0)
+                return unix_to_pal_error(ret);
+
+            handle->sock.busy_poll = attr->socket.busy_poll;
+        }
     }
 
     if (HANDLE_HDR(handle)->type == PAL_TYPE_TCP || HANDLE_HDR(handle)->type == PAL_TYPE_TCPSRV) {
@@ -1140,9 +1268,12 @@ struct handle_ops g_tcp_ops = {
     .waitforclient  = &tcp_accept,
     .read           = &tcp_read,
     .write          = &tcp_write,
+    .readv          = &tcp_readv,
+    .writev         = &tcp_writev,
     .delete         = &socket_delete,
     .close          = &socket_close,
     .attrquerybyhdl = &socket_attrquerybyhdl,
+    .attrquerycached = &socket_attrquerycached,
     .attrsetbyhdl   = &socket_attrsetbyhdl,
 };
 
@@ -1151,9 +1282,14 @@ struct handle_ops g_udp_ops = {
     .open           = &udp_open,
     .read           = &udp_receive,
     .write          = &udp_send,
+    .readv          = &udp_receivev,
+    .writev         = &udp_sendv,
+    .sendbatch      = &udp_sendbatch,
+    .recvbatch      = &udp_recvbatch,
     .delete         = &socket_delete,
     .close          = &socket_close,
     .attrquerybyhdl = &socket_attrquerybyhdl,
+    .attrquerycached = &socket_attrquerycached,
     .attrsetbyhdl   = &socket_attrsetbyhdl,
 };
 
@@ -1162,8 +1298,13 @@ struct handle_ops g_udpsrv_ops = {
     .open           = &udp_open,
     .readbyaddr     = &udp_receivebyaddr,
     .writebyaddr    = &udp_sendbyaddr,
+    .recvfrom       = &udp_recvfrom,
+    .sendto         = &udp_sendto,
+    .sendbatch      = &udp_sendbatch,
+    .recvbatch      = &udp_recvbatch,
     .delete         = &socket_delete,
     .close          = &socket_close,
     .attrquerybyhdl = &socket_attrquerybyhdl,
+    .attrquerycached = &socket_attrquerycached,
     .attrsetbyhdl   = &socket_attrsetbyhdl,
 };
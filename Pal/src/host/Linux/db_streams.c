@@ -362,6 +362,185 @@ int _DkReceiveHandle(PAL_HANDLE hdl, PAL_HANDLE* cargo) {
     return 0;
 }
 
+/* Handles sent in one _DkSendHandles() message. Each one has at most MAX_FDS host FDs, and the host
+ * accepts at most 253 FDs in one SCM_RIGHTS message. */
+#define HANDLES_BATCH 64
+
+/*
+ * Sends handles in batches of two host messages: the headers of all handles of the batch, followed
+ * by their serialized data with all their FDs in one SCM_RIGHTS control message. Compared to
+ * _DkSendHandle() in a loop, this is two syscalls instead of two per handle. The recipient knows
+ * the number of handles, so the batches need no other framing.
+ */
+int _DkSendHandles(PAL_HANDLE hdl, PAL_HANDLE* cargos, size_t count) {
+    if (HANDLE_HDR(hdl)->type != PAL_TYPE_PROCESS)
+        return -PAL_ERROR_BADHANDLE;
+
+    int fd = hdl->process.stream;
+    while (count) {
+        size_t cnt = MIN(count, (size_t)HANDLES_BATCH);
+        struct hdl_header hdrs[HANDLES_BATCH];
+        void* hdl_data[HANDLES_BATCH] = { NULL };
+        int fds[HANDLES_BATCH * MAX_FDS];
+        size_t nfds = 0;
+        size_t data_size = 0;
+        char* data = NULL;
+        int ret;
+
+        for (size_t i = 0; i < cnt; i++) {
+            ssize_t size = handle_serialize(cargos[i], &hdl_data[i]);
+            if (size < 0) {
+                ret = size;
+                goto out;
+            }
+            hdrs[i].fds = 0;
+            hdrs[i].data_size = size;
+            data_size += size;
+
+            for (int j = 0; j < MAX_FDS; j++)
+                if (HANDLE_HDR(cargos[i])->flags & (RFD(j) | WFD(j))) {
+                    hdrs[i].fds |= 1U << j;
+                    fds[nfds++] = cargos[i]->generic.fds[j];
+                }
+        }
+
+        data = malloc(data_size);
+        if (!data) {
+            ret = -PAL_ERROR_NOMEM;
+            goto out;
+        }
+        size_t off = 0;
+        for (size_t i = 0; i < cnt; i++) {
+            memcpy(data + off, hdl_data[i], hdrs[i].data_size);
+            off += hdrs[i].data_size;
+        }
+
+        ret = write_all(fd, hdrs, cnt * sizeof(hdrs[0]));
+        if (ret < 0) {
+            ret = unix_to_pal_error(ret);
+            goto out;
+        }
+
+        struct iovec iov = { .iov_base = data, .iov_len = data_size };
+        struct msghdr message_hdr = { .msg_iov = &iov, .msg_iovlen = 1 };
+        char control_buf[CMSG_SPACE(sizeof(fds))];
+        if (nfds) {
+            message_hdr.msg_control    = control_buf;
+            message_hdr.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+
+            struct cmsghdr* control_hdr = CMSG_FIRSTHDR(&message_hdr);
+            control_hdr->cmsg_level = SOL_SOCKET;
+            control_hdr->cmsg_type  = SCM_RIGHTS;
+            control_hdr->cmsg_len   = CMSG_LEN(sizeof(int) * nfds);
+            memcpy(CMSG_DATA(control_hdr), fds, sizeof(int) * nfds);
+        }
+
+        ssize_t sent = DO_SYSCALL(sendmsg, fd, &message_hdr, MSG_NOSIGNAL);
+        if (sent < 0) {
+            ret = unix_to_pal_error(sent);
+            goto out;
+        }
+        /* the FDs went with the first part, the rest of the data (if any) is just bytes */
+        ret = write_all(fd, data + sent, data_size - sent);
+        if (ret < 0)
+            ret = unix_to_pal_error(ret);
+
+out:
+        free(data);
+        for (size_t i = 0; i < cnt; i++)
+            free(hdl_data[i]);
+        if (ret < 0)
+            return ret;
+
+        cargos += cnt;
+        count -= cnt;
+    }
+    return 0;
+}
+
+int _DkReceiveHandles(PAL_HANDLE hdl, PAL_HANDLE* cargos, size_t count) {
+    if (HANDLE_HDR(hdl)->type != PAL_TYPE_PROCESS)
+        return -PAL_ERROR_BADHANDLE;
+
+    int fd = hdl->process.stream;
+    while (count) {
+        size_t cnt = MIN(count, (size_t)HANDLES_BATCH);
+        struct hdl_header hdrs[HANDLES_BATCH];
+
+        int ret = read_all(fd, hdrs, cnt * sizeof(hdrs[0]));
+        if (ret < 0)
+            return unix_to_pal_error(ret);
+
+        size_t data_size = 0;
+        size_t nfds = 0;
+        for (size_t i = 0; i < cnt; i++) {
+            if (hdrs[i].fds & ~((1U << MAX_FDS) - 1))
+                return -PAL_ERROR_DENIED;
+            nfds += __builtin_popcount(hdrs[i].fds);
+            data_size += hdrs[i].data_size;
+        }
+
+        char* data = malloc(data_size);
+        if (!data)
+            return -PAL_ERROR_NOMEM;
+
+        struct iovec iov = { .iov_base = data, .iov_len = data_size };
+        char control_buf[CMSG_SPACE(sizeof(int) * HANDLES_BATCH * MAX_FDS)];
+        struct msghdr message_hdr = {
+            .msg_iov        = &iov,
+            .msg_iovlen     = 1,
+            .msg_control    = control_buf,
+            .msg_controllen = CMSG_SPACE(sizeof(int) * nfds),
+        };
+
+        ssize_t received = DO_SYSCALL(recvmsg, fd, &message_hdr, 0);
+        if (received <= 0) {
+            free(data);
+            return received < 0 ? unix_to_pal_error(received) : -PAL_ERROR_DENIED;
+        }
+        ret = read_all(fd, data + received, data_size - received);
+        if (ret < 0) {
+            free(data);
+            return unix_to_pal_error(ret);
+        }
+
+        int* fds = NULL;
+        size_t fds_cnt = 0;
+        struct cmsghdr* control_hdr = CMSG_FIRSTHDR(&message_hdr);
+        if (control_hdr && control_hdr->cmsg_level == SOL_SOCKET
+                && control_hdr->cmsg_type == SCM_RIGHTS) {
+            fds = (int*)CMSG_DATA(control_hdr);
+            fds_cnt = (control_hdr->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        }
+
+        size_t off = 0;
+        size_t fds_idx = 0;
+        for (size_t i = 0; i < cnt; i++) {
+            ret = handle_deserialize(&cargos[i], data + off, hdrs[i].data_size);
+            if (ret < 0) {
+                free(data);
+                return ret;
+            }
+            off += hdrs[i].data_size;
+
+            for (int j = 0; j < MAX_FDS; j++) {
+                if (!(hdrs[i].fds & (1U << j)))
+                    continue;
+                if (fds_idx < fds_cnt) {
+                    cargos[i]->generic.fds[j] = fds[fds_idx++];
+                } else {
+                    HANDLE_HDR(cargos[i])->flags &= ~(RFD(j) | WFD(j));
+                }
+            }
+        }
+        free(data);
+
+        cargos += cnt;
+        count -= cnt;
+    }
+    return 0;
+}
+
 int _DkInitDebugStream(const char* path) {
     int ret;
 
@@ -95,11 +95,13 @@ typedef struct pal_handle {
             PAL_BOL tcp_cork;
             PAL_BOL tcp_keepalive;
             PAL_BOL tcp_nodelay;
+            PAL_NUM busy_poll;
         } sock;
 
         struct {
             PAL_IDX stream;
             PAL_BOL nonblocking;
+            PAL_IDX pid; /* host PID of the child, 0 in the child's handle of its parent */
         } process;
 
         struct {
@@ -111,6 +113,10 @@ typedef struct pal_handle {
             uint32_t signaled;
             bool auto_clear;
         } event;
+
+        struct {
+            PAL_IDX fd; /* host epoll instance */
+        } waitset;
     };
 }* PAL_HANDLE;
 
@@ -80,6 +80,11 @@ int handle_deserialize(PAL_HANDLE* handle, const void* data, size_t size);
 
 bool stataccess(struct stat* stats, int acc);
 
+int64_t pal_file_read_direct(PAL_HANDLE handle, PAL_NUM offset, PAL_NUM count, PAL_PTR buffer);
+int64_t pal_file_write_direct(PAL_HANDLE handle, PAL_NUM offset, PAL_NUM count,
+                              const void* buffer);
+int pal_process_write_memory(PAL_HANDLE process, const PAL_IOVEC* iov, PAL_NUM iov_cnt);
+
 void init_child_process(int parent_pipe_fd, PAL_HANDLE* parent, char** manifest_out,
                         uint64_t* instance_id);
 
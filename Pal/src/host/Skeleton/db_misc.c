@@ -16,6 +16,10 @@ int _DkSystemTimeQuery(uint64_t* out_usec) {
     return -PAL_ERROR_NOTIMPLEMENTED;
 }
 
+int _DkSystemTimeBaseQuery(PAL_TSC_TIME_BASE* base) {
+    return -PAL_ERROR_NOTIMPLEMENTED;
+}
+
 int _DkRandomBitsRead(void* buffer, size_t size) {
     return -PAL_ERROR_NOTIMPLEMENTED;
 }
@@ -57,3 +61,7 @@ int _DkSetProtectedFilesKey(PAL_PTR pf_key_hex) {
     __UNUSED(pf_key_hex);
     return -PAL_ERROR_NOTIMPLEMENTED;
 }
+
+void _DkStartupTrace(const char* phase) {
+    __UNUSED(phase);
+}
@@ -17,3 +17,18 @@ int _DkStreamsWaitEvents(size_t count, PAL_HANDLE* handle_array, PAL_FLG* events
                          PAL_FLG* ret_events, int64_t timeout_us) {
     return -PAL_ERROR_NOTIMPLEMENTED;
 }
+
+int _DkWaitSetCreate(PAL_HANDLE* handle) {
+    return -PAL_ERROR_NOTIMPLEMENTED;
+}
+
+int _DkWaitSetUpdate(PAL_HANDLE set, PAL_HANDLE handle, PAL_FLG events, uint64_t cookie) {
+    return -PAL_ERROR_NOTIMPLEMENTED;
+}
+
+int _DkWaitSetWait(PAL_HANDLE set, size_t* count, uint64_t* cookies, PAL_FLG* ret_events,
+                   int64_t timeout_us) {
+    return -PAL_ERROR_NOTIMPLEMENTED;
+}
+
+struct handle_ops g_waitset_ops = {};
@@ -114,6 +114,10 @@ void init_slab_mgr(size_t alignment) {
         INIT_FAIL(PAL_ERROR_NOMEM, "cannot initialize slab manager");
 }
 
+size_t print_slab_mgr_stats(char* buf, size_t size) {
+    return slab_print_stats(g_slab_mgr, buf, size);
+}
+
 void* malloc(size_t size) {
     void* ptr = slab_alloc(g_slab_mgr, size);
 
@@ -98,6 +98,8 @@ def generate_library_paths():
 argparser = argparse.ArgumentParser()
 argparser.add_argument('-d', '--dir', default='/',
     help='Search directory tree from this root to generate list of trusted files.')
+argparser.add_argument('--no-auto-trusted-files', action='store_true',
+    help='Do not add the files found in the directory tree as trusted files.')
 
 def main(args=None):
     args = argparser.parse_args(args[1:])
@@ -109,8 +111,11 @@ def main(args=None):
 
     manifest = '/entrypoint.manifest'
     rendered_manifest = env.get_template(manifest).render()
-    already_added_files = extract_files_from_user_manifest(rendered_manifest)
-    trusted_files = generate_trusted_files(args.dir, already_added_files)
+    if args.no_auto_trusted_files:
+        trusted_files = ''
+    else:
+        already_added_files = extract_files_from_user_manifest(rendered_manifest)
+        trusted_files = generate_trusted_files(args.dir, already_added_files)
     with open(manifest, 'wb') as manifest_file:
         trusted_files_string = '\n'.join((rendered_manifest, trusted_files, '\n'))
         manifest_file.write(trusted_files_string.encode('UTF-8'))
@@ -9,10 +9,12 @@ import json
 import hashlib
 import os
 import pathlib
+import re
 import shutil
 import struct
 import sys
 import tempfile
+import time
 
 import docker  # pylint: disable=import-error
 import jinja2
@@ -25,6 +27,9 @@ def gsc_image_name(original_image_name):
 def gsc_unsigned_image_name(original_image_name):
     return f'gsc-{original_image_name}-unsigned'
 
+def gsc_profile_image_name(original_image_name):
+    return f'gsc-{original_image_name}-profile'
+
 def gsc_tmp_build_path(original_image_name):
     return pathlib.Path('build') / f'gsc-{original_image_name}'
 
@@ -248,6 +253,55 @@ def gsc_build_graphene(args):
     print(f'Successfully built a base-Graphene image `{graphene_image_name}`.')
 
 
+def gsc_hash_cache_dir():
+    return pathlib.Path(os.getenv('XDG_CACHE_HOME', pathlib.Path.home() / '.cache')) / 'gsc'
+
+
+def find_hash_cache(cache_dir, layers):
+    # Find the cache of the image sharing the longest chain of layers with the image being signed
+    # (typically its base image). Entries are validated by graphene-sgx-sign against the size,
+    # mtime and inode of each file, so stale ones are simply recomputed.
+    best_cache, best_len = None, 0
+    for layers_file in cache_dir.glob('*.layers'):
+        try:
+            with open(layers_file, 'r') as file:
+                cached_layers = json.load(file)
+        except (OSError, ValueError):
+            continue
+        common_len = len(os.path.commonprefix([cached_layers, layers]))
+        cache_file = layers_file.with_suffix('.json')
+        if common_len > best_len and cache_file.exists():
+            best_cache, best_len = cache_file, common_len
+    return best_cache
+
+
+# Hash trusted files of the unsigned image (in parallel, reusing hashes cached for images with
+# common layers) and store the resulting cache on the host and in `tmp_build_path` for signing.
+def update_hash_cache(docker_socket, unsigned_image, tmp_build_path):
+    layers = unsigned_image.attrs['RootFS']['Layers']
+    cache_dir = gsc_hash_cache_dir()
+    os.makedirs(cache_dir, exist_ok=True)
+    cache_name = hashlib.sha256('\n'.join(layers).encode('UTF-8')).hexdigest()
+
+    with tempfile.TemporaryDirectory() as tmpdirname:
+        seed_cache = find_hash_cache(cache_dir, layers)
+        if seed_cache is not None:
+            shutil.copyfile(seed_cache, os.path.join(tmpdirname, 'hashes.json'))
+
+        docker_socket.containers.run(unsigned_image.id,
+            '\'export PYTHONPATH="${PYTHONPATH}:$(find /graphene/meson_build_output/lib -type d '
+            '-path "*/site-packages")" && graphene-sgx-sign --manifest /entrypoint.manifest '
+            '--cache /tmp/host/hashes.json --cache-only\'',
+            entrypoint=['sh', '-c'], user='root', remove=True,
+            volumes={tmpdirname: {'bind': '/tmp/host', 'mode': 'rw'}})
+
+        shutil.copyfile(os.path.join(tmpdirname, 'hashes.json'), cache_dir / f'{cache_name}.json')
+        with open(cache_dir / f'{cache_name}.layers', 'w') as file:
+            json.dump(layers, file)
+        shutil.copyfile(os.path.join(tmpdirname, 'hashes.json'),
+                        tmp_build_path / 'gsc-hash-cache.json')
+
+
 # Command 3: Sign Docker image which was previously built via `gsc build`.
 def gsc_sign_image(args):
     unsigned_image_name = gsc_unsigned_image_name(args.image)  # input image name
@@ -271,8 +325,13 @@ def gsc_sign_image(args):
     sign_template = env.get_template(f'Dockerfile.{env.globals["Distro"]}.sign.template')
 
     os.makedirs(tmp_build_path, exist_ok=True)
+    if not args.no_hash_cache:
+        print('Hashing trusted files...')
+        update_hash_cache(docker_socket, unsigned_image, tmp_build_path)
+
     with open(tmp_build_path / 'Dockerfile.sign', 'w') as dockerfile:
-        dockerfile.write(sign_template.render(image=unsigned_image_name))
+        dockerfile.write(sign_template.render(image=unsigned_image_name,
+                                              hash_cache=not args.no_hash_cache))
 
     # copy user-provided signing key to our tmp build dir (to copy it later inside Docker image)
     tmp_build_key_path = tmp_build_path / 'gsc-signer-key.pem'
@@ -294,6 +353,186 @@ def gsc_sign_image(args):
           f'`{unsigned_image_name}`.')
 
 
+# Command 4: Run the image once with SGX stats enabled and generate a tuned manifest.
+
+# Below this rate of (non-exitless) OCALLs, exitless RPC threads do not pay for the host cores
+# they keep busy.
+PROFILE_EXITLESS_MIN_OCALLS_PER_SEC = 10000
+# Headroom for allocations not seen in the profiling run, and for the parts of the enclave which
+# are not heap (Graphene binaries, TCSes, stacks, SSAs and the manifest).
+PROFILE_HEAP_MARGIN = 1.25
+PROFILE_ENCLAVE_OVERHEAD = 64 * 1024 * 1024
+# Graphene starts some helper threads (IPC, async events) only on demand.
+PROFILE_EXTRA_THREADS = 2
+
+def copy_file_from_image(docker_socket, image_name, path, host_dir):
+    docker_socket.containers.run(image_name, f'\'cp {path} /tmp/host/\'',
+                                 entrypoint=['sh', '-c'], user='root', remove=True,
+                                 volumes={host_dir: {'bind': '/tmp/host', 'mode': 'rw'}})
+    return os.path.join(host_dir, os.path.basename(path))
+
+
+def sgx_run_options():
+    devices = [f'{dev}:{dev}:rwm' for dev in ('/dev/sgx_enclave', '/dev/sgx_provision',
+                                               '/dev/sgx/enclave', '/dev/sgx/provision',
+                                               '/dev/isgx', '/dev/gsgx')
+               if os.path.exists(dev)]
+    volumes = {}
+    if os.path.exists('/var/run/aesmd'):
+        volumes['/var/run/aesmd'] = {'bind': '/var/run/aesmd', 'mode': 'rw'}
+    return devices, volumes
+
+
+def parse_profile_log(log):
+    profile = {'heap_pages': 0, 'threads': 0, 'ocalls': {}, 'used_files': set()}
+    for line in log.splitlines():
+        match = re.search(r'Peak enclave heap usage: \d+ MB \((\d+) pages\)', line)
+        if match:
+            profile['heap_pages'] = max(profile['heap_pages'], int(match.group(1)))
+            continue
+        match = re.search(r'Peak # of enclave threads: (\d+)', line)
+        if match:
+            profile['threads'] = max(profile['threads'], int(match.group(1)))
+            continue
+        match = re.search(r'Used trusted file: (.*)$', line)
+        if match:
+            profile['used_files'].add(match.group(1))
+            continue
+        json_start = line.find('{"pid": ')
+        if json_start >= 0 and '"ocall": ' in line:
+            try:
+                ocall = json.loads(line[json_start:])
+            except ValueError:
+                continue
+            total = profile['ocalls'].setdefault(ocall['ocall'], [0, 0, 0])
+            total[0] += ocall['count']
+            total[1] += ocall['exitless_count']
+            total[2] += ocall['cycles']
+    return profile
+
+
+def tuned_manifest(profile, manifest, runtime):
+    heap_size = profile['heap_pages'] * 4096
+    needed_size = int(heap_size * PROFILE_HEAP_MARGIN) + PROFILE_ENCLAVE_OVERHEAD
+    enclave_size = 1 << (needed_size - 1).bit_length()  # must be a power of two
+    thread_num = profile['threads'] + PROFILE_EXTRA_THREADS
+
+    ocalls = sum(count for count, _, _ in profile['ocalls'].values())
+    ocall_rate = ocalls / runtime if runtime > 0 else 0
+    rpc_thread_num = 0
+    if ocall_rate >= PROFILE_EXITLESS_MIN_OCALLS_PER_SEC:
+        rpc_thread_num = min(thread_num, os.cpu_count() or 1)
+
+    lines = [
+        '# Generated by `gsc profile`: append to the application manifest (replacing the options',
+        '# set below) and rebuild the image with `gsc build --no-auto-trusted-files`.',
+        f'# Profiling run: {runtime:.1f} s, peak heap {heap_size // (1024 * 1024)} MB, '
+        f'{profile["threads"]} threads, {ocall_rate:.0f} OCALLs/s',
+        f'sgx.enclave_size = "{enclave_size // (1024 * 1024)}M"',
+        f'sgx.thread_num = {thread_num}',
+        f'sgx.rpc_thread_num = {rpc_thread_num}',
+        '',
+        '# trusted files opened during the profiling run',
+    ]
+
+    trusted_files = manifest.get('sgx', {}).get('trusted_files', {})
+    if isinstance(trusted_files, dict):
+        trusted_files = trusted_files.values()
+    num_used = 0
+    for val in trusted_files:
+        uri = val['uri'] if isinstance(val, dict) else val
+        if uri in profile['used_files'] or uri == 'file:/trusted_argv':
+            escaped_uri = uri.translate(str.maketrans({'\\': r'\\', '"': r'\"'}))
+            lines.append(f'sgx.trusted_files.profiled{num_used} = "{escaped_uri}"')
+            num_used += 1
+
+    return '\n'.join(lines) + '\n', num_used, len(list(trusted_files))
+
+
+def gsc_profile_image(args):
+    unsigned_image_name = gsc_unsigned_image_name(args.image)  # input image name
+    profile_image_name = gsc_profile_image_name(args.image)    # temporary profiling image
+    tmp_build_path = gsc_tmp_build_path(args.image)            # pathlib obj with build artifacts
+    output = args.output or re.sub(r'[/:]', '_', args.image) + '.tuned.manifest'
+
+    docker_socket = docker.from_env()
+
+    if get_docker_image(docker_socket, unsigned_image_name) is None:
+        print(f'Cannot find unsigned graphenized Docker image `{unsigned_image_name}`.\n'
+              f'You must first build this image via `gsc build` command.')
+        sys.exit(1)
+
+    devices, volumes = sgx_run_options()
+    if not devices:
+        print('Cannot find an Intel SGX device on this host, `gsc profile` needs to run the image.')
+        sys.exit(1)
+
+    os.makedirs(tmp_build_path, exist_ok=True)
+
+    # enable SGX stats (and debug mode, so that the enclave may print them) in a manifest copy
+    with tempfile.TemporaryDirectory() as tmpdirname:
+        manifest_path = copy_file_from_image(docker_socket, unsigned_image_name,
+                                             '/entrypoint.manifest', tmpdirname)
+        manifest = toml.load(manifest_path)
+    profile_manifest = {**manifest, 'sgx': {**manifest.get('sgx', {}), 'enable_stats': True,
+                                            'debug': True}}
+    with open(tmp_build_path / 'entrypoint.manifest.profile', 'w') as manifest_file:
+        toml.dump(profile_manifest, manifest_file)
+
+    env = jinja2.Environment(loader=jinja2.FileSystemLoader('templates/'))
+    env.globals.update(yaml.safe_load(args.config_file))
+    profile_template = env.get_template(f'Dockerfile.{env.globals["Distro"]}.profile.template')
+    with open(tmp_build_path / 'Dockerfile.profile', 'w') as dockerfile:
+        dockerfile.write(profile_template.render(image=unsigned_image_name))
+
+    print(f'Building profiling image `{profile_image_name}`...')
+    tmp_build_key_path = tmp_build_path / 'gsc-signer-key.pem'
+    shutil.copyfile(os.path.abspath(args.key), tmp_build_key_path)
+    try:
+        build_docker_image(docker_socket.api, tmp_build_path, profile_image_name,
+                           'Dockerfile.profile', forcerm=True)
+    finally:
+        os.remove(tmp_build_key_path)
+
+    if get_docker_image(docker_socket, profile_image_name) is None:
+        print(f'Failed to build profiling image `{profile_image_name}`.')
+        sys.exit(1)
+
+    print(f'Running `{profile_image_name}`...')
+    try:
+        start = time.monotonic()
+        container = docker_socket.containers.run(profile_image_name, args.arguments,
+                                                 devices=devices, volumes=volumes, detach=True)
+        try:
+            result = container.wait(timeout=args.timeout)
+            runtime = time.monotonic() - start
+            log = container.logs().decode('UTF-8', errors='replace')
+        finally:
+            container.remove(force=True)
+    finally:
+        docker_socket.images.remove(profile_image_name, force=True)
+
+    if result['StatusCode'] != 0:
+        print(f'Warning: the profiled application exited with status {result["StatusCode"]}, '
+              'the results may be incomplete.')
+
+    profile = parse_profile_log(log)
+    if not profile['heap_pages']:
+        print('Could not find SGX stats in the output of the profiling run.')
+        sys.exit(1)
+
+    contents, num_used, num_total = tuned_manifest(profile, manifest, runtime)
+    with open(output, 'w') as output_file:
+        output_file.write(contents)
+
+    print('Hottest OCALLs (number, count, exitless count, cycles):')
+    hot_ocalls = sorted(profile['ocalls'].items(), key=lambda item: -item[1][2])[:5]
+    for ocall, (count, exitless_count, cycles) in hot_ocalls:
+        print(f'    {ocall:4} {count:12} {exitless_count:12} {cycles:16}')
+    print(f'Used {num_used} of {num_total} trusted files.')
+    print(f'Successfully wrote tuned manifest options to `{output}`.')
+
+
 # Simplified version of read_sigstruct from python/graphenelibos/sgx_get_token.py
 def read_sigstruct(sig):
     # Offsets for fields in SIGSTRUCT (defined by the SGX HW architecture, they never change)
@@ -373,6 +612,9 @@ sub_build.add_argument('--rm', action='store_true',
     help='Remove intermediate Docker images when build is successful.')
 sub_build.add_argument('--build-arg', action='append', default=[],
     help='Set build-time variables (same as "docker build --build-arg").')
+sub_build.add_argument('--no-auto-trusted-files', action='store_true',
+    help='Do not add all files of the image as trusted files, only those listed in the manifest '
+         '(e.g. generated by "gsc profile").')
 sub_build.add_argument('-c', '--config_file', type=argparse.FileType('r', encoding='UTF-8'),
     default='config.yaml', help='Specify configuration file.')
 sub_build.add_argument('image', help='Name of the application Docker image.')
@@ -403,9 +645,25 @@ sub_sign = subcommands.add_parser('sign-image', help='Sign graphenized Docker im
 sub_sign.set_defaults(command=gsc_sign_image)
 sub_sign.add_argument('-c', '--config_file', type=argparse.FileType('r', encoding='UTF-8'),
     default='config.yaml', help='Specify configuration file.')
+sub_sign.add_argument('--no-hash-cache', action='store_true',
+    help='Hash all trusted files from scratch, without reusing or updating the hash cache.')
 sub_sign.add_argument('image', help='Name of the application (base) Docker image.')
 sub_sign.add_argument('key', help='Key to sign the Intel SGX enclaves inside the Docker image.')
 
+sub_profile = subcommands.add_parser('profile', help='Run graphenized Docker image with SGX '
+                                     'stats and generate a tuned manifest')
+sub_profile.set_defaults(command=gsc_profile_image)
+sub_profile.add_argument('-c', '--config_file', type=argparse.FileType('r', encoding='UTF-8'),
+    default='config.yaml', help='Specify configuration file.')
+sub_profile.add_argument('-o', '--output',
+    help='Output file with tuned manifest options (default: <image>.tuned.manifest).')
+sub_profile.add_argument('--timeout', type=float, default=None,
+    help='Stop the profiling run after this many seconds.')
+sub_profile.add_argument('image', help='Name of the application (base) Docker image.')
+sub_profile.add_argument('key', help='Key to sign the Intel SGX enclave of the profiling image.')
+sub_profile.add_argument('arguments', nargs='*',
+    help='Arguments for the application (only with images built with --insecure-args).')
+
 sub_info = subcommands.add_parser('info-image', help='Retrieve information about a graphenized '
                                   'Docker image')
 sub_info.set_defaults(command=gsc_info_image)
@@ -2,6 +2,7 @@
 #define AVL_TREE_H
 
 #include <stdbool.h>
+#include <stddef.h>
 
 /*
  * Example usage of this module:
@@ -54,6 +55,14 @@ struct avl_tree {
 };
 
 void avl_tree_insert(struct avl_tree* tree, struct avl_tree_node* node);
+
+/*
+ * Builds `tree` from `count` nodes in O(count), instead of O(count * log(count)) of repeated
+ * `avl_tree_insert`. `tree` must be empty and `nodes` must be sorted with respect to `tree.cmp`
+ * (i.e. `tree.cmp(nodes[i], nodes[i + 1])` holds); the in-order of the built tree is the order of
+ * `nodes`.
+ */
+void avl_tree_build(struct avl_tree* tree, struct avl_tree_node** nodes, size_t count);
 void avl_tree_delete(struct avl_tree* tree, struct avl_tree_node* node);
 
 /*
@@ -95,6 +104,27 @@ struct avl_tree_node* avl_tree_lower_bound_fn(struct avl_tree* tree, void* cmp_a
                                               bool cmp(void*, struct avl_tree_node*));
 struct avl_tree_node* avl_tree_lower_bound(struct avl_tree* tree, struct avl_tree_node* cmp_arg);
 
+/*
+ * Defines `static inline struct avl_tree_node* NAME(struct avl_tree* tree, ARG_TYPE cmp_arg)`,
+ * which does the same as `avl_tree_lower_bound_fn(tree, cmp_arg, CMP)`, but with `CMP` (a function
+ * or macro taking `(ARG_TYPE, struct avl_tree_node*)`) inlined into the loop instead of called
+ * indirectly at each level of the tree. Meant for hot lookups.
+ */
+#define DEFINE_AVL_TREE_LOWER_BOUND_FN(NAME, ARG_TYPE, CMP)                         \
+    static inline struct avl_tree_node* NAME(struct avl_tree* tree, ARG_TYPE cmp_arg) { \
+        struct avl_tree_node* node = tree->root;                                    \
+        struct avl_tree_node* ret = NULL;                                           \
+        while (node) {                                                              \
+            if (CMP(cmp_arg, node)) {                                               \
+                ret = node;                                                         \
+                node = node->left;                                                  \
+            } else {                                                                \
+                node = node->right;                                                 \
+            }                                                                       \
+        }                                                                           \
+        return ret;                                                                 \
+    }
+
 bool debug_avl_tree_is_balanced(struct avl_tree* tree);
 
 #endif // AVL_TREE_H
@@ -48,6 +48,11 @@ typedef struct {
     ssize_t (*pal_recv_cb)(int fd, void* buf, size_t buf_size);
     ssize_t (*pal_send_cb)(int fd, const void* buf, size_t buf_size);
     int stream_fd;
+    /* records encrypted by lib_SSLWriteBatched() are collected here and sent at once */
+    uint8_t* batch_buf;
+    size_t batch_size;
+    size_t batch_used;
+    bool batching;
 } LIB_SSL_CONTEXT;
 
 #endif /* CRYPTO_USE_MBEDTLS */
@@ -106,6 +111,7 @@ int lib_SSLFree(LIB_SSL_CONTEXT* ssl_ctx);
 int lib_SSLHandshake(LIB_SSL_CONTEXT* ssl_ctx);
 int lib_SSLRead(LIB_SSL_CONTEXT* ssl_ctx, uint8_t* buf, size_t buf_size);
 int lib_SSLWrite(LIB_SSL_CONTEXT* ssl_ctx, const uint8_t* buf, size_t buf_size);
+int lib_SSLWriteBatched(LIB_SSL_CONTEXT* ssl_ctx, const uint8_t* buf, size_t buf_size);
 int lib_SSLSave(LIB_SSL_CONTEXT* ssl_ctx, uint8_t* buf, size_t buf_size, size_t* out_size);
 
 #endif /* CRYPTO_H */
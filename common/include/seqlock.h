@@ -86,4 +86,29 @@ static inline void write_seqend(seqlock_t* sl) {
     spinlock_unlock(&sl->lock);
 }
 
+/*!
+ * \brief Start a reader-side critical section that excludes writers (acquires spinlock).
+ *
+ * Useful for readers that cannot be retried, e.g. because they take references to the data.
+ */
+static inline void read_seqlock_excl(seqlock_t* sl) {
+    spinlock_lock(&sl->lock);
+}
+
+/*!
+ * \brief End a reader-side critical section that excludes writers (releases spinlock).
+ */
+static inline void read_sequnlock_excl(seqlock_t* sl) {
+    spinlock_unlock(&sl->lock);
+}
+
+#ifdef DEBUG_SPINLOCKS
+/*!
+ * \brief Returns true if the seqlock is held by a writer or an exclusive reader.
+ */
+static inline bool seqlock_is_locked(seqlock_t* sl) {
+    return spinlock_is_locked(&sl->lock);
+}
+#endif // DEBUG_SPINLOCKS
+
 #endif // _SEQLOCK_H
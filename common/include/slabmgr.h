@@ -107,6 +107,18 @@ static_assert(IS_ALIGNED(offsetof(struct slab_area, raw), 16),
 // (SLAB_HDR_SIZE)).
 static const size_t slab_levels[SLAB_LEVEL] = {SLAB_LEVEL_SIZES};
 
+/* Allocation statistics, protected by SYSTEM_LOCK */
+typedef struct slab_stats {
+    size_t live[SLAB_LEVEL]; /* objects taken from the manager, including those in thread caches */
+    size_t peak[SLAB_LEVEL];
+    size_t large_live;       /* large objects (allocated directly with system_malloc) */
+    size_t large_bytes;
+    size_t large_peak_bytes;
+    size_t system_allocs;    /* calls to system_malloc, for both slab areas and large objects */
+    size_t system_bytes;     /* memory currently obtained with system_malloc */
+    size_t system_peak_bytes;
+} SLAB_STATS_TYPE;
+
 DEFINE_LISTP(slab_obj);
 DEFINE_LISTP(slab_area);
 typedef struct slab_mgr {
@@ -116,6 +128,7 @@ typedef struct slab_mgr {
     void* addr[SLAB_LEVEL];
     void* addr_top[SLAB_LEVEL];
     SLAB_AREA active_area[SLAB_LEVEL];
+    SLAB_STATS_TYPE stats;
 } SLAB_MGR_TYPE, *SLAB_MGR;
 
 typedef struct __attribute__((packed)) large_mem_obj {
@@ -183,6 +196,21 @@ static inline size_t init_size_align_up(size_t size) {
 #define STARTUP_SIZE 16
 #endif
 
+// SYSTEM_LOCK needs to be held by the caller on entry.
+static inline void __slab_stats_take(SLAB_MGR mgr, size_t level, size_t count) {
+    mgr->stats.live[level] += count;
+    if (mgr->stats.live[level] > mgr->stats.peak[level])
+        mgr->stats.peak[level] = mgr->stats.live[level];
+}
+
+// SYSTEM_LOCK needs to be held by the caller on entry.
+static inline void __slab_stats_system_malloc(SLAB_MGR mgr, size_t size) {
+    mgr->stats.system_allocs++;
+    mgr->stats.system_bytes += size;
+    if (mgr->stats.system_bytes > mgr->stats.system_peak_bytes)
+        mgr->stats.system_peak_bytes = mgr->stats.system_bytes;
+}
+
 static inline void __set_free_slab_area(SLAB_AREA area, SLAB_MGR mgr, int level) {
     size_t slab_size = slab_levels[level] + SLAB_HDR_SIZE;
     mgr->addr[level]        = (void*)area->raw;
@@ -212,6 +240,8 @@ static inline SLAB_MGR create_slab_mgr(void) {
         return NULL;
 
     mgr = (SLAB_MGR)mem;
+    memset(&mgr->stats, 0, sizeof(mgr->stats));
+    __slab_stats_system_malloc(mgr, __INIT_MAX_MEM_SIZE(size));
 
     void* addr = (void*)mgr + sizeof(SLAB_MGR_TYPE);
     for (size_t i = 0; i < SLAB_LEVEL; i++) {
@@ -280,6 +310,7 @@ static inline int maybe_enlarge_slab_mgr(SLAB_MGR mgr, int level) {
         if (!area)
             return -ENOMEM;
 
+        __slab_stats_system_malloc(mgr, __MAX_MEM_SIZE(slab_levels[level], size));
         area->size = size;
         INIT_LIST_HEAD(area, __list);
 
@@ -311,6 +342,14 @@ static inline void* slab_alloc(SLAB_MGR mgr, size_t size) {
         mem->size = size;
         OBJ_LEVEL(mem) = (unsigned char)-1;
 
+        SYSTEM_LOCK();
+        __slab_stats_system_malloc(mgr, sizeof(LARGE_MEM_OBJ_TYPE) + size);
+        mgr->stats.large_live++;
+        mgr->stats.large_bytes += size;
+        if (mgr->stats.large_bytes > mgr->stats.large_peak_bytes)
+            mgr->stats.large_peak_bytes = mgr->stats.large_bytes;
+        SYSTEM_UNLOCK();
+
         return OBJ_RAW(mem);
     }
 
@@ -332,6 +371,7 @@ static inline void* slab_alloc(SLAB_MGR mgr, size_t size) {
     }
     assert(mgr->addr[level] <= mgr->addr_top[level]);
     OBJ_LEVEL(mobj) = level;
+    __slab_stats_take(mgr, level, 1);
     SYSTEM_UNLOCK();
 
 #ifdef SLAB_CANARY
@@ -381,6 +421,12 @@ static inline void slab_free(SLAB_MGR mgr, void* obj) {
 #ifdef DEBUG
         memset(obj, 0xCC, mem->size);
 #endif
+        SYSTEM_LOCK();
+        mgr->stats.system_bytes -= mem->size + sizeof(LARGE_MEM_OBJ_TYPE);
+        mgr->stats.large_live--;
+        mgr->stats.large_bytes -= mem->size;
+        SYSTEM_UNLOCK();
+
         system_free(mem, mem->size + sizeof(LARGE_MEM_OBJ_TYPE));
         return;
     }
@@ -411,7 +457,181 @@ static inline void slab_free(SLAB_MGR mgr, void* obj) {
     SYSTEM_LOCK();
     INIT_LIST_HEAD(mobj, __list);
     LISTP_ADD_TAIL(mobj, &mgr->free_list[level], __list);
+    mgr->stats.live[level]--;
     SYSTEM_UNLOCK();
 }
 
+/*
+ * Per-thread caches ("magazines") of free slab objects.
+ *
+ * A cache keeps a short singly-linked list of free objects for each level (linked through
+ * `__list.next`), so that most allocations and frees do not take SYSTEM_LOCK. An empty list is
+ * refilled from `mgr` with SLAB_CACHE_BATCH objects at once, and when a list grows beyond
+ * SLAB_CACHE_SIZE objects, SLAB_CACHE_BATCH of them are returned to `mgr` at once. Objects freed
+ * by a thread other than the allocating one simply go to the freeing thread's cache, so
+ * producer-consumer patterns hand the memory back to the shared free lists in batches.
+ *
+ * A cache must only be used by one thread at a time and must be drained with slab_cache_drain()
+ * before it is discarded.
+ */
+#ifndef SLAB_CACHE_SIZE
+#define SLAB_CACHE_SIZE 32
+#endif
+#define SLAB_CACHE_BATCH (SLAB_CACHE_SIZE / 2)
+
+typedef struct slab_cache {
+    SLAB_OBJ head[SLAB_LEVEL];
+    size_t count[SLAB_LEVEL];
+} SLAB_CACHE_TYPE, *SLAB_CACHE;
+
+// SYSTEM_LOCK needs to be held by the caller on entry.
+static inline void __slab_cache_refill(SLAB_MGR mgr, SLAB_CACHE cache, size_t level) {
+    assert(SYSTEM_LOCKED());
+
+    size_t i;
+    for (i = 0; i < SLAB_CACHE_BATCH; i++) {
+        SLAB_OBJ mobj;
+        if (!LISTP_EMPTY(&mgr->free_list[level])) {
+            mobj = LISTP_FIRST_ENTRY(&mgr->free_list[level], SLAB_OBJ_TYPE, __list);
+            LISTP_DEL(mobj, &mgr->free_list[level], __list);
+        } else if (mgr->addr[level] < mgr->addr_top[level]) {
+            mobj = (void*)mgr->addr[level];
+            mgr->addr[level] += slab_levels[level] + SLAB_HDR_SIZE;
+        } else {
+            /* don't enlarge the manager just to fill the cache */
+            break;
+        }
+        mobj->__list.next = cache->head[level];
+        cache->head[level] = mobj;
+        cache->count[level]++;
+    }
+    __slab_stats_take(mgr, level, i);
+}
+
+/* Returns `count` objects from the head of the `level` list of `cache` to `mgr`. */
+static inline void __slab_cache_flush(SLAB_MGR mgr, SLAB_CACHE cache, size_t level, size_t count) {
+    assert(count <= cache->count[level]);
+
+    SYSTEM_LOCK();
+    for (size_t i = 0; i < count; i++) {
+        SLAB_OBJ mobj = cache->head[level];
+        cache->head[level] = mobj->__list.next;
+        INIT_LIST_HEAD(mobj, __list);
+        LISTP_ADD_TAIL(mobj, &mgr->free_list[level], __list);
+    }
+    mgr->stats.live[level] -= count;
+    SYSTEM_UNLOCK();
+    cache->count[level] -= count;
+}
+
+static inline void* slab_alloc_cached(SLAB_MGR mgr, SLAB_CACHE cache, size_t size) {
+    size_t level = -1;
+
+    for (size_t i = 0; i < SLAB_LEVEL; i++)
+        if (size <= slab_levels[i]) {
+            level = i;
+            break;
+        }
+
+    if (!cache || level == (size_t)-1)
+        return slab_alloc(mgr, size);
+
+    if (!cache->count[level]) {
+        SYSTEM_LOCK();
+        int ret = maybe_enlarge_slab_mgr(mgr, level);
+        if (ret < 0) {
+            SYSTEM_UNLOCK();
+            return NULL;
+        }
+        __slab_cache_refill(mgr, cache, level);
+        SYSTEM_UNLOCK();
+        assert(cache->count[level]);
+    }
+
+    SLAB_OBJ mobj = cache->head[level];
+    cache->head[level] = mobj->__list.next;
+    cache->count[level]--;
+    OBJ_LEVEL(mobj) = level;
+
+#ifdef SLAB_CANARY
+    unsigned long* m = (unsigned long*)((void*)OBJ_RAW(mobj) + slab_levels[level]);
+    *m = SLAB_CANARY_STRING;
+#endif
+
+    return OBJ_RAW(mobj);
+}
+
+static inline void slab_free_cached(SLAB_MGR mgr, SLAB_CACHE cache, void* obj) {
+    if (!obj)
+        return;
+
+    unsigned char level = RAW_TO_LEVEL(obj);
+
+    /* large objects and corrupted headers are handled (and reported) by slab_free() */
+    if (!cache || level >= SLAB_LEVEL) {
+        slab_free(mgr, obj);
+        return;
+    }
+
+#ifdef SLAB_CANARY
+    unsigned long* m = (unsigned long*)(obj + slab_levels[level]);
+    __UNUSED(m);
+    assert(*m == SLAB_CANARY_STRING);
+#endif
+
+    SLAB_OBJ mobj = RAW_TO_OBJ(obj, SLAB_OBJ_TYPE);
+#ifdef DEBUG
+    memset(obj, 0xCC, slab_levels[level]);
+#endif
+
+    mobj->__list.next = cache->head[level];
+    cache->head[level] = mobj;
+    if (++cache->count[level] > SLAB_CACHE_SIZE)
+        __slab_cache_flush(mgr, cache, level, SLAB_CACHE_BATCH);
+}
+
+/* Returns all objects kept in `cache` to `mgr`. */
+static inline void slab_cache_drain(SLAB_MGR mgr, SLAB_CACHE cache) {
+    for (size_t i = 0; i < SLAB_LEVEL; i++)
+        if (cache->count[i])
+            __slab_cache_flush(mgr, cache, i, cache->count[i]);
+}
+
+/* Writes a human-readable summary of allocation statistics of `mgr` to `buf` (truncated and
+ * NULL-terminated like with snprintf()). Returns the length of the full summary. */
+static inline size_t slab_print_stats(SLAB_MGR mgr, char* buf, size_t size) {
+    SLAB_STATS_TYPE stats;
+    size_t capacity[SLAB_LEVEL];
+
+    SYSTEM_LOCK();
+    stats = mgr->stats;
+    for (size_t i = 0; i < SLAB_LEVEL; i++) {
+        SLAB_AREA area;
+        capacity[i] = 0;
+        LISTP_FOR_EACH_ENTRY(area, &mgr->area_list[i], __list) {
+            capacity[i] += area->size;
+        }
+    }
+    SYSTEM_UNLOCK();
+
+    size_t len = 0;
+#define __SLAB_PRINT(fmt...) \
+    (len += snprintf(len < size ? buf + len : NULL, len < size ? size - len : 0, fmt))
+
+    __SLAB_PRINT("%10s %10s %10s %10s %14s\n", "obj size", "live", "peak", "capacity",
+                 "live bytes");
+    for (size_t i = 0; i < SLAB_LEVEL; i++) {
+        size_t obj_size = slab_levels[i] + SLAB_HDR_SIZE;
+        __SLAB_PRINT("%10lu %10lu %10lu %10lu %14lu\n", obj_size, stats.live[i], stats.peak[i],
+                     capacity[i], stats.live[i] * obj_size);
+    }
+    __SLAB_PRINT("large objects: %lu (%lu bytes, peak %lu bytes)\n", stats.large_live,
+                 stats.large_bytes, stats.large_peak_bytes);
+    __SLAB_PRINT("system allocations: %lu (%lu bytes in use, peak %lu bytes)\n",
+                 stats.system_allocs, stats.system_bytes, stats.system_peak_bytes);
+
+#undef __SLAB_PRINT
+    return len;
+}
+
 #endif /* SLABMGR_H */
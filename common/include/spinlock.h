@@ -117,13 +117,17 @@ out:
 }
 
 /*!
- * \brief Try to acquire spinlock for some time.
+ * \brief Try to acquire spinlock for some time, reporting how long it spun.
  *
  * \param iterations  Number of iterations (tries) after which this function times out.
+ * \param spent       On return, number of iterations actually spun (equals `iterations` on
+ *                    timeout).
  * \return            0 if acquiring the lock succeeded, 1 if timed out.
  */
-static inline int spinlock_lock_timeout(spinlock_t* lock, unsigned long iterations) {
+static inline int spinlock_lock_timeout_spent(spinlock_t* lock, unsigned long iterations,
+                                              unsigned long* spent) {
     uint32_t val;
+    unsigned long left = iterations;
 
     /* First check if lock is already free. */
     if (__atomic_exchange_n(&lock->lock, SPINLOCK_LOCKED, __ATOMIC_ACQUIRE) == SPINLOCK_UNLOCKED) {
@@ -133,10 +137,11 @@ static inline int spinlock_lock_timeout(spinlock_t* lock, unsigned long iteratio
     do {
         /* This check imposes no inter-thread ordering, thus does not slow other threads. */
         while (__atomic_load_n(&lock->lock, __ATOMIC_RELAXED) != SPINLOCK_UNLOCKED) {
-            if (iterations == 0) {
+            if (left == 0) {
+                *spent = iterations;
                 return 1;
             }
-            iterations--;
+            left--;
             CPU_RELAX();
         }
         /* Seen lock as free, check if it still is, this time with acquire semantics (but only
@@ -147,9 +152,21 @@ static inline int spinlock_lock_timeout(spinlock_t* lock, unsigned long iteratio
 
 out_success:
     debug_spinlock_take_ownership(lock);
+    *spent = iterations - left;
     return 0;
 }
 
+/*!
+ * \brief Try to acquire spinlock for some time.
+ *
+ * \param iterations  Number of iterations (tries) after which this function times out.
+ * \return            0 if acquiring the lock succeeded, 1 if timed out.
+ */
+static inline int spinlock_lock_timeout(spinlock_t* lock, unsigned long iterations) {
+    unsigned long spent;
+    return spinlock_lock_timeout_spent(lock, iterations, &spent);
+}
+
 /*!
  * \brief Compare the contents of `*lock` with the contents of `*expected`
  *
@@ -330,6 +330,45 @@ void avl_tree_insert(struct avl_tree* tree, struct avl_tree_node* node) {
     }
 }
 
+/* Builds a balanced tree from sorted `nodes` (the middle one becomes the root) and returns its
+ * root. Stores the height of the tree in `*height`. Recursion depth is O(log(count)). */
+static struct avl_tree_node* avl_tree_build_range(struct avl_tree_node** nodes, size_t count,
+                                                  struct avl_tree_node* parent, size_t* height) {
+    if (!count) {
+        *height = 0;
+        return NULL;
+    }
+
+    /* The left subtree gets the same number of nodes as the right one or one more, so heights
+     * differ by at most one. */
+    size_t mid = count / 2;
+    struct avl_tree_node* node = nodes[mid];
+    size_t left_height;
+    size_t right_height;
+
+    node->parent = parent;
+    node->left = avl_tree_build_range(nodes, mid, node, &left_height);
+    node->right = avl_tree_build_range(nodes + mid + 1, count - mid - 1, node, &right_height);
+    assert(left_height == right_height || left_height == right_height + 1);
+    node->balance = left_height == right_height ? 0 : -1;
+
+    *height = left_height + 1;
+    return node;
+}
+
+void avl_tree_build(struct avl_tree* tree, struct avl_tree_node** nodes, size_t count) {
+    assert(!tree->root);
+
+#ifdef DEBUG
+    for (size_t i = 1; i < count; i++) {
+        assert(tree->cmp(nodes[i - 1], nodes[i]));
+    }
+#endif
+
+    size_t height;
+    tree->root = avl_tree_build_range(nodes, count, /*parent=*/NULL, &height);
+}
+
 void avl_tree_swap_node(struct avl_tree* tree, struct avl_tree_node* old_node,
                         struct avl_tree_node* new_node) {
     assert(tree->cmp(old_node, new_node) && tree->cmp(new_node, old_node));
@@ -0,0 +1,325 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* Copyright (C) 2021 Intel Corporation */
+
+/*
+ * AES-128-GCM with a 96-bit IV and a 128-bit tag, implemented with AES-NI and PCLMULQDQ.
+ *
+ * mbedTLS uses AES-NI too, but processes GCM one 16-byte block at a time through several layers
+ * of function pointers, expands the key into a generic cipher context allocated on the heap and
+ * precomputes multiplication tables it doesn't use with PCLMULQDQ. This is significant for
+ * protected files, which encrypt each 4KB node with its own key. Here, the key expansion is done on
+ * the stack, four counter blocks are encrypted in parallel and GHASH of four blocks is computed
+ * with a single reduction (using precomputed H^1..H^4), as described in Intel's white paper
+ * "Intel Carry-Less Multiplication Instruction and its Usage for Computing the GCM Mode".
+ *
+ * GHASH operates on byte-reflected blocks, so that the bit-reflected GCM field elements can be
+ * multiplied with PCLMULQDQ followed by a one-bit left shift.
+ *
+ * This file must not include libc-replacement headers of Graphene (e.g. "api.h"): <immintrin.h>
+ * pulls in the compiler's own headers.
+ */
+
+#include "aesni_gcm.h"
+
+#ifdef __x86_64__
+#include <immintrin.h>
+
+#include "cpu.h"
+
+#define AES128_ROUNDS 10
+#define GCM_BLOCK_SIZE 16
+
+#define AESNI_TARGET __attribute__((target("aes,pclmul,ssse3,sse4.1")))
+
+#define CPUID_FEATURE_LEAF  0x1
+#define CPUID_ECX_PCLMULQDQ (1u << 1)
+#define CPUID_ECX_SSSE3     (1u << 9)
+#define CPUID_ECX_SSE41     (1u << 19)
+#define CPUID_ECX_AES       (1u << 25)
+
+/* -1 = not detected yet; races on initialization are benign (all threads compute the same value) */
+static int g_aesni_gcm_supported = -1;
+
+bool aesni_gcm_supported(void) {
+    int supported = __atomic_load_n(&g_aesni_gcm_supported, __ATOMIC_RELAXED);
+    if (supported >= 0)
+        return supported;
+
+    unsigned int words[CPUID_WORD_NUM];
+    const uint32_t needed = CPUID_ECX_PCLMULQDQ | CPUID_ECX_SSSE3 | CPUID_ECX_SSE41 |
+                            CPUID_ECX_AES;
+    cpuid(CPUID_FEATURE_LEAF, 0, words);
+    supported = (words[CPUID_WORD_ECX] & needed) == needed;
+
+    __atomic_store_n(&g_aesni_gcm_supported, supported, __ATOMIC_RELAXED);
+    return supported;
+}
+
+AESNI_TARGET
+static inline __m128i aes128_expand_step(__m128i key, __m128i assist) {
+    assist = _mm_shuffle_epi32(assist, 0xff);
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    return _mm_xor_si128(key, assist);
+}
+
+/* the round constant must be an immediate, hence a macro */
+#define AES128_EXPAND(rk, i, rcon) \
+    (rk)[i] = aes128_expand_step((rk)[(i) - 1], _mm_aeskeygenassist_si128((rk)[(i) - 1], rcon))
+
+AESNI_TARGET
+static void aes128_expand_key(const uint8_t* key, __m128i rk[AES128_ROUNDS + 1]) {
+    rk[0] = _mm_loadu_si128((const __m128i*)key);
+    AES128_EXPAND(rk, 1, 0x01);
+    AES128_EXPAND(rk, 2, 0x02);
+    AES128_EXPAND(rk, 3, 0x04);
+    AES128_EXPAND(rk, 4, 0x08);
+    AES128_EXPAND(rk, 5, 0x10);
+    AES128_EXPAND(rk, 6, 0x20);
+    AES128_EXPAND(rk, 7, 0x40);
+    AES128_EXPAND(rk, 8, 0x80);
+    AES128_EXPAND(rk, 9, 0x1b);
+    AES128_EXPAND(rk, 10, 0x36);
+}
+
+AESNI_TARGET
+static inline __m128i aes128_encrypt_block(const __m128i rk[AES128_ROUNDS + 1], __m128i block) {
+    block = _mm_xor_si128(block, rk[0]);
+    for (int i = 1; i < AES128_ROUNDS; i++)
+        block = _mm_aesenc_si128(block, rk[i]);
+    return _mm_aesenclast_si128(block, rk[AES128_ROUNDS]);
+}
+
+AESNI_TARGET
+static inline void aes128_encrypt_4blocks(const __m128i rk[AES128_ROUNDS + 1], __m128i b[4]) {
+    for (int j = 0; j < 4; j++)
+        b[j] = _mm_xor_si128(b[j], rk[0]);
+    for (int i = 1; i < AES128_ROUNDS; i++)
+        for (int j = 0; j < 4; j++)
+            b[j] = _mm_aesenc_si128(b[j], rk[i]);
+    for (int j = 0; j < 4; j++)
+        b[j] = _mm_aesenclast_si128(b[j], rk[AES128_ROUNDS]);
+}
+
+/* accumulates the unreduced 256-bit carry-less product of `a` and `b` into `lo` and `hi` */
+AESNI_TARGET
+static inline void clmul_acc(__m128i a, __m128i b, __m128i* lo, __m128i* hi) {
+    __m128i mid = _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x10),
+                                _mm_clmulepi64_si128(a, b, 0x01));
+    *lo = _mm_xor_si128(*lo, _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x00),
+                                           _mm_slli_si128(mid, 8)));
+    *hi = _mm_xor_si128(*hi, _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x11),
+                                           _mm_srli_si128(mid, 8)));
+}
+
+/* shifts the 256-bit product left by one bit and reduces it modulo the GCM polynomial */
+AESNI_TARGET
+static inline __m128i ghash_reduce(__m128i lo, __m128i hi) {
+    __m128i carry_lo = _mm_srli_epi32(lo, 31);
+    __m128i carry_hi = _mm_srli_epi32(hi, 31);
+    lo = _mm_slli_epi32(lo, 1);
+    hi = _mm_slli_epi32(hi, 1);
+    __m128i carry_mid = _mm_srli_si128(carry_lo, 12);
+    carry_hi = _mm_slli_si128(carry_hi, 4);
+    carry_lo = _mm_slli_si128(carry_lo, 4);
+    lo = _mm_or_si128(lo, carry_lo);
+    hi = _mm_or_si128(hi, carry_hi);
+    hi = _mm_or_si128(hi, carry_mid);
+
+    __m128i t1 = _mm_xor_si128(_mm_xor_si128(_mm_slli_epi32(lo, 31), _mm_slli_epi32(lo, 30)),
+                               _mm_slli_epi32(lo, 25));
+    __m128i t2 = _mm_srli_si128(t1, 4);
+    lo = _mm_xor_si128(lo, _mm_slli_si128(t1, 12));
+    __m128i t3 = _mm_xor_si128(_mm_xor_si128(_mm_srli_epi32(lo, 1), _mm_srli_epi32(lo, 2)),
+                               _mm_srli_epi32(lo, 7));
+    t3 = _mm_xor_si128(t3, t2);
+    lo = _mm_xor_si128(lo, t3);
+    return _mm_xor_si128(hi, lo);
+}
+
+AESNI_TARGET
+static inline __m128i gfmul(__m128i a, __m128i b) {
+    __m128i lo = _mm_setzero_si128();
+    __m128i hi = _mm_setzero_si128();
+    clmul_acc(a, b, &lo, &hi);
+    return ghash_reduce(lo, hi);
+}
+
+AESNI_TARGET
+static inline __m128i bswap128(__m128i x) {
+    return _mm_shuffle_epi8(x, _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0));
+}
+
+/* loads up to 16 bytes, zero-padded (the last block of the input may be shorter) */
+AESNI_TARGET
+static inline __m128i load_partial(const uint8_t* src, size_t size) {
+    uint8_t buf[GCM_BLOCK_SIZE] __attribute__((aligned(16))) = {0};
+    for (size_t i = 0; i < size; i++)
+        buf[i] = src[i];
+    return _mm_load_si128((const __m128i*)buf);
+}
+
+AESNI_TARGET
+static inline void store_partial(uint8_t* dst, __m128i block, size_t size) {
+    uint8_t buf[GCM_BLOCK_SIZE] __attribute__((aligned(16)));
+    _mm_store_si128((__m128i*)buf, block);
+    for (size_t i = 0; i < size; i++)
+        dst[i] = buf[i];
+}
+
+struct gcm_state {
+    __m128i rk[AES128_ROUNDS + 1];
+    __m128i h[4];  /* byte-reflected H^1..H^4 */
+    __m128i j0;    /* pre-counter block */
+    __m128i ghash; /* byte-reflected GHASH accumulator */
+};
+
+AESNI_TARGET
+static void gcm_init(struct gcm_state* state, const uint8_t* key, const uint8_t* iv,
+                     const uint8_t* aad, size_t aad_size) {
+    aes128_expand_key(key, state->rk);
+
+    state->h[0] = bswap128(aes128_encrypt_block(state->rk, _mm_setzero_si128()));
+    for (int i = 1; i < 4; i++)
+        state->h[i] = gfmul(state->h[i - 1], state->h[0]);
+
+    /* J0 = IV || 0^31 || 1 */
+    state->j0 = _mm_insert_epi32(load_partial(iv, AESNI_GCM_IV_SIZE),
+                                 (int)__builtin_bswap32(1), 3);
+
+    state->ghash = _mm_setzero_si128();
+    while (aad_size > 0) {
+        size_t size = aad_size < GCM_BLOCK_SIZE ? aad_size : GCM_BLOCK_SIZE;
+        __m128i block = bswap128(load_partial(aad, size));
+        state->ghash = gfmul(_mm_xor_si128(state->ghash, block), state->h[0]);
+        aad += size;
+        aad_size -= size;
+    }
+}
+
+AESNI_TARGET
+static inline __m128i gcm_counter_block(const struct gcm_state* state, uint32_t counter) {
+    return _mm_insert_epi32(state->j0, (int)__builtin_bswap32(counter), 3);
+}
+
+/* CTR-mode en/decryption of `input` into `output` with GHASH over the ciphertext (which is the
+ * output when encrypting and the input when decrypting); `input` and `output` may be the same */
+AESNI_TARGET
+static void gcm_crypt(struct gcm_state* state, bool encrypt, const uint8_t* input, size_t size,
+                      uint8_t* output) {
+    uint32_t counter = 2; /* counter 1 (J0) is used for the tag */
+    __m128i ghash = state->ghash;
+
+    while (size >= 4 * GCM_BLOCK_SIZE) {
+        __m128i ks[4];
+        __m128i data[4];
+        for (int j = 0; j < 4; j++) {
+            ks[j] = gcm_counter_block(state, counter++);
+            data[j] = _mm_loadu_si128((const __m128i*)input + j);
+        }
+        aes128_encrypt_4blocks(state->rk, ks);
+
+        __m128i lo = _mm_setzero_si128();
+        __m128i hi = _mm_setzero_si128();
+        for (int j = 0; j < 4; j++) {
+            __m128i out = _mm_xor_si128(data[j], ks[j]);
+            _mm_storeu_si128((__m128i*)output + j, out);
+            __m128i cipher = bswap128(encrypt ? out : data[j]);
+            if (j == 0)
+                cipher = _mm_xor_si128(cipher, ghash);
+            clmul_acc(cipher, state->h[3 - j], &lo, &hi);
+        }
+        ghash = ghash_reduce(lo, hi);
+
+        input += 4 * GCM_BLOCK_SIZE;
+        output += 4 * GCM_BLOCK_SIZE;
+        size -= 4 * GCM_BLOCK_SIZE;
+    }
+
+    while (size > 0) {
+        size_t block_size = size < GCM_BLOCK_SIZE ? size : GCM_BLOCK_SIZE;
+        __m128i ks = aes128_encrypt_block(state->rk, gcm_counter_block(state, counter++));
+        __m128i data = load_partial(input, block_size);
+        __m128i out = _mm_xor_si128(data, ks);
+        store_partial(output, out, block_size);
+
+        /* the part of the keystream beyond the data must not enter GHASH */
+        __m128i cipher = encrypt ? load_partial(output, block_size) : data;
+        ghash = gfmul(_mm_xor_si128(ghash, bswap128(cipher)), state->h[0]);
+
+        input += block_size;
+        output += block_size;
+        size -= block_size;
+    }
+
+    state->ghash = ghash;
+}
+
+AESNI_TARGET
+static __m128i gcm_tag(struct gcm_state* state, size_t aad_size, size_t data_size) {
+    /* byte-reflected [len(A)]64 || [len(C)]64, lengths in bits */
+    __m128i lengths = _mm_set_epi64x((long long)(aad_size * 8), (long long)(data_size * 8));
+    __m128i ghash = gfmul(_mm_xor_si128(state->ghash, lengths), state->h[0]);
+    return _mm_xor_si128(bswap128(ghash), aes128_encrypt_block(state->rk, state->j0));
+}
+
+AESNI_TARGET
+static void gcm_wipe(struct gcm_state* state) {
+    volatile __m128i* p = (volatile __m128i*)state;
+    for (size_t i = 0; i < sizeof(*state) / sizeof(__m128i); i++)
+        p[i] = _mm_setzero_si128();
+}
+
+AESNI_TARGET
+void aesni_gcm128_encrypt(const uint8_t* key, const uint8_t* iv, const uint8_t* aad,
+                          size_t aad_size, const uint8_t* input, size_t input_size,
+                          uint8_t* output, uint8_t* tag) {
+    struct gcm_state state;
+    gcm_init(&state, key, iv, aad, aad_size);
+    gcm_crypt(&state, /*encrypt=*/true, input, input_size, output);
+    _mm_storeu_si128((__m128i*)tag, gcm_tag(&state, aad_size, input_size));
+    gcm_wipe(&state);
+}
+
+AESNI_TARGET
+bool aesni_gcm128_decrypt(const uint8_t* key, const uint8_t* iv, const uint8_t* aad,
+                          size_t aad_size, const uint8_t* input, size_t input_size,
+                          uint8_t* output, const uint8_t* tag) {
+    struct gcm_state state;
+    gcm_init(&state, key, iv, aad, aad_size);
+    gcm_crypt(&state, /*encrypt=*/false, input, input_size, output);
+    __m128i diff = _mm_xor_si128(gcm_tag(&state, aad_size, input_size),
+                                 _mm_loadu_si128((const __m128i*)tag));
+    gcm_wipe(&state);
+
+    /* constant-time comparison */
+    if (_mm_testz_si128(diff, diff))
+        return true;
+
+    /* don't leak data which failed authentication */
+    volatile uint8_t* out = output;
+    for (size_t i = 0; i < input_size; i++)
+        out[i] = 0;
+    return false;
+}
+
+#else /* __x86_64__ */
+
+bool aesni_gcm_supported(void) {
+    return false;
+}
+
+void aesni_gcm128_encrypt(const uint8_t* key, const uint8_t* iv, const uint8_t* aad,
+                          size_t aad_size, const uint8_t* input, size_t input_size,
+                          uint8_t* output, uint8_t* tag) {
+    __builtin_trap();
+}
+
+bool aesni_gcm128_decrypt(const uint8_t* key, const uint8_t* iv, const uint8_t* aad,
+                          size_t aad_size, const uint8_t* input, size_t input_size,
+                          uint8_t* output, const uint8_t* tag) {
+    __builtin_trap();
+}
+
+#endif /* __x86_64__ */
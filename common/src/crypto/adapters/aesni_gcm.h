@@ -0,0 +1,33 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* Copyright (C) 2021 Intel Corporation */
+
+/*
+ * AES-128-GCM using AES-NI and PCLMULQDQ, used by the mbedTLS adapter as a fast path. Implemented
+ * either in-tree (aesni_gcm.c, the default) or with ISA-L crypto (isal_gcm.c), depending on
+ * `CRYPTO_GCM_PROVIDER` in common/src/Makefile.
+ */
+
+#ifndef AESNI_GCM_H
+#define AESNI_GCM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define AESNI_GCM_KEY_SIZE 16
+#define AESNI_GCM_IV_SIZE  12
+#define AESNI_GCM_TAG_SIZE 16
+
+/* Returns true if the CPU supports the instructions needed by the functions below. */
+bool aesni_gcm_supported(void);
+
+void aesni_gcm128_encrypt(const uint8_t* key, const uint8_t* iv, const uint8_t* aad,
+                          size_t aad_size, const uint8_t* input, size_t input_size,
+                          uint8_t* output, uint8_t* tag);
+
+/* Returns false (and zeroes the output) if `tag` doesn't match the data. */
+bool aesni_gcm128_decrypt(const uint8_t* key, const uint8_t* iv, const uint8_t* aad,
+                          size_t aad_size, const uint8_t* input, size_t input_size,
+                          uint8_t* output, const uint8_t* tag);
+
+#endif /* AESNI_GCM_H */
@@ -0,0 +1,85 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* Copyright (C) 2021 Intel Corporation */
+
+/*
+ * AES-128-GCM fast path (see aesni_gcm.h) on top of the Intel ISA-L crypto library, selected with
+ * `make CRYPTO_GCM_PROVIDER=isal`. ISA-L picks the SSE, AVX2 or AVX-512 (VAES/VPCLMULQDQ) code at
+ * runtime, so on recent CPUs it is several times faster than the four-block loop of aesni_gcm.c.
+ *
+ * All ISA-L variants need AES-NI and PCLMULQDQ; without them the mbedTLS adapter falls back to
+ * mbedTLS, as with aesni_gcm.c.
+ */
+
+#include <isa-l_crypto/aes_gcm.h>
+
+#include "aesni_gcm.h"
+#include "cpu.h"
+
+#define CPUID_FEATURE_LEAF  0x1
+#define CPUID_ECX_PCLMULQDQ (1u << 1)
+#define CPUID_ECX_AES       (1u << 25)
+
+/* -1 = not detected yet; races on initialization are benign (all threads compute the same value) */
+static int g_isal_gcm_supported = -1;
+
+bool aesni_gcm_supported(void) {
+    int supported = __atomic_load_n(&g_isal_gcm_supported, __ATOMIC_RELAXED);
+    if (supported >= 0)
+        return supported;
+
+    unsigned int words[CPUID_WORD_NUM];
+    const uint32_t needed = CPUID_ECX_PCLMULQDQ | CPUID_ECX_AES;
+    cpuid(CPUID_FEATURE_LEAF, 0, words);
+    supported = (words[CPUID_WORD_ECX] & needed) == needed;
+
+    __atomic_store_n(&g_isal_gcm_supported, supported, __ATOMIC_RELAXED);
+    return supported;
+}
+
+static void wipe(void* buf, size_t size) {
+    volatile uint8_t* p = buf;
+    for (size_t i = 0; i < size; i++)
+        p[i] = 0;
+}
+
+void aesni_gcm128_encrypt(const uint8_t* key, const uint8_t* iv, const uint8_t* aad,
+                          size_t aad_size, const uint8_t* input, size_t input_size,
+                          uint8_t* output, uint8_t* tag) {
+    struct gcm_key_data key_data __attribute__((aligned(16)));
+    struct gcm_context_data ctx_data;
+
+    aes_gcm_pre_128(key, &key_data);
+    /* ISA-L takes a non-const IV only because of its generic prototype, it does not modify it */
+    aes_gcm_enc_128(&key_data, &ctx_data, output, input, input_size, (uint8_t*)iv, aad, aad_size,
+                    tag, AESNI_GCM_TAG_SIZE);
+
+    wipe(&key_data, sizeof(key_data));
+    wipe(&ctx_data, sizeof(ctx_data));
+}
+
+bool aesni_gcm128_decrypt(const uint8_t* key, const uint8_t* iv, const uint8_t* aad,
+                          size_t aad_size, const uint8_t* input, size_t input_size,
+                          uint8_t* output, const uint8_t* tag) {
+    struct gcm_key_data key_data __attribute__((aligned(16)));
+    struct gcm_context_data ctx_data;
+    uint8_t computed_tag[AESNI_GCM_TAG_SIZE];
+
+    aes_gcm_pre_128(key, &key_data);
+    aes_gcm_dec_128(&key_data, &ctx_data, output, input, input_size, (uint8_t*)iv, aad, aad_size,
+                    computed_tag, sizeof(computed_tag));
+
+    wipe(&key_data, sizeof(key_data));
+    wipe(&ctx_data, sizeof(ctx_data));
+
+    /* constant-time comparison */
+    uint8_t diff = 0;
+    for (size_t i = 0; i < sizeof(computed_tag); i++)
+        diff |= computed_tag[i] ^ tag[i];
+    wipe(computed_tag, sizeof(computed_tag));
+    if (!diff)
+        return true;
+
+    /* don't leak data which failed authentication */
+    wipe(output, input_size);
+    return false;
+}
@@ -7,6 +7,7 @@
 #include <limits.h>
 #include <stdint.h>
 
+#include "aesni_gcm.h"
 #include "api.h"
 #include "assert.h"
 #include "crypto.h"
@@ -24,6 +25,9 @@
 /* This is declared in pal_internal.h, but that can't be included here. */
 int _DkRandomBitsRead(void* buffer, size_t size);
 
+/* number of TLS records (of at most 16KB payload each) sent at once by lib_SSLWriteBatched() */
+#define SSL_WRITE_BATCH_RECORDS 4
+
 static int mbedtls_to_pal_error(int error) {
     switch (error) {
         case 0:
@@ -140,6 +144,11 @@ int lib_AESGCMEncrypt(const uint8_t* key, size_t key_size, const uint8_t* iv, co
                       uint8_t* tag, size_t tag_size) {
     int ret = -PAL_ERROR_INVAL;
 
+    if (key_size == AESNI_GCM_KEY_SIZE && tag_size == AESNI_GCM_TAG_SIZE && aesni_gcm_supported()) {
+        aesni_gcm128_encrypt(key, iv, aad, aad_size, input, input_size, output, tag);
+        return 0;
+    }
+
     mbedtls_gcm_context gcm;
     mbedtls_gcm_init(&gcm);
 
@@ -168,6 +177,12 @@ int lib_AESGCMDecrypt(const uint8_t* key, size_t key_size, const uint8_t* iv, co
                       const uint8_t* tag, size_t tag_size) {
     int ret = -PAL_ERROR_INVAL;
 
+    if (key_size == AESNI_GCM_KEY_SIZE && tag_size == AESNI_GCM_TAG_SIZE && aesni_gcm_supported()) {
+        if (!aesni_gcm128_decrypt(key, iv, aad, aad_size, input, input_size, output, tag))
+            return -PAL_ERROR_CRYPTO_AUTH_FAILED;
+        return 0;
+    }
+
     mbedtls_gcm_context gcm;
     mbedtls_gcm_init(&gcm);
 
@@ -301,12 +316,44 @@ static int recv_cb(void* ctx, uint8_t* buf, size_t buf_size) {
     return ret;
 }
 
+/* Sends all records collected by lib_SSLWriteBatched(). They are already committed by mbedTLS, so
+ * interrupted sends are retried (the stream is blocking). */
+static int flush_batch(LIB_SSL_CONTEXT* ssl_ctx) {
+    size_t done = 0;
+    while (done < ssl_ctx->batch_used) {
+        size_t size = MIN(ssl_ctx->batch_used - done, (size_t)INT_MAX);
+        ssize_t ret = ssl_ctx->pal_send_cb(ssl_ctx->stream_fd, ssl_ctx->batch_buf + done, size);
+        if (ret < 0) {
+            if (ret == -EINTR || ret == -EAGAIN || ret == -EWOULDBLOCK)
+                continue;
+            ssl_ctx->batch_used = 0;
+            return ret == -EPIPE ? MBEDTLS_ERR_NET_CONN_RESET : MBEDTLS_ERR_NET_SEND_FAILED;
+        }
+        done += ret;
+    }
+    ssl_ctx->batch_used = 0;
+    return 0;
+}
+
 static int send_cb(void* ctx, uint8_t const* buf, size_t buf_size) {
     LIB_SSL_CONTEXT* ssl_ctx = (LIB_SSL_CONTEXT*)ctx;
     int fd = ssl_ctx->stream_fd;
     if (fd < 0)
         return MBEDTLS_ERR_NET_INVALID_CONTEXT;
 
+    if (ssl_ctx->batching) {
+        if (buf_size > ssl_ctx->batch_size - ssl_ctx->batch_used) {
+            int ret = flush_batch(ssl_ctx);
+            if (ret < 0)
+                return ret;
+        }
+        if (buf_size <= ssl_ctx->batch_size) {
+            memcpy(ssl_ctx->batch_buf + ssl_ctx->batch_used, buf, buf_size);
+            ssl_ctx->batch_used += buf_size;
+            return (int)buf_size;
+        }
+    }
+
     if (buf_size > INT_MAX) {
         /* pal_send_cb cannot send more than 32-bit limit, trim buf_size to fit in 32-bit */
         buf_size = INT_MAX;
@@ -381,6 +428,7 @@ int lib_SSLInit(LIB_SSL_CONTEXT* ssl_ctx, int stream_fd, bool is_server, const u
 }
 
 int lib_SSLFree(LIB_SSL_CONTEXT* ssl_ctx) {
+    free(ssl_ctx->batch_buf);
     mbedtls_ssl_free(&ssl_ctx->ssl);
     mbedtls_ssl_config_free(&ssl_ctx->conf);
     mbedtls_ctr_drbg_free(&ssl_ctx->ctr_drbg);
@@ -414,6 +462,44 @@ int lib_SSLWrite(LIB_SSL_CONTEXT* ssl_ctx, const uint8_t* buf, size_t buf_size)
     return ret;
 }
 
+/*! Same as lib_SSLWrite(), but encrypts up to SSL_WRITE_BATCH_RECORDS records and sends them with
+ * one call of `pal_send_cb` (instead of one call per record). Must only be used on blocking
+ * streams, as the records are sent even if the send is interrupted. */
+int lib_SSLWriteBatched(LIB_SSL_CONTEXT* ssl_ctx, const uint8_t* buf, size_t buf_size) {
+    int payload   = mbedtls_ssl_get_max_out_record_payload(&ssl_ctx->ssl);
+    int expansion = mbedtls_ssl_get_record_expansion(&ssl_ctx->ssl);
+    if (payload <= 0 || expansion < 0 || buf_size <= (size_t)payload)
+        return lib_SSLWrite(ssl_ctx, buf, buf_size);
+
+    size_t record_size = (size_t)payload + (size_t)expansion;
+    if (!ssl_ctx->batch_buf) {
+        ssl_ctx->batch_buf = calloc(SSL_WRITE_BATCH_RECORDS, record_size);
+        if (!ssl_ctx->batch_buf)
+            return lib_SSLWrite(ssl_ctx, buf, buf_size);
+        ssl_ctx->batch_size = SSL_WRITE_BATCH_RECORDS * record_size;
+        ssl_ctx->batch_used = 0;
+    }
+
+    size_t done = 0;
+    int ret = 0;
+    ssl_ctx->batching = true;
+    while (done < buf_size && ssl_ctx->batch_size - ssl_ctx->batch_used >= record_size) {
+        /* writes one record at most */
+        ret = mbedtls_ssl_write(&ssl_ctx->ssl, buf + done, buf_size - done);
+        if (ret <= 0)
+            break;
+        done += ret;
+    }
+    ssl_ctx->batching = false;
+
+    int flush_ret = flush_batch(ssl_ctx);
+    if (flush_ret < 0)
+        return mbedtls_to_pal_error(flush_ret);
+    if (!done)
+        return mbedtls_to_pal_error(ret);
+    return done;
+}
+
 int lib_SSLSave(LIB_SSL_CONTEXT* ssl_ctx, uint8_t* buf, size_t buf_size, size_t* out_size) {
     int ret = mbedtls_ssl_context_save(&ssl_ctx->ssl, buf, buf_size, out_size);
     if (ret == MBEDTLS_ERR_SSL_BUFFER_TOO_SMALL) {
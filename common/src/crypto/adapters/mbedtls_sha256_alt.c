@@ -0,0 +1,162 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* Copyright (C) 2021 Intel Corporation */
+
+/*
+ * Replacement for the SHA-256 block function of mbedTLS (enabled by MBEDTLS_SHA256_PROCESS_ALT in
+ * our mbedTLS config).
+ *
+ * SHA-256 dominates the verification of trusted files, so on CPUs with the SHA extensions
+ * (SHA-NI) we use the dedicated SHA256RNDS2/SHA256MSG1/SHA256MSG2 instructions, which are several
+ * times faster than the portable code. Support is detected at runtime via CPUID (like mbedTLS does
+ * for AES-NI); on other CPUs we fall back to a portable implementation, equivalent to the one in
+ * mbedTLS.
+ *
+ * This file must not include libc-replacement headers of Graphene (e.g. "api.h"): <immintrin.h>
+ * pulls in the compiler's own headers.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "mbedtls/sha256.h"
+
+#ifdef __x86_64__
+#include <immintrin.h>
+
+#include "cpu.h"
+#endif
+
+static const uint32_t g_sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_process_generic(uint32_t state[8], const unsigned char data[64]) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++) {
+        w[i] = (uint32_t)data[i * 4] << 24 | (uint32_t)data[i * 4 + 1] << 16 |
+               (uint32_t)data[i * 4 + 2] << 8 | (uint32_t)data[i * 4 + 3];
+    }
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; i++) {
+        uint32_t t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) +
+                      g_sha256_k[i] + w[i];
+        uint32_t t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+}
+
+#ifdef __x86_64__
+__attribute__((target("sha,sse4.1")))
+static void sha256_process_shani(uint32_t state[8], const unsigned char data[64]) {
+    const __m128i bswap_mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    /* SHA256RNDS2 operates on the state in "ABEF" and "CDGH" order */
+    __m128i tmp    = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&state[0]), 0xB1);
+    __m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&state[4]), 0x1B);
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+    __m128i abef_save = state0;
+    __m128i cdgh_save = state1;
+
+    __m128i msg[4];
+    for (int i = 0; i < 4; i++)
+        msg[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + i * 16)), bswap_mask);
+
+    /* 16 groups of 4 rounds; msg[i % 4] holds the message words of group i, and is replaced by the
+     * words of group i + 4 once it is consumed */
+    for (int i = 0; i < 16; i++) {
+        __m128i wk = _mm_add_epi32(msg[i % 4], _mm_loadu_si128((const __m128i*)&g_sha256_k[i * 4]));
+        state1 = _mm_sha256rnds2_epu32(state1, state0, wk);
+        state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(wk, 0x0E));
+
+        if (i < 12) {
+            __m128i next = _mm_sha256msg1_epu32(msg[i % 4], msg[(i + 1) % 4]);
+            next = _mm_add_epi32(next, _mm_alignr_epi8(msg[(i + 3) % 4], msg[(i + 2) % 4], 4));
+            msg[i % 4] = _mm_sha256msg2_epu32(next, msg[(i + 3) % 4]);
+        }
+    }
+
+    state0 = _mm_add_epi32(state0, abef_save);
+    state1 = _mm_add_epi32(state1, cdgh_save);
+
+    /* back to "ABCD" and "EFGH" order */
+    tmp    = _mm_shuffle_epi32(state0, 0x1B);
+    state1 = _mm_shuffle_epi32(state1, 0xB1);
+    _mm_storeu_si128((__m128i*)&state[0], _mm_blend_epi16(tmp, state1, 0xF0));
+    _mm_storeu_si128((__m128i*)&state[4], _mm_alignr_epi8(state1, tmp, 8));
+}
+
+#define CPUID_EXT_FEATURE_LEAF 0x7
+#define CPUID_FEATURE_LEAF     0x1
+#define CPUID_EBX_SHA          (1u << 29)
+#define CPUID_ECX_SSSE3        (1u << 9)
+#define CPUID_ECX_SSE41        (1u << 19)
+
+/* -1 = not detected yet; races on initialization are benign (all threads compute the same value) */
+static int g_sha_ni_supported = -1;
+
+static bool sha_ni_supported(void) {
+    int supported = __atomic_load_n(&g_sha_ni_supported, __ATOMIC_RELAXED);
+    if (supported >= 0)
+        return supported;
+
+    unsigned int words[CPUID_WORD_NUM];
+    supported = 0;
+    cpuid(0, 0, words);
+    if (words[CPUID_WORD_EAX] >= CPUID_EXT_FEATURE_LEAF) {
+        cpuid(CPUID_EXT_FEATURE_LEAF, 0, words);
+        bool has_sha = words[CPUID_WORD_EBX] & CPUID_EBX_SHA;
+        cpuid(CPUID_FEATURE_LEAF, 0, words);
+        bool has_sse = (words[CPUID_WORD_ECX] & CPUID_ECX_SSSE3) &&
+                       (words[CPUID_WORD_ECX] & CPUID_ECX_SSE41);
+        supported = has_sha && has_sse;
+    }
+
+    __atomic_store_n(&g_sha_ni_supported, supported, __ATOMIC_RELAXED);
+    return supported;
+}
+#endif /* __x86_64__ */
+
+int mbedtls_internal_sha256_process(mbedtls_sha256_context* ctx, const unsigned char data[64]) {
+#ifdef __x86_64__
+    if (sha_ni_supported()) {
+        sha256_process_shani(ctx->state, data);
+        return 0;
+    }
+#endif
+    sha256_process_generic(ctx->state, data);
+    return 0;
+}
@@ -4,9 +4,19 @@
 
 #include "api.h"
 
+typedef uint64_t __attribute__((aligned(1), may_alias)) unaligned_u64;
+
 int memcmp(const void* lhs, const void* rhs, size_t count) {
     const unsigned char* l = lhs;
     const unsigned char* r = rhs;
+
+    /* skip the equal prefix a word at a time, the first differing byte is then found below */
+    while (count >= sizeof(uint64_t) && *(const unaligned_u64*)l == *(const unaligned_u64*)r) {
+        count -= sizeof(uint64_t);
+        l += sizeof(uint64_t);
+        r += sizeof(uint64_t);
+    }
+
     while (count && *l == *r) {
         count--;
         l++;
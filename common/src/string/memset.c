@@ -11,9 +11,44 @@
 
 #undef memset
 
+#if defined(__x86_64__)
+typedef uint32_t __attribute__((aligned(1), may_alias)) unaligned_u32;
+typedef uint64_t __attribute__((aligned(1), may_alias)) unaligned_u64;
+typedef uint64_t __attribute__((vector_size(16), aligned(1), may_alias)) unaligned_v16;
+
+/* Sets up to 64 bytes with a few (possibly overlapping) unaligned stores, see memcpy(). */
+static inline void set_small(char* d, uint8_t ch, size_t count) {
+    uint64_t pattern = ch * 0x0101010101010101UL;
+    if (count >= 16) {
+        unaligned_v16 v = {pattern, pattern};
+        *(unaligned_v16*)d = v;
+        *(unaligned_v16*)(d + count - 16) = v;
+        if (count > 32) {
+            *(unaligned_v16*)(d + 16) = v;
+            *(unaligned_v16*)(d + count - 32) = v;
+        }
+    } else if (count >= 8) {
+        *(unaligned_u64*)d = pattern;
+        *(unaligned_u64*)(d + count - 8) = pattern;
+    } else if (count >= 4) {
+        *(unaligned_u32*)d = (uint32_t)pattern;
+        *(unaligned_u32*)(d + count - 4) = (uint32_t)pattern;
+    } else if (count) {
+        d[0] = ch;
+        d[count / 2] = ch;
+        d[count - 1] = ch;
+    }
+}
+#endif
+
 void* memset(void* dest, int ch, size_t count) {
     char* d = dest;
 #if defined(__x86_64__)
+    if (count <= 64) {
+        set_small(d, (uint8_t)ch, count);
+        return dest;
+    }
+
     /* "Beginning with processors based on Intel microarchitecture code name Ivy Bridge, REP string
      * operation using MOVSB and STOSB can provide both flexible and high-performance REP string
      * operations for software in common situations like memory copy and set operations"
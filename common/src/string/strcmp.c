@@ -1,8 +1,32 @@
 /* SPDX-License-Identifier: LGPL-3.0-or-later */
 
+#include <stdint.h>
+
 #include "api.h"
 
+/* nonzero iff some byte of `x` is zero */
+#define HAS_ZERO_BYTE(x) (((x) - 0x0101010101010101UL) & ~(x) & 0x8080808080808080UL)
+
+typedef uint64_t __attribute__((may_alias)) word_t;
+
 int strcmp(const char* lhs, const char* rhs) {
+    if (((uintptr_t)lhs ^ (uintptr_t)rhs) % sizeof(uint64_t) == 0) {
+        /* both strings can be read in aligned words (which never cross a page boundary); skip the
+         * equal prefix that way, the rest is compared byte by byte below */
+        for (; !IS_ALIGNED_POW2((uintptr_t)lhs, sizeof(uint64_t)); lhs++, rhs++)
+            if (*lhs != *rhs || !*lhs)
+                return *(unsigned char*)lhs - *(unsigned char*)rhs;
+
+        const word_t* l = (const word_t*)lhs;
+        const word_t* r = (const word_t*)rhs;
+        while (*l == *r && !HAS_ZERO_BYTE(*l)) {
+            l++;
+            r++;
+        }
+        lhs = (const char*)l;
+        rhs = (const char*)r;
+    }
+
     while (*lhs == *rhs && *lhs) {
         lhs++;
         rhs++;
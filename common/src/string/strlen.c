@@ -3,8 +3,15 @@
  *                    Paweł Marczewski <pawel@invisiblethingslab.com>
  */
 
+#include <stdint.h>
+
 #include "api.h"
 
+/* nonzero iff some byte of `x` is zero */
+#define HAS_ZERO_BYTE(x) (((x) - 0x0101010101010101UL) & ~(x) & 0x8080808080808080UL)
+
+typedef uint64_t __attribute__((may_alias)) word_t;
+
 size_t strnlen(const char* str, size_t maxlen) {
     size_t len;
     for (len = 0; len < maxlen && str[len] != '\0'; len++)
@@ -13,8 +20,17 @@ size_t strnlen(const char* str, size_t maxlen) {
 }
 
 size_t strlen(const char* str) {
-    size_t len;
-    for (len = 0; str[len] != '\0'; len++)
+    const char* s = str;
+    for (; !IS_ALIGNED_POW2((uintptr_t)s, sizeof(uint64_t)); s++)
+        if (*s == '\0')
+            return s - str;
+
+    /* aligned word reads never cross a page boundary, so reading past the terminator is safe */
+    const word_t* w = (const word_t*)s;
+    while (!HAS_ZERO_BYTE(*w))
+        w++;
+
+    for (s = (const char*)w; *s != '\0'; s++)
         ;
-    return len;
+    return s - str;
 }
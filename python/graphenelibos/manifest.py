@@ -15,6 +15,7 @@ import sysconfig
 
 import click
 import jinja2
+import toml
 
 from . import (
     _CONFIG_PKGLIBDIR,
@@ -104,6 +105,66 @@ def render(template, variables=None):
     '''Render template, given as string. Optional variables may be given as mapping.'''
     return _env.from_string(template).render(**(variables or {}))
 
+def read_trusted_files_usage(logs):
+    '''Read logs written with `sgx.trusted_files_usage_log`.
+
+    Returns:
+        tuple: chunk size and dict: normalized host path -> (file size, set of indices of chunks
+        read), merged over all logs (i.e. all processes).
+    '''
+    chunk_size = None
+    usage = {}
+    for log in logs:
+        for line in log:
+            if line.startswith('# chunk size '):
+                chunk_size = int(line[len('# chunk size '):].split(';')[0])
+                continue
+            if line.startswith('#') or not line.strip():
+                continue
+            size, chunks, uri = line.rstrip('\n').split(' ', 2)
+            used = usage.setdefault(uri_to_path(uri), (int(size), set()))[1]
+            if chunks == '-':
+                continue
+            for chunk_range in chunks.split(','):
+                first, _, last = chunk_range.partition('-')
+                used.update(range(int(first), int(last or first) + 1))
+    return chunk_size, usage
+
+def uri_to_path(uri):
+    if not uri.startswith('file:'):
+        raise ValueError(f'Unsupported trusted file URI: {uri!r}')
+    return os.path.normpath(uri[len('file:'):])
+
+def minimize_trusted_files(manifest, usage):
+    '''Replace `sgx.trusted_files` of a (not yet signed) manifest with the files which were opened
+    according to `usage` (see :py:func:`read_trusted_files_usage`). Directories are expanded to
+    the files in them, as in graphene-sgx-sign.
+
+    Returns:
+        tuple: number of trusted files before and after
+    '''
+    trusted_files = manifest.get('sgx', {}).get('trusted_files', [])
+    if isinstance(trusted_files, dict):
+        trusted_files = trusted_files.values()
+
+    total = 0
+    kept = []
+    for val in trusted_files:
+        uri = val['uri'] if isinstance(val, dict) else val
+        path = pathlib.Path(uri_to_path(uri))
+        if path.is_dir() and not isinstance(val, dict):
+            sub_paths = sorted(filter(pathlib.Path.is_file, path.rglob('*')))
+            total += len(sub_paths)
+            kept.extend(f'file:{sub_path}' for sub_path in sub_paths
+                        if os.path.normpath(sub_path) in usage)
+        else:
+            total += 1
+            if os.fspath(path) in usage:
+                kept.append(val)
+
+    manifest.setdefault('sgx', {})['trusted_files'] = kept
+    return total, len(kept)
+
 def validate_define(_ctx, _param, values):
     ret = {}
     for value in values:
@@ -117,13 +178,30 @@ def validate_define(_ctx, _param, values):
 @click.command()
 @click.option('--string', '-c')
 @click.option('--define', '-D', multiple=True, callback=validate_define)
+@click.option('--trusted-files-usage', '-u', type=click.File('r'), multiple=True,
+    help='Keep only trusted files opened according to this log (`sgx.trusted_files_usage_log`); '
+         'may be repeated')
 @click.argument('infile', type=click.File('r'), required=False)
 @click.argument('outfile', type=click.File('w'), default='-')
-def main(string, define, infile, outfile):
+def main(string, define, trusted_files_usage, infile, outfile):
     if not bool(string) ^ bool(infile):
         click.get_current_context().fail('specify exactly one of (infile, -c)')
     template = infile.read() if infile else string
-    outfile.write(render(template, define))
+    manifest = render(template, define)
+
+    if trusted_files_usage:
+        chunk_size, usage = read_trusted_files_usage(trusted_files_usage)
+        manifest = toml.loads(manifest)
+        total, kept = minimize_trusted_files(manifest, usage)
+        message = f'Kept {kept} of {total} trusted files'
+        if chunk_size:
+            read_chunks = sum(len(chunks) for _, chunks in usage.values())
+            all_chunks = sum(-(-size // chunk_size) for size, _ in usage.values())
+            message += f' ({read_chunks} of their {all_chunks} chunks were read)'
+        click.echo(message, err=True)
+        manifest = toml.dumps(manifest)
+
+    outfile.write(manifest)
 
 if __name__ == '__main__':
     main() # pylint: disable=no-value-for-parameter
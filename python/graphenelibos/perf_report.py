@@ -0,0 +1,290 @@
+#!/usr/bin/env python3
+# pylint: disable=invalid-name
+
+'''Runs an application natively, under graphene-direct and under graphene-sgx, and reports where
+the Graphene overhead comes from, per category of syscalls.
+
+The application must already have a manifest (`APPLICATION.manifest`). The report is made from
+a copy of it (`APPLICATION-perf-report.manifest`) with `libos.syscall_stats` and
+`sgx.enable_stats` turned on, so that the original manifest and its signature stay untouched.
+Native syscall counts come from `strace -c`, if strace is installed.
+'''
+
+import argparse
+import collections
+import json
+import os
+import re
+import shutil
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+import toml
+
+MODES = ('native', 'graphene-direct', 'graphene-sgx')
+
+CATEGORIES = {
+    'file': '''read write pread64 pwrite64 readv writev preadv pwritev open openat close stat
+        fstat lstat newfstatat statx lseek getdents getdents64 access faccessat fcntl flock
+        truncate ftruncate fsync fdatasync fallocate rename renameat unlink unlinkat mkdir mkdirat
+        rmdir readlink readlinkat statfs fstatfs chmod fchmod fchmodat chown fchown fchownat umask
+        dup dup2 dup3 pipe pipe2 sendfile chdir fchdir getcwd mknod mknodat creat''',
+    'network': '''socket socketpair connect accept accept4 bind listen sendto recvfrom sendmsg
+        recvmsg sendmmsg recvmmsg shutdown getsockopt setsockopt getsockname getpeername''',
+    'polling': '''poll ppoll select pselect6 epoll_create epoll_create1 epoll_ctl epoll_wait
+        epoll_pwait eventfd eventfd2''',
+    'memory': 'mmap munmap mprotect brk mremap madvise mincore msync mlock munlock mbind',
+    'process': '''clone clone3 fork vfork execve exit exit_group wait4 waitid kill tkill tgkill
+        getpid getppid gettid set_tid_address prctl arch_prctl setpgid getpgid getpgrp setsid
+        getsid getuid geteuid getgid getegid setuid setgid getgroups setgroups getrlimit
+        setrlimit prlimit64 sched_getaffinity sched_setaffinity getrusage uname sysinfo
+        getcpu''',
+    'signal': '''rt_sigaction rt_sigprocmask rt_sigreturn rt_sigsuspend rt_sigtimedwait
+        rt_sigpending rt_sigqueueinfo sigaltstack pause''',
+    'sync': 'futex set_robust_list get_robust_list sched_yield',
+    'time': '''clock_gettime clock_getres clock_nanosleep gettimeofday time nanosleep getitimer
+        setitimer alarm''',
+}
+SYSCALL_CATEGORY = {name: category
+                    for category, names in CATEGORIES.items() for name in names.split()}
+CATEGORY_ORDER = tuple(CATEGORIES) + ('other',)
+
+SYSCALL_STATS_LINE = re.compile(r'^(\w+) (\d+) (\d+) \d+ \|')
+SGX_COUNTERS = {
+    'eenter': re.compile(r'# of EENTERs:\s+(\d+)'),
+    'eexit': re.compile(r'# of EEXITs:\s+(\d+)'),
+    'aex': re.compile(r'# of AEXs:\s+(\d+)'),
+}
+OCALL_LINE = re.compile(r'\{"pid": .*\}')
+
+argparser = argparse.ArgumentParser(
+    description='Compare an application under Graphene against its native run.')
+argparser.add_argument('--runs', '-n', type=int, default=3, metavar='RUNS',
+                       help='Number of timed runs in each mode (the median is reported)')
+argparser.add_argument('--key', metavar='KEY', default=os.environ.get('SGX_SIGNER_KEY'),
+                       help='Enclave signing key (default: $SGX_SIGNER_KEY)')
+argparser.add_argument('--no-sgx', action='store_true',
+                       help='Skip graphene-sgx (e.g. on machines without SGX)')
+argparser.add_argument('--no-strace', action='store_true',
+                       help='Do not count native syscalls with strace')
+argparser.add_argument('--json', action='store_true',
+                       help='Print the report as JSON instead of a table')
+argparser.add_argument('application', metavar='APPLICATION',
+                       help='Executable with an APPLICATION.manifest next to it')
+argparser.add_argument('args', nargs=argparse.REMAINDER, metavar='ARGS',
+                       help='Arguments of the application')
+
+
+def prepare(app):
+    '''Creates `APP-perf-report` (a symlink to the executable) and its manifest with the stats
+    turned on. Returns the path of the symlink.'''
+    with open(app + '.manifest') as f:
+        manifest = toml.load(f)
+
+    manifest.setdefault('libos', {})['syscall_stats'] = True
+    sgx = manifest.setdefault('sgx', {})
+    sgx['enable_stats'] = True
+    # the stats are only collected in debug enclaves
+    sgx['debug'] = True
+
+    variant = app + '-perf-report'
+    if os.path.lexists(variant):
+        os.unlink(variant)
+    os.symlink(os.path.realpath(app), variant)
+    with open(variant + '.manifest', 'w') as f:
+        toml.dump(manifest, f)
+    return variant
+
+
+def sign(variant, key):
+    '''Signs the manifest of the variant and gets its launch token.'''
+    # imported here, because these modules are only installed with SGX support
+    from . import sgx_get_token, sgx_sign # pylint: disable=import-outside-toplevel
+
+    sgx_sign.main(['--key', key, '--manifest', variant + '.manifest',
+                   '--output', variant + '.manifest.sgx'])
+    sgx_get_token.main(['--sig', variant + '.sig', '--output', variant + '.token'])
+
+
+def run(cmd, runs):
+    '''Runs `cmd` `runs` times and returns the median wall-clock time and the stderr of the last
+    run.'''
+    times = []
+    stderr = ''
+    for _ in range(runs):
+        start = time.monotonic()
+        proc = subprocess.run(cmd, stdout=subprocess.DEVNULL, stderr=subprocess.PIPE,
+                              universal_newlines=True, check=False)
+        times.append(time.monotonic() - start)
+        stderr = proc.stderr
+        if proc.returncode:
+            sys.stderr.write(stderr)
+            raise RuntimeError(f'{" ".join(cmd)} failed with exit code {proc.returncode}')
+    return statistics.median(times), stderr
+
+
+def parse_syscall_stats(output):
+    '''Returns {syscall: [calls, cycles]} summed over all processes in `output`.'''
+    stats = collections.defaultdict(lambda: [0, 0])
+    in_stats = False
+    for line in output.splitlines():
+        if '----- Syscall stats -----' in line:
+            in_stats = True
+            continue
+        match = SYSCALL_STATS_LINE.match(line) if in_stats else None
+        if not match:
+            in_stats = False
+            continue
+        stats[match.group(1)][0] += int(match.group(2))
+        stats[match.group(1)][1] += int(match.group(3))
+    return stats
+
+
+def parse_sgx_stats(output):
+    '''Returns the process-wide SGX counters and {ocall: [count, exitless_count, cycles]}, both
+    summed over all processes in `output`.'''
+    counters = dict.fromkeys(SGX_COUNTERS, 0)
+    ocalls = collections.defaultdict(lambda: [0, 0, 0])
+    in_total = False
+    for line in output.splitlines():
+        if '----- ' in line:
+            in_total = 'Total SGX stats for process' in line
+        if in_total:
+            for name, regex in SGX_COUNTERS.items():
+                match = regex.search(line)
+                if match:
+                    counters[name] += int(match.group(1))
+        match = OCALL_LINE.search(line)
+        if match:
+            ocall = json.loads(match.group(0))
+            stats = ocalls[ocall['ocall']]
+            stats[0] += ocall['count']
+            stats[1] += ocall['exitless_count']
+            stats[2] += ocall['cycles']
+    return counters, ocalls
+
+
+def parse_strace(path):
+    '''Returns {syscall: [calls, seconds]} from the summary of `strace -c`.'''
+    stats = {}
+    with open(path) as f:
+        for line in f:
+            fields = line.split()
+            # % time, seconds, usecs/call, calls, [errors,] syscall
+            if len(fields) < 5 or not fields[3].isdigit() or fields[-1] == 'total':
+                continue
+            stats[fields[-1]] = [int(fields[3]), float(fields[1])]
+    return stats
+
+
+def by_category(stats):
+    '''Sums per-syscall [calls, time] pairs per category.'''
+    categories = {category: [0, 0] for category in CATEGORY_ORDER}
+    for name, (calls, spent) in stats.items():
+        category = categories[SYSCALL_CATEGORY.get(name, 'other')]
+        category[0] += calls
+        category[1] += spent
+    return categories
+
+
+def collect(args):
+    '''Runs the application in all modes and returns the raw results.'''
+    app = args.application
+    report = {'application': app, 'runs': args.runs, 'time': {}, 'syscalls': {}}
+
+    report['time']['native'], _ = run([app] + args.args, args.runs)
+    if not args.no_strace and shutil.which('strace'):
+        with tempfile.NamedTemporaryFile(suffix='.strace') as f:
+            run(['strace', '-f', '-c', '-o', f.name, app] + args.args, 1)
+            report['syscalls']['native'] = by_category(parse_strace(f.name))
+
+    variant = prepare(app)
+    report['time']['graphene-direct'], output = run(['graphene-direct', variant] + args.args,
+                                                    args.runs)
+    report['syscalls']['graphene-direct'] = by_category(parse_syscall_stats(output))
+
+    if not args.no_sgx:
+        if not args.key:
+            raise RuntimeError('graphene-sgx needs a signing key (--key or $SGX_SIGNER_KEY)')
+        sign(variant, args.key)
+        report['time']['graphene-sgx'], output = run(['graphene-sgx', variant] + args.args,
+                                                     args.runs)
+        report['syscalls']['graphene-sgx'] = by_category(parse_syscall_stats(output))
+        report['sgx'], ocalls = parse_sgx_stats(output)
+        report['ocalls'] = {ocall: dict(zip(('count', 'exitless_count', 'cycles'), stats))
+                            for ocall, stats in sorted(ocalls.items(),
+                                                       key=lambda item: -item[1][2])}
+    return report
+
+
+def print_report(report):
+    native = report['time']['native']
+    print(f'Application: {report["application"]} (median of {report["runs"]} runs)')
+    print()
+    print(f'{"mode":<16} {"time [s]":>10} {"slowdown":>9}')
+    for mode in MODES:
+        if mode in report['time']:
+            spent = report['time'][mode]
+            print(f'{mode:<16} {spent:>10.3f} {spent / native:>8.2f}x')
+
+    syscalls = report['syscalls']
+    direct = syscalls['graphene-direct']
+    sgx = syscalls.get('graphene-sgx')
+    total_direct = sum(cycles for _, cycles in direct.values()) or 1
+    total_sgx = (sum(cycles for _, cycles in sgx.values()) if sgx else 0) or 1
+
+    print()
+    print('Syscalls per category (Graphene time is in million TSC cycles spent in LibOS)')
+    header = f'{"category":<10} {"native calls":>12} {"direct calls":>12} {"direct Mcyc":>12}'
+    if sgx:
+        header += f' {"sgx calls":>10} {"sgx Mcyc":>10} {"sgx/direct":>10} {"sgx share":>9}'
+    print(header)
+    for category in CATEGORY_ORDER:
+        native_calls = syscalls['native'][category][0] if 'native' in syscalls else '-'
+        calls, cycles = direct[category]
+        line = f'{category:<10} {native_calls:>12} {calls:>12} {cycles / 1e6:>12.1f}'
+        if sgx:
+            sgx_calls, sgx_cycles = sgx[category]
+            ratio = f'{sgx_cycles / cycles:.2f}x' if cycles else '-'
+            line += (f' {sgx_calls:>10} {sgx_cycles / 1e6:>10.1f} {ratio:>10}'
+                     f' {100 * sgx_cycles / total_sgx:>8.1f}%')
+        if calls or (sgx and sgx[category][0]):
+            print(line)
+    print(f'(graphene-direct spent {total_direct / 1e6:.1f} Mcycles in syscalls in total)')
+
+    if sgx:
+        counters = report['sgx']
+        print()
+        print(f'SGX: {counters["eenter"]} EENTERs, {counters["eexit"]} EEXITs, '
+              f'{counters["aex"]} AEXs')
+        print('Top OCALLs by cycles (indices of `enum ocall_index` in ocall_types.h):')
+        print(f'{"ocall":>6} {"count":>10} {"exitless":>10} {"Mcycles":>10}')
+        for ocall, stats in list(report['ocalls'].items())[:10]:
+            print(f'{ocall:>6} {stats["count"]:>10} {stats["exitless_count"]:>10} '
+                  f'{stats["cycles"] / 1e6:>10.1f}')
+
+
+def main(args=None):
+    args = argparser.parse_args(args)
+    if args.runs < 1:
+        argparser.error('RUNS must be at least 1')
+
+    try:
+        report = collect(args)
+    except (OSError, RuntimeError) as e:
+        print(f'{argparser.prog}: {e}', file=sys.stderr)
+        return 1
+
+    if args.json:
+        json.dump(report, sys.stdout, indent=4)
+        print()
+    else:
+        print_report(report)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
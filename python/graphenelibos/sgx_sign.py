@@ -5,13 +5,17 @@
 #                    Michał Kowalczyk <mkow@invisiblethingslab.com>
 
 import argparse
+import array
+import concurrent.futures
 import datetime
 import hashlib
+import json
 import os
 from pathlib import Path
 import struct
 import subprocess
-from sys import stderr
+from sys import byteorder, stderr
+import time
 
 import toml
 
@@ -155,9 +159,96 @@ def sha256(data):
     return sha.digest()
 
 
-def get_hash(filename):
+def get_hash(filename, hash_cache=None):
+    if hash_cache is not None:
+        hash_ = hash_cache.lookup(filename)
+        if hash_ is not None:
+            return hash_
+
+    hashing_start = time.time_ns()
+    sha = hashlib.sha256()
     with open(filename, 'rb') as file:
-        return sha256(file.read())
+        for chunk in iter(lambda: file.read(1024 * 1024), b''):
+            sha.update(chunk)
+    hash_ = sha.digest()
+
+    if hash_cache is not None:
+        hash_cache.store(filename, hash_, hashing_start)
+    return hash_
+
+
+def get_chunk_hashes(filename):
+    '''Computes the hashes of a trusted file as verified by the enclave when the file is opened.
+
+    Returns the SHA256 hash of the whole file, the concatenated 128-bit (truncated SHA256) hashes
+    of its TRUSTED_CHUNK_SIZE-sized chunks, and the "root" SHA256 hash over the file size and the
+    chunk hashes, which is stored in the manifest.
+    '''
+    file_sha = hashlib.sha256()
+    chunk_hashes = bytearray()
+    size = 0
+    with open(filename, 'rb') as file:
+        for chunk in iter(lambda: file.read(offs.TRUSTED_CHUNK_SIZE), b''):
+            file_sha.update(chunk)
+            chunk_hashes += sha256(chunk)[:16]
+            size += len(chunk)
+    root_hash = sha256(struct.pack('<Q', size) + chunk_hashes)
+    return file_sha.digest(), bytes(chunk_hashes), root_hash
+
+
+class HashCache:
+    '''Persistent cache of trusted-file hashes.
+
+    Entries are keyed by the absolute path of the file and are valid as long as its size, mtime
+    and inode number do not change.
+    '''
+
+    VERSION = 1
+
+    def __init__(self, path):
+        self.path = path
+        self.entries = {}
+        try:
+            with open(path, 'r', encoding='UTF-8') as file:
+                data = json.load(file)
+            if data.get('version') == self.VERSION:
+                self.entries = data['entries']
+        except FileNotFoundError:
+            pass
+        except (ValueError, KeyError, AttributeError, OSError) as exc:
+            # a broken cache is not fatal, we just start from scratch
+            print(f'Ignoring invalid hash cache {path}: {exc}', file=stderr)
+
+    @staticmethod
+    def _key(filename):
+        return os.path.abspath(filename)
+
+    @staticmethod
+    def _stat_fields(stat):
+        return {'size': stat.st_size, 'mtime_ns': stat.st_mtime_ns, 'ino': stat.st_ino}
+
+    def lookup(self, filename):
+        entry = self.entries.get(self._key(filename))
+        if entry is None:
+            return None
+        fields = self._stat_fields(os.stat(filename))
+        if any(entry.get(name) != value for name, value in fields.items()):
+            return None
+        return bytes.fromhex(entry['sha256'])
+
+    def store(self, filename, hash_, hashing_start):
+        stat = os.stat(filename)
+        # a file modified within the mtime granularity around hashing may have changed without
+        # changing its mtime ("racily clean"), so it is not cached
+        if stat.st_mtime_ns >= hashing_start - 1_000_000_000:
+            return
+        self.entries[self._key(filename)] = {**self._stat_fields(stat), 'sha256': hash_.hex()}
+
+    def save(self):
+        tmp_path = f'{self.path}.tmp{os.getpid()}'
+        with open(tmp_path, 'w', encoding='UTF-8') as file:
+            json.dump({'version': self.VERSION, 'entries': self.entries}, file)
+        os.replace(tmp_path, self.path)
 
 
 def walk_dir(path):
@@ -188,7 +279,13 @@ def append_trusted_dir_or_file(targets, val, check_exist):
     else:
         targets.append((uri_, path, hash_))
 
-def get_trusted_files(manifest, check_exist=True, do_hash=True):
+def get_trusted_files(manifest, check_exist=True, do_hash=True, hash_cache=None,
+                      chunk_hashes=None, jobs=None):
+    '''If `chunk_hashes` is a dict, chunk hashes of files larger than a single chunk are also
+    computed (in the same pass as the whole-file hash) and stored there, keyed by host path.
+
+    Files are hashed by `jobs` threads (by default, one per CPU); hashlib releases the GIL while
+    hashing, so this scales with the number of cores on big file trees.'''
     targets = [] # tuple of graphene-uri, host-path, hash-of-host-file (can be None)
 
     preload_str = manifest['loader']['preload']
@@ -208,13 +305,21 @@ def get_trusted_files(manifest, check_exist=True, do_hash=True):
     if not do_hash:
         return targets
 
-    hashed_targets = []
-    for (uri, target, hash_) in targets:
-        if hash_ is None:
-            hash_ = get_hash(target).hex()
-        hashed_targets.append((uri, target, hash_))
+    def hash_target(target, hash_):
+        if hash_ is None and chunk_hashes is not None and \
+                os.path.getsize(target) > offs.TRUSTED_CHUNK_SIZE:
+            file_hash, chunks, root_hash = get_chunk_hashes(target)
+            # dict updates are atomic, no lock needed
+            chunk_hashes[str(target)] = (chunks, root_hash)
+            hash_ = file_hash.hex()
+        elif hash_ is None:
+            hash_ = get_hash(target, hash_cache).hex()
+        return hash_
 
-    return hashed_targets
+    with concurrent.futures.ThreadPoolExecutor(max_workers=jobs) as executor:
+        hashes = executor.map(hash_target, [target for _, target, _ in targets],
+                              [hash_ for _, _, hash_ in targets])
+        return [(uri, target, hash_) for (uri, target, _), hash_ in zip(targets, hashes)]
 
 
 # Populate Enclave Memory
@@ -367,6 +472,7 @@ def gen_area_content(attr, areas, enclave_base, enclave_heap_min):
         struct.pack_into('<Q', tls_data, t * offs.PAGESIZE + offset, value)
 
     enclave_heap_max = pal_area.addr
+    pal_entry_offset = pal_area.addr + entry_point(pal_area.elf_filename) - enclave_base
 
     # Sanity check that we measure everything except the heap which is zeroed
     # on enclave startup.
@@ -383,8 +489,7 @@ def gen_area_content(attr, areas, enclave_base, enclave_heap_min):
         ssa_offset = ssa - enclave_base
         set_tcs_field(t, offs.TCS_OSSA, '<Q', ssa_offset)
         set_tcs_field(t, offs.TCS_NSSA, '<L', offs.SSA_FRAME_NUM)
-        set_tcs_field(t, offs.TCS_OENTRY, '<Q',
-                      pal_area.addr + entry_point(pal_area.elf_filename) - enclave_base)
+        set_tcs_field(t, offs.TCS_OENTRY, '<Q', pal_entry_offset)
         set_tcs_field(t, offs.TCS_OGS_BASE, '<Q', tls_area.addr - enclave_base + offs.PAGESIZE * t)
         set_tcs_field(t, offs.TCS_OFS_LIMIT, '<L', 0xfff)
         set_tcs_field(t, offs.TCS_OGS_LIMIT, '<L', 0xfff)
@@ -402,6 +507,7 @@ def gen_area_content(attr, areas, enclave_base, enclave_heap_min):
         set_tls_field(t, offs.SGX_MANIFEST_SIZE, len(manifest_area.content))
         set_tls_field(t, offs.SGX_HEAP_MIN, enclave_heap_min)
         set_tls_field(t, offs.SGX_HEAP_MAX, enclave_heap_max)
+        set_tls_field(t, offs.SGX_EDMM_ENABLED, int(attr['edmm_enable']))
 
     tcs_area.content = tcs_data
     tls_area.content = tls_data
@@ -438,8 +544,19 @@ def populate_memory_areas(attr, areas, enclave_base, enclave_heap_min):
 
     gen_area_content(attr, areas, enclave_base, enclave_heap_min)
 
+    if attr['edmm_enable']:
+        # with EDMM, free (heap) pages are not EADDed at enclave build time but EAUGed on demand
+        return areas
+
     return areas + free_areas
 
+def offsets_array(start, count, step):
+    '''Array of `count` 64-bit little-endian offsets, starting at `start`.'''
+    offsets = array.array('Q', range(start, start + count * step, step))
+    if byteorder != 'little':
+        offsets.byteswap()
+    return offsets
+
 def generate_measurement(enclave_base, attr, areas):
     # pylint: disable=too-many-statements,too-many-branches,too-many-locals
 
@@ -447,29 +564,45 @@ def generate_measurement(enclave_base, attr, areas):
         data = struct.pack('<8sLQ44s', b'ECREATE', offs.SSA_FRAME_SIZE // offs.PAGESIZE, size, b'')
         digest.update(data)
 
-    def do_eadd(digest, offset, flags):
-        assert offset < attr['enclave_size']
-        data = struct.pack('<8sQQ40s', b'EADD', offset, flags, b'')
-        digest.update(data)
-
-    def do_eextend(digest, offset, content):
-        assert offset < attr['enclave_size']
-
-        if len(content) != 256:
-            raise ValueError('Exactly 256 bytes expected')
-
-        data = struct.pack('<8sQ48s', b'EEXTEND', offset, b'')
-        digest.update(data)
-        digest.update(content)
-
     def include_page(digest, addr, flags, content, measure):
         if len(content) != offs.PAGESIZE:
             raise ValueError('Exactly one page expected')
 
-        do_eadd(digest, addr - enclave_base, flags)
+        offset = addr - enclave_base
+        assert offset < attr['enclave_size']
+        records = [struct.pack('<8sQQ40s', b'EADD', offset, flags, b'')]
         if measure:
             for i in range(0, offs.PAGESIZE, 256):
-                do_eextend(digest, addr - enclave_base + i, content[i:i + 256])
+                records.append(struct.pack('<8sQ48s', b'EEXTEND', offset + i, b''))
+                records.append(content[i:i + 256])
+        digest.update(b''.join(records))
+
+    def include_zero_pages(digest, addr, size, flags, measure):
+        # equivalent to include_page() with ZERO_PAGE for each page of the area; areas like the heap
+        # span millions of pages, so the records are not packed page by page: the records of a batch
+        # of pages are copies of one template and differ only in the offsets, which are filled in
+        # as whole columns of 64-bit words
+        assert addr - enclave_base + size <= attr['enclave_size']
+        eadd = struct.pack('<8sQQ40s', b'EADD', 0, flags, b'')
+        eextend = struct.pack('<8sQ48s', b'EEXTEND', 0, b'') + bytes(256)
+        template = eadd + eextend * (offs.PAGESIZE // 256) if measure else eadd
+        page_words = len(template) // 8
+        batch_pages = max(1, (4 << 20) // len(template))
+
+        start = addr - enclave_base
+        end = start + size
+        for batch in range(start, end, batch_pages * offs.PAGESIZE):
+            count = min(batch_pages, (end - batch) // offs.PAGESIZE)
+            records = bytearray(template * count)
+            words = memoryview(records).cast('Q')
+            # the offset is the second word of both EADD and EEXTEND records
+            words[1::page_words] = offsets_array(batch, count, offs.PAGESIZE)
+            if measure:
+                for i in range(offs.PAGESIZE // 256):
+                    first = (len(eadd) + i * len(eextend)) // 8 + 1
+                    words[first::page_words] = offsets_array(batch + i * 256, count,
+                                                             offs.PAGESIZE)
+            digest.update(records)
 
     mrenclave = hashlib.sha256()
     do_ecreate(mrenclave, attr['enclave_size'])
@@ -555,14 +688,15 @@ def generate_measurement(enclave_base, attr, areas):
                         desc = 'data'
                     load_file(mrenclave, file, offset, baseaddr_ + addr, filesize, memsize,
                               desc, flags)
+        elif area.content is None:
+            include_zero_pages(mrenclave, area.addr, area.size, area.flags, area.measure)
+            print_area(area.addr, area.size, area.flags, area.desc, area.measure)
         else:
             for addr in range(area.addr, area.addr + area.size, offs.PAGESIZE):
-                data = ZERO_PAGE
-                if area.content is not None:
-                    start = addr - area.addr
-                    end = start + offs.PAGESIZE
-                    data = area.content[start:end]
-                    data += b'\0' * (offs.PAGESIZE - len(data)) # pad last page
+                start = addr - area.addr
+                end = start + offs.PAGESIZE
+                data = area.content[start:end]
+                data += b'\0' * (offs.PAGESIZE - len(data)) # pad last page
                 include_page(mrenclave, addr, area.flags, data, area.measure)
 
             print_area(area.addr, area.size, area.flags, area.desc,
@@ -650,14 +784,14 @@ def generate_sigstruct(attr, args, mrenclave):
 
 argparser = argparse.ArgumentParser()
 argparser.add_argument('--output', '-output', metavar='OUTPUT',
-                       type=str, required=True,
+                       type=str, required=False,
                        help='Output .manifest.sgx file '
                             '(manifest augmented with autogenerated fields)')
 argparser.add_argument('--libpal', '-libpal', metavar='LIBPAL',
                        type=str,
                        help='Input libpal file (by default it gets the installed one)')
 argparser.add_argument('--key', '-key', metavar='KEY',
-                       type=str, required=True,
+                       type=str, required=False,
                        help='specify signing key(.pem) file')
 argparser.add_argument('--manifest', '-manifest', metavar='MANIFEST',
                        type=str, required=True,
@@ -666,6 +800,16 @@ argparser.add_argument('--manifest', '-manifest', metavar='MANIFEST',
 argparser.add_argument('--depend', '-depend',
                        action='store_true', required=False,
                        help='Generate dependency for Makefile')
+argparser.add_argument('--cache', '-cache', metavar='CACHE',
+                       type=str, required=False,
+                       help='File with cached hashes of trusted files, reused across runs '
+                            '(created if it does not exist)')
+argparser.add_argument('--cache-only', '-cache-only',
+                       action='store_true', required=False,
+                       help='Only hash the trusted files into the --cache file, do not sign')
+argparser.add_argument('--jobs', '-j', metavar='JOBS',
+                       type=int, required=False,
+                       help='Number of threads hashing trusted files (default: number of CPUs)')
 
 argparser.set_defaults(libpal=os.path.join(_CONFIG_PKGLIBDIR, 'sgx/libpal.so'))
 
@@ -676,7 +820,20 @@ def parse_args(args):
         'libpal': args.libpal,
         'key': args.key,
         'manifest': args.manifest,
+        'cache': args.cache,
+        'jobs': args.jobs,
     }
+    if args.cache_only:
+        if args.cache is None:
+            argparser.error('--cache-only requires --cache')
+            return None
+        args_dict['cache_only'] = True
+        return args_dict
+
+    if args.output is None:
+        argparser.error('an output file is required')
+        return None
+
     if args.depend:
         args_dict['depend'] = True
     else:
@@ -707,6 +864,8 @@ def read_manifest(path):
     sgx.setdefault('require_pkru', False)
     sgx.setdefault('support_exinfo', False)
     sgx.setdefault('nonpie_binary', False)
+    sgx.setdefault('edmm_enable', False)
+    sgx.setdefault('lazy_trusted_files', False)
     sgx.setdefault('enable_stats', False)
 
     loader = manifest.setdefault('loader', {})
@@ -729,6 +888,7 @@ def main_sign(manifest, args):
     attr['thread_num'] = manifest_sgx['thread_num']
     attr['isv_prod_id'] = manifest_sgx['isvprodid']
     attr['isv_svn'] = manifest_sgx['isvsvn']
+    attr['edmm_enable'] = manifest_sgx['edmm_enable']
     attr['flags'], attr['xfrms'], attr['misc_select'] = get_enclave_attributes(manifest)
     today = datetime.date.today()
     attr['year'] = today.year
@@ -740,6 +900,7 @@ def main_sign(manifest, args):
     print(f'    thread_num:  {attr["thread_num"]}')
     print(f'    isv_prod_id: {attr["isv_prod_id"]}')
     print(f'    isv_svn:     {attr["isv_svn"]}')
+    print(f'    edmm:        {attr["edmm_enable"]}')
     print(f'    attr.flags:  {attr["flags"].hex()}')
     print(f'    attr.xfrm:   {attr["xfrms"].hex()}')
     print(f'    misc_select: {attr["misc_select"].hex()}')
@@ -758,11 +919,31 @@ def main_sign(manifest, args):
 
     # Use `list()` to ensure non-laziness (`manifest_sgx` is a part of `manifest`, and we'll be
     # changing it while iterating).
-    expanded_trusted_files = list(get_trusted_files(manifest))
+    hash_cache = HashCache(args['cache']) if args.get('cache') else None
+    chunk_hashes = {} if manifest_sgx['lazy_trusted_files'] else None
+    expanded_trusted_files = list(get_trusted_files(manifest, hash_cache=hash_cache,
+                                                    chunk_hashes=chunk_hashes, jobs=args['jobs']))
+    if hash_cache is not None:
+        hash_cache.save()
     manifest_sgx['trusted_files'] = [] # generate the list from scratch, dropping directory entries
+    chunk_hashes_data = bytearray()
     for val in expanded_trusted_files:
-        uri, _, hash_ = val
-        manifest_sgx['trusted_files'].append({'uri': uri, 'sha256': hash_})
+        uri, target, hash_ = val
+        entry = {'uri': uri, 'sha256': hash_}
+        if chunk_hashes and str(target) in chunk_hashes:
+            # only the root hash is measured (as part of the manifest); the chunk hashes themselves
+            # are shipped in a separate file and verified by the enclave against the root hash
+            chunks, root_hash = chunk_hashes[str(target)]
+            entry['chunk_hashes_sha256'] = root_hash.hex()
+            entry['chunk_hashes_offset'] = len(chunk_hashes_data)
+            chunk_hashes_data += chunks
+        manifest_sgx['trusted_files'].append(entry)
+
+    if chunk_hashes is not None:
+        chunk_hashes_uri = manifest_sgx.setdefault('trusted_chunk_hashes_file',
+                                                   f'file:{args["output"]}.chunks')
+        with open(resolve_uri(chunk_hashes_uri, check_exist=False), 'wb') as file:
+            file.write(chunk_hashes_data)
 
     # Populate memory areas
     memory_areas = get_memory_areas(attr, args)
@@ -826,6 +1007,13 @@ def make_depend(manifest, args):
     return 0
 
 
+def update_hash_cache(manifest, args):
+    hash_cache = HashCache(args['cache'])
+    get_trusted_files(manifest, hash_cache=hash_cache, jobs=args['jobs'])
+    hash_cache.save()
+    return 0
+
+
 def main(args=None):
     args = parse_args(args)
     if args is None:
@@ -838,6 +1026,8 @@ def main(args=None):
         print(f'Parsing {manifest_path} as TOML failed: {exc}', file=stderr)
         return 1
 
+    if args.get('cache_only'):
+        return update_hash_cache(manifest, args)
     if args.get('depend'):
         return make_depend(manifest, args)
     return main_sign(manifest, args)
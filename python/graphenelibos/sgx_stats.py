@@ -0,0 +1,98 @@
+#!/usr/bin/env python3
+# pylint: disable=invalid-name
+
+'''Reader of the live SGX stats file (see `sgx.stats_file` in the manifest syntax docs).'''
+
+import argparse
+import struct
+import sys
+import time
+
+STATS_MAGIC = 0x5354415453584753
+STATS_VERSION = 1
+
+HEADER = struct.Struct('<QIIIIQ')
+OCALL = struct.Struct('<QQQ')
+THREAD = struct.Struct('<IiQQQQQ')
+
+THREAD_COUNTERS = ('eenter', 'eexit', 'aex', 'sync_signal', 'async_signal')
+
+argparser = argparse.ArgumentParser()
+argparser.add_argument('file', metavar='FILE',
+                       help='Stats file of a running enclave (`sgx.stats_file` + `.<pid>`)')
+argparser.add_argument('--prometheus', action='store_true',
+                       help='Print in the Prometheus text exposition format')
+argparser.add_argument('--interval', type=float, metavar='SECONDS',
+                       help='Print repeatedly, every SECONDS seconds')
+
+
+def read_stats(path):
+    '''Returns a snapshot of the stats file as a dict. Counters are read without synchronization
+    with the enclave, so the snapshot may be slightly inconsistent.'''
+    with open(path, 'rb') as f:
+        data = f.read()
+
+    magic, version, pid, ocalls_cnt, threads_cnt, start_time = HEADER.unpack_from(data, 0)
+    if magic != STATS_MAGIC:
+        raise ValueError(f'{path}: not an SGX stats file')
+    if version != STATS_VERSION:
+        raise ValueError(f'{path}: unsupported version {version}')
+
+    offset = HEADER.size
+    ocalls = []
+    for i in range(ocalls_cnt):
+        cnt, exitless_cnt, cycles = OCALL.unpack_from(data, offset)
+        offset += OCALL.size
+        if cnt:
+            ocalls.append({'ocall': i, 'cnt': cnt, 'exitless_cnt': exitless_cnt,
+                           'cycles': cycles})
+
+    threads = []
+    for _ in range(threads_cnt):
+        tid, ocall, *counters = THREAD.unpack_from(data, offset)
+        offset += THREAD.size
+        if tid:
+            threads.append({'tid': tid, 'ocall': ocall, **dict(zip(THREAD_COUNTERS, counters))})
+
+    return {'pid': pid, 'start_time': start_time, 'ocalls': ocalls, 'threads': threads}
+
+
+def print_text(stats):
+    print(f'pid {stats["pid"]}, up {time.time() - stats["start_time"] / 1e6:.1f}s')
+    print('ocall        count     exitless          cycles')
+    for o in stats['ocalls']:
+        print(f'{o["ocall"]:5} {o["cnt"]:12} {o["exitless_cnt"]:12} {o["cycles"]:15}')
+    print('    tid  ocall       eenter        eexit          aex  sync_sig async_sig')
+    for t in stats['threads']:
+        ocall = t['ocall'] if t['ocall'] >= 0 else '-'
+        print(f'{t["tid"]:7} {ocall:>6} {t["eenter"]:12} {t["eexit"]:12} {t["aex"]:12}'
+              f' {t["sync_signal"]:9} {t["async_signal"]:9}')
+
+
+def print_prometheus(stats):
+    pid = stats['pid']
+    for name in ('cnt', 'exitless_cnt', 'cycles'):
+        print(f'# TYPE graphene_sgx_ocall_{name} counter')
+        for o in stats['ocalls']:
+            print(f'graphene_sgx_ocall_{name}{{pid="{pid}",ocall="{o["ocall"]}"}} {o[name]}')
+    for name in THREAD_COUNTERS:
+        print(f'# TYPE graphene_sgx_thread_{name} counter')
+        for t in stats['threads']:
+            print(f'graphene_sgx_thread_{name}{{pid="{pid}",tid="{t["tid"]}"}} {t[name]}')
+
+
+def main(args=None):
+    args = argparser.parse_args(args)
+    printer = print_prometheus if args.prometheus else print_text
+
+    while True:
+        try:
+            stats = read_stats(args.file)
+        except (OSError, ValueError, struct.error) as e:
+            print(e, file=sys.stderr)
+            return 1
+        printer(stats)
+        if args.interval is None:
+            return 0
+        sys.stdout.flush()
+        time.sleep(args.interval)
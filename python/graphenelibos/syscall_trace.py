@@ -0,0 +1,132 @@
+#!/usr/bin/env python3
+# pylint: disable=invalid-name
+
+'''Decodes binary syscall traces written by LibOS with `libos.syscall_trace_file`.
+
+The trace starts with a header and the syscall table of the LibOS that wrote it (names and how to
+print the return value and the arguments), so the decoder does not need to match the Graphene
+version. Only raw argument values are recorded, pointers are not dereferenced.
+'''
+
+import argparse
+import collections
+import struct
+import sys
+
+MAGIC = b'GSYSTRC1'
+VERSION = 1
+HEADER = struct.Struct('<8sIIIIQ')
+RECORD = struct.Struct('<QQIIq6Q')
+
+argparser = argparse.ArgumentParser(
+    description='Print a binary syscall trace of Graphene.')
+argparser.add_argument('--summary', '-s', action='store_true',
+                       help='Print per-syscall totals instead of every call')
+argparser.add_argument('--tid', type=int, action='append', metavar='TID',
+                       help='Only show calls of this thread (may be repeated)')
+argparser.add_argument('trace', metavar='TRACE', type=argparse.FileType('rb'),
+                       help='Trace file (`<libos.syscall_trace_file>.<pid>`)')
+
+
+class TraceError(Exception):
+    pass
+
+
+def read_trace(f):
+    data = f.read(HEADER.size)
+    if len(data) < HEADER.size:
+        raise TraceError('file too short')
+    magic, version, record_size, pid, names_size, tsc_hz = HEADER.unpack(data)
+    if magic != MAGIC:
+        raise TraceError('not a Graphene syscall trace')
+    if version != VERSION or record_size != RECORD.size:
+        raise TraceError(f'unsupported trace version {version} (record size {record_size})')
+
+    syscalls = {}
+    for line in f.read(names_size).decode('ascii').splitlines():
+        nr, name, *kinds = line.split(' ')
+        syscalls[int(nr)] = (name, kinds[0] if kinds else '')
+
+    records = []
+    while True:
+        data = f.read(RECORD.size)
+        if len(data) < RECORD.size:
+            break
+        start, end, tid, sysno, ret, *args = RECORD.unpack(data)
+        records.append((start, end, tid, sysno, ret, args))
+    records.sort()
+    return pid, tsc_hz, syscalls, records
+
+
+def format_value(kind, value):
+    signed = value - (1 << 64) if value >= 1 << 63 else value
+    if kind == 'i':
+        return str(struct.unpack('<i', struct.pack('<I', value & 0xffffffff))[0])
+    if kind == 'l':
+        return str(signed)
+    if kind == 'r' and -4096 < signed < 0:
+        return str(signed)
+    return hex(value)
+
+
+def format_call(syscalls, sysno, ret, args):
+    name, kinds = syscalls.get(sysno, (f'syscall_{sysno}', ''))
+    ret_kind, arg_kinds = (kinds[0], kinds[1:]) if kinds else ('l', 'xxxxxx')
+    args_str = ', '.join(format_value(kind, arg) for kind, arg in zip(arg_kinds, args))
+    return f'{name}({args_str}) = {format_value(ret_kind, ret & ((1 << 64) - 1))}'
+
+
+def cycles_to_us(cycles, tsc_hz):
+    return cycles * 1000000 / tsc_hz
+
+
+def print_calls(pid, tsc_hz, syscalls, records):
+    if not records:
+        return
+    first = records[0][0]
+    for start, end, tid, sysno, ret, args in records:
+        call = format_call(syscalls, sysno, ret, args)
+        if tsc_hz:
+            print(f'{cycles_to_us(start - first, tsc_hz):14.3f} [{pid}:{tid}] {call} '
+                  f'<{cycles_to_us(end - start, tsc_hz):.3f} us>')
+        else:
+            print(f'{start - first:16} [{pid}:{tid}] {call} <{end - start} cycles>')
+
+
+def print_summary(tsc_hz, syscalls, records):
+    totals = collections.defaultdict(lambda: [0, 0, 0])
+    for start, end, _, sysno, ret, _ in records:
+        total = totals[sysno]
+        total[0] += 1
+        total[1] += end - start
+        total[2] += -4096 < ret < 0
+
+    unit = 'us' if tsc_hz else 'cycles'
+    print(f'{"syscall":24} {"calls":>10} {"errors":>8} {"total_" + unit:>16} {"avg_" + unit:>12}')
+    for sysno, (calls, cycles, errors) in sorted(totals.items(), key=lambda item: -item[1][1]):
+        name = syscalls.get(sysno, (f'syscall_{sysno}',))[0]
+        total = cycles_to_us(cycles, tsc_hz) if tsc_hz else cycles
+        print(f'{name:24} {calls:10} {errors:8} {total:16.1f} {total / calls:12.1f}')
+
+
+def main(args=None):
+    args = argparser.parse_args(args)
+
+    try:
+        pid, tsc_hz, syscalls, records = read_trace(args.trace)
+    except (TraceError, UnicodeDecodeError, ValueError) as e:
+        print(f'{argparser.prog}: {args.trace.name}: {e}', file=sys.stderr)
+        return 1
+
+    if args.tid:
+        records = [record for record in records if record[2] in args.tid]
+
+    if args.summary:
+        print_summary(tsc_hz, syscalls, records)
+    else:
+        print_calls(pid, tsc_hz, syscalls, records)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
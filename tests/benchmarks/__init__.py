@@ -27,8 +27,10 @@ def which(command):
         shell=True, check=True, stdout=subprocess.PIPE).stdout.strip().decode()
 
 class Exec:
-    def __init__(self, executable, manifest_template, **kwds):
+    def __init__(self, executable, manifest_template, name=None, **kwds):
         self.executable = pathlib.Path(executable)
+        # one executable can be run under several manifests, each under a different name
+        self.name = name or self.executable.name
         self.manifest_template = manifest_template
         self.template_vars = kwds
 
@@ -46,7 +48,7 @@ class Exec:
 
     @property
     def manifest_path(self):
-        return (self.benchmarks_path / self.executable.name).with_suffix('.manifest')
+        return (self.benchmarks_path / self.name).with_suffix('.manifest')
 
     @property
     def manifest_sgx_path(self):
@@ -54,16 +56,18 @@ class Exec:
 
     @property
     def executable_path(self):
-        return self.benchmarks_path / self.executable.name
+        return self.benchmarks_path / self.name
 
 
     def setup(self, *_args):
         self.benchmarks_path.mkdir(parents=True, exist_ok=True)
-        try:
-            self.executable_path.unlink()
-        except FileNotFoundError:
-            pass
-        self.executable_path.symlink_to(self.conf_path / self.executable)
+        # when run from the source tree (not by asv), the executable is already in place
+        if self.executable_path.resolve() != (self.conf_path / self.executable).resolve():
+            try:
+                self.executable_path.unlink()
+            except FileNotFoundError:
+                pass
+            self.executable_path.symlink_to(self.conf_path / self.executable)
 
         with open(self.conf_path / self.manifest_template) as file:
             template = MesonTemplate(file.read())
@@ -71,6 +75,7 @@ class Exec:
         with open(self.manifest_path, 'w') as file:
             file.write(template.substitute(
                 GRAPHENEDIR=os.environ['ASV_BUILD_DIR'],
+                BENCHMARKSDIR=os.fspath(self.benchmarks_path),
                 ARCH_LIBDIR='/lib/x86_64-linux-gnu',
                 **self.template_vars))
 
@@ -104,10 +109,14 @@ class Exec:
         return os.fspath(self.graphene_path / 'Runtime/pal_loader')
 
 
-    def run_in_graphene(self, *args, sgx=True):
+    def run_in_graphene(self, *args, sgx=True, **kwds):
         self._set_sgx(sgx)
         return subprocess.run([self.pal_loader, os.fspath(self.manifest_sgx_path), *args],
-            check=True, cwd=self.benchmarks_path)
+            check=True, cwd=self.benchmarks_path, **kwds)
+
+    def run_native(self, *args, **kwds):
+        return subprocess.run([os.fspath(self.executable_path), *args],
+            check=True, cwd=self.benchmarks_path, **kwds)
 
     @contextlib.contextmanager
     def graphene_server(self, *args, sgx=True, sleep=30):
@@ -0,0 +1,227 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/*
+ * File I/O benchmark for protected, trusted, allowed and tmpfs files. Usage:
+ *
+ *     fileio PATTERN PATH FILE_SIZE BLOCK_SIZE THREADS OPS
+ *
+ * Each of THREADS threads opens PATH on its own and does OPS operations of BLOCK_SIZE bytes.
+ * Patterns:
+ *   seq_read, seq_write    each thread goes sequentially over its own part of the file
+ *   rand_read, rand_write  random block-aligned offsets in the whole file
+ *   append                 writes at the end of the file (opened with O_APPEND)
+ *
+ * Unless the pattern is append, the file is first created with FILE_SIZE bytes if it is missing or
+ * has a different size (trusted files must already have the right size). Prints one line:
+ *
+ *     MB_PER_SEC IOPS P99_LATENCY_US
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+enum pattern { SEQ_READ, SEQ_WRITE, RAND_READ, RAND_WRITE, APPEND };
+
+static const char* g_pattern_names[] = {
+    [SEQ_READ] = "seq_read", [SEQ_WRITE] = "seq_write", [RAND_READ] = "rand_read",
+    [RAND_WRITE] = "rand_write", [APPEND] = "append",
+};
+
+static enum pattern g_pattern;
+static const char* g_path;
+static size_t g_file_size;
+static size_t g_block_size;
+static long g_threads;
+static long g_ops;
+
+struct thread_ctx {
+    pthread_t thread;
+    long idx;
+    uint64_t* latencies; /* nanoseconds, one per operation */
+};
+
+static void die(const char* msg) {
+    perror(msg);
+    exit(1);
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+        die("clock_gettime");
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static bool is_write(enum pattern pattern) {
+    return pattern == SEQ_WRITE || pattern == RAND_WRITE || pattern == APPEND;
+}
+
+static void prepare_file(void) {
+    struct stat st;
+    if (stat(g_path, &st) == 0 && (size_t)st.st_size == g_file_size)
+        return;
+
+    int fd = open(g_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        die("open (prepare)");
+
+    char* buf = malloc(g_block_size);
+    if (!buf)
+        die("malloc");
+    memset(buf, 0xa5, g_block_size);
+    for (size_t done = 0; done < g_file_size; ) {
+        size_t size = g_file_size - done < g_block_size ? g_file_size - done : g_block_size;
+        ssize_t ret = write(fd, buf, size);
+        if (ret < 0 && errno != EINTR)
+            die("write (prepare)");
+        if (ret > 0)
+            done += ret;
+    }
+    free(buf);
+    close(fd);
+}
+
+static void* thread_main(void* arg) {
+    struct thread_ctx* ctx = arg;
+
+    int flags = is_write(g_pattern) ? O_RDWR : O_RDONLY;
+    if (g_pattern == APPEND)
+        flags = O_WRONLY | O_CREAT | O_APPEND;
+    int fd = open(g_path, flags, 0644);
+    if (fd < 0)
+        die("open");
+
+    char* buf = malloc(g_block_size);
+    if (!buf)
+        die("malloc");
+    memset(buf, 0x5a, g_block_size);
+
+    size_t blocks = g_file_size / g_block_size;
+    size_t part_blocks = blocks / g_threads;
+    size_t part_start = ctx->idx * part_blocks;
+    unsigned int seed = ctx->idx + 1;
+
+    for (long i = 0; i < g_ops; i++) {
+        size_t block = 0;
+        if (g_pattern == SEQ_READ || g_pattern == SEQ_WRITE)
+            block = part_start + (part_blocks ? i % part_blocks : 0);
+        else if (g_pattern == RAND_READ || g_pattern == RAND_WRITE)
+            block = blocks ? (size_t)rand_r(&seed) % blocks : 0;
+        off_t offset = block * g_block_size;
+
+        uint64_t start = now_ns();
+        ssize_t ret;
+        if (g_pattern == APPEND) {
+            ret = write(fd, buf, g_block_size);
+        } else if (is_write(g_pattern)) {
+            ret = pwrite(fd, buf, g_block_size, offset);
+        } else {
+            ret = pread(fd, buf, g_block_size, offset);
+        }
+        ctx->latencies[i] = now_ns() - start;
+
+        if (ret < 0)
+            die(is_write(g_pattern) ? "write" : "read");
+        if ((size_t)ret != g_block_size) {
+            fprintf(stderr, "short %s at offset %ld\n", is_write(g_pattern) ? "write" : "read",
+                    (long)offset);
+            exit(1);
+        }
+    }
+
+    free(buf);
+    close(fd);
+    return NULL;
+}
+
+static int cmp_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static size_t parse_size(const char* str) {
+    char* end;
+    size_t size = strtoul(str, &end, 10);
+    switch (*end) {
+        case 'G': size *= 1024;
+        /* fallthrough */
+        case 'M': size *= 1024;
+        /* fallthrough */
+        case 'K': size *= 1024;
+    }
+    return size;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc != 7) {
+        fprintf(stderr, "usage: %s seq_read|seq_write|rand_read|rand_write|append PATH FILE_SIZE "
+                "BLOCK_SIZE THREADS OPS\n", argv[0]);
+        return 2;
+    }
+
+    size_t i;
+    for (i = 0; i < sizeof(g_pattern_names) / sizeof(g_pattern_names[0]); i++)
+        if (!strcmp(argv[1], g_pattern_names[i]))
+            break;
+    if (i == sizeof(g_pattern_names) / sizeof(g_pattern_names[0])) {
+        fprintf(stderr, "unknown pattern: %s\n", argv[1]);
+        return 2;
+    }
+    g_pattern    = i;
+    g_path       = argv[2];
+    g_file_size  = parse_size(argv[3]);
+    g_block_size = parse_size(argv[4]);
+    g_threads    = strtol(argv[5], NULL, 10);
+    g_ops        = strtol(argv[6], NULL, 10);
+    if (!g_block_size || g_threads < 1 || g_ops < 1
+            || (g_pattern != APPEND && g_file_size < g_block_size * g_threads)) {
+        fprintf(stderr, "invalid sizes\n");
+        return 2;
+    }
+
+    if (g_pattern == APPEND) {
+        if (unlink(g_path) < 0 && errno != ENOENT)
+            die("unlink");
+    } else {
+        prepare_file();
+    }
+
+    struct thread_ctx* ctxs = calloc(g_threads, sizeof(*ctxs));
+    uint64_t* latencies = malloc(g_threads * g_ops * sizeof(*latencies));
+    if (!ctxs || !latencies)
+        die("malloc");
+
+    uint64_t start = now_ns();
+    for (long t = 0; t < g_threads; t++) {
+        ctxs[t].idx = t;
+        ctxs[t].latencies = &latencies[t * g_ops];
+        if (pthread_create(&ctxs[t].thread, NULL, thread_main, &ctxs[t]) != 0)
+            die("pthread_create");
+    }
+    for (long t = 0; t < g_threads; t++)
+        pthread_join(ctxs[t].thread, NULL);
+    uint64_t elapsed = now_ns() - start;
+
+    size_t total_ops = g_threads * g_ops;
+    qsort(latencies, total_ops, sizeof(*latencies), cmp_u64);
+    uint64_t p99 = latencies[total_ops * 99 / 100];
+
+    double seconds = elapsed / 1e9;
+    printf("%.1f %.0f %.1f\n", total_ops * g_block_size / seconds / (1024 * 1024),
+           total_ops / seconds, p99 / 1e3);
+
+    free(latencies);
+    free(ctxs);
+    return 0;
+}
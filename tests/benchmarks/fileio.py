@@ -0,0 +1,141 @@
+# SPDX-License-Identifier: LGPL-3.0-or-later
+
+'''
+File I/O benchmarks
+-------------------
+
+Throughput, IOPS and 99th percentile latency of 4K reads and writes (see ``fileio.c``) on
+protected, trusted, allowed and tmpfs files, for several file sizes, access patterns and numbers of
+threads. Natively, ``tmpfs`` is ``/dev/shm`` and trusted files are plain files.
+``FileIOProtectedCache`` additionally sweeps ``sgx.protected_files_cache_size``.
+'''
+
+import os
+import shutil
+import subprocess
+
+from . import Exec
+
+KINDS = ['tmpfs', 'allowed', 'trusted', 'protected']
+PATTERNS = ['seq_read', 'rand_read', 'seq_write', 'rand_write', 'append']
+SIZES = ['1M', '64M']
+THREADS = [1, 4]
+PF_CACHE_SIZES = ['64K', '192K', '1M', '16M']
+
+BLOCK_SIZE = '4K'
+OPS = 4096 # per thread
+
+def _size_bytes(size):
+    return int(size[:-1]) * {'K': 1 << 10, 'M': 1 << 20, 'G': 1 << 30}[size[-1]]
+
+def _run(run, path, pattern, size, threads):
+    proc = run(pattern, path, size, BLOCK_SIZE, str(threads), str(OPS), stdout=subprocess.PIPE)
+    mbps, iops, p99_us = proc.stdout.decode().strip().split('\n')[-1].split()
+    return float(mbps), float(iops), float(p99_us)
+
+def _prepare_dirs(benchmarks_path):
+    for kind in ('trusted', 'allowed', 'protected'):
+        path = benchmarks_path / 'fileio-{}'.format(kind)
+        # protected files from an earlier run may have been written with a different cache size
+        # or be stale otherwise, Graphene creates them again on first use
+        shutil.rmtree(path, ignore_errors=True)
+        path.mkdir(parents=True)
+
+    # trusted files are hashed when signing the manifests, so they must exist first
+    for size in SIZES:
+        with open(benchmarks_path / 'fileio-trusted' / '{}.data'.format(size), 'wb') as file:
+            file.write(b'\xa5' * _size_bytes(size))
+
+class FileIO:
+    fileio = Exec('fileio', manifest_template='fileio.manifest.template', PF_CACHE_SIZE='192K')
+
+    params = (KINDS, PATTERNS, SIZES, THREADS)
+    param_names = ['kind', 'pattern', 'size', 'threads']
+    timeout = 600
+
+    def setup(self, *args):
+        self.fileio.benchmarks_path.mkdir(parents=True, exist_ok=True)
+        _prepare_dirs(self.fileio.benchmarks_path)
+        self.fileio.setup(*args)
+
+    def _path(self, kind, pattern, size, threads, native):
+        if kind == 'trusted':
+            if pattern not in ('seq_read', 'rand_read'):
+                raise NotImplementedError # trusted files are read-only
+            return os.fspath(self.fileio.benchmarks_path / 'fileio-trusted' /
+                '{}.data'.format(size))
+
+        name = '{}-{}-{}.data'.format(size, pattern, threads)
+        if kind == 'tmpfs':
+            return os.path.join('/dev/shm' if native else '/tmpfs', 'fileio-' + name)
+        if native:
+            if kind == 'protected':
+                raise NotImplementedError # not different from a plain file natively
+            kind = 'allowed'
+        return os.fspath(self.fileio.benchmarks_path / 'fileio-{}'.format(kind) / name)
+
+    def _native(self, kind, pattern, size, threads):
+        path = self._path(kind, pattern, size, threads, native=True)
+        try:
+            return _run(self.fileio.run_native, path, pattern, size, threads)
+        finally:
+            if path.startswith('/dev/shm/'):
+                os.unlink(path)
+
+    def _sgx(self, kind, pattern, size, threads):
+        path = self._path(kind, pattern, size, threads, native=False)
+        return _run(self.fileio.run_in_graphene, path, pattern, size, threads)
+
+    def track_native_mbps(self, *args):
+        return self._native(*args)[0]
+    track_native_mbps.unit = 'MB/s'
+
+    def track_native_iops(self, *args):
+        return self._native(*args)[1]
+    track_native_iops.unit = 'IOPS'
+
+    def track_native_p99(self, *args):
+        return self._native(*args)[2]
+    track_native_p99.unit = 'us'
+
+    def track_graphene_sgx_mbps(self, *args):
+        return self._sgx(*args)[0]
+    track_graphene_sgx_mbps.unit = 'MB/s'
+
+    def track_graphene_sgx_iops(self, *args):
+        return self._sgx(*args)[1]
+    track_graphene_sgx_iops.unit = 'IOPS'
+
+    def track_graphene_sgx_p99(self, *args):
+        return self._sgx(*args)[2]
+    track_graphene_sgx_p99.unit = 'us'
+
+class FileIOProtectedCache:
+    execs = {size: Exec('fileio', manifest_template='fileio.manifest.template',
+                        name='fileio-pf-{}'.format(size), PF_CACHE_SIZE=size)
+             for size in PF_CACHE_SIZES}
+
+    params = (PF_CACHE_SIZES, ['seq_read', 'rand_read', 'rand_write'])
+    param_names = ['cache_size', 'pattern']
+    timeout = 600
+
+    def setup(self, *args):
+        benchmarks_path = self.execs[PF_CACHE_SIZES[0]].benchmarks_path
+        benchmarks_path.mkdir(parents=True, exist_ok=True)
+        _prepare_dirs(benchmarks_path)
+        for fileio in self.execs.values():
+            fileio.setup(*args)
+
+    def _sgx(self, cache_size, pattern):
+        fileio = self.execs[cache_size]
+        path = os.fspath(fileio.benchmarks_path / 'fileio-protected' /
+            'cache-{}-{}.data'.format(cache_size, pattern))
+        return _run(fileio.run_in_graphene, path, pattern, '16M', 1)
+
+    def track_graphene_sgx_mbps(self, *args):
+        return self._sgx(*args)[0]
+    track_graphene_sgx_mbps.unit = 'MB/s'
+
+    def track_graphene_sgx_p99(self, *args):
+        return self._sgx(*args)[2]
+    track_graphene_sgx_p99.unit = 'us'
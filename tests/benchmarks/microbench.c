@@ -0,0 +1,423 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/*
+ * Micro-benchmarks of the primitives Graphene emulates. Usage:
+ *
+ *     microbench TEST ITERATIONS [ARG]
+ *
+ * Runs ITERATIONS operations of TEST (after a short warm-up) and prints the average time of one
+ * operation in nanoseconds. See `usage()` for the tests and what one operation is.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CHUNK_SIZE (64 * 1024)
+#define FILE_SIZE  4096
+#define MMAP_SIZE  (64 * 1024)
+
+static void usage(const char* argv0) {
+    fprintf(stderr,
+            "usage: %s TEST ITERATIONS [ARG]\n"
+            "tests (one operation is):\n"
+            "  getpid         getpid() syscall (emulated inside LibOS)\n"
+            "  sched_yield    sched_yield() syscall (goes to the host)\n"
+            "  clock_gettime  clock_gettime(CLOCK_MONOTONIC)\n"
+            "  futex          futex wake/wait round trip between two threads\n"
+            "  pipe           transfer of %d bytes through a pipe between two threads\n"
+            "  uds            transfer of %d bytes through a UNIX socket pair\n"
+            "  fork           fork() of a child that exits immediately, and waitpid()\n"
+            "  exec           fork() and execve() of this program doing nothing, and waitpid()\n"
+            "  open_stat      stat(), open() and close() of file ARG (created if missing)\n"
+            "  file_rw        pwrite() and pread() of %d bytes at offset 0 of file ARG\n"
+            "  mmap           mmap() of %d bytes of anonymous memory, touching it, and munmap()\n"
+            "  accept         connect() to a loopback TCP socket, accept() and close() of both\n"
+            "  epoll          epoll_wait() on ARG pipes of which one is readable\n",
+            argv0, CHUNK_SIZE, CHUNK_SIZE, FILE_SIZE, MMAP_SIZE);
+}
+
+static void die(const char* msg) {
+    perror(msg);
+    exit(1);
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+        die("clock_gettime");
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static long futex(atomic_int* uaddr, int op, int val) {
+    return syscall(SYS_futex, uaddr, op, val, NULL, NULL, 0);
+}
+
+/* getpid, sched_yield, clock_gettime */
+
+static void run_getpid(long iterations, const char* arg) {
+    for (long i = 0; i < iterations; i++)
+        syscall(SYS_getpid);
+}
+
+static void run_sched_yield(long iterations, const char* arg) {
+    for (long i = 0; i < iterations; i++)
+        sched_yield();
+}
+
+static void run_clock_gettime(long iterations, const char* arg) {
+    struct timespec ts;
+    for (long i = 0; i < iterations; i++)
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+}
+
+/* futex ping-pong: the main thread sets the word to 1, the peer sets it back to 0 */
+
+static atomic_int g_futex_word;
+static long g_peer_iterations;
+
+static void* futex_peer(void* arg) {
+    for (long i = 0; i < g_peer_iterations; i++) {
+        while (atomic_load(&g_futex_word) != 1)
+            futex(&g_futex_word, FUTEX_WAIT_PRIVATE, 0);
+        atomic_store(&g_futex_word, 0);
+        futex(&g_futex_word, FUTEX_WAKE_PRIVATE, 1);
+    }
+    return NULL;
+}
+
+static void run_futex(long iterations, const char* arg) {
+    pthread_t peer;
+    g_peer_iterations = iterations;
+    atomic_store(&g_futex_word, 0);
+    if (pthread_create(&peer, NULL, futex_peer, NULL) != 0)
+        die("pthread_create");
+
+    for (long i = 0; i < iterations; i++) {
+        atomic_store(&g_futex_word, 1);
+        futex(&g_futex_word, FUTEX_WAKE_PRIVATE, 1);
+        while (atomic_load(&g_futex_word) != 0)
+            futex(&g_futex_word, FUTEX_WAIT_PRIVATE, 1);
+    }
+    pthread_join(peer, NULL);
+}
+
+/* pipe and UNIX socket throughput: the peer thread writes, the main thread reads */
+
+static int g_write_fd;
+
+static void* writer_peer(void* arg) {
+    static char buf[CHUNK_SIZE];
+    memset(buf, 0xa5, sizeof(buf));
+    for (long i = 0; i < g_peer_iterations; i++) {
+        size_t done = 0;
+        while (done < sizeof(buf)) {
+            ssize_t ret = write(g_write_fd, buf + done, sizeof(buf) - done);
+            if (ret < 0 && errno != EINTR)
+                die("write");
+            if (ret > 0)
+                done += ret;
+        }
+    }
+    return NULL;
+}
+
+static void transfer(int read_fd, int write_fd, long iterations) {
+    static char buf[CHUNK_SIZE];
+    pthread_t peer;
+    g_peer_iterations = iterations;
+    g_write_fd = write_fd;
+    if (pthread_create(&peer, NULL, writer_peer, NULL) != 0)
+        die("pthread_create");
+
+    size_t left = (size_t)iterations * CHUNK_SIZE;
+    while (left) {
+        ssize_t ret = read(read_fd, buf, left < sizeof(buf) ? left : sizeof(buf));
+        if (ret < 0 && errno != EINTR)
+            die("read");
+        if (ret == 0) {
+            fprintf(stderr, "unexpected EOF\n");
+            exit(1);
+        }
+        if (ret > 0)
+            left -= ret;
+    }
+    pthread_join(peer, NULL);
+}
+
+static void run_pipe(long iterations, const char* arg) {
+    int fds[2];
+    if (pipe(fds) < 0)
+        die("pipe");
+    transfer(fds[0], fds[1], iterations);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+static void run_uds(long iterations, const char* arg) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+        die("socketpair");
+    transfer(fds[0], fds[1], iterations);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+/* fork and exec */
+
+static void wait_child(pid_t pid) {
+    int status;
+    if (waitpid(pid, &status, 0) < 0)
+        die("waitpid");
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "child failed\n");
+        exit(1);
+    }
+}
+
+static void run_fork(long iterations, const char* arg) {
+    for (long i = 0; i < iterations; i++) {
+        pid_t pid = fork();
+        if (pid < 0)
+            die("fork");
+        if (pid == 0)
+            _exit(0);
+        wait_child(pid);
+    }
+}
+
+static const char* g_argv0;
+
+static void run_exec(long iterations, const char* arg) {
+    for (long i = 0; i < iterations; i++) {
+        pid_t pid = fork();
+        if (pid < 0)
+            die("fork");
+        if (pid == 0) {
+            execl(g_argv0, g_argv0, "noop", "0", NULL);
+            _exit(1);
+        }
+        wait_child(pid);
+    }
+}
+
+static void run_noop(long iterations, const char* arg) {}
+
+/* open/stat of trusted, protected or plain files */
+
+static void prepare_file(const char* path) {
+    struct stat st;
+    if (stat(path, &st) == 0)
+        return;
+
+    char buf[FILE_SIZE];
+    memset(buf, 0xa5, sizeof(buf));
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        die("open");
+    if (write(fd, buf, sizeof(buf)) != sizeof(buf))
+        die("write");
+    close(fd);
+}
+
+static void run_open_stat(long iterations, const char* path) {
+    for (long i = 0; i < iterations; i++) {
+        struct stat st;
+        if (stat(path, &st) < 0)
+            die("stat");
+        int fd = open(path, O_RDONLY);
+        if (fd < 0)
+            die("open");
+        close(fd);
+    }
+}
+
+static int g_file_fd = -1;
+
+static void run_file_rw(long iterations, const char* path) {
+    char buf[FILE_SIZE];
+    memset(buf, 0xa5, sizeof(buf));
+    if (g_file_fd < 0) {
+        g_file_fd = open(path, O_RDWR);
+        if (g_file_fd < 0)
+            die("open");
+    }
+    for (long i = 0; i < iterations; i++) {
+        if (pwrite(g_file_fd, buf, sizeof(buf), 0) != sizeof(buf))
+            die("pwrite");
+        if (pread(g_file_fd, buf, sizeof(buf), 0) != sizeof(buf))
+            die("pread");
+    }
+}
+
+/* anonymous memory */
+
+static void run_mmap(long iterations, const char* arg) {
+    for (long i = 0; i < iterations; i++) {
+        char* addr = mmap(NULL, MMAP_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                          -1, 0);
+        if (addr == MAP_FAILED)
+            die("mmap");
+        for (size_t off = 0; off < MMAP_SIZE; off += 4096)
+            addr[off] = 1;
+        if (munmap(addr, MMAP_SIZE) < 0)
+            die("munmap");
+    }
+}
+
+/* TCP connection setup on the loopback interface */
+
+static int g_listen_fd = -1;
+static struct sockaddr_in g_listen_addr;
+
+static void prepare_accept(void) {
+    g_listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (g_listen_fd < 0)
+        die("socket");
+
+    g_listen_addr.sin_family      = AF_INET;
+    g_listen_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    g_listen_addr.sin_port        = 0;
+    if (bind(g_listen_fd, (struct sockaddr*)&g_listen_addr, sizeof(g_listen_addr)) < 0)
+        die("bind");
+    socklen_t addrlen = sizeof(g_listen_addr);
+    if (getsockname(g_listen_fd, (struct sockaddr*)&g_listen_addr, &addrlen) < 0)
+        die("getsockname");
+    if (listen(g_listen_fd, 16) < 0)
+        die("listen");
+}
+
+static void run_accept(long iterations, const char* arg) {
+    for (long i = 0; i < iterations; i++) {
+        int cli_fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (cli_fd < 0)
+            die("socket");
+        if (connect(cli_fd, (struct sockaddr*)&g_listen_addr, sizeof(g_listen_addr)) < 0)
+            die("connect");
+        int srv_fd = accept(g_listen_fd, NULL, NULL);
+        if (srv_fd < 0)
+            die("accept");
+        close(srv_fd);
+        close(cli_fd);
+    }
+}
+
+/* epoll scalability: one of ARG pipes is readable */
+
+static int g_epoll_fd = -1;
+
+static void prepare_epoll(const char* arg) {
+    long fds_cnt = arg ? strtol(arg, NULL, 10) : 1;
+    if (fds_cnt < 1) {
+        fprintf(stderr, "epoll needs at least one pipe\n");
+        exit(2);
+    }
+
+    g_epoll_fd = epoll_create1(0);
+    if (g_epoll_fd < 0)
+        die("epoll_create1");
+
+    for (long i = 0; i < fds_cnt; i++) {
+        int fds[2];
+        if (pipe(fds) < 0)
+            die("pipe");
+        struct epoll_event event = { .events = EPOLLIN, .data.fd = fds[0] };
+        if (epoll_ctl(g_epoll_fd, EPOLL_CTL_ADD, fds[0], &event) < 0)
+            die("epoll_ctl");
+        if (i == fds_cnt - 1 && write(fds[1], "x", 1) != 1)
+            die("write");
+    }
+}
+
+static void run_epoll(long iterations, const char* arg) {
+    struct epoll_event event;
+    for (long i = 0; i < iterations; i++) {
+        if (epoll_wait(g_epoll_fd, &event, 1, 0) != 1) {
+            fprintf(stderr, "epoll_wait did not report the readable pipe\n");
+            exit(1);
+        }
+    }
+}
+
+static const struct {
+    const char* name;
+    void (*run)(long iterations, const char* arg);
+} g_tests[] = {
+    { "getpid",        run_getpid },
+    { "sched_yield",   run_sched_yield },
+    { "clock_gettime", run_clock_gettime },
+    { "futex",         run_futex },
+    { "pipe",          run_pipe },
+    { "uds",           run_uds },
+    { "fork",          run_fork },
+    { "exec",          run_exec },
+    { "noop",          run_noop },
+    { "open_stat",     run_open_stat },
+    { "file_rw",       run_file_rw },
+    { "mmap",          run_mmap },
+    { "accept",        run_accept },
+    { "epoll",         run_epoll },
+};
+
+int main(int argc, char* argv[]) {
+    if (argc < 3 || argc > 4) {
+        usage(argv[0]);
+        return 2;
+    }
+    g_argv0 = argv[0];
+
+    const char* name = argv[1];
+    long iterations = strtol(argv[2], NULL, 10);
+    const char* arg = argc > 3 ? argv[3] : NULL;
+    if (iterations < 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    void (*run)(long iterations, const char* arg) = NULL;
+    for (size_t i = 0; i < sizeof(g_tests) / sizeof(g_tests[0]); i++)
+        if (!strcmp(g_tests[i].name, name))
+            run = g_tests[i].run;
+    bool needs_file = run == run_open_stat || run == run_file_rw;
+    if (!run || (needs_file && !arg)) {
+        usage(argv[0]);
+        return 2;
+    }
+    if (run == run_noop)
+        return 0;
+
+    if (needs_file)
+        prepare_file(arg);
+    if (run == run_accept)
+        prepare_accept();
+    if (run == run_epoll)
+        prepare_epoll(arg);
+
+    /* warm-up: fault in code and data, let Graphene allocate its internal state */
+    run(iterations / 10 + 1, arg);
+
+    uint64_t start = now_ns();
+    run(iterations, arg);
+    uint64_t end = now_ns();
+
+    printf("%.1f\n", iterations ? (double)(end - start) / iterations : 0.0);
+    return 0;
+}
@@ -0,0 +1,85 @@
+# SPDX-License-Identifier: LGPL-3.0-or-later
+
+'''
+Micro-benchmarks
+----------------
+
+Average latency of Graphene's own primitives (see ``microbench.c``), natively, in Graphene without
+SGX, in Graphene-SGX and in Graphene-SGX with exitless OCALLs (``sgx.rpc_thread_num``). The results
+are tracked by asv, so regressions show up as steps in ``asv publish`` graphs.
+'''
+
+import os
+import subprocess
+
+from . import Exec
+
+# test name -> (microbench test, iterations, argument)
+TESTS = {
+    'getpid':         ('getpid', 1000000, None),
+    'sched_yield':    ('sched_yield', 100000, None),
+    'clock_gettime':  ('clock_gettime', 1000000, None),
+    'futex':          ('futex', 10000, None),
+    'pipe_64K':       ('pipe', 10000, None),
+    'uds_64K':        ('uds', 10000, None),
+    'fork':           ('fork', 20, None),
+    'exec':           ('exec', 10, None),
+    'open_trusted':   ('open_stat', 10000, 'microbench-trusted.data'),
+    'open_protected': ('open_stat', 10000, 'microbench-protected.data'),
+    'open_allowed':   ('open_stat', 10000, 'microbench-allowed.data'),
+    'epoll_1':        ('epoll', 100000, '1'),
+    'epoll_1024':     ('epoll', 100000, '1024'),
+}
+
+def _parse(proc):
+    return float(proc.stdout.decode().strip().split('\n')[-1])
+
+class Microbench:
+    microbench = Exec('microbench', manifest_template='microbench.manifest.template',
+        RPC_THREAD_NUM='0', ENABLE_STATS='false')
+    microbench_exitless = Exec('microbench', manifest_template='microbench.manifest.template',
+        name='microbench-exitless', RPC_THREAD_NUM='2', ENABLE_STATS='false')
+
+    params = list(TESTS)
+    param_names = ['test']
+    unit = 'ns'
+    timeout = 600
+
+    def setup(self, *args):
+        benchmarks_path = self.microbench.benchmarks_path
+        benchmarks_path.mkdir(parents=True, exist_ok=True)
+        # trusted files are hashed when signing the manifests, so they must exist first
+        for name in ('microbench-trusted.data', 'microbench-allowed.data'):
+            with open(benchmarks_path / name, 'wb') as file:
+                file.write(b'\xa5' * 4096)
+        # protected files are created (encrypted) by Graphene on first use
+        try:
+            os.unlink(benchmarks_path / 'microbench-protected.data')
+        except FileNotFoundError:
+            pass
+
+        self.microbench.setup(*args)
+        self.microbench_exitless.setup(*args)
+
+    def _args(self, test):
+        name, iterations, arg = TESTS[test]
+        if arg and arg.endswith('.data'):
+            arg = os.fspath(self.microbench.benchmarks_path / arg)
+        return [name, str(iterations)] + ([arg] if arg else [])
+
+    def track_native(self, test):
+        if TESTS[test][2] == 'microbench-protected.data':
+            raise NotImplementedError # not different from a plain file natively
+        return _parse(self.microbench.run_native(*self._args(test), stdout=subprocess.PIPE))
+
+    def track_graphene_nosgx(self, test):
+        return _parse(self.microbench.run_in_graphene(*self._args(test), sgx=False,
+            stdout=subprocess.PIPE))
+
+    def track_graphene_sgx(self, test):
+        return _parse(self.microbench.run_in_graphene(*self._args(test), sgx=True,
+            stdout=subprocess.PIPE))
+
+    def track_graphene_sgx_exitless(self, test):
+        return _parse(self.microbench_exitless.run_in_graphene(*self._args(test), sgx=True,
+            stdout=subprocess.PIPE))
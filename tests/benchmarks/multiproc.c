@@ -0,0 +1,329 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/*
+ * Multi-process benchmark of IPC-heavy patterns. Usage:
+ *
+ *     multiproc TEST PROCESSES ITERATIONS [LOCK_FILE]
+ *
+ * Starts PROCESSES children, lets them all begin at once and prints the number of operations per
+ * second done by all of them together (process creation is not timed, except in `fork_wait`). See
+ * `usage()` for the tests and what one operation is.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+static void usage(const char* argv0) {
+    fprintf(stderr,
+            "usage: %s TEST PROCESSES ITERATIONS [LOCK_FILE]\n"
+            "tests (one operation is):\n"
+            "  fork_wait   fork() of a child that exits immediately; each of ITERATIONS rounds\n"
+            "              forks PROCESSES children at once and then reaps them (waitpid storm)\n"
+            "  pipe_pool   a task sent to a worker through a pipe and its result sent back; the\n"
+            "              parent hands out one task to every worker per round (process pool)\n"
+            "  posix_lock  fcntl() write lock and unlock of one byte of LOCK_FILE, which all\n"
+            "              children share (default: multiproc.lock, created if missing)\n"
+            "  signal      signal round trip between a child and the parent\n"
+            "  pid_lookup  kill(pid, 0) of another child (checks that the process exists)\n",
+            argv0);
+}
+
+static void die(const char* msg) {
+    perror(msg);
+    exit(1);
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+        die("clock_gettime");
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void read_exact(int fd, void* buf, size_t size) {
+    while (size) {
+        ssize_t ret = read(fd, buf, size);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            die("read");
+        buf = (char*)buf + ret;
+        size -= ret;
+    }
+}
+
+static void write_exact(int fd, const void* buf, size_t size) {
+    while (size) {
+        ssize_t ret = write(fd, buf, size);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            die("write");
+        buf = (const char*)buf + ret;
+        size -= ret;
+    }
+}
+
+static void wait_children(long cnt) {
+    for (long i = 0; i < cnt; i++) {
+        int status;
+        if (waitpid(-1, &status, 0) < 0)
+            die("waitpid");
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            fprintf(stderr, "child failed\n");
+            exit(1);
+        }
+    }
+}
+
+static long g_procs;
+static long g_iterations;
+static uint64_t g_start_ns; /* the clock starts when the timed part of the test begins */
+static const char* g_lock_file = "multiproc.lock";
+
+/* fork_wait */
+
+static long run_fork_wait(void) {
+    g_start_ns = now_ns();
+    for (long round = 0; round < g_iterations; round++) {
+        for (long i = 0; i < g_procs; i++) {
+            pid_t pid = fork();
+            if (pid < 0)
+                die("fork");
+            if (pid == 0)
+                _exit(0);
+        }
+        wait_children(g_procs);
+    }
+    return g_procs * g_iterations;
+}
+
+/*
+ * The other tests fork all children first. Each child then waits for a PID to be written to the
+ * shared start pipe, which the parent does for all children at once after starting the clock. The
+ * PID is that of another child (used by `pid_lookup` only).
+ */
+
+static pid_t* g_children;
+static int g_start_pipe[2];
+
+typedef void (*child_func_t)(long idx, pid_t peer);
+
+static void start_children(child_func_t func) {
+    g_children = calloc(g_procs, sizeof(*g_children));
+    if (!g_children)
+        die("calloc");
+    if (pipe(g_start_pipe) < 0)
+        die("pipe");
+
+    for (long i = 0; i < g_procs; i++) {
+        pid_t pid = fork();
+        if (pid < 0)
+            die("fork");
+        if (pid == 0) {
+            close(g_start_pipe[1]);
+            pid_t peer;
+            read_exact(g_start_pipe[0], &peer, sizeof(peer));
+            if (peer == getpid())
+                peer = getppid();
+            func(i, peer);
+            _exit(0);
+        }
+        g_children[i] = pid;
+    }
+    close(g_start_pipe[0]);
+}
+
+static void go(void) {
+    g_start_ns = now_ns();
+    for (long i = 0; i < g_procs; i++)
+        write_exact(g_start_pipe[1], &g_children[(i + 1) % g_procs], sizeof(pid_t));
+    close(g_start_pipe[1]);
+}
+
+/* pipe_pool */
+
+static int (*g_task_pipes)[2];
+static int (*g_result_pipes)[2];
+
+static void pool_worker(long idx, pid_t peer) {
+    for (long i = 0; i < g_iterations; i++) {
+        uint64_t task;
+        read_exact(g_task_pipes[idx][0], &task, sizeof(task));
+        task *= 2;
+        write_exact(g_result_pipes[idx][1], &task, sizeof(task));
+    }
+}
+
+static long run_pipe_pool(void) {
+    g_task_pipes = calloc(g_procs, sizeof(*g_task_pipes));
+    g_result_pipes = calloc(g_procs, sizeof(*g_result_pipes));
+    if (!g_task_pipes || !g_result_pipes)
+        die("calloc");
+    for (long i = 0; i < g_procs; i++)
+        if (pipe(g_task_pipes[i]) < 0 || pipe(g_result_pipes[i]) < 0)
+            die("pipe");
+
+    start_children(pool_worker);
+    go();
+
+    for (long round = 0; round < g_iterations; round++) {
+        for (long i = 0; i < g_procs; i++) {
+            uint64_t task = round;
+            write_exact(g_task_pipes[i][1], &task, sizeof(task));
+        }
+        for (long i = 0; i < g_procs; i++) {
+            uint64_t result;
+            read_exact(g_result_pipes[i][0], &result, sizeof(result));
+            if (result != (uint64_t)round * 2) {
+                fprintf(stderr, "wrong result from worker %ld\n", i);
+                exit(1);
+            }
+        }
+    }
+    wait_children(g_procs);
+    return g_procs * g_iterations;
+}
+
+/* posix_lock */
+
+static void lock_worker(long idx, pid_t peer) {
+    int fd = open(g_lock_file, O_RDWR);
+    if (fd < 0)
+        die("open");
+
+    for (long i = 0; i < g_iterations; i++) {
+        struct flock fl = { .l_type = F_WRLCK, .l_whence = SEEK_SET, .l_start = 0, .l_len = 1 };
+        if (fcntl(fd, F_SETLKW, &fl) < 0)
+            die("fcntl(F_SETLKW)");
+        fl.l_type = F_UNLCK;
+        if (fcntl(fd, F_SETLK, &fl) < 0)
+            die("fcntl(F_UNLCK)");
+    }
+    close(fd);
+}
+
+static long run_posix_lock(void) {
+    int fd = open(g_lock_file, O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+        die("open");
+    close(fd);
+
+    start_children(lock_worker);
+    go();
+    wait_children(g_procs);
+    return g_procs * g_iterations;
+}
+
+/* signal: real-time signals, because they are queued and concurrent requests are not merged */
+
+#define SIG_REQUEST  (SIGRTMIN)
+#define SIG_RESPONSE (SIGRTMIN + 1)
+
+static void signal_worker(long idx, pid_t peer) {
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIG_RESPONSE);
+
+    pid_t parent = getppid();
+    for (long i = 0; i < g_iterations; i++) {
+        if (kill(parent, SIG_REQUEST) < 0)
+            die("kill");
+        while (sigwaitinfo(&set, NULL) < 0)
+            if (errno != EINTR)
+                die("sigwaitinfo");
+    }
+}
+
+static long run_signal(void) {
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIG_REQUEST);
+    sigaddset(&set, SIG_RESPONSE);
+    /* blocked before fork(), so that the children inherit the mask and no signal is lost */
+    if (sigprocmask(SIG_BLOCK, &set, NULL) < 0)
+        die("sigprocmask");
+
+    start_children(signal_worker);
+    go();
+
+    sigemptyset(&set);
+    sigaddset(&set, SIG_REQUEST);
+    for (long i = 0; i < g_procs * g_iterations; i++) {
+        siginfo_t info;
+        while (sigwaitinfo(&set, &info) < 0)
+            if (errno != EINTR)
+                die("sigwaitinfo");
+        if (kill(info.si_pid, SIG_RESPONSE) < 0)
+            die("kill");
+    }
+    wait_children(g_procs);
+    return g_procs * g_iterations;
+}
+
+/* pid_lookup */
+
+static void pid_lookup_worker(long idx, pid_t peer) {
+    for (long i = 0; i < g_iterations; i++) {
+        if (kill(peer, 0) < 0)
+            die("kill");
+    }
+}
+
+static long run_pid_lookup(void) {
+    start_children(pid_lookup_worker);
+    go();
+    wait_children(g_procs);
+    return g_procs * g_iterations;
+}
+
+static const struct {
+    const char* name;
+    long (*run)(void);
+} g_tests[] = {
+    { "fork_wait",  run_fork_wait },
+    { "pipe_pool",  run_pipe_pool },
+    { "posix_lock", run_posix_lock },
+    { "signal",     run_signal },
+    { "pid_lookup", run_pid_lookup },
+};
+
+int main(int argc, char* argv[]) {
+    if (argc < 4 || argc > 5) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    g_procs = strtol(argv[2], NULL, 10);
+    g_iterations = strtol(argv[3], NULL, 10);
+    if (argc > 4)
+        g_lock_file = argv[4];
+    if (g_procs < 1 || g_iterations < 1) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    long (*run)(void) = NULL;
+    for (size_t i = 0; i < sizeof(g_tests) / sizeof(g_tests[0]); i++)
+        if (!strcmp(g_tests[i].name, argv[1]))
+            run = g_tests[i].run;
+    if (!run) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    long ops = run();
+    uint64_t end = now_ns();
+
+    printf("%.1f\n", ops / ((end - g_start_ns) / 1e9));
+    return 0;
+}
@@ -0,0 +1,58 @@
+# SPDX-License-Identifier: LGPL-3.0-or-later
+
+'''
+Multi-process benchmarks
+------------------------
+
+Throughput of fork-heavy and IPC-heavy patterns (see ``multiproc.c``) with 1 to 64 processes:
+waitpid storms, a process pool fed through pipes, POSIX locks, signals between processes and PID
+lookups. In Graphene, POSIX locks, signals to other processes and PID lookups go through the IPC
+leader (the first process), and each ``fork()`` sends a checkpoint to the child, so the results
+show how the leader and checkpointing scale with the number of processes.
+'''
+
+import os
+import subprocess
+
+from . import Exec
+
+# test -> iterations per process (rounds for fork_wait)
+TESTS = {
+    'fork_wait':  2,
+    'pipe_pool':  1000,
+    'posix_lock': 1000,
+    'signal':     1000,
+    'pid_lookup': 1000,
+}
+
+PROCESSES = [1, 2, 4, 8, 16, 32, 64]
+
+def _parse(proc):
+    return float(proc.stdout.decode().strip().split('\n')[-1])
+
+class MultiProcess:
+    multiproc = Exec('multiproc', manifest_template='multiproc.manifest.template')
+
+    params = (list(TESTS), PROCESSES)
+    param_names = ['test', 'processes']
+    unit = 'operations/s'
+    timeout = 1200
+
+    def setup(self, *args):
+        self.multiproc.setup(*args)
+
+    def _args(self, test, processes):
+        lock_file = os.fspath(self.multiproc.benchmarks_path / 'multiproc.lock')
+        return [test, str(processes), str(TESTS[test]), lock_file]
+
+    def track_native(self, test, processes):
+        return _parse(self.multiproc.run_native(*self._args(test, processes),
+            stdout=subprocess.PIPE))
+
+    def track_graphene_nosgx(self, test, processes):
+        return _parse(self.multiproc.run_in_graphene(*self._args(test, processes), sgx=False,
+            stdout=subprocess.PIPE))
+
+    def track_graphene_sgx(self, test, processes):
+        return _parse(self.multiproc.run_in_graphene(*self._args(test, processes), sgx=True,
+            stdout=subprocess.PIPE))
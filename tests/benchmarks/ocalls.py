@@ -0,0 +1,194 @@
+# SPDX-License-Identifier: LGPL-3.0-or-later
+
+'''
+OCALL budgets
+-------------
+
+Number of OCALLs (with an enclave exit or served by exitless RPC threads) per operation of the
+syscall corpus in ``microbench.c`` in Graphene-SGX, taken from the per-OCALL stats of
+``sgx.enable_stats``. Each test is run with two iteration counts and only the difference is
+counted, so OCALLs done at startup and exit cancel out.
+
+asv tracks the counts. ``make -C benchmarks check-ocall-budgets`` compares them with the budgets in
+``ocall_budgets.txt`` and fails if a test needs more OCALLs than budgeted, so that a change which
+adds an OCALL to a hot syscall is noticed right away. Each budget has a note with the OCALLs it is
+made of; a budget of ``-`` marks a test that cannot be measured reliably (its note says why), such
+tests are only reported. After an intended change, rewrite the budgets with ``python3 -m
+benchmarks.ocalls --update`` (with the same environment as in the Makefile); the notes are kept.
+'''
+
+import argparse
+import json
+import math
+import os
+import re
+import subprocess
+import sys
+
+from . import Exec
+
+# test name -> (microbench test, argument)
+TESTS = {
+    'getpid':        ('getpid', None),
+    'clock_gettime': ('clock_gettime', None),
+    'sched_yield':   ('sched_yield', None),
+    'futex':         ('futex', None),
+    'open_stat':     ('open_stat', 'microbench-allowed.data'),
+    'file_rw':       ('file_rw', 'microbench-allowed.data'),
+    'mmap':          ('mmap', None),
+    'accept':        ('accept', None),
+    'epoll_wait':    ('epoll', '1'),
+}
+
+ITERATIONS = (1000, 3000)
+
+# OCALLs per operation above the budget which are still accepted (timers, TSC recalibration and
+# helper threads of Graphene do some OCALLs of their own)
+TOLERANCE = 0.05
+
+BUDGETS_FILE = 'ocall_budgets.txt'
+
+# budget of a test which cannot be measured reliably
+UNMEASURED = '-'
+
+
+def _operations(iterations):
+    # microbench.c runs `iterations / 10 + 1` warm-up operations first
+    return iterations + iterations // 10 + 1
+
+def _ocall_names(graphene_path):
+    names = []
+    with open(graphene_path / 'Pal/src/host/Linux-SGX/ocall_types.h') as file:
+        for match in re.finditer(r'^\s+OCALL_(\w+)', file.read(), re.MULTILINE):
+            if match.group(1) == 'NR':
+                break
+            names.append(match.group(1).lower())
+    return names
+
+def _count_ocalls(proc, names):
+    counts = {}
+    for line in proc.stderr.decode(errors='replace').splitlines():
+        if '"ocall"' not in line:
+            continue
+        stats = json.loads(line[line.index('{'):])
+        name = names[stats['ocall']] if stats['ocall'] < len(names) else str(stats['ocall'])
+        counts[name] = counts.get(name, 0) + stats['count'] + stats['exitless_count']
+    return counts
+
+def measure(microbench, test):
+    '''Returns a dict of OCALL type -> OCALLs per operation of `test`.'''
+    name, arg = TESTS[test]
+    if arg and arg.endswith('.data'):
+        arg = os.fspath(microbench.benchmarks_path / arg)
+    names = _ocall_names(microbench.graphene_path)
+
+    counts = []
+    for iterations in ITERATIONS:
+        proc = microbench.run_in_graphene(name, str(iterations), *([arg] if arg else []),
+            sgx=True, stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+        counts.append(_count_ocalls(proc, names))
+
+    operations = _operations(ITERATIONS[1]) - _operations(ITERATIONS[0])
+    return {ocall: max(counts[1].get(ocall, 0) - counts[0].get(ocall, 0), 0) / operations
+        for ocall in set(counts[0]) | set(counts[1])}
+
+def _prepare(microbench, *args):
+    microbench.benchmarks_path.mkdir(parents=True, exist_ok=True)
+    # trusted files are hashed when signing the manifest, so they must exist first
+    for name in ('microbench-trusted.data', 'microbench-allowed.data'):
+        with open(microbench.benchmarks_path / name, 'wb') as file:
+            file.write(b'\xa5' * 4096)
+    microbench.setup(*args)
+
+def _stats_exec():
+    return Exec('microbench', manifest_template='microbench.manifest.template',
+        name='microbench-stats', RPC_THREAD_NUM='0', ENABLE_STATS='true')
+
+
+class OcallBudget:
+    microbench = _stats_exec()
+
+    params = list(TESTS)
+    param_names = ['test']
+    unit = 'OCALLs'
+    timeout = 600
+
+    def setup(self, *args):
+        _prepare(self.microbench, *args)
+
+    def track_ocalls_per_op(self, test):
+        return sum(measure(self.microbench, test).values())
+
+
+def read_budgets(path):
+    budgets = {}
+    with open(path) as file:
+        for line in file:
+            line = line.split('#', 1)[0].strip()
+            if line:
+                test, budget = line.split()
+                budgets[test] = None if budget == UNMEASURED else float(budget)
+    return budgets
+
+def write_budgets(path, budgets):
+    header = []
+    notes = {}
+    with open(path) as file:
+        for line in file:
+            if line.startswith('#'):
+                header.append(line)
+            elif '#' in line:
+                notes[line.split()[0]] = line[line.index('#'):].rstrip()
+    with open(path, 'w') as file:
+        file.writelines(header)
+        for test in TESTS:
+            budget = budgets.get(test)
+            budget = UNMEASURED if budget is None else '{:g}'.format(budget)
+            file.write('{:16}{:8}{}'.format(test, budget, notes.get(test, '')).rstrip() + '\n')
+
+def main(args=None):
+    argparser = argparse.ArgumentParser(
+        description='Compare OCALLs per syscall in Graphene-SGX with the checked-in budgets.')
+    argparser.add_argument('--update', action='store_true',
+        help='write the measured counts as the new budgets')
+    argparser.add_argument('tests', metavar='TEST', nargs='*',
+        help='only run these tests (one of: {})'.format(', '.join(TESTS)))
+    args = argparser.parse_args(args)
+    for test in args.tests:
+        if test not in TESTS:
+            argparser.error('unknown test: {}'.format(test))
+
+    microbench = _stats_exec()
+    _prepare(microbench)
+    budgets_path = microbench.conf_path / BUDGETS_FILE
+    budgets = read_budgets(budgets_path)
+
+    failed = False
+    for test in args.tests or TESTS:
+        per_type = measure(microbench, test)
+        total = sum(per_type.values())
+        breakdown = ', '.join('{} {:.2f}'.format(ocall, count)
+            for ocall, count in sorted(per_type.items()) if count >= 0.01)
+
+        if args.update:
+            budgets[test] = math.ceil(total * 100) / 100
+            status = 'updated'
+        elif test not in budgets:
+            status = 'NO BUDGET'
+            failed = True
+        elif budgets[test] is None:
+            status = 'not measured'
+        elif total > budgets[test] + TOLERANCE:
+            status = 'OVER BUDGET ({:g})'.format(budgets[test])
+            failed = True
+        else:
+            status = 'ok'
+        print('{:16}{:8.2f}  {:24}{}'.format(test, total, status, breakdown))
+
+    if args.update:
+        write_budgets(budgets_path, budgets)
+    return 1 if failed else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
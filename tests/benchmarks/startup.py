@@ -0,0 +1,114 @@
+# SPDX-License-Identifier: LGPL-3.0-or-later
+
+'''
+Startup benchmark
+-----------------
+
+Time from the start of ``pal-sgx`` to the first instruction of the application, split into phases
+using the startup trace (``sgx.startup_trace``), for a C hello world, Python and a JVM.
+
+This benchmark can be configured with the following environment variables:
+
+.. envvar:: STARTUP_PYTHON
+    Python interpreter to start. Default is ``/usr/bin/python3``.
+
+.. envvar:: STARTUP_JAVA
+    Java launcher to start. Default is ``java`` from ``PATH``.
+'''
+
+import os
+import pathlib
+import shutil
+import subprocess
+
+from . import Exec
+
+STARTUP_PYTHON = os.getenv('STARTUP_PYTHON', '/usr/bin/python3')
+STARTUP_JAVA = os.getenv('STARTUP_JAVA', shutil.which('java') or 'java')
+
+def _python_stdlib():
+    try:
+        return subprocess.run([STARTUP_PYTHON, '-c',
+            'import sysconfig; print(sysconfig.get_paths()["stdlib"])'],
+            check=True, stdout=subprocess.PIPE).stdout.decode().strip()
+    except (OSError, subprocess.CalledProcessError):
+        return None
+
+def _java_home():
+    java = shutil.which(STARTUP_JAVA)
+    # e.g. /usr/lib/jvm/java-11-openjdk-amd64/bin/java
+    return os.fspath(pathlib.Path(java).resolve().parent.parent) if java else None
+
+PYTHON_STDLIB = _python_stdlib()
+JAVA_HOME = _java_home()
+
+# app -> (Exec, arguments); None if the app is not installed
+APPS = {
+    'helloworld': (Exec('helloworld', manifest_template='startup-helloworld.manifest.template',
+                        name='startup-helloworld'), []),
+    'python': (Exec(STARTUP_PYTHON, manifest_template='startup-python.manifest.template',
+                    name='startup-python', PYTHON_STDLIB=PYTHON_STDLIB or ''),
+               ['-c', 'pass']) if PYTHON_STDLIB else None,
+    'java': (Exec(STARTUP_JAVA, manifest_template='startup-java.manifest.template',
+                  name='startup-java', JAVA_HOME=JAVA_HOME or ''),
+             ['-Xmx2G', '-version']) if JAVA_HOME else None,
+}
+
+# phase -> (first mark, last mark); the time between them, None means the start of pal-sgx
+PHASES = {
+    'total':         (None, 'LibOS: entering application'),
+    'host':          (None, 'host: enclave loaded'),
+    'eadd':          ('host: ECREATE', 'host: EADD/EEXTEND'),
+    'einit':         ('host: EADD/EEXTEND', 'host: EINIT'),
+    'pal':           ('host: enclave loaded', 'PAL: LibOS loaded'),
+    'trusted_files': ('PAL: enclave memory and manifest initialized',
+                      'PAL: trusted and allowed files initialized'),
+    'libos':         ('PAL: LibOS loaded', 'LibOS: entering application'),
+    'elf_loading':   ('LibOS: init_stack', 'LibOS: init_elf_objects'),
+}
+
+def _read_trace(path):
+    marks = {}
+    with open(path) as file:
+        for line in file:
+            if line.startswith('#'):
+                continue
+            usec, _, phase = line.rstrip('\n').split(None, 2)
+            marks[phase] = int(usec)
+    return marks
+
+class Startup:
+    params = (list(APPS), list(PHASES))
+    param_names = ['app', 'phase']
+    unit = 'ms'
+    timeout = 600
+
+    def setup(self, app, phase):
+        if APPS[app] is None:
+            raise NotImplementedError
+        APPS[app][0].setup()
+
+    def _traces(self, exe):
+        return exe.benchmarks_path.glob('startup.trace.*')
+
+    def track_graphene_sgx(self, app, phase):
+        exe, args = APPS[app]
+        for path in self._traces(exe):
+            path.unlink()
+
+        exe.run_in_graphene(*args, sgx=True, stdout=subprocess.DEVNULL,
+            stderr=subprocess.DEVNULL)
+
+        # child processes (if any) write their own traces, the first process never restores
+        # a checkpoint
+        for path in self._traces(exe):
+            marks = _read_trace(path)
+            if 'LibOS: receive_checkpoint_and_restore' not in marks:
+                break
+        else:
+            raise RuntimeError('no startup trace of the first process')
+
+        first, last = PHASES[phase]
+        if last not in marks or (first and first not in marks):
+            raise NotImplementedError # e.g. no such phase with EDMM
+        return (marks[last] - (marks[first] if first else 0)) / 1000